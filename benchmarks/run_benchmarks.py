@@ -0,0 +1,433 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2001-2009 Ichiro Fujinaga, Michael Droettboom,
+#                         Karl MacMillan, and Christoph Dalitz
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+#
+
+"""Microbenchmarks for the most frequently used Gamera plugins.
+
+Usage:
+
+   python run_benchmarks.py [options] [-o results.json]
+   python run_benchmarks.py --compare old.json new.json
+
+Every benchmark is run on a set of pages (deterministic synthetic pages
+at several resolutions and optionally real scans given with ``--page``)
+in DENSE and RLE storage where the plugin supports it. The results are
+written as JSON, and two result files can be compared to detect
+performance regressions. See README in this directory."""
+
+import sys, os, time, random, re, platform, tempfile, shutil
+from optparse import OptionParser
+try:
+   import json
+except ImportError:
+   json = None
+
+_here = os.path.dirname(os.path.abspath(__file__))
+_data = os.path.join(_here, "..", "tests", "data")
+
+# (name, ncols, nrows): a small page, an A4 page at 300 dpi and
+# the same page at 600 dpi
+_sizes = [("small", 800, 1000),
+          ("a4_300dpi", 2480, 3508),
+          ("a4_600dpi", 4960, 7016)]
+
+######################################################################
+# test pages
+
+def synthetic_page(ncols, nrows, seed=42):
+   """Returns a ONEBIT page with text-like content: lines of glyph-sized
+filled and hollow rectangles, some of them touching, and salt noise.
+The page only depends on its size and *seed*."""
+   from gamera.core import Image, Point, Dim, ONEBIT
+   rnd = random.Random(seed)
+   page = Image(Point(0, 0), Dim(ncols, nrows), ONEBIT)
+   # glyph metrics scale with the resolution (x-height ~ 1/150 of width)
+   xheight = max(4, ncols / 150)
+   margin = ncols / 12
+   y = margin
+   while y + 3 * xheight < nrows - margin:
+      x = margin
+      while x + 2 * xheight < ncols - margin:
+         w = rnd.randint(xheight / 2, xheight + xheight / 2)
+         h = rnd.choice((xheight, xheight, 2 * xheight))
+         ul = Point(x, y + 2 * xheight - h)
+         lr = Point(x + w - 1, y + 2 * xheight - 1)
+         if rnd.random() < 0.6:
+            page.draw_filled_rect(ul, lr, 1)
+         else:
+            page.draw_hollow_rect(ul, lr, 1)
+         x += w + rnd.randint(1, xheight / 3 + 1)
+         if rnd.random() < 0.15:
+            x += xheight
+      y += 3 * xheight
+   for i in xrange(ncols * nrows / 2000):
+      page.set((rnd.randint(0, ncols - 1), rnd.randint(0, nrows - 1)), 1)
+   return page
+
+def load_pages(sizes, extra_pages):
+   from gamera.core import load_image, ONEBIT
+   pages = []
+   for name, ncols, nrows in sizes:
+      pages.append(("synthetic_%s" % name, synthetic_page(ncols, nrows)))
+   for filename in extra_pages:
+      image = load_image(filename)
+      if image.data.pixel_type != ONEBIT:
+         image = image.to_greyscale().otsu_threshold()
+      pages.append((os.path.basename(filename), image))
+   return pages
+
+######################################################################
+# benchmarks
+#
+# Each benchmark is a function (page, storage, tmpdir) -> callable.
+# The setup in the function itself is not timed; only the returned
+# callable is. Returning None skips the benchmark for this input.
+
+def _bench_cc_analysis(page, storage, tmpdir):
+   def run():
+      page.image_copy().cc_analysis()
+   return run
+
+def _greyscale(page):
+   # smooth the edges a little so that the thresholds are not trivial
+   return page.to_greyscale().mean_filter(3)
+
+def _bench_otsu_threshold(page, storage, tmpdir):
+   if storage != "DENSE":
+      return None
+   grey = _greyscale(page)
+   return lambda: grey.otsu_threshold()
+
+def _bench_sauvola_threshold(page, storage, tmpdir):
+   if storage != "DENSE":
+      return None
+   grey = _greyscale(page)
+   return lambda: grey.sauvola_threshold()
+
+def _bench_erode(page, storage, tmpdir):
+   if storage != "DENSE":
+      return None
+   return lambda: page.erode()
+
+def _bench_dilate(page, storage, tmpdir):
+   if storage != "DENSE":
+      return None
+   return lambda: page.dilate()
+
+def _bench_thin_zs(page, storage, tmpdir):
+   return lambda: page.thin_zs()
+
+def _bench_thin_lc(page, storage, tmpdir):
+   return lambda: page.thin_lc()
+
+_featureset = ['area', 'aspect_ratio', 'black_area', 'moments',
+               'nholes_extended', 'volume64regions']
+
+def _bench_generate_features(page, storage, tmpdir):
+   ccs = page.image_copy().cc_analysis()
+   def run():
+      for cc in ccs:
+         cc.generate_features(_featureset, True)
+   return run
+
+def _training_glyphs(page):
+   # every component is labeled by a coarse size class, which is
+   # enough to exercise the classifier
+   ccs = page.image_copy().cc_analysis()
+   for cc in ccs:
+      cc.classify_manual("class.%d.%d" % (cc.nrows / 8, cc.ncols / 8))
+   return ccs
+
+def _bench_knn_classify(page, storage, tmpdir):
+   if storage != "DENSE":
+      return None
+   from gamera import knn
+   ccs = _training_glyphs(page)
+   classifier = knn.kNNNonInteractive(ccs, _featureset, 0)
+   unknown = page.image_copy().cc_analysis()
+   def run():
+      classifier.classify_list_automatic(unknown)
+   return run
+
+def _bench_knn_leave_one_out(page, storage, tmpdir):
+   if storage != "DENSE":
+      return None
+   from gamera import knn
+   classifier = knn.kNNNonInteractive(_training_glyphs(page), _featureset, 0)
+   return lambda: classifier.classifier.leave_one_out()
+
+def _bench_save_tiff(page, storage, tmpdir):
+   filename = os.path.join(tmpdir, "page.tiff")
+   return lambda: page.save_tiff(filename)
+
+def _bench_load_tiff(page, storage, tmpdir):
+   from gamera.core import load_image, DENSE, RLE
+   filename = os.path.join(tmpdir, "page.tiff")
+   page.save_tiff(filename)
+   storage = {"DENSE": DENSE, "RLE": RLE}[storage]
+   return lambda: load_image(filename, storage)
+
+def _bench_save_png(page, storage, tmpdir):
+   if storage != "DENSE":
+      return None
+   filename = os.path.join(tmpdir, "page.png")
+   return lambda: page.save_PNG(filename)
+
+def _bench_load_png(page, storage, tmpdir):
+   if storage != "DENSE":
+      return None
+   from gamera.core import load_image
+   filename = os.path.join(tmpdir, "page.png")
+   page.save_PNG(filename)
+   return lambda: load_image(filename)
+
+def _bench_xml_load(page, storage, tmpdir):
+   if storage != "DENSE":
+      return None
+   from gamera import gamera_xml
+   filename = os.path.join(tmpdir, "glyphs.xml")
+   gamera_xml.glyphs_to_xml(filename, _training_glyphs(page), False)
+   return lambda: gamera_xml.glyphs_from_xml(filename)
+
+benchmarks = [
+   ("cc_analysis", _bench_cc_analysis),
+   ("otsu_threshold", _bench_otsu_threshold),
+   ("sauvola_threshold", _bench_sauvola_threshold),
+   ("erode", _bench_erode),
+   ("dilate", _bench_dilate),
+   ("thin_zs", _bench_thin_zs),
+   ("thin_lc", _bench_thin_lc),
+   ("generate_features", _bench_generate_features),
+   ("knn_classify", _bench_knn_classify),
+   ("knn_leave_one_out", _bench_knn_leave_one_out),
+   ("save_tiff", _bench_save_tiff),
+   ("load_tiff", _bench_load_tiff),
+   ("save_png", _bench_save_png),
+   ("load_png", _bench_load_png),
+   ("xml_load", _bench_xml_load),
+   ]
+
+######################################################################
+# running and comparing
+
+def _median(values):
+   values = sorted(values)
+   n = len(values)
+   if n % 2:
+      return values[n / 2]
+   return (values[n / 2 - 1] + values[n / 2]) / 2.0
+
+def time_callable(func, repeat, min_time):
+   """Runs *func* once untimed, then *repeat* times (and at least
+*min_time* seconds in total). Returns the list of timings in seconds."""
+   func()
+   times = []
+   total = 0.0
+   while len(times) < repeat or total < min_time:
+      t = time.time()
+      func()
+      t = time.time() - t
+      times.append(t)
+      total += t
+      if len(times) >= 100 * repeat:
+         break
+   return times
+
+def run_benchmarks(pages, storages, pattern=None, repeat=5, min_time=0.0,
+                   verbose=True):
+   from gamera.core import RLE
+   selected = re.compile(pattern or ".")
+   results = []
+   tmpdir = tempfile.mkdtemp(prefix="gamera_bench")
+   try:
+      for page_name, dense_page in pages:
+         for storage in storages:
+            if storage == "RLE":
+               page = dense_page.image_copy(RLE)
+            else:
+               page = dense_page
+            for name, bench in benchmarks:
+               if not selected.search(name):
+                  continue
+               func = bench(page, storage, tmpdir)
+               if func is None:
+                  continue
+               times = time_callable(func, repeat, min_time)
+               result = {"name": name,
+                         "page": page_name,
+                         "storage": storage,
+                         "ncols": page.ncols,
+                         "nrows": page.nrows,
+                         "times": times,
+                         "min": min(times),
+                         "median": _median(times)}
+               results.append(result)
+               if verbose:
+                  print "%-20s %-24s %-6s %10.4f s %10.4f s" % \
+                        (name, page_name, storage, result["min"],
+                         result["median"])
+                  sys.stdout.flush()
+   finally:
+      shutil.rmtree(tmpdir, True)
+   return results
+
+def system_info():
+   from gamera.__version__ import ver
+   info = {"gamera_version": ver,
+           "python": platform.python_version(),
+           "platform": platform.platform(),
+           "machine": platform.machine(),
+           "processor": platform.processor(),
+           "date": time.strftime("%Y-%m-%d %H:%M:%S")}
+   try:
+      from gamera.__compiletime_config__ import has_openmp
+      info["openmp"] = bool(has_openmp)
+   except ImportError:
+      pass
+   return info
+
+def compare(old, new, threshold):
+   """Prints the relative change of the median timings between the
+result dictionaries *old* and *new* and returns the list of benchmarks
+that got slower by more than the fraction *threshold*."""
+   def key(r):
+      return (r["name"], r["page"], r["storage"])
+   old_results = dict([(key(r), r) for r in old["results"]])
+   regressions = []
+   print "%-20s %-24s %-6s %10s %10s %8s" % \
+         ("benchmark", "page", "storage", "old", "new", "change")
+   for r in new["results"]:
+      k = key(r)
+      if not old_results.has_key(k):
+         continue
+      before = old_results[k]["median"]
+      after = r["median"]
+      if before > 0:
+         change = (after - before) / before
+      else:
+         change = 0.0
+      mark = ""
+      if change > threshold:
+         mark = "  SLOWER"
+         regressions.append(k)
+      elif change < -threshold:
+         mark = "  faster"
+      print "%-20s %-24s %-6s %10.4f %10.4f %+7.1f%%%s" % \
+            (k + (before, after, change * 100.0, mark))
+   return regressions
+
+def _load_json(filename):
+   fd = open(filename, "r")
+   try:
+      return json.load(fd)
+   finally:
+      fd.close()
+
+def main(argv):
+   parser = OptionParser(usage="%prog [options]\n"
+                         "       %prog --compare OLD.json NEW.json")
+   parser.add_option("-o", "--output", dest="output", default=None,
+                     help="write the results as JSON to FILE",
+                     metavar="FILE")
+   parser.add_option("-b", "--benchmarks", dest="pattern", default=None,
+                     help="only run benchmarks whose name matches REGEX",
+                     metavar="REGEX")
+   parser.add_option("-s", "--sizes", dest="sizes",
+                     default="small,a4_300dpi",
+                     help="comma separated synthetic page sizes out of %s"
+                     " (default: %%default)" %
+                     ",".join([s[0] for s in _sizes]))
+   parser.add_option("-p", "--page", dest="pages", action="append",
+                     default=[], metavar="FILE",
+                     help="additionally run on the image FILE "
+                     "(may be given several times)")
+   parser.add_option("--no-testline", dest="testline", action="store_false",
+                     default=True,
+                     help="do not include tests/data/testline.png")
+   parser.add_option("--storage", dest="storage", default="DENSE,RLE",
+                     help="storage formats to test (default: %default)")
+   parser.add_option("-r", "--repeat", dest="repeat", type="int", default=5,
+                     help="timed runs per benchmark (default: %default)")
+   parser.add_option("-t", "--min-time", dest="min_time", type="float",
+                     default=0.0,
+                     help="minimum total seconds per benchmark")
+   parser.add_option("-l", "--list", dest="list", action="store_true",
+                     default=False, help="list the benchmarks and exit")
+   parser.add_option("-c", "--compare", dest="compare", action="store_true",
+                     default=False,
+                     help="compare two result files instead of running")
+   parser.add_option("--threshold", dest="threshold", type="float",
+                     default=0.1,
+                     help="relative slowdown reported as regression by "
+                     "--compare (default: %default)")
+   (options, args) = parser.parse_args(argv)
+
+   if options.list:
+      for name, bench in benchmarks:
+         print name
+      return 0
+
+   if options.compare:
+      if len(args) != 2:
+         parser.error("--compare needs exactly two result files")
+      if json is None:
+         parser.error("--compare needs the json module (Python 2.6)")
+      regressions = compare(_load_json(args[0]), _load_json(args[1]),
+                            options.threshold)
+      if regressions:
+         print "%d benchmark(s) slower by more than %d%%" % \
+               (len(regressions), options.threshold * 100)
+         return 1
+      return 0
+
+   if options.output and json is None:
+      parser.error("--output needs the json module (Python 2.6)")
+   sizes = []
+   for name in options.sizes.split(","):
+      name = name.strip()
+      if not name:
+         continue
+      size = [s for s in _sizes if s[0] == name]
+      if not size:
+         parser.error("unknown page size '%s'" % name)
+      sizes.append(size[0])
+   storages = [s.strip().upper() for s in options.storage.split(",")]
+   for s in storages:
+      if s not in ("DENSE", "RLE"):
+         parser.error("unknown storage format '%s'" % s)
+   pages = options.pages[:]
+   if options.testline:
+      pages.insert(0, os.path.join(_data, "testline.png"))
+
+   from gamera.core import init_gamera
+   init_gamera()
+   results = run_benchmarks(load_pages(sizes, pages), storages,
+                            options.pattern, options.repeat,
+                            options.min_time)
+   if options.output:
+      fd = open(options.output, "w")
+      try:
+         json.dump({"system": system_info(), "results": results},
+                   fd, indent=1, sort_keys=True)
+      finally:
+         fd.close()
+   return 0
+
+if __name__ == "__main__":
+   sys.exit(main(sys.argv[1:]))
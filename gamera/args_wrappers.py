@@ -25,6 +25,53 @@ import re
 from enums import *
 import util
 
+# The C++ call of a plugin that releases the interpreter lock must not
+# touch any Python object, so the argument and return types that are
+# converted inside of the call are refused.
+def check_release_gil(function):
+   if function.progress_bar:
+      raise RuntimeError("The plugin '%s' can not release the GIL because it has a progress bar" % function.__name__)
+   types = list(function.args.list) + [function.return_type]
+   for arg in types:
+      if arg.__class__.__name__ in ("Class", "Pixel"):
+         raise RuntimeError("The plugin '%s' can not release the GIL because it takes or returns a %s" % (function.__name__, arg.__class__.__name__))
+
+# Whether a <name>_many wrapper, calling the plugin on each image of a
+# list, is generated for the plugin: it must take a single image, and
+# no argument that depends on the pixel type of that image.
+def many_supported(function):
+   if (function.pure_python or function.progress_bar or
+       function.self_type.__class__.__name__ != "ImageType"):
+      return False
+   for arg in function.args.list:
+      if arg.__class__.__name__ in ("ImageType", "ImageList", "Class", "Pixel"):
+         return False
+   return function.return_type.__class__.__name__ not in ("Class", "Pixel")
+
+# The C++ type in which a <name>_many wrapper keeps the results
+def many_result_type(function):
+   return_type = function.return_type
+   return getattr(return_type, 'return_type', return_type.c_type)
+
+# The call of the plugin on images[i] in a <name>_many wrapper
+def many_call(function):
+   output_args = [arg.symbol for arg in function.args.list]
+   if function.feature_function:
+      output_args.append("feature_buffer + i * %d" % function.return_type.length)
+      lhs = ""
+   elif function.return_type != None:
+      lhs = "results[i] = "
+   else:
+      lhs = ""
+   result = "switch (combinations[i]) {\n"
+   for choice, pixel_type in function.self_type._get_choices():
+      result += "case %s:\n" % choice.upper()
+      result += "%s%s(%s);\nbreak;\n" % (
+         lhs, function.__name__,
+         ", ".join(["*((%s*)images[i])" % choice] + output_args))
+   result += "}\n"
+   return result
+
 class Arg:
    arg_format = 'O'
    convert_from_PyObject = False
@@ -68,6 +115,8 @@ class Arg:
       if function.progress_bar:
          output_args.append('ProgressBar((char *)"%s")' % function.progress_bar);
       if function.feature_function:
+         if function.release_gil:
+            return "{\nReleaseGIL release_gil;\n%s(%s, feature_buffer);\n}\n" % (function.__name__, ", ".join(output_args))
          return "%s(%s, feature_buffer);" % (function.__name__, ", ".join(output_args))
       else:
          if function.return_type != None:
@@ -77,6 +126,8 @@ class Arg:
          rhs = "%s(%s)" % (function.__name__, ", ".join(output_args))
          if function.return_type.__class__.__name__ == "Pixel":
             rhs = "pixel_to_python(%s)" % rhs
+         if function.release_gil:
+            return "{\nReleaseGIL release_gil;\n%s%s;\n}\n" % (lhs, rhs)
          return "%s%s;\n" % (lhs, rhs)
 
    def call(self, function, args, output_args, limit_choices=None):
@@ -132,13 +183,17 @@ class ImageType(Arg):
    c_type = 'Image*'
    convert_from_PyObject = True
    multiple = True
+   dense_copied = ["OneBitRleImageView", "RleCc", "MlCc"]
 
    def from_python(self):
       return """if (!is_ImageObject(%(pysymbol)s)) {
           PyErr_SetString(PyExc_TypeError, "Argument '%(name)s' must be an image");
           return 0;
         }
+        if (!image_decode_pending(%(pysymbol)s))
+          return 0;
         %(symbol)s = ((Image*)((RectObject*)%(pysymbol)s)->m_x);
+        %(symbol)s->refresh();
         image_get_fv(%(pysymbol)s, &%(symbol)s->features, &%(symbol)s->features_len);
         """ % self
 
@@ -150,18 +205,32 @@ class ImageType(Arg):
          choices = self._get_choices_for_pixel_type(limit_choices)
       else:
          choices = self._get_choices()
+      # The image arguments other than self are rarely stored as RLE
+      # or multi-label Ccs.  Those are passed as a dense copy (see
+      # DenseOneBitCopy), so that the function is not instantiated for
+      # every combination of them.
+      if self.name != 'self' and isinstance(function.self_type, ImageType):
+         copied = [x for x in choices if x[0] in self.dense_copied]
+      else:
+         copied = []
       result = "switch(get_image_combination(%(pysymbol)s)) {\n" % self
       for choice, pixel_type in choices:
+         if (choice, pixel_type) in copied:
+            continue
          result += "case %s:\n" % choice.upper()
          new_output_args = output_args + ["*((%s*)%s)" % (choice, self.symbol)]
-         if len(args) == 0:
-            result += self._do_call(function, new_output_args)
-         else:
-            if limit_choices is None:
-               result += args[0].call(function, args[1:], new_output_args, pixel_type)
-            else:
-               result += args[0].call(function, args[1:], new_output_args, limit_choices)
+         result += self._call_next(function, args, new_output_args,
+                                   pixel_type, limit_choices)
          result += "break;\n"
+      if len(copied):
+         for choice, pixel_type in copied:
+            result += "case %s:\n" % choice.upper()
+         result += ("{\nDenseOneBitCopy %s_dense(%s, get_image_combination(%s));\n" %
+                    (self.symbol, self.symbol, self.pysymbol))
+         new_output_args = output_args + ["%s_dense.view()" % self.symbol]
+         result += self._call_next(function, args, new_output_args,
+                                   ONEBIT, limit_choices)
+         result += "}\nbreak;\n"
       result += "default:\n"
       acceptable_types = [util.get_pixel_type_name(y).upper() for x, y in choices]
       if len(acceptable_types) >= 2:
@@ -178,6 +247,13 @@ class ImageType(Arg):
       result += "}\n"
       return result
 
+   def _call_next(self, function, args, output_args, pixel_type, limit_choices):
+      if len(args) == 0:
+         return self._do_call(function, output_args)
+      if limit_choices is None:
+         return args[0].call(function, args[1:], output_args, pixel_type)
+      return args[0].call(function, args[1:], output_args, limit_choices)
+
    def _get_choices(self):
       result = []
       pixel_types = list(self.pixel_types[:])
@@ -188,7 +264,8 @@ class ImageType(Arg):
 
    def _get_choices_for_pixel_type(self, pixel_type):
       if pixel_type == ONEBIT:
-         result = ["OneBitImageView", "Cc", "OneBitRleImageView", "RleCc", "MlCc"]
+         result = ["OneBitImageView", "Cc", "OneBitRleImageView", "RleCc", "MlCc",
+                   "OneBitPackedImageView"]
       else:
          result = [util.get_pixel_type_name(pixel_type) + "ImageView"]
       return [(x, pixel_type) for x in result]
@@ -265,7 +342,12 @@ class ImageList(Arg):
               PyErr_SetString(PyExc_TypeError, type_error_%(name)s);
               return 0;
             }
+            if (!image_decode_pending(element)) {
+              Py_DECREF(%(pysymbol)s_seq);
+              return 0;
+            }
             %(symbol)s[i] = std::pair<Image*, int>((Image*)(((RectObject*)element)->m_x), get_image_combination(element));
+            %(symbol)s[i].first->refresh();
             image_get_fv(element, &%(symbol)s[i].first->features,
                          &%(symbol)s[i].first->features_len);
           }
@@ -0,0 +1,359 @@
+# -*- mode: python; indent-tabs-mode: nil; tab-width: 3 -*-
+# vim: set tabstop=3 shiftwidth=3 expandtab:
+#
+# Copyright (C) 2001-2009 Ichiro Fujinaga, Michael Droettboom,
+#                         Karl MacMillan, and Christoph Dalitz
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+"""Runs a page pipeline (loading, binarization, segmentation,
+classification, ...) over many image files on several processes, and
+saves its output images in the background."""
+
+import os
+import sys
+import traceback
+import cPickle
+import threading
+import Queue
+from gamera.core import load_image, DENSE
+
+def _default_processes():
+   try:
+      import multiprocessing
+      return multiprocessing.cpu_count()
+   except (ImportError, NotImplementedError):
+      # when no multiprocessing module is available (python < 2.6)
+      return 1
+
+def _decode(filename, data, compression):
+   # images read ahead are decoded from memory when the format allows it
+   ext = os.path.splitext(filename)[1][1:].lower()
+   if data is not None:
+      if ext == "png":
+         from gamera.plugins import png_support
+         return png_support.load_PNG_from_bytes.__call__(data, compression)
+      elif ext in ("tif", "tiff"):
+         from gamera.plugins import tiff_support
+         return tiff_support.load_tiff_from_bytes.__call__(data, compression)
+   return load_image(filename, compression)
+
+def _read_ahead(next_task, pages):
+   # reads the files of the next pages while the current one is processed
+   def read():
+      while True:
+         task = next_task()
+         if task is None:
+            break
+         index, filename = task
+         try:
+            fd = open(filename, "rb")
+            try:
+               data = fd.read()
+            finally:
+               fd.close()
+            pages.put((index, filename, data, None))
+         except Exception:
+            pages.put((index, filename, None, traceback.format_exc()))
+      pages.put(None)
+   reader = threading.Thread(target=read)
+   reader.setDaemon(True)
+   reader.start()
+   return reader
+
+def _run_page(pipeline, filename, data, compression, pickle=False):
+   try:
+      result = pipeline(_decode(filename, data, compression), filename)
+      if pickle:
+         result = cPickle.dumps(result, 2)
+      return result, None
+   except Exception:
+      return None, traceback.format_exc()
+
+def _worker(pipeline, tasks, results, prefetch, compression):
+   pages = Queue.Queue(prefetch)
+   _read_ahead(tasks.get, pages)
+   while True:
+      page = pages.get()
+      if page is None:
+         break
+      index, filename, data, error = page
+      if error is None:
+         result, error = _run_page(pipeline, filename, data, compression, True)
+      else:
+         result = None
+      results.put((index, result, error))
+
+def _process_pages_serial(filenames, pipeline, prefetch, compression):
+   todo = iter(enumerate(filenames))
+   def next_task():
+      try:
+         return todo.next()
+      except StopIteration:
+         return None
+   pages = Queue.Queue(prefetch)
+   _read_ahead(next_task, pages)
+   while True:
+      page = pages.get()
+      if page is None:
+         break
+      index, filename, data, error = page
+      if error is None:
+         result, error = _run_page(pipeline, filename, data, compression)
+      if error is not None:
+         raise RuntimeError("Processing '%s' failed:\n%s" % (filename, error))
+      yield filename, result
+
+def process_pages(filenames, pipeline, processes=None, prefetch=2,
+                  compression=DENSE):
+   """Calls *pipeline* (*image*, *filename*) on the image of each of
+the given files, and yields the (*filename*, *result*) pairs in the
+order of *filenames*.
+
+The pages are processed by *processes* worker processes (by default
+one per CPU).  Each of them reads the files of its next *prefetch*
+pages while it runs *pipeline* on the current one, and at most
+*processes* times (*prefetch* + 1) pages are in work or waiting to be
+yielded at any time, so that the memory used does not grow with the
+number of pages.
+
+The worker processes are forked from the calling process, so that the
+objects *pipeline* uses, such as a kNN classifier loaded before
+calling process_pages, are shared with them rather than copied or
+loaded again.  The result of *pipeline* is sent back to the calling
+process, and must therefore be picklable (a list of class names, an
+XML string, ..., but not an image).
+
+When *pipeline* raises an exception, the remaining pages are
+abandoned and a RuntimeError holding the traceback of the worker is
+raised.  On Windows, and when *processes* is 1, the pages are processed
+in the calling process, still reading the next pages ahead.
+
+Since each worker process is busy with a page of its own, OpenMP
+plugins should be limited to one thread (by setting OMP_NUM_THREADS to
+1) when *processes* is the number of CPUs."""
+   if processes is None:
+      processes = _default_processes()
+   prefetch = max(int(prefetch), 1)
+   if processes <= 1 or sys.platform == 'win32':
+      for x in _process_pages_serial(filenames, pipeline, prefetch, compression):
+         yield x
+      return
+
+   import multiprocessing
+   filenames = list(filenames)
+   tasks = multiprocessing.Queue()
+   results = multiprocessing.Queue()
+   workers = [multiprocessing.Process(
+                 target=_worker,
+                 args=(pipeline, tasks, results, prefetch, compression))
+              for i in range(processes)]
+   for worker in workers:
+      worker.daemon = True
+      worker.start()
+   try:
+      limit = processes * (prefetch + 1)
+      issued = 0
+      done = 0
+      finished = {}
+      while done < len(filenames):
+         while issued < len(filenames) and issued - done < limit:
+            tasks.put((issued, filenames[issued]))
+            issued += 1
+         try:
+            index, result, error = results.get(True, 1.0)
+         except Queue.Empty:
+            # a worker killed by a crash in a plugin never answers
+            for worker in workers:
+               if worker.exitcode not in (None, 0):
+                  raise RuntimeError("A worker process died (exit code %d)." %
+                                     worker.exitcode)
+            continue
+         if error is not None:
+            raise RuntimeError("Processing '%s' failed:\n%s" %
+                               (filenames[index], error))
+         finished[index] = result
+         while finished.has_key(done):
+            result = cPickle.loads(finished.pop(done))
+            yield filenames[done], result
+            done += 1
+      for worker in workers:
+         tasks.put(None)
+      for worker in workers:
+         worker.join()
+   finally:
+      for worker in workers:
+         if worker.is_alive():
+            worker.terminate()
+
+def _save(image, filename, options):
+   ext = os.path.splitext(filename)[1][1:].lower()
+   if ext == "png":
+      from gamera.plugins import png_support
+      function = png_support.save_PNG
+   elif ext in ("tif", "tiff"):
+      from gamera.plugins import tiff_support
+      function = tiff_support.save_tiff
+   else:
+      image.save_image(filename)
+      return
+   # the wrappers take all of the arguments, so the defaults are filled in
+   args = list(options)
+   for arg in function.args.list[len(args) + 1:]:
+      args.append(arg.default)
+   function.__call__(image, filename, *args)
+
+class SaveResult:
+   """The pending save of an image, returned by ImageWriter.save."""
+   def __init__(self, filename):
+      self.filename = filename
+      self.error = None
+      self._done = threading.Event()
+
+   def done(self):
+      """Returns ``True`` when the image has been saved (or saving it
+failed)."""
+      return self._done.isSet()
+
+   def wait(self):
+      """Waits until the image has been saved, and raises an IOError
+holding the traceback when saving it failed."""
+      self._done.wait()
+      if self.error is not None:
+         raise IOError("Saving '%s' failed:\n%s" % (self.filename, self.error))
+
+class ImageWriter:
+   """Saves images on background threads, so that encoding and writing
+the output images of a page overlaps with processing the next one.
+
+*threads*
+  The number of writer threads.
+
+*queue_size*
+  The number of images that may wait to be saved.  save blocks while
+  the queue is full, so that the images waiting do not pile up when
+  the pages are processed faster than they are written.
+
+PNG and TIFF files are encoded without holding the Python interpreter
+lock, so that the writer threads run in parallel with the processing;
+images in other formats are saved with save_image.  An ImageWriter
+can be used in a ``with`` statement, which calls close at its end::
+
+   with batch.ImageWriter() as writer:
+      for filename in filenames:
+         image = load_image(filename)
+         ...
+         writer.save(onebit, filename + ".bin.png", options=(1, 1))
+"""
+   def __init__(self, threads=1, queue_size=4):
+      self._queue = Queue.Queue(max(int(queue_size), 1))
+      self._lock = threading.Lock()
+      self._pending = []
+      self._threads = []
+      for i in range(max(int(threads), 1)):
+         thread = threading.Thread(target=self._write)
+         thread.setDaemon(True)
+         thread.start()
+         self._threads.append(thread)
+
+   def _write(self):
+      while True:
+         task = self._queue.get()
+         if task is None:
+            break
+         image, result, options, callback = task
+         try:
+            _save(image, result.filename, options)
+         except Exception:
+            result.error = traceback.format_exc()
+         del image
+         result._done.set()
+         if callback is not None:
+            try:
+               callback(result)
+            except Exception:
+               traceback.print_exc()
+
+   def save(self, image, filename, options=(), callback=None, copy=True):
+      """SaveResult **save** (Image *image*, String *filename*, tuple
+*options* = (), Function *callback* = ``None``, bool *copy* = ``True``)
+
+Queues *image* to be saved to *filename*, whose extension determines
+the file type, and returns a SaveResult, whose ``wait`` method waits
+until the image is saved.
+
+*options*
+  The arguments of save_PNG or save_tiff after the file name, such as
+  ``(1, 1)`` (compression level 1 and no filter) for fast PNG files or
+  ``(1,)`` for Group 4 compressed TIFF files.
+
+*callback*
+  Called with the SaveResult on the writer thread once the image is
+  saved (or saving it failed).
+
+*copy*
+  When ``True``, a copy of the image is saved, so that the image may
+  be changed right away.  The copy of a whole DENSE image shares its
+  pixels until either is changed, so that it costs no time unless the
+  image is changed while it is saved.  When ``False``, the image
+  itself is saved and must not be changed until it is."""
+      if not self._threads:
+         raise RuntimeError("The ImageWriter is closed.")
+      if copy:
+         image = image.image_copy()
+      result = SaveResult(filename)
+      self._lock.acquire()
+      try:
+         # the failed saves are kept for wait and close
+         self._pending = [x for x in self._pending
+                          if not x.done() or x.error is not None]
+         self._pending.append(result)
+      finally:
+         self._lock.release()
+      self._queue.put((image, result, tuple(options), callback))
+      return result
+
+   def wait(self):
+      """Waits until all queued images are saved, and raises an IOError
+for the first one that failed."""
+      self._lock.acquire()
+      try:
+         pending = self._pending
+         self._pending = []
+      finally:
+         self._lock.release()
+      for result in pending:
+         result._done.wait()
+      for result in pending:
+         result.wait()
+
+   def close(self):
+      """Waits until all queued images are saved and stops the writer
+threads.  Raises an IOError for the first image that failed."""
+      if not self._threads:
+         return
+      for thread in self._threads:
+         self._queue.put(None)
+      for thread in self._threads:
+         thread.join()
+      self._threads = []
+      self.wait()
+
+   def __enter__(self):
+      return self
+
+   def __exit__(self, type, value, tb):
+      self.close()
@@ -17,13 +17,15 @@
 # Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 #
 
-import sys
+import sys, os, time, array
 from gamera import core  # grab all of the standard gamera modules
 from gamera import util
 from gamera import gamera_xml
 from gamera import graph
+from gamera import kdtree
 from gamera import image_utilities
 from gamera.plugins import structural
+from gamera.plugins import segmentation
 from fudge import Fudge
 from gamera.gui import has_gui
 from gamera.gameracore import CONFIDENCE_DEFAULT
@@ -38,6 +40,117 @@ class ClassifierError(Exception):
     pass
 
 
+class ClassifierStats:
+    """Collects the time spent in the stages of automatic classification
+and grouping, together with some counters.  Returned by
+``enable_stats`` of the classifiers.
+
+The stages are
+
+  ``features``: feature generation for the glyphs to classify,
+  ``classify``: distance search and confidence calculation,
+  ``splits``: splitting of glyphs classified as ``_split``,
+  ``pregroup``: search for neighboring glyphs that might be grouped,
+  ``grouping``: evaluation of the group candidates.
+
+The counters are ``glyphs`` (glyphs classified), ``distances``
+(distances to training glyphs computed), ``group_candidates``
+(calls of the grouping evaluate function), ``groups`` (unions found),
+``splits`` (glyphs created by splitting) and ``group_cache_hits``
+(group candidates whose classification was found in the group cache
+of a noninteractive classifier).
+
+When *trace* is ``True``, each stage is additionally recorded as an
+event that can be saved with ``write_trace`` and viewed in any viewer
+for the Chrome trace event format."""
+    def __init__(self, trace=False):
+        self.trace = trace
+        self.reset()
+
+    def reset(self):
+        """Sets all timings and counters to zero and drops the trace."""
+        self.times = {}
+        self.calls = {}
+        self.counters = {}
+        self.events = []
+
+    def start(self, stage):
+        return time.time()
+
+    def stop(self, stage, start):
+        now = time.time()
+        self.times[stage] = self.times.get(stage, 0.0) + (now - start)
+        self.calls[stage] = self.calls.get(stage, 0) + 1
+        if self.trace:
+            self.events.append((stage, start, now - start))
+
+    def count(self, counter, n=1):
+        self.counters[counter] = self.counters.get(counter, 0) + n
+
+    def __str__(self):
+        lines = []
+        stages = self.times.keys()
+        stages.sort()
+        for stage in stages:
+            lines.append("%-18s %10.4f s  (%d calls)" %
+                         (stage, self.times[stage], self.calls[stage]))
+        counters = self.counters.keys()
+        counters.sort()
+        for counter in counters:
+            lines.append("%-18s %10d" % (counter, self.counters[counter]))
+        return "\n".join(lines)
+
+    def write_trace(self, filename):
+        """Writes the recorded stages as a JSON file in the Chrome trace
+event format (only available when the statistics were enabled with
+*trace* = ``True``)."""
+        if not self.trace:
+            raise ClassifierError("The statistics were not enabled with trace=True.")
+        pid = os.getpid()
+        events = []
+        for stage, start, duration in self.events:
+            events.append('{"name": "%s", "cat": "classify", "ph": "X", '
+                          '"ts": %d, "dur": %d, "pid": %d, "tid": 0}' %
+                          (stage, int(start * 1e6), int(duration * 1e6), pid))
+        if len(self.events):
+            end = self.events[-1][1] + self.events[-1][2]
+            for counter, value in self.counters.items():
+                events.append('{"name": "%s", "ph": "C", "ts": %d, '
+                              '"pid": %d, "args": {"%s": %d}}' %
+                              (counter, int(end * 1e6), pid, counter, value))
+        fd = open(filename, "w")
+        try:
+            fd.write('{"traceEvents": [\n%s\n]}\n' % ",\n".join(events))
+        finally:
+            fd.close()
+
+
+# The split functions that split_glyphs can do, with their
+# split_glyphs method and center
+_builtin_splits = {'splitx': (0, [0.5]),
+                   'splity': (1, [0.5]),
+                   'splitx_max': (2, [0.5]),
+                   'splitx_left': (0, [0.25]),
+                   'splitx_right': (0, [0.75]),
+                   'splity_top': (1, [0.25]),
+                   'splity_bottom': (1, [0.75])}
+
+
+class _NullStats:
+    # Used while no statistics are collected, so that the classification
+    # code needs no checks
+    def start(self, stage):
+        return 0.0
+
+    def stop(self, stage, start):
+        pass
+
+    def count(self, counter, n=1):
+        pass
+
+_null_stats = _NullStats()
+
+
 class _Classifier:
     """The base class for both the interactive and noninteractive classifier."""
 
@@ -63,6 +176,45 @@ class _Classifier:
     def __len__(self):
         return len(self._database)
 
+    ########################################
+    # STATISTICS
+    _stats = _null_stats
+
+    # noninteractive classifiers keep the classifications of the group
+    # candidates (see NonInteractiveClassifier)
+    _group_cache = None
+
+    def enable_stats(self, trace=False):
+        """ClassifierStats **enable_stats** (bool *trace* = ``False``)
+
+Starts collecting the time spent in the stages of automatic
+classification and grouping (feature generation, classification,
+splitting, pre-grouping and grouping) and counts the glyphs
+processed, the distances computed and the group candidates
+evaluated.  Returns the ClassifierStats object holding these values;
+print it for a summary.  When *trace* is ``True``, the individual
+stages are recorded too and can be saved with its ``write_trace``
+method as a Chrome trace JSON file.
+
+Collecting statistics has no measurable overhead, as only whole
+stages are timed."""
+        self._stats = ClassifierStats(trace)
+        return self._stats
+
+    def disable_stats(self):
+        """**disable_stats** ()
+
+Stops collecting statistics."""
+        self._stats = _null_stats
+
+    def get_stats(self):
+        """ClassifierStats **get_stats** ()
+
+Returns the current statistics, or ``None`` when they are not enabled."""
+        if self._stats is _null_stats:
+            return None
+        return self._stats
+
    ########################################
    # GROUPING
     def group_list_automatic(self, glyphs, grouping_function=None,
@@ -148,11 +300,21 @@ this automatically for you.
         glyphs = [x for x in glyphs if not x.get_main_id().startswith('split')]
         if grouping_function is None:
             grouping_function = BoundingBoxGroupingFunction(4)
+        stats = self._stats
+        start = stats.start("pregroup")
         G = self._pregroup(glyphs, grouping_function)
+        stats.stop("pregroup", start)
+        if self._group_cache is not None:
+            self._group_cache.check_state(self._group_cache_state())
         if evaluate_function is None:
             evaluate_function = self._evaluate_subgroup
+        if stats is not _null_stats:
+            evaluate_function = _CountingEvaluateFunction(evaluate_function, stats)
+        start = stats.start("grouping")
         found_unions = self._find_group_unions(
             G, evaluate_function, max_parts_per_group, max_graph_size, criterion)
+        stats.stop("grouping", start)
+        stats.count("groups", len(found_unions))
         return found_unions + splits, removed
 
     def group_and_update_list_automatic(self, glyphs, *args, **kwargs):
@@ -171,9 +333,17 @@ a list of glyphs that is already updated for splitting and grouping."""
         G.add_nodes(glyphs)
         progress = util.ProgressFactory("Pre-grouping glyphs...", len(glyphs))
         try:
+            if (isinstance(function, (BoundingBoxGroupingFunction,
+                                      ShapedGroupingFunction)) and
+                function._threshold >= 0):
+                # these only group glyphs with close bounding boxes, so
+                # that the other pairs need not be tested at all
+                neighbors = _bounding_box_neighbors(glyphs, function._threshold)
+            else:
+                neighbors = [range(i + 1, len(glyphs)) for i in range(len(glyphs))]
             for i in range(len(glyphs)):
                 gi = glyphs[i]
-                for j in range(i + 1, len(glyphs)):
+                for j in neighbors[i]:
                     gj = glyphs[j]
                     if function(gi, gj):
                         G.add_edge(gi, gj)
@@ -182,10 +352,38 @@ a list of glyphs that is already updated for splitting and grouping."""
             progress.kill()
         return G
 
+    def _guess_group(self, subgroup, with_union=False):
+        # Returns guess_glyph_automatic of the union of the glyphs of
+        # subgroup, and the union when with_union is True (else None).
+        # With a group cache, the union is only built and classified
+        # for new combinations of parts.
+        cache = self._group_cache
+        key = None
+        if cache is not None:
+            key = cache.key(subgroup)
+        if key is not None:
+            entry = cache.get(key)
+            if entry is not None:
+                self._stats.count("group_cache_hits")
+                feature_functions, features, guess = entry
+                union = None
+                if with_union:
+                    union = image_utilities.union_images(subgroup)
+                    union.feature_functions = feature_functions
+                    union.features = array.array('d', features)
+                return guess, union
+        union = image_utilities.union_images(subgroup)
+        guess = self.guess_glyph_automatic(union)
+        if key is not None:
+            cache.add(key, subgroup, (union.feature_functions,
+                                      array.array('d', union.features), guess))
+        if not with_union:
+            union = None
+        return guess, union
+
     def _evaluate_subgroup(self, subgroup):
         if len(subgroup) > 1:
-            union = image_utilities.union_images(subgroup)
-            classification, confidence = self.guess_glyph_automatic(union)
+            classification, confidence = self._guess_group(subgroup)[0]
             classification_name = classification[0][1]
             if (classification_name.startswith("_split") or
                 classification_name.startswith("skip")):
@@ -204,22 +402,30 @@ a list of glyphs that is already updated for splitting and grouping."""
         progress = util.ProgressFactory("Grouping glyphs...", G.nsubgraphs)
         try:
             found_unions = []
-            for root in G.get_subgraph_roots():
-                if G.size_of_subgraph(root) > max_graph_size:
-                    continue
-                best_grouping = G.optimize_partitions(
-                root, evaluate_function, max_parts_per_group, max_graph_size, criterion)
+            roots = [root for root in G.get_subgraph_roots()
+                     if G.size_of_subgraph(root) <= max_graph_size]
+            # the best groupings of the subgraphs are searched in
+            # parallel, a batch at a time
+            groupings = []
+            for i in range(0, len(roots), 64):
+                batch = roots[i:i + 64]
+                groupings.extend(G.optimize_all_partitions(
+                    batch, evaluate_function, max_parts_per_group,
+                    max_graph_size, criterion))
+                for root in batch:
+                    progress.step()
+            for best_grouping in groupings:
                 if not best_grouping is None:
                     for subgroup in best_grouping:
                         if len(subgroup) > 1:
-                            union = image_utilities.union_images(subgroup)
+                            guess, union = self._guess_group(subgroup, True)
                             found_unions.append(union)
-                            classification, confidence = self.guess_glyph_automatic(union)
+                            classification, confidence = guess
                             union.classify_heuristic(classification)
                             part_name = "_group._part." + classification[0][1]
                         for glyph in subgroup:
                             glyph.classify_heuristic(part_name)
-                progress.step()
+                        self._reclassified(subgroup)
         finally:
             progress.kill()
         return found_unions
@@ -280,18 +486,33 @@ page."""
                 if glyph.classification_state in (core.UNCLASSIFIED, core.AUTOMATIC):
                     for child in glyph.children_images:
                         removed[child] = None
+            stats = self._stats
+            todo = []
+            start = stats.start("features")
             for glyph in glyphs:
                 if not removed.has_key(glyph):
                     self.generate_features(glyph)
                 if (glyph.classification_state in
                    (core.UNCLASSIFIED, core.AUTOMATIC)):
-                    (id, conf) = self._classify_automatic_impl(glyph)
-                    glyph.classify_automatic(id)
-                    glyph.confidence = conf
-                    adds = self._do_splits(self, glyph)
-                    progress.add_length(len(adds))
-                    added.extend(adds)
+                    todo.append(glyph)
+                else:
+                    progress.step()
+            stats.stop("features", start)
+            start = stats.start("classify")
+            results = self._classify_list_automatic_impl(todo)
+            stats.stop("classify", start)
+            stats.count("glyphs", len(todo))
+            stats.count("distances", len(todo) * len(self.database))
+            start = stats.start("splits")
+            for glyph, (id, conf) in zip(todo, results):
+                glyph.classify_automatic(id)
+                glyph.confidence = conf
+            added = self._do_splits_list(todo)
+            progress.add_length(len(added))
+            for glyph in todo:
                 progress.step()
+            stats.stop("splits", start)
+            stats.count("splits", len(added))
             if len(added):
                 added_recurse, removed_recurse = self._classify_list_automatic(
                     added, max_recursion, recursion_level + 1, progress)
@@ -303,6 +524,16 @@ page."""
                 progress.kill()
         return added, removed.keys()
 
+    def _reclassified(self, glyphs):
+        # Called when the class of glyphs that may be training data has
+        # changed
+        pass
+
+    def _classify_list_automatic_impl(self, glyphs):
+        # Classifiers that can classify many glyphs at once more
+        # efficiently override this
+        return [self._classify_automatic_impl(glyph) for glyph in glyphs]
+
     def classify_list_automatic(self, glyphs, max_recursion=10, progress=None):
         """**classify_list_automatic** (ImageList *glyphs*, int *max_recursion* = 10)
 
@@ -377,6 +608,34 @@ a list of glyphs that is already updated based on splitting."""
     def _do_splits_null(self, glyph):
         return []
 
+    def _do_splits_list(self, glyphs):
+        # Splits all glyphs of a list.  The glyphs that use one of the
+        # built-in split functions are split together in parallel by
+        # split_glyphs.  The splits are returned in the order of glyphs.
+        if not self._perform_splits:
+            return []
+        splits = [[]] * len(glyphs)
+        batches = {}
+        for i, glyph in enumerate(glyphs):
+            id = glyph.get_main_id()
+            if id.startswith('_split.'):
+                name = id[7:]
+                if _builtin_splits.has_key(name):
+                    batches.setdefault(name, []).append(i)
+                else:
+                    splits[i] = self._do_splits(self, glyph)
+        for name, indices in batches.items():
+            method, center = _builtin_splits[name]
+            batch = [glyphs[i] for i in indices]
+            for i, glyph, parts in zip(indices, batch,
+                                       segmentation.split_glyphs(batch, method, center)):
+                glyph.children_images = parts
+                splits[i] = parts
+        added = []
+        for parts in splits:
+            added.extend(parts)
+        return added
+
    ########################################
    # XML
    # Note that unclassified glyphs in the XML file are ignored.
@@ -402,18 +661,20 @@ Saves the training data in XML format to the given filename."""
         return gamera_xml.WriteXMLFile(
             glyphs=glyphs).write_filename(filename, with_features)
 
-    def from_xml(self, stream):
-        """**from_xml** (stream *stream*)
+    def from_xml(self, stream, storage_format=core.DENSE):
+        """**from_xml** (stream *stream*, *storage_format* = ``DENSE``)
 
 Loads the training data from the given stream (which could be any object 
-supporting the file protocol, such as a file object or StringIO object.)"""
-        self._from_xml(gamera_xml.LoadXML().parse_stream(stream))
+supporting the file protocol, such as a file object or StringIO object.)
+With *storage_format* ``PACKED``, the glyphs are kept with one bit per
+pixel in one block of memory (see glyphs_from_xml)."""
+        self._from_xml(gamera_xml.LoadXML(storage_format=storage_format).parse_stream(stream))
 
-    def from_xml_filename(self, filename):
-        """**from_xml_filename** (FileOpen *filename*)
+    def from_xml_filename(self, filename, storage_format=core.DENSE):
+        """**from_xml_filename** (FileOpen *filename*, *storage_format* = ``DENSE``)
 
-Loads the training data from the given filename."""
-        stream = gamera_xml.LoadXML().parse_filename(filename)
+Loads the training data from the given filename (see from_xml)."""
+        stream = gamera_xml.LoadXML(storage_format=storage_format).parse_filename(filename)
         self._from_xml(stream)
 
     def _from_xml(self, xml):
@@ -421,19 +682,20 @@ Loads the training data from the given filename."""
                   if x.classification_state != core.UNCLASSIFIED]
         self.set_glyphs(database)
 
-    def merge_from_xml(self, stream):
-        """**merge_from_xml** (stream *stream*)
+    def merge_from_xml(self, stream, storage_format=core.DENSE):
+        """**merge_from_xml** (stream *stream*, *storage_format* = ``DENSE``)
 
 Loads the training data from the given stream (which could be a file
-handle or StringIO object) and adds it to the existing training data."""
-        self._merge_xml(gamera_xml.LoadXML().parse_stream(stream))
+handle or StringIO object) and adds it to the existing training data
+(see from_xml for *storage_format*)."""
+        self._merge_xml(gamera_xml.LoadXML(storage_format=storage_format).parse_stream(stream))
 
-    def merge_from_xml_filename(self, filename):
-        """**merge_from_xml_filename** (stream *stream*)
+    def merge_from_xml_filename(self, filename, storage_format=core.DENSE):
+        """**merge_from_xml_filename** (stream *stream*, *storage_format* = ``DENSE``)
 
 Loads the training data from the given filename and adds it to the
-existing training data."""
-        self._merge_xml(gamera_xml.LoadXML().parse_filename(filename))
+existing training data (see from_xml for *storage_format*)."""
+        self._merge_xml(gamera_xml.LoadXML(storage_format=storage_format).parse_filename(filename))
 
     def _merge_xml(self, xml):
         database = [x for x in xml.glyphs
@@ -461,7 +723,7 @@ class NonInteractiveClassifier(_Classifier):
 Creates a new classifier instance.
 
 *database*
-        Can come in two forms:
+        Can come in three forms:
 
            - When a list (or Python iterable) each element is a glyph to
              use as training data for the classifier
@@ -469,6 +731,10 @@ Creates a new classifier instance.
            - *For non-interactive classifiers only*, when *database* is a filename,
              the classifier will be "unserialized" from the given file.
 
+           - When ``None``, the classifier starts without training data,
+             which can then be given with instantiate_from_xml (kNN only)
+             or unserialize.
+
     Any images in the list that were manually classified (have
     classification_state == MANUAL) will be used as training data
     for the classifier.  Any UNCLASSIFIED or AUTOMATICALLY
@@ -497,10 +763,18 @@ Creates a new classifier instance.
 
 .. __: writing_plugins.html
 
+The classifications of the group candidates of group_list_automatic_
+are kept in a cache, so that grouping the same glyphs again (for
+instance with group_and_update_list_automatic_ after some of them were
+changed) only classifies the new combinations of parts (see
+invalidate_group_cache_).
         """
+        self._group_cache = _GroupCache()
         if type(database) == list:
             self._database = util.CallbackList(database)
             self.set_glyphs(database)
+        elif database is None:
+            self._database = util.CallbackList([])
         elif database[-4:] == ".xml":
             self._database = util.CallbackList(database)
             self.from_xml_filename(database)
@@ -547,6 +821,7 @@ expensive.
         self.database.clear()
         self.database.extend(glyphs)
         self.instantiate_from_images(self.database, self.normalize)
+        self._group_cache.clear()
 
     def merge_glyphs(self, glyphs):
         """**merge_glyphs** (ImageList *glyphs*)
@@ -558,6 +833,22 @@ expensive."""
         self.generate_features_on_glyphs(glyphs)
         self.database.extend(glyphs)
         self.instantiate_from_images(self.database, self.normalize)
+        self._group_cache.clear()
+
+    def remove_glyphs(self, glyphs):
+        """**remove_glyphs** (ImageList *glyphs*)
+
+Removes the given glyphs from the current set of training data.  Glyphs
+that are not in the training data are ignored.
+
+On some non-interactive classifiers, this operation can be quite
+expensive."""
+        remove = set([id(glyph) for glyph in glyphs])
+        keep = [glyph for glyph in self.database if id(glyph) not in remove]
+        self.database.clear()
+        self.database.extend(keep)
+        self.instantiate_from_images(self.database, self.normalize)
+        self._group_cache.clear()
 
     def clear_glyphs(self):
         """**clear_glyphs** ()
@@ -565,6 +856,7 @@ expensive."""
 Removes all training data from the classifier.
 """
         self.database.clear()
+        self._group_cache.clear()
 
     def load_settings(self, filename):
         """**load_settings** (FileOpen *filename*)
@@ -574,6 +866,37 @@ format of this file is entirely dependant on the concrete classifier
 type."""
         _Classifier.load_settings(self, filename)
         self.instantiate_from_images(self.database, self.normalize)
+        self._group_cache.clear()
+
+    ########################################
+    # GROUPING
+    def _group_cache_state(self):
+        # The settings the classification of a glyph depends on besides
+        # the training data (whose changes clear the cache): the cache
+        # is cleared when they have changed since the last grouping
+        return None
+
+    def clear_group_cache(self):
+        """**clear_group_cache** ()
+
+Drops all classifications of group candidates kept by
+group_list_automatic_.  This is done automatically when the training
+data or the settings of the classifier change."""
+        self._group_cache.clear()
+
+    def invalidate_group_cache(self, glyphs):
+        """**invalidate_group_cache** (ImageList *glyphs*)
+
+Drops the kept classifications of all group candidates with a part
+having the label of one of the given connected components on the
+same image.
+
+The group candidates are identified by the image, the labels and the
+bounding boxes of their parts, so that relabeled, split or merged
+connected components are regrouped anyway.  Only when the pixels of
+a connected component are changed in place must the cache be told
+with this method."""
+        self._group_cache.invalidate(glyphs)
 
    ########################################
    # AUTOMATIC CLASSIFICATION
@@ -682,15 +1005,27 @@ Creates a new classifier instance.
         for child in glyph.children_images:
             if child in self.database:
                 self.database.remove(child)
+        return self._classify_with_database(glyph)
+
+    def _classify_with_database(self, glyph):
+        # Classifiers that keep their own copy of the training data
+        # override this
         return self.classify_with_images(self.database, glyph)
 
     def guess_glyph_automatic(self, glyph):
         if len(self.database):
             self.generate_features(glyph)
-            return self.classify_with_images(self.database, glyph)
+            return self._classify_with_database(glyph)
         else:
             return ([(0.0, 'unknown')], {})
 
+    def _reclassified(self, glyphs):
+        # The database callbacks of the 'reclassify' alert get the
+        # training glyphs whose class has changed
+        glyphs = [glyph for glyph in glyphs if glyph in self.database]
+        if len(glyphs):
+            self.database.trigger_callback('reclassify', glyphs)
+
     ########################################
     # MANUAL CLASSIFICATION
     def classify_glyph_manual(self, glyph, id):
@@ -721,6 +1056,7 @@ end user definitively knows the identity of the glyph.
                 self.database.remove(child)
         glyph.classify_manual([(1.0, id)])
         self.generate_features(glyph)
+        self._reclassified([glyph])
         self.database.append(glyph)
         return self._do_splits(self, glyph), removed.keys()
 
@@ -754,6 +1090,7 @@ connnected components, such as the lower-case *i*.
                     if glyph.nrows > 2 and glyph.ncols > 2:
                         glyph.classify_heuristic('_group._part.' + sub)
                         self.generate_features(glyph)
+                self._reclassified(glyphs)
                 added, removed = self.classify_glyph_manual(union, sub)
                 added.append(union)
                 return added, removed
@@ -768,14 +1105,18 @@ connnected components, such as the lower-case *i*.
                 removed.add(child)
 
         new_glyphs = []
+        reclassified = []
         for glyph in glyphs:
             # Don't re-insert removed children glyphs
             if not glyph in removed:
                 if not glyph in self.database:
                     self.generate_features(glyph)
                     new_glyphs.append(glyph)
+                else:
+                    reclassified.append(glyph)
                 glyph.classify_manual([(1.0, id)])
                 added.extend(self._do_splits(self, glyph))
+        self._reclassified(reclassified)
         self.database.extend(new_glyphs)
         return added, list(removed)
 
@@ -847,6 +1188,72 @@ training usually takes place.
 # GROUPING UTILITIES
 
 
+class _GroupCache:
+    # The results of _guess_group (the feature functions and features
+    # of the union and its guess_glyph_automatic) for the group
+    # candidates of a noninteractive classifier.  The candidates are
+    # keyed by the sorted (page, label, bounding box) of their parts,
+    # where the page is the id of the ImageData of the connected
+    # components, which is kept alive so that the id is not reused.
+    max_entries = 100000
+
+    def __init__(self):
+        self.clear()
+        self._state = None
+
+    def clear(self):
+        self._entries = {}
+        self._pages = {}
+
+    def check_state(self, state):
+        if state != self._state:
+            self.clear()
+            self._state = state
+
+    def key(self, subgroup):
+        # None for glyphs that are not connected components
+        parts = []
+        for glyph in subgroup:
+            if not isinstance(glyph, core.Cc):
+                return None
+            parts.append((id(glyph.data), glyph.label, glyph.ul_x,
+                          glyph.ul_y, glyph.lr_x, glyph.lr_y))
+        parts.sort()
+        return tuple(parts)
+
+    def get(self, key):
+        return self._entries.get(key)
+
+    def add(self, key, subgroup, entry):
+        if len(self._entries) >= self.max_entries:
+            self.clear()
+        for glyph in subgroup:
+            data = glyph.data
+            self._pages[id(data)] = data
+        self._entries[key] = entry
+
+    def invalidate(self, glyphs):
+        labels = set([(id(glyph.data), glyph.label) for glyph in glyphs
+                      if isinstance(glyph, core.Cc)])
+        for key in self._entries.keys():
+            for part in key:
+                if part[:2] in labels:
+                    del self._entries[key]
+                    break
+
+
+class _CountingEvaluateFunction:
+    # Wraps the evaluate function of group_list_automatic to count
+    # the group candidates
+    def __init__(self, function, stats):
+        self.function = function
+        self.stats = stats
+
+    def __call__(self, subgroup):
+        self.stats.count("group_candidates")
+        return self.function(subgroup)
+
+
 class BasicGroupingFunction:
     def __init__(self, threshold):
         self._threshold = threshold
@@ -855,6 +1262,47 @@ class BasicGroupingFunction:
         return Fudge(a, self._threshold).intersects(b)
 
 
+def _bounding_box_neighbors(glyphs, threshold):
+    """Returns for each glyph the sorted indices of the following glyphs
+whose bounding box might intersect its own bounding box expanded by
+*threshold*.
+
+The candidates are found as close pairs of bounding box centers in a
+kd-tree with the maximum norm.  The few glyphs that are much larger than
+the others would make the search radius too large, so they are compared
+with all other glyphs directly."""
+    if len(glyphs) == 0:
+        return []
+    t = int(threshold + 0.5)
+    # doubled centers and extents, so that everything stays integral
+    cx = [g.ul_x + g.lr_x for g in glyphs]
+    cy = [g.ul_y + g.lr_y for g in glyphs]
+    wx = [g.ncols - 1 + t for g in glyphs]
+    wy = [g.nrows - 1 + t for g in glyphs]
+    sizes = [max(g.ncols, g.nrows) for g in glyphs]
+    limit = sorted(sizes)[(len(sizes) * 95) / 100]
+
+    neighbors = [[] for g in glyphs]
+    small = [i for i in range(len(glyphs)) if sizes[i] <= limit]
+    if len(small) > 1:
+        tree = kdtree.KdTree([kdtree.KdNode([cx[i], cy[i]], i) for i in small], 0)
+        for a, b in tree.pairs_within(2 * (limit - 1 + t)):
+            i, j = min(a.data, b.data), max(a.data, b.data)
+            neighbors[i].append(j)
+    for i in range(len(glyphs)):
+        if sizes[i] <= limit:
+            continue
+        for j in range(len(glyphs)):
+            if j == i or (j < i and sizes[j] > limit):
+                continue
+            if (abs(cx[i] - cx[j]) <= wx[i] + wx[j] and
+                abs(cy[i] - cy[j]) <= wy[i] + wy[j]):
+                neighbors[min(i, j)].append(max(i, j))
+    for n in neighbors:
+        n.sort()
+    return neighbors
+
+
 class ShapedGroupingFunction:
     def __init__(self, threshold):
         self._function = structural.shaped_grouping_function
@@ -81,17 +81,28 @@ def make_subtrees_stddev(graph, ratio, distance, relabel=1, lab="cluster."):
     return nodes
 
 
-def make_spanning_tree(glyphs, k=None):
+def make_spanning_tree(glyphs, k=None, num_neighbors=None):
+    """Returns the minimum spanning tree of the glyphs with the distances
+of the kNN object *k* as an undirected graph. When *num_neighbors* is
+given, the tree is built by *kNN.spanning_tree* instead of from the
+matrix of the distances between all pairs of glyphs, which needs
+O(*n*\ :sup:`2`) memory: with *num_neighbors* > 0, it is approximated
+from the nearest neighbors of each glyph, which is feasible for
+hundreds of thousands of glyphs."""
     if k is None:
         k = knn.kNNInteractive()
-    uniq_dists = k.distance_matrix(glyphs, 0)
+    if num_neighbors is None:
+        uniq_dists = k.distance_matrix(glyphs, 0)
+    else:
+        uniq_dists = k.spanning_tree(glyphs, num_neighbors, 0)
     g = graph.Undirected()
     g.create_minimum_spanning_tree(glyphs, uniq_dists)
     return g
 
 
-def cluster(glyphs, ratio=1.0, distance=2, label="cluster.", k=None, relabel=1):
-    g = make_spanning_tree(glyphs, k)
+def cluster(glyphs, ratio=1.0, distance=2, label="cluster.", k=None, relabel=1,
+            num_neighbors=None):
+    g = make_spanning_tree(glyphs, k, num_neighbors)
     return make_subtrees_stddev(g, ratio, distance, lab=label)
 
 
@@ -134,6 +145,53 @@ def do_tests(filename):
     gamera_xml.glyphs_to_xml(c, os.path.abspath(os.path.dirname(filename) + "cluster_3_0_" + os.path.basename(filename)))
 
 
+def cut_dendrogram(merges, num_clusters=None, max_distance=None):
+    """Returns the cluster number of each image clustered by
+*kNN.hierarchical_clustering* with the given *merges*. The clusters are
+numbered from 0 in the order of their first image.
+
+*num_clusters*
+  The number of clusters: the merges that would give fewer clusters
+  are not done.
+
+*max_distance*
+  Only the merges up to this distance are done (used when
+  *num_clusters* is None)."""
+    n = len(merges) + 1
+    if num_clusters is not None:
+        count = max(0, n - num_clusters)
+    elif max_distance is not None:
+        count = len([m for m in merges if m[2] <= max_distance])
+    else:
+        raise ValueError("either num_clusters or max_distance must be given")
+    # the later merges are done first, so that the cluster made by a
+    # merge is known when its parts are labeled
+    cluster = range(2 * n - 1)
+    for m in range(count - 1, -1, -1):
+        a, b = merges[m][0], merges[m][1]
+        cluster[a] = cluster[b] = cluster[n + m]
+    labels = []
+    numbers = {}
+    for i in range(n):
+        labels.append(numbers.setdefault(cluster[i], len(numbers)))
+    return labels
+
+
+def hierarchical_cluster(glyphs, num_clusters=None, max_distance=None,
+                         linkage="single", label="cluster.", k=None):
+    """Clusters the glyphs with *kNN.hierarchical_clustering* (with the
+kNN object *k*) and classifies each glyph automatically as *label*
+followed by the number of its cluster (see *cut_dendrogram* for the
+other arguments). Returns the glyphs."""
+    if k is None:
+        k = knn.kNNInteractive()
+    merges = k.hierarchical_clustering(glyphs, linkage, 0)
+    labels = cut_dendrogram(merges, num_clusters, max_distance)
+    for glyph, cluster in zip(glyphs, labels):
+        glyph.classify_automatic(label + str(cluster))
+    return glyphs
+
+
 def make_unique_names(glyphs):
     for i in range(len(glyphs)):
         glyphs[i].classify_automatic(glyphs[i].get_main_id() + str(i))
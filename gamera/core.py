@@ -39,7 +39,7 @@ Additionally this module contains the following functions:
 load_image - load an image from a file.
 image_info - get information about an image file.
 display_multi - display a list of images in a grid-like window.
-init_gamera - parse the gamera options and load all of the plugins.
+init_gamera - parse the gamera options and set up the plugins.
 """
 
 # Python standard library
@@ -57,7 +57,15 @@ except ImportError:
 from gameracore import ONEBIT, GREYSCALE, FLOAT, COMPLEX
 from gamera.enums import ALL
 # import the storage types
-from gameracore import DENSE, RLE
+from gameracore import DENSE, RLE, PACKED
+# import the memory budget
+from gameracore import memory_usage, set_memory_limit, spill_images, \
+     reset_memory_peak
+# import the buffer pool
+from gameracore import buffer_pool_usage, set_buffer_pool_limit, \
+     clear_buffer_pool
+# import the report of the vectorized kernels
+from gameracore import cpu_dispatch
 
 # import confidence types
 # from gameracore import CONFIDENCE_DEFAULT, CONFIDENCE_KNNFRACTION, CONFIDENCE_LINEARWEIGHT, CONFIDENCE_INVERSEWEIGHT, CONFIDENCE_NUN, CONFIDENCE_NNDISTANCE, CONFIDENCE_AVGDISTANCE
@@ -90,8 +98,8 @@ class SegmentationError(Exception):
 
 
 ######################################################################
-def load_image(filename, compression=DENSE):
-    """**load_image** (FileOpen *filename*, Choice *storage_format* = ``DENSE``)
+def load_image(filename, compression=DENSE, rect=None):
+    """**load_image** (FileOpen *filename*, Choice *storage_format* = ``DENSE``, Rect *rect* = None)
 
 Load an image from the given filename.  At present, TIFF and PNG files are
 supported.
@@ -99,9 +107,24 @@ supported.
 *storage_format*
   The type of `storage format`__ to use for the resulting image.
 
+*rect*
+  When given, only the part of the image within *rect* is returned, at
+  the offset of *rect*.  For TIFF files only the strips or tiles that
+  overlap *rect* are decoded, so cutting a small region out of a large
+  scan is fast and needs little memory.
+
 .. __: image_types.html#storage-formats"""
     methods = plugin.methods_flat_category("File")
-    methods = [y for x, y in methods if x.startswith("load") and x != "load_image"]
+    if rect is not None:
+        for x, method in methods:
+            if x.startswith("load") and x.endswith("_region"):
+                for ext in method.exts:
+                    if os.path.splitext(filename)[1][1:].lower() == ext.lower():
+                        return method.__call__(filename, rect, compression)
+        return load_image(filename, compression).subimage(rect)
+    # (the loaders of regions, pages and bytes take other arguments)
+    methods = [y for x, y in methods if x.startswith("load") and x != "load_image"
+               and not x.endswith(("_region", "_page", "_pages", "_bytes"))]
 
     if len(methods) == 0:
         raise RuntimeError("There don't seem to be any imported plugins that can load files.  Try running init_gamera(), or explicitly loading the plugins that support file loading, such as tiff_support and png_support.")
@@ -136,7 +159,8 @@ Saves an image to a file.  The file type is automatically
 determined from the extension.
 """
     methods = plugin.methods_flat_category("File")
-    methods = [y for x, y in methods if x.startswith("save") and x != "save_image"]
+    methods = [y for x, y in methods if x.startswith("save") and x != "save_image"
+               and not x.endswith("_bytes")]
 
     if len(methods) == 0:
         raise RuntimeError("There don't seem to be any imported plugins that can save files.  Try running init_gamera(), or explicitly loading the plugins that support file saving, such as tiff_support and png_support.")
@@ -144,13 +168,15 @@ determined from the extension.
     for method in methods:
         for ext in method.exts:
             if os.path.splitext(filename)[1][1:].lower() == ext.lower():
-                method.__call__(image, filename)
+                # the options after the file name take their defaults
+                options = [arg.default for arg in method.args.list[1:]]
+                method.__call__(image, filename, *options)
                 return None
 
     # For backward compatibility, fall back to tiff if
     # we can't automatically determine the filetype by
     # the extension
-    _tiff_support.save_tiff(image, filename)
+    _tiff_support.save_tiff(image, filename, 0)
 
 
 def nested_list_to_image(l, t=-1):
@@ -234,7 +260,8 @@ See `pixel types`_ for more information."""
     pixel_type_name = property(pixel_type_name, doc=pixel_type_name.__doc__)
 
     _storage_format_names = {DENSE:  "Dense",
-                             RLE:    "RLE"}
+                             RLE:    "RLE",
+                             PACKED: "Packed"}
 
     def storage_format_name(self):
         """String **storage_format_name** ()
@@ -248,15 +275,18 @@ See `storage formats`_ for more information."""
 
     storage_format_name = property(storage_format_name, doc=storage_format_name.__doc__)
 
-    def load_image(filename, compression=DENSE):
+    def load_image(filename, compression=DENSE, rect=None):
         """Load an image from the given filename.  At present, TIFF and PNG files are
 supported.
 
 *storage_format*
   The type of `storage format`__ to use for the resulting image.
 
+*rect*
+  When given, only the part of the image within *rect* is loaded.
+
 .. __: image_types.html#storage-formats"""
-        return load_image(filename, compression)
+        return load_image(filename, compression, rect)
 
     load_image = staticmethod(load_image)
 
@@ -714,7 +744,7 @@ def _init_gamera():
         verbose = config.get("verbosity_level")
     except:
         verbose = 0
-    paths.import_directory(paths.plugins, globals(), locals(), verbose)
+    plugin.import_plugins(paths.plugins, verbose)
     sys.path.append(".")
 
 if sys.platform == 'win32':
@@ -740,7 +770,7 @@ if __name__ == "__main__":
     init_gamera()
 
 __all__ = ("init_gamera UNCLASSIFIED AUTOMATIC HEURISTIC MANUAL "
-           "ONEBIT GREYSCALE GREY16 RGB FLOAT COMPLEX ALL DENSE RLE "
+           "ONEBIT GREYSCALE GREY16 RGB FLOAT COMPLEX ALL DENSE RLE PACKED "
            "CONFIDENCE_DEFAULT CONFIDENCE_KNNFRACTION "
            "CONFIDENCE_LINEARWEIGHT CONFIDENCE_INVERSEWEIGHT "
            "CONFIDENCE_NUN CONFIDENCE_NNDISTANCE CONFIDENCE_AVGDISTANCE "
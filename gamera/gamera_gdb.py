@@ -0,0 +1,639 @@
+# -*- mode: python; indent-tabs-mode: nil; tab-width: 3 -*-
+# vim: set tabstop=3 shiftwidth=3 expandtab:
+#
+# Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom,
+#                          and Karl MacMillan
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+"""Binary glyph databases.
+
+A glyph database (usually ``*.gdb``) holds the same data as a Gamera
+XML file -- the symbol table and the glyphs with their position,
+bitmap, classification and properties -- together with the feature
+vectors of the glyphs, in a binary form that is much smaller and
+faster to load.
+
+The glyphs are stored in chunks of up to *chunk_size* glyphs, each of
+which may be compressed with zlib.  An index of the chunks at the end
+of the file allows to read single glyphs (see GDBFile) without loading
+the whole database.  The layout of a file is::
+
+  magic, version            "GAMGDB\\r\\n", uint32
+  chunk 0 ... chunk n-1     (possibly compressed) chunks, see below
+  index                     see below
+  index offset, magic       uint64, "GAMGDB\\r\\n"
+
+All integers are little endian, and byte strings are stored as their
+uint32 length followed by their bytes.  A chunk holds the geometry
+(*ul_x*, *ul_y*, *ncols*, *nrows*), classification states, class id
+counts, class ids and confidences, scaling, feature flags and features
+of its glyphs as the byte strings of arrays (in the byte order of the
+index), then the properties of each glyph, and last their bitmaps
+packed with eight pixels per byte.  The features of all glyphs of a
+chunk form one contiguous matrix.  The index holds the byte order,
+compression, number of glyphs, chunk size and number of features, the
+symbols, the class names, the names and lengths of the feature
+functions, and the offset, length and number of glyphs of each chunk.
+
+The strings (symbols, class names and property names) and property
+values start with a type byte: 's' for a byte string, 'u' for a
+unicode string in UTF-8, 'i' for an int64, 'l' for a long in decimal,
+'f' for a double and 'b' for a bool byte.  The file holds no pickled
+or marshal'ed data, so that reading it cannot run code."""
+
+import array, os, os.path, struct, sys, zlib
+
+import core, util
+from util import ProgressFactory
+from gamera.symbol_table import SymbolTable
+from gamera.plugins import string_io
+
+GDB_FORMAT_VERSION = 1
+GDB_MAGIC = "GAMGDB\r\n"
+
+extensions = "Glyph databases (*.gdb)|*.gdb|All files|*"
+
+_compressions = ('none', 'zlib')
+
+# The property types that are stored as they are; others are stored
+# as strings, as in the Gamera XML format
+_saveable_types = (int, long, float, bool, str, unicode)
+
+class GDBError(Exception):
+   pass
+
+def _array(typecode, string, swap):
+   a = array.array(typecode)
+   a.fromstring(string)
+   if swap:
+      a.byteswap()
+   return a
+
+def _pack_bytes(out, string):
+   out.append(struct.pack("<I", len(string)))
+   out.append(string)
+
+def _pack_value(out, value):
+   # a string, or a property value of one of the _saveable_types
+   if type(value) is bool:
+      out.append("b" + struct.pack("<B", value))
+   elif type(value) is int:
+      out.append("i" + struct.pack("<q", value))
+   elif type(value) is long:
+      out.append("l")
+      _pack_bytes(out, str(value))
+   elif type(value) is float:
+      out.append("f" + struct.pack("<d", value))
+   elif type(value) is unicode:
+      out.append("u")
+      _pack_bytes(out, value.encode("utf-8"))
+   else:
+      out.append("s")
+      _pack_bytes(out, str(value))
+
+class _Corrupt(Exception):
+   pass
+
+class _Reader:
+   # reads the data written by _pack_bytes and _pack_value; any data
+   # that does not fit raises _Corrupt
+   def __init__(self, data):
+      self.data = data
+      self.pos = 0
+
+   def take(self, n):
+      if n < 0 or self.pos + n > len(self.data):
+         raise _Corrupt()
+      start = self.pos
+      self.pos += n
+      return self.data[start:self.pos]
+
+   def unpack(self, format):
+      return struct.unpack(format, self.take(struct.calcsize(format)))
+
+   def bytes(self):
+      return self.take(self.unpack("<I")[0])
+
+   def value(self):
+      tag = self.take(1)
+      if tag == "b":
+         return bool(self.unpack("<B")[0])
+      if tag == "i":
+         return int(self.unpack("<q")[0])
+      if tag == "f":
+         return self.unpack("<d")[0]
+      try:
+         if tag == "l":
+            return long(self.bytes())
+         if tag == "u":
+            return self.bytes().decode("utf-8")
+      except ValueError:
+         raise _Corrupt()
+      if tag == "s":
+         return self.bytes()
+      raise _Corrupt()
+
+   def string(self):
+      value = self.value()
+      if not isinstance(value, basestring):
+         raise _Corrupt()
+      return value
+
+   def end(self):
+      if self.pos != len(self.data):
+         raise _Corrupt()
+
+################################################################################
+# SAVING
+################################################################################
+
+class WriteGDB:
+   def __init__(self, glyphs=[], symbol_table=[], with_features=True,
+                compression='zlib', chunk_size=4096):
+      self.glyphs = glyphs
+      if (not (isinstance(symbol_table, SymbolTable) or
+               util.is_string_or_unicode_list(symbol_table))):
+         raise GDBError(
+            "symbol_table argument to WriteGDB must be of type SymbolTable or a list of strings.")
+      if compression not in _compressions:
+         raise GDBError(
+            "compression must be one of %s." % ", ".join(_compressions))
+      if chunk_size < 1:
+         raise GDBError("chunk_size must be positive.")
+      self.symbol_table = symbol_table
+      self.with_features = with_features
+      self.compression = compression
+      self.chunk_size = chunk_size
+
+   def write_filename(self, filename, with_features=None):
+      if not with_features is None:
+         self.with_features = with_features
+      if not os.path.exists(os.path.split(os.path.abspath(filename))[0]):
+         raise GDBError(
+            "Cannot create a file at '%s'." %
+            os.path.split(os.path.abspath(filename))[0])
+      fd = open(filename, 'wb')
+      try:
+         self.write_stream(fd)
+      finally:
+         fd.close()
+
+   def write_stream(self, stream):
+      glyphs = self.glyphs
+      if isinstance(glyphs, core.ImageBase):
+         glyphs = [glyphs]
+      if (not isinstance(self.symbol_table, SymbolTable) and
+          util.is_string_or_unicode_list(self.symbol_table)):
+         symbols = list(self.symbol_table)
+      else:
+         symbols = self.symbol_table.symbols.keys()
+      symbols.sort()
+
+      # all glyphs share the feature functions of the first glyph
+      # that has features
+      feature_functions = ([], 0)
+      if self.with_features:
+         for glyph in glyphs:
+            if len(glyph.feature_functions[0]):
+               feature_functions = glyph.feature_functions
+               break
+      self._feature_functions = feature_functions
+      self._classes = {}
+
+      stream.write(GDB_MAGIC + struct.pack("<I", GDB_FORMAT_VERSION))
+      offset = len(GDB_MAGIC) + 4
+      chunks = []
+      progress = ProgressFactory("Saving glyph database...",
+                                 len(glyphs) / self.chunk_size + 1)
+      try:
+         for start in xrange(0, len(glyphs), self.chunk_size):
+            count = min(self.chunk_size, len(glyphs) - start)
+            data = self._chunk(glyphs[start:start+count])
+            stream.write(data)
+            chunks.append((offset, len(data), count))
+            offset += len(data)
+            progress.step()
+      finally:
+         progress.kill()
+
+      classes = [None] * len(self._classes)
+      for name, i in self._classes.items():
+         classes[i] = name
+      index = [struct.pack("<BBQII", sys.byteorder == 'big',
+                           list(_compressions).index(self.compression),
+                           len(glyphs), self.chunk_size,
+                           feature_functions[1])]
+      for strings in (symbols, classes):
+         index.append(struct.pack("<I", len(strings)))
+         for string in strings:
+            _pack_value(index, string)
+      index.append(struct.pack("<I", len(feature_functions[0])))
+      for name, function in feature_functions[0]:
+         _pack_value(index, name)
+         index.append(struct.pack("<I", function.return_type.length))
+      index.append(struct.pack("<I", len(chunks)))
+      for chunk in chunks:
+         index.append(struct.pack("<QQI", *chunk))
+      stream.write("".join(index))
+      stream.write(struct.pack("<Q", offset) + GDB_MAGIC)
+
+   def _class_id(self, name):
+      if not self._classes.has_key(name):
+         self._classes[name] = len(self._classes)
+      return self._classes[name]
+
+   def _chunk(self, glyphs):
+      geometry = array.array('i')
+      states = array.array('B')
+      id_counts = array.array('I')
+      id_classes = array.array('I')
+      id_confidences = array.array('d')
+      scaling = array.array('d')
+      has_features = array.array('B')
+      features = array.array('d')
+      properties = []
+      feature_functions, num_features = self._feature_functions
+      zeros = array.array('d', [0.0] * num_features)
+      for glyph in glyphs:
+         geometry.extend((glyph.ul_x, glyph.ul_y, glyph.ncols, glyph.nrows))
+         states.append(glyph.classification_state)
+         id_counts.append(len(glyph.id_name))
+         for confidence, id in glyph.id_name:
+            id_classes.append(self._class_id(id))
+            id_confidences.append(confidence)
+         scaling.append(glyph.scaling)
+         if (num_features and glyph.feature_functions[0] == feature_functions and
+             len(glyph.features) == num_features):
+            has_features.append(1)
+            features.extend(glyph.features)
+         else:
+            has_features.append(0)
+            features.extend(zeros)
+         glyph_properties = {}
+         for key, val in glyph.properties.items():
+            if val is None:
+               continue
+            if type(val) not in _saveable_types:
+               val = str(val)
+            glyph_properties[key] = val
+         properties.append(glyph_properties)
+      data = []
+      for a in (geometry, states, id_counts, id_classes, id_confidences,
+                scaling, has_features, features):
+         _pack_bytes(data, a.tostring())
+      for glyph_properties in properties:
+         data.append(struct.pack("<I", len(glyph_properties)))
+         for key, val in glyph_properties.items():
+            _pack_value(data, key)
+            _pack_value(data, val)
+      _pack_bytes(data, string_io._glyphs_to_bits(glyphs))
+      data = "".join(data)
+      if self.compression == 'zlib':
+         data = zlib.compress(data)
+      return data
+
+################################################################################
+# LOADING
+################################################################################
+
+class GDBFile:
+   """Read access to a glyph database.
+
+The glyphs are read chunk by chunk when they are accessed, so that
+``GDBFile(filename)[i]`` only loads the chunk of glyph *i*.
+
+*symbol_table*
+  The symbol table as a SymbolTable.
+
+*feature_names*
+  The names and lengths of the feature functions of the features.
+
+*feature_functions*
+  The feature functions of the features, or ``None`` if some of them
+  are not known to this version of Gamera.
+"""
+   def __init__(self, filename):
+      try:
+         self._stream = open(filename, 'rb')
+      except IOError, e:
+         raise GDBError(str(e))
+      try:
+         self._read_index()
+      except:
+         self._stream.close()
+         raise
+      self._cache = (None, None)
+
+   def _read_index(self):
+      stream = self._stream
+      head = stream.read(len(GDB_MAGIC) + 4)
+      if len(head) != len(GDB_MAGIC) + 4 or head[:len(GDB_MAGIC)] != GDB_MAGIC:
+         raise GDBError("The file is not a Gamera glyph database.")
+      version = struct.unpack("<I", head[len(GDB_MAGIC):])[0]
+      if version > GDB_FORMAT_VERSION:
+         raise GDBError(
+            "The glyph database is of a newer version, which can not be read " +
+            "by this version of Gamera.")
+      stream.seek(0, 2)
+      end = stream.tell() - (8 + len(GDB_MAGIC))
+      if end < len(head):
+         raise GDBError("The glyph database is truncated.")
+      stream.seek(end)
+      tail = stream.read(8 + len(GDB_MAGIC))
+      if tail[8:] != GDB_MAGIC:
+         raise GDBError("The glyph database is truncated.")
+      offset = struct.unpack("<Q", tail[:8])[0]
+      if offset < len(head) or offset > end:
+         raise GDBError("The index of the glyph database is corrupt.")
+      stream.seek(offset)
+      reader = _Reader(stream.read(end - offset))
+      try:
+         (big_endian, compression, num_glyphs, chunk_size,
+          num_features) = reader.unpack("<BBQII")
+         index = {'byteorder': ('little', 'big')[big_endian != 0],
+                  'num_glyphs': num_glyphs,
+                  'chunk_size': chunk_size,
+                  'num_features': num_features}
+         for key in ('symbols', 'classes'):
+            index[key] = [reader.string()
+                          for i in xrange(reader.unpack("<I")[0])]
+         index['features'] = [(reader.string(), reader.unpack("<I")[0])
+                              for i in xrange(reader.unpack("<I")[0])]
+         index['chunks'] = [reader.unpack("<QQI")
+                            for i in xrange(reader.unpack("<I")[0])]
+         # the chunks lie between the header and the index, and all
+         # but the last are full
+         chunks = index['chunks']
+         if (chunk_size < 1 or
+             len(chunks) != (num_glyphs + chunk_size - 1) / chunk_size):
+            raise _Corrupt()
+         for i in xrange(len(chunks)):
+            chunk_offset, length, count = chunks[i]
+            if (chunk_offset < len(head) or chunk_offset + length > offset or
+                count != min(chunk_size, num_glyphs - i * chunk_size)):
+               raise _Corrupt()
+         reader.end()
+      except _Corrupt:
+         raise GDBError("The index of the glyph database is corrupt.")
+      if compression >= len(_compressions):
+         raise GDBError(
+            "Unknown compression %d in the glyph database." % compression)
+      index['compression'] = _compressions[compression]
+      self._index = index
+      self._swap = index['byteorder'] != sys.byteorder
+      self.symbol_table = SymbolTable()
+      for symbol in index['symbols']:
+         self.symbol_table.add(symbol)
+      self.feature_names = index['features']
+      self.num_features = index['num_features']
+      self.feature_functions = self._find_feature_functions()
+
+   def _find_feature_functions(self):
+      if not self.num_features:
+         return None
+      known = {}
+      for feature in core.ImageBase.get_feature_functions('all')[0]:
+         known[feature[0]] = feature
+      functions = []
+      for name, length in self.feature_names:
+         if (not known.has_key(name) or
+             known[name][1].return_type.length != length):
+            return None
+         functions.append(known[name])
+      return (functions, self.num_features)
+
+   def close(self):
+      self._stream.close()
+
+   def __len__(self):
+      return self._index['num_glyphs']
+
+   def _chunk(self, k):
+      # the decoded chunk k; the last one is kept for random access
+      if self._cache[0] == k:
+         return self._cache[1]
+      offset, length, count = self._index['chunks'][k]
+      self._stream.seek(offset)
+      data = self._stream.read(length)
+      try:
+         if self._index['compression'] == 'zlib':
+            data = zlib.decompress(data)
+         reader = _Reader(data)
+         (geometry, states, id_counts, id_classes, id_confidences, scaling,
+          has_features, features) = [reader.bytes() for i in xrange(8)]
+         properties = []
+         for i in xrange(count):
+            glyph_properties = {}
+            for j in xrange(reader.unpack("<I")[0]):
+               key = reader.string()
+               glyph_properties[key] = reader.value()
+            properties.append(glyph_properties)
+         bits = reader.bytes()
+         reader.end()
+      except (zlib.error, _Corrupt):
+         raise GDBError("Chunk %d of the glyph database is corrupt." % k)
+      swap = self._swap
+      try:
+         geometry = _array('i', geometry, swap)
+         states = _array('B', states, swap)
+         id_counts = _array('I', id_counts, swap)
+         id_classes = _array('I', id_classes, swap)
+         id_confidences = _array('d', id_confidences, swap)
+         scaling = _array('d', scaling, swap)
+         has_features = _array('B', has_features, swap)
+         features = _array('d', features, swap)
+      except ValueError:
+         raise GDBError("Chunk %d of the glyph database is corrupt." % k)
+      # the pixels are only unpacked when they are used (see _glyphs)
+      size = 0
+      for i in xrange(0, len(geometry), 4):
+         if (geometry[i] < 0 or geometry[i+1] < 0 or
+             geometry[i+2] < 1 or geometry[i+3] < 1):
+            size = -1
+            break
+         size += (geometry[i+2] * geometry[i+3] + 7) / 8
+      id_starts = [0]
+      for n in id_counts:
+         id_starts.append(id_starts[-1] + n)
+      if (len(geometry) != 4 * count or size != len(bits) or
+          len(states) != count or len(id_counts) != count or
+          len(id_classes) != id_starts[-1] or
+          len(id_confidences) != id_starts[-1] or
+          len(scaling) != count or len(has_features) != count or
+          len(features) != count * self.num_features or
+          (len(id_classes) and max(id_classes) >= len(self._index['classes']))):
+         raise GDBError("Chunk %d of the glyph database is corrupt." % k)
+      chunk = (count, geometry, states, id_starts, id_classes,
+               id_confidences, scaling, has_features, features,
+               properties, bits)
+      self._cache = (k, chunk)
+      return chunk
+
+   def _glyphs(self, chunk, start, stop):
+      (count, geometry, states, id_starts, id_classes, id_confidences,
+       scaling, has_features, features, properties, bits) = chunk
+      # the packed bitmap of glyph i starts at begin
+      begin = 0
+      for i in xrange(start):
+         begin += (geometry[4*i+2] * geometry[4*i+3] + 7) / 8
+      classes = self._index['classes']
+      num_features = self.num_features
+      glyphs = []
+      for i in xrange(start, stop):
+         ncols, nrows = geometry[4*i+2], geometry[4*i+3]
+         end = begin + (ncols * nrows + 7) / 8
+         # the pixels are only unpacked when they are first used
+         glyph = core.Image(core.Point(geometry[4*i], geometry[4*i+1]),
+                            core.Dim(ncols, nrows), core.ONEBIT, core.DENSE,
+                            decode=(string_io._unpack_glyph_bits,
+                                    bits[begin:end]))
+         begin = end
+         glyphs.append(glyph)
+         glyph.classification_state = states[i]
+         id_name = [(id_confidences[j], classes[id_classes[j]])
+                    for j in xrange(id_starts[i], id_starts[i+1])]
+         id_name.sort()
+         glyph.id_name = id_name
+         for key, val in properties[i].items():
+            glyph.properties[key] = val
+         glyph.scaling = scaling[i]
+         if has_features[i]:
+            glyph.features = features[i*num_features:(i+1)*num_features]
+            if self.feature_functions is not None:
+               glyph.feature_functions = self.feature_functions
+      return glyphs
+
+   def __getitem__(self, i):
+      if i < 0:
+         i += len(self)
+      if i < 0 or i >= len(self):
+         raise IndexError("glyph index out of range")
+      chunk_size = self._index['chunk_size']
+      return self._glyphs(self._chunk(i / chunk_size), i % chunk_size,
+                          i % chunk_size + 1)[0]
+
+   def glyphs(self):
+      """Returns all glyphs of the database."""
+      glyphs = []
+      progress = ProgressFactory("Loading glyph database...",
+                                 len(self._index['chunks']))
+      try:
+         for k in xrange(len(self._index['chunks'])):
+            chunk = self._chunk(k)
+            glyphs.extend(self._glyphs(chunk, 0, chunk[0]))
+            progress.step()
+      finally:
+         progress.kill()
+      return glyphs
+
+   def features(self):
+      """Returns the features of all glyphs as one contiguous array of
+*len(self)* times *num_features* numbers.  The features of glyphs
+saved without features are zero."""
+      result = array.array('d')
+      for k in xrange(len(self._index['chunks'])):
+         result.extend(self._chunk(k)[8])
+      return result
+
+   def training_data(self):
+      """Returns the features and main ids of the classified glyphs,
+as an ``array('d')`` of one row of features per glyph and a list of
+ids, without creating any images.  Raises a GDBError when a classified
+glyph was saved without features."""
+      result = array.array('d')
+      id_names = []
+      classes = self._index['classes']
+      num_features = self.num_features
+      for k in xrange(len(self._index['chunks'])):
+         (count, geometry, states, id_starts, id_classes, id_confidences,
+          scaling, has_features, features, properties, bits) = self._chunk(k)
+         for i in xrange(count):
+            if (states[i] == core.UNCLASSIFIED or
+                id_starts[i] == id_starts[i+1]):
+               continue
+            if not has_features[i]:
+               raise GDBError(
+                  "The glyph at (%d, %d) was saved without features." %
+                  (geometry[4*i], geometry[4*i+1]))
+            id_name = [(id_confidences[j], classes[id_classes[j]])
+                       for j in xrange(id_starts[i], id_starts[i+1])]
+            id_name.sort()
+            id_names.append(id_name[0][1])
+            result.extend(features[i*num_features:(i+1)*num_features])
+      return result, id_names
+
+class LoadGDB:
+   def __init__(self, parts = ['symbol_table', 'glyphs']):
+      self._parts = parts
+      self.symbol_table = SymbolTable()
+      self.glyphs = []
+
+   def parse_filename(self, filename):
+      gdb = GDBFile(filename)
+      try:
+         if 'symbol_table' in self._parts:
+            self.symbol_table = gdb.symbol_table
+         if 'glyphs' in self._parts:
+            self.glyphs = gdb.glyphs()
+      finally:
+         gdb.close()
+      return self
+
+def glyphs_from_gdb(filename, feature_functions = None):
+   """**glyphs_from_gdb** (*filename*, *feature_functions* = ``None``)
+
+Return a list of glyphs from a glyph database.  When
+*feature_functions* is given, the features are generated unless they
+were saved with the same feature functions."""
+   glyphs = LoadGDB().parse_filename(filename).glyphs
+   if not feature_functions is None:
+      from gamera.plugins import features
+      features.generate_features_list(glyphs, feature_functions)
+   return glyphs
+
+def glyphs_to_gdb(filename, glyphs, with_features=True, compression='zlib'):
+   """**glyphs_to_gdb** (*filename*, *glyphs*, *with_features* = ``True``, *compression* = ``'zlib'``)
+
+Saves the given list of glyphs to a glyph database.
+
+*with_features*
+  When set to ``True``, the features generated on the glyphs are saved.
+
+*compression*
+  ``'zlib'`` or ``'none'``.
+"""
+   WriteGDB(glyphs, with_features=with_features,
+            compression=compression).write_filename(filename)
+
+def xml_to_gdb(xml_filename, gdb_filename, compression='zlib'):
+   """**xml_to_gdb** (*xml_filename*, *gdb_filename*, *compression* = ``'zlib'``)
+
+Converts a Gamera XML file into a glyph database."""
+   from gamera import gamera_xml
+   loader = gamera_xml.LoadXML().parse_filename(xml_filename)
+   WriteGDB(loader.glyphs, loader.symbol_table,
+            compression=compression).write_filename(gdb_filename)
+
+def gdb_to_xml(gdb_filename, xml_filename, with_features=True):
+   """**gdb_to_xml** (*gdb_filename*, *xml_filename*, *with_features* = ``True``)
+
+Converts a glyph database into a Gamera XML file.  The features are
+only written when their feature functions are known."""
+   from gamera import gamera_xml
+   loader = LoadGDB().parse_filename(gdb_filename)
+   gamera_xml.WriteXMLFile(loader.glyphs, loader.symbol_table,
+                           with_features=with_features).write_filename(xml_filename)
@@ -89,6 +89,30 @@ elif sys.platform == 'darwin':
 elif '--compiler=mingw32' in sys.argv or not sys.platform == 'win32':
    extras['libraries'] = ['stdc++'] # Not for intel compiler
 
+# The size of Grey16 and Float pixels must be the same in the core and
+# all plugins
+try:
+   from gamera.__compiletime_config__ import grey16_native
+except ImportError:
+   grey16_native = False
+try:
+   from gamera.__compiletime_config__ import float_single
+except ImportError:
+   float_single = False
+try:
+   from gamera.__compiletime_config__ import cpu_dispatch
+except ImportError:
+   cpu_dispatch = True
+define_macros = []
+if grey16_native:
+   define_macros.append(('GAMERA_GREY16_NATIVE', None))
+if float_single:
+   define_macros.append(('GAMERA_FLOAT_SINGLE', None))
+if not cpu_dispatch:
+   define_macros.append(('GAMERA_NO_CPU_DISPATCH', None))
+if define_macros:
+   extras['define_macros'] = define_macros
+
 # Check that we are running a recent enough version of Python.
 # This depends on the platform.
 default_required_version = 222
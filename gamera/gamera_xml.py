@@ -20,13 +20,14 @@
 #
 
 import gzip, os, os.path, cStringIO
+import array
 import warnings
 from weakref import proxy
 from xml.parsers import expat
 
 import core, util
 from util import word_wrap, ProgressFactory, is_image_list
-from gamera.plugins import runlength
+from gamera.plugins import runlength, string_io
 from gamera.symbol_table import SymbolTable
 from config import config
 
@@ -57,6 +58,11 @@ _saveable_types = {
    'str':   str,
    'float': float }
 
+def _property_value(type, data):
+   if _saveable_types.has_key(type):
+      return _saveable_types[type](data)
+   return unicode(data)
+
 extensions = "XML files (*.xml;*.xml.gz)|*.xml;*.xml.gz|All files|*"
 
 class XMLError(Exception):
@@ -133,13 +139,15 @@ class WriteXML:
       if len(glyphs):
          word_wrap(stream, '<glyphs>', indent)
          indent += 1
+         # the runs of all glyphs are encoded at once
+         runs = runlength.glyphs_to_rle(glyphs)
          for i, glyph in util.enumerate(glyphs):
-            self._write_glyph(stream, glyph, indent)
+            self._write_glyph(stream, glyph, indent, runs[i])
             progress.step()
          indent -= 1
          word_wrap(stream, '</glyphs>', indent)
 
-   def _write_glyph(self, stream,  glyph, indent=0):
+   def _write_glyph(self, stream,  glyph, indent=0, runs=None):
       tag = ('<glyph uly="%s" ulx="%s" nrows="%s" ncols="%s">' %
              (glyph.ul_y, glyph.ul_x, glyph.nrows, glyph.ncols))
       word_wrap(stream, tag, indent)
@@ -156,7 +164,9 @@ class WriteXML:
       indent -= 1
       word_wrap(stream, '</ids>', indent)
       word_wrap(stream, '<data>', indent)
-      word_wrap(stream, glyph.to_rle(), indent+1)
+      if runs is None:
+         runs = glyph.to_rle()
+      word_wrap(stream, runs, indent+1)
       word_wrap(stream, '</data>', indent)
       feature_functions = glyph.feature_functions[0]
       if self.with_features and len(feature_functions):
@@ -207,12 +217,24 @@ class WriteXMLFile(WriteXML):
 ################################################################################
 
 class LoadXML:
-   def __init__(self, parts = ['symbol_table', 'glyphs']):
+   # The documents written by WriteXML are read by a parser in C++
+   # (see _parse_records), all others by expat.  Loaders of other
+   # documents turn this off.
+   _read_records = True
+   _records_with_data = True
+   _records_with_features = False
+
+   # With storage_format PACKED, the glyphs are PACKED images.  Those of
+   # the documents read by the C++ parser share one block of memory (see
+   # runlength.packed_glyphs_from_rle) and are decoded while loading.
+   def __init__(self, parts = ['symbol_table', 'glyphs'], storage_format=core.DENSE):
       self._start_elements = {}
       self._end_elements = {}
       self._stream_length = 0
       self._parts = parts
       self._progress_value = 0
+      self._storage_format = storage_format
+      self._packed_glyph = None
 
    def try_type_convert(self, dictionary, key, typename, tagname):
       try:
@@ -246,8 +268,13 @@ class LoadXML:
       return self.parse_stream(stream)
 
    def parse_stream(self, stream):
+      data = stream.read()
+      if self._parse_records(data):
+         return self
+      stream = cStringIO.StringIO(data)
       self._setup_handlers()
       self._parser = expat.ParserCreate()
+      self._parser.buffer_text = True
       self._parser.StartElementHandler = self._start_element_handler
       self._parser.EndElementHandler = self._end_element_handler
       self._stream = stream
@@ -265,6 +292,70 @@ class LoadXML:
          del self._parser
       return self
    
+   def _parse_records(self, data):
+      # Loads the document from the records of string_io._glyphs_from_xml
+      # through the same methods as the expat handlers.  Returns False,
+      # with nothing loaded, for the documents left to expat, which also
+      # reports the errors of the records that cannot be loaded.
+      if not self._read_records or not isinstance(data, str):
+         return False
+      records = string_io._glyphs_from_xml(
+         data, 'glyphs' in self._parts and self._records_with_data,
+         self._records_with_features, 0)
+      if records is None:
+         return False
+      version, symbols, glyphs = records
+      if version < GAMERA_XML_FORMAT_VERSION:
+         return False
+      self._setup_handlers()
+      self._stream_length = 0
+      self._progress = util.ProgressFactory("Loading XML...", 50, numsteps=32)
+      try:
+         try:
+            if 'symbol_table' in self._parts:
+               for name in symbols:
+                  self.symbol_table.add(name)
+            if 'glyphs' in self._parts:
+               self._append_glyph = self._append_glyph_to_glyphs
+               packed_glyphs = self._packed_glyphs_from_records(glyphs)
+               for i, (ul_x, ul_y, ncols, nrows, state, ids, runs, scaling,
+                       features, properties) in enumerate(glyphs):
+                  if packed_glyphs is not None:
+                     self._packed_glyph = packed_glyphs[i]
+                  self._ul_x, self._ul_y = ul_x, ul_y
+                  self._ncols, self._nrows = ncols, nrows
+                  self._id_name = ids
+                  self._scaling = scaling
+                  if state is None:
+                     self._classification_state = core.UNCLASSIFIED
+                  else:
+                     self._classification_state = classification_state_to_number(state)
+                  if runs is None:
+                     self._data = None
+                  else:
+                     self._data = [runs]
+                  self._feature_values = dict(features)
+                  self._properties = {}
+                  for name, type, value in properties:
+                     self._properties[name] = _property_value(type, value)
+                  self._tag_end_glyph()
+               self._append_glyph = None
+         except Exception:
+            return False
+      finally:
+         self._packed_glyph = None
+         self._progress.kill()
+         self._remove_handlers()
+      return True
+
+   def _packed_glyphs_from_records(self, glyphs):
+      if self._storage_format != core.PACKED or not self._records_with_data:
+         return None
+      geometry = array.array('i')
+      for glyph in glyphs:
+         geometry.extend(glyph[:4])
+      return runlength.packed_glyphs_from_rle(geometry, [glyph[6] for glyph in glyphs])
+
    def add_start_element_handler(self, name, func):
       self._start_elements[name] = func
 
@@ -375,11 +466,17 @@ class LoadXML:
       self._classification_state = core.UNCLASSIFIED
 
    def _tag_end_glyph(self):
-      glyph = core.Image(core.Point(self._ul_x, self._ul_y),
-                         core.Dim(self._ncols, self._nrows),
-                         core.ONEBIT, core.DENSE)
-      if not self._data is None:
-         glyph.from_rle(str(u''.join(self._data)))
+      if self._packed_glyph is not None:
+         glyph = self._packed_glyph
+      else:
+         if self._data is None:
+            decode = None
+         else:
+            # the pixels are only decoded when they are first used
+            decode = (runlength.from_rle, str(''.join(self._data)))
+         glyph = core.Image(core.Point(self._ul_x, self._ul_y),
+                            core.Dim(self._ncols, self._nrows),
+                            core.ONEBIT, self._storage_format, decode=decode)
       glyph.classification_state = self._classification_state
       self._id_name.sort()
       glyph.id_name = self._id_name
@@ -424,22 +521,110 @@ class LoadXML:
       self._parser.CharacterDataHandler = self.add_property_value
 
    def _tag_end_property(self):
-      data = u''.join(self._property_value)
-      if _saveable_types.has_key(self._property_type):
-         self._properties[self._property_name] = \
-            _saveable_types[self._property_type](data)
-      else:
-         self._properties[self._property_name] = data
+      self._properties[self._property_name] = _property_value(
+         self._property_type, u''.join(self._property_value))
       self._parser.CharacterDataHandler = None
 
    def add_property_value(self, data):
       self._property_value.append(data)
 
-def glyphs_from_xml(filename, feature_functions = None):
-   """**glyphs_from_xml** (*filename*, *feature_functions* = ``None``)
+class LoadXMLFeatures(LoadXML):
+   """Loads only what a non-interactive classifier needs from the glyphs
+of a Gamera XML file: the stored feature values and the main id of each
+classified glyph.  No images are created, and the pixel data (the
+``<data>`` tags) is skipped, unless *with_data* is ``True``.
+
+*feature_functions*
+  The features to load, in the form accepted by
+  ``Image.get_feature_functions``.  Every classified glyph must have
+  stored values for all of them.
+
+After parsing, ``features`` is an ``array('d')`` with one row of
+feature values per classified glyph, ``id_names`` is the list of their
+main ids and, when *with_data* is ``True``, ``glyphs`` holds the glyphs
+themselves (with their features set)."""
+   def __init__(self, feature_functions='all', with_data=False):
+      LoadXML.__init__(self, parts=['glyphs'])
+      self._feature_functions = core.ImageBase.get_feature_functions(feature_functions)
+      self._with_data = with_data
+      self._records_with_data = with_data
+      self._records_with_features = True
+
+   def _setup_handlers(self):
+      LoadXML._setup_handlers(self)
+      self.features = array.array('d')
+      self.id_names = []
+
+   def _tag_start_glyphs(self, a):
+      LoadXML._tag_start_glyphs(self, a)
+      if not self._with_data:
+         self.add_start_element_handler('data', self._tag_skip)
+         self.add_end_element_handler('data', self._tag_skip)
+      self.add_start_element_handler('feature', self._tag_start_feature)
+      self.add_end_element_handler('feature', self._tag_end_feature)
+
+   def _tag_end_glyphs(self):
+      LoadXML._tag_end_glyphs(self)
+      self.remove_start_element_handler('feature')
+      self.remove_end_element_handler('feature')
+
+   def _tag_skip(self, *args):
+      pass
+
+   def _tag_start_glyph(self, a):
+      LoadXML._tag_start_glyph(self, a)
+      self._feature_values = {}
+
+   def _tag_end_glyph(self):
+      if (self._classification_state == core.UNCLASSIFIED or
+          not len(self._id_name)):
+         return
+      features = array.array('d')
+      for name, function in self._feature_functions[0]:
+         if not self._feature_values.has_key(name):
+            raise XMLError(
+               "The glyph at (%d, %d) has no stored values for the feature '%s'." %
+               (self._ul_x, self._ul_y, name))
+         values = self._feature_values[name].split()
+         if len(values) != function.return_type.length:
+            raise XMLError(
+               "The feature '%s' of the glyph at (%d, %d) has %d values instead of %d." %
+               (name, self._ul_x, self._ul_y, len(values),
+                function.return_type.length))
+         features.extend([float(x) for x in values])
+      self.features.extend(features)
+      self._id_name.sort()
+      self.id_names.append(self._id_name[0][1])
+      if self._with_data:
+         LoadXML._tag_end_glyph(self)
+         glyph = self.glyphs[-1]
+         glyph.features = features
+         glyph.feature_functions = self._feature_functions
+      elif not len(self.id_names) & 0xf:
+         self._update_progress()
+
+   def _tag_start_feature(self, a):
+      self._feature_name = self.try_type_convert(a, 'name', str, 'feature')
+      self._feature_value = []
+      self._parser.CharacterDataHandler = self.add_feature_value
+
+   def _tag_end_feature(self):
+      self._feature_values[self._feature_name] = u''.join(self._feature_value)
+      self._parser.CharacterDataHandler = None
+
+   def add_feature_value(self, data):
+      self._feature_value.append(data)
+
+def glyphs_from_xml(filename, feature_functions = None, storage_format = core.DENSE):
+   """**glyphs_from_xml** (*filename*, *feature_functions* = ``None``, *storage_format* = ``DENSE``)
+
+Return a list of glyphs from a Gamera XML file.
 
-Return a list of glyphs from a Gamera XML file."""
-   glyphs = LoadXML().parse_filename(filename).glyphs
+With *storage_format* ``PACKED``, the glyphs are PACKED images with one
+bit per pixel, and the pixels of all glyphs are kept in one block of
+memory.  This takes a small fraction of the memory of ``DENSE`` glyphs
+for large training databases."""
+   glyphs = LoadXML(storage_format=storage_format).parse_filename(filename).glyphs
    if not feature_functions is None:
       from gamera.plugins import features
       features.generate_features_list(glyphs, feature_functions)
@@ -190,7 +190,7 @@ class DocumentationGenerator:
          _png_support.save_PNG(
             image,
             os.path.join(self.output_images_path,
-                         "%s_generic.png" % (pixel_type_name)))
+                         "%s_generic.png" % (pixel_type_name)), -1, 0)
 
    def copy_css(self, input_path, output_path):
       print "Copying CSS file"
@@ -304,6 +304,7 @@ class PluginDocumentationGenerator:
             dest[key] = val
             flat[key] = val
 
+      plugin.load_lazy_plugins()
       methods = plugin.plugin_methods
       flat_methods = {}
       flat_list = {}
@@ -500,7 +501,7 @@ class PluginDocumentationGenerator:
       _png_support.save_PNG(
          image,
          os.path.join(
-         self.docgen.output_images_path, filename + ".png"))
+         self.docgen.output_images_path, filename + ".png"), -1, 0)
 
    def write_image(self, s, filename, tag=""):
       image = _png_support.load_PNG(os.path.join(self.docgen.output_images_path, filename + ".png"), 0)
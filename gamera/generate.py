@@ -70,6 +70,7 @@ template = Template("""
   [[exec from enums import *]]
   [[exec from plugin import *]]
   [[exec from util import get_pixel_type_name]]
+  [[exec from gamera.args_wrappers import many_supported, many_result_type, many_call]]
 
   [[# This should be included first in order to avoid libpng.h/setjmp.h problems. #]]
   [[if module.__class__.__name__ == "PngSupportModule"]]
@@ -77,6 +78,7 @@ template = Template("""
   [[end]]
 
   #include \"gameramodule.hpp\"
+  #include \"thread_exception.hpp\"
   #include \"knnmodule.hpp\"
 
   [[# include the headers that the module needs #]]
@@ -89,6 +91,10 @@ template = Template("""
   #include <stdexcept>
   #include \"Python.h\"
   #include <list>
+  #include <vector>
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
 
   using namespace Gamera;
   [[for x in module.cpp_namespaces]]
@@ -109,8 +115,52 @@ template = Template("""
     [[for function in module.functions]]
       [[if not function.pure_python]]
         static PyObject* call_[[function.__name__]](PyObject* self, PyObject* args);
+        [[if many_supported(function)]]
+          static PyObject* call_[[function.__name__]]_many(PyObject* self, PyObject* args);
+        [[end]]
+      [[end]]
+    [[end]]
+  }
+
+  [[# The call statistics of the functions, see gamera.plugin.stats #]]
+  static bool plugin_stats_enabled = false;
+  [[for function in module.functions]]
+    [[if not function.pure_python]]
+      static PluginStats stats_[[function.__name__]][PLUGIN_STATS_SLOTS];
+      [[if many_supported(function)]]
+        static PluginStats stats_[[function.__name__]]_many[PLUGIN_STATS_SLOTS];
+      [[end]]
+    [[end]]
+  [[end]]
+  static PluginStatsEntry plugin_stats_table[] = {
+    [[for function in module.functions]]
+      [[if not function.pure_python]]
+        { \"[[function.__name__]]\", stats_[[function.__name__]] },
+        [[if many_supported(function)]]
+          { \"[[function.__name__]]_many\", stats_[[function.__name__]]_many },
+        [[end]]
       [[end]]
     [[end]]
+    { NULL, NULL }
+  };
+
+  static PyObject* call__plugin_stats(PyObject* self, PyObject* args) {
+    return plugin_stats_to_python(plugin_stats_table);
+  }
+
+  static PyObject* call__plugin_stats_reset(PyObject* self, PyObject* args) {
+    plugin_stats_reset(plugin_stats_table);
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  static PyObject* call__plugin_stats_enable(PyObject* self, PyObject* args) {
+    int enabled;
+    if (PyArg_ParseTuple(args, CHAR_PTR_CAST \"i:_plugin_stats_enable\", &enabled) <= 0)
+      return 0;
+    plugin_stats_enabled = enabled != 0;
+    Py_INCREF(Py_None);
+    return Py_None;
   }
 
   [[# Create the list of methods for the module - the name of the function #]]
@@ -124,8 +174,17 @@ template = Template("""
           call_[[function.__name__]], METH_VARARGS,
           CHAR_PTR_CAST [[function.escape_docstring()]]
         },
+        [[if many_supported(function)]]
+          { CHAR_PTR_CAST \"[[function.__name__]]_many\",
+            call_[[function.__name__]]_many, METH_VARARGS,
+            CHAR_PTR_CAST \"[["Calls %s on each image of a list." % function.__name__]]\"
+          },
+        [[end]]
       [[end]]
     [[end]]
+    { CHAR_PTR_CAST \"_plugin_stats\", call__plugin_stats, METH_NOARGS, NULL },
+    { CHAR_PTR_CAST \"_plugin_stats_reset\", call__plugin_stats_reset, METH_NOARGS, NULL },
+    { CHAR_PTR_CAST \"_plugin_stats_enable\", call__plugin_stats_enable, METH_VARARGS, NULL },
     { NULL }
   };
 
@@ -181,6 +240,13 @@ template = Template("""
         [[arg.from_python()]]
       [[end]]
 
+      [[if isinstance(function.self_type, ImageType)]]
+        PluginStatsCall stats_call(plugin_stats_enabled ? plugin_stats_slot(stats_[[function.__name__]], self_pyarg) : 0);
+        stats_call.add_pixels(self_arg);
+      [[else]]
+        PluginStatsCall stats_call(plugin_stats_enabled ? plugin_stats_slot(stats_[[function.__name__]], 0) : 0);
+      [[end]]
+
       [[if function.feature_function]]
          feature_t* feature_buffer = 0;
          if (offset < 0) {
@@ -194,10 +260,41 @@ template = Template("""
          }
          [[args[0].call(function, args[1:], [])]]
       [[else]]
+        [[# the function may change the pixels of any image it is given #]]
+        [[if not function.read_only]]
+          [[for arg in args]]
+            [[if isinstance(arg, ImageType)]]
+              [[arg.symbol]]->data()->touch();
+              [[arg.symbol]]->refresh();
+            [[end]]
+            [[if isinstance(arg, ImageList)]]
+              for (size_t i = 0; i < [[arg.symbol]].size(); ++i) {
+                [[arg.symbol]][i].first->data()->touch();
+                [[arg.symbol]][i].first->refresh();
+              }
+            [[end]]
+          [[end]]
+        [[end]]
+        [[# the images are not spilled while the function runs (see memory_budget.hpp) #]]
+        MemoryBudgetPins pins;
+        [[for arg in args]]
+          [[if isinstance(arg, ImageType)]]
+            if ([[arg.symbol]] != 0)
+              pins.add([[arg.symbol]]->data());
+          [[end]]
+          [[if isinstance(arg, ImageList)]]
+            for (size_t i = 0; i < [[arg.symbol]].size(); ++i)
+              pins.add([[arg.symbol]][i].first->data());
+          [[end]]
+        [[end]]
+        memory_budget_enforce();
         try {
           [[if len(args)]]
             [[args[0].call(function, args[1:], [])]]
           [[else]]
+            [[if function.release_gil]]
+              ReleaseGIL release_gil;
+            [[end]]
             [[if function.return_type != None]]
               [[function.return_type.symbol]] =
             [[end]]
@@ -207,6 +304,9 @@ template = Template("""
           PyErr_SetString(PyExc_RuntimeError, e.what());
           return 0;
         }
+        [[if isinstance(function.return_type, (ImageType, ImageList))]]
+          stats_call.add_bytes([[function.return_type.symbol]]);
+        [[end]]
       [[end]]
 
       [[if function.feature_function]]
@@ -245,6 +345,12 @@ template = Template("""
                 return Py_None;
                } else
                 return NULL;
+            [[# plugins called in_place return the image they were called on #]]
+            [[if isinstance(function.return_type, ImageType) and isinstance(function.self_type, ImageType)]]
+            } else if ((Image*)[[function.return_type.symbol]] == self_arg) {
+              Py_INCREF(self_pyarg);
+              return self_pyarg;
+            [[end]]
             } else {
               [[function.return_type.to_python()]]
               return return_pyarg;
@@ -256,11 +362,174 @@ template = Template("""
         [[end]]
       [[end]]
       }
+
+      [[# The <name>_many variant takes an iterable of images in place of self #]]
+      [[# and calls the function on each of them in a loop, in parallel when #]]
+      [[# the function does not need the interpreter lock. #]]
+      [[if many_supported(function)]]
+      static PyObject* call_[[function.__name__]]_many(PyObject* self, PyObject* args) {
+        PyErr_Clear();
+        PyObject* images_pyarg;
+        [[for arg in function.args.list]]
+          [[arg.declare()]]
+        [[end]]
+        [[if function.return_type != None and not function.feature_function]]
+          [[function.return_type.declare()]]
+        [[end]]
+        int threads = 0;
+        if (PyArg_ParseTuple(args, CHAR_PTR_CAST \"O[[for arg in function.args.list]][[arg.arg_format]][[end]]|i:[[function.__name__]]_many\",
+                             &images_pyarg
+        [[for arg in function.args.list]]
+                             , &[[arg.pysymbol]]
+        [[end]]
+                             , &threads) <= 0)
+          return 0;
+
+        [[for arg in function.args.list]]
+          [[arg.from_python()]]
+        [[end]]
+
+        [[# the tuple keeps the images alive while the lock is released #]]
+        PyObject* images_tuple = PySequence_Tuple(images_pyarg);
+        if (images_tuple == NULL)
+          return 0;
+        long n = (long)PyTuple_GET_SIZE(images_tuple);
+        std::vector<Image*> images(n);
+        std::vector<int> combinations(n);
+        for (long i = 0; i < n; ++i) {
+          PyObject* element = PyTuple_GET_ITEM(images_tuple, i);
+          if (!is_ImageObject(element)) {
+            Py_DECREF(images_tuple);
+            PyErr_SetString(PyExc_TypeError, \"Argument 'images' must be an iterable of images.\");
+            return 0;
+          }
+          if (!image_decode_pending(element)) {
+            Py_DECREF(images_tuple);
+            return 0;
+          }
+          images[i] = (Image*)((RectObject*)element)->m_x;
+          images[i]->refresh();
+          combinations[i] = get_image_combination(element);
+          switch (combinations[i]) {
+          [[for choice, pixel_type in function.self_type._get_choices()]]
+          case [[choice.upper()]]:
+          [[end]]
+            break;
+          default:
+            Py_DECREF(images_tuple);
+            PyErr_Format(PyExc_TypeError, \"The images of '[[function.__name__]]_many' can not have pixel type '%s'.\", get_pixel_type_name(element));
+            return 0;
+          }
+          [[if not function.read_only]]
+            images[i]->data()->touch();
+            images[i]->refresh();
+          [[end]]
+        }
+        MemoryBudgetPins pins;
+        for (long i = 0; i < n; ++i)
+          pins.add(images[i]->data());
+        memory_budget_enforce();
+        PluginStatsCall stats_call(plugin_stats_enabled ? plugin_stats_slot(stats_[[function.__name__]]_many, n > 0 ? PyTuple_GET_ITEM(images_tuple, 0) : 0) : 0);
+        for (long i = 0; i < n; ++i)
+          stats_call.add_pixels(images[i]);
+
+        [[if function.feature_function]]
+          feature_t* feature_buffer = new feature_t[n * [[function.return_type.length]] + 1];
+        [[end]]
+        [[if function.return_type != None and not function.feature_function]]
+          std::vector<[[many_result_type(function)]]> results(n);
+        [[end]]
+        std::vector<char> done(n, 0);
+        ThreadException error;
+        {
+          [[if function.release_gil]]
+            ReleaseGIL release_gil;
+            if (threads <= 0) {
+#ifdef _OPENMP
+              threads = omp_get_max_threads();
+#else
+              threads = 1;
+#endif
+            }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 16)
+#endif
+          [[end]]
+          for (long i = 0; i < n; ++i) {
+            try {
+              [[many_call(function)]]
+              done[i] = 1;
+            } catch (...) {
+              error.keep();
+            }
+          }
+        }
+
+        [[if function.feature_function]]
+          PyObject* result = NULL;
+          if (error.empty() && PyErr_Occurred() == NULL) {
+            PyObject* str = PyString_FromStringAndSize((char*)feature_buffer, n * [[function.return_type.length]] * sizeof(feature_t));
+            if (str != 0) {
+              PyObject* array_init = get_ArrayInit();
+              if (array_init != 0)
+                result = PyObject_CallFunction(array_init, (char *)\"sO\", (char *)\"d\", str);
+              Py_DECREF(str);
+            }
+          }
+          delete[] feature_buffer;
+        [[else]]
+          [[if function.return_type == None]]
+            PyObject* result = Py_None;
+            Py_INCREF(Py_None);
+          [[else]]
+            PyObject* result = PyList_New(n);
+            for (long i = 0; i < n; ++i) {
+              [[if isinstance(function.return_type, ImageType)]]
+                if (!done[i] || results[i] == NULL) {
+              [[else]]
+                if (!done[i]) {
+              [[end]]
+                Py_INCREF(Py_None);
+                PyList_SET_ITEM(result, i, Py_None);
+                continue;
+              }
+              [[if isinstance(function.return_type, ImageType)]]
+                if ((Image*)results[i] == images[i]) {
+                  PyObject* same = PyTuple_GET_ITEM(images_tuple, i);
+                  Py_INCREF(same);
+                  PyList_SET_ITEM(result, i, same);
+                  continue;
+                }
+              [[end]]
+              [[function.return_type.symbol]] = results[i];
+              [[if isinstance(function.return_type, (ImageType, ImageList))]]
+                stats_call.add_bytes([[function.return_type.symbol]]);
+              [[end]]
+              [[function.return_type.to_python()]]
+              PyList_SET_ITEM(result, i, return_pyarg);
+            }
+          [[end]]
+        [[end]]
+        [[for arg in function.args.list]]
+          [[arg.delete()]]
+        [[end]]
+        Py_DECREF(images_tuple);
+        if (!error.empty() || PyErr_Occurred() != NULL) {
+          Py_XDECREF(result);
+          if (!error.empty())
+            PyErr_SetString(PyExc_RuntimeError, error.what().c_str());
+          return 0;
+        }
+        return result;
+      }
+      [[end]]
     [[end]]
   [[end]]
 
   DL_EXPORT(void) init[[module_name]](void) {
     Py_InitModule(CHAR_PTR_CAST \"[[module_name]]\", [[module_name]]_methods);
+    // counts the images of the module into the memory budget of gameracore
+    get_gameracore_dict();
   }
   """)
 
@@ -308,6 +577,9 @@ def generate_plugin(plugin_filename, location, compiling_gamera,
 
   if regenerate:
     print "generating wrappers for", module_name, "plugin"
+    for function in plugin_module.module.functions:
+      if function.release_gil:
+        args_wrappers.check_release_gil(function)
     template.execute_file(cpp_filename, plugin_module.__dict__)
   else:
     print "skipping wrapper generation for", module_name, "plugin (output up-to-date)"
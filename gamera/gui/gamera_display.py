@@ -620,6 +620,12 @@ class ImageDisplay(wx.ScrolledWindow, util.CallbackObject):
       scaling_quality = self.scaling_quality
       image = self.image
 
+      if self._can_paint_tiled(image, scaling, scaling_quality):
+         self._paint_tiled(x1, y1, x2, y2, origin, dc, tmpdc)
+         if redraw_rubber:
+            self.draw_rubber(dc, clear=False)
+         return
+
       x1 = max(x1 - scaling * 2, 0)
       y1 = max(y1 - scaling * 2, 0)
       x2 = min(x2 + scaling * 2, image.width * scaling)
@@ -647,7 +653,12 @@ class ImageDisplay(wx.ScrolledWindow, util.CallbackObject):
                highlight,
                color.Red(), color.Green(), color.Blue())
 
-      scaled_image = subimage.scale(scaling, scaling_quality)
+      if scaling < 1.0 and abs(1.0 / scaling - round(1.0 / scaling)) < 1e-6:
+         # zoomed out by a whole factor (see scale): averaging the pixels
+         # is faster than interpolating and does not alias
+         scaled_image = subimage.downscale_area(int(round(1.0 / scaling)))
+      else:
+         scaled_image = subimage.scale(scaling, scaling_quality)
 
       image = wx.EmptyImage(scaled_image.ncols, scaled_image.nrows)
       scaled_image.to_buffer(image.GetDataBuffer())
@@ -660,6 +671,44 @@ class ImageDisplay(wx.ScrolledWindow, util.CallbackObject):
       if redraw_rubber:
          self.draw_rubber(dc, clear=False)
 
+   # The display pixels of the common image types at whole zooms are
+   # rendered by to_buffer_tiled, which keeps the rendered tiles with the
+   # image, so that only the parts coming into view are converted
+   def _can_paint_tiled(self, image, scaling, scaling_quality):
+      if image.data.pixel_type not in (ONEBIT, GREYSCALE, GREY16, RGB):
+         return False
+      if scaling >= 1.0:
+         return scaling_quality == 0 and scaling == floor(scaling)
+      return abs(1.0 / scaling - round(1.0 / scaling)) < 1e-6
+
+   def _paint_tiled(self, x1, y1, x2, y2, origin, dc, tmpdc):
+      image = self.image
+      scaling = self.scaling
+      x = int(floor(x1))
+      y = int(floor(y1))
+      width = int(ceil(x2)) - x
+      height = int(ceil(y2)) - y
+      if width <= 0 or height <= 0:
+         return
+
+      wx_image = wx.EmptyImage(width, height)
+      buffer = wx_image.GetDataBuffer()
+      image.to_buffer_tiled(buffer, x, y, width, height, scaling)
+
+      # one call per highlight color
+      ccs_by_color = {}
+      for highlight, color in self.highlights:
+         ccs_by_color.setdefault(
+            (color.Red(), color.Green(), color.Blue()), []).append(highlight)
+      for (red, green, blue), ccs in ccs_by_color.items():
+         image.draw_ccs_to_buffer(buffer, x, y, width, height, scaling,
+                                  ccs, red, green, blue)
+
+      bmp = wx.BitmapFromImage(wx_image)
+      tmpdc.SelectObject(bmp)
+      dc.Blit(x - origin[0], y - origin[1], width, height,
+              tmpdc, 0, 0, wx.COPY, True)
+
    def PaintAreaRect(self, rect):
       # When painting a specific area, we have to make it
       # slightly bigger to adjust for scaling
@@ -963,7 +1012,11 @@ class MultiImageGridRenderer(GridCellRenderer):
                          int(ceil(sub_height * scaling))), 0)
             else:
                # This is the easy case - just scale the image.
-               if scaling < 1.0:
+               if scaling < 1.0 and \
+                      abs(1.0 / scaling - round(1.0 / scaling)) < 1e-6 and \
+                      image.data.pixel_type == ONEBIT:
+                  scaled_image = image.downscale_area(int(round(1.0 / scaling)))
+               elif scaling < 1.0:
                   scaled_image = image.to_greyscale().resize(
                      Dim(width, height), 1)
                else:
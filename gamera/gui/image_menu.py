@@ -51,6 +51,7 @@ def members_for_menu(self):
            if hasattr(self, x)]
 
 def methods_for_menu(self):
+   plugin.load_lazy_plugins()
    return plugin.plugin_methods[self.data.pixel_type]
 
 class ImageMenu:
@@ -19,7 +19,7 @@
 #
 
 from threading import *
-import sys, os
+import sys, os, random
 from gamera import core, util, config, classify
 from gamera.plugins import features as features_module
 import gamera.knncore, gamera.gamera_xml
@@ -28,6 +28,10 @@ import array
 from gamera.knncore import CITY_BLOCK
 from gamera.knncore import EUCLIDEAN
 from gamera.knncore import FAST_EUCLIDEAN
+from gamera.knncore import STORAGE_DOUBLE
+from gamera.knncore import STORAGE_FLOAT
+from gamera.knncore import STORAGE_UINT16
+from gamera.knncore import STORAGE_UINT8
 
 KNN_XML_FORMAT_VERSION = 1.0
 
@@ -46,6 +50,8 @@ _distance_type_to_number = {
 # file. After the file is loaded, kNN.load_settings extracts
 # the data from the class to set up kNN.
 class _KnnLoadXML(gamera.gamera_xml.LoadXML):
+   _read_records = False
+
    def __init__(self):
       gamera.gamera_xml.LoadXML.__init__(self)
 
@@ -187,8 +193,8 @@ of images regardless of the order of the pairs.
       progress.kill()
       return m
 
-   def unique_distances(self, images, normalize=True):
-      """**unique_distances** (ImageList *images*, Bool *normalize* = ``True``)
+   def unique_distances(self, images, normalize=True, filename=None, sample=0):
+      """**unique_distances** (ImageList *images*, Bool *normalize* = ``True``, String *filename* = ``None``, Int *sample* = 0)
 
 Return a list of the unique pairs of images in the passed in list
 and the distances between them. The return list is a list of tuples
@@ -196,15 +202,97 @@ of (distance, imagea, imageb) so that it easy to sort.
 
 *normalize*
   When true, the features are normalized before performing the distance
-  calculations."""
+  calculations.
+
+*filename*
+  When given, the distances are written to this file instead of being
+  returned, so that the distances of more images than fit into memory
+  can be computed. The file holds the distances between image *i* and
+  the images *j* > *i* for one *i* after the other, as doubles in the
+  byte order of the machine (e.g. for ``numpy.fromfile``).
+
+*sample*
+  When greater than zero (and less than the number of pairs), only the
+  distances of a random sample of *sample* pairs are returned, which
+  is enough for choosing thresholds from the distribution of the
+  distances. The pairs are a stratified sample: in the order of the
+  pairs above, they are split into *sample* groups of (nearly) the
+  same size, and one pair is drawn from each group. For the fraction
+  *F* of all distances below a threshold and the fraction *f* of the
+  sampled distances below it, the difference between *F* and *f* is
+  below sqrt(ln(2/*a*) / (2 *sample*)) for all thresholds at once with a
+  probability of at least 1 - *a* (e.g. 0.0136 for 10000 pairs and
+  *a* = 0.05), and the stratification only makes it smaller. The sample
+  is drawn from the ``random`` module, so that ``random.seed`` makes it
+  reproducible. It can not be written to a file."""
       self.generate_features_on_glyphs(images)
       l = len(images)
+      if sample > 0 and sample < l * (l - 1) // 2:
+         seed = random.getrandbits(32)
+         return self._unique_distances(images, None, normalize, None, sample, seed)
       progress = util.ProgressFactory("Generating unique distances...", l)
-      dists = self._unique_distances(images, progress.step, normalize)
+      dists = self._unique_distances(images, progress.step, normalize, filename)
       #dists = self._unique_distances(images)
       progress.kill()
       return dists
 
+   def hierarchical_clustering(self, images, linkage="single", normalize=True):
+      """**hierarchical_clustering** (ImageList *images*, String *linkage* = ``"single"``, Bool *normalize* = ``True``)
+
+Agglomerative clustering of the images with the distances of the kNN
+object. Returns the *n* - 1 merges of the dendrogram of the *n* images
+in increasing order of distance, as a list of tuples (*a*, *b*,
+*distance*, *size*). As in the linkage matrix of scipy, the images
+are the clusters 0 to *n* - 1, the cluster made by the *m*-th merge is
+*n* + *m*, and *size* is its number of images. See
+gamera.cluster.cut_dendrogram for cutting the dendrogram into clusters.
+
+*linkage*
+  How the distance between clusters is computed from the distances
+  between their images: ``"single"`` (the smallest), ``"complete"``
+  (the largest) or ``"average"``. The single linkage clustering
+  computes the distances when needed; the other linkages need the
+  distances between all pairs of images in memory.
+
+*normalize*
+  When true, the features are normalized before performing the distance
+  calculations."""
+      linkages = {"single": 0, "complete": 1, "average": 2}
+      if not linkages.has_key(linkage):
+         raise ValueError("linkage must be 'single', 'complete' or 'average'")
+      self.generate_features_on_glyphs(images)
+      l = len(images)
+      progress = util.ProgressFactory("Generating unique distances...", l)
+      merges = self._cluster(images, progress.step, normalize, linkages[linkage])
+      progress.kill()
+      return merges
+
+   def spanning_tree(self, images, num_neighbors=10, normalize=True):
+      """**spanning_tree** (ImageList *images*, Int *num_neighbors* = 10, Bool *normalize* = ``True``)
+
+Returns a spanning tree of the images with the distances of the kNN
+object, as the list of its *n* - 1 edges (*a*, *b*, *distance*)
+between the images *a* and *b* in increasing order of distance (see
+gamera.cluster.make_spanning_tree).
+
+*num_neighbors*
+  The tree is built from the edges between each image and its
+  *num_neighbors* nearest neighbors, found with a vantage point tree,
+  and the edges joining the parts of this graph, which are searched
+  from the *num_neighbors* images of each part farthest from their
+  neighbors. This approximates the minimum spanning tree (the total
+  distance is typically a few percent larger) with O(*n*
+  *num_neighbors*) memory, and in far less time than the exact tree
+  for many images. When zero, or when a weight is negative, the exact
+  minimum spanning tree is built in O(*n*\ :sup:`2`) time instead,
+  with the distances computed when needed, in O(*n*) memory.
+
+*normalize*
+  When true, the features are normalized before performing the distance
+  calculations."""
+      self.generate_features_on_glyphs(images)
+      return self._spanning_tree(images, normalize, num_neighbors)
+
    def evaluate(self):
       """Float **evaluate** ()
 
@@ -217,8 +305,8 @@ correct).
       ans = self.leave_one_out()
       return float(ans[0]) / float(ans[1])
 
-   def knndistance_statistics(self, k=0):
-      """**knndistance_statistics** (Int *k* = 0)
+   def knndistance_statistics(self, k=0, sample=0):
+      """**knndistance_statistics** (Int *k* = 0, Int *sample* = 0)
 
 Returns a list of average distances between each training sample and its *k*
 nearest neighbors. So, when you have *n* training samples, *n* average
@@ -234,13 +322,47 @@ you must create a new classifier from training samples belonging only
 to the specific class.
 
 When *k* is zero, the property ``num_k`` of the knn classifier is used.
+
+When *sample* is greater than zero (and less than *n*), the distances
+are only computed for a random sample of about *sample* training
+samples, stratified by class: each class contributes its share of
+*sample* (at least one training sample). The neighbors are still
+searched among all training samples, so that each returned distance is
+exact, and the mean of the returned distances is off from that of all
+*n* distances by about their standard deviation divided by
+sqrt(*sample*). The sample is drawn from the ``random`` module.
+
+The training samples are searched on ``num_threads`` threads.
 """
       self.instantiate_from_images(self.database, self.normalize)
-      progress = util.ProgressFactory("Generating knndistance statistics...", len(self.database))
-      stats = self._knndistance_statistics(k, progress.step)
+      indexes = None
+      length = len(self.database)
+      if sample > 0 and sample < length:
+         indexes = self._stratified_sample(sample)
+         length = len(indexes)
+      progress = util.ProgressFactory("Generating knndistance statistics...", length)
+      stats = self._knndistance_statistics(k, progress.step, indexes)
       progress.kill()
       return stats
 
+   def _stratified_sample(self, sample):
+      # the indexes of about sample glyphs of the database, drawn from
+      # each class in proportion to its size (at least one)
+      classes = {}
+      # (in the order of instantiate_from_images)
+      i = 0
+      for glyph in self.database:
+         classes.setdefault(glyph.get_main_id(), []).append(i)
+         i += 1
+      fraction = float(sample) / len(self.database)
+      indexes = []
+      for name in sorted(classes.keys()):
+         members = classes[name]
+         count = max(1, int(round(fraction * len(members))))
+         indexes.extend(random.sample(members, count))
+      indexes.sort()
+      return indexes
+
    def settings_dialog(self, parent):
       """Display a settings dialog for k-NN settings"""
       from gamera import args
@@ -535,6 +657,18 @@ Set the weighting vector elements for one specific feature.
       weights[feature_name] = values
       self.set_weights_by_features(weights)
 
+class _DatabaseChanges:
+   """Collects the training glyphs of a kNNInteractive classifier that
+   were added, removed or reclassified since its feature data was last
+   brought up to date.  It is the callback of the database, and does
+   not refer to the classifier, so that the two do not form a cycle."""
+   def __init__(self):
+      self.glyphs = {}
+
+   def __call__(self, glyphs):
+      for glyph in glyphs:
+         self.glyphs[id(glyph)] = glyph
+
 class kNNInteractive(_kNNBase, classify.InteractiveClassifier):
    def __init__(self, database=[], features='all', perform_splits=1, num_k=1):
       """**kNNInteractive** (ImageList *database* = ``[]``, *features* = 'all', bool *perform_splits* = ``True``, int *num_k* = ``1``)
@@ -587,11 +721,73 @@ Creates a new kNN interactive classifier instance.
       num_features = features_module.get_features_length(features)
       _kNNBase.__init__(self, num_features=num_features, num_k=num_k)
       classify.InteractiveClassifier.__init__(self, database, perform_splits)
+      # The training glyphs in the order of the feature data, which is
+      # updated from the changes of the database before classifying
+      self._glyphs = None
+      self._glyphs_version = None
+      self._changes = _DatabaseChanges()
+      for alert in ('add', 'remove', 'reclassify'):
+         self.database.add_callback(alert, self._changes)
 
    def __del__(self):
       _kNNBase.__del__(self)
       classify.InteractiveClassifier.__del__(self)
 
+   def _update_feature_data(self):
+      # The feature data is built again when it was changed elsewhere
+      # (for instance by evaluate), and updated with add_images and
+      # remove_feature_vectors otherwise.
+      changes = self._changes.glyphs
+      self._changes.glyphs = {}
+      if (self._glyphs is None or self._glyphs_version != self.data_version or
+          len(self._glyphs) == 0):
+         glyphs = list(self.database)
+         if len(glyphs):
+            self.instantiate_from_images(glyphs, False)
+         self._glyphs = glyphs
+         self._update_positions()
+      elif len(changes):
+         removed = [self._positions[i] for i in changes if i in self._positions]
+         added = [glyph for glyph in changes.values() if glyph in self.database]
+         if len(removed) == len(self._glyphs):
+            self._glyphs = None
+            return self._update_feature_data()
+         if len(removed):
+            self.remove_feature_vectors(removed)
+            removed = dict.fromkeys(removed)
+            self._glyphs = [glyph for glyph in self._glyphs
+                            if self._positions[id(glyph)] not in removed]
+            self._update_positions()
+         if len(added):
+            self.add_images(added)
+            for glyph in added:
+               self._positions[id(glyph)] = len(self._glyphs)
+               self._glyphs.append(glyph)
+      self._glyphs_version = self.data_version
+
+   def _update_positions(self):
+      # (the enumerate of this module is the one from threading)
+      self._positions = {}
+      for glyph in self._glyphs:
+         self._positions[id(glyph)] = len(self._positions)
+
+   def _classify_with_database(self, glyph):
+      self._update_feature_data()
+      return self.classify(glyph)
+
+   def _classify_list_automatic_impl(self, glyphs):
+      if len(glyphs) == 0:
+         return []
+      if len(self.database) == 0:
+         raise classify.ClassifierError(
+            "Cannot classify using an empty production database.")
+      for glyph in glyphs:
+         for child in glyph.children_images:
+            if child in self.database:
+               self.database.remove(child)
+      self._update_feature_data()
+      return self.classify_list(glyphs)
+
    def noninteractive_copy(self):
       """**noninteractive_copy** ()
 
@@ -616,6 +812,7 @@ Changes the set of features used in the classifier to the given list of feature
       self.features = f
       self.feature_functions = core.ImageBase.get_feature_functions(f)
       self.num_features = features_module.get_features_length(f)
+      self._glyphs = None
       if len(self.database):
          self.is_dirty = True
          self.generate_features_on_glyphs(self.database)
@@ -639,6 +836,10 @@ Creates a new kNN classifier instance.
              filename, in which case the classifier will be
              "unserialized" from the given file.
 
+           - When ``None``, the classifier starts without training
+             data, which can then be loaded with instantiate_from_xml
+             or unserialize.
+
         Any images in the list that were manually classified (have
 	classification_state == MANUAL) will be used as training data
 	for the classifier.  Any UNCLASSIFIED or AUTOMATICALLY
@@ -689,6 +890,112 @@ Creates a new kNN classifier instance.
       _kNNBase.__del__(self)
       classify.NonInteractiveClassifier.__del__(self)
 
+   def _classify_list_automatic_impl(self, glyphs):
+      return self.classify_list(glyphs)
+
+   def _group_cache_state(self):
+      return (self.num_k, self.distance_type, tuple(self.confidence_types),
+              self.get_weights().tostring(), self.get_selections().tostring())
+
+   def merge_glyphs(self, glyphs):
+      """**merge_glyphs** (ImageList *glyphs*)
+
+Adds the given glyphs to the current set of training data.  Only the
+features of the new glyphs are computed, and they are added to the
+classifier data without rebuilding it (the normalization is updated
+with the new glyphs)."""
+      if self.num_feature_vectors == 0:
+         classify.NonInteractiveClassifier.merge_glyphs(self, glyphs)
+         return
+      self.generate_features_on_glyphs(glyphs)
+      self.database.extend(glyphs)
+      self.add_images(glyphs)
+      self._group_cache.clear()
+
+   def remove_glyphs(self, glyphs):
+      """**remove_glyphs** (ImageList *glyphs*)
+
+Removes the given glyphs from the current set of training data without
+rebuilding the classifier data.  Glyphs that are not in the training
+data are ignored."""
+      remove = set([id(glyph) for glyph in glyphs])
+      # training data loaded with unserialize comes before the glyphs
+      first = self.num_feature_vectors - len(self.database)
+      database = list(self.database)
+      indexes = [first + i for i in range(len(database))
+                 if id(database[i]) in remove]
+      keep = [glyph for glyph in self.database if id(glyph) not in remove]
+      self.remove_feature_vectors(indexes)
+      self.database.clear()
+      self.database.extend(keep)
+      self._group_cache.clear()
+
+   def instantiate_from_xml(self, filename, with_data=False):
+      """**instantiate_from_xml** (FileOpen *filename*, bool *with_data* = ``False``)
+
+Uses the classified glyphs of the given Gamera XML file as training
+data, taking their features from the values stored in the file.
+Unlike from_xml_filename, no images are created: the feature values
+and ids are streamed from the file into the classifier data, and the
+pixel data is not read.  Every classified glyph must have stored
+values for the features of the classifier.
+
+*with_data*
+  When ``True``, the glyphs are loaded as well and become the
+  training glyphs (see get_glyphs).  Otherwise the classifier has no
+  training glyphs, as after unserialize."""
+      xml = gamera.gamera_xml.LoadXMLFeatures(
+         self.feature_functions, with_data).parse_filename(filename)
+      self.database.clear()
+      if with_data:
+         self.database.extend(xml.glyphs)
+      self.instantiate_from_features(xml.features, xml.id_names, self.normalize)
+      self._group_cache.clear()
+
+   def instantiate_from_gdb(self, filename, with_data=False, threads=0):
+      """**instantiate_from_gdb** (FileOpen *filename*, bool *with_data* = ``False``, int *threads* = 0)
+
+Uses the classified glyphs of the given glyph database as training
+data.  When the database holds the features of the classifier, they
+are copied into the classifier data without creating any images, as
+with instantiate_from_xml.  Otherwise the glyphs are loaded and their
+features are computed on *threads* threads (all cores when 0, see
+generate_features_list), without holding the Python interpreter lock.
+
+This is the quickest way to set up a classifier for the GA optimization
+(see knnga.GAOptimization).
+
+*with_data*
+  When ``True``, the glyphs become the training glyphs (see
+  get_glyphs).  Otherwise the classifier has no training glyphs, as
+  after unserialize."""
+      from gamera import gamera_gdb
+      gdb = gamera_gdb.GDBFile(filename)
+      try:
+         if (not with_data and gdb.feature_functions is not None and
+             gdb.feature_functions == self.feature_functions):
+            try:
+               features, id_names = gdb.training_data()
+            except gamera_gdb.GDBError:
+               features = None
+            if features is not None:
+               self.database.clear()
+               self.instantiate_from_features(features, id_names, self.normalize)
+               self._group_cache.clear()
+               return
+         glyphs = [glyph for glyph in gdb.glyphs()
+                   if glyph.classification_state != core.UNCLASSIFIED and
+                   len(glyph.id_name)]
+      finally:
+         gdb.close()
+      # the features saved with the same functions are not computed again
+      features_module.generate_features_list(glyphs, self.feature_functions, threads)
+      self.database.clear()
+      if with_data:
+         self.database.extend(glyphs)
+      self.instantiate_from_images(glyphs, self.normalize)
+      self._group_cache.clear()
+
    def change_feature_set(self, f):
       """**change_feature_set** (*features*)
 
@@ -706,6 +1013,7 @@ Changes the set of features used in the classifier to the given list of feature
          self.is_dirty = True
          self.generate_features_on_glyphs(self.database)
          self.instantiate_from_images(self.database, self.normalize)
+      self._group_cache.clear()
 
    def set_normalization_state(self, flag):
       """**set_normalization_state** (bool *flag*)
@@ -713,6 +1021,7 @@ Set whether normalization is used or not for classification.
 """
       self.instantiate_from_images(self.database, flag)
       self.normalize = flag
+      self._group_cache.clear()
 
    def get_normalization_state(self):
       """**get_normalization_state** ()
@@ -17,7 +17,7 @@
 # Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 from random import randint
-from gamera.args import Args, Int, Check
+from gamera.args import Args, Int, Real, Check
 from gamera.knn import kNNInteractive
 from gamera.util import ProgressFactory
 
@@ -48,6 +48,28 @@ parameters.
                 original._perform_splits,
                 k)
 
+def _editCandidates(classifier, k = 0):
+    """Returns the glyphs of a given kNNClassifier and the lists of the
+indexes of those to be removed by Wilson's editing and of those in a Tomek
+link. The *k* nearest neighbors of every glyph are computed only once, by
+the kNN core, and both editing rules are applied to them.
+
+    *classifier*
+      The classifier whose glyphs are edited
+
+    *k*
+      The k-value used by Wilson's editing. k = 0 means, that the
+      classifier's k-value will be used"""
+    if k == 0:
+        k = classifier.num_k
+    glyphs = list(classifier.get_glyphs())
+    if len(glyphs) < 2:
+        return glyphs, [], []
+    engine = _copyClassifier(classifier, k)
+    engine.instantiate_from_images(glyphs, False)
+    wilson, tomek = engine._edit_candidates(k)
+    return glyphs, wilson, tomek
+
 def _getMainId(classificationResult):
     """Classification results returned from a kNN Classifier are in a list
 containing '(confidence, className)' tuples. So to determine the 'main class',
@@ -159,20 +181,12 @@ Reference: D. Wilson: 'Asymptotic Properties of NN Rules Using Edited Data'.
                  rareThreshold = 3):
 
         editedClassifier = _copyClassifier(classifier, k)
-        toBeRemoved = set()
-        progress = ProgressFactory("Generating edited MNN classifier...",
-                                      len(classifier.get_glyphs()))
+        progress = ProgressFactory("Generating edited MNN classifier...", 1)
 
         # classify each glyph with its leave-one-out classifier
-        for i, glyph in enumerate(classifier.get_glyphs()):
-            editedClassifier.get_glyphs().remove(glyph)
-            detectedClass = _getMainId(\
-                                editedClassifier.guess_glyph_automatic(glyph))
-            # check if recognized class complies with the true class
-            if glyph.get_main_id() != detectedClass:
-                toBeRemoved.add(glyph)
-            editedClassifier.get_glyphs().add(glyph)
-            progress.step()
+        glyphs, wilson, tomek = _editCandidates(classifier, k)
+        toBeRemoved = set([glyphs[i] for i in wilson])
+        progress.step()
 
         rareClasses = self._getRareClasses(classifier.get_glyphs(),
                                            protectRare, rareThreshold)
@@ -207,6 +221,42 @@ Reference: D. Wilson: 'Asymptotic Properties of NN Rules Using Edited Data'.
 
 edit_mnn = EditMnn()    
 
+class EditTomek(EditingAlgorithm):
+    """**edit_tomek** (kNNInteractive *classifier*, bool *protectRare*, int *rareThreshold*)
+
+Removal of *Tomek links*. Two glyphs of different classes form a Tomek link
+when each is the other's nearest neighbour. Such pairs lie on the decision
+boundary between their classes, or one of them is noise, so that removing
+both cleans the boundary.
+
+    *classifier*
+        The classifier from which to create an edited copy
+    *protect rare classes*
+        Do not remove the glyphs of rare classes (see edit_mnn)
+    *rare class threshold*
+        In case *protect rare classes* is enabled, classes with less than this
+        number of elements are considered to be rare
+
+Reference: I. Tomek: 'Two Modifications of CNN'. *IEEE Transactions on
+Systems, Man, and Cybernetics*, 6(11):769-772, 1976
+"""
+    name = "Tomek links"
+    args = Args([Check("Protect rare classes", default = True),
+                 Int("Rare class threshold", default = 3)])
+
+    def __call__(self, classifier, protectRare = True, rareThreshold = 3):
+        editedClassifier = _copyClassifier(classifier)
+        glyphs, wilson, tomek = _editCandidates(classifier, 1)
+        rareClasses = edit_mnn._getRareClasses(glyphs, protectRare,
+                                               rareThreshold)
+        for i in tomek:
+            if glyphs[i].get_main_id() in rareClasses:
+                continue
+            editedClassifier.get_glyphs().remove(glyphs[i])
+        return editedClassifier
+
+edit_tomek = EditTomek()
+
 class EditCnn(EditingAlgorithm):
     """**edit_cnn** (kNNInteractive *classifier*, int *k* = 0, bool *randomize*)
     
@@ -279,6 +329,52 @@ Reference: P.E. Hart: 'The Condensed Nearest Neighbor rule'. *IEEE Transactions
 
 edit_cnn = EditCnn()
 
+class EditCondense(EditingAlgorithm):
+    """**edit_condense** (kNNInteractive *classifier*, int *k* = 0, float *tolerance* = 0.01)
+
+Prototype selection with Hart's *Condensed Nearest Neighbour* rule, done by
+the kNN core. Unlike edit_cnn, the resulting classifier keeps the *k* of
+the given classifier, and its leave-one-out accuracy on all glyphs of the
+given classifier is at most *tolerance* below that of the given classifier.
+Classification time grows with the number of glyphs, so that the edited
+classifier classifies faster by the factor it is smaller.
+
+    *classifier*
+        The classifier from which to create an edited copy
+    *internalK*
+        The k value used internally by the editing algorithm and by the
+        edited classifier. 0 means, use the same value as the given
+        classifier (recommended)
+    *tolerance*
+        The largest loss of leave-one-out accuracy (between 0 and 1) that
+        is accepted. As long as the loss is larger, the misclassified
+        prototypes get the nearest glyph of their class as another
+        prototype
+
+The glyphs are processed in the order of the classifier's glyph set, so that
+the result does not depend on the number of threads.
+
+Reference: P.E. Hart: 'The Condensed Nearest Neighbor rule'. *IEEE Transactions on Information Theory*, 14(3):515-516, 1968
+"""
+    name = "Condensed Nearest Neighbour with accuracy tolerance"
+    args = Args([Int("Internal k", default = 0),
+                 Real("Tolerance", range = (0.0, 1.0), default = 0.01)])
+
+    def __call__(self, classifier, k = 0, tolerance = 0.01):
+        if k == 0:
+            k = classifier.num_k
+        glyphs = list(classifier.get_glyphs())
+        if len(glyphs) < 2:
+            return _copyClassifier(classifier, k)
+        engine = _copyClassifier(classifier, k)
+        engine.instantiate_from_images(glyphs, False)
+        prototypes = engine._condense(k, tolerance)
+        return kNNInteractive([glyphs[i] for i in prototypes],
+                              classifier.features,
+                              classifier._perform_splits, k)
+
+edit_condense = EditCondense()
+
 class EditMnnCnn(EditingAlgorithm):
     """**edit_mnn_cnn** (kNNInteractive *classifier*, int *k* = 0, bool *protectRare*, int *rareThreshold*, bool *randomize*)
 
@@ -22,7 +22,8 @@
 from gamera.args import *
 from gamera import paths
 from gamera import util
-import new, os, os.path, imp, inspect, sys, copy
+from gamera import result_cache
+import new, os, os.path, imp, inspect, sys, copy, glob, marshal
 from gamera.backport import sets
 from types import *
 from enums import *
@@ -30,6 +31,9 @@ from enums import *
 
 plugin_methods = {}
 
+# Whether the C++ plugin modules record the statistics of their calls
+_stats_enabled = os.environ.get("GAMERA_PLUGIN_STATS", "") not in ("", "0")
+
 class PluginModule:
    category = None
    cpp_namespaces = []
@@ -72,12 +76,16 @@ class PluginFunction:
    image_types_must_match = 0
    testable = 0
    feature_function = False
+   read_only = False
+   release_gil = False
+   pure = False
    doc_examples = []
    category = None
    pure_python = False
    progress_bar = ""
    author = None
    add_to_image = True
+   many = None
 
    def get_formatted_argument_list(cls):
       return "**%s** (%s)" % (cls.__name__, ', '.join(
@@ -92,36 +100,58 @@ class PluginFunction:
       return r'"%s\n\n%s"' % (cls.get_formatted_argument_list(), doc)
    escape_docstring = classmethod(escape_docstring)
 
+   def _load_cpp_module(cls):
+      parts = cls.__module__.split('.')
+      file = inspect.getfile(cls)
+      cpp_module_name = '_' + parts[-1]
+      directory = os.path.split(file)[0]
+      sys.path.append(directory)
+      try:
+         found = imp.find_module(cpp_module_name)
+      finally:
+         del sys.path[-1]
+      if found:
+         module = imp.load_module(cpp_module_name, *found)
+         if _stats_enabled and hasattr(module, "_plugin_stats_enable"):
+            module._plugin_stats_enable(True)
+         return module
+      return None
+   _load_cpp_module = classmethod(_load_cpp_module)
+
    def register(cls):
       # add_to_image = add_to_image and cls.add_to_image
       if cls.return_type != None:
          if cls.return_type.name == None:
             cls.return_type = copy.copy(cls.return_type)
             cls.return_type.name = cls.__name__
+      module = None
       if not hasattr(cls, "__call__"):
          # This loads the actual C++ function if it is not directly
          # linked in the Python PluginFunction class
-         parts = cls.__module__.split('.')
-         file = inspect.getfile(cls)
-         cpp_module_name = '_' + parts[-1]
-         directory = os.path.split(file)[0]
-         sys.path.append(directory)
-         found = imp.find_module(cpp_module_name)
-         del sys.path[-1]
-         if found:
-             module = imp.load_module(cpp_module_name, *found)
+         module = cls._load_cpp_module()
          if module == None:
             return
          func = getattr(module, cls.__name__)
+         cls.many = staticmethod(getattr(module, cls.__name__ + "_many", None))
       elif cls.__call__ is None:
          func = None
       else:
+         # the C++ module (if any) still provides the <name>_many variant
+         if not cls.pure_python:
+            try:
+               module = cls._load_cpp_module()
+            except ImportError:
+               module = None
+            if module != None:
+               cls.many = staticmethod(getattr(module, cls.__name__ + "_many", None))
          func = cls.__call__
          if type(cls.__call__) == new.instancemethod:
             func = cls.__call__.im_func
          func.func_doc = ("%s\n\n%s" %
                           (cls.get_formatted_argument_list(),
                            util.dedent(cls.__doc__)))
+      if cls.pure and func is not None:
+         func = result_cache.memoize(cls, func, module)
       cls.__call__ = staticmethod(func)
 
       if cls.category == None:
@@ -168,6 +198,221 @@ def PluginFactory(name, category=None,
    cls.module = Builtin
    return cls
 
+def _stats_modules():
+   # the loaded C++ plugin modules
+   return [module for module in sys.modules.values()
+           if module is not None and hasattr(module, "_plugin_stats")]
+
+def enable_stats(enabled=True):
+   """Starts (or stops) recording the number of calls of each C++ plugin
+method, the time they take, the pixels of the images they are called on
+and the bytes of the images they return, for each pixel type.  This can
+also be done by setting the environment variable GAMERA_PLUGIN_STATS
+to 1.  The statistics cost nearly nothing while they are disabled."""
+   global _stats_enabled
+   _stats_enabled = bool(enabled)
+   for module in _stats_modules():
+      module._plugin_stats_enable(_stats_enabled)
+
+def reset_stats():
+   """Clears the statistics of all C++ plugin methods."""
+   for module in _stats_modules():
+      module._plugin_stats_reset()
+
+def stats():
+   """Returns the statistics recorded since enable_stats, as a list of
+(*name*, *pixel_type*, *calls*, *seconds*, *pixels*, *bytes*) tuples,
+the most time consuming first.  *pixel_type* is the name of the pixel
+type of the image the method was called on (None for functions that do
+not take an image), *seconds* the wall time of the calls, *pixels* the
+total number of pixels of these images, and *bytes* the total size of
+the pixel data of the images they returned.  The methods that were not
+called are left out."""
+   result = []
+   for module in _stats_modules():
+      for name, pixel_type, calls, seconds, pixels, bytes in module._plugin_stats():
+         if pixel_type is not None:
+            pixel_type = util.get_pixel_type_name(pixel_type)
+         result.append((name, pixel_type, calls, seconds, pixels, bytes))
+   result.sort(lambda a, b: cmp(b[3], a[3]))
+   return result
+
+# Whether import_plugins only imports a plugin module when one of its
+# methods is first used
+lazy_plugins = os.environ.get("GAMERA_LAZY_PLUGINS", "1") not in ("", "0")
+# The plugin modules that are not imported yet, with the top-level
+# categories of their functions (None when they are not known)
+_lazy_modules = {}
+
+def _default_plugin_index():
+   path = os.environ.get("GAMERA_PLUGIN_INDEX")
+   if path is not None:
+      return path or None
+   home = os.path.expanduser("~")
+   if home == "~":
+      return None
+   return os.path.join(home, ".gamera_plugin_index")
+
+# Where the methods and categories of each plugin module are kept
+# between runs (the environment variable GAMERA_PLUGIN_INDEX, or
+# ~/.gamera_plugin_index), or None to find them again on each run
+plugin_index = _default_plugin_index()
+
+def _plugin_signature(directory):
+   signature = []
+   for filename in glob.glob(os.path.join(directory, "*.py")):
+      name = os.path.basename(filename).split('.')[0]
+      if name != '__init__':
+         st = os.stat(filename)
+         signature.append((name, int(st.st_mtime), st.st_size))
+   signature.sort()
+   return signature
+
+def _read_plugin_index(directory, signature):
+   if plugin_index is None:
+      return None
+   try:
+      fd = open(plugin_index, "rb")
+      try:
+         index = marshal.load(fd)
+      finally:
+         fd.close()
+      if index[directory][0] == signature:
+         return index[directory][1]
+   except Exception:
+      pass
+   return None
+
+def _write_plugin_index(directory, signature, entries):
+   if plugin_index is None:
+      return
+   try:
+      fd = open(plugin_index, "rb")
+      try:
+         index = marshal.load(fd)
+      finally:
+         fd.close()
+   except Exception:
+      index = {}
+   index[directory] = (signature, entries)
+   # written aside and renamed, since several processes may start at once
+   tmp = "%s.%d" % (plugin_index, os.getpid())
+   try:
+      fd = open(tmp, "wb")
+   except (IOError, OSError):
+      # a read-only home directory: the index is built again next time
+      return
+   try:
+      try:
+         marshal.dump(index, fd)
+      finally:
+         fd.close()
+      if sys.platform == 'win32' and os.path.exists(plugin_index):
+         os.remove(plugin_index)
+      os.rename(tmp, plugin_index)
+   except (IOError, OSError):
+      try:
+         os.remove(tmp)
+      except OSError:
+         pass
+
+def _plugin_categories(module):
+   plugin_module = getattr(module, "module", None)
+   if not isinstance(plugin_module, PluginModule):
+      return None
+   categories = []
+   for function in plugin_module.functions:
+      if not isinstance(function, ClassType):
+         function = function.__class__
+      category = function.category
+      if category is None:
+         category = plugin_module.category
+      if category is not None:
+         category = category.split('/')[0]
+         if category not in categories:
+            categories.append(category)
+   return categories
+
+def _index_plugins(names):
+   # imports the plugin modules, noting the methods each adds to images
+   from gamera import core
+   entries = []
+   for name in names:
+      before = core.ImageBase.__dict__.copy()
+      try:
+         module = __import__(name, globals(), locals(), [])
+      except Exception, e:
+         entries.append((name, str(e), [], None))
+         continue
+      methods = [key for key, val in core.ImageBase.__dict__.items()
+                 if before.get(key) is not val]
+      entries.append((name, None, methods, _plugin_categories(module)))
+   return entries
+
+def _lazy_method(name, module_name):
+   def method(self, *args, **kwargs):
+      _load_lazy_module(module_name)
+      from gamera import core
+      if getattr(core.ImageBase.__dict__.get(name), "im_func", None) is method:
+         raise AttributeError("The plugin module '%s' does not define '%s'." %
+                              (module_name, name))
+      return getattr(self, name)(*args, **kwargs)
+   method.__name__ = name
+   method.__doc__ = ("**%s** is loaded from the plugin module '%s' when it is first called." %
+                     (name, module_name))
+   return method
+
+def _load_lazy_module(name):
+   if _lazy_modules.has_key(name):
+      __import__(name, globals(), locals(), [])
+      del _lazy_modules[name]
+
+def import_plugins(directory, verbose=0):
+   """Imports the plugin modules in *directory*.  When *lazy_plugins* is
+true (the default, unless the environment variable GAMERA_LAZY_PLUGINS
+is 0), a module is only imported when one of its methods is first
+called, or when the methods of its category are looked up.  Until then
+its image methods are small stubs, whose names are read from an index
+kept in *plugin_index* (~/.gamera_plugin_index, unless the environment
+variable GAMERA_PLUGIN_INDEX names another file) and rebuilt when the
+plugin modules change.  When the index cannot be written, or
+*plugin_index* is None (GAMERA_PLUGIN_INDEX is empty), all modules are
+imported at once to find their methods."""
+   if not lazy_plugins:
+      return paths.import_directory(directory, globals(), locals(), verbose)
+   from gamera import core
+   signature = _plugin_signature(directory)
+   entries = _read_plugin_index(directory, signature)
+   if entries is None:
+      entries = _index_plugins([x[0] for x in signature])
+      _write_plugin_index(directory, signature, entries)
+   for name, failed, methods, categories in entries:
+      if failed or sys.modules.has_key(name):
+         # modules that failed are tried again, as they were before
+         try:
+            __import__(name, globals(), locals(), [])
+         except Exception, e:
+            if verbose:
+               sys.stdout.write("[%s %s]\n" % (name, str(e)))
+         continue
+      _lazy_modules[name] = categories
+      for method in methods:
+         if not core.ImageBase.__dict__.has_key(method):
+            setattr(core.ImageBase, method,
+                    new.instancemethod(_lazy_method(method, name), None,
+                                       core.gameracore.Image))
+   if verbose:
+      names = _lazy_modules.keys()
+      names.sort()
+      sys.stdout.write("Plugins loaded on first use: %s\n" % ", ".join(names))
+
+def load_lazy_plugins(category=None):
+   """Imports the plugin modules whose import import_plugins deferred,
+or only those that have functions in the (top-level) *category*."""
+   for name, categories in _lazy_modules.items():
+      if category is None or categories is None or category in categories:
+         _load_lazy_module(name)
+
 def get_config_options(command):
    return os.popen(command).read()
 
@@ -178,7 +423,8 @@ def methods_flat_category(category, pixel_type=None):
          # We have to cast the lists to sets here to make Python 2.3.0 happy.
          methods.update(sets.Set(methods_flat_category(category, pixel_type)))
       return list(methods)
-   elif plugin_methods.has_key(pixel_type):
+   load_lazy_plugins(category)
+   if plugin_methods.has_key(pixel_type):
       methods = plugin_methods[pixel_type]
       if methods.has_key(category):
          return _methods_flatten(methods[category])
@@ -28,7 +28,8 @@ ARITHMETIC_TYPES = [GREYSCALE, GREY16, FLOAT, RGB, COMPLEX]
 
 class ArithmeticCombine(PluginFunction):
     self_type = ImageType(ARITHMETIC_TYPES)
-    args = Args([ImageType(ARITHMETIC_TYPES, 'other'), Check('in_place', default=False)])
+    args = Args([ImageType(ARITHMETIC_TYPES, 'other'), Check('in_place', default=False),
+                 Int('threads', range=(0, 1024), default=0)])
     return_type = ImageType(ARITHMETIC_TYPES)
     image_types_must_match = True
 
@@ -46,11 +47,15 @@ class add_images(ArithmeticCombine):
     *in_place*
       If true, the operation will be performed in-place, changing the
       contents of the current image.
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
     """
-    def __call__(self, other, in_place=False):
+    def __call__(self, other, in_place=False, threads=0):
        if self.data.pixel_type == ONEBIT:
-           return _logical.or_image(self, other, in_place)
-       return _arithmetic.add_images(self, other, in_place)
+           return _logical.or_image(self, other, in_place, threads)
+       return _arithmetic.add_images(self, other, in_place, threads)
     __call__ = staticmethod(__call__)
 
     def __doc_example1__(images):
@@ -74,13 +79,18 @@ class subtract_images(ArithmeticCombine):
     *in_place*
       If true, the operation will be performed in-place, changing the
       contents of the current image.
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
     """
     self_type = ImageType(ALL)
-    args = Args([ImageType(ALL, 'other'), Check('in_place', default=False)])
+    args = Args([ImageType(ALL, 'other'), Check('in_place', default=False),
+                 Int('threads', range=(0, 1024), default=0)])
     return_type = ImageType(ALL)
 
-    def __call__(self, other, in_place=False):
-       return _arithmetic.subtract_images(self, other, in_place)
+    def __call__(self, other, in_place=False, threads=0):
+       return _arithmetic.subtract_images(self, other, in_place, threads)
     __call__ = staticmethod(__call__)
 
     def __doc_example1__(images):
@@ -105,14 +115,19 @@ class divide_images(ArithmeticCombine):
     *in_place*
       If true, the operation will be performed in-place, changing the
       contents of the current image.
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
     """
     self_type = ImageType([GREYSCALE, GREY16, FLOAT])
     args = Args([ImageType([GREYSCALE, GREY16, FLOAT], 'other'),
-                 Check("in_place", default=False)])
+                 Check("in_place", default=False),
+                 Int('threads', range=(0, 1024), default=0)])
     return_type = ImageType([GREYSCALE, GREY16, FLOAT])
                   
-    def __call__(self, other, in_place=False):
-       return _arithmetic.divide_images(self, other, in_place)
+    def __call__(self, other, in_place=False, threads=0):
+       return _arithmetic.divide_images(self, other, in_place, threads)
     __call__ = staticmethod(__call__)
 
 class multiply_images(ArithmeticCombine):
@@ -129,17 +144,99 @@ class multiply_images(ArithmeticCombine):
     *in_place*
       If true, the operation will be performed in-place, changing the
       contents of the current image.
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
     """
-    def __call__(self, other, in_place=False):
+    def __call__(self, other, in_place=False, threads=0):
        if self.data.pixel_type == ONEBIT:
-           return _logical.and_image(self, other, in_place)
-       return _arithmetic.multiply_images(self, other, in_place)
+           return _logical.and_image(self, other, in_place, threads)
+       return _arithmetic.multiply_images(self, other, in_place, threads)
+    __call__ = staticmethod(__call__)
+
+class multiply_add(PluginFunction):
+    """
+    Replaces each pixel value *x* by *factor* * *x* + *offset*. This
+    covers scaling the pixel values and adding or subtracting a constant.
+
+    *saturate*
+      When true, the results are rounded and clipped to the range of the
+      pixel type (0 to 255 for GreyScale and 0 to 65535 for Grey16),
+      otherwise they wrap around modulo the size of the range. Float
+      results are neither rounded nor clipped.
+
+    *in_place*
+      If true, the operation will be performed in-place, changing the
+      contents of the current image.
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
+
+    For integer pixels, the results are tabulated for all pixel values
+    once, so that the pixels are only looked up.
+    """
+    self_type = ImageType([GREYSCALE, GREY16, FLOAT])
+    args = Args([Float("factor", default=1.0), Float("offset", default=0.0),
+                 Check("saturate", default=True), Check("in_place", default=False),
+                 Int('threads', range=(0, 1024), default=0)])
+    return_type = ImageType([GREYSCALE, GREY16, FLOAT])
+
+    def __call__(self, factor=1.0, offset=0.0, saturate=True, in_place=False, threads=0):
+       return _arithmetic.multiply_add(self, factor, offset, saturate, in_place, threads)
+    __call__ = staticmethod(__call__)
+
+class multiply_add_images(PluginFunction):
+    """
+    Combines the corresponding pixels *x* of the current image and *y*
+    of another image into *factor* * *x* + *other_factor* * *y* +
+    *offset*. For example, a background image is subtracted without
+    going below zero with
+
+    .. code:: Python
+
+      foreground = image.multiply_add_images(background, 1, -1)
+
+    The two images must be the same type and size.
+
+    *saturate*
+      When true, the results are rounded and clipped to the range of the
+      pixel type (0 to 255 for GreyScale and 0 to 65535 for Grey16),
+      otherwise they wrap around modulo the size of the range. Float
+      results are neither rounded nor clipped.
+
+    *in_place*
+      If true, the operation will be performed in-place, changing the
+      contents of the current image.
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
+
+    When the factors and the offset are integers, integer pixels are
+    combined exactly in integer arithmetic.
+    """
+    self_type = ImageType([GREYSCALE, GREY16, FLOAT])
+    args = Args([ImageType([GREYSCALE, GREY16, FLOAT], 'other'),
+                 Float("factor", default=1.0), Float("other_factor", default=1.0),
+                 Float("offset", default=0.0), Check("saturate", default=True),
+                 Check("in_place", default=False),
+                 Int('threads', range=(0, 1024), default=0)])
+    return_type = ImageType([GREYSCALE, GREY16, FLOAT])
+    image_types_must_match = True
+
+    def __call__(self, other, factor=1.0, other_factor=1.0, offset=0.0,
+                 saturate=True, in_place=False, threads=0):
+       return _arithmetic.multiply_add_images(self, other, factor, other_factor,
+                                              offset, saturate, in_place, threads)
     __call__ = staticmethod(__call__)
 
 class ArithmeticModule(PluginModule):
     cpp_headers=["arithmetic.hpp"]
     category = "Combine/Arithmetic"
-    functions = [add_images, subtract_images, multiply_images, divide_images]
+    functions = [add_images, subtract_images, multiply_images, divide_images,
+                 multiply_add, multiply_add_images]
     author = "Michael Droettboom"
     url = "http://gamera.sourceforge.net/"
 module = ArithmeticModule()
@@ -26,6 +26,7 @@
 
 from gamera.plugin import *
 from gamera.args import NoneDefault
+from gamera.__compiletime_config__ import has_openmp
 import _binarization
 
 class image_mean(PluginFunction):
@@ -34,6 +35,7 @@ class image_mean(PluginFunction):
     """
     category = "Binarization/RegionInformation"
     return_type = Real("output")
+    pure = True
     self_type = ImageType([GREYSCALE,GREY16,FLOAT])
     def __call__(self):
         return _binarization.image_mean(self)
@@ -46,6 +48,7 @@ class image_variance(PluginFunction):
     """
     category = "Binarization/RegionInformation"
     return_type = Real("output")
+    pure = True
     self_type = ImageType([GREYSCALE,GREY16,FLOAT])
     def __call__(self):
         return _binarization.image_variance(self)
@@ -61,6 +64,8 @@ class mean_filter(PluginFunction):
     """
     category = "Binarization/RegionInformation"
     return_type = ImageType([FLOAT], "output")
+    pure = True
+    release_gil = True
     self_type = ImageType([GREYSCALE,GREY16,FLOAT])
     args = Args([Int("region size", default=5)])
     doc_examples = [(GREYSCALE,), (GREY16,), (FLOAT,)]
@@ -81,6 +86,8 @@ class variance_filter(PluginFunction):
     """
     category = "Binarization/RegionInformation"
     return_type = ImageType([FLOAT], "output")
+    pure = True
+    release_gil = True
     self_type = ImageType([GREYSCALE,GREY16,FLOAT])
     args = Args([ImageType([FLOAT], "means"),
                  Int("region size", default=5)])
@@ -108,6 +115,8 @@ class wiener_filter(PluginFunction):
     """
     category = "Filter"
     return_type = ImageType([GREYSCALE,GREY16,FLOAT], "output")
+    pure = True
+    release_gil = True
     self_type = ImageType([GREYSCALE,GREY16,FLOAT])
     args = Args([Int("region size", default=5),
                  Real("noise variance", default=-1.0)])
@@ -138,24 +147,37 @@ class niblack_threshold(PluginFunction):
 
     *upper bound*
       A global threshold above which all pixels are considered white.
+
+    *threads*
+      The number of threads.  When different from 1, the image is split
+      into tiles that are thresholded in parallel, each with a margin of
+      half the region size, so that the result is the same as with one
+      thread.  When 0, the OpenMP default (usually the number of cores)
+      is used.  This requires Gamera to be compiled with OpenMP support;
+      otherwise the tiles are thresholded one after another.
     """
     return_type = ImageType([ONEBIT], "output")
+    pure = True
+    release_gil = True
     self_type = ImageType([GREYSCALE])
     args = Args([Int("region size", default=15),
                  Real("sensitivity", default=-0.2),
                  Int("lower bound", range=(0,255), default=20),
-                 Int("upper bound", range=(0,255), default=150)])
+                 Int("upper bound", range=(0,255), default=150),
+                 Int("threads", range=(0, 1024), default=0)])
     doc_examples = [(GREYSCALE,)]
     def __call__(self, 
                  region_size=15, 
                  sensitivity=-0.2,
                  lower_bound=20,
-                 upper_bound=150):
+                 upper_bound=150,
+                 threads=0):
         return _binarization.niblack_threshold(self, 
                                                region_size, 
                                                sensitivity,
                                                lower_bound,
-                                               upper_bound)
+                                               upper_bound,
+                                               threads)
     __call__ = staticmethod(__call__)
 
    
@@ -183,27 +205,40 @@ class sauvola_threshold(PluginFunction):
 
     *upper bound*
       A global threshold above which all pixels are considered white.
+
+    *threads*
+      The number of threads.  When different from 1, the image is split
+      into tiles that are thresholded in parallel, each with a margin of
+      half the region size, so that the result is the same as with one
+      thread.  When 0, the OpenMP default (usually the number of cores)
+      is used.  This requires Gamera to be compiled with OpenMP support;
+      otherwise the tiles are thresholded one after another.
     """
     return_type = ImageType([ONEBIT], "output")
+    pure = True
+    release_gil = True
     self_type = ImageType([GREYSCALE])
     args = Args([Int("region size", default=15),
                  Real("sensitivity", default=0.5),
                  Int("dynamic range", range=(1, 255), default=128),
                  Int("lower bound", range=(0,255), default=20),
-                 Int("upper bound", range=(0,255), default=150)])
+                 Int("upper bound", range=(0,255), default=150),
+                 Int("threads", range=(0, 1024), default=0)])
     doc_examples = [(GREYSCALE,)]
     def __call__(self, 
                  region_size=15, 
                  sensitivity=0.5, 
                  dynamic_range=128,
                  lower_bound=20,
-                 upper_bound=150):
+                 upper_bound=150,
+                 threads=0):
         return _binarization.sauvola_threshold(self, 
                                                region_size, 
                                                sensitivity, 
                                                dynamic_range,
                                                lower_bound,
-                                               upper_bound)
+                                               upper_bound,
+                                               threads)
     __call__ = staticmethod(__call__)
 
 class gatos_background(PluginFunction):
@@ -224,6 +259,8 @@ class gatos_background(PluginFunction):
     """
     category = "Binarization/RegionInformation"
     return_type = ImageType([GREYSCALE], "output")
+    pure = True
+    release_gil = True
     self_type = ImageType([GREYSCALE])
     args = Args([ImageType([ONEBIT], "binarization"),
                  Int("region size", default=15)])
@@ -248,9 +285,12 @@ class gatos_threshold(PluginFunction):
       A preliminary binarization of the image.
 
     Use the default settings for the other parameters unless you know
-    what you are doing.
+    what you are doing.  To try several settings on the same image, use
+    gatos_threshold_sweep_.
     """
     return_type = ImageType([ONEBIT], "output")
+    pure = True
+    release_gil = True
     self_type = ImageType([GREYSCALE])
     args = Args([ImageType([GREYSCALE], "background"),
                  ImageType([ONEBIT], "binarization"),
@@ -267,6 +307,36 @@ class gatos_threshold(PluginFunction):
     __call__ = staticmethod(__call__)
 
 
+class gatos_threshold_sweep(PluginFunction):
+    """
+    Thresholds an image like gatos_threshold_ once for each parameter
+    triple (*q* [i], *p1* [i], *p2* [i]) and returns the list of results.
+
+    The statistics of the image, the *background* (as computed once by
+    gatos_background_) and the *binarization* that do not depend on the
+    parameters are gathered only once, and the threshold of each setting
+    is tabulated over the background values, so that each further setting
+    costs a single table lookup per pixel.
+    """
+    return_type = ImageList("outputs")
+    pure = True
+    release_gil = True
+    self_type = ImageType([GREYSCALE])
+    args = Args([ImageType([GREYSCALE], "background"),
+                 ImageType([ONEBIT], "binarization"),
+                 FloatVector("q"),
+                 FloatVector("p1"),
+                 FloatVector("p2")])
+    def __call__(self, background, binarization, q, p1, p2):
+        return _binarization.gatos_threshold_sweep(self, 
+                                                   background, 
+                                                   binarization, 
+                                                   q, 
+                                                   p1, 
+                                                   p2)
+    __call__ = staticmethod(__call__)
+
+
 class white_rohrer_threshold(PluginFunction):
     """
     Creates a binary image using White and Rohrer's dynamic thresholding
@@ -295,6 +365,13 @@ class white_rohrer_threshold(PluginFunction):
     Without bias the thresholding decision would be determined by
     noise fluctuations in uniform areas.
 
+    *threads*
+      The number of threads.  The horizontal running average runs
+      through the image in raster order and is computed serially, but
+      the vertical averages and the thresholds of the columns are
+      computed in parallel, with the same result as with one thread.
+      When 0, the OpenMP default (usually the number of cores) is used.
+
     This implementation uses code from XITE__.
 
     .. __: http://www.ifi.uio.no/forskning/grupper/dsb/Software/Xite/
@@ -320,18 +397,21 @@ class white_rohrer_threshold(PluginFunction):
        THIS SOFTWARE.
     """
     return_type = ImageType([ONEBIT], "onebit")
+    pure = True
+    release_gil = True
     self_type = ImageType([GREYSCALE])
     args = Args([Int("x lookahead", default=8),
                  Int("y lookahead", default=1),
                  Int("bias mode", default=0),
                  Int("bias factor", default=100),
                  Int("f factor",default=100),
-                 Int("g factor",default=100)])
+                 Int("g factor",default=100),
+                 Int("threads", range=(0, 1024), default=0)])
     author = "Uma Kompella (using code from the XITE library)"
     doc_examples = [(GREYSCALE,)]
 
     def __call__(self, x_lookahead=8, y_lookahead=1, bias_mode=0,
-                 bias_factor=100, f_factor=100, g_factor=100):
+                 bias_factor=100, f_factor=100, g_factor=100, threads=0):
         return _binarization.white_rohrer_threshold(
             self, 
             x_lookahead, 
@@ -339,7 +419,8 @@ class white_rohrer_threshold(PluginFunction):
             bias_mode,
             bias_factor,
             f_factor,
-            g_factor)
+            g_factor,
+            threads)
     __call__ = staticmethod(__call__)
 
 
@@ -371,6 +452,7 @@ class shading_subtraction(PluginFunction):
     """
     author = "Christoph Dalitz"
     return_type = ImageType([ONEBIT], "onebit")
+    pure = True
     self_type = ImageType([GREYSCALE])
     args = Args([Int("k", default=7), Int("threshold", default=NoneDefault)])
     pure_python = True
@@ -401,15 +483,27 @@ class brink_threshold(PluginFunction):
     To that end, it generally predicts lower thresholds than other
     thresholding algorithms.
 
+    The criterion of each threshold is computed in constant time from
+    cumulative sums of the histogram, so that GREY16 images (with 65536
+    levels) are thresholded as quickly as GREYSCALE images.
+
+    *region_size*
+      When 0 (the default), the whole image is thresholded with one
+      threshold.  Otherwise each *region_size* x *region_size* tile of
+      the image is thresholded with the threshold of its own histogram
+      (the tiles with a single grey level taking the global threshold).
+
     Reference: A.D. Brink, N.E. Pendock: Minimum cross-entropy threshold selection.
     Pattern Recognition 29 (1), 1996. 179-188.
     """
     author = "Johanna Devaney, Brian Stern"
-    self_type = ImageType([GREYSCALE])
+    self_type = ImageType([GREYSCALE, GREY16])
+    args = Args([Int("region_size", range=(0, 65536), default=0)])
     return_type = ImageType([ONEBIT], "onebit")
+    pure = True
     doc_examples = [(GREYSCALE,)]
-    def __call__(self):
-        return _binarization.brink_threshold(self)
+    def __call__(self, region_size=0):
+        return _binarization.brink_threshold(self, region_size)
     __call__ = staticmethod(__call__)
 
 
@@ -425,11 +519,15 @@ class BinarizationGenerator(PluginModule):
                  sauvola_threshold,
                  gatos_background,
                  gatos_threshold,
+                 gatos_threshold_sweep,
                  white_rohrer_threshold,
                  shading_subtraction,
                  brink_threshold]
     author = "John Ashley Burgoyne and Ichiro Fujinaga"
     url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
 
 module = BinarizationGenerator()
 
@@ -19,6 +19,7 @@
 #
 
 from gamera.plugin import *
+from gamera.__compiletime_config__ import has_openmp
 
 import _color
 
@@ -211,6 +212,9 @@ class ColorModule(PluginModule):
                  colors_to_labels]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
 
 module = ColorModule()
 
@@ -125,11 +125,34 @@ class contour_pavlidis(PluginFunction):
     return_type = PointVector("contour")
     author = "Andreas Leuschner"
 
+class labeled_contours(PluginFunction):
+  """
+  Returns the outer and hole contours of all connected components of a
+  labeled image (e.g. after cc_analysis_), traced in a single scan of
+  the image with the border following algorithm by Suzuki and Abe.
+
+  The result is a list of tuples (*label*, *hole*, *points*), one for
+  each contour, where *label* is the label of the component, *hole* is
+  1 for the contour of a hole and 0 for the outer contour, and *points*
+  are the 8-connected border pixels of the component along the contour,
+  in page coordinates. The contours are in the order in which their
+  topmost-leftmost pixel is found in the image.
+
+  This is much faster than calling contour_pavlidis_ on each connected
+  component, and also finds the contours of the holes.
+
+  See S. Suzuki, K. Abe: *Topological structural analysis of digitized
+  binary images by border following.* Computer Vision, Graphics, and
+  Image Processing 30, pp. 32-46, 1985.
+  """
+  self_type = ImageType([ONEBIT])
+  return_type = Class("contours")
+
 class ContourModule(PluginModule):
   cpp_headers = ["contour.hpp"]
   category = "Analysis/Contour"
   functions = [contour_top, contour_left, contour_bottom, contour_right,
-               contour_samplepoints, contour_pavlidis]
+               contour_samplepoints, contour_pavlidis, labeled_contours]
   author = "Michael Droettboom"
   url = "http://gamera.sourceforge.net/"
 
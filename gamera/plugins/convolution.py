@@ -20,6 +20,7 @@
 """The convolution module contains plugins for linear filtering"""
 
 from gamera.plugin import *
+from gamera.__compiletime_config__ import has_openmp
 from gamera.plugins import image_utilities
 from gamera import util
 import _arithmetic
@@ -40,6 +41,12 @@ class convolve(PluginFunction):
 
     Uses code from the Vigra library (Copyright 1998-2007 by Ullrich
     K\u00f6the).
+
+    For GreyScale, Grey16 and Float images, kernels whose rows are all
+    multiples of one row are applied as a row and a column pass, and
+    other kernels with more than 36 weights are applied through the
+    Fourier transform of overlapping tiles (see ``fft``), which is faster
+    the larger the kernel.
     
     *kernel*
       A kernel for the convolution.  The kernel may either be a FloatImage
@@ -71,6 +78,11 @@ class convolve(PluginFunction):
 
         wrap image around (periodic boundary conditions)
 
+    *threads*
+      The number of threads for GreyScale, Grey16 and Float images (0
+      means the OpenMP default, usually the number of cores).  This
+      requires Gamera to be compiled with OpenMP support.
+
     Example usage:
 
     .. code:: Python
@@ -82,20 +94,25 @@ class convolve(PluginFunction):
 
       # Using one of the included kernel generators
       img2 = image.convolve(GaussianKernel(3.0))
+
+    GreyScale, Grey16 and Float images are convolved natively: a kernel
+    that is the outer product of a column and a row (such as a Gaussian
+    or a Sobel kernel) is applied as a row pass followed by a column pass.
     """
     category = "Filter/Convolution"
     self_type = ImageType(CONVOLUTION_TYPES)
     args = Args([ImageType([FLOAT], 'kernel'),
                  Choice('border_treatment',
                         ['avoid', 'clip', 'repeat', 'reflect', 'wrap'],
-                        default=1)])
+                        default=1),
+                 Int("threads", range=(0, 1024), default=0)])
     return_type = ImageType(CONVOLUTION_TYPES)
 
-    def __call__(self, kernel, border_treatment=3):
+    def __call__(self, kernel, border_treatment=3, threads=0):
         from gamera.gameracore import FLOAT
         if type(kernel) == list:
             kernel = image_utilities.nested_list_to_image(kernel, FLOAT)
-        return _convolution.convolve(self, kernel, border_treatment)
+        return _convolution.convolve(self, kernel, border_treatment, threads)
     __call__ = staticmethod(__call__)
 
 class convolve_xy(PluginFunction):
@@ -120,6 +137,9 @@ class convolve_xy(PluginFunction):
     *border_treatment*
       Specifies how to treat the borders of the image.  See
       ``convolve`` for information about *border_treatment* values.
+
+    *threads*
+      The number of threads.  See ``convolve``.
     """
     category = "Filter/Convolution"
     self_type = ImageType(CONVOLUTION_TYPES)
@@ -127,11 +147,12 @@ class convolve_xy(PluginFunction):
                  ImageType([FLOAT], 'kernel_y'),
                  Choice('border_treatment',
                         ['avoid', 'clip', 'repeat', 'reflect', 'wrap'],
-                        default=1)])
+                        default=1),
+                 Int("threads", range=(0, 1024), default=0)])
     return_type = ImageType(CONVOLUTION_TYPES)
     pure_python = True
 
-    def __call__(self, kernel_x, kernel_y=None, border_treatment=1):
+    def __call__(self, kernel_x, kernel_y=None, border_treatment=1, threads=0):
         from gamera.gameracore import FLOAT
         if kernel_y is None:
             kernel_y = kernel_x
@@ -143,8 +164,8 @@ class convolve_xy(PluginFunction):
                 kernel_y = image_utilities.nested_list_to_image(kernel_y, FLOAT)
             if type(kernel_x) == list:
                 kernel_x = image_utilities.nested_list_to_image(kernel_x, FLOAT)
-        result = _convolution.convolve_x(self, kernel_x, border_treatment)
-        return _convolution.convolve_y(result, kernel_y, border_treatment)
+        result = _convolution.convolve_x(self, kernel_x, border_treatment, threads)
+        return _convolution.convolve_y(result, kernel_y, border_treatment, threads)
     __call__ = staticmethod(__call__)
 
 class convolve_x(PluginFunction):
@@ -164,20 +185,24 @@ class convolve_x(PluginFunction):
     *border_treatment*
       Specifies how to treat the borders of the image.  See
       ``convolve`` for information about *border_treatment* values.
+
+    *threads*
+      The number of threads.  See ``convolve``.
     """
     category = "Filter/Convolution"
     self_type = ImageType(CONVOLUTION_TYPES)
     args = Args([ImageType([FLOAT], 'kernel_x'),
                  Choice('border_treatment',
                         ['avoid', 'clip', 'repeat', 'reflect', 'wrap'],
-                        default=1)])
+                        default=1),
+                 Int("threads", range=(0, 1024), default=0)])
     return_type = ImageType(CONVOLUTION_TYPES)
 
-    def __call__(self, kernel, border_treatment=1):
+    def __call__(self, kernel, border_treatment=1, threads=0):
         from gamera.gameracore import FLOAT
         if type(kernel) == list:
             kernel = image_utilities.nested_list_to_image(kernel, FLOAT)
-        return _convolution.convolve_x(self, kernel, border_treatment)
+        return _convolution.convolve_x(self, kernel, border_treatment, threads)
     __call__ = staticmethod(__call__)
 
 class convolve_y(PluginFunction):
@@ -196,20 +221,24 @@ class convolve_y(PluginFunction):
     *border_treatment*
       Specifies how to treat the borders of the image.  See
       ``convolve`` for information about *border_treatment* values.
+
+    *threads*
+      The number of threads.  See ``convolve``.
     """
     category = "Filter/Convolution"
     self_type = ImageType(CONVOLUTION_TYPES)
     args = Args([ImageType([FLOAT], 'kernel_y'),
                  Choice('border_treatment',
                         ['avoid', 'clip', 'repeat', 'reflect', 'wrap'],
-                        default=1)])
+                        default=1),
+                 Int("threads", range=(0, 1024), default=0)])
     return_type = ImageType(CONVOLUTION_TYPES)
 
-    def __call__(self, kernel, border_treatment=1):
+    def __call__(self, kernel, border_treatment=1, threads=0):
         from gamera.gameracore import FLOAT
         if type(kernel) == list:
             kernel = image_utilities.nested_list_to_image(kernel, FLOAT)
-        return _convolution.convolve_y(self, kernel, border_treatment)
+        return _convolution.convolve_y(self, kernel, border_treatment, threads)
     __call__ = staticmethod(__call__)
 
 ########################################
@@ -305,6 +334,69 @@ class gaussian_smoothing(PluginFunction):
             border_treatment = BORDER_TREATMENT_REFLECT)
     __call__ = staticmethod(__call__)
 
+class recursive_gaussian_smoothing(PluginFunction):
+    """
+    Performs gaussian smoothing with the recursive filter of Young and
+    van Vliet, whose cost per pixel does not depend on the standard
+    deviation.  See:
+
+    Young, Ian T., and Lucas J. van Vliet. 1995. Recursive
+    implementation of the Gaussian filter. *Signal Processing* 44:
+    139--151.
+
+    The result approximates ``gaussian_smoothing`` with the borders
+    treated as BORDER_TREATMENT_REPEAT.  The approximation is close for
+    large standard deviations, where it is much faster, but coarse for
+    standard deviations of about 1 or less.
+
+    *standard_deviation*
+      The standard deviation of the Gaussian (at least 0.5).
+
+    *threads*
+      The number of threads.  See ``convolve``.
+    """
+    self_type = ImageType([GREYSCALE, GREY16, FLOAT])
+    args = Args([Float("standard_deviation", default=10.0),
+                 Int("threads", range=(0, 1024), default=0)])
+    return_type = ImageType([GREYSCALE, GREY16, FLOAT])
+    doc_examples = [(GREYSCALE, 5.0)]
+    def __call__(self, standard_deviation=10.0, threads=0):
+        return _convolution.recursive_gaussian_smoothing(
+            self, standard_deviation, threads)
+    __call__ = staticmethod(__call__)
+
+class box_filter(PluginFunction):
+    """
+    Replaces each pixel by the mean over the square window of
+    (2*radius+1) * (2*radius+1) pixels around it.  The window sums are
+    updated as the window moves, so that the cost per pixel does not
+    depend on the radius.
+
+    *radius*
+      The radius of the window.
+
+    *border_treatment*
+      Specifies how to treat the borders of the image.  See
+      ``convolve`` for information about *border_treatment* values.
+      With BORDER_TREATMENT_CLIP, the mean is taken over the part of
+      the window inside the image.
+
+    *threads*
+      The number of threads.  See ``convolve``.
+    """
+    self_type = ImageType([GREYSCALE, GREY16, FLOAT])
+    args = Args([Int("radius", range=(0, 10000), default=1),
+                 Choice('border_treatment',
+                        ['avoid', 'clip', 'repeat', 'reflect', 'wrap'],
+                        default=3),
+                 Int("threads", range=(0, 1024), default=0)])
+    return_type = ImageType([GREYSCALE, GREY16, FLOAT])
+    doc_examples = [(GREYSCALE, 3)]
+    def __call__(self, radius=1, border_treatment=3, threads=0):
+        return _convolution.box_filter(self, radius, border_treatment,
+                                       threads)
+    __call__ = staticmethod(__call__)
+
 class simple_sharpen(PluginFunction):
     """
     Perform simple sharpening.
@@ -426,11 +518,15 @@ class ConvolutionModule(PluginModule):
                  GaussianKernel, GaussianDerivativeKernel,
                  BinomialKernel, AveragingKernel,
                  SymmetricGradientKernel, SimpleSharpeningKernel,
-                 gaussian_smoothing, simple_sharpen,
+                 gaussian_smoothing, recursive_gaussian_smoothing,
+                 box_filter, simple_sharpen,
                  gaussian_gradient, laplacian_of_gaussian,
                  hessian_matrix_of_gaussian, sobel_edge_detection]
     author = u"Michael Droettboom (With code from VIGRA by Ullrich K\u00f6the)"
     url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
 module = ConvolutionModule()
 
 BORDER_TREATMENT_AVOID = 0
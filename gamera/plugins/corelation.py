@@ -92,11 +92,99 @@ class corelation_sum_squares(PluginFunction):
     args = Args([ImageType([ONEBIT], "template"), Point("offset")])
     progress_bar = "Correlating"
 
+class corelation_weighted_map(PluginFunction):
+    """
+    Returns the corelation_weighted_ of the template at all offsets in
+    the rectangle *offset*, *size* at once, as a FLOAT image of *size*
+    whose origin is *offset*: the pixel at (*x*, *y*) of the result is
+    the corelation with the template placed at (*x*, *y*).
+
+    This is much faster than calling corelation_weighted_ for each
+    offset, since the cost per offset only depends on the number of
+    black runs of the template and not on its area.
+
+    *template*
+      The template image.
+
+    *offset*
+      The first displacement of the template on the image.
+
+    *size*
+      The number of displacements in each direction.
+
+    *bb*, *bw*, *wb*, *ww*
+      The rewards and penalties, as in corelation_weighted_.
+
+    *threads*
+      The number of threads among which the rows of the result are
+      split.  When 0 (the default), the number of processors is used.
+    """
+    return_type = ImageType([FLOAT], "corelation")
+    self_type = ImageType([ONEBIT, GREYSCALE])
+    args = Args([ImageType([ONEBIT], "template"),
+                 Point("offset"), Dim("size"),
+                 Float("bb"), Float("bw"), Float("wb"), Float("ww"),
+                 Int("threads", range=(0, 1024), default=0)])
+    release_gil = True
+
+class corelation_sum_map(PluginFunction):
+    """
+    Returns the corelation_sum_ of the template at all offsets in the
+    rectangle *offset*, *size* at once, as a FLOAT image of *size*
+    whose origin is *offset* (see corelation_weighted_map_).
+
+    *template*
+      The template image.
+
+    *offset*
+      The first displacement of the template on the image.
+
+    *size*
+      The number of displacements in each direction.
+
+    *threads*
+      The number of threads.  When 0 (the default), the number of
+      processors is used.
+    """
+    return_type = ImageType([FLOAT], "corelation")
+    self_type = ImageType([ONEBIT, GREYSCALE])
+    args = Args([ImageType([ONEBIT], "template"),
+                 Point("offset"), Dim("size"),
+                 Int("threads", range=(0, 1024), default=0)])
+    release_gil = True
+
+class corelation_sum_squares_map(PluginFunction):
+    """
+    Returns the corelation_sum_squares_ of the template at all offsets
+    in the rectangle *offset*, *size* at once, as a FLOAT image of
+    *size* whose origin is *offset* (see corelation_weighted_map_).
+
+    *template*
+      The template image.
+
+    *offset*
+      The first displacement of the template on the image.
+
+    *size*
+      The number of displacements in each direction.
+
+    *threads*
+      The number of threads.  When 0 (the default), the number of
+      processors is used.
+    """
+    return_type = ImageType([FLOAT], "corelation")
+    self_type = ImageType([ONEBIT, GREYSCALE])
+    args = Args([ImageType([ONEBIT], "template"),
+                 Point("offset"), Dim("size"),
+                 Int("threads", range=(0, 1024), default=0)])
+    release_gil = True
+
 class CorelationModule(PluginModule):
     cpp_headers=["corelation.hpp"]
     category = "Corelation"
     functions = [corelation_weighted, corelation_sum,
-                 corelation_sum_squares]
+                 corelation_sum_squares, corelation_weighted_map,
+                 corelation_sum_map, corelation_sum_squares_map]
     author = "Michael Droettboom"
     url = "http://gamera.sourceforge.net/"
 module = CorelationModule()
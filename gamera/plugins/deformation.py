@@ -124,7 +124,9 @@ the following meaning:
     case you should do your own smoothing afterwards.
 
 The random generator is initialized with *random_seed* for allowing
-reproducable results.
+reproducable results.  Every pixel is flipped with its own random
+number, so that degrade_kanungo_variants_ can compute several
+degradations of the same image in parallel.
 
 References:
 
@@ -146,6 +148,39 @@ References:
     author = "Christoph Dalitz"
     doc_examples = [(ONEBIT, 0.0, 0.5, 0.5, 0.5, 0.5, 2, 0)]
 
+class degrade_kanungo_variants(PluginFunction):
+    """Returns *n* degradations of an image with the scheme of
+Kanungo et al. (see degrade_kanungo_), e.g. for generating synthetic
+training data from a single glyph.
+
+The *i*-th image of the list is the same as the result of
+degrade_kanungo with the seed *random_seed* + *i*.  The distance
+transforms that the degradation depends on are only computed once
+for all images.
+
+*threads*
+  The number of threads on which the images are computed.  When 0,
+  the OpenMP default (usually the number of cores) is used.  This
+  requires Gamera to be compiled with OpenMP support; otherwise the
+  images are computed one after another.
+"""
+    self_type = ImageType([ONEBIT])
+    args = Args([Float('eta', range=(0.0,1.0)),
+                 Float('a0', range=(0.0,1.0)),
+                 Float('a'),
+                 Float('b0', range=(0.0,1.0)),
+                 Float('b'),
+                 Int('k', default=2),
+                 Int('n', range=(0, sys.maxint), default=1),
+                 Int('random_seed', default=0),
+                 Int('threads', range=(0, 1024), default=0)])
+    return_type = ImageList("variants")
+    release_gil = True
+    def __call__(self, eta, a0, a, b0, b, k=2, n=1, random_seed=0, threads=0):
+        return _deformation.degrade_kanungo_variants(self, eta, a0, a, b0, b, k, n,
+                                                     random_seed, threads)
+    __call__ = staticmethod(__call__)
+
 class white_speckles(PluginFunction):
     """Adds white speckles to an image. This is supposed to emulate
 image defects introduced through printing, scanning and thresholding.
@@ -206,7 +241,7 @@ class DefModule(PluginModule):
     cpp_headers=["deformations.hpp"]
     category = "Deformations"
     functions = [noise, inkrub, wave, ink_diffuse,
-                 degrade_kanungo, white_speckles]
+                 degrade_kanungo, degrade_kanungo_variants, white_speckles]
     author = "Albert Brzeczko"
     url = "http://gamera.sourceforge.net/"
 module = DefModule()
@@ -498,6 +498,9 @@ class remove_border(PluginFunction):
   This is a special case of the flood_fill algorithm that is designed
   to remove dark borders produced by photocopiers or flatbed scanners
   around the border of the image.
+
+  All black pixels that are 4-connected to the image border are set to
+  white in a single pass over the border.
   """
   self_type = ImageType([ONEBIT])
 
@@ -21,6 +21,7 @@
 post-processing from the VIGRA Computer Vision Library."""
 
 from gamera.plugin import *
+from gamera.__compiletime_config__ import has_openmp
 import _edgedetect
 
 ########################################
@@ -115,17 +116,35 @@ class canny_edge_image(PluginFunction):
 	The scale relates to the value b of the exponential filter.
 
       *gradient_threshold*
-	This operator first calls cannyEdgelList() to generate an
-	edgel list for the given image. Than it scans this list and
-	selects edgels whose strength is above the given
-	gradient_threshold.
+	The edgels (local maxima of the gradient magnitude in gradient
+	direction, as in VIGRA's cannyEdgelList()) whose strength is
+	above *gradient_threshold* are marked.
+
+      *low_threshold*
+	When given (not negative), edgels whose strength is above
+	*low_threshold* are marked too when they are 8-connected to a
+	marked edgel (hysteresis thresholding). The default -1 marks
+	only the edgels above *gradient_threshold*.
+
+      *threads*
+	The number of threads to use.  When 0, the number of processors
+	is used.
+
+      The gradients, the non-maximum suppression and the marking of
+      the edge pixels are computed row by row in parallel, without
+      building an edgel list.
       """
       self_type = ImageType([GREYSCALE, GREY16, FLOAT])
       args = Args([Real("scale", [0, 1e300], default=0.8),
-                   Real("gradient_threshold", [0, 1e300], default=4.0)])
+                   Real("gradient_threshold", [0, 1e300], default=4.0),
+                   Real("low_threshold", [-1, 1e300], default=-1.0),
+                   Int("threads", range=(0, 1024), default=0)])
       return_type = ImageType([GREYSCALE, GREY16, FLOAT])
-      def __call__(self, scale=0.8, gradient_threshold=4.0):
-            return _edgedetect.canny_edge_image(self, scale, gradient_threshold)
+      release_gil = True
+      def __call__(self, scale=0.8, gradient_threshold=4.0, low_threshold=-1.0,
+                   threads=0):
+            return _edgedetect.canny_edge_image(self, scale, gradient_threshold,
+                                                low_threshold, threads)
       __call__ = staticmethod(__call__)
       doc_examples = [(GREYSCALE,)]
 
@@ -165,5 +184,8 @@ class EdgeDetect(PluginModule):
                    outline]
       author = u"Ullrich K\u00f6the (wrapped by Robert Ferguson)"
       url = "http://gamera.sourceforge.net/"
+      if has_openmp:
+            extra_compile_args = ["-fopenmp"]
+            extra_link_args = ["-fopenmp"]
 module = EdgeDetect()
 
@@ -19,12 +19,14 @@
 
 import array
 from gamera.plugin import *
+from gamera.__compiletime_config__ import has_openmp
 import _features
 
 class Feature(PluginFunction):
     self_type = ImageType([ONEBIT])
     return_type = FloatVector(length=1)
     feature_function = True
+    release_gil = True
     doc_examples = [(ONEBIT,)]
 
 class black_area(Feature):
@@ -333,6 +335,76 @@ class diagonal_projection(Feature):
     return_type = FloatVector(length=1)
     author = "Andrew Hankinson"
 
+class run_statistics(Feature):
+    """
+    Statistics of the black runs of the image in four directions, which
+    describe the thickness of its strokes.
+
+    0-7. The fractions of the horizontal black runs of lengths 1, 2-3,
+         4-7, 8-15, 16-31, 32-63, 64-127 and 128 or more
+    8-15. The same for the vertical runs
+    16-23. The same for the runs from the upper left to the lower right
+    24-31. The same for the runs from the upper right to the lower left
+    32. The stroke width: the median over the black pixels of the
+        length of the shortest of the four runs through the pixel
+
+    The histograms of a direction without runs are 0, and so is the
+    stroke width of an image without black pixels.
+
+    +---------------------------+
+    | **Invariant to:**         |
+    +-------+----------+--------+
+    | scale | rotation | mirror |
+    +-------+----------+--------+
+    |       |          |        |
+    +-------+----------+--------+
+    """
+    return_type = FloatVector(length=33)
+
+
+class _fused_features(PluginFunction):
+    """
+    Computes the given features in one call, sharing the intermediate
+    results (projections, moment sums, runs and region counts) between
+    them, and stores them consecutively in the image's ``features``.
+    The intermediate results are kept with the image until its pixels
+    are changed.
+
+    *features*
+      The codes of the features, as indices into ``fused_features``.
+      A negative code -*n* skips *n* values.
+
+    Used by generate_features_; not meant to be called directly.
+    """
+    category = "Utility"
+    self_type = ImageType([ONEBIT])
+    args = Args([IntVector('features')])
+    return_type = None
+    read_only = True
+
+class _fused_features_list(PluginFunction):
+    """
+    Runs _fused_features_ on each image in *images*, distributing the
+    images over *threads* threads (all cores when 0).  The Python
+    interpreter lock is released meanwhile.  The ``features`` of the
+    images must already have the right length.
+
+    Used by generate_features_list_; not meant to be called directly.
+    """
+    category = "Utility"
+    self_type = None
+    args = Args([ImageList('images'), IntVector('features'),
+                 Int('threads', range=(0, 1024), default=0)])
+    return_type = None
+    read_only = True
+
+# The features _fused_features can compute, in the order of the
+# FusedFeature codes in features.hpp
+fused_features = [black_area, moments, nholes, nholes_extended, volume,
+                  area, aspect_ratio, nrows_feature, ncols_feature,
+                  compactness, volume16regions, volume64regions,
+                  zernike_moments, skeleton_features, top_bottom,
+                  diagonal_projection, run_statistics]
 
 class generate_features(PluginFunction):
     """
@@ -358,6 +430,7 @@ class generate_features(PluginFunction):
     args = Args([Class('features', list), Check('force')])
     return_type = None
     cache = {}
+    fused_cache = {}
     def __call__(self, features=None, force=False):
       if features is None:
          features = self.get_feature_functions()
@@ -365,15 +438,48 @@ class generate_features(PluginFunction):
          return
       self.feature_functions = features
       features, num_features = features
-      if len(self.features) != num_features:
+      generate_features._prepare(self, num_features)
+      codes, others = generate_features._split_fused(features)
+      if codes:
+          self._fused_features(codes)
+      for function, offset in others:
+          function.__call__(self, offset)
+    __call__ = staticmethod(__call__)
+
+    def _prepare(image, num_features):
+      # Gives the image a feature array of the right length
+      if len(image.features) != num_features:
           if not generate_features.cache.has_key(num_features):
               generate_features.cache[num_features] = [0] * num_features
-          self.features = array.array('d', generate_features.cache[num_features])
+          image.features = array.array('d', generate_features.cache[num_features])
+    _prepare = staticmethod(_prepare)
+
+    def _split_fused(features):
+      # Returns the codes for _fused_features, and the (function, offset)
+      # pairs of the features it cannot compute
+      key = tuple([function for name, function in features])
+      if not generate_features.fused_cache.has_key(key):
+          generate_features.fused_cache[key] = \
+              generate_features._split_fused_uncached(features)
+      return generate_features.fused_cache[key]
+    _split_fused = staticmethod(_split_fused)
+
+    def _split_fused_uncached(features):
+      codes = []
+      others = []
       offset = 0
       for name, function in features:
-          function.__call__(self, offset)
-          offset += function.return_type.length
-    __call__ = staticmethod(__call__)
+          length = function.return_type.length
+          if function in fused_features:
+              codes.append(fused_features.index(function))
+          else:
+              codes.append(-length)
+              others.append((function, offset))
+          offset += length
+      if len(others) == len(features):
+          codes = []
+      return codes, others
+    _split_fused_uncached = staticmethod(_split_fused_uncached)
 
 class FeaturesModule(PluginModule):
     category = "Features"
@@ -382,10 +488,15 @@ class FeaturesModule(PluginModule):
                  nholes_extended, volume, area,
                  aspect_ratio, nrows_feature, ncols_feature, compactness,
                  volume16regions, volume64regions,
-                 generate_features, zernike_moments,
-                 skeleton_features, top_bottom, diagonal_projection]
+                 generate_features, _fused_features, _fused_features_list,
+                 zernike_moments,
+                 skeleton_features, top_bottom, diagonal_projection,
+                 run_statistics]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
 module = FeaturesModule()
 
 def get_features_length(features):
@@ -398,19 +509,37 @@ def get_features_length(features):
     ff = core.ImageBase.get_feature_functions(features)
     return ff[1]
 
-def generate_features_list(list, features='all'):
+def generate_features_list(list, features='all', threads=0):
    """
    Generate features on a list of images.
 
    *features*
      Follows the same rules as for generate_features_.
+
+   *threads*
+     The built-in features are computed in C++ on *threads* threads
+     (all cores when 0), without holding the Python interpreter lock.
+     Other feature functions are called for each image in turn.
    """
    from gamera import core, util
    ff = core.Image.get_feature_functions(features)
-   progress = util.ProgressFactory("Generating features...", len(list) / 10)
+   functions, num_features = ff
+   glyphs = []
+   for glyph in list:
+      if glyph.feature_functions != ff:
+         glyph.feature_functions = ff
+         generate_features._prepare(glyph, num_features)
+         glyphs.append(glyph)
+   codes, others = generate_features._split_fused(functions)
+   if codes and len(glyphs):
+      _features._fused_features_list(glyphs, codes, threads)
+   if not others:
+      return
+   progress = util.ProgressFactory("Generating features...", len(glyphs) / 10)
    try:
-      for i, glyph in enumerate(list):
-         glyph.generate_features(ff)
+      for i, glyph in enumerate(glyphs):
+         for function, offset in others:
+            function.__call__(glyph, offset)
          if i % 10 == 0:
              progress.step()
    finally:
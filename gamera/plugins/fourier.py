@@ -0,0 +1,79 @@
+#
+# Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+"""Discrete Fourier transforms of images."""
+
+from gamera.plugin import *
+from gamera.__compiletime_config__ import has_openmp
+import _fourier
+
+class fft(PluginFunction):
+    """
+    Returns the two dimensional discrete Fourier transform of the image
+    as a COMPLEX image of the same size, with the zero frequency in the
+    upper left pixel.  As with ``numpy.fft.fft2``, the transform is not
+    scaled.
+
+    Any image size can be transformed; sizes whose prime factors are
+    small (2, 3 and 5 in particular) are fastest.  The transforms of
+    each row and column length are prepared once and kept for later
+    calls.  Real images are transformed two rows at a time.
+
+    *threads*
+      The number of threads among which the rows and columns of the
+      transform are divided.  When 0, as many threads as OpenMP provides
+      are used.
+    """
+    category = "Filter/Fourier"
+    self_type = ImageType([GREYSCALE, GREY16, FLOAT, COMPLEX])
+    args = Args([Int("threads", range=(0, 1024), default=0)])
+    return_type = ImageType([COMPLEX], "spectrum")
+    release_gil = True
+    def __call__(self, threads=0):
+        return _fourier.fft(self, threads)
+    __call__ = staticmethod(__call__)
+
+class inverse_fft(PluginFunction):
+    """
+    Returns the inverse two dimensional discrete Fourier transform of a
+    COMPLEX image, scaled by 1 / (*nrows* * *ncols*) so that
+    ``image.fft().inverse_fft()`` gives back the image (as a COMPLEX
+    image, whose real part can be taken with ``extract_real``).
+
+    *threads*
+      The number of threads, see fft_.
+    """
+    category = "Filter/Fourier"
+    self_type = ImageType([COMPLEX])
+    args = Args([Int("threads", range=(0, 1024), default=0)])
+    return_type = ImageType([COMPLEX])
+    release_gil = True
+    def __call__(self, threads=0):
+        return _fourier.inverse_fft(self, threads)
+    __call__ = staticmethod(__call__)
+
+class FourierModule(PluginModule):
+    cpp_headers = ["fourier.hpp"]
+    category = "Filter"
+    functions = [fft, inverse_fft]
+    author = "Michael Droettboom and Karl MacMillan"
+    url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
+module = FourierModule()
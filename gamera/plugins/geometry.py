@@ -20,6 +20,7 @@
 
 from gamera.plugin import *
 from gamera.args import NoneDefault
+from gamera.__compiletime_config__ import has_openmp
 import _geometry
 try:
   from gamera.core import RGBPixel
@@ -40,10 +41,21 @@ class voronoi_from_labeled_image(PluginFunction):
 
   .. __: segmentation.html#cc-analysis
 
-  The implementation applies a watershed algorithm to the distance transform
-  of the input image, a method known as *seeded region growing* (U. K\u00f6the:
-  *Primary Image Segmentation.* Proceedings 17th DAGM-Symposium, pp. 554-561,
-  Springer, 1995).
+  Every pixel gets the label of the labeled pixel with the smallest
+  Euclidean distance.  This is computed exactly and in linear time with
+  the separable feature transform of Meijster et al. (A. Meijster,
+  J.B.T.M. Roerdink, W.H. Hesselink: *A general algorithm for computing
+  distance transforms in linear time.* Mathematical Morphology and its
+  Applications to Image and Signal Processing, pp. 331-340, 2000).
+
+  *white_edges*
+    When ``True``, the unlabeled pixels where two Voronoi cells meet
+    are set to zero, so that the cells are separated by white edges.
+
+  *threads*
+    The number of threads for the column and row passes (0 means the
+    OpenMP default, usually the number of cores).  This requires Gamera
+    to be compiled with OpenMP support.
 
   The example shown below is the image *voronoi_cells* as created with
   the the following code:
@@ -61,6 +73,8 @@ class voronoi_from_labeled_image(PluginFunction):
   """
   self_type = ImageType([ONEBIT,GREYSCALE])
   return_type = ImageType([ONEBIT,GREYSCALE])
+  args = Args([Check("white_edges", default=False),
+               Int("threads", range=(0, 1024), default=0)])
   def __doc_example1__(images):
     image = images[ONEBIT]
     ccs = image.cc_analysis()
@@ -71,7 +85,7 @@ class voronoi_from_labeled_image(PluginFunction):
     voronoi_cells.highlight(voronoi_edges, RGBPixel(255,255,255))
     return [image, voronoi_cells]
   doc_examples = [__doc_example1__]
-  author = u"Christoph Dalitz, based on code by Ullrich K\u00f6the"
+  author = u"Christoph Dalitz"
 
 class voronoi_from_points(PluginFunction):
   """
@@ -85,13 +99,16 @@ class voronoi_from_points(PluginFunction):
   need not necessarily all be different, which can be useful as an 
   approximation of an area Voronoi tesselation.
 
-  The algorithm is very simple: it stores the points in a `kd-tree`_ and
-  then looks up the closest point for each image pixel. This has a runtime
-  of *O(N log(n))*, where *N* is the number of image pixels and *n* is the
-  number of points. For not too many points, this should be faster than the
-  morphological region growing approach of `voronoi_from_labeled_image`_.
+  The closest points are found row by row from the closest point in each
+  column that contains points, with the same exact separable algorithm as
+  in `voronoi_from_labeled_image`_. This has a runtime of
+  *O(R(C + c))*, where *R* and *C* are the number of rows and columns of
+  the image and *c* is the number of distinct point columns. Points at the
+  same distance are decided arbitrarily.
+
+  *threads*
+    The number of threads for bands of rows (0 means the OpenMP default).
 
-.. _`kd-tree`: kdtree.html
 .. _`voronoi_from_labeled_image`: #voronoi-from-labeled-image
 
   The example shown below is the image *voronoi_edges* as created with
@@ -109,7 +126,8 @@ class voronoi_from_points(PluginFunction):
        voronoi_edges.set(p,1)
   """
   self_type = ImageType([ONEBIT,GREYSCALE])
-  args = Args([PointVector("points"),IntVector("labels")])
+  args = Args([PointVector("points"),IntVector("labels"),
+               Int("threads", range=(0, 1024), default=0)])
   return_type = None
   def __doc_example1__(images):
     from gamera.core import Image
@@ -130,6 +148,11 @@ class labeled_region_neighbors(PluginFunction):
   (default), 8-connectivity is used for neighborship, otherwise
   4-connectivity is used.
 
+  Each pair is given as ``[label1, label2]`` with *label1* greater than
+  *label2*, and the pairs are sorted. The image is scanned once row by
+  row; bands of rows are scanned on *threads* threads (0 means the OpenMP
+  default, usually the number of cores).
+
   This can be useful for building a Delaunay graph from a Voronoi tesselation
   as in the following example:
 
@@ -162,12 +185,13 @@ class labeled_region_neighbors(PluginFunction):
 
   """
   self_type = ImageType([ONEBIT])
-  args = Args([Check("eight_connectivity",default=True)])
+  args = Args([Check("eight_connectivity",default=True),
+               Int("threads", range=(0, 1024), default=0)])
   return_type = Class("labelpairs")
   author = "Christoph Dalitz"
   # wrapper for passing default argument
-  def __call__(self, eight_connectivity=True):
-      return _geometry.labeled_region_neighbors(self, eight_connectivity)
+  def __call__(self, eight_connectivity=True, threads=0):
+      return _geometry.labeled_region_neighbors(self, eight_connectivity, threads)
   __call__ = staticmethod(__call__)
 
 class delaunay_from_points(PluginFunction):
@@ -182,13 +206,15 @@ class delaunay_from_points(PluginFunction):
   for the computation of a neighborship graph from a set of connected
   components.
 
-  The computation of the Delaunay triangulation is based on the Delaunay
-  tree which is a randomized geometric data structure. It is
-  described in O. Devillers, S. Meiser, M. Teillaud:
-  `Fully dynamic Delaunay triangulation in logarithmic expected time per operation.`__
-  Computational Geometry: Theory and Applications 2, pp. 55-80, 1992.
-
-.. __: http://hal.inria.fr/inria-00090678
+  The Delaunay triangulation is computed incrementally by the Bowyer-Watson
+  algorithm. The points are inserted in a biased randomized insertion order
+  (BRIO) with each round sorted along a Hilbert curve, as described in
+  N. Amenta, S. Choi, G. Rote: *Incremental constructions con BRIO.*
+  Proceedings of the 19th Symposium on Computational Geometry,
+  pp. 211-219, 2003. As consecutive points are thus close to each other,
+  each point is quickly found by walking through the triangulation from
+  the previously inserted point, so that the runtime is nearly linear
+  in the number of points.
 
   This can be useful for building a neighborhood graph as shown in the
   following example:
@@ -247,6 +273,15 @@ class graph_color_ccs(PluginFunction):
             2 = from the exact area Voronoi diagram
             (can be slow on large images)
 
+    *threads*:
+        The number of threads for the Voronoi diagram and for painting
+        the result (0 means the OpenMP default, usually the number of
+        cores).  This requires Gamera to be compiled with OpenMP support.
+
+    The neighborhood graph is built and colored in a compact array
+    form directly from the label pairs, and the pixels are painted
+    from a table of the colors of all labels.
+
     .. code:: Python
 
        ccs = imgage.cc_analysis()
@@ -264,11 +299,11 @@ class graph_color_ccs(PluginFunction):
     """
     category = "Color"
     author = "Oliver Christen and Tobias Bolten"
-    args = Args([ImageList('ccs'), Class('colors', klass=RGBPixel, list_of=True,default=NoneDefault), Choice('method', ["CC center", "20% contour points", "voronoi diagram"], default=1)])
+    args = Args([ImageList('ccs'), Class('colors', klass=RGBPixel, list_of=True,default=NoneDefault), Choice('method', ["CC center", "20% contour points", "voronoi diagram"], default=1), Int("threads", range=(0, 1024), default=0)])
     self_type = ImageType([ONEBIT])
     return_type = ImageType([RGB])
 
-    def __call__(image, ccs, colors=None, method=1):
+    def __call__(image, ccs, colors=None, method=1, threads=0):
       if colors == None:
         from gamera.core import RGBPixel
         colors = [ RGBPixel(150, 0, 0),
@@ -281,7 +316,7 @@ class graph_color_ccs(PluginFunction):
                    RGBPixel(0, 190, 255),
                    RGBPixel(230, 190, 20),
                    ]
-      return _geometry.graph_color_ccs(image, ccs, colors, method)
+      return _geometry.graph_color_ccs(image, ccs, colors, method, threads)
     __call__ = staticmethod(__call__)
 
 
@@ -289,8 +324,11 @@ class convex_hull_from_points(PluginFunction):
     """Returns the polygon vertices of the convex hull of the given list of
 points.
 
-The function uses Graham's scan algorithm as described e.g. in Cormen et al.:
-*Introduction to Algorithms.* 2nd ed., MIT Press, p. 949, 2001
+The vertices are listed as by Graham's scan (Cormen et al.:
+*Introduction to Algorithms.* 2nd ed., MIT Press, p. 949, 2001),
+starting at the topmost of the leftmost points, but are found with
+Andrew's monotone chain algorithm, which only needs the points sorted by
+their coordinates.
 """
     self_type = None
     args = Args([PointVector("points")])
@@ -314,6 +352,25 @@ cannot be a vertex point of the convex hull.
    author = "Christoph Dalitz"
 
 
+class convex_hulls(PluginFunction):
+   """Returns the convex hulls of all connected components *ccs* of the
+labeled image, i.e. the same list as
+
+.. code:: Python
+
+  [cc.convex_hull_as_points() for cc in ccs]
+
+with the vertex coordinates relative to the upper left corner of each
+component. The leftmost and rightmost pixels in each row of all
+components are found in a single scan of the image, and each hull is
+computed from these by the monotone chain algorithm, without sorting.
+Components without black pixels get an empty list.
+   """
+   self_type = ImageType([ONEBIT])
+   args = Args([ImageList("ccs")])
+   return_type = Class("hulls")
+
+
 class convex_hull_as_image(PluginFunction):
    """Returns an image containing the polygon of the convex hull calculated
 by convex_hull_as_points_.
@@ -364,6 +421,50 @@ April 1998.
    doc_examples = [__doc_example1__]
 
 
+class max_empty_rects(PluginFunction):
+   """Returns up to *n* maximal empty rectangles that do not intersect any
+of the bounding boxes *ccs*, in the order of decreasing area. This is
+T. Breuel's branch-and-bound algorithm for a *maximal whitespace cover*.
+As it works on bounding boxes rather than on pixels, it is much faster
+than repeated calls of max_empty_rect_ and well suited for finding column
+gutters and other whitespace separators in page layout analysis.
+
+Each rectangle is considered as an obstacle for all subsequent rectangles,
+so that the returned rectangles do not overlap.
+
+*ccs*
+  The obstacles, usually the connected components of the image. When
+  omitted, ``cc_analysis`` is run on a copy of the image.
+
+*n*
+  The maximum number of rectangles returned.
+
+*min_width*, *min_height*
+  Only rectangles of at least this width and height are returned. Large
+  values prune the search considerably, e.g. a large *min_height* in
+  combination with a small *min_width* returns column gutters.
+
+The coordinates of the returned rectangles are relative to the upper left
+corner of the image, as for max_empty_rect_.
+
+Reference: T. Breuel: `\"Two Geometric Algorithms for Layout Analysis.\"`__
+Document Analysis Systems V, LNCS 2423, pp. 188-199, 2002.
+
+.. __: http://dx.doi.org/10.1007/3-540-45869-7_23
+   """
+   self_type = ImageType([ONEBIT])
+   args = Args([ImageList("ccs"), Int("n", range=(0, 1000000), default=10),
+                Int("min_width", default=1), Int("min_height", default=1)])
+   return_type = Class("rects")
+   author = "Christoph Dalitz"
+
+   def __call__(image, ccs=None, n=10, min_width=1, min_height=1):
+       if ccs is None:
+           ccs = image.image_copy().cc_analysis()
+       return _geometry.max_empty_rects(image, ccs, n, min_width, min_height)
+   __call__ = staticmethod(__call__)
+
+
 class GeometryModule(PluginModule):
   cpp_headers = ["geometry.hpp"]
   category = "Geometry"
@@ -376,10 +477,15 @@ class GeometryModule(PluginModule):
                graph_color_ccs,
                convex_hull_from_points,
                convex_hull_as_points,
+               convex_hulls,
                convex_hull_as_image,
-               max_empty_rect]
+               max_empty_rect,
+               max_empty_rects]
   author = "Christoph Dalitz"
   url = "http://gamera.sourceforge.net/"
+  if has_openmp:
+    extra_compile_args = ["-fopenmp"]
+    extra_link_args = ["-fopenmp"]
 
 module = GeometryModule()
 
@@ -62,6 +62,42 @@ class to_buffer_colorize(PluginFunction):
                  Int("red"), Int("green"), Int("blue"),
                  Bool("invert")])
 
+class to_buffer_tiled(PluginFunction):
+    """
+    Encodes the *width* x *height* display pixels at (*x*, *y*) of the
+    image shown at *scaling* into a 'buffer' required by wx.Image
+    (i.e. 8-bit RGB triplets), as ``to_rgb`` followed by scale_ would
+    (or downscale_area_ when *scaling* is less than one).  *x* and *y*
+    are relative to the upper left of the image, in display pixels.
+
+    *scaling* must be a whole number or one over a whole number.  The
+    image is rendered in tiles that are kept with it until its pixels
+    or the *scaling* change, so that scrolling the display only renders
+    the part that comes into view.
+
+    .. _scale: transformation.html#scale
+    .. _downscale_area: transformation.html#downscale-area
+    """
+    self_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB])
+    args = Args([Class("Buffer"), Int("x"), Int("y"),
+                 Int("width"), Int("height"), Float("scaling")])
+    read_only = True
+
+class draw_ccs_to_buffer(PluginFunction):
+    """
+    Draws the black pixels of the *ccs* in the given color over a buffer
+    filled by to_buffer_tiled_ with the same arguments, as draw_cc_
+    would before the image is scaled.
+
+    .. _to_buffer_tiled: #to-buffer-tiled
+    .. _draw_cc: #draw-cc
+    """
+    self_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB])
+    args = Args([Class("Buffer"), Int("x"), Int("y"),
+                 Int("width"), Int("height"), Float("scaling"),
+                 ImageList("ccs"), Int("red"), Int("green"), Int("blue")])
+    read_only = True
+
 class color_ccs(PluginFunction):
     """
     Returns an RGB image where each connected component of the
@@ -108,7 +144,7 @@ class GuiSupportModule(PluginModule):
     category = None
     cpp_headers = ["gui_support.hpp"]
     functions = [to_string, to_buffer, to_buffer_colorize, color_ccs,
-                 draw_cc]
+                 draw_cc, to_buffer_tiled, draw_ccs_to_buffer]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
     
@@ -122,6 +122,46 @@ class match_id_name(PluginFunction):
         return 0
     __call__ = staticmethod(__call__)
 
+class IdNameMatcher:
+    """Matches symbol names against a set of the special-purpose
+    regular expressions of match_id_name at once.
+
+    Each distinct name is tested against the expressions only the
+    first time it is seen; the expressions it matches are then kept,
+    so that the expressions a glyph matches are found with a single
+    dictionary lookup of its main id (see RuleEngine)."""
+    def __init__(self, regexs=[]):
+        self._regexs = []
+        self._names = {}
+        for regex in regexs:
+            self.add(regex)
+
+    def add(self, regex):
+        for r, compiled in self._regexs:
+            if r == regex:
+                return
+        compiled = regex_cache.get(regex, None)
+        if compiled is None:
+            compiled = build_id_regex(regex)
+            regex_cache[regex] = compiled
+        self._regexs.append((regex, compiled))
+        for name, matches in self._names.items():
+            if compiled.match(name):
+                self._names[name] = matches + (regex,)
+
+    def get_regexs(self):
+        return [regex for regex, compiled in self._regexs]
+
+    def match(self, name):
+        """Returns the tuple of the expressions matching name, in the
+        order in which they were added."""
+        matches = self._names.get(name)
+        if matches is None:
+            matches = tuple([regex for regex, compiled in self._regexs
+                             if compiled.match(name)])
+            self._names[name] = matches
+        return matches
+
 _valid = string.letters + string.digits + "_"
 def id_name_to_identifier(symbol):
     while len(symbol) and symbol[0] == '.':
@@ -125,6 +125,8 @@ class to_onebit(PluginFunction):
     """
     Converts the given image to a ONEBIT image. First the image is converted
     and then the otsu_threshold_ algorithm is applied.
+    (Dense ONEBIT images are made from RGB images directly, without
+    creating the GREYSCALE image in between.)
     For other ways to convert to ONEBIT images, see the Binarization_ category.
 
     Converting an image to one of the same type performs a copy operation.
@@ -132,15 +134,13 @@ class to_onebit(PluginFunction):
     .. _otsu_threshold: binarization.html#otsu-threshold
     .. _Binarization: binarization.html
     """
-    pure_python = True
     self_type = ImageType([FLOAT, GREYSCALE, GREY16, RGB, COMPLEX])
+    args = Args([Choice("storage_format", ["DENSE", "RLE", "PACKED"])])
     return_type = ImageType([ONEBIT], "onebit")
     def __call__(self, storage_format=DENSE):
         if self.data.pixel_type == ONEBIT:
             return self.image_copy()
-        if self.data.pixel_type != GREYSCALE:
-            self = _image_conversion.to_greyscale(self)
-        return self.otsu_threshold(storage_format)
+        return _image_conversion.to_onebit(self, storage_format)
     __call__ = staticmethod(__call__)
     doc_examples = [(RGB,), (GREYSCALE,)]
 to_onebit = to_onebit
@@ -165,7 +165,7 @@ class ImageConversionModule(PluginModule):
     category = "Conversion"
     cpp_headers=["image_conversion.hpp"]
     functions = [to_rgb, to_greyscale, to_grey16, to_float,
-                 to_onebit, to_onebit, to_complex, extract_real,
+                 to_onebit, to_complex, extract_real,
                  extract_imaginary]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
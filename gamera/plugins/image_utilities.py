@@ -25,7 +25,8 @@ from gamera.plugin import *
 from gamera.gui import has_gui
 from gamera.util import warn_deprecated
 from gamera.args import NoneDefault
-import sys
+from gamera.__compiletime_config__ import has_openmp
+import sys, os, binascii
 import _image_utilities
 
 class image_copy(PluginFunction):
@@ -33,6 +34,12 @@ class image_copy(PluginFunction):
     Copies an image along with all of its underlying data.  Since the data is
     copied, changes to the new image do not affect the original image.
 
+    A DENSE copy of a dense image that is not a view on part of a larger
+    image shares the pixels of the original until either of them is
+    changed, so that copies which are only read cost no time or memory.
+    The pixels are copied when the first plugin method that is not
+    ``read_only`` is called on either image, or a pixel is set.
+
     *storage_format*
       specifies the compression type for the returned copy:
 
@@ -40,17 +47,146 @@ class image_copy(PluginFunction):
       no compression
     RLE (1)
       run-length encoding compression
+    PACKED (2)
+      bit-packed, one bit per pixel (OneBit only)
     """
     category = "Utility"
     self_type = ImageType(ALL)
     return_type = ImageType(ALL)
-    args = Args([Choice("storage_format", ["DENSE", "RLE"])])
+    args = Args([Choice("storage_format", ["DENSE", "RLE", "PACKED"])])
+    read_only = True
     def __call__(image, storage_format = 0):
         if image.nrows <= 0 or image.ncols <= 0:
             return image
         return _image_utilities.image_copy(image, storage_format)
     __call__ = staticmethod(__call__)
 
+class to_shared_memory(PluginFunction):
+    """
+    Returns a DENSE copy of the image whose pixels are kept in POSIX
+    shared memory, so that other processes can use the same pixels
+    instead of a copy of them.  The shared_memory_handle_ of the copy
+    can be pickled (for instance by ``multiprocessing``) and attached
+    in the other process, which takes no time regardless of the size
+    of the image.
+
+    All processes that attached the pixels see each other's changes of
+    them.  The pixels can be attached as long as the copy returned
+    here (or an image sharing its data) exists; images that were
+    attached keep their pixels after that.
+
+    *name*
+      The name of the shared memory object, which must start with a
+      slash and must not exist yet.  When empty, a name of the form
+      ``/gamera-<pid>-<random>`` is used.
+
+    Only available on POSIX systems.
+    """
+    category = "Utility"
+    self_type = ImageType(ALL)
+    return_type = ImageType(ALL)
+    args = Args([String("name", default="")])
+    def __call__(image, name=""):
+        if name == "":
+            name = "/gamera-%d-%s" % (os.getpid(),
+                                      binascii.hexlify(os.urandom(8)))
+        return _image_utilities.to_shared_memory(image, name)
+    __call__ = staticmethod(__call__)
+
+class SharedImageHandle:
+    """A picklable reference to an image whose pixels are in shared
+    memory (see shared_memory_handle_).  *attach* () returns an image
+    on the same pixels."""
+    def __init__(self, data, pixel_type, rect):
+        self.name, self.data_ncols, self.data_nrows, \
+                   self.data_ul_x, self.data_ul_y = data
+        self.pixel_type = pixel_type
+        self.ul_x, self.ul_y, self.ncols, self.nrows = rect
+
+    def attach(self):
+        image = attach_shared_memory(self.name, self.pixel_type,
+                                     self.data_ncols, self.data_nrows,
+                                     self.data_ul_x, self.data_ul_y)
+        if (self.ul_x, self.ul_y, self.ncols, self.nrows) != \
+               (self.data_ul_x, self.data_ul_y,
+                self.data_ncols, self.data_nrows):
+            from gamera.core import Rect, Point, Dim
+            image = image.subimage(Rect(Point(self.ul_x, self.ul_y),
+                                        Dim(self.ncols, self.nrows)))
+        return image
+
+class shared_memory_handle(PluginFunction):
+    """
+    Returns a SharedImageHandle for an image whose pixels are in shared
+    memory (see to_shared_memory_).  The handle can be pickled and sent
+    to another process, where its *attach* () method returns an image
+    on the same pixels:
+
+    .. code:: Python
+
+      shared = image.to_shared_memory()
+      queue.put(shared.shared_memory_handle())
+      # in the other process
+      image = queue.get().attach()
+
+    For a view on part of the pixels (such as a connected component),
+    the attached image is a view on the same region.
+    """
+    category = "Utility"
+    self_type = ImageType(ALL)
+    return_type = Class("handle")
+    pure_python = True
+    def __call__(image):
+        data = _image_utilities._shared_memory_data(image)
+        if data is None:
+            raise ValueError("The pixels of the image are not in shared memory (see to_shared_memory).")
+        return SharedImageHandle(data, image.data.pixel_type,
+                                 (image.ul_x, image.ul_y,
+                                  image.ncols, image.nrows))
+    __call__ = staticmethod(__call__)
+
+class _shared_memory_data(PluginFunction):
+    """
+    Returns the name, size and offset of the shared memory pixels of the
+    image as a tuple (name, ncols, nrows, ul_x, ul_y), or None.
+
+    This function is not intended to be used directly; see
+    shared_memory_handle_.
+    """
+    self_type = ImageType(ALL)
+    return_type = Class("data")
+
+class attach_shared_memory(PluginFunction):
+    """
+    Returns an image on the pixels in the POSIX shared memory object
+    *name*, which another process made with to_shared_memory_.  Usually
+    called through the *attach* () method of a shared_memory_handle_.
+
+    *name*
+      The name of the shared memory object
+
+    *pixel_type*
+      The type of the pixels
+
+    *ncols*, *nrows*, *ul_x*, *ul_y*
+      The size and offset of the image
+    """
+    category = "Utility"
+    self_type = None
+    args = Args([String("name"),
+                 Choice("pixel_type",
+                        ["ONEBIT", "GREYSCALE", "GREY16", "RGB", "FLOAT",
+                         "COMPLEX"]),
+                 Int("ncols", range=(1, 2147483647)),
+                 Int("nrows", range=(1, 2147483647)),
+                 Int("ul_x", range=(0, 2147483647), default=0),
+                 Int("ul_y", range=(0, 2147483647), default=0)])
+    return_type = ImageType(ALL)
+    def __call__(name, pixel_type, ncols, nrows, ul_x=0, ul_y=0):
+        return _image_utilities.attach_shared_memory(name, pixel_type, ncols,
+                                                     nrows, ul_x, ul_y)
+    __call__ = staticmethod(__call__)
+
 class image_save(PluginFunction):
     """
     Saves an image to file with specified name and format.
@@ -313,14 +449,82 @@ class diff_images(PluginFunction):
         return result
     __call__ = staticmethod(__call__)
 
+COMPARE_TYPES = [ONEBIT, GREYSCALE, GREY16, RGB, FLOAT]
+
 class mse(PluginFunction):
     """
-    Calculates the mean square error between two images.
+    Calculates the mean square error between two images of the same
+    type and size.  For RGB images, the error is averaged over the
+    three channels.  See compare_images_ for the other measures of the
+    difference.
     """
     category = "Utility"
-    self_type = ImageType([RGB])
-    args = Args([ImageType([RGB])])
+    self_type = ImageType(COMPARE_TYPES)
+    args = Args([ImageType(COMPARE_TYPES, 'other')])
     return_type = Float()
+    image_types_must_match = True
+
+class compare_images(PluginFunction):
+    """
+    Compares the image with another image of the same type and size,
+    without creating a difference image, and returns a dictionary with
+
+    *mse*
+      the mean square error of the pixel values, as in mse_.
+
+    *psnr*
+      the peak signal-to-noise ratio in decibels, for a peak value of
+      255 for GREYSCALE and RGB images, 65535 for GREY16 images and
+      1 for ONEBIT and FLOAT images.  It is infinite for equal images.
+
+    *differing*
+      the number of pixels that differ.
+
+    *bbox*
+      the bounding box of the pixels that differ, as a Rect in the
+      coordinates of this image, or None when no pixel differs.
+
+    ONEBIT pixels differ when one is black and the other white, so
+    that labeled images compare equal to their unlabeled versions.
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
+
+    To compare many pairs of images, compare_image_pairs_ runs the
+    comparisons in parallel.
+
+    .. code:: Python
+
+      result = page.compare_images(reference)
+      if result['differing']:
+          print "pages differ within", result['bbox']
+    """
+    category = "Utility"
+    self_type = ImageType(COMPARE_TYPES)
+    args = Args([ImageType(COMPARE_TYPES, 'other'),
+                 Int('threads', range=(0, 1024), default=0)])
+    return_type = Class("comparison")
+    image_types_must_match = True
+
+class compare_image_pairs(PluginFunction):
+    """
+    Compares the images of the list *images* with the corresponding
+    images of the list *others* as compare_images_ does, and returns
+    the list of the results.  Both images of a pair must have the same
+    pixel type, storage type and size.
+
+    The pairs are compared in parallel on *threads* threads (0 means
+    the OpenMP default, usually the number of cores).
+    """
+    category = "Utility"
+    self_type = None
+    args = Args([ImageList('images'), ImageList('others'),
+                 Int('threads', range=(0, 1024), default=0)])
+    return_type = Class("comparisons")
+    def __call__(images, others, threads=0):
+        return _image_utilities.compare_image_pairs(images, others, threads)
+    __call__ = staticmethod(__call__)
 
 class reset_onebit_image(PluginFunction):
     """
@@ -401,18 +605,29 @@ class UtilModule(PluginModule):
     cpp_headers=["image_utilities.hpp"]
     category = None
     functions = [image_save, image_copy,
+                 to_shared_memory, shared_memory_handle,
+                 _shared_memory_data, attach_shared_memory,
                  histogram, union_images,
                  fill_white, fill, pad_image, pad_image_default, trim_image,
 		 invert, clip_image, mask,
                  nested_list_to_image, to_nested_list,
-                 diff_images, mse, reset_onebit_image,
+                 diff_images, mse, compare_images,
+                 compare_image_pairs, reset_onebit_image,
                  ccs_from_labeled_image,
                  min_max_location, min_max_location_nomask]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
+    # shm_open
+    if sys.platform.startswith("linux"):
+        extra_libraries = ["rt"]
 module = UtilModule()
 
 union_images = union_images()
 nested_list_to_image = nested_list_to_image()
+compare_image_pairs = compare_image_pairs()
+attach_shared_memory = attach_shared_memory()
 
 del pad_image_default
@@ -23,7 +23,8 @@ import _logical
 class LogicalCombine(PluginFunction):
   self_type = ImageType([ONEBIT])
   return_type = ImageType([ONEBIT])
-  args = Args([ImageType([ONEBIT], "other"), Check("in_place", default=False)])
+  args = Args([ImageType([ONEBIT], "other"), Check("in_place", default=False),
+               Int("threads", range=(0, 1024), default=0)])
 
 class and_image(LogicalCombine):
   """
@@ -36,10 +37,14 @@ class and_image(LogicalCombine):
     If true, the operation will be performed in-place, changing the
     contents of the current image.
 
+  *threads*
+    The number of threads for large images (0 means the OpenMP default,
+    usually the number of cores).
+
   See or_image_ for some usage examples.
   """
-  def __call__(self, other, in_place=False):
-    return _logical.and_image(self, other, in_place)
+  def __call__(self, other, in_place=False, threads=0):
+    return _logical.and_image(self, other, in_place, threads)
   __call__ = staticmethod(__call__)
 
   def __doc_example1__(images):
@@ -60,6 +65,10 @@ class or_image(LogicalCombine):
     If true, the operation will be performed in-place, changing the
     contents of the current image.
 
+  *threads*
+    The number of threads for large images (0 means the OpenMP default,
+    usually the number of cores).
+
   Usage examples:
 
   Using logical functions in different ways will generally involve
@@ -107,8 +116,8 @@ class or_image(LogicalCombine):
     # cc: a cc on that image
     src.clip_image(cc).xor_image(cc, True)
   """
-  def __call__(self, other, in_place=False):
-    return _logical.or_image(self, other, in_place)
+  def __call__(self, other, in_place=False, threads=0):
+    return _logical.or_image(self, other, in_place, threads)
   __call__ = staticmethod(__call__)
 
   def __doc_example1__(images):
@@ -129,10 +138,14 @@ class xor_image(LogicalCombine):
     If true, the operation will be performed in-place, changing the
     contents of the current image.
 
+  *threads*
+    The number of threads for large images (0 means the OpenMP default,
+    usually the number of cores).
+
   See or_image_ for some usage examples.
   """
-  def __call__(self, other, in_place=False):
-    return _logical.xor_image(self, other, in_place)
+  def __call__(self, other, in_place=False, threads=0):
+    return _logical.xor_image(self, other, in_place, threads)
   __call__ = staticmethod(__call__)
 
   def __doc_example1__(images):
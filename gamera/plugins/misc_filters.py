@@ -20,6 +20,7 @@
 #
 
 from gamera.plugin import *
+from gamera.__compiletime_config__ import has_openmp
 import _misc_filters
 
 class rank(PluginFunction):
@@ -42,19 +43,37 @@ class rank(PluginFunction):
   *border_treatment* (0, 1)
     When 0 ('padwhite'), window pixels outside the image are set to white.
     When 1 ('reflect'), reflecting boundary conditions are used.
+
+  *threads*
+    The number of threads among which the rows are divided.  When 0,
+    as many threads as OpenMP provides are used.
+
+  *in_place*
+    When True, the result is written to the image itself, which is
+    returned, instead of to a new image (not for connected components).
+
+  The time per pixel hardly depends on *k*: the histograms of the
+  columns of the window are kept from row to row, and the histogram of
+  the window is updated from them (S. Perreault and P. Hebert: Median
+  Filtering in Constant Time.  IEEE Transactions on Image Processing 16,
+  pp. 2389-2394, 2007).  The bins are the distinct pixel values of the
+  image, grouped into coarse bins, so that GREY16 and FLOAT images are
+  filtered the same way.
   """
   self_type = ImageType([ONEBIT, GREYSCALE, GREY16, FLOAT])
   args = Args([Int('rank'), Int('k', default=3),
-               Choice('border_treatment', ['padwhite', 'reflect'], default=1)])
+               Choice('border_treatment', ['padwhite', 'reflect'], default=1),
+               Int('threads', range=(0, 1024), default=0),
+               Check('in_place', default=False)])
   return_type = ImageType([ONEBIT, GREYSCALE, GREY16, FLOAT])
   author = "Christoph Dalitz and David Kolanus"
   doc_examples = [(GREYSCALE, 2), (GREYSCALE, 5), (GREYSCALE, 8)]
-  def __call__(self, rank, k=3, border_treatment=1):
+  def __call__(self, rank, k=3, border_treatment=1, threads=0, in_place=False):
     if k%2 == 0:
       raise RuntimeError("rank: window size k must be odd")
     if rank < 1 or rank > k*k:
       raise RuntimeError("rank: rank must be between 1 and k*k")
-    return _misc_filters.rank(self, rank, k, border_treatment)
+    return _misc_filters.rank(self, rank, k, border_treatment, threads, in_place)
   __call__ = staticmethod(__call__)
 
 class mean(PluginFunction):
@@ -65,17 +84,23 @@ class mean(PluginFunction):
   *k* is the window size (must be odd), and *border_treatment* can
   be 0 ('padwhite'), which sets window pixels outside the image to white,
   or 1 ('reflect'), for reflecting boundary conditions.
+
+  When *in_place* is True, the result is written to the image itself,
+  which is returned, instead of to a new image (not for connected
+  components).  Only the (*k* - 1) / 2 rows above the current one are
+  then kept aside.
   """
   self_type = ImageType([ONEBIT, GREYSCALE, GREY16, FLOAT])
   args = Args([Int('k', default=3),
-               Choice('border_treatment', ['padwhite', 'reflect'], default=1)])
+               Choice('border_treatment', ['padwhite', 'reflect'], default=1),
+               Check('in_place', default=False)])
   doc_examples = [(GREYSCALE,)]
   return_type = ImageType([ONEBIT, GREYSCALE, GREY16, FLOAT])
   author = "David Kolanus"
-  def __call__(self, k=3, border_treatment=1):
+  def __call__(self, k=3, border_treatment=1, in_place=False):
     if k%2 == 0:
       raise RuntimeError("mean: window size k must be odd")
-    return _misc_filters.mean(self, k, border_treatment)
+    return _misc_filters.mean(self, k, border_treatment, in_place)
   __call__ = staticmethod(__call__)
 
 class min_max_filter(PluginFunction):
@@ -85,7 +110,9 @@ class min_max_filter(PluginFunction):
 
     *k* is the window size (must be odd) and *filter* is the filter type
     (0 for min, 1 for max). When *k_vertical* is nonzero, the vertical size of
-    the window is set to *k_vertical* instead of *k*.
+    the window is set to *k_vertical* instead of *k*.  When *in_place* is
+    True, the result is written to the image itself, which is returned,
+    instead of to a new image (not for connected components).
 
     This function does the same as *rank(1,k,border_treatment=1)*, but is
     much faster because the runtime of *min_max_filter* is constant in
@@ -103,16 +130,17 @@ class min_max_filter(PluginFunction):
     self_type = ImageType([ONEBIT, GREYSCALE, GREY16, FLOAT])
     args = Args([Int('k', default=3),
                  Choice('filter', ['min', 'max'], default=0),
-                 Int('k_vertical', default=0)])
+                 Int('k_vertical', default=0),
+                 Check('in_place', default=False)])
     return_type = ImageType([ONEBIT, GREYSCALE, GREY16, FLOAT])
     author = "David Kolanus"
     doc_examples = [(GREYSCALE,)]
-    def __call__(self, k=3, filter=0, k_vertical=0):
+    def __call__(self, k=3, filter=0, k_vertical=0, in_place=False):
         if k%2 == 0:
             raise RuntimeError("min_max_filter: window size k must be odd")
         if k_vertical != 0 and k_vertical%2 == 0:
             raise RuntimeError("min_max_filter: k_vertical must be zero or odd")
-        return _misc_filters.min_max_filter(self, k, filter, k_vertical)
+        return _misc_filters.min_max_filter(self, k, filter, k_vertical, in_place)
     __call__ = staticmethod(__call__)
 
 class create_gabor_filter(PluginFunction):
@@ -144,6 +172,45 @@ class create_gabor_filter(PluginFunction):
     __call__ = staticmethod(__call__)
     
 
+class gabor_filter_bank(PluginFunction):
+    """
+    Filters the image with a bank of Gabor filters, one for each
+    combination of the *frequencies* and *orientations* (given in
+    radians), and returns the list of responses, the orientations varying
+    fastest.  *direction* determines the angular sigma as in
+    create_gabor_filter_.
+
+    The image is Fourier transformed only once, and each response is the
+    inverse transform of its product with the filter as computed by
+    create_gabor_filter_ (with circular boundary conditions).  The
+    responses are complex images; their magnitude is the local energy of
+    the texture in the frequency band of the filter.
+
+    *block_size*
+      When nonzero, only the mean energy (squared magnitude) of the
+      response in each *block_size* times *block_size* block is returned
+      for each filter, as a float image with one pixel per block.  This
+      needs memory for one response instead of all of them.
+
+    *threads*
+      The number of threads among which the rows and columns of each
+      transform are divided.  When 0, as many threads as OpenMP provides
+      are used.
+    """
+    self_type = ImageType([GREYSCALE, GREY16, FLOAT])
+    args = Args([FloatVector("orientations"), FloatVector("frequencies"),
+                 Int("direction", default=5),
+                 Int("block_size", range=(0, 65536), default=0),
+                 Int("threads", range=(0, 1024), default=0)])
+    return_type = ImageList("responses")
+    release_gil = True
+    def __call__(self, orientations, frequencies, direction=5, block_size=0,
+                 threads=0):
+        return _misc_filters.gabor_filter_bank(self, orientations, frequencies,
+                                               direction, block_size, threads)
+    __call__ = staticmethod(__call__)
+
+
 class kfill(PluginFunction):
     """
     Removes salt and pepper noise in onebit images by applying the *kfill*
@@ -209,8 +276,11 @@ class kfill_modified(PluginFunction):
 class MiscFiltersModule(PluginModule):
     category = "Filter"
     functions = [mean, rank, min_max_filter, create_gabor_filter,
-                 kfill, kfill_modified]
+                 gabor_filter_bank, kfill, kfill_modified]
     cpp_headers = ["misc_filters.hpp"]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
 module = MiscFiltersModule()
@@ -21,6 +21,7 @@
 from gamera.plugin import *
 from gamera.util import warn_deprecated
 from gamera import config
+from gamera.__compiletime_config__ import grey16_native, float_single
 
 try:
     import numpy.numarray as n
@@ -34,14 +35,15 @@ except ImportError:
 else:
     _typecodes = {RGB       : n.UInt8,
                   GREYSCALE : n.UInt8,
-                  GREY16    : n.UInt32,
+                  GREY16    : grey16_native and n.UInt16 or n.UInt32,
                   ONEBIT    : n.UInt16,
-                  FLOAT     : n.Float64,
+                  FLOAT     : float_single and n.Float32 or n.Float64,
                   COMPLEX   : n.Complex64 }
     _inverse_typecodes = { n.UInt8     : GREYSCALE,
                            n.UInt32    : GREY16,
                            n.UInt16    : ONEBIT,
                            n.Float64   : FLOAT,
+                           n.Float32   : FLOAT,
                            n.Complex64 : COMPLEX } 
         
     class from_numarray(PluginFunction):
@@ -95,7 +97,7 @@ else:
                 offset,
                 Dim(array.shape[1], array.shape[0]),
                 pixel_type, DENSE,
-                array.tostring())
+                array.astype(_typecodes[pixel_type]).tostring())
         __call__ = staticmethod(__call__)
 
         def _check_input(array):
@@ -106,7 +108,7 @@ else:
             elif len(shape) == 2:
                 if _inverse_typecodes.has_key(typecode):
                     return _inverse_typecodes[typecode]
-            raise ValueError('Array is not one of the acceptable types (UInt8 * 3, UInt8, UInt16, UInt32, Float64, Complex64)')
+            raise ValueError('Array is not one of the acceptable types (UInt8 * 3, UInt8, UInt16, UInt32, Float32, Float64, Complex64)')
         _check_input = staticmethod(_check_input)
 
     class to_numarray(PluginFunction):
@@ -20,6 +20,7 @@
 
 from gamera.plugin import *
 from gamera import config
+from gamera.__compiletime_config__ import grey16_native, float_single
 
 try:
     import numpy as n
@@ -33,14 +34,15 @@ except ImportError:
 else:
     _typecodes = {RGB       : n.dtype('uint8'),
                   GREYSCALE : n.dtype('uint8'),
-                  GREY16    : n.dtype('uint32'),
+                  GREY16    : n.dtype(grey16_native and 'uint16' or 'uint32'),
                   ONEBIT    : n.dtype('uint16'),
-                  FLOAT     : n.dtype('float64'),
+                  FLOAT     : n.dtype(float_single and 'float32' or 'float64'),
                   COMPLEX   : n.dtype('complex128') }
     _inverse_typecodes = { n.dtype('uint8')     : GREYSCALE,
                            n.dtype('uint32')    : GREY16,
                            n.dtype('uint16')    : ONEBIT,
                            n.dtype('float64')   : FLOAT,
+                           n.dtype('float32')   : FLOAT,
                            n.dtype('complex128') : COMPLEX } 
         
     class from_numpy(PluginFunction):
@@ -69,7 +71,15 @@ else:
         | COMPLEX    | complex128       |
         +------------+------------------+
 
-        Requires two copying operations;  may fail for very large images.
+        By default, the pixels are copied once.  With *copy* = False, the
+        image uses the memory of the array itself (which must then be C
+        contiguous and writable), so that changes to the image change
+        the array and vice versa.  When Gamera is built with
+        ``--grey16=native``, GREY16 pixels are 16 bits wide, and uint32
+        arrays can only be copied (the values are truncated to 16 bits).
+        float32 arrays are copied into FLOAT images, unless Gamera is built
+        with ``--float=single``, and then float64 arrays can only be
+        copied.
 
         To use this function, which is not a method on images, do the
         following:
@@ -83,15 +93,12 @@ else:
         args = Args([Class("array")])
         return_type = ImageType(ALL)
         pure_python = True
-        def __call__(array, offset=(0, 0)):
+        def __call__(array, offset=(0, 0), copy=True):
             from gamera.plugins import _string_io
-            from gamera.core import Dim
             pixel_type = from_numpy._check_input(array)
-            return _string_io._from_raw_string(
-                offset,
-                Dim(array.shape[1], array.shape[0]),
-                pixel_type, DENSE,
-                array.tostring())
+            if copy:
+                array = n.array(array, _typecodes[pixel_type], order='C')
+            return _string_io._from_buffer(offset, pixel_type, array)
         __call__ = staticmethod(__call__)
 
         def _check_input(array):
@@ -103,12 +110,14 @@ else:
             elif len(shape) == 2:
                 if _inverse_typecodes.has_key(typecode):
                     return _inverse_typecodes[typecode]
-            raise ValueError('Array is not one of the acceptable types (uint8 * 3, uint8, uint16, uint32, float64, complex128)')
+            raise ValueError('Array is not one of the acceptable types (uint8 * 3, uint8, uint16, uint32, float32, float64, complex128)')
         _check_input = staticmethod(_check_input)
 
     class to_numpy(PluginFunction):
         """
-        Returns an ``Numeric`` array containing a copy of the image's data.
+        Returns an ``Numeric`` array containing a copy of the image's data,
+        or with *copy* = False, an array using the image's data itself
+        (which is only valid as long as the image is not resized).
 
         The array will be one of the following types corresponding to
         each of the Gamera image types:
@@ -131,7 +140,12 @@ else:
         | COMPLEX    | complex128      |
         +------------+-----------------+
 
-        Requires *three* copies, and may fail for very large images.
+        When Gamera is built with ``--grey16=native``, GREY16 images give
+        uint16 arrays, and with ``--float=single``, FLOAT images give
+        float32 arrays.
+
+        The pixels are passed to numpy through the buffer protocol, so
+        only a view on part of a page needs more than one copy.
 
         This method can be used for utilizing special functions present in
         numpy. If you need to compute the discrete fourier transform of
@@ -148,15 +162,23 @@ else:
         self_type = ImageType(ALL)
         return_type = Class("array")
         pure_python = True
-        def __call__(image):
+        def __call__(image, copy=True):
             from gamera.plugins import _string_io
             pixel_type = image.data.pixel_type
             shape = (image.nrows, image.ncols)
             typecode = _typecodes[pixel_type]
             if pixel_type == RGB:
                 shape += (3,)
-            array = n.fromstring(_string_io._to_raw_string(image), typecode)
-            return n.resize(array, shape)
+            try:
+                buffer = memoryview(image)
+            except BufferError:
+                # RLE images and connected components
+                array = n.fromstring(_string_io._to_raw_string(image), typecode)
+                return n.resize(array, shape)
+            array = n.asarray(buffer)
+            if copy:
+                array = array.copy()
+            return array
         __call__ = staticmethod(__call__)
 
         def __doc_example1__(images):
@@ -71,6 +71,182 @@ class projection_cutting(PluginFunction):
 	    return _pagesegmentation.projection_cutting(image, Tx, Ty, noise, gap_treatment)
     __call__ = staticmethod(__call__)
 
+class LayoutNode:
+    """
+    A node of a LayoutTree_, that is one step of the recursive cutting
+    of projection_cutting_.
+
+    *region*
+      the Rect that the parent node cut out (the whole image for the
+      root).
+
+    *bbox*
+      the bounding box of the black pixels in *region*.
+
+    *direction*
+      'x' when the node is cut at the gaps between rows, 'y' when at
+      the gaps between columns.
+
+    *splits*
+      the split points of the cut, as pairs of the first and last row
+      (or column) of each part.
+
+    *label*
+      the label of the segment for the leaves, 0 for the other nodes.
+
+    *children*
+      the parts between the split points, from top to bottom or from
+      left to right.
+    """
+    def __init__(self, region, bbox, direction, splits, label):
+        self.region = region
+        self.bbox = bbox
+        self.direction = direction
+        self.splits = splits
+        self.label = label
+        self.children = []
+
+    def segments(self):
+        """The leaves below the node in reading order."""
+        if not self.children:
+            return [self]
+        result = []
+        for child in self.children:
+            result.extend(child.segments())
+        return result
+
+class LayoutTree:
+    """
+    The cut tree of projection_cutting_ on *image*, as returned by
+    projection_cutting_tree_.  The image keeps the labels of the
+    segments, as with projection_cutting_.
+
+    After pixels of the image were changed, for instance after glyphs
+    were removed as noise or split, update_ brings the segmentation up
+    to date, cutting anew only the parts of the tree whose cuts
+    changed.
+    """
+    def __init__(self, image, Tx=0, Ty=0, noise=0, gap_treatment=0):
+        self.image = image
+        self._tree = _pagesegmentation._layout_tree(image, Tx, Ty, noise, gap_treatment)
+
+    def segments(self):
+        """
+        Returns the segments as a list of 'CCs' in reading order, as
+        projection_cutting_ does.
+        """
+        return _pagesegmentation._layout_tree_segments(self.image, self._tree)
+
+    def update(self, rect=None):
+        """
+        Updates the tree after the pixels of the image in *rect* (all
+        pixels when None) were changed.  The work is proportional to
+        the size of *rect* and of the regions whose cuts changed.  The
+        black pixels in *rect* and in the segments that were cut anew
+        are labeled.
+        """
+        from gamera.core import Rect
+        if rect is None:
+            rect = Rect(self.image.ul, self.image.lr)
+        _pagesegmentation._layout_tree_update(self.image, self._tree, rect)
+
+    def root(self):
+        """
+        Returns the root of the tree as a LayoutNode_, with the
+        coordinates of the image.
+        """
+        from gamera.core import Rect, Point
+        x, y = self.image.ul_x, self.image.ul_y
+        def rect(r):
+            return Rect(Point(r[0] + x, r[1] + y), Point(r[2] + x, r[3] + y))
+        nodes = _pagesegmentation._layout_tree_nodes(self._tree)
+        stack = []
+        root = None
+        for region, bbox, direction, splits, label, nchildren in nodes:
+            if direction == 'x':
+                offset = y
+            else:
+                offset = x
+            node = LayoutNode(rect(region), rect(bbox), direction,
+                              [s + offset for s in splits], label)
+            if stack:
+                parent, left = stack[-1]
+                parent.children.append(node)
+                if left == 1:
+                    stack.pop()
+                else:
+                    stack[-1] = (parent, left - 1)
+            else:
+                root = node
+            if nchildren:
+                stack.append((node, nchildren))
+        return root
+
+class projection_cutting_tree(PluginFunction):
+    """
+    Segments a page as projection_cutting_ does, but returns the tree
+    of the recursive cuts as a LayoutTree_, from which the segments are
+    taken with *segments()*.  After local changes of the image, the
+    tree is updated with *update(rect)* in time proportional to the
+    changed area rather than to the page.
+
+    The arguments are those of projection_cutting_.
+
+    .. code:: Python
+
+      tree = image.projection_cutting_tree(Tx, Ty)
+      segments = tree.segments()
+      # remove a glyph and update the segmentation
+      image.clip_image(glyph).fill_white()
+      tree.update(glyph)
+      segments = tree.segments()
+    """
+    self_type = ImageType([ONEBIT])
+    args = Args([Int('Tx', default = 0), Int('Ty', default = 0), \
+		 Int('noise', default = 0), Choice('gap_treatment', ["cut", "ignore"], default=0)])
+    return_type = Class("tree")
+    pure_python = True
+    def __call__(image, Tx = 0, Ty = 0, noise = 0, gap_treatment = 0):
+        return LayoutTree(image, Tx, Ty, noise, gap_treatment)
+    __call__ = staticmethod(__call__)
+
+class _layout_tree(PluginFunction):
+    """
+    Cuts the image as projection_cutting_ does and returns the cut tree
+    for LayoutTree_.
+    """
+    category = None
+    self_type = ImageType([ONEBIT])
+    args = Args([Int('Tx'), Int('Ty'), Int('noise'), Int('gap_treatment')])
+    return_type = Class("tree")
+
+class _layout_tree_update(PluginFunction):
+    """
+    Updates the cut tree after the pixels in *rect* were changed (see
+    LayoutTree_).
+    """
+    category = None
+    self_type = ImageType([ONEBIT])
+    args = Args([Class('tree'), Rect('rect')])
+
+class _layout_tree_segments(PluginFunction):
+    """
+    Returns the segments of the cut tree (see LayoutTree_).
+    """
+    category = None
+    self_type = ImageType([ONEBIT])
+    args = Args([Class('tree')])
+    return_type = ImageList("ccs")
+
+class _layout_tree_nodes(PluginFunction):
+    """
+    Returns the nodes of the cut tree in preorder (see LayoutTree_).
+    """
+    category = None
+    self_type = None
+    args = Args([Class('tree')])
+    return_type = Class("nodes")
+
 class runlength_smearing(PluginFunction):
     """
     Segments a page with the *Run Length Smearing* algorithm.
@@ -88,6 +264,10 @@ class runlength_smearing(PluginFunction):
     found segment. Note that the input image is changed such that each
     pixel is set to its CC label.
 
+    The smearing and the labeling of the segments work on the runs of
+    black pixels, so that the runtime mainly depends on the number of
+    runs rather than on the image size.
+
     Arguments:
 
     *Cx*:
@@ -431,7 +611,9 @@ class PageSegmentationModule(PluginModule):
     cpp_headers = ["pagesegmentation.hpp"]
     cpp_namespace = ["Gamera"]
     category = "PageSegmentation"
-    functions = [projection_cutting, runlength_smearing, bbox_merging, \
+    functions = [projection_cutting, projection_cutting_tree, _layout_tree,
+                 _layout_tree_update, _layout_tree_segments, _layout_tree_nodes,
+                 runlength_smearing, bbox_merging, \
                      sub_cc_analysis, textline_reading_order, \
                      segmentation_error]
 module = PageSegmentationModule() # create an instance of the module
@@ -56,10 +56,12 @@ class load_PNG(PluginFunction):
         no compression
       RLE (1)
         run-length encoding compression
+      PACKED (2)
+        bit-packed, one bit per pixel (OneBit only)
     """
     self_type = None
     args = Args([FileOpen("image_file_name", "", "*.png"),
-                 Choice("storage format", ["DENSE", "RLE"])])
+                 Choice("storage format", ["DENSE", "RLE", "PACKED"])])
     return_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB, FLOAT])
     def __call__(filename, compression = 0):
         from gamera.plugins import _png_support
@@ -67,14 +69,62 @@ class load_PNG(PluginFunction):
     __call__ = staticmethod(__call__)
     exts = ['png']
 
+_png_filters = ["default", "none", "sub", "up", "average", "paeth", "all"]
+
 class save_PNG(PluginFunction):
     """
     Saves the image to a PNG format file.
+
+    *compression_level* (optional)
+      The zlib compression level, from 0 (none) to 9 (best).  The
+      default of -1 uses the zlib default.  Level 1 with the *none*
+      filter is much faster for intermediate files that are read back
+      soon.
+
+    *filters* (optional)
+      The PNG row filters to use.  *default* leaves the choice to
+      libpng, which tries all filters for GreyScale and RGB images.
     """
     self_type = ImageType(ALL)
-    args = Args([FileSave("image_file_name", "image.png", "*.png")])
+    read_only = True
+    release_gil = True
+    args = Args([FileSave("image_file_name", "image.png", "*.png"),
+                 Int("compression_level", range=(-1, 9), default=-1),
+                 Choice("filters", _png_filters, default=0)])
     exts = ['png']
 
+class load_PNG_from_bytes(PluginFunction):
+    """
+    Loads a PNG image from a string holding the contents of a PNG file,
+    such as one received over the network, without writing it to disk.
+
+    *data*
+      The PNG file as a string
+
+    *storage_format* (optional)
+      specifies the compression type for the result (see load_PNG)
+    """
+    self_type = None
+    args = Args([Class("data"),
+                 Choice("storage format", ["DENSE", "RLE", "PACKED"])])
+    return_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB, FLOAT])
+    def __call__(data, compression = 0):
+        from gamera.plugins import _png_support
+        return _png_support.load_PNG_from_bytes(data, compression)
+    __call__ = staticmethod(__call__)
+
+class save_PNG_to_bytes(PluginFunction):
+    """
+    Returns the image encoded in PNG format, as a string, without
+    writing it to disk.  *compression_level* and *filters* are the same
+    as for save_PNG.
+    """
+    self_type = ImageType(ALL)
+    read_only = True
+    args = Args([Int("compression_level", range=(-1, 9), default=-1),
+                 Choice("filters", _png_filters, default=0)])
+    return_type = Class("data")
+
 class PngSupportModule(PluginModule):
     import sys
     import os.path
@@ -115,10 +165,12 @@ class PngSupportModule(PluginModule):
 #        extra_libraries = ["z"]
     else:
         extra_libraries = ["png"]
-    functions = [save_PNG, PNG_info, load_PNG]
+    functions = [save_PNG, PNG_info, load_PNG, load_PNG_from_bytes,
+                 save_PNG_to_bytes]
     author = "Michael Droettboom and Albert Bzreckzo"
     url = "http://gamera.sourceforge.net/"
 module = PngSupportModule()
 
 PNG_info = PNG_info()
 load_PNG = load_PNG()
+load_PNG_from_bytes = load_PNG_from_bytes()
@@ -0,0 +1,285 @@
+#
+# Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+"""Lazy evaluation of chains of pointwise plugins, which are computed
+in a single pass over the pixels."""
+
+from gamera.plugin import *
+from gamera.__compiletime_config__ import has_openmp
+import _pointwise
+
+# the instructions of the pointwise programs (see pointwise.hpp)
+(LOAD, ADD, SUBTRACT, MULTIPLY, DIVIDE, MULTIPLY_ADD, MULTIPLY_ADD_IMAGES,
+ INVERT, THRESHOLD, AND, OR, XOR, TO_GREYSCALE, TO_GREY16,
+ TO_FLOAT) = range(15)
+
+# the pixel types each instruction supports
+_supported = {
+    ADD: (GREYSCALE, GREY16, FLOAT),
+    SUBTRACT: (GREYSCALE, GREY16, FLOAT),
+    MULTIPLY: (GREYSCALE, GREY16, FLOAT),
+    DIVIDE: (GREYSCALE, GREY16, FLOAT),
+    MULTIPLY_ADD: (GREYSCALE, GREY16, FLOAT),
+    MULTIPLY_ADD_IMAGES: (GREYSCALE, GREY16, FLOAT),
+    INVERT: (ONEBIT, GREYSCALE, GREY16, RGB),
+    THRESHOLD: (GREYSCALE, GREY16, FLOAT),
+    AND: (ONEBIT,),
+    OR: (ONEBIT,),
+    XOR: (ONEBIT,),
+    TO_GREYSCALE: (ONEBIT, RGB),
+    TO_GREY16: (ONEBIT, GREYSCALE, RGB),
+    TO_FLOAT: (ONEBIT, GREYSCALE, GREY16, RGB)
+    }
+
+class PointwiseExpression(object):
+    """
+    A chain of pointwise operations on images that is only computed
+    when its result is needed.  It is made with the lazy_ plugin, and
+    has the following methods of images, which return a new expression
+    instead of an image:
+
+      add_images, subtract_images, multiply_images, divide_images,
+      multiply_add, multiply_add_images, and_image, or_image,
+      xor_image, invert, threshold, to_greyscale, to_grey16, to_float
+
+    Their arguments are those of the plugins, without *in_place* and
+    *threads*, and their other operand may be an image or an
+    expression.  Unlike the plugin, invert returns the inverted
+    expression.
+
+    evaluate computes the pixels of the resulting image in a single
+    pass, block by block, without storing the intermediate results in
+    images.  The results are those of the plugins.  The other methods
+    of images are called on the evaluated image, and the operations
+    that can not be computed pointwise for the pixel type at hand (for
+    instance ``to_greyscale`` of a FLOAT image, which depends on the
+    range of the pixels) are computed when they are called, their
+    result starting a new expression.
+    """
+
+    def __init__(self, image=None, opcode=LOAD, operands=(), pixel_type=None,
+                 arguments=(), constants=()):
+        if image is not None:
+            # the operands of the programs are dense images
+            if (image.data.storage_format != DENSE or
+                image.__class__.__name__ in ("Cc", "MlCc")):
+                image = image.image_copy(DENSE)
+            pixel_type = image.data.pixel_type
+            self.storage_format = image.data.storage_format
+            self.ul = image.ul
+            self.dim = image.dim
+        else:
+            self.storage_format = operands[0].storage_format
+            self.ul = operands[0].ul
+            self.dim = operands[0].dim
+        self._image = image
+        self._opcode = opcode
+        self._operands = list(operands)
+        self._arguments = list(arguments)
+        self._constants = list(constants)
+        self.pixel_type = pixel_type
+
+    def _compile(self):
+        images, code, constants = [], [], []
+        indices = {}
+        def emit(expression):
+            for operand in expression._operands:
+                emit(operand)
+            if expression._opcode == LOAD:
+                key = id(expression._image)
+                if key not in indices:
+                    indices[key] = len(images)
+                    images.append(expression._image)
+                code.extend([LOAD, indices[key]])
+            else:
+                code.append(expression._opcode)
+                code.extend(expression._arguments)
+            constants.extend(expression._constants)
+        emit(self)
+        return images, code, constants
+
+    def evaluate(self, threads=0):
+        """Computes the image of the expression.  *threads* is the
+number of threads (0 for as many as OpenMP provides).  Each call
+computes the pixels again, from the current pixels of the images."""
+        if self._opcode == LOAD:
+            return self._image.image_copy(self.storage_format)
+        images, code, constants = self._compile()
+        result = _pointwise._evaluate_pointwise(images, code, constants, threads)
+        if self.storage_format != DENSE:
+            result = result.image_copy(self.storage_format)
+        return result
+
+    def _evaluate_operand(self):
+        if self._opcode == LOAD:
+            return self._image
+        return self.evaluate()
+
+    def __getattr__(self, name):
+        if name.startswith('__'):
+            raise AttributeError(name)
+        return getattr(self.evaluate(), name)
+
+    def _apply(self, opcode, name, others, args, arguments=(), constants=()):
+        # a new expression, or the result of the plugin when the
+        # operation is not pointwise for the pixel types of the operands
+        operands = [self] + [_expression(x) for x in others]
+        pixel_type = self.pixel_type
+        fused = pixel_type in _supported[opcode]
+        for operand in operands[1:]:
+            fused = fused and operand.pixel_type == pixel_type
+        if not fused:
+            # the plugins are called on the images themselves, since some
+            # look at the whole image a view belongs to
+            images = [x._evaluate_operand() for x in operands]
+            if name == "invert":
+                # which works in place
+                images[0] = images[0].image_copy()
+                images[0].invert()
+                return PointwiseExpression(images[0])
+            return PointwiseExpression(getattr(images[0], name)(*(images[1:] + list(args))))
+        if opcode == THRESHOLD:
+            pixel_type = ONEBIT
+        elif opcode == TO_GREYSCALE:
+            pixel_type = GREYSCALE
+        elif opcode == TO_GREY16:
+            pixel_type = GREY16
+        elif opcode == TO_FLOAT:
+            pixel_type = FLOAT
+        result = PointwiseExpression(None, opcode, operands, pixel_type,
+                                     arguments, constants)
+        if opcode in (TO_GREYSCALE, TO_GREY16, TO_FLOAT):
+            result.storage_format = DENSE
+        return result
+
+    def add_images(self, other):
+        if self.pixel_type == ONEBIT:
+            return self._apply(OR, "or_image", [other], ())
+        return self._apply(ADD, "add_images", [other], ())
+
+    def subtract_images(self, other):
+        return self._apply(SUBTRACT, "subtract_images", [other], ())
+
+    def multiply_images(self, other):
+        if self.pixel_type == ONEBIT:
+            return self._apply(AND, "and_image", [other], ())
+        return self._apply(MULTIPLY, "multiply_images", [other], ())
+
+    def divide_images(self, other):
+        return self._apply(DIVIDE, "divide_images", [other], ())
+
+    def multiply_add(self, factor=1.0, offset=0.0, saturate=True):
+        return self._apply(MULTIPLY_ADD, "multiply_add", [],
+                           (factor, offset, saturate),
+                           [int(bool(saturate))], [float(factor), float(offset)])
+
+    def multiply_add_images(self, other, factor=1.0, other_factor=1.0,
+                            offset=0.0, saturate=True):
+        return self._apply(MULTIPLY_ADD_IMAGES, "multiply_add_images", [other],
+                           (factor, other_factor, offset, saturate),
+                           [int(bool(saturate))],
+                           [float(factor), float(other_factor), float(offset)])
+
+    def and_image(self, other):
+        return self._apply(AND, "and_image", [other], ())
+
+    def or_image(self, other):
+        return self._apply(OR, "or_image", [other], ())
+
+    def xor_image(self, other):
+        return self._apply(XOR, "xor_image", [other], ())
+
+    def invert(self):
+        return self._apply(INVERT, "invert", [], ())
+
+    def threshold(self, threshold, storage_format=DENSE):
+        result = self._apply(THRESHOLD, "threshold", [],
+                             (threshold, storage_format), [int(threshold)])
+        result.storage_format = storage_format
+        return result
+
+    def _convert(self, opcode, name, pixel_type):
+        # conversions to the same type are copies
+        if self.pixel_type == pixel_type:
+            return self
+        return self._apply(opcode, name, [], ())
+
+    def to_greyscale(self):
+        return self._convert(TO_GREYSCALE, "to_greyscale", GREYSCALE)
+
+    def to_grey16(self):
+        return self._convert(TO_GREY16, "to_grey16", GREY16)
+
+    def to_float(self):
+        return self._convert(TO_FLOAT, "to_float", FLOAT)
+
+def _expression(value):
+    if isinstance(value, PointwiseExpression):
+        return value
+    return PointwiseExpression(value)
+
+class lazy(PluginFunction):
+    """
+    Returns a PointwiseExpression_ of the image, on which chains of
+    pointwise plugins are only computed when ``evaluate`` is called,
+    in a single pass over the pixels instead of one pass per plugin
+    storing its result in a new image.  For example
+
+    .. code:: Python
+
+      mask = image.lazy().subtract_images(background).invert().threshold(128).evaluate()
+
+    computes the same image as
+
+    .. code:: Python
+
+      difference = image.subtract_images(background)
+      difference.invert()
+      mask = difference.threshold(128)
+
+    without the two intermediate images.  The expression is computed
+    from the pixels the images have when it is evaluated.
+    """
+    self_type = ImageType(ALL)
+    return_type = Class("expression", PointwiseExpression)
+    pure_python = True
+    def __call__(self):
+        return PointwiseExpression(self)
+    __call__ = staticmethod(__call__)
+
+class _evaluate_pointwise(PluginFunction):
+    """
+    Runs a pointwise program (see PointwiseExpression_) on a list of
+    dense images of the same size.
+    """
+    self_type = None
+    args = Args([ImageList("operands"), IntVector("program"),
+                 FloatVector("constants"), Int("threads", default=0)])
+    return_type = ImageType(ALL)
+    release_gil = True
+
+class PointwiseModule(PluginModule):
+    cpp_headers = ["pointwise.hpp"]
+    category = "Utility"
+    functions = [lazy, _evaluate_pointwise]
+    author = "Michael Droettboom"
+    url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
+module = PointwiseModule()
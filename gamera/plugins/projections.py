@@ -22,14 +22,18 @@ from gamera.plugin import *
 from gamera.gui import has_gui
 from gamera import util
 import _projections
-from math import pi
 
 class projection_rows(PluginFunction):
     """
     Compute the horizontal projections of an image.  This computes the
     number of pixels in each row.
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
     """
     self_type = ImageType([ONEBIT])
+    args = Args([Int("threads", range=(0, 1024), default=0)])
     return_type = IntVector()
     doc_examples = [(ONEBIT,)]
 
@@ -37,8 +41,16 @@ class projection_cols(PluginFunction):
     """
     Compute the vertical projections of an image.  This computes the
     number of pixels in each column.
+
+    The rows are counted one after the other into the column counts, so
+    the image is read in row-major order.
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
     """
     self_type = ImageType([ONEBIT])
+    args = Args([Int("threads", range=(0, 1024), default=0)])
     return_type = IntVector()
     doc_examples = [(ONEBIT,)]
 
@@ -58,14 +70,58 @@ class projections(PluginFunction):
     return_type = Class()
     pure_python = 1
     def __call__(image):
-        rows = _projections.projection_rows(image)
-        cols = _projections.projection_cols(image)
+        rows, cols = _projections._projection_rows_cols(image, 0)
         gui = has_gui.gui
         if gui:
             gui.ShowProjections(rows, cols, image)
         return (rows, cols)
     __call__ = staticmethod(__call__)
 
+class _projection_rows_cols(PluginFunction):
+    """
+    Returns the tuple (*rows*, *columns*) of projections_, counted in
+    one pass over the image.
+    """
+    category = None
+    self_type = ImageType([ONEBIT])
+    args = Args([Int("threads")])
+    return_type = Class("projections")
+
+class strip_projections(PluginFunction):
+    """
+    Computes the projections of strips of the image in one pass.  This
+    is returned as a tuple (*rows*, *columns*) of lists of
+    ``IntVector``:
+
+    *rows*
+      The horizontal projections (as projection_rows_) of the vertical
+      strips between the columns in *x_bounds*: strip *i* covers the
+      columns *x_bounds[i]* to *x_bounds[i+1]-1*.
+
+    *columns*
+      The vertical projections (as projection_cols_) of the horizontal
+      strips between the rows in *y_bounds*.
+
+    The bounds are relative to the image and must be increasing (empty
+    strips are allowed).
+
+    *threads*
+      The number of threads for large images (0 means the OpenMP
+      default, usually the number of cores).
+
+    .. code:: Python
+
+      # the projections of the left and right halves, and of the
+      # upper and lower halves
+      (left, right), (upper, lower) = image.strip_projections(
+          [0, image.ncols / 2, image.ncols],
+          [0, image.nrows / 2, image.nrows])
+    """
+    self_type = ImageType([ONEBIT])
+    args = Args([IntVector("x_bounds"), IntVector("y_bounds"),
+                 Int("threads", range=(0, 1024), default=0)])
+    return_type = Class("projections")
+
 class projection_skewed_cols(PluginFunction):
     """
     Computes all vertical projections of an image skewed by a list of
@@ -143,10 +199,10 @@ class rotation_angle_projections(PluginFunction):
     pp. 143-158 (2008).
 
     This method works for a wide range of documents (text, music,
-    forms), but can become slow for large images. This particular
-    implementation can be accelerated by reducing the number of black
-    pixels in the image, eg. by scaling it down, only considering a
-    fraction of the image or by removing 'uninteresting' pixels.
+    forms).  The projections are computed from the runs of black pixels,
+    which are extracted only once for all trial angles, so that the cost
+    per angle grows with the number of runs rather than with the number
+    of black pixels.
 
     Arguments:
 
@@ -178,109 +234,9 @@ class rotation_angle_projections(PluginFunction):
     args = Args([Float("minangle", default=-2.5), Float("maxangle", default=2.5), Float("accuracy", default=0.0)])
     return_type = FloatVector("rotation_angle_and_accuracy", 2)
     author = "Christoph Dalitz"
-    pure_python = 1
-
+    release_gil = True
     def __call__(self, minangle = -2.5, maxangle = 2.5, accuracy = 0):
-
-        # l2norm: compute L2-Norm of derivative of vec
-        def l2norm(vec):
-            var = 0
-            for i in range(0,len(vec)-1):
-                var += (vec[i] - vec[i+1])**2
-            return var
-
-        # some arguments checking
-        if (accuracy == 0):
-            accuracy = 180 * 0.5 / (self.ncols * pi)
-        if (maxangle <= minangle):
-            raise RuntimeError("maxangle %f must be greater than minangle %f\n" \
-                               % (maxangle, minangle))
-
-        #
-        # rough guess where the maximum is
-        # necessary because l2norm has many local maxima
-        #
-        roughacc = 0.5
-        if ((maxangle - minangle)/4.0) < roughacc:
-            # at least five trial points
-            roughacc = (maxangle - minangle) / 4.0
-        else:
-            roughacc = (maxangle-minangle) / round((maxangle-minangle)/roughacc)
-        angle = [(minangle + x*roughacc) for x in \
-                    range(0,int(round((maxangle - minangle)/roughacc))+1)]
-        alist = [l2norm(x) for x in self.projection_skewed_rows(angle)]
-        # find maximum in list
-        fb = alist[0]; bi = 0
-        for i in range(1,len(alist)):
-            if alist[i] > fb:
-                fb = alist[i]; bi = i
-        b = angle[bi]
-
-        #
-        # initialize values for golden section search
-        #
-        if (bi == 0):
-            # maximum on lower iterval end: check neighborhood
-            c = b + 1.5*accuracy;
-            fc = l2norm(self.projection_skewed_rows(c))
-            if (fc > fb) and (c < angle[bi+1]):
-                a = b; fa = fb;
-                b = c; fb = fc;
-                c = angle[bi+1]; fc = alist[bi+1];
-            else:
-                raise RuntimeError("maximum found on interval end %f\n" \
-                                   % angle[bi])
-        elif (bi == len(angle)-1):
-            # maximum on upper iterval end: check neighborhood
-            a = b - 1.5*accuracy;
-            fa = l2norm(self.projection_skewed_rows(a))
-            if (fa > fb) and (a > angle[bi-1]):
-                c = b; fc = fb;
-                b = a; fb = fa;
-                a = angle[bi-1]; fa = alist[bi-1];
-            else:
-                raise RuntimeError("maximum found on interval end %f\n" \
-                                   % angle[bi])
-        else:
-            # the normal case: maximum somewhere in the middle
-            a = angle[bi-1]; fa = alist[bi-1];
-            c = angle[bi+1]; fc = alist[bi+1];
-
-        #
-        # fine tuning with golden section search
-        # see Press at al: "Numerical Recipes",
-        # Cambridge University Press (1986)
-        #
-        golden = 0.38197  # (3 - sqrt(2)) / 2
-        x = 500   # dummy value for recognition of first iteration
-        while (c-b > accuracy) or (b-a > accuracy):
-            if (x == 500):
-                # special case first iteration
-                if (fc > fa):
-                    x = b + golden * (c - b)
-                else:
-                    x = b - golden * (b - a)
-            else:
-                # ordinary situation
-                if (c-b > b-a):
-                    x = b + golden * (c - b)
-                else:
-                    x = b - golden * (b - a)
-            fx = l2norm(self.projection_skewed_rows(x))
-            if (x > b):
-                if (fx < fb):
-                    c = x; fc = fx
-                else:
-                    a = b; fa = fb;
-                    b = x; fb = fx;
-            else:
-                if (fx < fb):
-                    a = x; fa = fx
-                else:
-                    c = b; fc = fb;
-                    b = x; fb = fx;
-        return [b, accuracy]
-
+        return _projections.rotation_angle_projections(self, minangle, maxangle, accuracy)
     __call__ = staticmethod(__call__)
 
 
@@ -298,8 +254,7 @@ class diagonal_projections(PluginFunction):
     pure_python = 1
     def __call__(image):
         rotated_image = image.rotate(45, None, 1)
-        rows = _projections.projection_rows(rotated_image)
-        cols = _projections.projection_cols(rotated_image)
+        rows, cols = _projections._projection_rows_cols(rotated_image, 0)
         gui = has_gui.gui
         if gui:
             gui.ShowProjections(rows, cols, rotated_image)
@@ -311,6 +266,7 @@ class ProjectionsModule(PluginModule):
     cpp_headers=["projections.hpp"]
     category = "Analysis"
     functions = [projection_rows, projection_cols, projections,
+                 _projection_rows_cols, strip_projections,
                  projection_skewed_rows, projection_skewed_cols,
                  rotation_angle_projections, diagonal_projections]
     author = "Michael Droettboom and Karl MacMillan"
@@ -141,6 +141,40 @@ class from_rle(PluginFunction):
     self_type = ImageType([ONEBIT])
     args = Args(String("runs"))
 
+class glyphs_to_rle(PluginFunction):
+    """
+    Returns the to_rle_ strings of a list of OneBit images.
+    """
+    self_type = None
+    args = Args([ImageList("glyphs")])
+    return_type = Class("runs")
+
+class glyphs_from_rle(PluginFunction):
+    """
+    Decodes the run-length encoded strings *runs* (see from_rle_) into
+    the images of the list *glyphs*, one string for each image.  The
+    strings may be byte or unicode strings.
+    """
+    self_type = None
+    args = Args([ImageList("glyphs"), Class("runs")])
+
+class packed_glyphs_from_rle(PluginFunction):
+    """
+    Returns new OneBit images decoded from the run-length encoded
+    strings *runs* (see from_rle_), with the PACKED storage format.
+    The pixels of all images are packed into one shared block of
+    memory, which is freed when the last of the images is gone.  This
+    takes much less memory than separate DENSE images for the many
+    small glyphs of a training database.
+
+    *geometry* holds the four numbers *ul_x*, *ul_y*, *ncols* and
+    *nrows* of each image.  The images whose runs are ``None`` stay
+    white.
+    """
+    self_type = None
+    args = Args([IntVector("geometry"), Class("runs")])
+    return_type = ImageList("glyphs")
+
 class iterate_runs(PluginFunction):
     """
     Returns nested iterators over the runs in the given *color* and
@@ -209,12 +243,17 @@ class RunLengthModule(PluginModule):
                  filter_short_runs,
                  filter_tall_runs,
                  iterate_runs,
-                 to_rle, from_rle]
+                 to_rle, from_rle,
+                 glyphs_to_rle, glyphs_from_rle, packed_glyphs_from_rle]
 
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
 
 module = RunLengthModule()
+
+glyphs_to_rle = glyphs_to_rle()
+glyphs_from_rle = glyphs_from_rle()
+packed_glyphs_from_rle = packed_glyphs_from_rle()
                  
 del FrequentRun
 del FrequentRuns
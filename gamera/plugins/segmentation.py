@@ -18,6 +18,7 @@
 
 from gamera.plugin import *
 from gamera import util
+from gamera.__compiletime_config__ import has_openmp
 import _segmentation
 
 
@@ -47,9 +48,245 @@ class cc_analysis(Segmenter):
       ccs = [x.image_copy() for x in ccs]
 
     .. _image_copy: utility.html#image-copy
+
+    *method*
+      The labeling algorithm:
+
+      two-pass (0)
+        labels the image pixel by pixel (default).
+
+      runs (1)
+        labels horizontal runs of black pixels and merges them with a
+        union-find structure.  This is usually faster, in particular on
+        large images and RLE images, and gives exactly the same labels
+        and ccs as *two-pass*.
+
+      parallel (2)
+        like *runs*, but the image is split into horizontal strips that
+        are labeled on separate threads.  The labels are again the same
+        as for *two-pass*.  This requires Gamera to be compiled with
+        OpenMP support; otherwise the strips are labeled one after
+        another.
+
+    *threads*
+      The number of threads for the *parallel* method.  When 0, the
+      OpenMP default (usually the number of cores) is used.
+
+    The labels are stored in the OneBit pixels, so there are at most
+    65533 different labels.  Images with more ccs are labeled with the
+    *runs* (or *parallel*) method, and the labels are shared by ccs
+    whose bounding boxes do not overlap.  Each cc therefore still
+    consists of exactly the pixels with its label inside its bounding
+    box, but in this case the labels are not unique within the image.
+    """
+    args = Args([Choice("method", ["two-pass", "runs", "parallel"]),
+                 Int("threads", range=(0, 1024), default=0)])
+    def __call__(image, method=0, threads=0):
+        return _segmentation.cc_analysis(image, method, threads)
+    __call__ = staticmethod(__call__)
+
+
+class update_cc_analysis(PluginFunction):
+    """
+    Updates the connected components of an image labeled by
+    cc_analysis_ after the pixels inside *rect* have been edited (for
+    example erased, or drawn in black), without labeling the whole
+    image again.
+
+    Only the ccs whose bounding box intersects *rect* (or touches it
+    diagonally) and the ccs that the black pixels of *rect* now
+    connect to are labeled again; all other ccs and labels stay as
+    they are.  A cc whose pixels did not change is kept.
+
+    *ccs*
+      All ccs of the image, as returned by cc_analysis_ (or by earlier
+      calls of this function).
+
+    *rect*
+      The rectangle (in page coordinates) inside which pixels have
+      changed.
+
+    Returns a tuple of the removed ccs (taken from *ccs*) and a list of
+    the new ccs::
+
+      removed, added = image.update_cc_analysis(ccs, rect)
+      removed = set([id(x) for x in removed])
+      ccs = [x for x in ccs if id(x) not in removed] + added
+
+    The new ccs get unused labels where possible, so that the labels
+    stay unique within the image unless they were shared already (see
+    cc_analysis_).
+    """
+    self_type = ImageType([ONEBIT])
+    args = Args([ImageList("ccs"), Rect("rect")])
+    return_type = Class("changes", tuple)
+    def __call__(image, ccs, rect):
+        ccs = list(ccs)
+        removed, added = _segmentation.update_cc_analysis(image, ccs, rect)
+        return [ccs[i] for i in removed], added
+    __call__ = staticmethod(__call__)
+
+
+class CcTable:
+    """
+    A table of the connected components of an image, as returned by
+    cc_analysis_table_.  The table holds one column per property
+    (label, bounding box, black area and centroid), so that filtering
+    the components by size does not need a cc object per component.
+    The cc objects are created by ccs_ only for the components that
+    are left.
+
+    *image*
+      The labeled image the ccs refer to.  This is the analysed image,
+      except for PACKED images, which are labeled in a DENSE copy.
+    """
+    # the filters of _cc_table_filter
+    _filters = {"wide": 0, "narrow": 1, "tall": 2, "short": 3,
+                "small": 4, "large": 5, "black_area_small": 6,
+                "black_area_large": 7}
+
+    def __init__(self, image, method=0, threads=0):
+        self._table, labeled = _segmentation._cc_table(image, method, threads)
+        if labeled is None:
+            labeled = image
+        self.image = labeled
+
+    def __len__(self):
+        return _segmentation._cc_table_size(self._table)
+
+    def columns(self):
+        """
+        Returns the columns of the table as a dictionary of lists: the
+        labels (*label*), the bounding boxes in page coordinates
+        (*ul_x*, *ul_y*, *lr_x*, *lr_y*), the number of black pixels
+        (*black_area*) and the centroids (*center_x*, *center_y*).
+        """
+        return _segmentation._cc_table_columns(self._table)
+
+    def ccs(self):
+        """
+        Returns the ccs of the components in the table, in the order of
+        cc_analysis_.
+        """
+        return _segmentation._cc_table_ccs(self.image, self._table)
+
+    def filter(self, name, threshold):
+        """
+        Removes the components that the filter *name* rejects from the
+        table and sets their pixels to white, like the function
+        filter_*name* does with a list of ccs.  *name* is one of
+        ``wide``, ``narrow``, ``tall``, ``short``, ``small``,
+        ``large``, ``black_area_small`` and ``black_area_large``.
+        """
+        _segmentation._cc_table_filter(self.image, self._table,
+                                       self._filters[name], int(threshold))
+
+    def filter_wide(self, max_width):
+        self.filter("wide", max_width)
+
+    def filter_narrow(self, min_width):
+        self.filter("narrow", min_width)
+
+    def filter_tall(self, max_height):
+        self.filter("tall", max_height)
+
+    def filter_short(self, min_height):
+        self.filter("short", min_height)
+
+    def filter_small(self, min_size):
+        self.filter("small", min_size)
+
+    def filter_large(self, max_size):
+        self.filter("large", max_size)
+
+    def filter_black_area_small(self, min_size):
+        self.filter("black_area_small", min_size)
+
+    def filter_black_area_large(self, max_size):
+        self.filter("black_area_large", max_size)
+
+
+class cc_analysis_table(PluginFunction):
     """
-    pass
+    Labels the image like cc_analysis_ and returns a CcTable_ of its
+    connected components instead of a list of ccs.
 
+    The table is filled while labeling, so that filtering many small
+    components and computing size statistics does not create a cc
+    object for each of them::
+
+      table = image.cc_analysis_table()
+      table.filter_black_area_small(4)
+      table.filter_wide(200)
+      ccs = table.ccs()
+
+    which gives the same ccs (and pixels) as::
+
+      ccs = image.cc_analysis()
+      ccs = filter_black_area_small(ccs, 4)
+      ccs = filter_wide(ccs, 200)
+
+    *method*
+      The labeling algorithm: *runs* (1) or *parallel* (2), see
+      cc_analysis_.  The *two-pass* method (0) is the same as *runs*
+      here, as both give the same labels.
+
+    *threads*
+      The number of threads for the *parallel* method.
+    """
+    self_type = ImageType([ONEBIT])
+    args = Args([Choice("method", ["two-pass", "runs", "parallel"]),
+                 Int("threads", range=(0, 1024), default=0)])
+    return_type = Class("table")
+    pure_python = 1
+    def __call__(image, method=0, threads=0):
+        return CcTable(image, method, threads)
+    __call__ = staticmethod(__call__)
+
+class _cc_table(PluginFunction):
+    """
+    Labels the image and returns a tuple of the table and the labeled
+    image (None when it is the image itself), see CcTable_.
+    """
+    category = None
+    self_type = ImageType([ONEBIT])
+    args = Args([Int("method"), Int("threads")])
+    return_type = Class("table")
+
+class _cc_table_filter(PluginFunction):
+    """
+    Filters the table of the labeled image (see CcTable.filter).
+    """
+    category = None
+    self_type = ImageType([ONEBIT])
+    args = Args([Class("table"), Int("filter"), Int("threshold")])
+
+class _cc_table_ccs(PluginFunction):
+    """
+    Returns the ccs of the table of the labeled image.
+    """
+    category = None
+    self_type = ImageType([ONEBIT])
+    args = Args([Class("table")])
+    return_type = ImageList("ccs")
+
+class _cc_table_columns(PluginFunction):
+    """
+    Returns the columns of the table (see CcTable.columns).
+    """
+    category = None
+    self_type = None
+    args = Args([Class("table")])
+    return_type = Class("columns")
+
+class _cc_table_size(PluginFunction):
+    """
+    Returns the number of rows of the table.
+    """
+    category = None
+    self_type = None
+    args = Args([Class("table")])
+    return_type = Int("size")
 
 class cc_and_cluster(Segmenter):
     """
@@ -181,6 +418,37 @@ class splity_bottom(splity_base):
         return self.splity(0.75)
     __call__ = staticmethod(__call__)
 
+class split_glyphs(PluginFunction):
+    """
+    Splits all images of the list *glyphs* with the same split
+    function at once and returns a list with the list of splits of
+    each image.  The glyphs are split in parallel.
+
+    *method*
+      The split function: splitx_, splity_ or splitx_max_.
+
+    *center*
+      The split point candidates as for the split functions.
+
+    *threads*
+      The number of threads to use.  When 0, the number of processors
+      is used.
+
+    The classifiers use this function to split all glyphs classified
+    as ``_split.*`` in one call.
+    """
+    self_type = None
+    args = Args([ImageList("glyphs"),
+                 Choice("method", ["splitx", "splity", "splitx_max"]),
+                 FloatVector("center", default=[0.5]),
+                 Int("threads", range=(0, 1024), default=0)])
+    return_type = Class("splits", list)
+    def __call__(glyphs, method=0, center=[0.5], threads=0):
+        if not util.is_sequence(center):
+            center = [center]
+        return _segmentation.split_glyphs(glyphs, method, center, threads)
+    __call__ = staticmethod(__call__)
+
 # connected-component filters
 
 def filter_wide(ccs, max_width):
@@ -258,14 +526,21 @@ def filter_black_area_large(ccs, max_size):
 class SegmentationModule(PluginModule):
     category = "Segmentation"
     cpp_headers=["segmentation.hpp"]
-    functions = [cc_analysis, cc_and_cluster, splitx, splity,
-                 splitx_left, splitx_right, splity_top, splity_bottom,
-                 splitx_max]
+    functions = [cc_analysis, update_cc_analysis, cc_analysis_table,
+                 _cc_table, _cc_table_filter, _cc_table_ccs,
+                 _cc_table_columns, _cc_table_size, cc_and_cluster, splitx,
+                 splity, splitx_left, splitx_right, splity_top,
+                 splity_bottom, splitx_max, split_glyphs]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
 
 module = SegmentationModule()
 
 del Segmenter
 del splitx_base
 del splity_base
+
+split_glyphs = split_glyphs()
@@ -54,14 +54,96 @@ class _from_raw_string(PluginFunction):
                  Class("data_string")])
     return_type = ImageType(ALL)
 
+class _from_buffer(PluginFunction):
+    """
+    Instantiates a dense image whose pixels are the memory of an object
+    supporting the buffer protocol, such as a NumPy array, without
+    copying them.  Changes to the image change the object and vice
+    versa.  The object is kept alive as long as the image data.
+
+    The buffer must be C contiguous and writable, have the shape
+    (nrows, ncols), or (nrows, ncols, 3) for RGB images, and hold
+    items of the size of the pixels of *pixel_type*.
+
+    This function is not intended to be used directly.  To share data
+    with NumPy, use ``from_numpy`` in numpy_io.py.
+    """
+    self_type = None
+    args = Args([Point("offset"), Int("pixel_type"), Class("buffer")])
+    return_type = ImageType(ALL)
+
+class _glyphs_to_bits(PluginFunction):
+    """
+    Returns the bitmaps of a list of OneBit images in one string, with
+    eight pixels per byte along the rows of each image (the first pixel
+    in the lowest bit).  Each image starts at a new byte.
+
+    This function is not intended to be used directly.  It is used by
+    the binary glyph databases in gamera_gdb.py.
+    """
+    self_type = None
+    args = Args([ImageList("glyphs")])
+    return_type = Class("bits")
+
+class _glyphs_from_bits(PluginFunction):
+    """
+    Instantiates dense OneBit images from the bitmaps returned by
+    _glyphs_to_bits_.  *geometry* holds the four numbers *ul_x*,
+    *ul_y*, *ncols* and *nrows* of each image.
+
+    This function is not intended to be used directly.  It is used by
+    the binary glyph databases in gamera_gdb.py.
+    """
+    self_type = None
+    args = Args([Class("data_string"), IntVector("geometry")])
+    return_type = ImageList("glyphs")
+
+class _unpack_glyph_bits(PluginFunction):
+    """
+    Sets the pixels of a OneBit image from its bitmap as returned by
+    _glyphs_to_bits_.
+
+    This function is not intended to be used directly.  It decodes the
+    pixels of the glyphs of the binary glyph databases in gamera_gdb.py
+    when they are first used.
+    """
+    self_type = ImageType([ONEBIT])
+    args = Args([Class("data_string")])
+
+class _glyphs_from_xml(PluginFunction):
+    """
+    Parses the symbols and glyphs of a Gamera XML document written by
+    ``WriteXML``, splitting the ``<glyph>`` elements into ranges that
+    are parsed in parallel by *threads* threads (all processors when
+    0).  Returns None for the documents that must be read by expat,
+    such as those with comments or non-ASCII text.
+
+    This function is not intended to be used directly.  It is used by
+    ``LoadXML`` in gamera_xml.py.
+    """
+    self_type = None
+    args = Args([Class("data_string"), Check("with_data"), Check("with_features"),
+                 Int('threads', range=(0, 1024), default=0)])
+    return_type = Class("records")
+
 class StringIOModule(PluginModule):
     category = "ExternalLibraries"
     cpp_headers=["string_io.hpp"]
     functions = [_to_raw_string,
-                 _from_raw_string]
+                 _from_raw_string,
+                 _from_buffer,
+                 _glyphs_to_bits,
+                 _glyphs_from_bits,
+                 _unpack_glyph_bits,
+                 _glyphs_from_xml]
     author = "Alex Cobb"
     url = ('http://www.oeb.harvard.edu/faculty/holbrook/'
            'people/alex/Website/alex.htm')
 module = StringIOModule()
 
 _from_raw_string = _from_raw_string()
+_from_buffer = _from_buffer()
+_glyphs_to_bits = _glyphs_to_bits()
+_glyphs_from_bits = _glyphs_from_bits()
+_unpack_glyph_bits = _unpack_glyph_bits()
+_glyphs_from_xml = _glyphs_from_xml()
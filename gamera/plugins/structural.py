@@ -98,19 +98,58 @@ class edit_distance(PluginFunction):
     two strings.
 
     This counts the number of character substitutions, additions and deletions
-    necessary to transform one string into another. This plugin is a 
-    straightforward implementation of the classic algorithm by Wagner 
-    and Fischer, which has runtime complexity *O(m*n)*, where *m* and *n* are
-    the lengths of the two strings.
+    necessary to transform one string into another. This plugin computes
+    the classic matrix by Wagner and Fischer with the bit-parallel algorithm
+    by Myers, which has runtime complexity *O(ceil(m/64)*n)*, where *m* is
+    the length of the shorter and *n* the length of the longer string.
 
     See R.A. Wagner, M.J. Fischer: *The String-to-String Correction Problem.*
-    Journal of the ACM 21, pp. 168-173, 1974.
+    Journal of the ACM 21, pp. 168-173, 1974, and G. Myers: *A fast
+    bit-vector algorithm for approximate string matching based on dynamic
+    programming.* Journal of the ACM 46, pp. 395-415, 1999.
     """
     self_type = None
     args = Args([String("s1"), String("s2")])
     return_type = Int("distance")
     author = "Christoph Dalitz"
 
+class edit_distances(PluginFunction):
+    """
+    Computes the edit_distance_ of each pair of strings in a list at
+    once, which saves the overhead of one Python call per pair.
+
+    *pairs*
+      A list of tuples (*s1*, *s2*) of two strings.
+
+    The result is a list of the edit distances, in the order of *pairs*.
+    """
+    self_type = None
+    args = Args([Class("pairs")])
+    return_type = IntVector("distances")
+
+class least_squares_fit_lines(PluginFunction):
+    """
+    Performs a least_squares_fit_ through the bounding boxes of the
+    images of each line in a list of lines at once, for instance to
+    fit the baselines of all text lines of a page.
+
+    *lines*
+      A list of lines, each being a list of images (e.g. the connected
+      components of the line).
+
+    *reference*
+      The point of each bounding box the line is fitted to: the lower
+      center (the default, which fits the baseline), the center or the
+      upper center.
+
+    The result is a list of tuples (*m*, *b*, *q*) as returned by
+    least_squares_fit_, one for each line.
+    """
+    self_type = None
+    args = Args([Class("lines"),
+                 Choice("reference", ["lower center", "center", "upper center"])])
+    return_type = Class("fits")
+
 class RelationalModule(PluginModule):
     cpp_headers = ["structural.hpp"]
     category = "Relational"
@@ -118,7 +157,8 @@ class RelationalModule(PluginModule):
                  bounding_box_grouping_function,
                  shaped_grouping_function,
                  least_squares_fit, least_squares_fit_xy,
-                 edit_distance]
+                 edit_distance, edit_distances,
+                 least_squares_fit_lines]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
 
@@ -129,3 +169,5 @@ shaped_grouping_function = shaped_grouping_function()
 least_squares_fit = least_squares_fit()
 least_squares_fit_xy = least_squares_fit_xy()
 edit_distance = edit_distance()
+edit_distances = edit_distances()
+least_squares_fit_lines = least_squares_fit_lines()
@@ -21,6 +21,7 @@
 #
 
 from gamera.plugin import *
+from gamera.__compiletime_config__ import has_openmp
 import _threshold
 
 class threshold(PluginFunction):
@@ -37,10 +38,13 @@ class threshold(PluginFunction):
         no compression
       RLE (1)
         run-length encoding compression.
+      PACKED (2)
+        bit-packed, one bit per pixel (OneBit only).
     """
     self_type = ImageType([GREYSCALE, GREY16, FLOAT])
-    args = Args([Int("threshold"), Choice("storage format", ['dense', 'rle'])])
+    args = Args([Int("threshold"), Choice("storage format", ['dense', 'rle', 'packed'])])
     return_type = ImageType([ONEBIT], "output")
+    pure = True
     doc_examples = [(GREYSCALE, 128)]
     def __call__(image, threshold, storage_format = 0):
         return _threshold.threshold(image, threshold, storage_format)
@@ -56,6 +60,7 @@ class otsu_find_threshold(PluginFunction):
     """
     self_type = ImageType([GREYSCALE])
     return_type = Int("threshold_point")
+    pure = True
     doc_examples = [(GREYSCALE,)]
 
 class otsu_threshold(PluginFunction):
@@ -72,10 +77,13 @@ class otsu_threshold(PluginFunction):
         no compression
       RLE (1)
         run-length encoding compression
+      PACKED (2)
+        bit-packed, one bit per pixel (OneBit only)
     """
     self_type = ImageType([GREYSCALE])
-    args = Args(Choice("storage format", ['dense', 'rle']))
+    args = Args(Choice("storage format", ['dense', 'rle', 'packed']))
     return_type = ImageType([ONEBIT], "output")
+    pure = True
     doc_examples = [(GREYSCALE,)]
     def __call__(image, storage_format = 0):
         return _threshold.otsu_threshold(image, storage_format)
@@ -92,6 +100,7 @@ class tsai_moment_preserving_find_threshold(PluginFunction):
     """
     self_type = ImageType([GREYSCALE])
     return_type = Int("threshold_point")
+    pure = True
     doc_examples = [(GREYSCALE,)]
     author = "Uma Kompella"
 
@@ -110,10 +119,13 @@ class tsai_moment_preserving_threshold(PluginFunction):
         no compression
       RLE (1)
         run-length encoding compression
+      PACKED (2)
+        bit-packed, one bit per pixel (OneBit only)
     """
     self_type = ImageType([GREYSCALE])
-    args = Args(Choice("storage format", ['dense', 'rle']))
+    args = Args(Choice("storage format", ['dense', 'rle', 'packed']))
     return_type = ImageType([ONEBIT], "output")
+    pure = True
     doc_examples = [(GREYSCALE,)]
     author = "Uma Kompella"
     def __call__(image, storage_format = 0):
@@ -135,10 +147,13 @@ class abutaleb_threshold(PluginFunction):
         no compression
       RLE (1)
         run-length encoding compression
+      PACKED (2)
+        bit-packed, one bit per pixel (OneBit only)
     """
     self_type = ImageType([GREYSCALE])
-    args = Args(Choice("storage format", ['dense', 'rle']))
+    args = Args(Choice("storage format", ['dense', 'rle', 'packed']))
     return_type = ImageType([ONEBIT], "output")
+    pure = True
     doc_examples = [(GREYSCALE,)]
     def __call__(image, storage_format = 0):
         return _threshold.abutaleb_threshold(image, storage_format)
@@ -164,6 +179,8 @@ class bernsen_threshold(PluginFunction):
         no compression
       RLE (1)
         run-length encoding compression
+      PACKED (2)
+        bit-packed, one bit per pixel (OneBit only)
 
     *region_size*
       The size of each region in which to calculate a threshold
@@ -173,17 +190,29 @@ class bernsen_threshold(PluginFunction):
 
     *doubt_to_black*
       When ``True``, 'doubtful' values are set to black, otherwise to white.
+
+    *threads*
+      The number of threads among which bands of rows are divided.
+      When 0, the number of processors is used.  The result does not
+      depend on the number of threads.
+
+    The minimum and maximum of each region are computed with a constant
+    number of comparisons per pixel, so that the time does not grow
+    with *region_size*.
     """
     self_type = ImageType([GREYSCALE])
-    args = Args([Choice("storage format", ['dense', 'rle']),
+    args = Args([Choice("storage format", ['dense', 'rle', 'packed']),
                  Int("region size", range=(1, 50), default=11),
                  Int("contrast limit", range=(0, 255), default=80),
-                 Check("doubt_to_black", default=False)])
+                 Check("doubt_to_black", default=False),
+                 Int("threads", range=(0, 1024), default=0)])
     return_type = ImageType([ONEBIT], "output")
+    pure = True
+    release_gil = True
     doc_examples = [(GREYSCALE,)]
     def __call__(image, storage_format = 0, region_size = 11,
-                 contrast_limit = 80, doubt_to_black = False):
-        return _threshold.bernsen_threshold(image, storage_format, region_size, contrast_limit, doubt_to_black)
+                 contrast_limit = 80, doubt_to_black = False, threads = 0):
+        return _threshold.bernsen_threshold(image, storage_format, region_size, contrast_limit, doubt_to_black, threads)
     __call__ = staticmethod(__call__)
 
 class djvu_threshold(PluginFunction):
@@ -220,17 +249,27 @@ class djvu_threshold(PluginFunction):
       The number of child blocks (in each direction) per parent block.
       For instance, a *block_factor* of 2 results in 4 children per
       parent.
+
+    *threads*
+      The number of threads to use.  When 0, the number of processors
+      is used.  The colour histogram, the blocks of each level of the
+      block hierarchy and the final thresholding are computed in
+      parallel; the result does not depend on the number of threads.
     """
     self_type = ImageType([RGB])
     args = Args([Float("smoothness", default=0.2, range=(0.0, 1.0)),
                  Int("max_block_size", default=512),
                  Int("min_block_size", default=64),
-                 Int("block_factor", default=2, range=(1, 8))])
+                 Int("block_factor", default=2, range=(1, 8)),
+                 Int("threads", range=(0, 1024), default=0)])
     return_type = ImageType([ONEBIT], "output")
+    pure = True
+    release_gil = True
     def __call__(image, smoothness=0.2, max_block_size=512, min_block_size=64,
-                 block_factor=2):
+                 block_factor=2, threads=0):
         return _threshold.djvu_threshold(image, smoothness, max_block_size,
-                                         min_block_size, block_factor)
+                                         min_block_size, block_factor,
+                                         threads)
     __call__ = staticmethod(__call__)
     doc_examples = [(RGB, 0.5, 512, 64, 2)]
 
@@ -245,5 +284,8 @@ class ThresholdModule(PluginModule):
                  bernsen_threshold, djvu_threshold]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
+    if has_openmp:
+        extra_compile_args = ["-fopenmp"]
+        extra_link_args = ["-fopenmp"]
 
 module = ThresholdModule()
@@ -19,6 +19,7 @@
 #
 
 from gamera.plugin import *
+from gamera.__compiletime_config__ import has_openmp
 import sys
 import glob
 import _tiff_support
@@ -47,10 +48,12 @@ class load_tiff(PluginFunction):
         no compression
       RLE (1)
         run-length encoding compression
+      PACKED (2)
+        bit-packed, one bit per pixel (OneBit only)
     """
     self_type = None
     args = Args([FileOpen("image_file_name", "", "*.tiff;*.tif"),
-                 Choice("storage format", ["DENSE", "RLE"])])
+                 Choice("storage format", ["DENSE", "RLE", "PACKED"])])
     return_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB, FLOAT])
     def __call__(filename, compression = 0):
         return _tiff_support.load_tiff(filename, compression)
@@ -59,18 +62,263 @@ class load_tiff(PluginFunction):
 load_tiff_class = load_tiff
 load_tiff = load_tiff()
 
+class load_tiff_region(PluginFunction):
+    """
+    Loads the part of a TIFF file within a rectangle.  The result has
+    the offset of the rectangle, as if it were a subimage of the whole
+    image.  Only the strips or tiles of the file that overlap the
+    rectangle are decoded, so this is much faster than loading the
+    whole image for a small region of a large (tiled) scan.
+
+    *image_file_name*
+      A TIFF image filename
+
+    *rect*
+      The region to load, in the coordinates of the whole image
+
+    *storage_format* (optional)
+      specifies the compression type for the result (see load_tiff)
+    """
+    self_type = None
+    args = Args([FileOpen("image_file_name", "", "*.tiff;*.tif"),
+                 Rect("rect"),
+                 Choice("storage format", ["DENSE", "RLE", "PACKED"])])
+    return_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB])
+    def __call__(filename, rect, compression = 0):
+        return _tiff_support.load_tiff_region(filename, rect, compression)
+    __call__ = staticmethod(__call__)
+    exts = ["tiff", "tif"]
+load_tiff_region_class = load_tiff_region
+load_tiff_region = load_tiff_region()
+
+class load_tiff_from_bytes(PluginFunction):
+    """
+    Loads a TIFF image from a string holding the contents of a TIFF
+    file, such as one received over the network, without writing it to
+    disk.  Only the first page of multi-page files is loaded.
+
+    *data*
+      The TIFF file as a string
+
+    *storage_format* (optional)
+      specifies the compression type for the result (see load_tiff)
+    """
+    self_type = None
+    args = Args([Class("data"),
+                 Choice("storage format", ["DENSE", "RLE", "PACKED"])])
+    return_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB])
+    def __call__(data, compression = 0):
+        return _tiff_support.load_tiff_from_bytes(data, compression)
+    __call__ = staticmethod(__call__)
+
+class tiff_page_count(PluginFunction):
+    """
+    Returns the number of pages of a (multi-page) TIFF file.
+
+    *image_file_name*
+      A TIFF image filename"""
+    self_type = None
+    args = Args([String("image_file_name")])
+    return_type = Int("page_count")
+
+class load_tiff_page(PluginFunction):
+    """
+    Loads one page of a multi-page TIFF file.  Only that page is
+    decoded, so the pages of a large file can be processed one at a
+    time without splitting the file first.
+
+    *image_file_name*
+      A TIFF image filename
+
+    *page*
+      The page, from 0 to ``tiff_page_count`` - 1
+
+    *storage_format* (optional)
+      specifies the compression type for the result (see load_tiff)
+    """
+    self_type = None
+    args = Args([FileOpen("image_file_name", "", "*.tiff;*.tif"),
+                 Int("page", range=(0, 65535)),
+                 Choice("storage format", ["DENSE", "RLE", "PACKED"])])
+    return_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB])
+    def __call__(filename, page, compression = 0):
+        return _tiff_support.load_tiff_page(filename, page, compression)
+    __call__ = staticmethod(__call__)
+
+class load_tiff_pages(PluginFunction):
+    """
+    Loads *count* pages of a multi-page TIFF file, from page *first* on,
+    and returns them as a list (shorter at the end of the file).  The
+    pages are decoded in parallel.
+
+    *image_file_name*
+      A TIFF image filename
+
+    *first*
+      The first page to load
+
+    *count*
+      The number of pages to load
+
+    *storage_format* (optional)
+      specifies the compression type for the result (see load_tiff)
+
+    *threads*
+      The number of threads decoding pages (0 for as many as there are
+      processors).  Without OpenMP support, the pages are decoded one
+      after the other.
+
+    To process all pages of a file, use ``iter_tiff_pages``.
+    """
+    self_type = None
+    args = Args([FileOpen("image_file_name", "", "*.tiff;*.tif"),
+                 Int("first", range=(0, 65535)),
+                 Int("count", range=(1, 65536)),
+                 Choice("storage format", ["DENSE", "RLE", "PACKED"]),
+                 Int("threads", range=(0, 1024), default=0)])
+    return_type = ImageList("pages")
+    def __call__(filename, first, count, compression = 0, threads = 0):
+        return _tiff_support.load_tiff_pages(filename, first, count,
+                                             compression, threads)
+    __call__ = staticmethod(__call__)
+
 class save_tiff(PluginFunction):
     """
     Saves an image to disk in TIFF format.
 
     *image_file_name*
       A TIFF image filename
+
+    *compression* (optional)
+      *none* or *Group 4* (CCITT T.6, the fax compression, which is
+      only available for OneBit images).  Group 4 files are usually
+      much smaller than uncompressed ones, and loading them as RLE
+      images is fast.
     """
     self_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB])
-    args = Args([FileSave("image_file_name", "image.tiff", "*.tiff;*.tif")])
+    read_only = True
+    release_gil = True
+    args = Args([FileSave("image_file_name", "image.tiff", "*.tiff;*.tif"),
+                 Choice("compression", ["none", "Group 4"], default=0)])
     return_type = None
     exts = ["tiff", "tif"]
 
+class save_tiff_to_bytes(PluginFunction):
+    """
+    Returns the image encoded in TIFF format, as a string, without
+    writing it to disk.  *compression* is the same as for save_tiff.
+    """
+    self_type = ImageType([ONEBIT, GREYSCALE, GREY16, RGB])
+    read_only = True
+    args = Args([Choice("compression", ["none", "Group 4"], default=0)])
+    return_type = Class("data")
+
+class stream_binarize_tiff(PluginFunction):
+    """
+    Binarizes a TIFF file with ``sauvola_threshold``, optionally removes
+    speckles with ``despeckle``, and saves the result as a OneBit TIFF
+    file.  The image is read, processed and written in horizontal
+    bands, so the memory needed depends on the band height and not on
+    the size of the image.  This makes it possible to binarize scans
+    that are too large to be loaded.
+
+    The result is the same as that of loading the image, converting it
+    to greyscale with ``to_greyscale``, and calling ``sauvola_threshold`` and
+    ``despeckle`` on it.
+
+    *image_file_name*
+      A greyscale, 16 bit greyscale or RGB TIFF image filename
+
+    *output_file_name*
+      The filename of the OneBit TIFF image
+
+    *region_size*, *sensitivity*, *dynamic_range*, *lower_bound*, *upper_bound*
+      The arguments of ``sauvola_threshold``.
+
+    *despeckle_size*
+      The connected components with fewer pixels are removed.  When 0,
+      the image is not despeckled.
+
+    *band_height*
+      The number of rows processed at once (at least *region_size*).
+      Each band is processed together with the *region_size* / 2 +
+      *despeckle_size* rows above and below it.
+    """
+    self_type = None
+    args = Args([FileOpen("image_file_name", "", "*.tiff;*.tif"),
+                 FileSave("output_file_name", "image.tiff", "*.tiff;*.tif"),
+                 Int("region size", default=15),
+                 Real("sensitivity", default=0.5),
+                 Int("dynamic range", range=(1, 255), default=128),
+                 Int("lower bound", range=(0,255), default=20),
+                 Int("upper bound", range=(0,255), default=150),
+                 Int("despeckle size", range=(0, 100), default=0),
+                 Int("band height", range=(1, 65536), default=512)])
+    return_type = None
+    def __call__(filename, output_filename, region_size=15, sensitivity=0.5,
+                 dynamic_range=128, lower_bound=20, upper_bound=150,
+                 despeckle_size=0, band_height=512):
+        return _tiff_support.stream_binarize_tiff(
+            filename, output_filename, region_size, sensitivity,
+            dynamic_range, lower_bound, upper_bound, despeckle_size,
+            band_height)
+    __call__ = staticmethod(__call__)
+
+class map_tiff(PluginFunction):
+    """
+    Maps a TIFF file into memory instead of loading it.  The pixels are
+    only read from the file when they are accessed, so opening a large
+    image to cut out a few regions is nearly instant, and the memory is
+    shared between processes that map the same file.  Changing the
+    pixels of the image does not change the file.
+
+    Only uncompressed 8 bit greyscale and RGB images whose strips follow
+    each other in the file (as saved by save_tiff) can be mapped.  When
+    Gamera is built with ``--grey16=native``, 16 bit greyscale images in
+    the byte order of the machine can be mapped as well.
+    Memory mapping is not available on Windows.
+
+    *image_file_name*
+      A TIFF image filename
+    """
+    self_type = None
+    args = Args([FileOpen("image_file_name", "", "*.tiff;*.tif")])
+    return_type = ImageType([GREYSCALE, GREY16, RGB])
+
+class map_raw(PluginFunction):
+    """
+    Maps a file holding uncompressed pixels into memory as an image, in
+    the same way as map_tiff.
+
+    *image_file_name*
+      The filename
+
+    *pixel_type*
+      The type of the pixels, stored row by row in the native byte
+      order and in the size Gamera uses in memory (e.g. 4 bytes for
+      GREY16, or 2 bytes when Gamera is built with ``--grey16=native``,
+      and 8 bytes for FLOAT).
+
+    *ncols*, *nrows*
+      The size of the image
+
+    *offset*
+      The position of the first pixel in the file
+    """
+    self_type = None
+    args = Args([FileOpen("image_file_name", "", "*.*"),
+                 Choice("pixel_type",
+                        ["ONEBIT", "GREYSCALE", "GREY16", "RGB", "FLOAT",
+                         "COMPLEX"]),
+                 Int("ncols", range=(1, 2147483647)),
+                 Int("nrows", range=(1, 2147483647)),
+                 Int("offset", range=(0, 2147483647), default=0)])
+    return_type = ImageType(ALL)
+    def __call__(filename, pixel_type, ncols, nrows, offset=0):
+        return _tiff_support.map_raw(filename, pixel_type, ncols, nrows,
+                                     offset)
+    __call__ = staticmethod(__call__)
+
 class TiffSupportModule(PluginModule):
     category = "File"
     cpp_headers = ["tiff_support.hpp"]
@@ -97,7 +345,13 @@ class TiffSupportModule(PluginModule):
 	extra_compile_args = ['-Dunix']
     else:
         extra_libraries = ["tiff"]
-    functions = [tiff_info, load_tiff_class, save_tiff]
+        if has_openmp:
+            extra_compile_args = ["-fopenmp"]
+            extra_link_args = ["-fopenmp"]
+    functions = [tiff_info, tiff_page_count, load_tiff_class,
+                 load_tiff_region_class, load_tiff_page, load_tiff_pages,
+                 load_tiff_from_bytes, save_tiff, save_tiff_to_bytes,
+                 stream_binarize_tiff, map_tiff, map_raw]
     cpp_include_dirs = ["src/libtiff"]
     author = "Michael Droettboom and Karl MacMillan"
     url = "http://gamera.sourceforge.net/"
@@ -105,3 +359,21 @@ class TiffSupportModule(PluginModule):
 module = TiffSupportModule()
 
 tiff_info = tiff_info()
+tiff_page_count = tiff_page_count()
+load_tiff_page = load_tiff_page()
+load_tiff_pages = load_tiff_pages()
+load_tiff_from_bytes = load_tiff_from_bytes()
+stream_binarize_tiff = stream_binarize_tiff()
+map_tiff = map_tiff()
+map_raw = map_raw()
+
+def iter_tiff_pages(filename, compression=0, prefetch=0):
+    """Iterates over the pages of a multi-page TIFF file, loading them on
+demand.  With *prefetch* > 0, the next *prefetch* pages are decoded in
+parallel together with the current one, so that decoding a large file
+uses several processors."""
+    count = tiff_page_count(filename)
+    for first in range(0, count, prefetch + 1):
+        for page in load_tiff_pages(filename, first, prefetch + 1,
+                                    compression):
+            yield page
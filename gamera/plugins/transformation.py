@@ -45,12 +45,20 @@ class rotate(PluginFunction):
       When *bgcolor* is ``None``, white is used.
 
     *order*
-      The order of the spline used for interpolation.  Must be between 1 - 3.
+      The order of the spline used for interpolation.  Must be between 0 - 3.
+      Order 0 does not interpolate: the image is rotated by three shears
+      that only move whole rows and columns, which keeps the pixels of
+      ONEBIT images black or white and is fast for deskewing scanned
+      pages by a few degrees.  Pixels may then be off by one from their
+      exact position.
+
+    Rotations by multiples of 90 degrees copy the pixels without
+    interpolation, whatever the *order*.
     """
     category = "Transformation"
     self_type = ImageType(ALL)    
     return_type = ImageType(ALL)
-    args = Args([Float("angle"), Pixel("bgcolor", default=NoneDefault), Int("order", range=(1,3), default=1)])
+    args = Args([Float("angle"), Pixel("bgcolor", default=NoneDefault), Int("order", range=(0,3), default=1)])
     args.list[0].rng = (-180,180)
     doc_examples = [(RGB, 32.0, RGBPixel(255, 255, 255), 3), (COMPLEX, 15.0, 0.0j, 3)]
     author = u"Michael Droettboom (With code from VIGRA by Ullrich K\u00f6the)"
@@ -82,6 +90,7 @@ class resize(PluginFunction):
     self_type = ImageType(ALL)
     args = Args([Dim("dim"), Choice("interp_type", ["None", "Linear", "Spline"])])
     return_type = ImageType(ALL)
+    release_gil = True
 
 class scale(PluginFunction):
     """
@@ -107,8 +116,52 @@ class scale(PluginFunction):
     args= Args([Real("scaling"),
                 Choice("interp_type", ["None", "Linear", "Spline"])])
     return_type = ImageType(ALL)
+    release_gil = True
     doc_examples = [(RGB, 0.5, 2), (RGB, 2.0, 2)]
 
+class downscale_area(PluginFunction):
+    """
+    Returns a copy of the image shrunk by an integer *factor*, each pixel
+    being the mean of a *factor* x *factor* block of the image (or of the
+    part of it inside the image at the right and bottom edges).
+
+    Unlike scale_, this takes every pixel into account, so that reduced
+    ONEBIT images are not aliased.  ONEBIT images give a GREYSCALE image
+    whose pixels are darker the more black pixels their block holds.
+
+    *factor*
+      The factor by which the width and height are divided (rounded up).
+
+    .. _scale: #scale
+    """
+    category = "Transformation"
+    self_type = ImageType([ONEBIT, GREYSCALE, GREY16, FLOAT, RGB])
+    args = Args([Int("factor", range=(1, 1024), default=8)])
+    return_type = ImageType([GREYSCALE, GREY16, FLOAT, RGB])
+    release_gil = True
+    doc_examples = [(ONEBIT, 4), (RGB, 4)]
+
+class image_pyramid(PluginFunction):
+    """
+    Returns a list of *levels* images, each being the previous one (or
+    the image) halved by downscale_area_.
+
+    Every level is computed from the pixels of the image, not from the
+    rounded pixels of the previous level, and all levels are built in a
+    single pass over the image, as is needed for previews and thumbnails
+    at several sizes.
+
+    *levels*
+      The number of images returned.
+
+    .. _downscale_area: #downscale-area
+    """
+    category = "Transformation"
+    self_type = ImageType([ONEBIT, GREYSCALE, GREY16, FLOAT, RGB])
+    args = Args([Int("levels", range=(1, 32), default=4)])
+    return_type = ImageList("pyramid")
+    release_gil = True
+
 class shear_row(PluginFunction):
     """
     Shears a given row by a given amount.
@@ -163,7 +216,7 @@ class mirror_vertical(PluginFunction):
 class TransformationModule(PluginModule):
     cpp_headers=["transformation.hpp"]
     category = "Transformation"
-    functions = [rotate, resize, scale,
+    functions = [rotate, resize, scale, downscale_area, image_pyramid,
                  shear_row, shear_column,
                  mirror_horizontal, mirror_vertical]
     author = "Michael Droettboom, Karl MacMillan, and Christoph Dalitz"
@@ -0,0 +1,465 @@
+# -*- mode: python; indent-tabs-mode: nil; tab-width: 3 -*-
+# vim: set tabstop=3 shiftwidth=3 expandtab:
+#
+# Copyright (C) 2001-2009 Ichiro Fujinaga, Michael Droettboom,
+#                         Karl MacMillan, and Christoph Dalitz
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+"""A cache of the results of the plugin methods marked as ``pure``,
+keyed by a hash of the pixels of their images and their arguments.
+
+The cache is disabled by default.  Once enabled with enable_, a pure
+plugin method called again on images with the same pixels (and the
+same position and size) and with the same arguments returns a copy of
+the result of the first call instead of computing it again.  The
+results are kept in memory, the least recently used being dropped when
+they take more than *max_bytes*, and optionally in a directory as well,
+where they are kept between runs and shared by the processes using the
+same directory.  The results are only found again for the same version
+of Gamera and the same build of the plugin.
+
+Only results made of numbers, strings, arrays, images (not connected
+components) and lists, tuples and dicts of these are cached, and only
+for arguments made of numbers, strings, geometric types, pixels and
+images; the other calls are computed every time."""
+
+import os, sys, array, struct, inspect, hashlib, threading, thread
+from gamera import gameracore
+
+_enabled = False
+_max_bytes = 0
+_directory = None
+_lock = threading.Lock()
+# key -> [last use, result, size]
+_entries = {}
+_bytes = 0
+_tick = 0
+_hits = 0
+_disk_hits = 0
+_misses = 0
+
+def enable(max_bytes=256 << 20, directory=None):
+   """Starts caching the results of pure plugin methods.  At most
+*max_bytes* of results are kept in memory.  When *directory* is given,
+the results are stored there as well, and looked up there when they
+are not in memory.  The directory is created when needed and is never
+pruned; remove its files (or call clear(True)) to free the space.
+
+Since the results are read back from the directory, it must be private:
+on Unix, a directory that is not owned by the user or that others may
+access (a mode other than 0700) is refused with an IOError."""
+   global _enabled, _max_bytes, _directory, _hits, _disk_hits, _misses
+   if directory is not None:
+      if not os.path.isdir(directory):
+         os.makedirs(directory, 0700)
+      _check_private(directory)
+   _hits = _disk_hits = _misses = 0
+   _max_bytes = max_bytes
+   _directory = directory
+   _enabled = True
+   _lock.acquire()
+   try:
+      _evict()
+   finally:
+      _lock.release()
+
+def _check_private(directory):
+   if not hasattr(os, "getuid"):
+      return
+   info = os.stat(directory)
+   if info.st_uid != os.getuid() or info.st_mode & 077:
+      raise IOError(
+         "The result cache directory '%s' must be owned by the user and "
+         "have the mode 0700." % directory)
+
+def disable():
+   """Stops caching the results of pure plugin methods and drops the
+results kept in memory."""
+   global _enabled
+   _enabled = False
+   clear()
+
+def clear(disk=False):
+   """Drops the results kept in memory, and those stored in the
+directory as well when *disk* is true."""
+   global _entries, _bytes
+   _lock.acquire()
+   try:
+      _entries = {}
+      _bytes = 0
+   finally:
+      _lock.release()
+   if disk and _directory is not None:
+      for name in os.listdir(_directory):
+         if name.endswith(".result"):
+            try:
+               os.remove(os.path.join(_directory, name))
+            except OSError:
+               pass
+
+def stats():
+   """Returns (*hits*, *disk_hits*, *misses*, *entries*, *bytes*): the
+calls answered from memory, from the directory and computed since the
+cache was enabled, and the number and size of the results in memory."""
+   return (_hits, _disk_hits, _misses, len(_entries), _bytes)
+
+class _Uncacheable(Exception):
+   pass
+
+_scalar_types = (bool, int, long, float, complex, str, unicode)
+
+def _image_key(image):
+   digest = hashlib.sha1()
+   if isinstance(image, gameracore.MlCc):
+      labels = image.get_labels()
+      labels.sort()
+      label = tuple(labels)
+   elif isinstance(image, gameracore.Cc):
+      label = image.label
+   else:
+      label = None
+   try:
+      if label is not None:
+         # the pixels of other labels do not belong to the image
+         raise BufferError
+      digest.update(memoryview(image))
+   except (BufferError, TypeError):
+      digest.update(image._to_raw_string())
+   data = image.data
+   return ("image", data.pixel_type, data.storage_format, image.ul_x,
+           image.ul_y, image.ncols, image.nrows, label, digest.hexdigest())
+
+def _arg_key(value):
+   if value is None or isinstance(value, _scalar_types):
+      return value
+   if isinstance(value, gameracore.Image):
+      return _image_key(value)
+   if isinstance(value, (gameracore.Point, gameracore.FloatPoint,
+                         gameracore.Dim, gameracore.Size, gameracore.Rect,
+                         gameracore.RGBPixel)):
+      return repr(value)
+   if type(value) in (list, tuple):
+      return (type(value).__name__,) + tuple([_arg_key(x) for x in value])
+   raise _Uncacheable()
+
+def _key(identity, args, kwargs):
+   items = kwargs.items()
+   items.sort()
+   key = (identity, tuple([_arg_key(x) for x in args]),
+          tuple([(k, _arg_key(v)) for k, v in items]))
+   return hashlib.sha1(repr(key)).hexdigest()
+
+def _copy(value):
+   # results are copied in and out of the cache, so that changes to
+   # them do not change the cache
+   if value is None or isinstance(value, _scalar_types):
+      return value
+   if isinstance(value, gameracore.Image):
+      if isinstance(value, (gameracore.Cc, gameracore.MlCc)):
+         raise _Uncacheable()
+      # dense copies share the pixels until either image is changed
+      return value.image_copy(value.data.storage_format)
+   if isinstance(value, array.array):
+      return array.array(value.typecode, value)
+   if type(value) in (list, tuple):
+      return type(value)([_copy(x) for x in value])
+   if type(value) is dict:
+      return dict([(k, _copy(v)) for k, v in value.items()])
+   raise _Uncacheable()
+
+def _size(value):
+   if isinstance(value, gameracore.Image):
+      return int(value.data.mbytes * 1048576) + 64
+   if isinstance(value, array.array):
+      return len(value) * value.itemsize + 64
+   if isinstance(value, (str, unicode)):
+      return len(value) + 64
+   if type(value) in (list, tuple):
+      return sum([_size(x) for x in value]) + 64
+   if type(value) is dict:
+      return sum([_size(x) for x in value.values()]) + 64
+   return 32
+
+def _evict():
+   # drops the least recently used results (with the lock held)
+   global _bytes
+   while _bytes > _max_bytes and len(_entries):
+      oldest = min([(entry[0], key) for key, entry in _entries.items()])[1]
+      _bytes -= _entries[oldest][2]
+      del _entries[oldest]
+
+def _remember(key, value):
+   global _bytes, _tick
+   size = _size(value)
+   if size > _max_bytes:
+      return
+   _lock.acquire()
+   try:
+      if key not in _entries:
+         _tick += 1
+         _entries[key] = [_tick, value, size]
+         _bytes += size
+         _evict()
+   finally:
+      _lock.release()
+
+def _lookup(key):
+   global _tick
+   _lock.acquire()
+   try:
+      entry = _entries.get(key)
+      if entry is not None:
+         _tick += 1
+         entry[0] = _tick
+         return True, entry[1]
+   finally:
+      _lock.release()
+   return False, None
+
+# The results are stored in a format of their own rather than pickled,
+# since unpickling a file of the directory could run any code: a magic
+# string and then each value as a tag followed by its data, the lengths
+# and numbers being little-endian.  Reading a file only ever builds the
+# types below.
+_magic = "GAMERA-RESULT-1\n"
+
+def _encode(value, out):
+   if value is None:
+      out.append("N")
+   elif value is True:
+      out.append("T")
+   elif value is False:
+      out.append("F")
+   elif type(value) is int:
+      out.append("i" + struct.pack("<q", value))
+   elif type(value) is long:
+      _encode_bytes("l", str(value), out)
+   elif type(value) is float:
+      out.append("f" + struct.pack("<d", value))
+   elif type(value) is complex:
+      out.append("c" + struct.pack("<dd", value.real, value.imag))
+   elif type(value) is str:
+      _encode_bytes("s", value, out)
+   elif type(value) is unicode:
+      _encode_bytes("u", value.encode("utf-8"), out)
+   elif isinstance(value, array.array):
+      out.append("a" + value.typecode)
+      _encode_bytes("", value.tostring(), out)
+   elif isinstance(value, gameracore.Image):
+      data = value.data
+      out.append("I" + struct.pack("<6qd", data.pixel_type,
+                                   data.storage_format, value.ul_x,
+                                   value.ul_y, value.ncols, value.nrows,
+                                   value.resolution))
+      _encode_bytes("", value._to_raw_string(), out)
+   elif type(value) in (list, tuple):
+      if type(value) is list:
+         out.append("L")
+      else:
+         out.append("U")
+      out.append(struct.pack("<I", len(value)))
+      for x in value:
+         _encode(x, out)
+   elif type(value) is dict:
+      out.append("D" + struct.pack("<I", len(value)))
+      for k, v in value.items():
+         _encode(k, out)
+         _encode(v, out)
+   else:
+      raise _Uncacheable()
+
+def _encode_bytes(tag, value, out):
+   out.append(tag + struct.pack("<I", len(value)))
+   out.append(value)
+
+class _Corrupt(Exception):
+   pass
+
+class _Decoder:
+   def __init__(self, data):
+      self.data = data
+      self.pos = 0
+
+   def take(self, n):
+      if n < 0 or self.pos + n > len(self.data):
+         raise _Corrupt()
+      start = self.pos
+      self.pos += n
+      return self.data[start:self.pos]
+
+   def unpack(self, format):
+      return struct.unpack(format, self.take(struct.calcsize(format)))
+
+   def bytes(self):
+      return self.take(self.unpack("<I")[0])
+
+   def value(self):
+      tag = self.take(1)
+      if tag == "N":
+         return None
+      if tag == "T":
+         return True
+      if tag == "F":
+         return False
+      if tag == "i":
+         return int(self.unpack("<q")[0])
+      if tag == "l":
+         return long(self.bytes())
+      if tag == "f":
+         return self.unpack("<d")[0]
+      if tag == "c":
+         return complex(*self.unpack("<dd"))
+      if tag == "s":
+         return self.bytes()
+      if tag == "u":
+         return self.bytes().decode("utf-8")
+      if tag == "a":
+         result = array.array(self.take(1))
+         result.fromstring(self.bytes())
+         return result
+      if tag == "I":
+         return self.image()
+      if tag in ("L", "U"):
+         result = [self.value() for i in xrange(self.unpack("<I")[0])]
+         if tag == "U":
+            return tuple(result)
+         return result
+      if tag == "D":
+         result = {}
+         for i in xrange(self.unpack("<I")[0]):
+            k = self.value()
+            result[k] = self.value()
+         return result
+      raise _Corrupt()
+
+   def image(self):
+      from gamera.core import Point, Dim, DENSE
+      from gamera.plugins import _string_io
+      (pixel_type, storage_format, ul_x, ul_y, ncols, nrows,
+       resolution) = self.unpack("<6qd")
+      image = _string_io._from_raw_string(
+         Point(ul_x, ul_y), Dim(ncols, nrows), pixel_type, DENSE,
+         self.bytes())
+      if storage_format != DENSE:
+         image = image.image_copy(storage_format)
+      image.resolution = resolution
+      return image
+
+def _read(directory, key):
+   try:
+      fd = open(os.path.join(directory, key + ".result"), "rb")
+   except IOError:
+      return False, None
+   try:
+      try:
+         data = fd.read()
+         if not data.startswith(_magic):
+            return False, None
+         decoder = _Decoder(data)
+         decoder.pos = len(_magic)
+         value = decoder.value()
+         if decoder.pos != len(data):
+            return False, None
+         return True, value
+      except Exception:
+         return False, None
+   finally:
+      fd.close()
+
+def _write(directory, key, value):
+   out = [_magic]
+   try:
+      _encode(value, out)
+   except _Uncacheable:
+      return
+   filename = os.path.join(directory, key + ".result")
+   # written aside and renamed, since several processes may share the
+   # directory
+   tmp = "%s.%d.%d" % (filename, os.getpid(), thread.get_ident())
+   try:
+      fd = open(tmp, "wb")
+      try:
+         fd.write("".join(out))
+      finally:
+         fd.close()
+      if sys.platform == 'win32' and os.path.exists(filename):
+         os.remove(filename)
+      os.rename(tmp, filename)
+   except (IOError, OSError):
+      try:
+         os.remove(tmp)
+      except OSError:
+         pass
+
+def _file_stamp(filename):
+   if filename is None:
+      return None
+   try:
+      info = os.stat(filename)
+   except OSError:
+      return (filename,)
+   return (os.path.abspath(filename), info.st_size, info.st_mtime)
+
+def _identity(plugin, module):
+   # the results stored in the directory are only those of the same
+   # version of Gamera and of the same build of the plugin
+   from gamera.__version__ import ver
+   try:
+      source = inspect.getfile(plugin)
+   except TypeError:
+      source = None
+   return (ver, plugin.__module__, plugin.__name__,
+           _file_stamp(source),
+           _file_stamp(getattr(module, "__file__", None)))
+
+def memoize(plugin, func, module=None):
+   """Returns *func* (the function of the plugin method *plugin*) with
+its results cached while the cache is enabled.  *module* is the C++
+module of the plugin, if any."""
+   identity = _identity(plugin, module)
+   def memoized(*args, **kwargs):
+      global _hits, _disk_hits, _misses
+      if not _enabled:
+         return func(*args, **kwargs)
+      try:
+         key = _key(identity, args, kwargs)
+      except _Uncacheable:
+         return func(*args, **kwargs)
+      found, value = _lookup(key)
+      if found:
+         _hits += 1
+         return _copy(value)
+      directory = _directory
+      if directory is not None:
+         found, value = _read(directory, key)
+         if found:
+            _disk_hits += 1
+            _remember(key, value)
+            return _copy(value)
+      _misses += 1
+      result = func(*args, **kwargs)
+      try:
+         value = _copy(result)
+      except _Uncacheable:
+         return result
+      _remember(key, value)
+      if directory is not None:
+         _write(directory, key, value)
+      return result
+   memoized.__name__ = getattr(func, "__name__", plugin.__name__)
+   memoized.__doc__ = func.__doc__
+   return memoized
@@ -69,6 +69,7 @@ of Python.  For instance, Python 2.3.x supports Unicode 3.2.0.
 """
 
 from gamera import core
+from gamera.rectindex import find_text_sections, find_text_lines
 import unicodedata
 import string
 
@@ -80,39 +81,6 @@ class Page:
         self.glyphs = glyphs
         self.section_search_size = 1
         self.__fill = 0
-        self.__noise_size = 0
-        self.__large_size = 0
-
-    def __section_size_test(self, glyph):
-        """Filter for section finding - removes very small and
-        very large glyphs"""
-        black_area = glyph.black_area()[0]
-        if black_area > self.__noise_size and \
-                glyph.nrows < self.__large_size and \
-                glyph.ncols < self.__large_size:
-            return 1
-        else:
-            return 0
-
-    def __avg_glyph_size(self, glyphs):
-        """Compute the average glyph size for the page"""
-        total = 0.0
-        for g in glyphs:
-            total += g.nrows
-            total += g.ncols
-        return total / (2 * len(glyphs))
-
-    def __find_intersecting_rects(self, glyphs, index):
-        """For section finding - return the index of glyphs intersecting
-        the glyph and the index passed in."""
-        g = glyphs[index]
-        inter = []
-        for i in range(len(glyphs)):
-            if i == index:
-                continue
-            if g.intersects(glyphs[i]):
-                inter.append(i)
-        return inter
 
     def segment(self):
         """Segment the page into sections and lines. Also computes
@@ -134,86 +102,27 @@ class Page:
         """Find the sections within an image - this finds large blocks
         of text making it possible to find the lines within complex
         text layouts."""
-      
+        # The glyphs that are neither noise nor very large are expanded
+        # by the average glyph size, and merged while they intersect
+        # (see gamera.rectindex.find_text_sections).
         glyphs = self.glyphs
+        black_areas = [g.black_area()[0] for g in glyphs]
+        section_of = find_text_sections(glyphs, black_areas,
+                                        self.section_search_size, self.image)
 
-        FUDGE = self.__avg_glyph_size(glyphs) * self.section_search_size
-
-        # remove noise and large objects
-        self.__noise_size = FUDGE
-        self.__large_size = FUDGE * 20
-        new_glyphs = []
-        for g in glyphs:
-            if self.__section_size_test(g):
-                new_glyphs.append(g)
-            else:
-                if self.__fill:
-                    g.fill_white()
-        glyphs = new_glyphs
-        
-        # Sort the glyphs left-to-right and top-to-bottom
-        glyphs.sort(lambda x, y: cmp(x.ul_x, y.ul_x))
-        glyphs.sort(lambda x, y: cmp(x.ul_y, y.ul_y))
-        
-        # Create rectangles for each glyph that are bigger by FUDGE
-        big_rects = []
-        for g in glyphs:
-            ul_y = max(0, g.ul_y - FUDGE)
-            ul_x = max(0, g.ul_x - FUDGE)
-            lr_y = min(self.image.lr_y, g.lr_y + FUDGE)
-            lr_x = min(self.image.lr_x, g.lr_x + FUDGE)
-            ul_x = int(ul_x); ul_y = int(ul_y)
-            nrows = int(lr_y - ul_y + 1)
-            ncols = int(lr_x - ul_x + 1)
-            big_rects.append(core.Rect(core.Point(ul_x, ul_y), core.Dim(ncols, nrows)))
-
-        # Search for intersecting glyphs and merge them. This is
-        # harder than it seems at first because we want everything
-        # to merge together that intersects regardless of the order
-        # in the list. It ends up being similar to connected-component
-        # labeling. This is prone to be kind-of slow.
-        current = 0
-        rects = big_rects
-        while(1):
-            # Find the indexexes of any rects that interesect with current
-            inter = self.__find_intersecting_rects(rects, current)
-            # If we found intersecting rectangles merge them with them current
-            # rect, remove them from the list, and start the whole process
-            # over. We start over to make certain that everything that should
-            # be merged is.
-            if len(inter):
-                g = rects[current]
-                new_rects = [g]
-                for i in range(len(rects)):
-                    if i == current:
-                        continue
-                    if i in inter:
-                        g.union(rects[i])
-                    else:
-                        new_rects.append(rects[i])
-                rects = new_rects
-                current = 0
-            # If we didn't find anything that intersected move on to the next
-            # rectangle.
-            else:
-                current += 1
-            # Bail when we are done.
-            if current >= len(rects):
-                break
-        
-        # Create the sections
-        sections = []
-        for rect in rects:
-            sections.append(Section(rect))
-        
         # Place the original (small) glyphs into the sections
-        for glyph in self.glyphs:
-            if self.__section_size_test(glyph):
-                for s in sections:
-                    if s.bbox.intersects(glyph):
-                        s.add_glyph(glyph)
-                        break
-        
+        sections = []
+        for glyph, i in zip(glyphs, section_of):
+            if i < 0:
+                if self.__fill:
+                    glyph.fill_white()
+                continue
+            while len(sections) <= i:
+                sections.append(None)
+            if sections[i] is None:
+                sections[i] = Section(glyph)
+            sections[i].add_glyph(glyph)
+
         # Fix up the bounding boxes
         for s in sections:
             s.calculate_bbox()
@@ -331,77 +240,22 @@ class Section:
         self.avg_line_width = total_lwidth / l
         
 
-    def __find_intersecting_lines(self, glyphs, index):
-        g = glyphs[index]
-        inter = []
-        for i in range(len(glyphs)):
-            if i == index:
-                continue
-            if g.bbox.intersects(glyphs[i].bbox):
-                inter.append(i)
-        return inter
-
     def find_lines(self):
-        # Remove abnormally tall glyphs that might interfer with
-        # line finding
+        """Find the lines of the section. Abnormally tall glyphs,
+        that might interfere with line finding, are put into the
+        lines afterwards (see gamera.rectindex.find_text_lines)."""
         self.calculate_glyph_stats()
-        tall_indexes = self.find_tall_glyphs()
-        tall = []
-        glyphs = []
-        for i in range(len(self.glyphs)):
-            if i in tall_indexes:
-                tall.append(self.glyphs[i])
-            else:
-                glyphs.append(self.glyphs[i])
-        orig_glyphs = self.glyphs
-        self.glyphs = glyphs
-        
-        # find the lines - this is very basic for now
+        glyphs = self.glyphs
+        line_glyphs, lost = find_text_lines(glyphs)
         lines = []
-        for glyph in self.glyphs:
-            found = 0
-            for line in lines:
-                if line.contains_glyph(glyph):
-                    line.add_glyph(glyph)
-                    found = 1
-                    break
-            if not found:
-                new_line = Line(glyph)
-                lines.append(new_line)
-
-        # Merge any overlapping lines
-        current = 0
-        while(1):
-            inter = self.__find_intersecting_lines(lines, current)
-            if len(inter):
-                new_lines = [lines[current]]
-                for i in range(len(lines)):
-                    if i == current:
-                        continue
-                    if i in inter:
-                        new_lines[0].merge(lines[i])
-                    else:
-                        new_lines.append(lines[i])
-                current = 0
-                lines = new_lines
-            else:
-                current += 1
-            if current >= len(lines):
-                break
-
-        # Put the tall glyphs back in by assigning them to the first line
-        # we come to that intersects.
-        for i in range(len(tall)):
-            for line in lines:
-                found = 0
-                if line.bbox.contains_y(tall[i].ul_y):
-                    line.add_glyph(tall[i])
-                    found = 1
-                    break
-            if not found:
-                print "Did not find lines for all tall glyphs"
-                
-        self.glyphs = orig_glyphs
+        for indices in line_glyphs:
+            line = Line(glyphs[indices[0]])
+            for i in indices[1:]:
+                line.glyphs.append(glyphs[i])
+                line.bbox.union(glyphs[i])
+            lines.append(line)
+        if len(lost):
+            print "Did not find lines for all tall glyphs"
         self.lines = lines
         
 
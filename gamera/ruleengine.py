@@ -136,8 +136,10 @@ class RuleEngine:
    _class_rules = []
 
    def __init__(self, rules=[], reapply=0):
+      import id_name_matching
       self.rules = {}
-      self._regexs = {}
+      # the symbol name regular expressions of all rule arguments
+      self._matcher = id_name_matching.IdNameMatcher()
       self._rules_by_regex = {}
       for rule in rules + self._class_rules:
          if isfunction(rule):
@@ -148,7 +150,6 @@ class RuleEngine:
       self._reapply = reapply
 
    def add_rule(self, rule):
-      import id_name_matching
       assert len(rule.func_defaults)
       self.rules[rule] = None
       regex = rule.func_defaults[0]
@@ -156,8 +157,7 @@ class RuleEngine:
          self._rules_by_regex[regex] = []
       self._rules_by_regex[regex].append(rule)
       for regex in rule.func_defaults:
-         if not self._regexs.has_key(regex):
-            self._regexs[regex] = id_name_matching.build_id_regex(regex)
+         self._matcher.add(regex)
          if not self._rules_by_regex.has_key(regex):
             self._rules_by_regex[regex] = []
 
@@ -194,11 +194,11 @@ class RuleEngine:
       try:
          grid_index = group.GridIndexWithKeys(glyphs, grid_size, grid_size)
          found_regexs = {}
-         for regex_string, compiled in self._regexs.items():
-            for glyph in glyphs:
-               if glyph.match_id_name(compiled):
-                  grid_index.add_glyph_by_key(glyph, regex_string)
-                  found_regexs[regex_string] = None
+         match = self._matcher.match
+         for glyph in glyphs:
+            for regex_string in match(glyph.get_main_id()):
+               grid_index.add_glyph_by_key(glyph, regex_string)
+               found_regexs[regex_string] = None
 
          # This loop is only so the progress bar can do something useful.
          for regex in found_regexs.iterkeys():
@@ -0,0 +1,235 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+  A pool of the pixel buffers of dense images.
+
+  Plugins create images for their results and temporaries, which are
+  freed again a few steps later in a pipeline.  For page-sized images
+  each of these allocations is a fresh memory mapping whose pages are
+  faulted in one by one and returned to the system when freed.  The
+  pool keeps a few of the freed buffers instead and hands them out
+  again for images of (nearly) the same size.
+
+  Buffers are rounded up to a quarter of a power of two (so that at
+  most a fifth of a buffer is unused), and only buffers of at least
+  BUFFER_POOL_MIN_BYTES are kept, as malloc deals well with the smaller
+  ones.  The pool holds at most BUFFER_POOL_SLOTS buffers and 128 MB,
+  or the number of megabytes in the environment variable
+  GAMERA_BUFFER_POOL_MB (0 disables the pool).
+
+  Each buffer starts with a header that holds its size, so that it can
+  be given back to the pool of any module, whichever module it was
+  allocated by.  The modules built from Python attach to the pool of
+  gameracore (see buffer_pool_attach in gameramodule.hpp), so that all
+  of them share one pool and its limit.  Until then, a module keeps a
+  pool of its own.
+*/
+
+#ifndef gamera_buffer_pool_hpp
+#define gamera_buffer_pool_hpp
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <sched.h>
+#endif
+
+#define BUFFER_POOL_SLOTS 16
+#define BUFFER_POOL_MIN_BYTES (256 * 1024)
+#define BUFFER_POOL_HEADER 16
+
+namespace Gamera {
+
+  struct BufferPoolState {
+    volatile long lock;
+    int initialized;
+    size_t max_bytes;
+    size_t bytes;
+    size_t nbuffers;
+    void* buffers[BUFFER_POOL_SLOTS];
+    size_t sizes[BUFFER_POOL_SLOTS];
+  };
+
+  inline BufferPoolState*& buffer_pool_pointer() {
+    static BufferPoolState* pointer = 0;
+    return pointer;
+  }
+
+  inline BufferPoolState& buffer_pool_state() {
+    BufferPoolState* pointer = buffer_pool_pointer();
+    if (pointer == 0) {
+      // the pool of this module, zero initialized before any code runs
+      static BufferPoolState state;
+      return state;
+    }
+    return *pointer;
+  }
+
+  // a spin lock on a long that is 0 while unlocked
+  inline void spin_lock(volatile long& lock) {
+#ifdef _MSC_VER
+    while (_InterlockedExchange(&lock, 1))
+      ;
+#else
+    while (__sync_lock_test_and_set(&lock, 1))
+      sched_yield();
+#endif
+  }
+
+  inline void spin_unlock(volatile long& lock) {
+#ifdef _MSC_VER
+    _InterlockedExchange(&lock, 0);
+#else
+    __sync_lock_release(&lock);
+#endif
+  }
+
+  inline void buffer_pool_lock(BufferPoolState& state) {
+    spin_lock(state.lock);
+  }
+
+  inline void buffer_pool_unlock(BufferPoolState& state) {
+    spin_unlock(state.lock);
+  }
+
+  // frees the oldest buffers until size more bytes fit into the pool
+  inline void buffer_pool_trim(BufferPoolState& state, size_t size) {
+    while (state.nbuffers > 0 &&
+           (state.nbuffers == BUFFER_POOL_SLOTS ||
+            state.bytes + size > state.max_bytes)) {
+      free(state.buffers[0]);
+      state.bytes -= state.sizes[0];
+      --state.nbuffers;
+      for (size_t i = 0; i < state.nbuffers; ++i) {
+        state.buffers[i] = state.buffers[i + 1];
+        state.sizes[i] = state.sizes[i + 1];
+      }
+    }
+  }
+
+  inline void buffer_pool_init(BufferPoolState& state) {
+    size_t mb = 128;
+    const char* env = getenv("GAMERA_BUFFER_POOL_MB");
+    if (env != 0)
+      mb = (size_t)atol(env);
+    state.max_bytes = mb * 1024 * 1024;
+    state.initialized = 1;
+  }
+
+  // The size of the buffer handed out for bytes bytes
+  inline size_t buffer_pool_round(size_t bytes) {
+    if (bytes < BUFFER_POOL_MIN_BYTES)
+      return bytes;
+    size_t step = 1;
+    while ((bytes >> 2) >= step)
+      step <<= 1;
+    step >>= 1;
+    return (bytes + step - 1) / step * step;
+  }
+
+  /*
+    Returns uninitialized memory for bytes bytes, aligned as new would.
+  */
+  inline void* buffer_pool_allocate(size_t bytes) {
+    size_t size = buffer_pool_round(bytes);
+    if (size >= BUFFER_POOL_MIN_BYTES) {
+      BufferPoolState& state = buffer_pool_state();
+      buffer_pool_lock(state);
+      for (size_t i = state.nbuffers; i-- > 0; ) {
+        if (state.sizes[i] == size) {
+          char* buffer = (char*)state.buffers[i];
+          --state.nbuffers;
+          state.buffers[i] = state.buffers[state.nbuffers];
+          state.sizes[i] = state.sizes[state.nbuffers];
+          state.bytes -= size;
+          buffer_pool_unlock(state);
+          return buffer + BUFFER_POOL_HEADER;
+        }
+      }
+      buffer_pool_unlock(state);
+    }
+    char* buffer = (char*)malloc(size + BUFFER_POOL_HEADER);
+    if (buffer == 0)
+      throw std::bad_alloc();
+    *(size_t*)buffer = size;
+    return buffer + BUFFER_POOL_HEADER;
+  }
+
+  /*
+    Gives back memory returned by buffer_pool_allocate.
+  */
+  inline void buffer_pool_free(void* data) {
+    if (data == 0)
+      return;
+    char* buffer = (char*)data - BUFFER_POOL_HEADER;
+    size_t size = *(size_t*)buffer;
+    if (size >= BUFFER_POOL_MIN_BYTES) {
+      BufferPoolState& state = buffer_pool_state();
+      buffer_pool_lock(state);
+      if (!state.initialized)
+        buffer_pool_init(state);
+      if (size <= state.max_bytes) {
+        // the oldest buffers make room for this one
+        buffer_pool_trim(state, size);
+        state.buffers[state.nbuffers] = buffer;
+        state.sizes[state.nbuffers] = size;
+        ++state.nbuffers;
+        state.bytes += size;
+        buffer_pool_unlock(state);
+        return;
+      }
+      buffer_pool_unlock(state);
+    }
+    free(buffer);
+  }
+
+  /*
+    Frees all the buffers kept by the pool.
+  */
+  inline void buffer_pool_clear() {
+    BufferPoolState& state = buffer_pool_state();
+    buffer_pool_lock(state);
+    for (size_t i = 0; i < state.nbuffers; ++i)
+      free(state.buffers[i]);
+    state.nbuffers = 0;
+    state.bytes = 0;
+    buffer_pool_unlock(state);
+  }
+
+  /*
+    Sets the most bytes the pool keeps (0 disables it), freeing the
+    oldest buffers that no longer fit.
+  */
+  inline void buffer_pool_set_limit(size_t bytes) {
+    BufferPoolState& state = buffer_pool_state();
+    buffer_pool_lock(state);
+    state.max_bytes = bytes;
+    state.initialized = 1;
+    buffer_pool_trim(state, 0);
+    buffer_pool_unlock(state);
+  }
+
+}
+
+#endif
@@ -201,6 +201,7 @@ namespace Gamera {
     // Misc
     //
     virtual T* data() const { return m_image_data; }
+    virtual void refresh() { calculate_iterators(); }
     ImageView<T> parent() {
       return ImageView<T>(*m_image_data, 0, 0, m_image_data->nrows(),
 			   m_image_data->ncols());
@@ -406,6 +407,7 @@ namespace Gamera {
       calculate_iterators();
 
       m_labels[label]=new Rect(rect);
+      m_label_mask.insert(label);
     }
     MultiLabelCC(T& image_data, value_type label,
 		       const Point& upper_left,
@@ -416,6 +418,7 @@ namespace Gamera {
       calculate_iterators();
 
       m_labels[label]=new Rect(upper_left, lower_right);
+      m_label_mask.insert(label);
     }
     MultiLabelCC(T& image_data, value_type label,
 		       const Point& upper_left,
@@ -426,6 +429,7 @@ namespace Gamera {
       calculate_iterators();
 
       m_labels[label]=new Rect(upper_left, size);
+      m_label_mask.insert(label);
     }
 
     MultiLabelCC(T& image_data, value_type label,
@@ -437,6 +441,7 @@ namespace Gamera {
       calculate_iterators();
 
       m_labels[label]=new Rect(upper_left, dim);
+      m_label_mask.insert(label);
     }
     
     //
@@ -513,6 +518,8 @@ namespace Gamera {
       }
       m_labels.clear();
       m_labels[label] = new Rect((Rect)*this);
+      m_label_mask.clear();
+      m_label_mask.insert(label);
       ConnectedComponent<T>* cc=new ConnectedComponent<T>( *((T*)this->data()), label, this->ul(), this->lr() );
       return cc;
     }
@@ -522,7 +529,7 @@ namespace Gamera {
     //
     value_type get(const Point& point) const{
       value_type tmp = *(m_const_begin + (point.y() * m_image_data->stride()) + point.x());
-      if(m_labels.find(tmp) != m_labels.end())
+      if(m_label_mask.contains(tmp))
         return tmp;
       else
         return 0;    		
@@ -548,6 +555,7 @@ namespace Gamera {
     // Misc
     //
     virtual T* data() const { return m_image_data; }
+    virtual void refresh() { calculate_iterators(); }
     ImageView<T> parent() {
       return ImageView<T>(*m_image_data, 0, 0, m_image_data->nrows(),
 			   m_image_data->ncols());
@@ -569,7 +577,7 @@ namespace Gamera {
     }
     
     bool has_label(value_type label) const {
-    	return m_labels.find(label) != m_labels.end();
+      return m_label_mask.contains(label);
     }
     
     void add_label(value_type label, Rect& rect) {
@@ -578,6 +586,7 @@ namespace Gamera {
       }
       //beware rect is only a reference and m_labels just stores pointers => you have to make a copy of rect
       m_labels[label]=new Rect(rect);
+      m_label_mask.insert(label);
       this->union_rect(rect);
     }
 
@@ -586,6 +595,7 @@ namespace Gamera {
       if(it!=m_labels.end()){
         delete it->second;
         m_labels.erase(label);
+        m_label_mask.erase(label);
         find_bounding_box();
       }
     }
@@ -625,7 +635,8 @@ namespace Gamera {
         mlcc=new self(*((T*)this->data()));
         mlccs.push_back(mlcc);
         for (size_t j=0; j<labelVector[i]->size(); j++){
-          Rect* rect=m_labels[labelVector[i]->at(j)];
+          it=m_labels.find(labelVector[i]->at(j));
+          Rect* rect=(it!=m_labels.end()) ? it->second : NULL;
           if(rect!=NULL){
             value_type label=(value_type)(labelVector[i]->at(j));
             mlcc->add_label(label, *rect);
@@ -633,6 +644,7 @@ namespace Gamera {
             //tidy up
             for (size_t k=0; k<mlccs.size(); k++)
               delete mlccs[k];
+            mlccs.clear();
             char error[64];
             sprintf(error, "There is no label %d stored in this MLCC.\n", labelVector[i]->at(j));
             throw std::runtime_error(error);
@@ -735,12 +747,16 @@ namespace Gamera {
     const typename std::map<value_type, Rect*>* get_labels_pointer() const {
       return &m_labels;
     }
+    const MLCCDetail::LabelMask* get_label_mask() const {
+      return &m_label_mask;
+    }
   private:
     void copy_labels(const self& other){
       typename std::map<value_type, Rect*>::const_iterator iter;
       for (iter = other.m_labels.begin(); iter != other.m_labels.end(); iter++){
         m_labels[iter->first]=new Rect(*(iter->second));
       }
+      m_label_mask=other.m_label_mask;
     }
 
     /*
@@ -796,6 +812,8 @@ namespace Gamera {
     // The labels/rects for this connected-component
     typename std::map<value_type, Rect*> m_labels;
     typename std::map<value_type, Rect*>::iterator it;
+    // The labels as a table for testing pixels
+    MLCCDetail::LabelMask m_label_mask;
 
     // The neighborhood-relations
     typename std::vector<int> m_neighbors;
@@ -24,6 +24,7 @@
 #include "accessor.hpp"
 #include "iterator_base.hpp"
 #include <map>
+#include <vector>
 
 namespace Gamera {
   namespace CCDetail {
@@ -326,17 +327,41 @@ namespace Gamera {
 
   namespace MLCCDetail {
 
+    /*
+      The labels of a MultiLabelCC as a flat table indexed by the pixel
+      value, so that testing a pixel is a single lookup instead of a
+      search in the map of label rects.
+    */
+    class LabelMask {
+    public:
+      bool contains(size_t label) const {
+        return label < m_mask.size() && m_mask[label];
+      }
+      void insert(size_t label) {
+        if (label >= m_mask.size())
+          m_mask.resize(label + 1, 0);
+        m_mask[label] = 1;
+      }
+      void erase(size_t label) {
+        if (label < m_mask.size())
+          m_mask[label] = 0;
+      }
+      void clear() { m_mask.clear(); }
+    private:
+      std::vector<unsigned char> m_mask;
+    };
+
     template<class T, class I>
     class MLCCProxy {
     public:
-      MLCCProxy(I i, const typename std::map<T, Rect*> *labels) : m_iter(i){ 
+      MLCCProxy(I i, const LabelMask *labels) : m_iter(i){ 
         this->m_labels=labels;
       }
 
       // conversion to T
       operator T() {
         T tmp = m_accessor(m_iter);
-        if (m_labels->find(tmp) != m_labels->end())
+        if (m_labels->contains(tmp))
           return tmp;
         else
           return 0;
@@ -344,12 +369,12 @@ namespace Gamera {
       // assignment only happens if the label matches
       void operator=(T value) {
         T tmp=m_accessor(m_iter);
-        if (m_labels->find(tmp) != m_labels->end())
+        if (m_labels->contains(tmp))
           m_accessor.set(value, m_iter);
         }
     private:
       I m_iter;
-      const typename std::map<T, Rect*> *m_labels;
+      const LabelMask *m_labels;
       ImageAccessor<T> m_accessor;
     };
     
@@ -375,7 +400,7 @@ namespace Gamera {
       RowIterator() { }
 
       proxy_type operator*() const {
-        return proxy_type(m_iterator, m_image->get_labels_pointer());
+        return proxy_type(m_iterator, m_image->get_label_mask());
       }
 
       value_type get() const {
@@ -422,7 +447,7 @@ namespace Gamera {
       ColIterator() { }
 
       proxy_type operator*() const {
-        return proxy_type(m_iterator, m_image->get_labels_pointer());
+        return proxy_type(m_iterator, m_image->get_label_mask());
       }      
 
       // Image specific
@@ -551,7 +576,7 @@ namespace Gamera {
 
       // Operators
       proxy_type operator*() const {
-        return proxy_type(m_coliterator.m_iterator, m_coliterator.m_image->get_labels_pointer());
+        return proxy_type(m_coliterator.m_iterator, m_coliterator.m_image->get_label_mask());
       }
 
       value_type get() const {
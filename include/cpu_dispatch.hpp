@@ -0,0 +1,207 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+  Runtime dispatch of the vectorized kernels to the CPU.
+
+  The modules are compiled for the oldest CPU they have to run on, so
+  that the vectorized loops only use SSE2 on x86-64 (and NEON on 64-bit
+  ARM, where it is always there).  The few kernels that the hot loops
+  spend their time in are compiled again from the same source for AVX2
+  and AVX-512 (see GAMERA_CPU_KERNEL), and the variant for the best
+  instruction set of the CPU is chosen when the kernel is first used
+  (see CpuKernel::select).  The variants do not contract multiplications
+  and additions into FMA instructions, so that they round exactly like
+  the generic code: the results do not depend on the CPU.  (As clang can
+  not be told so per function, it only builds the AVX2 variant.)
+
+  The environment variable GAMERA_CPU_DISPATCH (generic, avx2 or
+  avx512) caps the instruction set that is used.  Only the generic
+  variant is built with compilers other than gcc or clang, on other
+  CPUs, or when GAMERA_NO_CPU_DISPATCH is defined (setup.py
+  --cpu-dispatch=no).
+
+  The variant chosen for each kernel is recorded in the state of
+  gameracore, which the other modules attach to like to the memory
+  budget (see get_gameracore_dict in gameramodule.hpp), so that
+  gameracore.cpu_dispatch() reports the kernels of all modules.
+*/
+
+#ifndef gamera_cpu_dispatch_hpp
+#define gamera_cpu_dispatch_hpp
+
+#include "buffer_pool.hpp"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(GAMERA_NO_CPU_DISPATCH) && (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define GAMERA_CPU_DISPATCH
+#endif
+
+#define CPU_DISPATCH_KERNELS 64
+#define CPU_DISPATCH_NAME 48
+
+namespace Gamera {
+
+  enum CpuLevel {
+    CPU_GENERIC,
+    CPU_AVX2,
+    CPU_AVX512,
+    CPU_LEVELS
+  };
+
+  inline const char* cpu_level_name(int level) {
+    static const char* names[CPU_LEVELS] = { "generic", "avx2", "avx512" };
+    return names[level];
+  }
+
+  // the best level the CPU (and the operating system) supports
+  inline int cpu_detect_level() {
+#ifdef GAMERA_CPU_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+      return CPU_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+      return CPU_AVX2;
+#endif
+    return CPU_GENERIC;
+  }
+
+  struct CpuDispatchState {
+    volatile long lock;
+    int initialized;
+    // the level the kernels are chosen for
+    int level;
+    size_t nkernels;
+    char names[CPU_DISPATCH_KERNELS][CPU_DISPATCH_NAME];
+    int levels[CPU_DISPATCH_KERNELS];
+  };
+
+  inline void cpu_dispatch_init(CpuDispatchState& state) {
+    state.level = cpu_detect_level();
+    const char* env = getenv("GAMERA_CPU_DISPATCH");
+    if (env != 0) {
+      for (int level = CPU_GENERIC; level < state.level; ++level) {
+        if (strcmp(env, cpu_level_name(level)) == 0)
+          state.level = level;
+      }
+    }
+    state.initialized = 1;
+  }
+
+  inline CpuDispatchState*& cpu_dispatch_pointer() {
+    static CpuDispatchState* pointer = 0;
+    return pointer;
+  }
+
+  inline CpuDispatchState& cpu_dispatch() {
+    CpuDispatchState*& pointer = cpu_dispatch_pointer();
+    if (pointer == 0) {
+      // the state of this module, zero initialized before any code runs
+      static CpuDispatchState state;
+      spin_lock(state.lock);
+      if (!state.initialized)
+        cpu_dispatch_init(state);
+      spin_unlock(state.lock);
+      pointer = &state;
+    }
+    return *pointer;
+  }
+
+  // records that the kernel name runs the variant for level
+  inline void cpu_dispatch_record(const char* name, int level) {
+    CpuDispatchState& state = cpu_dispatch();
+    spin_lock(state.lock);
+    size_t i = 0;
+    while (i < state.nkernels && strcmp(state.names[i], name) != 0)
+      ++i;
+    if (i < CPU_DISPATCH_KERNELS) {
+      if (i == state.nkernels) {
+        strncpy(state.names[i], name, CPU_DISPATCH_NAME - 1);
+        ++state.nkernels;
+      }
+      state.levels[i] = level;
+    }
+    spin_unlock(state.lock);
+  }
+
+  /*
+    The variants of a kernel (function pointers of type F, indexed by
+    CpuLevel, 0 where a variant is not built), as defined by
+    GAMERA_CPU_VARIANTS.  select returns the variant for the level of
+    the CPU, or for the next lower level that was built.  It does not
+    use the Python API, so that it can be called without the GIL; the
+    callers keep the result in a static variable.
+  */
+  template<class F>
+  struct CpuKernel {
+    F variants[CPU_LEVELS];
+
+    F select(const char* name) const {
+      int level = cpu_dispatch().level;
+      while (level > CPU_GENERIC && variants[level] == 0)
+        --level;
+      cpu_dispatch_record(name, level);
+      return variants[level];
+    }
+  };
+
+}
+
+/*
+  GAMERA_CPU_KERNEL(name, body, result, parameters, arguments) defines
+  the static functions name_generic, name_avx2 and name_avx512 taking
+  the parameters (in parentheses) that return body(arguments), and
+  GAMERA_CPU_VARIANTS(name) initializes a CpuKernel with them.  body
+  should be declared GAMERA_CPU_INLINE, so that it is compiled anew for
+  each instruction set.
+*/
+#if defined(__GNUC__) || defined(__clang__)
+#define GAMERA_CPU_INLINE inline __attribute__((always_inline))
+#else
+#define GAMERA_CPU_INLINE inline
+#endif
+
+#if defined(GAMERA_CPU_DISPATCH) && !defined(__clang__)
+#define GAMERA_CPU_KERNEL(name, body, result, parameters, arguments) \
+  static result name##_generic parameters { return body arguments; } \
+  __attribute__((target("avx2"))) \
+  static result name##_avx2 parameters { return body arguments; } \
+  __attribute__((target("avx2,avx512f"), optimize("fp-contract=off"))) \
+  static result name##_avx512 parameters { return body arguments; }
+#define GAMERA_CPU_VARIANTS(name) \
+  { { name##_generic, name##_avx2, name##_avx512 } }
+#elif defined(GAMERA_CPU_DISPATCH)
+#define GAMERA_CPU_KERNEL(name, body, result, parameters, arguments) \
+  static result name##_generic parameters { return body arguments; } \
+  __attribute__((target("avx2"))) \
+  static result name##_avx2 parameters { return body arguments; }
+#define GAMERA_CPU_VARIANTS(name) \
+  { { name##_generic, name##_avx2, 0 } }
+#else
+#define GAMERA_CPU_KERNEL(name, body, result, parameters, arguments) \
+  static result name##_generic parameters { return body arguments; }
+#define GAMERA_CPU_VARIANTS(name) \
+  { { name##_generic, 0, 0 } }
+#endif
+
+#endif
@@ -36,6 +36,14 @@ typedef int Py_ssize_t;
 #endif
 
 #include "gamera.hpp"
+#include "cpu_dispatch.hpp"
+#include <list>
+#include <algorithm>
+#include <new>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
 
 /*
   This file holds the C++ interface for the Python objects that wrap
@@ -52,6 +60,13 @@ typedef int Py_ssize_t;
   is inlined so that it is available to all of the gamera plugins. The inline
   versions are less efficient because they have to lookup the types at
   runtime.
+
+  The small geometric objects (Size, Dim, Point, FloatPoint and Rect)
+  hold their value in the instance struct (m_value, see ObjectValue),
+  which m_x points to, so that creating one does not allocate the C++
+  object on the heap.  An m_x pointing elsewhere is owned by the object and deleted
+  with it (for instance the Region of a RegionObject); for images, m_x
+  is the image view and m_value is not used.
 */
 
 /*
@@ -93,17 +108,71 @@ inline int send_deprecation_warning(const char* message, const char* filename, i
   return 1;
 }
 
+/*
+  The other modules count the memory of their images into the memory
+  budget of gameracore (see memory_budget.hpp), which it keeps in its
+  dictionary.
+*/
+#ifndef GAMERACORE_INTERNAL
+inline void memory_budget_attach(PyObject* dict) {
+  PyObject* budget = PyDict_GetItemString(dict, "_memory_budget");
+  if (budget != 0 && PyCObject_Check(budget))
+    memory_budget_pointer() = (MemoryBudgetState*)PyCObject_AsVoidPtr(budget);
+}
+
+/*
+  Likewise, they record the variants of their kernels in the state of
+  the CPU dispatch of gameracore (see cpu_dispatch.hpp).
+*/
+inline void cpu_dispatch_attach(PyObject* dict) {
+  PyObject* state = PyDict_GetItemString(dict, "_cpu_dispatch");
+  if (state != 0 && PyCObject_Check(state))
+    cpu_dispatch_pointer() = (CpuDispatchState*)PyCObject_AsVoidPtr(state);
+}
+
+/*
+  And they keep the buffers they free in the pool of gameracore (see
+  buffer_pool.hpp).  The buffers already kept in the pool of the
+  module are freed, as nobody would take them out again.
+*/
+inline void buffer_pool_attach(PyObject* dict) {
+  PyObject* pool = PyDict_GetItemString(dict, "_buffer_pool");
+  if (pool != 0 && PyCObject_Check(pool)) {
+    buffer_pool_clear();
+    buffer_pool_pointer() = (BufferPoolState*)PyCObject_AsVoidPtr(pool);
+  }
+}
+#endif
+
 /*
   Get the dictionary for gameracore. This uses get_module_dict above, but caches
   the result for faster lookups in subsequent calls.
 */
 inline PyObject* get_gameracore_dict() {
   static PyObject* dict = 0;
-  if (dict == 0)
+  if (dict == 0) {
     dict = get_module_dict("gamera.gameracore");
+#ifndef GAMERACORE_INTERNAL
+    if (dict != 0) {
+      memory_budget_attach(dict);
+      cpu_dispatch_attach(dict);
+      buffer_pool_attach(dict);
+    }
+#endif
+  }
   return dict;
 }
 
+/*
+  The pixels are now held by a Python object, which makes them a
+  candidate for spilling.  Spills what needs to be spilled if this took
+  the images over the limit of the memory budget.
+*/
+inline void memory_budget_hold(ImageDataBase* data) {
+  memory_budget_register(data);
+  memory_budget_enforce();
+}
+
 #ifndef GAMERACORE_INTERNAL
 inline PyObject* get_ArrayInit() {
   static PyObject* t = 0;
@@ -148,12 +217,29 @@ inline PyObject* get_ArrayAppend() {
 }
 #endif
 
+/*
+  The storage of the value of a small geometric object, constructed
+  with placement new.  A Size, Point or Rect member would make the
+  object structs, and ImageObject which starts with a RectObject, non-POD
+  types, on which offsetof (for tp_weaklistoffset) is not allowed.
+*/
+template<class T>
+union ObjectValue {
+  char m_bytes[sizeof(T)];
+  double m_align_double;
+  size_t m_align_size;
+  void* m_align_pointer;
+
+  T* get() { return reinterpret_cast<T*>(m_bytes); }
+};
+
 /*
   SIZE OBJECT
 */
 struct SizeObject {
   PyObject_HEAD
   Size* m_x;
+  ObjectValue<Size> m_value;
 };
 
 #ifndef GAMERACORE_INTERNAL
@@ -189,7 +275,7 @@ inline PyObject* create_SizeObject(const Size& d) {
     return 0;
   SizeObject* so;
   so = (SizeObject*)t->tp_alloc(t, 0);
-  so->m_x = new Size(d);
+  so->m_x = new (so->m_value.get()) Size(d);
   return (PyObject*)so;
 }
 
@@ -199,6 +285,7 @@ inline PyObject* create_SizeObject(const Size& d) {
 struct DimObject {
   PyObject_HEAD
   Dim* m_x;
+  ObjectValue<Dim> m_value;
 };
 
 #ifndef GAMERACORE_INTERNAL
@@ -234,7 +321,7 @@ inline PyObject* create_DimObject(const Dim& d) {
     return 0;
   DimObject* so;
   so = (DimObject*)t->tp_alloc(t, 0);
-  so->m_x = new Dim(d);
+  so->m_x = new (so->m_value.get()) Dim(d);
   return (PyObject*)so;
 }
 
@@ -244,11 +331,13 @@ inline PyObject* create_DimObject(const Dim& d) {
 struct PointObject {
   PyObject_HEAD
   Point* m_x;
+  ObjectValue<Point> m_value;
 };
 
 struct FloatPointObject {
   PyObject_HEAD
   FloatPoint* m_x;
+  ObjectValue<FloatPoint> m_value;
 };
 
 #ifndef GAMERACORE_INTERNAL
@@ -304,7 +393,7 @@ inline PyObject* create_PointObject(const Point& d) {
     return 0;
   PointObject* so;
   so = (PointObject*)t->tp_alloc(t, 0);
-  so->m_x = new Point(d);
+  so->m_x = new (so->m_value.get()) Point(d);
   return (PyObject*)so;
 }
 
@@ -415,7 +504,7 @@ inline PyObject* create_FloatPointObject(const FloatPoint& d) {
     return 0;
   FloatPointObject* so;
   so = (FloatPointObject*)t->tp_alloc(t, 0);
-  so->m_x = new FloatPoint(d);
+  so->m_x = new (so->m_value.get()) FloatPoint(d);
   return (PyObject*)so;
 }
 
@@ -425,6 +514,7 @@ inline PyObject* create_FloatPointObject(const FloatPoint& d) {
 struct RectObject {
   PyObject_HEAD
   Rect* m_x;
+  ObjectValue<Rect> m_value;
 };
 
 #ifndef GAMERACORE_INTERNAL
@@ -460,7 +550,7 @@ inline PyObject* create_RectObject(const Rect& d) {
     return 0;
   RectObject* so;
   so = (RectObject*)t->tp_alloc(t, 0);
-  so->m_x = new Rect(d);
+  so->m_x = new (so->m_value.get()) Rect(d);
   return (PyObject*)so;
 }
 
@@ -639,8 +729,13 @@ inline bool is_ImageDataObject(PyObject* x) {
   return PyObject_TypeCheck(x, t);
 }
 
+/*
+  With deferred, dense pixels are not allocated until allocate() is
+  called on the ImageData (see DEFERRED_ALLOCATION in image_data.hpp).
+*/
 inline PyObject* create_ImageDataObject(const Dim& dim, const Point& offset,
-                                        int pixel_type, int storage_format) {
+                                        int pixel_type, int storage_format,
+                                        bool deferred = false) {
   ImageDataObject* o;
   PyTypeObject* id_type = get_ImageDataType();
   if (id_type == 0)
@@ -650,19 +745,25 @@ inline PyObject* create_ImageDataObject(const Dim& dim, const Point& offset,
   o->m_storage_format = storage_format;
   if (storage_format == DENSE) {
     if (pixel_type == ONEBIT)
-      o->m_x = new ImageData<OneBitPixel>(dim, offset);
+      o->m_x = deferred ? new ImageData<OneBitPixel>(dim, offset, DEFERRED_ALLOCATION)
+        : new ImageData<OneBitPixel>(dim, offset);
     else if (pixel_type == GREYSCALE)
-      o->m_x = new ImageData<GreyScalePixel>(dim, offset);
+      o->m_x = deferred ? new ImageData<GreyScalePixel>(dim, offset, DEFERRED_ALLOCATION)
+        : new ImageData<GreyScalePixel>(dim, offset);
     else if (pixel_type == GREY16)
-      o->m_x = new ImageData<Grey16Pixel>(dim, offset);
+      o->m_x = deferred ? new ImageData<Grey16Pixel>(dim, offset, DEFERRED_ALLOCATION)
+        : new ImageData<Grey16Pixel>(dim, offset);
     // We have to explicity declare which FLOAT we want here, since there
     // is a name clash on Mingw32 with a typedef in windef.h
     else if (pixel_type == Gamera::FLOAT)
-      o->m_x = new ImageData<FloatPixel>(dim, offset);
+      o->m_x = deferred ? new ImageData<FloatPixel>(dim, offset, DEFERRED_ALLOCATION)
+        : new ImageData<FloatPixel>(dim, offset);
     else if (pixel_type == RGB)
-      o->m_x = new ImageData<RGBPixel>(dim, offset);
+      o->m_x = deferred ? new ImageData<RGBPixel>(dim, offset, DEFERRED_ALLOCATION)
+        : new ImageData<RGBPixel>(dim, offset);
     else if (pixel_type == Gamera::COMPLEX)
-      o->m_x = new ImageData<ComplexPixel>(dim, offset);
+      o->m_x = deferred ? new ImageData<ComplexPixel>(dim, offset, DEFERRED_ALLOCATION)
+        : new ImageData<ComplexPixel>(dim, offset);
     else {
       PyErr_Format(PyExc_TypeError, "Unknown pixel type '%d'.", pixel_type);
       return 0;
@@ -675,11 +776,20 @@ inline PyObject* create_ImageDataObject(const Dim& dim, const Point& offset,
                       "Pixel type must be ONEBIT when storage format is RLE.");
       return 0;
     }
+  } else if (storage_format == PACKED) {
+    if (pixel_type == ONEBIT)
+      o->m_x = new PackedImageData<OneBitPixel>(dim, offset);
+    else {
+      PyErr_SetString(PyExc_TypeError,
+                      "Pixel type must be ONEBIT when storage format is PACKED.");
+      return 0;
+    }
   } else {
     PyErr_SetString(PyExc_TypeError, "Unknown pixel type/storage format combination.");
     return 0;
   }
   o->m_x->m_user_data = (void*)o;
+  memory_budget_hold(o->m_x);
   return (PyObject*)o;
 }
 
@@ -719,6 +829,9 @@ struct ImageObject {
 //   PyObject* m_action_depth; // for limiting recursions for "actions"
   PyObject* m_weakreflist; // for Python weak references
   PyObject* m_confidence; // mapping of confidence values for id_name[0]
+  Py_ssize_t m_buffer_dims[6]; // shape and strides of exported buffers
+  Py_ssize_t m_buffer_exports; // the number of them still held
+  PyObject* m_pending_pixels; // decoder of the pixels (see image_decode_pending)
 };
 
 #ifndef GAMERACORE_INTERNAL
@@ -891,6 +1004,8 @@ inline int get_image_combination(PyObject* image) {
       return -1;
   } else if (storage == Gamera::RLE) {
     return Gamera::ONEBITRLEIMAGEVIEW;
+  } else if (storage == Gamera::PACKED) {
+    return Gamera::ONEBITPACKEDIMAGEVIEW;
   } else if (storage == Gamera::DENSE) {
     return get_pixel_type(image);
   } else {
@@ -898,50 +1013,151 @@ inline int get_image_combination(PyObject* image) {
   }
 }
 
+/*
+  A dense copy of a OneBit image stored as RLE or of a multi-label Cc.
+
+  The plugin wrappers pass such image arguments (other than self) to
+  the functions as this copy, so that the functions are instantiated
+  for dense images and Ccs only.  The copy has the origin, pixel
+  values and resolution of the image, and 0 for the pixels of other
+  labels.
+*/
+class DenseOneBitCopy {
+public:
+  DenseOneBitCopy(Image* image, int combination) {
+    if (combination == ONEBITRLEIMAGEVIEW)
+      copy(*((OneBitRleImageView*)image));
+    else if (combination == RLECC)
+      copy(*((RleCc*)image));
+    else
+      copy(*((MlCc*)image));
+  }
+  ~DenseOneBitCopy() {
+    delete m_view;
+    delete m_data;
+  }
+  OneBitImageView& view() { return *m_view; }
+private:
+  template<class T>
+  void copy(const T& image) {
+    m_data = new OneBitImageData(image.size(), image.origin());
+    m_view = new OneBitImageView(*m_data);
+    typename T::const_vec_iterator in = image.vec_begin();
+    OneBitImageView::vec_iterator out = m_view->vec_begin();
+    for (; in != image.vec_end(); ++in, ++out)
+      *out = *in;
+    m_view->resolution(image.resolution());
+    m_view->scaling(image.scaling());
+  }
+  OneBitImageData* m_data;
+  OneBitImageView* m_view;
+};
+
 /*
   This initializes all of the non-image members of an Image class.
+
+  The classification members are only created when they are first
+  accessed, as most images (e.g. the CCs returned by cc_analysis) never
+  use them, so they stay NULL here. C++ code must read them with the
+  image_features etc. functions below.
 */
 inline PyObject* init_image_members(ImageObject* o) {
-  /*
-    Create the features array. This will load the array module
-    (if required) and create an array object containing doubles.
-  */
-  static PyObject* array_func = 0;
-  if (array_func == 0) {
-    PyObject* array_module = PyImport_ImportModule(CHAR_PTR_CAST "array");
-    if (array_module == 0)
-      return 0;
-    PyObject* array_dict = PyModule_GetDict(array_module);
-    if (array_dict == 0)
-      return 0;
-    array_func = PyDict_GetItemString(array_dict, "array");
-    if (array_func == 0)
-      return 0;
-    Py_DECREF(array_module);
+  o->m_features = 0;
+  o->m_id_name = 0;
+  o->m_children_images = 0;
+  o->m_classification_state = 0;
+  o->m_confidence = 0;
+  o->m_pending_pixels = 0;
+  return (PyObject*)o;
+}
+
+/*
+  The pixels of an image created with a decoder (see the decode
+  argument of the Image constructor) are neither allocated nor decoded
+  until they are first used: m_pending_pixels holds the pair
+  (function, argument) until then, and function(image, argument) fills
+  the freshly allocated pixels.  Everything that gives access to the
+  pixels of an image must call image_decode_pending first.  It returns
+  false with a Python exception set if the pixels could not be decoded.
+*/
+inline bool image_decode_pending(PyObject* image) {
+  ImageObject* o = (ImageObject*)image;
+  if (o->m_pending_pixels == 0)
+    return true;
+  // cleared first, as the decoder uses the pixels itself
+  PyObject* pending = o->m_pending_pixels;
+  o->m_pending_pixels = 0;
+  Image* view = (Image*)((RectObject*)image)->m_x;
+  try {
+    view->data()->allocate();
+  } catch (std::exception& e) {
+    Py_DECREF(pending);
+    PyErr_SetString(PyExc_MemoryError, e.what());
+    return false;
   }
-  PyObject* arglist = Py_BuildValue(CHAR_PTR_CAST "(s)", CHAR_PTR_CAST "d");
-  o->m_features = PyObject_CallObject(array_func, arglist);
-  Py_DECREF(arglist);
-  if (o->m_features == 0)
-    return 0;
-  // id_name
-  o->m_id_name = PyList_New(0);
+  view->refresh();
+  PyObject* result = PyObject_CallFunctionObjArgs(PyTuple_GET_ITEM(pending, 0), image,
+                                                  PyTuple_GET_ITEM(pending, 1), NULL);
+  Py_DECREF(pending);
+  if (result == 0)
+    return false;
+  Py_DECREF(result);
+  return true;
+}
+
+/*
+  The classification members of an image, created with their initial
+  values on first access. These return a borrowed reference, or 0 with
+  a Python exception set.
+*/
+inline PyObject* image_features(ImageObject* o) {
+  if (o->m_features == 0) {
+    /*
+      Create the features array. This will load the array module
+      (if required) and create an array object containing doubles.
+    */
+    static PyObject* array_func = 0;
+    if (array_func == 0) {
+      PyObject* array_module = PyImport_ImportModule(CHAR_PTR_CAST "array");
+      if (array_module == 0)
+        return 0;
+      PyObject* array_dict = PyModule_GetDict(array_module);
+      if (array_dict == 0)
+        return 0;
+      array_func = PyDict_GetItemString(array_dict, "array");
+      if (array_func == 0)
+        return 0;
+      Py_DECREF(array_module);
+    }
+    PyObject* arglist = Py_BuildValue(CHAR_PTR_CAST "(s)", CHAR_PTR_CAST "d");
+    o->m_features = PyObject_CallObject(array_func, arglist);
+    Py_DECREF(arglist);
+  }
+  return o->m_features;
+}
+
+inline PyObject* image_id_name(ImageObject* o) {
   if (o->m_id_name == 0)
-    return 0;
-  // Children Images
-  o->m_children_images = PyList_New(0);
+    o->m_id_name = PyList_New(0);
+  return o->m_id_name;
+}
+
+inline PyObject* image_children_images(ImageObject* o) {
   if (o->m_children_images == 0)
-    return 0;
-  // Classification state
-  // o->m_classification_state = Py_BuildValue("i", UNCLASSIFIED);
-  o->m_classification_state = PyInt_FromLong(UNCLASSIFIED);
+    o->m_children_images = PyList_New(0);
+  return o->m_children_images;
+}
+
+inline PyObject* image_classification_state(ImageObject* o) {
   if (o->m_classification_state == 0)
-    return 0;
-  // confidence
-  o->m_confidence = PyDict_New();
+    o->m_classification_state = PyInt_FromLong(UNCLASSIFIED);
+  return o->m_classification_state;
+}
+
+inline PyObject* image_confidence(ImageObject* o) {
   if (o->m_confidence == 0)
-    return 0;  
-  return (PyObject*)o;
+    o->m_confidence = PyDict_New();
+  return o->m_confidence;
 }
 
 /*
@@ -1014,6 +1230,9 @@ inline PyObject* create_ImageObject(Image* image) {
     pixel_type = Gamera::ONEBIT;
     storage_type = Gamera::RLE;
     cc = true;
+  } else if (dynamic_cast<OneBitPackedImageView*>(image) != 0) {
+    pixel_type = Gamera::ONEBIT;
+    storage_type = Gamera::PACKED;
   } else {
     PyErr_SetString(PyExc_TypeError, "Unknown Image type returned from plugin.  Receiving this error indicates an internal inconsistency or memory corruption.  Please report it on the Gamera mailing list.");
     return 0;
@@ -1025,6 +1244,7 @@ inline PyObject* create_ImageObject(Image* image) {
     d->m_storage_format = storage_type;
     d->m_x = image->data();
     image->data()->m_user_data = (void*)d;
+    memory_budget_hold(image->data());
   } else {
     d = (ImageDataObject*)image->data()->m_user_data;
     Py_INCREF(d);
@@ -1346,6 +1566,145 @@ protected:
   PyObject* m_progress_bar;
 };
 
+/* Releases the interpreter lock for the lifetime of the object, so that
+   other Python threads can run while a plugin method computes.  The lock
+   is taken back when the scope is left by an exception as well. */
+
+class ReleaseGIL {
+public:
+  inline ReleaseGIL() {
+    m_state = PyEval_SaveThread();
+  }
+  inline ~ReleaseGIL() {
+    PyEval_RestoreThread(m_state);
+  }
+private:
+  ReleaseGIL(const ReleaseGIL&);
+  ReleaseGIL& operator=(const ReleaseGIL&);
+  PyThreadState* m_state;
+};
+
+/* PLUGIN STATISTICS
+
+   Each generated plugin module keeps, for each of its methods and each
+   pixel type of the image it is called on, what the calls have cost
+   while the statistics are enabled (see gamera.plugin.stats).  They are
+   only updated while the interpreter lock is held. */
+
+// one slot per pixel type, and one for the calls not on an image
+#define PLUGIN_STATS_SLOTS 7
+#define PLUGIN_STATS_NO_IMAGE 6
+
+struct PluginStats {
+  PluginStats() : calls(0), seconds(0.0), pixels(0.0), bytes(0.0) { }
+  size_t calls;
+  double seconds;
+  // the pixels of the images the method is called on
+  double pixels;
+  // the bytes of pixel data of the images it returns
+  double bytes;
+};
+
+struct PluginStatsEntry {
+  const char* name;
+  PluginStats* stats;
+};
+
+// the wall clock time in seconds
+inline double plugin_stats_time() {
+#ifdef _WIN32
+  // clock() measures the wall clock time there
+  return double(clock()) / CLOCKS_PER_SEC;
+#else
+  struct timeval now;
+  gettimeofday(&now, 0);
+  return now.tv_sec + now.tv_usec * 1e-6;
+#endif
+}
+
+/* Counts one call of a plugin method into the given slot, timing it
+   until the object is destroyed.  Does nothing when the slot is 0, as it
+   is while the statistics are disabled. */
+class PluginStatsCall {
+public:
+  inline PluginStatsCall(PluginStats* stats) : m_stats(stats) {
+    if (m_stats) {
+      m_stats->calls++;
+      m_start = plugin_stats_time();
+    }
+  }
+  inline ~PluginStatsCall() {
+    if (m_stats)
+      m_stats->seconds += plugin_stats_time() - m_start;
+  }
+  inline void add_pixels(const Image* image) {
+    if (m_stats && image)
+      m_stats->pixels += double(image->nrows()) * image->ncols();
+  }
+  inline void add_bytes(const Image* image) {
+    if (m_stats && image)
+      m_stats->bytes += double(image->data()->bytes());
+  }
+  inline void add_bytes(const std::list<Image*>* images) {
+    if (m_stats && images) {
+      for (std::list<Image*>::const_iterator i = images->begin();
+           i != images->end(); ++i)
+        add_bytes(*i);
+    }
+  }
+private:
+  PluginStatsCall(const PluginStatsCall&);
+  PluginStatsCall& operator=(const PluginStatsCall&);
+  PluginStats* m_stats;
+  double m_start;
+};
+
+// the slot for a call on the given image (which may be 0)
+inline PluginStats* plugin_stats_slot(PluginStats* stats, PyObject* image) {
+  if (image == 0)
+    return stats + PLUGIN_STATS_NO_IMAGE;
+  return stats + get_pixel_type(image);
+}
+
+/* The statistics of a module as a list of (name, pixel type, calls,
+   seconds, pixels, bytes) tuples, the pixel type being None for the
+   calls not on an image.  Only the slots with calls are listed. */
+inline PyObject* plugin_stats_to_python(const PluginStatsEntry* table) {
+  PyObject* result = PyList_New(0);
+  if (result == 0)
+    return 0;
+  for (; table->name != 0; ++table) {
+    for (int slot = 0; slot < PLUGIN_STATS_SLOTS; ++slot) {
+      const PluginStats& stats = table->stats[slot];
+      if (stats.calls == 0)
+        continue;
+      PyObject* pixel_type;
+      if (slot == PLUGIN_STATS_NO_IMAGE) {
+        Py_INCREF(Py_None);
+        pixel_type = Py_None;
+      } else
+        pixel_type = PyInt_FromLong(slot);
+      PyObject* entry = Py_BuildValue(CHAR_PTR_CAST "(sNnddd)", table->name,
+                                      pixel_type, (Py_ssize_t)stats.calls,
+                                      stats.seconds, stats.pixels, stats.bytes);
+      if (entry == 0 || PyList_Append(result, entry) != 0) {
+        Py_XDECREF(entry);
+        Py_DECREF(result);
+        return 0;
+      }
+      Py_DECREF(entry);
+    }
+  }
+  return result;
+}
+
+inline void plugin_stats_reset(PluginStatsEntry* table) {
+  for (; table->name != 0; ++table)
+    std::fill(table->stats, table->stats + PLUGIN_STATS_SLOTS, PluginStats());
+}
+
+#endif
+
 // Converting pixel types to/from Python
 
 inline PyObject* pixel_to_python(OneBitPixel px) {
@@ -1408,7 +1767,7 @@ inline RGBPixel pixel_from_python<RGBPixel>::convert(PyObject* obj) {
       }
       return RGBPixel((GreyScalePixel)PyInt_AsLong(obj));
     }
-    return RGBPixel(PyFloat_AsDouble(obj));
+    return RGBPixel((FloatPixel)PyFloat_AsDouble(obj));
   }
   return RGBPixel(*(((RGBPixelObject*)obj)->m_x));
 }
@@ -1433,4 +1792,3 @@ inline ComplexPixel pixel_from_python<ComplexPixel>::convert(PyObject* obj) {
 
 
 #endif
-#endif
@@ -4,10 +4,6 @@
 //
 // Copyright (C) 2010-2012 Oliver Christen, Christoph Dalitz
 //
-// This code is based on the Delaunay_Tree implementation
-// http://people.sc.fsu.edu/~burkardt/cpp_src/delaunay_tree_2d/
-// with the kind permission by Olivier Devillers.
-//
 // This program is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License
 // as published by the Free Software Foundation; either version 2
@@ -28,6 +24,7 @@
 #include <set>
 #include <stdexcept>
 #include <list>
+#include <utility>
 
 //-------------------------------------------------------------------------
 // data structure for computing the two dimensional Delaunay triangulation
@@ -35,12 +32,6 @@
 
 namespace Gamera { namespace Delaunaytree {
 
-  class Vertex;
-  class TriangleFlag;
-  class TriangleList;
-  class DelaunayTree;
-  class Triangle;
-
   // Vertex
   class Vertex {
   private:
@@ -60,78 +51,65 @@ namespace Gamera { namespace Delaunaytree {
     friend double operator^(Vertex a, Vertex b);
   };
 
-  // TriangleFlag
-  class TriangleFlag {
-  private:
-    int flag;
-  public:
-    TriangleFlag();
-    void kill();
-    bool isDead();
-    void setInfinite(int i);
-    int isInfinite();
-    void setLastFinite();
-    bool isLastFinite();
-    int getFlag();
-  };
-
-  // TriangleList
-  class TriangleList {
-  private:
-    Triangle *triangle;
-    TriangleList *next;
-  public:
-    TriangleList(TriangleList *list, Triangle *triangle);
-    ~TriangleList();
-    Triangle * getTriangle();
-    TriangleList * getNext();
+  // Triangle
+  // The triangles are kept in one array by the DelaunayTree and refer
+  // to their vertices and neighbors by index. The point at infinity has
+  // the vertex index -1, so that every edge of the convex hull has a
+  // "ghost" triangle outside. Vertices are counter clockwise and
+  // neighbor[i] is the triangle opposite to vertex[i].
+  struct Triangle {
+    int vertex[3];
+    int neighbor[3];
+    int mark;
+    bool dead;
   };
 
   // DelaunayTree
+  // Incremental (Bowyer-Watson) Delaunay triangulation. The name stems
+  // from the Delaunay tree formerly used for point location; points are
+  // now located by walking from the last created triangle, which is fast
+  // when consecutive points are close to each other. addVertices therefore
+  // inserts the points in a biased randomized insertion order (BRIO)
+  // with each round sorted along a Hilbert curve.
+  // The vertices are not owned by the DelaunayTree.
   class DelaunayTree {
   private:
-    int number;
-    Triangle *root;
-    std::vector<Triangle*> triangles;
+    std::vector<Vertex*> vertices;
+    std::vector<double> coords;
+    std::vector<Triangle> triangles;
+    std::vector<int> freetriangles;
+    // points that cannot be triangulated yet, because they are collinear
+    std::vector<Vertex*> pending;
+    int last;
+    int mark;
+    unsigned int seed;
+    // work space for the insertion
+    std::vector<int> cavity;
+    std::vector<int> created;
+    std::vector<int> startlink;
+    std::vector<int> endlink;
+    int infstartlink;
+    int infendlink;
+
+    int newVertex(Vertex *v);
+    int newTriangle();
+    void createFirstTriangle(int a, int b, int c);
+    int locate(int p);
+    bool conflict(int t, int p);
+    double orientation(int a, int b, int p);
+    void insert(int p);
+    void neighboringVertexIndices(std::vector<std::pair<int,int> > *edges);
   public:
     DelaunayTree();
     ~DelaunayTree();
     void addVertex(Vertex *v);
     void addVertices(std::vector<Vertex*> *vertices);
-    void appendTriangle(Triangle *t);
+    void neighboringLabels(std::vector<std::pair<int,int> > *labelpairs);
     void neighboringLabels(std::map<int,std::set<int> > *lbmap);
     void neighboringVertices(std::map<Vertex*,std::set<Vertex*> > *vmap);
     void getTriangles(std::list< std::vector<Vertex*>* > *triangles);
   };
 
-  // Triangle
-  class Triangle {
-  private:
-    int number;
-    TriangleFlag flag;
-    Vertex *vertices[3];
-    Triangle *neighbors[3];
-    TriangleList *sons;
-  public:
-    Triangle(DelaunayTree *tree);
-    Triangle(DelaunayTree *tree, Triangle *parent, int i);
-    Triangle(DelaunayTree *tree, Triangle *parent, Vertex *v, int i);
-    ~Triangle();
-    bool Conflict(Vertex *v);
-    Triangle * findConflict(Vertex *v);
-    TriangleFlag * getFlag();
-    Vertex * getVertex(int i);
-    void setNeighbor(int i, Triangle *t);
-    Triangle * getNeighbor(int i);
-    void setNumber(int i);
-    int getNumber();
-    int NeighborIndex(Triangle *t);
-    int cwNeighbor(Vertex *v);
-    void neighboringVertices(std::map<Vertex*,std::set<Vertex*> > *allneighbors);
-    void neighboringLabels(std::map<int,std::set<int> > *allneighbors);
-    void getTriangles(std::list< std::vector<Vertex*>* > *triangles);
-  };
-
 }} // end namespace Gamera::Delaunaytree
 
 #endif
@@ -21,6 +21,7 @@
 
 #include <vector>
 #include <queue>
+#include <utility>
 #include <cstdlib>
 
 namespace Gamera { namespace Kdtree {
@@ -51,10 +52,10 @@ struct KdNodePredicate {
 //--------------------------------------------------------
 // private helper classes used internally by KdTree
 //
-// the internal node structure used by kdtree
-class kdtree_node;
-// base class for different distance computations
-class DistanceMeasure;
+// the search state of a single k nearest neighbor query
+template<class Distance> class kdtree_search;
+// the search state of range searches and the pairs self join
+template<class Distance> class kdtree_range;
 // helper class for priority queue in k nearest neighbor search
 class nn4heap {
 public:
@@ -71,30 +72,74 @@ public:
 //--------------------------------------------------------
 
 // kdtree class
+//
+// The tree is stored implicitly: the nodes in *allnodes* are reordered
+// such that the subtree over the index range [a,b) has its root at
+// (a+b)/2, its low son over [a,(a+b)/2) and its high son over
+// [(a+b)/2+1,b). The cutting dimension is the depth modulo the
+// dimension. The coordinates and the bounding boxes of the subtrees are
+// kept in two packed arrays in the same order, so that a search only
+// touches contiguous memory.
 class KdTree {
+  template<class Distance> friend class kdtree_search;
+  template<class Distance> friend class kdtree_range;
 private:
-  // recursive build of tree
-  kdtree_node* build_tree(size_t depth, size_t a, size_t b);
-  // helper variable for keeping track of subtree bounding box
+  // builds the tree over *allnodes* and *coords*
+  void build(int distance_type, int num_threads);
+  // build of tree over the index range [a,b) of *order*; the
+  // bounds of its root must already be set. Subtrees larger than
+  // *parallel_cutoff* are built as OpenMP tasks when *parallel*
+  void build_tree(size_t depth, size_t a, size_t b, size_t* order, bool parallel);
+  enum { parallel_cutoff = 4096 };
+  // bounding box of all nodes
   CoordPoint lobound, upbound;
-  // helper variables and functions for k nearest neighbor search
-  std::priority_queue<nn4heap, std::vector<nn4heap>, compare_nn4heap> *neighborheap;
-  bool neighbor_search(const CoordPoint &point, kdtree_node* node, size_t k);
-  bool bounds_overlap_ball(const CoordPoint &point, double dist, kdtree_node* node);
-  bool ball_within_bounds(const CoordPoint &point, double dist, kdtree_node* node);
-  // class implementing the distance computation
-  DistanceMeasure* distance;
-  // search predicate in knn searches
-  KdNodePredicate* searchpredicate;
+  // coordinates of allnodes[i] start at coords[i*dimension]
+  DoubleVector coords;
+  // lower and upper bound of the subtree rooted at allnodes[i]
+  // start at bounds[2*i*dimension] and bounds[(2*i+1)*dimension]
+  DoubleVector bounds;
+  // distance measure and its weights (empty when unweighted)
+  int distance_type;
+  DoubleVector weights;
+  template<class Distance>
+  void k_nearest_neighbors(const Distance &d, const double* point, size_t k, std::vector<nn4heap>* found, KdNodePredicate* pred) const;
+  template<class Distance>
+  void k_nearest_neighbors_indices(const Distance &d, const double* points, size_t npoints, size_t k, size_t* indices, double* distances, int num_threads) const;
+  template<class Distance>
+  void range_search(const Distance &d, const double* point, double r, std::vector<nn4heap>* found, KdNodePredicate* pred) const;
+  // the distance in the units of *Distance::distance* as a true distance
+  double true_distance(double dist) const;
+  template<class Distance>
+  void pairs_within(const Distance &d, double r, std::vector<std::pair<size_t,size_t> >* result) const;
 public:
   KdNodeVector allnodes;
+  // position of allnodes[i] in the input of the constructor
+  std::vector<size_t> inputindex;
   size_t dimension;
-  kdtree_node* root;
   // distance_type can be 0 (max), 1 (city block), or 2 (euklid)
-  KdTree(const KdNodeVector* nodes, int distance_type=2);
+  // the tree is built on *num_threads* threads
+  KdTree(const KdNodeVector* nodes, int distance_type=2, int num_threads=1);
+  // tree over the *n* points of the given *dimension* whose coordinates
+  // are packed in *points* (point i starts at points[i*dimension]);
+  // the data of all nodes is NULL
+  KdTree(const double* points, size_t n, size_t dimension, int distance_type=2, int num_threads=1);
   ~KdTree();
   void set_distance(int distance_type, const DoubleVector* weights = NULL);
-  void k_nearest_neighbors(const CoordPoint &point, size_t k, KdNodeVector* result, KdNodePredicate* pred = NULL);
+  void k_nearest_neighbors(const CoordPoint &point, size_t k, KdNodeVector* result, KdNodePredicate* pred = NULL) const;
+  // k nearest neighbors of each point in *points* on *num_threads* threads
+  void k_nearest_neighbors_many(const std::vector<CoordPoint> &points, size_t k, std::vector<KdNodeVector>* results, int num_threads = 1) const;
+  // the *k* nearest neighbors of each of the *npoints* points packed in
+  // *points* as input indices (see *inputindex*) and distances; the
+  // neighbors of point i start at indices[i*k] and distances[i*k].
+  // *k* must not be greater than the number of nodes.
+  void k_nearest_neighbors_indices(const double* points, size_t npoints, size_t k, size_t* indices, double* distances, int num_threads = 1) const;
+  // all nodes within distance *r* of *point*, sorted by distance
+  void range_search(const CoordPoint &point, double r, KdNodeVector* result, KdNodePredicate* pred = NULL) const;
+  // the same as input indices (see *inputindex*) and distances
+  void range_search_indices(const double* point, double r, std::vector<size_t>* indices, std::vector<double>* distances) const;
+  // all pairs of nodes within distance *r* of each other
+  // as pairs of indices into *allnodes*
+  void pairs_within(double r, std::vector<std::pair<size_t,size_t> >* result) const;
 };
 
 }} // end namespace Gamera::Kdtree
@@ -0,0 +1,147 @@
+#ifndef __rectindex_HPP
+#define __rectindex_HPP
+
+//
+// Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include <vector>
+#include <limits>
+#include <cstdlib>
+#include <cmath>
+#include "dimensions.hpp"
+
+namespace Gamera { namespace Rectindex {
+
+typedef std::vector<Rect> RectVector;
+typedef std::vector<size_t> IndexVector;
+
+// distance between the closest pixels of two rects
+// (zero when the rects intersect)
+double rect_distance(const Rect& a, const Rect& b);
+
+// base class of the spatial indices over rects
+//
+// The rects are referred to by their index in the order of insertion.
+// All searches return the indices of the found rects, and the rect
+// passed to a search is found itself when it is in the index.
+class RectIndex {
+protected:
+  RectVector rects;
+  // appends to *result* all indices of rects whose bounding box
+  // might intersect the box [ul_x,lr_x]x[ul_y,lr_y]
+  virtual void candidates(long ul_x, long ul_y, long lr_x, long lr_y,
+                          IndexVector* result) const = 0;
+  // total bounding box of all rects
+  long bbox_ul_x, bbox_ul_y, bbox_lr_x, bbox_lr_y;
+public:
+  virtual ~RectIndex() {}
+  size_t size() const { return rects.size(); }
+  const Rect& rect(size_t i) const { return rects[i]; }
+  // all rects intersecting *r* in the order of insertion
+  void intersecting(const Rect& r, IndexVector* result) const;
+  // all rects within distance *d* of *r* in the order of insertion
+  void within_distance(const Rect& r, double d, IndexVector* result) const;
+  // the *k* rects closest to *r*, the closest first
+  // (rects at the same distance are ordered by insertion)
+  void k_nearest(const Rect& r, size_t k, IndexVector* result) const;
+};
+
+// Uniform grid of square cells. Each rect is registered in every cell
+// that it overlaps, so that a search only looks at the cells overlapping
+// the search region. The grid covers the bounding box of the rects
+// given to the constructor, and rects outside are kept in the border
+// cells. Rects can be added, moved and removed after construction.
+class RectGrid : public RectIndex {
+private:
+  long cell_size, ncols, nrows, ul_x, ul_y;
+  std::vector<IndexVector> cells;
+  std::vector<bool> removed;
+  void cell_range(const Rect& r, long* c0, long* r0, long* c1, long* r1) const;
+  void register_rect(size_t i);
+  void unregister_rect(size_t i);
+protected:
+  void candidates(long ul_x, long ul_y, long lr_x, long lr_y,
+                  IndexVector* result) const;
+public:
+  // when *cell_size* is zero, it is chosen from the size of the rects
+  RectGrid(const RectVector& rects, size_t cell_size = 0);
+  // adds a rect and returns its index
+  size_t add(const Rect& r);
+  // replaces the rect with index *i* by *r*
+  void update(size_t i, const Rect& r);
+  // removes the rect with index *i* from all subsequent searches
+  void remove(size_t i);
+  bool is_removed(size_t i) const { return removed[i]; }
+};
+
+// R-tree bulk loaded with the Sort-Tile-Recursive (STR) method of
+// Leutenegger et al.: the rects are sorted into vertical slices by
+// their x-center, each slice is sorted by the y-center and cut into
+// nodes of *node_size* entries. The upper levels are built in the same
+// way from the bounding boxes of the level below. The nodes are kept in
+// a single array, and the tree cannot be altered once it is built.
+class RectTree : public RectIndex {
+private:
+  struct Node {
+    long ul_x, ul_y, lr_x, lr_y;
+    // the entries are nodes[first..first+count) for inner nodes
+    // and order[first..first+count) for leaves
+    size_t first, count;
+    bool leaf;
+  };
+  std::vector<Node> nodes;
+  IndexVector order;
+  size_t root, node_size;
+protected:
+  void candidates(long ul_x, long ul_y, long lr_x, long lr_y,
+                  IndexVector* result) const;
+public:
+  RectTree(const RectVector& rects, size_t node_size = 16);
+};
+
+// Joins the rects into groups: starting with one group per rect, a
+// group absorbs all groups whose bounding box intersects its own, until
+// the bounding boxes of all groups are disjoint. The groups are kept in
+// a list that is scanned from the front; a group that absorbed others
+// moves to the front, followed by the absorbed groups in list order.
+// Returns the groups in their final list order, each as the indices of
+// its rects in the order in which they were joined.
+void merge_intersecting(const RectVector& rects, std::vector<IndexVector>* groups);
+
+// Text sections of a page, as found by roman_text.Page.find_sections:
+// glyphs whose black area is at most the average glyph extent (times
+// *search_size*) or that are larger than twenty times the extent are
+// dropped, the others are expanded by the extent (clipped to the lower
+// right of *page*) and merged while they intersect. Returns the section
+// of each glyph (-1 for dropped glyphs).
+void find_text_sections(const RectVector& glyphs, const std::vector<double>& black_areas,
+                        double search_size, const Rect& page, std::vector<long>* sections);
+
+// Text lines of a section, as found by roman_text.Section.find_lines:
+// glyphs whose height differs from the average by more than twice
+// *tall_deviation* are set aside, and the others are put into the first
+// line whose vertical extent contains their center. Intersecting lines
+// are merged, and the tall glyphs go into the first line containing
+// their top. Returns the glyphs of each line (sorted by left edge, except
+// after a merge) and the tall glyphs that are in no line.
+void find_text_lines(const RectVector& glyphs, double tall_deviation,
+                     std::vector<IndexVector>* lines, IndexVector* lost);
+
+}} // end namespace Gamera::Rectindex
+
+#endif
@@ -45,7 +45,7 @@ public:
  * */
 class DfsIterator: public NodeTraverseIterator {
    NodeStack _stack;
-   std::set<Edge*> _used_edges;
+   VisitMap* _used_edges; ///< by edge id, borrowed from the graph
    bool found_cycles;
    void init(Node* start);
 
@@ -53,6 +53,7 @@ public:
    DfsIterator(Graph* graph, Node* start): NodeTraverseIterator(graph) {
       init(start);  
    }
+   ~DfsIterator();
    Node* next();
 
    bool has_cycles() {
@@ -0,0 +1,127 @@
+/*
+ *
+ * Copyright (C) 2011 Christian Brandt
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef _CSR_GRAPH_HPP_3B1E8C2D7F4A96
+#define _CSR_GRAPH_HPP_3B1E8C2D7F4A96
+
+#include "graph_common.hpp"
+#include <vector>
+#include <utility>
+
+namespace Gamera { namespace GraphApi {
+
+
+
+/** CsrGraph is a frozen copy of a Graph in compressed sparse row form.
+ *
+ * The nodes are numbered 0..nnodes-1 in the order of their values, and
+ * the edges that can be traversed from node i are
+ * _targets[_offsets[i]] .. _targets[_offsets[i+1]-1] (with the weights
+ * in _weights), in the same order as in the Graph.  Undirected edges
+ * appear at both of their nodes.  Compared to the Graph, this needs no
+ * Node or Edge objects and no map, and the algorithms below work on
+ * node indices and contiguous arrays only.  The node values are
+ * copied, so the CsrGraph does not depend on the Graph afterwards.
+ *
+ * The CsrGraph cannot be changed.  When the Graph changes, a new
+ * CsrGraph must be created from it.
+ * */
+struct CsrGraph {
+   /// index returned when there is no node
+   static const size_t NONE = (size_t)-1;
+
+   std::vector<GraphData*> _values; ///< node values (owned copies)
+   std::vector<size_t> _offsets;    ///< nnodes+1 offsets into _targets
+   std::vector<size_t> _targets;    ///< target node of each traversable edge
+   std::vector<cost_t> _weights;    ///< weight of each traversable edge
+   size_t _nedges;                  ///< number of edges in the Graph
+   bool _directed;
+
+   CsrGraph(Graph* g);
+
+   /** An undirected CsrGraph with GraphDataLong values, equal to the
+    * CsrGraph of a Graph(FLAG_UNDIRECTED) into which the edges
+    * (first, second) were inserted in the given order with add_edge.
+    * This saves building the Graph when only the edges are known.
+    * */
+   CsrGraph(const std::vector<std::pair<long, long> >& edges);
+   ~CsrGraph();
+
+   size_t get_nnodes() const { return _values.size(); }
+   size_t get_nedges() const { return _nedges; }
+   bool is_directed() const { return _directed; }
+   GraphData* get_value(size_t node) const { return _values[node]; }
+
+   /// index of the node with the given value, or NONE
+   size_t get_index(GraphData* value) const;
+
+   /// nodes in the order a BFS resp. DFS from root visits them (like
+   /// BfsIterator and DfsIterator on the Graph)
+   void BFS(size_t root, std::vector<size_t>& order) const;
+   void DFS(size_t root, std::vector<size_t>& order) const;
+
+   /** Dijkstra's algorithm from source.  On return, distance[i] is the
+    * cost of the shortest path to node i and predecessor[i] the node
+    * before i on it (NONE for source and for nodes that cannot be
+    * reached, whose distance is the largest cost_t).
+    * */
+   void dijkstra_shortest_path(size_t source, std::vector<cost_t>& distance,
+         std::vector<size_t>& predecessor) const;
+
+   /** Dijkstra's algorithm from every node, on threads threads (0 for
+    * all processors when OpenMP is available).  On return, distance
+    * and predecessor (unless it is NULL) are nnodes x nnodes matrices
+    * whose row i is the result of dijkstra_shortest_path(i).
+    * */
+   void all_pairs_shortest_path(std::vector<cost_t>& distance,
+         std::vector<size_t>* predecessor, int threads = 0) const;
+
+   /// the node an edge (an index into _targets) starts at
+   size_t get_edge_source(size_t edge) const;
+
+   /** Kruskal's algorithm; adds the edges (indices into _targets) of a
+    * minimum spanning forest to tree_edges.  Returns false for
+    * directed graphs, like Graph::create_minimum_spanning_tree.
+    * */
+   bool minimum_spanning_tree(std::vector<size_t>& tree_edges) const;
+
+   /// the minimum spanning tree as a new Graph (NULL when directed)
+   Graph* create_minimum_spanning_tree() const;
+
+   /** Colors the nodes with ncolors colors (at least 6) such that no
+    * two neighbors have the same color, in the same way as
+    * Graph::colorize: nodes are removed smallest degree first and
+    * colored in the reverse order, each with the least used of the
+    * colors its neighbors do not have.  colors[i] is the color of
+    * node i.  Throws std::runtime_error when the colors do not
+    * suffice.
+    * */
+   void colorize(unsigned int ncolors, std::vector<unsigned int>& colors) const;
+
+private:
+   CsrGraph(const CsrGraph&);
+   CsrGraph& operator=(const CsrGraph&);
+};
+
+
+
+}} // end Gamera::GraphApi
+
+#endif /* _CSR_GRAPH_HPP_3B1E8C2D7F4A96 */
@@ -36,6 +36,8 @@ struct Edge {
    bool is_directed; ///< should be same as graph's directed
    cost_t weight;
    void* label;
+   size_t _id;       ///< dense id in the graph (see IdPool)
+   EdgeIterator _position; ///< position in the graph's list of edges
    
    /** creates a new edge. directed must be the same as the Graph's flag 
     * @param from_node  Node this edge is pointing from
@@ -24,6 +24,7 @@
 #include "bfsdfsiterator.hpp"
 #include "edgenodeiterator.hpp"
 #include "edge.hpp"
+#include "visitmap.hpp"
 
 namespace Gamera { namespace GraphApi {
 
@@ -44,6 +45,10 @@ struct Graph {
    ColorMap* _colors;
    Histogram* _colorhistogram;
 
+   IdPool _node_ids;         ///< ids of the nodes, indexing the visit maps
+   IdPool _edge_ids;         ///< ids of the edges
+   VisitMapPool _visit_maps; ///< visited flags lent to the traversals
+
 
    // --------------------------------------------------------------------------
    // Structure
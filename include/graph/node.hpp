@@ -31,6 +31,7 @@ struct Node {
    EdgeVector _edges;   /// < edges pointing in/out this node
    GraphData * _value;    /// < nodes's value
    Graph* _graph;
+   size_t _id;            /// < dense id in the graph (see IdPool)
 
    Node(GraphData * value, Graph* graph = NULL);
    ~Node();
@@ -93,6 +94,22 @@ struct Node {
 
 
 
+// -----------------------------------------------------------------------------
+// the visited flags of NodeTraverseIterator, by node id
+inline void NodeTraverseIterator::visit(Node* node) {
+   visit_map().set(node->_id);
+}
+
+inline void NodeTraverseIterator::unvisit(Node* node) {
+   visit_map().unset(node->_id);
+}
+
+inline bool NodeTraverseIterator::is_visited(Node* node) {
+   return visit_map().is_set(node->_id);
+}
+
+
+
 }} // end Gamera::GraphApi
 #endif /* _NODE_HPP_6F6639BC0A8223 */
 
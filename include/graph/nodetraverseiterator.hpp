@@ -22,6 +22,7 @@
 #define _NODETRAVERSEITERATOR_HPP_826C06039D50C0
 
 #include "graph_common.hpp"
+#include "visitmap.hpp"
 
 namespace Gamera { namespace GraphApi {
 
@@ -38,34 +39,40 @@ namespace Gamera { namespace GraphApi {
   * Please note that chaning the graph invalidates this iterator and 
   * leads to undefined behaviour.
   *
-  * initially no nodes are marked as visited
+  * initially no nodes are marked as visited. The visited flags are kept
+  * in a VisitMap indexed by the node ids, borrowed from the graph on the
+  * first visit and given back when the iterator is deleted, which must
+  * happen before the graph is deleted.
   */
 class NodeTraverseIterator {
 protected:
    Graph* _graph;
-   NodeSet _visited;
+   VisitMap* _visited;
+
+   /// borrows a visit map from the graph
+   VisitMap* borrow_visit_map();
+
+   inline VisitMap& visit_map() {
+      if(_visited == NULL)
+         _visited = borrow_visit_map();
+      return *_visited;
+   }
 
 public:
    NodeTraverseIterator(Graph* graph) {
       _graph = graph;
+      _visited = NULL;
    }
-   virtual ~NodeTraverseIterator() {}
+   virtual ~NodeTraverseIterator();
 
    /// marks the given node as visited
-   inline void visit(Node* node) {
-      _visited.insert(node);
-   }
+   inline void visit(Node* node);
 
    /// marks the given node as not visited
-   inline void unvisit(Node* node) {
-      if(is_visited(node))
-         _visited.erase(node);
-   }
+   inline void unvisit(Node* node);
 
    /// returns true when the given node is marked as visited
-   inline bool is_visited(Node* node) {
-      return _visited.count(node) == 1;
-   }
+   inline bool is_visited(Node* node);
 
    /// returns pointer to next node or NULL when there is no more node
    virtual Node* next() = 0;
@@ -30,22 +30,11 @@ namespace Gamera { namespace GraphApi {
 
 class SubgraphRoots {
 protected:
-   struct SubgraphNode {
-      Node *n;
-      bool root, visited;
-      SubgraphNode(Node* n) {
-         this->n = n;
-         root = visited = false;
-      }
-   };
-
-   std::stack<SubgraphNode*> nodeStack;
-   std::map<Node*, SubgraphNode*> nodeMap;
-   std::set<SubgraphNode*> nodeSet;
-   size_t i;
+   // by node id
+   std::vector<char> root, visited;
    Graph* g;
 
-   void process(SubgraphNode* t);
+   void process(Node* n);
    
 public:
    NodeVector* subgraph_roots(Graph* g);
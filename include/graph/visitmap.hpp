@@ -0,0 +1,152 @@
+/*
+ *
+ * Copyright (C) 2011 Christian Brandt
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _VISITMAP_HPP_5B1E0C7A93D24F
+#define _VISITMAP_HPP_5B1E0C7A93D24F
+
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <cstddef>
+
+namespace Gamera { namespace GraphApi {
+
+
+
+// -----------------------------------------------------------------------------
+/** dense ids 0..bound()-1 for the nodes (or edges) of a graph. The ids of
+  * removed nodes are given to the next added ones, so that the ids stay
+  * below the largest number of nodes the graph has had.
+  * */
+class IdPool {
+   std::vector<size_t> _free;
+   size_t _bound;
+
+public:
+   IdPool() {
+      _bound = 0;
+   }
+
+   size_t acquire() {
+      if(_free.empty())
+         return _bound++;
+      size_t id = _free.back();
+      _free.pop_back();
+      return id;
+   }
+
+   void release(size_t id) {
+      _free.push_back(id);
+   }
+
+   /// all ids are free again
+   void clear() {
+      _free.clear();
+      _bound = 0;
+   }
+
+   size_t bound() const {
+      return _bound;
+   }
+};
+
+
+
+// -----------------------------------------------------------------------------
+/** visited flags indexed by ids. A flag is set when its stamp is the
+  * number of the current traversal, so that starting a new traversal
+  * clears all flags without touching the array.
+  * */
+class VisitMap {
+   std::vector<unsigned int> _stamps;
+   unsigned int _epoch;
+
+public:
+   VisitMap() {
+      _epoch = 0;
+   }
+
+   /// clears all flags, for the ids below size (the others grow on demand)
+   void start(size_t size) {
+      if(_stamps.size() < size)
+         _stamps.resize(size, 0);
+      if(++_epoch == 0) {
+         std::fill(_stamps.begin(), _stamps.end(), 0u);
+         _epoch = 1;
+      }
+   }
+
+   inline void set(size_t id) {
+      if(id >= _stamps.size())
+         _stamps.resize(id + 1, 0);
+      _stamps[id] = _epoch;
+   }
+
+   inline void unset(size_t id) {
+      if(id < _stamps.size())
+         _stamps[id] = 0;
+   }
+
+   inline bool is_set(size_t id) const {
+      return id < _stamps.size() && _stamps[id] == _epoch;
+   }
+};
+
+
+
+// -----------------------------------------------------------------------------
+/** the visit maps of a graph, lent to its traversals. Successive traversals
+  * reuse the same arrays, while nested or simultaneous ones borrow
+  * different maps.
+  * */
+class VisitMapPool {
+   std::list<VisitMap> _maps;
+   std::vector<VisitMap*> _free;
+
+   // the free maps point into _maps
+   VisitMapPool(const VisitMapPool&);
+   VisitMapPool& operator=(const VisitMapPool&);
+
+public:
+   VisitMapPool() {}
+
+   /// a map with all flags cleared for the ids below size
+   VisitMap* borrow(size_t size) {
+      VisitMap* map;
+      if(_free.empty()) {
+         _maps.push_back(VisitMap());
+         map = &_maps.back();
+      }
+      else {
+         map = _free.back();
+         _free.pop_back();
+      }
+      map->start(size);
+      return map;
+   }
+
+   void give_back(VisitMap* map) {
+      _free.push_back(map);
+   }
+};
+
+
+
+}} // end Gamera::GraphApi
+#endif /* _VISITMAP_HPP_5B1E0C7A93D24F */
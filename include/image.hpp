@@ -24,9 +24,34 @@
 #include "pixel.hpp"
 #include "image_data.hpp"
 #include <stddef.h>
+#include <typeinfo>
 
 namespace Gamera {
 
+  /*
+    ImageCache
+
+    Base class for values that are computed from the pixels of an image
+    and kept with the image object.  The cache remembers the rectangle
+    of the image and the generation of its data when it was created,
+    and is dropped as soon as either of them changes.  An image keeps
+    one cache of each kind (derived class).
+  */
+  class ImageCache {
+  public:
+    ImageCache(const Rect& rect, size_t generation)
+      : m_rect(rect), m_generation(generation), m_next(0) { }
+    virtual ~ImageCache() { }
+    bool valid(const Rect& rect, size_t generation) const {
+      return m_generation == generation && m_rect == rect;
+    }
+  private:
+    friend class Image;
+    Rect m_rect;
+    size_t m_generation;
+    ImageCache* m_next;
+  };
+
   class Image : public Rect {
   public:
     Image()
@@ -35,6 +60,7 @@ namespace Gamera {
       m_scaling = 1.0;
       features = 0;
       features_len = 0;
+      m_cache = 0;
     }
     Image(const Point& upper_left, const Point& lower_right)
       : Rect(upper_left, lower_right) {
@@ -42,6 +68,7 @@ namespace Gamera {
       m_scaling = 1.0;
       features = 0;
       features_len = 0;
+      m_cache = 0;
     }
     Image(const Point& upper_left, const Size& size)
       : Rect(upper_left, size) {
@@ -49,11 +76,13 @@ namespace Gamera {
       m_scaling = 1.0;
       features = 0;
       features_len = 0;
+      m_cache = 0;
     }
     Image(const Point& upper_left, const Dim& dim)
       : Rect(upper_left, dim) {
       m_resolution = 0;
       m_scaling = 1.0;
+      m_cache = 0;
     }
 
     Image(const Rect& rect) : Rect(rect) {
@@ -61,19 +90,88 @@ namespace Gamera {
       m_scaling = 1.0;
       features = 0;
       features_len = 0;
+      m_cache = 0;
+    }
+    // copies do not share the cache
+    Image(const Image& other) : Rect(other) {
+      m_resolution = other.m_resolution;
+      m_scaling = other.m_scaling;
+      features = other.features;
+      features_len = other.features_len;
+      m_cache = 0;
+    }
+    Image& operator=(const Image& other) {
+      Rect::operator=(other);
+      m_resolution = other.m_resolution;
+      m_scaling = other.m_scaling;
+      features = other.features;
+      features_len = other.features_len;
+      cache(0);
+      return *this;
     }
-    virtual ~Image() {  }
+    virtual ~Image() { cache(0); }
     double resolution() const { return m_resolution; }
     void resolution(double r) { m_resolution = r; }
     double scaling() const { return m_scaling; }
     void scaling(double v) { m_scaling = v; }
     virtual ImageDataBase* data() const = 0;
+    /*
+      Recomputes the iterators the view keeps into the pixels of its
+      data, which move when the data gets pixels of its own (see
+      ImageData::share).  Called whenever a view is passed in from
+      Python.
+    */
+    virtual void refresh() { }
+    /*
+      The values of kind C cached for this image, or 0 if there are
+      none or the image has changed since they were computed.
+    */
+    template<class C>
+    C* cache() const {
+      ImageCache** c = &m_cache;
+      while (*c != 0) {
+        if (!(*c)->valid(*this, data()->generation())) {
+          ImageCache* invalid = *c;
+          *c = invalid->m_next;
+          delete invalid;
+          continue;
+        }
+        C* found = dynamic_cast<C*>(*c);
+        if (found != 0)
+          return found;
+        c = &(*c)->m_next;
+      }
+      return 0;
+    }
+    /*
+      Setting a cache takes ownership of it and drops the cache of the
+      same kind; cache(0) drops all caches.
+    */
+    void cache(ImageCache* c) const {
+      ImageCache** p = &m_cache;
+      while (*p != 0) {
+        if (*p == c)
+          return;
+        if (c == 0 || typeid(**p) == typeid(*c)) {
+          ImageCache* old = *p;
+          *p = old->m_next;
+          delete old;
+        } else {
+          p = &(*p)->m_next;
+        }
+      }
+      if (c != 0) {
+        c->m_next = m_cache;
+        m_cache = c;
+      }
+    }
   public:
     double* features;
     Py_ssize_t features_len;
   protected:
     double m_resolution;
     double m_scaling;
+    mutable ImageCache* m_cache;
   };
 
   /*
@@ -99,6 +197,10 @@ namespace Gamera {
 
   template<>
   inline size_t ImageBase<OneBitPixel>::depth() const { return 1; }
+  // Grey16 images have 16 bits per pixel whatever the size of their
+  // storage (see Grey16Value)
+  template<>
+  inline size_t ImageBase<Grey16Pixel>::depth() const { return 16; }
   template<>
   inline size_t ImageBase<RGBPixel>::ncolors() const { return 3; }
   template<>
@@ -22,21 +22,55 @@
   rather than a standard vector so that we can control the iterator type - the
   Vigra iterators assume that the iterator type is T* and some std::vectors
   don't use that as the iterator type.
+
+  The pixels are either allocated from the buffer pool (see
+  buffer_pool.hpp), a memory mapping of a file that holds them
+  uncompressed (on POSIX systems, see the file constructor below), a POSIX
+  shared memory object that other processes can attach as well (see the
+  shared memory constructor), or memory owned by someone else, such as a
+  NumPy array (see the buffer constructor).
+
+  Buffers from the pool may be shared by several ImageData (see share),
+  which then hold the same pixels until one of them is touched.  It
+  then copies the pixels to a buffer of its own before they are
+  changed, so that the pixels move and the views on it have to
+  recompute their iterators (see Image::refresh).
+
+  The buffers from the pool count into the memory budget, and the
+  images held by Python may have their pixels spilled to a temporary
+  file in place (see memory_budget.hpp).  Spilled pixels are not shared.
+
+  An ImageData constructed with DEFERRED_ALLOCATION has no pixels until
+  allocate() is called.  It is used for images whose pixels are decoded
+  when they are first used (see image_decode_pending in
+  gameramodule.hpp), and must not be accessed before that.
 */
 
 #ifndef kwm11162001_image_data_hpp
 #define kwm11162001_image_data_hpp
 
 #include "dimensions.hpp"
+#include "buffer_pool.hpp"
+#include "memory_budget.hpp"
 
 #include <cstddef>
 #include <cmath>
 #include <iostream>
 #include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace Gamera {
 
-  class ImageDataBase {
+  class ImageDataBase : public MemoryBudgetNode {
   public:
 
     ImageDataBase(const Dim& dim, const Point& offset) {
@@ -45,6 +79,9 @@ namespace Gamera {
       m_page_offset_x = offset.x();
       m_page_offset_y = offset.y();
       m_user_data = 0;
+      m_generation = 0;
+      m_shared = 0;
+      m_exports = 0;
     }
 
     ImageDataBase(const Dim& dim) {
@@ -53,6 +90,9 @@ namespace Gamera {
       m_page_offset_x = 0;
       m_page_offset_y = 0;
       m_user_data = 0;
+      m_generation = 0;
+      m_shared = 0;
+      m_exports = 0;
     }
 
     ImageDataBase(const Size& size, const Point& offset) {
@@ -61,6 +101,9 @@ namespace Gamera {
       m_page_offset_x = offset.x();
       m_page_offset_y = offset.y();
       m_user_data = 0;
+      m_generation = 0;
+      m_shared = 0;
+      m_exports = 0;
     }
 
     ImageDataBase(const Size& size) {
@@ -69,6 +112,9 @@ namespace Gamera {
       m_page_offset_x = 0;
       m_page_offset_y = 0;
       m_user_data = 0;
+      m_generation = 0;
+      m_shared = 0;
+      m_exports = 0;
     }
 
     ImageDataBase(const Rect& rect) {
@@ -79,6 +125,9 @@ namespace Gamera {
       m_page_offset_x = rect.ul_x();
       m_page_offset_y = rect.ul_y();
       m_user_data = 0;
+      m_generation = 0;
+      m_shared = 0;
+      m_exports = 0;
     }
 
     virtual ~ImageDataBase() {
@@ -98,30 +147,79 @@ namespace Gamera {
     virtual size_t bytes() const = 0;
     virtual double mbytes() const = 0;
 
+    /*
+      The generation is increased whenever the pixels are changed from
+      Python or by a plugin, so that values computed from the pixels
+      and kept with an image (see Image::cache) can be invalidated.
+      Shared pixels are copied before they are changed.
+    */
+    size_t generation() const { return m_generation; }
+    void touch() {
+      ++m_generation;
+      if (m_shared != 0)
+	unshare();
+      memory_budget_use(this);
+    }
+    bool shared() const { return m_shared != 0; }
+    /*
+      The number of buffers of the pixels that are exported to Python
+      (see image_getbuffer in imageobject.cpp).  While there are any,
+      the pixels must stay where they are, so they are neither shared
+      with copies (see ImageData::share) nor resized.
+    */
+    long exports() const { return m_exports; }
+    void add_exports(long n) { m_exports += n; }
+    /*
+      The name of the POSIX shared memory object holding the pixels, or
+      0 when they are not in shared memory (see the shared memory
+      constructor of ImageData).
+    */
+    virtual const char* shared_memory_name() const { return 0; }
+
     /*
       Setting dimensions
     */
     void page_offset_x(size_t x) { m_page_offset_x = x; }
     void page_offset_y(size_t y) { m_page_offset_y = y; }
     virtual void nrows(size_t nrows) {
+      touch();
       do_resize(nrows * m_stride);
     }
     virtual void ncols(size_t ncols) {
+      touch();
       m_stride = ncols;
       do_resize((m_size / m_stride) * m_stride);
     }
     virtual void dimensions(size_t rows, size_t cols) = 0;
     virtual void dim(const Dim& dim) = 0;
+    // gives an ImageData without pixels (see DEFERRED_ALLOCATION) its pixels
+    virtual void allocate() { }
   public:
     void* m_user_data;
   protected:
     virtual void do_resize(size_t size) = 0;
+    virtual void unshare() { }
     size_t m_size;
     size_t m_stride;
     size_t m_page_offset_x;
     size_t m_page_offset_y;
+    size_t m_generation;
+    // the number of ImageData sharing the pixels, or 0 if they are not shared
+    long* m_shared;
+    long m_exports;
   };
 
+  inline long shared_count_add(long* count, long n) {
+#ifdef _MSC_VER
+    return _InterlockedExchangeAdd(count, n) + n;
+#else
+    return __sync_add_and_fetch(count, n);
+#endif
+  }
+
+  enum SharedMemoryMode { SHARED_MEMORY_CREATE, SHARED_MEMORY_ATTACH };
+  enum DeferredAllocation { DEFERRED_ALLOCATION };
+
   template<class T>
   class ImageData : public ImageDataBase {
   public:
@@ -138,51 +236,165 @@ namespace Gamera {
     ImageData(const Dim& dim, const Point& offset) : 
       ImageDataBase(dim, offset) {
       m_data = 0;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = 0;
       create_data();
     }
 
     ImageData(const Dim& dim) : 
       ImageDataBase(dim) {
       m_data = 0;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = 0;
       create_data();
     }
 
     ImageData(const Size& size, const Point& offset) :
       ImageDataBase(size, offset) { 
       m_data = 0;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = 0;
       create_data(); 
     }
 
     ImageData(const Size& size) : 
       ImageDataBase(size) { 
       m_data = 0;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = 0;
       create_data();
     }
 
     ImageData(const Rect& rect) : 
       ImageDataBase(rect) { 
       m_data = 0;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = 0;
       create_data();
     }
 
+    ImageData(const Dim& dim, const Point& offset, DeferredAllocation) :
+      ImageDataBase(dim, offset) {
+      m_data = 0;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = 0;
+    }
+
+    /*
+      Maps the pixels from a file that holds them uncompressed, row by row
+      and in the native byte order, from file_offset on.  The mapping is
+      copy-on-write: the pixels are only read when they are accessed and
+      the pages are shared with other processes mapping the same file, but
+      changing the pixels does not change the file.
+    */
+    ImageData(const Dim& dim, const Point& offset, const char* filename,
+	      size_t file_offset) :
+      ImageDataBase(dim, offset) {
+      m_data = 0;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = 0;
+      map_file(filename, file_offset);
+    }
+
+    /*
+      Keeps the pixels in the POSIX shared memory object name (a name
+      starting with a slash), which is created with default pixels for
+      SHARED_MEMORY_CREATE and must exist and be large enough for
+      SHARED_MEMORY_ATTACH.  The mapping is shared, so that all
+      processes that attached the object use the same pixels and see
+      each other's changes.  The ImageData that created the object
+      removes its name when it no longer uses the pixels; after that,
+      the object can no longer be attached, but the ImageData that
+      attached it keep their pixels.
+    */
+    ImageData(const Dim& dim, const Point& offset, const char* name,
+	      SharedMemoryMode mode) :
+      ImageDataBase(dim, offset) {
+      m_data = 0;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = 0;
+      map_shared_memory(name, mode);
+    }
+
+    /*
+      Uses the pixels at data, which must hold dim.nrows() rows of
+      dim.ncols() pixels each, without copying them.  The memory is not
+      freed by the ImageData: release(context) is called instead when
+      the ImageData no longer uses it.
+    */
+    ImageData(const Dim& dim, const Point& offset, T* data,
+	      void (*release)(void*), void* context) :
+      ImageDataBase(dim, offset) {
+      m_data = data;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = release;
+      m_release_context = context;
+    }
+
+    /*
+      A new ImageData with the same dimensions and offset that shares
+      the pixels of this one until either of them is touched, or 0 if
+      the pixels are not from the buffer pool (a mapped file or memory
+      owned by someone else) or exported, which are not shared.
+    */
+    ImageData* share() {
+      if (m_data == 0 || m_mapping != 0 || m_release != 0 || spilled()
+	  || m_exports != 0)
+	return 0;
+      if (m_shared == 0)
+	m_shared = new long(1);
+      shared_count_add(m_shared, 1);
+      return new ImageData(dim(), offset(), m_data, m_shared);
+    }
+
     /*
       Destructor
     */
     virtual ~ImageData() {
-      if (m_data != 0) {
-	delete[] m_data;
-      }
+      free_data();
     }
     
+    virtual const char* shared_memory_name() const {
+      return m_shared_memory_name.empty() ? 0 : m_shared_memory_name.c_str();
+    }
+
     virtual size_t bytes() const { return m_size * sizeof(T); }
     virtual double mbytes() const { return (m_size * sizeof(T)) / 1048576.0; }
+
+    virtual bool spillable() const {
+      return m_data != 0 && m_mapping == 0 && m_release == 0 && m_shared == 0
+	&& !spilled() && !pinned() && bytes() >= MEMORY_BUDGET_MIN_SPILL;
+    }
+    virtual size_t spill() {
+      if (!spillable() || !memory_budget_spill_pages(m_data, bytes(), &m_spill_start,
+						     &m_spill_length))
+	return 0;
+      memory_budget_spilled(this);
+      return m_spill_length;
+    }
     virtual void dimensions(size_t rows, size_t cols) {
-      m_stride = cols; do_resize(rows * cols); }
+      m_stride = cols; do_resize(rows * cols); memory_budget_changed(this); }
     virtual void dim(const Dim& dim) {
-      m_stride = dim.ncols(); do_resize(dim.nrows() * dim.ncols()); }
+      m_stride = dim.ncols(); do_resize(dim.nrows() * dim.ncols());
+      memory_budget_changed(this); }
     virtual Dim dim() const {
       return Dim(m_stride, size() / m_stride);      
     }
+    virtual void allocate() {
+      if (m_data == 0) {
+	create_data();
+	memory_budget_changed(this);
+      }
+    }
 
     /*
       Iterators
@@ -197,31 +409,173 @@ namespace Gamera {
     */
     T& operator[](size_t n) { return m_data[n]; }
   protected:
+    // gives this ImageData a copy of the shared pixels of its own
+    virtual void unshare() {
+      if (*m_shared == 1) {
+	// the others are gone
+	delete m_shared;
+	m_shared = 0;
+	return;
+      }
+      T* data = allocate_data(m_size);
+      std::copy(m_data, m_data + m_size, data);
+      free_data();
+      m_data = data;
+    }
+
     virtual void do_resize(size_t size) {
       if (size > 0) {
 	size_t smallest = std::min(m_size, size);
-	m_size = size;
-	T* new_data = new T[m_size];
+	T* new_data = allocate_data(size);
 	for (size_t i = 0; i < smallest; ++i)
 	  new_data[i] = m_data[i];
-	if (m_data)
-	  delete[] m_data;
+	std::fill(new_data + smallest, new_data + size, T());
+	// the old pixels are counted with the old size
+	free_data();
 	m_data = new_data;
+	m_size = size;
       } else {
-	if (m_data)
-	  delete[] m_data;
+	free_data();
 	m_data = 0;
 	m_size = 0;
       }
     }
   private:
+    ImageData(const Dim& dim, const Point& offset, T* data, long* shared) :
+      ImageDataBase(dim, offset) {
+      m_data = data;
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_release = 0;
+      m_shared = shared;
+    }
+
+    void map_file(const char* filename, size_t file_offset) {
+#ifdef _WIN32
+      throw std::runtime_error("Memory mapped images are not supported on this platform.");
+#else
+      if (m_size == 0)
+	throw std::range_error("nrows and ncols must be >= 1.");
+      int fd = open(filename, O_RDONLY);
+      if (fd < 0)
+	throw std::invalid_argument("Failed to open file");
+      struct stat status;
+      size_t bytes = m_size * sizeof(T);
+      if (fstat(fd, &status) != 0 || (size_t)status.st_size < file_offset + bytes) {
+	close(fd);
+	throw std::range_error("The file is too small for the image.");
+      }
+      // mappings must start at a page boundary
+      size_t start = file_offset - file_offset % sysconf(_SC_PAGESIZE);
+      m_mapping_size = bytes + (file_offset - start);
+      void* mapping = mmap(0, m_mapping_size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE, fd, start);
+      close(fd);
+      if (mapping == MAP_FAILED)
+	throw std::runtime_error("Failed to map file");
+      m_mapping = mapping;
+      m_data = (T*)((char*)mapping + (file_offset - start));
+#endif
+    }
+
+    void map_shared_memory(const char* name, SharedMemoryMode mode) {
+#ifdef _WIN32
+      throw std::runtime_error("Shared memory images are not supported on this platform.");
+#else
+      if (m_size == 0)
+	throw std::range_error("nrows and ncols must be >= 1.");
+      bool create = mode == SHARED_MEMORY_CREATE;
+      int fd = shm_open(name, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+      if (fd < 0)
+	throw std::invalid_argument(create ? "Failed to create shared memory"
+				    : "Failed to open shared memory");
+      size_t bytes = m_size * sizeof(T);
+      struct stat status;
+      if (create ? ftruncate(fd, bytes) != 0
+	  : fstat(fd, &status) != 0 || (size_t)status.st_size < bytes) {
+	close(fd);
+	if (create)
+	  shm_unlink(name);
+	throw std::range_error(create ? "Failed to allocate shared memory"
+			       : "The shared memory is too small for the image.");
+      }
+      void* mapping = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+      if (mapping == MAP_FAILED) {
+	if (create)
+	  shm_unlink(name);
+	throw std::runtime_error("Failed to map shared memory");
+      }
+      m_mapping = mapping;
+      m_mapping_size = bytes;
+      m_data = (T*)mapping;
+      m_shared_memory_name = name;
+      m_owns_shared_memory = create;
+      if (create)
+	std::fill(m_data, m_data + m_size, pixel_traits<T>::default_value());
+#endif
+    }
+
+    void free_data() {
+      if (m_mapping != 0)
+	unmap();
+      else if (m_release != 0) {
+	m_release(m_release_context);
+	m_release = 0;
+      } else if (m_shared != 0) {
+	if (shared_count_add(m_shared, -1) == 0) {
+	  delete m_shared;
+	  release_data();
+	}
+	m_shared = 0;
+      } else if (m_data != 0)
+	release_data();
+    }
+
+    T* allocate_data(size_t size) {
+      T* data = (T*)buffer_pool_allocate(size * sizeof(T));
+      memory_budget_allocated(*m_budget, memory_budget_slot<T>::value,
+			      size * sizeof(T));
+      return data;
+    }
+
+    // gives the pixels from the pool back
+    void release_data() {
+      if (spilled()) {
+	memory_budget_unspill_pages(m_spill_start, m_spill_length);
+	memory_budget_unspilled(this);
+	m_spill_start = 0;
+	m_spill_length = 0;
+      }
+      buffer_pool_free(m_data);
+      memory_budget_freed(*m_budget, memory_budget_slot<T>::value,
+			  m_size * sizeof(T));
+    }
+
+    void unmap() {
+#ifndef _WIN32
+      munmap(m_mapping, m_mapping_size);
+      if (m_owns_shared_memory)
+	shm_unlink(m_shared_memory_name.c_str());
+#endif
+      m_mapping = 0;
+      m_owns_shared_memory = false;
+      m_shared_memory_name.clear();
+    }
+
     void create_data() {
       if (m_size > 0)
-	m_data = new T[m_size];
+	m_data = allocate_data(m_size);
       std::fill(m_data, m_data + m_size, pixel_traits<T>::default_value());
     }
 
     T* m_data;
+    void* m_mapping;
+    size_t m_mapping_size;
+    void (*m_release)(void*);
+    void* m_release_context;
+    std::string m_shared_memory_name;
+    bool m_owns_shared_memory;
   };
 }
 
@@ -25,9 +25,14 @@
 #include "image_data.hpp"
 #include "image_view.hpp"
 #include "rle_data.hpp"
+#include "packed_data.hpp"
 #include "connected_components.hpp"
 
 #include <list>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 /*
   The standard image types.
@@ -45,6 +50,7 @@ namespace Gamera {
   typedef ImageData<ComplexPixel> ComplexImageData;
   typedef ImageData<OneBitPixel> OneBitImageData;
   typedef RleImageData<OneBitPixel> OneBitRleImageData;
+  typedef PackedImageData<OneBitPixel> OneBitPackedImageData;
 
   /*
     ImageView
@@ -56,6 +62,7 @@ namespace Gamera {
   typedef ImageView<ComplexImageData> ComplexImageView;
   typedef ImageView<OneBitImageData> OneBitImageView;
   typedef ImageView<OneBitRleImageData> OneBitRleImageView;
+  typedef ImageView<OneBitPackedImageData> OneBitPackedImageView;
 
   /*
     Connected-components
@@ -67,6 +74,113 @@ namespace Gamera {
   typedef MultiLabelCC<OneBitImageData> MlCc;
   typedef std::list<MlCc*> MlCcs;
 
+  /*
+    A copy of the pixels of a connected component, 1 for the pixels of
+    its label(s) and 0 for all others, in dense rows without the page
+    around them.  Kernels that read a component many times read this
+    copy instead of comparing the label of every pixel of the page.
+    cc_bitmap builds it on first use and keeps it with the component
+    (see Image::cache) until its pixels, rectangle or label change.
+  */
+  class CCBitmap : public ImageCache {
+  public:
+    template<class T>
+    CCBitmap(const T& cc)
+      : ImageCache(cc, cc.data()->generation()),
+        m_data(cc.size(), cc.origin()), m_view(m_data) {
+      OneBitImageView::vec_iterator out = m_view.vec_begin();
+      for (typename T::const_vec_iterator i = cc.vec_begin(); i != cc.vec_end(); ++i, ++out)
+        *out = is_black(*i) ? 1 : 0;
+    }
+    const OneBitImageView& view() const { return m_view; }
+  private:
+    OneBitImageData m_data;
+    OneBitImageView m_view;
+  };
+
+  template<class T>
+  const OneBitImageView& cc_bitmap(const T& cc) {
+    CCBitmap* bitmap = cc.template cache<CCBitmap>();
+    if (bitmap == 0) {
+      bitmap = new CCBitmap(cc);
+      cc.cache(bitmap);
+    }
+    return bitmap->view();
+  }
+
+  /*
+    Row spans of dense images.
+
+    for_each_row_span calls f(p, n) for each row of a dense view, p
+    pointing to the first of the n pixels of the row. When the view
+    covers whole rows of its data, the rows are adjacent in memory
+    and f is called once for all of them. The loops in the functors
+    then run over plain arrays, which the compiler can vectorize.
+  */
+  template<class P, class F>
+  void for_each_row_span(const ImageView<ImageData<P> >& image, F& f) {
+    size_t nrows = image.nrows(), ncols = image.ncols();
+    if (ncols == image.data()->stride()) {
+      f(image[0], nrows * ncols);
+      return;
+    }
+    for (size_t y = 0; y < nrows; ++y)
+      f(image[y], ncols);
+  }
+
+  /*
+    The same for two dense views of the same size, calling f(p, q, n)
+    with the corresponding spans of both.
+  */
+  template<class P, class Q, class F>
+  void for_each_row_span(const ImageView<ImageData<P> >& a,
+                         const ImageView<ImageData<Q> >& b, F& f) {
+    size_t nrows = a.nrows(), ncols = a.ncols();
+    if (ncols == a.data()->stride() && ncols == b.data()->stride()) {
+      f(a[0], b[0], nrows * ncols);
+      return;
+    }
+    for (size_t y = 0; y < nrows; ++y)
+      f(a[y], b[y], ncols);
+  }
+
+  /*
+    The same split for several threads: for_each_span_block calls
+    f(y, x, n) for spans of n pixels starting at (x, y) that together
+    cover nrows x ncols pixels, on threads threads (0 for all
+    processors when OpenMP is available).  When the data is
+    contiguous, a span may run past the end of its row, and there is
+    one span per thread.  Otherwise the spans are rows.  Images with
+    fewer than 65536 pixels per thread use fewer threads.
+  */
+  template<class F>
+  void for_each_span_block(size_t nrows, size_t ncols, bool contiguous,
+                           int threads, const F& f) {
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+    }
+    const long npixels = (long)(nrows * ncols);
+    const long blocks = std::max(1L, std::min((long)threads, npixels / 65536));
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(blocks) schedule(static, 1)
+#endif
+    for (long block = 0; block < blocks; ++block) {
+      if (contiguous) {
+        size_t begin = npixels * block / blocks;
+        size_t end = npixels * (block + 1) / blocks;
+        f(0, begin, end - begin);
+      } else {
+        size_t y1 = nrows * (block + 1) / blocks;
+        for (size_t y = nrows * block / blocks; y < y1; ++y)
+          f(y, 0, ncols);
+      }
+    }
+  }
+
   /*
     Enumeration for all of the image types, pixel types, and storage
     types.
@@ -82,7 +196,8 @@ namespace Gamera {
   
   enum StorageTypes {
     DENSE,
-    RLE
+    RLE,
+    PACKED
   };
   
   /*
@@ -100,7 +215,8 @@ namespace Gamera {
     ONEBITRLEIMAGEVIEW,
     CC,
     RLECC,
-    MLCC
+    MLCC,
+    ONEBITPACKEDIMAGEVIEW
   };
   
   enum ClassificationStates {
@@ -131,10 +247,12 @@ namespace Gamera {
     typedef typename T::data_type data_type;
     typedef ImageData<typename T::value_type> dense_data_type;
     typedef RleImageData<typename T::value_type> rle_data_type;
+    typedef PackedImageData<typename T::value_type> packed_data_type;
     // view types
     typedef ImageView<data_type> view_type;
     typedef ImageView<dense_data_type> dense_view_type;
     typedef ImageView<rle_data_type> rle_view_type;
+    typedef ImageView<packed_data_type> packed_view_type;
     // cc types
     typedef ConnectedComponent<data_type> cc_type;
     typedef ConnectedComponent<dense_data_type> dense_cc_type;
@@ -172,10 +290,12 @@ namespace Gamera {
     typedef RGBImageView::data_type data_type;
     typedef ImageData<RGBImageView::value_type> dense_data_type;
     typedef ImageData<RGBImageView::value_type> rle_data_type;
+    typedef ImageData<RGBImageView::value_type> packed_data_type;
     // view types
     typedef ImageView<data_type> view_type;
     typedef ImageView<dense_data_type> dense_view_type;
     typedef ImageView<rle_data_type> rle_view_type;
+    typedef ImageView<packed_data_type> packed_view_type;
     // cc types
     typedef ConnectedComponent<data_type> cc_type;
     typedef ConnectedComponent<dense_data_type> dense_cc_type;
@@ -208,10 +328,12 @@ namespace Gamera {
     typedef ComplexImageView::data_type data_type;
     typedef ImageData<ComplexImageView::value_type> dense_data_type;
     typedef ImageData<ComplexImageView::value_type> rle_data_type;
+    typedef ImageData<ComplexImageView::value_type> packed_data_type;
     // view types
     typedef ImageView<data_type> view_type;
     typedef ImageView<dense_data_type> dense_view_type;
     typedef ImageView<rle_data_type> rle_view_type;
+    typedef ImageView<packed_data_type> packed_view_type;
     // cc types
     typedef ConnectedComponent<data_type> cc_type;
     typedef ConnectedComponent<dense_data_type> dense_cc_type;
@@ -268,6 +390,16 @@ namespace Gamera {
     }
   };
 
+  template<>
+  struct TypeIdImageFactory<ONEBIT, PACKED> {
+    typedef OneBitPackedImageData data_type;
+    typedef OneBitPackedImageView image_type;
+    static image_type* create(const Point& origin, const Dim& dim) {
+      data_type* data = new data_type(dim, origin);
+      return new image_type(*data, origin, dim);
+    }
+  };
+
   template<>
   struct TypeIdImageFactory<GREYSCALE, DENSE> {
     typedef GreyScaleImageData data_type;
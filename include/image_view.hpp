@@ -303,6 +303,7 @@ Use ImageView<T>::get(Point(col, row)) instead.
     // Misc
     //
     virtual T* data() const { return m_image_data; }
+    virtual void refresh() { calculate_iterators(); }
     self parent() const { return self(*m_image_data, m_image_data->offset(), m_image_data->dim()); }
     self& image() { return *this; }
 
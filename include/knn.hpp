@@ -22,8 +22,10 @@
 #define kwm08142002_knn
 
 #include "gamera_limits.hpp"
+#include "cpu_dispatch.hpp"
 #include <vector>
 #include <map>
+#include <functional>
 #include <cmath>
 #include <algorithm>
 #include <exception>
@@ -176,6 +178,116 @@ namespace Gamera {
       return distance;
     }
 
+    /*
+      DISTANCE FUNCTIONS on contiguous arrays.
+
+      These are the versions used in the inner loops of the
+      non-interactive classifier. The selection and the weighting
+      vector are folded into a single vector of effective weights
+      beforehand (see fold_weights), and a subset of the features
+      (as for the skip versions above) is handled by copying the
+      selected features into contiguous arrays first.
+
+      The sum is accumulated in four independent partial sums, so that
+      the compiler can use SIMD instructions for the loop without
+      having to reorder floating-point operations itself.
+
+      Note that the meaning of EUCLIDEAN above (a weighted sum of
+      sqrt(d*d) per dimension) is the weighted sum of |d|, so it uses
+      the city block kernel.
+
+      The known feature vector may be stored with a smaller type than
+      double (float or quantized integers), which is converted to
+      double in the loop. The functions are always inlined, so that
+      they are compiled for the instruction set of the kernel that
+      calls them (see cpu_dispatch.hpp).
+    */
+
+    /*
+      Computes weights[i] = selection[i] * weight[i]
+    */
+    template<class IterC, class IterD>
+    inline void fold_weights(IterC selection, IterD weight, size_t len,
+                             double* weights) {
+      for (size_t i = 0; i < len; ++i, ++selection, ++weight)
+        weights[i] = (*selection) * (*weight);
+    }
+
+    template<class T>
+    GAMERA_CPU_INLINE double city_block_distance(const T* known, const double* unknown,
+                                                 const double* weights, size_t len) {
+      double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+      size_t i = 0;
+      for (; i + 4 <= len; i += 4) {
+        sum[0] += weights[i] * std::fabs(unknown[i] - known[i]);
+        sum[1] += weights[i + 1] * std::fabs(unknown[i + 1] - known[i + 1]);
+        sum[2] += weights[i + 2] * std::fabs(unknown[i + 2] - known[i + 2]);
+        sum[3] += weights[i + 3] * std::fabs(unknown[i + 3] - known[i + 3]);
+      }
+      double distance = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+      for (; i < len; ++i)
+        distance += weights[i] * std::fabs(unknown[i] - known[i]);
+      return distance;
+    }
+
+    template<class T>
+    GAMERA_CPU_INLINE double fast_euclidean_distance(const T* known, const double* unknown,
+                                                     const double* weights, size_t len) {
+      double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+      size_t i = 0;
+      for (; i + 4 <= len; i += 4) {
+        double d0 = unknown[i] - known[i];
+        double d1 = unknown[i + 1] - known[i + 1];
+        double d2 = unknown[i + 2] - known[i + 2];
+        double d3 = unknown[i + 3] - known[i + 3];
+        sum[0] += weights[i] * (d0 * d0);
+        sum[1] += weights[i + 1] * (d1 * d1);
+        sum[2] += weights[i + 2] * (d2 * d2);
+        sum[3] += weights[i + 3] * (d3 * d3);
+      }
+      double distance = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+      for (; i < len; ++i) {
+        double d = unknown[i] - known[i];
+        distance += weights[i] * (d * d);
+      }
+      return distance;
+    }
+
+    /*
+      Partial distance versions of the above: the sum is computed in
+      blocks of a few features, and the computation stops as soon as
+      the partial sum reaches bound. The return value is then only a
+      lower bound of the distance (but >= bound). This relies on the
+      weights being non-negative.
+    */
+    template<class T>
+    inline double city_block_distance_bounded(const T* known, const double* unknown,
+                                              const double* weights, size_t len,
+                                              double bound) {
+      double distance = 0.0;
+      for (size_t i = 0; i < len; i += 16) {
+        distance += city_block_distance(known + i, unknown + i, weights + i,
+                                        std::min(len - i, size_t(16)));
+        if (distance >= bound)
+          break;
+      }
+      return distance;
+    }
+
+    template<class T>
+    inline double fast_euclidean_distance_bounded(const T* known, const double* unknown,
+                                                  const double* weights, size_t len,
+                                                  double bound) {
+      double distance = 0.0;
+      for (size_t i = 0; i < len; i += 16) {
+        distance += fast_euclidean_distance(known + i, unknown + i, weights + i,
+                                            std::min(len - i, size_t(16)));
+        if (distance >= bound)
+          break;
+      }
+      return distance;
+    }
+
     /*
       NORMALIZE
       
@@ -187,7 +299,9 @@ namespace Gamera {
       anything about the data structures used for storing the feature
       vectors. The add method is called for each feature vector,
       compute_normalization is called, and then feature vectors can
-      be normalized by calling apply.
+      be normalized by calling apply. The sums are kept, so that feature
+      vectors can be added (or removed) later and compute_normalization
+      called again.
     */
     class Normalize {
     public:
@@ -223,6 +337,36 @@ namespace Gamera {
         }
         ++m_num_feature_vectors;
       }
+      template<class T>
+      void remove(T begin, const T end) {
+        assert(m_sum_vector != 0 && m_sum2_vector != 0);
+        if (size_t(end - begin) != m_num_features)
+          throw std::range_error("Normalize: number features did not match.");
+        for (size_t i = 0; begin != end; ++begin, ++i) {
+          m_sum_vector[i] -= *begin;
+          m_sum2_vector[i] -= *begin * *begin;
+        }
+        --m_num_feature_vectors;
+      }
+      /*
+        Sets the sums to the values that give the current mean and
+        stdev vectors for the given number of feature vectors (for
+        normalizations that were set with set_mean_vector and
+        set_stdev_vector).
+      */
+      void restore_sums(size_t num_feature_vectors) {
+        m_num_feature_vectors = num_feature_vectors;
+        double n = double(num_feature_vectors);
+        for (size_t i = 0; i < m_num_features; ++i) {
+          double sum = m_mean_vector[i] * n;
+          double var = m_stdev_vector[i] * m_stdev_vector[i];
+          m_sum_vector[i] = sum;
+          m_sum2_vector[i] = (var * n * (n - 1) + sum * sum) / n;
+        }
+      }
+      size_t num_feature_vectors() const {
+        return m_num_feature_vectors;
+      }
       void compute_normalization() {
         assert(m_sum_vector != 0 && m_sum2_vector != 0);
         double mean, var, stdev, sum, sum2;
@@ -238,10 +382,6 @@ namespace Gamera {
           m_mean_vector[i] = mean;
           m_stdev_vector[i] = stdev;
         }
-        delete[] m_sum_vector;
-        m_sum_vector = 0;
-        delete[] m_sum2_vector;
-        m_sum2_vector = 0;
       }
       // in-place
       template<class T>
@@ -304,8 +444,14 @@ namespace Gamera {
       a database and majority the state of the class is undefined. If another
       search needs to be performed call reset (at which point add for each
       element will need to be called again).
+
+      The ids are small non-negative integers (class ids indexing a table
+      of class names), so that the votes are counted in an array indexed
+      by id. CompLT orders the ids; it is only used to break exact ties
+      and to order the answers after the winner, so that these do not
+      depend on how the ids were assigned.
     */
-    template<class IdType, class CompLT, class CompEQ>
+    template<class IdType, class CompLT = std::less<IdType> >
     class kNearestNeighbors {
     public:
       /*
@@ -318,8 +464,7 @@ namespace Gamera {
         This class holds the information needed for the Nearest Neighbor
         computation.
         
-        IdType: the type for the id (possibilities includes longs
-        and std::string)
+        IdType: the type for the id (an integral type)
       */
       class Neighbor {
       public:
@@ -338,10 +483,12 @@ namespace Gamera {
       public:
         IdStat() {
           min_distance = std::numeric_limits<double>::max();
+          total_distance = 0;
           count = 0;
         }
         IdStat(double distance, size_t c) {
           min_distance = distance;
+          total_distance = distance;
           count = c;
         }
         double min_distance;
@@ -355,56 +502,69 @@ namespace Gamera {
       typedef std::vector<neighbor_type> vec_type;
 
       // Constructor
-      kNearestNeighbors(size_t k = 1) : m_k(k) {
+      kNearestNeighbors(size_t k = 1, CompLT lt = CompLT())
+        : clt(lt), m_nun(id_type(), 0), m_has_nun(false), m_k(k) {
         m_max_distance = 0;
-        m_nun = NULL;
-      }
-      // Destructor
-      ~kNearestNeighbors() {
-        if (m_nun) delete m_nun;
+        m_nn.reserve(k);
       }
       // Reset the class to its initial state
       void reset() {
         m_nn.clear();
         m_max_distance = 0;
-        if (m_nun) delete m_nun;
-        m_nun = NULL;
+        m_has_nun = false;
       }
       /*
         Attempt to add a neighbor to the list of k closest
         neighbors. The list of neighbors is always kept sorted
         so that the largest distance is the last element.
+
+        The nearest unlike neighbor (the nearest one with an id other
+        than that of the nearest neighbor) is tracked in the same pass,
+        so the NUN confidence needs neither a larger k nor a second
+        search. Most candidates of a scan are farther than the k
+        nearest ones and only update these two.
       */
       void add(const id_type id, double distance) {
+        if (distance > m_max_distance)
+          m_max_distance = distance;
         // update nearest unlike neighbor
-        if (!m_nn.empty() && !ceq(m_nn[0].id,id)) {
-          if (!m_nun) {
-            if (distance < m_nn[0].distance)
-              m_nun = new neighbor_type(m_nn[0].id, m_nn[0].distance);
-            else
-              m_nun = new neighbor_type(id, distance);
-          } else {
-            if (distance < m_nn[0].distance) {
-              m_nun->id = m_nn[0].id;
-              m_nun->distance = m_nn[0].distance;
-            }
-            else if (distance < m_nun->distance) {
-              m_nun->id = id;
-              m_nun->distance = distance;
-            }
+        if (!m_nn.empty() && m_nn[0].id != id) {
+          if (distance < m_nn[0].distance) {
+            m_nun = m_nn[0];
+            m_has_nun = true;
+          } else if (!m_has_nun || distance < m_nun.distance) {
+            m_nun = neighbor_type(id, distance);
+            m_has_nun = true;
           }
         }
         // update list of k nearest neighbors
-        if (m_nn.size() < m_k) {
+        if (m_nn.size() < m_k)
           m_nn.push_back(neighbor_type(id, distance));
-          std::sort(m_nn.begin(), m_nn.end());
-        } else if (distance < m_nn.back().distance) {
-          m_nn.back().distance = distance;
-          m_nn.back().id = id;
-          std::sort(m_nn.begin(), m_nn.end());
-        }
-        if (distance > m_max_distance)
-          m_max_distance = distance;
+        else if (distance < m_nn.back().distance)
+          m_nn.back() = neighbor_type(id, distance);
+        else
+          return;
+        // move the new neighbor behind the nearer ones and those at the
+        // same distance
+        for (size_t j = m_nn.size() - 1;
+             j > 0 && distance < m_nn[j - 1].distance; --j)
+          std::swap(m_nn[j], m_nn[j - 1]);
+      }
+      /*
+        Whether there are k neighbors yet, and the distance of the
+        farthest of them. A candidate at this distance or farther
+        can not change the list of nearest neighbors, so it does not
+        need to be added (or its distance computed exactly) when only
+        the nearest neighbors are used (majority and the confidences
+        computed from the neighbors alone). Note that the default
+        confidence also depends on the largest distance added, and the
+        NUN confidence on the nearest unlike neighbor.
+      */
+      bool full() const {
+        return m_nn.size() >= m_k;
+      }
+      double max_nn_distance() const {
+        return m_nn.back().distance;
       }
       /*
         Find the id of the majority of the k nearest neighbors. This
@@ -422,81 +582,55 @@ namespace Gamera {
           return;
         }
         /*
-          Create a histogram of the ids in the nearest neighbors. A map
-          is used because the id_type could be anything. Additionally, even
-          if id_type was an integer there is no garuntee that they are small,
-          ordered numbers (making a vector impractical).
+          Create a histogram of the ids in the nearest neighbors. The
+          statistics are kept in an array indexed by id, and the ids
+          found are listed in the order of CompLT.
         */
-        typedef std::map<id_type, IdStat, CompLT> map_type;
-        map_type id_map;
-        typename map_type::iterator current;
+        m_ids.clear();
         for (typename vec_type::iterator i = m_nn.begin();
              i != m_nn.end(); ++i) {
-          current = id_map.find(i->id);
-          if (current == id_map.end()) {
-            id_map.insert(std::pair<id_type,
-                          IdStat>(i->id, IdStat(i->distance, 1)));
+          size_t c = size_t(i->id);
+          if (c >= m_stats.size())
+            m_stats.resize(c + 1);
+          IdStat& stat = m_stats[c];
+          if (stat.count == 0) {
+            stat = IdStat(i->distance, 1);
+            m_ids.push_back(i->id);
           } else {
-            current->second.count++;
-            current->second.total_distance += i->distance;
-            if (current->second.min_distance > i->distance)
-              current->second.min_distance = i->distance;
+            stat.count++;
+            stat.total_distance += i->distance;
+            if (stat.min_distance > i->distance)
+              stat.min_distance = i->distance;
           }
         }
+        std::sort(m_ids.begin(), m_ids.end(), clt);
         /*
           Now that we have the histogram we can take the majority if there
           is a clear winner, but if not, we need do some sort of tie breaking.
+          Ties in count are broken by the total (and so average) distance,
+          and ties in distance by the order of the ids.
         */
-        if (id_map.size() == 1) {
-          answer.resize(1);
-          answer[0] = std::make_pair(id_map.begin()->first, id_map.begin()->second.min_distance);
-          return;
-        } else {
-          /*
-            Find the id(s) with the maximum
-          */
-          std::vector<typename map_type::iterator> max;
-          max.push_back(id_map.begin());
-          for (typename map_type::iterator i = id_map.begin();
-               i != id_map.end(); ++i) {
-            if (i->second.count > max[0]->second.count) {
-              max.clear();
-              max.push_back(i);
-            } else if (i->second.count == max[0]->second.count) {
-              max.push_back(i);
-            }
-          }
-          /*
-            If the vector only has 1 element there are no ties and
-            we are done.
-          */
-          if (max.size() == 1) {
-            // put the winner in the result vector
-            answer.push_back(std::make_pair(max[0]->first, max[0]->second.min_distance));
-            // remove the winner from the id_map
-            id_map.erase(max[0]);
-          } else {
-            /*
-              Tie-break by average distance
-            */
-            typename map_type::iterator min_dist = max[0];
-            for (size_t i = 1; i < max.size(); ++i) {
-              if (max[i]->second.total_distance
-                  < min_dist->second.total_distance)
-                min_dist = max[i];
-            }
-            answer.push_back(std::make_pair(min_dist->first, min_dist->second.min_distance));
-            id_map.erase(min_dist);
-          }
-          for (typename map_type::iterator i = id_map.begin();
-               i != id_map.end(); ++i) {
-            // Could not figure out why distance should be < 1 for additional
-            // classes => let us instead return all classes among kNN (CD)
-            //if (i->second.min_distance < 1)
-            answer.push_back(std::make_pair(i->first, i->second.min_distance));
-          }
-          return;
+        size_t winner = 0;
+        for (size_t i = 1; i < m_ids.size(); ++i) {
+          const IdStat& best = m_stats[size_t(m_ids[winner])];
+          const IdStat& stat = m_stats[size_t(m_ids[i])];
+          if (stat.count > best.count
+              || (stat.count == best.count
+                  && stat.total_distance < best.total_distance))
+            winner = i;
+        }
+        answer.push_back(std::make_pair(m_ids[winner],
+                                        m_stats[size_t(m_ids[winner])].min_distance));
+        // Could not figure out why distance should be < 1 for additional
+        // classes => let us instead return all classes among kNN (CD)
+        for (size_t i = 0; i < m_ids.size(); ++i) {
+          if (i != winner)
+            answer.push_back(std::make_pair(m_ids[i],
+                                            m_stats[size_t(m_ids[i])].min_distance));
         }
+        // clear the array for the next search
+        for (size_t i = 0; i < m_ids.size(); ++i)
+          m_stats[size_t(m_ids[i])] = IdStat();
       }
       void calculate_confidences() {
         size_t i,j;
@@ -513,7 +647,7 @@ namespace Gamera {
             size_t m = 0;
             id_type mainid = answer[0].first;
             for (j = 0; j < m_nn.size(); ++j) {
-              if (ceq(m_nn[j].id, mainid)) {
+              if (m_nn[j].id == mainid) {
                 m++;
               }
             }
@@ -529,7 +663,7 @@ namespace Gamera {
               for (j = 1; j < m_nn.size(); ++j) {
                 if (m_nn[j].distance < 256*epsilonmin) {
                   n++;
-                  if (ceq(m_nn[j].id, mainid))
+                  if (m_nn[j].id == mainid)
                     m++;
                 }
               }
@@ -541,7 +675,7 @@ namespace Gamera {
               for (j = 0; j < m_nn.size(); ++j) {
                 weight = 1 / m_nn[j].distance;
                 denominator += weight;
-                if (ceq(m_nn[j].id, mainid))
+                if (m_nn[j].id == mainid)
                   numerator += weight;
               }
               confidence.push_back(numerator/denominator);
@@ -554,7 +688,7 @@ namespace Gamera {
               // distance to all neighbors equal => compute knn fraction
               size_t m = 0;
               for (j = 0; j < m_nn.size(); ++j) {
-                if (ceq(m_nn[j].id, mainid))
+                if (m_nn[j].id == mainid)
                   m++;
               }
               confidence.push_back(((double)m)/m_nn.size());
@@ -567,7 +701,7 @@ namespace Gamera {
               for (j = 0; j < m_nn.size(); ++j) {
                 weight = (maxdist - m_nn[j].distance) / scale;
                 denominator += weight;
-                if (ceq(m_nn[j].id, mainid))
+                if (m_nn[j].id == mainid)
                   numerator += weight;
               }
               confidence.push_back(numerator/denominator);
@@ -575,8 +709,8 @@ namespace Gamera {
           }
           // nearest unlike neighbor confidence
           else if (CONFIDENCE_NUN == confidence_types[i]) {
-            if (m_nun) {
-              confidence.push_back(1 - answer[0].second / (m_nun->distance + epsilonmin));
+            if (m_has_nun) {
+              confidence.push_back(1 - answer[0].second / (m_nun.distance + epsilonmin));
             } else {
               confidence.push_back(1.0);
             }
@@ -600,7 +734,7 @@ namespace Gamera {
         }
       }
     private:
-      CompEQ ceq; // test whether two class id's are equal
+      CompLT clt; // orders the class ids
       // simple measure that is defined for all classes and k values
       double get_default_confidence(double dist) {
         static double epsilonmin = std::numeric_limits<double>::min();
@@ -613,10 +747,15 @@ namespace Gamera {
       std::vector<int> confidence_types;
       std::vector<double> confidence;
       std::vector<neighbor_type> m_nn;
-      neighbor_type* m_nun;
+      // the nearest unlike neighbor, if m_has_nun
+      neighbor_type m_nun;
+      bool m_has_nun;
     private:
       size_t m_k;
       double m_max_distance;
+      // the statistics of each id and the ids found by majority
+      std::vector<IdStat> m_stats;
+      std::vector<id_type> m_ids;
     };
 
   } // namespace kNN
@@ -0,0 +1,450 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef knn_index_hpp
+#define knn_index_hpp
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "gamera_limits.hpp"
+
+namespace Gamera {
+  namespace kNN {
+    /*
+      VP TREE
+
+      A vantage point tree over a set of points with the city block (L1)
+      or the euclidean (L2) metric. Each node picks one of its points as
+      vantage point and splits the others at the median distance mu to
+      it into an inside (distance <= mu) and an outside set. Searches
+      then skip whole subtrees with the triangle inequality. Unlike a
+      k-d tree, this does not split along coordinate axes, so it still
+      prunes for the 30-100 dimensional feature vectors used in
+      classification.
+
+      The points are copied into the tree. Weighted distances can be
+      handled by scaling the coordinates before (with w for the city
+      block distance and sqrt(w) for the euclidean distance).
+
+      Besides the k nearest points, the tree finds the nearest point
+      with a label different from a given one and the farthest point,
+      which is what kNearestNeighbors needs for its confidences, and
+      all points within or beyond a given distance. Points at the same
+      distance are ordered by their index, like in a linear scan.
+    */
+    class VpTree {
+    public:
+      enum Metric { L1, L2 };
+
+      /*
+        data holds num_points points of dimension dim one after the
+        other; labels holds an integer label for each point.
+      */
+      VpTree(const double* data, size_t num_points, size_t dim,
+             Metric metric, const int* labels)
+        : m_points(data, data + num_points * dim), m_labels(labels, labels + num_points),
+          m_dim(dim), m_metric(metric) {
+        std::vector<size_t> indexes(num_points);
+        for (size_t i = 0; i < num_points; ++i)
+          indexes[i] = i;
+        m_nodes.reserve(num_points);
+        m_root = build(indexes, 0, num_points);
+      }
+
+      size_t size() const {
+        return m_labels.size();
+      }
+
+      /*
+        Replaces the labels of the points (which do not change the
+        tree), e.g. with the components of a graph for nearest_unlike.
+      */
+      void set_labels(const int* labels) {
+        m_labels.assign(labels, labels + m_labels.size());
+      }
+
+      double distance(const double* query, size_t i) const {
+        const double* p = &m_points[i * m_dim];
+        double sum = 0.0;
+        if (m_metric == L1) {
+          for (size_t j = 0; j < m_dim; ++j)
+            sum += std::fabs(query[j] - p[j]);
+          return sum;
+        }
+        for (size_t j = 0; j < m_dim; ++j)
+          sum += (query[j] - p[j]) * (query[j] - p[j]);
+        return std::sqrt(sum);
+      }
+
+      /*
+        The indexes of the k points nearest to query (in no particular
+        order). Of the points at the same distance, those with the
+        smaller index are taken.
+      */
+      void nearest(const double* query, size_t k, std::vector<size_t>& result) const {
+        std::vector<Candidate> heap;
+        if (k > 0)
+          search_nearest(m_root, query, k, -1, heap);
+        result.clear();
+        for (size_t i = 0; i < heap.size(); ++i)
+          result.push_back(heap[i].index);
+      }
+
+      /*
+        The index of the point nearest to query with a label other than
+        label, or size() if there is none (closer than bound).
+      */
+      size_t nearest_unlike(const double* query, int label,
+                            double bound = std::numeric_limits<double>::infinity()) const {
+        std::vector<Candidate> heap;
+        if (bound != std::numeric_limits<double>::infinity())
+          heap.push_back(Candidate(size(), bound));
+        search_nearest(m_root, query, 1, label, heap);
+        // a point at the bound itself replaces the bound (it has a
+        // smaller index), but is not closer
+        if (heap.empty() || heap[0].distance >= bound)
+          return size();
+        return heap[0].index;
+      }
+
+      /*
+        Appends the indexes of the points at most radius away from
+        query to result, except those with the label unlike (if it is
+        not negative).
+      */
+      void within(const double* query, double radius, std::vector<size_t>& result,
+                  int unlike = -1) const {
+        search_within(m_root, query, radius, unlike, result);
+      }
+
+      /*
+        Appends the indexes of the points at least radius away from
+        query to result.
+      */
+      void beyond(const double* query, double radius, std::vector<size_t>& result) const {
+        search_beyond(m_root, query, radius, result);
+      }
+
+      /*
+        The index of the point farthest from query (size() if the tree
+        is empty).
+      */
+      size_t farthest(const double* query) const {
+        Candidate best(size(), -1.0);
+        search_farthest(m_root, query, best);
+        return best.index;
+      }
+
+    private:
+      struct Node {
+        size_t point;
+        // the median distance to the vantage point, and the largest
+        // distance of any point in the subtree
+        double mu, max_distance;
+        long inside, outside;
+      };
+
+      struct Candidate {
+        Candidate(size_t i, double d) : index(i), distance(d) { }
+        bool operator<(const Candidate& other) const {
+          if (distance != other.distance)
+            return distance < other.distance;
+          return index < other.index;
+        }
+        size_t index;
+        double distance;
+      };
+
+      long build(std::vector<size_t>& indexes, size_t begin, size_t end) {
+        if (begin == end)
+          return -1;
+        long n = long(m_nodes.size());
+        m_nodes.push_back(Node());
+        // a deterministic pseudo-random vantage point
+        size_t pick = begin + (size_t(n) * 2654435761UL) % (end - begin);
+        std::swap(indexes[begin], indexes[pick]);
+        size_t vp = indexes[begin];
+        m_nodes[n].point = vp;
+        m_nodes[n].mu = 0.0;
+        m_nodes[n].max_distance = 0.0;
+        m_nodes[n].inside = m_nodes[n].outside = -1;
+        ++begin;
+        if (begin == end)
+          return n;
+
+        const double* p = &m_points[vp * m_dim];
+        std::vector<Candidate> dists;
+        dists.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i)
+          dists.push_back(Candidate(indexes[i], distance(p, indexes[i])));
+        size_t median = dists.size() / 2;
+        std::nth_element(dists.begin(), dists.begin() + median, dists.end());
+        double max_distance = 0.0;
+        for (size_t i = 0; i < dists.size(); ++i) {
+          indexes[begin + i] = dists[i].index;
+          max_distance = std::max(max_distance, dists[i].distance);
+        }
+        m_nodes[n].mu = dists[median].distance;
+        m_nodes[n].max_distance = max_distance;
+        // inside: [begin, begin + median], all with distance <= mu
+        long inside = build(indexes, begin, begin + median + 1);
+        long outside = build(indexes, begin + median + 1, end);
+        m_nodes[n].inside = inside;
+        m_nodes[n].outside = outside;
+        return n;
+      }
+
+      // heap holds at most k candidates, the farthest on top
+      void search_nearest(long n, const double* query, size_t k, int unlike,
+                          std::vector<Candidate>& heap) const {
+        if (n < 0)
+          return;
+        const Node& node = m_nodes[n];
+        double d = distance(query, node.point);
+        if (unlike < 0 || m_labels[node.point] != unlike) {
+          if (heap.size() < k) {
+            heap.push_back(Candidate(node.point, d));
+            std::push_heap(heap.begin(), heap.end());
+          } else if (Candidate(node.point, d) < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = Candidate(node.point, d);
+            std::push_heap(heap.begin(), heap.end());
+          }
+        }
+        // visit the more promising side first
+        if (d <= node.mu) {
+          search_nearest(node.inside, query, k, unlike, heap);
+          if (heap.size() < k || node.mu - d <= heap.front().distance)
+            search_nearest(node.outside, query, k, unlike, heap);
+        } else {
+          if (d - node.max_distance <= tau(heap, k))
+            search_nearest(node.outside, query, k, unlike, heap);
+          if (heap.size() < k || d - node.mu <= heap.front().distance)
+            search_nearest(node.inside, query, k, unlike, heap);
+        }
+      }
+
+      double tau(const std::vector<Candidate>& heap, size_t k) const {
+        if (heap.size() < k)
+          return std::numeric_limits<double>::infinity();
+        return heap.front().distance;
+      }
+
+      void search_within(long n, const double* query, double radius, int unlike,
+                         std::vector<size_t>& result) const {
+        if (n < 0)
+          return;
+        const Node& node = m_nodes[n];
+        double d = distance(query, node.point);
+        if (d <= radius && (unlike < 0 || m_labels[node.point] != unlike))
+          result.push_back(node.point);
+        // the inside points are at least d - mu away, the outside
+        // points at least mu - d and d - max_distance
+        if (d - node.mu <= radius)
+          search_within(node.inside, query, radius, unlike, result);
+        if (node.mu - d <= radius && d - node.max_distance <= radius)
+          search_within(node.outside, query, radius, unlike, result);
+      }
+
+      void search_beyond(long n, const double* query, double radius,
+                         std::vector<size_t>& result) const {
+        if (n < 0)
+          return;
+        const Node& node = m_nodes[n];
+        double d = distance(query, node.point);
+        if (d >= radius)
+          result.push_back(node.point);
+        if (d + node.mu >= radius)
+          search_beyond(node.inside, query, radius, result);
+        if (d + node.max_distance >= radius)
+          search_beyond(node.outside, query, radius, result);
+      }
+
+      void search_farthest(long n, const double* query, Candidate& best) const {
+        if (n < 0)
+          return;
+        const Node& node = m_nodes[n];
+        double d = distance(query, node.point);
+        if (d > best.distance)
+          best = Candidate(node.point, d);
+        // the outside points are the likely candidates
+        if (d + node.max_distance > best.distance)
+          search_farthest(node.outside, query, best);
+        if (d + node.mu > best.distance)
+          search_farthest(node.inside, query, best);
+      }
+
+      std::vector<double> m_points;
+      std::vector<int> m_labels;
+      std::vector<Node> m_nodes;
+      size_t m_dim;
+      Metric m_metric;
+      long m_root;
+    };
+
+    /*
+      PRODUCT QUANTIZER
+
+      Approximates a set of points by short codes: the coordinates are
+      split into groups ("subspaces") of sub_dim coordinates, and each
+      group of each point is replaced by the index (one byte) of the
+      nearest of up to 256 centroids found with k-means for this
+      subspace. The distance between a query and a point is then
+      approximated by the sum of the distances between the query and
+      the centroids of the point's code, which are looked up in a table
+      computed once per query (see distance_table).
+
+      Like the VP tree, this works with the city block distance and
+      the (squared) euclidean distance (Metric L2, where the squared
+      distance is used, as it is a sum over the coordinates).
+    */
+    class ProductQuantizer {
+    public:
+      enum { MAX_CENTROIDS = 256 };
+
+      ProductQuantizer(const double* data, size_t num_points, size_t dim,
+                       VpTree::Metric metric, size_t sub_dim = 4,
+                       size_t max_train = 20000)
+        : m_dim(dim), m_sub_dim(sub_dim), m_metric(metric) {
+        m_num_subspaces = (dim + sub_dim - 1) / sub_dim;
+        m_num_centroids = std::min(size_t(MAX_CENTROIDS), std::max(num_points, size_t(1)));
+        m_centroids.resize(m_num_subspaces * m_num_centroids * sub_dim, 0.0);
+        m_codes.resize(num_points * m_num_subspaces);
+        // training on every step-th point only
+        size_t step = std::max(size_t(1), num_points / max_train);
+        std::vector<double> sub;
+        for (size_t s = 0; s < m_num_subspaces; ++s) {
+          sub.clear();
+          for (size_t i = 0; i < num_points; i += step)
+            append_subvector(data + i * dim, s, sub);
+          train(s, sub);
+          for (size_t i = 0; i < num_points; ++i) {
+            std::vector<double> x;
+            append_subvector(data + i * dim, s, x);
+            m_codes[i * m_num_subspaces + s] = (unsigned char)nearest_centroid(s, &x[0]);
+          }
+        }
+      }
+
+      size_t size() const {
+        return m_codes.size() / std::max(m_num_subspaces, size_t(1));
+      }
+
+      /*
+        Fills table with the distances between the parts of query
+        and all centroids.
+      */
+      void distance_table(const double* query, std::vector<double>& table) const {
+        table.resize(m_num_subspaces * m_num_centroids);
+        std::vector<double> x;
+        for (size_t s = 0; s < m_num_subspaces; ++s) {
+          x.clear();
+          append_subvector(query, s, x);
+          for (size_t c = 0; c < m_num_centroids; ++c)
+            table[s * m_num_centroids + c] = distance(&x[0], centroid(s, c));
+        }
+      }
+
+      // the approximate distance between the query of table and point i
+      double distance(const std::vector<double>& table, size_t i) const {
+        const unsigned char* code = &m_codes[i * m_num_subspaces];
+        double sum = 0.0;
+        for (size_t s = 0; s < m_num_subspaces; ++s)
+          sum += table[s * m_num_centroids + code[s]];
+        return sum;
+      }
+
+    private:
+      void append_subvector(const double* point, size_t s, std::vector<double>& out) const {
+        for (size_t j = s * m_sub_dim; j < (s + 1) * m_sub_dim; ++j)
+          out.push_back(j < m_dim ? point[j] : 0.0);
+      }
+
+      const double* centroid(size_t s, size_t c) const {
+        return &m_centroids[(s * m_num_centroids + c) * m_sub_dim];
+      }
+
+      double distance(const double* a, const double* b) const {
+        double sum = 0.0;
+        for (size_t j = 0; j < m_sub_dim; ++j) {
+          if (m_metric == VpTree::L1)
+            sum += std::fabs(a[j] - b[j]);
+          else
+            sum += (a[j] - b[j]) * (a[j] - b[j]);
+        }
+        return sum;
+      }
+
+      size_t nearest_centroid(size_t s, const double* x) const {
+        size_t best = 0;
+        double best_distance = std::numeric_limits<double>::max();
+        for (size_t c = 0; c < m_num_centroids; ++c) {
+          double d = distance(x, centroid(s, c));
+          if (d < best_distance) {
+            best = c;
+            best_distance = d;
+          }
+        }
+        return best;
+      }
+
+      // a few rounds of k-means on the subvectors in sub
+      void train(size_t s, const std::vector<double>& sub) {
+        size_t n = sub.size() / m_sub_dim;
+        if (n == 0)
+          return;
+        double* centroids = &m_centroids[s * m_num_centroids * m_sub_dim];
+        // start with evenly spaced training points
+        for (size_t c = 0; c < m_num_centroids; ++c) {
+          size_t i = (c * n) / m_num_centroids;
+          std::copy(&sub[i * m_sub_dim], &sub[(i + 1) * m_sub_dim],
+                    centroids + c * m_sub_dim);
+        }
+        std::vector<double> sums(m_num_centroids * m_sub_dim);
+        std::vector<size_t> counts(m_num_centroids);
+        for (int round = 0; round < 10; ++round) {
+          std::fill(sums.begin(), sums.end(), 0.0);
+          std::fill(counts.begin(), counts.end(), 0);
+          for (size_t i = 0; i < n; ++i) {
+            size_t c = nearest_centroid(s, &sub[i * m_sub_dim]);
+            for (size_t j = 0; j < m_sub_dim; ++j)
+              sums[c * m_sub_dim + j] += sub[i * m_sub_dim + j];
+            counts[c]++;
+          }
+          for (size_t c = 0; c < m_num_centroids; ++c) {
+            // centroids without points are left where they are
+            if (counts[c] == 0)
+              continue;
+            for (size_t j = 0; j < m_sub_dim; ++j)
+              centroids[c * m_sub_dim + j] = sums[c * m_sub_dim + j] / counts[c];
+          }
+        }
+      }
+
+      size_t m_dim, m_sub_dim, m_num_subspaces, m_num_centroids;
+      VpTree::Metric m_metric;
+      std::vector<double> m_centroids;
+      std::vector<unsigned char> m_codes;
+    };
+
+  } // namespace kNN
+} //namespace Gamera
+
+#endif
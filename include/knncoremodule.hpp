@@ -26,6 +26,10 @@
 #include "gameramodule.hpp"
 #include "knn.hpp"
 #include "knnmodule.hpp"
+#include "knn_index.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace Gamera { namespace kNN {
 
@@ -34,6 +38,36 @@ namespace Gamera { namespace kNN {
     0,
   };
 
+  // the search index (see knncoremodule.cpp)
+  struct KnnIndex;
+  // the stored feature vectors reduced to the used features (see below)
+  struct KnnActive;
+
+  /*
+    The element types for storing the feature vectors of the database.
+    The quantized types store each feature scaled linearly between its
+    minimum and maximum over the (normalized) database.
+  */
+  enum StorageType {
+    STORAGE_DOUBLE,
+    STORAGE_FLOAT,
+    STORAGE_UINT16,
+    STORAGE_UINT8
+  };
+
+  inline size_t storage_size(int storage) {
+    switch (storage) {
+    case STORAGE_FLOAT:
+      return sizeof(float);
+    case STORAGE_UINT16:
+      return sizeof(unsigned short);
+    case STORAGE_UINT8:
+      return sizeof(unsigned char);
+    default:
+      return sizeof(double);
+    }
+  }
+
   /*
     The KnnObject holds all of the information needed by knn. Unlike
     many of the parts of Gamera, there is a significant amount of
@@ -46,57 +80,507 @@ namespace Gamera { namespace kNN {
     size_t num_features;
 
     /*
-      The feature vectors.
-      A vector to double arrays of size num_features is used to store the
-      feature vectors. It is only used for non-interactive classification).
+      The feature vectors (only used for non-interactive classification).
+      They are stored in a single row-major matrix of num_feature_vectors
+      rows of num_features values of the type given by storage, so that
+      the distance loops run over contiguous memory. features points to
+      the first row, which is aligned to a cache line inside
+      feature_storage (the allocated block) or inside mapping (a
+      file mapped by unserialize). features is 0 as long as there is
+      no data.
     */
-    std::vector<double*> *feature_vectors;
-
-    // The id_names for the feature vectors
-    char** id_names;
+    size_t num_feature_vectors;
+    // the number of rows allocated (see add_images)
+    size_t capacity;
+    StorageType storage;
+    void* features;
+    char* feature_storage;
+    // the mapped file when the data is used in place (see unserialize)
+    void* mapping;
+    size_t mapping_size;
+    /*
+      For the quantized storage types, feature k of a stored vector is
+      quantize_offset[k] + value * quantize_step[k] (0 otherwise).
+    */
+    double* quantize_offset;
+    double* quantize_step;
+    // The class of each feature vector as an index into class_names
+    int* class_ids;
+    // The interned id_names (each distinct name is stored once)
+    std::vector<char*>* class_names;
     // confidence types to be computed during classification
     std::vector<int> confidence_types;
     // The current selected features
     int *selection_vector;
     // The current weights applied to the distance calculation
     double* weight_vector;
-    // a histogram of the id_names for use in leave-one-out
+    // the number of feature vectors of each class for use in leave-one-out
     int* id_name_histogram;
+    /*
+      Whether feature vectors were added or removed since the
+      normalization was last computed (see knn_update_normalization).
+    */
+    bool normalization_changed;
+    // incremented whenever the stored feature vectors change
+    size_t data_version;
     /*
       The normalization applied to the feature vectors prior to distance
       calculation.
     */
     Normalize* normalize;
-    /*
-      Temporary storage for the unknown feature vector. This is simply to avoid
-      allocating memory for each call to classify (and could potentially
-      increase our cache hit rate, but who really knows).
-    */
-    double* unknown;
     // k - this is k-NN after all
     size_t num_k;
     // the distance type currently being used.
     DistanceType distance_type;
+    // the number of threads for the distance computations (0 = all cores)
+    int num_threads;
+    // whether classify uses a search index instead of a linear scan
+    bool use_index;
+    // the number of exactly compared candidates of the approximate search
+    // (0 = exact search)
+    size_t approximate_candidates;
+    // the index, built on demand (0 if not built yet)
+    KnnIndex* index;
+    // the reduced feature vectors for the linear scan, built on demand
+    KnnActive* active;
+    /*
+      The number of searches currently running without the GIL. While
+      it is not 0, the feature vectors, the index and the settings read
+      by the searches must not change (see knn_check_idle).
+    */
+    int searching;
   };
 
   /*
-    String comparison functors used by the kNearestNeighbors object
+    The number of threads actually used for the distance computations.
+    Without OpenMP everything runs on one thread.
+  */
+  inline int knn_num_threads(const KnnObject* o) {
+#ifdef _OPENMP
+    if (o->num_threads > 0)
+      return o->num_threads;
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+
+  // the i-th feature vector (T must be the element type of the storage)
+  template<class T>
+  inline T* knn_feature_vector(const KnnObject* o, size_t i) {
+    return (T*)o->features + i * o->num_features;
+  }
+
+  template<class T>
+  inline void knn_dequantize(const KnnObject* o, const T* fv, double* dest) {
+    for (size_t k = 0; k < o->num_features; ++k)
+      dest[k] = o->quantize_offset[k] + fv[k] * o->quantize_step[k];
+  }
+
+  // copies the i-th feature vector to dest as doubles
+  inline void knn_get_feature_vector(const KnnObject* o, size_t i, double* dest) {
+    switch (o->storage) {
+    case STORAGE_DOUBLE: {
+      const double* fv = knn_feature_vector<double>(o, i);
+      std::copy(fv, fv + o->num_features, dest);
+      break;
+    }
+    case STORAGE_FLOAT: {
+      const float* fv = knn_feature_vector<float>(o, i);
+      std::copy(fv, fv + o->num_features, dest);
+      break;
+    }
+    case STORAGE_UINT16:
+      knn_dequantize(o, knn_feature_vector<unsigned short>(o, i), dest);
+      break;
+    case STORAGE_UINT8:
+      knn_dequantize(o, knn_feature_vector<unsigned char>(o, i), dest);
+      break;
+    }
+  }
+
+  template<class T>
+  inline void knn_transform_features(KnnObject* o, const std::vector<double>& scale,
+                                     const std::vector<double>& shift) {
+    for (size_t i = 0; i < o->num_feature_vectors; ++i) {
+      T* fv = knn_feature_vector<T>(o, i);
+      for (size_t k = 0; k < o->num_features; ++k)
+        fv[k] = T(fv[k] * scale[k] + shift[k]);
+    }
+  }
+
+  /*
+    Brings the stored feature vectors up to date with the normalization
+    after feature vectors were added or removed (see add_images). This
+    must be called before the stored feature vectors are used. They are
+    normalized with the previous mean and standard deviation, so each
+    feature only changes linearly. For the quantized storage types only
+    the offsets and steps change.
+  */
+  inline void knn_update_normalization(KnnObject* o) {
+    if (!o->normalization_changed)
+      return;
+    o->normalization_changed = false;
+    Normalize* norm = o->normalize;
+    if (norm == 0 || o->features == 0 || norm->num_feature_vectors() < 2)
+      return;
+    size_t num_features = o->num_features;
+    std::vector<double> old_mean(norm->get_mean_vector(),
+                                 norm->get_mean_vector() + num_features);
+    std::vector<double> old_stdev(norm->get_stdev_vector(),
+                                  norm->get_stdev_vector() + num_features);
+    norm->compute_normalization();
+    const double* mean = norm->get_mean_vector();
+    const double* stdev = norm->get_stdev_vector();
+    std::vector<double> scale(num_features), shift(num_features);
+    for (size_t k = 0; k < num_features; ++k) {
+      scale[k] = old_stdev[k] / stdev[k];
+      shift[k] = (old_mean[k] - mean[k]) / stdev[k];
+    }
+    switch (o->storage) {
+    case STORAGE_DOUBLE:
+      knn_transform_features<double>(o, scale, shift);
+      break;
+    case STORAGE_FLOAT:
+      knn_transform_features<float>(o, scale, shift);
+      break;
+    default:
+      for (size_t k = 0; k < num_features; ++k) {
+        o->quantize_offset[k] = o->quantize_offset[k] * scale[k] + shift[k];
+        o->quantize_step[k] *= scale[k];
+      }
+    }
+    ++o->data_version;
+  }
+
+  /*
+    The stored feature vectors reduced to the features with a non-zero
+    effective weight, in the element type of the storage. When features
+    are deselected or weighted with zero, the linear scan of classify
+    reads these rows, so that each distance only touches the features
+    that are actually used (see knn_get_active).
+  */
+  struct KnnActive {
+    KnnActive(const KnnObject* o, const std::vector<size_t>& used)
+      : storage(o->storage), data_version(o->data_version), dims(used) {
+      switch (storage) {
+      case STORAGE_FLOAT:
+        copy_rows<float>(o);
+        break;
+      case STORAGE_UINT16:
+        copy_rows<unsigned short>(o);
+        break;
+      case STORAGE_UINT8:
+        copy_rows<unsigned char>(o);
+        break;
+      default:
+        copy_rows<double>(o);
+      }
+    }
+    template<class T>
+    void copy_rows(const KnnObject* o) {
+      size_t num_known = o->num_feature_vectors, len = dims.size();
+      // one more element, so that &rows[0] is valid without features
+      rows.resize((num_known * len + 1) * sizeof(T));
+      T* dest = (T*)&rows[0];
+      for (size_t i = 0; i < num_known; ++i) {
+        const T* fv = knn_feature_vector<T>(o, i);
+        for (size_t k = 0; k < len; ++k)
+          *dest++ = fv[dims[k]];
+      }
+    }
+    template<class T>
+    const T* row(size_t i) const {
+      return (const T*)&rows[0] + i * dims.size();
+    }
+    StorageType storage;
+    size_t data_version;
+    // the features in the rows
+    std::vector<size_t> dims;
+    std::vector<char> rows;
+  };
+
+  /*
+    An unknown feature vector prepared for the distances to the stored
+    feature vectors. For the quantized storage types the unknown is
+    moved into the quantized space and the steps are folded into the
+    weights, so that the kernels run on the stored values directly.
+    With *active*, only the features in its rows are compared.
+  */
+  struct StoredQuery {
+    StoredQuery(const KnnObject* o, const double* unknown_buf,
+                const double* weights_buf, const KnnActive* active_ = 0)
+      : object(o), active(active_) {
+      size_t len = active ? active->dims.size() : o->num_features;
+      // one more element, so that &v[0] is valid without features
+      unknown.resize(len + 1, 0.0);
+      weights.resize(len + 1, 0.0);
+      bool quantized = o->storage == STORAGE_UINT16 || o->storage == STORAGE_UINT8;
+      for (size_t k = 0; k < len; ++k) {
+        size_t feature = active ? active->dims[k] : k;
+        unknown[k] = unknown_buf[feature];
+        weights[k] = weights_buf[feature];
+        if (quantized) {
+          double step = o->quantize_step[feature];
+          unknown[k] = (unknown[k] - o->quantize_offset[feature]) / step;
+          if (o->distance_type == FAST_EUCLIDEAN)
+            weights[k] *= step * step;
+          else
+            weights[k] *= step;
+        }
+      }
+    }
+
+    // the compared features of the i-th feature vector
+    template<class T>
+    const T* row(size_t i) const {
+      return active ? active->row<T>(i) : knn_feature_vector<T>(object, i);
+    }
+
+    // the distance to the i-th feature vector
+    double distance(size_t i) const {
+      const KnnObject* o = object;
+      size_t len = unknown.size() - 1;
+      switch (o->storage) {
+      case STORAGE_FLOAT:
+        return compute_distance(o->distance_type, row<float>(i),
+                                &unknown[0], &weights[0], len);
+      case STORAGE_UINT16:
+        return compute_distance(o->distance_type, row<unsigned short>(i),
+                                &unknown[0], &weights[0], len);
+      case STORAGE_UINT8:
+        return compute_distance(o->distance_type, row<unsigned char>(i),
+                                &unknown[0], &weights[0], len);
+      default:
+        return compute_distance(o->distance_type, row<double>(i),
+                                &unknown[0], &weights[0], len);
+      }
+    }
+
+    // the distances to the feature vectors [begin, end) in out
+    inline void distances(size_t begin, size_t end, double* out) const;
+
+    const KnnObject* object;
+    const KnnActive* active;
+    std::vector<double> unknown;
+    std::vector<double> weights;
+  };
+
+  /*
+    The kernel of the linear scan, compiled for each instruction set
+    (see cpu_dispatch.hpp).
+  */
+  template<class T>
+  GAMERA_CPU_INLINE void stored_distances(const StoredQuery* query, size_t begin,
+                                          size_t end, double* out) {
+    DistanceType distance_type = query->object->distance_type;
+    size_t len = query->unknown.size() - 1;
+    const double* unknown = &query->unknown[0];
+    const double* weights = &query->weights[0];
+    for (size_t i = begin; i < end; ++i)
+      out[i - begin] = compute_distance(distance_type, query->row<T>(i),
+                                        unknown, weights, len);
+  }
+
+  GAMERA_CPU_INLINE void stored_distances(const StoredQuery* query, size_t begin,
+                                          size_t end, double* out) {
+    switch (query->object->storage) {
+    case STORAGE_FLOAT:
+      stored_distances<float>(query, begin, end, out);
+      break;
+    case STORAGE_UINT16:
+      stored_distances<unsigned short>(query, begin, end, out);
+      break;
+    case STORAGE_UINT8:
+      stored_distances<unsigned char>(query, begin, end, out);
+      break;
+    default:
+      stored_distances<double>(query, begin, end, out);
+    }
+  }
+
+  GAMERA_CPU_KERNEL(knn_stored_distances, stored_distances, void,
+                    (const StoredQuery* query, size_t begin, size_t end, double* out),
+                    (query, begin, end, out))
+
+  typedef void (*StoredDistances)(const StoredQuery*, size_t, size_t, double*);
+
+  inline void StoredQuery::distances(size_t begin, size_t end, double* out) const {
+    static const CpuKernel<StoredDistances> kernel =
+      GAMERA_CPU_VARIANTS(knn_stored_distances);
+    static const StoredDistances variant = kernel.select("knn.distances");
+    variant(this, begin, end, out);
+  }
+
+  // the id_name of the i-th feature vector
+  inline char* knn_id_name(const KnnObject* o, size_t i) {
+    return (*o->class_names)[o->class_ids[i]];
+  }
+
+  /*
+    String comparison functor for the maps from class names to class ids
   */
   struct ltstr {
     bool operator()(const char* s1, const char* s2) const {
       return strcmp(s1, s2) < 0;
     }
   };
-  struct eqstr {
-    bool operator()(const char* s1, const char* s2) const {
-      return strcmp(s1, s2) == 0;
+
+  /*
+    Orders class ids by their names, so that the kNearestNeighbors
+    answers are in the same order however the ids were assigned.
+  */
+  struct ClassNameLess {
+    ClassNameLess(const std::vector<char*>* names_ = 0) : names(names_) {}
+    bool operator()(int a, int b) const {
+      return strcmp((*names)[a], (*names)[b]) < 0;
     }
+    const std::vector<char*>* names;
   };
+  typedef kNearestNeighbors<int, ClassNameLess> ClassNearestNeighbors;
+
+  /*
+    The database prepared for searches that only need the k nearest
+    neighbors (leave-one-out and the knn distance statistics):
+
+    - the selections are folded into the weights, and features with
+      a weight of zero are dropped,
+    - the remaining features are copied into contiguous rows, ordered
+      by decreasing (weighted) spread over the database. The partial
+      sums of the distances then grow fast, so that the distance
+      computation for most candidates can stop after a few features
+      (see search).
+  */
+  struct NearestSearch {
+    NearestSearch(KnnObject* o, int* selections, double* weights,
+                  std::vector<long>* indexes = 0) {
+      distance_type = o->distance_type;
+      std::vector<size_t> all;
+      if (indexes == 0) {
+        for (size_t k = 0; k < o->num_features; ++k)
+          all.push_back(k);
+      } else {
+        all.assign(indexes->begin(), indexes->end());
+      }
+
+      size_t num_known = o->num_feature_vectors;
+      // the stopping criterion only works for non-negative weights
+      bounded = true;
+      std::vector<double> fv(o->num_features + 1);
+      std::vector<double> sum(o->num_features + 1, 0.0), sum2(o->num_features + 1, 0.0);
+      for (size_t i = 0; i < num_known; ++i) {
+        knn_get_feature_vector(o, i, &fv[0]);
+        for (size_t k = 0; k < o->num_features; ++k) {
+          sum[k] += fv[k];
+          sum2[k] += fv[k] * fv[k];
+        }
+      }
+      std::vector<std::pair<double, size_t> > order;
+      for (size_t k = 0; k < all.size(); ++k) {
+        double weight = selections[all[k]] * weights[all[k]];
+        if (weight == 0.0)
+          continue;
+        if (weight < 0.0)
+          bounded = false;
+        double mean = sum[all[k]] / num_known;
+        double var = std::max(0.0, sum2[all[k]] / num_known - mean * mean);
+        double spread = (distance_type == FAST_EUCLIDEAN) ? var : std::sqrt(var);
+        // negated, so that the sort is by decreasing spread
+        order.push_back(std::make_pair(-std::fabs(weight) * spread, k));
+      }
+      std::stable_sort(order.begin(), order.end());
+
+      len = order.size();
+      // one more element, so that &v[0] is valid without features
+      folded.resize(len + 1);
+      for (size_t k = 0; k < len; ++k) {
+        size_t feature = all[order[k].second];
+        folded[k] = selections[feature] * weights[feature];
+      }
+      data.resize(num_known * len + 1);
+      rows.resize(num_known);
+      for (size_t i = 0; i < num_known; ++i) {
+        double* row = &data[i * len];
+        knn_get_feature_vector(o, i, &fv[0]);
+        for (size_t k = 0; k < len; ++k)
+          row[k] = fv[all[order[k].second]];
+        rows[i] = row;
+      }
+    }
+
+    /*
+      Adds all rows except skip to knn. Once knn has k neighbors, the
+      distance to a candidate is only computed until it exceeds the
+      distance of the k-th neighbor, and such candidates are not added.
+      Only the neighbors (knn.m_nn) and majority are valid afterwards.
+    */
+    void search(size_t skip, const KnnObject* o,
+                ClassNearestNeighbors& knn) const {
+      search_ids(skip, o->class_ids, knn);
+    }
+
+    // the same with the indexes of the rows as ids
+    void search(size_t skip, kNearestNeighbors<int>& knn) const {
+      search_ids(skip, (const int*)0, knn);
+    }
+
+    // the same with only the given rows as candidates
+    void search(size_t skip, const KnnObject* o, const std::vector<int>& candidates,
+                ClassNearestNeighbors& knn) const {
+      search_ids(skip, o->class_ids, knn, &candidates);
+    }
 
+    template<class KNN>
+    void search_ids(size_t skip, const int* ids, KNN& knn,
+                    const std::vector<int>* candidates = 0) const {
+      const double infinity = std::numeric_limits<double>::infinity();
+      const double* unknown = rows[skip];
+      size_t num_candidates = candidates ? candidates->size() : rows.size();
+      for (size_t c = 0; c < num_candidates; ++c) {
+        size_t j = candidates ? size_t((*candidates)[c]) : c;
+        if (j == skip)
+          continue;
+        double bound = infinity;
+        if (bounded && knn.full())
+          bound = knn.max_nn_distance();
+        double distance = compute_distance(distance_type, rows[j], unknown,
+                                           &folded[0], len, bound);
+        if (distance < bound || bound == infinity)
+          knn.add(ids ? ids[j] : int(j), distance);
+      }
+    }
+
+    DistanceType distance_type;
+    bool bounded;
+    size_t len;
+    std::vector<double> folded;
+    std::vector<double> data;
+    std::vector<const double*> rows;
+  };
+
+  /*
+    The feature vectors used as queries by leave_one_out. We don't want
+    to do the calculation if there is no hope that kNN will return the
+    correct answer (because there aren't enough examples in the database).
+  */
+  inline bool leave_one_out_query(const KnnObject* o, size_t i) {
+    return o->id_name_histogram[o->class_ids[i]] >= int((o->num_k + 0.5) / 2);
+  }
+
+  /*
+    The queries are done in blocks of a few queries per thread. The
+    results of a block are counted in order, so that stop_threshold
+    stops after the same query as with one thread.
+
+    When subset is given, only the feature vectors in it (in increasing
+    order) are used as queries, as long as they are valid queries; all
+    feature vectors are still used as neighbors.
+  */
   static std::pair<int,int> leave_one_out(KnnObject* o, int stop_threshold,
                                           int* selection_vector = 0,
                                           double* weight_vector = 0,
-                                          std::vector<long>* indexes = 0) {
+                                          std::vector<long>* indexes = 0,
+                                          const std::vector<size_t>* subset = 0) {
     int* selections = selection_vector;
     if (selections == 0) {
       selections = o->selection_vector;
@@ -107,74 +591,626 @@ namespace Gamera { namespace kNN {
       weights = o->weight_vector;
     }
 
-    assert(o->feature_vectors != 0);
-    kNearestNeighbors<char*, ltstr, eqstr> knn(o->num_k);
+    assert(o->features != 0);
+    NearestSearch database(o, selections, weights, indexes);
+
+    std::vector<size_t> queries;
+    if (subset != 0) {
+      for (size_t q = 0; q < subset->size(); ++q) {
+        if (leave_one_out_query(o, (*subset)[q]))
+          queries.push_back((*subset)[q]);
+      }
+    } else {
+      for (size_t i = 0; i < o->num_feature_vectors; ++i) {
+        if (leave_one_out_query(o, i))
+          queries.push_back(i);
+      }
+    }
 
+    int num_threads = knn_num_threads(o);
+    size_t block_size = size_t(num_threads) * 16;
+    std::vector<char> correct(block_size);
     int total_correct = 0;
     int total_queries = 0;
-    if (indexes == 0) {
-      for (size_t i = 0; i < o->feature_vectors->size(); ++i/*, cur += o->num_features*/) {
-        // We don't want to do the calculation if there is no
-        // hope that kNN will return the correct answer (because
-        // there aren't enough examples in the database).
-        if (o->id_name_histogram[i] < int((o->num_k + 0.5) / 2)) {
-          continue;
-        }
-        double* current_known;
-        double* unknown = (*o->feature_vectors)[i];
-        for (size_t j = 0; j < o->feature_vectors->size(); ++j) {
-          current_known = (*o->feature_vectors)[j];
-          if (i == j)
-            continue;
-          double distance;
-          compute_distance(o->distance_type, current_known, o->num_features,
-                           unknown, &distance, selections, weights);
-          knn.add(o->id_names[j], distance);
+    for (size_t begin = 0; begin < queries.size(); begin += block_size) {
+      long end = long(std::min(queries.size(), begin + block_size));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+      {
+        ClassNearestNeighbors knn(o->num_k, ClassNameLess(o->class_names));
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (long q = long(begin); q < end; ++q) {
+          size_t i = queries[q];
+          database.search(i, o, knn);
+          knn.majority();
+          correct[q - begin] = knn.answer[0].first == o->class_ids[i];
+          knn.reset();
         }
-        knn.majority();
-        if (strcmp(knn.answer[0].first, o->id_names[i]) == 0) {
+      }
+      for (long q = long(begin); q < end; ++q) {
+        if (correct[q - begin])
           total_correct++;
-        }
-        knn.reset();
         total_queries++;
         if (total_queries - total_correct > stop_threshold)
           return std::make_pair(total_correct, total_queries);
       }
-    } else {
-      for (size_t i = 0; i < o->feature_vectors->size(); ++i) {
-        if (o->id_name_histogram[i] < int((o->num_k + 0.5) / 2))
+    }
+    return std::make_pair(total_correct, total_queries);
+  }
+
+  /*
+    The k nearest neighbors of each feature vector among the others (as
+    for leave_one_out), nearest first, as pairs of the index of the
+    neighbor and its distance. The editing rules only look at these
+    lists, so that the database is searched once for all of them.
+  */
+  typedef std::vector<std::vector<std::pair<int, double> > > NeighborLists;
+
+  static void neighbor_lists(KnnObject* o, size_t k, NeighborLists& lists) {
+    assert(o->features != 0);
+    NearestSearch database(o, o->selection_vector, o->weight_vector);
+    lists.assign(o->num_feature_vectors, std::vector<std::pair<int, double> >());
+    int num_threads = knn_num_threads(o);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+    {
+      kNearestNeighbors<int> knn(k);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+      for (long i = 0; i < long(o->num_feature_vectors); ++i) {
+        database.search(size_t(i), knn);
+        for (size_t j = 0; j < knn.m_nn.size(); ++j)
+          lists[i].push_back(std::make_pair(knn.m_nn[j].id, knn.m_nn[j].distance));
+        knn.reset();
+      }
+    }
+  }
+
+  /*
+    Wilson's editing rule: whether each feature vector is misclassified
+    by the majority of the first k of its neighbors.
+  */
+  static std::vector<bool> wilson_edit(const KnnObject* o, size_t k,
+                                       const NeighborLists& lists) {
+    std::vector<bool> result(lists.size());
+    ClassNearestNeighbors knn(k, ClassNameLess(o->class_names));
+    for (size_t i = 0; i < lists.size(); ++i) {
+      size_t n = std::min(k, lists[i].size());
+      if (n == 0)
+        continue;
+      for (size_t j = 0; j < n; ++j)
+        knn.add(o->class_ids[lists[i][j].first], lists[i][j].second);
+      knn.majority();
+      result[i] = knn.answer[0].first != o->class_ids[i];
+      knn.reset();
+    }
+    return result;
+  }
+
+  /*
+    Tomek links: whether each feature vector is the nearest neighbor of
+    its own nearest neighbor, which belongs to another class.
+  */
+  static std::vector<bool> tomek_links(const KnnObject* o,
+                                       const NeighborLists& lists) {
+    std::vector<bool> result(lists.size());
+    for (size_t i = 0; i < lists.size(); ++i) {
+      if (lists[i].empty())
+        continue;
+      int j = lists[i][0].first;
+      result[i] = !lists[j].empty() && lists[j][0].first == int(i)
+        && o->class_ids[j] != o->class_ids[i];
+    }
+    return result;
+  }
+
+  /*
+    Whether each of the queries is classified correctly by the majority of
+    its k nearest neighbors among the candidates (all feature vectors if 0),
+    leaving the query itself out.
+  */
+  static void classify_queries(const KnnObject* o, const NearestSearch& database,
+                               size_t k, const std::vector<int>& queries,
+                               const std::vector<int>* candidates,
+                               std::vector<char>& correct) {
+    correct.resize(queries.size());
+#ifdef _OPENMP
+#pragma omp parallel num_threads(knn_num_threads(o))
+#endif
+    {
+      ClassNearestNeighbors knn(k, ClassNameLess(o->class_names));
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 4)
+#endif
+      for (long q = 0; q < long(queries.size()); ++q) {
+        size_t i = size_t(queries[q]);
+        database.search_ids(i, o->class_ids, knn, candidates);
+        knn.majority();
+        correct[q] = !knn.answer.empty() && knn.answer[0].first == o->class_ids[i];
+        knn.reset();
+      }
+    }
+  }
+
+  /*
+    Prototype selection with Hart's condensed nearest neighbor rule. The
+    store starts with the first feature vector of each class, and the
+    feature vectors misclassified by the store are added to it until it
+    classifies all others correctly. The queries are classified in blocks
+    of a fixed size against the store of the start of the block, so that
+    the result does not depend on the number of threads.
+
+    The leave-one-out accuracy of the store (over all feature vectors) can
+    then be lower than that of the whole database. As long as it is lower
+    by more than tolerance, each misclassified prototype gets the nearest
+    feature vector of its class as a further prototype, and the store is
+    condensed again.
+
+    Returns the indexes of the prototypes, in the order they were added.
+  */
+  static std::vector<int> condense(KnnObject* o, size_t k, double tolerance) {
+    assert(o->features != 0);
+    NearestSearch database(o, o->selection_vector, o->weight_vector);
+    size_t n = o->num_feature_vectors;
+    const size_t block_size = 256;
+
+    std::vector<int> all(n);
+    for (size_t i = 0; i < n; ++i)
+      all[i] = int(i);
+    std::vector<char> correct;
+    classify_queries(o, database, k, all, 0, correct);
+    long target = long(std::count(correct.begin(), correct.end(), 1))
+      - long(std::floor(tolerance * n));
+
+    std::vector<int> store;
+    std::vector<char> in_store(n, 0);
+    std::vector<char> seen(o->class_names->size(), 0);
+    for (size_t i = 0; i < n; ++i) {
+      if (!seen[o->class_ids[i]]) {
+        seen[o->class_ids[i]] = 1;
+        store.push_back(int(i));
+        in_store[i] = 1;
+      }
+    }
+
+    for (;;) {
+      bool added = true;
+      while (added) {
+        added = false;
+        for (size_t begin = 0; begin < n; begin += block_size) {
+          std::vector<int> queries;
+          for (size_t i = begin; i < std::min(n, begin + block_size); ++i) {
+            if (!in_store[i])
+              queries.push_back(int(i));
+          }
+          classify_queries(o, database, k, queries, &store, correct);
+          for (size_t q = 0; q < queries.size(); ++q) {
+            if (!correct[q]) {
+              store.push_back(queries[q]);
+              in_store[queries[q]] = 1;
+              added = true;
+            }
+          }
+        }
+      }
+
+      classify_queries(o, database, k, all, &store, correct);
+      if (long(std::count(correct.begin(), correct.end(), 1)) >= target)
+        break;
+
+      // the candidates for further prototypes of each class
+      std::vector<std::vector<int> > outside(o->class_names->size());
+      for (size_t i = 0; i < n; ++i) {
+        if (!in_store[i])
+          outside[o->class_ids[i]].push_back(int(i));
+      }
+      std::vector<int> grown;
+      kNearestNeighbors<int> nearest(1);
+      for (size_t i = 0; i < n; ++i) {
+        if (!in_store[i] || correct[i] || outside[o->class_ids[i]].empty())
           continue;
-        double* current_known;
-        double* unknown = (*o->feature_vectors)[i];
-        for (size_t j = 0; j < o->feature_vectors->size(); ++j) {
-          current_known = (*o->feature_vectors)[j];
-          if (i == j)
+        database.search_ids(i, (const int*)0, nearest, &outside[o->class_ids[i]]);
+        grown.push_back(nearest.m_nn[0].id);
+        nearest.reset();
+      }
+      if (grown.empty())
+        break;
+      for (size_t g = 0; g < grown.size(); ++g) {
+        if (!in_store[grown[g]]) {
+          store.push_back(grown[g]);
+          in_store[grown[g]] = 1;
+        }
+      }
+    }
+    return store;
+  }
+
+  // the index of (i, j) (with i < j) when the rows of the upper triangle
+  // of a distance matrix are stored one after the other
+  inline long knn_triangle_index(long i, long j, long images_len) {
+    return i * images_len - (i * (i + 1)) / 2 + (j - i - 1);
+  }
+
+  // the pair (i, j) of an index of knn_triangle_index
+  inline void knn_triangle_pair(long index, long images_len, long& i, long& j) {
+    // row i starts at the smaller root of i^2 - (2n - 1) i + 2 index,
+    // which is corrected for rounding
+    double b = 2.0 * double(images_len) - 1.0;
+    i = long((b - std::sqrt(std::max(0.0, b * b - 8.0 * double(index)))) / 2.0);
+    i = std::max(0L, std::min(i, images_len - 2));
+    while (i > 0 && knn_triangle_index(i, i + 1, images_len) > index)
+      --i;
+    while (i < images_len - 2 && knn_triangle_index(i + 1, i + 2, images_len) <= index)
+      ++i;
+    j = index - knn_triangle_index(i, i + 1, images_len) + i + 1;
+  }
+
+  /*
+    HIERARCHICAL CLUSTERING
+
+    The agglomerative clusterings give the n - 1 merges of a dendrogram
+    of n feature vectors, in increasing order of their distance. As in
+    scipy's linkage matrix, the feature vectors are the clusters 0 to
+    n - 1, and the cluster of the m-th merge is n + m.
+  */
+  struct ClusterMerge {
+    ClusterMerge(long a_ = 0, long b_ = 0, double distance_ = 0.0, long size_ = 0)
+      : a(a_), b(b_), distance(distance_), size(size_) {}
+    bool operator<(const ClusterMerge& other) const {
+      return distance < other.distance;
+    }
+    long a, b;
+    double distance;
+    long size;
+  };
+
+  enum ClusterLinkage {
+    SINGLE_LINKAGE,
+    COMPLETE_LINKAGE,
+    AVERAGE_LINKAGE
+  };
+
+  /*
+    Numbers the clusters of merges given as pairs of feature vectors (one
+    of each merged cluster) in increasing order of distance.
+  */
+  inline void number_merges(long n, std::vector<ClusterMerge>& merges) {
+    std::stable_sort(merges.begin(), merges.end());
+    std::vector<long> parent(n), cluster(n), size(n, 1);
+    for (long i = 0; i < n; ++i) {
+      parent[i] = i;
+      cluster[i] = i;
+    }
+    for (size_t m = 0; m < merges.size(); ++m) {
+      long roots[2] = { merges[m].a, merges[m].b };
+      for (int r = 0; r < 2; ++r) {
+        while (parent[roots[r]] != roots[r]) {
+          parent[roots[r]] = parent[parent[roots[r]]];
+          roots[r] = parent[roots[r]];
+        }
+      }
+      long a = std::min(cluster[roots[0]], cluster[roots[1]]);
+      long b = std::max(cluster[roots[0]], cluster[roots[1]]);
+      parent[roots[0]] = roots[1];
+      size[roots[1]] += size[roots[0]];
+      cluster[roots[1]] = n + long(m);
+      merges[m] = ClusterMerge(a, b, merges[m].distance, size[roots[1]]);
+    }
+  }
+
+  /*
+    The edges (a, b, distance) of the minimum spanning tree of n feature
+    vectors, built with Prim's algorithm. The distances are computed
+    when needed by distance(i, j), so that only O(n) memory is used.
+  */
+  template<class D>
+  static std::vector<ClusterMerge> prim_spanning_tree(long n, const D& distance,
+                                                      int num_threads) {
+    const double infinity = std::numeric_limits<double>::infinity();
+    std::vector<double> nearest(n, infinity);
+    std::vector<long> neighbor(n, 0);
+    std::vector<long> outside(n);
+    for (long i = 0; i < n; ++i)
+      outside[i] = i;
+    std::vector<ClusterMerge> merges;
+    long current = 0;
+    while (outside.size() > 1) {
+      // remove the vertex added last to the tree
+      for (size_t k = 0; k < outside.size(); ++k) {
+        if (outside[k] == current) {
+          outside[k] = outside.back();
+          outside.pop_back();
+          break;
+        }
+      }
+      long count = long(outside.size());
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+      for (long k = 0; k < count; ++k) {
+        long j = outside[k];
+        double d = distance(current, j);
+        if (d < nearest[j]) {
+          nearest[j] = d;
+          neighbor[j] = current;
+        }
+      }
+      long next = outside[0];
+      for (long k = 1; k < count; ++k) {
+        long j = outside[k];
+        if (nearest[j] < nearest[next] || (nearest[j] == nearest[next] && j < next))
+          next = j;
+      }
+      merges.push_back(ClusterMerge(neighbor[next], next, nearest[next]));
+      current = next;
+    }
+    return merges;
+  }
+
+  /*
+    Single linkage clustering from the minimum spanning tree.
+  */
+  template<class D>
+  static std::vector<ClusterMerge> single_linkage(long n, const D& distance,
+                                                  int num_threads) {
+    std::vector<ClusterMerge> merges = prim_spanning_tree(n, distance, num_threads);
+    number_merges(n, merges);
+    return merges;
+  }
+
+  /*
+    Complete and average linkage clustering with the nearest neighbor
+    chain algorithm on the upper triangle of the distance matrix (see
+    knn_triangle_index), which is overwritten with the distances between
+    the clusters. Apart from the matrix, only O(n) memory is used.
+  */
+  static std::vector<ClusterMerge> chain_linkage(long n, std::vector<double>& distances,
+                                                 ClusterLinkage linkage) {
+    std::vector<char> active(n, 1);
+    std::vector<long> size(n, 1);
+    std::vector<long> chain;
+    std::vector<ClusterMerge> merges;
+    long first = 0;
+    while (long(merges.size()) < n - 1) {
+      if (chain.empty()) {
+        while (!active[first])
+          ++first;
+        chain.push_back(first);
+      }
+      long a, b;
+      double d;
+      for (;;) {
+        a = chain.back();
+        // the previous cluster of the chain wins ties
+        b = (chain.size() > 1) ? chain[chain.size() - 2] : -1;
+        d = (b >= 0) ? distances[knn_triangle_index(std::min(a, b), std::max(a, b), n)]
+          : std::numeric_limits<double>::infinity();
+        for (long k = 0; k < n; ++k) {
+          if (!active[k] || k == a)
             continue;
-          double distance;
-          if (o->distance_type == CITY_BLOCK) {
-            distance = city_block_distance_skip(current_known, unknown, selections, weights,
-                                                indexes->begin(), indexes->end());
-          } else if (o->distance_type == FAST_EUCLIDEAN) {
-            distance = fast_euclidean_distance_skip(current_known, unknown, selections, weights,
-                                                    indexes->begin(), indexes->end());
-          } else {
-            distance = euclidean_distance_skip(current_known, unknown, selections, weights,
-                                               indexes->begin(), indexes->end());
+          double dk = distances[knn_triangle_index(std::min(a, k), std::max(a, k), n)];
+          if (dk < d || b < 0) {
+            d = dk;
+            b = k;
           }
+        }
+        if (chain.size() > 1 && b == chain[chain.size() - 2])
+          break;
+        chain.push_back(b);
+      }
+      chain.pop_back();
+      chain.pop_back();
+
+      // the merged cluster takes the place of b
+      merges.push_back(ClusterMerge(a, b, d));
+      for (long k = 0; k < n; ++k) {
+        if (!active[k] || k == a || k == b)
+          continue;
+        double& dkb = distances[knn_triangle_index(std::min(b, k), std::max(b, k), n)];
+        double dka = distances[knn_triangle_index(std::min(a, k), std::max(a, k), n)];
+        if (linkage == COMPLETE_LINKAGE)
+          dkb = std::max(dka, dkb);
+        else
+          dkb = (size[a] * dka + size[b] * dkb) / (size[a] + size[b]);
+      }
+      active[a] = 0;
+      size[b] += size[a];
+    }
+    number_merges(n, merges);
+    return merges;
+  }
 
-          knn.add(o->id_names[j], distance);
+  /*
+    SPARSE SPANNING TREES
+
+    For more feature vectors than the O(n^2) distances allow, an
+    approximate minimum spanning tree is built from the graph of the
+    nearest neighbors of each feature vector, which are found with a VP
+    tree. Kruskal's algorithm gives the minimum spanning forest of this
+    graph, whose trees are then joined by Boruvka steps: each tree gets
+    the shortest edge to another tree that nearest_unlike (with the trees
+    as the labels of the VP tree) finds from a few of its points, those
+    farthest from their nearest neighbors. Searching from all points
+    would give the shortest edges, but takes many times longer, as the
+    other trees are far compared to the neighbors.
+  */
+
+  // disjoint sets of 0 to n - 1 (union-find)
+  class DisjointSets {
+  public:
+    DisjointSets(long n) : m_parent(n), m_size(n, 1) {
+      for (long i = 0; i < n; ++i)
+        m_parent[i] = i;
+    }
+    long find(long i) {
+      while (m_parent[i] != i) {
+        m_parent[i] = m_parent[m_parent[i]];
+        i = m_parent[i];
+      }
+      return i;
+    }
+    long size(long i) {
+      return m_size[find(i)];
+    }
+    // false if a and b are in the same set already
+    bool join(long a, long b) {
+      a = find(a);
+      b = find(b);
+      if (a == b)
+        return false;
+      if (m_size[a] > m_size[b])
+        std::swap(a, b);
+      m_parent[a] = b;
+      m_size[b] += m_size[a];
+      return true;
+    }
+  private:
+    std::vector<long> m_parent, m_size;
+  };
+
+  // orders edges by distance, and ties by their feature vectors
+  struct ClusterEdgeLess {
+    bool operator()(const ClusterMerge& x, const ClusterMerge& y) const {
+      if (x.distance != y.distance)
+        return x.distance < y.distance;
+      if (x.a != y.a)
+        return x.a < y.a;
+      return x.b < y.b;
+    }
+  };
+
+  // orders points by decreasing radius, and ties by index
+  struct RadiusGreater {
+    RadiusGreater(const std::vector<double>& r) : radius(r) {}
+    bool operator()(long a, long b) const {
+      if (radius[a] != radius[b])
+        return radius[a] > radius[b];
+      return a < b;
+    }
+    const std::vector<double>& radius;
+  };
+
+  /*
+    Kruskal's algorithm: appends the edges that join two trees of the
+    forest to tree, shortest first.
+  */
+  inline void kruskal_forest(std::vector<ClusterMerge>& edges, DisjointSets& forest,
+                             std::vector<ClusterMerge>& tree) {
+    std::sort(edges.begin(), edges.end(), ClusterEdgeLess());
+    for (size_t e = 0; e < edges.size(); ++e) {
+      if (forest.join(edges[e].a, edges[e].b))
+        tree.push_back(edges[e]);
+    }
+  }
+
+  /*
+    The edges (a, b, distance) of a spanning tree of the points of the
+    VP tree (whose labels are overwritten), which are also given as
+    points, dim coordinates each, in increasing order of distance. The
+    Boruvka steps search from num_samples points of each tree.
+    distance(i, j) is the distance given to the edges, which must order
+    the pairs of points as the metric of the VP tree does. Besides the
+    tree, O(n * num_neighbors) memory is used.
+  */
+  template<class D>
+  static std::vector<ClusterMerge> neighbor_spanning_tree(VpTree& tree, const double* points,
+                                                          size_t dim, long num_neighbors,
+                                                          long num_samples, const D& distance,
+                                                          int num_threads) {
+    long n = long(tree.size());
+    DisjointSets forest(n);
+    std::vector<ClusterMerge> result;
+    if (n < 2)
+      return result;
+    // the largest distance of each point to its nearest neighbors
+    std::vector<double> radius(n, 0.0);
+    {
+      // the graph of the nearest neighbors (without the unused slots of
+      // the points with fewer neighbors)
+      std::vector<ClusterMerge> edges(n * num_neighbors, ClusterMerge(-1, -1));
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 64)
+#endif
+      for (long i = 0; i < n; ++i) {
+        std::vector<size_t> nearest;
+        tree.nearest(points + i * dim, num_neighbors + 1, nearest);
+        long count = 0;
+        for (size_t m = 0; m < nearest.size() && count < num_neighbors; ++m) {
+          long j = long(nearest[m]);
+          if (j != i) {
+            double d = distance(i, j);
+            edges[i * num_neighbors + count++] = ClusterMerge(std::min(i, j), std::max(i, j), d);
+            radius[i] = std::max(radius[i], d);
+          }
         }
-        knn.majority();
-        if (strcmp(knn.answer[0].first, o->id_names[i]) == 0) {
-          total_correct++;
+      }
+      size_t used = 0;
+      for (size_t e = 0; e < edges.size(); ++e) {
+        if (edges[e].a >= 0)
+          edges[used++] = edges[e];
+      }
+      edges.resize(used);
+      kruskal_forest(edges, forest, result);
+    }
+
+    std::vector<int> labels(n);
+    std::vector<long> members(n), first(n + 1);
+    std::vector<ClusterMerge> shortest(n);
+    RadiusGreater farther(radius);
+    while (long(result.size()) < n - 1) {
+      // the points of each tree, the ones farthest from their neighbors
+      // first
+      std::fill(first.begin(), first.end(), 0);
+      for (long i = 0; i < n; ++i) {
+        labels[i] = int(forest.find(i));
+        ++first[labels[i] + 1];
+      }
+      for (long r = 0; r < n; ++r)
+        first[r + 1] += first[r];
+      for (long i = 0; i < n; ++i)
+        members[first[labels[i]]++] = i;
+      for (long r = n; r > 0; --r)
+        first[r] = first[r - 1];
+      first[0] = 0;
+      tree.set_labels(&labels[0]);
+      // the searches of a tree only look for points closer than the
+      // shortest edge of the tree found so far
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+#endif
+      for (long r = 0; r < n; ++r) {
+        shortest[r] = ClusterMerge(-1, -1);
+        if (first[r] == first[r + 1])
+          continue;
+        long end = std::min(first[r + 1], first[r] + num_samples);
+        std::partial_sort(members.begin() + first[r], members.begin() + end,
+                          members.begin() + first[r + 1], farther);
+        double bound = std::numeric_limits<double>::infinity();
+        for (long m = first[r]; m < end; ++m) {
+          long i = members[m];
+          const double* p = points + i * dim;
+          long j = long(tree.nearest_unlike(p, r, bound));
+          if (j < n) {
+            bound = tree.distance(p, j);
+            shortest[r] = ClusterMerge(std::min(i, j), std::max(i, j));
+          }
         }
-        knn.reset();
-        total_queries++;
-        if (total_queries - total_correct > stop_threshold)
-          return std::make_pair(total_correct, total_queries);
+        shortest[r].distance = distance(shortest[r].a, shortest[r].b);
       }
+      std::vector<ClusterMerge> edges;
+      for (long r = 0; r < n; ++r) {
+        if (shortest[r].a >= 0)
+          edges.push_back(shortest[r]);
+      }
+      kruskal_forest(edges, forest, result);
     }
-    return std::make_pair(total_correct, total_queries);
+    std::sort(result.begin(), result.end(), ClusterEdgeLess());
+    return result;
   }
 
 }} // end of namespaces
@@ -31,11 +31,18 @@
 #include <sstream>
 #include <time.h>
 #include <map>
+#include <deque>
+#include <fstream>
+#include <cstdio>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include <eo>
 #include <es.h>
 
@@ -52,6 +59,28 @@ namespace Gamera { namespace GA {
 
     enum OperationMode {GA_SELECTION, GA_WEIGHTING};
 
+    /*
+      The run status and the stop flag are shared between the thread of
+      a background run and the Python thread that queries or stops it,
+      so they are read and written atomically.
+    */
+    inline long ga_flag_get(volatile long& flag) {
+#ifdef _MSC_VER
+        return _InterlockedExchangeAdd(&flag, 0);
+#else
+        return __sync_add_and_fetch(&flag, 0);
+#endif
+    }
+
+    inline void ga_flag_set(volatile long& flag, long value) {
+#ifdef _MSC_VER
+        _InterlockedExchange(&flag, value);
+#else
+        __sync_lock_test_and_set(&flag, value);
+        __sync_synchronize();
+#endif
+    }
+
     template <typename EOT>
     class SelectOneDefaultWorth : public eoSelectOne<EOT> {};
 
@@ -132,26 +161,130 @@ namespace Gamera { namespace GA {
     class GAManualStop : public eoContinue<EOT> {
     /**************************************************************************/
         protected:
-            bool continueFlag;
+            volatile long continueFlag;
 
         public:
             GAManualStop() {
-                this->continueFlag = true;
+                this->continueFlag = 1;
             }
 
             virtual bool operator() ( const eoPop<EOT>& _vEO ) {
-                return this->continueFlag;
+                return this->getFlag();
             }
 
             bool getFlag() {
-                return this->continueFlag;
+                return ga_flag_get(this->continueFlag) != 0;
             }
 
             void setFlag(bool flag) {
-                this->continueFlag = flag;
+                ga_flag_set(this->continueFlag, flag ? 1 : 0);
             }
     };
 
+    /**************************************************************************/
+    template <typename EOT>
+    class GAFitnessCache {
+    /**************************************************************************/
+    // The fitness of the last evaluated genomes, so that genomes that
+    // reappear after crossover and mutation are not evaluated again. The
+    // genomes are keyed by their bits (selection) or by their weights
+    // rounded to float (weighting); the oldest entry is dropped when the
+    // cache is full.
+        protected:
+            typedef std::map<std::string, double> MapType;
+
+            size_t maxSize;
+            MapType fitnesses;
+            std::deque<typename MapType::iterator> order;
+            unsigned long hitCount;
+            unsigned long missCount;
+
+            std::string key(const EOT &individual) const;
+
+        public:
+            GAFitnessCache(size_t maxSize = 10000) {
+                this->maxSize = maxSize;
+                this->hitCount = 0;
+                this->missCount = 0;
+            }
+
+            bool lookup(const EOT &individual, double &fitness) {
+                if (this->maxSize == 0) {
+                    return false;
+                }
+                std::string k = this->key(individual);
+                bool found = false;
+#ifdef _OPENMP
+#pragma omp critical(knnga_fitness_cache)
+#endif
+                {
+                    typename MapType::const_iterator it = this->fitnesses.find(k);
+                    if (it != this->fitnesses.end()) {
+                        fitness = it->second;
+                        found = true;
+                        this->hitCount++;
+                    } else {
+                        this->missCount++;
+                    }
+                }
+                return found;
+            }
+
+            void store(const EOT &individual, double fitness) {
+                if (this->maxSize == 0) {
+                    return;
+                }
+                std::string k = this->key(individual);
+#ifdef _OPENMP
+#pragma omp critical(knnga_fitness_cache)
+#endif
+                {
+                    std::pair<typename MapType::iterator, bool> inserted =
+                        this->fitnesses.insert(std::make_pair(k, fitness));
+                    if (inserted.second) {
+                        this->order.push_back(inserted.first);
+                        if (this->order.size() > this->maxSize) {
+                            this->fitnesses.erase(this->order.front());
+                            this->order.pop_front();
+                        }
+                    }
+                }
+            }
+
+            void clear() {
+#ifdef _OPENMP
+#pragma omp critical(knnga_fitness_cache)
+#endif
+                {
+                    this->fitnesses.clear();
+                    this->order.clear();
+                }
+            }
+
+            unsigned long hits() const { return this->hitCount; }
+            unsigned long misses() const { return this->missCount; }
+    };
+
+    template <>
+    std::string GAFitnessCache<SelectionIndi>::key(const SelectionIndi &individual) const {
+        std::string k((individual.size() + 7) / 8, '\0');
+        for (size_t i = 0; i < individual.size(); ++i) {
+            if (individual[i]) {
+                k[i / 8] |= char(1 << (i % 8));
+            }
+        }
+        return k;
+    }
+
+    template <>
+    std::string GAFitnessCache<WeightingIndi>::key(const WeightingIndi &individual) const {
+        std::vector<float> weights(individual.begin(), individual.end());
+        if (weights.empty()) {
+            return std::string();
+        }
+        return std::string((const char*) &weights[0], weights.size() * sizeof(float));
+    }
+
     /**************************************************************************/
     template <typename EOT>
     class GABestIndiStat : public eoStat<EOT, std::string> {
@@ -159,8 +292,11 @@ namespace Gamera { namespace GA {
         public:
             using eoStat<EOT, std::string>::value;
 
-            GABestIndiStat(std::string name = "bestIndi")
-            : eoStat<EOT, std::string>(std::string(""), name)
+            // the hits and misses of cache (if not NULL) are shown after
+            // the best individual
+            GABestIndiStat(std::string name = "bestIndi",
+                           const GAFitnessCache<EOT> *cache = NULL)
+            : eoStat<EOT, std::string>(std::string(""), name), cache(cache)
             {}
 
             void operator()(const eoPop<EOT> &pop) {
@@ -174,21 +310,31 @@ namespace Gamera { namespace GA {
                     indiStream << *it << " , ";
                 }
                 indiStream << "]";
+                if (this->cache != NULL) {
+                    indiStream << " (fitness cache: " << this->cache->hits() << " hits, "
+                               << this->cache->misses() << " misses)";
+                }
 
                 value() = indiStream.str();
             }
 
             virtual std::string className(void) const { return "GABestIndiStat"; }
+
+        protected:
+            const GAFitnessCache<EOT> *cache;
     };
 
     /**************************************************************************/
     template <typename EOT>
     class GAClassifierUpdater : public eoContinue<EOT> {
     /**************************************************************************/
+    // Writes the best individual so far to the selections or weights of the
+    // classifier. This is done with the GIL held, so that a classification
+    // in Python while the optimization runs never sees half of an update.
         protected:
             KnnObject *knn;
             double bestFitness;
-            std::vector<EOT> bestSolution;
+            std::vector<typename EOT::AtomType> bestSolution;
             std::map<unsigned int, unsigned int> *indexRelation;
 
         public:
@@ -203,6 +349,12 @@ namespace Gamera { namespace GA {
                 return this->bestFitness;
             }
 
+            // lets the next best individual update the classifier, even
+            // if its fitness is lower (after the fitness has changed)
+            void resetBestFitness() {
+                this->bestFitness = 0.0;
+            }
+
             virtual bool operator()(const eoPop<EOT>& pop);
 
             virtual std::string className(void) const { return "GAClassifierUpdater"; }
@@ -216,13 +368,15 @@ namespace Gamera { namespace GA {
         if (bestIndi.fitness() > this->bestFitness) {
             this->bestFitness = bestIndi.fitness();
 
-            std::fill(this->knn->weight_vector, this->knn->weight_vector + this->knn->num_features, 0.0);
             std::fill(this->bestSolution.begin(), this->bestSolution.end(), 0.0);
-
             for (size_t i = 0; i < bestIndi.size(); ++i) {
-                this->knn->weight_vector[(*this->indexRelation)[i]] = bestIndi[i];
                 this->bestSolution[(*this->indexRelation)[i]] = bestIndi[i];
             }
+
+            PyGILState_STATE state = PyGILState_Ensure();
+            std::copy(this->bestSolution.begin(), this->bestSolution.end(),
+                      this->knn->weight_vector);
+            PyGILState_Release(state);
         }
 
         return true;
@@ -236,18 +390,661 @@ namespace Gamera { namespace GA {
         if (bestIndi.fitness() > this->bestFitness) {
             this->bestFitness = bestIndi.fitness();
 
-            std::fill(this->knn->selection_vector, this->knn->selection_vector + this->knn->num_features, 0);
             std::fill(this->bestSolution.begin(), this->bestSolution.end(), false);
-
             for (size_t i = 0; i < bestIndi.size(); ++i) {
-                this->knn->selection_vector[(*this->indexRelation)[i]] = bestIndi[i];
                 this->bestSolution[(*this->indexRelation)[i]] = bestIndi[i];
             }
+
+            PyGILState_STATE state = PyGILState_Ensure();
+            std::copy(this->bestSolution.begin(), this->bestSolution.end(),
+                      this->knn->selection_vector);
+            PyGILState_Release(state);
         }
 
         return true;
     }
 
+    /**************************************************************************/
+    template <typename EOT>
+    class GAProgress : public eoContinue<EOT> {
+    /**************************************************************************/
+    // The state of an optimization for the getters of GAOptimization, which
+    // may be called from other threads while it runs. After every generation
+    // the generation count, the best fitness, the number of fitness
+    // evaluations and the lines written by the monitors (whose streams are
+    // emptied) are copied here, so that the readers never touch the objects
+    // of the running GA.
+        protected:
+            eoEvalFuncCounter<EOT> *eval;
+            GAClassifierUpdater<EOT> *updater;
+            std::ostringstream *monitorStream;
+            std::ostringstream *bestIndiStream;
+            double startTime;
+
+            unsigned int generation;
+            double bestFitness;
+            unsigned long evaluations;
+            double seconds;
+            std::string monitor;
+            std::string bestIndi;
+
+            static double now() {
+#ifdef _OPENMP
+                return omp_get_wtime();
+#else
+                return double(time(NULL));
+#endif
+            }
+
+        public:
+            GAProgress() {
+                this->start(NULL, NULL, NULL, NULL);
+            }
+
+            // resets the progress for a new run with these objects
+            void start(eoEvalFuncCounter<EOT> *eval, GAClassifierUpdater<EOT> *updater,
+                       std::ostringstream *monitorStream, std::ostringstream *bestIndiStream) {
+#ifdef _OPENMP
+#pragma omp critical(knnga_progress)
+#endif
+                {
+                    this->eval = eval;
+                    this->updater = updater;
+                    this->monitorStream = monitorStream;
+                    this->bestIndiStream = bestIndiStream;
+                    this->startTime = now();
+                    this->generation = 0;
+                    this->bestFitness = 0.0;
+                    this->evaluations = 0;
+                    this->seconds = 0.0;
+                    this->monitor.clear();
+                    this->bestIndi.clear();
+                }
+            }
+
+            virtual bool operator()(const eoPop<EOT> &pop) {
+                std::string monitorLines = this->monitorStream->str();
+                this->monitorStream->str("");
+                std::string bestIndiLines = this->bestIndiStream->str();
+                this->bestIndiStream->str("");
+                double seconds = now() - this->startTime;
+#ifdef _OPENMP
+#pragma omp critical(knnga_progress)
+#endif
+                {
+                    ++this->generation;
+                    this->bestFitness = this->updater->getBestFitness();
+                    this->evaluations = this->eval->value();
+                    this->seconds = seconds;
+                    this->monitor += monitorLines;
+                    this->bestIndi += bestIndiLines;
+                }
+                return true;
+            }
+
+            void get(unsigned int &generation, double &bestFitness,
+                     unsigned long &evaluations, double &seconds) {
+#ifdef _OPENMP
+#pragma omp critical(knnga_progress)
+#endif
+                {
+                    generation = this->generation;
+                    bestFitness = this->bestFitness;
+                    evaluations = this->evaluations;
+                    seconds = this->seconds;
+                }
+            }
+
+            std::string getMonitor() {
+                std::string monitor;
+#ifdef _OPENMP
+#pragma omp critical(knnga_progress)
+#endif
+                monitor = this->monitor;
+                return monitor;
+            }
+
+            std::string getBestIndi() {
+                std::string bestIndi;
+#ifdef _OPENMP
+#pragma omp critical(knnga_progress)
+#endif
+                bestIndi = this->bestIndi;
+                return bestIndi;
+            }
+
+            virtual std::string className(void) const { return "GAProgress"; }
+    };
+
+    /**************************************************************************/
+    template <typename EOT>
+    class GAParetoRanking {
+    /**************************************************************************/
+    // NSGA-II ranking of individuals by the two objectives leave-one-out
+    // fitness (maximized) and number of active features (minimized): the
+    // non-dominated front of each individual (0 is the Pareto front) and
+    // its crowding distance within the front.
+        protected:
+            std::vector<unsigned int> front;
+            std::vector<double> crowding;
+
+            void crowdingDistances(const std::vector<double> &objective,
+                                   const std::vector<size_t> &members) {
+                std::vector<std::pair<double, size_t> > sorted;
+                for (size_t i = 0; i < members.size(); ++i) {
+                    sorted.push_back(std::make_pair(objective[members[i]], members[i]));
+                }
+                std::sort(sorted.begin(), sorted.end());
+                double range = sorted.back().first - sorted.front().first;
+                this->crowding[sorted.front().second] = std::numeric_limits<double>::infinity();
+                this->crowding[sorted.back().second] = std::numeric_limits<double>::infinity();
+                if (range <= 0.0) {
+                    return;
+                }
+                for (size_t i = 1; i + 1 < sorted.size(); ++i) {
+                    this->crowding[sorted[i].second] +=
+                        (sorted[i + 1].first - sorted[i - 1].first) / range;
+                }
+            }
+
+        public:
+            // the number of genes that are not 0
+            static unsigned int activeFeatures(const EOT &individual) {
+                unsigned int count = 0;
+                for (size_t i = 0; i < individual.size(); ++i) {
+                    if (individual[i] != typename EOT::AtomType()) {
+                        ++count;
+                    }
+                }
+                return count;
+            }
+
+            void operator()(const std::vector<const EOT*> &individuals) {
+                size_t n = individuals.size();
+                std::vector<double> fitness(n), features(n);
+                for (size_t i = 0; i < n; ++i) {
+                    fitness[i] = individuals[i]->fitness();
+                    features[i] = activeFeatures(*individuals[i]);
+                }
+
+                // fast non-dominated sorting
+                std::vector<std::vector<size_t> > dominated(n);
+                std::vector<size_t> dominating(n, 0);
+                std::vector<size_t> current;
+                for (size_t i = 0; i < n; ++i) {
+                    for (size_t j = 0; j < n; ++j) {
+                        if (fitness[i] >= fitness[j] && features[i] <= features[j] &&
+                            (fitness[i] > fitness[j] || features[i] < features[j])) {
+                            dominated[i].push_back(j);
+                        } else if (fitness[j] >= fitness[i] && features[j] <= features[i] &&
+                                   (fitness[j] > fitness[i] || features[j] < features[i])) {
+                            ++dominating[i];
+                        }
+                    }
+                    if (dominating[i] == 0) {
+                        current.push_back(i);
+                    }
+                }
+
+                this->front.assign(n, 0);
+                this->crowding.assign(n, 0.0);
+                for (unsigned int f = 0; !current.empty(); ++f) {
+                    std::vector<size_t> next;
+                    for (size_t k = 0; k < current.size(); ++k) {
+                        size_t i = current[k];
+                        this->front[i] = f;
+                        for (size_t d = 0; d < dominated[i].size(); ++d) {
+                            if (--dominating[dominated[i][d]] == 0) {
+                                next.push_back(dominated[i][d]);
+                            }
+                        }
+                    }
+                    this->crowdingDistances(fitness, current);
+                    this->crowdingDistances(features, current);
+                    current.swap(next);
+                }
+            }
+
+            unsigned int getFront(size_t i) const {
+                return this->front[i];
+            }
+
+            // whether individual i is in a lower front than j, or in the same
+            // front and less crowded
+            bool better(size_t i, size_t j) const {
+                if (this->front[i] != this->front[j]) {
+                    return this->front[i] < this->front[j];
+                }
+                return this->crowding[i] > this->crowding[j];
+            }
+    };
+
+    /**************************************************************************/
+    template <typename EOT>
+    class GAParetoSelect : public eoSelectOne<EOT> {
+    /**************************************************************************/
+    // The crowded binary tournament of NSGA-II (see GAParetoRanking).
+        protected:
+            GAParetoRanking<EOT> ranking;
+
+        public:
+            virtual void setup(const eoPop<EOT> &pop) {
+                std::vector<const EOT*> individuals;
+                for (size_t i = 0; i < pop.size(); ++i) {
+                    individuals.push_back(&pop[i]);
+                }
+                this->ranking(individuals);
+            }
+
+            virtual const EOT& operator()(const eoPop<EOT> &pop) {
+                size_t i = rng.random(pop.size());
+                size_t j = rng.random(pop.size());
+                return this->ranking.better(j, i) ? pop[j] : pop[i];
+            }
+
+            virtual std::string className(void) const { return "GAParetoSelect"; }
+    };
+
+    /**************************************************************************/
+    template <typename EOT>
+    class GAParetoReplacement : public eoReplacement<EOT> {
+    /**************************************************************************/
+    // The elitist replacement of NSGA-II: the parents and the offspring are
+    // ranked together (see GAParetoRanking), and the best of them form the
+    // next population.
+        protected:
+            GAParetoRanking<EOT> ranking;
+
+            struct Better {
+                const GAParetoRanking<EOT> *ranking;
+                bool operator()(size_t i, size_t j) const {
+                    return this->ranking->better(i, j);
+                }
+            };
+
+        public:
+            virtual void operator()(eoPop<EOT> &parents, eoPop<EOT> &offspring) {
+                size_t size = parents.size();
+                std::vector<const EOT*> individuals;
+                for (size_t i = 0; i < parents.size(); ++i) {
+                    individuals.push_back(&parents[i]);
+                }
+                for (size_t i = 0; i < offspring.size(); ++i) {
+                    individuals.push_back(&offspring[i]);
+                }
+                this->ranking(individuals);
+
+                std::vector<size_t> order(individuals.size());
+                for (size_t i = 0; i < order.size(); ++i) {
+                    order[i] = i;
+                }
+                Better better;
+                better.ranking = &this->ranking;
+                std::stable_sort(order.begin(), order.end(), better);
+
+                eoPop<EOT> next;
+                for (size_t i = 0; i < size && i < order.size(); ++i) {
+                    next.push_back(*individuals[order[i]]);
+                }
+                parents.swap(next);
+                offspring.clear();
+            }
+
+            virtual std::string className(void) const { return "GAParetoReplacement"; }
+    };
+
+    // one individual of the Pareto front, with the genes at the indices of
+    // the features of the classifier
+    struct GAParetoPoint {
+        double fitness;
+        unsigned int features;
+        std::vector<double> genes;
+    };
+
+    /**************************************************************************/
+    template <typename EOT>
+    class GAParetoFront : public eoContinue<EOT> {
+    /**************************************************************************/
+    // The non-dominated individuals of the population (see GAParetoRanking)
+    // after the latest generation, one for each pair of objective values,
+    // ordered by the number of active features. Like GAProgress, it may be read from other
+    // threads while the optimization runs.
+        protected:
+            std::map<unsigned int, unsigned int> *indexRelation;
+            size_t numFeatures;
+            std::vector<GAParetoPoint> points;
+
+            static bool fewerFeatures(const GAParetoPoint &a, const GAParetoPoint &b) {
+                if (a.features != b.features) {
+                    return a.features < b.features;
+                }
+                return a.fitness > b.fitness;
+            }
+
+        public:
+            GAParetoFront() {
+                this->start(NULL, 0);
+            }
+
+            // resets the front for a new run
+            void start(std::map<unsigned int, unsigned int> *indexRelation, size_t numFeatures) {
+#ifdef _OPENMP
+#pragma omp critical(knnga_progress)
+#endif
+                {
+                    this->indexRelation = indexRelation;
+                    this->numFeatures = numFeatures;
+                    this->points.clear();
+                }
+            }
+
+            virtual bool operator()(const eoPop<EOT> &pop) {
+                std::vector<const EOT*> individuals;
+                for (size_t i = 0; i < pop.size(); ++i) {
+                    individuals.push_back(&pop[i]);
+                }
+                GAParetoRanking<EOT> ranking;
+                ranking(individuals);
+
+                std::vector<GAParetoPoint> points;
+                for (size_t i = 0; i < individuals.size(); ++i) {
+                    if (ranking.getFront(i) != 0) {
+                        continue;
+                    }
+                    GAParetoPoint point;
+                    point.fitness = individuals[i]->fitness();
+                    point.features = GAParetoRanking<EOT>::activeFeatures(*individuals[i]);
+                    bool duplicate = false;
+                    for (size_t k = 0; k < points.size() && !duplicate; ++k) {
+                        duplicate = points[k].fitness == point.fitness &&
+                                    points[k].features == point.features;
+                    }
+                    if (duplicate) {
+                        continue;
+                    }
+                    point.genes.assign(this->numFeatures, 0.0);
+                    for (size_t k = 0; k < individuals[i]->size(); ++k) {
+                        point.genes[(*this->indexRelation)[k]] = (*individuals[i])[k];
+                    }
+                    points.push_back(point);
+                }
+                std::sort(points.begin(), points.end(), fewerFeatures);
+
+#ifdef _OPENMP
+#pragma omp critical(knnga_progress)
+#endif
+                this->points.swap(points);
+                return true;
+            }
+
+            std::vector<GAParetoPoint> get() {
+                std::vector<GAParetoPoint> points;
+#ifdef _OPENMP
+#pragma omp critical(knnga_progress)
+#endif
+                points = this->points;
+                return points;
+            }
+
+            virtual std::string className(void) const { return "GAParetoFront"; }
+    };
+
+    /**************************************************************************/
+    template <typename EOT>
+    class GAIslandMigration : public eoReplacement<EOT> {
+    /**************************************************************************/
+    // Island model: several GA processes (possibly on different hosts)
+    // optimize the same classifier and exchange their best individuals
+    // through files in a shared directory. Wraps the replacement, so that
+    // every interval generations the best migrants individuals of the
+    // population are written to island<i>.pop, and the individuals in the
+    // files of the other islands replace the worst individuals of the
+    // population (if they are better and not in the population yet).
+    // Each line of a file holds the fitness and the genes of an
+    // individual; the files are written under a temporary name and
+    // renamed, so that a reader never sees a partial file.
+        protected:
+            eoReplacement<EOT> &replacement;
+            std::string directory;
+            unsigned int island;
+            unsigned int islands;
+            unsigned int interval;
+            unsigned int migrants;
+            unsigned long generation;
+
+            std::string islandFile(unsigned int i) const {
+                std::ostringstream name;
+                name << this->directory << "/island" << i << ".pop";
+                return name.str();
+            }
+
+            void emigrate(const eoPop<EOT> &pop) const {
+                std::vector<const EOT*> sorted;
+                pop.sort(sorted);
+                std::string name = this->islandFile(this->island);
+                std::string temporary = name + ".tmp";
+                std::ofstream out(temporary.c_str());
+                out.precision(17);
+                for (size_t i = 0; i < sorted.size() && i < this->migrants; ++i) {
+                    out << sorted[i]->fitness();
+                    for (size_t k = 0; k < sorted[i]->size(); ++k) {
+                        out << " " << (*sorted[i])[k];
+                    }
+                    out << "\n";
+                }
+                out.close();
+                if (!out.fail()) {
+                    std::remove(name.c_str());
+                    std::rename(temporary.c_str(), name.c_str());
+                }
+            }
+
+            bool contains(const eoPop<EOT> &pop, const EOT &indi) const {
+                for (size_t i = 0; i < pop.size(); ++i) {
+                    if (std::equal(indi.begin(), indi.end(), pop[i].begin())) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void immigrate(eoPop<EOT> &pop) const {
+                if (pop.empty()) {
+                    return;
+                }
+                for (unsigned int i = 0; i < this->islands; ++i) {
+                    if (i == this->island) {
+                        continue;
+                    }
+                    std::ifstream in(this->islandFile(i).c_str());
+                    std::string line;
+                    while (std::getline(in, line)) {
+                        std::istringstream fields(line);
+                        double fitness;
+                        if (!(fields >> fitness)) {
+                            continue;
+                        }
+                        EOT migrant;
+                        typename EOT::AtomType gene;
+                        while (fields >> gene) {
+                            migrant.push_back(gene);
+                        }
+                        if (migrant.size() != pop[0].size() || this->contains(pop, migrant)) {
+                            continue;
+                        }
+                        migrant.fitness(fitness);
+                        typename eoPop<EOT>::iterator worst = pop.it_worse_element();
+                        if (*worst < migrant) {
+                            *worst = migrant;
+                        }
+                    }
+                }
+            }
+
+        public:
+            GAIslandMigration(eoReplacement<EOT> &replacement, std::string directory,
+                              unsigned int island, unsigned int islands,
+                              unsigned int interval, unsigned int migrants)
+            : replacement(replacement), directory(directory), island(island),
+              islands(islands), interval(std::max(interval, 1u)),
+              migrants(migrants), generation(0)
+            {}
+
+            void operator()(eoPop<EOT> &parents, eoPop<EOT> &offspring) {
+                this->replacement(parents, offspring);
+                if (++this->generation % this->interval == 0) {
+                    this->emigrate(parents);
+                    this->immigrate(parents);
+                }
+            }
+
+            virtual std::string className(void) const { return "GAIslandMigration"; }
+    };
+
+    // *************************************************************************
+    class GASelectionDistances {
+    // *************************************************************************
+    // Leave-one-out evaluation of selection individuals from precomputed
+    // distances. With a selection, the distance between two feature
+    // vectors is a sum of one (weighted) term per selected feature, so
+    // the terms of all pairs are computed once per feature, and the
+    // distances of an individual are the sum of the terms of its
+    // selected features. The distances of the last evaluated individuals
+    // are kept, and an individual that differs from one of them in fewer
+    // features than it selects (as after a mutation) is evaluated from
+    // its distances by adding and subtracting the terms of the features
+    // that differ.
+    //
+    // The terms are stored as floats, so that the distances can differ
+    // from those of leave_one_out in the last bits.
+        protected:
+            struct Entry {
+                std::vector<bool> genome;
+                std::vector<double> distances;
+                unsigned int readers;
+                unsigned long lastUse;
+            };
+
+            KnnObject *knn;
+            size_t numKnown;
+            size_t numPairs;
+            size_t numGenes;
+            bool usable;
+            std::vector<float> terms;
+            std::vector<size_t> queries;
+            std::vector<Entry*> cache;
+            size_t maxEntries;
+            unsigned long useCount;
+
+            size_t pairIndex(size_t i, size_t j) const;
+            void addTerms(std::vector<double> &distances,
+                          const std::vector<std::pair<size_t, double> > &genes) const;
+
+        public:
+            // memory is the number of bytes that may be used for the terms
+            // and the cached distances
+            GASelectionDistances(KnnObject *knn,
+                                 std::map<unsigned int, unsigned int> *indexRelation,
+                                 size_t memory);
+            ~GASelectionDistances();
+
+            // whether the terms fit into the memory
+            bool isUsable();
+
+            // same as leave_one_out with the selection of the individual
+            // (and the given subset of the queries, if not NULL)
+            std::pair<int, int> leaveOneOut(const SelectionIndi &individual,
+                                            const std::vector<size_t> *subset = NULL,
+                                            int stopThreshold = std::numeric_limits<int>::max());
+    };
+
+    // *************************************************************************
+    class GAQuerySample {
+    // *************************************************************************
+    // The queries of the leave-one-out fitness evaluation. With a fraction
+    // below 1, a stratified random sample of the queries is used (the
+    // fraction of the queries of each class, at least one), which is
+    // doubled every growth generations (if growth is not 0) until all
+    // queries are used.
+    //
+    // The fitness of the worst individual kept in the population is set
+    // after each generation, so that with early stopping the evaluation of
+    // an individual ends as soon as it has misclassified too many queries
+    // to reach it. Such an individual is rejected: its fitness is the best
+    // it could have reached, which is below that of every kept individual.
+        protected:
+            KnnObject *knn;
+            double fraction;
+            unsigned int growth;
+            double startFraction;
+            std::vector<size_t> all;
+            std::vector<size_t> queries;
+            double keepFitness;
+
+            void draw();
+
+        public:
+            GAQuerySample(KnnObject *knn, double fraction = 1.0, unsigned int growth = 0);
+
+            // updates the sample for the generation, returns whether it changed
+            bool nextGeneration(unsigned int generation);
+
+            // the sampled queries (all valid leave_one_out queries), or NULL
+            // when all queries are used
+            const std::vector<size_t> *getQueries();
+
+            // the number of queries
+            size_t size();
+
+            // sets the fitness of the worst individual kept on the current sample
+            void setKeepFitness(double fitness);
+
+            // the stop_threshold for leave_one_out with early stopping
+            int stopThreshold();
+
+            // whether leave_one_out stopped before all queries were done
+            bool rejected(std::pair<int, int> looEvalRes);
+
+            // the fitness from the (correct, queries) result of leave_one_out
+            double fitness(std::pair<int, int> looEvalRes);
+    };
+
+    /**************************************************************************/
+    template <typename EOT>
+    class GAQuerySchedule : public eoContinue<EOT> {
+    /**************************************************************************/
+    // Advances the query sample after each generation and sets the fitness
+    // of the worst individual kept. The cached fitness values and the best
+    // fitness of the classifier updater are dropped when the sample
+    // changes, as they are not comparable with those on the new sample.
+        protected:
+            GAQuerySample *sample;
+            GAFitnessCache<EOT> *cache;
+            GAClassifierUpdater<EOT> *updater;
+            unsigned int generation;
+
+        public:
+            GAQuerySchedule(GAQuerySample *sample, GAFitnessCache<EOT> *cache,
+                            GAClassifierUpdater<EOT> *updater) {
+                this->sample = sample;
+                this->cache = cache;
+                this->updater = updater;
+                this->generation = 0;
+            }
+
+            virtual bool operator()(const eoPop<EOT>& pop) {
+                if (this->sample->nextGeneration(++this->generation)) {
+                    this->cache->clear();
+                    this->updater->resetBestFitness();
+                } else if (!pop.empty()) {
+                    this->sample->setKeepFitness(pop.worse_element().fitness());
+                }
+                return true;
+            }
+
+            virtual std::string className(void) const { return "GAQuerySchedule"; }
+    };
+
     // *************************************************************************
     template <typename EOT>
     class GAFitnessEval : public eoEvalFunc<EOT> {
@@ -255,24 +1052,71 @@ namespace Gamera { namespace GA {
         protected:
             KnnObject *knn;
             std::map<unsigned int, unsigned int> *indexRelation;
+            GASelectionDistances *distances;
+            GAFitnessCache<EOT> *cache;
+            GAQuerySample *sample;
+            bool earlyStop;
 
             typedef typename EOT::ContainerType ContainerType;
             typedef typename EOT::AtomType AtomType;
 
+            // the (correct, queries) leave-one-out result with the individual
+            std::pair<int, int> leaveOneOut( EOT &individual );
+
+            // the stop_threshold for leave_one_out
+            int stopThreshold() {
+                if (this->sample != NULL && this->earlyStop) {
+                    return this->sample->stopThreshold();
+                }
+                return std::numeric_limits<int>::max();
+            }
+
+            double fitness(std::pair<int, int> looEvalRes) {
+                if (this->sample != NULL) {
+                    return this->sample->fitness(looEvalRes);
+                }
+                return looEvalRes.first / (double) looEvalRes.second;
+            }
+
+            bool rejected(std::pair<int, int> looEvalRes) {
+                return this->sample != NULL && this->sample->rejected(looEvalRes);
+            }
+
         public:
-            GAFitnessEval(KnnObject *knn, std::map<unsigned int, unsigned int> *indexRelation) {
+            // distances (only used for selection individuals), cache and
+            // sample (all queries if NULL) may be NULL
+            GAFitnessEval(KnnObject *knn, std::map<unsigned int, unsigned int> *indexRelation,
+                          GASelectionDistances *distances = NULL,
+                          GAFitnessCache<EOT> *cache = NULL,
+                          GAQuerySample *sample = NULL, bool earlyStop = false) {
                 this->knn = knn;
                 this->indexRelation = indexRelation;
+                this->distances = distances;
+                this->cache = cache;
+                this->sample = sample;
+                this->earlyStop = earlyStop;
             }
 
             virtual std::string className(void) const { return "GAFitnessEval"; }
 
-            virtual void operator()( EOT &individual );
+            virtual void operator()( EOT &individual ) {
+                double fitness;
+                if (this->cache == NULL || !this->cache->lookup(individual, fitness)) {
+                    std::pair<int, int> looEvalRes = this->leaveOneOut(individual);
+                    fitness = this->fitness(looEvalRes);
+                    // the fitness of a rejected individual depends on when
+                    // it was stopped
+                    if (this->cache != NULL && !this->rejected(looEvalRes)) {
+                        this->cache->store(individual, fitness);
+                    }
+                }
+                individual.fitness(fitness);
+            }
     };
 
     // specialization for weighting individual
     template <>
-    void GAFitnessEval<WeightingIndi>::operator()( WeightingIndi &individual ) {
+    std::pair<int, int> GAFitnessEval<WeightingIndi>::leaveOneOut( WeightingIndi &individual ) {
         AtomType convertedVector[this->knn->num_features];
         std::fill(convertedVector, convertedVector + this->knn->num_features, 0.0);
 
@@ -280,16 +1124,28 @@ namespace Gamera { namespace GA {
             convertedVector[(*this->indexRelation)[i]] = individual[i];
         }
 
-        std::pair<int, int> looEvalRes;
-        looEvalRes = leave_one_out(this->knn, std::numeric_limits<int>::max(),
-                                   NULL, convertedVector, NULL);
+        const std::vector<size_t> *queries = NULL;
+        if (this->sample != NULL) {
+            queries = this->sample->getQueries();
+        }
 
-        individual.fitness( looEvalRes.first / (double) looEvalRes.second );
+        return leave_one_out(this->knn, this->stopThreshold(),
+                             NULL, convertedVector, NULL, queries);
     }
 
     // specialization for selection individual
     template <>
-    void GAFitnessEval<SelectionIndi>::operator()( SelectionIndi &individual ) {
+    std::pair<int, int> GAFitnessEval<SelectionIndi>::leaveOneOut( SelectionIndi &individual ) {
+        const std::vector<size_t> *queries = NULL;
+        if (this->sample != NULL) {
+            queries = this->sample->getQueries();
+        }
+
+        if (this->distances != NULL && this->distances->isUsable()) {
+            return this->distances->leaveOneOut(individual, queries,
+                                                this->stopThreshold());
+        }
+
         int convertedVector[this->knn->num_features];
         std::fill(convertedVector, convertedVector + this->knn->num_features, 0);
 
@@ -300,11 +1156,8 @@ namespace Gamera { namespace GA {
             convertedVector[(*this->indexRelation)[i]] = (int) individual[i];
         }
 
-        std::pair<int, int> looEvalRes;
-        looEvalRes = leave_one_out(this->knn, std::numeric_limits<int>::max(),
-                                   convertedVector, NULL, NULL);
-
-        individual.fitness( looEvalRes.first / (double) looEvalRes.second );
+        return leave_one_out(this->knn, this->stopThreshold(),
+                             convertedVector, NULL, NULL, queries);
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -347,22 +1200,43 @@ namespace Gamera { namespace GA {
             unsigned int pSize;
             double cRate;
             double mRate;
+            unsigned int dCache;
+            unsigned int fCache;
+            double qSample;
+            unsigned int qGrowth;
+            bool eStop;
+            unsigned int seed;
 
         public:
             GABaseSetting(int opMode = GA_SELECTION,
                           unsigned int pSize = 75,
-                          double cRate = 0.95, double mRate = 0.05);
+                          double cRate = 0.95, double mRate = 0.05,
+                          unsigned int dCache = 0, unsigned int fCache = 10000,
+                          double qSample = 1.0, unsigned int qGrowth = 0,
+                          bool eStop = false, unsigned int seed = 0);
             // getter
             int getOpMode();
             unsigned int getPopSize();
             double getCrossRate();
             double getMutRate();
+            unsigned int getDistanceCache();
+            unsigned int getFitnessCache();
+            double getQuerySample();
+            unsigned int getSampleGrowth();
+            bool getEarlyStop();
+            unsigned int getSeed();
 
             // setter
             void setOpMode(int opMode);
             void setPopSize(unsigned int pSize);
             void setCrossRate(double cRate);
             void setMutRate(double mRate);
+            void setDistanceCache(unsigned int dCache);
+            void setFitnessCache(unsigned int fCache);
+            void setQuerySample(double qSample);
+            void setSampleGrowth(unsigned int qGrowth);
+            void setEarlyStop(bool eStop);
+            void setSeed(unsigned int seed);
     };
 
     /**************************************************************************/
@@ -376,6 +1250,7 @@ namespace Gamera { namespace GA {
             void setRankSelection(double preasure = 2.0, double exponent = 1.0);
             void setTournamentSelection(unsigned int tSize = 3);
             void setRandomSelection();
+            void setParetoSelection();
     };
 
     /**************************************************************************/
@@ -433,6 +1308,7 @@ namespace Gamera { namespace GA {
             void setGenerationalReplacement();
             void setSSGAworse();
             void setSSGAdetTournament(unsigned int tSize = 3);
+            void setParetoReplacement();
     };
     
     /**************************************************************************/
@@ -453,6 +1329,14 @@ namespace Gamera { namespace GA {
             bool parallelMode;
             unsigned int threadNum;
 
+            // island model (see GAIslandMigration), disabled when
+            // islandDirectory is empty
+            std::string islandDirectory;
+            unsigned int island;
+            unsigned int islands;
+            unsigned int migrationInterval;
+            unsigned int migrants;
+
         public:
             GAParallelization(bool mode = true, unsigned int threads = 2);
 
@@ -461,6 +1345,16 @@ namespace Gamera { namespace GA {
 
             unsigned int getThreadNum();
             void setThreadNum(unsigned int n = 2);
+
+            void setIslandModel(std::string directory, unsigned int island,
+                                unsigned int islands, unsigned int interval = 10,
+                                unsigned int migrants = 5);
+            bool isIslandModel();
+            std::string getIslandDirectory();
+            unsigned int getIsland();
+            unsigned int getIslands();
+            unsigned int getMigrationInterval();
+            unsigned int getMigrants();
     };
 
     /**************************************************************************/
@@ -468,7 +1362,7 @@ namespace Gamera { namespace GA {
     class GAOptimization {
     /**************************************************************************/
         protected:
-            bool running;
+            volatile long running;
 
             // basic GA settings
             unsigned int popSize;
@@ -485,6 +1379,8 @@ namespace Gamera { namespace GA {
             GAParallelization *parallelization;
 
             GAManualStop<EOT> manualStop;
+            GAProgress<EOT> progress;
+            GAParetoFront<EOT> paretoFront;
 
             eoIncrementorParam<unsigned int> *generationCounter;
             eoBestFitnessStat<EOT> *bestStat;
@@ -493,6 +1389,8 @@ namespace Gamera { namespace GA {
             std::ostringstream *monitorStream;
             std::ostringstream *bestIndiStream;
 
+            void Calculate();
+
         public:
             GAOptimization<EOT>(KnnObject *knn,
                            GABaseSetting *baseSetting,
@@ -504,6 +1402,16 @@ namespace Gamera { namespace GA {
                            GAParallelization *parallel);
             ~GAOptimization<EOT>();
 
+            /*
+              PrepareCalculation marks the optimization as running and
+              clears an earlier stop. It must be called before
+              StartCalculation by the thread that may stop the run, so
+              that a stop right after the start of a background run is
+              not lost. CancelCalculation undoes it when the run is not
+              started after all.
+            */
+            void PrepareCalculation();
+            void CancelCalculation();
             void StartCalculation();
             void StopCalculation();
 
@@ -522,8 +1430,11 @@ namespace Gamera { namespace GA {
 
             unsigned int getGenerationCount();
             double getBestFitnessValue();
+            void getProgress(unsigned int &generation, double &bestFitness,
+                             unsigned long &evaluations, double &seconds);
             std::string getMonitorString();
             std::string getBestIndiString();
+            std::vector<GAParetoPoint> getParetoFront();
 
             // setter
             void setKnnObject(KnnObject *knn);
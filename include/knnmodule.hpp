@@ -48,6 +48,10 @@ enum DistanceType {
 inline int image_get_fv(PyObject* image, double** buf, Py_ssize_t* len) {
   ImageObject* x = (ImageObject*)image;
 
+  // features that were never set are empty
+  if (x->m_features == 0) {
+    return -1;
+  }
   if (PyObject_CheckReadBuffer(x->m_features) < 0) {
     return -1;
   }
@@ -71,7 +75,7 @@ inline int image_get_id_name(PyObject* image, char** id_name, int* len) {
   ImageObject* x = (ImageObject*)image;
 
   // PyList_Size shoule type check the argument
-  if (PyList_Size(x->m_id_name) < 1) {
+  if (x->m_id_name == 0 || PyList_Size(x->m_id_name) < 1) {
     PyErr_SetString(PyExc_TypeError, "knn: id_name not a list or list is empty.");
     return -1;
   }
@@ -110,6 +114,34 @@ inline void compute_distance(DistanceType distance_type, const double* known_buf
 }
 
 
+/*
+  Compute the distance between two feature vectors with the
+  effective weights created by fold_weights. The known feature vector
+  may be stored as double, float or quantized integers.
+*/
+template<class T>
+GAMERA_CPU_INLINE double compute_distance(DistanceType distance_type, const T* known_buf,
+                                          const double* unknown_buf, const double* weights,
+                                          size_t len) {
+  if (distance_type == FAST_EUCLIDEAN)
+    return fast_euclidean_distance(known_buf, unknown_buf, weights, len);
+  // CITY_BLOCK and EUCLIDEAN (sum of sqrt(d*d) = |d|)
+  return city_block_distance(known_buf, unknown_buf, weights, len);
+}
+
+/*
+  The same, but stops early once the distance reaches bound (see the
+  partial distance functions in knn.hpp).
+*/
+template<class T>
+inline double compute_distance(DistanceType distance_type, const T* known_buf,
+                               const double* unknown_buf, const double* weights,
+                               size_t len, double bound) {
+  if (distance_type == FAST_EUCLIDEAN)
+    return fast_euclidean_distance_bounded(known_buf, unknown_buf, weights, len, bound);
+  return city_block_distance_bounded(known_buf, unknown_buf, weights, len, bound);
+}
+
 /*
   Compute the distance between a known and an unknown image
   with weights. This version takes an image and a buffer
@@ -0,0 +1,458 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+  The accounting of the memory held by the pixels of images.
+
+  The pixel buffers of the DENSE images, the words of the PACKED images
+  and the runs of the RLE images are counted, per pixel type, when they
+  are allocated and freed, together with the most that was ever held
+  at once.  Pixels mapped from a file or shared memory, or owned by
+  someone else (see image_data.hpp), are not counted.
+
+  The soft limit (GAMERA_MEMORY_LIMIT_MB megabytes, none by default) is
+  not enforced on allocations: going over it is only counted, and, when
+  spilling is enabled (GAMERA_MEMORY_SPILL=1), the DENSE images that
+  have not been used for the longest time are spilled until the pixels
+  held in memory fit again.  Spilling writes the pixels of an image to
+  an (unlinked) temporary file in GAMERA_SPILL_DIR (or TMPDIR, or /tmp)
+  and maps the file over them at the same address, so that the pixels
+  do not move and nobody notices, except that the system can now drop
+  them from memory instead of running out of it.  They are read back
+  from the file when they are read, and held in memory again when they
+  are changed.  Only the images held by
+  Python objects that are not used by a running plugin are spilled (see
+  memory_budget_enforce), and spilled images stay in their file until
+  they are freed.
+
+  Each module has its own copy of the inline functions below, so that
+  the modules built from Python attach to the state of gameracore (see
+  memory_budget_attach in gameramodule.hpp) to count into the same
+  totals.  Until then, a module counts into a state of its own.
+*/
+
+#ifndef gamera_memory_budget_hpp
+#define gamera_memory_budget_hpp
+
+#include "pixel.hpp"
+#include "buffer_pool.hpp"
+
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// one slot per pixel type (in the order of PixelTypes), and one for the rest
+#define MEMORY_BUDGET_SLOTS 7
+#define MEMORY_BUDGET_OTHER 6
+// smaller images are not worth spilling
+#define MEMORY_BUDGET_MIN_SPILL (1024 * 1024)
+
+namespace Gamera {
+
+  template<class T>
+  struct memory_budget_slot { enum { value = MEMORY_BUDGET_OTHER }; };
+  template<>
+  struct memory_budget_slot<OneBitPixel> { enum { value = 0 }; };
+  template<>
+  struct memory_budget_slot<GreyScalePixel> { enum { value = 1 }; };
+  template<>
+  struct memory_budget_slot<Grey16Pixel> { enum { value = 2 }; };
+  template<>
+  struct memory_budget_slot<RGBPixel> { enum { value = 3 }; };
+  template<>
+  struct memory_budget_slot<FloatPixel> { enum { value = 4 }; };
+  template<>
+  struct memory_budget_slot<ComplexPixel> { enum { value = 5 }; };
+
+  struct MemoryBudgetState;
+  inline MemoryBudgetState& memory_budget();
+
+  /*
+    The pixels of an image, which count into the budget state of the
+    module that made them for all their life.  The images held by
+    Python objects are kept in a list in the state (see
+    memory_budget_hold), from which they are spilled.  The list, the
+    pins and the time of the last use are only changed with the
+    interpreter lock held.
+  */
+  class MemoryBudgetNode {
+  public:
+    MemoryBudgetNode() : m_budget(&memory_budget()), m_budget_prev(0),
+			 m_budget_next(0), m_last_used(0), m_pins(0),
+			 m_spill_start(0), m_spill_length(0) { }
+    inline virtual ~MemoryBudgetNode();
+    // whether the pixels could be spilled now
+    virtual bool spillable() const { return false; }
+    /*
+      Spills the pixels, returning the number of bytes that were, or 0
+      if they could not be.
+    */
+    virtual size_t spill() { return 0; }
+    bool spilled() const { return m_spill_start != 0; }
+    // a plugin is using the pixels (see MemoryBudgetPins)
+    bool pinned() const { return m_pins != 0; }
+
+    MemoryBudgetState* m_budget;
+    MemoryBudgetNode* m_budget_prev;
+    MemoryBudgetNode* m_budget_next;
+    size_t m_last_used;
+    long m_pins;
+    // the pages mapped from a temporary file, if spilled
+    char* m_spill_start;
+    size_t m_spill_length;
+  };
+
+  struct MemoryBudgetState {
+    volatile long lock;
+    int initialized;
+    // the soft limit in bytes, or 0 for none
+    size_t limit;
+    int spill;
+    size_t bytes[MEMORY_BUDGET_SLOTS];
+    size_t peak[MEMORY_BUDGET_SLOTS];
+    size_t total;
+    size_t peak_total;
+    size_t spilled;
+    size_t spills;
+    // the allocations after which more than the limit was held in memory
+    size_t over_limit;
+    size_t clock;
+    MemoryBudgetNode* first;
+    /*
+      Set when memory_budget_enforce spilled all it could and was still
+      over the limit, and cleared when an image may have become
+      spillable (see memory_budget_changed), so that it does not look
+      at every image again on each call until then.
+    */
+    int exhausted;
+  };
+
+  inline void memory_budget_init(MemoryBudgetState& state) {
+    const char* env = getenv("GAMERA_MEMORY_LIMIT_MB");
+    state.limit = env == 0 ? 0 : (size_t)atol(env) * 1024 * 1024;
+    env = getenv("GAMERA_MEMORY_SPILL");
+    state.spill = env != 0 && atoi(env) != 0;
+    state.initialized = 1;
+  }
+
+  inline MemoryBudgetState*& memory_budget_pointer() {
+    static MemoryBudgetState* pointer = 0;
+    return pointer;
+  }
+
+  inline MemoryBudgetState& memory_budget() {
+    MemoryBudgetState*& pointer = memory_budget_pointer();
+    if (pointer == 0) {
+      // the state of this module, zero initialized before any code runs
+      static MemoryBudgetState state;
+      spin_lock(state.lock);
+      if (!state.initialized)
+	memory_budget_init(state);
+      spin_unlock(state.lock);
+      pointer = &state;
+    }
+    return *pointer;
+  }
+
+  inline void memory_budget_lock(MemoryBudgetState& state) {
+    spin_lock(state.lock);
+  }
+
+  inline void memory_budget_unlock(MemoryBudgetState& state) {
+    spin_unlock(state.lock);
+  }
+
+  // the bytes of pixels held in memory (those spilled are not)
+  inline size_t memory_budget_resident(const MemoryBudgetState& state) {
+    return state.total > state.spilled ? state.total - state.spilled : 0;
+  }
+
+  inline void memory_budget_allocated(MemoryBudgetState& state, int slot,
+				      size_t bytes) {
+    memory_budget_lock(state);
+    state.bytes[slot] += bytes;
+    if (state.bytes[slot] > state.peak[slot])
+      state.peak[slot] = state.bytes[slot];
+    state.total += bytes;
+    if (state.total > state.peak_total)
+      state.peak_total = state.total;
+    if (state.limit != 0 && memory_budget_resident(state) > state.limit)
+      ++state.over_limit;
+    memory_budget_unlock(state);
+  }
+
+  inline void memory_budget_freed(MemoryBudgetState& state, int slot,
+				  size_t bytes) {
+    memory_budget_lock(state);
+    state.bytes[slot] -= bytes;
+    state.total -= bytes;
+    memory_budget_unlock(state);
+  }
+
+  inline bool memory_budget_held(const MemoryBudgetNode* node) {
+    return node->m_budget_prev != 0 || node->m_budget->first == node;
+  }
+
+  /*
+    The node may have become spillable: it is new, its pixels were
+    used, allocated or resized, or a plugin let go of them.
+  */
+  inline void memory_budget_changed(MemoryBudgetNode* node) {
+    if (node->m_budget->exhausted && node->spillable())
+      node->m_budget->exhausted = 0;
+  }
+
+  // node is now held by a Python object
+  inline void memory_budget_register(MemoryBudgetNode* node) {
+    MemoryBudgetState& state = *node->m_budget;
+    if (memory_budget_held(node))
+      return;
+    node->m_last_used = ++state.clock;
+    node->m_budget_next = state.first;
+    if (state.first != 0)
+      state.first->m_budget_prev = node;
+    state.first = node;
+    memory_budget_changed(node);
+  }
+
+  inline MemoryBudgetNode::~MemoryBudgetNode() {
+    if (!memory_budget_held(this))
+      return;
+    if (m_budget_prev != 0)
+      m_budget_prev->m_budget_next = m_budget_next;
+    else
+      m_budget->first = m_budget_next;
+    if (m_budget_next != 0)
+      m_budget_next->m_budget_prev = m_budget_prev;
+  }
+
+  // the pixels of the node are being used
+  inline void memory_budget_use(MemoryBudgetNode* node) {
+    node->m_last_used = ++node->m_budget->clock;
+    memory_budget_changed(node);
+  }
+
+  /*
+    Maps a temporary file holding the whole pages of the bytes bytes at
+    data over them, returning whether it did so and the part that was
+    mapped in start and length.
+  */
+  inline bool memory_budget_spill_pages(void* data, size_t bytes,
+					char** start, size_t* length) {
+#ifdef _WIN32
+    return false;
+#else
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char* begin = (char*)(((size_t)data + page - 1) / page * page);
+    char* end = (char*)(((size_t)data + bytes) / page * page);
+    if (end <= begin)
+      return false;
+    size_t n = end - begin;
+    const char* dir = getenv("GAMERA_SPILL_DIR");
+    if (dir == 0)
+      dir = getenv("TMPDIR");
+    std::string path = std::string(dir == 0 ? "/tmp" : dir) + "/gamera-spill-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    int fd = mkstemp(&name[0]);
+    if (fd < 0)
+      return false;
+    unlink(&name[0]);
+    for (size_t done = 0; done < n; ) {
+      ssize_t written = write(fd, begin + done, n - done);
+      if (written < 0 && errno == EINTR)
+	continue;
+      if (written <= 0) {
+	close(fd);
+	return false;
+      }
+      done += written;
+    }
+    // private, so that forked processes still get their own copy
+    void* mapping = mmap(begin, n, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_FIXED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+      return false;
+    *start = begin;
+    *length = n;
+    return true;
+#endif
+  }
+
+  /*
+    Puts anonymous memory back in place of the pages mapped by
+    memory_budget_spill_pages (dropping their contents), before the
+    buffer they are part of is freed.
+  */
+  inline void memory_budget_unspill_pages(char* start, size_t length) {
+#ifndef _WIN32
+    mmap(start, length, PROT_READ | PROT_WRITE,
+	 MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0);
+#endif
+  }
+
+  inline void memory_budget_spilled(MemoryBudgetNode* node) {
+    MemoryBudgetState& state = *node->m_budget;
+    memory_budget_lock(state);
+    state.spilled += node->m_spill_length;
+    ++state.spills;
+    memory_budget_unlock(state);
+  }
+
+  inline void memory_budget_unspilled(MemoryBudgetNode* node) {
+    MemoryBudgetState& state = *node->m_budget;
+    memory_budget_lock(state);
+    state.spilled -= node->m_spill_length;
+    memory_budget_unlock(state);
+  }
+
+  inline bool memory_budget_less_used(const MemoryBudgetNode* a,
+				      const MemoryBudgetNode* b) {
+    return a->m_last_used < b->m_last_used;
+  }
+
+  /*
+    Spills the images that have not been used for the longest time
+    until at most the limit (or, when force is true, nothing) is held
+    in memory, returning the number of bytes spilled.  Unless force is
+    true, it only does so when spilling is enabled, and not again after
+    it could not get under the limit until another image may be spilled
+    (see MemoryBudgetState::exhausted).
+
+    It must be called with the interpreter lock held: the images that
+    are spilled are those held by Python objects, which are neither
+    freed nor used by anyone else then, except by the plugins that run
+    without the lock, which pin the images they are given.
+  */
+  inline size_t memory_budget_enforce(bool force = false) {
+    MemoryBudgetState& state = memory_budget();
+    if (!force && (!state.spill || state.limit == 0))
+      return 0;
+    memory_budget_lock(state);
+    size_t resident = memory_budget_resident(state);
+    memory_budget_unlock(state);
+    size_t limit = force ? 0 : state.limit;
+    if (resident <= limit || (!force && state.exhausted))
+      return 0;
+    std::vector<MemoryBudgetNode*> candidates;
+    for (MemoryBudgetNode* node = state.first; node != 0; node = node->m_budget_next)
+      if (node->spillable())
+	candidates.push_back(node);
+    std::sort(candidates.begin(), candidates.end(), memory_budget_less_used);
+    size_t spilled = 0;
+    for (size_t i = 0; i < candidates.size() && resident > limit; ++i) {
+      size_t bytes = candidates[i]->spill();
+      spilled += bytes;
+      resident = bytes < resident ? resident - bytes : 0;
+    }
+    state.exhausted = resident > limit;
+    return spilled;
+  }
+
+  /*
+    Pins the images given to a plugin while it runs, so that they are
+    not spilled by another thread while the plugin uses them without the
+    interpreter lock.  Made and destroyed with the lock held.
+  */
+  class MemoryBudgetPins {
+  public:
+    MemoryBudgetPins() { }
+    ~MemoryBudgetPins() {
+      for (size_t i = 0; i < m_nodes.size(); ++i) {
+	--m_nodes[i]->m_pins;
+	memory_budget_changed(m_nodes[i]);
+      }
+    }
+    void add(MemoryBudgetNode* node) {
+      ++node->m_pins;
+      memory_budget_use(node);
+      m_nodes.push_back(node);
+    }
+  private:
+    MemoryBudgetPins(const MemoryBudgetPins&);
+    MemoryBudgetPins& operator=(const MemoryBudgetPins&);
+    std::vector<MemoryBudgetNode*> m_nodes;
+  };
+
+  /*
+    An allocator counting what it allocates into the given slot, for the
+    containers holding pixels (such as the runs of RLE images).
+  */
+  template<class T, int Slot>
+  class MemoryBudgetAllocator {
+  public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template<class U>
+    struct rebind { typedef MemoryBudgetAllocator<U, Slot> other; };
+
+    MemoryBudgetAllocator() { }
+    template<class U>
+    MemoryBudgetAllocator(const MemoryBudgetAllocator<U, Slot>&) { }
+
+    pointer address(reference x) const { return &x; }
+    const_pointer address(const_reference x) const { return &x; }
+    size_type max_size() const {
+      return std::numeric_limits<size_type>::max() / sizeof(T);
+    }
+    pointer allocate(size_type n, const void* = 0) {
+      pointer p = (pointer)::operator new(n * sizeof(T));
+      memory_budget_allocated(memory_budget(), Slot, n * sizeof(T));
+      return p;
+    }
+    void deallocate(pointer p, size_type n) {
+      ::operator delete((void*)p);
+      memory_budget_freed(memory_budget(), Slot, n * sizeof(T));
+    }
+    void construct(pointer p, const T& value) { new((void*)p) T(value); }
+    void destroy(pointer p) { p->~T(); }
+  };
+
+  template<class T, class U, int Slot>
+  inline bool operator==(const MemoryBudgetAllocator<T, Slot>&,
+			 const MemoryBudgetAllocator<U, Slot>&) {
+    return true;
+  }
+
+  template<class T, class U, int Slot>
+  inline bool operator!=(const MemoryBudgetAllocator<T, Slot>&,
+			 const MemoryBudgetAllocator<U, Slot>&) {
+    return false;
+  }
+
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GAMERA_OBJECT_FREELIST_HPP
+#define GAMERA_OBJECT_FREELIST_HPP
+
+#include <Python.h>
+#include <string.h>
+
+/*
+  A list of the freed objects of a Python type, which are handed out
+  again by its tp_alloc instead of going through the allocator.  This
+  pays off for the small objects (points, rectangles, ...) that are
+  created and dropped by the million by the pixel access and the
+  geometry of connected components.
+
+  Only the objects of the type itself are kept; its subtypes (which
+  inherit tp_alloc and may have a larger or garbage collected layout)
+  are allocated as usual.  The list is only used with the GIL held.
+*/
+template<size_t Capacity = 256>
+class ObjectFreeList {
+public:
+  ObjectFreeList(PyTypeObject* type) : m_type(type), m_size(0) {}
+
+  PyObject* alloc(PyTypeObject* type, Py_ssize_t nitems) {
+    if (type != m_type || m_size == 0)
+      return PyType_GenericAlloc(type, nitems);
+    PyObject* obj = m_items[--m_size];
+    memset((void*)obj, 0, type->tp_basicsize);
+    return PyObject_INIT(obj, type);
+  }
+
+  // takes an object whose value has already been destroyed
+  void release(PyObject* obj) {
+    if (obj->ob_type == m_type && m_size < Capacity)
+      m_items[m_size++] = obj;
+    else
+      obj->ob_type->tp_free(obj);
+  }
+
+private:
+  PyTypeObject* m_type;
+  size_t m_size;
+  PyObject* m_items[Capacity];
+};
+
+#endif
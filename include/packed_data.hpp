@@ -0,0 +1,455 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+  Packed Image Data (one bit per pixel)
+
+  OneBit images stored as ImageData<OneBitPixel> use a full
+  OneBitPixel (16 bits) for every pixel. PackedImageData stores one
+  bit per pixel in machine words instead. Each row starts on a word
+  boundary so that row-wise algorithms can operate on whole words
+  (see words_per_row() and row()). Unused bits at the end of a row
+  are always kept at 0.
+
+  Since only one bit is stored, any non-zero value written to a
+  pixel is stored as black (1). Labels (as used by ConnectedComponent)
+  can therefore not be represented in this format.
+
+  Many small images, such as the glyphs of a training database, can
+  take their words from one PackedArena instead of allocating them
+  one by one (see the arena constructor).
+*/
+
+#ifndef gamera_packed_data_hpp
+#define gamera_packed_data_hpp
+
+#include "image_data.hpp"
+#include "dimensions.hpp"
+
+#include <cstring>
+#include <iterator>
+
+namespace Gamera {
+
+  namespace PackedDataDetail {
+
+    typedef unsigned long word_type;
+
+    enum {
+      WORD_BITS = sizeof(word_type) * 8
+    };
+
+    inline size_t words_for(size_t ncols) {
+      return (ncols + WORD_BITS - 1) / WORD_BITS;
+    }
+
+    inline word_type bit_mask(size_t col) {
+      return word_type(1) << (col % WORD_BITS);
+    }
+
+    /*
+      PackedProxy
+
+      A single bit cannot be referenced directly, so the non-const
+      iterator returns this proxy, which either converts to the pixel
+      value or sets/clears the bit on assignment. It plays the same
+      role as the RLEProxy in rle_data.hpp.
+    */
+    template<class T>
+    class PackedProxy {
+    public:
+      typedef T value_type;
+
+      PackedProxy(word_type* word, word_type mask)
+	: m_word(word), m_mask(mask) { }
+      void operator=(value_type v) {
+	if (v)
+	  *m_word |= m_mask;
+	else
+	  *m_word &= ~m_mask;
+      }
+      operator value_type() const {
+	return (*m_word & m_mask) ? 1 : 0;
+      }
+    private:
+      word_type* m_word;
+      word_type m_mask;
+    };
+
+    /*
+      The iterators address pixels by their linear position
+      (row * ncols + col), like the iterators of ImageData and
+      RleVector, so that ImageView can use them unchanged. The
+      current column and the first word of the current row are
+      cached so that sequential access does not need a division.
+    */
+    template<class V, class Iterator>
+    class PackedIteratorBase {
+    public:
+      typedef typename V::value_type value_type;
+      typedef int difference_type;
+      typedef std::random_access_iterator_tag iterator_category;
+      typedef Iterator self;
+
+      PackedIteratorBase() : m_vec(0), m_pos(0), m_col(0), m_row_word(0) { }
+      PackedIteratorBase(V* vec, size_t pos) : m_vec(vec) {
+	set_pos(pos);
+      }
+
+      self& operator++() {
+	++m_pos;
+	if (++m_col == m_vec->stride()) {
+	  m_col = 0;
+	  m_row_word += m_vec->words_per_row();
+	}
+	return (self&)*this;
+      }
+      self operator++(int) {
+	self tmp = (self&)*this;
+	this->operator++();
+	return tmp;
+      }
+      self& operator--() {
+	--m_pos;
+	if (m_col == 0) {
+	  m_col = m_vec->stride() - 1;
+	  m_row_word -= m_vec->words_per_row();
+	} else
+	  --m_col;
+	return (self&)*this;
+      }
+      self operator--(int) {
+	self tmp = (self&)*this;
+	this->operator--();
+	return tmp;
+      }
+      self& operator+=(size_t n) {
+	set_pos(m_pos + n);
+	return (self&)*this;
+      }
+      self operator+(size_t n) const {
+	self tmp = (const self&)*this;
+	tmp += n;
+	return tmp;
+      }
+      self& operator-=(size_t n) {
+	set_pos(m_pos - n);
+	return (self&)*this;
+      }
+      self operator-(size_t n) const {
+	self tmp = (const self&)*this;
+	tmp -= n;
+	return tmp;
+      }
+      bool operator==(const self& other) const {
+	return m_pos == other.m_pos;
+      }
+      bool operator!=(const self& other) const {
+	return m_pos != other.m_pos;
+      }
+      bool operator<(const self& other) const {
+	return m_pos < other.m_pos;
+      }
+      bool operator<=(const self& other) const {
+	return m_pos <= other.m_pos;
+      }
+      bool operator>(const self& other) const {
+	return m_pos > other.m_pos;
+      }
+      bool operator>=(const self& other) const {
+	return m_pos >= other.m_pos;
+      }
+      difference_type operator-(const self& other) const {
+	return m_pos - other.m_pos;
+      }
+      value_type get() const {
+	return (m_vec->words()[m_row_word + m_col / WORD_BITS]
+		& bit_mask(m_col)) ? 1 : 0;
+      }
+      size_t pos() const { return m_pos; }
+      V* vec() const { return m_vec; }
+    protected:
+      void set_pos(size_t pos) {
+	m_pos = pos;
+	size_t stride = m_vec->stride();
+	if (stride == 0) {
+	  m_col = 0;
+	  m_row_word = 0;
+	} else {
+	  size_t row = pos / stride;
+	  m_col = pos - row * stride;
+	  m_row_word = row * m_vec->words_per_row();
+	}
+      }
+      V* m_vec;
+      size_t m_pos;
+      size_t m_col;
+      size_t m_row_word;
+    };
+
+    template<class V>
+    class PackedIterator : public PackedIteratorBase<V, PackedIterator<V> > {
+    public:
+      typedef PackedIterator self;
+      typedef PackedIteratorBase<V, self> base;
+
+      using base::m_vec;
+      using base::m_col;
+      using base::m_row_word;
+
+      typedef PackedProxy<typename V::value_type> proxy_type;
+      typedef proxy_type reference;
+      typedef proxy_type pointer;
+
+      PackedIterator() : base() { }
+      PackedIterator(V* vec, size_t pos) : base(vec, pos) { }
+
+      proxy_type operator*() const {
+	return proxy_type(m_vec->words() + m_row_word + m_col / WORD_BITS,
+			  bit_mask(m_col));
+      }
+      void set(const typename V::value_type& v) {
+	*(*this) = v;
+      }
+    };
+
+    template<class V>
+    class ConstPackedIterator
+      : public PackedIteratorBase<const V, ConstPackedIterator<V> > {
+    public:
+      typedef ConstPackedIterator self;
+      typedef PackedIteratorBase<const V, self> base;
+
+      using base::m_vec;
+
+      typedef void reference;
+      typedef typename V::value_type* pointer;
+
+      ConstPackedIterator() : base() { }
+      ConstPackedIterator(const V* vec, size_t pos) : base(vec, pos) { }
+      // allow comparison with (and conversion from) a non-const iterator
+      ConstPackedIterator(const PackedIterator<V>& other)
+	: base(other.vec(), other.pos()) { }
+
+      typename V::value_type operator*() const {
+	return this->get();
+      }
+    };
+
+  } // namespace PackedDataDetail
+
+  /*
+    PackedArena
+
+    One zeroed block of words that is handed out in consecutive,
+    word-aligned slices to the PackedImageData created on it. The arena
+    counts its users: the creator holds the first reference and gives it
+    up with release() once all slices are handed out, and every
+    PackedImageData releases its slice when it is destroyed or resized.
+    The block is freed with the last reference.
+  */
+  class PackedArena {
+  public:
+    typedef PackedDataDetail::word_type word_type;
+
+    PackedArena(size_t nwords) : m_nwords(nwords), m_used(0), m_users(1) {
+      m_data = new word_type[std::max(nwords, size_t(1))];
+      std::memset(m_data, 0, std::max(nwords, size_t(1)) * sizeof(word_type));
+    }
+
+    // the number of words a PackedImageData of dim takes from an arena
+    static size_t words_for(const Dim& dim) {
+      return PackedDataDetail::words_for(dim.ncols()) * dim.nrows();
+    }
+
+    word_type* take(size_t nwords) {
+      if (nwords > m_nwords - m_used)
+	throw std::range_error("PackedArena: not enough words left");
+      word_type* slice = m_data + m_used;
+      m_used += nwords;
+      shared_count_add(&m_users, 1);
+      return slice;
+    }
+
+    void release() {
+      if (shared_count_add(&m_users, -1) == 0)
+	delete this;
+    }
+
+  private:
+    ~PackedArena() { delete[] m_data; }
+
+    word_type* m_data;
+    size_t m_nwords, m_used;
+    long m_users;
+  };
+
+  /*
+    PackedImageData is the data object for the PACKED storage format.
+    It currently only makes sense for OneBitPixel.
+  */
+  template<class T>
+  class PackedImageData : public ImageDataBase {
+  public:
+    typedef T value_type;
+    typedef PackedDataDetail::word_type word_type;
+    typedef PackedDataDetail::PackedProxy<T> reference;
+    typedef PackedDataDetail::PackedProxy<T> pointer;
+    typedef int difference_type;
+    typedef PackedDataDetail::PackedIterator<PackedImageData> iterator;
+    typedef PackedDataDetail::ConstPackedIterator<PackedImageData> const_iterator;
+
+    PackedImageData(const Dim& dim, const Point& offset)
+      : ImageDataBase(dim, offset) {
+      create_data();
+    }
+    PackedImageData(const Dim& dim)
+      : ImageDataBase(dim) {
+      create_data();
+    }
+    PackedImageData(const Size& size, const Point& offset)
+      : ImageDataBase(size, offset) {
+      create_data();
+    }
+    PackedImageData(const Size& size)
+      : ImageDataBase(size) {
+      create_data();
+    }
+    PackedImageData(const Rect& rect)
+      : ImageDataBase(rect) {
+      create_data();
+    }
+    /*
+      The words of the pixels are taken from arena, so they are white
+      and do not need an allocation of their own. Resizing the data
+      moves the pixels to words of its own.
+    */
+    PackedImageData(const Dim& dim, const Point& offset, PackedArena& arena)
+      : ImageDataBase(dim, offset) {
+      create_data(&arena);
+    }
+    virtual ~PackedImageData() {
+      free_data(m_data, m_nwords, m_arena);
+    }
+
+    virtual size_t bytes() const { return m_nwords * sizeof(word_type); }
+    virtual double mbytes() const { return bytes() / 1048576.0; }
+    virtual void dimensions(size_t rows, size_t cols) {
+      m_stride = cols; do_resize(rows * cols); }
+    virtual void dim(const Dim& dim) {
+      m_stride = dim.ncols(); do_resize(dim.nrows() * dim.ncols()); }
+    virtual Dim dim() const {
+      return Dim(m_stride, size() / m_stride);
+    }
+
+    /*
+      Iterators
+    */
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, m_size); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_size); }
+
+    reference operator[](size_t n) {
+      iterator i = begin() + n;
+      return *i;
+    }
+
+    /*
+      Direct word access for word-parallel algorithms. Row r of the
+      data (not of a view) starts at row(r) and is words_per_row()
+      words long. Bit (c % WORD_BITS) of word (c / WORD_BITS) holds
+      column c.
+    */
+    size_t words_per_row() const { return m_words_per_row; }
+    size_t nwords() const { return m_nwords; }
+    word_type* words() { return m_data; }
+    const word_type* words() const { return m_data; }
+    word_type* row(size_t r) { return m_data + r * m_words_per_row; }
+    const word_type* row(size_t r) const { return m_data + r * m_words_per_row; }
+  protected:
+    /*
+      do_resize is called after m_stride has (possibly) been changed,
+      so the old layout is remembered in m_data_stride to be able to
+      copy the pixels that are kept.
+    */
+    virtual void do_resize(size_t size) {
+      size_t old_stride = m_data_stride;
+      size_t old_words_per_row = m_words_per_row;
+      size_t smallest = std::min(m_size, size);
+      word_type* old_data = m_data;
+      size_t old_nwords = m_nwords;
+      PackedArena* old_arena = m_arena;
+      m_size = size;
+      m_data = 0;
+      create_data();
+      if (old_data != 0 && old_stride > 0 && m_stride > 0) {
+	for (size_t i = 0; i < smallest; ++i) {
+	  size_t old_row = i / old_stride, old_col = i % old_stride;
+	  if (old_data[old_row * old_words_per_row + old_col / PackedDataDetail::WORD_BITS]
+	      & PackedDataDetail::bit_mask(old_col)) {
+	    size_t r = i / m_stride, c = i % m_stride;
+	    m_data[r * m_words_per_row + c / PackedDataDetail::WORD_BITS]
+	      |= PackedDataDetail::bit_mask(c);
+	  }
+	}
+      }
+      free_data(old_data, old_nwords, old_arena);
+    }
+  private:
+    void create_data(PackedArena* arena = 0) {
+      m_data_stride = m_stride;
+      m_words_per_row = PackedDataDetail::words_for(m_stride);
+      m_nwords = (m_stride == 0) ? 0 : (m_size / m_stride) * m_words_per_row;
+      m_data = 0;
+      m_arena = 0;
+      if (m_nwords > 0) {
+	if (arena != 0) {
+	  m_data = arena->take(m_nwords);
+	  m_arena = arena;
+	} else {
+	  m_data = new word_type[m_nwords];
+	  std::memset(m_data, 0, m_nwords * sizeof(word_type));
+	}
+	memory_budget_allocated(*m_budget, memory_budget_slot<T>::value,
+				m_nwords * sizeof(word_type));
+      }
+    }
+
+    void free_data(word_type* data, size_t nwords, PackedArena* arena) {
+      if (data != 0) {
+	if (arena != 0)
+	  arena->release();
+	else
+	  delete[] data;
+	memory_budget_freed(*m_budget, memory_budget_slot<T>::value,
+			    nwords * sizeof(word_type));
+      }
+    }
+
+    word_type* m_data;
+    size_t m_nwords;
+    size_t m_words_per_row;
+    size_t m_data_stride;
+    // the arena the words are taken from, or 0 if they are our own
+    PackedArena* m_arena;
+  };
+}
+
+#endif
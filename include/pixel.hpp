@@ -59,9 +59,16 @@ namespace Gamera {
    *
    * The Gamera::FloatPixel type represents a single pixel in a
    * floating-point image. For floating-point images 0 is considerd
-   * black and max is considered white.
+   * black and max is considered white.  The pixels are single precision
+   * when Gamera is built with GAMERA_FLOAT_SINGLE (setup.py
+   * --float=single); computations over many pixels should then not
+   * accumulate in a FloatPixel.
    */
+#ifdef GAMERA_FLOAT_SINGLE
+  typedef float FloatPixel;
+#else
   typedef double FloatPixel;
+#endif
 
   /**
    * GreyScalePixel
@@ -71,12 +78,81 @@ namespace Gamera {
    */
   typedef unsigned char GreyScalePixel;
 
+#ifdef GAMERA_GREY16_NATIVE
+  /**
+   * Grey16Value
+   *
+   * The pixel type of 16bit greyscale images when Gamera is built with
+   * GAMERA_GREY16_NATIVE (setup.py --grey16=native).  It stores the
+   * 16 bits of the pixel only, but takes part in expressions as an
+   * unsigned int, so that the plugins compute with the same width as
+   * with the default Grey16Pixel.  It cannot simply be an unsigned short,
+   * since that is the OneBitPixel type.
+   */
+  class Grey16Value {
+  public:
+    Grey16Value() { }
+    Grey16Value(unsigned int value) : m_value((unsigned short)value) { }
+    operator unsigned int() const { return m_value; }
+
+    Grey16Value& operator+=(unsigned int value) {
+      m_value = (unsigned short)(m_value + value);
+      return *this;
+    }
+    Grey16Value& operator-=(unsigned int value) {
+      m_value = (unsigned short)(m_value - value);
+      return *this;
+    }
+    Grey16Value& operator*=(unsigned int value) {
+      m_value = (unsigned short)(m_value * value);
+      return *this;
+    }
+    Grey16Value& operator/=(unsigned int value) {
+      m_value = (unsigned short)(m_value / value);
+      return *this;
+    }
+    Grey16Value& operator++() {
+      ++m_value;
+      return *this;
+    }
+    Grey16Value& operator--() {
+      --m_value;
+      return *this;
+    }
+
+  private:
+    unsigned short m_value;
+  };
+}
+
+namespace std {
+  template<>
+  class numeric_limits<Gamera::Grey16Value>
+    : public numeric_limits<unsigned short> {
+  public:
+    static Gamera::Grey16Value min() throw() { return 0; }
+    static Gamera::Grey16Value max() throw() { return 65535; }
+  };
+}
+
+namespace Gamera {
+  /**
+   * Grey16Pixel
+   *
+   * The Gamera::Grey16Pixel type is for 16bit greyscale images.  For Grey16
+   * images 0 is considered black and 65535 is considered white.
+   */
+  typedef Grey16Value Grey16Pixel;
+#else
   /**
    * Grey16Pixel
    *
-   * The Gamera::Grey16Pixel type is for 16bit greyscale images.
+   * The Gamera::Grey16Pixel type is for 16bit greyscale images.  The pixels
+   * are stored in an unsigned int, unless Gamera is built with
+   * GAMERA_GREY16_NATIVE (see Grey16Value above).
    */
   typedef unsigned int Grey16Pixel;
+#endif
 
   /**
    * OneBitPixel
@@ -22,12 +22,161 @@
 #define mgd_arithmetic
 
 #include <functional>
+#include <cmath>
+#include <vector>
 #include "gamera.hpp"
 
+namespace ArithmeticDetail {
+  template<class P>
+  inline bool is_contiguous(const ImageView<ImageData<P> >& image) {
+    return image.ncols() == image.data()->stride();
+  }
+
+  /*
+    Conversion of the double results of multiply_add to the pixel
+    type: integer pixels are rounded and then either clipped to their
+    range (saturate) or taken modulo the range size.
+  */
+  template<class P>
+  struct PixelRange {
+    static const long long max = 0;
+  };
+  template<>
+  struct PixelRange<GreyScalePixel> {
+    static const long long max = 255;
+  };
+  template<>
+  struct PixelRange<Grey16Pixel> {
+    static const long long max = 65535;
+  };
+
+  template<class P>
+  inline P to_pixel(long long v, bool saturate) {
+    const long long max = PixelRange<P>::max;
+    if (saturate)
+      return (P)(v < 0 ? 0 : (v > max ? max : v));
+    // the range size is a power of two
+    return (P)(v & max);
+  }
+
+  template<class P>
+  inline P to_pixel(double v, bool saturate) {
+    double r = std::floor(v + 0.5);
+    // NaN and values beyond the range of long long
+    if (!(r > -9.0e18))
+      r = (r == r) ? -9.0e18 : 0.0;
+    else if (r > 9.0e18)
+      r = 9.0e18;
+    return to_pixel<P>((long long)r, saturate);
+  }
+
+  template<>
+  inline FloatPixel to_pixel<FloatPixel>(double v, bool) {
+    return v;
+  }
+
+  inline bool is_integral(double v) {
+    return std::floor(v) == v && std::fabs(v) < 16777216.0;
+  }
+
+  /*
+    factor * a + other_factor * b + offset for spans of pixels.  When
+    all three numbers are integers and the pixels are integers, the
+    sums are computed exactly in integers, which the compiler can
+    vectorize.
+  */
+  template<class P, class Q>
+  struct MultiplyAddSpan {
+    double factor, other_factor, offset;
+    bool saturate, integral;
+    MultiplyAddSpan(double f, double g, double o, bool s)
+      : factor(f), other_factor(g), offset(o), saturate(s) {
+      integral = PixelRange<P>::max > 0 && is_integral(f) && is_integral(g)
+        && is_integral(o);
+    }
+    void operator()(const P* a, const Q* b, P* dest, size_t n) const {
+      if (integral) {
+        const long long f = (long long)factor, g = (long long)other_factor,
+          o = (long long)offset;
+        for (size_t i = 0; i < n; ++i)
+          dest[i] = to_pixel<P>(f * (long long)a[i] + g * (long long)b[i] + o,
+                                saturate);
+      } else {
+        for (size_t i = 0; i < n; ++i)
+          dest[i] = to_pixel<P>(factor * a[i] + other_factor * b[i] + offset,
+                                saturate);
+      }
+    }
+  };
+
+  /*
+    factor * a + offset for spans of pixels.  For integer pixels,
+    the results for all values in the pixel range are tabulated.
+  */
+  template<class P>
+  struct MultiplyAddScalarSpan {
+    double factor, offset;
+    bool saturate;
+    std::vector<P> table;
+    MultiplyAddScalarSpan(double f, double o, bool s)
+      : factor(f), offset(o), saturate(s) {
+      if (PixelRange<P>::max > 0) {
+        table.resize(PixelRange<P>::max + 1);
+        for (size_t v = 0; v < table.size(); ++v)
+          table[v] = to_pixel<P>(factor * v + offset, saturate);
+      }
+    }
+    void operator()(const P* a, P* dest, size_t n) const {
+      if (table.empty()) {
+        for (size_t i = 0; i < n; ++i)
+          dest[i] = to_pixel<P>(factor * a[i] + offset, saturate);
+      } else {
+        const size_t size = table.size();
+        for (size_t i = 0; i < n; ++i) {
+          size_t v = (size_t)a[i];
+          dest[i] = v < size ? table[v]
+            : to_pixel<P>(factor * a[i] + offset, saturate);
+        }
+      }
+    }
+  };
+
+  // applies a span functor to the corresponding spans of dense views
+  // (for for_each_span_block)
+  template<class P, class Q, class SPAN>
+  struct BinarySpans {
+    const ImageView<ImageData<P> >& a;
+    const ImageView<ImageData<Q> >& b;
+    ImageView<ImageData<P> >& dest;
+    const SPAN& span;
+    BinarySpans(const ImageView<ImageData<P> >& a_,
+                const ImageView<ImageData<Q> >& b_,
+                ImageView<ImageData<P> >& dest_, const SPAN& span_)
+      : a(a_), b(b_), dest(dest_), span(span_) {}
+    void operator()(size_t y, size_t x, size_t n) const {
+      span(a[y] + x, b[y] + x, dest[y] + x, n);
+    }
+  };
+
+  template<class P, class SPAN>
+  struct UnarySpans {
+    const ImageView<ImageData<P> >& a;
+    ImageView<ImageData<P> >& dest;
+    const SPAN& span;
+    UnarySpans(const ImageView<ImageData<P> >& a_,
+               ImageView<ImageData<P> >& dest_, const SPAN& span_)
+      : a(a_), dest(dest_), span(span_) {}
+    void operator()(size_t y, size_t x, size_t n) const {
+      span(a[y] + x, dest[y] + x, n);
+    }
+  };
+}
+
 template<class T, class U, class FUNCTOR>
 inline 
 typename ImageFactory<T>::view_type* 
-arithmetic_combine(T& a, const U& b, const FUNCTOR& functor, bool in_place) {
+arithmetic_combine(T& a, const U& b, const FUNCTOR& functor, bool in_place,
+                   int threads=0) {
   if (a.nrows() != b.nrows() || a.ncols() != b.ncols())
     throw std::runtime_error("Images must be the same size.");
   
@@ -75,12 +224,62 @@ arithmetic_combine(T& a, const U& b, const FUNCTOR& functor, bool in_place) {
   }
 }
 
+template<class P, class Q, class FUNCTOR>
+struct ArithmeticSpan {
+  typedef typename NumericTraits<P>::Promote PROMOTE;
+  const FUNCTOR& functor;
+  typename choose_accessor<ImageView<ImageData<P> > >::accessor ad;
+  ArithmeticSpan(const FUNCTOR& f) : functor(f) {}
+  // dest may be a itself
+  void operator()(const P* a, const Q* b, P* dest, size_t n) const {
+    for (size_t i = 0; i < n; ++i) {
+      P* d = dest + i;
+      ad.set(NumericTraits<P>::fromPromote(functor(PROMOTE(a[i]), PROMOTE(b[i]))), d);
+    }
+  }
+  void operator()(P* a, const Q* b, size_t n) const {
+    (*this)(a, b, a, n);
+  }
+};
+
+/*
+  Dense images are combined span by span, on several threads for
+  large images (see for_each_span_block).
+*/
+template<class P, class Q, class FUNCTOR>
+inline
+ImageView<ImageData<P> >*
+arithmetic_combine(ImageView<ImageData<P> >& a, const ImageView<ImageData<Q> >& b,
+                   const FUNCTOR& functor, bool in_place, int threads=0) {
+  using namespace ArithmeticDetail;
+  if (a.nrows() != b.nrows() || a.ncols() != b.ncols())
+    throw std::runtime_error("Images must be the same size.");
+
+  typedef ImageView<ImageData<P> > VIEW;
+  typedef ArithmeticSpan<P, Q, FUNCTOR> SPAN;
+  SPAN span(functor);
+
+  VIEW* dest = &a;
+  ImageData<P>* dest_data = NULL;
+  if (!in_place) {
+    dest_data = new ImageData<P>(a.size(), a.origin());
+    dest = new VIEW(*dest_data, a);
+  }
+  for_each_span_block(a.nrows(), a.ncols(),
+                      is_contiguous(a) && is_contiguous(b) && is_contiguous(*dest),
+                      threads, BinarySpans<P, Q, SPAN>(a, b, *dest, span));
+  if (in_place)
+    // Returning NULL is converted to None by the wrapper mechanism
+    return NULL;
+  return dest;
+}
+
 template<class T, class U>
 typename ImageFactory<T>::view_type* 
-add_images(T& a, const U& b, bool in_place=true) {
+add_images(T& a, const U& b, bool in_place=true, int threads=0) {
   typedef typename T::value_type TVALUE;
   typedef typename NumericTraits<TVALUE>::Promote PROMOTE;
-  return arithmetic_combine(a, b, std::plus<PROMOTE>(), in_place);
+  return arithmetic_combine(a, b, std::plus<PROMOTE>(), in_place, threads);
 }
 
 template <class T>
@@ -107,25 +306,78 @@ struct my_minus<OneBitPixel> : public std::binary_function<OneBitPixel, OneBitPi
 
 template<class T, class U>
 typename ImageFactory<T>::view_type* 
-subtract_images(T& a, const U& b, bool in_place=true) {
+subtract_images(T& a, const U& b, bool in_place=true, int threads=0) {
   typedef typename T::value_type TVALUE;
-  return arithmetic_combine(a, b, my_minus<TVALUE>(), in_place);
+  return arithmetic_combine(a, b, my_minus<TVALUE>(), in_place, threads);
 }
 
 template<class T, class U>
 typename ImageFactory<T>::view_type* 
-multiply_images(T& a, const U& b, bool in_place=true) {
+multiply_images(T& a, const U& b, bool in_place=true, int threads=0) {
   typedef typename T::value_type TVALUE;
   typedef typename NumericTraits<TVALUE>::Promote PROMOTE;
-  return arithmetic_combine(a, b, std::multiplies<PROMOTE>(), in_place);
+  return arithmetic_combine(a, b, std::multiplies<PROMOTE>(), in_place, threads);
 }
 
 template<class T, class U>
 typename ImageFactory<T>::view_type* 
-divide_images(T& a, const U& b, bool in_place=true) {
+divide_images(T& a, const U& b, bool in_place=true, int threads=0) {
   typedef typename T::value_type TVALUE;
   typedef typename NumericTraits<TVALUE>::Promote PROMOTE;
-  return arithmetic_combine(a, b, std::divides<PROMOTE>(), in_place);
+  return arithmetic_combine(a, b, std::divides<PROMOTE>(), in_place, threads);
+}
+
+/*
+  factor * a + other_factor * b + offset, clipped to the range of the
+  pixel type (saturate) or wrapped around.
+*/
+template<class P, class Q>
+ImageView<ImageData<P> >*
+multiply_add_images(ImageView<ImageData<P> >& a, const ImageView<ImageData<Q> >& b,
+                    double factor=1.0, double other_factor=1.0, double offset=0.0,
+                    bool saturate=true, bool in_place=false, int threads=0) {
+  using namespace ArithmeticDetail;
+  if (a.nrows() != b.nrows() || a.ncols() != b.ncols())
+    throw std::runtime_error("Images must be the same size.");
+
+  typedef ImageView<ImageData<P> > VIEW;
+  typedef MultiplyAddSpan<P, Q> SPAN;
+  SPAN span(factor, other_factor, offset, saturate);
+
+  VIEW* dest = &a;
+  if (!in_place)
+    dest = new VIEW(*(new ImageData<P>(a.size(), a.origin())), a);
+  for_each_span_block(a.nrows(), a.ncols(),
+                      is_contiguous(a) && is_contiguous(b) && is_contiguous(*dest),
+                      threads, BinarySpans<P, Q, SPAN>(a, b, *dest, span));
+  if (in_place)
+    // Returning NULL is converted to None by the wrapper mechanism
+    return NULL;
+  return dest;
+}
+
+/*
+  factor * a + offset, clipped to the range of the pixel type
+  (saturate) or wrapped around.
+*/
+template<class P>
+ImageView<ImageData<P> >*
+multiply_add(ImageView<ImageData<P> >& a, double factor=1.0, double offset=0.0,
+             bool saturate=true, bool in_place=false, int threads=0) {
+  using namespace ArithmeticDetail;
+  typedef ImageView<ImageData<P> > VIEW;
+  typedef MultiplyAddScalarSpan<P> SPAN;
+  SPAN span(factor, offset, saturate);
+
+  VIEW* dest = &a;
+  if (!in_place)
+    dest = new VIEW(*(new ImageData<P>(a.size(), a.origin())), a);
+  for_each_span_block(a.nrows(), a.ncols(), is_contiguous(a) && is_contiguous(*dest),
+                      threads, UnarySpans<P, SPAN>(a, *dest, span));
+  if (in_place)
+    // Returning NULL is converted to None by the wrapper mechanism
+    return NULL;
+  return dest;
 }
 
-#endif 
+#endif
@@ -22,13 +22,21 @@
 #define jab18112005_binarization
 
 #include "gamera.hpp"
+#include "thread_exception.hpp"
 #include "threshold.hpp"
 #include "math.h"
 #include <numeric>
 #include <vector>
 #include <algorithm>
+#include <limits>
 
 #include <iostream>
+#include <string>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace Gamera;
 
@@ -46,104 +54,284 @@ struct double_squared : public std::unary_function<double, T>
     double operator()(T x) { return (double)x * (double)x; }
 };
 
-/* Adaptive function for adding pairs. */
+/* Thresholder of Gatos et al.  The threshold depends only on the
+ * background value, so it is tabulated once for all values of the
+ * integer pixel type T, as the source value below which a pixel is
+ * black.
+ */
 template<class T>
-struct pair_plus : public std::binary_function<T, T, T>
+class gatos_thresholder
 {
-    T operator()(T p, T q) 
+public:
+    gatos_thresholder(double q, double delta, double b, double p1, double p2)
+        : m_limits((size_t)std::numeric_limits<T>::max() + 1)
         {
-            return std::make_pair(p.first + q.first, 
-                                  p.second + q.second);
+            for (size_t g = 0; g < m_limits.size(); ++g) {
+                double t = q * delta
+                    * (((1 - p2) / (1 + std::exp(((-4 * (double)g) / (b * (1 - p1)))
+                                                 + ((2 * (1 + p1)) / (1 - p1)))))
+                       + p2);
+                // the smallest source value s that is not black, that is
+                // with g - s <= t, found without rounding surprises
+                long size = (long)m_limits.size();
+                double limit = std::ceil((double)g - t);
+                long l;
+                if (!(limit > 0.0))
+                    l = 0;
+                else if (limit >= (double)size)
+                    l = size;
+                else
+                    l = (long)limit;
+                while (l > 0 && !((double)((long)g - (l - 1)) > t))
+                    --l;
+                while (l < size && (double)((long)g - l) > t)
+                    ++l;
+                m_limits[g] = l;
+            }
         }
-};
 
-/* Binary function for accumulating background pixels. */
-template<class T, class U, class V>
-struct gatos_accumulate 
-    : public std::binary_function<T, U, V>
-{
-    typedef typename T::first_type type1;
-    typedef typename T::second_type type2;
-    T operator()(U mask, V pixel)
+    bool operator()(T src, T background) const
         {
-            if (is_black(mask)) return std::make_pair((type1)0, (type2)0);
-            else return std::make_pair((type1)1, (type2)pixel);
+            return (long)src < m_limits[background];
         }
-};
-
-/* Binary function for Gatos thresholding. */
-template<class T, class U>
-struct gatos_thresholder
-    : public std::binary_function<U, T, T>
-{
-    const double q;
-    const double delta;
-    const double b;
-    const double p1;
-    const double p2;
 
-    gatos_thresholder(double q, double delta, double b, double p1, double p2)
-        : q(q), delta(delta), b(b), p1(p1), p2(p2) {} 
-   
-    U operator()(T src, T background)
-        {
-            return 
-                ((double)(background - src) 
-                 > (q 
-                    * delta 
-                    * (((1 - p2) 
-                        / (1 
-                           + std::exp(((-4 * background) / (b * (1 - p1))) 
-                                      + ((2 * (1 + p1)) / (1 - p1))))) 
-                       + p2)))
-                ? pixel_traits<U>::black()
-                : pixel_traits<U>::white();
-        }
+private:
+    std::vector<long> m_limits;
 };
 
-/* FloatPixel image_mean(Image src)
+/* double image_mean(Image src)
  *
  * Returns the mean value over all pixels of an image.
  */
 template<class T>
-FloatPixel image_mean(const T &src)
+double image_mean(const T &src)
 {
-    FloatPixel sum 
+    double sum 
         = std::accumulate(src.vec_begin(), 
                           src.vec_end(), 
-                          (FloatPixel)0,
+                          0.0,
                           double_plus<typename T::value_type>());
     size_t area = src.nrows() * src.ncols();
     return sum / area;
 }
 
-/* FloatPixel image_variance(Image src)
+/* double image_variance(Image src)
  *
  * Returns the variance over all pixels of an image.
  */
 template<class T>
-FloatPixel image_variance(const T &src)
+double image_variance(const T &src)
 {
-    FloatImageData* squaredData = new FloatImageData(src.size(), src.origin());
-    FloatImageView* squares = new FloatImageView(*squaredData);
-
-    transform(src.vec_begin(), 
-              src.vec_end(), 
-              squares->vec_begin(), 
-              double_squared<typename T::value_type>());
-
-    FloatPixel sum
-        = std::accumulate(squares->vec_begin(), 
-                          squares->vec_end(), 
-                          (FloatPixel)0);
+    double_squared<typename T::value_type> square;
+    double sum = 0;
+    for (typename T::const_vec_iterator i = src.vec_begin();
+         i != src.vec_end(); ++i)
+        sum += square(*i);
     size_t area = src.nrows() * src.ncols();
-    FloatPixel mean = image_mean(src);
-    
-    delete squaredData;
-    delete squares;
+    double mean = image_mean(src);
     return sum / area - mean * mean;
 }
 
+/* The type in which region_sums adds up pixel values and their squares.
+ * Integer pixels are summed exactly, so that the results do not depend
+ * on the order of the additions.
+ */
+template<class T>
+struct region_sum_traits {
+    typedef double sum_type;
+};
+
+template<>
+struct region_sum_traits<GreyScalePixel> {
+    typedef unsigned long long sum_type;
+};
+
+template<>
+struct region_sum_traits<Grey16Pixel> {
+    typedef unsigned long long sum_type;
+};
+
+/* Running sums over the regions of the regional filters.
+ *
+ * The region of a pixel is the square of region_size centered on it,
+ * clipped to the image.  The rows must be visited in order with row():
+ * the column sums over the rows of the current region are updated as the
+ * region moves down, and their prefix sums give the sums over any region
+ * of the row, so each pixel costs O(1) whatever the region size.
+ */
+template<class T>
+class region_sums
+{
+public:
+    typedef typename region_sum_traits<typename T::value_type>::sum_type
+        sum_type;
+
+    region_sums(const T &src, size_t region_size)
+        : m_src(src), m_half(region_size / 2), m_top(0), m_bottom(0),
+          m_rows(0), m_columns(src.ncols(), 0), m_column_squares(src.ncols(), 0),
+          m_sums(src.ncols() + 1, 0), m_squares(src.ncols() + 1, 0) {}
+
+    void row(coord_t y)
+    {
+        size_t top = (size_t)std::max(0, (int)y - (int)m_half);
+        size_t bottom = std::min(y + m_half, m_src.nrows() - 1) + 1;
+        if (top < m_top || top >= m_bottom) {
+            std::fill(m_columns.begin(), m_columns.end(), (sum_type)0);
+            std::fill(m_column_squares.begin(), m_column_squares.end(),
+                      (sum_type)0);
+            m_top = m_bottom = top;
+        }
+        for (; m_top < top; ++m_top)
+            add_row(m_top, false);
+        for (; m_bottom < bottom; ++m_bottom)
+            add_row(m_bottom, true);
+        m_rows = bottom - top;
+        for (size_t x = 0; x < m_columns.size(); ++x) {
+            m_sums[x + 1] = m_sums[x] + m_columns[x];
+            m_squares[x + 1] = m_squares[x] + m_column_squares[x];
+        }
+    }
+
+    // The mean and the variance of the region of pixel x in the current row,
+    // computed as mean_filter and variance_filter do.
+    FloatPixel mean(coord_t x) const
+    {
+        return (FloatPixel)(m_sums[right(x)] - m_sums[left(x)]) / area(x);
+    }
+
+    FloatPixel variance(coord_t x, FloatPixel mean) const
+    {
+        return (FloatPixel)(m_squares[right(x)] - m_squares[left(x)]) / area(x)
+            - mean * mean;
+    }
+
+private:
+    size_t left(coord_t x) const
+    {
+        return (size_t)std::max(0, (int)x - (int)m_half);
+    }
+
+    size_t right(coord_t x) const
+    {
+        return std::min(x + m_half, m_src.ncols() - 1) + 1;
+    }
+
+    size_t area(coord_t x) const
+    {
+        return m_rows * (right(x) - left(x));
+    }
+
+    void add_row(size_t y, bool add)
+    {
+        typename T::const_row_iterator r = m_src.row_begin() + y;
+        typename T::const_row_iterator::iterator c = r.begin();
+        for (size_t x = 0; c != r.end(); ++c, ++x) {
+            sum_type value = (sum_type)*c;
+            if (add) {
+                m_columns[x] += value;
+                m_column_squares[x] += value * value;
+            } else {
+                m_columns[x] -= value;
+                m_column_squares[x] -= value * value;
+            }
+        }
+    }
+
+    const T &m_src;
+    size_t m_half, m_top, m_bottom, m_rows;
+    std::vector<sum_type> m_columns, m_column_squares;
+    std::vector<sum_type> m_sums, m_squares;
+};
+
+/* Running sums over the background of the regions of gatos_background.
+ *
+ * Like region_sums, but only the pixels that are white in the
+ * binarization are counted and summed.
+ */
+template<class T, class U>
+class background_sums
+{
+public:
+    typedef typename region_sum_traits<typename T::value_type>::sum_type
+        sum_type;
+
+    background_sums(const T &src, const U &binarization, size_t region_size)
+        : m_src(src), m_binarization(binarization), m_half(region_size / 2),
+          m_top(0), m_bottom(0), m_columns(src.ncols(), 0),
+          m_column_counts(src.ncols(), 0), m_sums(src.ncols() + 1, 0),
+          m_counts(src.ncols() + 1, 0) {}
+
+    void row(coord_t y)
+    {
+        size_t top = (size_t)std::max(0, (int)y - (int)m_half);
+        size_t bottom = std::min(y + m_half, m_src.nrows() - 1) + 1;
+        if (top < m_top || top >= m_bottom) {
+            std::fill(m_columns.begin(), m_columns.end(), (sum_type)0);
+            std::fill(m_column_counts.begin(), m_column_counts.end(), 0);
+            m_top = m_bottom = top;
+        }
+        for (; m_top < top; ++m_top)
+            add_row(m_top, false);
+        for (; m_bottom < bottom; ++m_bottom)
+            add_row(m_bottom, true);
+        for (size_t x = 0; x < m_columns.size(); ++x) {
+            m_sums[x + 1] = m_sums[x] + m_columns[x];
+            m_counts[x + 1] = m_counts[x] + m_column_counts[x];
+        }
+    }
+
+    // The number of background pixels in the region of pixel x in the
+    // current row, and their sum.
+    size_t count(coord_t x) const
+    {
+        return m_counts[right(x)] - m_counts[left(x)];
+    }
+
+    FloatPixel sum(coord_t x) const
+    {
+        return (FloatPixel)(m_sums[right(x)] - m_sums[left(x)]);
+    }
+
+private:
+    size_t left(coord_t x) const
+    {
+        return (size_t)std::max(0, (int)x - (int)m_half);
+    }
+
+    size_t right(coord_t x) const
+    {
+        return std::min(x + m_half, m_src.ncols() - 1) + 1;
+    }
+
+    void add_row(size_t y, bool add)
+    {
+        typename T::const_row_iterator r = m_src.row_begin() + y;
+        typename T::const_row_iterator::iterator c = r.begin();
+        typename U::const_row_iterator br = m_binarization.row_begin() + y;
+        typename U::const_row_iterator::iterator b = br.begin();
+        for (size_t x = 0; c != r.end(); ++c, ++b, ++x) {
+            if (is_black(*b))
+                continue;
+            sum_type value = (sum_type)*c;
+            if (add) {
+                m_columns[x] += value;
+                ++m_column_counts[x];
+            } else {
+                m_columns[x] -= value;
+                --m_column_counts[x];
+            }
+        }
+    }
+
+    const T &m_src;
+    const U &m_binarization;
+    size_t m_half, m_top, m_bottom;
+    std::vector<sum_type> m_columns;
+    std::vector<size_t> m_column_counts;
+    std::vector<sum_type> m_sums;
+    std::vector<size_t> m_counts;
+};
+
 /* Float mean_filter(Image src, size_t region_size);
  *
  * The implementation of region size is not entirely correct because of
@@ -156,25 +344,18 @@ FloatImageView* mean_filter(const T &src, size_t region_size)
     if ((region_size < 1) || (region_size > std::min(src.nrows(), src.ncols())))
         throw std::out_of_range("mean_filter: region_size out of range");
 
-    size_t half_region_size = region_size / 2;
-
-    typename ImageFactory<T>::view_type* copy = ImageFactory<T>::new_view(src);
     FloatImageData* data = new FloatImageData(src.size(), src.origin());
     FloatImageView* view = new FloatImageView(*data);
-  
-    for (coord_t y = 0; y < src.nrows(); ++y) {
-        for (coord_t x = 0; x < src.ncols(); ++x) {
-            // Define the region.
-            Point ul((coord_t)std::max(0, (int)x - (int)half_region_size),
-                     (coord_t)std::max(0, (int)y - (int)half_region_size));
-            Point lr((coord_t)std::min(x + half_region_size, src.ncols() - 1),
-                     (coord_t)std::min(y + half_region_size, src.nrows() - 1));
-            copy->rect_set(ul, lr);
-            view->set(Point(x, y), image_mean(*copy));
-        }
+
+    region_sums<T> sums(src, region_size);
+    FloatImageView::row_iterator vr = view->row_begin();
+    for (coord_t y = 0; y < src.nrows(); ++y, ++vr) {
+        sums.row(y);
+        FloatImageView::col_iterator v = vr.begin();
+        for (coord_t x = 0; v != vr.end(); ++x, ++v)
+            *v = sums.mean(x);
     }
 
-    delete copy;
     return view;
 }
 
@@ -194,42 +375,16 @@ FloatImageView* variance_filter(const T &src,
      if (src.size() != means.size())
         throw std::invalid_argument("variance_filter: sizes must match");
  
-    size_t half_region_size = region_size / 2;
-
-    // Compute squares of each element. This step avoid repeating the squaring
-    // operation for overlapping regions.
-    FloatImageData* squaredData = new FloatImageData(src.size(), src.origin());
-    FloatImageView* squares = new FloatImageView(*squaredData);
-
-    transform(src.vec_begin(), 
-              src.vec_end(), 
-              squares->vec_begin(), 
-              double_squared<typename T::value_type>());
-  
     FloatImageData* data = new FloatImageData(src.size(), src.origin());
     FloatImageView* view = new FloatImageView(*data);  
 
+    region_sums<T> sums(src, region_size);
     for (coord_t y = 0; y < src.nrows(); ++y) {
-        for (coord_t x = 0; x < src.ncols(); ++x) {
-            // Define the region.
-            Point ul((coord_t)std::max(0, (int)x - (int)half_region_size),
-                     (coord_t)std::max(0, (int)y - (int)half_region_size));
-            Point lr((coord_t)std::min(x + half_region_size, src.ncols() - 1),
-                     (coord_t)std::min(y + half_region_size, src.nrows() - 1));
-            squares->rect_set(ul, lr);
-            // Compute the variance.
-            FloatPixel sum
-                = std::accumulate(squares->vec_begin(), 
-                                  squares->vec_end(), 
-                                  (FloatPixel)0);
-            size_t area = squares->nrows() * squares->ncols();
-            FloatPixel mean = means.get(Point(x,y));
-            view->set(Point(x, y), sum / area - mean * mean);
-        }
+        sums.row(y);
+        for (coord_t x = 0; x < src.ncols(); ++x)
+            view->set(Point(x, y), sums.variance(x, means.get(Point(x, y))));
     }
     
-    delete squaredData;
-    delete squares;
     return view;
 }
 
@@ -242,28 +397,25 @@ T* wiener_filter(const T &src, size_t region_size, double noise_variance)
 {
     if ((region_size < 1) || (region_size > std::min(src.nrows(), src.ncols())))
         throw std::out_of_range("niblack_threshold: region_size out of range");
-    
-    // Compute regional statistics.
-    const FloatImageView* means = mean_filter(src, region_size);
-    const FloatImageView* variances = variance_filter(src, *means, region_size);
 
-    // Compute noise variance if needed.
+    const size_t nrows = src.nrows(), ncols = src.ncols();
+
+    // Compute noise variance if needed: the median of the regional
+    // variances, which are only kept for this.
     if (noise_variance < 0) {
-        FloatImageData* orderedVariancesData 
-            = new FloatImageData(variances->size(), variances->origin());
-        FloatImageView* orderedVariances 
-            = new FloatImageView(*orderedVariancesData);        
-        std::copy(variances->vec_begin(),
-                  variances->vec_end(),
-                  orderedVariances->vec_begin());
-        size_t area = orderedVariances->nrows() * orderedVariances->ncols();
-        std::nth_element(orderedVariances->vec_begin(),
-                         orderedVariances->vec_begin() + (area - 1) / 2,
-                         orderedVariances->vec_end());
-        noise_variance 
-            = (double)*(orderedVariances->vec_begin() + (area - 1) / 2);
-        delete orderedVariancesData;
-        delete orderedVariances;
+        std::vector<FloatPixel> all_variances(nrows * ncols);
+        region_sums<T> sums(src, region_size);
+        std::vector<FloatPixel>::iterator v = all_variances.begin();
+        for (coord_t y = 0; y < nrows; ++y) {
+            sums.row(y);
+            for (coord_t x = 0; x < ncols; ++x, ++v)
+                *v = sums.variance(x, sums.mean(x));
+        }
+        size_t area = nrows * ncols;
+        std::nth_element(all_variances.begin(),
+                         all_variances.begin() + (area - 1) / 2,
+                         all_variances.end());
+        noise_variance = (double)all_variances[(area - 1) / 2];
     }
 
     typedef typename T::value_type value_type;
@@ -272,28 +424,33 @@ T* wiener_filter(const T &src, size_t region_size, double noise_variance)
     data_type* data = new data_type(src.size(), src.origin());
     view_type* view = new view_type(*data);
 
-    for (coord_t y = 0; y < src.nrows(); ++y) {
-        for (coord_t x = 0; x < src.ncols(); ++x) {
-            double mean = (double)means->get(Point(x, y));
-            double variance = (double)variances->get(Point(x, y));
+    // The regional statistics are computed row by row.
+    region_sums<T> sums(src, region_size);
+    typename T::const_row_iterator sr = src.row_begin();
+    typename view_type::row_iterator vr = view->row_begin();
+    for (coord_t y = 0; y < nrows; ++y, ++sr, ++vr) {
+        sums.row(y);
+        typename T::const_col_iterator s = sr.begin();
+        typename view_type::col_iterator v = vr.begin();
+        for (coord_t x = 0; x < ncols; ++x, ++s, ++v) {
+            FloatPixel region_mean = sums.mean(x);
+            double mean = (double)region_mean;
+            double variance = (double)sums.variance(x, region_mean);
             // The estimate of noise variance will never be perfect, but in
             // theory, it would be impossible for any region to have a local
             // variance less than it. The following check eliminates that
             // theoretical impossibility and has a side benefit of preventing
             // division by zero.
             if (variance < noise_variance) {
-                view->set(Point(x, y), (value_type)mean);
+                *v = (value_type)mean;
             } else {
                 double multiplier = (variance - noise_variance) / variance;
-                double value = (double)src.get(Point(x, y));
-                view->set(Point(x, y),
-                          (value_type)(mean + multiplier * (value - mean)));
+                double value = (double)*s;
+                *v = (value_type)(mean + multiplier * (value - mean));
             }
         }
     }
 
-    delete means->data(); delete means;
-    delete variances->data(); delete variances;
     return view;
 }
 
@@ -314,35 +471,38 @@ OneBitImageView* niblack_threshold(const T &src,
     if ((region_size < 1) || (region_size > std::min(src.nrows(), src.ncols())))
         throw std::out_of_range("niblack_threshold: region_size out of range");
 
-    // Compute regional statistics.
-    const FloatImageView* means = mean_filter(src, region_size);
-    const FloatImageView* variances = variance_filter(src, *means, region_size);
+    // Regional statistics are computed row by row.
+    region_sums<T> sums(src, region_size);
 
     typedef ImageFactory<OneBitImageView>::data_type data_type;
     typedef ImageFactory<OneBitImageView>::view_type view_type;
     data_type* data = new data_type(src.size(), src.origin());
     view_type* view = new view_type(*data);
 
-    for (coord_t y = 0; y < src.nrows(); ++y) {
-        for (coord_t x = 0; x < src.ncols(); ++x) {
+    const OneBitPixel black_pixel = black(*view);
+    const OneBitPixel white_pixel = white(*view);
+    typename T::const_row_iterator sr = src.row_begin();
+    view_type::row_iterator vr = view->row_begin();
+    for (coord_t y = 0; y < src.nrows(); ++y, ++sr, ++vr) {
+        sums.row(y);
+        typename T::const_col_iterator s = sr.begin();
+        view_type::col_iterator v = vr.begin();
+        for (coord_t x = 0; s != sr.end(); ++x, ++s, ++v) {
             // Check global thresholds and then threshold adaptively.
-            FloatPixel pixel_value = (FloatPixel)src.get(Point(x, y));
+            FloatPixel pixel_value = (FloatPixel)*s;
             if (pixel_value < (FloatPixel)lower_bound) {
-                view->set(Point(x, y), black(*view));
+                *v = black_pixel;
             } else if (pixel_value >= (FloatPixel)upper_bound) {
-                view->set(Point(x, y), white(*view));
+                *v = white_pixel;
             } else {
-                FloatPixel mean = means->get(Point(x, y));
-                FloatPixel deviation = std::sqrt(variances->get(Point(x, y)));
+                FloatPixel mean = sums.mean(x);
+                FloatPixel deviation = std::sqrt(sums.variance(x, mean));
                 FloatPixel threshold = mean + sensitivity * deviation;
-                view->set(Point(x, y), 
-                          pixel_value > threshold ? white(*view) : black(*view));
+                *v = pixel_value > threshold ? white_pixel : black_pixel;
             }
         }
     }
 
-    delete means->data(); delete means;
-    delete variances->data(); delete variances;
     return view;
 }
 
@@ -365,41 +525,226 @@ OneBitImageView* sauvola_threshold(const T &src,
     if ((region_size < 1) || (region_size > std::min(src.nrows(), src.ncols())))
         throw std::out_of_range("niblack_threshold: region_size out of range");
 
-    // Compute regional statistics.
-    const FloatImageView* means = mean_filter(src, region_size);
-    const FloatImageView* variances = variance_filter(src, *means, region_size);
+    // Regional statistics are computed row by row.
+    region_sums<T> sums(src, region_size);
 
     typedef ImageFactory<OneBitImageView>::data_type data_type;
     typedef ImageFactory<OneBitImageView>::view_type view_type;
     data_type* data = new data_type(src.size(), src.origin());
     view_type* view = new view_type(*data);
 
-    for (coord_t y = 0; y < src.nrows(); ++y) {
-        for (coord_t x = 0; x < src.ncols(); ++x) {
+    const OneBitPixel black_pixel = black(*view);
+    const OneBitPixel white_pixel = white(*view);
+    typename T::const_row_iterator sr = src.row_begin();
+    view_type::row_iterator vr = view->row_begin();
+    for (coord_t y = 0; y < src.nrows(); ++y, ++sr, ++vr) {
+        sums.row(y);
+        typename T::const_col_iterator s = sr.begin();
+        view_type::col_iterator v = vr.begin();
+        for (coord_t x = 0; s != sr.end(); ++x, ++s, ++v) {
             // Check global thresholds and then threshold adaptively.
-            FloatPixel pixel_value = (FloatPixel)src.get(Point(x, y));
+            FloatPixel pixel_value = (FloatPixel)*s;
             if (pixel_value < (FloatPixel)lower_bound) {
-                view->set(Point(x, y), black(*view));
+                *v = black_pixel;
             } else if (pixel_value >= (FloatPixel)upper_bound) {
-                view->set(Point(x, y), white(*view));
+                *v = white_pixel;
             } else {
-                FloatPixel mean = means->get(Point(x, y));
-                FloatPixel deviation = std::sqrt(variances->get(Point(x, y)));
+                FloatPixel mean = sums.mean(x);
+                FloatPixel deviation = std::sqrt(sums.variance(x, mean));
                 FloatPixel adjusted_deviation 
                     = 1.0 - deviation / (FloatPixel)dynamic_range;
                 FloatPixel threshold 
                     = mean + (1.0 - sensitivity * adjusted_deviation);
-                view->set(Point(x, y), 
-                          pixel_value > threshold ? white(*view) : black(*view));
+                *v = pixel_value > threshold ? white_pixel : black_pixel;
             }
         }
     }
 
-    delete means->data(); delete means;
-    delete variances->data(); delete variances;
     return view;
 }
 
+/* OneBit tiled_binarization(Image src, Binarizer binarize, size_t halo,
+ *                           int threads);
+ *
+ * Runs a local binarizer on tiles of the image on several threads (0 for
+ * the OpenMP default) and assembles the results.  The binarizer is called
+ * with a view of a tile extended by halo pixels on each side (clipped to
+ * the image) and returns a OneBit image of the same size, of which only
+ * the tile is kept.  When the threshold of a pixel only depends on the
+ * pixels at most halo pixels away, the result is the same as that of the
+ * binarizer on the whole image.  The extended tiles are also at least
+ * 2 * halo + 1 pixels wide and high, so that they are never smaller than
+ * the region of the binarizer.
+ */
+template<class T, class Binarizer>
+OneBitImageView* tiled_binarization(const T &src, const Binarizer &binarize,
+                                    size_t halo, int threads)
+{
+    if (threads <= 0) {
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#else
+        threads = 1;
+#endif
+    }
+
+    typedef typename ImageFactory<T>::view_type src_view_type;
+    typedef ImageFactory<OneBitImageView>::data_type data_type;
+    typedef ImageFactory<OneBitImageView>::view_type view_type;
+    data_type* data = new data_type(src.size(), src.origin());
+    view_type* view = new view_type(*data);
+
+    const size_t tile_size = std::max((size_t)256, 4 * halo);
+    const size_t min_size = 2 * halo + 1;
+    const size_t tiles_x = (src.ncols() + tile_size - 1) / tile_size;
+    const size_t tiles_y = (src.nrows() + tile_size - 1) / tile_size;
+    const long ntiles = (long)(tiles_x * tiles_y);
+
+    ThreadException error;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+    for (long i = 0; i < ntiles; ++i) {
+        try {
+            // the tile and its extension, relative to src
+            size_t x0 = (i % tiles_x) * tile_size;
+            size_t y0 = (i / tiles_x) * tile_size;
+            size_t x1 = std::min(x0 + tile_size, src.ncols());
+            size_t y1 = std::min(y0 + tile_size, src.nrows());
+            size_t ex0 = x0 - std::min(x0, halo);
+            size_t ey0 = y0 - std::min(y0, halo);
+            size_t ex1 = std::min(std::max(x1 + halo, ex0 + min_size),
+                                  src.ncols());
+            size_t ey1 = std::min(std::max(y1 + halo, ey0 + min_size),
+                                  src.nrows());
+            ex0 = ex1 - std::min(ex1, std::max(ex1 - ex0, min_size));
+            ey0 = ey1 - std::min(ey1, std::max(ey1 - ey0, min_size));
+
+            src_view_type tile(*src.data(),
+                               Point(src.offset_x() + ex0,
+                                     src.offset_y() + ey0),
+                               Dim(ex1 - ex0, ey1 - ey0));
+            OneBitImageView* result = binarize(tile);
+            for (size_t y = y0; y < y1; ++y)
+                for (size_t x = x0; x < x1; ++x)
+                    view->set(Point(x, y),
+                              result->get(Point(x - ex0, y - ey0)));
+            delete result->data();
+            delete result;
+        } catch (...) {
+            error.keep();
+        }
+    }
+
+    if (!error.empty()) {
+        delete view;
+        delete data;
+        error.rethrow();
+    }
+    return view;
+}
+
+/* Binarizer for tiled_binarization that calls niblack_threshold. */
+template<class T>
+struct niblack_binarizer
+{
+    size_t region_size;
+    double sensitivity;
+    int lower_bound, upper_bound;
+
+    niblack_binarizer(size_t region_size, double sensitivity,
+                      int lower_bound, int upper_bound)
+        : region_size(region_size), sensitivity(sensitivity),
+          lower_bound(lower_bound), upper_bound(upper_bound) {}
+
+    OneBitImageView* operator()(const T &tile) const
+        {
+            return niblack_threshold(tile, region_size, sensitivity,
+                                     lower_bound, upper_bound);
+        }
+};
+
+/* Binarizer for tiled_binarization that calls sauvola_threshold. */
+template<class T>
+struct sauvola_binarizer
+{
+    size_t region_size;
+    double sensitivity;
+    int dynamic_range, lower_bound, upper_bound;
+
+    sauvola_binarizer(size_t region_size, double sensitivity,
+                      int dynamic_range, int lower_bound, int upper_bound)
+        : region_size(region_size), sensitivity(sensitivity),
+          dynamic_range(dynamic_range), lower_bound(lower_bound),
+          upper_bound(upper_bound) {}
+
+    OneBitImageView* operator()(const T &tile) const
+        {
+            return sauvola_threshold(tile, region_size, sensitivity,
+                                     dynamic_range, lower_bound, upper_bound);
+        }
+};
+
+/*
+ * OneBit niblack_threshold(GreyScale src, ..., int threads);
+ *
+ * niblack_threshold on tiles of the image on the given number of threads
+ * (0 for the OpenMP default).  The result does not depend on the number
+ * of threads.
+ */
+template<class T>
+OneBitImageView* niblack_threshold(const T &src, 
+                                   size_t region_size, 
+                                   double sensitivity,
+                                   int lower_bound,
+                                   int upper_bound,
+                                   int threads)
+{
+    if ((region_size < 1) || (region_size > std::min(src.nrows(), src.ncols())))
+        throw std::out_of_range("niblack_threshold: region_size out of range");
+    if (threads == 1)
+        return niblack_threshold(src, region_size, sensitivity,
+                                 lower_bound, upper_bound);
+    typedef typename ImageFactory<T>::view_type view_type;
+    return tiled_binarization(src,
+                              niblack_binarizer<view_type>(region_size,
+                                                           sensitivity,
+                                                           lower_bound,
+                                                           upper_bound),
+                              region_size / 2, threads);
+}
+
+/*
+ * OneBit sauvola_threshold(GreyScale src, ..., int threads);
+ *
+ * sauvola_threshold on tiles of the image on the given number of threads
+ * (0 for the OpenMP default).  The result does not depend on the number
+ * of threads.
+ */
+template<class T>
+OneBitImageView* sauvola_threshold(const T &src, 
+                                   size_t region_size, 
+                                   double sensitivity,
+                                   int dynamic_range,
+                                   int lower_bound,
+                                   int upper_bound,
+                                   int threads)
+{
+    if ((region_size < 1) || (region_size > std::min(src.nrows(), src.ncols())))
+        throw std::out_of_range("sauvola_threshold: region_size out of range");
+    if (threads == 1)
+        return sauvola_threshold(src, region_size, sensitivity, dynamic_range,
+                                 lower_bound, upper_bound);
+    typedef typename ImageFactory<T>::view_type view_type;
+    return tiled_binarization(src,
+                              sauvola_binarizer<view_type>(region_size,
+                                                           sensitivity,
+                                                           dynamic_range,
+                                                           lower_bound,
+                                                           upper_bound),
+                              region_size / 2, threads);
+}
+
 /* 
  * Image* gatos_background(Image src, size_t region_size);
  */
@@ -413,61 +758,99 @@ T* gatos_background(const T &src,
     if (src.size() != binarization.size())
         throw std::invalid_argument("gatos_background: sizes must match");
  
-    size_t half_region_size = region_size / 2;
-
-    typename ImageFactory<T>::view_type* scopy 
-        = ImageFactory<T>::new_view(src);
-    typename ImageFactory<U>::view_type* bcopy
-        = ImageFactory<U>::new_view(binarization);
-
-    typedef std::pair<unsigned int, FloatPixel> gatos_pair;
     typedef typename T::value_type src_value_type;
-    typedef typename U::value_type binarization_value_type;
-
     typedef typename ImageFactory<T>::data_type data_type;
     typedef typename ImageFactory<T>::view_type view_type;
     data_type* data = new data_type(src.size(), src.origin());
     view_type* view = new view_type(*data);
 
+    // The background pixels of the regions are counted and summed with
+    // running sums, so that each pixel costs O(1) whatever the region size.
+    background_sums<T, U> sums(src, binarization, region_size);
     for (coord_t y = 0; y < src.nrows(); ++y) {
+        sums.row(y);
         for (coord_t x = 0; x < src.ncols(); ++x) {
             if (is_white(binarization.get(Point(x, y)))) {
                 view->set(Point(x, y), src.get(Point(x, y)));
             } else {
-                // Define the region.
-                Point ul((coord_t)std::max(0, (int)x - (int)half_region_size),
-                         (coord_t)std::max(0, (int)y - (int)half_region_size));
-                Point lr((coord_t)std::min(x + half_region_size, src.ncols() - 1),
-                         (coord_t)std::min(y + half_region_size, src.nrows() - 1));
-                scopy->rect_set(ul, lr);
-                bcopy->rect_set(ul, lr);
-                // Count and accumulate background pixels.
-                gatos_pair sums =
-                    std::inner_product(bcopy->vec_begin(),
-                                       bcopy->vec_end(),
-                                       scopy->vec_begin(),
-                                       gatos_pair(0, 0.0),
-                                       pair_plus<gatos_pair>(),
-                                       gatos_accumulate
-                                       <
-                                       gatos_pair,
-                                       binarization_value_type,
-                                       src_value_type
-                                       >());
+                size_t count = sums.count(x);
                 view->set(Point(x, y), 
-                          sums.first > 0
-                          ? (src_value_type)(sums.second / sums.first)
+                          count > 0
+                          ? (src_value_type)(sums.sum(x) / count)
                           : white(src));
             }
         }
     }
 
-    delete scopy;
-    delete bcopy;
     return view;
 }
 
 
+/* The parameters of gatos_threshold that do not depend on q, p1 and p2,
+ * gathered in one pass over the images: delta, the average distance
+ * between foreground and background, and b, the average background.  As
+ * before, the difference of source and background is taken in the pixel
+ * type.
+ */
+template<class T, class U>
+void gatos_statistics(const T &src, 
+                      const T &background, 
+                      const U &binarization,
+                      double &delta,
+                      double &b)
+{
+    if (src.size() != background.size())
+        throw std::invalid_argument("gatos_threshold: sizes must match");
+    if (background.size() != binarization.size())
+        throw std::invalid_argument("gatos_threshold: sizes must match");
+
+    typedef typename T::value_type value_type;
+    double difference_sum = 0.0, background_sum = 0.0;
+    size_t foreground_count = 0, background_count = 0;
+    typename T::const_row_iterator sr = src.row_begin();
+    typename T::const_row_iterator gr = background.row_begin();
+    typename U::const_row_iterator br = binarization.row_begin();
+    for (; sr != src.row_end(); ++sr, ++gr, ++br) {
+        typename T::const_col_iterator s = sr.begin(), g = gr.begin();
+        typename U::const_col_iterator m = br.begin();
+        for (; s != sr.end(); ++s, ++g, ++m) {
+            difference_sum += (double)(value_type)(*s - *g);
+            if (is_black(*m)) {
+                ++foreground_count;
+            } else {
+                ++background_count;
+                background_sum += (double)*g;
+            }
+        }
+    }
+    delta = difference_sum / (double)foreground_count;
+    b = background_sum / (double)background_count;
+}
+
+template<class T>
+OneBitImageView* gatos_threshold(const T &src, 
+                                 const T &background, 
+                                 const gatos_thresholder<typename T::value_type> &black)
+{
+    typedef ImageFactory<OneBitImageView>::data_type data_type;
+    typedef ImageFactory<OneBitImageView>::view_type view_type;
+    data_type* data = new data_type(src.size(), src.origin());
+    view_type* view = new view_type(*data);
+
+    typename T::const_row_iterator sr = src.row_begin();
+    typename T::const_row_iterator gr = background.row_begin();
+    view_type::row_iterator vr = view->row_begin();
+    for (; sr != src.row_end(); ++sr, ++gr, ++vr) {
+        typename T::const_col_iterator s = sr.begin(), g = gr.begin();
+        view_type::col_iterator v = vr.begin();
+        for (; s != sr.end(); ++s, ++g, ++v)
+            *v = black(*s, *g) ? pixel_traits<OneBitPixel>::black()
+                               : pixel_traits<OneBitPixel>::white();
+    }
+
+    return view;
+}
+
 /*
  * Image gatos_threshold(Image src, 
  *                       Image background, 
@@ -484,58 +867,41 @@ OneBitImageView* gatos_threshold(const T &src,
                                  double p1,
                                  double p2)
 {
-    if (src.size() != background.size())
-        throw std::invalid_argument("gatos_threshold: sizes must match");
-    if (background.size() != binarization.size())
-        throw std::invalid_argument("gatos_threshold: sizes must match");
-
-    typedef std::pair<unsigned int, FloatPixel> gatos_pair;
-    typedef typename T::value_type base_value_type;
-    typedef typename U::value_type binarization_value_type;
-
-    double delta_numerator 
-        = std::inner_product(src.vec_begin(),
-                             src.vec_end(),
-                             background.vec_begin(),
-                             (double)0,
-                             double_plus<base_value_type>(),
-                             std::minus<base_value_type>());
-    unsigned int delta_denominator
-        = std::count_if(binarization.vec_begin(),
-                        binarization.vec_end(),
-                        is_black<binarization_value_type>);
-    double delta = delta_numerator / (double)delta_denominator;
-                             
-    gatos_pair b_sums
-        = std::inner_product(binarization.vec_begin(),
-                             binarization.vec_end(),
-                             background.vec_begin(),
-                             gatos_pair(0, 0.0),
-                             pair_plus<gatos_pair>(),
-                             gatos_accumulate
-                             <
-                             gatos_pair,
-                             binarization_value_type,
-                             base_value_type
-                             >());
-    double b = (double)b_sums.second / (double)b_sums.first;
-
-    typedef ImageFactory<OneBitImageView>::data_type data_type;
-    typedef ImageFactory<OneBitImageView>::view_type view_type;
-    data_type* data = new data_type(src.size(), src.origin());
-    view_type* view = new view_type(*data);
-
-    std::transform(src.vec_begin(), 
-                   src.vec_end(),
-                   background.vec_begin(),
-                   view->vec_begin(),
-                   gatos_thresholder
-                   <
-                   typename T::value_type, 
-                   typename U::value_type
-                   >(q, delta, b, p1, p2));
+    double delta, b;
+    gatos_statistics(src, background, binarization, delta, b);
+    return gatos_threshold(src, background,
+                           gatos_thresholder<typename T::value_type>(q, delta, b, p1, p2));
+}
 
-    return view;
+/*
+ * ImageList gatos_threshold_sweep(Image src, 
+ *                                 Image background, 
+ *                                 Image binarization,
+ *                                 FloatVector q,
+ *                                 FloatVector p1,
+ *                                 FloatVector p2);
+ *
+ * gatos_threshold for each parameter triple (q[i], p1[i], p2[i]), with
+ * the statistics gathered only once.
+ */
+template<class T, class U>
+ImageList* gatos_threshold_sweep(const T &src, 
+                                 const T &background, 
+                                 const U &binarization,
+                                 FloatVector* q,
+                                 FloatVector* p1,
+                                 FloatVector* p2)
+{
+    if (q->size() != p1->size() || q->size() != p2->size())
+        throw std::invalid_argument("gatos_threshold_sweep: q, p1 and p2 must have the same length");
+    double delta, b;
+    gatos_statistics(src, background, binarization, delta, b);
+    ImageList* result = new ImageList();
+    for (size_t i = 0; i < q->size(); ++i)
+        result->push_back(gatos_threshold(src, background,
+                                          gatos_thresholder<typename T::value_type>
+                                          ((*q)[i], delta, b, (*p1)[i], (*p2)[i])));
+    return result;
 }
 
 
@@ -783,6 +1149,194 @@ inline int wr1_g (int diff, int *g)
 }
 
 
+/* The tables and steps of white_rohrer_threshold.
+ *
+ * The horizontal running average Y runs through the whole image in
+ * raster order (it is carried over from the end of each row to the
+ * start of the next), so it is computed serially, a band of rows at a
+ * time.  Given the values of Y of a band, the vertical running averages
+ * Z of the columns and the thresholds of the pixels are independent from
+ * column to column, and are computed in parallel on slices of the
+ * columns.  Z is kept in the order in which the lookahead visits the
+ * columns (starting after the column 1 + x_lookahead of XITE), so that
+ * the step k of a row updates Z[k] and thresholds the pixel k + 1.
+ */
+namespace WhiteRohrerDetail {
+  // factor * f(diff) / 100 (with f from wr1_f or wr1_g) for the
+  // differences in [-256, 255]
+  inline void scaled_table(const int* tab, int tab_offset, int factor,
+                           int* table) {
+    for (int diff = -256; diff < 256; ++diff)
+      table[diff + 256] = factor * -tab[tab_offset - diff] / 100;
+  }
+
+  // table[diff], where the differences are clamped to [-256, 255] when
+  // Checked
+  template<bool Checked>
+  inline int lookup(const int* table, int diff) {
+    if (Checked)
+      diff = std::min(std::max(diff, -256), 255);
+    return table[diff + 256];
+  }
+
+  // whether the running averages a + table[v - a] of the values v in
+  // [vlo, vhi] stay in [lo, hi] once there, with differences in the
+  // table, so that their lookups need not be checked
+  inline bool stays_in(const int* table, int lo, int hi, int vlo, int vhi) {
+    for (int a = lo; a <= hi; ++a)
+      for (int v = vlo; v <= vhi; ++v) {
+        int diff = v - a;
+        if (diff < -256 || diff > 255)
+          return false;
+        int next = a + table[diff + 256];
+        if (next < lo || next > hi)
+          return false;
+      }
+    return true;
+  }
+
+  // bias_factor * wr1_bias(z, offset) / 100, tabulated for the usual z
+  class Thresholds {
+  public:
+    Thresholds(int bias_factor, int offset)
+      : m_bias_factor(bias_factor), m_offset(offset), m_table(LOW + HIGH) {
+      for (int z = -LOW; z < HIGH; ++z)
+        m_table[z + LOW] = bias_factor * wr1_bias(z, offset) / 100;
+    }
+    int operator()(int z) const {
+      size_t i = (size_t)(z + LOW);
+      if (i < m_table.size())
+        return m_table[i];
+      return m_bias_factor * wr1_bias(z, m_offset) / 100;
+    }
+  private:
+    enum { LOW = 2048, HIGH = 2560 };
+    int m_bias_factor, m_offset;
+    std::vector<int> m_table;
+  };
+
+  // the pixels by their index in raster order, the column after the
+  // last one being the first of the next row; XITE reads a row past the
+  // image, which here repeats the last pixel
+  template<class T>
+  class RasterPixels {
+  public:
+    typedef typename T::value_type value_type;
+    RasterPixels(const T& image)
+      : m_rows(image.nrows()), m_ncols(image.ncols()),
+        m_last((long)(image.nrows() * image.ncols()) - 1) {
+      for (size_t y = 0; y < image.nrows(); ++y)
+        m_rows[y] = image[y];
+    }
+    int operator()(long i) const {
+      if (i > m_last)
+        i = m_last;
+      return m_rows[i / m_ncols][i % m_ncols];
+    }
+    // the pixels from index i on, n of them at most, in the same row
+    // (or the last pixel, repeated, past the image)
+    const value_type* run(long i, long& n, bool& repeated) const {
+      long col = i % m_ncols;
+      n = std::min(n, m_ncols - col);
+      repeated = i > m_last;
+      if (repeated)
+        return &m_rows.back()[m_ncols - 1];
+      return m_rows[i / m_ncols] + col;
+    }
+    const value_type* operator[](long y) const { return m_rows[y]; }
+  private:
+    std::vector<const value_type*> m_rows;
+    long m_ncols, m_last;
+  };
+
+  // image_mean and image_variance in a single pass: the sums of the
+  // pixels and their squares are integers, and thus the same in any order
+  template<class T>
+  void mean_and_variance(const RasterPixels<T>& pixels, long nrows,
+                         long ncols, double& mean, double& variance) {
+    typedef typename T::value_type value_type;
+    // runs of pixels whose sums fit in an unsigned int
+    const long chunk = std::numeric_limits<value_type>::max() <= 255 ? 4096 : 1;
+    double sum = 0.0, squares = 0.0;
+    for (long y = 0; y < nrows; ++y) {
+      const value_type* row = pixels[y];
+      for (long x0 = 0; x0 < ncols; x0 += chunk) {
+        unsigned int run_sum = 0, run_squares = 0;
+        for (long x = x0, x1 = std::min(x0 + chunk, ncols); x < x1; ++x) {
+          unsigned int v = row[x];
+          run_sum += v;
+          run_squares += v * v;
+        }
+        sum += run_sum;
+        squares += run_squares;
+      }
+    }
+    double area = (double)(size_t)(nrows * ncols);
+    mean = sum / area;
+    variance = squares / area - mean * mean;
+  }
+
+  // the horizontal running average Y over the n pixels from the raster
+  // index next on
+  template<bool Checked, class T>
+  void horizontal_averages(const RasterPixels<T>& pixels, const int* f_table,
+                           long next, long n, int& Y, int* out) {
+    typedef typename T::value_type value_type;
+    for (long end = next + n; next < end; ) {
+      long run = end - next;
+      bool repeated;
+      const value_type* u = pixels.run(next, run, repeated);
+      if (repeated)
+        for (long j = 0; j < run; ++j) {
+          Y += lookup<Checked>(f_table, (int)*u - Y);
+          *out++ = Y;
+        }
+      else
+        for (long j = 0; j < run; ++j) {
+          Y += lookup<Checked>(f_table, (int)u[j] - Y);
+          *out++ = Y;
+        }
+      next += run;
+    }
+  }
+
+  // the vertical running averages Z and the thresholded pixels of the
+  // rows y0..y0 + nrows - 1, given their horizontal averages, on slices
+  // of the columns
+  template<bool Checked, class T>
+  void vertical_averages(const RasterPixels<T>& pixels, const int* g_table,
+                         const Thresholds& thresholds, const int* band_Y,
+                         long y0, long nrows, long xsize, int* Z,
+                         OneBitImageView& view, int threads) {
+    typedef typename T::value_type value_type;
+    const OneBitPixel black_pixel = black(view);
+    const OneBitPixel white_pixel = white(view);
+    const long slices = std::min((long)threads, xsize);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+    for (long s = 0; s < slices; ++s) {
+      const long k0 = s * xsize / slices;
+      const long k1 = (s + 1) * xsize / slices;
+      const long k_end = std::min(k1, xsize - 1);
+      for (long r = 0; r < nrows; ++r) {
+        const int* row_Y = band_Y + r * xsize;
+        const value_type* src = pixels[y0 + r];
+        OneBitPixel* dst = view[y0 + r];
+        // the first pixel takes Z of the last step of the previous row
+        if (k1 == xsize)
+          dst[0] = src[0] < thresholds(Z[xsize - 1]) ? black_pixel : white_pixel;
+        for (long k = k0; k < k_end; ++k) {
+          Z[k] += lookup<Checked>(g_table, row_Y[k] - Z[k]);
+          dst[k + 1] = src[k + 1] < thresholds(Z[k]) ? black_pixel : white_pixel;
+        }
+        if (k1 == xsize)
+          Z[xsize - 1] += lookup<Checked>(g_table, row_Y[xsize - 1] - Z[xsize - 1]);
+      }
+    }
+  }
+}
+
 /*
  * OneBit white_rohrer_threshold(GreyScale src, 
  *                          int x_lookahead,
@@ -790,118 +1344,151 @@ inline int wr1_g (int diff, int *g)
  *                          int bias_mode,
  *                          int bias_factor,
  *                          int f_factor
- *                          int g_factor);
+ *                          int g_factor,
+ *                          int threads);
+ *
+ * The result does not depend on the number of threads (0 for the
+ * OpenMP default).
  */
 
 template<class T>
 OneBitImageView* white_rohrer_threshold (const T& in, int x_lookahead, int y_lookahead,
-	     int bias_mode, int bias_factor, int f_factor, int g_factor)
+	     int bias_mode, int bias_factor, int f_factor, int g_factor,
+	     int threads)
 {
-  int xsize, ysize;
-  int x, y;
-  int u;
-  int prevY;
-  int Y = 0;
-  int f, g;
-  int x_ahead, y_ahead;
-  int t;
-  int offset = wr1_params.WR1_BIAS;
-  //double mu, s_dev;
-  FloatPixel mu = 0.0;
-  FloatPixel  s_dev = 0.0; 
-  int *Z;
-  int n;
-
+  using namespace WhiteRohrerDetail;
+  typedef typename T::value_type value_type;
   typedef ImageFactory<OneBitImageView>::data_type data_type;
   typedef ImageFactory<OneBitImageView>::view_type view_type;
-  data_type* bin_data = new data_type(in.size(), in.origin());
-  view_type* bin_view = new view_type(*bin_data);  
-  
 
-  xsize = in.ncols();
-  ysize = in.nrows();
-  //  std::cout<<"sizes are "<<ysize<<","<<xsize<<std::endl;
+  if (x_lookahead < 0 || y_lookahead < 0)
+    throw std::range_error("white_rohrer_threshold: the lookaheads must not be negative.");
+  if (threads <= 0) {
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#else
+    threads = 1;
+#endif
+  }
+
+  const long xsize = in.ncols();
+  const long ysize = in.nrows();
   x_lookahead = x_lookahead % xsize;
 
-  if (bias_mode == 0) 
-  {
-    mu = image_mean(in);
-    s_dev = sqrt(image_variance(in));
-    offset = (int)(s_dev - 40) ;
-  } 
-  else 
+  int offset;
+  FloatPixel mu = 0.0;
+  const RasterPixels<T> pixels(in);
+  if (bias_mode == 0) {
+    FloatPixel variance;
+    mean_and_variance(pixels, ysize, xsize, mu, variance);
+    FloatPixel s_dev = sqrt(variance);
+    offset = (int)(s_dev - 40);
+  }
+  else
     offset = bias_mode;
 
-  Z = new int[2*xsize+1];
-  for(n = 0; n< 2*xsize+1; ++n)
-    Z[n] = 0;
-   
-  //Z[1] = prevY = (int)mu;
-  Z[0] = prevY = (int)mu;
+  int f_table[512], g_table[512];
+  scaled_table(wr1_params.wr1_f_tab, wr1_params.WR1_F_OFFSET, f_factor, f_table);
+  scaled_table(wr1_params.wr1_g_tab, wr1_params.WR1_G_OFFSET, g_factor, g_table);
+  const Thresholds thresholds(bias_factor, offset);
 
-   for (y=0; y< 1+y_lookahead; y++)
-   {
-      if (y < y_lookahead)
-	 t = xsize;
-      else
-	 t = x_lookahead;
-      for (x=0; x< t; x++)
-      {
-	 u = in.get(Point(x,y));
-	 wr1_f (u-prevY, &f);
-	 Y = prevY + f;
-	 if (y == 1)
-	    Z[x] = (int)mu;
-	 else
-	 {
-	    wr1_g(Y-Z[x], &g);
-	    Z[x] = Z[x] + g; 
-	 }
+  data_type* bin_data = new data_type(in.size(), in.origin());
+  view_type* bin_view = new view_type(*bin_data);
+  const OneBitPixel black_pixel = black(*bin_view);
+  const OneBitPixel white_pixel = white(*bin_view);
+
+  // the start of the running averages, on the first lookahead lines
+  // (with Z indexed by the columns 0..xsize of XITE)
+  const int start = (int)mu;
+  std::vector<int> columns(xsize + 1, 0);
+  columns[0] = start;
+  int Y = 0;
+  for (long y = 0; y < 1 + (long)y_lookahead; ++y) {
+    long t = y < y_lookahead ? xsize : x_lookahead;
+    for (long x = 0; x < t; ++x) {
+      int f, g;
+      wr1_f(pixels(std::min(y, ysize) * xsize + x) - start, &f);
+      Y = start + f;
+      if (y == 1)
+        columns[x] = start;
+      else {
+        wr1_g(Y - columns[x], &g);
+        columns[x] += g;
       }
-      
-   }
-   x_ahead = 1 + x_lookahead;
-   y_ahead = 1 + y_lookahead;
- 
-   for (y = 0; y < ysize; y++)
-   {
-      for (x = 0; x < xsize; x++)
-      {
-	 if (in.get(Point(x,y)) < (bias_factor  
-			     * wr1_bias(Z[x_ahead],offset) / 100))
-	 {
-	    bin_view->set(Point(x,y),black(*bin_view));
-	 }
-	 
-	 else	
-	 {
-	    bin_view->set(Point(x,y),white(*bin_view));
-	 }
-
-	 x_ahead++;
-	 if (x_ahead > xsize)
-	 {
-	    x_ahead = 1;
-	    y_ahead++;
-	 }
-	 if (y_ahead <= ysize)
-	 {
-	    prevY = Y;
-	    wr1_f(in.get(Point(x_ahead,y_ahead))-prevY, &f);    
-	    Y = prevY + f_factor * f / 100;
-	    wr1_g(Y-Z[x_ahead], &g);
-	    Z[x_ahead] = Z[x_ahead] + g_factor * g / 100;
-	 }
-	 else
-	    Z[x_ahead] = Z[x_ahead-1];
+    }
+  }
+
+  // Z in the order of the lookahead: step k of a row visits the column
+  // (ahead + k) % xsize + 1
+  const long ahead = 1 + x_lookahead;
+  std::vector<int> Z(xsize);
+  for (long k = 0; k < xsize; ++k)
+    Z[k] = columns[(ahead + k) % xsize + 1];
+  const int Z0 = columns[0];
+
+  // the raster index of the pixel read by the next step, and the last
+  // one that is read (later steps copy Z from the previous column)
+  long next = (1 + std::min((long)y_lookahead, ysize)) * xsize + ahead + 1;
+  const long last_read = (ysize + 1) * xsize;
+
+  // the lookups need no clamping when the averages stay in a range
+  const int max_value = std::numeric_limits<value_type>::max();
+  int Y_low = std::min(0, Y), Y_high = std::max(max_value, Y);
+  int Z_low = std::min(Y_low, *std::min_element(Z.begin(), Z.end()));
+  int Z_high = std::max(Y_high, *std::max_element(Z.begin(), Z.end()));
+  const bool checked =
+    !stays_in(f_table, Y_low, Y_high, 0, max_value) ||
+    !stays_in(g_table, Z_low, Z_high, Y_low, Y_high);
+
+  const long band_rows = std::max(1L, 65536 / xsize);
+  std::vector<int> band_Y;
+  long y = 0;
+  while (y < ysize) {
+    long band = 0;
+    while (band < band_rows && y + band < ysize &&
+           next + (band + 1) * xsize - 1 <= last_read)
+      ++band;
+
+    if (band == 0) {
+      // the last rows, of which some steps copy Z
+      const value_type* src = pixels[y];
+      OneBitPixel* dst = (*bin_view)[y];
+      for (long k = 0; k < xsize; ++k, ++next) {
+        if (k == xsize - 1)
+          dst[0] = src[0] < thresholds(Z[k]) ? black_pixel : white_pixel;
+        if (next <= last_read) {
+          Y += lookup<true>(f_table, pixels(next) - Y);
+          Z[k] += lookup<true>(g_table, Y - Z[k]);
+        }
+        else if ((ahead + k) % xsize == 0)
+          Z[k] = Z0;
+        else
+          Z[k] = Z[k == 0 ? xsize - 1 : k - 1];
+        if (k < xsize - 1)
+          dst[k + 1] = src[k + 1] < thresholds(Z[k]) ? black_pixel : white_pixel;
       }
-   }
- 
- delete [] Z;
- Z = NULL;
-  
- return bin_view;
+      ++y;
+      continue;
+    }
 
+    // the horizontal running average of the band, serially, then the
+    // columns in parallel
+    band_Y.resize(band * xsize);
+    if (checked) {
+      horizontal_averages<true>(pixels, f_table, next, band * xsize, Y, &band_Y[0]);
+      vertical_averages<true>(pixels, g_table, thresholds, &band_Y[0], y, band,
+                              xsize, &Z[0], *bin_view, threads);
+    }
+    else {
+      horizontal_averages<false>(pixels, f_table, next, band * xsize, Y, &band_Y[0]);
+      vertical_averages<false>(pixels, g_table, thresholds, &band_Y[0], y, band,
+                               xsize, &Z[0], *bin_view, threads);
+    }
+    y += band;
+    next += band * xsize;
+  }
+
+  return bin_view;
 }
 
 /*
@@ -931,160 +1518,143 @@ FloatVector* histogram_real_values(const T& image) {
     return values;
 }
 
+namespace BrinkDetail {
+  /*
+    The histogram of the pixels of an image, the values from levels - 1
+    on counting as levels - 1.
+  */
+  template<class T>
+  void histogram(const T& image, std::vector<double>& values) {
+    const size_t top = values.size() - 1;
+    std::fill(values.begin(), values.end(), 0.0);
+    typename T::const_vec_iterator p = image.vec_begin();
+    for (; p != image.vec_end(); ++p) {
+      size_t v = (size_t)*p;
+      values[v < top ? v : top] += 1.0;
+    }
+  }
+
+  /*
+    The minimum cross-entropy threshold of a histogram, or -1 when the
+    histogram has less than two (non zero) levels.
+
+    With the normalized histogram p, m_f(t) the first moment of the
+    levels g <= t and m_b(t) that of the levels g > t, the criterion of
+    the threshold t is the sum of
+
+      p[g] (m - g) (log(m) - log(g))
+
+    over the levels 0 < g <= t with m = m_f(t), and over the levels
+    g > t with m = m_b(t).  Expanded, both sums only need the
+    cumulative sums P, Q and H of p[g], p[g] log(g) and p[g] g log(g),
+    so that each threshold is evaluated in constant time instead of
+    summing over all levels.
+  */
+  inline int brink_level(const std::vector<double>& histo) {
+    const size_t levels = histo.size();
+    double total = 0.0;
+    size_t lo = levels, hi = 0;
+    for (size_t g = 0; g < levels; ++g) {
+      total += histo[g];
+      if (histo[g] > 0.0 && g > 0) {
+        lo = std::min(lo, g);
+        hi = g;
+      }
+    }
+    if (lo >= hi)
+      return -1;
+    const double inv_total = 1.0 / total;
+
+    // the sums over all levels
+    double m_all = 0.0, p_all = 0.0, q_all = 0.0, h_all = 0.0;
+    for (size_t g = lo; g <= hi; ++g) {
+      double p = histo[g] * inv_total, lg = std::log((double)g);
+      m_all += g * p;
+      p_all += p;
+      q_all += p * lg;
+      h_all += p * g * lg;
+    }
+
+    int best = -1;
+    double best_value = 0.0;
+    double m_f = 0.0, P = 0.0, Q = 0.0, H = 0.0;
+    // the thresholds with both moments non zero
+    for (size_t t = lo; t < hi; ++t) {
+      double p = histo[t] * inv_total, lg = std::log((double)t);
+      m_f += t * p;
+      P += p;
+      Q += p * lg;
+      H += p * t * lg;
+      double m_b = m_all - m_f;
+      if (m_f == 0.0 || m_b <= 0.0)
+        continue;
+      double lf = std::log(m_f), lb = std::log(m_b);
+      double value = m_f * lf * (P - 1.0) - m_f * Q + H
+        + m_b * lb * (p_all - P - 1.0) - m_b * (q_all - Q) + (h_all - H);
+      if (best < 0 || value < best_value) {
+        best = (int)t;
+        best_value = value;
+      }
+    }
+    return best;
+  }
+
+  // the levels of the histograms of the pixel types
+  template<class T>
+  size_t histogram_levels(const T&) {
+    return 256;
+  }
+
+  inline size_t histogram_levels(const Grey16ImageView&) {
+    return 65536;
+  }
+}
+
 /*
- *  Image* brink_threshold(const T& image);
+ *  Image* brink_threshold(GreyScale|Grey16 image, int region_size);
  *
  *  Calculates threshold for image with Brink and Pendock's minimum-cross    
- *  entropy method and returns corrected image.
+ *  entropy method and returns corrected image.  When region_size is
+ *  not 0, each region_size x region_size tile of the image is
+ *  thresholded with the threshold of its own histogram.
  *
  *  References: Brink, A., and Pendock, N. 1996. Minimum cross-entropy
  *  threshold selection. Pattern Recognition 29: 179-188. 
  *
  */
 template<class T>
-Image* brink_threshold(const T& image)
+Image* brink_threshold(const T& image, int region_size=0)
 {
-  int i,j;  // for iteration
-
-  static const size_t VEC_DBL_SZ = sizeof(double) * 256; //size of vector
-  unsigned long vecSum = 0;     // sum of histogram
-  double invHistSum;            // inverse of histogram sum
-  int Topt = 0;                 // threshold value
-  double locMin = numeric_limits<double>::max(); // local minimum
-  int isMinInit = 0;            // flat for minimum initialization
-
-  FloatVector *histoFV;
-  histoFV = histogram_real_values(image);   // compute gray histogram 
-  unsigned long histo[256];
-  for (i = 0; i < 256; i++)
-    histo[i] = (*histoFV)[i];   // copy from FloatVector to an array of longs
-  delete histoFV;
-
-  double pmf[256];          // pmf (i.e. normalized histogram)
-  double m_f[256];          // first foreground moment
-  double m_b[256];          // first background moment
-
-  double tmpVec1[256];      // temporary vector 1
-  double tmpVec2[256];      // temporary vector 2
-  double tmpVec3[256];      // temporary vector 3
-
-  double tmp1[256][256];    // temporary matrix 1
-  double tmp2[256][256];    // temporary matrix 2 
-  double tmp3[256][256];    // temporary matrix 3
-  double tmp4[256][256];    // temporary matrix 4
-
-  double tmpMat1[256][256];  // local temporary matrix 1
-  double tmpMat2[256][256];  // local temporary matrix 2
-  
-  // compute sum of the histogram
-  for (i = 0; i < 256; ++i)
-        vecSum += histo[i];
-        
-  // compute inverse of vecSum
-  invHistSum = 1.0 / vecSum;    
-
-  // compute normalized histogram (pmf)  
-  for (i = 0; i < 256; i++)
-    pmf[i] = histo[i] * invHistSum;     // equivalent to dividing by the sum, but faster!
-    
-  // compute foreground moment
-  m_f[0] = 0.0;
-  for (i = 1; i < 256; ++i)         
-    m_f[i] = i * pmf[i] + m_f[i - 1];
-
-  // compute background moment
-  memcpy(m_b, m_f, VEC_DBL_SZ);      
-
-  for (i = 0; i < 256; ++i)
-    m_b[i] = m_f[255] - m_b[i];     
-    
-  // compute brink entropy binarization
-  for (i = 0; i < 256; ++i)     
-  {
-    for (j = 0; j < 256; ++j)
-    {
-      tmp1[i][j] = m_f[j] / i;
-
-      if ((m_f[j] == 0) || (i == 0)) 
-      {
-        tmp2[i][j] = 0.0;               
-        tmp3[i][j] = 0.0;
-      }
-      else
-      {
-        tmp2[i][j] = log(tmp1[i][j]);
-        tmp3[i][j] = log(1.0 / tmp1[i][j]);;
+  using namespace BrinkDetail;
+  std::vector<double> histo(histogram_levels(image));
+  histogram(image, histo);
+  // the threshold is the level after the minimum (1 without one)
+  int level = brink_level(histo);
+  int global = level < 0 ? 1 : level + 1;
+  if (region_size <= 0)
+    return threshold(image, global, 0);
+
+  typedef typename T::value_type value_type;
+  typedef TypeIdImageFactory<ONEBIT, DENSE> fact_type;
+  typename fact_type::image_type* view = fact_type::create(image.origin(), image.dim());
+  for (size_t y0 = 0; y0 < image.nrows(); y0 += region_size) {
+    for (size_t x0 = 0; x0 < image.ncols(); x0 += region_size) {
+      Dim dim(std::min((size_t)region_size, image.ncols() - x0),
+              std::min((size_t)region_size, image.nrows() - y0));
+      T tile(image, Point(image.ul_x() + x0, image.ul_y() + y0), dim);
+      histogram(tile, histo);
+      level = brink_level(histo);
+      // tiles with a single level take the global threshold
+      value_type t = (value_type)(level < 0 ? global : level + 1);
+      for (size_t y = 0; y < dim.nrows(); ++y) {
+        const value_type* in = tile[y];
+        OneBitPixel* out = (*view)[y0 + y] + x0;
+        for (size_t x = 0; x < dim.ncols(); ++x)
+          out[x] = in[x] > t ? white(*view) : black(*view);
       }
-      tmp4[i][j] = pmf[i] * (m_f[j] * tmp2[i][j] + i * tmp3[i][j]);
     }
   }
-
-  // compute the diagonal of the cumulative sum of tmp4 and store result in tmpVec1
-  memcpy(tmpMat1[0], tmp4[0], VEC_DBL_SZ);   // copies first row of tmp4 to the first row of tmpMat1
-  for (i = 1; i < 256; ++i)         // get cumulative sum
-    for (j = 0; j < 256; ++j)
-      tmpMat1[i][j] = tmpMat1[i-1][j] + tmp4[i][j];
-    for (i = 0; i < 256; ++i)       // set to diagonal
-      tmpVec1[i] = tmpMat1[i][i];   // tmpVec1 is now the diagonal of the cumulative sum of tmp4
- 
-
-  // same operation but for background moment, NOTE: tmp1 through tmp4 get overwritten
-  for (i = 0; i < 256; ++i)     
-  {
-    for (j = 0; j < 256; ++j)
-    {
-      tmp1[i][j] = m_b[j] / i;          // tmpb0 = m_b_rep ./ g_rep;
-      if ((m_b[j] == 0) || (i == 0)) 
-      {
-        tmp2[i][j] = 0.0;               // replace inf or NaN values with 0
-        tmp3[i][j] = 0.0;
-            }
-            else
-            {  
-                tmp2[i][j] = log(tmp1[i][j]);
-                tmp3[i][j] = log(1.0 / tmp1[i][j]);;
-            }
-            tmp4[i][j] = pmf[i] * (m_b[j] * tmp2[i][j] + i * tmp3[i][j]);
-        }
-    }
-
-    // sum columns, subtract diagonal of cumulative sum of tmp4 
-    memcpy(tmpVec2, tmp4[0], VEC_DBL_SZ);   // copies first row of tmp4 to the first row of tmpMat2 
-    for (i = 1; i < 256; ++i)           
-        for (j = 0; j < 256; ++j)
-            tmpVec2[j] += tmp4[i][j];   // sums of columns of tmp4 and store result in tmpVec2
-
-    // compute the diagonal of the cumulative sum of tmp4 and store result in tmpVec1
-    memcpy(tmpMat2[0], tmp4[0], VEC_DBL_SZ);    // copies first row of tmp4 to the first row of tmpMat2 
-    for (i = 1; i < 256; ++i)       // get cumulative sum
-        for (j = 0; j < 256; ++j)
-          tmpMat2[i][j] = tmpMat2[i-1][j] + tmp4[i][j]; 
-    for (i = 0; i < 256; ++i)       // set to diagonal
-        tmpVec3[i] = tmpMat2[i][i]; // tmpVec3 is now the diagonal of the cumulative sum of tmpMat2
-
-    for (i = 0; i < 256; ++i)       
-        tmpVec2[i] -= tmpVec3[i];
-    for (int i = 0; i < 256; ++i)
-        tmpVec1[i] += tmpVec2[i];
-
-    // calculate the threshold value
-    for (i = 0; i < 256; ++i)
-    {
-        if (m_f[i] != 0 && m_b[i] != 0)
-        {
-            if (!isMinInit || tmpVec1[i] < locMin)
-            {
-                isMinInit = 1;
-                locMin = tmpVec1[i];    // gets a new minimum
-                Topt = i;
-            }
-        }
-    }
-        
-    Topt++; // DO I NEED TO ADD ONE
-    
-    // call threshold from threshold.hpp with image and Topt and return the output
-    return threshold(image, Topt, 0);   
+  return view;
 }
 
 #endif
@@ -27,6 +27,10 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <limits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace Gamera {
 
@@ -240,33 +244,89 @@ namespace Gamera {
     return view;	
   }
 
+  namespace ColorLabelsDetail {
+    /*
+      A hash table from the 24 bit colors to labels with open
+      addressing.  It only grows with the number of distinct colors,
+      which is small compared to the number of pixels.
+    */
+    class ColorTable {
+    public:
+      ColorTable() : m_keys(256, EMPTY), m_values(256), m_size(0) { }
+
+      // the label of the color, or 0 when the color is unknown
+      const unsigned int* find(unsigned int key) const {
+        size_t i = slot(key);
+        return (m_keys[i] == key) ? &m_values[i] : 0;
+      }
+
+      // adds the color unless it is known already
+      void insert(unsigned int key, unsigned int value) {
+        size_t i = slot(key);
+        if (m_keys[i] == key)
+          return;
+        m_keys[i] = key;
+        m_values[i] = value;
+        if (2 * ++m_size > m_keys.size())
+          grow();
+      }
+
+    private:
+      static const unsigned int EMPTY = 0xffffffff;
+
+      size_t slot(unsigned int key) const {
+        size_t mask = m_keys.size() - 1;
+        size_t i = (key * 2654435761u) & mask;
+        while (m_keys[i] != key && m_keys[i] != EMPTY)
+          i = (i + 1) & mask;
+        return i;
+      }
+
+      void grow() {
+        std::vector<unsigned int> keys(2 * m_keys.size(), EMPTY);
+        std::vector<unsigned int> values(keys.size());
+        keys.swap(m_keys);
+        values.swap(m_values);
+        m_size = 0;
+        for (size_t i = 0; i < keys.size(); ++i)
+          if (keys[i] != EMPTY)
+            insert(keys[i], values[i]);
+      }
+
+      std::vector<unsigned int> m_keys, m_values;
+      size_t m_size;
+    };
+
+    inline unsigned int key(const RGBPixel& value) {
+      return (value.red() << 16) | (value.green() << 8) | value.blue();
+    }
+  }
+
   // replace colors with labels
   // Christoph Dalitz and Hasan Yildiz
   template<class T>
   Image* colors_to_labels(const T &src, PyObject* obj) {
+    using ColorLabelsDetail::key;
     OneBitImageData* dest_data = new OneBitImageData(src.size(), src.origin());
     OneBitImageView* dest = new OneBitImageView(*dest_data, src.origin(), src.size());
 
-    typedef typename T::value_type value_type;
-    value_type value;
     typedef typename OneBitImageView::value_type onebit_value_type;
 
-    std::string buf;
     onebit_value_type label;
     // highest label that can be stored in Onebit pixel type
     onebit_value_type max_value = std::numeric_limits<onebit_value_type>::max();
 
-    std::map<unsigned int, unsigned int> pixel;
-    std::map<unsigned int, unsigned int>::iterator iter;
+    ColorLabelsDetail::ColorTable pixel;
 
     PyObject *itemKey, *itemValue;
-    unsigned int testKey;
     Py_ssize_t pos = 0;
+    int nrows = (int)src.nrows();
+    size_t ncols = src.ncols();
 
     // mapping given how colors are to be mapped to labels
     if (PyDict_Check(obj)) {
 
-      // copy color->label map to C++ map
+      // copy color->label map to the color table
       long given_label;
       label = 1;
       while (PyDict_Next(obj, &pos, &itemKey, &itemValue)) {
@@ -281,21 +341,30 @@ namespace Gamera {
         }
         
         RGBPixel *rgbpixel = ((RGBPixelObject *) itemKey)->m_x;
-        testKey = (rgbpixel->red() << 16) | (rgbpixel->green() << 8) | rgbpixel->blue();
-        
         given_label = PyInt_AsLong(itemValue);
         if (given_label < 0)
           throw std::invalid_argument("Labels must be positive integers.");
-        if (pixel.find(testKey) == pixel.end()) 
-          pixel[testKey] = given_label;
+        pixel.insert(key(*rgbpixel), (unsigned int)given_label);
       }
 
-      for (size_t y=0; y<src.nrows(); ++y) {
-        for (size_t x=0; x<src.ncols(); ++x) {
-          value = src.get(Point(x,y));
-          testKey = (value.red() << 16) | (value.green() << 8) | value.blue();
-          if (pixel.find(testKey) != pixel.end()) 
-            dest->set(Point(x,y), pixel.find(testKey)->second);
+      // the table is only read, so bands of rows of large images are
+      // labeled on several threads
+      int threads = 1;
+#ifdef _OPENMP
+      if (double(nrows) * ncols >= double(1 << 22))
+        threads = std::max(1, std::min(omp_get_max_threads(), nrows));
+#endif
+      int y;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(threads)
+#endif
+      for (y = 0; y < nrows; ++y) {
+        typename T::const_row_iterator row = src.row_begin() + y;
+        OneBitPixel* out = (*dest)[y];
+        for (typename T::const_col_iterator col = row.begin(); col != row.end(); ++col, ++out) {
+          const unsigned int* found = pixel.find(key(*col));
+          if (found != 0)
+            *out = onebit_value_type(*found);
         }
       }
     }
@@ -304,27 +373,33 @@ namespace Gamera {
     else if (obj == Py_None) {
       label = 2;
       // special colors black and white
-      pixel[0] = 1;
-      pixel[(255<<16) | (255<<8) | 255] = 0;
-      for (size_t y=0; y<src.nrows(); ++y) {
-        for (size_t x=0; x<src.ncols(); ++x) {
-
-          value = src.get(Point(x,y));  
-          testKey = (value.red() << 16) | (value.green() << 8) | value.blue();
-          
-          if ( !(value.red()==0 && value.green()==0 && value.blue()==0) &&
-               !(value.red()==255 && value.green()==255 && value.blue()==255) &&
-               pixel.find(testKey) == pixel.end() ) {
-            if (label == max_value) {
-              char msg[128];
-              sprintf(msg, "More RGB colors than available labels (%i).", max_value);
-              throw std::range_error(msg);
+      pixel.insert(0, 1);
+      pixel.insert((255<<16) | (255<<8) | 255, 0);
+      // colors mostly come in runs, so the label of the last color is kept
+      unsigned int last_key = 0, last_label = 1;
+      typename T::const_row_iterator row = src.row_begin();
+      for (int y = 0; y < nrows; ++y, ++row) {
+        OneBitPixel* out = (*dest)[y];
+        for (typename T::const_col_iterator col = row.begin(); col != row.end(); ++col, ++out) {
+          unsigned int testKey = key(*col);
+          if (testKey != last_key) {
+            const unsigned int* found = pixel.find(testKey);
+            if (found == 0) {
+              if (label == max_value) {
+                char msg[128];
+                sprintf(msg, "More RGB colors than available labels (%i).", max_value);
+                throw std::range_error(msg);
+              }
+              pixel.insert(testKey, label);
+              last_label = label++;
+            } else {
+              last_label = *found;
             }
-            pixel[testKey] = label++;
+            last_key = testKey;
           }
 
           // replace color with label
-          dest->set(Point(x,y), pixel.find(testKey)->second);
+          *out = onebit_value_type(last_label);
         }
       }
     }
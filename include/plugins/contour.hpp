@@ -23,6 +23,9 @@
 #define mgd10222004_contours
 
 #include "gamera.hpp"
+#include <vector>
+#include <algorithm>
+#include <limits>
 
 namespace Gamera {
   template<class T>
@@ -117,162 +120,178 @@ namespace Gamera {
     return output;
   }
 
-  // etxraction of sample points from the contour
-  // author: Oliver Christen
-  template<class T>
-  PointVector * contour_samplepoints(const T& cc, int percentage) {
-    PointVector *output = new PointVector();
-    PointVector *contour_points = new PointVector();
-    PointVector::iterator found;
-
-    FloatVector *top = contour_top(cc);
-    FloatVector *right = contour_right(cc);
-    FloatVector *bottom = contour_bottom(cc);
-    FloatVector *left = contour_left(cc);
-    FloatVector::iterator it;
+  namespace ContourDetail {
+    // the sample points of contour_samplepoints from the four contours
+    // of an image of size ncols x nrows at origin
+    inline void samplepoints(const Point& origin, size_t ncols, size_t nrows,
+                             const FloatVector* top, const FloatVector* right,
+                             const FloatVector* bottom, const FloatVector* left,
+                             int percentage, PointVector* output) {
+      PointVector *contour_points = new PointVector();
+      PointVector::iterator found;
+      FloatVector::const_iterator it;
+      // the points already in contour_points
+      std::vector<bool> seen(ncols * nrows, false);
 
-    int x, y, i;
-    float d;
+      int x, y, i;
+      float d;
 
-    unsigned int top_d = std::numeric_limits<unsigned int>::max() ;
-    unsigned int top_max_x = 0;
-    unsigned int top_max_y = 0;
+      unsigned int top_d = std::numeric_limits<unsigned int>::max() ;
+      unsigned int top_max_x = 0;
+      unsigned int top_max_y = 0;
 
-    unsigned int right_d = std::numeric_limits<unsigned int>::max();
-    unsigned int right_max_x = 0;
-    unsigned int right_max_y = 0;
+      unsigned int right_d = std::numeric_limits<unsigned int>::max();
+      unsigned int right_max_x = 0;
+      unsigned int right_max_y = 0;
 
-    unsigned int bottom_d = std::numeric_limits<unsigned int>::max();
-    unsigned int bottom_max_x = 0;
-    unsigned int bottom_max_y = 0;
+      unsigned int bottom_d = std::numeric_limits<unsigned int>::max();
+      unsigned int bottom_max_x = 0;
+      unsigned int bottom_max_y = 0;
 
-    unsigned int left_d = std::numeric_limits<unsigned int>::max();
-    unsigned int left_max_x = 0; 
-    unsigned int left_max_y = 0;
+      unsigned int left_d = std::numeric_limits<unsigned int>::max();
+      unsigned int left_max_x = 0; 
+      unsigned int left_max_y = 0;
 
-    // top
-    i = 0;for(it = top->begin() ; it != top->end() ; it++, i++) {
-      if( *it == std::numeric_limits<double>::infinity() ) {
-        continue;
-      }
-      d = *it;
-      x = cc.offset_x() + i;
-      y = cc.offset_y() + d;
-      if( d < top_d) {
-        top_d = d;
-        top_max_x = x;
-        top_max_y = y;	
-      }
-      found = find(contour_points->begin(), contour_points->end(), Point(x,y));
-      if(found == contour_points->end()) {
-        contour_points->push_back( Point(x,y) );
-      }
-    }
-    // right
-    i = 0;for(it = right->begin() ; it != right->end() ; it++, i++) {
-      if( *it == std::numeric_limits<double>::infinity() ) {
-        continue;
-      }
-      d = *it;
-      x = cc.offset_x() + cc.ncols() - d;
-      y = cc.offset_y() + i;
-      if( d < right_d) {
-        right_d = d;
-        right_max_x = x;
-        right_max_y = y;
-      }
-      found = find(contour_points->begin(), contour_points->end(), Point(x,y));
-      if(found == contour_points->end()) {
-        contour_points->push_back( Point(x,y) );
-      }
-    }
-    // bottom
-    i = 0;for(it = bottom->begin() ; it != bottom->end() ; it++, i++) {
-      if( *it == std::numeric_limits<double>::infinity() ) {
-        continue;
-      }
-      d = *it;
-      x = cc.offset_x() + i;
-      y = cc.offset_y() + cc.nrows() - d;
-      if( d <= bottom_d) {
-        bottom_d = d;
-        bottom_max_x = x;
-        bottom_max_y = y;
-      }
-      found = find(contour_points->begin(), contour_points->end(), Point(x,y));
-      if(found == contour_points->end()) {
-        contour_points->push_back( Point(x,y) );
+      // top
+      i = 0;for(it = top->begin() ; it != top->end() ; it++, i++) {
+        if( *it == std::numeric_limits<double>::infinity() ) {
+          continue;
+        }
+        d = *it;
+        x = origin.x() + i;
+        y = origin.y() + d;
+        if( d < top_d) {
+          top_d = d;
+          top_max_x = x;
+          top_max_y = y;	
+        }
+        if (!seen[(y - origin.y()) * ncols + (x - origin.x())]) {
+          seen[(y - origin.y()) * ncols + (x - origin.x())] = true;
+          contour_points->push_back( Point(x,y) );
+        }
       }
-    }
-    // left
-    i = 0;for(it = left->begin() ; it != left->end() ; it++, i++) {
-      if( *it == std::numeric_limits<double>::infinity() ) {
-        continue;
+      // right
+      i = 0;for(it = right->begin() ; it != right->end() ; it++, i++) {
+        if( *it == std::numeric_limits<double>::infinity() ) {
+          continue;
+        }
+        d = *it;
+        x = origin.x() + ncols - d;
+        y = origin.y() + i;
+        if( d < right_d) {
+          right_d = d;
+          right_max_x = x;
+          right_max_y = y;
+        }
+        if (!seen[(y - origin.y()) * ncols + (x - origin.x())]) {
+          seen[(y - origin.y()) * ncols + (x - origin.x())] = true;
+          contour_points->push_back( Point(x,y) );
+        }
       }
-      d = *it;
-      x = cc.offset_x() + d;
-      y = cc.offset_y() + i;
-      if( d <= left_d) {
-        left_d = d;
-        left_max_x = x;
-        left_max_y = y;
+      // bottom
+      i = 0;for(it = bottom->begin() ; it != bottom->end() ; it++, i++) {
+        if( *it == std::numeric_limits<double>::infinity() ) {
+          continue;
+        }
+        d = *it;
+        x = origin.x() + i;
+        y = origin.y() + nrows - d;
+        if( d <= bottom_d) {
+          bottom_d = d;
+          bottom_max_x = x;
+          bottom_max_y = y;
+        }
+        if (!seen[(y - origin.y()) * ncols + (x - origin.x())]) {
+          seen[(y - origin.y()) * ncols + (x - origin.x())] = true;
+          contour_points->push_back( Point(x,y) );
+        }
       }
-      found = find(contour_points->begin(), contour_points->end(), Point(x,y));
-      if(found == contour_points->end()) {
-        contour_points->push_back( Point(x,y) );
+      // left
+      i = 0;for(it = left->begin() ; it != left->end() ; it++, i++) {
+        if( *it == std::numeric_limits<double>::infinity() ) {
+          continue;
+        }
+        d = *it;
+        x = origin.x() + d;
+        y = origin.y() + i;
+        if( d <= left_d) {
+          left_d = d;
+          left_max_x = x;
+          left_max_y = y;
+        }
+        if (!seen[(y - origin.y()) * ncols + (x - origin.x())]) {
+          seen[(y - origin.y()) * ncols + (x - origin.x())] = true;
+          contour_points->push_back( Point(x,y) );
+        }
       }
-    }
 
-    // add only every 100/percentage-th point
-    double delta = 100.0/percentage;
-    double step = 0.0;
-    unsigned int offset = 0; // to avoid overflow and rounding errors
-    unsigned int ii = 0;
-    while (ii < contour_points->size()) {
-      output->push_back( (*contour_points)[ii] );
-      step += delta;
-      if (step > 100.0) {
-        step -= 100.0;
-        offset += 100;
+      // add only every 100/percentage-th point
+      double delta = 100.0/percentage;
+      double step = 0.0;
+      unsigned int offset = 0; // to avoid overflow and rounding errors
+      unsigned int ii = 0;
+      while (ii < contour_points->size()) {
+        output->push_back( (*contour_points)[ii] );
+        step += delta;
+        if (step > 100.0) {
+          step -= 100.0;
+          offset += 100;
+        }
+        ii = offset + (unsigned int)step;
       }
-      ii = offset + (unsigned int)step;
-    }
 
-    // add the four outer extreme points ...
-    // ... top
-    if (top_d != std::numeric_limits<unsigned int>::max()) {
-      found = find(output->begin(), output->end(), Point(top_max_x, top_max_y));
-      if(found == output->end()) {
-        output->push_back( Point(top_max_x, top_max_y) );
+      // add the four outer extreme points ...
+      // ... top
+      if (top_d != std::numeric_limits<unsigned int>::max()) {
+        found = find(output->begin(), output->end(), Point(top_max_x, top_max_y));
+        if(found == output->end()) {
+          output->push_back( Point(top_max_x, top_max_y) );
+        }
       }
-    }
-    // ... right
-    if (right_d != std::numeric_limits<unsigned int>::max()) {
-      found = find(output->begin(), output->end(), Point(right_max_x, right_max_y));
-      if(found == output->end()) {
-        output->push_back( Point(right_max_x, right_max_y) );
+      // ... right
+      if (right_d != std::numeric_limits<unsigned int>::max()) {
+        found = find(output->begin(), output->end(), Point(right_max_x, right_max_y));
+        if(found == output->end()) {
+          output->push_back( Point(right_max_x, right_max_y) );
+        }
       }
-    }
-    // ... bottom
-    if (bottom_d != std::numeric_limits<unsigned int>::max()) {
-      found = find(output->begin(), output->end(), Point(bottom_max_x, bottom_max_y));
-      if(found == output->end()) {
-        output->push_back( Point(bottom_max_x, bottom_max_y) );
+      // ... bottom
+      if (bottom_d != std::numeric_limits<unsigned int>::max()) {
+        found = find(output->begin(), output->end(), Point(bottom_max_x, bottom_max_y));
+        if(found == output->end()) {
+          output->push_back( Point(bottom_max_x, bottom_max_y) );
+        }
       }
-    }
-    // ... left
-    if (left_d != std::numeric_limits<unsigned int>::max()) {
-      found = find(output->begin(), output->end(), Point(left_max_x, left_max_y));
-      if(found == output->end()) {
-        output->push_back( Point(left_max_x, left_max_y) );
+      // ... left
+      if (left_d != std::numeric_limits<unsigned int>::max()) {
+        found = find(output->begin(), output->end(), Point(left_max_x, left_max_y));
+        if(found == output->end()) {
+          output->push_back( Point(left_max_x, left_max_y) );
+        }
       }
+
+      delete contour_points;
     }
+  }
+
+  // etxraction of sample points from the contour
+  // author: Oliver Christen
+  template<class T>
+  PointVector * contour_samplepoints(const T& cc, int percentage) {
+    PointVector *output = new PointVector();
+
+    FloatVector *top = contour_top(cc);
+    FloatVector *right = contour_right(cc);
+    FloatVector *bottom = contour_bottom(cc);
+    FloatVector *left = contour_left(cc);
+
+    ContourDetail::samplepoints(cc.origin(), cc.ncols(), cc.nrows(),
+                                top, right, bottom, left, percentage, output);
 
     delete top;
     delete right;
     delete bottom;
     delete left;
-    delete contour_points;
 
     return output;
   }
@@ -402,7 +421,207 @@ namespace Gamera {
       v_contour->pop_back(); // start pixel is doublette
   
     return v_contour;
-  }  
+  }
+
+  /*
+    The outer and hole contours of all components of a labeled image,
+    as found by contour_tracing.  The points of all contours are stored
+    one after another in points, in page coordinates; contour i is
+    points[start[i]] ... points[start[i+1] - 1], belongs to the
+    component labels[i] and is the contour of a hole if holes[i].
+  */
+  struct ContourSet {
+    PointVector points;
+    std::vector<size_t> start;
+    std::vector<OneBitPixel> labels;
+    std::vector<bool> holes;
+    // the contour indices sorted by label (see find)
+    std::vector<size_t> by_label;
+
+    ContourSet() : start(1, 0) { }
+    size_t size() const { return labels.size(); }
+    PointVector::const_iterator begin(size_t i) const { return points.begin() + start[i]; }
+    PointVector::const_iterator end(size_t i) const { return points.begin() + start[i + 1]; }
+
+    struct LabelLess {
+      LabelLess(const ContourSet& s) : m_s(s) { }
+      bool operator()(size_t i, OneBitPixel l) const { return m_s.labels[i] < l; }
+      bool operator()(OneBitPixel l, size_t i) const { return l < m_s.labels[i]; }
+      bool operator()(size_t i, size_t j) const { return m_s.labels[i] < m_s.labels[j]; }
+      const ContourSet& m_s;
+    };
+    // the range of by_label holding the contours of label
+    std::pair<std::vector<size_t>::const_iterator, std::vector<size_t>::const_iterator>
+    find(OneBitPixel label) const {
+      return std::equal_range(by_label.begin(), by_label.end(), label, LabelLess(*this));
+    }
+  };
+
+  namespace ContourDetail {
+    // the 8 neighbors in clockwise order, starting east
+    const int neighbor_x[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+    const int neighbor_y[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+    /*
+      Follows the border of label through the pixel start of the padded
+      label image, beginning the search at the background neighbor in
+      direction from (step 3 of Suzuki and Abe's algorithm).  Border
+      pixels are marked -1 in marks when their east neighbor is
+      background and has been examined, and 1 otherwise.
+    */
+    inline void follow_border(const std::vector<OneBitPixel>& labels, std::vector<signed char>& marks,
+                              size_t stride, size_t start, int from, OneBitPixel label,
+                              const Point& origin, PointVector& points) {
+      long offsets[8];
+      for (int k = 0; k < 8; ++k)
+        offsets[k] = neighbor_y[k] * long(stride) + neighbor_x[k];
+      // the first foreground neighbor clockwise
+      int k1 = -1;
+      for (int i = 0; i < 8; ++i) {
+        if (labels[start + offsets[(from + i) % 8]] == label) {
+          k1 = (from + i) % 8;
+          break;
+        }
+      }
+      if (k1 < 0) {
+        marks[start] = -1;
+        points.push_back(Point(origin.x() + start % stride - 1, origin.y() + start / stride - 1));
+        return;
+      }
+      size_t first = start + offsets[k1];
+      size_t current = start;
+      int back = k1; // the direction of the previous pixel
+      while (true) {
+        points.push_back(Point(origin.x() + current % stride - 1, origin.y() + current / stride - 1));
+        // the next foreground neighbor counterclockwise
+        bool east = false;
+        int k = back;
+        for (int i = 1; i <= 8; ++i) {
+          k = (back + 8 - i) % 8;
+          if (labels[current + offsets[k]] == label)
+            break;
+          if (k == 0)
+            east = true;
+        }
+        if (east)
+          marks[current] = -1;
+        else if (marks[current] == 0)
+          marks[current] = 1;
+        size_t next = current + offsets[k];
+        if (next == start && current == first)
+          break;
+        current = next;
+        back = (k + 4) % 8;
+      }
+    }
+  }
+
+  /*
+    Traces the outer and hole contours of every component of a labeled
+    image in one raster scan, with the border following algorithm by
+    Suzuki and Abe applied to all labels at once: a pixel starts an
+    outer contour when it is not yet on a contour and its west neighbor
+    has another label, and a hole contour when its east neighbor has
+    another label and it is not on a contour that already passed that
+    neighbor.  Each contour is an 8-connected sequence of the border
+    pixels of its component.
+
+    See S. Suzuki, K. Abe: *Topological structural analysis of
+    digitized binary images by border following.* Computer Vision,
+    Graphics, and Image Processing 30, pp. 32-46, 1985.
+  */
+  template<class T>
+  void contour_tracing(const T& image, ContourSet& out) {
+    // the labels with a frame of background pixels
+    size_t stride = image.ncols() + 2;
+    std::vector<OneBitPixel> labels(stride * (image.nrows() + 2), 0);
+    std::vector<signed char> marks(labels.size(), 0);
+    typename T::const_row_iterator row = image.row_begin();
+    for (size_t y = 1; row != image.row_end(); ++row, ++y) {
+      size_t i = y * stride + 1;
+      for (typename T::const_row_iterator::iterator col = row.begin(); col != row.end(); ++col, ++i)
+        labels[i] = *col;
+    }
+
+    out.points.clear();
+    out.start.assign(1, 0);
+    out.labels.clear();
+    out.holes.clear();
+    for (size_t y = 1; y <= image.nrows(); ++y) {
+      for (size_t i = y * stride + 1; i < (y + 1) * stride - 1; ++i) {
+        OneBitPixel label = labels[i];
+        if (label == 0)
+          continue;
+        bool hole;
+        if (marks[i] == 0 && labels[i - 1] != label)
+          hole = false;
+        else if (marks[i] >= 0 && labels[i + 1] != label)
+          hole = true;
+        else
+          continue;
+        ContourDetail::follow_border(labels, marks, stride, i, hole ? 0 : 4, label,
+                                     image.origin(), out.points);
+        out.start.push_back(out.points.size());
+        out.labels.push_back(label);
+        out.holes.push_back(hole);
+      }
+    }
+    out.by_label.resize(out.size());
+    for (size_t i = 0; i < out.size(); ++i)
+      out.by_label[i] = i;
+    std::stable_sort(out.by_label.begin(), out.by_label.end(), ContourSet::LabelLess(out));
+  }
+
+  /*
+    The points of contour_samplepoints of the component cc, read from
+    the contours of its label: the topmost and bottommost contour
+    points in each column and the leftmost and rightmost ones in each
+    row of cc are the same as the contour_top etc. of cc.
+  */
+  inline void contour_samplepoints(const ContourSet& contours, const Cc& cc, int percentage,
+                                   PointVector& output) {
+    const double inf = std::numeric_limits<double>::infinity();
+    FloatVector top(cc.ncols(), inf), bottom(cc.ncols(), inf);
+    FloatVector left(cc.nrows(), inf), right(cc.nrows(), inf);
+    std::pair<std::vector<size_t>::const_iterator, std::vector<size_t>::const_iterator>
+      range = contours.find(cc.label());
+    for (std::vector<size_t>::const_iterator i = range.first; i != range.second; ++i) {
+      for (PointVector::const_iterator p = contours.begin(*i); p != contours.end(*i); ++p) {
+        if (p->x() < cc.ul_x() || p->x() > cc.lr_x() || p->y() < cc.ul_y() || p->y() > cc.lr_y())
+          continue;
+        size_t c = p->x() - cc.ul_x(), r = p->y() - cc.ul_y();
+        if (top[c] == inf || r < top[c])
+          top[c] = r;
+        if (bottom[c] == inf || cc.nrows() - r < bottom[c])
+          bottom[c] = cc.nrows() - r;
+        if (left[r] == inf || c < left[r])
+          left[r] = c;
+        if (right[r] == inf || cc.ncols() - c < right[r])
+          right[r] = cc.ncols() - c;
+      }
+    }
+    output.clear();
+    ContourDetail::samplepoints(cc.origin(), cc.ncols(), cc.nrows(),
+                                &top, &right, &bottom, &left, percentage, &output);
+  }
+
+  /*
+    The contours of contour_tracing as a Python list of tuples (label,
+    hole, points).
+  */
+  template<class T>
+  PyObject* labeled_contours(const T& image) {
+    ContourSet contours;
+    contour_tracing(image, contours);
+    PyObject* result = PyList_New(contours.size());
+    for (size_t i = 0; i < contours.size(); ++i) {
+      PointVector points(contours.begin(i), contours.end(i));
+      PyObject* py_points = PointVector_to_python(&points);
+      PyList_SET_ITEM(result, i, Py_BuildValue(CHAR_PTR_CAST "(iiN)", int(contours.labels[i]),
+                                               int(contours.holes[i]), py_points));
+    }
+    return result;
+  }
 
 }
 #endif
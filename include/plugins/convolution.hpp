@@ -22,34 +22,727 @@
 #define mgd_convolution
 
 #include "gamera.hpp"
+#include "fourier.hpp"
 #include "vigra/stdconvolution.hxx"
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace Gamera;
 
-template<class T, class U>
-typename ImageFactory<T>::view_type* convolve(const T& src, const U& k, int border_mode) {
-  if (k.nrows() > src.nrows() || k.ncols() > src.ncols())
-    throw std::runtime_error("The image must be bigger than the kernel.");
+/*
+  Native convolution of GreyScale, Grey16 and Float images.
 
-  typename ImageFactory<T>::data_type* dest_data =
-    new typename ImageFactory<T>::data_type(src.size(), src.ul());
-  typename ImageFactory<T>::view_type* dest =
-    new typename ImageFactory<T>::view_type(*dest_data);
+  The pixels are summed in double precision with the kernel taps in the
+  same order as in vigra's convolveLine, and the borders are treated as
+  there, so that a 1D convolution gives the same result as vigra.  The
+  inner loops run along a row of pixels for a single tap, which lets the
+  compiler vectorize them.  A 2D kernel that is the outer product of a
+  column and a row (such as a Gaussian or a Sobel kernel) is convolved as
+  a row pass followed by a column pass over bands of rows, with the
+  intermediate rows kept in double precision.  Other kernels are
+  convolved through the Fourier transform when they are large (see
+  FftConvolution) and by vigra otherwise, as are the other pixel types.
+*/
+namespace ConvolutionDetail {
 
-  // I originally had the following two lines abstracted out in a function,
-  // but that seemed to choke and crash gcc 3.3.2
-  try {
+  template<class Pixel>
+  struct native_pixel { enum { value = 0 }; };
+  template<>
+  struct native_pixel<GreyScalePixel> { enum { value = 1 }; };
+  template<>
+  struct native_pixel<Grey16Pixel> { enum { value = 1 }; };
+  template<>
+  struct native_pixel<FloatPixel> { enum { value = 1 }; };
+
+  // A 1D kernel, taps[i] being the weight at offset left + i.
+  struct Kernel {
+    std::vector<double> taps;
+    int left, right;
+    double weight(int offset) const { return taps[offset - left]; }
+  };
+
+  inline int resolve_threads(int threads) {
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+    }
+    return threads;
+  }
+
+  // The index of position i in a signal of length n after the border
+  // treatment, or -1 when the position is clipped.
+  inline long border_index(long i, long n, int border) {
+    if (i >= 0 && i < n)
+      return i;
+    switch (border) {
+    case BORDER_TREATMENT_REPEAT:
+      return i < 0 ? 0 : n - 1;
+    case BORDER_TREATMENT_REFLECT:
+      return i < 0 ? -i : 2 * (n - 1) - i;
+    case BORDER_TREATMENT_WRAP:
+      return i < 0 ? i + n : i - n;
+    default:
+      return -1;
+    }
+  }
+
+  inline double kernel_norm(const Kernel& k) {
+    double norm = 0.0;
+    for (int j = k.left; j <= k.right; ++j)
+      norm += k.weight(j);
+    if (norm == 0.0)
+      throw std::runtime_error("Cannot use BORDER_TREATMENT_CLIP with a kernel that sums to zero.");
+    return norm;
+  }
+
+  // The renormalization of position x of a signal of length n when the
+  // taps outside of the signal are clipped (1 where the kernel fits).
+  inline double clip_factor(const Kernel& k, long x, long n, double norm) {
+    double clipped = 0.0;
+    if (x < k.right) {
+      for (long j = k.right; j > x; --j)
+        clipped += k.weight(j);
+    } else if (n - x <= -k.left) {
+      for (long j = x - n; j >= k.left; --j)
+        clipped += k.weight(j);
+    } else
+      return 1.0;
+    return norm / (norm - clipped);
+  }
+
+  // The positions [begin, end) of a signal of length n that are written.
+  inline void written_range(const Kernel& k, long n, int border,
+                            long& begin, long& end) {
+    begin = 0;
+    end = n;
+    if (border == BORDER_TREATMENT_AVOID) {
+      begin = k.right;
+      end = n + k.left;
+    }
+  }
+
+  /*
+    Convolves the n values at in into out[begin, end).  ext is scratch
+    space for n + k.right - k.left values, clip the renormalization of
+    each position for BORDER_TREATMENT_CLIP.
+  */
+  inline void convolve_line(const double* in, double* out, long n,
+                            const Kernel& k, int border,
+                            const std::vector<double>& clip, double* ext) {
+    // ext[i] is the value at position i - k.right
+    const long pad = k.right;
+    const long m = n + k.right - k.left;
+    std::copy(in, in + n, ext + pad);
+    for (long i = 0; i < pad; ++i) {
+      long s = border_index(i - pad, n, border);
+      ext[i] = s < 0 ? 0.0 : in[s];
+    }
+    for (long i = pad + n; i < m; ++i) {
+      long s = border_index(i - pad, n, border);
+      ext[i] = s < 0 ? 0.0 : in[s];
+    }
+    long begin, end;
+    written_range(k, n, border, begin, end);
+    std::fill(out + begin, out + end, 0.0);
+    for (int j = k.right; j >= k.left; --j) {
+      const double w = k.weight(j);
+      const double* shifted = ext + pad - j;
+      for (long x = begin; x < end; ++x)
+        out[x] += w * shifted[x];
+    }
+    if (border == BORDER_TREATMENT_CLIP) {
+      for (long x = 0; x < std::min((long)k.right, n); ++x)
+        out[x] *= clip[x];
+      for (long x = std::max(n + k.left, (long)k.right); x < n; ++x)
+        out[x] *= clip[x];
+    }
+  }
+
+  inline std::vector<double> clip_factors(const Kernel& k, long n, int border) {
+    std::vector<double> clip;
+    if (border == BORDER_TREATMENT_CLIP) {
+      double norm = kernel_norm(k);
+      clip.resize(n);
+      for (long x = 0; x < n; ++x)
+        clip[x] = clip_factor(k, x, n, norm);
+    }
+    return clip;
+  }
+
+  template<class Iter>
+  inline void load_row(Iter row, long n, double* out) {
+    for (long x = 0; x < n; ++x)
+      out[x] = row[x];
+  }
+
+  template<class Iter>
+  inline void store_row(const double* in, long begin, long end, Iter row) {
+    typedef typename std::iterator_traits<Iter>::value_type value_type;
+    for (long x = begin; x < end; ++x)
+      row[x] = vigra::NumericTraits<value_type>::fromRealPromote(in[x]);
+  }
+
+  // Convolves the rows of src with k.
+  template<class T, class V>
+  void convolve_rows(const T& src, V& dest, const Kernel& k, int border,
+                     int threads) {
+    const long nrows = src.nrows(), ncols = src.ncols();
+    const std::vector<double> clip = clip_factors(k, ncols, border);
+    long begin, end;
+    written_range(k, ncols, border, begin, end);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+    {
+      std::vector<double> in(ncols), out(ncols);
+      std::vector<double> ext(ncols + k.right - k.left);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+      for (long y = 0; y < nrows; ++y) {
+        load_row(src[y], ncols, &in[0]);
+        convolve_line(&in[0], &out[0], ncols, k, border, clip, &ext[0]);
+        store_row(&out[0], begin, end, dest[y]);
+      }
+    }
+  }
+
+  // The column pass for the output rows [y0, y1): rows(u) is the row at
+  // position u (before the border treatment) of a signal of nrows rows.
+  // The columns are processed in tiles so that the sums stay in cache.
+  template<class Rows, class V>
+  void convolve_columns(const Rows& rows, V& dest, long y0, long y1,
+                        long nrows, long x0, long x1, const Kernel& k,
+                        int border, double norm, double* sums) {
+    const long tile = 1024;
+    for (long y = y0; y < y1; ++y) {
+      double factor = 1.0;
+      if (border == BORDER_TREATMENT_CLIP)
+        factor = clip_factor(k, y, nrows, norm);
+      for (long t0 = x0; t0 < x1; t0 += tile) {
+        const long t1 = std::min(t0 + tile, x1);
+        std::fill(sums + t0, sums + t1, 0.0);
+        for (int j = k.right; j >= k.left; --j) {
+          long r = border_index(y - j, nrows, border);
+          if (r < 0)
+            continue;
+          const double w = k.weight(j);
+          typename Rows::iterator row = rows(y - j, r);
+          for (long x = t0; x < t1; ++x)
+            sums[x] += w * row[x];
+        }
+        if (factor != 1.0)
+          for (long x = t0; x < t1; ++x)
+            sums[x] *= factor;
+      }
+      store_row(sums, x0, x1, dest[y]);
+    }
+  }
+
+  // The source rows of a column pass, r being the row after the border
+  // treatment.
+  template<class T>
+  struct ImageRows {
+    typedef const typename T::value_type* iterator;
+    const T& image;
+    ImageRows(const T& image_) : image(image_) { }
+    iterator operator()(long, long r) const { return image[r]; }
+  };
+
+  // The rows [first, first + count) of the row pass, stored by position
+  // before the border treatment.
+  struct BandRows {
+    typedef const double* iterator;
+    const double* band;
+    long first, ncols;
+    iterator operator()(long u, long) const {
+      return band + (u - first) * ncols;
+    }
+  };
+
+  // Convolves the columns of src with k.
+  template<class T, class V>
+  void convolve_columns(const T& src, V& dest, const Kernel& k, int border,
+                        int threads) {
+    const long nrows = src.nrows(), ncols = src.ncols();
+    const double norm = (border == BORDER_TREATMENT_CLIP) ? kernel_norm(k) : 0.0;
+    long begin, end;
+    written_range(k, nrows, border, begin, end);
+    const ImageRows<T> rows(src);
+    const long band = 32;
+    const long nbands = (end - begin + band - 1) / band;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+    {
+      std::vector<double> sums(ncols);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+      for (long b = 0; b < nbands; ++b) {
+        const long y0 = begin + b * band;
+        convolve_columns(rows, dest, y0, std::min(y0 + band, end), nrows,
+                         0, ncols, k, border, norm, &sums[0]);
+      }
+    }
+  }
+
+  // Convolves src with the outer product of ky and kx, band by band: the
+  // rows each band needs are convolved with kx, then their columns with ky.
+  template<class T, class V>
+  void convolve_separable(const T& src, V& dest, const Kernel& kx,
+                          const Kernel& ky, int border, int threads) {
+    const long nrows = src.nrows(), ncols = src.ncols();
+    const std::vector<double> clip = clip_factors(kx, ncols, border);
+    const double norm = (border == BORDER_TREATMENT_CLIP) ? kernel_norm(ky) : 0.0;
+    long x0, x1, y0, y1;
+    written_range(kx, ncols, border, x0, x1);
+    written_range(ky, nrows, border, y0, y1);
+    const long halo = ky.right - ky.left;
+    const long band = std::max(32L, 4 * halo);
+    const long nbands = (y1 - y0 + band - 1) / band;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+    {
+      std::vector<double> in(ncols), sums(ncols);
+      std::vector<double> ext(ncols + kx.right - kx.left);
+      std::vector<double> rows((band + halo) * ncols);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+      for (long b = 0; b < nbands; ++b) {
+        const long top = y0 + b * band;
+        const long bottom = std::min(top + band, y1);
+        BandRows band_rows;
+        band_rows.band = &rows[0];
+        band_rows.first = top - ky.right;
+        band_rows.ncols = ncols;
+        for (long u = band_rows.first; u < bottom - ky.left; ++u) {
+          long r = border_index(u, nrows, border);
+          if (r < 0)
+            continue;
+          load_row(src[r], ncols, &in[0]);
+          convolve_line(&in[0], &rows[(u - band_rows.first) * ncols], ncols,
+                        kx, border, clip, &ext[0]);
+        }
+        convolve_columns(band_rows, dest, top, bottom, nrows, x0, x1, ky,
+                         border, norm, &sums[0]);
+      }
+    }
+  }
+
+  // A one-row kernel image as a 1D kernel with the given extent.
+  template<class U>
+  Kernel row_kernel(const U& k, int left, int right) {
+    if (right < 0)
+      throw std::runtime_error("The 1D kernel is too short.");
+    Kernel result;
+    result.left = left;
+    result.right = right;
+    for (int j = left; j <= right; ++j)
+      result.taps.push_back(k.get(Point(j - left, 0)));
+    return result;
+  }
+
+  /*
+    Splits the 2D kernel k into kx and ky when it is their outer product
+    up to rounding, in which case the row through the largest weight
+    becomes kx.
+  */
+  template<class U>
+  bool separate_kernel(const U& k, Kernel& kx, Kernel& ky) {
+    const long nrows = k.nrows(), ncols = k.ncols();
+    long pr = 0, pc = 0;
+    double largest = 0.0;
+    for (long y = 0; y < nrows; ++y)
+      for (long x = 0; x < ncols; ++x)
+        if (std::abs((double)k.get(Point(x, y))) > largest) {
+          largest = std::abs((double)k.get(Point(x, y)));
+          pr = y;
+          pc = x;
+        }
+    if (largest == 0.0)
+      return false;
+    kx.left = -int(k.center_x());
+    kx.right = int(ncols) - 1 - int(k.center_x());
+    ky.left = -int(k.center_y());
+    ky.right = int(nrows) - 1 - int(k.center_y());
+    kx.taps.resize(ncols);
+    ky.taps.resize(nrows);
+    const double pivot = k.get(Point(pc, pr));
+    for (long x = 0; x < ncols; ++x)
+      kx.taps[x] = k.get(Point(x, pr));
+    for (long y = 0; y < nrows; ++y)
+      ky.taps[y] = k.get(Point(pc, y)) / pivot;
+    const double tolerance = 1e-12 * largest;
+    for (long y = 0; y < nrows; ++y)
+      for (long x = 0; x < ncols; ++x)
+        if (std::abs(k.get(Point(x, y)) - ky.taps[y] * kx.taps[x]) > tolerance)
+          return false;
+    return true;
+  }
+
+  inline void check_border(int border_mode) {
+    if (border_mode < BORDER_TREATMENT_AVOID || border_mode > BORDER_TREATMENT_WRAP)
+      throw std::runtime_error("Unknown border treatment mode.");
+  }
+
+  /*
+    The kernel taps as doubles for vigra, which multiplies them with the
+    pixels.  There are no products of RGB or Complex pixels with a float,
+    as FloatPixel is when Gamera is built with GAMERA_FLOAT_SINGLE.
+  */
+  template<class U>
+  class KernelAccessor {
+  public:
+    typedef double value_type;
+    typedef double VALUETYPE;
+
+    template<class ITERATOR>
+    double operator()(ITERATOR const& i) const {
+      return m_accessor(i);
+    }
+
+    template<class ITERATOR, class DIFFERENCE>
+    double operator()(ITERATOR const& i, DIFFERENCE diff) const {
+      ITERATOR tmp = i + diff;
+      return m_accessor(tmp);
+    }
+
+    ImageAccessor<typename U::value_type> m_accessor;
+  };
+
+  template<class T, class U, class V>
+  void vigra_convolve(const T& src, const U& k, V& dest, int border_mode) {
+    // I originally had the following two lines abstracted out in a function,
+    // but that seemed to choke and crash gcc 3.3.2
     typename U::ConstIterator center = k.upperLeft() + Diff2D(k.center_x(), k.center_y());
     tuple5<
       typename U::ConstIterator,
-      typename choose_accessor<U>::accessor,
+      KernelAccessor<U>,
       Diff2D, Diff2D, BorderTreatmentMode> kernel
-      (center, choose_accessor<U>::make_accessor(k), 
+      (center, KernelAccessor<U>(), 
        Diff2D(-k.center_x(), -k.center_y()),
        Diff2D(k.width() - k.center_x(), k.height() - k.center_y()),
        (BorderTreatmentMode)border_mode);
     
-    vigra::convolveImage(src_image_range(src), dest_image(*dest), kernel); 
+    vigra::convolveImage(src_image_range(src), dest_image(dest), kernel); 
+  }
+
+  template<class T, class U, class V>
+  void vigra_convolve_x(const T& src, const U& k, V& dest, int border_mode) {
+    typename U::const_vec_iterator center = k.vec_begin() + k.center_x();
+    tuple5<
+      typename U::const_vec_iterator,
+      KernelAccessor<U>,
+      int, int, BorderTreatmentMode> kernel
+      (center, KernelAccessor<U>(), 
+       -int(k.center_x()), int(k.width()) - int(k.center_x()) - 1,
+       (BorderTreatmentMode)border_mode);
+    
+    vigra::separableConvolveX(src_image_range(src), dest_image(dest), kernel); 
+  }
+
+  template<class T, class U, class V>
+  void vigra_convolve_y(const T& src, const U& k, V& dest, int border_mode) {
+    typename U::const_vec_iterator center = k.vec_begin() + k.center_x();
+    tuple5<
+      typename U::const_vec_iterator,
+      KernelAccessor<U>,
+      int, int, BorderTreatmentMode> kernel
+      (center, KernelAccessor<U>(), 
+       -int(k.center_x()), int(k.width()) - int(k.center_x()) - 1,
+       (BorderTreatmentMode)border_mode);
+    
+    vigra::separableConvolveY(src_image_range(src), dest_image(dest), kernel); 
+  }
+
+  /*
+    Convolution through the Fourier transform, for large kernels that are
+    not separable (see FftDetail::TiledConvolution).  The tiles are filled
+    from the image with the border treatment (zero where it is clipped),
+    two at a time as the real and imaginary parts of a complex tile.  For
+    BORDER_TREATMENT_CLIP the pixels near the border are renormalized by
+    the sum of the kernel weights that fall inside the image, taken from
+    the summed area table of the kernel.
+  */
+  template<class T, class V>
+  class FftConvolution {
+  public:
+    typedef std::complex<double> Complex;
+
+    template<class U>
+    FftConvolution(const T& src, const U& k, V& dest, int border)
+      : m_src(src), m_dest(dest), m_border(border),
+        m_convolution(weights(k), -long(k.center_x()), long(k.ncols()) - 1 - long(k.center_x()),
+                      -long(k.center_y()), long(k.nrows()) - 1 - long(k.center_y()),
+                      src.ncols(), src.nrows()),
+        m_left(m_convolution.left()), m_right(m_convolution.right()),
+        m_top(m_convolution.top()), m_bottom(m_convolution.bottom()),
+        m_bx(m_convolution.block_ncols()), m_by(m_convolution.block_nrows()),
+        m_ntx((long(src.ncols()) + m_bx - 1) / m_bx),
+        m_ntiles(m_ntx * ((long(src.nrows()) + m_by - 1) / m_by)),
+        m_sums(size_t(k.ncols() + 1) * (k.nrows() + 1), 0.0), m_norm(0.0) {
+      const long kncols = k.ncols();
+      for (long y = 0; y < long(k.nrows()); ++y)
+        for (long x = 0; x < kncols; ++x)
+          m_sums[size_t(y + 1) * (kncols + 1) + x + 1] = k.get(Point(x, y)) +
+            m_sums[size_t(y) * (kncols + 1) + x + 1] +
+            m_sums[size_t(y + 1) * (kncols + 1) + x] - m_sums[size_t(y) * (kncols + 1) + x];
+      if (border == BORDER_TREATMENT_CLIP) {
+        m_norm = kernel_sum(m_left, m_right, m_top, m_bottom);
+        if (m_norm == 0.0)
+          throw std::runtime_error("Cannot use BORDER_TREATMENT_CLIP with a kernel that sums to zero.");
+      }
+    }
+
+    void operator()(int threads) const {
+      m_convolution(*this, (m_ntiles + 1) / 2, threads);
+    }
+
+    // the tiles 2 * pair and 2 * pair + 1 as the real and imaginary parts
+    void fill(long pair, Complex* tile) const {
+      const long nx = m_convolution.tile_ncols(), ny = m_convolution.tile_nrows();
+      std::vector<double> values(nx);
+      for (long v = 0; v < ny; ++v) {
+        Complex* out = tile + size_t(v) * nx;
+        for (long part = 0; part < 2; ++part) {
+          std::fill(values.begin(), values.end(), 0.0);
+          const long t = 2 * pair + part;
+          if (t < m_ntiles) {
+            const long y = (t / m_ntx) * m_by + v - m_bottom;
+            const long nrows = m_src.nrows();
+            const long r = (y >= -m_bottom && y < nrows - m_top) ? border_index(y, nrows, m_border) : -1;
+            if (r >= 0)
+              fill_row(m_src[r], (t % m_ntx) * m_bx - m_right, &values[0]);
+          }
+          if (part == 0)
+            for (long u = 0; u < nx; ++u)
+              out[u] = Complex(values[u], 0.0);
+          else
+            for (long u = 0; u < nx; ++u)
+              out[u] = Complex(out[u].real(), values[u]);
+        }
+      }
+    }
+
+    void store(long pair, const Complex* tile) const {
+      const long nx = m_convolution.tile_ncols();
+      const long nrows = m_src.nrows(), ncols = m_src.ncols();
+      long x0 = 0, x1 = ncols, y0 = 0, y1 = nrows;
+      if (m_border == BORDER_TREATMENT_AVOID) {
+        x0 = m_right; x1 = ncols + m_left;
+        y0 = m_bottom; y1 = nrows + m_top;
+      }
+      std::vector<double> row(ncols);
+      for (long part = 0; part < 2 && 2 * pair + part < m_ntiles; ++part) {
+        const long t = 2 * pair + part, tx = t % m_ntx, ty = t / m_ntx;
+        const long bx0 = std::max(tx * m_bx, x0), bx1 = std::min((tx + 1) * m_bx, x1);
+        const long by0 = std::max(ty * m_by, y0), by1 = std::min((ty + 1) * m_by, y1);
+        for (long y = by0; y < by1; ++y) {
+          // output x is at position x - tx * bx + right of the tile
+          const Complex* out = tile + size_t(y - ty * m_by + m_bottom) * nx + m_right - tx * m_bx;
+          for (long x = bx0; x < bx1; ++x)
+            row[x] = part == 0 ? out[x].real() : out[x].imag();
+          if (m_border == BORDER_TREATMENT_CLIP)
+            for (long x = bx0; x < bx1; ++x)
+              row[x] *= clip_factor(x, y);
+          store_row(&row[0], bx0, bx1, m_dest[y]);
+        }
+      }
+    }
+
+  private:
+    template<class U>
+    static std::vector<double> weights(const U& k) {
+      std::vector<double> result;
+      for (size_t y = 0; y < k.nrows(); ++y)
+        for (size_t x = 0; x < k.ncols(); ++x)
+          result.push_back(k.get(Point(x, y)));
+      return result;
+    }
+
+    // the sum of the kernel weights at the offsets [j0, j1] x [i0, i1]
+    double kernel_sum(long j0, long j1, long i0, long i1) const {
+      const size_t stride = size_t(m_right - m_left + 2);
+      const size_t x0 = j0 - m_left, x1 = j1 - m_left + 1;
+      const size_t y0 = i0 - m_top, y1 = i1 - m_top + 1;
+      return m_sums[y1 * stride + x1] - m_sums[y0 * stride + x1] -
+        m_sums[y1 * stride + x0] + m_sums[y0 * stride + x0];
+    }
+
+    double clip_factor(long x, long y) const {
+      const long ncols = m_src.ncols(), nrows = m_src.nrows();
+      const long j0 = std::max(m_left, x - ncols + 1), j1 = std::min(m_right, x);
+      const long i0 = std::max(m_top, y - nrows + 1), i1 = std::min(m_bottom, y);
+      if (j0 == m_left && j1 == m_right && i0 == m_top && i1 == m_bottom)
+        return 1.0;
+      return m_norm / kernel_sum(j0, j1, i0, i1);
+    }
+
+    // the positions of a tile row that start at position xoff of an
+    // image row; the positions that no output pixel reads stay zero
+    template<class Iter>
+    void fill_row(Iter row, long xoff, double* values) const {
+      const long ncols = m_src.ncols(), nx = m_convolution.tile_ncols();
+      for (long u = 0; u < nx; ++u) {
+        const long x = xoff + u;
+        if (x < -m_right || x >= ncols - m_left)
+          continue;
+        const long c = border_index(x, ncols, m_border);
+        if (c >= 0)
+          values[u] = row[c];
+      }
+    }
+
+    const T& m_src;
+    V& m_dest;
+    int m_border;
+    FftDetail::TiledConvolution m_convolution;
+    long m_left, m_right, m_top, m_bottom, m_bx, m_by, m_ntx, m_ntiles;
+    std::vector<double> m_sums;
+    double m_norm;
+  };
+
+  // The number of kernel weights above which the Fourier transform is
+  // faster than vigra's direct convolution (between 5x5 and 7x7 on a
+  // single thread).
+  const long fft_min_weights = 36;
+
+  template<class U>
+  bool use_fft(const U& k) {
+    return long(k.nrows()) * long(k.ncols()) > fft_min_weights;
+  }
+
+  template<bool native>
+  struct Engine {
+    template<class T, class U, class V>
+    static void convolve(const T& src, const U& k, V& dest, int border_mode,
+                         int threads) {
+      vigra_convolve(src, k, dest, border_mode);
+    }
+    template<class T, class U, class V>
+    static void convolve_x(const T& src, const U& k, V& dest, int border_mode,
+                           int threads) {
+      vigra_convolve_x(src, k, dest, border_mode);
+    }
+    template<class T, class U, class V>
+    static void convolve_y(const T& src, const U& k, V& dest, int border_mode,
+                           int threads) {
+      vigra_convolve_y(src, k, dest, border_mode);
+    }
+  };
+
+  template<>
+  struct Engine<true> {
+    template<class T, class U, class V>
+    static void convolve(const T& src, const U& k, V& dest, int border_mode,
+                         int threads) {
+      Kernel kx, ky;
+      if (separate_kernel(k, kx, ky))
+        convolve_separable(src, dest, kx, ky, border_mode,
+                           resolve_threads(threads));
+      else if (use_fft(k))
+        FftConvolution<T, V>(src, k, dest, border_mode)(resolve_threads(threads));
+      else
+        vigra_convolve(src, k, dest, border_mode);
+    }
+    // the last weight is not used, as with vigra_convolve_x
+    template<class T, class U, class V>
+    static void convolve_x(const T& src, const U& k, V& dest, int border_mode,
+                           int threads) {
+      convolve_rows(src, dest,
+                    row_kernel(k, -int(k.center_x()),
+                               int(k.width()) - int(k.center_x()) - 1),
+                    border_mode, resolve_threads(threads));
+    }
+    template<class T, class U, class V>
+    static void convolve_y(const T& src, const U& k, V& dest, int border_mode,
+                           int threads) {
+      convolve_columns(src, dest,
+                       row_kernel(k, -int(k.center_x()),
+                                  int(k.width()) - int(k.center_x()) - 1),
+                       border_mode, resolve_threads(threads));
+    }
+  };
+
+  template<class T, class V>
+  struct use_engine {
+    enum { value = native_pixel<typename T::value_type>::value &&
+           native_pixel<typename V::value_type>::value };
+  };
+
+  template<class T, class V>
+  void check_dest(const T& src, const V& dest) {
+    if (dest.nrows() != src.nrows() || dest.ncols() != src.ncols())
+      throw std::runtime_error("The destination must have the size of the image.");
+  }
+}
+
+/*
+  The following write the convolution of src into dest, which must have
+  the same size, using threads threads (0 for the OpenMP default) for
+  GreyScale, Grey16 and Float images.  With BORDER_TREATMENT_AVOID, the
+  pixels where the kernel does not fit are left unchanged.  dest may be of
+  another pixel type than src, e.g. Float to keep the fractions.
+*/
+template<class T, class U, class V>
+void convolve_into(const T& src, const U& k, V& dest, int border_mode, int threads) {
+  if (k.nrows() > src.nrows() || k.ncols() > src.ncols())
+    throw std::runtime_error("The image must be bigger than the kernel.");
+  ConvolutionDetail::check_dest(src, dest);
+  ConvolutionDetail::check_border(border_mode);
+  ConvolutionDetail::Engine<ConvolutionDetail::use_engine<T, V>::value>::
+    convolve(src, k, dest, border_mode, threads);
+}
+
+template<class T, class U, class V>
+void convolve_x_into(const T& src, const U& k, V& dest, int border_mode, int threads) {
+  if (k.nrows() > src.nrows() || k.ncols() > src.ncols())
+    throw std::runtime_error("The image must be bigger than the kernel.");
+  if (k.nrows() != 1)
+    throw std::runtime_error("The 1D kernel must have only one row.");
+  ConvolutionDetail::check_dest(src, dest);
+  ConvolutionDetail::check_border(border_mode);
+  ConvolutionDetail::Engine<ConvolutionDetail::use_engine<T, V>::value>::
+    convolve_x(src, k, dest, border_mode, threads);
+}
+
+template<class T, class U, class V>
+void convolve_y_into(const T& src, const U& k, V& dest, int border_mode, int threads) {
+  if (k.nrows() > src.ncols() || k.ncols() > src.nrows())
+    throw std::runtime_error("The image must be bigger than the kernel.");
+  if (k.nrows() != 1)
+    throw std::runtime_error("The 1D kernel must have only one row.");
+  ConvolutionDetail::check_dest(src, dest);
+  ConvolutionDetail::check_border(border_mode);
+  ConvolutionDetail::Engine<ConvolutionDetail::use_engine<T, V>::value>::
+    convolve_y(src, k, dest, border_mode, threads);
+}
+
+template<class T, class U>
+typename ImageFactory<T>::view_type* convolve(const T& src, const U& k, int border_mode, int threads) {
+  if (k.nrows() > src.nrows() || k.ncols() > src.ncols())
+    throw std::runtime_error("The image must be bigger than the kernel.");
+
+  typename ImageFactory<T>::data_type* dest_data =
+    new typename ImageFactory<T>::data_type(src.size(), src.ul());
+  typename ImageFactory<T>::view_type* dest =
+    new typename ImageFactory<T>::view_type(*dest_data);
+
+  try {
+    convolve_into(src, k, *dest, border_mode, threads);
   } catch (std::exception e) {
     delete dest;
     delete dest_data;
@@ -59,7 +752,7 @@ typename ImageFactory<T>::view_type* convolve(const T& src, const U& k, int bord
 }
 
 template<class T, class U>
-typename ImageFactory<T>::view_type* convolve_x(const T& src, const U& k, int border_mode) {
+typename ImageFactory<T>::view_type* convolve_x(const T& src, const U& k, int border_mode, int threads) {
   if (k.nrows() > src.nrows() || k.ncols() > src.ncols())
     throw std::runtime_error("The image must be bigger than the kernel.");
   if (k.nrows() != 1)
@@ -70,19 +763,8 @@ typename ImageFactory<T>::view_type* convolve_x(const T& src, const U& k, int bo
   typename ImageFactory<T>::view_type* dest =
     new typename ImageFactory<T>::view_type(*dest_data);
 
-  // I originally had the following two lines abstracted out in a function,
-  // but that seemed to choke and crash gcc 3.3.2
   try {
-    typename U::const_vec_iterator center = k.vec_begin() + k.center_x();
-    tuple5<
-      typename U::const_vec_iterator,
-      typename choose_accessor<U>::accessor,
-      int, int, BorderTreatmentMode> kernel
-      (center, choose_accessor<U>::make_accessor(k), 
-       -int(k.center_x()), int(k.width()) - int(k.center_x()) - 1,
-       (BorderTreatmentMode)border_mode);
-    
-    vigra::separableConvolveX(src_image_range(src), dest_image(*dest), kernel); 
+    convolve_x_into(src, k, *dest, border_mode, threads);
   } catch (std::exception e) {
     delete dest;
     delete dest_data;
@@ -92,7 +774,7 @@ typename ImageFactory<T>::view_type* convolve_x(const T& src, const U& k, int bo
 }
 
 template<class T, class U>
-typename ImageFactory<T>::view_type* convolve_y(const T& src, const U& k, int border_mode) {
+typename ImageFactory<T>::view_type* convolve_y(const T& src, const U& k, int border_mode, int threads) {
   if (k.nrows() > src.ncols() || k.ncols() > src.nrows())
     throw std::runtime_error("The image must be bigger than the kernel.");
   if (k.nrows() != 1)
@@ -103,19 +785,8 @@ typename ImageFactory<T>::view_type* convolve_y(const T& src, const U& k, int bo
   typename ImageFactory<T>::view_type* dest =
     new typename ImageFactory<T>::view_type(*dest_data);
 
-  // I originally had the following two lines abstracted out in a function,
-  // but that seemed to choke and crash gcc 3.3.2
   try {
-    typename U::const_vec_iterator center = k.vec_begin() + k.center_x();
-    tuple5<
-      typename U::const_vec_iterator,
-      typename choose_accessor<U>::accessor,
-      int, int, BorderTreatmentMode> kernel
-      (center, choose_accessor<U>::make_accessor(k), 
-       -int(k.center_x()), int(k.width()) - int(k.center_x()) - 1,
-       (BorderTreatmentMode)border_mode);
-    
-    vigra::separableConvolveY(src_image_range(src), dest_image(*dest), kernel); 
+    convolve_y_into(src, k, *dest, border_mode, threads);
   } catch (std::exception e) {
     delete dest;
     delete dest_data;
@@ -124,6 +795,304 @@ typename ImageFactory<T>::view_type* convolve_y(const T& src, const U& k, int bo
   return dest;
 }
 
+/*
+  Smoothing whose cost per pixel does not depend on the size of the
+  kernel: a box filter with running sums, and Young and van Vliet's
+  recursive approximation of the Gaussian (I.T. Young, L.J. van Vliet:
+  Recursive implementation of the Gaussian filter.  Signal Processing 44,
+  pp. 139-151, 1995).
+*/
+namespace ConvolutionDetail {
+
+  // The number of positions of the window [x - radius, x + radius] inside
+  // a signal of length n.
+  inline long window_count(long x, long radius, long n) {
+    return std::min(x + radius, n - 1) - std::max(x - radius, 0L) + 1;
+  }
+
+  template<class Iter>
+  inline void add_row(Iter row, long n, double sign, double* sums) {
+    for (long x = 0; x < n; ++x)
+      sums[x] += sign * row[x];
+  }
+
+  /*
+    The sums over the windows of 2 * radius + 1 values around the
+    positions [begin, end) of the n values at in.  ext is scratch space for
+    n + 2 * radius values.
+  */
+  inline void box_line(const double* in, double* out, long n, long radius,
+                       int border, long begin, long end, double* ext) {
+    // ext[i] is the value at position i - radius
+    std::copy(in, in + n, ext + radius);
+    for (long i = 0; i < radius; ++i) {
+      long s = border_index(i - radius, n, border);
+      ext[i] = s < 0 ? 0.0 : in[s];
+      s = border_index(n + i, n, border);
+      ext[n + radius + i] = s < 0 ? 0.0 : in[s];
+    }
+    double sum = 0.0;
+    for (long i = begin; i <= begin + 2 * radius; ++i)
+      sum += ext[i];
+    for (long x = begin; x < end; ++x) {
+      out[x] = sum;
+      if (x + 1 < end)
+        sum += ext[x + 2 * radius + 1] - ext[x];
+    }
+  }
+
+  /*
+    The mean over the (2 * radius + 1) x (2 * radius + 1) window of each
+    pixel.  The column sums of a band of rows are updated as the window
+    moves down, so that each pixel costs O(1).  The bands are fixed, so that
+    the result does not depend on the number of threads.
+  */
+  template<class T, class V>
+  void box_filter(const T& src, V& dest, long radius, int border,
+                  int threads) {
+    const long nrows = src.nrows(), ncols = src.ncols();
+    long x0, x1, y0, y1;
+    Kernel extent;
+    extent.left = -int(radius);
+    extent.right = int(radius);
+    written_range(extent, ncols, border, x0, x1);
+    written_range(extent, nrows, border, y0, y1);
+    const long band = std::max(64L, 4 * (2 * radius + 1));
+    const long nbands = (y1 - y0 + band - 1) / band;
+    const double area = double(2 * radius + 1) * double(2 * radius + 1);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+    {
+      std::vector<double> columns(ncols), sums(ncols);
+      std::vector<double> ext(ncols + 2 * radius);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+      for (long b = 0; b < nbands; ++b) {
+        const long top = y0 + b * band;
+        const long bottom = std::min(top + band, y1);
+        std::fill(columns.begin(), columns.end(), 0.0);
+        for (long u = top - radius; u <= top + radius; ++u) {
+          long r = border_index(u, nrows, border);
+          if (r >= 0)
+            add_row(src[r], ncols, 1.0, &columns[0]);
+        }
+        for (long y = top; y < bottom; ++y) {
+          if (y > top) {
+            long r = border_index(y - radius - 1, nrows, border);
+            if (r >= 0)
+              add_row(src[r], ncols, -1.0, &columns[0]);
+            r = border_index(y + radius, nrows, border);
+            if (r >= 0)
+              add_row(src[r], ncols, 1.0, &columns[0]);
+          }
+          box_line(&columns[0], &sums[0], ncols, radius, border, x0, x1,
+                   &ext[0]);
+          if (border == BORDER_TREATMENT_CLIP) {
+            const double rows = (double)window_count(y, radius, nrows);
+            for (long x = x0; x < x1; ++x)
+              sums[x] /= rows * (double)window_count(x, radius, ncols);
+          } else {
+            for (long x = x0; x < x1; ++x)
+              sums[x] /= area;
+          }
+          store_row(&sums[0], x0, x1, dest[y]);
+        }
+      }
+    }
+  }
+
+  /*
+    Young and van Vliet's recursive Gaussian: a causal and an anticausal
+    filter of third order.  The borders are treated as with
+    BORDER_TREATMENT_REPEAT: the causal filter starts in the steady state
+    of the first value, and the anticausal filter in the state it would
+    reach if the line went on with its last value, which is a linear
+    function of the last states of the causal filter (B. Triggs, M. Sdika:
+    Boundary conditions for Young-van Vliet recursive filtering.  IEEE
+    Transactions on Signal Processing 54, pp. 2365-2367, 2006).  That
+    function is found here by running the filters on its basis.
+  */
+  class RecursiveGaussian {
+  public:
+    RecursiveGaussian(double sigma) {
+      if (sigma < 0.5)
+        throw std::runtime_error("The standard deviation must be at least 0.5.");
+      double q;
+      if (sigma >= 2.5)
+        q = 0.98711 * sigma - 0.96330;
+      else
+        q = 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * sigma);
+      coefficients(q);
+      for (int i = 0; i < 3; ++i) {
+        // t[j] is the deviation of the causal filter at position n - 3 + j
+        // from the last value for the basis state i
+        std::vector<double> t(3, 0.0);
+        t[2 - i] = 1.0;
+        for (size_t j = 3; std::abs(t[j - 1]) + std::abs(t[j - 2]) +
+               std::abs(t[j - 3]) > 1e-17; ++j)
+          t.push_back(a1 * t[j - 1] + a2 * t[j - 2] + a3 * t[j - 3]);
+        double y1 = 0.0, y2 = 0.0, y3 = 0.0;
+        for (size_t j = t.size() - 1; j >= 3; --j) {
+          double y = B * t[j] + a1 * y1 + a2 * y2 + a3 * y3;
+          y3 = y2;
+          y2 = y1;
+          y1 = y;
+        }
+        M[0][i] = y1;
+        M[1][i] = y2;
+        M[2][i] = y3;
+      }
+    }
+
+    // Filters the n values at line in place.
+    void filter(double* line, long n) const {
+      const double first = line[0], last = line[n - 1];
+      double w1 = first, w2 = first, w3 = first;
+      for (long i = 0; i < n; ++i) {
+        double w = B * line[i] + a1 * w1 + a2 * w2 + a3 * w3;
+        line[i] = w;
+        w3 = w2;
+        w2 = w1;
+        w1 = w;
+      }
+      double y1, y2, y3;
+      start_anticausal(w1 - last, w2 - last, w3 - last, last, y1, y2, y3);
+      for (long i = n - 1; i >= 0; --i) {
+        double y = B * line[i] + a1 * y1 + a2 * y2 + a3 * y3;
+        line[i] = y;
+        y3 = y2;
+        y2 = y1;
+        y1 = y;
+      }
+    }
+
+    // Filters the columns [x0, x1) of the n rows in place, the columns of
+    // a tile at once.
+    void filter_columns(double* const* rows, long n, long x0, long x1) const {
+      const long tile = 256;
+      double last[tile], w1[tile], w2[tile], w3[tile];
+      for (long t0 = x0; t0 < x1; t0 += tile) {
+        const long m = std::min(tile, x1 - t0);
+        for (long x = 0; x < m; ++x) {
+          last[x] = rows[n - 1][t0 + x];
+          w1[x] = w2[x] = w3[x] = rows[0][t0 + x];
+        }
+        for (long i = 0; i < n; ++i) {
+          double* row = rows[i] + t0;
+          for (long x = 0; x < m; ++x) {
+            double w = B * row[x] + a1 * w1[x] + a2 * w2[x] + a3 * w3[x];
+            row[x] = w;
+            w3[x] = w2[x];
+            w2[x] = w1[x];
+            w1[x] = w;
+          }
+        }
+        for (long x = 0; x < m; ++x)
+          start_anticausal(w1[x] - last[x], w2[x] - last[x], w3[x] - last[x],
+                           last[x], w1[x], w2[x], w3[x]);
+        for (long i = n - 1; i >= 0; --i) {
+          double* row = rows[i] + t0;
+          for (long x = 0; x < m; ++x) {
+            double y = B * row[x] + a1 * w1[x] + a2 * w2[x] + a3 * w3[x];
+            row[x] = y;
+            w3[x] = w2[x];
+            w2[x] = w1[x];
+            w1[x] = y;
+          }
+        }
+      }
+    }
+
+  private:
+    void coefficients(double q) {
+      const double q2 = q * q, q3 = q2 * q;
+      const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+      a1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+      a2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+      a3 = 0.422205 * q3 / b0;
+      B = 1.0 - (a1 + a2 + a3);
+    }
+
+    // The anticausal states after the line from the deviations s1, s2, s3
+    // of the last causal states from the last value.
+    void start_anticausal(double s1, double s2, double s3, double last,
+                          double& y1, double& y2, double& y3) const {
+      y1 = last + M[0][0] * s1 + M[0][1] * s2 + M[0][2] * s3;
+      y2 = last + M[1][0] * s1 + M[1][1] * s2 + M[1][2] * s3;
+      y3 = last + M[2][0] * s1 + M[2][1] * s2 + M[2][2] * s3;
+    }
+
+    double B, a1, a2, a3;
+    double M[3][3];
+  };
+
+  // Smooths the rows of src into the double rows, then the columns of
+  // those in tiles, and stores them in dest.
+  template<class T, class V>
+  void recursive_gaussian(const T& src, V& dest,
+                          const RecursiveGaussian& filter, int threads) {
+    const long nrows = src.nrows(), ncols = src.ncols();
+    std::vector<double> pixels(nrows * ncols);
+    std::vector<double*> rows(nrows);
+    for (long y = 0; y < nrows; ++y)
+      rows[y] = &pixels[y * ncols];
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+    for (long y = 0; y < nrows; ++y) {
+      load_row(src[y], ncols, rows[y]);
+      filter.filter(rows[y], ncols);
+    }
+    const long strip = 256;
+    const long nstrips = (ncols + strip - 1) / strip;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+    for (long s = 0; s < nstrips; ++s)
+      filter.filter_columns(&rows[0], nrows, s * strip,
+                            std::min((s + 1) * strip, ncols));
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+    for (long y = 0; y < nrows; ++y)
+      store_row(rows[y], 0, ncols, dest[y]);
+  }
+}
+
+template<class T>
+typename ImageFactory<T>::view_type* box_filter(const T& src, int radius, int border_mode, int threads) {
+  if (radius < 0)
+    throw std::runtime_error("The radius must not be negative.");
+  if (size_t(2 * radius + 1) > src.nrows() || size_t(2 * radius + 1) > src.ncols())
+    throw std::runtime_error("The image must be bigger than the kernel.");
+  ConvolutionDetail::check_border(border_mode);
+
+  typename ImageFactory<T>::data_type* dest_data =
+    new typename ImageFactory<T>::data_type(src.size(), src.origin());
+  typename ImageFactory<T>::view_type* dest =
+    new typename ImageFactory<T>::view_type(*dest_data);
+
+  ConvolutionDetail::box_filter(src, *dest, radius, border_mode,
+                                ConvolutionDetail::resolve_threads(threads));
+  return dest;
+}
+
+template<class T>
+typename ImageFactory<T>::view_type* recursive_gaussian_smoothing(const T& src, double std_dev, int threads) {
+  ConvolutionDetail::RecursiveGaussian filter(std_dev);
+
+  typename ImageFactory<T>::data_type* dest_data =
+    new typename ImageFactory<T>::data_type(src.size(), src.origin());
+  typename ImageFactory<T>::view_type* dest =
+    new typename ImageFactory<T>::view_type(*dest_data);
+
+  ConvolutionDetail::recursive_gaussian(src, *dest, filter,
+                                        ConvolutionDetail::resolve_threads(threads));
+  return dest;
+}
+
 FloatImageView* _copy_kernel(const Kernel1D<FloatPixel>& kernel) {
   FloatImageData* dest_data = new FloatImageData(Dim(kernel.size(), 1));
   FloatImageView* dest = new FloatImageView(*dest_data);
@@ -22,37 +22,462 @@
 #define mgd06292004_corelation
 
 #include "gamera.hpp"
+#include "rle_utilities.hpp"
+#include "fourier.hpp"
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace Gamera {
 
-  template<class T, class U>
-  double corelation_weighted(const T& a, const U& b, const Point& p, double bb, double bw, double wb, double ww) {
-    size_t ul_y = std::max(a.ul_y(), p.y());
-    size_t ul_x = std::max(a.ul_x(), p.x());
-    size_t lr_y = std::min(a.lr_y(), p.y() + b.nrows());
-    size_t lr_x = std::min(a.lr_x(), p.x() + b.ncols());
-    double result = 0;
-    double area = 0;
-
-    for (size_t y = ul_y, ya = ul_y-a.ul_y(), yb = ul_y-p.y(); y < lr_y; ++y, ++ya, ++yb) {
-      for (size_t x = ul_x, xa = ul_x-a.ul_x(), xb = ul_x-p.x(); x < lr_x; ++x, ++xa, ++xb) {
-	if (is_black(b.get(Point(xb, yb)))) {
-	  area++;
-	  if (is_black(a.get(Point(xa, ya))))
-	    result += bb;
-	  else
-	    result += bw;
-	} else {
-	  if (is_black(a.get(Point(xa, ya))))
-	    result += wb;
-	  else
-	    result += ww;
-	}
+  /*
+    All corelations are computed from a few integer sums over the
+    overlap of the template and the image (see Overlap), so that the
+    corelation at a single offset and the corelation maps below give
+    exactly the same values.
+  */
+  namespace CorelationDetail {
+    // the value of an image pixel in the sums: whether it is black for
+    // corelation_weighted, and the pixel value for the other methods
+    struct BlackValue {
+      template<class V>
+      long long operator()(V a) const { return is_black(a) ? 1 : 0; }
+    };
+
+    struct PixelValue {
+      long long operator()(OneBitPixel a) const { return is_black(a) ? 1 : 0; }
+      long long operator()(GreyScalePixel a) const { return a; }
+    };
+
+    /*
+      The number of pixels in the overlap (area) and of the black
+      template pixels among them (black), and the sums of the values of
+      the image pixels and of their squares, over the whole overlap
+      (sum, squares) and under the black template pixels only
+      (black_sum, black_squares).
+    */
+    struct Overlap {
+      Overlap() : area(0), black(0), sum(0), squares(0), black_sum(0), black_squares(0) { }
+      long long area, black, sum, squares, black_sum, black_squares;
+    };
+
+    // the overlap of template b at offset p of image a, pixel by pixel
+    template<class T, class U, class Value>
+    Overlap overlap(const T& a, const U& b, const Point& p, const Value& value,
+                    ProgressBar progress_bar = ProgressBar()) {
+      size_t ul_y = std::max(a.ul_y(), p.y());
+      size_t ul_x = std::max(a.ul_x(), p.x());
+      size_t lr_y = std::min(a.lr_y() + 1, p.y() + b.nrows());
+      size_t lr_x = std::min(a.lr_x() + 1, p.x() + b.ncols());
+      Overlap o;
+
+      progress_bar.set_length(lr_y > ul_y ? lr_y - ul_y : 0);
+      for (size_t y = ul_y, ya = ul_y-a.ul_y(), yb = ul_y-p.y(); y < lr_y; ++y, ++ya, ++yb) {
+        for (size_t x = ul_x, xa = ul_x-a.ul_x(), xb = ul_x-p.x(); x < lr_x; ++x, ++xa, ++xb) {
+          long long v = value(a.get(Point(xa, ya)));
+          o.area++;
+          o.sum += v;
+          o.squares += v * v;
+          if (is_black(b.get(Point(xb, yb)))) {
+            o.black++;
+            o.black_sum += v;
+            o.black_squares += v * v;
+          }
+        }
+        progress_bar.step();
       }
+      return o;
     }
-    return result / area;
+
+    // the rewards and penalties of corelation_weighted (the image
+    // values are 1 for black and 0 for white pixels)
+    struct Weighted {
+      Weighted(double bb, double bw, double wb, double ww)
+        : m_bb(bb), m_bw(bw), m_wb(wb), m_ww(ww) { }
+      double operator()(const Overlap& o) const {
+        double result = m_bb * o.black_sum + m_bw * (o.black - o.black_sum) +
+          m_wb * (o.sum - o.black_sum) + m_ww * (o.area - o.black - o.sum + o.black_sum);
+        return result / o.black;
+      }
+      double m_bb, m_bw, m_wb, m_ww;
+    };
+
+    // the sum of corelation_absolute_distance per black template pixel
+    template<class V>
+    struct AbsoluteDistance;
+
+    template<>
+    struct AbsoluteDistance<OneBitPixel> {
+      double operator()(const Overlap& o) const {
+        return double(o.black - o.black_sum + o.sum - o.black_sum) / o.black;
+      }
+    };
+
+    template<>
+    struct AbsoluteDistance<GreyScalePixel> {
+      double operator()(const Overlap& o) const {
+        long long max = NumericTraits<GreyScalePixel>::max();
+        return double(o.black_sum + max * (o.area - o.black) - (o.sum - o.black_sum)) / o.black;
+      }
+    };
+
+    // the sum of corelation_square_absolute_distance per black
+    // template pixel
+    template<class V>
+    struct SquareAbsoluteDistance;
+
+    template<>
+    struct SquareAbsoluteDistance<OneBitPixel> : public AbsoluteDistance<OneBitPixel> { };
+
+    template<>
+    struct SquareAbsoluteDistance<GreyScalePixel> {
+      double operator()(const Overlap& o) const {
+        long long max = NumericTraits<GreyScalePixel>::max();
+        return double(o.black_squares + max * max * (o.area - o.black) -
+                      2 * max * (o.sum - o.black_sum) + (o.squares - o.black_squares)) / o.black;
+      }
+    };
+
+    /*
+      The prefix sums of the values of the image pixels and of their
+      squares along the rows y0 to y1 - 1 of an image, so that the sum
+      over a part of a row takes constant time.
+    */
+    class RowSums {
+    public:
+      template<class T, class Value>
+      RowSums(const T& image, size_t y0, size_t y1, const Value& value)
+        : m_y0(y0), m_stride(image.ncols() + 1),
+          m_sums((y1 - y0) * m_stride, 0), m_squares((y1 - y0) * m_stride, 0) {
+        typename T::const_row_iterator row = image.row_begin() + y0;
+        for (size_t y = 0; y < y1 - y0; ++y, ++row) {
+          long long* sums = &m_sums[y * m_stride];
+          long long* squares = &m_squares[y * m_stride];
+          size_t x = 0;
+          for (typename T::const_row_iterator::iterator col = row.begin(); col != row.end(); ++col, ++x) {
+            long long v = value(*col);
+            sums[x + 1] = sums[x] + v;
+            squares[x + 1] = squares[x] + v * v;
+          }
+        }
+      }
+      // the sums over the columns x0 to x1 - 1 of row y
+      long long sum(size_t y, size_t x0, size_t x1) const {
+        const long long* sums = &m_sums[(y - m_y0) * m_stride];
+        return sums[x1] - sums[x0];
+      }
+      long long squares(size_t y, size_t x0, size_t x1) const {
+        const long long* squares = &m_squares[(y - m_y0) * m_stride];
+        return squares[x1] - squares[x0];
+      }
+    private:
+      size_t m_y0, m_stride;
+      std::vector<long long> m_sums, m_squares;
+    };
+
+    // the black runs of each row of the template
+    template<class U>
+    void template_runs(const U& b, RleBlackRuns& out) {
+      out.nrows = b.nrows();
+      out.ncols = b.ncols();
+      out.runs.clear();
+      out.row.assign(1, 0);
+      for (typename U::const_row_iterator row = b.row_begin(); row != b.row_end(); ++row) {
+        size_t x = 0, start = 0;
+        bool in_run = false;
+        for (typename U::const_row_iterator::iterator col = row.begin(); col != row.end(); ++col, ++x) {
+          if (is_black(*col) != in_run) {
+            if (in_run)
+              out.runs.push_back(RleBlackRuns::run_type(start, x));
+            start = x;
+            in_run = !in_run;
+          }
+        }
+        if (in_run)
+          out.runs.push_back(RleBlackRuns::run_type(start, x));
+        out.row.push_back(out.runs.size());
+      }
+    }
+
+    /*
+      The sums of the values of the pixels of a part of an image and of
+      their squares over any rectangle, from the summed area tables.
+    */
+    class RectSums {
+    public:
+      template<class T, class Value>
+      RectSums(const T& image, long x0, long x1, long y0, long y1, const Value& value)
+        : m_x0(x0), m_y0(y0), m_stride(x1 - x0 + 1),
+          m_sums((y1 - y0 + 1) * m_stride, 0), m_squares((y1 - y0 + 1) * m_stride, 0) {
+        typename T::const_row_iterator row = image.row_begin() + y0;
+        for (long y = 1; y <= y1 - y0; ++y, ++row) {
+          typename T::const_row_iterator::iterator col = row.begin() + x0;
+          long long sum = 0, squares = 0;
+          for (long x = 1; x <= x1 - x0; ++x, ++col) {
+            long long v = value(*col);
+            sum += v;
+            squares += v * v;
+            m_sums[y * m_stride + x] = m_sums[(y - 1) * m_stride + x] + sum;
+            m_squares[y * m_stride + x] = m_squares[(y - 1) * m_stride + x] + squares;
+          }
+        }
+      }
+      // the sums over the columns x0 to x1 - 1 of the rows y0 to y1 - 1
+      long long sum(long x0, long x1, long y0, long y1) const {
+        return rect(m_sums, x0, x1, y0, y1);
+      }
+      long long squares(long x0, long x1, long y0, long y1) const {
+        return rect(m_squares, x0, x1, y0, y1);
+      }
+    private:
+      long long rect(const std::vector<long long>& table, long x0, long x1, long y0, long y1) const {
+        x0 -= m_x0; x1 -= m_x0; y0 -= m_y0; y1 -= m_y0;
+        return table[y1 * m_stride + x1] - table[y0 * m_stride + x1] -
+          table[y1 * m_stride + x0] + table[y0 * m_stride + x0];
+      }
+      long m_x0, m_y0, m_stride;
+      std::vector<long long> m_sums, m_squares;
+    };
+
+    /*
+      The sums of the image values and their squares under the black
+      pixels of template b (black_sum and black_squares of the overlaps)
+      at the offsets [x0, x1) x [y0, y1) relative to image a, through the
+      Fourier transform: they are the convolution of the values (zero
+      outside the image) with the template turned by 180 degrees.  The
+      values and their squares are the real and imaginary parts of the
+      tiles (see FftDetail::TiledConvolution).  The sums are integers
+      much smaller than 2^53 and the error of the transform is far below
+      1/2, so that they are rounded back exactly.
+    */
+    template<class T, class Value>
+    class BlackSums {
+    public:
+      typedef std::complex<double> Complex;
+
+      template<class U>
+      BlackSums(const T& a, const U& b, long x0, long x1, long y0, long y1,
+                const Value& value, int threads)
+        : m_a(a), m_value(value), m_x0(x0), m_x1(x1), m_y0(y0), m_y1(y1),
+          m_convolution(weights(b), 1 - long(b.ncols()), 0, 1 - long(b.nrows()), 0,
+                        x1 - x0, y1 - y0),
+          m_ntx((x1 - x0 + m_convolution.block_ncols() - 1) / m_convolution.block_ncols()),
+          m_sums(size_t(x1 - x0) * (y1 - y0)), m_squares(size_t(x1 - x0) * (y1 - y0)) {
+        const long nty = (y1 - y0 + m_convolution.block_nrows() - 1) / m_convolution.block_nrows();
+        m_convolution(*this, m_ntx * nty, threads);
+      }
+
+      long long sum(long x, long y) const {
+        return m_sums[size_t(y - m_y0) * (m_x1 - m_x0) + x - m_x0];
+      }
+      long long squares(long x, long y) const {
+        return m_squares[size_t(y - m_y0) * (m_x1 - m_x0) + x - m_x0];
+      }
+
+      // position (u, v) of tile t is the image at the first offset of
+      // its block plus (u, v)
+      void fill(long t, Complex* tile) const {
+        const long nx = m_convolution.tile_ncols(), ny = m_convolution.tile_nrows();
+        const long qx = m_x0 + (t % m_ntx) * m_convolution.block_ncols();
+        const long qy = m_y0 + (t / m_ntx) * m_convolution.block_nrows();
+        const long ncols = m_a.ncols(), nrows = m_a.nrows();
+        const long u0 = std::max(0L, -qx), u1 = std::max(u0, std::min(nx, ncols - qx));
+        for (long v = 0; v < ny; ++v) {
+          Complex* out = tile + size_t(v) * nx;
+          std::fill(out, out + nx, Complex(0.0, 0.0));
+          if (qy + v < 0 || qy + v >= nrows)
+            continue;
+          typename T::const_row_iterator::iterator col = (m_a.row_begin() + (qy + v)).begin() + (qx + u0);
+          for (long u = u0; u < u1; ++u, ++col) {
+            const double x = double(m_value(*col));
+            out[u] = Complex(x, x * x);
+          }
+        }
+      }
+
+      void store(long t, const Complex* tile) const {
+        const long nx = m_convolution.tile_ncols();
+        const long qx = m_x0 + (t % m_ntx) * m_convolution.block_ncols();
+        const long qy = m_y0 + (t / m_ntx) * m_convolution.block_nrows();
+        const long bx1 = std::min(m_x1 - qx, m_convolution.block_ncols());
+        const long by1 = std::min(m_y1 - qy, m_convolution.block_nrows());
+        for (long y = 0; y < by1; ++y)
+          for (long x = 0; x < bx1; ++x) {
+            const Complex& c = tile[size_t(y) * nx + x];
+            const size_t i = size_t(qy + y - m_y0) * (m_x1 - m_x0) + qx + x - m_x0;
+            m_sums[i] = (long long)floor(c.real() + 0.5);
+            m_squares[i] = (long long)floor(c.imag() + 0.5);
+          }
+      }
+
+    private:
+      // the black pixels of the template turned by 180 degrees
+      template<class U>
+      static std::vector<double> weights(const U& b) {
+        const long ncols = b.ncols(), nrows = b.nrows();
+        std::vector<double> result(size_t(ncols) * nrows);
+        for (long y = 0; y < nrows; ++y)
+          for (long x = 0; x < ncols; ++x)
+            result[size_t(nrows - 1 - y) * ncols + ncols - 1 - x] =
+              is_black(b.get(Point(x, y))) ? 1.0 : 0.0;
+        return result;
+      }
+
+      const T& m_a;
+      const Value& m_value;
+      long m_x0, m_x1, m_y0, m_y1;
+      FftDetail::TiledConvolution m_convolution;
+      long m_ntx;
+      mutable std::vector<long long> m_sums, m_squares;
+    };
+
+    /*
+      corelation_map through BlackSums, with the other sums over the
+      overlap taken from summed area tables: the cost per offset does not
+      depend on the template.
+    */
+    template<class T, class U, class Value, class Corelation>
+    void fft_corelation_map(const T& a, const U& b, long dx0, long dy0, FloatImageView& dest,
+                            const Value& value, const Corelation& corelation, int threads) {
+      const long a_ncols = a.ncols(), a_nrows = a.nrows();
+      const long b_ncols = b.ncols(), b_nrows = b.nrows();
+      const long ncols = dest.ncols(), nrows = dest.nrows();
+      // the offsets whose overlap is not empty, and the image under them
+      const long x0 = std::max(dx0, 1 - b_ncols), x1 = std::min(dx0 + ncols, a_ncols);
+      const long y0 = std::max(dy0, 1 - b_nrows), y1 = std::min(dy0 + nrows, a_nrows);
+      if (x0 >= x1 || y0 >= y1) {
+        std::fill(dest.vec_begin(), dest.vec_end(), corelation(Overlap()));
+        return;
+      }
+      RectSums image_sums(a, std::max(x0, 0L), std::min(x1 - 1 + b_ncols, a_ncols),
+                          std::max(y0, 0L), std::min(y1 - 1 + b_nrows, a_nrows), value);
+      RectSums template_sums(b, 0, b_ncols, 0, b_nrows, BlackValue());
+      BlackSums<T, Value> black_sums(a, b, x0, x1, y0, y1, value, threads);
+      for (long my = 0; my < nrows; ++my) {
+        const long dy = dy0 + my;
+        const long ty0 = std::max(0L, -dy), ty1 = std::min(b_nrows, a_nrows - dy);
+        for (long mx = 0; mx < ncols; ++mx) {
+          const long dx = dx0 + mx;
+          const long tx0 = std::max(0L, -dx), tx1 = std::min(b_ncols, a_ncols - dx);
+          Overlap o;
+          if (ty0 < ty1 && tx0 < tx1) {
+            o.area = (ty1 - ty0) * (tx1 - tx0);
+            o.sum = image_sums.sum(tx0 + dx, tx1 + dx, ty0 + dy, ty1 + dy);
+            o.squares = image_sums.squares(tx0 + dx, tx1 + dx, ty0 + dy, ty1 + dy);
+            o.black = template_sums.sum(tx0, tx1, ty0, ty1);
+            o.black_sum = black_sums.sum(dx, dy);
+            o.black_squares = black_sums.squares(dx, dy);
+          }
+          dest.set(Point(mx, my), corelation(o));
+        }
+      }
+    }
+
+    // Whether fft_corelation_map is faster: the cost per offset of
+    // corelation_map grows with the rows and black runs of the template
+    // (a solid template breaks even at 32 to 64 rows, random noise at 12
+    // to 16 rows).  The error of the transform of templates above 2^24
+    // pixels could come close to 1/2.
+    inline bool use_fft(const RleBlackRuns& runs) {
+      return runs.nrows + 2 * runs.runs.size() > 140 &&
+        runs.nrows * runs.ncols < (size_t(1) << 24);
+    }
+
+    /*
+      The corelation of template b at the offsets offset to offset +
+      size - 1 of image a, as a FLOAT image with offset as its origin.
+      The sums over the overlap are taken from the row sums of the
+      image, along the black runs of the template, so that the cost per
+      offset depends on the number of runs in the template and not on
+      its area.  The rows of the result are spread over the threads.
+    */
+    template<class T, class U, class Value, class Corelation>
+    FloatImageView* corelation_map(const T& a, const U& b, const Point& offset, const Dim& size,
+                                   const Value& value, const Corelation& corelation, int threads) {
+      if (threads <= 0) {
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#else
+        threads = 1;
+#endif
+      }
+      FloatImageData* dest_data = new FloatImageData(size, offset);
+      FloatImageView* dest = new FloatImageView(*dest_data);
+
+      // the offsets relative to the image
+      const long dx0 = long(offset.x()) - long(a.ul_x());
+      const long dy0 = long(offset.y()) - long(a.ul_y());
+      const long a_ncols = a.ncols(), a_nrows = a.nrows();
+      const long b_ncols = b.ncols(), b_nrows = b.nrows();
+
+      // only the rows of the image that the template can overlap
+      long y0 = std::min(std::max(dy0, 0L), a_nrows);
+      long y1 = std::max(std::min(dy0 + long(size.nrows()) - 1 + b_nrows, a_nrows), y0);
+      RleBlackRuns runs;
+      template_runs(b, runs);
+      if (use_fft(runs)) {
+        try {
+          fft_corelation_map(a, b, dx0, dy0, *dest, value, corelation, threads);
+        } catch (std::exception& e) {
+          delete dest;
+          delete dest_data;
+          throw;
+        }
+        return dest;
+      }
+      RowSums image_sums(a, y0, y1, value);
+      RowSums template_sums(b, 0, b.nrows(), BlackValue());
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 4)
+#endif
+      for (long my = 0; my < long(size.nrows()); ++my) {
+        const long dy = dy0 + my;
+        const long ty0 = std::max(0L, -dy), ty1 = std::min(b_nrows, a_nrows - dy);
+        for (long mx = 0; mx < long(size.ncols()); ++mx) {
+          const long dx = dx0 + mx;
+          const long tx0 = std::max(0L, -dx), tx1 = std::min(b_ncols, a_ncols - dx);
+          Overlap o;
+          if (ty0 < ty1 && tx0 < tx1) {
+            o.area = (ty1 - ty0) * (tx1 - tx0);
+            for (long ty = ty0; ty < ty1; ++ty) {
+              const size_t ay = size_t(ty + dy);
+              o.sum += image_sums.sum(ay, tx0 + dx, tx1 + dx);
+              o.squares += image_sums.squares(ay, tx0 + dx, tx1 + dx);
+              o.black += template_sums.sum(ty, tx0, tx1);
+              for (size_t i = runs.row[ty]; i < runs.row[ty + 1]; ++i) {
+                const long r0 = std::max(long(runs.runs[i].first), tx0);
+                const long r1 = std::min(long(runs.runs[i].second), tx1);
+                if (r0 < r1) {
+                  o.black_sum += image_sums.sum(ay, r0 + dx, r1 + dx);
+                  o.black_squares += image_sums.squares(ay, r0 + dx, r1 + dx);
+                }
+              }
+            }
+          }
+          dest->set(Point(mx, my), corelation(o));
+        }
+      }
+      return dest;
+    }
+  }
+
+  template<class T, class U>
+  double corelation_weighted(const T& a, const U& b, const Point& p, double bb, double bw, double wb, double ww) {
+    using namespace CorelationDetail;
+    return Weighted(bb, bw, wb, ww)(overlap(a, b, p, BlackValue()));
   }
 
+  template<class T, class U>
+  FloatImageView* corelation_weighted_map(const T& a, const U& b, const Point& offset, const Dim& size,
+                                          double bb, double bw, double wb, double ww, int threads) {
+    using namespace CorelationDetail;
+    return corelation_map(a, b, offset, size, BlackValue(), Weighted(bb, bw, wb, ww), threads);
+  }
 
   inline double corelation_absolute_distance(OneBitPixel a, OneBitPixel b) {
     if (is_black(a) == is_black(b))
@@ -69,25 +494,17 @@ namespace Gamera {
   template<class T, class U>
   double corelation_sum(const T& a, const U& b, const Point& p, 
 			ProgressBar progress_bar = ProgressBar()) {
-    size_t ul_y = std::max(a.ul_y(), p.y());
-    size_t ul_x = std::max(a.ul_x(), p.x());
-    size_t lr_y = std::min(a.lr_y(), p.y() + b.nrows());
-    size_t lr_x = std::min(a.lr_x(), p.x() + b.ncols());
-    double result = 0;
-    double area = 0;
-
-    progress_bar.set_length(lr_y - ul_y);
-    for (size_t y = ul_y, ya = ul_y-a.ul_y(), yb = ul_y-p.y(); y < lr_y; ++y, ++ya, ++yb) {
-      for (size_t x = ul_x, xa = ul_x-a.ul_x(), xb = ul_x-p.x(); x < lr_x; ++x, ++xa, ++xb) {
-	typename T::value_type px_a = a.get(Point(xb, yb));
-	typename U::value_type px_b = b.get(Point(xb, yb));
-	if (is_black(px_b))
-	  area++;
-	result += corelation_absolute_distance(px_a, px_b);
-      }
-      progress_bar.step();
-    }
-    return result / area;
+    using namespace CorelationDetail;
+    AbsoluteDistance<typename T::value_type> corelation;
+    return corelation(overlap(a, b, p, PixelValue(), progress_bar));
+  }
+
+  template<class T, class U>
+  FloatImageView* corelation_sum_map(const T& a, const U& b, const Point& offset, const Dim& size,
+                                     int threads) {
+    using namespace CorelationDetail;
+    AbsoluteDistance<typename T::value_type> corelation;
+    return corelation_map(a, b, offset, size, PixelValue(), corelation, threads);
   }
 
   inline double corelation_square_absolute_distance(OneBitPixel a, OneBitPixel b) {
@@ -98,7 +515,7 @@ namespace Gamera {
 
   inline double corelation_square_absolute_distance(GreyScalePixel a, OneBitPixel b) {
     double result = 0;
-    if (is_black(a))
+    if (is_black(b))
       result = a;
     else
       result = (double)(NumericTraits<GreyScalePixel>::max() - a);
@@ -107,25 +524,17 @@ namespace Gamera {
 
   template<class T, class U>
   double corelation_sum_squares(const T& a, const U& b, const Point& p, ProgressBar progress_bar = ProgressBar()) {
-    size_t ul_y = std::max(a.ul_y(), p.y());
-    size_t ul_x = std::max(a.ul_x(), p.x());
-    size_t lr_y = std::min(a.lr_y(), p.y() + b.nrows());
-    size_t lr_x = std::min(a.lr_x(), p.x() + b.ncols());
-    double result = 0;
-    double area = 0;
-
-    progress_bar.set_length(lr_y - ul_y);
-    for (size_t y = ul_y, ya = ul_y-a.ul_y(), yb = ul_y-p.y(); y < lr_y; ++y, ++ya, ++yb) {
-      for (size_t x = ul_x, xa = ul_x-a.ul_x(), xb = ul_x-p.x(); x < lr_x; ++x, ++xa, ++xb) {
-	typename T::value_type px_a = a.get(Point(xb, yb));
-	typename U::value_type px_b = b.get(Point(xb, yb));
-	if (is_black(px_b))
-	  area++;
-	result += corelation_square_absolute_distance(px_a, px_b);
-      }
-      progress_bar.step();
-    }
-    return result / area;
+    using namespace CorelationDetail;
+    SquareAbsoluteDistance<typename T::value_type> corelation;
+    return corelation(overlap(a, b, p, PixelValue(), progress_bar));
+  }
+
+  template<class T, class U>
+  FloatImageView* corelation_sum_squares_map(const T& a, const U& b, const Point& offset, const Dim& size,
+                                             int threads) {
+    using namespace CorelationDetail;
+    SquareAbsoluteDistance<typename T::value_type> corelation;
+    return corelation_map(a, b, offset, size, PixelValue(), corelation, threads);
   }
 
 }
@@ -19,17 +19,24 @@
 #define _kwn12032001_deformations
 
 #include "plugins/image_utilities.hpp"
+#include "thread_exception.hpp"
 #include "vigra/resizeimage.hxx"
 #include "vigra/affinegeometry.hxx"
 #include "plugins/logical.hpp"
 #include "plugins/morphology.hpp"
 
 #include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include <cstdlib>
 #include <ctime>
 #include <math.h>
 #include <time.h>
 #include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // for backward compatibility:
 // plugin rotate has been moved from here to transformation.hpp
@@ -255,9 +262,36 @@ inline double sinc(float per, int n)
   return sin2(per,n)*per/(2*M_PI*n);
 }
 
-inline double noisefunc(void)
+/*
+ * Random numbers for the deformations.  The i-th number for a seed is
+ * a hash of the seed and of i (with the finalizer of splitmix64), so
+ * that it does not depend on the order in which the numbers are drawn:
+ * the numbers of the pixels can be drawn on any thread, and the
+ * deformations neither use nor change the global state of rand().
+ */
+class DeformationRandom {
+public:
+  DeformationRandom(long seed) : m_key(mix((unsigned long long)seed)), m_next(0) {}
+  // the i-th number, uniform in [0, 1)
+  double at(unsigned long long i) const {
+    return (mix(m_key + i * 0x9e3779b97f4a7c15ULL) >> 11) * (1.0 / 9007199254740992.0);
+  }
+  // the next number in sequence
+  double next() {
+    return at(m_next++);
+  }
+private:
+  static unsigned long long mix(unsigned long long z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+  unsigned long long m_key, m_next;
+};
+
+inline double noisefunc(DeformationRandom& random)
 {
-  return -1.0 + (2.0 * rand()/(RAND_MAX+1.0));
+  return -1.0 + 2.0 * random.next();
 }
 
 inline size_t expDim(size_t amp)
@@ -289,9 +323,9 @@ typename ImageFactory<T>::view_type* wave(const T &src, int amplitude, float fre
 
   typedef typename T::value_type pixelFormat;
 
-  srand(random_seed);
+  DeformationRandom random(random_seed);
 
-  pixelFormat background = pixelFormat(0.0);
+  pixelFormat background = pixelFormat(FloatPixel(0.0));
   
   data_type* new_data;
   view_type* new_view;
@@ -353,13 +387,13 @@ typename ImageFactory<T>::view_type* wave(const T &src, int amplitude, float fre
     
     if (direction) {
       for(size_t i=0; i<new_view->nrows(); i++) {
-	double shift = ((double)amplitude/2)*(1-waveType(freq,(int)i-offset))+(turbulence*(rand()/RAND_MAX))+(turbulence/2.0);
+	double shift = ((double)amplitude/2)*(1-waveType(freq,(int)i-offset))+(turbulence*random.next())+(turbulence/2.0);
 	shear_x(src, *new_view, i, (size_t)(floor(shift)), background, (double)(shift-floor(shift)));
       }
     }
     else {
       for(size_t i=0; i<new_view->ncols(); i++) {
-	double shift = ((double)amplitude/2)*(1-waveType(freq,(int)i-offset))+(turbulence*(rand()/RAND_MAX))+(turbulence/2.0);
+	double shift = ((double)amplitude/2)*(1-waveType(freq,(int)i-offset))+(turbulence*random.next())+(turbulence/2.0);
 	shear_y(src, *new_view, i, (size_t)(floor(shift)), background, (double)(shift - (size_t)(shift)));
       }
     }
@@ -387,7 +421,7 @@ typename ImageFactory<T>::view_type* noise(const T &src, int amplitude, int dire
 
   //image_copy_fill(src, *new_view);
 
-  srand(random_seed);
+  DeformationRandom random(random_seed);
 
   size_t (*vertExpand)(size_t), (*horizExpand)(size_t), (*vertShift)(size_t, double), (*horizShift)(size_t, double);
   
@@ -431,8 +465,8 @@ typename ImageFactory<T>::view_type* noise(const T &src, int amplitude, int dire
     
     for(size_t i = 0; i<src.nrows(); i++) {
       for(size_t j = 0; j<src.ncols();j++) {
-	new_view->set(Point(j+horizShift(amplitude,noisefunc()),
-			    i+vertShift(amplitude,noisefunc())),
+	new_view->set(Point(j+horizShift(amplitude,noisefunc(random)),
+			    i+vertShift(amplitude,noisefunc(random))),
 		      src.get(Point(j, i)));
       }
     }
@@ -470,7 +504,7 @@ typename ImageFactory<T>::view_type* inkrub(const T &src, int a, long random_see
     
     image_copy_fill(src, *new_view);
     
-    srand(random_seed);
+    DeformationRandom random(random_seed);
     
     for (int i=0; ir != src.row_end(); ++ir, ++jr, i++) {
       typename IteratorI::iterator ic = ir.begin();
@@ -478,7 +512,7 @@ typename ImageFactory<T>::view_type* inkrub(const T &src, int a, long random_see
       for (int j=0; ic != ir.end(); ++ic, ++jc, j++) {
 	pixelFormat px2 = *ic;
 	pixelFormat px1 = src.get(Point(new_view->ncols()-j-1, i));
-	if ((a*rand()/RAND_MAX) == 0)
+	if ((int)(a*random.next()) == 0)
 	  *jc = norm_weight_avg(px1, px2, 0.5, 0.5);
       }
     }
@@ -523,7 +557,7 @@ typename ImageFactory<T>::view_type* ink_diffuse(const T &src, int type, double
     pixelFormat aggColor = pixelFormat();
     pixelFormat currColor = pixelFormat();
     
-    srand(random_seed);
+    DeformationRandom random(random_seed);
     
     if (type == 0) {
       
@@ -570,9 +604,9 @@ typename ImageFactory<T>::view_type* ink_diffuse(const T &src, int type, double
       
       size_t starti, startj;
       double iD, jD;
-      iD = (double)src.ncols() * (double)rand() / (double)RAND_MAX;
+      iD = (double)src.ncols() * random.next();
       starti = (unsigned int)(floor(iD));
-      jD = (double)src.nrows() * (double)rand() / (double)RAND_MAX;
+      jD = (double)src.nrows() * random.next();
       startj = (unsigned int)(floor(jD));
       
       while( ( (iD>0) && (iD < src.ncols())) && ( (jD>0) && (jD<src.nrows()) ) ) {
@@ -584,8 +618,8 @@ typename ImageFactory<T>::view_type* ink_diffuse(const T &src, int type, double
 	aggColor = norm_weight_avg(aggColor, currColor, 1-weight, weight);
 	new_view->set(Point(size_t(floor(iD)), size_t(floor(jD))), 
 		      norm_weight_avg(aggColor, currColor, 1.0-val, val));
-	iD += sin(2.0*M_PI*rand()/(double)RAND_MAX);
-	jD += cos(2.0*M_PI*rand()/(double)RAND_MAX);
+	iD += sin(2.0*M_PI*random.next());
+	jD += cos(2.0*M_PI*random.next());
       }
     }
     
@@ -601,80 +635,163 @@ typename ImageFactory<T>::view_type* ink_diffuse(const T &src, int type, double
 
 /*
  * Image degradation after Kanungo et al.
+ *
+ * The distances of the pixels to the other color only depend on the
+ * image, and every pixel is flipped with its own random number (see
+ * DeformationRandom), so that several degradations of the same image
+ * share the distances and can be computed on separate threads.
  */
+namespace KanungoDetail {
+  // the maximum distance with a flip probability
+  const int max_distance = 32;
+
+  /*
+   * For every pixel in row-major order, the chessboard distance from a
+   * black pixel to the closest white pixel or from a white pixel to the
+   * closest black pixel, or max_distance + 1 when it is further away.
+   */
+  template<class T>
+  void distances(const T &src, std::vector<unsigned char>& dist)
+  {
+    typedef typename ImageFactory<T>::data_type data_type;
+    typedef typename ImageFactory<T>::view_type view_type;
+
+    // distance transforms of the foreground and of the inverted image
+    FloatImageView* dt_fore = (FloatImageView*)distance_transform(src, 0, 1);
+    data_type* inverted_data = new data_type(src.size(), src.origin());
+    view_type* inverted = new view_type(*inverted_data);
+    typename T::const_vec_iterator p = src.vec_begin();
+    typename view_type::vec_iterator q = inverted->vec_begin();
+    for (; p != src.vec_end(); p++, q++)
+      *q = is_black(*p) ? white(src) : black(src);
+    FloatImageView* dt_back = (FloatImageView*)distance_transform(*inverted, 0, 1);
+    delete inverted; delete inverted_data;
+
+    dist.resize(src.nrows() * src.ncols());
+    FloatImageView::vec_iterator df = dt_fore->vec_begin(), db = dt_back->vec_begin();
+    std::vector<unsigned char>::iterator d = dist.begin();
+    for (p = src.vec_begin(); p != src.vec_end(); p++, df++, db++, d++) {
+      int dp = (int)((is_black(*p) ? *df : *db) + 0.5);
+      *d = (unsigned char)std::min(dp, max_distance + 1);
+    }
+    delete dt_fore->data(); delete dt_fore;
+    delete dt_back->data(); delete dt_back;
+  }
+
+  /*
+   * One degradation of src with the given distances: the pixels are
+   * flipped randomly, followed by a closing with a k x k square.
+   */
+  template<class T>
+  typename ImageFactory<T>::view_type* degrade(const T &src, const std::vector<unsigned char>& dist,
+                                               float eta, float a0, float a, float b0, float b,
+                                               int k, long random_seed)
+  {
+    typedef typename ImageFactory<T>::data_type data_type;
+    typedef typename ImageFactory<T>::view_type view_type;
+    typedef typename T::value_type value_type;
+    value_type blackval = black(src);
+    value_type whiteval = white(src);
+
+    // flip probabilities by distance
+    double P_foreground_flip[max_distance];
+    double P_background_flip[max_distance];
+    for (int d=0; d<max_distance; d++) {
+      P_foreground_flip[d] = a0*exp(-a*(d+1)*(d+1)) + eta;
+      P_background_flip[d] = b0*exp(-b*(d+1)*(d+1)) + eta;
+    }
+
+    data_type* dest_data = new data_type(src.size(), src.origin());
+    view_type* dest = new view_type(*dest_data);
+
+    // flip pixels randomly based on their distance from border
+    DeformationRandom random(random_seed);
+    typename T::const_vec_iterator p = src.vec_begin();
+    typename view_type::vec_iterator q = dest->vec_begin();
+    for (size_t i = 0; p != src.vec_end(); p++, q++, i++) {
+      int d = dist[i];
+      bool foreground = is_black(*p);
+      bool flip = d > 0 && d <= max_distance &&
+        random.at(i) <= (foreground ? P_foreground_flip[d-1] : P_background_flip[d-1]);
+      *q = (foreground != flip) ? blackval : whiteval;
+    }
+
+    // do a morphological closing
+    if (k>1) {
+      // build structuring element
+      data_type* se_data = new data_type(Dim(k,k), Point(0,0));
+      view_type* se = new view_type(*se_data);
+      for (q=se->vec_begin(); q!=se->vec_end(); q++)
+        *q = blackval;
+      view_type* dilated = dilate_with_structure(*dest, *se, Point(k/2,k/2));
+      view_type* eroded = erode_with_structure(*dilated, *se, Point(k/2,k/2));
+      delete dilated->data(); delete dilated;
+      delete dest->data(); delete dest;
+      delete se_data; delete se;
+      dest = eroded;
+    }
+
+    return dest;
+  }
+}
+
 template<class T>
 typename ImageFactory<T>::view_type* degrade_kanungo(const T &src, float eta, float a0, float a, float b0, float b, int k, int random_seed = 0)
 {
-  typedef typename ImageFactory<T>::data_type data_type;
-  typedef typename ImageFactory<T>::view_type view_type;
-  typedef typename T::value_type value_type;
-  int d;
-  double randval;
+  std::vector<unsigned char> dist;
+  KanungoDetail::distances(src, dist);
+  return KanungoDetail::degrade(src, dist, eta, a0, a, b0, b, k, random_seed);
+}
 
-  FloatImageView *dt_fore, *dt_back;
-  typename T::const_vec_iterator p;
-  typename view_type::vec_iterator q;
-  FloatImageView::vec_iterator df,db;
-  value_type blackval = black(src);
-  value_type whiteval = white(src);
+/*
+ * n degradations of the same image, with the seeds random_seed,
+ * random_seed + 1, ..., computed on threads threads (0 for the OpenMP
+ * default).
+ */
+template<class T>
+ImageList* degrade_kanungo_variants(const T &src, float eta, float a0, float a, float b0, float b, int k, int n, int random_seed = 0, int threads = 0)
+{
+  typedef typename ImageFactory<T>::view_type view_type;
 
-  data_type* dest_data = new data_type(src.size(), src.origin());
-  view_type* dest = new view_type(*dest_data);
-  
-  // compute distance transform of foreground and background
-  // as dest is not yet needed we abuse it for storing the inverted image
-  dt_fore = (FloatImageView*)distance_transform(src, 0);
-  for (p=src.vec_begin(), q=dest->vec_begin(); p != src.vec_end(); p++, q++) {
-    if (is_black(*p)) *q = whiteval;
-    else *q = blackval;
-  }
-  dt_back = (FloatImageView*)distance_transform(*dest, 0);
-
-  // precompute probabilities (maximum distance 32 should be enough)
-  double P_foreground_flip[32];
-  double P_background_flip[32];
-  for (d=0; d<32; d++) {
-    P_foreground_flip[d] = a0*exp(-a*(d+1)*(d+1)) + eta;
-    P_background_flip[d] = b0*exp(-b*(d+1)*(d+1)) + eta;
+  if (n < 0)
+    throw std::range_error("degrade_kanungo_variants: n must not be negative.");
+  if (threads <= 0) {
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#else
+    threads = 1;
+#endif
   }
 
-  // flip pixels randomly based on their distance from border
-  srand(random_seed);
-  for (q=dest->vec_begin(), df=dt_fore->vec_begin(), db=dt_back->vec_begin();
-       q != dest->vec_end(); q++, df++, db++) {
-    randval = ((double)rand()) / RAND_MAX;
-    // note that dest is still inverted => black is background!!
-    if (is_black(*q)) {
-      d = (int)(*db + 0.5);
-      if ((d > 32) || (randval > P_background_flip[d-1]))
-        *q = whiteval;
-    } else {
-      d = (int)(*df + 0.5);
-      if ((d > 32) || (randval > P_foreground_flip[d-1]))
-        *q = blackval;
+  std::vector<unsigned char> dist;
+  KanungoDetail::distances(src, dist);
+  std::vector<view_type*> variants(n, (view_type*)NULL);
+
+  ThreadException error;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+  for (int i = 0; i < n; ++i) {
+    try {
+      variants[i] = KanungoDetail::degrade(src, dist, eta, a0, a, b0, b, k,
+                                           (long)random_seed + i);
+    } catch (...) {
+      error.keep();
     }
   }
 
-  // do a morphological closing
-  if (k>1) {
-    // build structuring element
-    data_type* se_data = new data_type(Dim(k,k), Point(0,0));
-    view_type* se = new view_type(*se_data);
-    for (q=se->vec_begin(); q!=se->vec_end(); q++)
-      *q = blackval;
-    view_type* dilated = dilate_with_structure(*dest, *se, Point(k/2,k/2));
-    view_type* eroded = erode_with_structure(*dilated, *se, Point(k/2,k/2));
-    delete dilated->data(); delete dilated;
-    delete dest->data(); delete dest;
-    delete se_data; delete se;
-    dest = eroded;
+  if (!error.empty()) {
+    for (int i = 0; i < n; ++i) {
+      if (variants[i] != NULL) {
+        delete variants[i]->data(); delete variants[i];
+      }
+    }
+    error.rethrow();
   }
-
-  // clean up
-  delete dt_fore->data(); delete dt_fore;
-  delete dt_back->data(); delete dt_back;
-
-  return dest;
+  ImageList* result = new ImageList();
+  for (int i = 0; i < n; ++i)
+    result->push_back(variants[i]);
+  return result;
 }
 
 
@@ -695,6 +812,7 @@ Image* white_speckles(const T &src, float p0, int n, int k, int connectivity = 2
 
   value_type blackval = black(src);
   value_type whiteval = white(src);
+  DeformationRandom random(random_seed);
 
   data_type* speckles_data = new data_type(src.size(), src.origin());
   view_type* speckles = new view_type(*speckles_data);
@@ -703,12 +821,12 @@ Image* white_speckles(const T &src, float p0, int n, int k, int connectivity = 2
   for (y=0; y <= maxy; y++) {
     for (x=0; x <= maxx; x++) {
       Point p(x,y);
-      if (is_black(src.get(p)) && (((double)rand()) / RAND_MAX < p0)) {
+      if (is_black(src.get(p)) && (random.next() < p0)) {
         speckles->set(p,blackval);
         for (i=0; i<n; i++) {
           if (p.x() == 0 || p.x() == maxx || p.y() == 0 || p.y() == maxy)
             break;
-          randval = ((double)rand()) / RAND_MAX;
+          randval = random.next();
           if (connectivity == 0) {
             // random rook move
             if (randval < 0.25)      p.x(p.x() + 1);
@@ -22,6 +22,8 @@
 #define mgd12032001_draw_hpp
 
 #include <stack>
+#include <vector>
+#include <algorithm>
 
 namespace Gamera {
 
@@ -296,72 +298,125 @@ namespace Gamera {
                 value, thickness, accuracy);
   }
 
-  /* From John R. Shaw's QuickFill code which is based on
-     "An Efficient Flood Visit Algorithm" by Anton Treuenfels,
-     C/C++ Users Journal Vol 12, No. 8, Aug 1994 */
+  /*
+    Scanline flood fill.
+
+    The stack holds horizontal runs that have already been filled. For
+    each run, the rows above and below are scanned for interior pixels,
+    and every interior run found there is filled as a whole and pushed.
+    The row the run was reached from needs to be scanned only outside
+    of the parent run. Runs of dense images are filled with std::fill
+    on the row pointer.
+  */
+  namespace FloodFillDetail {
+    template<class T>
+    inline typename T::value_type pixel(const T& image, size_t x, size_t y) {
+      return image.get(Point(x, y));
+    }
+
+    template<class P>
+    inline P pixel(const ImageView<ImageData<P> >& image, size_t x, size_t y) {
+      return image[y][x];
+    }
+
+    template<class T>
+    inline void fill_span(T& image, size_t y, size_t left, size_t right,
+                          const typename T::value_type& color) {
+      for (size_t x = left; x <= right; ++x)
+        image.set(Point(x, y), color);
+    }
+
+    template<class P>
+    inline void fill_span(ImageView<ImageData<P> >& image, size_t y,
+                          size_t left, size_t right, const P& color) {
+      P* row = image[y];
+      std::fill(row + left, row + right + 1, color);
+    }
+
+    template<class V>
+    struct EqualTo {
+      V interior;
+      EqualTo(const V& v) : interior(v) {}
+      bool operator()(const V& v) const { return v == interior; }
+    };
+
+    template<class V>
+    struct IsBlack {
+      bool operator()(const V& v) const { return is_black(v); }
+    };
+  }
 
   template<class T>
   struct FloodFill {
-    typedef std::stack<Point> Stack;
-
-    inline static void travel(T& image, Stack& s,
-                              const typename T::value_type& interior, 
-                              const typename T::value_type& color,
-                              const size_t left, const size_t right,
-                              const size_t y) {
-      if (left + 1 <= right) {
-        typename T::value_type col1, col2;
-        for (size_t x = left + 1; x <= right; ++x) {
-          col1 = image.get(Point(x-1, y));
-          col2 = image.get(Point(x, y));
-          if (col1 == interior && col2 != interior) {
-            s.push(Point(x-1, y));
-          }
-        }
-        if (col2 == interior) {
-          s.push(Point(right, y));
-        }
+    typedef typename T::value_type value_type;
+
+    struct Span {
+      size_t left, right, y;
+      // the parent run, if any
+      bool has_parent;
+      size_t parent_left, parent_right, parent_y;
+    };
+    typedef std::stack<Span, std::vector<Span> > Stack;
+
+    // Fills the interior run through (x, y) and pushes it. Returns the
+    // right end of the run.
+    template<class F>
+    static size_t fill_run(T& image, Stack& s, const F& inside,
+                           const value_type& color, size_t x, size_t y,
+                           const Span* parent) {
+      using namespace FloodFillDetail;
+      size_t left = x, right = x;
+      while (left > 0 && inside(pixel(image, left - 1, y)))
+        --left;
+      while (right + 1 < image.ncols() && inside(pixel(image, right + 1, y)))
+        ++right;
+      fill_span(image, y, left, right, color);
+      Span span;
+      span.left = left;
+      span.right = right;
+      span.y = y;
+      span.has_parent = (parent != 0);
+      if (parent) {
+        span.parent_left = parent->left;
+        span.parent_right = parent->right;
+        span.parent_y = parent->y;
       }
+      s.push(span);
+      return right;
     }
 
-    static void fill_seeds(T& image, Stack& s, 
-                           const typename T::value_type& interior, 
-                           const typename T::value_type& color) {
-      typedef typename T::value_type pixel_t;
-      size_t left, right;
+    // Fills and pushes all interior runs of row y that touch [left, right]
+    template<class F>
+    static void scan(T& image, Stack& s, const F& inside,
+                     const value_type& color, size_t left, size_t right,
+                     size_t y, const Span* parent) {
+      for (size_t x = left; x <= right; ++x) {
+        if (inside(FloodFillDetail::pixel(image, x, y)))
+          x = fill_run(image, s, inside, color, x, y, parent) + 1;
+      }
+    }
+
+    template<class F>
+    static void fill_seeds(T& image, Stack& s, const F& inside,
+                           const value_type& color) {
       while (!s.empty()) {
-        Point p = s.top();
+        Span span = s.top();
         s.pop();
-        if (image.get(p) == interior) {
-          for (right = p.x();
-               right < image.ncols();
-               ++right) {
-            if (image.get(Point(right, p.y())) != interior)
-              break;
-            image.set(Point(right, p.y()), color);
-          }
-          --right;
-
-          long int l = p.x() - 1;
-          for (; l >= 0; --l) {
-            if (image.get(Point(l, p.y())) != interior)
-              break;
-            image.set(Point(l, p.y()), color);
-          }
-          left = (size_t)l + 1;
-
-          if (left != right) {
-            if (p.y() < image.nrows() - 1)
-              travel(image, s, interior, color, left, right, p.y() + 1);
-            if (p.y() > 0)
-              travel(image, s, interior, color, left, right, p.y() - 1);
+        for (int dir = -1; dir <= 1; dir += 2) {
+          if ((dir < 0 && span.y == 0) ||
+              (dir > 0 && span.y + 1 >= image.nrows()))
+            continue;
+          size_t y = span.y + dir;
+          if (span.has_parent && y == span.parent_y) {
+            // the parent run itself is already filled
+            if (span.left < span.parent_left)
+              scan(image, s, inside, color,
+                   span.left, span.parent_left - 1, y, &span);
+            if (span.right > span.parent_right)
+              scan(image, s, inside, color,
+                   span.parent_right + 1, span.right, y, &span);
           } else {
-            if (p.y() < image.nrows() - 1)
-              if (image.get(Point(left, p.y() + 1)) != color)
-                s.push(Point(left, p.y() + 1));
-            if (p.y() > 1)
-              if (image.get(Point(left, p.y() - 1)) != color)
-                s.push(Point(left, p.y() - 1));
+            scan(image, s, inside, color, span.left, span.right, y, &span);
           }
         }
       }
@@ -372,31 +427,50 @@ namespace Gamera {
   void flood_fill(T& image, const P& p, const typename T::value_type& color) {
     double x = double(p.x()) - double(image.ul_x());
     double y = double(p.y()) - double(image.ul_y());
-    if (y >= image.nrows() || x >= image.ncols())
+    if (x < 0 || y < 0 || y >= image.nrows() || x >= image.ncols())
       throw std::runtime_error("Coordinate out of range.");
     typename T::value_type interior = image.get(Point((size_t)x, (size_t)y));
     if (color == interior)
       return;
+    FloodFillDetail::EqualTo<typename T::value_type> inside(interior);
     typename FloodFill<T>::Stack s;
-    s.push(Point((size_t)x, (size_t)y));
-    FloodFill<T>::fill_seeds(image, s, interior, color);
+    FloodFill<T>::fill_run(image, s, inside, color, (size_t)x, (size_t)y, 0);
+    FloodFill<T>::fill_seeds(image, s, inside, color);
   }
 
+  /*
+    Clears all black pixels that are 4-connected to the image border.
+    The border is walked once and the stack is drained after each seed,
+    so that border pixels of an already cleared component are skipped
+    and every component is filled exactly once.
+  */
   template<class T>
   void remove_border(T& image) {
+    typedef FloodFill<T> Fill;
+    FloodFillDetail::IsBlack<typename T::value_type> inside;
+    typename T::value_type color = white(image);
+    typename Fill::Stack s;
     size_t bottom = image.nrows() - 1;
     size_t right = image.ncols() - 1;
-    for (size_t x = 0; x < image.ncols(); ++x) {
-      if (image.get(Point(x, 0)) != 0)
-        flood_fill(image, Point(x, 0), white(image));
-      if (image.get(Point(x, bottom)) != 0)
-        flood_fill(image, Point(x, bottom), white(image));
+    for (size_t x = 0; x <= right; ++x) {
+      if (inside(FloodFillDetail::pixel(image, x, 0))) {
+        Fill::fill_run(image, s, inside, color, x, 0, 0);
+        Fill::fill_seeds(image, s, inside, color);
+      }
+      if (inside(FloodFillDetail::pixel(image, x, bottom))) {
+        Fill::fill_run(image, s, inside, color, x, bottom, 0);
+        Fill::fill_seeds(image, s, inside, color);
+      }
     }
-    for (size_t y = 0; y < image.nrows(); ++y) {
-      if (image.get(Point(0, y)) != 0)
-        flood_fill(image, Point(0, y), white(image));
-      if (image.get(Point(right, y)) != 0)
-        flood_fill(image, Point(right, y), white(image));
+    for (size_t y = 0; y <= bottom; ++y) {
+      if (inside(FloodFillDetail::pixel(image, 0, y))) {
+        Fill::fill_run(image, s, inside, color, 0, y, 0);
+        Fill::fill_seeds(image, s, inside, color);
+      }
+      if (inside(FloodFillDetail::pixel(image, right, y))) {
+        Fill::fill_run(image, s, inside, color, right, y, 0);
+        Fill::fill_seeds(image, s, inside, color);
+      }
     }
   }
 
@@ -25,6 +25,9 @@
 #include "vigra/edgedetection.hxx"
 #include "logical.hpp"
 #include "morphology.hpp"
+#include "convolution.hpp"
+#include <vector>
+#include <cmath>
 
 namespace Gamera {
 
@@ -82,23 +85,196 @@ namespace Gamera {
     return dest;
   }
 
+  /*
+    Raster version of vigra's cannyEdgeImage.
+
+    The gradients are computed with the native convolution engine in the
+    same order as in vigra's cannyEdgelList, and the non-maximum
+    suppression uses the same arithmetic, so that without hysteresis the
+    same pixels are marked.  Instead of collecting the edgels in a list,
+    each pixel gets a byte code for the pixel its edgel falls on and
+    whether it is a strong or a weak edgel; the pixels are then marked
+    from these codes row by row.  All passes run over rows in parallel.
+  */
+  namespace CannyDetail {
+    inline ConvolutionDetail::Kernel engine_kernel(const vigra::Kernel1D<double>& k) {
+      ConvolutionDetail::Kernel result;
+      result.left = k.left();
+      result.right = k.right();
+      for (int i = k.left(); i <= k.right(); ++i)
+        result.taps.push_back(k[i]);
+      return result;
+    }
+
+    enum { NONE = 0, WEAK = 1, STRONG = 2 };
+
+    /*
+      The edgel codes of row y: 0 for no edgel, else
+      1 + (ox + 1) + 3 * (oy + 1) + 9 * (strength class - 1), where
+      (ox, oy) is the offset of the pixel the edgel is rounded to.
+    */
+    inline void find_edgels(const FloatImageView& gx, const FloatImageView& gy,
+                            const FloatImageView& mag, long y, double high,
+                            double low, unsigned char* codes) {
+      const double t = 0.5 / std::sin(M_PI / 8.0);
+      const long ncols = mag.ncols();
+      for (long x = 1; x < ncols - 1; ++x) {
+        const double m = mag[y][x];
+        codes[x] = 0;
+        if (m == 0.0)
+          continue;
+        const int dx = (int)std::floor(gx[y][x] * t / m + 0.5);
+        const int dy = (int)std::floor(gy[y][x] * t / m + 0.5);
+        const double m1 = mag[y - dy][x - dx];
+        const double m3 = mag[y + dy][x + dx];
+        if (m1 < m && m3 <= m) {
+          // sub-pixel position and strength as stored by vigra's Edgel
+          const double del = (m1 - m3) / 2.0 / (m1 + m3 - 2.0 * m);
+          const float ex = x + dx * del;
+          const float ey = y + dy * del;
+          const float strength = m;
+          int strength_class;
+          if (high < strength)
+            strength_class = STRONG;
+          else if (low < strength)
+            strength_class = WEAK;
+          else
+            continue;
+          const int ox = (int)(ex + 0.5) - (int)x;
+          const int oy = (int)(ey + 0.5) - (int)y;
+          codes[x] = (unsigned char)(1 + (ox + 1) + 3 * (oy + 1) +
+                                     9 * (strength_class - 1));
+        }
+      }
+    }
+
+    // The strongest edgel class that falls on each pixel of row y.
+    inline void collect_row(const std::vector<unsigned char>& codes, long y,
+                            long nrows, long ncols, unsigned char* classes) {
+      std::fill(classes, classes + ncols, (unsigned char)NONE);
+      for (long sy = std::max(1L, y - 1); sy <= std::min(nrows - 2, y + 1); ++sy) {
+        const unsigned char* row = &codes[sy * ncols];
+        for (long x = 1; x < ncols - 1; ++x) {
+          if (row[x] == 0)
+            continue;
+          const int code = row[x] - 1;
+          const int oy = (code / 3) % 3 - 1;
+          if (sy + oy != y)
+            continue;
+          const int ox = code % 3 - 1;
+          const unsigned char c = (unsigned char)(code / 9 + 1);
+          if (classes[x + ox] < c)
+            classes[x + ox] = c;
+        }
+      }
+    }
+  }
+
   template<class T>
-  typename ImageFactory<T>::view_type* canny_edge_image(const T& src, double scale, double gradient_threshold) {
+  typename ImageFactory<T>::view_type* canny_edge_image(const T& src, double scale, double gradient_threshold, double low_threshold = -1.0, int threads = 0) {
+    using namespace CannyDetail;
+    typedef typename T::value_type value_type;
     if ((scale < 0) || (gradient_threshold < 0))
       throw std::runtime_error("The scale and gradient threshold must be >= 0");
 
+    vigra::Kernel1D<double> smooth, grad;
+    smooth.initGaussian(scale);
+    grad.initGaussianDerivative(scale, 1);
+    const long nrows = src.nrows(), ncols = src.ncols();
+    const long size = std::max(smooth.right() - smooth.left() + 1,
+                               grad.right() - grad.left() + 1);
+
     typename ImageFactory<T>::data_type* dest_data =
       new typename ImageFactory<T>::data_type(src.size(), src.origin());
 
     typename ImageFactory<T>::view_type* dest =
       new typename ImageFactory<T>::view_type(*dest_data, src);
 
-    try {
-      vigra::cannyEdgeImage(src_image_range(src), dest_image(*dest), scale, gradient_threshold, NumericTraits<typename T::value_type>::one());
-    } catch (std::exception e) {
-      delete dest;
-      delete dest_data;
-      throw;
+    if (ncols < size || nrows < size) {
+      // too small for the kernels; vigra decides what to do
+      try {
+        vigra::cannyEdgeImage(src_image_range(src), dest_image(*dest), scale, gradient_threshold, NumericTraits<value_type>::one());
+      } catch (std::exception e) {
+        delete dest;
+        delete dest_data;
+        throw;
+      }
+      return dest;
+    }
+
+    threads = ConvolutionDetail::resolve_threads(threads);
+    const ConvolutionDetail::Kernel ks = engine_kernel(smooth);
+    const ConvolutionDetail::Kernel kg = engine_kernel(grad);
+    const int border = BORDER_TREATMENT_REFLECT;
+    const double low = (low_threshold < 0 || low_threshold > gradient_threshold)
+      ? gradient_threshold : low_threshold;
+
+    FloatImageData tmp_data(src.size(), src.origin());
+    FloatImageData gx_data(src.size(), src.origin());
+    FloatImageData gy_data(src.size(), src.origin());
+    FloatImageView tmp(tmp_data), gx(gx_data), gy(gy_data);
+    ConvolutionDetail::convolve_rows(src, tmp, kg, border, threads);
+    ConvolutionDetail::convolve_columns(tmp, gx, ks, border, threads);
+    ConvolutionDetail::convolve_columns(src, tmp, kg, border, threads);
+    ConvolutionDetail::convolve_rows(tmp, gy, ks, border, threads);
+
+    // the gradient magnitude goes into tmp
+    FloatImageView& mag = tmp;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+    for (long y = 0; y < nrows; ++y) {
+      const FloatPixel* a = gx[y];
+      const FloatPixel* b = gy[y];
+      FloatPixel* m = mag[y];
+      for (long x = 0; x < ncols; ++x)
+        m[x] = std::sqrt(a[x] * a[x] + b[x] * b[x]);
+    }
+
+    std::vector<unsigned char> codes(nrows * ncols, 0);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+    for (long y = 1; y < nrows - 1; ++y)
+      find_edgels(gx, gy, mag, y, gradient_threshold, low, &codes[y * ncols]);
+
+    const value_type one = NumericTraits<value_type>::one();
+    std::vector<unsigned char> classes(nrows * ncols);
+    bool any_weak = false;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static) reduction(||:any_weak)
+#endif
+    for (long y = 0; y < nrows; ++y) {
+      unsigned char* row = &classes[y * ncols];
+      collect_row(codes, y, nrows, ncols, row);
+      for (long x = 0; x < ncols; ++x) {
+        if (row[x] == STRONG)
+          dest->set(Point(x, y), one);
+        else if (row[x] == WEAK)
+          any_weak = true;
+      }
+    }
+
+    if (any_weak) {
+      // hysteresis: the weak edge pixels connected to a strong one
+      std::vector<long> stack;
+      for (long i = 0; i < nrows * ncols; ++i)
+        if (classes[i] == STRONG)
+          stack.push_back(i);
+      while (!stack.empty()) {
+        const long i = stack.back();
+        stack.pop_back();
+        const long y = i / ncols, x = i % ncols;
+        for (long ny = std::max(0L, y - 1); ny <= std::min(nrows - 1, y + 1); ++ny)
+          for (long nx = std::max(0L, x - 1); nx <= std::min(ncols - 1, x + 1); ++nx) {
+            const long j = ny * ncols + nx;
+            if (classes[j] == WEAK) {
+              classes[j] = STRONG;
+              dest->set(Point(nx, ny), one);
+              stack.push_back(j);
+            }
+          }
+      }
     }
     return dest;
   }
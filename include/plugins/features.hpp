@@ -24,13 +24,22 @@
 #define kwm10242002_features
 
 #include "gamera.hpp"
+#include "thread_exception.hpp"
 #include "image_utilities.hpp"
 #include "morphology.hpp"
 #include "thinning.hpp"
 #include "plugins/projections.hpp"
 #include "plugins/transformation.hpp"
+#include "plugins/rle_utilities.hpp"
+#include "plugins/packed_utilities.hpp"
 #include <cmath>
 #include <vector>
+#include <string>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace Gamera {
   //
@@ -123,14 +132,12 @@ namespace Gamera {
     }
   }
 
-  template<class T>
-  void moments(T &m, feature_t* buf) {
-    feature_t m10 = 0, m11 = 0, m20 = 0, m21 = 0, m12 = 0, 
-      m01 = 0, m02 = 0, m30 = 0, m03 = 0, m00 = 0, dummy = 0;
-    moments_1d(m.row_begin(), m.row_end(), m00, m01, m02, m03);
-    moments_1d(m.col_begin(), m.col_end(), dummy, m10, m20, m30);
-    moments_2d(m.col_begin(), m.col_end(), m11, m12, m21);
-
+  // the normalized moments from the raw moment sums
+  inline void moments_from_sums(size_t nrows, size_t ncols, feature_t m00,
+                                feature_t m10, feature_t m01, feature_t m20,
+                                feature_t m02, feature_t m11, feature_t m30,
+                                feature_t m03, feature_t m12, feature_t m21,
+                                feature_t* buf) {
     feature_t x, y, x2, y2, div;
     x = (feature_t)m10 / m00;
     x2 = 2 * x * x;
@@ -138,12 +145,12 @@ namespace Gamera {
     y2 = 2 * y * y;
 
     // normalized center of gravity [0,1]
-    if (m.ncols() > 1)
-      *(buf++) = x / (m.ncols()-1);
+    if (ncols > 1)
+      *(buf++) = x / (ncols-1);
     else
       *(buf++) = 0.5; // only one pixel wide
-    if (m.nrows() > 1)
-      *(buf++) = y / (m.nrows()-1);
+    if (nrows > 1)
+      *(buf++) = y / (nrows-1);
     else
       *(buf++) = 0.5; // only one pixel high
   
@@ -158,6 +165,17 @@ namespace Gamera {
     *(buf++) = (m21 - (2 * x * m11) - (y * m20) + (x2 * m01)) / div;    // u21
     *buf = (m03 - (3 * y * m02) + (y2 * m01)) / div;                // u03
   }
+
+  template<class T>
+  void moments(T &m, feature_t* buf) {
+    feature_t m10 = 0, m11 = 0, m20 = 0, m21 = 0, m12 = 0, 
+      m01 = 0, m02 = 0, m30 = 0, m03 = 0, m00 = 0, dummy = 0;
+    moments_1d(m.row_begin(), m.row_end(), m00, m01, m02, m03);
+    moments_1d(m.col_begin(), m.col_end(), dummy, m10, m20, m30);
+    moments_2d(m.col_begin(), m.col_end(), m11, m12, m21);
+    moments_from_sums(m.nrows(), m.ncols(), m00, m10, m01, m20, m02, m11,
+                      m30, m03, m12, m21, buf);
+  }
  
   // Number of holes in x and y direction
   
@@ -200,15 +218,114 @@ namespace Gamera {
     return hole_count;
   }
   
+  // the white runs of a row or column as needed by nholes_1d
+  struct FusedLineRuns {
+    int holes; // number of black pixels followed by a white one
+    bool last; // whether the line ends with a black pixel
+    bool has_black;
+    FusedLineRuns() : holes(0), last(false), has_black(false) {}
+  };
+
+  // nholes_1d over the lines [begin, end)
+  inline int fused_nholes(const std::vector<FusedLineRuns>& lines,
+                          size_t begin, size_t end) {
+    int hole_count = 0;
+    for (size_t i = begin; i < end; ++i) {
+      hole_count += lines[i].holes;
+      if (!lines[i].last && hole_count && lines[i].has_black)
+        hole_count--;
+    }
+    return hole_count;
+  }
+
+  // row y of a OneBit image packed into words as in packed_utilities.hpp
+  // (bit x of the row is column x, the bits past the last column are 0)
+  template<class T>
+  void nholes_pack_row(const T& image, size_t y, packed_word* out) {
+    const size_t W = PackedDataDetail::WORD_BITS;
+    std::fill(out, out + PackedDataDetail::words_for(image.ncols()), packed_word(0));
+    typename T::const_row_iterator row = image.row_begin() + y;
+    typename T::const_row_iterator::iterator c = row.begin();
+    for (size_t x = 0; c != row.end(); ++c, ++x)
+      if (is_black(*c))
+        out[x / W] |= packed_word(1) << (x % W);
+  }
+
+  inline void nholes_pack_row(const OneBitPackedImageView& image, size_t y,
+                              packed_word* out) {
+    get_packed_row(image, y, out);
+  }
+
+  // The runs of the rows and columns of an image as needed by nholes_1d,
+  // from its rows packed into words: the black pixels followed by a
+  // white one are the bits of w & ~(w >> 1) within a row (the bits of
+  // the next word shifted in), and of above & ~below between two rows.
+  template<class T>
+  void nholes_line_runs(const T& image, std::vector<FusedLineRuns>& rows,
+                        std::vector<FusedLineRuns>& cols) {
+    const size_t W = PackedDataDetail::WORD_BITS;
+    size_t nrows = image.nrows(), ncols = image.ncols();
+    size_t nwords = PackedDataDetail::words_for(ncols);
+    packed_word last_bit = packed_word(1) << ((ncols - 1) % W);
+    rows.assign(nrows, FusedLineRuns());
+    cols.assign(ncols, FusedLineRuns());
+    PackedRow above(nwords, 0), row(nwords), any(nwords, 0);
+    for (size_t y = 0; y < nrows; ++y) {
+      nholes_pack_row(image, y, &row[0]);
+      FusedLineRuns& r = rows[y];
+      for (size_t i = 0; i < nwords; ++i) {
+        packed_word next = i + 1 < nwords ? row[i + 1] : 0;
+        packed_word ends = row[i] & ~((row[i] >> 1) | (next << (W - 1)));
+        r.holes += int(packed_popcount(ends));
+        r.has_black = r.has_black || row[i] != 0;
+        for (ends = above[i] & ~row[i]; ends != 0; ends &= ends - 1)
+          ++cols[i * W + packed_lowest_bit(ends)].holes;
+        any[i] |= row[i];
+      }
+      // the black pixel at the end of the row is not followed by a white one
+      r.last = (row[nwords - 1] & last_bit) != 0;
+      if (r.last)
+        --r.holes;
+      above.swap(row);
+    }
+    for (size_t x = 0; x < ncols; ++x) {
+      packed_word bit = packed_word(1) << (x % W);
+      cols[x].last = (above[x / W] & bit) != 0;
+      cols[x].has_black = (any[x / W] & bit) != 0;
+    }
+  }
+
+  // nholes (or nholes_extended) from the runs of the rows and columns
+  inline void nholes_from_runs(const std::vector<FusedLineRuns>& rows,
+                               const std::vector<FusedLineRuns>& cols,
+                               bool extended, feature_t* buf) {
+    size_t nrows = rows.size(), ncols = cols.size();
+    if (!extended) {
+      buf[0] = (feature_t)fused_nholes(cols, 0, ncols) / ncols;
+      buf[1] = (feature_t)fused_nholes(rows, 0, nrows) / nrows;
+      return;
+    }
+    double quarter_cols = ncols / 4.0;
+    double start = 0.0;
+    for (size_t j = 0; j < 4; ++j) {
+      buf[j] = fused_nholes(cols, size_t(start),
+                            size_t(start) + size_t(quarter_cols)) / quarter_cols;
+      start += quarter_cols;
+    }
+    double quarter_rows = nrows / 4.0;
+    start = 0.0;
+    for (size_t j = 0; j < 4; ++j) {
+      buf[4 + j] = fused_nholes(rows, size_t(start),
+                                size_t(start) + size_t(quarter_rows)) / quarter_rows;
+      start += quarter_rows;
+    }
+  }
+
   template<class T>
   void nholes(T &m, feature_t* buf) {
-    int vert, horiz;
-    
-    vert = nholes_1d(m.col_begin(), m.col_end());
-    horiz = nholes_1d(m.row_begin(), m.row_end());
-    
-    *(buf++) = (feature_t)vert / m.ncols();
-    *buf = (feature_t)horiz / m.nrows();
+    std::vector<FusedLineRuns> rows, cols;
+    nholes_line_runs(m, rows, cols);
+    nholes_from_runs(rows, cols, false, buf);
   }
 
   //
@@ -219,22 +336,9 @@ namespace Gamera {
   //
   template<class T>
   void nholes_extended(const T& m, feature_t* buf) {
-    double quarter_cols = m.ncols() / 4.0;
-    double start = 0.0;
-    for (size_t i = 0; i < 4; ++i) {
-      *(buf++) = nholes_1d(m.col_begin() + size_t(start),
-			    m.col_begin() + size_t(start) + size_t(quarter_cols))
-                /quarter_cols;
-      start += quarter_cols;
-    }
-    double quarter_rows = m.nrows() / 4.0;
-    start = 0.0;
-    for (size_t i = 0; i < 4; ++i) {
-      *(buf++) = nholes_1d(m.row_begin() + size_t(start),
-			   m.row_begin() + size_t(start) + size_t(quarter_rows))
-               / quarter_rows;
-      start += quarter_rows;
-    }
+    std::vector<FusedLineRuns> rows, cols;
+    nholes_line_runs(m, rows, cols);
+    nholes_from_runs(rows, cols, true, buf);
   }
 
   template<class T>
@@ -374,6 +478,97 @@ namespace Gamera {
     *buf = result;
   }
 
+  // The regions of volume16regions and volume64regions, n x n regions:
+  // region (i, j) has the columns [x[i], x[i] + width[i]) and the rows
+  // [y[j], y[j] + height[j]), except that the regions (i, 0) with i > 0
+  // have height[n] rows, since the original loops did not reset the
+  // height for each column.
+  template<class T>
+  void volume_region_bounds(const T& image, size_t n,
+                            std::vector<size_t>& x, std::vector<size_t>& width,
+                            std::vector<size_t>& y, std::vector<size_t>& height) {
+    double cols = image.ncols() / double(n);
+    double rows = image.nrows() / double(n);
+    x.resize(n);
+    width.resize(n);
+    y.resize(n);
+    height.resize(n + 1);
+    double start = double(image.offset_x());
+    width[0] = std::max(size_t(cols), size_t(1));
+    for (size_t i = 0; i < n; ++i) {
+      x[i] = size_t(start) - image.offset_x();
+      start += cols;
+      if (i + 1 < n)
+        width[i + 1] = std::max(size_t(start + cols) - size_t(start), size_t(1));
+    }
+    start = double(image.offset_y());
+    height[0] = std::max(size_t(rows), size_t(1));
+    for (size_t j = 0; j < n; ++j) {
+      y[j] = size_t(start) - image.offset_y();
+      start += rows;
+      height[j + 1] = std::max(size_t(start + rows) - size_t(start), size_t(1));
+    }
+    for (size_t i = 0; i < n; ++i)
+      if (x[i] + width[i] > image.ncols() || y[i] + height[i] > image.nrows() ||
+          y[0] + height[n] > image.nrows())
+        throw std::range_error("volume regions: region out of range.");
+  }
+
+  // The volumes of the n x n regions from a summed-area table that only
+  // holds the corners of the regions: the black pixels of the rectangle
+  // [0, ys[a]) x [0, xs[b]) at table[a * xs.size() + b].  It takes one
+  // pass over the rows down to the lowest region.
+  template<class T>
+  void volume_regions(const T& image, size_t n, feature_t* buf) {
+    std::vector<size_t> x, width, y, height;
+    volume_region_bounds(image, n, x, width, y, height);
+    std::vector<size_t> xs, ys;
+    for (size_t i = 0; i < n; ++i) {
+      xs.push_back(x[i]);
+      xs.push_back(x[i] + width[i]);
+      ys.push_back(y[i]);
+      ys.push_back(y[i] + height[i]);
+    }
+    ys.push_back(y[0] + height[n]);
+    std::sort(xs.begin(), xs.end());
+    xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+    size_t stride = xs.size();
+    std::vector<size_t> table(ys.size() * stride);
+    // the black pixels of the rows above in [0, xs[b])
+    std::vector<size_t> above(stride, 0);
+    typename T::const_row_iterator row = image.row_begin();
+    for (size_t r = 0, a = 0; a < ys.size(); ++r, ++row) {
+      if (ys[a] == r)
+        std::copy(above.begin(), above.end(), table.begin() + stride * a++);
+      if (a == ys.size())
+        break;
+      size_t count = 0, col = 0;
+      typename T::const_row_iterator::iterator c = row.begin();
+      for (size_t b = 0; b < stride; ++b) {
+        for (; col < xs[b]; ++col, ++c)
+          if (is_black(*c))
+            ++count;
+        above[b] += count;
+      }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      size_t b0 = std::lower_bound(xs.begin(), xs.end(), x[i]) - xs.begin();
+      size_t b1 = std::lower_bound(xs.begin(), xs.end(), x[i] + width[i]) - xs.begin();
+      for (size_t j = 0; j < n; ++j) {
+        size_t h = (i > 0 && j == 0) ? height[n] : height[j];
+        size_t a0 = std::lower_bound(ys.begin(), ys.end(), y[j]) - ys.begin();
+        size_t a1 = std::lower_bound(ys.begin(), ys.end(), y[j] + h) - ys.begin();
+        size_t count = table[a1 * stride + b1] - table[a0 * stride + b1]
+          - table[a1 * stride + b0] + table[a0 * stride + b0];
+        *(buf++) = feature_t(count) / (h * width[i]);
+      }
+    }
+  }
+
   //
   // volume16regions
   //
@@ -382,31 +577,7 @@ namespace Gamera {
   //
   template<class T>
   void volume16regions(const T& image, feature_t* buf) {
-    double rows = image.nrows() / 4.0;
-    double cols = image.ncols() / 4.0;
-    size_t rows_int = size_t(rows);
-    size_t cols_int = size_t(cols);
-    Dim size(cols_int, rows_int);
-    if (size.ncols() == 0)
-        size.ncols(1);
-    if (size.nrows() == 0)
-        size.nrows(1);
-    double start_col = double(image.offset_x());
-    for (size_t i = 0; i < 4; ++i) {
-      double start_row = double(image.offset_y());
-      for (size_t j = 0; j < 4; ++j) {
-        T tmp(image, Point((size_t)start_col, (size_t)start_row), size);
-        *(buf++) = volume(tmp);
-        start_row += rows;
-        size.nrows( size_t(start_row + rows)-size_t(start_row));
-        if (size.nrows() == 0)
-            size.nrows(1);
-      }
-      start_col += cols;
-      size.ncols( size_t(start_col + cols) - size_t(start_col));
-      if (size.ncols() == 0)
-        size.ncols(1);
-    }
+    volume_regions(image, 4, buf);
   }
 
   //
@@ -417,31 +588,7 @@ namespace Gamera {
   //
   template<class T>
   void volume64regions(const T& image, feature_t* buf) {
-    double rows = image.nrows() / 8.0;
-    double cols = image.ncols() / 8.0;
-    size_t rows_int = size_t(rows);
-    size_t cols_int = size_t(cols);
-    Dim size(cols_int, rows_int);
-    if (size.ncols() == 0)
-        size.ncols(1);
-    if (size.nrows() == 0)
-        size.nrows(1);
-    double start_col = double(image.offset_x());
-    for (size_t i = 0; i < 8; ++i) {
-      double start_row = double(image.offset_y());
-      for (size_t j = 0; j < 8; ++j) {
-        T tmp(image, Point((size_t)start_col, (size_t)start_row), size);
-        *(buf++) = volume(tmp);
-        start_row += rows;
-        size.nrows( size_t(start_row + rows)-size_t(start_row));
-        if (size.nrows() == 0)
-            size.nrows(1);
-      }
-      start_col += cols;
-      size.ncols( size_t(start_col + cols) - size_t(start_col));
-      if (size.ncols() == 0)
-            size.ncols(1);
-    }
+    volume_regions(image, 8, buf);
   }
 
 
@@ -490,6 +637,64 @@ namespace Gamera {
     }
   }
 
+  // The radial polynomials up to order *order_n*, as evaluated by
+  // zer_pol_R, in the order of the Zernike moments features. Each term
+  // keeps the integer coefficients and the power of the distance it is
+  // multiplied with, so that evaluating all polynomials for a pixel only
+  // needs the powers of its distance to the center.
+  class ZernikeRadialTable {
+  public:
+    ZernikeRadialTable(size_t order_n) {
+      // precomputed factorials as in zer_pol_R => make sure that n < 11
+      const int fak_a[] = {1,1,2,6,24,120,720,5040,40320,362880,3628800};
+      if (order_n > 10)
+        throw std::range_error("zernike_moments: the order must be at most 10.");
+      max_power = 0;
+      for (int n = 2; n <= int(order_n); ++n) {
+        for (int m = n%2; m <= n; m += 2) {
+          begin.push_back(terms.size());
+          int sign = 1;
+          for (int s = 0; s <= (n-m)/2; ++s) {
+            Term t;
+            t.sign = sign;
+            t.na = fak_a[n-s] / fak_a[s];
+            t.nb = fak_a[(n+m)/2-s];
+            t.nc = fak_a[(n-m)/2-s];
+            t.power = (n-2*s == 0) ? 0 : s+1;
+            max_power = std::max(max_power, t.power);
+            terms.push_back(t);
+            sign = -sign;
+          }
+        }
+      }
+      begin.push_back(terms.size());
+    }
+    size_t size() const { return begin.size() - 1; }
+    // evaluates all polynomials at *distance*; *powers* must have room
+    // for max_power + 1 values
+    void evaluate(double distance, double* powers, double* values) const {
+      powers[0] = 1;
+      for (int k = 1; k <= max_power; ++k)
+        powers[k] = powers[k-1] * distance;
+      for (size_t i = 0; i < size(); ++i) {
+        double result = 0;
+        for (size_t j = begin[i]; j < begin[i+1]; ++j) {
+          const Term& t = terms[j];
+          result += t.sign * (t.na * powers[t.power] / t.nb) / t.nc;
+        }
+        values[i] = result;
+      }
+    }
+  private:
+    struct Term {
+      int sign, na, nb, nc, power;
+    };
+    std::vector<Term> terms;
+    // the terms of polynomial i are [begin[i], begin[i+1])
+    std::vector<size_t> begin;
+    int max_power;
+  };
+
   // we use this wrapper so that it is easy to
   // change the maximum order in the future
   template<class T>
@@ -500,18 +705,13 @@ namespace Gamera {
     zernike_moments( image, buf, 6);
   }
 
+  // the Zernike moments around the given center of mass
   template<class T>
-  void zernike_moments(const T& image, feature_t* buf, size_t order_n) {
+  void zernike_moments_from_centroid(const T& image, feature_t* buf, size_t order_n,
+                                     feature_t m00, double centroid_x, double centroid_y) {
     size_t const max_order_n=order_n; 
     size_t num_features=0; // evaluated by max_order_n
-    double x_dist, y_dist, real_tmp, imag_tmp;
-
-    // compute center of mass and normalization factor m00
-    feature_t m00=0, m10=0, m01=0, dummy1=0, dummy2=0, dummy3=0;
-    moments_1d(image.row_begin(), image.row_end(), m00, m01, dummy1, dummy2);
-    moments_1d(image.col_begin(), image.col_end(), dummy1, m10, dummy2, dummy3);
-    double centroid_x = m10/m00;
-    double centroid_y = m01/m00;
+    double x_dist, y_dist;
 
     // we use a Zernike circle that includes the entire image
     // beware however that some pixels can fall outside the circle
@@ -531,19 +731,34 @@ namespace Gamera {
       *(buf++) = 0.0;
     buf = begin;
 
-    size_t m, n, idx;
+    // The magnitude of zer_pol is that of its radial polynomial, so the
+    // angle is not needed. The squared distances of the columns and rows
+    // to the center are tabulated, and the polynomials are evaluated
+    // from the table of their coefficients.
+    ZernikeRadialTable table(max_order_n);
+    std::vector<double> x_dist2(image.ncols()), y_dist2(image.nrows());
+    for (size_t x = 0; x < image.ncols(); ++x) {
+      x_dist = (x - centroid_x) / unit_circle_scale;
+      x_dist2[x] = x_dist * x_dist;
+    }
+    for (size_t y = 0; y < image.nrows(); ++y) {
+      y_dist = (y - centroid_y) / unit_circle_scale;
+      y_dist2[y] = y_dist * y_dist;
+    }
+    std::vector<double> powers(max_order_n + 2), values(table.size());
+
+    size_t m, idx;
     typename T::const_vec_iterator it = image.vec_begin();
     for (size_t y = 0; y < image.nrows(); ++y) {
       for (size_t x = 0; x < image.ncols(); ++x, ++it) {
         if (is_black(*it)) {
-          x_dist = (x - centroid_x) / unit_circle_scale;
-          y_dist = (y - centroid_y) / unit_circle_scale;
-          for (n = 2, idx=0; n <= max_order_n; ++n) {
-            for (m = n%2; m <= n; m+=2) {
-              zer_pol(n, m, x_dist, y_dist, real_tmp, imag_tmp);
-              buf[idx++] += sqrt(real_tmp*real_tmp + imag_tmp*imag_tmp);
-            }
-          }
+          double distance = sqrt(x_dist2[x] + y_dist2[y]);
+          // pixels outside the unit circle do not contribute
+          if (distance > 1.0)
+            continue;
+          table.evaluate(distance, &powers[0], &values[0]);
+          for (idx = 0; idx < num_features; ++idx)
+            buf[idx] += fabs(values[idx]);
         }
       }
     }
@@ -559,9 +774,62 @@ namespace Gamera {
 
   }
 
+  template<class T>
+  void zernike_moments(const T& image, feature_t* buf, size_t order_n) {
+    // compute center of mass and normalization factor m00
+    feature_t m00=0, m10=0, m01=0, dummy1=0, dummy2=0, dummy3=0;
+    moments_1d(image.row_begin(), image.row_end(), m00, m01, dummy1, dummy2);
+    moments_1d(image.col_begin(), image.col_end(), dummy1, m10, dummy2, dummy3);
+    zernike_moments_from_centroid(image, buf, order_n, m00, m10/m00, m01/m00);
+  }
+
   //
   // Skeleton features
   //
+  // The skeleton of thin_lc is computed on the pixels without making an
+  // image of it, and its joints and end points are counted row by row
+  // in the final pass of the thinning (see thin_lc_pixels).
+  //
+  struct SkeletonCounts {
+    size_t T_joints, X_joints, bend_points, end_points, total_pixels;
+    size_t center_x, center_y;
+    SkeletonCounts() : T_joints(0), X_joints(0), bend_points(0), end_points(0),
+                       total_pixels(0), center_x(0), center_y(0) { }
+
+    void operator()(const ThinningDetail::Pixels& pixels, size_t y) {
+      const unsigned char* row = &pixels.black[y * pixels.ncols];
+      for (size_t x = 0; x < pixels.ncols; ++x) {
+        if (!row[x])
+          continue;
+        ++total_pixels;
+        center_x += x;
+        center_y += y;
+        unsigned char p = pixels.neighborhood(x, y);
+        size_t N = 0;
+        for (unsigned char q = p; q != 0; q &= q - 1)
+          ++N;
+        switch (N) {
+        case 4:
+          ++X_joints;
+          break;
+        case 3:
+          ++T_joints;
+          break;
+        case 2:
+          if (!(((p & 17) == 17) || // Crosswise pairs
+                ((p & 34) == 34) ||
+                ((p & 68) == 68) ||
+                ((p & 136) == 136)))
+            ++bend_points;
+          break;
+        case 1:
+          ++end_points;
+          break;
+        }
+      }
+    }
+  };
+
   template<class T>
   void skeleton_features(const T& image, feature_t* buf) {
     if (image.nrows() == 1 || image.ncols() == 1) {
@@ -574,79 +842,43 @@ namespace Gamera {
       return;
     }
 
-    typedef typename ImageFactory<T>::view_type* view_type;
-    view_type skel = thin_lc(image);
-    unsigned char p;
-    size_t T_joints = 0, X_joints = 0, bend_points = 0;
-    size_t end_points = 0, total_pixels = 0;
-    size_t center_x = 0, center_y = 0;
-    for (size_t y = 0; y < skel->nrows(); ++y) {
-      size_t y_before = (y == 0) ? 1 : y - 1;
-      size_t y_after = (y == skel->nrows() - 1) ? skel->nrows() - 2 : y + 1;
-      for (size_t x = 0; x < skel->ncols(); ++x) {
-	if (is_black(skel->get(Point(x, y)))) {
-	  ++total_pixels;
-	  center_x += x;
-	  center_y += y;
-	  size_t N, S;
-	  thin_zs_get(y, y_before, y_after, x, *skel, p, N, S);
-	  switch (N) {
-	  case 4:
-	    ++X_joints;
-	    break;
-	  case 3:
-	    ++T_joints;
-	    break;
-	  case 2:
-	    if (!(((p & 17) == 17) || // Crosswise pairs
-		  ((p & 34) == 34) ||
-		  ((p & 68) == 68) ||
-		  ((p & 136) == 136))) 
-	      ++bend_points;
-	    break;
-	  case 1:
-	    ++end_points;
-	    break;
-	  }
-	}
-      }
-    }
+    ThinningDetail::Pixels skel(image);
+    SkeletonCounts counts;
+    ThinningDetail::thin_lc_pixels(skel, counts);
+    size_t total_pixels = counts.total_pixels;
     if (total_pixels == 0) {
       for (size_t i = 0; i < 6; ++i)
 	*(buf++) = 0.0;
       return;
     }
 
-    center_x /= total_pixels;
+    size_t center_x = counts.center_x / total_pixels;
     size_t x_axis_crossings = 0;
     bool last_pixel = false;
-    for (size_t y = 0; y < skel->nrows(); ++y)
-      if (is_black(skel->get(Point(center_x, y))) && !last_pixel) {
+    for (size_t y = 0; y < skel.nrows; ++y)
+      if (skel.black[y * skel.ncols + center_x] && !last_pixel) {
         last_pixel = true;
         ++x_axis_crossings;
       } else {
         last_pixel = false;
       }
   
-    center_y /= total_pixels;
+    size_t center_y = counts.center_y / total_pixels;
     size_t y_axis_crossings = 0;
     last_pixel = false;
-    for (size_t x = 0; x < skel->ncols(); ++x) {
-      if (is_black(skel->get(Point(x, center_y))) && !last_pixel) {
+    for (size_t x = 0; x < skel.ncols; ++x) {
+      if (skel.black[center_y * skel.ncols + x] && !last_pixel) {
         last_pixel = true;
         ++y_axis_crossings;
       } else {
         last_pixel = false;
       }
     }
-    
-    delete skel->data();
-    delete skel;
 
-    *(buf++) = feature_t(X_joints);
-    *(buf++) = feature_t(T_joints);
-    *(buf++) = feature_t(bend_points) / feature_t(total_pixels);
-    *(buf++) = feature_t(end_points);
+    *(buf++) = feature_t(counts.X_joints);
+    *(buf++) = feature_t(counts.T_joints);
+    *(buf++) = feature_t(counts.bend_points) / feature_t(total_pixels);
+    *(buf++) = feature_t(counts.end_points);
     *(buf++) = feature_t(x_axis_crossings);
     *buf = feature_t(y_axis_crossings);
   }
@@ -727,5 +959,637 @@ namespace Gamera {
     delete proj_y;
     delete rotated_image;
   }
+
+  // run_statistics: the histograms of the lengths of the black runs in
+  // four directions (horizontal, vertical, down-right and down-left),
+  // in bins of doubling width (1, 2-3, 4-7, ..., >= 128), and the
+  // stroke width, which is the median over the black pixels of the
+  // shortest of the four runs through each pixel.
+  const size_t RUN_STATISTICS_BINS = 8;
+
+  inline size_t run_statistics_bin(size_t length) {
+    size_t bin = 0;
+    for (; length > 1 && bin + 1 < RUN_STATISTICS_BINS; length >>= 1)
+      ++bin;
+    return bin;
+  }
+
+  // the runs of the line from (x, y) in the direction (dx, dy)
+  inline void run_statistics_line(const std::vector<unsigned char>& black,
+                                  std::vector<size_t>& shortest,
+                                  size_t nrows, size_t ncols, long x, long y,
+                                  long dx, long dy, feature_t* hist) {
+    long step = dy * long(ncols) + dx;
+    size_t length = 0;
+    long p = y * long(ncols) + x;
+    while (true) {
+      bool inside = x >= 0 && x < long(ncols) && y < long(nrows);
+      if (inside && black[p]) {
+        ++length;
+      } else if (length) {
+        hist[run_statistics_bin(length)] += 1;
+        for (size_t i = 1; i <= length; ++i) {
+          size_t& s = shortest[p - long(i) * step];
+          s = std::min(s, length);
+        }
+        length = 0;
+      }
+      if (!inside)
+        break;
+      x += dx;
+      y += dy;
+      p += step;
+    }
+  }
+
+  template<class T>
+  void run_statistics(const T& image, feature_t* buf) {
+    const size_t bins = RUN_STATISTICS_BINS;
+    size_t nrows = image.nrows(), ncols = image.ncols();
+    std::vector<unsigned char> black(nrows * ncols);
+    typename T::const_vec_iterator it = image.vec_begin();
+    for (size_t i = 0; i < black.size(); ++i, ++it)
+      black[i] = is_black(*it);
+    std::vector<size_t> shortest(black.size(), std::max(nrows, ncols));
+    std::fill(buf, buf + 4 * bins + 1, 0.0);
+
+    for (size_t y = 0; y < nrows; ++y)
+      run_statistics_line(black, shortest, nrows, ncols, 0, y, 1, 0, buf);
+    for (size_t x = 0; x < ncols; ++x)
+      run_statistics_line(black, shortest, nrows, ncols, x, 0, 0, 1, buf + bins);
+    // the diagonals start in the top row and in the left (right) column
+    for (size_t x = 0; x < ncols; ++x) {
+      run_statistics_line(black, shortest, nrows, ncols, x, 0, 1, 1, buf + 2 * bins);
+      run_statistics_line(black, shortest, nrows, ncols, x, 0, -1, 1, buf + 3 * bins);
+    }
+    for (size_t y = 1; y < nrows; ++y) {
+      run_statistics_line(black, shortest, nrows, ncols, 0, y, 1, 1, buf + 2 * bins);
+      run_statistics_line(black, shortest, nrows, ncols, ncols - 1, y, -1, 1,
+                          buf + 3 * bins);
+    }
+
+    // each histogram holds the fractions of the runs of its direction
+    for (size_t d = 0; d < 4; ++d) {
+      feature_t* hist = buf + d * bins;
+      feature_t runs = 0;
+      for (size_t i = 0; i < bins; ++i)
+        runs += hist[i];
+      if (runs > 0) {
+        for (size_t i = 0; i < bins; ++i)
+          hist[i] /= runs;
+      }
+    }
+
+    std::vector<size_t> widths(std::max(nrows, ncols) + 1, 0);
+    size_t count = 0;
+    for (size_t i = 0; i < black.size(); ++i) {
+      if (black[i]) {
+        ++widths[shortest[i]];
+        ++count;
+      }
+    }
+    if (count) {
+      size_t width = 0;
+      for (size_t seen = widths[0]; seen * 2 < count; seen += widths[width])
+        ++width;
+      buf[4 * bins] = feature_t(width);
+    }
+  }
+
+  //
+  // Fused feature extraction
+  //
+  // _fused_features computes several of the features above in one call.
+  // The intermediates that these share (the row and column projections,
+  // the moment sums, the runs in each row and column, and the black
+  // pixel counts of rectangles) are gathered in a single pass over the
+  // pixels, and each feature is then computed from them. The results
+  // are the same as those of the individual feature functions. The
+  // intermediates and the more expensive features are cached with the
+  // image until its pixels change.
+  //
+
+  // the codes of the features, in the order of fused_feature_names
+  // in features.py
+  enum FusedFeature {
+    FUSED_BLACK_AREA = 0, FUSED_MOMENTS, FUSED_NHOLES, FUSED_NHOLES_EXTENDED,
+    FUSED_VOLUME, FUSED_AREA, FUSED_ASPECT_RATIO, FUSED_NROWS, FUSED_NCOLS,
+    FUSED_COMPACTNESS, FUSED_VOLUME16REGIONS, FUSED_VOLUME64REGIONS,
+    FUSED_ZERNIKE_MOMENTS, FUSED_SKELETON_FEATURES, FUSED_TOP_BOTTOM,
+    FUSED_DIAGONAL_PROJECTION, FUSED_RUN_STATISTICS, FUSED_NUM_FEATURES
+  };
+
+  // the number of values of each feature
+  inline size_t fused_feature_length(int code) {
+    const size_t lengths[FUSED_NUM_FEATURES] =
+      {1, 9, 2, 8, 1, 1, 1, 1, 1, 1, 16, 64, 14, 6, 2, 1,
+       4 * RUN_STATISTICS_BINS + 1};
+    if (code < 0)
+      return size_t(-code);
+    if (code >= FUSED_NUM_FEATURES)
+      throw std::range_error("_fused_features: unknown feature code.");
+    return lengths[code];
+  }
+
+  // moments_1d over a projection
+  inline void fused_moments_1d(const std::vector<size_t>& proj, feature_t& m0,
+                               feature_t& m1, feature_t& m2, feature_t& m3) {
+    feature_t tmp = 0;
+    for (size_t x = 0; x < proj.size(); ++x) {
+      size_t p = proj[x];
+      m0 += p;
+      m1 += (tmp = x * p);
+      m2 += (tmp *= x);
+      m3 += (tmp * x);
+    }
+  }
+
+  // the intermediates shared by the features
+  struct FusedIntermediates {
+    std::vector<size_t> row_proj, col_proj;
+    size_t black;
+    // mixed moment sums (as in moments_2d)
+    feature_t m11, m12, m21;
+    std::vector<FusedLineRuns> row_runs, col_runs;
+    // black pixels in the rectangle [0,y) x [0,x)
+    // at area[y * (ncols + 1) + x]
+    std::vector<size_t> area;
+  };
+
+  template<class T>
+  void fused_intermediates(const T& image, bool runs, bool mixed,
+                           bool rects, FusedIntermediates& f) {
+    size_t nrows = image.nrows(), ncols = image.ncols();
+    f.row_proj.assign(nrows, 0);
+    f.col_proj.assign(ncols, 0);
+    f.black = 0;
+    f.m11 = f.m12 = f.m21 = 0;
+    if (runs) {
+      f.row_runs.assign(nrows, FusedLineRuns());
+      f.col_runs.assign(ncols, FusedLineRuns());
+    }
+    if (rects)
+      f.area.assign((nrows + 1) * (ncols + 1), 0);
+    typename T::const_vec_iterator it = image.vec_begin();
+    for (size_t y = 0; y < nrows; ++y) {
+      size_t row_black = 0, sum_x = 0, sum_xx = 0;
+      FusedLineRuns row;
+      for (size_t x = 0; x < ncols; ++x, ++it) {
+        bool black = is_black(*it);
+        if (black) {
+          ++row_black;
+          ++f.col_proj[x];
+          sum_x += x;
+          sum_xx += x * x;
+        }
+        if (runs) {
+          FusedLineRuns& col = f.col_runs[x];
+          if (black) {
+            row.last = row.has_black = true;
+            col.last = col.has_black = true;
+          } else {
+            if (row.last) {
+              row.last = false;
+              ++row.holes;
+            }
+            if (col.last) {
+              col.last = false;
+              ++col.holes;
+            }
+          }
+        }
+        if (rects)
+          f.area[(y + 1) * (ncols + 1) + x + 1] = f.area[y * (ncols + 1) + x + 1]
+            + f.area[(y + 1) * (ncols + 1) + x] - f.area[y * (ncols + 1) + x]
+            + (black ? 1 : 0);
+      }
+      f.row_proj[y] = row_black;
+      f.black += row_black;
+      if (runs)
+        f.row_runs[y] = row;
+      if (mixed) {
+        f.m11 += feature_t(y) * feature_t(sum_x);
+        f.m12 += feature_t(y * y) * feature_t(sum_x);
+        f.m21 += feature_t(y) * feature_t(sum_xx);
+      }
+    }
+  }
+
+  //
+  // Run-length kernels
+  //
+  // For OneBitRleImageViews and RleCcs the intermediates are computed
+  // from the black runs of each row (see rle_utilities.hpp) instead of
+  // the pixels: a run adds its length to the projections and closed
+  // form sums of x and x^2 to the moments. The overloads of the single
+  // features below use the same intermediates.
+  //
+
+  // the sum of x (and x^2) for x in [b, e)
+  inline size_t rle_sum_x(size_t b, size_t e) {
+    return (b + e - 1) * (e - b) / 2;
+  }
+  inline size_t rle_sum_xx(size_t b, size_t e) {
+    // sum of x^2 for x in [0, n) is (n - 1) n (2n - 1) / 6
+    return ((e - 1) * e * (2 * e - 1) - (b == 0 ? 0 : (b - 1) * b * (2 * b - 1))) / 6;
+  }
+
+  template<class T>
+  void rle_fused_intermediates(const T& image, bool runs, bool mixed,
+                               bool rects, FusedIntermediates& f) {
+    size_t nrows = image.nrows(), ncols = image.ncols();
+    RleBlackRuns r;
+    rle_black_runs(image, r);
+    rle_projections(r, &f.row_proj, &f.col_proj);
+    f.black = 0;
+    f.m11 = f.m12 = f.m21 = 0;
+    for (size_t y = 0; y < nrows; ++y) {
+      f.black += f.row_proj[y];
+      if (mixed) {
+        size_t sum_x = 0, sum_xx = 0;
+        for (size_t i = r.row[y]; i < r.row[y + 1]; ++i) {
+          sum_x += rle_sum_x(r.runs[i].first, r.runs[i].second);
+          sum_xx += rle_sum_xx(r.runs[i].first, r.runs[i].second);
+        }
+        f.m11 += feature_t(y) * feature_t(sum_x);
+        f.m12 += feature_t(y * y) * feature_t(sum_x);
+        f.m21 += feature_t(y) * feature_t(sum_xx);
+      }
+    }
+    if (runs) {
+      // a line has a hole after each of its runs except one at its end
+      f.row_runs.assign(nrows, FusedLineRuns());
+      for (size_t y = 0; y < nrows; ++y) {
+        FusedLineRuns& row = f.row_runs[y];
+        size_t n = r.row[y + 1] - r.row[y];
+        row.has_black = n > 0;
+        row.last = n > 0 && r.runs[r.row[y + 1] - 1].second == ncols;
+        row.holes = int(n) - (row.last ? 1 : 0);
+      }
+      std::vector<size_t> counts;
+      rle_column_run_counts(r, counts);
+      f.col_runs.assign(ncols, FusedLineRuns());
+      for (size_t i = r.row[nrows - 1]; i < r.row[nrows]; ++i)
+        for (size_t x = r.runs[i].first; x < r.runs[i].second; ++x)
+          f.col_runs[x].last = true;
+      for (size_t x = 0; x < ncols; ++x) {
+        FusedLineRuns& col = f.col_runs[x];
+        col.has_black = f.col_proj[x] > 0;
+        col.holes = int(counts[x]) - (col.last ? 1 : 0);
+      }
+    }
+    if (rects) {
+      size_t stride = ncols + 1;
+      f.area.assign((nrows + 1) * stride, 0);
+      for (size_t y = 0; y < nrows; ++y) {
+        // black pixels in [0, x) of row y, added to the row above
+        size_t in_row = 0, i = r.row[y];
+        for (size_t x = 0; x < ncols; ++x) {
+          while (i < r.row[y + 1] && r.runs[i].second <= x)
+            ++i;
+          if (i < r.row[y + 1] && r.runs[i].first <= x)
+            ++in_row;
+          f.area[(y + 1) * stride + x + 1] = f.area[y * stride + x + 1] + in_row;
+        }
+      }
+    }
+  }
+
+  inline void fused_intermediates(const OneBitRleImageView& image, bool runs,
+                                  bool mixed, bool rects, FusedIntermediates& f) {
+    rle_fused_intermediates(image, runs, mixed, rects, f);
+  }
+
+  inline void fused_intermediates(const RleCc& image, bool runs,
+                                  bool mixed, bool rects, FusedIntermediates& f) {
+    rle_fused_intermediates(image, runs, mixed, rects, f);
+  }
+
+  template<class T>
+  void rle_black_area(const T& image, feature_t* buf) {
+    RleBlackRuns r;
+    rle_black_runs(image, r);
+    size_t count = 0;
+    for (size_t i = 0; i < r.runs.size(); ++i)
+      count += r.runs[i].second - r.runs[i].first;
+    *buf = feature_t(count);
+  }
+
+  template<class T>
+  void rle_moments(const T& image, feature_t* buf) {
+    FusedIntermediates f;
+    rle_fused_intermediates(image, false, true, false, f);
+    feature_t m00 = 0, m10 = 0, m01 = 0, m20 = 0, m02 = 0, m30 = 0, m03 = 0;
+    feature_t dummy = 0;
+    fused_moments_1d(f.row_proj, m00, m01, m02, m03);
+    fused_moments_1d(f.col_proj, dummy, m10, m20, m30);
+    moments_from_sums(image.nrows(), image.ncols(), m00, m10, m01, m20, m02,
+                      f.m11, m30, m03, f.m12, f.m21, buf);
+  }
+
+  template<class T>
+  void rle_nholes(const T& image, feature_t* buf, bool extended) {
+    FusedIntermediates f;
+    rle_fused_intermediates(image, true, false, false, f);
+    nholes_from_runs(f.row_runs, f.col_runs, extended, buf);
+  }
+
+  inline void black_area(const OneBitRleImageView& image, feature_t* buf) {
+    rle_black_area(image, buf);
+  }
+  inline void black_area(const RleCc& image, feature_t* buf) {
+    rle_black_area(image, buf);
+  }
+  inline void volume(const OneBitRleImageView& image, feature_t* buf) {
+    rle_black_area(image, buf);
+    *buf /= image.nrows() * image.ncols();
+  }
+  inline void volume(const RleCc& image, feature_t* buf) {
+    rle_black_area(image, buf);
+    *buf /= image.nrows() * image.ncols();
+  }
+  inline void moments(OneBitRleImageView& image, feature_t* buf) {
+    rle_moments(image, buf);
+  }
+  inline void moments(RleCc& image, feature_t* buf) {
+    rle_moments(image, buf);
+  }
+  inline void nholes(OneBitRleImageView& image, feature_t* buf) {
+    rle_nholes(image, buf, false);
+  }
+  inline void nholes(RleCc& image, feature_t* buf) {
+    rle_nholes(image, buf, false);
+  }
+  inline void nholes_extended(const OneBitRleImageView& image, feature_t* buf) {
+    rle_nholes(image, buf, true);
+  }
+  inline void nholes_extended(const RleCc& image, feature_t* buf) {
+    rle_nholes(image, buf, true);
+  }
+
+  // volume16regions and volume64regions with *n* x *n* regions
+  template<class T>
+  void fused_volume_regions(const T& image, const FusedIntermediates& f,
+                            size_t n, feature_t* buf) {
+    size_t stride = image.ncols() + 1;
+    std::vector<size_t> x, width, y, height;
+    volume_region_bounds(image, n, x, width, y, height);
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        size_t h = (i > 0 && j == 0) ? height[n] : height[j];
+        size_t x0 = x[i], y0 = y[j], w = width[i];
+        size_t count = f.area[(y0 + h) * stride + x0 + w]
+          - f.area[y0 * stride + x0 + w] - f.area[(y0 + h) * stride + x0]
+          + f.area[y0 * stride + x0];
+        *(buf++) = feature_t(count) / (h * w);
+      }
+    }
+  }
+
+  // the values kept with an image by _fused_features (see Image::cache)
+  struct FusedFeatureCache : public ImageCache {
+    FusedFeatureCache(const Image& image)
+      : ImageCache(image, image.data()->generation()),
+        pass(false), runs(false), mixed(false) { }
+    // which parts of the intermediates have been computed
+    bool pass, runs, mixed;
+    FusedIntermediates f;
+    // the values of the features that need more than the intermediates,
+    // empty if not computed yet
+    std::vector<feature_t> values[FUSED_NUM_FEATURES];
+  };
+
+  inline bool fused_feature_cached(int code) {
+    switch (code) {
+    case FUSED_COMPACTNESS: case FUSED_VOLUME16REGIONS:
+    case FUSED_VOLUME64REGIONS: case FUSED_ZERNIKE_MOMENTS:
+    case FUSED_SKELETON_FEATURES: case FUSED_DIAGONAL_PROJECTION:
+    case FUSED_RUN_STATISTICS:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // _fused_features of image, reading its pixels from pixels (the
+  // image itself, or the compact copy of a connected component)
+  template<class T, class U>
+  void fused_features_from(const T& image, const U& pixels, const IntVector* codes) {
+    size_t i, total = 0;
+    for (i = 0; i < codes->size(); ++i)
+      total += fused_feature_length((*codes)[i]);
+    if (image.features == 0 || size_t(image.features_len) < total)
+      throw std::range_error("_fused_features: the feature array is too short.");
+
+    // The intermediates and values are kept with the image, so that
+    // computing other features of it later does not scan the pixels
+    // again.
+    FusedFeatureCache* cache = image.template cache<FusedFeatureCache>();
+    if (cache == 0) {
+      cache = new FusedFeatureCache(image);
+      image.cache(cache);
+    }
+    bool pass = false, runs = false, mixed = false, rects = false;
+    for (i = 0; i < codes->size(); ++i) {
+      int code = (*codes)[i];
+      if (code < 0 || (fused_feature_cached(code) && !cache->values[code].empty()))
+        continue;
+      switch (code) {
+      case FUSED_BLACK_AREA: case FUSED_VOLUME: case FUSED_ZERNIKE_MOMENTS:
+      case FUSED_TOP_BOTTOM:
+        pass = true;
+        break;
+      case FUSED_MOMENTS:
+        pass = mixed = true;
+        break;
+      case FUSED_NHOLES: case FUSED_NHOLES_EXTENDED:
+        pass = runs = true;
+        break;
+      case FUSED_VOLUME16REGIONS: case FUSED_VOLUME64REGIONS:
+        pass = rects = true;
+        break;
+      }
+    }
+    FusedIntermediates& f = cache->f;
+    if (rects || (runs && !cache->runs) || (mixed && !cache->mixed)
+        || (pass && !cache->pass)) {
+      cache->runs = runs = runs || cache->runs;
+      cache->mixed = mixed = mixed || cache->mixed;
+      fused_intermediates(pixels, runs, mixed, rects, f);
+      cache->pass = true;
+    }
+    size_t nrows = image.nrows(), ncols = image.ncols();
+    feature_t m00 = 0, m10 = 0, m01 = 0, m20 = 0, m02 = 0, m30 = 0, m03 = 0;
+    feature_t dummy = 0;
+    if (cache->pass) {
+      fused_moments_1d(f.row_proj, m00, m01, m02, m03);
+      fused_moments_1d(f.col_proj, dummy, m10, m20, m30);
+    }
+
+    feature_t* buf = image.features;
+    for (i = 0; i < codes->size(); ++i) {
+      int code = (*codes)[i];
+      size_t length = fused_feature_length(code);
+      if (code >= 0 && fused_feature_cached(code)) {
+        std::vector<feature_t>& values = cache->values[code];
+        if (values.empty()) {
+          values.resize(length);
+          switch (code) {
+          case FUSED_COMPACTNESS:
+            compactness(pixels, &values[0]);
+            break;
+          case FUSED_VOLUME16REGIONS:
+            fused_volume_regions(image, f, 4, &values[0]);
+            break;
+          case FUSED_VOLUME64REGIONS:
+            fused_volume_regions(image, f, 8, &values[0]);
+            break;
+          case FUSED_ZERNIKE_MOMENTS:
+            zernike_moments_from_centroid(pixels, &values[0], 6,
+                                          m00, m10/m00, m01/m00);
+            break;
+          case FUSED_SKELETON_FEATURES:
+            skeleton_features(pixels, &values[0]);
+            break;
+          case FUSED_DIAGONAL_PROJECTION:
+            // the rotation interpolates the label values of a Cc
+            diagonal_projection(image, &values[0]);
+            break;
+          case FUSED_RUN_STATISTICS:
+            run_statistics(pixels, &values[0]);
+            break;
+          }
+        }
+        std::copy(values.begin(), values.end(), buf);
+        buf += length;
+        continue;
+      }
+      switch (code) {
+      case FUSED_BLACK_AREA:
+        *buf = feature_t(f.black);
+        break;
+      case FUSED_MOMENTS:
+        moments_from_sums(nrows, ncols, m00, m10, m01, m20, m02, f.m11,
+                          m30, m03, f.m12, f.m21, buf);
+        break;
+      case FUSED_NHOLES:
+        nholes_from_runs(f.row_runs, f.col_runs, false, buf);
+        break;
+      case FUSED_NHOLES_EXTENDED:
+        nholes_from_runs(f.row_runs, f.col_runs, true, buf);
+        break;
+      case FUSED_VOLUME:
+        *buf = feature_t(f.black) / (nrows * ncols);
+        break;
+      case FUSED_AREA:
+        area(image, buf);
+        break;
+      case FUSED_ASPECT_RATIO:
+        aspect_ratio(image, buf);
+        break;
+      case FUSED_NROWS:
+        nrows_feature(image, buf);
+        break;
+      case FUSED_NCOLS:
+        ncols_feature(image, buf);
+        break;
+      case FUSED_TOP_BOTTOM: {
+        size_t top = 0;
+        while (top < nrows && f.row_proj[top] == 0)
+          ++top;
+        if (top == nrows) {
+          buf[0] = 1.0;
+          buf[1] = 0.0;
+        } else {
+          // like top_bottom, the first row is not searched for the bottom
+          int bottom = int(nrows) - 1;
+          while (bottom > 0 && f.row_proj[bottom] == 0)
+            --bottom;
+          if (bottom == 0)
+            bottom = -1;
+          buf[0] = feature_t(top) / feature_t(nrows);
+          buf[1] = feature_t(bottom) / feature_t(nrows);
+        }
+        break;
+      }
+      }
+      buf += length;
+    }
+    // the rectangle counts are as large as the image and not kept
+    if (rects)
+      std::vector<size_t>().swap(f.area);
+  }
+
+  template<class T>
+  void _fused_features(const T& image, const IntVector* codes) {
+    fused_features_from(image, image, codes);
+  }
+
+  // connected components are read through their compact copy
+  // (see cc_bitmap), which the kernels scan without label tests
+  inline void _fused_features(const Cc& image, const IntVector* codes) {
+    fused_features_from(image, cc_bitmap(image), codes);
+  }
+
+  inline void _fused_features(const MlCc& image, const IntVector* codes) {
+    fused_features_from(image, cc_bitmap(image), codes);
+  }
+
+  // _fused_features on an image of an ImageVector
+  inline void fused_features_of(Image* image, int combination,
+                                const IntVector* codes) {
+    switch (combination) {
+    case ONEBITIMAGEVIEW:
+      _fused_features(*((OneBitImageView*)image), codes);
+      break;
+    case CC:
+      _fused_features(*((Cc*)image), codes);
+      break;
+    case MLCC:
+      _fused_features(*((MlCc*)image), codes);
+      break;
+    case ONEBITRLEIMAGEVIEW:
+      _fused_features(*((OneBitRleImageView*)image), codes);
+      break;
+    case RLECC:
+      _fused_features(*((RleCc*)image), codes);
+      break;
+    case ONEBITPACKEDIMAGEVIEW:
+      _fused_features(*((OneBitPackedImageView*)image), codes);
+      break;
+    default:
+      throw std::runtime_error
+        ("There is an Image in the list that is not a OneBit image.");
+    }
+  }
+
+  // _fused_features on all images of a list, distributed over *threads*
+  // threads (all cores when 0) without holding the Python interpreter
+  // lock. The feature arrays must have been set up by the caller.
+  inline void _fused_features_list(ImageVector& images, const IntVector* codes,
+                                   int threads) {
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+    }
+    long n = (long)images.size();
+    ThreadException error;
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 16)
+#endif
+    for (long i = 0; i < n; ++i) {
+      try {
+        fused_features_of(images[i].first, images[i].second, codes);
+      } catch (...) {
+        error.keep();
+      }
+    }
+    Py_END_ALLOW_THREADS
+    error.rethrow();
+  }
 }
 #endif
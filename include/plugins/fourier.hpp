@@ -0,0 +1,602 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef gamera_fourier_hpp
+#define gamera_fourier_hpp
+
+#include "gamera.hpp"
+#include <vector>
+#include <map>
+#include <complex>
+#include <algorithm>
+#include <stdexcept>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+  Discrete Fourier transforms of images.
+
+  There is no FFT library in the build, so this header carries its own:
+  a mixed radix FFT for lengths with factors 2, 3, 4, 5 and other small
+  primes, and Bluestein's algorithm for lengths with a prime factor above
+  64.  The plan of a length (its twiddle factors, and the chirp of
+  Bluestein's algorithm) is computed once and kept for later transforms
+  of the same length (see DftPlan).  The rows and columns of a 2D
+  transform are divided among OpenMP threads, each transforming whole
+  rows or columns, so that the result does not depend on the number of
+  threads.
+
+  The forward transform is not scaled, and the inverse transform is
+  scaled by 1 / (nrows * ncols), as with numpy.fft.
+*/
+namespace Gamera {
+  namespace FftDetail {
+    typedef std::complex<double> Complex;
+
+    // scratch space of a transform, one per thread
+    struct Workspace {
+      std::vector<Complex> a, b, scratch;
+    };
+
+    // Forward mixed radix FFT (Cooley-Tukey with the factors 4, 2, 3, 5,
+    // ...) of a fixed length, from one buffer into another.  The factors
+    // up to 5 have their own butterflies, the others a generic one.
+    class Fft {
+    public:
+      explicit Fft(size_t n) : m_n(n), m_twiddles(n) {
+        for (size_t k = 0; k < n; ++k)
+          m_twiddles[k] = std::polar(1.0, -2.0 * M_PI * k / n);
+        size_t p = 4;
+        while (n > 1) {
+          while (n % p) {
+            p = (p == 4) ? 2 : (p == 2) ? 3 : p + 2;
+            if (p * p > n)
+              p = n;
+          }
+          n /= p;
+          m_factors.push_back(p);
+          m_factors.push_back(n);
+        }
+      }
+
+      size_t largest_factor() const {
+        size_t p = 1;
+        for (size_t i = 0; i < m_factors.size(); i += 2)
+          p = std::max(p, m_factors[i]);
+        return p;
+      }
+
+      void operator()(const Complex* in, Complex* out, std::vector<Complex>& scratch) const {
+        if (m_n == 1) {
+          out[0] = in[0];
+          return;
+        }
+        scratch.resize(largest_factor());
+        work(out, in, 1, &m_factors[0], &scratch[0]);
+      }
+
+    private:
+      void work(Complex* out, const Complex* in, size_t fstride,
+                const size_t* factors, Complex* scratch) const {
+        size_t p = factors[0], m = factors[1];
+        if (m == 1) {
+          for (size_t q = 0; q < p; ++q)
+            out[q] = in[q * fstride];
+        } else {
+          for (size_t q = 0; q < p; ++q)
+            work(out + q * m, in + q * fstride, fstride * p, factors + 2, scratch);
+        }
+        if (p == 2) {
+          for (size_t u = 0; u < m; ++u) {
+            Complex t = out[u + m] * m_twiddles[u * fstride];
+            out[u + m] = out[u] - t;
+            out[u] += t;
+          }
+        } else if (p == 4) {
+          for (size_t u = 0; u < m; ++u) {
+            Complex s0 = out[u + m] * m_twiddles[u * fstride];
+            Complex s1 = out[u + 2 * m] * m_twiddles[2 * u * fstride];
+            Complex s2 = out[u + 3 * m] * m_twiddles[3 * u * fstride];
+            Complex s5 = out[u] - s1;
+            Complex s3 = s0 + s2, s4 = s0 - s2;
+            out[u] += s1;
+            out[u + 2 * m] = out[u] - s3;
+            out[u] += s3;
+            out[u + m] = Complex(s5.real() + s4.imag(), s5.imag() - s4.real());
+            out[u + 3 * m] = Complex(s5.real() - s4.imag(), s5.imag() + s4.real());
+          }
+        } else if (p == 3) {
+          const double epi3 = m_twiddles[fstride * m].imag();
+          for (size_t u = 0; u < m; ++u) {
+            Complex s1 = out[u + m] * m_twiddles[u * fstride];
+            Complex s2 = out[u + 2 * m] * m_twiddles[2 * u * fstride];
+            Complex s3 = s1 + s2, s0 = (s1 - s2) * epi3;
+            Complex a = out[u] - s3 * 0.5;
+            out[u] += s3;
+            out[u + m] = Complex(a.real() - s0.imag(), a.imag() + s0.real());
+            out[u + 2 * m] = Complex(a.real() + s0.imag(), a.imag() - s0.real());
+          }
+        } else if (p == 5) {
+          const Complex ya = m_twiddles[fstride * m], yb = m_twiddles[2 * fstride * m];
+          for (size_t u = 0; u < m; ++u) {
+            Complex s0 = out[u];
+            Complex s1 = out[u + m] * m_twiddles[u * fstride];
+            Complex s2 = out[u + 2 * m] * m_twiddles[2 * u * fstride];
+            Complex s3 = out[u + 3 * m] * m_twiddles[3 * u * fstride];
+            Complex s4 = out[u + 4 * m] * m_twiddles[4 * u * fstride];
+            Complex s7 = s1 + s4, s10 = s1 - s4, s8 = s2 + s3, s9 = s2 - s3;
+            out[u] = s0 + s7 + s8;
+            Complex s5(s0.real() + s7.real() * ya.real() + s8.real() * yb.real(),
+                       s0.imag() + s7.imag() * ya.real() + s8.imag() * yb.real());
+            Complex s6(s10.imag() * ya.imag() + s9.imag() * yb.imag(),
+                       -s10.real() * ya.imag() - s9.real() * yb.imag());
+            out[u + m] = s5 - s6;
+            out[u + 4 * m] = s5 + s6;
+            Complex s11(s0.real() + s7.real() * yb.real() + s8.real() * ya.real(),
+                        s0.imag() + s7.imag() * yb.real() + s8.imag() * ya.real());
+            Complex s12(-s10.imag() * yb.imag() + s9.imag() * ya.imag(),
+                        s10.real() * yb.imag() - s9.real() * ya.imag());
+            out[u + 2 * m] = s11 + s12;
+            out[u + 3 * m] = s11 - s12;
+          }
+        } else {
+          for (size_t u = 0; u < m; ++u) {
+            for (size_t q = 0; q < p; ++q)
+              scratch[q] = out[u + q * m];
+            for (size_t q1 = 0; q1 < p; ++q1) {
+              size_t k = u + q1 * m, step = fstride * k % m_n, index = 0;
+              Complex sum = scratch[0];
+              for (size_t q = 1; q < p; ++q) {
+                index += step;
+                if (index >= m_n)
+                  index -= m_n;
+                sum += scratch[q] * m_twiddles[index];
+              }
+              out[k] = sum;
+            }
+          }
+        }
+      }
+
+      size_t m_n;
+      std::vector<Complex> m_twiddles;
+      std::vector<size_t> m_factors;
+    };
+
+    // Discrete Fourier transform of a fixed length in place, without the
+    // 1/n scaling of the inverse.  Lengths with a large prime factor are
+    // reduced to a power of two by Bluestein's chirp z-transform.
+    class Dft {
+    public:
+      explicit Dft(size_t n) : m_n(n), m_fft(n), m_m(n) {
+        if (m_fft.largest_factor() <= 64)
+          return;
+        for (m_m = 1; m_m < 2 * n - 1; m_m *= 2)
+          ;
+        m_fft = Fft(m_m);
+        // chirp e^(-i pi k^2 / n), k^2 taken modulo 2n for accuracy
+        m_chirp.resize(n);
+        for (size_t k = 0; k < n; ++k)
+          m_chirp[k] = std::polar(1.0, -M_PI * double((k * k) % (2 * n)) / n);
+        std::vector<Complex> b(m_m, Complex(0.0, 0.0)), scratch;
+        b[0] = 1.0;
+        for (size_t k = 1; k < n; ++k)
+          b[k] = b[m_m - k] = std::conj(m_chirp[k]);
+        m_chirp_fft.resize(m_m);
+        m_fft(&b[0], &m_chirp_fft[0], scratch);
+      }
+
+      size_t size() const { return m_n; }
+
+      // the inverse is the conjugate of the forward transform of the
+      // conjugate
+      void operator()(Complex* data, bool inverse, Workspace& w) const {
+        w.a.resize(m_m);
+        w.b.resize(m_m);
+        if (m_m == m_n) {
+          for (size_t k = 0; k < m_n; ++k)
+            w.a[k] = inverse ? std::conj(data[k]) : data[k];
+          m_fft(&w.a[0], data, w.scratch);
+          if (inverse)
+            for (size_t k = 0; k < m_n; ++k)
+              data[k] = std::conj(data[k]);
+          return;
+        }
+        for (size_t k = 0; k < m_n; ++k)
+          w.a[k] = (inverse ? std::conj(data[k]) : data[k]) * m_chirp[k];
+        std::fill(w.a.begin() + m_n, w.a.end(), Complex(0.0, 0.0));
+        m_fft(&w.a[0], &w.b[0], w.scratch);
+        for (size_t k = 0; k < m_m; ++k)
+          w.b[k] = std::conj(w.b[k] * m_chirp_fft[k]);
+        m_fft(&w.b[0], &w.a[0], w.scratch);
+        double scale = 1.0 / m_m;
+        for (size_t k = 0; k < m_n; ++k) {
+          Complex x = std::conj(w.a[k]) * m_chirp[k] * scale;
+          data[k] = inverse ? std::conj(x) : x;
+        }
+      }
+
+    private:
+      size_t m_n;
+      Fft m_fft;
+      size_t m_m;
+      std::vector<Complex> m_chirp, m_chirp_fft;
+    };
+
+    /*
+      The plans computed so far, by length.  A plan is not changed by
+      transforming, so a cached plan is shared by all threads; plans are
+      only added, up to max_cached_plans of them, so that a reference
+      into the cache stays valid.  The cache needs the lock of OpenMP, as
+      plugins that release the GIL may look up plans concurrently; without
+      OpenMP each DftPlan computes its own plan.
+    */
+    const size_t max_cached_plans = 64;
+
+    inline std::map<size_t, Dft*>& plan_cache() {
+      static std::map<size_t, Dft*> cache;
+      return cache;
+    }
+
+    // The plan of the transforms of length n, from the cache if possible.
+    class DftPlan {
+    public:
+      explicit DftPlan(size_t n) : m_plan(NULL), m_owned(NULL) {
+#ifdef _OPENMP
+#pragma omp critical(gamera_fft_plans)
+        {
+          std::map<size_t, Dft*>& cache = plan_cache();
+          std::map<size_t, Dft*>::iterator i = cache.find(n);
+          if (i != cache.end())
+            m_plan = i->second;
+          else if (cache.size() < max_cached_plans)
+            m_plan = cache[n] = new Dft(n);
+        }
+#endif
+        if (m_plan == NULL)
+          m_plan = m_owned = new Dft(n);
+      }
+      ~DftPlan() { delete m_owned; }
+      const Dft& operator*() const { return *m_plan; }
+    private:
+      DftPlan(const DftPlan&);
+      DftPlan& operator=(const DftPlan&);
+      const Dft* m_plan;
+      Dft* m_owned;
+    };
+
+    // The smallest length of at least n whose only prime factors are 2,
+    // 3 and 5, which the mixed radix FFT transforms fastest.
+    inline size_t good_size(size_t n) {
+      size_t best = 1;
+      while (best < n)
+        best *= 2;
+      for (size_t p5 = 1; p5 < best; p5 *= 5)
+        for (size_t p35 = p5; p35 < best; p35 *= 3) {
+          size_t m = p35;
+          while (m < n)
+            m *= 2;
+          best = std::min(best, m);
+        }
+      return best;
+    }
+
+    // Transforms the columns of a dense complex image, divided among
+    // threads; the columns are copied out a few at a time so that the
+    // image is read along its rows.
+    inline void dft_columns(ComplexImageView& image, const Dft& cols,
+                            bool inverse, int threads) {
+      const int batch = 8;
+      int nrows = image.nrows(), ncols = image.ncols();
+      Complex* data = &image[0][0];
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+      {
+        Workspace w;
+        std::vector<Complex> columns(size_t(batch) * nrows);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int x0 = 0; x0 < ncols; x0 += batch) {
+          int n = std::min(batch, ncols - x0);
+          for (int y = 0; y < nrows; ++y)
+            for (int j = 0; j < n; ++j)
+              columns[size_t(j) * nrows + y] = data[size_t(y) * ncols + x0 + j];
+          for (int j = 0; j < n; ++j)
+            cols(&columns[size_t(j) * nrows], inverse, w);
+          for (int y = 0; y < nrows; ++y)
+            for (int j = 0; j < n; ++j)
+              data[size_t(y) * ncols + x0 + j] = columns[size_t(j) * nrows + y];
+        }
+      }
+    }
+
+    // 2D transform of a dense complex image, rows and columns divided
+    // among threads
+    inline void dft2(ComplexImageView& image, const Dft& rows, const Dft& cols,
+                     bool inverse, int threads) {
+      int nrows = image.nrows(), ncols = image.ncols();
+      Complex* data = &image[0][0];
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+      {
+        Workspace w;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int y = 0; y < nrows; ++y)
+          rows(data + size_t(y) * ncols, inverse, w);
+      }
+      dft_columns(image, cols, inverse, threads);
+    }
+
+    // the same with the plans of the size of the image
+    inline void dft2(ComplexImageView& image, bool inverse, int threads) {
+      DftPlan rows(image.ncols()), cols(image.nrows());
+      dft2(image, *rows, *cols, inverse, threads);
+    }
+
+    /*
+      Copies the real image src into the dense complex image dest (of
+      the same size) and transforms its rows.  Two rows are transformed
+      at once as the real and imaginary parts of a complex row, whose
+      spectrum Z gives the spectra (Z[k] + conj(Z[n - k])) / 2 and
+      (Z[k] - conj(Z[n - k])) / 2i of the two rows.
+    */
+    template<class T>
+    void real_rows(const T& src, ComplexImageView& dest, const Dft& rows,
+                   int threads) {
+      const int nrows = src.nrows(), ncols = src.ncols();
+      const int npairs = (nrows + 1) / 2;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+      {
+        Workspace w;
+        std::vector<Complex> z(ncols);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int pair = 0; pair < npairs; ++pair) {
+          const int y = 2 * pair;
+          typename T::const_row_iterator a = src.row_begin() + y;
+          Complex* out_a = &dest[y][0];
+          if (y + 1 == nrows) {
+            typename T::const_row_iterator::iterator col = a.begin();
+            for (int x = 0; x < ncols; ++x, ++col)
+              out_a[x] = Complex(double(*col), 0.0);
+            rows(out_a, false, w);
+            continue;
+          }
+          typename T::const_row_iterator b = a + 1;
+          typename T::const_row_iterator::iterator col_a = a.begin(), col_b = b.begin();
+          for (int x = 0; x < ncols; ++x, ++col_a, ++col_b)
+            z[x] = Complex(double(*col_a), double(*col_b));
+          rows(&z[0], false, w);
+          Complex* out_b = &dest[y + 1][0];
+          for (int k = 0; k < ncols; ++k) {
+            const Complex zk = z[k], zn = std::conj(z[k == 0 ? 0 : ncols - k]);
+            out_a[k] = (zk + zn) * 0.5;
+            out_b[k] = Complex(0.0, -0.5) * (zk - zn);
+          }
+        }
+      }
+    }
+
+    /*
+      Overlap-save convolution with a fixed real kernel, for kernels too
+      large to be convolved directly.  The output is cut into blocks of
+      block_ncols() x block_nrows() pixels; the tile of a block holds the
+      input extended by the kernel on each side, so that its circular
+      convolution with the kernel is the linear convolution inside the
+      block.  Position (u, v) of a tile is the input at (u - right,
+      v - bottom) relative to the upper left of its block, and the output
+      at (x, y) of the block is at (x + right, y + bottom) of the tile.
+      As the kernel is real, the real and imaginary parts of a tile are
+      convolved independently, so that two real tiles are convolved at
+      once.
+
+      weights[(y - top) * (right - left + 1) + x - left] is the weight at
+      offset (x, y), which multiplies the input at (-x, -y) relative to
+      the output.
+    */
+    class TiledConvolution {
+    public:
+      TiledConvolution(const std::vector<double>& weights, long left, long right,
+                       long top, long bottom, long ncols, long nrows)
+        : m_left(left), m_right(right), m_top(top), m_bottom(bottom),
+          m_nx(tile_size(right - left + 1, ncols)), m_ny(tile_size(bottom - top + 1, nrows)),
+          m_row_dft(m_nx), m_col_dft(m_ny),
+          m_kernel(size_t(m_nx) * m_ny, Complex(0.0, 0.0)) {
+        // the weight at offset j goes to position j modulo the tile size,
+        // with the 1 / (nx * ny) of the inverse transform
+        const double scale = 1.0 / (double(m_nx) * m_ny);
+        for (long y = top; y <= bottom; ++y)
+          for (long x = left; x <= right; ++x)
+            m_kernel[size_t((y + m_ny) % m_ny) * m_nx + (x + m_nx) % m_nx] =
+              weights[size_t(y - top) * (right - left + 1) + x - left] * scale;
+        Workspace w;
+        std::vector<Complex> columns;
+        transform(&m_kernel[0], false, w, columns);
+      }
+
+      /*
+        The tile size for a kernel k wide on an input n wide: the blocks
+        are about three times as wide as the kernel, which was fastest
+        for kernels from 5 to 61 pixels wide, and the tile is not (much)
+        larger than the input with the kernel.
+      */
+      static long tile_size(long k, long n) {
+        return long(good_size(std::min(std::max(4 * (k - 1), 64L), n + k - 1)));
+      }
+
+      long tile_ncols() const { return m_nx; }
+      long tile_nrows() const { return m_ny; }
+      long block_ncols() const { return m_nx - (m_right - m_left); }
+      long block_nrows() const { return m_ny - (m_bottom - m_top); }
+      long left() const { return m_left; }
+      long right() const { return m_right; }
+      long top() const { return m_top; }
+      long bottom() const { return m_bottom; }
+
+      /*
+        Convolves count tiles: tiles.fill(i, tile) writes tile i into
+        tile (of tile_ncols() x tile_nrows() values, row by row), and
+        tiles.store(i, tile) reads its convolution.  The tiles are divided
+        among the threads and each is transformed by a single thread, so
+        that the result does not depend on the number of threads.
+      */
+      template<class Tiles>
+      void operator()(const Tiles& tiles, long count, int threads) const {
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+        {
+          Workspace w;
+          std::vector<Complex> tile(size_t(m_nx) * m_ny), columns;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+          for (long i = 0; i < count; ++i) {
+            tiles.fill(i, &tile[0]);
+            transform(&tile[0], false, w, columns);
+            for (size_t j = 0; j < tile.size(); ++j)
+              tile[j] *= m_kernel[j];
+            transform(&tile[0], true, w, columns);
+            tiles.store(i, &tile[0]);
+          }
+        }
+      }
+
+    private:
+      // 2D transform of a tile by a single thread, the columns copied out
+      // a few at a time
+      void transform(Complex* tile, bool inverse, Workspace& w,
+                     std::vector<Complex>& columns) const {
+        const long batch = 8;
+        for (long v = 0; v < m_ny; ++v)
+          (*m_row_dft)(tile + size_t(v) * m_nx, inverse, w);
+        columns.resize(size_t(batch) * m_ny);
+        for (long u0 = 0; u0 < m_nx; u0 += batch) {
+          const long n = std::min(batch, m_nx - u0);
+          for (long v = 0; v < m_ny; ++v)
+            for (long j = 0; j < n; ++j)
+              columns[size_t(j) * m_ny + v] = tile[size_t(v) * m_nx + u0 + j];
+          for (long j = 0; j < n; ++j)
+            (*m_col_dft)(&columns[size_t(j) * m_ny], inverse, w);
+          for (long v = 0; v < m_ny; ++v)
+            for (long j = 0; j < n; ++j)
+              tile[size_t(v) * m_nx + u0 + j] = columns[size_t(j) * m_ny + v];
+        }
+      }
+
+      long m_left, m_right, m_top, m_bottom, m_nx, m_ny;
+      DftPlan m_row_dft, m_col_dft;
+      std::vector<Complex> m_kernel;
+    };
+
+    inline int resolve_threads(int threads) {
+      if (threads <= 0) {
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#else
+        threads = 1;
+#endif
+      }
+      return threads;
+    }
+
+    // the forward transform of an image into dest: real images go
+    // through real_rows, complex images are copied and transformed
+    template<class Pixel>
+    struct Forward {
+      template<class T>
+      static void transform(const T& src, ComplexImageView& dest, const Dft& rows,
+                            const Dft& cols, int threads) {
+        real_rows(src, dest, rows, threads);
+        dft_columns(dest, cols, false, threads);
+      }
+    };
+
+    template<>
+    struct Forward<ComplexPixel> {
+      template<class T>
+      static void transform(const T& src, ComplexImageView& dest, const Dft& rows,
+                            const Dft& cols, int threads) {
+        std::copy(src.vec_begin(), src.vec_end(), dest.vec_begin());
+        dft2(dest, rows, cols, false, threads);
+      }
+    };
+
+    template<class T>
+    void forward(const T& src, ComplexImageView& dest, const Dft& rows,
+                 const Dft& cols, int threads) {
+      Forward<typename T::value_type>::transform(src, dest, rows, cols, threads);
+    }
+  }
+
+  /*
+    The 2D discrete Fourier transform of the image, as a complex image
+    of the same size and origin.
+  */
+  template<class T>
+  ComplexImageView* fft(const T& src, int threads) {
+    using namespace FftDetail;
+    ComplexImageData* dest_data = new ComplexImageData(src.size(), src.origin());
+    ComplexImageView* dest = new ComplexImageView(*dest_data);
+    try {
+      DftPlan rows(src.ncols()), cols(src.nrows());
+      forward(src, *dest, *rows, *cols, resolve_threads(threads));
+    } catch (std::exception& e) {
+      delete dest;
+      delete dest_data;
+      throw;
+    }
+    return dest;
+  }
+
+  /*
+    The inverse 2D discrete Fourier transform of a complex image, scaled
+    by 1 / (nrows * ncols) so that it undoes fft.
+  */
+  template<class T>
+  ComplexImageView* inverse_fft(const T& src, int threads) {
+    using namespace FftDetail;
+    ComplexImageData* dest_data = new ComplexImageData(src.size(), src.origin());
+    ComplexImageView* dest = new ComplexImageView(*dest_data);
+    try {
+      std::copy(src.vec_begin(), src.vec_end(), dest->vec_begin());
+      dft2(*dest, true, resolve_threads(threads));
+      const double scale = 1.0 / (double(src.nrows()) * src.ncols());
+      for (ComplexImageView::vec_iterator i = dest->vec_begin(); i != dest->vec_end(); ++i)
+        *i *= scale;
+    } catch (std::exception& e) {
+      delete dest;
+      delete dest_data;
+      throw;
+    }
+    return dest;
+  }
+}
+
+#endif
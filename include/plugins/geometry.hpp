@@ -26,15 +26,19 @@
 #include <map>
 #include <set>
 #include <stack>
+#include <queue>
+#include <vector>
+#include <limits>
 #include <algorithm>
+#include <cstdlib>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "gamera.hpp"
-#include "vigra/distancetransform.hxx"
-#include "vigra/seededregiongrowing.hxx"
 #include "geostructs/kdtree.hpp"
 #include "geostructs/delaunaytree.hpp"
-#include "graph/graph.hpp"
+#include "graph/csr_graph.hpp"
 #include "graph/graphdataderived.hpp"
-#include "graph/node.hpp"
 #include "plugins/contour.hpp"
 #include "plugins/draw.hpp"
 
@@ -46,89 +50,181 @@ using namespace std;
 
 namespace Gamera {
 
-  // this implementation is based on a sample program included
-  // in the VIGRA library by Ulrich Koethe
+  /*
+    The area Voronoi tesselation is the nearest feature transform of the
+    labeled pixels: every pixel gets the label of the closest labeled
+    pixel.  It is computed exactly with the separable algorithm of
+    Meijster, Roerdink and Hesselink (A general algorithm for computing
+    distance transforms in linear time, 2000), in the form of
+    Felzenszwalb and Huttenlocher:
+
+     - for every column, the row of the closest labeled pixel in that
+       column is found by a downward and an upward scan,
+     - for every row, the closest labeled pixel is then the minimum over
+       the columns x' of (x - x')^2 + (y - row(x'))^2, which is found
+       from the lower envelope of these parabolas in linear time.
+
+    Both passes are independent for different columns resp. rows and
+    run on several threads when OpenMP is available.
+  */
   template<class T>
-  Image* voronoi_from_labeled_image(const T& src, bool white_edges=false) {
+  Image* voronoi_from_labeled_image(const T& src, bool white_edges=false,
+                                    int threads=0) {
     typedef typename T::value_type value_type;
     typedef typename ImageFactory<T>::data_type data_type;
     typedef typename ImageFactory<T>::view_type view_type;
-    // vigra's seeded region growing only works on greyscale images
-    Grey16ImageData* voronoi_data = new Grey16ImageData(src.size(), src.origin());
-    Grey16ImageView* voronoi = new Grey16ImageView(*voronoi_data);
-    size_t x,y;
-    value_type val, maxlabel;
-    map<value_type, bool> all_labels;
-
-    maxlabel = 0;
-    for (y=0; y<src.nrows(); ++y) {
-      for (x=0; x<src.ncols(); ++x) {
-        val = src.get(Point(x,y));
-        if (val > 0) {
-          voronoi->set(Point(x,y),val);
-          all_labels.insert(make_pair(val,true));
-          if (val > maxlabel) maxlabel = val;
-        } else {
-          voronoi->set(Point(x,y),0);
+    const long nrows = (long)src.nrows();
+    const long ncols = (long)src.ncols();
+
+    // copy the labels and check that there are some
+    std::vector<value_type> labels(nrows * ncols);
+    value_type found[3];
+    size_t nfound = 0;
+    {
+      typename T::const_row_iterator row = src.row_begin();
+      typename std::vector<value_type>::iterator out = labels.begin();
+      for (; row != src.row_end(); ++row) {
+        typename T::const_col_iterator col = row.begin();
+        for (; col != row.end(); ++col, ++out) {
+          value_type val = *col;
+          *out = val;
+          if (val > 0 && nfound < 3 &&
+              std::find(found, found + nfound, val) == found + nfound)
+            found[nfound++] = val;
         }
       }
     }
-    if (all_labels.size() <= 2) {
-      delete voronoi;
-      delete voronoi_data;
+    if (nfound <= 2)
       throw std::runtime_error("Black pixels must be labeled for Voronoi tesselation.");
+
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
     }
 
-    FloatImageData* dist_data = new FloatImageData(src.size(), src.origin());
-    FloatImageView* dist = new FloatImageView(*dist_data);
-
-    try {
-      // The Voronoi tesselation is done by a watershed segmentation
-      // on the distance transform image, which is quite a bit overhead.
-      // The algorithm should be significantly faster when the Voronoi
-      // cells are computed directly similar to a distance transform.
-      // TODO: implement this based on VIGRA's distance transform code
-      vigra::distanceTransform(src_image_range(src), dest_image(*dist), 0, 2);
-      vigra::ArrayOfRegionStatistics<vigra::SeedRgDirectValueFunctor<float> > 
-        statistics((size_t)maxlabel);
-      if (white_edges) {
-        vigra::seededRegionGrowing(src_image_range(*dist), src_image(*voronoi),
-                                   dest_image(*voronoi), statistics, KeepContours);
-      } else {
-        vigra::seededRegionGrowing(src_image_range(*dist), src_image(*voronoi),
-                                   dest_image(*voronoi), statistics, CompleteGrow);
+    // first pass: nearest[y * ncols + x] is the row of the labeled pixel
+    // closest to (x, y) in column x, or -1 when the column has none.
+    // The scans go row by row over a block of columns for locality.
+    std::vector<long> nearest(nrows * ncols);
+    const long blocks = std::min((long)threads, ncols);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static, 1)
+#endif
+    for (long block = 0; block < blocks; ++block) {
+      long x0 = ncols * block / blocks;
+      long x1 = ncols * (block + 1) / blocks;
+      for (long x = x0; x < x1; ++x)
+        nearest[x] = (labels[x] > 0) ? 0 : -1;
+      for (long y = 1; y < nrows; ++y) {
+        for (long x = x0; x < x1; ++x) {
+          long i = y * ncols + x;
+          nearest[i] = (labels[i] > 0) ? y : nearest[i - ncols];
+        }
+      }
+      for (long y = nrows - 2; y >= 0; --y) {
+        for (long x = x0; x < x1; ++x) {
+          long i = y * ncols + x;
+          long below = nearest[i + ncols];
+          if (below > y && (nearest[i] < 0 || below - y < y - nearest[i]))
+            nearest[i] = below;
+        }
       }
-    } catch (std::exception e) {
-      delete dist;
-      delete dist_data;
-      delete voronoi;
-      delete voronoi_data;
-      throw;
     }
 
-    // distance image no longer needed
-    delete dist;
-    delete dist_data;
-
-    // copy over result to return value
-    data_type* result_data = new data_type(voronoi->size(), voronoi->origin());
-    view_type* result = new view_type(*result_data);
-    for (y=0; y<voronoi->nrows(); ++y) {
-      for (x=0; x<voronoi->ncols(); ++x) {
-        result->set(Point(x,y),(value_type)voronoi->get(Point(x,y)));
+    // second pass: lower envelope of the parabolas of the columns
+    std::vector<value_type> voronoi(nrows * ncols);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+    {
+      std::vector<long> sites(ncols);        // columns in the envelope
+      std::vector<double> bounds(ncols + 1); // where their parabolas start
+      std::vector<double> heights(ncols);    // squared column distances
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+      for (long y = 0; y < nrows; ++y) {
+        const long* row_nearest = &nearest[y * ncols];
+        long k = -1;
+        for (long q = 0; q < ncols; ++q) {
+          if (row_nearest[q] < 0)
+            continue;
+          double dy = (double)(y - row_nearest[q]);
+          heights[q] = dy * dy;
+          double s = 0;
+          while (k >= 0) {
+            long v = sites[k];
+            s = ((heights[q] + (double)q * q) - (heights[v] + (double)v * v))
+              / (2.0 * (q - v));
+            if (s > bounds[k])
+              break;
+            --k;
+          }
+          ++k;
+          sites[k] = q;
+          bounds[k] = (k == 0) ? -std::numeric_limits<double>::max() : s;
+        }
+        bounds[k + 1] = std::numeric_limits<double>::max();
+        long j = 0;
+        for (long x = 0; x < ncols; ++x) {
+          while (bounds[j + 1] < x)
+            ++j;
+          long v = sites[j];
+          voronoi[y * ncols + x] = labels[row_nearest[v] * ncols + v];
+        }
       }
     }
 
-    // greyscale image no longer needed
-    delete voronoi;
-    delete voronoi_data;
+    // white edges between the regions, except at labeled pixels
+    if (white_edges) {
+      for (long y = 0; y < nrows; ++y) {
+        for (long x = 0; x < ncols; ++x) {
+          long i = y * ncols + x;
+          if (labels[i] > 0)
+            continue;
+          if ((x + 1 < ncols && voronoi[i + 1] != voronoi[i] && voronoi[i + 1] != 0) ||
+              (y + 1 < nrows && voronoi[i + ncols] != voronoi[i] && voronoi[i + ncols] != 0))
+            voronoi[i] = 0;
+        }
+      }
+    }
 
+    // copy over result to return value
+    data_type* result_data = new data_type(src.size(), src.origin());
+    view_type* result = new view_type(*result_data);
+    typename view_type::row_iterator row = result->row_begin();
+    typename std::vector<value_type>::const_iterator in = voronoi.begin();
+    for (; row != result->row_end(); ++row) {
+      typename view_type::col_iterator col = row.begin();
+      for (; col != row.end(); ++col, ++in)
+        *col = *in;
+    }
     return result;
   }
 
 
+  /*
+    The Voronoi tesselation of points is computed with the same
+    separable scheme as voronoi_from_labeled_image, but on the columns
+    that contain points (which may lie outside of the image):
+
+     - the points of each column are sorted by row, and while the rows
+       are scanned, a pointer per column follows the first point at or
+       below the current row, so that the closest point of the column
+       is one of two candidates,
+     - the closest point of a row is then found from the lower envelope
+       of the parabolas of these columns.
+
+    This takes O(nrows * (ncols + columns)) time. Bands of rows run on
+    several threads when OpenMP is available. Equidistant points are
+    decided arbitrarily, as before with the kd-tree.
+  */
   template<class T>
-  void voronoi_from_points(T& src, const PointVector* points, IntVector* labels) {
+  void voronoi_from_points(T& src, const PointVector* points, IntVector* labels,
+                           int threads=0) {
 
     // some plausi checks
     if (points->empty())
@@ -136,148 +232,239 @@ namespace Gamera {
     if (points->size() != labels->size())
       throw std::runtime_error("Number of points must match the number of labels.");
 
-    size_t i,x,y;
-
-    // build kd-tree from points
-    KdNodeVector nodes,neighbors;
-    CoordPoint p(2);
-    for (i=0; i<points->size(); i++) {
-      p[0] = (*points)[i].x();
-      p[1] = (*points)[i].y();
-      KdNode n(p);
-      n.data = &((*labels)[i]);
-      nodes.push_back(n);
+    const long nrows = (long)src.nrows();
+    const long ncols = (long)src.ncols();
+
+    // the points ordered by column, row and index; the points of
+    // column columns[c] are first[c] to first[c + 1] - 1
+    std::vector<std::pair<std::pair<long,long>, size_t> > sorted(points->size());
+    for (size_t i = 0; i < points->size(); ++i)
+      sorted[i] = std::make_pair(std::make_pair((long)(*points)[i].x(),
+                                                (long)(*points)[i].y()), i);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<long> columns, first, rows;
+    std::vector<int> site_labels;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+      if (columns.empty() || columns.back() != sorted[i].first.first) {
+        columns.push_back(sorted[i].first.first);
+        first.push_back((long)i);
+      }
+      rows.push_back(sorted[i].first.second);
+      site_labels.push_back((*labels)[sorted[i].second]);
+    }
+    const long ncolumns = (long)columns.size();
+    first.push_back((long)sorted.size());
+
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
     }
-    KdTree tree(&nodes);
 
-    // label all pixels with nearest neighbor label
-    for (y=0; y<src.nrows(); ++y) {
-      for (x=0; x<src.ncols(); ++x) {
-        if (src.get(Point(x,y)) == 0) {
-          p[0] = x; p[1] = y;
-          tree.k_nearest_neighbors(p, 1, &neighbors);
-          src.set(Point(x,y),*((int*)(neighbors[0].data)));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+    {
+      std::vector<long> below(ncolumns);      // first point at or below the row
+      std::vector<long> nearest(ncolumns);    // closest point of the column
+      std::vector<double> heights(ncolumns);  // its squared row distance
+      std::vector<long> sites(ncolumns);      // columns in the envelope
+      std::vector<double> bounds(ncolumns + 1);
+      long previous = -2;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+      for (long y = 0; y < nrows; ++y) {
+        // closest point of every column
+        for (long c = 0; c < ncolumns; ++c) {
+          long& b = below[c];
+          if (y != previous + 1)
+            b = std::lower_bound(rows.begin() + first[c], rows.begin() + first[c + 1], y)
+              - rows.begin();
+          else
+            while (b < first[c + 1] && rows[b] < y)
+              ++b;
+          long best = b;
+          if (b == first[c + 1] || (b > first[c] && y - rows[b - 1] <= rows[b] - y))
+            best = b - 1;
+          // the first of the points on the same pixel
+          while (best > first[c] && rows[best - 1] == rows[best])
+            --best;
+          nearest[c] = best;
+          double dy = (double)(y - rows[best]);
+          heights[c] = dy * dy;
+        }
+        previous = y;
+
+        // lower envelope of the parabolas of the columns
+        long k = -1;
+        for (long q = 0; q < ncolumns; ++q) {
+          double s = 0;
+          double cq = (double)columns[q];
+          while (k >= 0) {
+            long v = sites[k];
+            double cv = (double)columns[v];
+            s = ((heights[q] + cq * cq) - (heights[v] + cv * cv)) / (2.0 * (cq - cv));
+            if (s > bounds[k])
+              break;
+            --k;
+          }
+          ++k;
+          sites[k] = q;
+          bounds[k] = (k == 0) ? -std::numeric_limits<double>::max() : s;
+        }
+        bounds[k + 1] = std::numeric_limits<double>::max();
+
+        // label the white pixels of the row
+        typename T::row_iterator row = src.row_begin() + y;
+        typename T::row_iterator::iterator col = row.begin();
+        long j = 0;
+        for (long x = 0; x < ncols; ++x, ++col) {
+          while (bounds[j + 1] < x)
+            ++j;
+          if (*col == 0)
+            *col = site_labels[nearest[sites[j]]];
         }
       }
     }
   }
 
 
-  // returns list of neighboring label pairs
-  template<class T>
-  PyObject* labeled_region_neighbors(const T& src, bool eight_connectivity=true) {
-    size_t x,y,max_x,max_y;
+  // pairs of labels of neighboring regions, resp. Delaunay neighbors
+  typedef std::vector<std::pair<int,int> > LabelPairVector;
+
+  namespace RegionNeighborDetail {
+    // collects the label pairs of one band of rows. A small direct
+    // mapped cache of recent pairs catches nearly all repetitions along
+    // the region borders, and the pairs are made unique whenever they
+    // have doubled since the last time, so that the memory stays
+    // proportional to the number of distinct pairs
+    struct PairCollector {
+      enum { CACHE_SIZE = 4096 };
+      LabelPairVector pairs;
+      size_t compacted;
+      std::vector<std::pair<int,int> > cache;
+      PairCollector() : compacted(0), cache(CACHE_SIZE, std::make_pair(0, 0)) {}
+      void compact() {
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        compacted = pairs.size();
+      }
+      inline void add(int label1, int label2) {
+        std::pair<int,int> p(std::max(label1, label2), std::min(label1, label2));
+        std::pair<int,int>& cached =
+          cache[((unsigned int)p.first * 2654435761u + (unsigned int)p.second)
+                % CACHE_SIZE];
+        if (cached == p)
+          return;
+        cached = p;
+        pairs.push_back(p);
+        if (pairs.size() >= 2 * compacted + 65536)
+          compact();
+      }
+    };
 
-    typedef typename T::value_type value_type;
-    max_x = src.ncols()-1;
-    max_y = src.nrows()-1;
-
-    // map for storing neighborship relations; to avoid duplicates,
-    // we store for each label only *smaller* neighboring labels
-    // note that we must use 'int' insetad of 'value_type' because
-    // some versions of gcc do not like nested templates
-    typedef set<value_type> set_type;
-    typedef map<value_type,set_type> map_type;
-    map_type neighbors;
-
-    // check bulk of image
-    value_type label1,label2;
-    //set<value_type> emptyset;
-    set_type emptyset;
-    for (y=0; y<max_y; ++y) {
-      for (x=0; x<max_x; ++x) {
-        label1 = src.get(Point(x,y));
-        label2 = src.get(Point(x+1,y));
-        if (label1 > label2) {
-          if (neighbors.find(label1) == neighbors.end())
-            neighbors[label1] = emptyset;
-          neighbors[label1].insert(label2);
-        }
-        else if (label2 > label1) {
-          if (neighbors.find(label2) == neighbors.end())
-            neighbors[label2] = emptyset;
-          neighbors[label2].insert(label1);
-        }
-        label2 = src.get(Point(x,y+1));
-        if (label1 > label2) {
-          if (neighbors.find(label1) == neighbors.end())
-            neighbors[label1] = emptyset;
-          neighbors[label1].insert(label2);
-        }
-        else if (label2 > label1) {
-          if (neighbors.find(label2) == neighbors.end())
-            neighbors[label2] = emptyset;
-          neighbors[label2].insert(label1);
-        }
-        if (eight_connectivity) {
-          label2 = src.get(Point(x+1,y+1));
-          if (label1 > label2) {
-            if (neighbors.find(label1) == neighbors.end())
-              neighbors[label1] = emptyset;
-            neighbors[label1].insert(label2);
-          }
-          else if (label2 > label1) {
-            if (neighbors.find(label2) == neighbors.end())
-              neighbors[label2] = emptyset;
-            neighbors[label2].insert(label1);
+    template<class Iterator, class Vector>
+    inline void read_row(Iterator r, Vector& row) {
+      typename Iterator::iterator c = r.begin();
+      for (size_t x = 0; x < row.size(); ++x, ++c)
+        row[x] = (int)*c;
+    }
+  }
+
+  // the labels of touching regions as pairs (label1, label2) with
+  // label1 > label2, sorted and without duplicates. Only the right,
+  // lower and (with eight_connectivity) lower right neighbor of each
+  // pixel is compared. Each row is scanned once run by run together
+  // with the row below it; bands of rows run on threads threads (0
+  // for all processors when OpenMP is available).
+  template<class T>
+  void labeled_region_neighbors_cpp(const T& src, bool eight_connectivity,
+                                    LabelPairVector *result, int threads=0) {
+    using namespace RegionNeighborDetail;
+    const long ncols = src.ncols();
+    const long nrows = src.nrows();
+
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+    }
+    // bands of at least 64 rows, so that the rows read twice (at the
+    // band borders) do not matter
+    const long bands = std::max(1L, std::min((long)threads, nrows / 64));
+    std::vector<PairCollector> collectors(bands);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static, 1)
+#endif
+    for (long band = 0; band < bands; ++band) {
+      const long y0 = nrows * band / bands;
+      const long y1 = nrows * (band + 1) / bands;
+      PairCollector& collector = collectors[band];
+      std::vector<int> row(ncols), next(ncols);
+      typename T::const_row_iterator r = src.row_begin() + y0;
+      read_row(r, next);
+      for (long y = y0; y < y1; ++y) {
+        row.swap(next);
+        const bool has_next = (y + 1 < nrows);
+        if (has_next)
+          read_row(++r, next);
+        long x = 0;
+        while (x < ncols) {
+          // the run [x, end) of equal labels
+          const int label = row[x];
+          long end = x + 1;
+          while (end < ncols && row[end] == label)
+            ++end;
+          if (end < ncols)
+            collector.add(label, row[end]);
+          if (has_next) {
+            for (long i = x; i < end; ++i) {
+              if (next[i] != label)
+                collector.add(label, next[i]);
+            }
+            if (eight_connectivity) {
+              const long dend = std::min(end, ncols - 1);
+              for (long i = x; i < dend; ++i) {
+                if (next[i+1] != label)
+                  collector.add(label, next[i+1]);
+              }
+            }
           }
+          x = end;
         }
       }
+      collector.compact();
     }
-    // check last row
-    for (x=0; x<max_x; ++x) {
-      label1 = src.get(Point(x,max_y));
-      label2 = src.get(Point(x+1,max_y));
-      if (label1 > label2) {
-        if (neighbors.find(label1) == neighbors.end())
-          neighbors[label1] = emptyset;
-        neighbors[label1].insert(label2);
-      }
-      else if (label2 > label1) {
-        if (neighbors.find(label2) == neighbors.end())
-          neighbors[label2] = emptyset;
-        neighbors[label2].insert(label1);
-      }
-    }
-    // check last column
-    for (y=0; y<max_y; ++y) {
-      label1 = src.get(Point(max_x,y));
-      label2 = src.get(Point(max_x,y+1));
-      if (label1 > label2) {
-        if (neighbors.find(label1) == neighbors.end())
-          neighbors[label1] = emptyset;
-        neighbors[label1].insert(label2);
-      }
-      else if (label2 > label1) {
-        if (neighbors.find(label2) == neighbors.end())
-          neighbors[label2] = emptyset;
-        neighbors[label2].insert(label1);
-      }
+
+    LabelPairVector pairs;
+    for (long band = 0; band < bands; ++band)
+      pairs.insert(pairs.end(), collectors[band].pairs.begin(),
+                   collectors[band].pairs.end());
+    if (bands > 1) {
+      std::sort(pairs.begin(), pairs.end());
+      pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
     }
-    //printf("emptyset.size(): %i\n", emptyset.size());
-
-    // copy result over to return value
-    PyObject *retval, *entry, *entry1, *entry2;
-    retval = PyList_New(0);
-    typename map_type::iterator it1;
-    typename set_type::iterator it2;
-    for (it1=neighbors.begin(); it1!=neighbors.end(); it1++) {
-      entry1 = Py_BuildValue("i", (int)it1->first);
-      //printf("Neighbors of %i:", (int)it1->first);
-      for (it2=it1->second.begin(); it2!=it1->second.end(); it2++) {
-        // beware that PyList_SetItem 'steals' a reference,
-        // while PyList_append increases the reference
-        entry = PyList_New(2);
-        Py_INCREF(entry1);
-        PyList_SetItem(entry, 0, entry1);
-        entry2 = Py_BuildValue("i", (int)*it2);
-        //printf(" %i", (int)*it2);
-        PyList_SetItem(entry, 1, entry2);
-        PyList_Append(retval, entry);
-        Py_DECREF(entry);
-      }
-      //printf("\n");
-      Py_DECREF(entry1);
+    result->swap(pairs);
+  }
+
+  // returns list of neighboring label pairs
+  template<class T>
+  PyObject* labeled_region_neighbors(const T& src, bool eight_connectivity=true,
+                                     int threads=0) {
+    LabelPairVector neighbors;
+    labeled_region_neighbors_cpp(src, eight_connectivity, &neighbors, threads);
+
+    PyObject *retval = PyList_New(neighbors.size());
+    for (size_t i = 0; i < neighbors.size(); ++i) {
+      PyObject *entry = PyList_New(2);
+      PyList_SetItem(entry, 0, Py_BuildValue("i", neighbors[i].first));
+      PyList_SetItem(entry, 1, Py_BuildValue("i", neighbors[i].second));
+      PyList_SetItem(retval, i, entry);
     }
     return retval;
   }
@@ -286,7 +473,9 @@ namespace Gamera {
   //-----------------------------------------------------------------------
   // functions for Delaunay triangulation
   //-----------------------------------------------------------------------
-  void delaunay_from_points_cpp(PointVector *pv, IntVector *lv, std::map<int,std::set<int> > *result) {
+  // the Delaunay neighbors are given as sorted pairs (label1, label2)
+  // with label1 < label2
+  void delaunay_from_points_cpp(PointVector *pv, IntVector *lv, LabelPairVector *result) {
 
     // some plausi checks
 	if (pv->empty()) {
@@ -300,50 +489,36 @@ namespace Gamera {
     }
 
     DelaunayTree dt;
-    PointVector::iterator pv_it;
-    IntVector::iterator lv_it;
-    std::vector<Vertex*> vertices;
-    std::vector<Vertex*>::iterator it;
-
-    result->clear();
-
-    pv_it = pv->begin();
-    lv_it = lv->begin();
-
-    int x, y;
-    while(pv_it != pv->end() && lv_it != lv->end()) {
-      x = (*pv_it).x();
-      y = (*pv_it).y();
-      vertices.push_back(new Vertex(x, y, (*lv_it)));
-      ++pv_it;
-      ++lv_it;
-    }
-    random_shuffle(vertices.begin(), vertices.end());
-    dt.addVertices(&vertices);
-    dt.neighboringLabels(result);
-    for(it = vertices.begin() ; it != vertices.end() ; ++it) {
-      delete *it;
+    std::vector<Vertex> vertices;
+    std::vector<Vertex*> vertexptrs;
+    size_t i;
+
+    vertices.reserve(pv->size());
+    vertexptrs.reserve(pv->size());
+    for (i = 0; i < pv->size(); ++i) {
+      vertices.push_back(Vertex((*pv)[i].x(), (*pv)[i].y(), (*lv)[i]));
     }
+    for (i = 0; i < vertices.size(); ++i) {
+      vertexptrs.push_back(&vertices[i]);
+    }
+    dt.addVertices(&vertexptrs);
+    dt.neighboringLabels(result);
   }
   
   PyObject* delaunay_from_points(PointVector *pv, IntVector *lv) {
   	PyObject *list, *entry, *label1, *label2;
-    std::map<int,std::set<int> > neighbors;
-    std::map<int,std::set<int> >::iterator nit1;
-    std::set<int>::iterator nit2;
+    LabelPairVector neighbors;
+    LabelPairVector::iterator nit;
   	
 	delaunay_from_points_cpp(pv, lv, &neighbors);
-    list = PyList_New(0);
-    for (nit1=neighbors.begin(); nit1!=neighbors.end(); ++nit1) {
-      for (nit2=nit1->second.begin(); nit2!=nit1->second.end(); nit2++) {
-        entry = PyList_New(2);
-        label1 = Py_BuildValue("i", nit1->first);
-        label2 = Py_BuildValue("i", *nit2);
-        PyList_SetItem(entry, 0, label1);
-        PyList_SetItem(entry, 1, label2);
-        PyList_Append(list, entry);
-        Py_DECREF(entry);
-      }
+    list = PyList_New(neighbors.size());
+    for (nit=neighbors.begin(); nit!=neighbors.end(); ++nit) {
+      entry = PyList_New(2);
+      label1 = Py_BuildValue("i", nit->first);
+      label2 = Py_BuildValue("i", nit->second);
+      PyList_SetItem(entry, 0, label1);
+      PyList_SetItem(entry, 1, label2);
+      PyList_SetItem(list, nit - neighbors.begin(), entry);
     }
 
   	return list;
@@ -354,94 +529,70 @@ namespace Gamera {
   // functions for graph coloring of Cc's with different colors
   //-----------------------------------------------------------------------
   typedef std::map<unsigned int, Image*> LabelCcMap;
-  template<class T>
-  Graph *graph_from_ccs(T &image, ImageVector &ccs, int method) {
-    Graph *graph = new Graph(FLAG_UNDIRECTED);
-    graph->make_singly_connected();
 
-    PointVector *pv = new PointVector();
-    IntVector *iv = new IntVector();
+  // the edges of the neighborhood graph of the ccs as label pairs, in
+  // the order in which they are found
+  template<class T>
+  void neighbors_from_ccs(T &image, ImageVector &ccs, int method,
+                          std::vector<std::pair<long,long> > &edges,
+                          int threads=0) {
+    LabelPairVector neighbors;
     ImageVector::iterator iter;
 
     if( method == 0 || method == 1 ) {
+      PointVector pv;
+      IntVector iv;
       if( method == 0 ) {
         // method == 0 --> from the CC center points
         for( iter = ccs.begin(); iter != ccs.end(); iter++) {
           Cc* cc = static_cast<Cc*>((*iter).first);
-          pv->push_back( cc->center() );
-          iv->push_back( cc->label() );
+          pv.push_back( cc->center() );
+          iv.push_back( cc->label() );
         }        
       }
       else if( method == 1) {
-        // method == 1 --> from a 20 percent sample of the contour points
+        // method == 1 --> from a 20 percent sample of the contour points,
+        // read from the contours of all ccs traced in one scan
+        ContourSet contours;
+        contour_tracing(image, contours);
+        PointVector cc_pv;
         for( iter = ccs.begin(); iter != ccs.end(); iter++) {
           Cc* cc = static_cast<Cc*>((*iter).first);
-          PointVector *cc_pv = contour_samplepoints(*cc, 20);
+          contour_samplepoints(contours, *cc, 20, cc_pv);
           PointVector::iterator point_vec_iter;
-          for( point_vec_iter = cc_pv->begin(); point_vec_iter != cc_pv->end(); point_vec_iter++ ) {
-            pv->push_back(*point_vec_iter);
-            iv->push_back(cc->label());
+          for( point_vec_iter = cc_pv.begin(); point_vec_iter != cc_pv.end(); point_vec_iter++ ) {
+            pv.push_back(*point_vec_iter);
+            iv.push_back(cc->label());
           }
-          delete cc_pv;
-        }
-      }
-
-      // Build the graph
-      std::map<int,std::set<int> > neighbors;
-      std::map<int,std::set<int> >::iterator nit1;
-      std::set<int>::iterator nit2;
-      delaunay_from_points_cpp(pv, iv, &neighbors);
-      for (nit1=neighbors.begin(); nit1!=neighbors.end(); ++nit1) {
-        for (nit2=nit1->second.begin(); nit2!=nit1->second.end(); nit2++) {
-           GraphDataLong* a_p = new GraphDataLong(nit1->first);
-           GraphDataLong* b_p = new GraphDataLong(*nit2);
-           bool del_a = !graph->add_node(a_p);
-           bool del_b = !graph->add_node(b_p);
-           graph->add_edge(a_p, b_p); 
-           if(del_a)
-              delete a_p;
-           if(del_b)
-              delete b_p;
         }
       }
+      delaunay_from_points_cpp(&pv, &iv, &neighbors);
     }
     else if( method == 2 ) {
       // method == 2 --> from the exact area Voronoi diagram
       typedef typename ImageFactory<T>::view_type view_type;
-      Image *voronoi       = voronoi_from_labeled_image(image);
-      PyObject *labelpairs = labeled_region_neighbors( *((view_type*) voronoi) );
-      for (int i = 0; i < PyList_Size(labelpairs); i++) {
-        PyObject *adj_list = PyList_GetItem(labelpairs, i);
-        PyObject *region1 = PyList_GetItem(adj_list, 0);
-        PyObject *region2 = PyList_GetItem(adj_list, 1);
-        GraphDataLong* a_p = new GraphDataLong(PyInt_AsLong(region1));
-        GraphDataLong* b_p = new GraphDataLong(PyInt_AsLong(region2));
-        bool del_a = !graph->add_node(a_p);
-        bool del_b = !graph->add_node(b_p);
-        graph->add_edge(a_p, b_p); 
-        if(del_a)
-           delete a_p;
-        if(del_b)
-           delete b_p;
+      Image *voronoi = voronoi_from_labeled_image(image, false, threads);
+      try {
+        labeled_region_neighbors_cpp( *((view_type*) voronoi), true, &neighbors, threads );
+      } catch (std::exception& e) {
+        delete voronoi->data();
+        delete voronoi;
+        throw;
       }
       delete voronoi->data();
       delete voronoi;
-      Py_DECREF(labelpairs);
     }
     else {
       throw std::runtime_error("Unknown method for construction the neighborhood graph");
     }
 
-    delete pv;
-    delete iv;
-    return graph;
+    edges.assign(neighbors.begin(), neighbors.end());
   }
 
-
   template<class T>
-  RGBImageView* graph_color_ccs(T &image, ImageVector &ccs, PyObject *colors, int method) {
-    Graph *graph = NULL;
-    std::vector<RGBPixel*> RGBColors;
+  RGBImageView* graph_color_ccs(T &image, ImageVector &ccs, PyObject *colors, int method,
+                                int threads=0) {
+    std::vector<RGBPixel> RGBColors;
     
     // check input parameters
     if( ccs.size() == 0 ) {
@@ -458,15 +609,26 @@ namespace Gamera {
     // extract the colors
     for( int i = 0; i < PyList_Size(colors); i++) {
       PyObject *Py_RGBPixel = PyList_GetItem(colors, i);
-      RGBPixel *RGBPixel    = ((RGBPixelObject*) Py_RGBPixel )->m_x;
-      RGBColors.push_back(RGBPixel);
+      RGBColors.push_back(*((RGBPixelObject*) Py_RGBPixel )->m_x);
     }
 
-    // build the graph from the given ccs
-    graph = graph_from_ccs(image, ccs, method);
-
-    // volor the graph
-    graph->colorize( PyList_Size(colors) );
+    // color the neighborhood graph of the ccs, which is built in its
+    // compact form right from the label pairs, and make a table of the
+    // pixel color for each label (black for labels not colored)
+    std::vector<std::pair<long,long> > edges;
+    neighbors_from_ccs(image, ccs, method, edges, threads);
+    CsrGraph csr(edges);
+    std::vector<unsigned int> node_colors;
+    csr.colorize( RGBColors.size(), node_colors );
+    std::vector<RGBPixel> label_colors;
+    for (size_t i = 0; i < csr.get_nnodes(); i++) {
+      long label = static_cast<GraphDataLong*>(csr.get_value(i))->data;
+      if (label <= 0)
+        continue;
+      if ((size_t)label >= label_colors.size())
+        label_colors.resize(label + 1, RGBPixel(0,0,0));
+      label_colors[label] = RGBColors[node_colors[i]];
+    }
 
     // Create the return image
     // Ccs not passed to the function are set black in the result
@@ -474,34 +636,31 @@ namespace Gamera {
     
     RGBViewFactory::image_type *coloredImage = 
        RGBViewFactory::create(image.origin(), image.dim());
-    
-    int label;
-    for( size_t y = 0; y < image.nrows(); y++) {
-      for( size_t x = 0; x < image.ncols(); x++ ) {
-        label = image.get(Point(x,y));
-        if( label != 0 ) {
-          try {
-             GraphDataLong d(label);
-             Node* n = graph->get_node(&d);
-             unsigned int c = graph->get_color(n);
-             coloredImage->set(Point(x,y), *RGBColors[c]);
-          }
-          catch( std::runtime_error runtimeError ) {
-            coloredImage->set(Point(x,y), RGBPixel(0,0,0));
-          }
-        }
-      }
-    }
 
-    NodePtrIterator* it = graph->get_nodes();
-    Node* n;
-    
-    while((n = it->next()) != NULL) {
-      delete dynamic_cast<GraphDataLong*>(n->_value);
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+    }
+    const long nrows = image.nrows();
+    const size_t ncols = image.ncols();
+    const size_t nlabels = label_colors.size();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+    for (long y = 0; y < nrows; ++y) {
+      typename T::row_iterator r = image.row_begin() + y;
+      typename T::row_iterator::iterator c = r.begin();
+      RGBViewFactory::image_type::row_iterator out = coloredImage->row_begin() + y;
+      RGBViewFactory::image_type::row_iterator::iterator o = out.begin();
+      for (size_t x = 0; x < ncols; ++x, ++c, ++o) {
+        size_t label = *c;
+        if (label != 0)
+          *o = (label < nlabels) ? label_colors[label] : RGBPixel(0,0,0);
+      }
     }
-
-    delete it;
-    delete graph;
 
     return coloredImage;
   }
@@ -535,107 +694,147 @@ namespace Gamera {
     return atan2(dy, dx);
   };
 
-  // see Cormen et al.: Introduction to Algorithms.
-  // 2nd ed., MIT Press, p. 949, 2001
-  PointVector* convex_hull_from_points(PointVector *points) {
-     //get leftmost and top point and save it in (*points)[0]
-     size_t min_x = points->at(0).x();
-     size_t min_y = points->at(0).y();
-     size_t min_i = 0;
-     size_t i;
-     for(i=0; i < points->size(); i++) {
-        if (points->at(i).x() < min_x) {
-            min_x = points->at(i).x();
-            min_y = points->at(i).y();
-            min_i = i;
-        } else if (points->at(i).x() == min_x && points->at(i).y() < min_y) {
-            min_x = points->at(i).x();
-            min_y = points->at(i).y();
-            min_i = i;
-        }
-     }
-     std::swap( points->at(0), points->at(min_i));
-
-
-      //sort by polar in polarmap. If more than one point,
-      //remove all but the one farthest from origin
-     Point origin = points->at(0);
-     std::map<double, Point> stack_polarangle;
-     std::map<double, Point>::iterator found;
-     double polarangle;
-     Point p;
-
-     for(PointVector::iterator it = points->begin()+1; it != points->end();it++) {
-        p = *it;
-        polarangle = polar_angle(origin, p);
-        found = stack_polarangle.find(polarangle);
-        //use nearest
-        if(found == stack_polarangle.end()){
-           stack_polarangle[polarangle] = p;
-        }
-        else if(greater_distance(origin, p, found->second)) {
-           stack_polarangle[polarangle] = p;
-    	}
-     }
-
-
-     // start with graham scan
-     PointVector* retVector = new PointVector;
-     std::map<double, Point>::iterator pointIt;
-     pointIt = stack_polarangle.begin();
-
-     retVector->push_back(origin); 	        // push point[0]
-
-     retVector->push_back(pointIt->second); // push point[1]
-     pointIt++;
-
-     retVector->push_back(pointIt->second); // push point[2]
-     pointIt++;
+  namespace HullDetail {
+    // Andrew's monotone chain over points sorted lexicographically (in
+    // either coordinate order).  The vertices are returned with positive
+    // clockwise_orientation at each of them, starting at the topmost of
+    // the leftmost points, which is the order of Graham's scan from there.
+    inline PointVector* monotone_chain(const PointVector& sorted) {
+      size_t n = sorted.size();
+      PointVector chain(2 * n);
+      size_t k = 0;
+      for (size_t i = 0; i < n; ++i) {
+        while (k >= 2 && clockwise_orientation(chain[k-2], chain[k-1], sorted[i]) <= 0.0)
+          --k;
+        chain[k++] = sorted[i];
+      }
+      for (size_t i = n - 1, lower = k + 1; i-- > 0;) {
+        while (k >= lower && clockwise_orientation(chain[k-2], chain[k-1], sorted[i]) <= 0.0)
+          --k;
+        chain[k++] = sorted[i];
+      }
+      // the first point is repeated at the end
+      if (k > 1)
+        --k;
+      chain.resize(k);
+      size_t start = 0;
+      for (size_t i = 1; i < k; ++i)
+        if (chain[i].x() < chain[start].x() ||
+            (chain[i].x() == chain[start].x() && chain[i].y() < chain[start].y()))
+          start = i;
+      PointVector* hull = new PointVector(chain.begin() + start, chain.end());
+      hull->insert(hull->end(), chain.begin(), chain.begin() + start);
+      return hull;
+    }
 
+    // The leftmost and rightmost point of each nonempty row, top to bottom,
+    // which are sorted by y and then x.  Points inside a row cannot be
+    // vertices of the hull.
+    inline void row_extremes(const std::vector<long>& left, const std::vector<long>& right,
+                             PointVector& points) {
+      points.clear();
+      for (size_t y = 0; y < left.size(); ++y) {
+        if (right[y] < left[y])
+          continue;
+        points.push_back(Point((coord_t)left[y], y));
+        if (right[y] != left[y])
+          points.push_back(Point((coord_t)right[y], y));
+      }
+    }
 
-     //pointIt starts at point[3]
-     for( ; pointIt != stack_polarangle.end(); pointIt++) {
-        p = pointIt->second;
-        while(retVector->size() > 2 && clockwise_orientation(*(retVector->end()-2),*(retVector->end()-1), p) <= 0.0) {
-			retVector->pop_back();
-        }
-        retVector->push_back(p);
-     }
+    struct PointLess {
+      bool operator()(const Point& a, const Point& b) const {
+        return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+      }
+    };
+  }
 
-     return retVector;
+  // Andrew's monotone chain; see A. M. Andrew: Another efficient algorithm
+  // for convex hulls in two dimensions. Information Processing Letters 9,
+  // pp. 216-219, 1979
+  PointVector* convex_hull_from_points(PointVector *points) {
+    if (points->empty())
+      throw std::runtime_error("convex_hull_from_points: no points given");
+    PointVector sorted(*points);
+    std::sort(sorted.begin(), sorted.end(), HullDetail::PointLess());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    return HullDetail::monotone_chain(sorted);
   }
 
 
   template<class T>
   PointVector* convex_hull_as_points(const T& src) {
-    PointVector *contour_points = new PointVector();
-    PointVector::iterator found;
-
-    FloatVector *left = contour_left(src);
-    FloatVector *right = contour_right(src);
-    FloatVector::iterator it;
-    size_t y;
-    std::set<Point> pointset;
-
-    for(it = left->begin(), y=0; it != left->end() ; it++, y++) {
-      if( *it != std::numeric_limits<double>::infinity() ) {
-        contour_points->push_back(Point((coord_t)*it,y));
-        pointset.insert(Point((coord_t)*it,y));
+    std::vector<long> left(src.nrows(), (long)src.ncols()), right(src.nrows(), -1);
+    typename T::const_row_iterator r = src.row_begin();
+    for (size_t y = 0; r != src.row_end(); ++r, ++y) {
+      typename T::const_col_iterator c = r.begin();
+      for (long x = 0; c != r.end(); ++c, ++x) {
+        if (is_black(*c)) {
+          if (left[y] > x)
+            left[y] = x;
+          right[y] = x;
+        }
       }
     }
-    for(it = right->begin(), y=0; it != right->end() ; it++, y++) {
-      if( *it != std::numeric_limits<double>::infinity() ) {
-        if(pointset.count(Point((coord_t)src.ncols()-*it,y))==0)
-          contour_points->push_back(Point((coord_t)src.ncols()-*it,y));
-      }
+    PointVector points;
+    HullDetail::row_extremes(left, right, points);
+    if (points.empty())
+      throw std::runtime_error("convex_hull_as_points: image has no black pixels");
+    return HullDetail::monotone_chain(points);
+  }
+
+  /*
+    The convex hulls of the connected components ccs of the labeled image
+    src, each as convex_hull_as_points of the component would return it.
+    The leftmost and rightmost pixels in each row of all components are
+    found in one scan of src.
+  */
+  template<class T>
+  PyObject* convex_hulls(const T& src, ImageVector& ccs) {
+    typedef typename T::value_type value_type;
+    const size_t nlabels = (size_t)std::numeric_limits<value_type>::max() + 1;
+    std::vector<long> index(nlabels, -1);
+    std::vector<std::vector<long> > left(ccs.size()), right(ccs.size());
+    for (size_t i = 0; i < ccs.size(); ++i) {
+      if (ccs[i].second != CC)
+        throw std::runtime_error("convex_hulls: ccs must be connected components");
+      Cc* cc = static_cast<Cc*>(ccs[i].first);
+      if (cc->label() >= nlabels)
+        throw std::runtime_error("convex_hulls: label out of range");
+      index[cc->label()] = i;
+      left[i].assign(cc->nrows(), (long)cc->ncols());
+      right[i].assign(cc->nrows(), -1);
     }
-    PointVector *output = convex_hull_from_points(contour_points);
 
-    delete left;
-    delete right;
-    delete contour_points;
+    typename T::const_row_iterator r = src.row_begin();
+    for (long y = src.ul_y(); r != src.row_end(); ++r, ++y) {
+      typename T::const_col_iterator c = r.begin();
+      for (long x = src.ul_x(); c != r.end(); ++c, ++x) {
+        value_type v = *c;
+        if (v == 0 || index[v] < 0)
+          continue;
+        long i = index[v];
+        Image* cc = ccs[i].first;
+        if (y < (long)cc->ul_y() || y > (long)cc->lr_y() ||
+            x < (long)cc->ul_x() || x > (long)cc->lr_x())
+          continue;
+        long row = y - (long)cc->ul_y(), col = x - (long)cc->ul_x();
+        if (left[i][row] > col)
+          left[i][row] = col;
+        right[i][row] = col;
+      }
+    }
 
-    return output;
+    PyObject* result = PyList_New(ccs.size());
+    PointVector points;
+    for (size_t i = 0; i < ccs.size(); ++i) {
+      HullDetail::row_extremes(left[i], right[i], points);
+      PointVector* hull = points.empty() ? new PointVector()
+                                         : HullDetail::monotone_chain(points);
+      PyList_SET_ITEM(result, i, PointVector_to_python(hull));
+      delete hull;
+    }
+    return result;
   }
 
   template<class T>
@@ -727,6 +926,131 @@ namespace Gamera {
   }
 
 
+  /*
+    Maximal whitespace rectangles among a set of obstacles (usually the
+    bounding boxes of the connected components), following T. Breuel's
+    branch-and-bound algorithm. Candidates are expanded in the order of
+    decreasing area, so that the first N empty candidates are the N
+    largest whitespace rectangles. Each result is added as an obstacle
+    for all later candidates, which makes the results pairwise disjoint.
+  */
+  namespace WhitespaceDetail {
+    struct Box {
+      long x0, y0, x1, y1;
+      Box(long a, long b, long c, long d) : x0(a), y0(b), x1(c), y1(d) {}
+      long width() const { return x1 - x0 + 1; }
+      long height() const { return y1 - y0 + 1; }
+      bool intersects(const Box& o) const {
+        return x0 <= o.x1 && o.x0 <= x1 && y0 <= o.y1 && o.y0 <= y1;
+      }
+    };
+
+    struct Candidate {
+      Box bound;
+      std::vector<size_t> obstacles;
+      size_t known_results;
+      Candidate(const Box& b, size_t k) : bound(b), known_results(k) {}
+    };
+
+    // (area, index into the candidate store)
+    typedef std::pair<double, size_t> QueueEntry;
+  }
+
+  template<class T>
+  PyObject* max_empty_rects(const T& src, ImageVector& ccs, int n,
+                            int min_width, int min_height) {
+    using namespace WhitespaceDetail;
+    if (min_width < 1) min_width = 1;
+    if (min_height < 1) min_height = 1;
+
+    Box page(0, 0, (long)src.ncols() - 1, (long)src.nrows() - 1);
+    // obstacles in coordinates relative to the image; the found
+    // rectangles are appended after the connected components
+    std::vector<Box> obstacles;
+    obstacles.reserve(ccs.size() + (n > 0 ? n : 0));
+    for (ImageVector::iterator i = ccs.begin(); i != ccs.end(); ++i) {
+      Image* cc = i->first;
+      Box b((long)cc->ul_x() - (long)src.ul_x(),
+            (long)cc->ul_y() - (long)src.ul_y(),
+            (long)cc->lr_x() - (long)src.ul_x(),
+            (long)cc->lr_y() - (long)src.ul_y());
+      if (b.intersects(page))
+        obstacles.push_back(b);
+    }
+    const size_t n_ccs = obstacles.size();
+
+    std::vector<Box> results;
+    std::vector<Candidate> store;
+    std::priority_queue<QueueEntry> queue;
+    if (n > 0 && page.width() >= min_width && page.height() >= min_height) {
+      store.push_back(Candidate(page, 0));
+      for (size_t k = 0; k < n_ccs; ++k)
+        store.back().obstacles.push_back(k);
+      queue.push(QueueEntry((double)page.width() * page.height(), 0));
+    }
+
+    while (!queue.empty() && results.size() < (size_t)n) {
+      size_t index = queue.top().second;
+      queue.pop();
+      Box bound = store[index].bound;
+      std::vector<size_t> obs;
+      obs.swap(store[index].obstacles);
+      // results found since this candidate was created are new obstacles
+      for (size_t k = store[index].known_results; k < results.size(); ++k)
+        if (results[k].intersects(bound))
+          obs.push_back(n_ccs + k);
+
+      if (obs.empty()) {
+        results.push_back(bound);
+        obstacles.push_back(bound);
+        continue;
+      }
+
+      // pivot on the obstacle closest to the center of the bound
+      long cx2 = bound.x0 + bound.x1, cy2 = bound.y0 + bound.y1;
+      size_t pivot = obs[0];
+      long best = std::numeric_limits<long>::max();
+      for (size_t k = 0; k < obs.size(); ++k) {
+        const Box& o = obstacles[obs[k]];
+        long d = std::abs(o.x0 + o.x1 - cx2) + std::abs(o.y0 + o.y1 - cy2);
+        if (d < best) {
+          best = d;
+          pivot = obs[k];
+        }
+      }
+      const Box p = obstacles[pivot];
+
+      Box subs[4] = {
+        Box(bound.x0, bound.y0, p.x0 - 1, bound.y1),  // left
+        Box(p.x1 + 1, bound.y0, bound.x1, bound.y1),  // right
+        Box(bound.x0, bound.y0, bound.x1, p.y0 - 1),  // top
+        Box(bound.x0, p.y1 + 1, bound.x1, bound.y1)   // bottom
+      };
+      for (size_t s = 0; s < 4; ++s) {
+        const Box& sub = subs[s];
+        if (sub.width() < min_width || sub.height() < min_height)
+          continue;
+        store.push_back(Candidate(sub, results.size()));
+        std::vector<size_t>& sub_obs = store.back().obstacles;
+        for (size_t k = 0; k < obs.size(); ++k)
+          if (obs[k] != pivot && obstacles[obs[k]].intersects(sub))
+            sub_obs.push_back(obs[k]);
+        queue.push(QueueEntry((double)sub.width() * sub.height(),
+                              store.size() - 1));
+      }
+    }
+
+    PyObject* list = PyList_New(results.size());
+    for (size_t k = 0; k < results.size(); ++k) {
+      const Box& r = results[k];
+      PyList_SET_ITEM(list, k,
+                      create_RectObject(Rect(Point(r.x0, r.y0),
+                                             Point(r.x1, r.y1))));
+    }
+    return list;
+  }
+
+
 } // namespace Gamera
 #endif
 
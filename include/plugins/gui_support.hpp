@@ -28,6 +28,9 @@
 #include "connected_components.hpp"
 
 #include <algorithm>
+#include <map>
+#include <vector>
+#include <stdexcept>
 
 namespace Gamera {
 
@@ -373,6 +376,336 @@ void to_buffer_colorize(const T& m, PyObject* py_buffer,
   }
 }
 
+/*
+  Tiled rendering for the image display
+
+  The display asks for the part of the image it shows, at its zoom,
+  with to_buffer_tiled.  The image is rendered in tiles of TILE_SIZE x
+  TILE_SIZE display pixels, which are kept with the image (see
+  ImageCache) until its pixels or its zoom change, so that scrolling
+  only renders the tiles that come into view.  Highlighted ccs are
+  drawn over the buffer afterwards with draw_ccs_to_buffer.
+*/
+
+namespace GuiDetail {
+
+  const int TILE_SIZE = 256;
+  const size_t MAX_TILES = 128;
+
+  /*
+    The zoom of the display as an integer: n > 0 shows each pixel as
+    n x n display pixels, n < 0 shows the mean of -n x -n pixels as one
+    display pixel.  The display only uses such scalings.
+  */
+  inline int zoom_of(double scaling) {
+    if (scaling >= 1.0) {
+      int zoom = int(scaling + 0.5);
+      if (std::abs(scaling - zoom) < 1e-6)
+        return zoom;
+    } else if (scaling > 0.0) {
+      int zoom = int(1.0 / scaling + 0.5);
+      if (std::abs(1.0 / scaling - zoom) < 1e-6)
+        return zoom == 1 ? 1 : -zoom;
+    }
+    throw std::range_error("The scaling must be a whole number or one over a whole number.");
+  }
+
+  // the pixels as to_rgb converts them
+  template<class Pixel>
+  struct display_rgb {
+    template<class T>
+    display_rgb(const T& image) { }
+    RGBPixel operator()(Pixel value) const {
+      return RGBPixel(value, value, value);
+    }
+  };
+
+  template<>
+  struct display_rgb<OneBitPixel> {
+    template<class T>
+    display_rgb(const T& image) { }
+    RGBPixel operator()(OneBitPixel value) const {
+      if (is_white(value))
+        return RGBPixel(255, 255, 255);
+      return RGBPixel(0, 0, 0);
+    }
+  };
+
+  template<>
+  struct display_rgb<Grey16Pixel> {
+    template<class T>
+    display_rgb(const T& image) {
+      Grey16Pixel max = find_max(image.parent());
+      m_scale = max > 0 ? 255.0 / max : 0.0;
+    }
+    RGBPixel operator()(Grey16Pixel value) const {
+      GreyScalePixel tmp = GreyScalePixel(value * m_scale);
+      return RGBPixel(tmp, tmp, tmp);
+    }
+    double m_scale;
+  };
+
+  template<>
+  struct display_rgb<RGBPixel> {
+    template<class T>
+    display_rgb(const T& image) { }
+    RGBPixel operator()(RGBPixel value) const {
+      return value;
+    }
+  };
+
+  // the pixels of the image that display pixel d (of one axis) shows
+  inline void source_range(int d, int zoom, size_t size, size_t& from, size_t& to) {
+    if (zoom > 0) {
+      from = d / zoom;
+      to = from + 1;
+    } else {
+      from = size_t(d) * -zoom;
+      to = std::min(from - zoom, size);
+    }
+  }
+
+  // the display pixel showing pixel pos (of one axis)
+  inline int display_pixel(size_t pos, int zoom) {
+    if (zoom > 0)
+      return int(pos) * zoom;
+    return int(pos / -zoom);
+  }
+
+  // the number of display pixels showing size pixels
+  inline int display_size(size_t size, int zoom) {
+    if (zoom > 0)
+      return int(size) * zoom;
+    return int((size - zoom - 1) / -zoom);
+  }
+
+  class RenderedTiles : public ImageCache {
+  public:
+    RenderedTiles(const Image& image, int zoom)
+      : ImageCache(image, image.data()->generation()), m_zoom(zoom), m_uses(0) { }
+    int zoom() const { return m_zoom; }
+    // the tile, or 0 when it has not been rendered
+    char* find(int tile_x, int tile_y) {
+      tile_map::iterator i = m_tiles.find(std::make_pair(tile_x, tile_y));
+      if (i == m_tiles.end())
+        return 0;
+      i->second.second = ++m_uses;
+      return &(i->second.first[0]);
+    }
+    // room for a new tile, dropping the least recently used one if needed
+    char* add(int tile_x, int tile_y) {
+      if (m_tiles.size() >= MAX_TILES) {
+        tile_map::iterator oldest = m_tiles.begin();
+        for (tile_map::iterator i = m_tiles.begin(); i != m_tiles.end(); ++i)
+          if (i->second.second < oldest->second.second)
+            oldest = i;
+        m_tiles.erase(oldest);
+      }
+      std::pair<std::vector<char>, size_t>& tile = m_tiles[std::make_pair(tile_x, tile_y)];
+      tile.first.resize(TILE_SIZE * TILE_SIZE * 3);
+      tile.second = ++m_uses;
+      return &tile.first[0];
+    }
+  private:
+    typedef std::map<std::pair<int, int>, std::pair<std::vector<char>, size_t> > tile_map;
+    int m_zoom;
+    size_t m_uses;
+    tile_map m_tiles;
+  };
+
+  template<class T>
+  void render_tile(const T& image, const display_rgb<typename T::value_type>& rgb,
+                   int zoom, int tile_x, int tile_y, char* tile) {
+    std::fill(tile, tile + TILE_SIZE * TILE_SIZE * 3, char(255));
+    int x0 = tile_x * TILE_SIZE, y0 = tile_y * TILE_SIZE;
+    int width = std::min(TILE_SIZE, display_size(image.ncols(), zoom) - x0);
+    int height = std::min(TILE_SIZE, display_size(image.nrows(), zoom) - y0);
+    if (width <= 0 || height <= 0)
+      return;
+    size_t col_from, col_to, last_from, last_to;
+    source_range(x0, zoom, image.ncols(), col_from, col_to);
+    source_range(x0 + width - 1, zoom, image.ncols(), last_from, last_to);
+    std::vector<double> sums(width * 3);
+    std::vector<RGBPixel> row(last_to - col_from);
+    for (int dy = 0; dy < height; ++dy) {
+      size_t row_from, row_to;
+      source_range(y0 + dy, zoom, image.nrows(), row_from, row_to);
+      char* out = tile + dy * TILE_SIZE * 3;
+      if (zoom > 0) {
+        typename T::const_row_iterator r = image.row_begin() + row_from;
+        typename T::const_row_iterator::iterator c = r.begin() + col_from;
+        for (size_t i = 0; i < row.size(); ++i, ++c)
+          row[i] = rgb(*c);
+        for (int dx = 0; dx < width; ++dx) {
+          const RGBPixel& p = row[(x0 + dx) / zoom - col_from];
+          *(out++) = (unsigned char)p.red();
+          *(out++) = (unsigned char)p.green();
+          *(out++) = (unsigned char)p.blue();
+        }
+      } else {
+        std::fill(sums.begin(), sums.end(), 0.0);
+        for (size_t y = row_from; y < row_to; ++y) {
+          typename T::const_row_iterator r = image.row_begin() + y;
+          typename T::const_row_iterator::iterator c = r.begin() + col_from;
+          for (size_t x = col_from; x < last_to; ++x, ++c) {
+            RGBPixel p = rgb(*c);
+            double* sum = &sums[((x - col_from) / -zoom) * 3];
+            sum[0] += p.red();
+            sum[1] += p.green();
+            sum[2] += p.blue();
+          }
+        }
+        for (int dx = 0; dx < width; ++dx) {
+          size_t from, to;
+          source_range(x0 + dx, zoom, image.ncols(), from, to);
+          double area = double(to - from) * (row_to - row_from);
+          for (int c = 0; c < 3; ++c)
+            *(out++) = (unsigned char)(sums[dx * 3 + c] / area + 0.5);
+        }
+      }
+    }
+  }
+
+  /*
+    Draws the black pixels of cc in color over the display pixels
+    buffer holds, as draw_cc on the unscaled image would before it is
+    scaled: when zoomed out, each display pixel is changed by the
+    share of its pixels that the cc covers.
+  */
+  template<class T, class U>
+  void draw_cc_to_buffer(const T& image, const display_rgb<typename T::value_type>& rgb,
+                         const U& cc, char* buffer, int x, int y, int width, int height,
+                         int zoom, RGBPixel color) {
+    if (!cc.intersects(image))
+      return;
+    // the part of cc on the image, relative to the image
+    Rect area = cc.intersection(image);
+    size_t left = area.ul_x() - image.ul_x(), right = area.lr_x() - image.ul_x() + 1;
+    size_t top = area.ul_y() - image.ul_y(), bottom = area.lr_y() - image.ul_y() + 1;
+    int dx0 = std::max(display_pixel(left, zoom), x);
+    int dx1 = std::min(display_size(right, zoom), x + width);
+    int dy0 = std::max(display_pixel(top, zoom), y);
+    int dy1 = std::min(display_size(bottom, zoom), y + height);
+    for (int dy = dy0; dy < dy1; ++dy) {
+      size_t row_from, row_to;
+      source_range(dy, zoom, image.nrows(), row_from, row_to);
+      for (int dx = dx0; dx < dx1; ++dx) {
+        size_t col_from, col_to;
+        source_range(dx, zoom, image.ncols(), col_from, col_to);
+        double all = double(col_to - col_from) * (row_to - row_from);
+        double delta[3] = {0.0, 0.0, 0.0};
+        bool covered = false;
+        for (size_t sy = std::max(row_from, top); sy < std::min(row_to, bottom); ++sy) {
+          for (size_t sx = std::max(col_from, left); sx < std::min(col_to, right); ++sx) {
+            if (is_black(cc.get(Point(sx + image.ul_x() - cc.ul_x(),
+                                      sy + image.ul_y() - cc.ul_y())))) {
+              RGBPixel base = rgb(image.get(Point(sx, sy)));
+              delta[0] += int(color.red()) - int(base.red());
+              delta[1] += int(color.green()) - int(base.green());
+              delta[2] += int(color.blue()) - int(base.blue());
+              covered = true;
+            }
+          }
+        }
+        if (!covered)
+          continue;
+        unsigned char* out = (unsigned char*)buffer + ((dy - y) * width + (dx - x)) * 3;
+        for (int c = 0; c < 3; ++c) {
+          double value = out[c] + delta[c] / all + 0.5;
+          out[c] = (unsigned char)std::max(0.0, std::min(255.0, value));
+        }
+      }
+    }
+  }
+
+  inline char* write_buffer(PyObject* py_buffer, int width, int height) {
+    char* buffer;
+    Py_ssize_t buffer_len;
+    if (width < 0 || height < 0)
+      throw std::range_error("The width and height must not be negative.");
+    if (PyObject_AsWriteBuffer(py_buffer, (void **)&buffer, &buffer_len) != 0)
+      throw std::runtime_error("The buffer is not writable.");
+    if ((size_t)buffer_len != size_t(width) * height * 3)
+      throw std::range_error("The buffer is not of the correct size.");
+    return buffer;
+  }
+}
+
+/*
+  Renders the width x height display pixels at (x, y) of the image
+  shown at scaling (relative to its upper left) into py_buffer.
+*/
+template<class T>
+void to_buffer_tiled(const T& m, PyObject* py_buffer, int x, int y,
+                     int width, int height, double scaling) {
+  using namespace GuiDetail;
+  int zoom = zoom_of(scaling);
+  char* buffer = write_buffer(py_buffer, width, height);
+  RenderedTiles* tiles = m.template cache<RenderedTiles>();
+  if (tiles == 0 || tiles->zoom() != zoom) {
+    tiles = new RenderedTiles(m, zoom);
+    m.cache(tiles);
+  }
+  display_rgb<typename T::value_type> rgb(m);
+  for (int tile_y = std::max(y, 0) / TILE_SIZE; tile_y * TILE_SIZE < y + height; ++tile_y) {
+    for (int tile_x = std::max(x, 0) / TILE_SIZE; tile_x * TILE_SIZE < x + width; ++tile_x) {
+      char* tile = tiles->find(tile_x, tile_y);
+      if (tile == 0) {
+        tile = tiles->add(tile_x, tile_y);
+        render_tile(m, rgb, zoom, tile_x, tile_y, tile);
+      }
+      int dx0 = std::max(x, tile_x * TILE_SIZE), dx1 = std::min(x + width, (tile_x + 1) * TILE_SIZE);
+      int dy0 = std::max(y, tile_y * TILE_SIZE), dy1 = std::min(y + height, (tile_y + 1) * TILE_SIZE);
+      for (int dy = dy0; dy < dy1; ++dy)
+        std::copy(tile + ((dy - tile_y * TILE_SIZE) * TILE_SIZE + dx0 - tile_x * TILE_SIZE) * 3,
+                  tile + ((dy - tile_y * TILE_SIZE) * TILE_SIZE + dx1 - tile_x * TILE_SIZE) * 3,
+                  buffer + ((dy - y) * width + dx0 - x) * 3);
+    }
+  }
+  // the parts left and above the image
+  for (int dy = 0; dy < height; ++dy)
+    for (int dx = 0; dx < width; ++dx)
+      if (dx + x < 0 || dy + y < 0)
+        std::fill(buffer + (dy * width + dx) * 3, buffer + (dy * width + dx + 1) * 3, char(255));
+}
+
+/*
+  Draws the ccs in the given color over a buffer filled by
+  to_buffer_tiled with the same arguments.
+*/
+template<class T>
+void draw_ccs_to_buffer(const T& m, PyObject* py_buffer, int x, int y,
+                        int width, int height, double scaling, ImageVector& ccs,
+                        int red, int green, int blue) {
+  using namespace GuiDetail;
+  int zoom = zoom_of(scaling);
+  char* buffer = write_buffer(py_buffer, width, height);
+  display_rgb<typename T::value_type> rgb(m);
+  RGBPixel color((unsigned char)red, (unsigned char)green, (unsigned char)blue);
+  for (ImageVector::iterator i = ccs.begin(); i != ccs.end(); ++i) {
+    Image* cc = (*i).first;
+    switch ((*i).second) {
+    case ONEBITIMAGEVIEW:
+      draw_cc_to_buffer(m, rgb, *((OneBitImageView*)cc), buffer, x, y, width, height, zoom, color);
+      break;
+    case CC:
+      draw_cc_to_buffer(m, rgb, *((Cc*)cc), buffer, x, y, width, height, zoom, color);
+      break;
+    case MLCC:
+      draw_cc_to_buffer(m, rgb, *((MlCc*)cc), buffer, x, y, width, height, zoom, color);
+      break;
+    case ONEBITRLEIMAGEVIEW:
+      draw_cc_to_buffer(m, rgb, *((OneBitRleImageView*)cc), buffer, x, y, width, height, zoom, color);
+      break;
+    case RLECC:
+      draw_cc_to_buffer(m, rgb, *((RleCc*)cc), buffer, x, y, width, height, zoom, color);
+      break;
+    default:
+      throw std::runtime_error("There is an Image in the list that is not a OneBit image.");
+    }
+  }
+}
+
 template<class T, class U>
 void draw_cc(T& m, const U& cc,
 	     int red, int green, int blue) {
@@ -22,6 +22,7 @@
 
 #include "gamera.hpp"
 #include "image_utilities.hpp"
+#include "threshold.hpp"
 
 /*
   IMAGE CONVERSION
@@ -58,6 +59,45 @@ namespace Gamera {
       }
     };    
 
+    /*
+      The conversions between the common pixel types go over the rows
+      of the (always dense) images as plain arrays, which is much
+      faster than the image iterators, and lets the compiler vectorize
+      the simple ones.
+    */
+
+    // RGBValue::luminance, in integer arithmetic
+    inline GreyScalePixel rgb_luminance(const RGBPixel& p) {
+      // a hundred times the luminance
+      unsigned int s = 30 * p.red() + 59 * p.green() + 11 * p.blue();
+      // halves are rounded the way the floating point sum happens to
+      if (s % 100 == 50)
+        return p.luminance();
+      return GreyScalePixel((s + 50) / 100);
+    }
+
+    // casts each pixel of in to the pixel type of out
+    template<class T, class U>
+    void convert_rows(const T& in, U& out) {
+      for (size_t y = 0; y < in.nrows(); ++y) {
+        const typename T::value_type* in_row = in[y];
+        typename U::value_type* out_row = out[y];
+        for (size_t x = 0; x < in.ncols(); ++x)
+          out_row[x] = typename U::value_type(in_row[x]);
+      }
+    }
+
+    // sets each pixel of out to the luminance of the pixel of in
+    template<class U>
+    void luminance_rows(const RGBImageView& in, U& out) {
+      for (size_t y = 0; y < in.nrows(); ++y) {
+        const RGBPixel* in_row = in[y];
+        typename U::value_type* out_row = out[y];
+        for (size_t x = 0; x < in.ncols(); ++x)
+          out_row[x] = typename U::value_type(rgb_luminance(in_row[x]));
+      }
+    }
+
     /*
       TO RGB
     */
@@ -132,19 +172,7 @@ namespace Gamera {
         RGBImageView* view = creator<RGBPixel>::image(image);
 
         try {
-          GreyScaleImageView::const_row_iterator in_row = image.row_begin();
-          GreyScaleImageView::const_col_iterator in_col;
-          RGBImageView::row_iterator out_row = view->row_begin();
-          RGBImageView::col_iterator out_col;
-          ImageAccessor<GreyScalePixel> in_acc;
-          ImageAccessor<RGBPixel> out_acc;
-          for (; in_row != image.row_end(); ++in_row, ++out_row) {
-            for (in_col = in_row.begin(), out_col = out_row.begin();
-                 in_col != in_row.end(); ++in_col, ++out_col) {
-              GreyScalePixel tmp = in_acc(in_col);
-              out_acc.set(RGBPixel(tmp, tmp, tmp), out_col);
-            }
-          }
+          convert_rows(image, *view);
         } catch (std::exception e) {
           delete view->data();
           delete view;
@@ -298,17 +326,32 @@ namespace Gamera {
         GreyScaleImageView* view = creator<GreyScalePixel>::image(image);
 
         try {
-          RGBImageView::const_row_iterator in_row = image.row_begin();
-          RGBImageView::const_col_iterator in_col;
-          GreyScaleImageView::row_iterator out_row = view->row_begin();
-          GreyScaleImageView::col_iterator out_col;
-          ImageAccessor<RGBPixel> in_acc;
-          ImageAccessor<GreyScalePixel> out_acc;
-          for (; in_row != image.row_end(); ++in_row, ++out_row) {
-            for (in_col = in_row.begin(), out_col = out_row.begin();
-                 in_col != in_row.end(); ++in_col, ++out_col) {
-              out_acc.set(in_acc(in_col).luminance(), out_col);
-            }
+          luminance_rows(image, *view);
+        } catch (std::exception e) {
+          delete view->data();
+          delete view;
+          throw;
+        }
+        return view;
+      }
+    };
+
+    template<>
+    struct to_greyscale_converter<Grey16Pixel> {
+      GreyScaleImageView* operator()(const Grey16ImageView& image) {
+        GreyScaleImageView* view = creator<GreyScalePixel>::image(image);
+        try {
+          Grey16Pixel max = find_max(image.parent());
+          double scale;
+          if (max > 0)
+            scale = 255.0 / max;
+          else
+            scale = 0.0;
+          for (size_t y = 0; y < image.nrows(); ++y) {
+            const Grey16Pixel* in_row = image[y];
+            GreyScalePixel* out_row = (*view)[y];
+            for (size_t x = 0; x < image.ncols(); ++x)
+              out_row[x] = GreyScalePixel(in_row[x] * scale);
           }
         } catch (std::exception e) {
           delete view->data();
@@ -431,18 +474,7 @@ namespace Gamera {
         Grey16ImageView* view = creator<Grey16Pixel>::image(image);
 
         try {
-          RGBImageView::const_row_iterator in_row = image.row_begin();
-          RGBImageView::const_col_iterator in_col;
-          Grey16ImageView::row_iterator out_row = view->row_begin();
-          Grey16ImageView::col_iterator out_col;
-          ImageAccessor<RGBPixel> in_acc;
-          ImageAccessor<Grey16Pixel> out_acc;
-          for (; in_row != image.row_end(); ++in_row, ++out_row) {
-            for (in_col = in_row.begin(), out_col = out_row.begin();
-                 in_col != in_row.end(); ++in_col, ++out_col) {
-              out_acc.set(in_acc(in_col).luminance(), out_col);
-            }
-          }
+          luminance_rows(image, *view);
         } catch (std::exception e) {
           delete view->data();
           delete view;
@@ -491,19 +523,7 @@ namespace Gamera {
         Grey16ImageView* view = creator<Grey16Pixel>::image(image);
 
         try {
-          GreyScaleImageView::const_row_iterator in_row = image.row_begin();
-          GreyScaleImageView::const_col_iterator in_col;
-          Grey16ImageView::row_iterator out_row = view->row_begin();
-          Grey16ImageView::col_iterator out_col;
-          ImageAccessor<GreyScalePixel> in_acc;
-          ImageAccessor<Grey16Pixel> out_acc;
-          for (; in_row != image.row_end(); ++in_row, ++out_row) {
-            for (in_col = in_row.begin(), out_col = out_row.begin();
-                 in_col != in_row.end(); ++in_col, ++out_col) {
-              GreyScalePixel tmp = in_acc(in_col);
-              out_acc.set(tmp, out_col);
-            }
-          }
+          convert_rows(image, *view);
         } catch (std::exception e) {
           delete view->data();
           delete view;
@@ -618,18 +638,7 @@ namespace Gamera {
       FloatImageView* operator()(const RGBImageView& image) {
 	FloatImageView* view = creator<FloatPixel>::image(image);
 	try {
-	  RGBImageView::const_row_iterator in_row = image.row_begin();
-	  RGBImageView::const_col_iterator in_col;
-	  FloatImageView::row_iterator out_row = view->row_begin();
-	  FloatImageView::col_iterator out_col;
-	  ImageAccessor<RGBImageView::value_type> in_acc;
-	  ImageAccessor<FloatPixel> out_acc;
-	  for (; in_row != image.row_end(); ++in_row, ++out_row) {
-	    for (in_col = in_row.begin(), out_col = out_row.begin();
-		 in_col != in_row.end(); ++in_col, ++out_col) {
-	      out_acc.set(FloatPixel(in_acc.get(in_col).luminance()), out_col);
-	    }
-	  }
+	  luminance_rows(image, *view);
 	} catch (std::exception e) {
 	  delete view->data();
 	  delete view;
@@ -640,6 +649,24 @@ namespace Gamera {
       }
     };
 
+    template<>
+    struct to_float_converter<GreyScalePixel> {
+      FloatImageView* operator()(const GreyScaleImageView& image) {
+	FloatImageView* view = creator<FloatPixel>::image(image);
+	convert_rows(image, *view);
+	return view;
+      }
+    };
+
+    template<>
+    struct to_float_converter<Grey16Pixel> {
+      FloatImageView* operator()(const Grey16ImageView& image) {
+	FloatImageView* view = creator<FloatPixel>::image(image);
+	convert_rows(image, *view);
+	return view;
+      }
+    };
+
     template<>
     struct to_float_converter<OneBitPixel> {
       template<class T>
@@ -773,6 +800,58 @@ namespace Gamera {
     return conv(image);    
   }
 
+  /*
+    to_onebit converts the image to greyscale and applies the Otsu
+    threshold to it.  Dense images are made from RGB images directly,
+    without the greyscale image in between.
+  */
+  template<class T>
+  Image* to_onebit(const T& image, int storage_format) {
+    GreyScaleImageView* grey = to_greyscale(image);
+    Image* view;
+    try {
+      view = otsu_threshold(*grey, storage_format);
+    } catch (std::exception e) {
+      delete grey->data();
+      delete grey;
+      throw;
+    }
+    delete grey->data();
+    delete grey;
+    return view;
+  }
+
+  inline Image* to_onebit(const GreyScaleImageView& image, int storage_format) {
+    return otsu_threshold(image, storage_format);
+  }
+
+  inline Image* to_onebit(const RGBImageView& image, int storage_format) {
+    if (storage_format != DENSE)
+      return to_onebit<RGBImageView>(image, storage_format);
+    std::vector<size_t> counts(256, 0);
+    for (size_t y = 0; y < image.nrows(); ++y) {
+      const RGBPixel* in_row = image[y];
+      for (size_t x = 0; x < image.ncols(); ++x)
+        ++counts[_image_conversion::rgb_luminance(in_row[x])];
+    }
+    FloatVector histogram(256);
+    double size = image.nrows() * image.ncols();
+    for (size_t i = 0; i < 256; ++i)
+      histogram[i] = counts[i] / size;
+    GreyScalePixel threshold = otsu_find_threshold_of_histogram(&histogram);
+
+    typedef TypeIdImageFactory<ONEBIT, DENSE> fact_type;
+    fact_type::image_type* view = fact_type::create(image.origin(), image.dim());
+    for (size_t y = 0; y < image.nrows(); ++y) {
+      const RGBPixel* in_row = image[y];
+      OneBitPixel* out_row = (*view)[y];
+      for (size_t x = 0; x < image.ncols(); ++x)
+        out_row[x] = _image_conversion::rgb_luminance(in_row[x]) > threshold ?
+          white(*view) : black(*view);
+    }
+    return view;
+  }
+
   template<class T>
   FloatImageView* extract_real(const T& image) {
     FloatImageData* data = new FloatImageData(image.size(), image.origin());
@@ -24,15 +24,21 @@
 #define kwm12032001_image_utilities
 
 #include "gamera.hpp"
+#include "thread_exception.hpp"
 #include "gameramodule.hpp"
 #include "gamera_limits.hpp"
 #include "vigra/resizeimage.hxx"
 #include "vigra/basicgeometry.hxx"
 #include "plugins/logical.hpp"
+#include "plugins/rle_utilities.hpp"
 #include <exception>
 #include <math.h>
 #include <algorithm>
 #include <map>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // for compatibility: resize, scale, mirror, and shear
 //  were formerly implemented in image_utilitis instead of transformation
@@ -110,6 +116,52 @@ namespace Gamera {
     image_copy_attributes(src, dest);
   }
 
+  // into RLE images, run by run (unless both share their data)
+  template<class T, class P>
+  void image_copy_fill(const T& src, ImageView<RleImageData<P> >& dest) {
+    if ((src.nrows() != dest.nrows()) | (src.ncols() != dest.ncols()))
+      throw std::range_error("image_copy_fill: src and dest image dimensions must match!");
+    if ((const void*)src.data() == (const void*)dest.data()) {
+      typename T::const_vec_iterator i = src.vec_begin();
+      typename ImageView<RleImageData<P> >::vec_iterator j = dest.vec_begin();
+      for (; i != src.vec_end(); ++i, ++j)
+        *j = (P)*i;
+    } else {
+      RleBuilder<P> builder(dest);
+      typename T::const_row_iterator row = src.row_begin();
+      typename T::const_col_iterator col;
+      for (; row != src.row_end(); ++row)
+        for (col = row.begin(); col != row.end(); ++col)
+          builder.append((P)*col);
+    }
+    image_copy_attributes(src, dest);
+  }
+
+  template<class P, class Q>
+  struct CopySpan {
+    void operator()(const P* src, Q* dest, size_t n) const {
+      for (size_t i = 0; i < n; ++i)
+        dest[i] = (Q)src[i];
+    }
+  };
+
+  template<class P>
+  struct CopySpan<P, P> {
+    void operator()(const P* src, P* dest, size_t n) const {
+      std::copy(src, src + n, dest);
+    }
+  };
+
+  // dense images into dense ones, span by span
+  template<class P, class Q>
+  void image_copy_fill(const ImageView<ImageData<P> >& src, ImageView<ImageData<Q> >& dest) {
+    if ((src.nrows() != dest.nrows()) | (src.ncols() != dest.ncols()))
+      throw std::range_error("image_copy_fill: src and dest image dimensions must match!");
+    CopySpan<P, Q> copy;
+    for_each_row_span(src, dest, copy);
+    image_copy_attributes(src, dest);
+  }
+
   /*
     simple_image_copy
 
@@ -133,6 +185,24 @@ namespace Gamera {
     return dest;
   }
 
+  /*
+    in_place_view
+
+    The view that filters called with in_place write their result to:
+    the image itself.  The wrappers return the Python object of the
+    image when a plugin returns it.  Connected components are refused,
+    since the result would change the pixels of the other components.
+  */
+  template<class T>
+  typename ImageFactory<T>::view_type* in_place_view(const T& src) {
+    throw std::invalid_argument("in_place is not possible for connected components.");
+  }
+
+  template<class D>
+  ImageView<D>* in_place_view(const ImageView<D>& src) {
+    return const_cast<ImageView<D>*>(&src);
+  }
+
   
 
   /*
@@ -143,11 +213,69 @@ namespace Gamera {
     OneBit*ImageView is returned rather that a ConnectedComponent (which is why the
     ImageFactory is used).
   */
+  /*
+    Only OneBit images can be stored in the PACKED format, so the
+    packed branch of image_copy is only instantiated for OneBit pixels.
+  */
+  template<class T, class Pixel>
+  struct _image_copy_packed {
+    Image* operator()(T& a) {
+      throw std::runtime_error("Pixel type must be OneBit to use PACKED data.");
+    }
+  };
+
+  template<class T>
+  struct _image_copy_packed<T, OneBitPixel> {
+    Image* operator()(T& a) {
+      typename ImageFactory<T>::packed_data_type* data =
+        new typename ImageFactory<T>::packed_data_type(a.size(), a.origin());
+      typename ImageFactory<T>::packed_view_type* view =
+        new typename ImageFactory<T>::packed_view_type(*data, a.origin(), a.size());
+      try {
+        image_copy_fill(a, *view);
+      } catch (std::exception e) {
+        delete view;
+        delete data;
+        throw;
+      }
+      return view;
+    }
+  };
+
+  /*
+    A dense copy of a view on all of the pixels of dense data shares
+    them with the original until either image is changed (see
+    ImageData::share).  Other images are copied right away.
+  */
+  template<class T>
+  Image* _image_copy_shared(const T& a) {
+    return 0;
+  }
+
+  template<class P>
+  Image* _image_copy_shared(const ImageView<ImageData<P> >& a) {
+    ImageData<P>* data = a.data();
+    if (a.offset_x() != data->page_offset_x() || a.offset_y() != data->page_offset_y()
+        || a.ncols() != data->ncols() || a.nrows() != data->nrows())
+      return 0;
+    ImageData<P>* shared = data->share();
+    if (shared == 0)
+      return 0;
+    ImageView<ImageData<P> >* view = new ImageView<ImageData<P> >(*shared);
+    image_copy_attributes(a, *view);
+    return view;
+  }
+
   template<class T>
   Image* image_copy(T &a, int storage_format) {
     if (a.ul_x() > a.lr_x() || a.ul_y() > a.lr_y())
       throw std::exception();
-    if (storage_format == DENSE) {
+    if (storage_format == PACKED) {
+      return _image_copy_packed<T, typename T::value_type>()(a);
+    } else if (storage_format == DENSE) {
+      Image* shared = _image_copy_shared(a);
+      if (shared != 0)
+        return shared;
       typename ImageFactory<T>::dense_data_type* data =
         new typename ImageFactory<T>::dense_data_type(a.size(), a.origin());
       typename ImageFactory<T>::dense_view_type* view =
@@ -190,7 +318,7 @@ namespace Gamera {
     size_t lr_y = std::min(a.lr_y(), b.lr_y());
     size_t lr_x = std::min(a.lr_x(), b.lr_x());
     
-    if (ul_y >= lr_y || ul_x >= lr_x)
+    if (ul_y > lr_y || ul_x > lr_x)
       return;
     for (size_t y = ul_y, ya = y-a.ul_y(), yb=y-b.ul_y(); y <= lr_y; ++y, ++ya, ++yb)
       for (size_t x = ul_x, xa = x-a.ul_x(), xb=x-b.ul_x(); x <= lr_x; ++x, ++xa, ++xb) {
@@ -201,6 +329,34 @@ namespace Gamera {
       }
   }
 
+  /*
+    The union of a dense OneBit view or Cc into a (which contains it),
+    reading the rows of its data directly: the pixels of the Cc are the
+    ones with its label, those of a view (label 0) all black pixels.
+  */
+  template<class U>
+  void _union_image_rows(OneBitImageView& a, const U& b, OneBitPixel label) {
+    const OneBitImageData* data = b.data();
+    size_t stride = data->stride();
+    const OneBitPixel* src = data->begin()
+      + (b.offset_y() - data->page_offset_y()) * stride
+      + (b.offset_x() - data->page_offset_x());
+    size_t x0 = b.ul_x() - a.ul_x(), y0 = b.ul_y() - a.ul_y();
+    size_t nrows = b.nrows(), ncols = b.ncols();
+    for (size_t y = 0; y < nrows; ++y, src += stride) {
+      OneBitPixel* dest = a[y0 + y] + x0;
+      if (label == 0) {
+        for (size_t x = 0; x < ncols; ++x)
+          if (src[x] != 0)
+            dest[x] = 1;
+      } else {
+        for (size_t x = 0; x < ncols; ++x)
+          if (src[x] == label)
+            dest[x] = 1;
+      }
+    }
+  }
+
   Image *union_images(ImageVector &list_of_images) {
     size_t min_x, min_y, max_x, max_y;
     min_x = min_y = std::numeric_limits<size_t>::max();
@@ -228,10 +384,10 @@ namespace Gamera {
         Image* image = (*i).first;
         switch((*i).second) {
         case ONEBITIMAGEVIEW:
-          _union_image(*dest, *((OneBitImageView*)image));
+          _union_image_rows(*dest, *((OneBitImageView*)image), 0);
           break;
         case CC:
-          _union_image(*dest, *((Cc*)image));
+          _union_image_rows(*dest, *((Cc*)image), ((Cc*)image)->label());
           break;
         case ONEBITRLEIMAGEVIEW:
           _union_image(*dest, *((OneBitRleImageView*)image));
@@ -239,6 +395,9 @@ namespace Gamera {
         case RLECC:
           _union_image(*dest, *((RleCc*)image));
           break;
+        case ONEBITPACKEDIMAGEVIEW:
+          _union_image(*dest, *((OneBitPackedImageView*)image));
+          break;
         default:
           throw std::runtime_error
             ("There is an Image in the list that is not a OneBit image.");
@@ -254,6 +413,59 @@ namespace Gamera {
   }
 
 
+  /*
+    The pixel counts of an image, counts having one entry per possible
+    pixel value.  Dense images are counted row by row into four
+    sub-histograms, so that runs of equal pixels do not wait on each
+    other's increments, and images of more than 4 megapixels are
+    counted in bands of rows on several threads.
+  */
+  template<class T>
+  void histogram_counts(const T& image, std::vector<size_t>& counts) {
+    typename T::const_row_iterator row = image.row_begin();
+    typename T::const_col_iterator col;
+    ImageAccessor<typename T::value_type> acc;
+    for (; row != image.row_end(); ++row)
+      for (col = row.begin(); col != row.end(); ++col)
+        counts[acc.get(col)]++;
+  }
+
+  template<class P>
+  void histogram_counts(const ImageView<ImageData<P> >& image, std::vector<size_t>& counts) {
+    size_t l = counts.size();
+    size_t ncols = image.ncols();
+    int nrows = (int)image.nrows();
+    int threads = 1;
+#ifdef _OPENMP
+    if (double(nrows) * ncols >= double(1 << 22))
+      threads = std::max(1, std::min(omp_get_max_threads(), nrows));
+#endif
+    int band = (nrows + threads - 1) / threads;
+    std::vector<size_t> sub(4 * l * threads, 0);
+    int t;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(threads)
+#endif
+    for (t = 0; t < threads; ++t) {
+      size_t* c = &sub[4 * l * t];
+      int y_end = std::min(nrows, (t + 1) * band);
+      for (int y = t * band; y < y_end; ++y) {
+        const P* p = image[y];
+        size_t x = 0;
+        for (; x + 4 <= ncols; x += 4) {
+          ++c[p[x]];
+          ++c[l + p[x + 1]];
+          ++c[2 * l + p[x + 2]];
+          ++c[3 * l + p[x + 3]];
+        }
+        for (; x < ncols; ++x)
+          ++c[p[x]];
+      }
+    }
+    for (size_t i = 0; i < sub.size(); ++i)
+      counts[i % l] += sub[i];
+  }
+
   /*
     FloatVector histogram(GreyScale|Grey16 image);
 
@@ -268,22 +480,13 @@ namespace Gamera {
     FloatVector* values = new FloatVector(l);
 
     try {
-      // set the list to 0
-      std::fill(values->begin(), values->end(), 0);
-      
-      typename T::const_row_iterator row = image.row_begin();
-      typename T::const_col_iterator col;
-      ImageAccessor<typename T::value_type> acc;
-
-      // create the histogram
-      for (; row != image.row_end(); ++row)
-        for (col = row.begin(); col != row.end(); ++col)
-          (*values)[acc.get(col)]++;
+      std::vector<size_t> counts(l, 0);
+      histogram_counts(image, counts);
 
       // convert from absolute values to percentages
       double size = image.nrows() * image.ncols();
       for (size_t i = 0; i < l; i++) {
-        (*values)[i] = (*values)[i] / size;
+        (*values)[i] = counts[i] / size;
       }
     } catch (std::exception e) {
       delete values;
@@ -353,6 +556,21 @@ namespace Gamera {
     std::fill(image.vec_begin(), image.vec_end(), white(image));
   }
 
+  template<class P>
+  struct FillSpan {
+    P color;
+    FillSpan(P c) : color(c) {}
+    void operator()(P* p, size_t n) const {
+      std::fill(p, p + n, color);
+    }
+  };
+
+  template<class P>
+  void fill_white(ImageView<ImageData<P> >& image) {
+    FillSpan<P> fill_span(white(image));
+    for_each_row_span(image, fill_span);
+  }
+
   /*
     Fill an image with any color
   */
@@ -363,6 +581,12 @@ namespace Gamera {
       *destcolor = color;
   }
 
+  template <class P>
+  void fill(ImageView<ImageData<P> >& m, typename ImageView<ImageData<P> >::value_type color) {
+    FillSpan<P> fill_span(color);
+    for_each_row_span(m, fill_span);
+  }
+
   /*
     Pad an image with the default value
   */
@@ -526,6 +750,20 @@ namespace Gamera {
       acc.set(invert(acc(in)), in);
   }
 
+  template<class P>
+  struct InvertSpan {
+    void operator()(P* p, size_t n) const {
+      for (size_t i = 0; i < n; ++i)
+        p[i] = invert(p[i]);
+    }
+  };
+
+  template<class P>
+  void invert(ImageView<ImageData<P> >& image) {
+    InvertSpan<P> invert_span;
+    for_each_row_span(image, invert_span);
+  }
+
 
   template<class T>
   Image *clip_image(T& m, const Rect* rect) {
@@ -717,20 +955,396 @@ namespace Gamera {
   }
 
 
-  template<class T>
-  double mse(T& a, T& b) {
-    if (a.size() != b.size())
+  /*
+    The comparison of two images of the same size (compare_images),
+    computed without a difference image: the sum of the squared
+    differences of the pixel values (over the channels of RGB pixels),
+    the number of pixels that differ, and the bounding box of those
+    pixels.  ONEBIT pixels differ when one is black and the other is
+    white.
+
+    The rows of dense images are compared as plain arrays, which the
+    compiler vectorizes, and those of PACKED images a word at a time.
+    The squared differences of integer pixels are summed exactly in 64
+    bits, and the sums of the rows are added up in row order, so that
+    the result does not depend on the number of threads.
+  */
+  template<class P>
+  struct compare_traits {
+    typedef double sum_type;
+    enum { channels = 1 };
+    static double peak() { return 1.0; }
+    static sum_type square(P a, P b) {
+      double d = double(a) - double(b);
+      return d * d;
+    }
+    static bool differ(P a, P b) { return a != b; }
+  };
+
+  template<>
+  struct compare_traits<OneBitPixel> {
+    typedef unsigned long long sum_type;
+    enum { channels = 1 };
+    static double peak() { return 1.0; }
+    static sum_type square(OneBitPixel a, OneBitPixel b) { return differ(a, b); }
+    static bool differ(OneBitPixel a, OneBitPixel b) { return is_black(a) != is_black(b); }
+  };
+
+  template<>
+  struct compare_traits<GreyScalePixel> {
+    typedef unsigned long long sum_type;
+    enum { channels = 1 };
+    static double peak() { return 255.0; }
+    static sum_type square(GreyScalePixel a, GreyScalePixel b) {
+      int d = int(a) - int(b);
+      return sum_type(d * d);
+    }
+    static bool differ(GreyScalePixel a, GreyScalePixel b) { return a != b; }
+  };
+
+  template<>
+  struct compare_traits<Grey16Pixel> {
+#ifdef GAMERA_GREY16_NATIVE
+    typedef unsigned long long sum_type;
+    static sum_type square(Grey16Pixel a, Grey16Pixel b) {
+      long long d = (long long)(unsigned int)a - (long long)(unsigned int)b;
+      return sum_type(d * d);
+    }
+#else
+    // the squares of the differences of 32 bit pixels may not fit
+    // into 64 bits
+    typedef double sum_type;
+    static sum_type square(Grey16Pixel a, Grey16Pixel b) {
+      double d = double(a) - double(b);
+      return d * d;
+    }
+#endif
+    enum { channels = 1 };
+    static double peak() { return 65535.0; }
+    static bool differ(Grey16Pixel a, Grey16Pixel b) {
+      return (unsigned int)a != (unsigned int)b;
+    }
+  };
+
+  template<>
+  struct compare_traits<RGBPixel> {
+    typedef unsigned long long sum_type;
+    enum { channels = 3 };
+    static double peak() { return 255.0; }
+    static sum_type square(const RGBPixel& a, const RGBPixel& b) {
+      int r = int(a.red()) - int(b.red());
+      int g = int(a.green()) - int(b.green());
+      int l = int(a.blue()) - int(b.blue());
+      return sum_type(r * r + g * g + l * l);
+    }
+    static bool differ(const RGBPixel& a, const RGBPixel& b) { return a != b; }
+  };
+
+  struct ImageComparison {
+    // the sum of the squared differences
+    double sse;
+    size_t npixels, channels;
+    size_t differing;
+    // the bounding box of the differing pixels (ul_x > lr_x when none)
+    size_t ul_x, ul_y, lr_x, lr_y;
+    double peak;
+
+    double mse() const {
+      if (npixels == 0)
+        return 0.0;
+      return sse / (double(npixels) * channels);
+    }
+
+    double psnr() const {
+      double m = mse();
+      if (m == 0.0)
+        return std::numeric_limits<double>::infinity();
+      return 10.0 * log10(peak * peak / m);
+    }
+  };
+
+  namespace CompareDetail {
+    struct Row {
+      double sse;
+      size_t differing;
+      // the first and last column that differ
+      size_t first, last;
+    };
+
+    template<class P, class IteratorA, class IteratorB>
+    void compare_span(IteratorA a, IteratorB b, size_t n, Row& row) {
+      typedef compare_traits<P> traits;
+      typename traits::sum_type sse = 0;
+      size_t differing = 0;
+      IteratorA i = a;
+      IteratorB j = b;
+      for (size_t x = 0; x < n; ++x, ++i, ++j) {
+        P p = *i, q = *j;
+        sse += traits::square(p, q);
+        differing += traits::differ(p, q);
+      }
+      row.sse = double(sse);
+      row.differing = differing;
+      row.first = row.last = 0;
+      if (differing == 0)
+        return;
+      // only the rows that differ are scanned again for the box
+      bool found = false;
+      i = a;
+      j = b;
+      for (size_t x = 0; x < n; ++x, ++i, ++j) {
+        if (traits::differ(*i, *j)) {
+          if (!found)
+            row.first = x;
+          found = true;
+          row.last = x;
+        }
+      }
+    }
+
+    // the rows of any two views, compared through their iterators
+    template<class T, class U>
+    struct Rows {
+      typedef typename T::value_type value_type;
+      enum { parallel = false };
+      const T& a;
+      const U& b;
+      Rows(const T& a_, const U& b_) : a(a_), b(b_) {}
+      void operator()(size_t y, Row& row) const {
+        compare_span<value_type>((a.row_begin() + y).begin(),
+                                 (b.row_begin() + y).begin(), a.ncols(), row);
+      }
+    };
+
+    template<class P>
+    struct Rows<ImageView<ImageData<P> >, ImageView<ImageData<P> > > {
+      typedef ImageView<ImageData<P> > view_type;
+      enum { parallel = true };
+      const view_type& a;
+      const view_type& b;
+      Rows(const view_type& a_, const view_type& b_) : a(a_), b(b_) {}
+      void operator()(size_t y, Row& row) const {
+        compare_span<P>((const P*)a[y], (const P*)b[y], a.ncols(), row);
+      }
+    };
+
+    template<>
+    struct Rows<OneBitPackedImageView, OneBitPackedImageView> {
+      enum { parallel = true };
+      const OneBitPackedImageView& a;
+      const OneBitPackedImageView& b;
+      Rows(const OneBitPackedImageView& a_, const OneBitPackedImageView& b_)
+        : a(a_), b(b_) {}
+      void operator()(size_t y, Row& row) const {
+        enum { STACK_WORDS = 128 };
+        size_t nwords = packed_row_words(a);
+        packed_word stack_a[STACK_WORDS], stack_b[STACK_WORDS];
+        PackedRow heap_a, heap_b;
+        packed_word *row_a = stack_a, *row_b = stack_b;
+        if (nwords > STACK_WORDS) {
+          heap_a.resize(nwords);
+          heap_b.resize(nwords);
+          row_a = &heap_a[0];
+          row_b = &heap_b[0];
+        }
+        get_packed_row(a, y, row_a);
+        get_packed_row(b, y, row_b);
+        row.differing = row.first = row.last = 0;
+        for (size_t i = 0; i < nwords; ++i) {
+          packed_word w = row_a[i] ^ row_b[i];
+          if (w == 0)
+            continue;
+          size_t x = i * PackedDataDetail::WORD_BITS;
+          if (row.differing == 0)
+            row.first = x + packed_lowest_bit(w);
+          row.last = x + packed_highest_bit(w);
+          row.differing += packed_popcount(w);
+        }
+        row.sse = double(row.differing);
+      }
+    };
+  }
+
+  /*
+    Compares the rows of a and b on threads threads (0 for all
+    processors when OpenMP is available).  Only dense and PACKED
+    images are split, and only those with at least 65536 pixels per
+    thread.  Does not use the Python API.
+  */
+  template<class T, class U>
+  ImageComparison compare_image_rows(const T& a, const U& b, int threads) {
+    typedef typename T::value_type value_type;
+    typedef CompareDetail::Rows<T, U> rows_type;
+    if (a.nrows() != b.nrows() || a.ncols() != b.ncols())
       throw std::runtime_error("Both images must be the same size.");
-    typename T::vec_iterator it_a, it_b;
-    double error = 0;
-    for (it_a = a.vec_begin(), it_b = b.vec_begin();
-         it_a != a.vec_end(); ++it_a, ++it_b) {
-      double rdiff = (double)it_a->red() - it_b->red();
-      double bdiff = (double)it_a->blue() - it_b->blue();
-      double gdiff = (double)it_a->green() - it_b->green();
-      error += rdiff*rdiff + bdiff*bdiff + gdiff*gdiff;
+    long nrows = (long)a.nrows();
+    std::vector<CompareDetail::Row> rows(nrows);
+    rows_type compare(a, b);
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+    }
+    long npixels = nrows * (long)a.ncols();
+    threads = rows_type::parallel ?
+      (int)std::max(1L, std::min((long)threads, npixels / 65536)) : 1;
+    long y;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(threads) if (threads > 1)
+#endif
+    for (y = 0; y < nrows; ++y)
+      compare(size_t(y), rows[y]);
+
+    ImageComparison result;
+    result.sse = 0.0;
+    result.npixels = size_t(npixels);
+    result.channels = compare_traits<value_type>::channels;
+    result.differing = 0;
+    result.ul_x = result.ul_y = std::numeric_limits<size_t>::max();
+    result.lr_x = result.lr_y = 0;
+    result.peak = compare_traits<value_type>::peak();
+    for (y = 0; y < nrows; ++y) {
+      const CompareDetail::Row& row = rows[y];
+      result.sse += row.sse;
+      if (row.differing == 0)
+        continue;
+      result.differing += row.differing;
+      result.ul_x = std::min(result.ul_x, row.first);
+      result.lr_x = std::max(result.lr_x, row.last);
+      result.ul_y = std::min(result.ul_y, size_t(y));
+      result.lr_y = size_t(y);
+    }
+    return result;
+  }
+
+  /*
+    The comparison as a dictionary, with the bounding box in the
+    coordinates of the image at origin.
+  */
+  inline PyObject* image_comparison_to_python(const ImageComparison& c,
+                                              const Point& origin) {
+    PyObject* bbox;
+    if (c.differing == 0) {
+      Py_INCREF(Py_None);
+      bbox = Py_None;
+    } else {
+      bbox = create_RectObject(Rect(Point(c.ul_x + origin.x(), c.ul_y + origin.y()),
+                                    Point(c.lr_x + origin.x(), c.lr_y + origin.y())));
+      if (bbox == 0)
+        return 0;
+    }
+    return Py_BuildValue(CHAR_PTR_CAST "{sdsdsnsN}",
+                         "mse", c.mse(), "psnr", c.psnr(),
+                         "differing", (Py_ssize_t)c.differing, "bbox", bbox);
+  }
+
+  template<class T, class U>
+  PyObject* compare_images(const T& a, const U& b, int threads) {
+    ImageComparison c;
+    ThreadException error;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+      c = compare_image_rows(a, b, threads);
+    } catch (...) {
+      error.keep();
+    }
+    Py_END_ALLOW_THREADS
+    error.rethrow();
+    return image_comparison_to_python(c, a.origin());
+  }
+
+  template<class T, class U>
+  double mse(const T& a, const U& b) {
+    return compare_image_rows(a, b, 1).mse();
+  }
+
+  namespace CompareDetail {
+    template<class T>
+    ImageComparison compare_as(Image* a, Image* b) {
+      return compare_image_rows(*((T*)a), *((T*)b), 1);
+    }
+
+    inline ImageComparison compare_pair(Image* a, Image* b, int combination) {
+      switch (combination) {
+      case ONEBITIMAGEVIEW:
+        return compare_as<OneBitImageView>(a, b);
+      case GREYSCALEIMAGEVIEW:
+        return compare_as<GreyScaleImageView>(a, b);
+      case GREY16IMAGEVIEW:
+        return compare_as<Grey16ImageView>(a, b);
+      case RGBIMAGEVIEW:
+        return compare_as<RGBImageView>(a, b);
+      case FLOATIMAGEVIEW:
+        return compare_as<FloatImageView>(a, b);
+      case ONEBITRLEIMAGEVIEW:
+        return compare_as<OneBitRleImageView>(a, b);
+      case CC:
+        return compare_as<Cc>(a, b);
+      case RLECC:
+        return compare_as<RleCc>(a, b);
+      case MLCC:
+        return compare_as<MlCc>(a, b);
+      case ONEBITPACKEDIMAGEVIEW:
+        return compare_as<OneBitPackedImageView>(a, b);
+      default:
+        throw std::runtime_error("COMPLEX images can not be compared.");
+      }
     }
-    return (error / (a.nrows() * a.ncols())) / 3.0;
+  }
+
+  /*
+    compare_images on the pairs images[i], others[i], which are spread
+    over threads threads (0 for all processors) without holding the
+    Python interpreter lock.
+  */
+  inline PyObject* compare_image_pairs(ImageVector& images, ImageVector& others,
+                                       int threads) {
+    if (images.size() != others.size())
+      throw std::runtime_error("Both lists must have the same length.");
+    long n = (long)images.size();
+    for (long i = 0; i < n; ++i) {
+      if (images[i].second != others[i].second)
+        throw std::runtime_error
+          ("The images of a pair must have the same pixel type and storage.");
+    }
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+    }
+    std::vector<ImageComparison> results(n);
+    ThreadException error;
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+    for (long i = 0; i < n; ++i) {
+      try {
+        results[i] = CompareDetail::compare_pair(images[i].first, others[i].first,
+                                                 images[i].second);
+      } catch (...) {
+        error.keep();
+      }
+    }
+    Py_END_ALLOW_THREADS
+    error.rethrow();
+    PyObject* list = PyList_New(n);
+    if (list == 0)
+      return 0;
+    for (long i = 0; i < n; ++i) {
+      PyObject* item = image_comparison_to_python(results[i],
+                                                  images[i].first->origin());
+      if (item == 0) {
+        Py_DECREF(list);
+        return 0;
+      }
+      PyList_SET_ITEM(list, i, item);
+    }
+    return list;
   }
 
   template<class T>
@@ -742,56 +1356,117 @@ namespace Gamera {
   }
 
   /*
-   * compute Cc's from an already labeled image
-   * Christoph Dalitz and Hasan Yildiz
-   */
-  template<class T>
-  ImageList* ccs_from_labeled_image(T &src) {
-    typedef typename T::value_type value_type;
-    value_type value;
+    The bounding boxes of the labels of a labeled image, indexed by the
+    label: box[4 * label] ... box[4 * label + 3] is ul_x, ul_y, lr_x,
+    lr_y, and labels that do not occur have ul_x > lr_x.  The boxes
+    are updated once per run of equal labels rather than once per
+    pixel.
+  */
+  namespace LabelBoxesDetail {
+    inline void init(unsigned int* box, size_t labels) {
+      for (size_t i = 0; i < labels; ++i) {
+        box[4 * i] = box[4 * i + 1] = std::numeric_limits<unsigned int>::max();
+        box[4 * i + 2] = box[4 * i + 3] = 0;
+      }
+    }
 
-    ImageList* return_ccs = new ImageList();
+    inline void add(unsigned int* box, size_t label, unsigned int x0,
+                    unsigned int x1, unsigned int y) {
+      unsigned int* b = box + 4 * label;
+      if (x0 < b[0]) b[0] = x0;
+      if (y < b[1]) b[1] = y;
+      if (x1 > b[2]) b[2] = x1;
+      if (y > b[3]) b[3] = y;
+    }
 
-    std::map<unsigned int, Rect*> pixel;
-    std::map<unsigned int, Rect*>::iterator iter;
+    template<class Iterator>
+    void add_row(unsigned int* box, Iterator begin, Iterator end, unsigned int y) {
+      unsigned int x = 0, x0 = 0;
+      size_t label = 0;
+      for (Iterator i = begin; i != end; ++i, ++x) {
+        size_t value = size_t(*i);
+        if (value != label) {
+          if (label != 0)
+            add(box, label, x0, x - 1, y);
+          label = value;
+          x0 = x;
+        }
+      }
+      if (label != 0)
+        add(box, label, x0, x - 1, y);
+    }
+  }
 
-    for (size_t y=0; y < src.nrows(); ++y) {
-      for (size_t x=0; x < src.ncols(); ++x) {
-        if (!is_white(src.get(Point(x,y)))) {
-          value = src.get(Point(x,y));
+  template<class T>
+  void label_boxes(const T& image, std::vector<unsigned int>& box) {
+    LabelBoxesDetail::init(&box[0], box.size() / 4);
+    unsigned int y = 0;
+    for (typename T::const_row_iterator r = image.row_begin(); r != image.row_end(); ++r, ++y)
+      LabelBoxesDetail::add_row(&box[0], r.begin(), r.end(), y);
+  }
 
-          // when new label: create Rect for new Cc
-          if (pixel.find(value) == pixel.end()) {
-            pixel[value] = new Rect(Point(x, y), Point(x, y));
-          }
-          // update Rect bounding box when known label
-          else {
-            iter = pixel.find(value);
-
-            if (y < (*iter).second->ul_y())
-              (*iter).second->ul_y(y);
-            if (x < (*iter).second->ul_x())
-              (*iter).second->ul_x(x);
-            if (y > (*iter).second->lr_y())
-              (*iter).second->lr_y(y);
-            if (x > (*iter).second->lr_x())
-              (*iter).second->lr_x(x);
-          }
-        }
+  /*
+    Dense images are scanned along the row pointers, and images of more
+    than 4 megapixels in bands of rows on several threads, whose boxes
+    are merged at the end.
+  */
+  inline void label_boxes(const OneBitImageView& image, std::vector<unsigned int>& box) {
+    size_t labels = box.size() / 4;
+    size_t ncols = image.ncols();
+    int nrows = (int)image.nrows();
+    int threads = 1;
+#ifdef _OPENMP
+    if (double(nrows) * ncols >= double(1 << 22))
+      threads = std::max(1, std::min(omp_get_max_threads(), nrows));
+#endif
+    int band = (nrows + threads - 1) / threads;
+    std::vector<unsigned int> sub(box.size() * (threads - 1));
+    int t;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(threads)
+#endif
+    for (t = 0; t < threads; ++t) {
+      unsigned int* b = (t == 0) ? &box[0] : &sub[box.size() * (t - 1)];
+      LabelBoxesDetail::init(b, labels);
+      int y_end = std::min(nrows, (t + 1) * band);
+      for (int y = t * band; y < y_end; ++y) {
+        const OneBitPixel* p = image[y];
+        LabelBoxesDetail::add_row(b, p, p + ncols, (unsigned int)y);
       }
     }
+    for (size_t i = 0; i < sub.size(); i += 4) {
+      unsigned int* b = &box[i % box.size()];
+      b[0] = std::min(b[0], sub[i]);
+      b[1] = std::min(b[1], sub[i + 1]);
+      b[2] = std::max(b[2], sub[i + 2]);
+      b[3] = std::max(b[3], sub[i + 3]);
+    }
+  }
 
+  /*
+   * compute Cc's from an already labeled image
+   * Christoph Dalitz and Hasan Yildiz
+   */
+  template<class T>
+  ImageList* ccs_from_labeled_image(T &src) {
+    // labels are bounded by the pixel type, so the bounding boxes are
+    // indexed directly by the label
+    size_t labels = size_t(std::numeric_limits<typename T::value_type>::max()) + 1;
+    std::vector<unsigned int> box(4 * labels);
+    label_boxes(src, box);
+
+    ImageList* return_ccs = new ImageList();
     // create Cc's for all labels
-    for (iter = pixel.begin(); iter != pixel.end(); iter++) {
+    for (size_t label = 1; label < labels; ++label) {
+      const unsigned int* b = &box[4 * label];
+      if (b[0] > b[2])
+        continue;
       return_ccs->push_back(new ConnectedComponent<typename T::data_type>(
                     *src.data(),    // data
-                    (*iter).first,  // label
-                    Point((*iter).second->ul_x(), (*iter).second->ul_y()), // upper left
-                    Point((*iter).second->lr_x(), (*iter).second->lr_y())  // lower right
+                    typename T::value_type(label),  // label
+                    Point(b[0] + src.ul_x(), b[1] + src.ul_y()), // upper left
+                    Point(b[2] + src.ul_x(), b[3] + src.ul_y())  // lower right
                   ));
-
-      delete iter->second;
-      iter->second = 0;
     }
 
     return return_ccs;
@@ -933,6 +1608,87 @@ namespace Gamera {
                          create_PointObject(Point(max_x,max_y)), max_val);
   }
 
+  /*
+    to_shared_memory
+
+    A DENSE copy of the image whose pixels are kept in the new POSIX
+    shared memory object name (see the shared memory constructor of
+    ImageData), so that other processes can attach them with
+    attach_shared_memory instead of copying them.
+  */
+  template<class T>
+  typename ImageFactory<T>::dense_view_type*
+  to_shared_memory(const T& src, const char* name) {
+    typedef typename ImageFactory<T>::dense_data_type data_type;
+    typedef typename ImageFactory<T>::dense_view_type view_type;
+    data_type* dest_data = new data_type(src.dim(), src.origin(), name,
+                                         SHARED_MEMORY_CREATE);
+    view_type* dest = new view_type(*dest_data);
+    try {
+      image_copy_fill(src, *dest);
+    } catch (std::exception&) {
+      delete dest;
+      delete dest_data;
+      throw;
+    }
+    return dest;
+  }
+
+  /*
+    The name, size and offset of the shared memory pixels of the image
+    (not only of the view) as a tuple (name, ncols, nrows, ul_x, ul_y),
+    or None when the pixels are not in shared memory.
+  */
+  template<class T>
+  PyObject* _shared_memory_data(const T& image) {
+    const ImageDataBase* data = image.data();
+    if (data->shared_memory_name() == 0) {
+      Py_INCREF(Py_None);
+      return Py_None;
+    }
+    return Py_BuildValue(CHAR_PTR_CAST "(siiii)", data->shared_memory_name(),
+                         int(data->ncols()), int(data->nrows()),
+                         int(data->page_offset_x()),
+                         int(data->page_offset_y()));
+  }
+
+  namespace SharedMemoryDetail {
+    template<class P>
+    Image* attach(const char* name, const Dim& dim, const Point& offset) {
+      ImageData<P>* data = new ImageData<P>(dim, offset, name,
+                                            SHARED_MEMORY_ATTACH);
+      return new ImageView<ImageData<P> >(*data);
+    }
+  }
 
+  /*
+    attach_shared_memory
+
+    An image on the pixels in the POSIX shared memory object name,
+    which another process created with to_shared_memory.
+  */
+  Image* attach_shared_memory(const char* name, int pixel_type, int ncols,
+                              int nrows, int ul_x, int ul_y) {
+    if (ncols < 1 || nrows < 1 || ul_x < 0 || ul_y < 0)
+      throw std::range_error("attach_shared_memory: ncols and nrows must be >= 1 and the offset >= 0.");
+    Dim dim(ncols, nrows);
+    Point offset(ul_x, ul_y);
+    switch (pixel_type) {
+    case ONEBIT:
+      return SharedMemoryDetail::attach<OneBitPixel>(name, dim, offset);
+    case GREYSCALE:
+      return SharedMemoryDetail::attach<GreyScalePixel>(name, dim, offset);
+    case GREY16:
+      return SharedMemoryDetail::attach<Grey16Pixel>(name, dim, offset);
+    case RGB:
+      return SharedMemoryDetail::attach<RGBPixel>(name, dim, offset);
+    case FLOAT:
+      return SharedMemoryDetail::attach<FloatPixel>(name, dim, offset);
+    case COMPLEX:
+      return SharedMemoryDetail::attach<ComplexPixel>(name, dim, offset);
+    default:
+      throw std::runtime_error("attach_shared_memory: unknown pixel type");
+    }
+  }
 }
 #endif
@@ -21,6 +21,7 @@
 #define kwm10092002_logical
 
 #include "gamera.hpp"
+#include "packed_utilities.hpp"
 #include <functional>
 #include <exception>
 
@@ -28,7 +29,8 @@ namespace Gamera {
 
 template<class T, class U, class FUNCTOR>
 inline typename ImageFactory<T>::view_type* 
-logical_combine(T& a, const U& b, const FUNCTOR& functor, bool in_place) {
+logical_combine(T& a, const U& b, const FUNCTOR& functor, bool in_place,
+                int threads=0) {
   if (a.nrows() != b.nrows() || a.ncols() != b.ncols())
     throw std::runtime_error("Images must be the same size.");
   
@@ -79,32 +81,158 @@ logical_combine(T& a, const U& b, const FUNCTOR& functor, bool in_place) {
   }
 }
 
+// We make our own, since logical_xor is not in STL
+template <class _Tp>
+struct logical_xor : public std::binary_function<_Tp,_Tp,bool>
+{
+  bool operator()(const _Tp& __x, const _Tp& __y) const { return __x ^ __y; }
+};
+
+/*
+  The word-wise equivalents of the functors above, used when both
+  images are PACKED.
+*/
+inline packed_word logical_word(const std::logical_and<bool>&, packed_word a, packed_word b) {
+  return a & b;
+}
+
+inline packed_word logical_word(const std::logical_or<bool>&, packed_word a, packed_word b) {
+  return a | b;
+}
+
+inline packed_word logical_word(const logical_xor<bool>&, packed_word a, packed_word b) {
+  return a ^ b;
+}
+
+/*
+  When both images are PACKED, whole words (WORD_BITS pixels) are
+  combined at once instead of going through the pixel accessors.
+  Blocks of rows are combined on several threads for large images.
+*/
+template<class FUNCTOR>
+struct PackedLogicalRows {
+  const OneBitPackedImageView& a;
+  const OneBitPackedImageView& b;
+  OneBitPackedImageView& dest;
+  const FUNCTOR& functor;
+  PackedLogicalRows(const OneBitPackedImageView& a_, const OneBitPackedImageView& b_,
+                    OneBitPackedImageView& dest_, const FUNCTOR& f)
+    : a(a_), b(b_), dest(dest_), functor(f) {}
+  void operator()(size_t y, size_t, size_t) const {
+    // rows of usual page widths fit the buffers on the stack
+    enum { STACK_WORDS = 128 };
+    size_t nwords = packed_row_words(a);
+    packed_word stack_a[STACK_WORDS], stack_b[STACK_WORDS];
+    PackedRow heap_a, heap_b;
+    packed_word *row_a = stack_a, *row_b = stack_b;
+    if (nwords > STACK_WORDS) {
+      heap_a.resize(nwords);
+      heap_b.resize(nwords);
+      row_a = &heap_a[0];
+      row_b = &heap_b[0];
+    }
+    get_packed_row(a, y, row_a);
+    get_packed_row(b, y, row_b);
+    for (size_t i = 0; i < nwords; ++i)
+      row_a[i] = logical_word(functor, row_a[i], row_b[i]);
+    put_packed_row(dest, y, row_a);
+  }
+};
+
+template<class FUNCTOR>
+inline OneBitPackedImageView*
+logical_combine(OneBitPackedImageView& a, const OneBitPackedImageView& b,
+		const FUNCTOR& functor, bool in_place, int threads=0) {
+  if (a.nrows() != b.nrows() || a.ncols() != b.ncols())
+    throw std::runtime_error("Images must be the same size.");
+
+  OneBitPackedImageView* dest = &a;
+  OneBitPackedImageData* dest_data = 0;
+  if (!in_place) {
+    dest_data = new OneBitPackedImageData(a.size(), a.origin());
+    dest = new OneBitPackedImageView(*dest_data);
+  }
+  for_each_span_block(a.nrows(), a.ncols(), false, threads,
+                      PackedLogicalRows<FUNCTOR>(a, b, *dest, functor));
+  if (in_place)
+    // Returning NULL is converted to None by the wrapper mechanism
+    return NULL;
+  return dest;
+}
+
+template<class FUNCTOR>
+struct LogicalSpan {
+  const FUNCTOR& functor;
+  LogicalSpan(const FUNCTOR& f) : functor(f) {}
+  void operator()(const OneBitPixel* a, const OneBitPixel* b, OneBitPixel* dest,
+                  size_t n) const {
+    for (size_t i = 0; i < n; ++i)
+      dest[i] = functor(is_black(a[i]), is_black(b[i])) ?
+        pixel_traits<OneBitPixel>::black() : pixel_traits<OneBitPixel>::white();
+  }
+  void operator()(OneBitPixel* a, const OneBitPixel* b, size_t n) const {
+    (*this)(a, b, a, n);
+  }
+};
+
+template<class FUNCTOR>
+struct LogicalSpans {
+  const OneBitImageView& a;
+  const OneBitImageView& b;
+  OneBitImageView& dest;
+  LogicalSpan<FUNCTOR> span;
+  LogicalSpans(const OneBitImageView& a_, const OneBitImageView& b_,
+               OneBitImageView& dest_, const FUNCTOR& f)
+    : a(a_), b(b_), dest(dest_), span(f) {}
+  void operator()(size_t y, size_t x, size_t n) const {
+    span(a[y] + x, b[y] + x, dest[y] + x, n);
+  }
+};
+
+/*
+  Dense images are combined span by span (see for_each_span_block).
+*/
+template<class FUNCTOR>
+inline OneBitImageView*
+logical_combine(OneBitImageView& a, const OneBitImageView& b,
+		const FUNCTOR& functor, bool in_place, int threads=0) {
+  if (a.nrows() != b.nrows() || a.ncols() != b.ncols())
+    throw std::runtime_error("Images must be the same size.");
+
+  OneBitImageView* dest = &a;
+  if (!in_place) {
+    OneBitImageData* dest_data = new OneBitImageData(a.size(), a.origin());
+    dest = new OneBitImageView(*dest_data);
+  }
+  bool contiguous = a.ncols() == a.data()->stride() &&
+    b.ncols() == b.data()->stride() && dest->ncols() == dest->data()->stride();
+  for_each_span_block(a.nrows(), a.ncols(), contiguous, threads,
+                      LogicalSpans<FUNCTOR>(a, b, *dest, functor));
+  if (in_place)
+    // Returning NULL is converted to None by the wrapper mechanism
+    return NULL;
+  return dest;
+}
+
 template<class T, class U>
 typename ImageFactory<T>::view_type* 
-and_image(T& a, const U& b, bool in_place=true) {
+and_image(T& a, const U& b, bool in_place=true, int threads=0) {
   typedef typename T::value_type value_type;
-  return logical_combine(a, b, std::logical_and<bool>(), in_place);
+  return logical_combine(a, b, std::logical_and<bool>(), in_place, threads);
 }
 
 template<class T, class U>
 typename ImageFactory<T>::view_type* 
-or_image(T& a, const U& b, bool in_place=true) {
+or_image(T& a, const U& b, bool in_place=true, int threads=0) {
   typedef typename T::value_type value_type;
-  return logical_combine(a, b, std::logical_or<bool>(), in_place);
-};
-
-// We make our own, since logical_xor is not in STL
-template <class _Tp>
-struct logical_xor : public std::binary_function<_Tp,_Tp,bool>
-{
-  bool operator()(const _Tp& __x, const _Tp& __y) const { return __x ^ __y; }
+  return logical_combine(a, b, std::logical_or<bool>(), in_place, threads);
 };
 
 template<class T, class U>
 typename ImageFactory<T>::view_type* 
-xor_image(T& a, const U& b, bool in_place=true) {
+xor_image(T& a, const U& b, bool in_place=true, int threads=0) {
   typedef typename T::value_type value_type;
-  return logical_combine(a, b, logical_xor<bool>(), in_place);
+  return logical_combine(a, b, logical_xor<bool>(), in_place, threads);
 }
 
 }
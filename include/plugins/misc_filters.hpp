@@ -27,7 +27,15 @@
 #include "neighbor.hpp"
 #include "vigra/gaborfilter.hxx"
 #include "convolution.hpp"
+#include "fourier.hpp"
 #include <math.h>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <complex>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
@@ -37,7 +45,7 @@ namespace Gamera {
   // min/max filter
   //---------------------------
   template<class T>
-  typename ImageFactory<T>::view_type* min_max_filter(const T &src, unsigned int k_h=3, int filter=0, unsigned int k_v=0){
+  typename ImageFactory<T>::view_type* min_max_filter(const T &src, unsigned int k_h=3, int filter=0, unsigned int k_v=0, bool in_place=false){
 
     typedef typename ImageFactory<T>::data_type data_type;
     typedef typename ImageFactory<T>::view_type view_type;
@@ -57,12 +65,17 @@ namespace Gamera {
     if(k_v==0)
       k_v=k_h;
     if (src.nrows() < k_v || src.ncols() < k_h)
-      return simple_image_copy(src);
-
+      return in_place ? in_place_view(src) : simple_image_copy(src);
 
-    data_type *res_data = new data_type(src.size(), src.origin());
-    view_type *res= new view_type(*res_data);
-    image_copy_fill(src, *res);
+    view_type *res;
+    if (in_place) {
+      // every row (and then column) is read before it is written
+      res = in_place_view(src);
+    } else {
+      data_type *res_data = new data_type(src.size(), src.origin());
+      res = new view_type(*res_data);
+      image_copy_fill(src, *res);
+    }
 
     unsigned int src_nrows = src.nrows();
     unsigned int src_ncols = src.ncols();
@@ -177,6 +190,8 @@ namespace Gamera {
     int _border_treatment; // 0=padwhite, 1=reflect
     typename T::value_type _white_val;
     unsigned int _k;
+    const std::vector<typename T::value_type>* _kept;
+    int _row;
 
   public:
     GetPixel4Border<T>(const T &src, int border_treatment, unsigned int k):_src(src){
@@ -185,6 +200,15 @@ namespace Gamera {
 	  _border_treatment=border_treatment;
 	  _white_val = white(src);
 	  _k = k;
+	  _kept = 0;
+    }
+
+    // For filtering in place: the rows above row have been overwritten,
+    // and their pixels are read from kept, which holds the last (k-1)/2
+    // of them (row i in row i % ((k-1)/2)).
+    void keep_rows(const std::vector<typename T::value_type>* kept, int row) {
+      _kept = kept;
+      _row = row;
     }
 
     typename T::value_type operator() (int column, int row) {
@@ -204,6 +228,8 @@ namespace Gamera {
           return _white_val;
         }
       }
+      if (_kept != 0 && row < _row)
+        return (*_kept)[(row % ((_k - 1) / 2)) * _src_ncols + column];
       return _src.get(Point(column, row));
     }
   };
@@ -212,21 +238,29 @@ namespace Gamera {
   // mean filter (David Kolanus)
   //----------------------------------------------
   template<class T>
-  typename ImageFactory<T>::view_type* mean(const T &src, unsigned int k=3, size_t border_treatment=1) {
+  typename ImageFactory<T>::view_type* mean(const T &src, unsigned int k=3, size_t border_treatment=1, bool in_place=false) {
     typedef typename ImageFactory<T>::data_type data_type;
     typedef typename ImageFactory<T>::view_type view_type;
     typedef typename T::value_type T_value_type;
 
     if (src.nrows() < k || src.ncols() < k)
-      return simple_image_copy(src);
-
-
-    data_type *res_data = new data_type(src.size(), src.origin());
-    view_type *res= new view_type(*res_data);
+      return in_place ? in_place_view(src) : simple_image_copy(src);
 
     int src_ncols = src.ncols();
     int src_nrows = src.nrows();
 
+    // in place, each row is computed into line, and the original pixels
+    // of the rows above that are still needed are kept in a ring of rows
+    view_type *res;
+    std::vector<T_value_type> line(src_ncols), kept;
+    if (in_place) {
+      res = in_place_view(src);
+      kept.resize(((k-1)/2) * src_ncols);
+    } else {
+      data_type *res_data = new data_type(src.size(), src.origin());
+      res = new view_type(*res_data);
+    }
+
     double window_sum=0.0;
     double kk = 1.0/double(k*k);
 
@@ -243,6 +277,8 @@ namespace Gamera {
 
 	for(row=0; row<src_nrows; row++){
       column=0;
+      if (in_place && r > 0)
+        gp.keep_rows(&kept, row);
 
       //init sum
       window_sum=0.0;
@@ -253,7 +289,7 @@ namespace Gamera {
       }
 
       //calc mean
-      res->set( Point(column,row), T_value_type(window_sum*kk + 0.5));
+      line[column] = T_value_type(window_sum*kk + 0.5);
 
       //go right column....
       for(column=1; column<src_ncols; column++) {
@@ -266,8 +302,14 @@ namespace Gamera {
         }
 
         //calc mean
-        res->set( Point(column,row), T_value_type(window_sum*kk + 0.5));
+        line[column] = T_value_type(window_sum*kk + 0.5);
       }
+
+      if (in_place && r > 0)
+        for (column=0; column<src_ncols; column++)
+          kept[(row % r) * src_ncols + column] = src.get(Point(column,row));
+      for (column=0; column<src_ncols; column++)
+        res->set(Point(column,row), line[column]);
 	}
     return res;
   }
@@ -275,151 +317,218 @@ namespace Gamera {
   //----------------------------------------------------------------
   // rank filter (Christoph Dalitz and David Kolanus)
   //----------------------------------------------------------------
-  template<class T>
-  class RankHist {
-  public:
-    unsigned int* hist;
-    unsigned int histsize;
-    RankHist<T>() {
-      unsigned int color;
-      histsize = (unsigned int)pow(2.0,8.0*sizeof(T));
-      hist = new unsigned int[histsize];
-      for(color=0; color<histsize; color++){
-        hist[color]=0;
+  namespace RankDetail {
+    inline int resolve_threads(int threads) {
+      if (threads <= 0) {
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#else
+        threads = 1;
+#endif
       }
-    };
-    ~RankHist<T>() { delete[] hist; };
-    inline unsigned int operator() (unsigned int r, unsigned int k2);
-  };
+      return threads;
+    }
 
-  template<>
-  RankHist<Grey16Pixel>::RankHist() {
-    unsigned int color;
-    histsize = 65536; // only 16bit
-    hist = new unsigned int[histsize];
-    for(color=0; color<histsize; color++){
-      hist[color]=0;
+    // which value in the window is selected for rank r (r = 1 being
+    // the darkest for all pixel types)
+    template<class V>
+    inline unsigned int rank_position(unsigned int r, unsigned int k2) {
+      return r;
     }
-  }
 
-  template<class T>
-  inline unsigned int RankHist<T>::operator() (unsigned int r, unsigned int k2) {
-	unsigned int collect = 0;
-    unsigned int color;
-	for(color=0; color<histsize; color++){
-      collect += hist[color];
-      if(collect>=r){
-        return color;
+    template<>
+    inline unsigned int rank_position<OneBitPixel>(unsigned int r, unsigned int k2) {
+      return k2 - r + 1;
+    }
+
+    /*
+      The image padded by r pixels on every side as by GetPixel4Border,
+      with each pixel replaced by the index of its value among the sorted
+      distinct values (levels), so that every pixel type gives as few
+      histogram bins as there are values in the image.
+    */
+    template<class T>
+    void padded_levels(const T& src, int r, size_t border_treatment,
+                       std::vector<typename T::value_type>& levels,
+                       std::vector<unsigned int>& padded) {
+      typedef typename T::value_type value_type;
+      int pcols = (int)src.ncols() + 2 * r;
+      int prows = (int)src.nrows() + 2 * r;
+      GetPixel4Border<T> gp(src, border_treatment, 2 * r + 1);
+      std::vector<value_type> values(pcols * prows);
+      for (int y = 0; y < prows; ++y)
+        for (int x = 0; x < pcols; ++x)
+          values[y * pcols + x] = gp(x - r, y - r);
+      padded.resize(values.size());
+      if (std::numeric_limits<value_type>::is_integer) {
+        value_type top = *std::max_element(values.begin(), values.end());
+        if (double(top) < double(1 << 24)) {
+          // count the values in a table rather than sorting them
+          std::vector<unsigned int> index(size_t(top) + 1, 0);
+          for (size_t i = 0; i < values.size(); ++i)
+            index[size_t(values[i])] = 1;
+          levels.clear();
+          for (size_t v = 0; v < index.size(); ++v)
+            if (index[v]) {
+              index[v] = (unsigned int)levels.size();
+              levels.push_back(value_type(v));
+            }
+          for (size_t i = 0; i < values.size(); ++i)
+            padded[i] = index[size_t(values[i])];
+          return;
+        }
       }
-	}
-	return color;
-  }
+      levels = values;
+      std::sort(levels.begin(), levels.end());
+      levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+      for (size_t i = 0; i < values.size(); ++i)
+        padded[i] = (unsigned int)(std::lower_bound(levels.begin(), levels.end(), values[i])
+                                   - levels.begin());
+    }
+
+    /*
+      The level at position target in the k x k windows of the padded
+      levels for the output pixels in columns [x0, x1) and rows [y0, y1),
+      by the constant time median filter of S. Perreault and P. Hebert
+      (IEEE Transactions on Image Processing 16, 2007): every column
+      keeps the histogram of its k pixels, which moves down one row with
+      two updates, and the window histogram moves right by adding one
+      column histogram and subtracting another.  The histograms have a
+      coarse bin for every nfine levels, and the fine bins of the window
+      are only brought up to date for the coarse bin that holds the
+      target.
+    */
+    inline void rank_tile(const std::vector<unsigned int>& padded, int pcols,
+                          unsigned int nlevels, unsigned int nfine, int k,
+                          unsigned int target, int x0, int x1, int y0, int y1,
+                          std::vector<unsigned int>& out, int ncols) {
+      unsigned int ncoarse = (nlevels + nfine - 1) / nfine;
+      int width = x1 - x0;
+      int hcols = width + k - 1;
+      std::vector<unsigned short> col_coarse(hcols * ncoarse, 0);
+      std::vector<unsigned short> col_fine(hcols * nlevels, 0);
+      std::vector<int> coarse(ncoarse), fine(ncoarse * nfine);
+      std::vector<int> valid_at(ncoarse);
+
+      for (int y = y0; y < y1 + k - 1; ++y) {
+        // the column histograms cover rows y - k + 1 to y
+        const unsigned int* add = &padded[y * pcols + x0];
+        for (int j = 0; j < hcols; ++j) {
+          ++col_coarse[j * ncoarse + add[j] / nfine];
+          ++col_fine[j * nlevels + add[j]];
+        }
+        if (y >= y0 + k) {
+          const unsigned int* remove = &padded[(y - k) * pcols + x0];
+          for (int j = 0; j < hcols; ++j) {
+            --col_coarse[j * ncoarse + remove[j] / nfine];
+            --col_fine[j * nlevels + remove[j]];
+          }
+        }
+        if (y < y0 + k - 1)
+          continue;
+
+        unsigned int* dest = &out[(y - k + 1) * ncols + x0];
+        std::fill(coarse.begin(), coarse.end(), 0);
+        for (int j = 0; j < k; ++j)
+          for (unsigned int c = 0; c < ncoarse; ++c)
+            coarse[c] += col_coarse[j * ncoarse + c];
+        std::fill(valid_at.begin(), valid_at.end(), -k);
+        for (int x = 0; x < width; ++x) {
+          if (x > 0) {
+            const unsigned short* in = &col_coarse[(x + k - 1) * ncoarse];
+            const unsigned short* gone = &col_coarse[(x - 1) * ncoarse];
+            for (unsigned int c = 0; c < ncoarse; ++c)
+              coarse[c] += int(in[c]) - int(gone[c]);
+          }
+          unsigned int below = 0, c = 0;
+          while (below + coarse[c] < target)
+            below += coarse[c++];
+
+          int* bins = &fine[c * nfine];
+          unsigned int first = c * nfine;
+          unsigned int nbins = std::min(nfine, nlevels - first);
+          if (x - valid_at[c] >= k) {
+            std::fill(bins, bins + nbins, 0);
+            for (int j = x; j < x + k; ++j) {
+              const unsigned short* h = &col_fine[j * nlevels + first];
+              for (unsigned int b = 0; b < nbins; ++b)
+                bins[b] += h[b];
+            }
+          } else {
+            for (int j = valid_at[c]; j < x; ++j) {
+              const unsigned short* in = &col_fine[(j + k) * nlevels + first];
+              const unsigned short* gone = &col_fine[j * nlevels + first];
+              for (unsigned int b = 0; b < nbins; ++b)
+                bins[b] += int(in[b]) - int(gone[b]);
+            }
+          }
+          valid_at[c] = x;
 
-  template<>
-  inline unsigned int RankHist<OneBitPixel>::operator() (unsigned int r, unsigned int k2) {
-	unsigned int collect = 0;
-    unsigned int color;
-	collect = 0;
-	for(color=0; color<histsize; color++){
-      collect += hist[color];
-      if(collect>=k2-r+1){
-        return color;
+          unsigned int b = 0;
+          while (below + bins[b] < target)
+            below += bins[b++];
+          dest[x] = first + b;
+        }
       }
-	}
-	return color;
+    }
   }
 
   template<class T>
-  typename ImageFactory<T>::view_type* rank (const T &src, unsigned int rank, unsigned int k=3, size_t border_treatment=1) {
+  typename ImageFactory<T>::view_type* rank (const T &src, unsigned int rank, unsigned int k=3, size_t border_treatment=1, int threads=0, bool in_place=false) {
     typedef typename ImageFactory<T>::data_type data_type;
     typedef typename ImageFactory<T>::view_type view_type;
     typedef typename T::value_type T_value_type;
 
     if (src.nrows() < k || src.ncols() < k)
-      return simple_image_copy(src);
-
-    data_type *res_data = new data_type(src.size(), src.origin());
-    view_type *res= new view_type(*res_data);
-    //image_copy_fill(src, *res);
-
-    int src_ncols = (int)src.ncols();
-    int src_nrows = (int)src.nrows();
-
-    //(col,row)
-    int column=0;
-    int row;
-    unsigned int color;
-	int r = (k-1)/2;
-
-	//rank class
-	RankHist<T_value_type> rk;
-
-	//row/column are now center
-	GetPixel4Border<T> gp(src, border_treatment, k);
-	int ci, ri;
-	int r_p=r;
-	int r_m=-r;
-
-	for(row=0; row<src_nrows; row++){
-      column=0;
-
-      for(color=0; color<rk.histsize; color++){
-        rk.hist[color]=0;
-      }
-      //init hist
-      for(ri=r_m; ri<=r_p; ri++) {
-        for(ci=r_m; ci<=r_p; ci++) {
-          rk.hist[gp(column+ci, row+ri)]++;
-        }
-      }
-
-      //calc median
-      res->set( Point(column,row), T_value_type(rk(rank,k*k)));
-
-      //go right column....
-      for(column=1; column<src_ncols; column++) {
-        for(ci=r_m; ci<=r_p; ci++) {
-          //sub
-          rk.hist[gp(column-1-r,row+ci)]--;
-
-          //add
-          rk.hist[gp(column+r,row+ci)]++;
-        }
-
-        //calc median
-        res->set( Point(column,row), T_value_type(rk(rank,k*k)));
-      }
-	}
-
-    return res;
-  }
-
-  // specialization for FloatImage,
-  // because here the histogram based approach does not work
-  template<>
-  FloatImageView* rank (const FloatImageView &src, unsigned int rank, unsigned int k, size_t border_treatment) {
+      return in_place ? in_place_view(src) : simple_image_copy(src);
+
+    int ncols = (int)src.ncols();
+    int nrows = (int)src.nrows();
+    int r = (k-1)/2;
+    unsigned int target = RankDetail::rank_position<T_value_type>(rank, k*k);
+    target = std::max(1u, std::min(target, k*k));
+
+    std::vector<T_value_type> levels;
+    std::vector<unsigned int> padded;
+    RankDetail::padded_levels(src, r, border_treatment, levels, padded);
+    unsigned int nlevels = (unsigned int)levels.size();
+    unsigned int nfine = (unsigned int)ceil(sqrt(double(nlevels)));
+
+    // the column histograms of a tile take up to 16MB, so that images
+    // with many levels are cut into narrower stripes of columns
+    size_t column_size = 2 * (nlevels + (nlevels + nfine - 1) / nfine);
+    int stripe = (int)((size_t(1) << 24) / column_size) - ((int)k - 1);
+    stripe = std::max(std::min(stripe, ncols), 16);
+    int nstripes = (ncols + stripe - 1) / stripe;
+    threads = std::min(RankDetail::resolve_threads(threads), nrows);
+    int band = (nrows + threads - 1) / threads;
+    int nbands = (nrows + band - 1) / band;
+
+    std::vector<unsigned int> out(ncols * nrows);
+    int tile;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(threads)
+#endif
+    for (tile = 0; tile < nbands * nstripes; ++tile) {
+      int x0 = (tile % nstripes) * stripe;
+      int y0 = (tile / nstripes) * band;
+      RankDetail::rank_tile(padded, ncols + 2 * r, nlevels, nfine, (int)k, target,
+                            x0, std::min(x0 + stripe, ncols),
+                            y0, std::min(y0 + band, nrows), out, ncols);
+    }
 
-    if (src.nrows() < k || src.ncols() < k)
-      return simple_image_copy(src);
-
-    int x,y;
-    size_t i;
-    FloatImageData *res_data = new FloatImageData(src.size(), src.origin());
-    FloatImageView *res= new FloatImageView(*res_data);
-
-	GetPixel4Border<FloatImageView> gp(src, border_treatment, k);
-    vector<FloatPixel> window(k*k);
-    
-    int radius = (k-1)/2;
-    for(y = 0 ; (size_t)y < src.nrows() ; y++) {
-      for(x = 0 ; (size_t)x < src.ncols(); x++) {
-        for(i = 0 ; i < k*k ; i++) {
-          window[i] = gp(x - radius + (i%k), y - radius + (i/k));
-        }
-        nth_element(window.begin(), window.begin() + rank, window.end());
-        res->set(Point(x,y), *(window.begin()+rank));
-      }
+    // the levels hold the pixels of the image, which can therefore be
+    // overwritten in place
+    view_type *res;
+    if (in_place) {
+      res = in_place_view(src);
+    } else {
+      data_type *res_data = new data_type(src.size(), src.origin());
+      res = new view_type(*res_data);
     }
+    std::vector<unsigned int>::const_iterator o = out.begin();
+    for (typename view_type::vec_iterator i = res->vec_begin(); i != res->vec_end(); ++i, ++o)
+      *i = levels[*o];
     return res;
   }
 
@@ -450,133 +559,274 @@ namespace Gamera {
   }
 
   //---------------------------
-  // kfill
+  // Gabor filter bank
   //---------------------------
 
-  // count core ON pixel
-  inline unsigned int kfill_count_core_pixel(OneBitImageView *tmp, int x, int y, Point *c_lr) {
-    unsigned int core_pixel = 0;
-    for( unsigned int cy = y ; cy <= c_lr->y() ; cy++ ) {
-      for( unsigned int cx = x ; cx <= c_lr->x() ; cx++ ) {
-        if( (*tmp).get( Point(cx, cy) ) == is_black(tmp)) {
-          core_pixel++;
+  /*
+   * Responses of the image to the Gabor filters of all combinations of
+   * frequencies and orientations (orientations varying fastest).  The
+   * image is transformed once; each response is the inverse transform of
+   * its product with the filter spectrum of create_gabor_filter.  With
+   * block_size > 0 the mean energy |response|^2 of each block is returned
+   * instead of the complex response.
+   */
+  template<class T>
+  ImageList* gabor_filter_bank(const T& src, FloatVector* orientations,
+                               FloatVector* frequencies, int direction,
+                               int block_size, int threads) {
+    using namespace FftDetail;
+    if (orientations->empty() || frequencies->empty())
+      throw std::runtime_error("gabor_filter_bank: orientations and frequencies must not be empty.");
+    if (block_size < 0)
+      throw std::runtime_error("gabor_filter_bank: block_size must not be negative.");
+    threads = RankDetail::resolve_threads(threads);
+
+    int nrows = src.nrows(), ncols = src.ncols();
+    DftPlan row_dft(ncols), col_dft(nrows);
+
+    ComplexImageData spectrum_data(src.size(), src.origin());
+    ComplexImageView spectrum(spectrum_data);
+    forward(src, spectrum, *row_dft, *col_dft, threads);
+
+    FloatImageData filter_data(src.size(), src.origin());
+    FloatImageView filter(filter_data);
+    ComplexImageData* work_data = NULL;
+    ComplexImageView* work = NULL;
+    ImageList* result = new ImageList();
+    try {
+      if (block_size > 0) {
+        work_data = new ComplexImageData(src.size(), src.origin());
+        work = new ComplexImageView(*work_data);
+      }
+      double scale = 1.0 / (double(nrows) * ncols);
+      for (size_t f = 0; f < frequencies->size(); ++f) {
+        for (size_t o = 0; o < orientations->size(); ++o) {
+          double frequency = (*frequencies)[f];
+          vigra::createGaborFilter(dest_image_range(filter), (*orientations)[o], frequency,
+                                   vigra::angularGaborSigma(direction, frequency),
+                                   vigra::radialGaborSigma(frequency));
+          ComplexImageView* response = work;
+          if (block_size == 0) {
+            ComplexImageData* response_data = new ComplexImageData(src.size(), src.origin());
+            response = new ComplexImageView(*response_data);
+            result->push_back(response);
+          }
+          Complex* r = &(*response)[0][0];
+          const Complex* s = &spectrum[0][0];
+          const FloatPixel* g = &filter[0][0];
+          for (size_t i = 0, n = size_t(nrows) * ncols; i < n; ++i)
+            r[i] = s[i] * (g[i] * scale);
+          dft2(*response, *row_dft, *col_dft, true, threads);
+          if (block_size == 0)
+            continue;
+
+          int bcols = (ncols + block_size - 1) / block_size;
+          int brows = (nrows + block_size - 1) / block_size;
+          FloatImageData* energy_data = new FloatImageData(Dim(bcols, brows));
+          FloatImageView* energy = new FloatImageView(*energy_data);
+          result->push_back(energy);
+          for (int by = 0; by < brows; ++by) {
+            int y1 = std::min(nrows, (by + 1) * block_size);
+            for (int bx = 0; bx < bcols; ++bx) {
+              int x1 = std::min(ncols, (bx + 1) * block_size);
+              double sum = 0.0;
+              for (int y = by * block_size; y < y1; ++y) {
+                const Complex* row = &(*work)[y][0];
+                for (int x = bx * block_size; x < x1; ++x)
+                  sum += std::norm(row[x]);
+              }
+              energy->set(Point(bx, by),
+                          sum / ((y1 - by * block_size) * (x1 - bx * block_size)));
+            }
+          }
         }
       }
-    }
-    return core_pixel;
-  }
-  // set all core pixel to given value
-  inline void kfill_set_core_pixel(OneBitImageView *res, int x, int y, Point *c_lr, int v) {
-    for( unsigned int cy = y ; cy <= c_lr->y() ; cy++ ) {
-      for( unsigned int cx = x ; cx <= c_lr->x() ; cx++ ) {
-        (*res).set( Point(cx, cy), v);
+    } catch (std::exception& e) {
+      for (ImageList::iterator i = result->begin(); i != result->end(); ++i) {
+        delete (*i)->data(); delete *i;
+      }
+      delete result;
+      if (work != NULL) {
+        delete work; delete work_data;
       }
+      throw std::runtime_error(std::string("gabor_filter_bank: ") + e.what());
     }
+    if (work != NULL) {
+      delete work; delete work_data;
+    }
+    return result;
   }
-  // get n, r, c
-  void kfill_get_condition_variables(OneBitImageView *tmp, int k, int x, int y, int size_x, int size_y, int *n, int *r, int *c) {
-		
-    // upper left corner of current window
-    int ul_x;
-    int ul_y;
-    // upper right corner of current window
-    int ur_x;
-    int ur_y;
-    // lower left corner of current window
-    int ll_x;
-    int ll_y;
-    // lower right corner of current window
-    int lr_x;
-    int lr_y;
-
-    int nnp = 4*(k-1); // total number of neighborhood pixels
-    int* nh_pixel = new int[nnp]; // array for neighborhood pixel
-    int nh_pixel_count = 0;
-    int corner_pixel_count;
-    int nh_ccs;
-    OneBitPixel pixelvalue;
-		
-    // calculate window borders
-    ul_x = ( x - 1 );
-    ul_y = ( y - 1 );
-    ur_x = ( x + k - 2 );
-    ur_y = ( y - 1 );
-    ll_x = ( x - 1 );
-    ll_y = ( y + k - 2 );
-    lr_x = ( x + k - 2 );
-    lr_y = ( y + k - 2 );
-										
-    // fill array with neighborhood and count neighborhood ON pixel
-    int i = 0;
-    for( int ul_to_ur_np = ul_x ; ul_to_ur_np < ur_x ; ul_to_ur_np++ ) {
-		
-      if(ul_to_ur_np < 0 || y-1 < 0 ) {
-        pixelvalue = 0;
-      } else {
-        pixelvalue = (*tmp).get( Point(ul_to_ur_np, y - 1) );
+
+  //---------------------------
+  // kfill
+  //---------------------------
+
+  namespace KfillDetail {
+    // Pixel flags of the working copy.  ON is the core criterion (value
+    // equal to one), BLACK the neighborhood criterion (any nonzero value)
+    // and FLIPPED marks pixels changed by the previous iteration.
+    enum { BLACK = 1, ON = 2, FLIPPED = 4 };
+
+    // Copies the flags of src into a grid with a white border of one pixel,
+    // so that neighborhoods at the image edge need no range checks.
+    template<class T>
+    void fill_flags(const T& src, std::vector<unsigned char>& flags) {
+      size_t stride = src.ncols() + 2;
+      flags.assign(stride * (src.nrows() + 2), 0);
+      ImageAccessor<typename T::value_type> acc;
+      typename T::const_row_iterator row = src.row_begin();
+      for (size_t y = 1; row != src.row_end(); ++row, ++y) {
+        unsigned char* f = &flags[y * stride + 1];
+        typename T::const_col_iterator col = row.begin();
+        for (; col != row.end(); ++col, ++f) {
+          typename T::value_type v = acc.get(col);
+          if (v == 1)
+            *f = BLACK | ON;
+          else if (is_black(v))
+            *f = BLACK;
+        }
       }
-			
-      nh_pixel[i++] = is_black(pixelvalue);
-      if (is_black(pixelvalue)) { nh_pixel_count++; }
     }
 
-    for( int ur_to_lr_np = ur_y ; ur_to_lr_np < lr_y ; ur_to_lr_np++ ) {
-		
-      if(ur_to_lr_np < 0 || x + k - 2 > size_x - 1 ) {
-        pixelvalue = 0;
-      } else {
-        pixelvalue = (*tmp).get( Point(x + k - 2, ur_to_lr_np) );
+    // Core and neighborhood counts of all windows in one window row.  The
+    // column sums slide down by one row per call of next(), so that each
+    // row costs O(ncols) and each window O(1) independent of k.  Window
+    // wx of the row covers the padded columns wx..wx+k-1; its core starts
+    // at image column wx.
+    class WindowRow {
+    public:
+      WindowRow(const std::vector<unsigned char>& flags, size_t ncols, size_t nrows, int k)
+        : m_flags(&flags[0]), m_stride(ncols + 2), m_k(k), m_y(-1),
+          m_on(m_stride, 0), m_black(m_stride, 0), m_trans(m_stride, 0),
+          m_flipped(m_stride, 0), m_row_flipped(nrows + 2, 0), m_window_flipped(0),
+          m_on_sum(m_stride + 1, 0), m_flipped_sum(m_stride + 1, 0),
+          m_top(m_stride + 1, 0), m_bottom(m_stride + 1, 0),
+          m_top_trans(m_stride, 0), m_bottom_trans(m_stride, 0) {
+        for (size_t y = 0; y < nrows + 2; ++y) {
+          const unsigned char* f = m_flags + y * m_stride;
+          for (size_t x = 0; x < m_stride; ++x)
+            m_row_flipped[y] += (f[x] & FLIPPED) != 0;
+        }
+        // column sums for the row before the first window row, so that
+        // next() only has to slide them
+        for (int y = 0; y < k - 3 && y < int(nrows); ++y)
+          add_core(y, 1);
+        for (int y = 0; y < k - 2 && y <= int(nrows); ++y)
+          add_trans(y, 1);
+        for (int y = 0; y < k - 1 && y <= int(nrows) + 1; ++y)
+          add_flipped(y, 1);
       }
-			
-      nh_pixel[i++] = is_black(pixelvalue);
-      if (is_black(pixelvalue)) { nh_pixel_count++; }
-    }
-		
-    for( int lr_to_ll_np = lr_x ; lr_to_ll_np > ll_x ; lr_to_ll_np-- ) {
-		
-      if( lr_to_ll_np > size_x - 1 || y + k - 2 > size_y - 1 ) {
-        pixelvalue = 0;
-      } else {
-        pixelvalue = (*tmp).get( Point(lr_to_ll_np, y + k - 2) );
+
+      // Moves to the next window row.
+      void next() {
+        ++m_y;
+        if (m_y > 0) {
+          add_core(m_y - 1, -1);
+          add_trans(m_y - 1, -1);
+          add_flipped(m_y - 1, -1);
+        }
+        add_core(m_y + m_k - 3, 1);
+        add_trans(m_y + m_k - 2, 1);
+        add_flipped(m_y + m_k - 1, 1);
       }
-			
-      nh_pixel[i++] = is_black(pixelvalue);
-      if (is_black(pixelvalue)) { nh_pixel_count++; }
-    }
-			
-    for( int ll_to_ul_np = ll_y ; ll_to_ul_np > ul_y ; ll_to_ul_np-- ) {
-		
-      if(x - 1 < 0 || ll_to_ul_np > size_y - 1 ) {
-        pixelvalue = 0;
-      } else {
-        pixelvalue = (*tmp).get( Point(x - 1, ll_to_ul_np) );
+
+      // Whether any pixel in the windows of the current row was flipped.
+      bool flipped() const { return m_window_flipped != 0; }
+
+      // Builds the prefix sums along the current row.
+      void prepare() {
+        const unsigned char* top = m_flags + m_y * m_stride;
+        const unsigned char* bottom = top + (m_k - 1) * m_stride;
+        for (size_t x = 0; x < m_stride; ++x) {
+          m_on_sum[x + 1] = m_on_sum[x] + m_on[x];
+          m_flipped_sum[x + 1] = m_flipped_sum[x] + m_flipped[x];
+          m_top[x + 1] = m_top[x] + (top[x] & BLACK);
+          m_bottom[x + 1] = m_bottom[x] + (bottom[x] & BLACK);
+        }
+        for (size_t x = 0; x + 1 < m_stride; ++x) {
+          m_top_trans[x + 1] = m_top_trans[x] + ((top[x] ^ top[x + 1]) & BLACK);
+          m_bottom_trans[x + 1] = m_bottom_trans[x] + ((bottom[x] ^ bottom[x + 1]) & BLACK);
+        }
+      }
+
+      int core_on(int wx) const {
+        return m_on_sum[wx + m_k - 1] - m_on_sum[wx + 1];
       }
-			
-      nh_pixel[i++] = is_black(pixelvalue);
-      if (is_black(pixelvalue)) { nh_pixel_count++; }
-    }
-						
-    // count corner ON pixel
-    corner_pixel_count = nh_pixel[(k-1)*0] + nh_pixel[(k-1)*1] + nh_pixel[(k-1)*2] + nh_pixel[(k-1)*3];
-
-    // get ccs in neighborhood
-    nh_ccs = 0;
-    for(int nhpixel = 0 ; nhpixel < i ; nhpixel++) {
-      nh_ccs += abs( nh_pixel[(nhpixel+1)%nnp] - nh_pixel[nhpixel] );
-    }
-    nh_ccs /= 2;
 
-    *n = nh_pixel_count;
-    *r = corner_pixel_count;
-    *c = nh_ccs;
+      bool flipped(int wx) const {
+        return m_flipped_sum[wx + m_k] != m_flipped_sum[wx];
+      }
+
+      // n: ON pixels in the neighborhood, r: ON corner pixels,
+      // c: connected components in the neighborhood
+      void neighborhood(int wx, int& n, int& r, int& c) const {
+        int left = wx, right = wx + m_k - 1;
+        const unsigned char* top = m_flags + m_y * m_stride;
+        const unsigned char* bottom = top + (m_k - 1) * m_stride;
+        n = m_top[right + 1] - m_top[left] + m_bottom[right + 1] - m_bottom[left]
+          + m_black[left] + m_black[right];
+        r = (top[left] & BLACK) + (top[right] & BLACK)
+          + (bottom[left] & BLACK) + (bottom[right] & BLACK);
+        c = (m_top_trans[right] - m_top_trans[left]
+             + m_bottom_trans[right] - m_bottom_trans[left]
+             + m_trans[left] + m_trans[right]) / 2;
+      }
+
+    private:
+      // The window row y has the core rows y..y+k-3, the transitions
+      // between image rows y-1..y+k-2 (each counted at its lower row) and
+      // the padded rows y..y+k-1.
+      void add_core(int y, int sign) {
+        const unsigned char* f = m_flags + (y + 1) * m_stride;
+        for (size_t x = 0; x < m_stride; ++x) {
+          m_on[x] += sign * ((f[x] & ON) >> 1);
+          m_black[x] += sign * (f[x] & BLACK);
+        }
+      }
+
+      void add_trans(int y, int sign) {
+        const unsigned char* f = m_flags + (y + 1) * m_stride;
+        const unsigned char* above = f - m_stride;
+        for (size_t x = 0; x < m_stride; ++x)
+          m_trans[x] += sign * ((f[x] ^ above[x]) & BLACK);
+      }
+
+      // padded row y
+      void add_flipped(int y, int sign) {
+        if (m_row_flipped[y] == 0)
+          return;
+        m_window_flipped += sign * m_row_flipped[y];
+        const unsigned char* f = m_flags + y * m_stride;
+        for (size_t x = 0; x < m_stride; ++x)
+          m_flipped[x] += sign * ((f[x] & FLIPPED) >> 2);
+      }
 
-    delete[] nh_pixel;
+      const unsigned char* m_flags;
+      size_t m_stride;
+      int m_k, m_y;
+      std::vector<int> m_on, m_black, m_trans, m_flipped;
+      std::vector<int> m_row_flipped;
+      int m_window_flipped;
+      std::vector<int> m_on_sum, m_flipped_sum, m_top, m_bottom;
+      std::vector<int> m_top_trans, m_bottom_trans;
+    };
+
+    inline bool fill_condition(int k, int n, int r, int c) {
+      return (c <= 1) && ((n > 3*k - 4) || ((n == 3*k - 4) && (r == 2)));
+    }
+
+    struct Fill {
+      int x, y;
+      OneBitPixel value;
+      Fill(int x_, int y_, OneBitPixel value_) : x(x_), y(y_), value(value_) {}
+    };
   }
-	
+
   // the actual kfill implementation
   template<class T>
   OneBitImageView * kfill(const T &src, int k, int iterations) {
-		
+    using namespace KfillDetail;
+
     //
     // create a copy of the original image
     // kfill algorithm sets pixel ON/OFF information in this image
@@ -584,160 +834,113 @@ namespace Gamera {
     OneBitImageData *res_data = new OneBitImageData( src.size(), src.origin() );
     OneBitImageView *res = new OneBitImageView(*res_data);
     image_copy_fill(src, *res);
-		
-    // kfill algorithm reads pixel ON/OFF information from this image
-    OneBitImageData *tmp_data = new OneBitImageData( src.size(), src.origin() );
-    OneBitImageView *tmp = new OneBitImageView(*tmp_data);
-		
-    bool changed; // pixels changed in an iteration
-    int src_size_x = src.ncols(); // source image size x
-    int src_size_y = src.nrows(); // source image size y
-		
-    int x, y; // windows position (upper left core coordinate)
-    Point c_lr; // windows position (lower right core coordinate)
-		
+
+    // kfill algorithm reads pixel ON/OFF information from these flags,
+    // which are updated after each iteration
+    std::vector<unsigned char> flags;
+    fill_flags(src, flags);
+
+    int ncols = src.ncols(), nrows = src.nrows();
+    size_t stride = ncols + 2;
     int ncp = (k-2)*(k-2); // number of core pixel
-    int core_pixel; // number of ON core pixel
-		
-    int r; // number of pixel in the neighborhood corners
-    int n; // number of neighborhood pixel
-    int c; // number of ccs in neighborhood
-				
-    while(iterations) {
-			
-      // create a copy from the result image (result of previous iteration or original at first iteration)
-      image_copy_fill(*res, *tmp);
-			
-      // reset changed pixel
-      changed =  false;
-			
-      // move window over the image
-      for(y = 0 ; y < src_size_y - (k-3) ; y++) {
-        for(x = 0 ; x < src_size_x - (k-3) ; x++) {
-					
-          // calculate lower right core coordinate
-          c_lr.x( x + (k - 3) );
-          c_lr.y( y + (k - 3) );
-
-          // count core ON pixel
-          core_pixel = kfill_count_core_pixel(tmp, x, y, &c_lr);
-
-          //
+    int nnp = 4*(k-1); // number of neighborhood pixel
+    int r, n, c;
+
+    std::vector<Fill> fills, previous;
+    for (bool first = true; iterations; first = false, --iterations) {
+      WindowRow row(flags, ncols, nrows, k);
+      fills.clear();
+
+      // move window over the image; after the first iteration only windows
+      // containing a pixel flipped in the previous one can change
+      for (int y = 0; y < nrows - (k-3); ++y) {
+        row.next();
+        if (!first && !row.flipped())
+          continue;
+        row.prepare();
+        for (int x = 0; x < ncols - (k-3); ++x) {
+          if (!first && !row.flipped(x))
+            continue;
+          int core_pixel = row.core_on(x);
           // ON filling requires ALL core pixels to be OFF
-          //
-          if(core_pixel == 0) {
-            // get condition variables
-            kfill_get_condition_variables(tmp, k, x, y, src_size_x, src_size_y, &n, &r, &c);
-            // condition check
-            if( (c <= 1) && ( (n > 3*k - 4) || (n == 3*k - 4) && (r == 2) ) ) {
-              kfill_set_core_pixel(res, x, y, &c_lr, 1);
-              changed = true;
-            }
+          if (core_pixel == 0) {
+            row.neighborhood(x, n, r, c);
+            if (fill_condition(k, n, r, c))
+              fills.push_back(Fill(x, y, 1));
           }
-					
-          //
           // OFF filling requires ALL core pixels to be ON
-          //				
-          if(core_pixel == ncp) {
-            kfill_get_condition_variables(tmp, k, x, y, src_size_x, src_size_y, &n, &r, &c);
-            n = ( 4*(k-1) ) - n;
-            r = 4 - r;
-            // condition check
-            if( (c <= 1) && ( (n > 3*k - 4) || (n == 3*k - 4) && (r == 2) ) ) {
-              kfill_set_core_pixel(res, x, y, &c_lr, 0);
-              changed = true;
-            }
+          else if (core_pixel == ncp) {
+            row.neighborhood(x, n, r, c);
+            if (fill_condition(k, nnp - n, 4 - r, c))
+              fills.push_back(Fill(x, y, 0));
           }
-										
-        } // end for x
-      } // end for y
-						
-      if(!changed) {
+        }
+      }
+
+      if (fills.empty())
         break;
+
+      // filling always flips the whole core, as the ON and OFF conditions
+      // are exclusive no two fills of an iteration contradict each other
+      for (size_t i = 0; i < previous.size(); ++i)
+        for (int y = previous[i].y; y < previous[i].y + k - 2; ++y)
+          for (int x = previous[i].x; x < previous[i].x + k - 2; ++x)
+            flags[(y + 1) * stride + x + 1] &= ~FLIPPED;
+      for (size_t i = 0; i < fills.size(); ++i) {
+        unsigned char f = fills[i].value ? (BLACK | ON | FLIPPED) : FLIPPED;
+        for (int y = fills[i].y; y < fills[i].y + k - 2; ++y)
+          for (int x = fills[i].x; x < fills[i].x + k - 2; ++x) {
+            flags[(y + 1) * stride + x + 1] = f;
+            res->set(Point(x, y), fills[i].value);
+          }
       }
-			
-      iterations--;
-    } // end while
-		
-    delete tmp->data();
-    delete tmp;
-		
+      std::swap(fills, previous);
+    }
+
     return res;
   }
 
 
   template<class T>
   OneBitImageView * kfill_modified(const T &src, int k) {
-    /*
-      create a copy of the original image
-      kfill algorithm sets pixel ON/OFF information in this image
-    */
+    using namespace KfillDetail;
+
     OneBitImageData *res_data = new OneBitImageData( src.size(), src.origin() );
     OneBitImageView *res = new OneBitImageView(*res_data);
-		
-    OneBitImageData *tmp_data = new OneBitImageData( src.size(), src.origin() );
-    OneBitImageView *tmp = new OneBitImageView(*tmp_data);
-    image_copy_fill(src, *tmp);
-		
-    int src_size_x = src.ncols(); // source image size x
-    int src_size_y = src.nrows(); // source image size y
-		
-    int x, y; // windows position (upper left core coordinate)
-    Point c_lr; // windows position (lower right core coordinate)
-		
-    int ncp = (k-2) * (k-2);
-    float ncp_required = ncp / 2.0f; // number of core pixel required -- modified version
-		
-    int core_pixel; // number of ON core pixel
-		
-    int r; // number of pixel in the neighborhood corners
-    int n; // number of neighborhood pixel
-    int c; // number of ccs in neighborhood
-		
-    // move window over the image
-    for(y = 0 ; y < src_size_y - (k-3) ; y++) {
-      for(x = 0 ; x < src_size_x - (k-3) ; x++) {
-        // calculate lower right core coordinate
-        c_lr.x( x + (k - 3) );
-        c_lr.y( y + (k - 3) );
-				
-        // count core ON pixel
-        core_pixel = kfill_count_core_pixel(tmp, x, y, &c_lr);
-				
-        // ON >= (k-2)^2/2 ?
-        if(core_pixel >= ncp_required) {
-					
-          // Examine in the Neighborhood
-          kfill_get_condition_variables(tmp, k, x, y, src_size_x, src_size_y, &n, &r, &c);
-          n = ( 4*(k-1) ) - n;
-          r = 4 - r;
-					
-          // eq. satisfied?
-          if( (c <= 1) && ( (n > 3*k - 4) || (n == 3*k - 4) && (r == 2) ) ) {
-            kfill_set_core_pixel(res, x, y, &c_lr, 0);
-          } else {
-            kfill_set_core_pixel(res, x, y, &c_lr, 1);
-          }			
-					
-        } else {
-					
-          // Examine in the Neighborhood
-          kfill_get_condition_variables(tmp, k, x, y, src_size_x, src_size_y, &n, &r, &c);
-
-          // eq. satisfied?					
-          if( (c <= 1) && ( (n > 3*k - 4) || (n == 3*k - 4) && (r == 2) ) ) {
-            kfill_set_core_pixel(res, x, y, &c_lr, 1);
-          } else {
-            kfill_set_core_pixel(res, x, y, &c_lr, 0);
-          }
 
-        }
-								
-      } // end for x
-    } // end for y
-		
-    delete tmp->data();
-    delete tmp;
+    std::vector<unsigned char> flags;
+    fill_flags(src, flags);
+
+    int ncols = src.ncols(), nrows = src.nrows();
+    int xmax = ncols - (k-2), ymax = nrows - (k-2); // last window position
+    int ncp = (k-2)*(k-2);
+    int nnp = 4*(k-1);
+    int r, n, c;
+
+    WindowRow row(flags, ncols, nrows, k);
+    for (int y = 0; y <= ymax; ++y) {
+      row.next();
+      row.prepare();
+      for (int x = 0; x <= xmax; ++x) {
+        int core_pixel = row.core_on(x);
+        OneBitPixel value;
+        row.neighborhood(x, n, r, c);
+        // ON >= (k-2)^2/2 ?
+        if (2 * core_pixel >= ncp)
+          value = fill_condition(k, nnp - n, 4 - r, c) ? 0 : 1;
+        else
+          value = fill_condition(k, n, r, c) ? 1 : 0;
+
+        // every window sets its whole core, so a pixel ends up with the
+        // value of the last window covering it; that is the window whose
+        // core starts at the pixel, or the last one in the row or column
+        int x_end = (x == xmax) ? ncols : x + 1;
+        int y_end = (y == ymax) ? nrows : y + 1;
+        for (int py = y; py < y_end; ++py)
+          for (int px = x; px < x_end; ++px)
+            res->set(Point(px, py), value);
+      }
+    }
 
     return res;
   }
@@ -26,10 +26,15 @@
 
 #include <vector>
 #include <algorithm>
+#include <limits>
 #include "gamera.hpp"
 #include "neighbor.hpp"
 #include "image_utilities.hpp"
+#include "packed_utilities.hpp"
 #include "vigra/distancetransform.hxx"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // for backward compatibility:
 // mean, rank were formerly defined in the present header file
@@ -39,7 +44,206 @@ using namespace std;
 
 namespace Gamera {
 
-  
+  namespace MorphologyDetail {
+    struct MaxOf {
+      template<class V>
+      V operator()(const V& a, const V& b) const { return a < b ? b : a; }
+    };
+
+    struct MinOf {
+      template<class V>
+      V operator()(const V& a, const V& b) const { return b < a ? b : a; }
+    };
+
+    /*
+      out[x] = op(f[x + lo], ..., f[x + hi]) for x in [0, n), where f is
+      pad outside [0, n), by the van Herk/Gil-Werman algorithm: the line
+      is cut into blocks of hi - lo + 1 entries, whose running results
+      from the left (g) and from the right (h) give every window with a
+      single op, so that op is applied three times per entry whatever
+      the length of the window (M. van Herk, Pattern Recognition Letters
+      13, 1992; J. Gil and M. Werman, IEEE PAMI 15, 1993).
+
+      Every entry is a row of w values, so that the same code filters a
+      row of an image (w = 1) and all the columns at once (w = ncols).
+    */
+    template<class V, class Op>
+    void line_filter(const V* f, V* out, int n, size_t w, int lo, int hi,
+                     V pad, Op op, std::vector<V>& g, std::vector<V>& h) {
+      int k = hi - lo + 1;
+      int length = ((n + 2 * (k - 1)) / k) * k;
+      g.resize(length * w);
+      h.resize(length * w);
+      // g[i] = f[i + lo] for the i with i + lo in [0, n)
+      int first = std::min(std::max(-lo, 0), length);
+      int last = std::max(std::min(n - lo, length), first);
+      std::fill(g.begin(), g.begin() + first * w, pad);
+      std::copy(f + (first + lo) * w, f + (last + lo) * w, g.begin() + first * w);
+      std::fill(g.begin() + last * w, g.end(), pad);
+      std::copy(g.begin(), g.end(), h.begin());
+      for (int start = 0; start < length; start += k) {
+        for (size_t j = (start + 1) * w; j < (start + k) * w; ++j)
+          g[j] = op(g[j - w], g[j]);
+        for (size_t j = (start + k - 1) * w; j-- > start * w; )
+          h[j] = op(h[j], h[j + w]);
+      }
+      for (size_t j = 0, j_end = n * w; j < j_end; ++j)
+        out[j] = op(h[j], g[j + (k - 1) * w]);
+    }
+
+    /*
+      dest(x, y) = op over src(x + u, y + v) for u in [x0, x1] and v in
+      [y0, y1] (src being pad outside the image), as a row and a column
+      line_filter.
+    */
+    template<class V, class Op>
+    void rect_filter(const std::vector<V>& src, int ncols, int nrows,
+                     int x0, int x1, int y0, int y1, V pad, Op op,
+                     std::vector<V>& dest) {
+      std::vector<V> rows(src.size()), g, h;
+      dest.resize(src.size());
+      for (int y = 0; y < nrows; ++y)
+        line_filter(&src[y * ncols], &rows[y * ncols], ncols, 1, x0, x1,
+                    pad, op, g, h);
+      line_filter(&rows[0], &dest[0], nrows, ncols, y0, y1, pad, op, g, h);
+    }
+
+    // the offsets u in [x0, x1], v in [y0, y1] from the origin
+    struct Rectangle {
+      int x0, x1, y0, y1;
+    };
+
+    /*
+      Covers the black pixels of the structuring element with rectangles:
+      every run of black pixels in a row is stretched over the rows above
+      and below that are black all along it, so that a convex element
+      gives one rectangle per width of its rows.
+    */
+    template<class U>
+    void decompose(const U& se, Point origin, std::vector<Rectangle>& rects) {
+      int ncols = (int)se.ncols();
+      int nrows = (int)se.nrows();
+      std::vector<char> black(ncols * nrows);
+      for (int y = 0; y < nrows; ++y)
+        for (int x = 0; x < ncols; ++x)
+          black[y * ncols + x] = is_black(se.get(Point(x, y)));
+      for (int y = 0; y < nrows; ++y) {
+        int x = 0;
+        while (x < ncols) {
+          if (!black[y * ncols + x]) {
+            ++x;
+            continue;
+          }
+          int x0 = x;
+          while (x < ncols && black[y * ncols + x])
+            ++x;
+          int y0 = y, y1 = y;
+          while (y0 > 0 && std::count(&black[(y0 - 1) * ncols + x0],
+                                      &black[(y0 - 1) * ncols + x], 0) == 0)
+            --y0;
+          while (y1 < nrows - 1 && std::count(&black[(y1 + 1) * ncols + x0],
+                                              &black[(y1 + 1) * ncols + x], 0) == 0)
+            ++y1;
+          Rectangle r = {x0 - (int)origin.x(), x - 1 - (int)origin.x(),
+                         y0 - (int)origin.y(), y1 - (int)origin.y()};
+          // skip it when it lies in a rectangle found from another row
+          size_t i = 0;
+          while (i < rects.size() && (rects[i].x0 > r.x0 || rects[i].x1 < r.x1 ||
+                                      rects[i].y0 > r.y0 || rects[i].y1 < r.y1))
+            ++i;
+          if (i == rects.size())
+            rects.push_back(r);
+        }
+      }
+    }
+
+    // 1 for the black pixels of the image, one row after the other
+    template<class T>
+    void binary_pixels(const T& src, std::vector<unsigned char>& pixels) {
+      pixels.resize(src.nrows() * src.ncols());
+      std::vector<unsigned char>::iterator p = pixels.begin();
+      for (typename T::const_row_iterator r = src.row_begin(); r != src.row_end(); ++r)
+        for (typename T::const_col_iterator c = r.begin(); c != r.end(); ++c, ++p)
+          *p = is_black(*c) ? 1 : 0;
+    }
+
+    template<class T>
+    typename ImageFactory<T>::view_type*
+    binary_image(const T& src, const std::vector<unsigned char>& pixels) {
+      typedef typename ImageFactory<T>::data_type data_type;
+      typedef typename ImageFactory<T>::view_type view_type;
+      data_type* dest_data = new data_type(src.size(), src.origin());
+      view_type* dest = new view_type(*dest_data);
+      typename T::value_type blackval = black(src);
+      std::vector<unsigned char>::const_iterator p = pixels.begin();
+      for (typename view_type::row_iterator r = dest->row_begin(); r != dest->row_end(); ++r)
+        for (typename view_type::col_iterator c = r.begin(); c != r.end(); ++c, ++p)
+          if (*p)
+            *c = blackval;
+      return dest;
+    }
+
+    /*
+      Dilates (or erodes) the black pixels by every rectangle of the
+      structuring element and unites (or intersects) the results.
+    */
+    template<class T>
+    typename ImageFactory<T>::view_type*
+    binary_morphology(const T& src, const std::vector<Rectangle>& rects, bool erosion) {
+      std::vector<unsigned char> pixels, result, part;
+      binary_pixels(src, pixels);
+      int ncols = (int)src.ncols();
+      int nrows = (int)src.nrows();
+      if (erosion)
+        result = pixels;
+      else
+        result.assign(pixels.size(), 0);
+      for (size_t i = 0; i < rects.size(); ++i) {
+        const Rectangle& r = rects[i];
+        if (erosion) {
+          rect_filter(pixels, ncols, nrows, r.x0, r.x1, r.y0, r.y1,
+                      (unsigned char)0, MinOf(), part);
+          for (size_t j = 0; j < result.size(); ++j)
+            result[j] &= part[j];
+        } else {
+          rect_filter(pixels, ncols, nrows, -r.x1, -r.x0, -r.y1, -r.y0,
+                      (unsigned char)0, MaxOf(), part);
+          for (size_t j = 0; j < result.size(); ++j)
+            result[j] |= part[j];
+        }
+      }
+      return binary_image(src, result);
+    }
+
+    /*
+      Whether the structuring element is better applied as rectangles
+      (decomposed into rects) than offset by offset at every black pixel:
+      a rectangle costs about as much as ten offsets per pixel.  The
+      offset by offset erosion stops at the first white pixel, which it
+      finds after about as many offsets as there are pixels per white
+      pixel.
+    */
+    template<class T, class U>
+    bool prefer_rectangles(const T& src, const U& se, Point origin, bool erosion,
+                           std::vector<Rectangle>& rects) {
+      double offsets = 0.0;
+      for (typename U::const_vec_iterator i = se.vec_begin(); i != se.vec_end(); ++i)
+        if (is_black(*i))
+          offsets += 1.0;
+      if (offsets <= 1.0)
+        return false;
+      double pixels = double(src.nrows()) * src.ncols();
+      double black_pixels = 0.0;
+      for (typename T::const_vec_iterator i = src.vec_begin(); i != src.vec_end(); ++i)
+        if (is_black(*i))
+          black_pixels += 1.0;
+      if (erosion && black_pixels < pixels)
+        offsets = std::min(offsets, pixels / (pixels - black_pixels));
+      decompose(se, origin, rects);
+      return black_pixels * offsets > 10.0 * rects.size() * pixels;
+    }
+  }
+
   /*
   * binary dilation with arbitrary structuring element
   */
@@ -51,6 +255,10 @@ namespace Gamera {
 	typedef typename T::value_type value_type;
 	int x,y;
 
+	std::vector<MorphologyDetail::Rectangle> rects;
+	if (MorphologyDetail::prefer_rectangles(src, structuring_element, origin, false, rects))
+	  return MorphologyDetail::binary_morphology(src, rects, false);
+
 	value_type blackval = black(src);
 
 	data_type* dest_data = new data_type(src.size(), src.origin());
@@ -127,6 +335,10 @@ namespace Gamera {
 	typedef typename T::value_type value_type;
 	int x,y;
 
+	std::vector<MorphologyDetail::Rectangle> rects;
+	if (MorphologyDetail::prefer_rectangles(src, structuring_element, origin, true, rects))
+	  return MorphologyDetail::binary_morphology(src, rects, true);
+
 	value_type blackval = black(src);
 
 	data_type* dest_data = new data_type(src.size(), src.origin());
@@ -212,6 +424,22 @@ namespace Gamera {
      vector<OneBitPixel>::iterator end) {
     return *(max_element(begin, end));
   }
+  /* on PACKED images, the 3x3 minimum/maximum filters used for
+     erosion/dilation work on whole words */
+  inline void neighbor9(const OneBitPackedImageView& m, Max<OneBitPixel> func,
+                        OneBitPackedImageView& tmp) {
+    if (m.nrows() < 3 || m.ncols() < 3)
+      return;
+    packed_neighbor9(m, tmp, false);
+  }
+
+  inline void neighbor9(const OneBitPackedImageView& m, Min<OneBitPixel> func,
+                        OneBitPackedImageView& tmp) {
+    if (m.nrows() < 3 || m.ncols() < 3)
+      return;
+    packed_neighbor9(m, tmp, true);
+  }
+
   /* the general implementation (both for onebit and greyscale) needed 
      to be renamed to allow for template specilization on onebit images */
   template<class T>
@@ -290,13 +518,44 @@ namespace Gamera {
     }
   }
   
-  /* implementation for non-onebit images */
+  namespace MorphologyDetail {
+    /* the square kernel of erode_dilate, written to dest (which may be
+       m itself, as the pixels are first copied) */
+    template<class T, class U>
+    void erode_dilate_rect(const T& m, const size_t times, int direction, U& dest) {
+      typedef typename T::value_type value_type;
+      int t = times > 1 ? (int)times : 1;
+      std::vector<value_type> pixels(m.nrows() * m.ncols()), result;
+      typename std::vector<value_type>::iterator p = pixels.begin();
+      for (typename T::const_vec_iterator i = m.vec_begin(); i != m.vec_end(); ++i, ++p)
+        *p = *i;
+      if (direction)
+        rect_filter(pixels, (int)m.ncols(), (int)m.nrows(), -t, t, -t, t,
+                    white(m), MaxOf(), result);
+      else
+        rect_filter(pixels, (int)m.ncols(), (int)m.nrows(), -t, t, -t, t,
+                    white(m), MinOf(), result);
+      p = result.begin();
+      for (typename U::vec_iterator i = dest.vec_begin(); i != dest.vec_end(); ++i, ++p)
+        *i = *p;
+    }
+  }
+
+  /* implementation for non-onebit images: the square kernel is the
+     maximum (or minimum) of the (2*times+1) square around each pixel,
+     with white outside the image, as after times 3x3 steps */
   template<class T>
   typename ImageFactory<T>::view_type* erode_dilate(T &m, const size_t times, int direction, int geo){
+	typedef typename ImageFactory<T>::data_type data_type;
 	typedef typename ImageFactory<T>::view_type view_type;
-	view_type* new_view;
-	
-	new_view = erode_dilate_original(m,times,direction,geo);
+	typedef typename T::value_type value_type;
+
+	if (geo || m.nrows() < 3 || m.ncols() < 3)
+	  return erode_dilate_original(m,times,direction,geo);
+
+	data_type* new_data = new data_type(m.size(), m.origin());
+	view_type* new_view = new view_type(*new_data);
+	MorphologyDetail::erode_dilate_rect(m, times, direction, *new_view);
 	return new_view;
   }
   
@@ -342,6 +601,85 @@ namespace Gamera {
 	return result;
   }
   
+  /* for PACKED onebit images, the square structuring element is
+     applied as repeated word-parallel 3x3 steps, which gives the same
+     result as erode/dilate_with_structure with a (2*times+1) square */
+  template<>
+  inline ImageFactory<OneBitPackedImageView>::view_type*
+  erode_dilate<OneBitPackedImageView>(OneBitPackedImageView &src, const size_t times, int direction, int geo){
+    typedef ImageFactory<OneBitPackedImageView>::data_type data_type;
+    typedef ImageFactory<OneBitPackedImageView>::view_type view_type;
+
+    if (src.nrows() < 3 || src.ncols() < 3 || times < 1)
+      return simple_image_copy(src);
+
+    if (geo) {
+      // octagonal kernel, see the OneBitImageView version above
+      OneBitImageData* se_data = new OneBitImageData(Dim(1+2*times,1+2*times));
+      OneBitImageView* se = new OneBitImageView(*se_data);
+      view_type* result;
+      int n_corner = (1+(int)times) / 2;
+      int n = (int)se->ncols()-1;
+      for(int y = 0; y < (int)se->nrows(); y++)
+        for(int x = 0; x < (int)se->ncols(); x++)
+          if (!(x+y < n_corner || n-x+y < n_corner ||
+                x+n-y < n_corner || n-x+n-y < n_corner))
+            se->set(Point(x,y),OneBitPixel(1));
+      if (direction)
+        result = erode_with_structure(src,*se, Point(times,times));
+      else
+        result = dilate_with_structure(src,*se,Point(times,times),false);
+      delete se->data();
+      delete se;
+      return result;
+    }
+
+    data_type* new_data = new data_type(src.size(), src.origin());
+    view_type* new_view = new view_type(*new_data);
+    packed_neighbor9(src, *new_view, !direction);
+    if (times > 1) {
+      data_type* flip_data = new data_type(src.size(), src.origin());
+      view_type* flip_view = new view_type(*flip_data);
+      for (size_t r = 1; r < times; ++r) {
+        std::swap(new_view, flip_view);
+        std::swap(new_data, flip_data);
+        packed_neighbor9(*flip_view, *new_view, !direction);
+      }
+      delete flip_view;
+      delete flip_data;
+    }
+    return new_view;
+  }
+
+  namespace MorphologyDetail {
+    // whether erode_dilate takes the square kernel path above
+    template<class T>
+    inline bool square_kernel_path(const T& m) { return true; }
+    inline bool square_kernel_path(const OneBitImageView& m) { return false; }
+    inline bool square_kernel_path(const OneBitPackedImageView& m) { return false; }
+  }
+
+  /* with in_place, the result is written to the image itself: directly
+     for the square kernel of non-onebit images, else copied back from
+     the result */
+  template<class T>
+  typename ImageFactory<T>::view_type* erode_dilate(T &m, const size_t times, int direction, int geo, bool in_place) {
+    typedef typename ImageFactory<T>::view_type view_type;
+    if (!in_place)
+      return erode_dilate(m, times, direction, geo);
+    view_type* view = in_place_view(m);
+    if (!geo && m.nrows() >= 3 && m.ncols() >= 3 &&
+        MorphologyDetail::square_kernel_path(m)) {
+      MorphologyDetail::erode_dilate_rect(m, times, direction, *view);
+      return view;
+    }
+    view_type* result = erode_dilate(m, times, direction, geo);
+    image_copy_fill(*result, *view);
+    delete result->data();
+    delete result;
+    return view;
+  }
+
   template<class T>
   void erode(T& image) {
     erode_dilate(image, 1, 1, 0);
@@ -476,13 +814,232 @@ namespace Gamera {
     }
   }
 
+  namespace DistanceDetail {
+    inline int resolve_threads(int threads) {
+      if (threads <= 0) {
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#else
+        threads = 1;
+#endif
+      }
+      return threads;
+    }
+
+    // the black pixels of the image, one row after the other
+    template<class T>
+    void black_pixels(const T& src, std::vector<char>& black, bool& any_white) {
+      black.resize(src.nrows() * src.ncols());
+      any_white = false;
+      std::vector<char>::iterator b = black.begin();
+      for (typename T::const_row_iterator r = src.row_begin(); r != src.row_end(); ++r)
+        for (typename T::const_col_iterator c = r.begin(); c != r.end(); ++c, ++b) {
+          *b = is_black(*c);
+          if (!*b)
+            any_white = true;
+        }
+    }
+
+    /*
+      The lower envelope of the parabolas (y - q)^2 + f[q] for the q
+      with finite f[q] (P. Felzenszwalb and D. Huttenlocher: Distance
+      transforms of sampled functions.  Theory of Computing 8, 2012),
+      evaluated at every y into d (or infinity everywhere when no f[q] is
+      finite).  v and z are work space of n and n + 1 entries.
+    */
+    inline void lower_envelope(const double* f, double* d, size_t n, double infinity,
+                               std::vector<long>& v, std::vector<double>& z) {
+      long k = -1;
+      for (size_t q = 0; q < n; ++q) {
+        if (f[q] >= infinity)
+          continue;
+        double s = 0.0;
+        while (k >= 0) {
+          long p = v[k];
+          s = ((f[q] + double(q) * q) - (f[p] + double(p) * p)) / (2.0 * q - 2.0 * p);
+          if (s > z[k])
+            break;
+          --k;
+        }
+        ++k;
+        v[k] = q;
+        z[k] = k == 0 ? -infinity : s;
+        z[k + 1] = infinity;
+      }
+      if (k < 0) {
+        std::fill(d, d + n, infinity);
+        return;
+      }
+      long j = 0;
+      for (size_t y = 0; y < n; ++y) {
+        while (z[j + 1] < y)
+          ++j;
+        double distance = double(y) - v[j];
+        d[y] = distance * distance + f[v[j]];
+      }
+    }
+
+    /*
+      The exact Euclidean distance of every black pixel to the nearest
+      white pixel: the distances along the rows, then the lower envelopes
+      along the columns, each pass spread over the threads.
+    */
+    template<class T>
+    void euclidean_distance(const T& src, FloatImageView& dest, int threads) {
+      const long ncols = src.ncols(), nrows = src.nrows();
+      const double infinity = 1e30;
+      std::vector<char> black;
+      bool any_white;
+      black_pixels(src, black, any_white);
+      FloatPixel* d = &*dest.data()->begin();
+      if (!any_white) {
+        // as vigra::distanceTransform, which starts from a white pixel
+        // at (-ncols, -nrows)
+        for (long y = 0; y < nrows; ++y)
+          for (long x = 0; x < ncols; ++x)
+            d[y * ncols + x] = sqrt(double(ncols + x) * (ncols + x) +
+                                    double(nrows + y) * (nrows + y));
+        return;
+      }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(threads)
+#endif
+      for (long y = 0; y < nrows; ++y) {
+        const char* b = &black[y * ncols];
+        FloatPixel* row = d + y * ncols;
+        double distance = infinity;
+        for (long x = 0; x < ncols; ++x) {
+          distance = b[x] ? distance + 1.0 : 0.0;
+          row[x] = distance;
+        }
+        distance = infinity;
+        for (long x = ncols - 1; x >= 0; --x) {
+          distance = b[x] ? distance + 1.0 : 0.0;
+          if (distance < row[x])
+            row[x] = distance;
+        }
+      }
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+      {
+        // the columns are copied in blocks, so that whole rows are read
+        const long block = 16;
+        std::vector<double> columns(block * nrows), envelope(nrows);
+        std::vector<long> v(nrows);
+        std::vector<double> z(nrows + 1);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (long x0 = 0; x0 < ncols; x0 += block) {
+          const long width = std::min(block, ncols - x0);
+          // the row distances are squared here rather than in d, so that
+          // they stay exact when FloatPixel is a float
+          for (long y = 0; y < nrows; ++y)
+            for (long i = 0; i < width; ++i) {
+              const double distance = d[y * ncols + x0 + i];
+              columns[i * nrows + y] = distance >= infinity ? infinity : distance * distance;
+            }
+          for (long i = 0; i < width; ++i) {
+            lower_envelope(&columns[i * nrows], &envelope[0], nrows, infinity, v, z);
+            std::copy(envelope.begin(), envelope.end(), columns.begin() + i * nrows);
+          }
+          for (long y = 0; y < nrows; ++y)
+            for (long i = 0; i < width; ++i)
+              d[y * ncols + x0 + i] = sqrt(columns[i * nrows + y]);
+        }
+      }
+    }
+
+    /*
+      The chamfer distance with steps of 3 to the four and of 4 to the
+      diagonal neighbors (G. Borgefors: Distance transformations in
+      digital images.  Computer Vision, Graphics, and Image Processing
+      34, 1986), in a forward and a backward pass over the rows.
+    */
+    template<class T>
+    void chamfer_distance(const T& src, Grey16ImageView& dest) {
+      const long ncols = src.ncols(), nrows = src.nrows();
+      std::vector<char> black;
+      bool any_white;
+      black_pixels(src, black, any_white);
+      Grey16Pixel* d = &*dest.data()->begin();
+      // the distances are computed as unsigned ints and stored clipped
+      const unsigned int infinity = std::numeric_limits<Grey16Pixel>::max() - 4;
+      if (!any_white) {
+        for (long y = 0; y < nrows; ++y)
+          for (long x = 0; x < ncols; ++x) {
+            long dx = ncols + x, dy = nrows + y;
+            unsigned long dist = 4 * std::min(dx, dy) + 3 * std::abs(dx - dy);
+            d[y * ncols + x] = std::min(dist, (unsigned long)infinity);
+          }
+        return;
+      }
+      for (long y = 0; y < nrows; ++y) {
+        Grey16Pixel* row = d + y * ncols;
+        const Grey16Pixel* above = y > 0 ? row - ncols : row;
+        for (long x = 0; x < ncols; ++x) {
+          if (!black[y * ncols + x]) {
+            row[x] = 0;
+            continue;
+          }
+          unsigned int m = infinity;
+          if (x > 0)
+            m = std::min(m, row[x - 1] + 3);
+          if (y > 0) {
+            m = std::min(m, above[x] + 3);
+            if (x > 0)
+              m = std::min(m, above[x - 1] + 4);
+            if (x + 1 < ncols)
+              m = std::min(m, above[x + 1] + 4);
+          }
+          row[x] = std::min(m, infinity);
+        }
+      }
+      for (long y = nrows - 1; y >= 0; --y) {
+        Grey16Pixel* row = d + y * ncols;
+        const Grey16Pixel* below = y + 1 < nrows ? row + ncols : row;
+        for (long x = ncols - 1; x >= 0; --x) {
+          unsigned int m = row[x];
+          if (m == 0)
+            continue;
+          if (x + 1 < ncols)
+            m = std::min(m, row[x + 1] + 3);
+          if (y + 1 < nrows) {
+            m = std::min(m, below[x] + 3);
+            if (x + 1 < ncols)
+              m = std::min(m, below[x + 1] + 4);
+            if (x > 0)
+              m = std::min(m, below[x - 1] + 4);
+          }
+          row[x] = std::min(m, infinity);
+        }
+      }
+    }
+  }
+
+  /*
+    For all black pixels, the distance to the nearest white pixel.
+    norm is 0 (chessboard), 1 (Manhattan) or 2 (exact Euclidean) for a
+    FLOAT image, or 3 for a GREY16 image of the 3-4 chamfer distance.
+    Other values give the chessboard distance, as vigra does.
+  */
   template<class T>
-  Image* distance_transform(const T& src, int norm) {
+  Image* distance_transform(const T& src, int norm, int threads) {
+    if (norm == 3) {
+      Grey16ImageData* dest_data = new Grey16ImageData(src.size(), src.origin());
+      Grey16ImageView* dest = new Grey16ImageView(*dest_data);
+      DistanceDetail::chamfer_distance(src, *dest);
+      return dest;
+    }
     FloatImageData* dest_data = new FloatImageData(src.size(), src.origin());
     FloatImageView* dest = new FloatImageView(*dest_data);
     
     try {
-      vigra::distanceTransform(src_image_range(src), dest_image(*dest), 0, norm);
+      if (norm == 2)
+        DistanceDetail::euclidean_distance(src, *dest, DistanceDetail::resolve_threads(threads));
+      else
+        vigra::distanceTransform(src_image_range(src), dest_image(*dest), 0, norm);
     } catch (std::exception e) {
       delete dest;
       delete dest_data;
@@ -492,4 +1049,3 @@ namespace Gamera {
   }
 }
 #endif
-
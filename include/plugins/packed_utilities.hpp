@@ -0,0 +1,240 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef gamera_packed_utilities_hpp
+#define gamera_packed_utilities_hpp
+
+#include "gamera.hpp"
+#include <vector>
+
+/*
+  Helpers for word-parallel algorithms on OneBitPackedImageViews.
+
+  A view does not generally start on a word boundary of the underlying
+  data, so rows are first copied into an aligned buffer ("row buffer")
+  in which bit 0 of word 0 is the first column of the view, and the
+  bits past the last column are 0. The algorithms then work on whole
+  words of these buffers, and the results are written back with
+  put_packed_row, which leaves all pixels outside of the view untouched.
+*/
+
+namespace Gamera {
+
+  typedef PackedDataDetail::word_type packed_word;
+  typedef std::vector<packed_word> PackedRow;
+
+  inline size_t packed_row_words(const OneBitPackedImageView& image) {
+    return PackedDataDetail::words_for(image.ncols());
+  }
+
+  inline packed_word packed_tail_mask(size_t ncols) {
+    size_t bits = ncols % PackedDataDetail::WORD_BITS;
+    if (bits == 0)
+      return ~packed_word(0);
+    return (packed_word(1) << bits) - 1;
+  }
+
+  // the number of set bits of w
+  inline size_t packed_popcount(packed_word w) {
+#ifdef __GNUC__
+    return __builtin_popcountl(w);
+#else
+    size_t n = 0;
+    for (; w != 0; w &= w - 1)
+      ++n;
+    return n;
+#endif
+  }
+
+  // the index of the lowest set bit of w, which must not be 0
+  inline size_t packed_lowest_bit(packed_word w) {
+#ifdef __GNUC__
+    return __builtin_ctzl(w);
+#else
+    size_t n = 0;
+    for (; (w & 1) == 0; w >>= 1)
+      ++n;
+    return n;
+#endif
+  }
+
+  // the index of the highest set bit of w, which must not be 0
+  inline size_t packed_highest_bit(packed_word w) {
+#ifdef __GNUC__
+    return PackedDataDetail::WORD_BITS - 1 - __builtin_clzl(w);
+#else
+    size_t n = 0;
+    for (w >>= 1; w != 0; w >>= 1)
+      ++n;
+    return n;
+#endif
+  }
+
+  /*
+    Copies row y of the view into out (which must hold
+    packed_row_words(image) words).
+  */
+  inline void get_packed_row(const OneBitPackedImageView& image, size_t y,
+                             packed_word* out) {
+    const size_t W = PackedDataDetail::WORD_BITS;
+    const OneBitPackedImageData* data = image.data();
+    const packed_word* src =
+      data->row(image.offset_y() - data->page_offset_y() + y);
+    size_t col0 = image.offset_x() - data->page_offset_x();
+    size_t src_words = data->words_per_row();
+    size_t nwords = packed_row_words(image);
+    size_t shift = col0 % W;
+    size_t first = col0 / W;
+    if (shift == 0) {
+      for (size_t i = 0; i < nwords; ++i)
+        out[i] = src[first + i];
+    } else {
+      for (size_t i = 0; i < nwords; ++i) {
+        packed_word w = src[first + i] >> shift;
+        if (first + i + 1 < src_words)
+          w |= src[first + i + 1] << (W - shift);
+        out[i] = w;
+      }
+    }
+    out[nwords - 1] &= packed_tail_mask(image.ncols());
+  }
+
+  /*
+    Writes a row buffer back into row y of the view.
+  */
+  inline void put_packed_row(OneBitPackedImageView& image, size_t y,
+                             const packed_word* in) {
+    const size_t W = PackedDataDetail::WORD_BITS;
+    OneBitPackedImageData* data = image.data();
+    packed_word* dest =
+      data->row(image.offset_y() - data->page_offset_y() + y);
+    size_t col0 = image.offset_x() - data->page_offset_x();
+    size_t ncols = image.ncols();
+    size_t nwords = packed_row_words(image);
+    size_t shift = col0 % W;
+    size_t first = col0 / W;
+    for (size_t i = 0; i < nwords; ++i) {
+      size_t nbits = std::min(W, ncols - i * W);
+      packed_word mask = (nbits == W) ? ~packed_word(0) : ((packed_word(1) << nbits) - 1);
+      packed_word w = in[i] & mask;
+      dest[first + i] = (dest[first + i] & ~(mask << shift)) | (w << shift);
+      if (shift != 0 && nbits > W - shift) {
+        dest[first + i + 1] = (dest[first + i + 1] & ~(mask >> (W - shift)))
+          | (w >> (W - shift));
+      }
+    }
+  }
+
+  /*
+    Sets (black) or clears the bits [from, to) of a row of words.
+  */
+  inline void packed_fill_bits(packed_word* row, size_t from, size_t to,
+                               bool black) {
+    const size_t W = PackedDataDetail::WORD_BITS;
+    while (from < to) {
+      size_t bit = from % W;
+      size_t n = std::min(W - bit, to - from);
+      packed_word mask = (n == W) ? ~packed_word(0)
+        : ((packed_word(1) << n) - 1) << bit;
+      if (black)
+        row[from / W] |= mask;
+      else
+        row[from / W] &= ~mask;
+      from += n;
+    }
+  }
+
+  /*
+    Horizontal 3-pixel dilation (OR over x-1, x, x+1) and erosion
+    (AND over x-1, x, x+1) of a row buffer. Pixels outside of the row
+    count as white, so erosion clears the first and last column.
+  */
+  inline void packed_dilate_row(const packed_word* in, packed_word* out,
+                                size_t nwords, size_t ncols) {
+    const size_t W = PackedDataDetail::WORD_BITS;
+    for (size_t i = 0; i < nwords; ++i) {
+      packed_word w = in[i];
+      packed_word left = w << 1, right = w >> 1;
+      if (i > 0)
+        left |= in[i - 1] >> (W - 1);
+      if (i + 1 < nwords)
+        right |= in[i + 1] << (W - 1);
+      out[i] = w | left | right;
+    }
+    out[nwords - 1] &= packed_tail_mask(ncols);
+  }
+
+  inline void packed_erode_row(const packed_word* in, packed_word* out,
+                               size_t nwords, size_t ncols) {
+    const size_t W = PackedDataDetail::WORD_BITS;
+    for (size_t i = 0; i < nwords; ++i) {
+      packed_word w = in[i];
+      packed_word left = w << 1, right = w >> 1;
+      if (i > 0)
+        left |= in[i - 1] >> (W - 1);
+      if (i + 1 < nwords)
+        right |= in[i + 1] << (W - 1);
+      out[i] = w & left & right;
+    }
+    out[nwords - 1] &= packed_tail_mask(ncols);
+  }
+
+  /*
+    One 3x3 (square) dilation or erosion step from src into dest,
+    which must have the same size. This is equivalent to neighbor9 with
+    the Min/Max functors on OneBit images: pixels outside of the image
+    are considered white.
+  */
+  inline void packed_neighbor9(const OneBitPackedImageView& src,
+                               OneBitPackedImageView& dest, bool dilate) {
+    size_t nrows = src.nrows(), ncols = src.ncols();
+    size_t nwords = packed_row_words(src);
+    // horizontal pass results for rows y - 1, y and y + 1
+    PackedRow row(nwords), above(nwords, 0), current(nwords), below(nwords, 0);
+    PackedRow result(nwords);
+    get_packed_row(src, 0, &row[0]);
+    if (dilate)
+      packed_dilate_row(&row[0], &current[0], nwords, ncols);
+    else
+      packed_erode_row(&row[0], &current[0], nwords, ncols);
+    for (size_t y = 0; y < nrows; ++y) {
+      if (y + 1 < nrows) {
+        get_packed_row(src, y + 1, &row[0]);
+        if (dilate)
+          packed_dilate_row(&row[0], &below[0], nwords, ncols);
+        else
+          packed_erode_row(&row[0], &below[0], nwords, ncols);
+      } else {
+        std::fill(below.begin(), below.end(), packed_word(0));
+      }
+      if (dilate) {
+        for (size_t i = 0; i < nwords; ++i)
+          result[i] = above[i] | current[i] | below[i];
+      } else {
+        for (size_t i = 0; i < nwords; ++i)
+          result[i] = above[i] & current[i] & below[i];
+      }
+      put_packed_row(dest, y, &result[0]);
+      above.swap(current);
+      current.swap(below);
+    }
+  }
+}
+
+#endif
@@ -25,7 +25,9 @@
 
 #include <Python.h>
 #include <map>
+#include <set>
 #include <vector>
+#include <limits>
 #include <iostream>
 #include <algorithm>
 #include <stdexcept>
@@ -60,6 +62,17 @@ int pagesegmentation_median_height(ImageList* ccs) {
   return median(&ccs_heights);
 }
 
+int pagesegmentation_median_height(const CcTable& table) {
+  if (table.size() == 0) {
+    throw std::runtime_error("pagesegmentation_median_height: no CC's found in image.");
+  }
+  vector<int> ccs_heights(table.size());
+  for (size_t i = 0; i < table.size(); ++i) {
+    ccs_heights[i] = int(table.lr_y[i] - table.ul_y[i] + 1);
+  }
+  return median(&ccs_heights);
+}
+
 
 /*****************************************************************************
 * Run Length Smearing
@@ -70,37 +83,117 @@ int pagesegmentation_median_height(ImageList* ccs) {
 *   If you choose "-1" the algorithm will determine the
 *   median character length in the image to obtain the values for Cx,Cy or 
 *   Csm.
+*
+* The smearing works on the runs of black pixels of the rows, which are
+* found only once: short white gaps are closed by merging runs, the
+* vertical gaps are found from the changes between consecutive rows,
+* and the smeared regions are labeled as runs as in cc_analysis.
 ******************************************************************************/
+namespace RlsaDetail {
+  using CcRunDetail::LabelRun;
+
+  typedef unsigned long Word;
+  const size_t word_bits = sizeof(Word) * 8;
+
+  /*
+    Appends the runs[begin, end) of one row to out, merging runs with a
+    white gap of at most C pixels between them. A gap at the beginning
+    of the row is closed as well, but not a gap at its end, because only
+    white runs that end at a black pixel are smeared.
+  */
+  inline void smear_row(const std::vector<LabelRun>& runs, size_t begin,
+                        size_t end, size_t C, std::vector<LabelRun>& out) {
+    for (size_t i = begin; i < end; ++i) {
+      const LabelRun& run = runs[i];
+      if (i == begin) {
+        out.push_back(run);
+        if (run.start <= C)
+          out.back().start = 0;
+      } else if (run.start - out.back().end - 1 <= C) {
+        out.back().end = run.end;
+      } else {
+        out.push_back(run);
+      }
+    }
+  }
+
+  /*
+    Appends the columns in the runs[a, a_end) that are not in the
+    runs[b, b_end) of the same row as (start, end) pairs to diff.
+  */
+  inline void run_difference(const std::vector<LabelRun>& runs,
+                             size_t a, size_t a_end, size_t b, size_t b_end,
+                             std::vector<std::pair<size_t, size_t> >& diff) {
+    for (; a < a_end; ++a) {
+      size_t x = runs[a].start;
+      while (b < b_end && runs[b].end < x)
+        ++b;
+      for (size_t q = b; q < b_end && runs[q].start <= runs[a].end; ++q) {
+        if (runs[q].start > x)
+          diff.push_back(std::make_pair(x, runs[q].start - 1));
+        x = runs[q].end + 1;
+      }
+      if (x <= runs[a].end)
+        diff.push_back(std::make_pair(x, runs[a].end));
+    }
+  }
+
+  inline void set_bits(std::vector<Word>& bits, size_t start, size_t end, bool value) {
+    for (size_t x = start; x <= end; ) {
+      size_t w = x / word_bits, b = x % word_bits;
+      size_t n = std::min(word_bits - b, end - x + 1);
+      Word mask = (n == word_bits) ? ~Word(0) : (((Word(1) << n) - 1) << b);
+      if (value)
+        bits[w] |= mask;
+      else
+        bits[w] &= ~mask;
+      x += n;
+    }
+  }
+
+  /*
+    The first column in [x, end] whose bit is value, or end + 1
+  */
+  inline size_t find_bit(const std::vector<Word>& bits, size_t x, size_t end, bool value) {
+    while (x <= end) {
+      Word word = bits[x / word_bits];
+      if (!value)
+        word = ~word;
+      word >>= x % word_bits;
+      if (word == 0) {
+        // skip the rest of the word
+        x += word_bits - x % word_bits;
+        continue;
+      }
+      for (; !(word & 1); word >>= 1)
+        ++x;
+      return std::min(x, end + 1);
+    }
+    return end + 1;
+  }
+
+  struct Gap {
+    Gap(size_t c, size_t s) : col(c), start(s) { }
+    size_t col, start;
+  };
+}
+
 template<class T>
 ImageList* runlength_smearing(T &image, int Cx, int Cy, int Csm) {
-    typedef OneBitImageView view_type;
-    typedef OneBitImageData data_type;
+    using namespace CcRunDetail;
+    using namespace RlsaDetail;
     typedef typename T::value_type value_type;
+    value_type max_value = std::numeric_limits<value_type>::max();
 
-    data_type* img1_data = new data_type(image.size(), image.origin());
-    view_type* img1 = new view_type(*img1_data);
-    image_copy_fill(image, *img1);
-    
-    data_type* img2_data = new data_type(image.size(), image.origin());
-    view_type* img2 = new view_type(*img2_data);
-    image_copy_fill(image, *img2);
-
-    int Ctemp = 0;
     size_t nrows = image.nrows();
     size_t ncols = image.ncols();
-    size_t x, y;
-    value_type black_val = black(image);
-    value_type white_val = white(image);
+    size_t x, y, i;
 
     // when no values given, guess them from the Cc size statistics
     if (Csm <= 0 || Cy <= 0 || Cx <= 0) {
-      ImageList* ccs_temp = cc_analysis(image);
-      int Median = pagesegmentation_median_height(ccs_temp);
-
-      for (ImageList::iterator i = ccs_temp->begin(); i != ccs_temp->end(); i++) {
-        delete *i;
-      }
-      delete ccs_temp;
+      CcTable table;
+      cc_analysis_table(image, table);
+      int Median = pagesegmentation_median_height(table);
 
       if (Csm <= 0)
         Csm = 3 * Median;
@@ -110,345 +203,568 @@ ImageList* runlength_smearing(T &image, int Cx, int Cy, int Csm) {
         Cx = 20 * Median;
     }
 
-    // horizontal smearing
-    for (y = 0; y < nrows; ++y) {
-      for (x = 0, Ctemp = 0; x < ncols; ++x) {
-        if (is_white(image.get(Point(x, y)))) {
-          Ctemp += 1;
-        } else {
-          if ((0 != Ctemp) && (Ctemp <= Cx)){
-            for (int z = 0; z < Ctemp; z++) {
-              img1->set(Point(x-z-1, y), black_val);
+    // the black runs of the image
+    std::vector<LabelRun> runs;
+    find_runs((const T&)image, 0, nrows, runs);
+    std::vector<size_t> row_begin(nrows + 1, 0);
+    for (i = 0; i < runs.size(); ++i)
+      ++row_begin[runs[i].row + 1];
+    for (y = 0; y < nrows; ++y)
+      row_begin[y + 1] += row_begin[y];
+
+    /*
+      The vertical white gaps of at most Cy pixels that end at a black
+      pixel (gaps at the top border included). A column becomes black
+      or white only where the runs of two consecutive rows differ, and
+      a gap is found in the row where it ends.
+    */
+    std::vector<Gap> gaps;
+    std::vector<size_t> gaps_end(nrows + 1, 0);
+    std::vector<size_t> gap_count(nrows + 1, 0);
+    {
+      std::vector<long> last_black(ncols, -1);
+      std::vector<std::pair<size_t, size_t> > diff;
+      for (y = 0; y < nrows; ++y) {
+        size_t prev = (y == 0) ? 0 : row_begin[y - 1];
+        // columns that become black
+        diff.clear();
+        run_difference(runs, row_begin[y], row_begin[y + 1], prev, row_begin[y], diff);
+        for (i = 0; i < diff.size(); ++i) {
+          for (x = diff[i].first; x <= diff[i].second; ++x) {
+            long length = long(y) - 1 - last_black[x];
+            if (length > 0 && length <= Cy) {
+              gaps.push_back(Gap(x, last_black[x] + 1));
+              ++gap_count[last_black[x] + 2];
             }
           }
-          Ctemp = 0;
-        }
-      }
-    }
-
-    // vertical smearing
-    for (x = 0; x < ncols; ++x) {
-      for (y = 0, Ctemp = 0; y < nrows; ++y) {
-        if (is_white(image.get(Point(x, y)))) {
-          Ctemp += 1;
-        } else {
-          if ((0 != Ctemp) && (Ctemp <= Cy)) {
-            for (int z = 0; z < Ctemp; z++)
-              img2->set(Point(x, y-z-1), black_val);
-          }
-          Ctemp = 0;
         }
+        // columns that become white
+        diff.clear();
+        run_difference(runs, prev, row_begin[y], row_begin[y], row_begin[y + 1], diff);
+        for (i = 0; i < diff.size(); ++i)
+          for (x = diff[i].first; x <= diff[i].second; ++x)
+            last_black[x] = y - 1;
+        gaps_end[y + 1] = gaps.size();
       }
     }
-
-    // logical AND between both images
-    for(y = 0; y < nrows; ++y) {
-      for(x = 0; x < ncols; ++x) {
-        if ((is_black(img1->get(Point(x, y))))
-            && (is_black(img2->get(Point(x, y))))){
-          img1->set(Point(x, y), black_val);
-        } else {
-          img1->set(Point(x, y), white_val);
-        }
-      }
+    // the gaps ordered by their first row
+    for (y = 0; y < nrows; ++y)
+      gap_count[y + 1] += gap_count[y];
+    std::vector<size_t> gaps_by_start(gaps.size());
+    {
+      std::vector<size_t> next(gap_count.begin(), gap_count.end() - 1);
+      for (i = 0; i < gaps.size(); ++i)
+        gaps_by_start[next[gaps[i].start]++] = i;
     }
 
-    // again horizontal smearing for removal of small holes
-    for (y = 0; y < nrows; ++y) {
-      for (x = 0, Ctemp = 0; x < ncols; ++x) {
-        if (is_white(img1->get(Point(x, y)))) {
-          Ctemp += 1;
-        } else {
-          if ((0 != Ctemp) && (Ctemp <= Csm)){
-            for (int z = 0; z < Ctemp; z++)
-              img1->set(Point(x-z-1, y), black_val);
+    /*
+      Row by row, the horizontally smeared runs are intersected with the
+      vertically smeared row, which is kept as bits (the black pixels
+      and the gaps that cover the row), and the result is smeared once
+      more with Csm.
+    */
+    std::vector<LabelRun> smeared;
+    {
+      std::vector<Word> vbits((ncols + word_bits - 1) / word_bits, 0);
+      std::vector<LabelRun> hruns, andruns;
+      for (y = 0; y < nrows; ++y) {
+        for (i = gaps_end[y]; i < gaps_end[y + 1]; ++i)
+          set_bits(vbits, gaps[i].col, gaps[i].col, false);
+        for (i = gap_count[y]; i < gap_count[y + 1]; ++i)
+          set_bits(vbits, gaps[gaps_by_start[i]].col, gaps[gaps_by_start[i]].col, true);
+        for (i = row_begin[y]; i < row_begin[y + 1]; ++i)
+          set_bits(vbits, runs[i].start, runs[i].end, true);
+
+        hruns.clear();
+        smear_row(runs, row_begin[y], row_begin[y + 1], size_t(Cx), hruns);
+        andruns.clear();
+        for (i = 0; i < hruns.size(); ++i) {
+          x = hruns[i].start;
+          while (true) {
+            x = find_bit(vbits, x, hruns[i].end, true);
+            if (x > hruns[i].end)
+              break;
+            size_t start = x;
+            x = find_bit(vbits, x, hruns[i].end, false);
+            andruns.push_back(LabelRun(y, start, x - 1, 0));
           }
-          Ctemp = 0;
         }
-      }
-    }
+        smear_row(andruns, 0, andruns.size(), size_t(Csm), smeared);
 
-    ImageList* ccs_AND = cc_analysis(*img1);
-    ImageList* return_ccs = new ImageList();
-
-    // create result Cc's 
-    ImageList::iterator i;
-    for (i = ccs_AND->begin(); i != ccs_AND->end(); ++i) {  
-      Cc* cc = dynamic_cast<Cc*>(*i);
-      int label = cc->label();
-      bool containspixel = false; // some segments may not contain black pixels
-
-      // Methods "get" and "set" operates relative to the image view
-      // but the offset of the connected components is not relative
-      // to the view. (here: (*i)->offset_x() and (*i)->offset_y())
-      //
-      // This means that these values must be adjusted for labeling
-      // the image view.
-      for (y = 0; y < cc->nrows(); ++y) {
-        for (x = 0; x < cc->ncols(); ++x) {
-          if ( is_black(image.get(Point(x+(*i)->offset_x()-image.offset_x(),
-                                        y+(*i)->offset_y()-image.offset_y())))
-              && is_black(cc->get(Point(x,y))) ) {
-            image.set(Point(x + cc->offset_x() - image.offset_x(),
-                            y + cc->offset_y() - image.offset_y()), label);
-            containspixel = true;
-          }
-        }
+        for (i = row_begin[y]; i < row_begin[y + 1]; ++i)
+          set_bits(vbits, runs[i].start, runs[i].end, false);
       }
+    }
 
-      // create new CC with the dimensions, offset and label from the
-      // smeared image, pointing to the original image.
-      if (containspixel) {
-        return_ccs->push_back(new ConnectedComponent<data_type>(
-                *((data_type*)image.data()),                // Data
-                label,                                      // Label
-                Point((*i)->offset_x(), (*i)->offset_y()),  // Point
-                (*i)->dim())                                // Dim
-                );
-      }
+    // label the smeared regions like cc_analysis does
+    LabelSets sets;
+    sets.add();
+    sets.add();
+    connect_runs(smeared, sets);
+    for (i = 0; i < smeared.size(); ++i)
+      smeared[i].label = sets.find(smeared[i].label);
+    std::vector<Rect> rects;
+    std::vector<bool> found;
+    std::vector<size_t> label;
+    run_bounding_boxes(smeared, sets.size(), rects, found);
+
+    /*
+      Every black pixel gets the label of the smeared region containing
+      it. Regions that do not contain any black pixel (some segments
+      may not) are dropped.
+    */
+    std::vector<size_t> region(runs.size());
+    std::vector<bool> containspixel(rects.size(), false);
+    size_t s = 0;
+    for (i = 0; i < runs.size(); ++i) {
+      while (smeared[s].row < runs[i].row
+             || (smeared[s].row == runs[i].row && smeared[s].end < runs[i].start))
+        ++s;
+      region[i] = s;
+      containspixel[smeared[s].label] = true;
     }
-    
-    // clean up
-    for (ImageList::iterator i=ccs_AND->begin(); i!=ccs_AND->end(); i++)
-      delete *i;
-    delete ccs_AND;
-    delete img1->data();
-    delete img1;
-    delete img2->data();
-    delete img2;
-
-    return return_ccs;
+    if (sets.size() > size_t(max_value))
+      recycle_labels(smeared, rects, found, max_value - 1, label);
+    for (i = 0; i < runs.size(); ++i)
+      runs[i].label = smeared[region[i]].label;
+    for (i = 0; i < found.size(); ++i)
+      found[i] = found[i] && containspixel[i];
+    write_run_labels(image, runs, 0, runs.size());
+    return ccs_from_rects(image, rects, found, label);
 }
 
 
 /*-------------------------------------------------------------------------
  * Functions for projection_cutting:
- * Interne_RXY_Cut(image, Tx, Ty, ccs, noise, label):recursively splits 
- * the image, sets the label and creates the CCs.
- * Start_point(image, ul, lr):search the upper_left point of the sub-image.
- * End_point(image,ul,lr):search the lower_right point of the sub-image.
- * Split_point:searchs the split point of the image
- * rxy_cut(image,Tx,Ty,noise,label):returns the ccs-list
+ * LayoutBits: which pixels of the page are black, one bit per pixel.
+ * ProjectionIndex: summed black pixel counts of a region of the page,
+ * from which the projections of all sub-regions are computed.
+ * proj_cut_Split_Point: searchs the split points in a projection.
+ * LayoutTree: the tree of the recursive cuts, which can be updated after
+ * local changes of the page.
+ * projection_cutting(image,Tx,Ty,noise,gap_treatment): returns the
+ * ccs-list
  *-------------------------------------------------------------------------*/
 
 
-/* Function: Start_Point
- * This funktion is used to search the first black pixel:
- * calculates the coordinates of the begin of the cc
- * returns the coordinates of the upper-left point of subimage
+/* Class: LayoutBits
+ * A copy of the black pixels of the page. The layout tree keeps it to
+ * find out which pixels were changed.
  */
+class LayoutBits {
+public:
+    typedef unsigned long word_type;
+    enum { WORD_BITS = sizeof(word_type) * 8 };
+
+    template<class T>
+    LayoutBits(const T& image) {
+        m_ncols = image.ncols();
+        m_nrows = image.nrows();
+        m_words = (m_ncols + WORD_BITS - 1) / WORD_BITS;
+        m_bits.assign(m_words * m_nrows, 0);
+        typename T::const_row_iterator row = image.row_begin();
+        for (size_t y = 0; y < m_nrows; ++y, ++row) {
+            typename T::const_col_iterator col = row.begin();
+            for (size_t x = 0; x < m_ncols; ++x, ++col)
+                if (is_black(*col))
+                    set(x, y, true);
+        }
+    }
 
+    size_t ncols() const { return m_ncols; }
+    size_t nrows() const { return m_nrows; }
 
-
-template<class T>
-Point proj_cut_Start_Point(T& image, Point ul, Point lr) {
-    Point Start;
-
-    for (size_t y = ul.y(); y <= lr.y(); y++) {
-    for (size_t x = ul.x(); x <= lr.x(); x++) {
-        if ((image.get(Point(x, y))) != 0) {
-            Start.x(x);
-            Start.y(y);
-            goto endLoop1; // unfortunately there is no break(2) in gorgeous C++
-        }
+    bool get(size_t x, size_t y) const {
+        return (m_bits[y * m_words + x / WORD_BITS] >> (x % WORD_BITS)) & 1;
     }
-    } 
-    endLoop1:
 
-    for (size_t x = ul.x(); x <= lr.x(); x++) {
-    for (size_t y = ul.y(); y <= lr.y(); y++) {
-        if ((image.get(Point(x, y))) != 0) {
-            if (Start.x() > x)
-                Start.x(x);
-            goto endLoop2; // unfortunately there is no break(2) in gorgeous C++
-            }
-        }
+    void set(size_t x, size_t y, bool black) {
+        word_type& w = m_bits[y * m_words + x / WORD_BITS];
+        word_type bit = word_type(1) << (x % WORD_BITS);
+        if (black)
+            w |= bit;
+        else
+            w &= ~bit;
     }
-    endLoop2:
-    return Start;
-}
 
-/* Function: End_Point
- * This funktion is used to search the last black pixel:the lower-right point
- * of subimage calculates the coordinates of the end of the CC.
- */
-template<class T>
-Point proj_cut_End_Point(T& image, Point ul, Point lr) {
-    Point End;
-    size_t x, y;
+private:
+    size_t m_ncols, m_nrows, m_words;
+    std::vector<word_type> m_bits;
+};
+
 
-    for (y = lr.y(); y+1 >= ul.y()+1; y--) {
-        for (x = lr.x(); x+1 >= ul.x()+1; x--) {
-            if ((image.get(Point(x, y))) != 0) {
-                End.x(x);
-                End.y(y);
-                goto endLoop1;
+/* Class: ProjectionIndex
+ * Summed area table of the black pixels in the region [ul,lr] of the
+ * page: entry (x,y) is the number of black pixels of the region above and
+ * left of (x,y). It is built once per (re)cut region, so that the
+ * recursion never looks at the pixels again: the number of black pixels
+ * in a rectangle takes four lookups, and the projections of a sub-region
+ * are one row or one column rectangles.
+ * The coordinates are those of the page.
+ */
+class ProjectionIndex {
+public:
+    ProjectionIndex(const LayoutBits& bits, Point ul, Point lr) {
+        m_x0 = ul.x();
+        m_y0 = ul.y();
+        size_t nrows = lr.y() - ul.y() + 1;
+        m_stride = lr.x() - ul.x() + 2;
+        m_sum.assign((nrows + 1) * m_stride, 0);
+        for (size_t y = 0; y < nrows; ++y) {
+            unsigned int* above = &m_sum[y * m_stride];
+            unsigned int* sum = above + m_stride;
+            unsigned int rowcount = 0;
+            for (size_t x = 1; x < m_stride; ++x) {
+                if (bits.get(m_x0 + x - 1, m_y0 + y))
+                    ++rowcount;
+                sum[x] = above[x] + rowcount;
             }
         }
     }
-    endLoop1:
-    
-    for (x = lr.x(); x+1 > ul.x()+1; x--) {
-        for (y = lr.y(); y+1 > ul.y()+1; y--) {
-            if ((image.get(Point(x,y))) != 0){
-                if (End.x()<x)
-                    End.x(x);
-                goto endLoop2;
-            }
-        }
+
+    // number of black pixels in [x0,x1] x [y0,y1]
+    size_t count(size_t x0, size_t y0, size_t x1, size_t y1) const {
+        x0 -= m_x0; x1 -= m_x0; y0 -= m_y0; y1 -= m_y0;
+        const unsigned int* top = &m_sum[y0 * m_stride];
+        const unsigned int* bottom = &m_sum[(y1 + 1) * m_stride];
+        return bottom[x1 + 1] - top[x1 + 1] - bottom[x0] + top[x0];
     }
-    endLoop2:
 
-    return End;
-}
+private:
+    size_t m_x0, m_y0, m_stride;
+    std::vector<unsigned int> m_sum;
+};
+
 
 /* Function: Split_Point
  * calculates the coordinates of the split_point.
- * The split point is determined
- * by finding the largest possible gaps in the X and Y projection of the image.
+ * The split point is determined by finding the largest possible gaps in
+ * the projection between begin and end, where projection[i - offset] is
+ * the projection value at coordinate i.
  */
-template<class T>
-IntVector * proj_cut_Split_Point(T& image, Point ul, Point lr, int Tx, int Ty, int noise, int gap_treatment, char direction ) {
-    IntVector * SplitPoints = new IntVector(); //empty IntVector
-    size_t size;
-    lr.x()-ul.x()>lr.y()-ul.y()?size=lr.x()-ul.x():size=lr.y()-ul.y();
-
-    int SplitPoints_Min[size]; // probably no need for such big mem-alloc, but necessary in certain situations
-    int SplitPoints_Max[size]; 
+inline void proj_cut_Split_Point(const std::vector<unsigned int>& projection, size_t offset,
+                                 size_t begin, size_t end, int min_gap, int noise,
+                                 int gap_treatment, IntVector& SplitPoints) {
+    IntVector SplitPoints_Min, SplitPoints_Max;
     int gap_width = 0; // width of the gap
-    int gap_counter = 0; //number of gaps
-
-    if (direction == 'x'){
-        // Correct Points for Rect() with offset
-        Point a( ul.x() + image.offset_x(), ul.y() + image.offset_y() );
-        Point b( lr.x() + image.offset_x(), lr.y() + image.offset_y() );
-        IntVector *proj_x = projection_rows(image, Rect(a, b));
-        SplitPoints->push_back(ul.y()); // starting point
-        
-        for (size_t i = 1; i < proj_x->size(); i++) {
-            if ((*proj_x)[i] <= noise) {
-                gap_width++;
-                if (Ty <= gap_width) {// min-gap <= act-gap?
-                SplitPoints_Min[gap_counter] = (i + ul.y() - gap_width+1);
-                SplitPoints_Max[gap_counter] = (i + ul.y()); // finally set to last point of gap
-                }
-            } 
-            else {
-                if (Ty <= gap_width)
-                    gap_counter++;
-                gap_width = 0;
+    int gap_min = 0, gap_max = 0;
+
+    SplitPoints.clear();
+    SplitPoints.push_back(begin); // starting point
+
+    for (size_t i = begin + 1; i <= end; i++) {
+        if (projection[i - offset] <= size_t(noise)) {
+            gap_width++;
+            if (min_gap <= gap_width) {// min-gap <= act-gap?
+                gap_min = i - gap_width + 1;
+                gap_max = i; // finally set to last point of gap
             }
-        }
-    delete proj_x;
-    }
-    else{ // y-direction
-        // Correct Points for Rect() with offset
-        Point a( ul.x() + image.offset_x(), ul.y() + image.offset_y() );
-        Point b( lr.x() + image.offset_x(), lr.y() + image.offset_y() );
-        IntVector *proj_y = projection_cols(image, Rect(a, b));
-        SplitPoints->push_back(ul.x()); // starting point
-        
-        for (size_t i = 1; i < proj_y->size(); i++) {
-            if ((*proj_y)[i] <= noise) {
-                gap_width++;
-                if (Tx <= gap_width) {// min-gap <= act-gap?
-                SplitPoints_Min[gap_counter] = (i + ul.x() - gap_width+1);
-                SplitPoints_Max[gap_counter] = (i + ul.x()); // finally set to last point of gap
-                }
-            } 
-            else {
-                if (Tx <= gap_width) 
-                    gap_counter++;
-                gap_width = 0;
+        } 
+        else {
+            if (min_gap <= gap_width) {
+                SplitPoints_Min.push_back(gap_min);
+                SplitPoints_Max.push_back(gap_max);
             }
+            gap_width = 0;
         }
-        delete proj_y;
     }
     
-    for (int i=0; i<gap_counter; i++){
+    for (size_t i=0; i<SplitPoints_Min.size(); i++){
         if (0==gap_treatment){ // cut exactly in the middle of the gap -> no unlabeled noise pixels
             int mid = (SplitPoints_Min[i] + SplitPoints_Max[i]) / 2;
             SplitPoints_Min[i] = mid;
             SplitPoints_Max[i] = mid;
         }
-        SplitPoints->push_back(SplitPoints_Min[i]);
-        SplitPoints->push_back(SplitPoints_Max[i]);
+        SplitPoints.push_back(SplitPoints_Min[i]);
+        SplitPoints.push_back(SplitPoints_Max[i]);
     }   
-    direction=='x'? SplitPoints->push_back(lr.y()): SplitPoints->push_back(lr.x()); // ending point
-    
-    return SplitPoints;
+    SplitPoints.push_back(end); // ending point
 }
 
 
+/* Struct: LayoutNode
+ * One step of the recursive cutting: the region that the parent cut out
+ * (the whole page for the root), the bounding box of its black pixels,
+ * the direction in which it is cut ('x' for the gaps between rows, 'y'
+ * for those between columns) and the split points of the cut. The
+ * children are the parts between the split points, in reading order.
+ * A node in direction 'y' without gaps is a leaf, that is a segment.
+ *
+ * The node keeps the projections of its region on the rows and on the
+ * columns, from which its bounding box and split points are computed, so
+ * that changed pixels only need to be added to them.
+ */
+struct LayoutNode {
+    Point region_ul, region_lr;
+    Point ul, lr;
+    char direction;
+    IntVector splits;
+    std::vector<unsigned int> rows, cols;
+    // the label of a segment, 0 for the inner nodes
+    int label;
+    std::vector<LayoutNode*> children;
+
+    LayoutNode(Point rul, Point rlr, char d)
+        : region_ul(rul), region_lr(rlr), direction(d), label(0) {}
+
+    ~LayoutNode() {
+        for (size_t i = 0; i < children.size(); ++i)
+            delete children[i];
+    }
+
+    bool is_leaf() const {
+        return direction == 'y' && splits.size() == 2;
+    }
+};
+
+// a pixel that turned black (delta 1) or white (delta -1)
+struct LayoutChange {
+    size_t x, y;
+    int delta;
+};
 
-/* Function: Interne_RXY_Cut
- * This function recursively splits the image in horizontal or 
- * vertical direction.
- * The original image will have all of its pixels "labeled" with a number
- * representing each connected component.
+/* Class: LayoutTree
+ * The cut tree of projection_cutting. After pixels of the page were
+ * changed, update() adds the changes to the projections of the nodes
+ * whose regions contain them, from the root down. A node whose bounding
+ * box and split points come out the same keeps its children, of which
+ * only those containing changes are visited; the subtree of any other
+ * node is cut anew from its region. The work is thus proportional to the
+ * changed area and to the regions whose cuts change, rather than to the
+ * page.
+ * The segments (leaves) are numbered by increasing labels as they are
+ * cut, starting with 2 as projection_cutting always did.
  */
-template<class T>
-void projection_cutting_intern(T& image, Point ul, Point lr, ImageList* ccs, 
-        int Tx, int Ty, int noise, int gap_treatment, char direction, int& label) {
-    
-    Point Start = proj_cut_Start_Point(image, ul, lr);
-    Point End = proj_cut_End_Point(image, ul, lr);
-    IntVector * SplitPoints = proj_cut_Split_Point(image, Start, End, Tx, Ty, noise, gap_treatment, direction);
-    IntVector::iterator It;
-    
-    ul.x(Start.x());
-    ul.y(Start.y());
-    lr.x(End.x());
-    lr.y(End.y());
-    
-        
+class LayoutTree {
+public:
+    LayoutTree(const LayoutBits& bits, int Tx, int Ty, int noise, int gap_treatment)
+        : m_bits(bits), m_Tx(Tx), m_Ty(Ty), m_noise(noise),
+          m_gap_treatment(gap_treatment), m_label(1) {
+        Point lr(m_bits.ncols() - 1, m_bits.nrows() - 1);
+        m_root = new LayoutNode(Point(0, 0), lr, 'x');
+        cut(m_root);
+    }
 
-    if (!(direction=='y' && SplitPoints->size() == 2)){ // ending condition, SplitPoints==2 => only Start- and Endpoint no gaps
-        if (direction=='x'){
-            direction = 'y';
-            for(It = SplitPoints->begin(); It != SplitPoints->end(); It++){
-                Point begin, end; // note the lowercase of end, which is not End
-                begin.x(Start.x());
-                begin.y(*It);
-                It++;
-                end.x(End.x());
-                end.y(*It);
-                projection_cutting_intern(image, begin, end, ccs, Tx, Ty, noise, gap_treatment, direction, label);
+    ~LayoutTree() {
+        delete m_root;
+    }
+
+    const LayoutNode* root() const { return m_root; }
+
+    /* Compares the rectangle [ul,lr] of the image with the copy of its
+     * black pixels and updates the tree. The segments that were cut anew
+     * or have new pixels are appended to dirty.
+     */
+    template<class T>
+    void update(const T& image, Point ul, Point lr, std::vector<LayoutNode*>& dirty) {
+        if (image.ncols() != m_bits.ncols() || image.nrows() != m_bits.nrows())
+            throw std::runtime_error("The image is not the size of the layout tree.");
+        std::vector<LayoutChange> changes;
+        typename T::const_row_iterator row = image.row_begin() + ul.y();
+        for (size_t y = ul.y(); y <= lr.y(); ++y, ++row) {
+            typename T::const_col_iterator col = row.begin() + ul.x();
+            for (size_t x = ul.x(); x <= lr.x(); ++x, ++col) {
+                bool black = is_black(*col);
+                if (black != m_bits.get(x, y)) {
+                    LayoutChange change = { x, y, black ? 1 : -1 };
+                    changes.push_back(change);
+                    m_bits.set(x, y, black);
+                }
             }
         }
-        else { // direction==y
-            direction = 'x';
-            for(It = SplitPoints->begin(); It != SplitPoints->end(); ++It){
-                Point begin, end; // note the lowercase of end, which is not End
-                begin.x(*It);
-                begin.y(Start.y());
-                It++;
-                end.x(*It);
-                end.y(End.y());
-                projection_cutting_intern(image, begin, end, ccs, Tx, Ty, noise, gap_treatment, direction, label);
+        if (!changes.empty())
+            update(m_root, changes, dirty);
+    }
+
+private:
+    // bounding box and split points from the projections
+    void geometry(LayoutNode* node) const {
+        size_t x0 = node->region_ul.x(), y0 = node->region_ul.y();
+        size_t top = 0, bottom = node->rows.size(), left = 0, right = node->cols.size();
+        while (top < bottom && node->rows[top] == 0) ++top;
+        while (bottom > top && node->rows[bottom - 1] == 0) --bottom;
+        while (left < right && node->cols[left] == 0) ++left;
+        while (right > left && node->cols[right - 1] == 0) --right;
+        if (top == bottom) {
+            // an empty region is treated like a single white pixel at
+            // its origin
+            node->ul = node->lr = node->region_ul;
+        } else {
+            node->ul = Point(x0 + left, y0 + top);
+            node->lr = Point(x0 + right - 1, y0 + bottom - 1);
+        }
+        if (node->direction == 'x')
+            proj_cut_Split_Point(node->rows, y0, node->ul.y(), node->lr.y(),
+                                 m_Ty, m_noise, m_gap_treatment, node->splits);
+        else
+            proj_cut_Split_Point(node->cols, x0, node->ul.x(), node->lr.x(),
+                                 m_Tx, m_noise, m_gap_treatment, node->splits);
+    }
+
+    // the children of node between its split points
+    void add_children(LayoutNode* node) const {
+        const IntVector& splits = node->splits;
+        for (size_t i = 0; i + 1 < splits.size(); i += 2) {
+            if (node->direction == 'x')
+                node->children.push_back
+                    (new LayoutNode(Point(node->ul.x(), splits[i]),
+                                    Point(node->lr.x(), splits[i + 1]), 'y'));
+            else
+                node->children.push_back
+                    (new LayoutNode(Point(splits[i], node->ul.y()),
+                                    Point(splits[i + 1], node->lr.y()), 'x'));
+        }
+    }
+
+    void cut(LayoutNode* node, const ProjectionIndex& index) {
+        size_t x0 = node->region_ul.x(), y0 = node->region_ul.y();
+        size_t x1 = node->region_lr.x(), y1 = node->region_lr.y();
+        node->rows.resize(y1 - y0 + 1);
+        node->cols.resize(x1 - x0 + 1);
+        for (size_t y = y0; y <= y1; ++y)
+            node->rows[y - y0] = index.count(x0, y, x1, y);
+        for (size_t x = x0; x <= x1; ++x)
+            node->cols[x - x0] = index.count(x, y0, x, y1);
+        geometry(node);
+        if (node->is_leaf()) {
+            node->label = ++m_label;
+            return;
+        }
+        add_children(node);
+        for (size_t i = 0; i < node->children.size(); ++i)
+            cut(node->children[i], index);
+    }
+
+    // cuts the region of node anew
+    void cut(LayoutNode* node) {
+        for (size_t i = 0; i < node->children.size(); ++i)
+            delete node->children[i];
+        node->children.clear();
+        node->label = 0;
+        ProjectionIndex index(m_bits, node->region_ul, node->region_lr);
+        cut(node, index);
+    }
+
+    static void leaves(LayoutNode* node, std::vector<LayoutNode*>& out) {
+        if (node->label != 0)
+            out.push_back(node);
+        for (size_t i = 0; i < node->children.size(); ++i)
+            leaves(node->children[i], out);
+    }
+
+    void update(LayoutNode* node, const std::vector<LayoutChange>& changes,
+                std::vector<LayoutNode*>& dirty) {
+        size_t x0 = node->region_ul.x(), y0 = node->region_ul.y();
+        for (size_t i = 0; i < changes.size(); ++i) {
+            node->rows[changes[i].y - y0] += changes[i].delta;
+            node->cols[changes[i].x - x0] += changes[i].delta;
+        }
+        Point ul = node->ul, lr = node->lr;
+        IntVector splits = node->splits;
+        geometry(node);
+        if (!(node->ul == ul && node->lr == lr && node->splits == splits)) {
+            cut(node);
+            leaves(node, dirty);
+            return;
+        }
+        if (node->label != 0) {
+            dirty.push_back(node);
+            return;
+        }
+        std::vector<LayoutChange> inside;
+        for (size_t c = 0; c < node->children.size(); ++c) {
+            LayoutNode* child = node->children[c];
+            inside.clear();
+            for (size_t i = 0; i < changes.size(); ++i) {
+                const LayoutChange& change = changes[i];
+                if (change.x >= child->region_ul.x() && change.x <= child->region_lr.x() &&
+                    change.y >= child->region_ul.y() && change.y <= child->region_lr.y())
+                    inside.push_back(change);
             }
+            if (!inside.empty())
+                update(child, inside, dirty);
         }
-    } else {
-        label++;
-        for (size_t y = ul.y(); y <= lr.y(); y++) {
-            for (size_t x = ul.x(); x <= lr.x(); x++) {
-                if((image.get(Point(x, y))) != 0){
-                    image.set(Point(x, y), label);
-                }
+    }
+
+    LayoutBits m_bits;
+    int m_Tx, m_Ty, m_noise, m_gap_treatment;
+    int m_label;
+    LayoutNode* m_root;
+};
+
+
+/* Sets all black pixels in [ul,lr] to label. */
+template<class T>
+void layout_label(T& image, Point ul, Point lr, int label) {
+    ImageAccessor<typename T::value_type> acc;
+    typename T::row_iterator row = image.row_begin() + ul.y();
+    for (size_t y = ul.y(); y <= lr.y(); y++, ++row) {
+        typename T::col_iterator col = row.begin() + ul.x();
+        for (size_t x = ul.x(); x <= lr.x(); x++, ++col) {
+            if (acc(col) != 0) {
+                acc.set(label, col);
             }
         }
+    }
+}
+
+template<class T>
+void layout_label_segment(T& image, const LayoutNode* node) {
+    layout_label(image, node->ul, node->lr, node->label);
+}
+
+/* Labels the black pixels of the segment that lie in [ul,lr]. */
+template<class T>
+void layout_label_overlap(T& image, Point ul, Point lr, const LayoutNode* node) {
+    Point a(std::max(ul.x(), node->ul.x()), std::max(ul.y(), node->ul.y()));
+    Point b(std::min(lr.x(), node->lr.x()), std::min(lr.y(), node->lr.y()));
+    if (a.x() <= b.x() && a.y() <= b.y())
+        layout_label(image, a, b, node->label);
+}
+
+inline void layout_segments(const LayoutNode* node, std::vector<const LayoutNode*>& out) {
+    if (node->label != 0)
+        out.push_back(node);
+    for (size_t i = 0; i < node->children.size(); ++i)
+        layout_segments(node->children[i], out);
+}
 
-        Point cc(Start.x() + image.offset_x(), Start.y() + image.offset_y());
+// the segments as ccs in reading order (see projection_cutting)
+template<class T>
+ImageList* layout_segment_ccs(T& image, const LayoutTree& tree) {
+    std::vector<const LayoutNode*> segments;
+    layout_segments(tree.root(), segments);
+    ImageList* ccs = new ImageList();
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const LayoutNode* node = segments[i];
+        Point cc(node->ul.x() + image.offset_x(), node->ul.y() + image.offset_y());
         ccs->push_back(
                 new ConnectedComponent<typename T::data_type>(
                     *((typename T::data_type*)image.data()),
-                    OneBitPixel(label),
+                    OneBitPixel(node->label),
                     cc,
-                    Dim((End.x() - Start.x() + 1), (End.y() - Start.y() + 1))
+                    Dim((node->lr.x() - node->ul.x() + 1), (node->lr.y() - node->ul.y() + 1))
                 )
             );
     }
-    delete SplitPoints;
+    return ccs;
+}
+
+// the default gap widths of projection_cutting
+template<class T>
+void projection_cutting_defaults(T& image, int& Tx, int& Ty) {
+    if (Tx < 1 || Ty < 1) {
+        CcTable table;
+        cc_analysis_table(image, table);
+        int Median = pagesegmentation_median_height(table);
+        if (Tx < 1) {
+          Tx = Median * 7;
+        }
+        if (Ty < 1) {
+          if (Median > 1) Ty = Median / 2;
+          else Ty = 1;
+        }
+    }
 }
 
 /*
@@ -457,54 +773,118 @@ void projection_cutting_intern(T& image, Point ul, Point lr, ImageList* ccs,
  */
 template<class T>
 ImageList* projection_cutting(T& image, int Tx, int Ty, int noise, int gap_treatment) {
-    int Label = 1;
-    char direction = 'x';
-
     if (noise < 0) {
         noise = 0;
     }
+    projection_cutting_defaults(image, Tx, Ty);
+    LayoutTree tree(LayoutBits(image), Tx, Ty, noise, gap_treatment);
+    // labeling does not change which pixels are black
+    std::vector<const LayoutNode*> segments;
+    layout_segments(tree.root(), segments);
+    for (size_t i = 0; i < segments.size(); ++i)
+        layout_label_segment(image, segments[i]);
+    return layout_segment_ccs(image, tree);
+}
 
-    // set default values
-    if (Tx < 1 || Ty < 1) {
-        ImageList* ccs_temp = cc_analysis(image);
-        int Median = pagesegmentation_median_height(ccs_temp);
-        for (ImageList::iterator i = ccs_temp->begin(); 
-                i != ccs_temp->end(); i++) {
-            delete *i;
-        }
-        delete ccs_temp;
-        if (Tx < 1) {
-          Tx = Median * 7;
-        }
-        if (Ty < 1) {
-          if (Median > 1) Ty = Median / 2;
-          else Ty = 1;
-        }
+
+/*
+ * The layout tree is handed to Python in a PyCObject, which deletes it
+ * with the Python object.
+ */
+inline void layout_tree_delete(void* tree, void*) {
+    delete (LayoutTree*)tree;
+}
+
+// tells layout trees from other PyCObjects
+inline void* layout_tree_desc() {
+    static char desc;
+    return &desc;
+}
+
+inline LayoutTree* layout_tree_from_python(PyObject* tree) {
+    if (!PyCObject_Check(tree) || PyCObject_GetDesc(tree) != layout_tree_desc())
+        throw std::runtime_error("The argument is not a layout tree.");
+    return (LayoutTree*)PyCObject_AsVoidPtr(tree);
+}
+
+template<class T>
+PyObject* _layout_tree(T& image, int Tx, int Ty, int noise, int gap_treatment) {
+    if (noise < 0) {
+        noise = 0;
     }
-    // set minimal gap_width
-    /*if (Tx <= 2){
-        if (gap_treatment)
-            Tx=2;
-        else
-            Tx=3;
+    projection_cutting_defaults(image, Tx, Ty);
+    LayoutTree* tree = new LayoutTree(LayoutBits(image), Tx, Ty, noise, gap_treatment);
+    std::vector<const LayoutNode*> segments;
+    layout_segments(tree->root(), segments);
+    for (size_t i = 0; i < segments.size(); ++i)
+        layout_label_segment(image, segments[i]);
+    return PyCObject_FromVoidPtrAndDesc((void*)tree, layout_tree_desc(),
+                                        layout_tree_delete);
+}
+
+template<class T>
+void _layout_tree_update(T& image, PyObject* tree_object, Rect* rect) {
+    LayoutTree* tree = layout_tree_from_python(tree_object);
+    // the rectangle in the coordinates of the view, clipped to it
+    long x0 = std::max(long(rect->ul_x()), long(image.ul_x())) - long(image.ul_x());
+    long y0 = std::max(long(rect->ul_y()), long(image.ul_y())) - long(image.ul_y());
+    long x1 = std::min(long(rect->lr_x()), long(image.lr_x())) - long(image.ul_x());
+    long y1 = std::min(long(rect->lr_y()), long(image.lr_y())) - long(image.ul_y());
+    if (x0 > x1 || y0 > y1)
+        return;
+    std::vector<LayoutNode*> dirty;
+    tree->update(image, Point(x0, y0), Point(x1, y1), dirty);
+    /* The segments cut at the middle of a gap share the cut line, whose
+     * pixels get the label of the later segment as in projection_cutting.
+     * So the later segments overlapping a relabeled one are labeled again
+     * where they overlap.  The black pixels redrawn in the rectangle do
+     * not change the layout, but lost their label.
+     */
+    std::set<const LayoutNode*> relabel(dirty.begin(), dirty.end());
+    std::vector<const LayoutNode*> segments;
+    layout_segments(tree->root(), segments);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const LayoutNode* node = segments[i];
+        if (relabel.find(node) == relabel.end())
+            continue;
+        layout_label_segment(image, node);
+        for (size_t j = i + 1; j < segments.size(); ++j)
+            layout_label_overlap(image, node->ul, node->lr, segments[j]);
     }
-    if (Ty <= 2){
-        if (gap_treatment)
-            Ty=2;
-        else
-            Ty=3;
-    }*/
+    for (size_t i = 0; i < segments.size(); ++i)
+        layout_label_overlap(image, Point(x0, y0), Point(x1, y1), segments[i]);
+}
 
-    ImageList* ccs = new ImageList();
-    Point ul, lr;
+template<class T>
+ImageList* _layout_tree_segments(T& image, PyObject* tree_object) {
+    return layout_segment_ccs(image, *layout_tree_from_python(tree_object));
+}
 
-    ul.x(0);
-    ul.y(0);
-    lr.x(image.ncols() - 1);
-    lr.y(image.nrows() - 1);
-    projection_cutting_intern(image, ul, lr, ccs, Tx, Ty, noise, gap_treatment, direction, Label);
-    
-    return ccs;
+/*
+ * The nodes in preorder, as tuples (region, bbox, direction, splits,
+ * label, number of children), with the coordinates relative to the image.
+ */
+inline PyObject* _layout_tree_nodes(PyObject* tree_object) {
+    const LayoutTree* tree = layout_tree_from_python(tree_object);
+    PyObject* list = PyList_New(0);
+    std::vector<const LayoutNode*> stack(1, tree->root());
+    while (!stack.empty()) {
+        const LayoutNode* node = stack.back();
+        stack.pop_back();
+        PyObject* splits = PyList_New(node->splits.size());
+        for (size_t i = 0; i < node->splits.size(); ++i)
+            PyList_SET_ITEM(splits, i, PyInt_FromLong(node->splits[i]));
+        PyObject* item = Py_BuildValue(CHAR_PTR_CAST "((iiii)(iiii)cNii)",
+            int(node->region_ul.x()), int(node->region_ul.y()),
+            int(node->region_lr.x()), int(node->region_lr.y()),
+            int(node->ul.x()), int(node->ul.y()), int(node->lr.x()), int(node->lr.y()),
+            node->direction, splits, node->label, int(node->children.size()));
+        PyList_Append(list, item);
+        Py_DECREF(item);
+        for (size_t i = node->children.size(); i > 0; --i)
+            stack.push_back(node->children[i - 1]);
+    }
+    return list;
 }
 
 
@@ -28,6 +28,8 @@
 #include "image_utilities.hpp"
 #include <png.h>
 #include <stdio.h>
+#include <string.h>
+#include <vector>
 
 // TODO: Get/Save resolution information
 
@@ -36,52 +38,97 @@ using namespace Gamera;
 #define PNG_BYTES_TO_CHECK 8
 #define METER_PER_INCH 0.0254
 
-void PNG_info_specific(const char* filename, FILE* & fp, png_structp& png_ptr, png_infop& info_ptr, png_infop& end_info, png_uint_32& width, png_uint_32& height, int& bit_depth, int& color_type, double& x_resolution, double& y_resolution) {
-  fp = fopen(filename, "rb");
-  if (!fp)
-    throw std::invalid_argument("Failed to open image");
+/*
+  A PNG file in memory, such as one received over the network, read
+  with PNG_read_memory instead of from a FILE.
+*/
+struct PNG_memory_source {
+  const png_byte* data;
+  size_t size;
+  size_t pos;
+};
+
+void PNG_read_memory(png_structp png_ptr, png_bytep out, png_size_t length) {
+  PNG_memory_source* source = (PNG_memory_source*)png_get_io_ptr(png_ptr);
+  if (length > source->size - source->pos)
+    png_error(png_ptr, "Unexpected end of PNG data");
+  memcpy(out, source->data + source->pos, length);
+  source->pos += length;
+}
+
+void PNG_write_memory(png_structp png_ptr, png_bytep data, png_size_t length) {
+  std::vector<char>* out = (std::vector<char>*)png_get_io_ptr(png_ptr);
+  out->insert(out->end(), (char*)data, (char*)data + length);
+}
 
+void PNG_flush_memory(png_structp png_ptr) {
+}
+
+/*
+  Reads the header of the PNG file filename or, if source is not 0, of
+  the PNG file in memory (fp is then 0).
+*/
+void PNG_info_specific(const char* filename, FILE* & fp, png_structp& png_ptr, png_infop& info_ptr, png_infop& end_info, png_uint_32& width, png_uint_32& height, int& bit_depth, int& color_type, double& x_resolution, double& y_resolution, PNG_memory_source* source = 0) {
   // Check if a PNG file
   char buf[PNG_BYTES_TO_CHECK];
-  if (fread(buf, 1, PNG_BYTES_TO_CHECK, fp) != PNG_BYTES_TO_CHECK) {
-    fclose(fp);
-    throw std::runtime_error("Image file too small");
+  if (source) {
+    fp = 0;
+    if (source->size < PNG_BYTES_TO_CHECK)
+      throw std::runtime_error("Image file too small");
+    memcpy(buf, source->data, PNG_BYTES_TO_CHECK);
+    source->pos = PNG_BYTES_TO_CHECK;
+  } else {
+    fp = fopen(filename, "rb");
+    if (!fp)
+      throw std::invalid_argument("Failed to open image");
+    if (fread(buf, 1, PNG_BYTES_TO_CHECK, fp) != PNG_BYTES_TO_CHECK) {
+      fclose(fp);
+      throw std::runtime_error("Image file too small");
+    }
   }
   if (png_sig_cmp((png_byte*)buf, 0, PNG_BYTES_TO_CHECK)) {
-    fclose(fp);
+    if (fp)
+      fclose(fp);
     throw std::runtime_error("Not a PNG file");
   }
   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, (png_voidp)NULL,
 				   NULL, NULL);
   if (!png_ptr) {
-    fclose(fp);
+    if (fp)
+      fclose(fp);
     throw std::runtime_error("Could not read PNG header");
   }
 
   info_ptr = png_create_info_struct(png_ptr);
   if (!info_ptr) {
     png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
-    fclose(fp);
+    if (fp)
+      fclose(fp);
     throw std::runtime_error("Could not read PNG info");
   }
   
   end_info = png_create_info_struct(png_ptr);
   if (!end_info) {
     png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
-    fclose(fp);
+    if (fp)
+      fclose(fp);
     throw std::runtime_error("Could not read PNG info");
   }
 
   if (setjmp(png_jmpbuf(png_ptr))) {
     png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-    fclose(fp);
+    if (fp)
+      fclose(fp);
     throw std::runtime_error("error in reading PNG header");
   }
 
   png_set_sig_bytes(png_ptr, PNG_BYTES_TO_CHECK);
 
   // Initialize IO
-  png_init_io(png_ptr, fp);
+  if (source)
+    png_set_read_fn(png_ptr, (png_voidp)source, PNG_read_memory);
+  else
+    png_init_io(png_ptr, fp);
 
   // Read in info
   png_read_info(png_ptr, info_ptr);
@@ -104,7 +151,8 @@ void PNG_close(FILE* fp, png_structp png_ptr, png_infop info_ptr, png_infop end_
   // interested in the comment texts following the image data anyway.
   //png_read_end(png_ptr, end_info);
   png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-  fclose(fp);
+  if (fp)
+    fclose(fp);
 }
 
 ImageInfo* PNG_info(char* filename) {
@@ -137,6 +185,11 @@ ImageInfo* PNG_info(char* filename) {
   return info;
 }
 
+inline bool PNG_little_endian() {
+  const unsigned short probe = 1;
+  return *(const unsigned char*)&probe == 1;
+}
+
 template<class T>
 void load_PNG_simple(T& image, png_structp& png_ptr) {
   typename T::row_iterator r = image.row_begin();
@@ -144,6 +197,24 @@ void load_PNG_simple(T& image, png_structp& png_ptr) {
     png_read_row(png_ptr, (png_bytep)(&(*r)), NULL);
 }
 
+template<class T>
+void load_PNG_grey16(T& image, png_structp& png_ptr) {
+  if (PNG_little_endian())
+    png_set_swap(png_ptr);
+#ifdef GAMERA_GREY16_NATIVE
+  // the pixels have the size of the samples
+  load_PNG_simple(image, png_ptr);
+#else
+  // the pixels are wider than the 16 bit samples
+  std::vector<png_uint_16> row(image.ncols());
+  typename T::row_iterator r = image.row_begin();
+  for (; r != image.row_end(); ++r) {
+    png_read_row(png_ptr, (png_bytep)&row[0], NULL);
+    std::copy(row.begin(), row.end(), r.begin());
+  }
+#endif
+}
+
 template<class T>
 void load_PNG_onebit(T& image, png_structp& png_ptr) {
   png_set_invert_mono(png_ptr);
@@ -174,19 +245,43 @@ void load_PNG_onebit(T& image, png_structp& png_ptr) {
   delete[] row;
 }
 
-Image* load_PNG(const char* filename, int storage) {
+// RLE images get their runs row by row
+inline void load_PNG_onebit(OneBitRleImageView& image, png_structp& png_ptr) {
+  png_set_invert_mono(png_ptr);
+#if PNG_LIBPNG_VER > 10399
+  png_set_expand_gray_1_2_4_to_8(png_ptr);
+#else
+  png_set_gray_1_2_4_to_8(png_ptr);
+#endif
+
+  std::vector<png_byte> row(image.ncols());
+  RleBuilder<OneBitPixel> builder(image);
+  for (size_t y = 0; y < image.nrows(); ++y) {
+    png_read_row(png_ptr, &row[0], NULL);
+    for (size_t x = 0; x < image.ncols(); ++x)
+      builder.append(row[x] ? pixel_traits<OneBitPixel>::black()
+                     : pixel_traits<OneBitPixel>::white());
+  }
+}
+
+/*
+  Loads the PNG file filename or, if source is not 0, the PNG file in
+  memory.
+*/
+Image* load_PNG_source(const char* filename, PNG_memory_source* source, int storage) {
   FILE* fp;
   png_structp png_ptr;
   png_infop info_ptr, end_info;
   png_uint_32 width, height;
   int bit_depth, color_type;
   double x_resolution, y_resolution;
-  PNG_info_specific(filename, fp, png_ptr, info_ptr, end_info, width, height, bit_depth, color_type, x_resolution, y_resolution);
+  PNG_info_specific(filename, fp, png_ptr, info_ptr, end_info, width, height, bit_depth, color_type, x_resolution, y_resolution, source);
 
   // libpng exception handling
   if (setjmp(png_jmpbuf(png_ptr))) {
     png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-    fclose(fp);
+    if (fp)
+      fclose(fp);
     throw std::runtime_error("error in reading PNG data");
   }
 
@@ -199,9 +294,9 @@ Image* load_PNG(const char* filename, int storage) {
 
   if (color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_PALETTE ||
       color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
-    if (storage == RLE) {
+    if (storage == RLE || storage == PACKED) {
       PNG_close(fp, png_ptr, info_ptr, end_info);
-      throw std::runtime_error("Pixel type must be OneBit to use RLE data.");
+      throw std::runtime_error("Pixel type must be OneBit to use RLE or PACKED data.");
     }
     if (color_type == PNG_COLOR_TYPE_PALETTE)
       png_set_palette_to_rgb(png_ptr);
@@ -227,6 +322,14 @@ Image* load_PNG(const char* filename, int storage) {
 	//Damon: end	
 	PNG_close(fp, png_ptr, info_ptr, end_info);
 	return image;
+      } else if (storage == PACKED) {
+	typedef TypeIdImageFactory<ONEBIT, PACKED> fact;
+	fact::image_type* image =
+	  fact::create(Point(0, 0), Dim(width, height));
+	load_PNG_onebit(*image, png_ptr);
+	image->resolution(reso);
+	PNG_close(fp, png_ptr, info_ptr, end_info);
+	return image;
       } else {
 	typedef TypeIdImageFactory<ONEBIT, RLE> fact;
 	fact::image_type* image =
@@ -239,9 +342,9 @@ Image* load_PNG(const char* filename, int storage) {
 	return image;
       }	
     } else if (bit_depth <= 8) {
-      if (storage == RLE) {
+      if (storage == RLE || storage == PACKED) {
 	PNG_close(fp, png_ptr, info_ptr, end_info);
-	throw std::runtime_error("Pixel type must be OneBit to use RLE data.");
+	throw std::runtime_error("Pixel type must be OneBit to use RLE or PACKED data.");
       }
       if (bit_depth < 8) {
 #if PNG_LIBPNG_VER > 10399
@@ -260,14 +363,14 @@ Image* load_PNG(const char* filename, int storage) {
       PNG_close(fp, png_ptr, info_ptr, end_info);
       return image;
     } else if (bit_depth == 16) {
-      if (storage == RLE) {
+      if (storage == RLE || storage == PACKED) {
 	PNG_close(fp, png_ptr, info_ptr, end_info);
-	throw std::runtime_error("Pixel type must be OneBit to use RLE data.");
+	throw std::runtime_error("Pixel type must be OneBit to use RLE or PACKED data.");
       }
       typedef TypeIdImageFactory<GREY16, DENSE> fact_type;
       fact_type::image_type*
 	image = fact_type::create(Point(0, 0), Dim(width, height));
-      load_PNG_simple(*image, png_ptr);
+      load_PNG_grey16(*image, png_ptr);
 	  //Damon
 	  image->resolution(reso);
 	  //Damon: end	
@@ -279,46 +382,119 @@ Image* load_PNG(const char* filename, int storage) {
   throw std::runtime_error("PNG file is an unsupported type");
 }
 
+Image* load_PNG(const char* filename, int storage) {
+  return load_PNG_source(filename, 0, storage);
+}
+
+/*
+  Loads a PNG file held in a string, without writing it to disk.
+*/
+Image* load_PNG_from_bytes(PyObject* data, int storage) {
+  if (!PyString_Check(data))
+    throw std::invalid_argument("The data must be a string.");
+  PNG_memory_source source;
+  source.data = (const png_byte*)PyString_AS_STRING(data);
+  source.size = PyString_GET_SIZE(data);
+  source.pos = 0;
+  return load_PNG_source(0, &source, storage);
+}
+
+/*
+  The savers convert the whole image into PNG rows before anything is
+  written, so that libpng gets all row pointers at once
+  (png_write_image).  Rows that are already in PNG layout (GreyScale
+  and RGB) point directly into the image.
+*/
+struct PNG_rows {
+  std::vector<png_bytep> rows;
+  std::vector<png_byte> buffer;
+
+  void allocate(size_t nrows, size_t row_bytes) {
+    buffer.resize(nrows * row_bytes);
+    rows.resize(nrows);
+    for (size_t i = 0; i < nrows; ++i)
+      rows[i] = &buffer[i * row_bytes];
+  }
+};
+
 template<class P>
 struct PNG_saver {
   template<class T>
-  void operator()(T& image, png_structp png_ptr) {
+  void operator()(T& image, PNG_rows& out) {
+    out.rows.reserve(image.nrows());
     typename T::row_iterator r = image.row_begin();
     for (; r != image.row_end(); ++r)
-      png_write_row(png_ptr, (png_bytep)(&(*r)));
+      out.rows.push_back((png_bytep)(&(*r)));
   }
 };
 
+/*
+  Packs eight OneBit pixels into one byte of a 1-bit PNG row: the first
+  pixel goes to the most significant bit, and white is 1.
+*/
+template<class Iterator>
+inline png_byte PNG_pack_onebit(Iterator& c, size_t n) {
+  png_byte result = 0;
+  for (size_t i = 0; i < n; ++i, ++c)
+    result |= (png_byte)(!is_black(c.get())) << (7 - i);
+  return result;
+}
+
+inline png_byte PNG_pack_onebit(const OneBitPixel* p, size_t n) {
+  if (n == 8 && PNG_little_endian()) {
+    // Four 16 bit pixels per word: each lane's high bit is set if the
+    // pixel is black, and a multiplication gathers the four bits.
+    const unsigned long long low = 0x7fff7fff7fff7fffULL;
+    const unsigned long long gather = (1ULL << 54) | (1ULL << 37) |
+      (1ULL << 20) | (1ULL << 3);
+    unsigned long long w[2];
+    memcpy(w, p, sizeof(w));
+    png_byte result = 0;
+    for (int i = 0; i < 2; ++i) {
+      unsigned long long black = (((w[i] & low) + low) | w[i]) & ~low;
+      result |= (png_byte)((((black >> 15) * gather) >> 51) & 0xf) << (4 - 4 * i);
+    }
+    return ~result;
+  }
+  png_byte result = 0;
+  for (size_t i = 0; i < n; ++i)
+    result |= (png_byte)(p[i] == 0) << (7 - i);
+  return result;
+}
+
+template<class T>
+inline void PNG_pack_onebit_row(T& image, typename T::row_iterator r,
+                                png_bytep to) {
+  typename T::col_iterator c = r.begin();
+  size_t ncols = image.ncols();
+  for (size_t x = 0; x < ncols; x += 8)
+    *to++ = PNG_pack_onebit(c, std::min(ncols - x, (size_t)8));
+}
+
+inline void PNG_pack_onebit_row(OneBitImageView& image,
+                                OneBitImageView::row_iterator r,
+                                png_bytep to) {
+  const OneBitPixel* p = &(*r);
+  size_t ncols = image.ncols();
+  for (size_t x = 0; x < ncols; x += 8)
+    *to++ = PNG_pack_onebit(p + x, std::min(ncols - x, (size_t)8));
+}
+
 template<>
 struct PNG_saver<OneBitPixel> {
   template<class T>
-  void operator()(T& image, png_structp png_ptr) {
-    png_bytep row = new png_byte[image.ncols()];
-    try {
-      typename T::row_iterator r = image.row_begin();
-      for (; r != image.row_end(); ++r) {
-	png_bytep from = row;
-	typename T::col_iterator c = r.begin();
-	for (; c != r.end(); ++c, ++from) {
-	  if (is_black(c.get()))
-	    *from = 0;
-	  else
-	    *from = 255;
-	}
-	png_write_row(png_ptr, row);
-      }
-    } catch (std::exception e) {
-      delete[] row;
-      throw;
-    }
-    delete[] row;
+  void operator()(T& image, PNG_rows& out) {
+    out.allocate(image.nrows(), (image.ncols() + 7) / 8);
+    typename T::row_iterator r = image.row_begin();
+    for (size_t y = 0; r != image.row_end(); ++r, ++y)
+      PNG_pack_onebit_row(image, r, out.rows[y]);
   }
 };
 
 template<>
 struct PNG_saver<FloatPixel> {
   template<class T>
-  void operator()(T& image, png_structp png_ptr) {
+  void operator()(T& image, PNG_rows& out) {
     FloatPixel max = 0;
     max = find_max(image.parent());
     if (max > 0)
@@ -326,29 +502,21 @@ struct PNG_saver<FloatPixel> {
     else 
       max = 0;
 
-    png_bytep row = new png_byte[image.ncols()];
-    try {
-      typename T::row_iterator r = image.row_begin();
-      for (; r != image.row_end(); ++r) {
-	png_bytep from = row;
-	typename T::col_iterator c = r.begin();
-	for (; c != r.end(); ++c, ++from) {
-	  *from = (png_byte)(*c * max);
-	}
-	png_write_row(png_ptr, row);
-      }
-    } catch (std::exception e) {
-      delete[] row;
-      throw;
+    out.allocate(image.nrows(), image.ncols());
+    png_bytep to = out.rows.empty() ? 0 : out.rows[0];
+    typename T::row_iterator r = image.row_begin();
+    for (; r != image.row_end(); ++r) {
+      typename T::col_iterator c = r.begin();
+      for (; c != r.end(); ++c, ++to)
+	*to = (png_byte)(*c * max);
     }
-    delete[] row;
   }
 };
 
 template<>
 struct PNG_saver<ComplexPixel> {
   template<class T>
-  void operator()(T& image, png_structp png_ptr) {
+  void operator()(T& image, PNG_rows& out) {
     ComplexPixel temp = find_max(image.parent());
     FloatPixel max;
     if (temp.real() > 0)
@@ -356,80 +524,101 @@ struct PNG_saver<ComplexPixel> {
     else 
       max = 0;
 
-    png_bytep row = new png_byte[image.ncols()];
-    try {
-      typename T::row_iterator r = image.row_begin();
-      for (; r != image.row_end(); ++r) {
-	png_bytep from = row;
-	typename T::col_iterator c = r.begin();
-	for (; c != r.end(); ++c, ++from) {
-	  *from = (png_byte)((*c).real() * max);
-	}
-	png_write_row(png_ptr, row);
-      }
-    } catch (std::exception e) {
-      delete[] row;
-      throw;
+    out.allocate(image.nrows(), image.ncols());
+    png_bytep to = out.rows.empty() ? 0 : out.rows[0];
+    typename T::row_iterator r = image.row_begin();
+    for (; r != image.row_end(); ++r) {
+      typename T::col_iterator c = r.begin();
+      for (; c != r.end(); ++c, ++to)
+	*to = (png_byte)((*c).real() * max);
     }
-    delete[] row;
   }
 };
 
 template<>
 struct PNG_saver<Grey16Pixel> {
   template<class T>
-  void operator()(T& image, png_structp png_ptr) {
-    png_bytep row = new png_byte[image.ncols() * 2];
-    try {
-      typename T::row_iterator r = image.row_begin();
-      for (; r != image.row_end(); ++r) {
-	typename T::col_iterator c = r.begin();
-	unsigned short* from = (unsigned short *)row;
-	for (; c != r.end(); ++c, ++from)
-	  *from = (unsigned short)(*c && 0xffff);
-	png_write_row(png_ptr, row);
+  void operator()(T& image, PNG_rows& out) {
+    // 16 bit PNG samples are big endian
+    out.allocate(image.nrows(), image.ncols() * 2);
+    png_bytep to = out.rows.empty() ? 0 : out.rows[0];
+    typename T::row_iterator r = image.row_begin();
+    for (; r != image.row_end(); ++r) {
+      typename T::col_iterator c = r.begin();
+      for (; c != r.end(); ++c) {
+	Grey16Pixel value = *c;
+	*to++ = (png_byte)((value >> 8) & 0xff);
+	*to++ = (png_byte)(value & 0xff);
       }
-    } catch (std::exception e) {
-      delete[] row;
-      throw;
     }
-    delete[] row;
   }
 };
 
+/*
+  Row filters that can be passed to save_PNG.  PNG_FILTERS_DEFAULT
+  leaves the choice to libpng (adaptive filtering for 8 and 16 bit
+  images).
+*/
+enum {
+  PNG_FILTERS_DEFAULT, PNG_FILTERS_NONE, PNG_FILTERS_SUB, PNG_FILTERS_UP,
+  PNG_FILTERS_AVERAGE, PNG_FILTERS_PAETH, PNG_FILTERS_ALL
+};
+
+inline void PNG_set_filters(png_structp png_ptr, int filters) {
+  int flags;
+  switch (filters) {
+  case PNG_FILTERS_DEFAULT: return;
+  case PNG_FILTERS_NONE: flags = PNG_FILTER_NONE; break;
+  case PNG_FILTERS_SUB: flags = PNG_FILTER_SUB; break;
+  case PNG_FILTERS_UP: flags = PNG_FILTER_UP; break;
+  case PNG_FILTERS_AVERAGE: flags = PNG_FILTER_AVG; break;
+  case PNG_FILTERS_PAETH: flags = PNG_FILTER_PAETH; break;
+  case PNG_FILTERS_ALL: flags = PNG_ALL_FILTERS; break;
+  default:
+    throw std::invalid_argument("Unknown PNG filter choice.");
+  }
+  png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, flags);
+}
+
+/*
+  Writes the image as a PNG file to fp or, if fp is 0, appends it to out.
+  compression_level is the zlib level (0-9, -1 for the zlib default),
+  filters one of the PNG_FILTERS_* choices.
+*/
 template<class T>
-void save_PNG(T& image, const char* filename) {
-  FILE* fp = fopen(filename, "wb");
-  if (!fp)
-    throw std::invalid_argument("Failed to open image");
-  
+void save_PNG_to(T& image, FILE* fp, std::vector<char>* out,
+                 int compression_level = -1, int filters = PNG_FILTERS_DEFAULT) {
+  if (compression_level < -1 || compression_level > 9)
+    throw std::invalid_argument("The compression level must be in the range -1 to 9.");
+  if (filters < PNG_FILTERS_DEFAULT || filters > PNG_FILTERS_ALL)
+    throw std::invalid_argument("Unknown PNG filter choice.");
+
+  // the rows are converted before libpng is set up, so that nothing
+  // needs to be cleaned up if the conversion fails
+  PNG_rows rows;
+  PNG_saver<typename T::value_type> saver;
+  saver(image, rows);
+
   png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if (!png_ptr) {
-    fclose(fp);
+  if (!png_ptr)
     throw std::runtime_error("Couldn't create PNG header");
-  }
 
   png_infop info_ptr = png_create_info_struct(png_ptr);
   if (!info_ptr) {
     png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
-    fclose(fp);
     throw std::runtime_error("Couldn't create PNG header");
   }			
 
   if (setjmp(png_jmpbuf(png_ptr))) {
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    fclose(fp);
     throw std::runtime_error("Unknown PNG error");
   }
   
   png_uint_32 width = image.ncols();
   png_uint_32 height = image.nrows();
   int bit_depth;
-  if (image.depth() == 32)
-    bit_depth = 16;
-  else if (image.depth() == 64)
-    bit_depth = 8;
-  else if (image.depth() == 128)
+  // Float and Complex images are scaled to 8 bits by PNG_saver
+  if (image.depth() > 16)
     bit_depth = 8;
   else
     bit_depth = image.depth();
@@ -445,16 +634,48 @@ void save_PNG(T& image, const char* filename) {
   png_set_pHYs(png_ptr, info_ptr, res_x, res_y, unit_type);
   //Damon:end
 
-  png_init_io(png_ptr, fp);
+  if (fp)
+    png_init_io(png_ptr, fp);
+  else
+    png_set_write_fn(png_ptr, (png_voidp)out, PNG_write_memory, PNG_flush_memory);
+  if (compression_level >= 0)
+    png_set_compression_level(png_ptr, compression_level);
+  PNG_set_filters(png_ptr, filters);
   png_write_info(png_ptr, info_ptr);
-  png_set_packing(png_ptr);
   
-  PNG_saver<typename T::value_type> saver;
-  saver(image, png_ptr);
+  if (!rows.rows.empty())
+    png_write_image(png_ptr, &rows.rows[0]);
   
   png_write_end(png_ptr, info_ptr);
   png_destroy_write_struct(&png_ptr, &info_ptr);
+}
+
+template<class T>
+void save_PNG(T& image, const char* filename, int compression_level = -1,
+              int filters = PNG_FILTERS_DEFAULT) {
+  FILE* fp = fopen(filename, "wb");
+  if (!fp)
+    throw std::invalid_argument("Failed to open image");
+  try {
+    save_PNG_to(image, fp, 0, compression_level, filters);
+  } catch (std::exception& e) {
+    fclose(fp);
+    throw;
+  }
   fclose(fp);
 }
 
+/*
+  Returns the image encoded as a PNG file in a string, without writing
+  it to disk.
+*/
+template<class T>
+PyObject* save_PNG_to_bytes(T& image, int compression_level = -1,
+                            int filters = PNG_FILTERS_DEFAULT) {
+  std::vector<char> out;
+  save_PNG_to(image, 0, &out, compression_level, filters);
+  return PyString_FromStringAndSize(out.empty() ? 0 : &out[0],
+                                    (Py_ssize_t)out.size());
+}
+
 #endif
@@ -0,0 +1,606 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom,
+ * and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef mgd_pointwise
+#define mgd_pointwise
+
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include "gamera.hpp"
+#include "arithmetic.hpp"
+#include "logical.hpp"
+#include "image_conversion.hpp"
+
+/*
+  POINTWISE PROGRAMS
+
+  A chain of pointwise plugins (arithmetic, logical, invert, threshold
+  and the conversions between pixel types) is evaluated in a single
+  pass over the images: the pixels are computed in blocks of BLOCK
+  pixels, each operation of the chain going over the whole block
+  before the next one, so that the intermediate values stay in the
+  cache instead of being stored in whole images.  Each operation uses
+  the same span functors as its plugin, so the results are the same.
+
+  The chain is given as a program for a stack machine (see
+  gamera/plugins/pointwise.py): LOAD pushes the pixels of one of the
+  operands, and the other instructions replace the values on top of
+  the stack by their result.
+*/
+namespace Gamera {
+  namespace PointwiseDetail {
+
+    enum Opcode {
+      LOAD,                // operand index
+      ADD,
+      SUBTRACT,
+      MULTIPLY,
+      DIVIDE,
+      MULTIPLY_ADD,        // saturate; constants factor, offset
+      MULTIPLY_ADD_IMAGES, // saturate; constants factor, other_factor, offset
+      INVERT,
+      THRESHOLD,           // threshold
+      AND,
+      OR,
+      XOR,
+      TO_GREYSCALE,
+      TO_GREY16,
+      TO_FLOAT
+    };
+
+    enum { BLOCK = 512 };
+
+    /*
+      A value on the stack: the pixels of the current block, which are
+      either in one of the operands or in one of the two buffers of the
+      slot.  An operation writes its result to the buffer it does not
+      read from, since the pixel types of both may differ in size.  The
+      last operation writes to the result image instead.
+    */
+    struct Slot {
+      const void* pixels;
+      char* buffers[2];
+      void* result;
+      void* free_buffer() const {
+        return pixels == buffers[0] ? buffers[1] : buffers[0];
+      }
+    };
+
+    class Operation {
+    public:
+      Operation(size_t slot) : m_slot(slot), m_last(false) {}
+      virtual ~Operation() {}
+      // computes the n pixels of the block starting at (x, y)
+      virtual void apply(Slot* stack, size_t y, size_t x, size_t n) const = 0;
+      void set_last() { m_last = true; }
+    protected:
+      void* destination(const Slot& slot) const {
+        return m_last ? slot.result : slot.free_buffer();
+      }
+      size_t m_slot;
+      bool m_last;
+    };
+
+    template<class P>
+    class Load : public Operation {
+    public:
+      Load(const ImageView<ImageData<P> >& image, size_t slot)
+        : Operation(slot), m_image(image) {}
+      void apply(Slot* stack, size_t y, size_t x, size_t) const {
+        stack[m_slot].pixels = m_image[y] + x;
+      }
+    private:
+      const ImageView<ImageData<P> >& m_image;
+    };
+
+    // the result of a program that only loads an operand
+    class Store : public Operation {
+    public:
+      Store(size_t pixel_size) : Operation(0), m_pixel_size(pixel_size) {}
+      void apply(Slot* stack, size_t, size_t, size_t n) const {
+        std::memcpy(stack[0].result, stack[0].pixels, n * m_pixel_size);
+      }
+    private:
+      size_t m_pixel_size;
+    };
+
+    // where the result of a block goes
+    class ResultRows {
+    public:
+      virtual ~ResultRows() {}
+      virtual void* pixels(size_t y, size_t x) const = 0;
+    };
+
+    template<class R>
+    class ResultView : public ResultRows {
+    public:
+      ResultView(ImageView<ImageData<R> >& image) : m_image(image) {}
+      void* pixels(size_t y, size_t x) const {
+        return m_image[y] + x;
+      }
+    private:
+      ImageView<ImageData<R> >& m_image;
+    };
+
+    // the operations with P pixels on top of the stack and an R result
+    template<class P, class R, class SPAN>
+    class Unary : public Operation {
+    public:
+      Unary(const SPAN& span, size_t slot) : Operation(slot), m_span(span) {}
+      void apply(Slot* stack, size_t, size_t, size_t n) const {
+        Slot& a = stack[m_slot];
+        R* dest = (R*)destination(a);
+        m_span((const P*)a.pixels, dest, n);
+        a.pixels = dest;
+      }
+    private:
+      SPAN m_span;
+    };
+
+    template<class P, class R, class SPAN>
+    class Binary : public Operation {
+    public:
+      Binary(const SPAN& span, size_t slot) : Operation(slot), m_span(span) {}
+      void apply(Slot* stack, size_t, size_t, size_t n) const {
+        Slot& a = stack[m_slot];
+        R* dest = (R*)destination(a);
+        m_span((const P*)a.pixels, (const P*)stack[m_slot + 1].pixels, dest, n);
+        a.pixels = dest;
+      }
+    private:
+      SPAN m_span;
+    };
+
+    // the spans of arithmetic.hpp and logical.hpp refer to their functor
+    template<class FUNCTOR, class SPAN>
+    struct FunctorSpan {
+      FUNCTOR functor;
+      SPAN span;
+      FunctorSpan() : span(functor) {}
+      FunctorSpan(const FunctorSpan&) : span(functor) {}
+      template<class P, class R>
+      void operator()(const P* a, const P* b, R* dest, size_t n) const {
+        span(a, b, dest, n);
+      }
+    };
+
+    template<class P>
+    struct InvertSpan {
+      void operator()(const P* a, P* dest, size_t n) const {
+        for (size_t i = 0; i < n; ++i)
+          dest[i] = invert(a[i]);
+      }
+    };
+
+    template<class P>
+    struct ThresholdSpan {
+      P threshold;
+      ThresholdSpan(P t) : threshold(t) {}
+      void operator()(const P* a, OneBitPixel* dest, size_t n) const {
+        for (size_t i = 0; i < n; ++i)
+          dest[i] = a[i] > threshold ? pixel_traits<OneBitPixel>::white()
+            : pixel_traits<OneBitPixel>::black();
+      }
+    };
+
+    template<class P, class R>
+    struct CastSpan {
+      void operator()(const P* a, R* dest, size_t n) const {
+        for (size_t i = 0; i < n; ++i)
+          dest[i] = R(a[i]);
+      }
+    };
+
+    template<class R>
+    struct LuminanceSpan {
+      void operator()(const RGBPixel* a, R* dest, size_t n) const {
+        for (size_t i = 0; i < n; ++i)
+          dest[i] = R(_image_conversion::rgb_luminance(a[i]));
+      }
+    };
+
+    template<class R>
+    struct OneBitSpan {
+      R white_value, black_value;
+      OneBitSpan(R w, R b) : white_value(w), black_value(b) {}
+      void operator()(const OneBitPixel* a, R* dest, size_t n) const {
+        for (size_t i = 0; i < n; ++i)
+          dest[i] = is_white(a[i]) ? white_value : black_value;
+      }
+    };
+
+    template<class P>
+    Operation* arithmetic(int opcode, size_t slot) {
+      typedef typename NumericTraits<P>::Promote PROMOTE;
+      switch (opcode) {
+      case ADD: {
+        typedef std::plus<PROMOTE> F;
+        typedef FunctorSpan<F, ArithmeticSpan<P, P, F> > SPAN;
+        return new Binary<P, P, SPAN>(SPAN(), slot);
+      }
+      case SUBTRACT: {
+        typedef my_minus<P> F;
+        typedef FunctorSpan<F, ArithmeticSpan<P, P, F> > SPAN;
+        return new Binary<P, P, SPAN>(SPAN(), slot);
+      }
+      case MULTIPLY: {
+        typedef std::multiplies<PROMOTE> F;
+        typedef FunctorSpan<F, ArithmeticSpan<P, P, F> > SPAN;
+        return new Binary<P, P, SPAN>(SPAN(), slot);
+      }
+      default: {
+        typedef std::divides<PROMOTE> F;
+        typedef FunctorSpan<F, ArithmeticSpan<P, P, F> > SPAN;
+        return new Binary<P, P, SPAN>(SPAN(), slot);
+      }
+      }
+    }
+
+    inline Operation* logical(int opcode, size_t slot) {
+      typedef OneBitPixel P;
+      if (opcode == AND) {
+        typedef std::logical_and<bool> F;
+        typedef FunctorSpan<F, LogicalSpan<F> > SPAN;
+        return new Binary<P, P, SPAN>(SPAN(), slot);
+      } else if (opcode == OR) {
+        typedef std::logical_or<bool> F;
+        typedef FunctorSpan<F, LogicalSpan<F> > SPAN;
+        return new Binary<P, P, SPAN>(SPAN(), slot);
+      }
+      typedef logical_xor<bool> F;
+      typedef FunctorSpan<F, LogicalSpan<F> > SPAN;
+      return new Binary<P, P, SPAN>(SPAN(), slot);
+    }
+
+    template<class P>
+    Operation* multiply_add(double factor, double offset, bool saturate, size_t slot) {
+      typedef ArithmeticDetail::MultiplyAddScalarSpan<P> SPAN;
+      return new Unary<P, P, SPAN>(SPAN(factor, offset, saturate), slot);
+    }
+
+    template<class P>
+    Operation* multiply_add_images(double factor, double other_factor, double offset,
+                                   bool saturate, size_t slot) {
+      typedef ArithmeticDetail::MultiplyAddSpan<P, P> SPAN;
+      return new Binary<P, P, SPAN>(SPAN(factor, other_factor, offset, saturate), slot);
+    }
+
+    template<class P>
+    Operation* invert(size_t slot) {
+      return new Unary<P, P, InvertSpan<P> >(InvertSpan<P>(), slot);
+    }
+
+    template<class P>
+    Operation* threshold(int t, size_t slot) {
+      // threshold converts its argument to the pixel type as well
+      return new Unary<P, OneBitPixel, ThresholdSpan<P> >(ThresholdSpan<P>((P)t), slot);
+    }
+
+    // the conversion of P pixels to R pixels
+    template<class P, class R>
+    Operation* cast(size_t slot) {
+      return new Unary<P, R, CastSpan<P, R> >(CastSpan<P, R>(), slot);
+    }
+
+    template<class R>
+    Operation* luminance(size_t slot) {
+      return new Unary<RGBPixel, R, LuminanceSpan<R> >(LuminanceSpan<R>(), slot);
+    }
+
+    template<class R>
+    Operation* from_onebit(R white_value, R black_value, size_t slot) {
+      return new Unary<OneBitPixel, R, OneBitSpan<R> >
+        (OneBitSpan<R>(white_value, black_value), slot);
+    }
+
+    inline size_t pixel_size(int pixel_type) {
+      switch (pixel_type) {
+      case ONEBIT: return sizeof(OneBitPixel);
+      case GREYSCALE: return sizeof(GreyScalePixel);
+      case GREY16: return sizeof(Grey16Pixel);
+      case RGB: return sizeof(RGBPixel);
+      case FLOAT: return sizeof(FloatPixel);
+      default: return sizeof(ComplexPixel);
+      }
+    }
+
+    /*
+      The operations of a program, checked against the pixel types of
+      its operands.
+    */
+    class Program {
+    public:
+      Program(const ImageVector& operands, const IntVector& code,
+              const FloatVector& constants);
+      ~Program() {
+        for (size_t i = 0; i < m_operations.size(); ++i)
+          delete m_operations[i];
+        delete m_result;
+      }
+      // creates the result image, which the last operation writes to
+      Image* create_result(const Point& origin, const Dim& dim);
+      void operator()(size_t y, size_t x, size_t n) const;
+      size_t depth() const { return m_depth; }
+      bool contiguous() const { return m_contiguous; }
+    private:
+      std::vector<Operation*> m_operations;
+      ResultRows* m_result;
+      size_t m_depth, m_pixel_size;
+      int m_pixel_type;
+      bool m_contiguous;
+    };
+
+    template<class P>
+    Operation* load(Image* image, size_t slot, bool& contiguous) {
+      ImageView<ImageData<P> >* view = static_cast<ImageView<ImageData<P> >*>(image);
+      contiguous = contiguous && view->ncols() == view->data()->stride();
+      return new Load<P>(*view, slot);
+    }
+
+    inline Program::Program(const ImageVector& operands, const IntVector& code,
+                            const FloatVector& constants)
+      : m_result(NULL), m_depth(0), m_pixel_size(0), m_pixel_type(-1),
+        m_contiguous(true) {
+      if (operands.empty())
+        throw std::runtime_error("A pointwise program needs at least one operand.");
+      std::vector<int> types;
+      size_t c = 0;
+      try {
+        for (size_t i = 0; i < code.size(); ++i) {
+          int opcode = code[i];
+          int argument = 0;
+          if (opcode == LOAD || opcode == MULTIPLY_ADD || opcode == MULTIPLY_ADD_IMAGES
+              || opcode == THRESHOLD) {
+            if (++i == code.size())
+              throw std::runtime_error("The pointwise program is truncated.");
+            argument = code[i];
+          }
+          size_t needed = (opcode == LOAD) ? 0 : 1;
+          if (opcode == ADD || opcode == SUBTRACT || opcode == MULTIPLY ||
+              opcode == DIVIDE || opcode == MULTIPLY_ADD_IMAGES || opcode == AND ||
+              opcode == OR || opcode == XOR)
+            needed = 2;
+          if (types.size() < needed)
+            throw std::runtime_error("The pointwise program takes values from an empty stack.");
+          if (needed == 2 && types[types.size() - 1] != types[types.size() - 2])
+            throw std::runtime_error("The images must be the same type.");
+          if (opcode == MULTIPLY_ADD || opcode == MULTIPLY_ADD_IMAGES) {
+            if (constants.size() < c + (opcode == MULTIPLY_ADD ? 2 : 3))
+              throw std::runtime_error("The pointwise program needs more constants.");
+          }
+          size_t slot = types.size() - needed;
+          int type = needed ? types.back() : -1;
+          Operation* operation = NULL;
+          int result = type;
+          switch (opcode) {
+          case LOAD: {
+            if (argument < 0 || (size_t)argument >= operands.size())
+              throw std::runtime_error("The pointwise program loads a missing operand.");
+            Image* image = operands[argument].first;
+            if (image->nrows() != operands[0].first->nrows() ||
+                image->ncols() != operands[0].first->ncols())
+              throw std::runtime_error("Images must be the same size.");
+            switch (operands[argument].second) {
+            case ONEBITIMAGEVIEW:
+              operation = load<OneBitPixel>(image, slot, m_contiguous);
+              result = ONEBIT; break;
+            case GREYSCALEIMAGEVIEW:
+              operation = load<GreyScalePixel>(image, slot, m_contiguous);
+              result = GREYSCALE; break;
+            case GREY16IMAGEVIEW:
+              operation = load<Grey16Pixel>(image, slot, m_contiguous);
+              result = GREY16; break;
+            case RGBIMAGEVIEW:
+              operation = load<RGBPixel>(image, slot, m_contiguous);
+              result = RGB; break;
+            case FLOATIMAGEVIEW:
+              operation = load<FloatPixel>(image, slot, m_contiguous);
+              result = FLOAT; break;
+            case COMPLEXIMAGEVIEW:
+              operation = load<ComplexPixel>(image, slot, m_contiguous);
+              result = COMPLEX; break;
+            default:
+              throw std::runtime_error("The operands of a pointwise program must be dense images.");
+            }
+            break;
+          }
+          case ADD: case SUBTRACT: case MULTIPLY: case DIVIDE:
+            if (type == GREYSCALE)
+              operation = arithmetic<GreyScalePixel>(opcode, slot);
+            else if (type == GREY16)
+              operation = arithmetic<Grey16Pixel>(opcode, slot);
+            else if (type == FLOAT)
+              operation = arithmetic<FloatPixel>(opcode, slot);
+            break;
+          case MULTIPLY_ADD: {
+            double factor = constants[c], offset = constants[c + 1];
+            c += 2;
+            if (type == GREYSCALE)
+              operation = multiply_add<GreyScalePixel>(factor, offset, argument != 0, slot);
+            else if (type == GREY16)
+              operation = multiply_add<Grey16Pixel>(factor, offset, argument != 0, slot);
+            else if (type == FLOAT)
+              operation = multiply_add<FloatPixel>(factor, offset, argument != 0, slot);
+            break;
+          }
+          case MULTIPLY_ADD_IMAGES: {
+            double factor = constants[c], other_factor = constants[c + 1],
+              offset = constants[c + 2];
+            c += 3;
+            if (type == GREYSCALE)
+              operation = multiply_add_images<GreyScalePixel>
+                (factor, other_factor, offset, argument != 0, slot);
+            else if (type == GREY16)
+              operation = multiply_add_images<Grey16Pixel>
+                (factor, other_factor, offset, argument != 0, slot);
+            else if (type == FLOAT)
+              operation = multiply_add_images<FloatPixel>
+                (factor, other_factor, offset, argument != 0, slot);
+            break;
+          }
+          case INVERT:
+            if (type == ONEBIT)
+              operation = invert<OneBitPixel>(slot);
+            else if (type == GREYSCALE)
+              operation = invert<GreyScalePixel>(slot);
+            else if (type == GREY16)
+              operation = invert<Grey16Pixel>(slot);
+            else if (type == RGB)
+              operation = invert<RGBPixel>(slot);
+            break;
+          case THRESHOLD:
+            result = ONEBIT;
+            if (type == GREYSCALE)
+              operation = threshold<GreyScalePixel>(argument, slot);
+            else if (type == GREY16)
+              operation = threshold<Grey16Pixel>(argument, slot);
+            else if (type == FLOAT)
+              operation = threshold<FloatPixel>(argument, slot);
+            break;
+          case AND: case OR: case XOR:
+            if (type == ONEBIT)
+              operation = logical(opcode, slot);
+            break;
+          case TO_GREYSCALE:
+            result = GREYSCALE;
+            if (type == ONEBIT)
+              operation = from_onebit<GreyScalePixel>(255, 0, slot);
+            else if (type == RGB)
+              operation = luminance<GreyScalePixel>(slot);
+            break;
+          case TO_GREY16:
+            result = GREY16;
+            if (type == ONEBIT)
+              operation = from_onebit<Grey16Pixel>(65535, 0, slot);
+            else if (type == GREYSCALE)
+              operation = cast<GreyScalePixel, Grey16Pixel>(slot);
+            else if (type == RGB)
+              operation = luminance<Grey16Pixel>(slot);
+            break;
+          case TO_FLOAT:
+            result = FLOAT;
+            if (type == ONEBIT)
+              operation = from_onebit<FloatPixel>(1.0, 0.0, slot);
+            else if (type == GREYSCALE)
+              operation = cast<GreyScalePixel, FloatPixel>(slot);
+            else if (type == GREY16)
+              operation = cast<Grey16Pixel, FloatPixel>(slot);
+            else if (type == RGB)
+              operation = luminance<FloatPixel>(slot);
+            break;
+          default:
+            throw std::runtime_error("Unknown instruction in the pointwise program.");
+          }
+          if (operation == NULL)
+            throw std::runtime_error("The instruction of the pointwise program does not support the pixel type.");
+          m_operations.push_back(operation);
+          types.resize(slot);
+          types.push_back(result);
+          m_depth = std::max(m_depth, types.size());
+          m_pixel_size = std::max(m_pixel_size, pixel_size(result));
+        }
+        if (types.size() != 1)
+          throw std::runtime_error("The pointwise program must leave one value on the stack.");
+      } catch (...) {
+        for (size_t i = 0; i < m_operations.size(); ++i)
+          delete m_operations[i];
+        throw;
+      }
+      m_pixel_type = types[0];
+    }
+
+    template<class R>
+    Image* create_result(const Point& origin, const Dim& dim, ResultRows*& result) {
+      ImageData<R>* data = new ImageData<R>(dim, origin);
+      ImageView<ImageData<R> >* view = new ImageView<ImageData<R> >(*data);
+      result = new ResultView<R>(*view);
+      return view;
+    }
+
+    inline Image* Program::create_result(const Point& origin, const Dim& dim) {
+      if (m_operations.size() == 1)
+        // a single Load
+        m_operations.push_back(new Store(pixel_size(m_pixel_type)));
+      m_operations.back()->set_last();
+      switch (m_pixel_type) {
+      case ONEBIT:
+        return PointwiseDetail::create_result<OneBitPixel>(origin, dim, m_result);
+      case GREYSCALE:
+        return PointwiseDetail::create_result<GreyScalePixel>(origin, dim, m_result);
+      case GREY16:
+        return PointwiseDetail::create_result<Grey16Pixel>(origin, dim, m_result);
+      case RGB:
+        return PointwiseDetail::create_result<RGBPixel>(origin, dim, m_result);
+      case FLOAT:
+        return PointwiseDetail::create_result<FloatPixel>(origin, dim, m_result);
+      default:
+        return PointwiseDetail::create_result<ComplexPixel>(origin, dim, m_result);
+      }
+    }
+
+    // (for for_each_span_block)
+    inline void Program::operator()(size_t y, size_t x, size_t n) const {
+      // the buffers of short programs fit on the stack
+      enum { STACK_SLOTS = 4 };
+      const size_t buffer_size = BLOCK * m_pixel_size;
+      double stack_memory[STACK_SLOTS * 2 * BLOCK * sizeof(ComplexPixel) / sizeof(double)];
+      std::vector<double> heap_memory;
+      char* memory = (char*)stack_memory;
+      if (m_depth > STACK_SLOTS) {
+        heap_memory.resize(m_depth * 2 * buffer_size / sizeof(double) + 1);
+        memory = (char*)&heap_memory[0];
+      }
+      std::vector<Slot> stack(m_depth);
+      for (size_t i = 0; i < m_depth; ++i) {
+        stack[i].pixels = stack[i].result = NULL;
+        stack[i].buffers[0] = memory + 2 * i * buffer_size;
+        stack[i].buffers[1] = memory + (2 * i + 1) * buffer_size;
+      }
+      for (size_t done = 0; done < n; done += BLOCK) {
+        size_t block = std::min((size_t)BLOCK, n - done);
+        stack[0].result = m_result->pixels(y, x + done);
+        for (size_t i = 0; i < m_operations.size(); ++i)
+          m_operations[i]->apply(&stack[0], y, x + done, block);
+      }
+    }
+  }
+
+  /*
+    Image* _evaluate_pointwise(ImageVector operands, IntVector program,
+                               FloatVector constants, int threads);
+
+    Runs the pointwise program on the pixels of the operands, which
+    must be dense images of the same size, and returns the resulting
+    image (with the origin of the first operand).
+  */
+  inline Image* _evaluate_pointwise(ImageVector& operands, IntVector* code,
+                                    FloatVector* constants, int threads=0) {
+    using namespace PointwiseDetail;
+    Program program(operands, *code, *constants);
+    Image* first = operands[0].first;
+    Image* result = program.create_result(first->origin(), first->dim());
+    for_each_span_block(first->nrows(), first->ncols(), program.contiguous(),
+                        threads, program);
+    return result;
+  }
+}
+
+#endif
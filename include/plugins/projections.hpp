@@ -22,6 +22,12 @@
 #define kwm02212003_projections
 
 #include "gamera.hpp"
+#include "rle_utilities.hpp"
+#include "packed_utilities.hpp"
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
 
 namespace Gamera {
 
@@ -31,35 +37,191 @@ namespace Gamera {
   #endif
   
   /*
-    Generic projection routine - x and y projections
-    are acheived by passing in either row or col
-    iterators.
+    Projections are counted row by row: a RowCounter loads row y of an
+    image, and then counts the black pixels of a range of its columns,
+    or adds them to a vector of column counters, so that no projection
+    walks along the columns.  Packed rows are counted with popcount,
+    dense OneBit rows with a comparison the compiler can vectorize, and
+    the rows of other images (connected components, RLE) are first
+    turned into an array of flags.
+  */
+  namespace ProjectionDetail {
+    template<class T>
+    class RowCounter {
+    public:
+      RowCounter(const T& image) : m_image(image), m_black(image.ncols()) { }
+      void load(size_t y) {
+        typename T::const_row_iterator row = m_image.row_begin() + y;
+        typename T::const_row_iterator::iterator c = row.begin();
+        for (size_t x = 0; c != row.end(); ++c, ++x)
+          m_black[x] = is_black(*c);
+      }
+      // the black pixels in the columns [x0, x1)
+      int count(size_t x0, size_t x1) const {
+        int n = 0;
+        for (size_t x = x0; x < x1; ++x)
+          n += m_black[x];
+        return n;
+      }
+      // adds one to cols[x] for each black pixel in column x
+      void add(int* cols) const {
+        size_t ncols = m_black.size();
+        for (size_t x = 0; x < ncols; ++x)
+          cols[x] += m_black[x];
+      }
+    private:
+      const T& m_image;
+      std::vector<unsigned char> m_black;
+    };
+
+    template<>
+    class RowCounter<OneBitImageView> {
+    public:
+      RowCounter(const OneBitImageView& image)
+        : m_image(image), m_ncols(image.ncols()), m_row(0) { }
+      void load(size_t y) {
+        m_row = m_image[y];
+      }
+      int count(size_t x0, size_t x1) const {
+        int n = 0;
+        for (size_t x = x0; x < x1; ++x)
+          n += m_row[x] != 0;
+        return n;
+      }
+      void add(int* cols) const {
+        for (size_t x = 0; x < m_ncols; ++x)
+          cols[x] += m_row[x] != 0;
+      }
+    private:
+      const OneBitImageView& m_image;
+      size_t m_ncols;
+      const OneBitPixel* m_row;
+    };
+
+    template<>
+    class RowCounter<OneBitPackedImageView> {
+    public:
+      RowCounter(const OneBitPackedImageView& image)
+        : m_image(image), m_row(packed_row_words(image)) { }
+      void load(size_t y) {
+        get_packed_row(m_image, y, &m_row[0]);
+      }
+      int count(size_t x0, size_t x1) const {
+        const size_t W = PackedDataDetail::WORD_BITS;
+        if (x0 >= x1)
+          return 0;
+        size_t first = x0 / W, last = (x1 - 1) / W;
+        packed_word head = ~packed_word(0) << (x0 % W);
+        packed_word tail = packed_tail_mask(x1);
+        if (first == last)
+          return int(packed_popcount(m_row[first] & head & tail));
+        size_t n = packed_popcount(m_row[first] & head);
+        for (size_t i = first + 1; i < last; ++i)
+          n += packed_popcount(m_row[i]);
+        return int(n + packed_popcount(m_row[last] & tail));
+      }
+      void add(int* cols) const {
+        const size_t W = PackedDataDetail::WORD_BITS;
+        for (size_t i = 0; i < m_row.size(); ++i)
+          for (packed_word w = m_row[i]; w != 0; w &= w - 1)
+            ++cols[i * W + packed_lowest_bit(w)];
+      }
+    private:
+      const OneBitPackedImageView& m_image;
+      PackedRow m_row;
+    };
+
+    // the number of bands of rows for threads threads (0 for all
+    // processors), with at least 65536 pixels per band
+    inline long bands(size_t nrows, size_t ncols, int threads) {
+      if (threads <= 0) {
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#else
+        threads = 1;
+#endif
+      }
+      long npixels = long(nrows * ncols);
+      return std::max(1L, std::min(long(threads), npixels / 65536));
+    }
+  }
+
+  /*
+    The row projection (when rows is not 0) and the column projection
+    (when cols is not 0) of an image in one pass.  The rows are split
+    into bands for threads threads, which count the columns of their
+    band into vectors of their own that are summed up at the end.
   */
   template<class T>
-  inline IntVector* projection(T i, const T end) {
-    IntVector* proj = new IntVector(end - i, 0);
-    try {
-      typename T::iterator j;
-      typename IntVector::iterator p = proj->begin();
-      for (; i != end; ++i, ++p) {
-	for (j = i.begin(); j != i.end(); ++j) {
-	  if (is_black(*j))
-	    *p += 1;
-	}
-      }
-    } catch (std::exception e) {
-      delete proj;
-      throw;
+  void projection_rows_cols(const T& image, IntVector* rows, IntVector* cols,
+                            int threads=1) {
+    size_t nrows = image.nrows(), ncols = image.ncols();
+    if (rows != 0)
+      rows->assign(nrows, 0);
+    if (cols != 0)
+      cols->assign(ncols, 0);
+    long nbands = ProjectionDetail::bands(nrows, ncols, threads);
+    std::vector<IntVector> band_cols(cols != 0 ? nbands - 1 : 0, IntVector(ncols, 0));
+    long band;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nbands) schedule(static, 1) if (nbands > 1)
+#endif
+    for (band = 0; band < nbands; ++band) {
+      ProjectionDetail::RowCounter<T> counter(image);
+      int* col_counts = 0;
+      if (cols != 0)
+        col_counts = band == 0 ? &(*cols)[0] : &band_cols[band - 1][0];
+      size_t y1 = nrows * (band + 1) / nbands;
+      for (size_t y = nrows * band / nbands; y < y1; ++y) {
+        counter.load(y);
+        if (rows != 0)
+          (*rows)[y] = counter.count(0, ncols);
+        if (cols != 0)
+          counter.add(col_counts);
+      }
     }
-    return proj;
+    for (size_t i = 0; i < band_cols.size(); ++i)
+      for (size_t x = 0; x < ncols; ++x)
+        (*cols)[x] += band_cols[i][x];
+  }
+
+  /*
+    Projections of RLE images, computed from the runs: a run adds its
+    length to its row, and one to each of its columns.
+  */
+  template<class T>
+  IntVector* rle_projection(const T& image, bool rows) {
+    RleBlackRuns r;
+    rle_black_runs(image, r);
+    std::vector<size_t> proj;
+    if (rows)
+      rle_projections(r, &proj, 0);
+    else
+      rle_projections(r, 0, &proj);
+    return new IntVector(proj.begin(), proj.end());
+  }
+
+  inline IntVector* projection_rows(const OneBitRleImageView& image, int threads=1) {
+    return rle_projection(image, true);
+  }
+  inline IntVector* projection_rows(const RleCc& image, int threads=1) {
+    return rle_projection(image, true);
+  }
+  inline IntVector* projection_cols(const OneBitRleImageView& image, int threads=1) {
+    return rle_projection(image, false);
+  }
+  inline IntVector* projection_cols(const RleCc& image, int threads=1) {
+    return rle_projection(image, false);
   }
 
   /*
     Projection along the y axis (rows) of an image.
   */
   template<class T>
-  IntVector* projection_rows(const T& image) {
-    return projection(image.row_begin(), image.row_end());
+  IntVector* projection_rows(const T& image, int threads=1) {
+    IntVector* proj = new IntVector();
+    projection_rows_cols(image, proj, 0, threads);
+    return proj;
   }
 
   /*
@@ -76,25 +238,11 @@ namespace Gamera {
 
   /*
     Projection along the x axis (rows) of an image.
-    
-    MGD: Should be faster now because it accesses the image data in
-    row-major order.
   */
   template<class T>
-  IntVector* projection_cols(const T& image) {
-    IntVector* proj = new IntVector(image.ncols(), 0);
-    try {
-      for (size_t r = 0; r != image.nrows(); ++r) {
-	for (size_t c = 0; c != image.ncols(); ++c) {
-	  if (is_black(image.get(Point(c, r)))) {
-	    (*proj)[c] += 1;
-	  }
-	}
-      }
-    } catch (std::exception e) {
-      delete proj;
-      throw;
-    }
+  IntVector* projection_cols(const T& image, int threads=1) {
+    IntVector* proj = new IntVector();
+    projection_rows_cols(image, 0, proj, threads);
     return proj;
   }
 
@@ -110,6 +258,16 @@ namespace Gamera {
     return projection_cols(proj_image);
   }
 
+  // The Python part: both projections from one pass
+  template<class T>
+  PyObject* _projection_rows_cols(const T& image, int threads) {
+    IntVector rows, cols;
+    projection_rows_cols(image, &rows, &cols, threads);
+    PyObject* py_rows = IntVector_to_python(&rows);
+    PyObject* py_cols = IntVector_to_python(&cols);
+    return Py_BuildValue("(NN)", py_rows, py_cols);
+  }
+
   /*
     Projections of strips of a image -
     the coordinates are relative to the view.
@@ -147,36 +305,225 @@ namespace Gamera {
   }
 
   /*
-    returns y-projections of a rotated image
+    The projections of all strips of an image from one pass: the row
+    projections of the vertical strips between the columns in
+    x_bounds (strip i covers the columns x_bounds[i] to
+    x_bounds[i + 1] - 1), and the column projections of the horizontal
+    strips between the rows in y_bounds.  The bounds are relative to
+    the view and must not decrease.  Each band of rows counts the
+    columns of a horizontal strip into a vector of its own, which is
+    added to the projection of the strip when the band leaves it.
   */
+  namespace ProjectionDetail {
+    inline void add_strip(IntVector& xproj, IntVector& cols) {
+#ifdef _OPENMP
+#pragma omp critical (strip_projections)
+#endif
+      for (size_t x = 0; x < cols.size(); ++x)
+        xproj[x] += cols[x];
+      std::fill(cols.begin(), cols.end(), 0);
+    }
+
+    inline void check_bounds(const IntVector& bounds, size_t size) {
+      for (size_t i = 0; i < bounds.size(); ++i)
+        if (bounds[i] < 0 || size_t(bounds[i]) > size ||
+            (i > 0 && bounds[i] < bounds[i - 1]))
+          throw std::runtime_error("The strip bounds must be increasing and lie within the image.");
+    }
+  }
+
   template<class T>
-  void projection_skewed_cols(const T& image, FloatVector* angles, std::vector<IntVector*>& proj) {
-    int x;
-    size_t i;
-    size_t n = angles->size();
+  void strip_projections(const T& image, const IntVector& x_bounds,
+                         const IntVector& y_bounds,
+                         std::vector<IntVector>& yprojs,
+                         std::vector<IntVector>& xprojs, int threads=1) {
+    size_t nrows = image.nrows(), ncols = image.ncols();
+    ProjectionDetail::check_bounds(x_bounds, ncols);
+    ProjectionDetail::check_bounds(y_bounds, nrows);
+    size_t nx = x_bounds.size() > 1 ? x_bounds.size() - 1 : 0;
+    size_t ny = y_bounds.size() > 1 ? y_bounds.size() - 1 : 0;
+    yprojs.assign(nx, IntVector(nrows, 0));
+    xprojs.assign(ny, IntVector(ncols, 0));
+    long nbands = ProjectionDetail::bands(nrows, ncols, threads);
+    long band;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nbands) schedule(static, 1) if (nbands > 1)
+#endif
+    for (band = 0; band < nbands; ++band) {
+      ProjectionDetail::RowCounter<T> counter(image);
+      IntVector cols(ncols, 0);
+      size_t y1 = nrows * (band + 1) / nbands;
+      // the horizontal strip of row y, and whether cols holds counts of it
+      size_t strip = 0;
+      bool counted = false;
+      for (size_t y = nrows * band / nbands; y < y1; ++y) {
+        while (strip < ny && y >= size_t(y_bounds[strip + 1])) {
+          if (counted)
+            ProjectionDetail::add_strip(xprojs[strip], cols);
+          counted = false;
+          ++strip;
+        }
+        bool in_strip = strip < ny && y >= size_t(y_bounds[strip]);
+        if (nx == 0 && !in_strip)
+          continue;
+        counter.load(y);
+        for (size_t i = 0; i < nx; ++i)
+          yprojs[i][y] = counter.count(x_bounds[i], x_bounds[i + 1]);
+        if (in_strip) {
+          counter.add(&cols[0]);
+          counted = true;
+        }
+      }
+      if (counted)
+        ProjectionDetail::add_strip(xprojs[strip], cols);
+    }
+  }
 
-    FloatVector sina(n);
-    FloatVector cosa(n);
-    for (i = 0; i < n; i++) {
-      sina[i] = sin((*angles)[i] * M_PI / 180.0);
-      cosa[i] = cos((*angles)[i] * M_PI / 180.0);
+  // The Python part
+  template<class T>
+  PyObject* strip_projections(const T& image, IntVector* x_bounds,
+                              IntVector* y_bounds, int threads) {
+    std::vector<IntVector> yprojs, xprojs;
+    strip_projections(image, *x_bounds, *y_bounds, yprojs, xprojs, threads);
+    PyObject* py_yprojs = PyList_New(yprojs.size());
+    for (size_t i = 0; i < yprojs.size(); ++i)
+      PyList_SET_ITEM(py_yprojs, i, IntVector_to_python(&yprojs[i]));
+    PyObject* py_xprojs = PyList_New(xprojs.size());
+    for (size_t i = 0; i < xprojs.size(); ++i)
+      PyList_SET_ITEM(py_xprojs, i, IntVector_to_python(&xprojs[i]));
+    return Py_BuildValue("(NN)", py_yprojs, py_xprojs);
+  }
+
+  /*
+    Skewed projections are computed from runs of black pixels: along a
+    run the projected coordinate round(t*a + u*b) only changes where the
+    run crosses a bin boundary, so each run adds its pieces to the bins
+    with a handful of evaluations instead of one per pixel.  The
+    boundaries are estimated and then checked with the same expression
+    as for single pixels, so the projections are exact.
+  */
+  namespace SkewDetail {
+    // black pixels t0..t1 on line u
+    struct Run {
+      long u, t0, t1;
+      Run(long u_, long t0_, long t1_) : u(u_), t0(t0_), t1(t1_) { }
+    };
+
+    template<class T>
+    void horizontal_runs(const T& image, std::vector<Run>& runs) {
+      typename T::const_row_iterator row = image.row_begin();
+      for (long r = 0; row != image.row_end(); ++row, ++r) {
+        typename T::const_row_iterator::iterator col = row.begin();
+        long start = -1, c = 0;
+        for (; col != row.end(); ++col, ++c) {
+          if (is_black(*col)) {
+            if (start < 0)
+              start = c;
+          } else if (start >= 0) {
+            runs.push_back(Run(r, start, c - 1));
+            start = -1;
+          }
+        }
+        if (start >= 0)
+          runs.push_back(Run(r, start, c - 1));
+      }
     }
 
-    for (i = 0; i < n; i++)
-      proj[i] = new IntVector(image.ncols(), 0);
+    // the vertical runs, in the order of their last pixel
+    template<class T>
+    void vertical_runs(const T& image, std::vector<Run>& runs) {
+      std::vector<long> start(image.ncols(), -1);
+      typename T::const_row_iterator row = image.row_begin();
+      for (long r = 0; row != image.row_end(); ++row, ++r) {
+        typename T::const_row_iterator::iterator col = row.begin();
+        for (long c = 0; col != row.end(); ++col, ++c) {
+          if (is_black(*col)) {
+            if (start[c] < 0)
+              start[c] = r;
+          } else if (start[c] >= 0) {
+            runs.push_back(Run(c, start[c], r - 1));
+            start[c] = -1;
+          }
+        }
+      }
+      for (size_t c = 0; c < start.size(); ++c)
+        if (start[c] >= 0)
+          runs.push_back(Run(c, start[c], long(image.nrows()) - 1));
+    }
 
-    // compute skewed projections simultanously
-    for (size_t r = 0; r < image.nrows(); ++r) {
-      for (size_t c = 0; c < image.ncols(); ++c) {
-        if (is_black(image.get(Point(c, r)))) {
-          for (i = 0; i < n; i++) {
-            x = (int) round(c*cosa[i] - r*sina[i]);
-            if ((x > 0) && (x < (int)image.ncols()))
-              ++(*(proj[i]))[x];
+    // (int) round(p), without calling floor
+    inline int round_bin(double p) {
+      double q = p + 0.5;
+      int i = int(q);
+      return q < i ? i - 1 : i;
+    }
+
+    // adds every pixel t of every run to the bin round(t*a + u*b),
+    // when that bin lies in 1..proj.size()-1
+    inline void project_runs(const std::vector<Run>& runs, double a, double b,
+                             IntVector& proj) {
+      int n = int(proj.size());
+      double half = a > 0.0 ? 0.5 : -0.5;
+      for (std::vector<Run>::const_iterator run = runs.begin();
+           run != runs.end(); ++run) {
+        double base = double(run->u) * b;
+        long t = run->t0;
+        int first = round_bin(double(t) * a + base);
+        if (first == round_bin(double(run->t1) * a + base)) {
+          // most runs lie in a single bin
+          if (first > 0 && first < n)
+            proj[first] += int(run->t1 - t + 1);
+          continue;
+        }
+        while (t <= run->t1) {
+          int v = round_bin(double(t) * a + base);
+          long last = run->t1;
+          if (a != 0.0) {
+            double edge = (double(v) + half - base) / a;
+            if (edge < double(run->t1)) {
+              last = edge < double(t) ? t : long(edge);
+              while (last < run->t1 &&
+                     round_bin(double(last + 1) * a + base) == v)
+                ++last;
+              while (last > t && round_bin(double(last) * a + base) != v)
+                --last;
+            }
           }
+          if (v > 0 && v < n)
+            proj[v] += int(last - t + 1);
+          t = last + 1;
         }
       }
     }
+
+    // squared L2 norm of the derivative of a projection
+    inline double derivative_norm(const IntVector& proj) {
+      double norm = 0.0;
+      for (size_t i = 1; i < proj.size(); ++i) {
+        double d = double(proj[i - 1] - proj[i]);
+        norm += d * d;
+      }
+      return norm;
+    }
+  }
+
+  /*
+    returns y-projections of a rotated image
+  */
+  template<class T>
+  void projection_skewed_cols(const T& image, FloatVector* angles, std::vector<IntVector*>& proj) {
+    size_t i;
+    size_t n = angles->size();
+
+    std::vector<SkewDetail::Run> runs;
+    SkewDetail::vertical_runs(image, runs);
+    for (i = 0; i < n; i++) {
+      double sina = sin((*angles)[i] * M_PI / 180.0);
+      double cosa = cos((*angles)[i] * M_PI / 180.0);
+      proj[i] = new IntVector(image.ncols(), 0);
+      // x = round(c*cosa - r*sina) along the column runs
+      SkewDetail::project_runs(runs, -sina, cosa, *(proj[i]));
+    }
   }
 
   // The Python part
@@ -201,31 +548,17 @@ namespace Gamera {
   template<class T>
   void projection_skewed_rows(const T& image, FloatVector* angles, 
 			      std::vector<IntVector*>& proj) {
-    int y;
     size_t i;
     size_t n = angles->size();
 
-    FloatVector sina(n);
-    FloatVector cosa(n);
+    std::vector<SkewDetail::Run> runs;
+    SkewDetail::horizontal_runs(image, runs);
     for (i = 0; i < n; i++) {
-      sina[i] = sin((*angles)[i] * M_PI / 180.0);
-      cosa[i] = cos((*angles)[i] * M_PI / 180.0);
-    }
-
-    for (i = 0; i < n; i++)
+      double sina = sin((*angles)[i] * M_PI / 180.0);
+      double cosa = cos((*angles)[i] * M_PI / 180.0);
       proj[i] = new IntVector(image.nrows(), 0);
-
-    // compute skewed projections simultanously
-    for (size_t r = 0; r < image.nrows(); ++r) {
-      for (size_t c = 0; c < image.ncols(); ++c) {
-        if (is_black(image.get(Point(c, r)))) {
-          for (i = 0; i < n; i++) {
-            y = (int) round(c*sina[i] + r*cosa[i]);
-            if ((y > 0) && (y < (int)image.nrows()))
-              ++(*(proj[i]))[y];
-          }
-        }
-      }
+      // y = round(c*sina + r*cosa) along the row runs
+      SkewDetail::project_runs(runs, sina, cosa, *(proj[i]));
     }
   }
 
@@ -244,6 +577,131 @@ namespace Gamera {
     }
     return projlist;
   }
+
+  /*
+    Skew angle estimation of Dalitz et al. (IJDAR 11, 2008): the angle
+    whose skewed row projection has the largest derivative norm, first on
+    a grid of at most 0.5 degrees and then refined by golden section
+    search.  The runs are extracted once and shared by all angles.
+  */
+  namespace SkewDetail {
+    class SkewCriterion {
+    public:
+      template<class T>
+      SkewCriterion(const T& image) : m_proj(image.nrows()) {
+        horizontal_runs(image, m_runs);
+      }
+      double operator()(double angle) {
+        std::fill(m_proj.begin(), m_proj.end(), 0);
+        project_runs(m_runs, sin(angle * M_PI / 180.0),
+                     cos(angle * M_PI / 180.0), m_proj);
+        return derivative_norm(m_proj);
+      }
+    private:
+      std::vector<Run> m_runs;
+      IntVector m_proj;
+    };
+  }
+
+  template<class T>
+  FloatVector* rotation_angle_projections(const T& image, double minangle,
+                                          double maxangle, double accuracy) {
+    if (accuracy == 0)
+      accuracy = 180 * 0.5 / (image.ncols() * M_PI);
+    if (maxangle <= minangle) {
+      char msg[128];
+      sprintf(msg, "maxangle %f must be greater than minangle %f\n",
+              maxangle, minangle);
+      throw std::runtime_error(msg);
+    }
+    SkewDetail::SkewCriterion criterion(image);
+
+    // rough guess where the maximum is,
+    // necessary because the criterion has many local maxima
+    double roughacc = 0.5;
+    if ((maxangle - minangle) / 4.0 < roughacc)
+      // at least five trial points
+      roughacc = (maxangle - minangle) / 4.0;
+    else
+      roughacc = (maxangle - minangle) / round((maxangle - minangle) / roughacc);
+    int nangles = int(round((maxangle - minangle) / roughacc)) + 1;
+    FloatVector angle(nangles), alist(nangles);
+    size_t bi = 0;
+    for (int i = 0; i < nangles; ++i) {
+      angle[i] = minangle + i * roughacc;
+      alist[i] = criterion(angle[i]);
+      if (alist[i] > alist[bi])
+        bi = i;
+    }
+    double a, b = angle[bi], c, fa, fb = alist[bi], fc;
+
+    // initialize values for golden section search
+    if (bi == 0) {
+      // maximum on lower interval end: check neighborhood
+      c = b + 1.5 * accuracy;
+      fc = criterion(c);
+      if (fc > fb && c < angle[bi + 1]) {
+        a = b; fa = fb;
+        b = c; fb = fc;
+        c = angle[bi + 1]; fc = alist[bi + 1];
+      } else {
+        char msg[128];
+        sprintf(msg, "maximum found on interval end %f\n", angle[bi]);
+        throw std::runtime_error(msg);
+      }
+    } else if (bi == angle.size() - 1) {
+      // maximum on upper interval end: check neighborhood
+      a = b - 1.5 * accuracy;
+      fa = criterion(a);
+      if (fa > fb && a > angle[bi - 1]) {
+        c = b; fc = fb;
+        b = a; fb = fa;
+        a = angle[bi - 1]; fa = alist[bi - 1];
+      } else {
+        char msg[128];
+        sprintf(msg, "maximum found on interval end %f\n", angle[bi]);
+        throw std::runtime_error(msg);
+      }
+    } else {
+      // the normal case: maximum somewhere in the middle
+      a = angle[bi - 1]; fa = alist[bi - 1];
+      c = angle[bi + 1]; fc = alist[bi + 1];
+    }
+
+    // fine tuning with golden section search, see Press et al:
+    // "Numerical Recipes", Cambridge University Press (1986)
+    const double golden = 0.38197; // (3 - sqrt(5)) / 2
+    bool first = true;
+    while (c - b > accuracy || b - a > accuracy) {
+      double x;
+      if (first)
+        // special case first iteration
+        x = fc > fa ? b + golden * (c - b) : b - golden * (b - a);
+      else
+        x = c - b > b - a ? b + golden * (c - b) : b - golden * (b - a);
+      first = false;
+      double fx = criterion(x);
+      if (x > b) {
+        if (fx < fb) {
+          c = x; fc = fx;
+        } else {
+          a = b; fa = fb;
+          b = x; fb = fx;
+        }
+      } else {
+        if (fx < fb) {
+          a = x; fa = fx;
+        } else {
+          c = b; fc = fb;
+          b = x; fb = fx;
+        }
+      }
+    }
+    FloatVector* result = new FloatVector(2);
+    (*result)[0] = b;
+    (*result)[1] = accuracy;
+    return result;
+  }
 }
 
 #endif
@@ -0,0 +1,291 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef gamera_rle_utilities_hpp
+#define gamera_rle_utilities_hpp
+
+#include "gamera.hpp"
+#include <vector>
+#include <algorithm>
+
+/*
+  Helpers for run-based algorithms on OneBitRleImageViews and RleCcs.
+
+  Rather than expanding the runs pixel by pixel through the RLE
+  iterators, rle_black_runs reads the runs of the underlying
+  RleImageData directly and collects the black runs of each row of the
+  view, clipped to the view. The algorithms then work on these runs,
+  so their cost depends on the number of runs and not on the number of
+  pixels.
+*/
+
+namespace Gamera {
+
+  /*
+    The black runs of an image, row by row.  Each run is the half-open
+    column range [first, second) relative to the view, and the runs of
+    row y are runs[row[y]] ... runs[row[y+1] - 1], sorted and maximal
+    (adjacent runs are merged).
+  */
+  struct RleBlackRuns {
+    typedef std::pair<size_t, size_t> run_type;
+    size_t nrows, ncols;
+    std::vector<run_type> runs;
+    std::vector<size_t> row;
+  };
+
+  namespace RleUtilitiesDetail {
+    // whether a run value is black in a view or in a cc
+    struct ViewBlack {
+      bool operator()(OneBitPixel v) const { return is_black(v); }
+    };
+    struct CcBlack {
+      CcBlack(OneBitPixel label) : m_label(label) { }
+      bool operator()(OneBitPixel v) const { return v == m_label; }
+      OneBitPixel m_label;
+    };
+
+    template<class Image, class Black>
+    void black_runs(const Image& image, const Black& black, RleBlackRuns& out) {
+      using namespace RleDataDetail;
+      const OneBitRleImageData& data = *image.data();
+      size_t stride = data.stride();
+      size_t x0 = image.offset_x() - data.page_offset_x();
+      size_t y0 = image.offset_y() - data.page_offset_y();
+      out.nrows = image.nrows();
+      out.ncols = image.ncols();
+      out.runs.clear();
+      out.row.assign(1, 0);
+      for (size_t y = 0; y < image.nrows(); ++y) {
+        size_t p0 = (y0 + y) * stride + x0;
+        size_t p1 = p0 + image.ncols();
+        size_t first = out.runs.size();
+        for (size_t chunk = get_chunk(p0); chunk <= get_chunk(p1 - 1); ++chunk) {
+          const OneBitRleImageData::list_type& list = data.m_data[chunk];
+          size_t base = chunk << RLE_CHUNK_BITS;
+          OneBitRleImageData::list_type::const_iterator i = list.begin();
+          if (base < p0)
+            i = find_run_in_list(list.begin(), list.end(), get_rel_pos(p0));
+          size_t start = (i == list.begin()) ? base : base + prev(i)->end + 1;
+          for (; i != list.end() && start < p1; ++i) {
+            size_t end = base + i->end + 1;
+            if (black(i->value)) {
+              size_t b = std::max(start, p0) - p0;
+              size_t e = std::min(end, p1) - p0;
+              if (out.runs.size() > first && out.runs.back().second == b)
+                out.runs.back().second = e;
+              else
+                out.runs.push_back(RleBlackRuns::run_type(b, e));
+            }
+            start = end;
+          }
+        }
+        out.row.push_back(out.runs.size());
+      }
+    }
+  }
+
+  inline void rle_black_runs(const OneBitRleImageView& image, RleBlackRuns& out) {
+    RleUtilitiesDetail::black_runs(image, RleUtilitiesDetail::ViewBlack(), out);
+  }
+
+  inline void rle_black_runs(const RleCc& image, RleBlackRuns& out) {
+    RleUtilitiesDetail::black_runs(image, RleUtilitiesDetail::CcBlack(image.label()), out);
+  }
+
+  /*
+    RleBuilder writes the pixels of an RLE image in order, row by row
+    (a run continues on the next row at the right edge), as the bulk
+    producers (loaders, thresholds, copies and decoders) do.  Equal
+    neighbours are gathered into runs.  When the view covers all of its
+    data, the data is cleared first and the runs are appended to the
+    run lists in amortized constant time, without searching them, and
+    the iterators of the data are invalidated only once, when the
+    builder is destroyed.  Other views are written pixel by pixel.
+  */
+  template<class T>
+  class RleBuilder {
+  public:
+    typedef ImageView<RleImageData<T> > view_type;
+
+    RleBuilder(view_type& view)
+      : m_view(view), m_data(*view.data()), m_pos(0), m_value(0), m_length(0) {
+      m_whole = view.offset_x() == m_data.page_offset_x()
+        && view.offset_y() == m_data.page_offset_y()
+        && view.ncols() == m_data.ncols() && view.nrows() == m_data.nrows();
+      if (m_whole)
+        m_data.clear();
+    }
+    ~RleBuilder() {
+      flush();
+      ++m_data.m_dirty;
+    }
+
+    // appends n pixels of value v
+    void append(T v, size_t n = 1) {
+      if (v != m_value) {
+        flush();
+        m_value = v;
+      }
+      m_length += n;
+    }
+
+  private:
+    void flush() {
+      if (m_length == 0)
+        return;
+      if (m_whole) {
+        if (m_value != 0)
+          m_data.push_run(m_pos, m_pos + m_length - 1, m_value);
+      } else {
+        size_t ncols = m_view.ncols();
+        for (size_t i = m_pos; i < m_pos + m_length; ++i)
+          m_view.set(Point(i % ncols, i / ncols), m_value);
+      }
+      m_pos += m_length;
+      m_length = 0;
+    }
+
+    view_type& m_view;
+    RleImageData<T>& m_data;
+    bool m_whole;
+    size_t m_pos;
+    T m_value;
+    size_t m_length;
+  };
+
+  /*
+    The number of black pixels in each row (rows) or each column (cols).
+  */
+  inline void rle_projections(const RleBlackRuns& r, std::vector<size_t>* rows,
+                              std::vector<size_t>* cols) {
+    if (rows != 0) {
+      rows->assign(r.nrows, 0);
+      for (size_t y = 0; y < r.nrows; ++y)
+        for (size_t i = r.row[y]; i < r.row[y + 1]; ++i)
+          (*rows)[y] += r.runs[i].second - r.runs[i].first;
+    }
+    if (cols != 0) {
+      // every run adds one to a range of columns
+      std::vector<long> diff(r.ncols + 1, 0);
+      for (size_t i = 0; i < r.runs.size(); ++i) {
+        ++diff[r.runs[i].first];
+        --diff[r.runs[i].second];
+      }
+      cols->assign(r.ncols, 0);
+      long sum = 0;
+      for (size_t x = 0; x < r.ncols; ++x) {
+        sum += diff[x];
+        (*cols)[x] = size_t(sum);
+      }
+    }
+  }
+
+  /*
+    The number of vertical black runs in each column.  A vertical run
+    starts at every black pixel whose upper neighbour is white, so the
+    starts of row y are its runs minus the runs of row y - 1.
+  */
+  inline void rle_column_run_counts(const RleBlackRuns& r, std::vector<size_t>& counts) {
+    std::vector<long> diff(r.ncols + 1, 0);
+    for (size_t y = 0; y < r.nrows; ++y) {
+      size_t j = (y == 0) ? 0 : r.row[y - 1];
+      size_t j_end = (y == 0) ? 0 : r.row[y];
+      for (size_t i = r.row[y]; i < r.row[y + 1]; ++i) {
+        size_t b = r.runs[i].first, e = r.runs[i].second;
+        // subtract the runs of the row above from [b, e)
+        while (j < j_end && r.runs[j].second <= b)
+          ++j;
+        size_t k = j;
+        while (b < e) {
+          if (k < j_end && r.runs[k].first < e) {
+            if (r.runs[k].first > b) {
+              ++diff[b];
+              --diff[r.runs[k].first];
+            }
+            b = std::max(b, r.runs[k].second);
+            ++k;
+          } else {
+            ++diff[b];
+            --diff[e];
+            b = e;
+          }
+        }
+      }
+    }
+    counts.assign(r.ncols, 0);
+    long sum = 0;
+    for (size_t x = 0; x < r.ncols; ++x) {
+      sum += diff[x];
+      counts[x] = size_t(sum);
+    }
+  }
+
+  /*
+    The black runs of each column, stored as the runs of the rows of
+    the transposed image (out.nrows is r.ncols).  A vertical run can
+    only start or end in the columns where row y differs from row
+    y - 1, which is the symmetric difference of the runs of both rows,
+    so the cost depends on the number of runs and not on the number of
+    pixels.
+  */
+  inline void rle_column_runs(const RleBlackRuns& r, RleBlackRuns& out) {
+    typedef std::pair<size_t, RleBlackRuns::run_type> column_run;
+    std::vector<size_t> start(r.ncols, 0);
+    std::vector<char> open(r.ncols, 0);
+    std::vector<column_run> found;
+    std::vector<size_t> above, here, bounds;
+    for (size_t y = 0; y <= r.nrows; ++y) {
+      here.clear();
+      if (y < r.nrows) {
+        for (size_t i = r.row[y]; i < r.row[y + 1]; ++i) {
+          here.push_back(r.runs[i].first);
+          here.push_back(r.runs[i].second);
+        }
+      }
+      // the color changes between the pairs of merged boundaries
+      bounds.resize(above.size() + here.size());
+      std::merge(above.begin(), above.end(), here.begin(), here.end(), bounds.begin());
+      for (size_t k = 0; k + 1 < bounds.size(); k += 2) {
+        for (size_t x = bounds[k]; x < bounds[k + 1]; ++x) {
+          if (open[x])
+            found.push_back(column_run(x, RleBlackRuns::run_type(start[x], y)));
+          else
+            start[x] = y;
+          open[x] = !open[x];
+        }
+      }
+      above.swap(here);
+    }
+    // sort the runs by column; the runs of a column are found top down
+    out.nrows = r.ncols;
+    out.ncols = r.nrows;
+    out.row.assign(r.ncols + 1, 0);
+    for (size_t i = 0; i < found.size(); ++i)
+      ++out.row[found[i].first + 1];
+    for (size_t x = 0; x < r.ncols; ++x)
+      out.row[x + 1] += out.row[x];
+    out.runs.resize(found.size());
+    std::vector<size_t> next(out.row.begin(), out.row.end() - 1);
+    for (size_t i = 0; i < found.size(); ++i)
+      out.runs[next[found[i].first]++] = found[i].second;
+  }
+}
+
+#endif
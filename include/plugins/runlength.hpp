@@ -23,6 +23,8 @@
 #include <Python.h>
 #endif
 #include "gamera.hpp"
+#include "rle_utilities.hpp"
+#include "packed_utilities.hpp"
 #include "python_iterator.hpp"
 #include <vector>
 #include <algorithm>
@@ -197,7 +199,7 @@ namespace Gamera {
   }
 
 ///////////////////////////////////////////////////////////////////////////
-// Run-length histograms. These make a histogram of the lenght of the
+// Run-length histograms. These make a histogram of the length of the
 // runs in an image. They take an iterator range and a random-access
 // container for the result (that should be appropriately sized). The
 // histogram vector is not filled with zeros so that successive calls
@@ -284,9 +286,11 @@ namespace Gamera {
     IntVector tmp(image.ncols(), 0);
 
     try {
-      for (size_t r = 0; r != image.nrows(); ++r) {
-	for (size_t c = 0; c != image.ncols(); ++c) {
-	  if (color.is_self(image.get(Point(c, r)))) {
+      typename T::const_row_iterator row = image.row_begin();
+      for (; row != image.row_end(); ++row) {
+	typename T::const_col_iterator col = row.begin();
+	for (size_t c = 0; c != image.ncols(); ++c, ++col) {
+	  if (color.is_self(*col)) {
 	    tmp[c]++;
 	  } else {
 	    if (tmp[c] > 0) {
@@ -327,6 +331,101 @@ namespace Gamera {
 ///////////////////////////////////////////////////////////////////////////
 // Most frequent run(s) (basically returning a subset of a sorted histogram)
 
+  /*
+    OneBitRleImageViews and RleCcs take their runs from the run lists
+    of the RleImageData (see rle_black_runs) instead of expanding them
+    through the iterators.  The white runs are the gaps between the
+    black runs, and the vertical runs are derived from the runs of the
+    rows (see rle_column_runs), so the image is never read column by
+    column.
+  */
+  template<class F>
+  inline void for_each_run(const RleBlackRuns& r, size_t y, const runs::Black& color, F& f) {
+    for (size_t i = r.row[y]; i < r.row[y + 1]; ++i)
+      f(y, r.runs[i].first, r.runs[i].second);
+  }
+
+  template<class F>
+  inline void for_each_run(const RleBlackRuns& r, size_t y, const runs::White& color, F& f) {
+    size_t x = 0;
+    for (size_t i = r.row[y]; i < r.row[y + 1]; ++i) {
+      if (r.runs[i].first > x)
+        f(y, x, r.runs[i].first);
+      x = r.runs[i].second;
+    }
+    if (x < r.ncols)
+      f(y, x, r.ncols);
+  }
+
+  struct RunHistogramFunctor {
+    RunHistogramFunctor(IntVector& hist, size_t end, bool count_end)
+      : m_hist(hist), m_end(end), m_count_end(count_end) { }
+    void operator()(size_t y, size_t begin, size_t end) {
+      if (m_count_end || end != m_end)
+        m_hist[end - begin]++;
+    }
+    IntVector& m_hist;
+    size_t m_end;
+    bool m_count_end;
+  };
+
+  template<class T, class Color>
+  IntVector* rle_run_histogram(const T& image, const Color& color, const runs::Horizontal& direction) {
+    IntVector* hist = new IntVector(image.ncols() + 1, 0);
+
+    try {
+      RleBlackRuns r;
+      rle_black_runs(image, r);
+      RunHistogramFunctor count(*hist, r.ncols, true);
+      for (size_t y = 0; y < r.nrows; ++y)
+        for_each_run(r, y, color, count);
+    } catch (std::exception e) {
+      delete hist;
+      throw;
+    }
+    return hist;
+  }
+
+  // like the generic version, this does not count the runs that
+  // reach the bottom of the image
+  template<class T, class Color>
+  IntVector* rle_run_histogram(const T& image, const Color& color, const runs::Vertical& direction) {
+    IntVector* hist = new IntVector(image.nrows() + 1, 0);
+
+    try {
+      RleBlackRuns r, c;
+      rle_black_runs(image, r);
+      rle_column_runs(r, c);
+      RunHistogramFunctor count(*hist, c.ncols, false);
+      for (size_t x = 0; x < c.nrows; ++x)
+        for_each_run(c, x, color, count);
+    } catch (std::exception e) {
+      delete hist;
+      throw;
+    }
+    return hist;
+  }
+
+  template<class Color>
+  IntVector* run_histogram(const OneBitRleImageView& image, const Color& color, const runs::Horizontal& direction) {
+    return rle_run_histogram(image, color, direction);
+  }
+
+  template<class Color>
+  IntVector* run_histogram(const OneBitRleImageView& image, const Color& color, const runs::Vertical& direction) {
+    return rle_run_histogram(image, color, direction);
+  }
+
+  template<class Color>
+  IntVector* run_histogram(const RleCc& image, const Color& color, const runs::Horizontal& direction) {
+    return rle_run_histogram(image, color, direction);
+  }
+
+  template<class Color>
+  IntVector* run_histogram(const RleCc& image, const Color& color, const runs::Vertical& direction) {
+    return rle_run_histogram(image, color, direction);
+  }
+
   template<class T, class Color, class Direction>
   size_t most_frequent_run(const T& image, const Color& color, const Direction& direction) {
     IntVector* hist = run_histogram(image, color, direction);
@@ -446,21 +545,123 @@ namespace Gamera {
     }
   }
 
-  template<class Iter, class Color>
-  inline void image_filter_long_run(Iter i, const Iter end, const int min_length, const Color& color) {
-    for (; i != end; i++)
-      filter_run(i.begin(), i.end(), min_length, std::greater<size_t>(), color);
+  template<class T, class Functor, class Color, class Direction>
+  void filter_runs(T& image, size_t length, const Functor& functor, const Color& color,
+                   const Direction& direction) {
+    typedef typename runs::GetIterator<T, Direction>::iterator iterator;
+    iterator end = direction.end(image);
+    for (iterator i = direction.begin(image); i != end; ++i)
+      filter_run(i.begin(), i.end(), length, functor, color);
+  }
+
+  /*
+    In OneBitRleImageViews and RleCcs, all runs to filter are found
+    from the run lists first (as for the histograms above), and are
+    then set to the other color.  Since a run is only replaced by the
+    color around it, this does not change the other runs.
+  */
+  template<class T, class Functor, class Direction>
+  struct RunFilterFunctor {
+    RunFilterFunctor(T& image, size_t length, typename T::value_type value)
+      : m_image(image), m_length(length), m_value(value) { }
+    void operator()(size_t i, size_t begin, size_t end) {
+      if (Functor()(end - begin, m_length))
+        fill(i, begin, end, Direction());
+    }
+    void fill(size_t y, size_t begin, size_t end, const runs::Horizontal&) {
+      typename T::row_iterator row = m_image.row_begin() + y;
+      std::fill(row.begin() + begin, row.begin() + end, m_value);
+    }
+    void fill(size_t x, size_t begin, size_t end, const runs::Vertical&) {
+      typename T::col_iterator col = m_image.col_begin() + x;
+      std::fill(col.begin() + begin, col.begin() + end, m_value);
+    }
+    T& m_image;
+    size_t m_length;
+    typename T::value_type m_value;
+  };
+
+  template<class T, class Functor, class Color>
+  void rle_filter_runs(T& image, size_t length, const Functor& functor, const Color& color,
+                       const runs::Horizontal& direction) {
+    RleBlackRuns r;
+    rle_black_runs(image, r);
+    RunFilterFunctor<T, Functor, runs::Horizontal> filter(image, length, color.other(image));
+    for (size_t y = 0; y < r.nrows; ++y)
+      for_each_run(r, y, color, filter);
+  }
+
+  template<class T, class Functor, class Color>
+  void rle_filter_runs(T& image, size_t length, const Functor& functor, const Color& color,
+                       const runs::Vertical& direction) {
+    RleBlackRuns r, c;
+    rle_black_runs(image, r);
+    rle_column_runs(r, c);
+    RunFilterFunctor<T, Functor, runs::Vertical> filter(image, length, color.other(image));
+    for (size_t x = 0; x < c.nrows; ++x)
+      for_each_run(c, x, color, filter);
+  }
+
+  /*
+    The vertical runs of dense images are found row by row, with the
+    first row of the current run of every column, so that the image is
+    read in memory order instead of column by column (which strides by
+    a whole row per pixel on wide pages).  Only the runs that are
+    filtered are written along their column.
+  */
+  template<class T, class Functor, class Color>
+  void filter_vertical_runs(T& image, size_t length, const Functor& functor,
+                            const Color& color) {
+    RunFilterFunctor<T, Functor, runs::Vertical> filter(image, length, color.other(image));
+    size_t nrows = image.nrows(), ncols = image.ncols();
+    // nrows for the columns that are not in a run
+    std::vector<size_t> start(ncols, nrows);
+    typename T::row_iterator row = image.row_begin();
+    for (size_t y = 0; y < nrows; ++y, ++row) {
+      typename T::col_iterator col = row.begin();
+      for (size_t x = 0; x < ncols; ++x, ++col) {
+        if (color.is_self(*col)) {
+          if (start[x] == nrows)
+            start[x] = y;
+        } else if (start[x] != nrows) {
+          filter(x, start[x], y);
+          start[x] = nrows;
+        }
+      }
+    }
+    for (size_t x = 0; x < ncols; ++x)
+      if (start[x] != nrows)
+        filter(x, start[x], nrows);
+  }
+
+  template<class P, class Functor, class Color>
+  void filter_runs(ImageView<ImageData<P> >& image, size_t length, const Functor& functor,
+                   const Color& color, const runs::Vertical& direction) {
+    filter_vertical_runs(image, length, functor, color);
+  }
+
+  template<class P, class Functor, class Color>
+  void filter_runs(ConnectedComponent<ImageData<P> >& image, size_t length,
+                   const Functor& functor, const Color& color,
+                   const runs::Vertical& direction) {
+    filter_vertical_runs(image, length, functor, color);
   }
 
-  template<class Iter, class Color>
-  inline void image_filter_short_run(Iter i, const Iter end, const int max_length, const Color& color) {
-    for (; i != end; i++)
-      filter_run(i.begin(), i.end(), max_length, std::less<size_t>(), color);
+  template<class Functor, class Color, class Direction>
+  void filter_runs(OneBitRleImageView& image, size_t length, const Functor& functor,
+                   const Color& color, const Direction& direction) {
+    rle_filter_runs(image, length, functor, color, direction);
+  }
+
+  template<class Functor, class Color, class Direction>
+  void filter_runs(RleCc& image, size_t length, const Functor& functor,
+                   const Color& color, const Direction& direction) {
+    rle_filter_runs(image, length, functor, color, direction);
   }
 
   template<class T, class Color>
   void filter_narrow_runs(T& image, size_t max_width, const Color& color) {
-    image_filter_short_run(image.row_begin(), image.row_end(), max_width, color);
+    filter_runs(image, max_width, std::less<size_t>(), color, runs::Horizontal());
   }
 
   template<class T>
@@ -475,7 +676,7 @@ namespace Gamera {
 
   template<class T, class Color>
   void filter_short_runs(T& image, size_t max_height, const Color& color) {
-    image_filter_short_run(image.col_begin(), image.col_end(), max_height, color);
+    filter_runs(image, max_height, std::less<size_t>(), color, runs::Vertical());
   }
 
   template<class T>
@@ -490,7 +691,7 @@ namespace Gamera {
 
   template<class T, class Color>
   void filter_tall_runs(T& image, size_t min_height, const Color& color) {
-    image_filter_long_run(image.col_begin(), image.col_end(), min_height, color);
+    filter_runs(image, min_height, std::greater<size_t>(), color, runs::Vertical());
   }
 
   template<class T>
@@ -505,7 +706,7 @@ namespace Gamera {
 
   template<class T, class Color>
   void filter_wide_runs(T& image, size_t min_width, const Color& color) {
-    image_filter_long_run(image.row_begin(), image.row_end(), min_width, color);
+    filter_runs(image, min_width, std::greater<size_t>(), color, runs::Horizontal());
   }
 
   template<class T>
@@ -522,81 +723,308 @@ namespace Gamera {
 // TO/FROM RLE
 #ifndef GAMERA_NO_PYTHON
 
-  template<class T>
-  std::string to_rle(const T& image) {
-    // White first
-    std::ostringstream oss;
-
-    for (typename T::const_vec_iterator i = image.vec_begin();
-	 i != image.vec_end(); /* deliberately blank */) {
-      typename T::const_vec_iterator start;
-      start = i;
-      run_end(i, image.vec_end(), runs::White());
-      oss << int(i - start) << " ";
-      start = i;
-      run_end(i, image.vec_end(), runs::Black());
-      oss << int(i - start) << " ";
-    }
-
-    return oss.str();
-  }
-
-  inline long next_number(char* &s) {
-    // I would love to use istream::scan for this, but it's a GNU
-    // extension.  Plus, this is probably faster anyway,
-    // since it's more naive.
-
-    // Scan through whitespace (literally, non-numeric)
-    while (true) {
-      if ((*s >= 9 && *s <= 13) || *s == 32)
-	++s;
-      else {
-	if (*s >= '0' && *s <= '9')
-	  break;
-	if (*s == '\0')
-	  return -1;
-	throw std::invalid_argument("Invalid character in runlength string.");
+  /*
+    The run-length strings of to_rle and from_rle are decimal numbers
+    separated by white space, alternating between white and black runs
+    (white first) along the rows.  The numbers are written with a
+    hand-rolled formatter and read with a scanner that works on the
+    characters of both byte and unicode strings, so that the XML loader
+    does not need to convert its character data first.
+  */
+  namespace RleCodecDetail {
+    inline void append_number(std::string& out, size_t number) {
+      char digits[24];
+      char* p = digits + sizeof(digits);
+      *--p = ' ';
+      do {
+        *--p = char('0' + number % 10);
+        number /= 10;
+      } while (number != 0);
+      out.append(p, digits + sizeof(digits));
+    }
+
+    template<class T>
+    void encode(const T& image, std::string& out) {
+      bool black_run = false;
+      size_t run = 0;
+      for (typename T::const_row_iterator r = image.row_begin(); r != image.row_end(); ++r) {
+        for (typename T::const_col_iterator c = r.begin(); c != r.end(); ++c) {
+          if (is_black(*c) != black_run) {
+            append_number(out, run);
+            black_run = !black_run;
+            run = 0;
+          }
+          ++run;
+        }
+      }
+      append_number(out, run);
+      // every white run is followed by a (possibly empty) black run
+      if (!black_run)
+        append_number(out, 0);
+    }
+
+    // The next number in [p, end), or -1 at the end of the string.
+    template<class Char>
+    long next_number(const Char*& p, const Char* end) {
+      for (; p != end; ++p) {
+        unsigned long c = (unsigned long)*p;
+        if (c - '0' < 10)
+          break;
+        if (c != ' ' && c - 9 > 4)
+          throw std::invalid_argument("Invalid character in runlength string.");
+      }
+      if (p == end)
+        return -1;
+      long number = 0;
+      for (unsigned long d; p != end && (d = (unsigned long)*p - '0') < 10; ++p)
+        number = number * 10 + long(d);
+      return number;
+    }
+
+    template<class T, class Char>
+    void decode(T& image, const Char* p, const Char* end) {
+      typename T::value_type colors[2] = { white(image), black(image) };
+      size_t left = image.nrows() * image.ncols();
+      size_t ncols = image.ncols(), col = 0;
+      typename T::row_iterator r = image.row_begin();
+      typename T::col_iterator c = r.begin();
+      while (left != 0) {
+        for (size_t color = 0; color < 2; ++color) {
+          long run = next_number(p, end);
+          if (run < 0)
+            throw std::invalid_argument("Image is too large for run-length data");
+          if (size_t(run) > left)
+            throw std::invalid_argument("Image is too small for run-length data");
+          left -= size_t(run);
+          // a run continues on the next row at the right edge
+          for (size_t n = size_t(run); n != 0; ) {
+            size_t k = std::min(n, ncols - col);
+            n -= k;
+            col += k;
+            for (; k != 0; --k, ++c)
+              *c = colors[color];
+            if (col == ncols && left + n != 0) {
+              col = 0;
+              ++r;
+              c = r.begin();
+            }
+          }
+        }
+      }
+    }
+
+    // RLE images get the runs as they are read
+    template<class Char>
+    void decode(OneBitRleImageView& image, const Char* p, const Char* end) {
+      OneBitPixel colors[2] = { white(image), black(image) };
+      size_t left = image.nrows() * image.ncols();
+      RleBuilder<OneBitPixel> builder(image);
+      while (left != 0) {
+        for (size_t color = 0; color < 2; ++color) {
+          long run = next_number(p, end);
+          if (run < 0)
+            throw std::invalid_argument("Image is too large for run-length data");
+          if (size_t(run) > left)
+            throw std::invalid_argument("Image is too small for run-length data");
+          left -= size_t(run);
+          builder.append(colors[color], size_t(run));
+        }
       }
     }
 
-    long number = 0;
-    // Read in number
-    for (; *s >= '0' && *s <= '9'; ++s) {
-      number *= 10;
-      number += *s - '0';
+    // packed images get the runs as ranges of bits
+    template<class Char>
+    void decode(OneBitPackedImageView& image, const Char* p, const Char* end) {
+      OneBitPackedImageData* data = image.data();
+      size_t left = image.nrows() * image.ncols();
+      size_t ncols = image.ncols(), col = 0;
+      size_t col0 = image.offset_x() - data->page_offset_x();
+      size_t row = image.offset_y() - data->page_offset_y();
+      while (left != 0) {
+        for (size_t color = 0; color < 2; ++color) {
+          long run = next_number(p, end);
+          if (run < 0)
+            throw std::invalid_argument("Image is too large for run-length data");
+          if (size_t(run) > left)
+            throw std::invalid_argument("Image is too small for run-length data");
+          left -= size_t(run);
+          // a run continues on the next row at the right edge
+          for (size_t n = size_t(run); n != 0; ) {
+            size_t k = std::min(n, ncols - col);
+            packed_fill_bits(data->row(row), col0 + col, col0 + col + k,
+                             color != 0);
+            n -= k;
+            col += k;
+            if (col == ncols && left + n != 0) {
+              col = 0;
+              ++row;
+            }
+          }
+        }
+      }
     }
 
-    return number;
+    template<class T>
+    void decode_string(T& image, PyObject* runs) {
+      if (PyString_Check(runs)) {
+        const char* p = PyString_AS_STRING(runs);
+        decode(image, p, p + PyString_GET_SIZE(runs));
+      } else if (PyUnicode_Check(runs)) {
+        const Py_UNICODE* p = PyUnicode_AS_UNICODE(runs);
+        decode(image, p, p + PyUnicode_GET_SIZE(runs));
+      } else {
+        throw std::invalid_argument("The runs must be given as strings.");
+      }
+    }
+  }
+
+  template<class T>
+  std::string to_rle(const T& image) {
+    std::string result;
+    result.reserve(64);
+    RleCodecDetail::encode(image, result);
+    return result;
   }
 
   template<class T>
   void from_rle(T& image, const char *runs) {
-    // White first
-
-    char *p = const_cast<char *>(runs);
-    // Outside the loop since we need to do a check at the end
-    for (typename T::vec_iterator i = image.vec_begin();
-	 i != image.vec_end(); /* deliberately blank */) {
-      // white
-      long run;
-      run = next_number(p);
-      if (run < 0)
-	throw std::invalid_argument("Image is too large for run-length data");
-      typename T::vec_iterator end = i + (size_t)run;
-      if (end > image.vec_end())
-	throw std::invalid_argument("Image is too small for run-length data");
-      std::fill(i, end, white(image));
-      i = end;
-      // black
-      run = next_number(p);
-      if (run < 0)
-	throw std::invalid_argument("Image is too large for run-length data");
-      end = i + (size_t)run;
-      if (end > image.vec_end())
-	throw std::invalid_argument("Image is too small for run-length data");
-      std::fill(i, end, black(image));
-      i = end;
+    RleCodecDetail::decode(image, runs, runs + strlen(runs));
+  }
+
+  /*
+    to_rle and from_rle for a whole list of glyphs.
+  */
+  inline PyObject* glyphs_to_rle(ImageVector& glyphs) {
+    PyObject* result = PyList_New(glyphs.size());
+    if (result == NULL)
+      return NULL;
+    std::string runs;
+    for (size_t i = 0; i < glyphs.size(); ++i) {
+      runs.clear();
+      Image* image = glyphs[i].first;
+      switch (glyphs[i].second) {
+      case ONEBITIMAGEVIEW:
+        RleCodecDetail::encode(*((OneBitImageView*)image), runs);
+        break;
+      case CC:
+        RleCodecDetail::encode(*((Cc*)image), runs);
+        break;
+      case MLCC:
+        RleCodecDetail::encode(*((MlCc*)image), runs);
+        break;
+      case ONEBITRLEIMAGEVIEW:
+        RleCodecDetail::encode(*((OneBitRleImageView*)image), runs);
+        break;
+      case RLECC:
+        RleCodecDetail::encode(*((RleCc*)image), runs);
+        break;
+      case ONEBITPACKEDIMAGEVIEW:
+        RleCodecDetail::encode(*((OneBitPackedImageView*)image), runs);
+        break;
+      default:
+        Py_DECREF(result);
+        throw std::runtime_error("There is an Image in the list that is not a OneBit image.");
+      }
+      PyList_SET_ITEM(result, i, PyString_FromStringAndSize(runs.data(), runs.size()));
     }
+    return result;
+  }
+
+  inline void glyphs_from_rle(ImageVector& glyphs, PyObject* runs) {
+    PyObject* seq = PySequence_Fast(runs, "runs must be a sequence of strings");
+    if (seq == NULL)
+      throw std::runtime_error("runs must be a sequence of strings");
+    if (size_t(PySequence_Fast_GET_SIZE(seq)) != glyphs.size()) {
+      Py_DECREF(seq);
+      throw std::invalid_argument("There must be one string of runs for each glyph.");
+    }
+    try {
+      for (size_t i = 0; i < glyphs.size(); ++i) {
+        PyObject* s = PySequence_Fast_GET_ITEM(seq, i);
+        Image* image = glyphs[i].first;
+        switch (glyphs[i].second) {
+        case ONEBITIMAGEVIEW:
+          RleCodecDetail::decode_string(*((OneBitImageView*)image), s);
+          break;
+        case CC:
+          RleCodecDetail::decode_string(*((Cc*)image), s);
+          break;
+        case MLCC:
+          RleCodecDetail::decode_string(*((MlCc*)image), s);
+          break;
+        case ONEBITRLEIMAGEVIEW:
+          RleCodecDetail::decode_string(*((OneBitRleImageView*)image), s);
+          break;
+        case RLECC:
+          RleCodecDetail::decode_string(*((RleCc*)image), s);
+          break;
+        case ONEBITPACKEDIMAGEVIEW:
+          RleCodecDetail::decode_string(*((OneBitPackedImageView*)image), s);
+          break;
+        default:
+          throw std::runtime_error("There is an Image in the list that is not a OneBit image.");
+        }
+      }
+    } catch (...) {
+      Py_DECREF(seq);
+      throw;
+    }
+    Py_DECREF(seq);
+  }
+
+  /*
+    New OneBit glyphs decoded from the strings runs (see from_rle), with
+    the pixels of all of them packed into one PackedArena.  geometry
+    holds the four numbers ul_x, ul_y, ncols and nrows of each glyph.
+    A glyph whose runs are None stays white.
+  */
+  inline ImageList* packed_glyphs_from_rle(const IntVector* geometry,
+                                           PyObject* runs) {
+    if (geometry->size() % 4 != 0)
+      throw std::invalid_argument("geometry must hold four numbers for each glyph");
+    size_t n = geometry->size() / 4;
+    size_t nwords = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if ((*geometry)[4*i] < 0 || (*geometry)[4*i+1] < 0 ||
+          (*geometry)[4*i+2] < 1 || (*geometry)[4*i+3] < 1)
+        throw std::invalid_argument("Invalid glyph geometry");
+      nwords += PackedArena::words_for(Dim((*geometry)[4*i+2], (*geometry)[4*i+3]));
+    }
+    PyObject* seq = PySequence_Fast(runs, "runs must be a sequence of strings");
+    if (seq == NULL)
+      throw std::runtime_error("runs must be a sequence of strings");
+    if (size_t(PySequence_Fast_GET_SIZE(seq)) != n) {
+      Py_DECREF(seq);
+      throw std::invalid_argument("There must be one string of runs for each glyph.");
+    }
+
+    PackedArena* arena = new PackedArena(nwords);
+    ImageList* result = new ImageList();
+    try {
+      for (size_t i = 0; i < n; ++i) {
+        OneBitPackedImageData* data = new OneBitPackedImageData
+          (Dim((*geometry)[4*i+2], (*geometry)[4*i+3]),
+           Point((*geometry)[4*i], (*geometry)[4*i+1]), *arena);
+        OneBitPackedImageView* image = new OneBitPackedImageView(*data);
+        result->push_back(image);
+        PyObject* s = PySequence_Fast_GET_ITEM(seq, i);
+        if (s != Py_None)
+          RleCodecDetail::decode_string(*image, s);
+      }
+    } catch (...) {
+      for (ImageList::iterator i = result->begin(); i != result->end(); ++i) {
+        delete (*i)->data();
+        delete *i;
+      }
+      delete result;
+      arena->release();
+      Py_DECREF(seq);
+      throw;
+    }
+    // the glyphs hold the arena from now on
+    arena->release();
+    Py_DECREF(seq);
+    return result;
   }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -26,13 +26,20 @@
 #include <algorithm>
 #include <functional>
 #include <map>
+#include <set>
 #include <stdexcept>
+#include <string>
 #include "gamera.hpp"
+#include "thread_exception.hpp"
 #include "gamera_limits.hpp"
 #include "features.hpp"
 #include "image_utilities.hpp"
 #include "projections.hpp"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /*
   Connected-component analysis (8-connected)
 
@@ -44,6 +51,12 @@
   number of components is limited by the size of the pixel type (65536 for
   unsigned shorts).
 
+  The run-based variants lift this limit: a ConnectedComponent is defined
+  by its label *and* its bounding box, so a label can be shared by
+  components whose bounding boxes do not overlap.  When an image has more
+  components than labels, the labels are reassigned that way (see
+  recycle_labels); otherwise every component keeps its own label.
+
   Authors
   -------
   Karl MacMillan <karlmac@peabody.jhu.edu>
@@ -53,11 +66,8 @@
   -------
   Started 6/8/01 KWM
 
-  TODO
-  ----
-  - This algorithm can be significantly faster when working on run-length data
-  so an appropriate specialization should be made when run-length matrices
-  are completed.
+  A run-based variant (cc_analysis_runs) that gives identical results is
+  selected with the method argument of cc_analysis.
 */
 
 namespace {
@@ -95,7 +105,7 @@ namespace {
 namespace Gamera {
 
   template<class T>
-  ImageList* cc_analysis(T& image) {
+  ImageList* cc_analysis_two_pass(T& image) {
     equiv_table eq;
     // get the max value that can be held in the matrix
     typename T::value_type max_value = 
@@ -291,6 +301,1128 @@ namespace Gamera {
     return ccs;
   }
 
+  /*
+    Run-based connected-component labeling (8-connected)
+
+    Instead of looking at the W, NW, N and NE neighbours of every single
+    pixel, the image is scanned once for horizontal runs of black pixels.
+    Each run is connected to the runs of the previous row that it touches
+    (including diagonally), and connected runs are merged in a union-find
+    structure with path compression.  The labels are then written once
+    per run.
+
+    The provisional labels are handed out by the same rule as in the
+    pixel-based algorithm (a run gets a new label when its first pixel has
+    no black neighbour in the row above), and every component ends up with
+    the smallest provisional label it contains, so both algorithms give
+    identical labels and ConnectedComponents.
+  */
+  namespace CcRunDetail {
+    struct LabelRun {
+      LabelRun(size_t r, size_t s, size_t e, size_t l)
+        : row(r), start(s), end(e), label(l) { }
+      size_t row, start, end, label;
+    };
+
+    /*
+      Union-find over the provisional labels. The root of a set is
+      always its smallest label.
+    */
+    struct LabelSets : public std::vector<size_t> {
+      size_t find(size_t x) {
+        size_t root = x;
+        while ((*this)[root] != root)
+          root = (*this)[root];
+        while ((*this)[x] != root) {
+          size_t next = (*this)[x];
+          (*this)[x] = root;
+          x = next;
+        }
+        return root;
+      }
+      void join(size_t a, size_t b) {
+        a = find(a);
+        b = find(b);
+        if (a < b)
+          (*this)[b] = a;
+        else if (b < a)
+          (*this)[a] = b;
+      }
+      size_t add() {
+        push_back(size());
+        return size() - 1;
+      }
+    };
+
+    /*
+      Appends the runs of rows [y0, y1) of the image to runs.
+    */
+    template<class T>
+    void find_runs(const T& image, size_t y0, size_t y1,
+                   std::vector<LabelRun>& runs) {
+      size_t ncols = image.ncols();
+      typename T::const_row_iterator row = image.row_begin() + y0;
+      for (size_t y = y0; y < y1; ++y, ++row) {
+        typename T::const_col_iterator col = row.begin();
+        size_t x = 0;
+        while (x < ncols) {
+          for (; x < ncols && !is_black(*col); ++x, ++col) ;
+          if (x == ncols)
+            break;
+          size_t start = x;
+          for (; x < ncols && is_black(*col); ++x, ++col) ;
+          runs.push_back(LabelRun(y, start, x - 1, 0));
+        }
+      }
+    }
+
+    /*
+      Gives every run its provisional label and connects it to the runs
+      of the previous row that it touches. The runs must be ordered by
+      row and by column within each row.
+    */
+    inline void connect_runs(std::vector<LabelRun>& runs, LabelSets& sets) {
+      size_t prev_begin = 0, prev_end = 0;
+      size_t i = 0;
+      while (i < runs.size()) {
+        size_t y = runs[i].row;
+        size_t row_begin = i;
+        // runs of the previous row only count when it is row y - 1
+        if (prev_end == prev_begin || runs[prev_begin].row + 1 != y)
+          prev_begin = prev_end = row_begin;
+        size_t p = prev_begin;
+        for (; i < runs.size() && runs[i].row == y; ++i) {
+          LabelRun& run = runs[i];
+          // runs of the previous row that end left of start - 1 can not
+          // touch this run or any later one
+          while (p < prev_end && runs[p].end + 1 < run.start)
+            ++p;
+          if (p < prev_end && runs[p].start <= run.start + 1) {
+            // the first pixel has a black neighbour above
+            run.label = runs[p].label;
+          } else {
+            run.label = sets.add();
+          }
+          for (size_t q = p; q < prev_end && runs[q].start <= run.end + 1; ++q)
+            sets.join(run.label, runs[q].label);
+        }
+        prev_begin = row_begin;
+        prev_end = i;
+      }
+    }
+
+    /*
+      Writes the labels of runs[begin, end) into the image. The runs
+      must be ordered by row.
+    */
+    template<class T>
+    void write_run_labels(T& image, const std::vector<LabelRun>& runs,
+                          size_t begin, size_t end) {
+      typedef typename T::value_type value_type;
+      ImageAccessor<value_type> acc;
+      typename T::row_iterator out_row = image.row_begin();
+      size_t out_y = 0;
+      for (size_t i = begin; i < end; ++i) {
+        const LabelRun& run = runs[i];
+        for (; out_y < run.row; ++out_y, ++out_row) ;
+        typename T::col_iterator col = out_row.begin() + run.start;
+        for (size_t x = run.start; x <= run.end; ++x, ++col)
+          acc.set(value_type(run.label), col);
+      }
+    }
+
+    /*
+      The bounding boxes of the labels of the runs (found[l] tells
+      whether label l is used).
+    */
+    inline void run_bounding_boxes(const std::vector<LabelRun>& runs,
+                                   size_t nlabels, std::vector<Rect>& rects,
+                                   std::vector<bool>& found) {
+      rects.assign(nlabels, Rect());
+      found.assign(nlabels, false);
+      for (size_t i = 0; i < runs.size(); ++i) {
+        const LabelRun& run = runs[i];
+        Rect& r = rects[run.label];
+        if (!found[run.label]) {
+          found[run.label] = true;
+          r = Rect(Point(run.start, run.row), Point(run.end, run.row));
+        } else {
+          if (run.start < r.ul_x())
+            r.ul_x(run.start);
+          if (run.end > r.lr_x())
+            r.lr_x(run.end);
+          if (run.row > r.lr_y())
+            r.lr_y(run.row);
+        }
+      }
+    }
+
+    /*
+      Assigns the pixel labels when there are more components than
+      labels up to max_label. The labels are handed out in turn (so the
+      first components keep their labels), skipping the labels of the
+      components with an overlapping bounding box.  The components
+      arrive ordered by their top row, so
+      only those that reach down to the top row of a component can
+      overlap with it.  The runs are relabeled, and label[l] is the new
+      label of the old label l.
+    */
+    inline void recycle_labels(std::vector<LabelRun>& runs,
+                               const std::vector<Rect>& rects,
+                               const std::vector<bool>& found,
+                               size_t max_label,
+                               std::vector<size_t>& label) {
+      label.assign(rects.size(), 0);
+      std::vector<size_t> active;
+      std::vector<size_t> used_by(max_label + 1, size_t(-1));
+      size_t next = 2;
+      for (size_t i = 0; i < rects.size(); ++i) {
+        if (!found[i])
+          continue;
+        const Rect& r = rects[i];
+        size_t keep = 0;
+        for (size_t j = 0; j < active.size(); ++j) {
+          const Rect& other = rects[active[j]];
+          if (other.lr_y() < r.ul_y())
+            continue;
+          active[keep++] = active[j];
+          if (other.lr_x() >= r.ul_x() && other.ul_x() <= r.lr_x())
+            used_by[label[active[j]]] = i;
+        }
+        active.resize(keep);
+        size_t l = next;
+        for (size_t tries = 0; used_by[l] == i; ++tries) {
+          if (tries == max_label)
+            throw std::range_error("Max label exceeded - change OneBitPixel type in pixel.hpp");
+          l = (l == max_label) ? 2 : l + 1;
+        }
+        label[i] = l;
+        next = (l == max_label) ? 2 : l + 1;
+        active.push_back(i);
+      }
+      for (size_t i = 0; i < runs.size(); ++i)
+        runs[i].label = label[runs[i].label];
+    }
+
+    /*
+      Creates the ConnectedComponents from the bounding boxes. The
+      component with the old label l gets the pixel label label[l] (or l,
+      when label is empty).
+    */
+    template<class T>
+    ImageList* ccs_from_rects(T& image, const std::vector<Rect>& rects,
+                              const std::vector<bool>& found,
+                              const std::vector<size_t>& label) {
+      ImageList* ccs = new ImageList();
+      try {
+        for (size_t i = 0; i < rects.size(); ++i) {
+          if (found[i]) {
+            ccs->push_back(new ConnectedComponent<typename T::data_type>(*((typename T::data_type*)image.data()),
+                                                                         OneBitPixel(label.empty() ? i : label[i]),
+                                                                         Point(rects[i].offset_x() + image.offset_x(),
+                                                                               rects[i].offset_y() + image.offset_y()),
+                                                                         rects[i].dim()));
+          }
+        }
+      } catch (std::exception e) {
+        for (ImageList::iterator i = ccs->begin(); i != ccs->end(); ++i)
+          delete *i;
+        delete ccs;
+        throw;
+      }
+      return ccs;
+    }
+
+    /*
+      The black area and the sums of the coordinates of the pixels of
+      each label of the runs.
+    */
+    struct RunStatistics {
+      std::vector<size_t> area;
+      std::vector<double> sum_x, sum_y;
+    };
+
+    inline void run_statistics(const std::vector<LabelRun>& runs,
+                               size_t nlabels, RunStatistics& stats) {
+      stats.area.assign(nlabels, 0);
+      stats.sum_x.assign(nlabels, 0.0);
+      stats.sum_y.assign(nlabels, 0.0);
+      for (size_t i = 0; i < runs.size(); ++i) {
+        const LabelRun& run = runs[i];
+        size_t length = run.end - run.start + 1;
+        stats.area[run.label] += length;
+        stats.sum_x[run.label] += 0.5 * double(run.start + run.end) * double(length);
+        stats.sum_y[run.label] += double(run.row) * double(length);
+      }
+    }
+  }
+
+  /*
+    Connected-component table
+
+    A table of the connected components of a labeled image with one
+    array per column (label, bounding box, black area and the sums of
+    the pixel coordinates, from which the centroids follow), filled by
+    cc_analysis_table from the runs of the labeling.  Filtering the
+    components by size only has to look at these arrays, and
+    ConnectedComponents are created only for the rows that are left
+    (see cc_table_ccs).  All coordinates are page coordinates.
+  */
+  struct CcTable {
+    std::vector<size_t> label, ul_x, ul_y, lr_x, lr_y, black_area;
+    std::vector<double> sum_x, sum_y;
+
+    size_t size() const {
+      return label.size();
+    }
+
+    void clear() {
+      label.clear(); ul_x.clear(); ul_y.clear(); lr_x.clear(); lr_y.clear();
+      black_area.clear(); sum_x.clear(); sum_y.clear();
+    }
+
+    void push_back(size_t l, const Rect& r, size_t area, double sx, double sy) {
+      label.push_back(l);
+      ul_x.push_back(r.ul_x());
+      ul_y.push_back(r.ul_y());
+      lr_x.push_back(r.lr_x());
+      lr_y.push_back(r.lr_y());
+      black_area.push_back(area);
+      sum_x.push_back(sx);
+      sum_y.push_back(sy);
+    }
+
+    // keeps the rows i with keep[i] != 0, in their order
+    void select(const std::vector<unsigned char>& keep) {
+      size_t n = 0;
+      for (size_t i = 0; i < size(); ++i) {
+        if (keep[i]) {
+          label[n] = label[i];
+          ul_x[n] = ul_x[i]; ul_y[n] = ul_y[i];
+          lr_x[n] = lr_x[i]; lr_y[n] = lr_y[i];
+          black_area[n] = black_area[i];
+          sum_x[n] = sum_x[i]; sum_y[n] = sum_y[i];
+          ++n;
+        }
+      }
+      label.resize(n); ul_x.resize(n); ul_y.resize(n); lr_x.resize(n);
+      lr_y.resize(n); black_area.resize(n); sum_x.resize(n); sum_y.resize(n);
+    }
+  };
+
+  namespace CcRunDetail {
+    /*
+      Fills the table like ccs_from_rects creates the
+      ConnectedComponents.
+    */
+    template<class T>
+    void table_from_rects(const T& image, const std::vector<Rect>& rects,
+                          const std::vector<bool>& found,
+                          const std::vector<size_t>& label,
+                          const RunStatistics& stats, CcTable& table) {
+      table.clear();
+      double x0 = double(image.offset_x()), y0 = double(image.offset_y());
+      for (size_t i = 0; i < rects.size(); ++i) {
+        if (!found[i])
+          continue;
+        Rect r(Point(rects[i].ul_x() + image.offset_x(), rects[i].ul_y() + image.offset_y()),
+               rects[i].dim());
+        size_t area = stats.area[i];
+        table.push_back(label.empty() ? i : label[i], r, area,
+                        stats.sum_x[i] + x0 * double(area),
+                        stats.sum_y[i] + y0 * double(area));
+      }
+    }
+  }
+
+  /*
+    When table is given, it is filled instead of creating the
+    ConnectedComponents, and 0 is returned.
+  */
+  template<class T>
+  ImageList* cc_analysis_runs(T& image, CcTable* table = 0) {
+    using namespace CcRunDetail;
+    typedef typename T::value_type value_type;
+    value_type max_value = std::numeric_limits<value_type>::max();
+
+    std::vector<LabelRun> runs;
+    LabelSets sets;
+    // labels 0 and 1 are not used for components
+    sets.add();
+    sets.add();
+
+    // first pass: find the runs and connect them to the previous row
+    find_runs((const T&)image, 0, image.nrows(), runs);
+    connect_runs(runs, sets);
+
+    // second pass: write the final labels
+    for (size_t i = 0; i < runs.size(); ++i)
+      runs[i].label = sets.find(runs[i].label);
+    std::vector<Rect> rects;
+    std::vector<bool> found;
+    std::vector<size_t> label;
+    run_bounding_boxes(runs, sets.size(), rects, found);
+    RunStatistics stats;
+    if (table != 0)
+      run_statistics(runs, sets.size(), stats);
+    if (sets.size() > size_t(max_value))
+      recycle_labels(runs, rects, found, max_value - 1, label);
+    write_run_labels(image, runs, 0, runs.size());
+    if (table != 0) {
+      table_from_rects(image, rects, found, label, stats, *table);
+      return 0;
+    }
+    return ccs_from_rects(image, rects, found, label);
+  }
+
+  /*
+    Parallel run-based connected-component labeling
+
+    The image is split into one horizontal strip per thread. Each thread
+    finds the runs of its strip and connects the runs within the strip.
+    The equivalences along the rows shared by neighbouring strips are
+    then merged, and the final labels are written (in parallel for DENSE
+    data, for which the strips do not share any memory).
+
+    A run gets a new provisional label under the same rule as in
+    cc_analysis_runs.  Since these labels increase in raster order, and
+    the first run of every component (in raster order) always gets a new
+    label, the smallest run index in each set of the union-find
+    identifies the label of the component.  The labels are therefore
+    the same as those of the serial algorithms, for any number of
+    threads.
+
+    Without OpenMP, the strips are processed one after another.
+  */
+  namespace CcRunDetail {
+    template<class Data>
+    struct parallel_write {
+      enum { value = false };
+    };
+    template<class V>
+    struct parallel_write<ImageData<V> > {
+      enum { value = true };
+    };
+  }
+
+  template<class T>
+  ImageList* cc_analysis_parallel(T& image, int threads, CcTable* table = 0) {
+    using namespace CcRunDetail;
+    typedef typename T::value_type value_type;
+    value_type max_value = std::numeric_limits<value_type>::max();
+    const size_t no_label = 0;
+
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+    }
+    size_t nrows = image.nrows();
+    int nstrips = (int)std::max(size_t(1), std::min(size_t(threads), nrows));
+    std::vector<size_t> strip_y(nstrips + 1);
+    for (int s = 0; s <= nstrips; ++s)
+      strip_y[s] = (nrows * s) / nstrips;
+
+    // find the runs of every strip
+    std::vector<std::vector<LabelRun> > strip_runs(nstrips);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nstrips) schedule(static, 1)
+#endif
+    for (int s = 0; s < nstrips; ++s)
+      find_runs((const T&)image, strip_y[s], strip_y[s + 1], strip_runs[s]);
+
+    // index of the first run of every row (and of every strip) in runs
+    std::vector<LabelRun> runs;
+    std::vector<size_t> row_begin(nrows + 1, 0);
+    std::vector<size_t> strip_begin(nstrips + 1, 0);
+    for (int s = 0; s < nstrips; ++s) {
+      strip_begin[s] = runs.size();
+      runs.insert(runs.end(), strip_runs[s].begin(), strip_runs[s].end());
+      std::vector<LabelRun>().swap(strip_runs[s]);
+    }
+    strip_begin[nstrips] = runs.size();
+    for (size_t i = 0; i < runs.size(); ++i)
+      ++row_begin[runs[i].row + 1];
+    for (size_t y = 0; y < nrows; ++y)
+      row_begin[y + 1] += row_begin[y];
+
+    /*
+      Connect the runs within each strip (sets holds one element per run)
+      and mark the runs that get a new provisional label. A run in the
+      first row of a strip looks at the last row of the strip above only
+      to decide whether it gets a new label.
+    */
+    LabelSets sets;
+    sets.resize(runs.size());
+    std::vector<size_t> strip_new(nstrips + 1, 0);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nstrips) schedule(static, 1)
+#endif
+    for (int s = 0; s < nstrips; ++s) {
+      size_t nnew = 0;
+      for (size_t y = strip_y[s]; y < strip_y[s + 1]; ++y) {
+        size_t p = (y == 0) ? 0 : row_begin[y - 1];
+        size_t prev_end = (y == 0) ? 0 : row_begin[y];
+        for (size_t i = row_begin[y]; i < row_begin[y + 1]; ++i) {
+          LabelRun& run = runs[i];
+          sets[i] = i;
+          while (p < prev_end && runs[p].end + 1 < run.start)
+            ++p;
+          if (p < prev_end && runs[p].start <= run.start + 1) {
+            run.label = no_label;
+          } else {
+            // the number of the new label within the strip (from 1)
+            run.label = ++nnew;
+          }
+          if (y != strip_y[s])
+            for (size_t q = p; q < prev_end && runs[q].start <= run.end + 1; ++q)
+              sets.join(i, q);
+        }
+      }
+      strip_new[s + 1] = nnew;
+    }
+
+    // labels 0 and 1 are not used for components
+    strip_new[0] = 1;
+    for (int s = 0; s < nstrips; ++s)
+      strip_new[s + 1] += strip_new[s];
+
+    // merge the equivalences along the shared rows
+    for (int s = 1; s < nstrips; ++s) {
+      size_t y = strip_y[s];
+      if (y == strip_y[s - 1])
+        continue;
+      size_t p = row_begin[y - 1];
+      size_t prev_end = row_begin[y];
+      for (size_t i = row_begin[y]; i < row_begin[y + 1]; ++i) {
+        while (p < prev_end && runs[p].end + 1 < runs[i].start)
+          ++p;
+        for (size_t q = p; q < prev_end && runs[q].start <= runs[i].end + 1; ++q)
+          sets.join(i, q);
+      }
+    }
+
+    /*
+      Resolve the labels. The parent of a run always has a smaller index,
+      so a single pass in order flattens the sets, and every root is a run
+      with a new label.
+    */
+    for (int s = 0; s < nstrips; ++s)
+      for (size_t i = strip_begin[s]; i < strip_begin[s + 1]; ++i)
+        if (runs[i].label != no_label)
+          runs[i].label += strip_new[s];
+    for (size_t i = 0; i < runs.size(); ++i) {
+      sets[i] = sets[sets[i]];
+      runs[i].label = runs[sets[i]].label;
+    }
+
+    size_t nlabels = strip_new[nstrips] + 1;
+    std::vector<Rect> rects;
+    std::vector<bool> found;
+    std::vector<size_t> label;
+    run_bounding_boxes(runs, nlabels, rects, found);
+    RunStatistics stats;
+    if (table != 0)
+      run_statistics(runs, nlabels, stats);
+    if (nlabels > size_t(max_value))
+      recycle_labels(runs, rects, found, max_value - 1, label);
+
+    if (parallel_write<typename T::data_type>::value) {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nstrips) schedule(static, 1)
+#endif
+      for (int s = 0; s < nstrips; ++s)
+        write_run_labels(image, runs, strip_begin[s], strip_begin[s + 1]);
+    } else {
+      write_run_labels(image, runs, 0, runs.size());
+    }
+    if (table != 0) {
+      table_from_rects(image, rects, found, label, stats, *table);
+      return 0;
+    }
+    return ccs_from_rects(image, rects, found, label);
+  }
+
+  /*
+    method 0 is the pixel-based two-pass algorithm, method 1 the
+    run-based one and method 2 the parallel run-based one, using the
+    given number of threads (0 for the OpenMP default). Images with
+    more components than the two-pass algorithm can label are labeled
+    with the run-based one.
+  */
+  template<class T>
+  ImageList* cc_analysis(T& image, int method = 0, int threads = 0) {
+    if (method == 1)
+      return cc_analysis_runs(image);
+    if (method == 2)
+      return cc_analysis_parallel(image, threads);
+    try {
+      return cc_analysis_two_pass(image);
+    } catch (std::range_error e) {
+      // too many components for the two-pass labeling
+      return cc_analysis_runs(image);
+    }
+  }
+
+  /*
+    PACKED images store only one bit per pixel and can not hold the
+    labels, so the labeling is done on a DENSE copy of the image. The
+    returned ConnectedComponents refer to that copy.
+  */
+  inline ImageList* cc_analysis(OneBitPackedImageView& image, int method = 0,
+                                int threads = 0) {
+    OneBitImageData* data = new OneBitImageData(image.size(), image.origin());
+    OneBitImageView* view = new OneBitImageView(*data, image.origin(), image.size());
+    ImageList* ccs = 0;
+    try {
+      image_copy_fill(image, *view);
+      ccs = cc_analysis(*view, method, threads);
+    } catch (std::exception e) {
+      delete view;
+      delete data;
+      throw;
+    }
+    delete view;
+    if (ccs == 0 || ccs->empty())
+      delete data;
+    return ccs;
+  }
+
+  /*
+    Labels the image as cc_analysis does (with the run-based labeling,
+    in parallel for method 2) and fills table with its components.
+    Packed images are labeled in a temporary DENSE copy.
+  */
+  template<class T>
+  void cc_analysis_table(T& image, CcTable& table, int method = 0,
+                         int threads = 0) {
+    if (method == 2)
+      cc_analysis_parallel(image, threads, &table);
+    else
+      cc_analysis_runs(image, &table);
+  }
+
+  inline void cc_analysis_table(OneBitPackedImageView& image, CcTable& table,
+                                int method = 0, int threads = 0) {
+    OneBitImageData data(image.size(), image.origin());
+    OneBitImageView view(data, image.origin(), image.size());
+    image_copy_fill(image, view);
+    cc_analysis_table(view, table, method, threads);
+  }
+
+  /*
+    The ConnectedComponents of the rows of the table, which refer to the
+    labeled image.
+  */
+  template<class T>
+  ImageList* cc_table_ccs(T& image, const CcTable& table) {
+    typedef ConnectedComponent<typename T::data_type> cc_type;
+    ImageList* ccs = new ImageList();
+    try {
+      for (size_t i = 0; i < table.size(); ++i)
+        ccs->push_back(new cc_type(*((typename T::data_type*)image.data()),
+                                   OneBitPixel(table.label[i]),
+                                   Point(table.ul_x[i], table.ul_y[i]),
+                                   Dim(table.lr_x[i] - table.ul_x[i] + 1,
+                                       table.lr_y[i] - table.ul_y[i] + 1)));
+    } catch (std::exception e) {
+      for (ImageList::iterator i = ccs->begin(); i != ccs->end(); ++i)
+        delete *i;
+      delete ccs;
+      throw;
+    }
+    return ccs;
+  }
+
+  /*
+    Removes the rows of the components that the filter rejects from the
+    table and sets their pixels to white, as the Python filters
+    filter_wide etc. do with lists of ccs.  The filters compare the
+    width, the height, both or the black area with the threshold:
+  */
+  enum CcTableFilter {
+    CC_FILTER_WIDE,            // width > threshold
+    CC_FILTER_NARROW,          // width < threshold
+    CC_FILTER_TALL,            // height > threshold
+    CC_FILTER_SHORT,           // height < threshold
+    CC_FILTER_SMALL,           // height or width < threshold
+    CC_FILTER_LARGE,           // height or width > threshold
+    CC_FILTER_BLACK_AREA_SMALL,  // black area < threshold
+    CC_FILTER_BLACK_AREA_LARGE   // black area > threshold
+  };
+
+  template<class T>
+  void cc_table_filter(T& image, CcTable& table, int filter, size_t t) {
+    size_t n = table.size();
+    std::vector<unsigned char> keep(n);
+    const size_t *ul_x = n ? &table.ul_x[0] : 0, *lr_x = n ? &table.lr_x[0] : 0;
+    const size_t *ul_y = n ? &table.ul_y[0] : 0, *lr_y = n ? &table.lr_y[0] : 0;
+    const size_t* area = n ? &table.black_area[0] : 0;
+    switch (filter) {
+    case CC_FILTER_WIDE:
+      for (size_t i = 0; i < n; ++i)
+        keep[i] = lr_x[i] - ul_x[i] + 1 <= t;
+      break;
+    case CC_FILTER_NARROW:
+      for (size_t i = 0; i < n; ++i)
+        keep[i] = lr_x[i] - ul_x[i] + 1 >= t;
+      break;
+    case CC_FILTER_TALL:
+      for (size_t i = 0; i < n; ++i)
+        keep[i] = lr_y[i] - ul_y[i] + 1 <= t;
+      break;
+    case CC_FILTER_SHORT:
+      for (size_t i = 0; i < n; ++i)
+        keep[i] = lr_y[i] - ul_y[i] + 1 >= t;
+      break;
+    case CC_FILTER_SMALL:
+      for (size_t i = 0; i < n; ++i)
+        keep[i] = (lr_x[i] - ul_x[i] + 1 >= t) & (lr_y[i] - ul_y[i] + 1 >= t);
+      break;
+    case CC_FILTER_LARGE:
+      for (size_t i = 0; i < n; ++i)
+        keep[i] = (lr_x[i] - ul_x[i] + 1 <= t) & (lr_y[i] - ul_y[i] + 1 <= t);
+      break;
+    case CC_FILTER_BLACK_AREA_SMALL:
+      for (size_t i = 0; i < n; ++i)
+        keep[i] = area[i] >= t;
+      break;
+    case CC_FILTER_BLACK_AREA_LARGE:
+      for (size_t i = 0; i < n; ++i)
+        keep[i] = area[i] <= t;
+      break;
+    default:
+      throw std::runtime_error("cc_table_filter: unknown filter.");
+    }
+    typedef typename T::value_type value_type;
+    ImageAccessor<value_type> acc;
+    for (size_t i = 0; i < n; ++i) {
+      if (keep[i])
+        continue;
+      value_type label = value_type(table.label[i]);
+      typename T::row_iterator row = image.row_begin() + (ul_y[i] - image.ul_y());
+      for (size_t y = ul_y[i]; y <= lr_y[i]; ++y, ++row) {
+        typename T::col_iterator col = row.begin() + (ul_x[i] - image.ul_x());
+        for (size_t x = ul_x[i]; x <= lr_x[i]; ++x, ++col)
+          if (acc.get(col) == label)
+            acc.set(value_type(0), col);
+      }
+    }
+    table.select(keep);
+  }
+
+  /*
+    The Python part: the table is handed to Python in a PyCObject, which
+    deletes it with the Python object.  _cc_table returns the tuple of
+    the table and the labeled image, which is a new DENSE image for
+    PACKED images and None otherwise.
+  */
+  inline void cc_table_delete(void* table, void*) {
+    delete (CcTable*)table;
+  }
+
+  // tells cc tables from other PyCObjects
+  inline void* cc_table_desc() {
+    static char desc;
+    return &desc;
+  }
+
+  inline CcTable* cc_table_from_python(PyObject* table) {
+    if (!PyCObject_Check(table) || PyCObject_GetDesc(table) != cc_table_desc())
+      throw std::runtime_error("The argument is not a cc table.");
+    return (CcTable*)PyCObject_AsVoidPtr(table);
+  }
+
+  inline PyObject* cc_table_to_python(CcTable* table) {
+    return PyCObject_FromVoidPtrAndDesc((void*)table, cc_table_desc(),
+                                        cc_table_delete);
+  }
+
+  template<class T>
+  PyObject* _cc_table(T& image, int method, int threads) {
+    CcTable* table = new CcTable();
+    try {
+      cc_analysis_table(image, *table, method, threads);
+    } catch (std::exception e) {
+      delete table;
+      throw;
+    }
+    PyObject* py_table = cc_table_to_python(table);
+    Py_INCREF(Py_None);
+    return Py_BuildValue("(NN)", py_table, Py_None);
+  }
+
+  inline PyObject* _cc_table(OneBitPackedImageView& image, int method,
+                             int threads) {
+    OneBitImageData* data = new OneBitImageData(image.size(), image.origin());
+    OneBitImageView* view = new OneBitImageView(*data, image.origin(), image.size());
+    CcTable* table = new CcTable();
+    try {
+      image_copy_fill(image, *view);
+      cc_analysis_table(*view, *table, method, threads);
+    } catch (std::exception e) {
+      delete table;
+      delete view;
+      delete data;
+      throw;
+    }
+    PyObject* py_table = cc_table_to_python(table);
+    return Py_BuildValue("(NN)", py_table, create_ImageObject(view));
+  }
+
+  template<class T>
+  void _cc_table_filter(T& image, PyObject* table, int filter, int threshold) {
+    cc_table_filter(image, *cc_table_from_python(table), filter,
+                    size_t(std::max(threshold, 0)));
+  }
+
+  template<class T>
+  ImageList* _cc_table_ccs(T& image, PyObject* table) {
+    return cc_table_ccs(image, *cc_table_from_python(table));
+  }
+
+  /*
+    The columns of the table as a dictionary of lists (the centroids
+    instead of the sums of the coordinates).
+  */
+  inline PyObject* _cc_table_columns(PyObject* table_object) {
+    const CcTable& table = *cc_table_from_python(table_object);
+    const std::vector<size_t>* columns[] = {
+      &table.label, &table.ul_x, &table.ul_y, &table.lr_x, &table.lr_y,
+      &table.black_area };
+    const char* names[] = {
+      "label", "ul_x", "ul_y", "lr_x", "lr_y", "black_area" };
+    PyObject* dict = PyDict_New();
+    size_t n = table.size();
+    for (size_t c = 0; c < 6; ++c) {
+      PyObject* list = PyList_New(n);
+      for (size_t i = 0; i < n; ++i)
+        PyList_SET_ITEM(list, i, PyInt_FromLong(long((*columns[c])[i])));
+      PyDict_SetItemString(dict, names[c], list);
+      Py_DECREF(list);
+    }
+    PyObject* cx = PyList_New(n);
+    PyObject* cy = PyList_New(n);
+    for (size_t i = 0; i < n; ++i) {
+      double area = double(table.black_area[i]);
+      PyList_SET_ITEM(cx, i, PyFloat_FromDouble(table.sum_x[i] / area));
+      PyList_SET_ITEM(cy, i, PyFloat_FromDouble(table.sum_y[i] / area));
+    }
+    PyDict_SetItemString(dict, "center_x", cx);
+    PyDict_SetItemString(dict, "center_y", cy);
+    Py_DECREF(cx);
+    Py_DECREF(cy);
+    return dict;
+  }
+
+  inline int _cc_table_size(PyObject* table) {
+    return int(cc_table_from_python(table)->size());
+  }
+
+  /*
+    Incremental connected-component analysis
+
+    After the pixels inside the rectangle dirty of an image labeled by
+    cc_analysis have been changed (set to white, or to black with any
+    label), update_cc_analysis relabels only the components that can
+    have changed: those whose bounding box intersects dirty (expanded
+    by one pixel for the 8-connectivity) and those that the black
+    pixels of dirty now connect to.  The black pixels of these
+    components are traced again with a flood fill; all others keep
+    their pixels, labels and ConnectedComponents.
+
+    A traced component that has exactly the pixels of one of the old
+    components keeps it.  The other traced components get the label of
+    one of the old components they contain, when no remaining component
+    uses it, or otherwise an unused label.  Only when all labels are in
+    use, a label is shared with components whose bounding boxes do not
+    overlap (as with recycle_labels).
+
+    The result is a tuple of the indices (into ccs) of the removed
+    components and a list of the new ones.
+  */
+  namespace CcUpdateDetail {
+    struct OldCc {
+      size_t label;
+      Rect rect;
+      size_t area;
+      bool affected;
+      bool removed;
+    };
+
+    struct TracedPixel {
+      TracedPixel(size_t x_, size_t y_, size_t v) : x(x_), y(y_), value(v) { }
+      size_t x, y;
+      size_t value;
+    };
+
+    struct Traced {
+      std::vector<TracedPixel> pixels;
+      Rect rect;
+      std::vector<size_t> old;
+      size_t stray;
+      size_t label;
+    };
+
+    template<class T>
+    void restore(T& image, const std::vector<Traced>& traced) {
+      for (size_t i = 0; i < traced.size(); ++i)
+        for (size_t j = 0; j < traced[i].pixels.size(); ++j) {
+          const TracedPixel& p = traced[i].pixels[j];
+          image.set(Point(p.x, p.y), typename T::value_type(p.value));
+        }
+    }
+
+    /*
+      The old component (label, bounding box) a pixel belongs to, or
+      olds.size() for black pixels outside of all components.
+    */
+    inline size_t find_old(const std::vector<OldCc>& olds,
+                           const std::multimap<size_t, size_t>& by_label,
+                           size_t label, size_t x, size_t y) {
+      typedef std::multimap<size_t, size_t>::const_iterator iterator;
+      std::pair<iterator, iterator> range = by_label.equal_range(label);
+      for (iterator i = range.first; i != range.second; ++i)
+        if (olds[i->second].rect.contains_point(Point(x, y)))
+          return i->second;
+      return olds.size();
+    }
+
+    /*
+      Traces the 8-connected black pixels from (x, y) and sets them to
+      white; they are written back with their new label afterwards.
+    */
+    template<class T>
+    void trace(T& image, size_t x, size_t y, std::vector<OldCc>& olds,
+               const std::multimap<size_t, size_t>& by_label,
+               Traced& traced) {
+      std::vector<Point> stack;
+      traced.stray = 0;
+      size_t min_x = x, max_x = x, min_y = y, max_y = y;
+      traced.pixels.push_back(TracedPixel(x, y, image.get(Point(x, y))));
+      image.set(Point(x, y), 0);
+      stack.push_back(Point(x, y));
+      while (!stack.empty()) {
+        Point p = stack.back();
+        stack.pop_back();
+        size_t y0 = p.y() > 0 ? p.y() - 1 : 0;
+        size_t y1 = std::min(p.y() + 1, image.nrows() - 1);
+        size_t x0 = p.x() > 0 ? p.x() - 1 : 0;
+        size_t x1 = std::min(p.x() + 1, image.ncols() - 1);
+        for (size_t r = y0; r <= y1; ++r)
+          for (size_t c = x0; c <= x1; ++c) {
+            size_t value = image.get(Point(c, r));
+            if (value == 0)
+              continue;
+            traced.pixels.push_back(TracedPixel(c, r, value));
+            image.set(Point(c, r), 0);
+            stack.push_back(Point(c, r));
+            min_x = std::min(min_x, c);
+            max_x = std::max(max_x, c);
+            min_y = std::min(min_y, r);
+            max_y = std::max(max_y, r);
+          }
+      }
+      traced.rect = Rect(Point(min_x, min_y), Point(max_x, max_y));
+      for (size_t i = 0; i < traced.pixels.size(); ++i) {
+        const TracedPixel& p = traced.pixels[i];
+        size_t j = find_old(olds, by_label, p.value, p.x, p.y);
+        if (j == olds.size()) {
+          ++traced.stray;
+        } else if (!olds[j].removed) {
+          olds[j].removed = true;
+          traced.old.push_back(j);
+        } else if (std::find(traced.old.begin(), traced.old.end(), j)
+                   == traced.old.end()) {
+          traced.old.push_back(j);
+        }
+      }
+    }
+
+    /*
+      Chooses the label of a traced component; used[l] counts the
+      remaining and new components with label l.
+    */
+    inline size_t choose_label(const Traced& traced,
+                               const std::vector<OldCc>& olds,
+                               const std::vector<Traced>& all, size_t n,
+                               const std::vector<size_t>& used,
+                               size_t max_label) {
+      for (size_t i = 0; i < traced.old.size(); ++i)
+        if (olds[traced.old[i]].label <= max_label
+            && used[olds[traced.old[i]].label] == 0)
+          return olds[traced.old[i]].label;
+      size_t highest = 1;
+      for (size_t l = max_label; l > 1; --l)
+        if (used[l] != 0) {
+          highest = l;
+          break;
+        }
+      if (highest < max_label)
+        return highest + 1;
+      for (size_t l = 2; l <= max_label; ++l)
+        if (used[l] == 0)
+          return l;
+      // all labels are in use: share one with components that do not
+      // overlap this one
+      std::vector<bool> taken(max_label + 2, false);
+      for (size_t i = 0; i < olds.size(); ++i)
+        if (!olds[i].removed && olds[i].rect.intersects(traced.rect))
+          taken[olds[i].label] = true;
+      for (size_t i = 0; i < n; ++i)
+        if (all[i].rect.intersects(traced.rect))
+          taken[all[i].label] = true;
+      for (size_t l = 2; l <= max_label; ++l)
+        if (!taken[l])
+          return l;
+      throw std::range_error("update_cc_analysis: There are too many overlapping connected components to label them.");
+    }
+  }
+
+  template<class T>
+  PyObject* update_cc_analysis(T& image, ImageVector& ccs, Rect* dirty) {
+    using namespace CcUpdateDetail;
+    typedef typename T::value_type value_type;
+    typedef ConnectedComponent<typename T::data_type> cc_type;
+    const size_t max_label = size_t(std::numeric_limits<value_type>::max()) - 1;
+
+    // the old components, in coordinates relative to the image
+    std::vector<OldCc> olds(ccs.size());
+    std::multimap<size_t, size_t> by_label;
+    for (size_t i = 0; i < ccs.size(); ++i) {
+      Image* cc = ccs[i].first;
+      if ((ccs[i].second != CC && ccs[i].second != RLECC)
+          || cc->data() != image.data())
+        throw std::runtime_error("update_cc_analysis: All ccs must be ConnectedComponents of the image.");
+      if (!image.contains_rect(*cc))
+        throw std::runtime_error("update_cc_analysis: All ccs must be inside the image.");
+      olds[i].label = ccs[i].second == CC ? ((Cc*)cc)->label()
+                                          : ((RleCc*)cc)->label();
+      olds[i].rect = Rect(Point(cc->offset_x() - image.offset_x(),
+                                cc->offset_y() - image.offset_y()),
+                          cc->dim());
+      olds[i].area = 0;
+      olds[i].affected = false;
+      olds[i].removed = false;
+      by_label.insert(std::make_pair(olds[i].label, i));
+    }
+
+    std::vector<Traced> traced;
+    PyObject* removed = PyList_New(0);
+    ImageList* added = new ImageList();
+    if (dirty->intersects(image)) {
+      Rect d = dirty->intersection(image);
+      d = Rect(Point(d.ul_x() - image.offset_x(), d.ul_y() - image.offset_y()),
+               d.dim());
+      Rect area(Point(d.ul_x() > 0 ? d.ul_x() - 1 : 0,
+                      d.ul_y() > 0 ? d.ul_y() - 1 : 0),
+                Point(std::min(d.lr_x() + 1, image.ncols() - 1),
+                      std::min(d.lr_y() + 1, image.nrows() - 1)));
+
+      // the affected components and their areas (to recognize the
+      // unchanged ones)
+      for (size_t i = 0; i < olds.size(); ++i) {
+        OldCc& old = olds[i];
+        if (!old.rect.intersects(area))
+          continue;
+        old.affected = true;
+        for (size_t r = old.rect.ul_y(); r <= old.rect.lr_y(); ++r)
+          for (size_t c = old.rect.ul_x(); c <= old.rect.lr_x(); ++c)
+            if (image.get(Point(c, r)) == old.label)
+              ++old.area;
+      }
+
+      try {
+        for (size_t r = area.ul_y(); r <= area.lr_y(); ++r)
+          for (size_t c = area.ul_x(); c <= area.lr_x(); ++c)
+            if (image.get(Point(c, r)) != 0) {
+              traced.push_back(Traced());
+              trace(image, c, r, olds, by_label, traced.back());
+            }
+        for (size_t i = 0; i < olds.size(); ++i) {
+          const OldCc& old = olds[i];
+          if (!old.affected)
+            continue;
+          for (size_t r = old.rect.ul_y(); r <= old.rect.lr_y(); ++r)
+            for (size_t c = old.rect.ul_x(); c <= old.rect.lr_x(); ++c)
+              if (image.get(Point(c, r)) == old.label) {
+                traced.push_back(Traced());
+                trace(image, c, r, olds, by_label, traced.back());
+              }
+          // an affected component without any pixels left
+          olds[i].removed = true;
+        }
+
+        // the unchanged components stay
+        for (size_t i = 0; i < traced.size(); ++i) {
+          Traced& t = traced[i];
+          if (t.old.size() == 1 && t.stray == 0) {
+            OldCc& old = olds[t.old[0]];
+            if (old.affected && old.area == t.pixels.size()
+                && old.rect == t.rect) {
+              old.removed = false;
+              t.label = 0;
+            }
+          }
+        }
+
+        std::vector<size_t> used(max_label + 1, 0);
+        for (size_t i = 0; i < olds.size(); ++i)
+          if (!olds[i].removed && olds[i].label <= max_label)
+            ++used[olds[i].label];
+        size_t n = 0;
+        for (size_t i = 0; i < traced.size(); ++i) {
+          if (traced[i].old.size() == 1 && !olds[traced[i].old[0]].removed)
+            continue;
+          // the labelled components are kept at the front
+          if (n != i)
+            std::swap(traced[n], traced[i]);
+          traced[n].label = choose_label(traced[n], olds, traced, n, used,
+                                         max_label);
+          ++used[traced[n].label];
+          ++n;
+        }
+
+        for (size_t i = 0; i < traced.size(); ++i) {
+          value_type label = i < n ? value_type(traced[i].label)
+            : value_type(olds[traced[i].old[0]].label);
+          for (size_t j = 0; j < traced[i].pixels.size(); ++j)
+            image.set(Point(traced[i].pixels[j].x, traced[i].pixels[j].y),
+                      label);
+        }
+        traced.resize(n);
+      } catch (std::exception e) {
+        restore(image, traced);
+        Py_DECREF(removed);
+        delete added;
+        throw;
+      }
+
+      for (size_t i = 0; i < olds.size(); ++i)
+        if (olds[i].removed) {
+          PyObject* index = PyInt_FromLong((long)i);
+          PyList_Append(removed, index);
+          Py_DECREF(index);
+        }
+      for (size_t i = 0; i < traced.size(); ++i)
+        added->push_back(new cc_type(*((typename T::data_type*)image.data()),
+                                     OneBitPixel(traced[i].label),
+                                     Point(traced[i].rect.ul_x() + image.offset_x(),
+                                           traced[i].rect.ul_y() + image.offset_y()),
+                                     traced[i].rect.dim()));
+    }
+    PyObject* result = Py_BuildValue("(NN)", removed, ImageList_to_python(added));
+    delete added;
+    return result;
+  }
+
+  inline PyObject* update_cc_analysis(OneBitPackedImageView& image,
+                                      ImageVector& ccs, Rect* dirty) {
+    throw std::runtime_error("update_cc_analysis: PACKED images can not hold the labels of ConnectedComponents.");
+  }
+
   template<class T>
   inline void delete_connected_components(T* ccs) {
     for (typename T::iterator i = ccs->begin(); i != ccs->end(); ++i)
@@ -464,179 +1596,170 @@ namespace Gamera {
     return minimum_index;
   }
 
-  template<class T>
-  void split_error_cleanup(T* view,
-                           ImageList* splits,
-                           IntVector *projs,
-                           ImageList* ccs) {
-    delete view->data();
-    delete view;
-    for (ImageList::iterator i = splits->begin(); i != splits->end(); ++i) 
-      delete (*i);
-    delete splits;
-    if (projs != NULL)
-      delete projs;
-    if (ccs != NULL) {
-      for (ImageList::iterator i = ccs->begin(); i != ccs->end(); ++i) 
-        delete (*i);
-      delete ccs;
-    }
-  }
+  namespace SplitDetail {
+    /*
+      Splits image at the valleys (or peaks, when use_max is set) of
+      its projections near the given centers.  The image is copied
+      once, and the connected components of each strip between two
+      split points are labeled in place in this copy, so that all
+      splits share the same image data.
+    */
+    template<class T>
+    ImageList* split(T& image, FloatVector* center, bool vertical,
+                     bool use_max) {
+      typedef typename ImageFactory<T>::view_type view_type;
+      ImageList* splits = new ImageList();
+      size_t length = vertical ? image.ncols() : image.nrows();
 
-  template<class T>
-  ImageList* splitx(T& image, FloatVector* center) {
-    ImageList* splits = new ImageList();
-    typename ImageFactory<T>::view_type* view = 0;
-    ImageList* ccs = NULL;
-    ImageList::iterator ccs_it;
-    size_t last_split, new_split;
+      if (length <= 1) {
+        splits->push_back(simple_image_copy(T(image, image.origin(), image.dim())));
+        return splits;
+      }
+      sort(center->begin(), center->end());
+      IntVector* projs = vertical ? projection_cols(image) : projection_rows(image);
+      std::vector<size_t> cuts(1, 0);
+      for (size_t i = 0; i < center->size(); ++i) {
+        size_t cut = use_max ? find_split_point_max(projs, (*center)[i])
+                             : find_split_point(projs, (*center)[i]);
+        if (cut > cuts.back())
+          cuts.push_back(cut);
+      }
+      delete projs;
+      cuts.push_back(length);
 
-    if (image.ncols() <= 1) {
-      view = simple_image_copy(T(image, image.origin(), image.dim()));
-      splits->push_back(view);
-      return splits;
-    }
-    sort(center->begin(), center->end());
-    IntVector *projs = projection_cols(image);
-    last_split = 0;
-    for (size_t i = 0; i<center->size(); i++) {
-      new_split = find_split_point(projs, (*center)[i]);
-      if (new_split <= last_split)
-        continue;
-      view = simple_image_copy(T(image, 
-                                 Point(image.ul_x() + last_split, image.ul_y()), 
-                                 Dim(new_split - last_split, image.nrows())));
-      last_split = new_split;
+      view_type* copy = simple_image_copy(T(image, image.origin(), image.dim()));
       try {
-        ccs = cc_analysis(*view);
+        for (size_t i = 0; i + 1 < cuts.size(); ++i) {
+          Point origin = copy->origin();
+          Dim dim = copy->dim();
+          if (vertical) {
+            origin.x(origin.x() + cuts[i]);
+            dim.ncols(cuts[i + 1] - cuts[i]);
+          } else {
+            origin.y(origin.y() + cuts[i]);
+            dim.nrows(cuts[i + 1] - cuts[i]);
+          }
+          view_type strip(*copy, origin, dim);
+          ImageList* ccs = cc_analysis(strip, 1);
+          splits->splice(splits->end(), *ccs);
+          delete ccs;
+        }
       } catch (std::range_error x) {
-        split_error_cleanup(view, splits, projs, ccs);
+        for (ImageList::iterator i = splits->begin(); i != splits->end(); ++i)
+          delete *i;
+        delete splits;
+        delete copy->data();
+        delete copy;
         throw x;
       }
-      for (ccs_it = ccs->begin(); ccs_it != ccs->end(); ++ccs_it)
-        splits->push_back(*ccs_it);
-      delete view;
-      delete ccs;
-    }
-    delete projs;
-    view = simple_image_copy(T(image, 
-                               Point(image.ul_x() + last_split, image.ul_y()),
-                               Dim(image.ncols() - last_split, image.nrows())));
-    try {
-      ccs = cc_analysis(*view);
-    } catch (std::range_error x) {
-      split_error_cleanup(view, splits, NULL, ccs);
-      throw x;
+      if (splits->empty())
+        delete copy->data();
+      delete copy;
+      return splits;
     }
-    for (ccs_it = ccs->begin(); ccs_it != ccs->end(); ++ccs_it)
-      splits->push_back(*ccs_it);
-    delete view;
-    delete ccs;
-    return splits;
+  }
+
+  template<class T>
+  ImageList* splitx(T& image, FloatVector* center) {
+    return SplitDetail::split(image, center, true, false);
   }
 
   template<class T>
   ImageList* splitx_max(T& image, FloatVector* center) {
-    ImageList* splits = new ImageList();
-    typename ImageFactory<T>::view_type* view = 0;
-    ImageList* ccs = NULL;
-    ImageList::iterator ccs_it;
-    size_t last_split, new_split;
+    return SplitDetail::split(image, center, true, true);
+  }
 
-    if (image.ncols() <= 1) {
-      view = simple_image_copy(T(image, image.origin(), image.dim()));
-      splits->push_back(view);
-      return splits;
+  template<class T>
+  ImageList* splity(T& image, FloatVector* center) {
+    return SplitDetail::split(image, center, false, false);
+  }
+
+  /*
+    Splitting of a whole list of glyphs (used by the classifiers for
+    the glyphs classified as _split.*)
+  */
+  namespace SplitGlyphsDetail {
+    template<class T>
+    ImageList* split(T& image, int method, const FloatVector& center) {
+      // the split functions sort the centers in place, so that every
+      // glyph needs its own copy
+      FloatVector c(center);
+      if (method == 0)
+        return splitx(image, &c);
+      else if (method == 1)
+        return splity(image, &c);
+      return splitx_max(image, &c);
     }
-    sort(center->begin(), center->end());
-    IntVector *projs = projection_cols(image);
-    last_split = 0;
-    for (size_t i = 0; i<center->size(); i++) {
-      new_split = find_split_point_max(projs, (*center)[i]);
-      if (new_split <= last_split)
-        continue;
-      view = simple_image_copy(T(image, 
-                                 Point(image.ul_x()+last_split, image.ul_y()),
-                                 Dim(new_split - last_split, image.nrows())));
-      last_split = new_split;
-      try {
-        ccs = cc_analysis(*view);
-      } catch (std::range_error x) {
-        split_error_cleanup(view, splits, projs, ccs);
-        throw x;
+
+    inline ImageList* split(Image* image, int type, int method,
+                            const FloatVector& center) {
+      switch (type) {
+      case ONEBITIMAGEVIEW:
+        return split(*((OneBitImageView*)image), method, center);
+      case CC:
+        return split(*((Cc*)image), method, center);
+      case MLCC:
+        return split(*((MlCc*)image), method, center);
+      case ONEBITRLEIMAGEVIEW:
+        return split(*((OneBitRleImageView*)image), method, center);
+      case RLECC:
+        return split(*((RleCc*)image), method, center);
+      default:
+        throw std::runtime_error("There is an Image in the list that is not a OneBit image.");
       }
-      for (ccs_it = ccs->begin(); ccs_it != ccs->end(); ++ccs_it)
-        splits->push_back(*ccs_it);
-      delete view;
-      delete ccs;
     }
-    delete projs;
-    view = simple_image_copy(T(image, 
-                               Point(image.ul_x() + last_split, image.ul_y()),
-                               Dim(image.ncols() - last_split, image.nrows())));
-    try { 
-      ccs = cc_analysis(*view);
-    } catch (std::range_error x) {
-      split_error_cleanup(view, splits, NULL, ccs);
-      throw x;
-    }
-    for (ccs_it = ccs->begin(); ccs_it != ccs->end(); ++ccs_it)
-      splits->push_back(*ccs_it);
-    delete view;
-    delete ccs;
-    return splits;
   }
 
-  template<class T>
-  ImageList* splity(T& image, FloatVector* center) {
-    ImageList* splits = new ImageList();
-    typename ImageFactory<T>::view_type* view = 0;
-    ImageList* ccs = NULL;
-    ImageList::iterator ccs_it;
-    size_t last_split, new_split;
-
-    if (image.nrows() <= 1) {
-      view = simple_image_copy(T(image, image.origin(), image.dim()));
-      splits->push_back(view);
-      return splits;
+  inline PyObject* split_glyphs(ImageVector& glyphs, int method,
+                                FloatVector* center, int threads) {
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
     }
-    sort(center->begin(), center->end());
-    IntVector *projs = projection_rows(image);
-    last_split = 0;
-    for (size_t i = 0; i<center->size(); i++) {
-      new_split = find_split_point(projs, (*center)[i]);
-      if (new_split <= last_split)
-        continue;
-      view = simple_image_copy(T(image, 
-                                 Point(image.ul_x(), image.ul_y()+last_split), 
-                                 Dim(image.ncols(), new_split - last_split)));
-      last_split = new_split;
+    long n = (long)glyphs.size();
+    std::vector<ImageList*> splits(n, (ImageList*)NULL);
+    ThreadException error;
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1) if (n > 1)
+#endif
+    for (long i = 0; i < n; ++i) {
       try {
-        ccs = cc_analysis(*view);
-      } catch (std::range_error x) {
-        split_error_cleanup(view, splits, projs, ccs);
-        throw x;
+        splits[i] = SplitGlyphsDetail::split(glyphs[i].first,
+                                             glyphs[i].second,
+                                             method, *center);
+      } catch (...) {
+        error.keep();
       }
-      for (ccs_it = ccs->begin(); ccs_it != ccs->end(); ++ccs_it)
-        splits->push_back(*ccs_it);
-      delete view;
-      delete ccs;
     }
-    delete projs;
-    view = simple_image_copy(T(image, 
-                               Point(image.ul_x(), image.ul_y() + last_split),
-                               Dim(image.ncols(), image.nrows() - last_split)));
-    try {
-      ccs = cc_analysis(*view);
-    } catch (std::range_error x) {
-      split_error_cleanup(view, splits, NULL, ccs);
-      throw x;
+    Py_END_ALLOW_THREADS
+    if (!error.empty()) {
+      // the splits of one glyph share their image data
+      std::set<ImageDataBase*> data;
+      for (long i = 0; i < n; ++i) {
+        if (splits[i] != NULL) {
+          for (ImageList::iterator j = splits[i]->begin();
+               j != splits[i]->end(); ++j) {
+            data.insert((*j)->data());
+            delete *j;
+          }
+          delete splits[i];
+        }
+      }
+      for (std::set<ImageDataBase*>::iterator j = data.begin();
+           j != data.end(); ++j)
+        delete *j;
+      error.rethrow();
     }
-    for (ccs_it = ccs->begin(); ccs_it != ccs->end(); ++ccs_it)
-      splits->push_back(*ccs_it);
-    delete view;
-    delete ccs;
-    return splits;
+    PyObject* result = PyList_New(n);
+    for (long i = 0; i < n; ++i) {
+      PyList_SET_ITEM(result, i, ImageList_to_python(splits[i]));
+      delete splits[i];
+    }
+    return result;
   }
 }
 
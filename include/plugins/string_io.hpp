@@ -18,6 +18,16 @@
  */
 
 #include "gamera.hpp"
+#include "rle_utilities.hpp"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <ctype.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #ifndef arc24_feb_2005_io
 #define arc24_feb_2005_io
@@ -40,6 +50,21 @@ PyObject* _to_raw_string(const T &image) {
   return pystring;
 };
 
+template<class T>
+void fill_image_from_values(T& image, const typename T::value_type* j) {
+  typename T::vec_iterator i = image.vec_begin();
+  for (; i != image.vec_end(); ++i, ++j) {
+    *i = *j;
+  }
+}
+
+// RLE images are written run by run
+inline void fill_image_from_values(OneBitRleImageView& image, const OneBitPixel* j) {
+  RleBuilder<OneBitPixel> builder(image);
+  for (size_t n = image.ncols() * image.nrows(); n != 0; --n, ++j)
+    builder.append(*j);
+}
+
 template <class T>
 bool fill_image_from_string(T &image, PyObject* data_string) {
   if (!PyString_CheckExact(data_string)) {
@@ -61,11 +86,7 @@ bool fill_image_from_string(T &image, PyObject* data_string) {
     }
     return false;
   }
-  typename T::vec_iterator i = image.vec_begin();
-  value_type* j = (value_type*)s;
-  for (; i != image.vec_end(); ++i, ++j) {
-    *i = *j;
-  }
+  fill_image_from_values(image, (const value_type*)s);
   return true;
 }
 
@@ -121,5 +142,831 @@ Image* _from_raw_string(Point offset, Dim size,
   return NULL;
 }
 
+namespace {
+  void release_python_buffer(void* context) {
+    Py_buffer* buffer = (Py_buffer*)context;
+    PyBuffer_Release(buffer);
+    delete buffer;
+  }
+
+  template<class T>
+  Image* image_from_buffer(const Point& offset, const Dim& dim,
+                           Py_buffer* buffer) {
+    if (buffer->len != (Py_ssize_t)(dim.nrows() * dim.ncols() * sizeof(T))) {
+      PyErr_SetString(PyExc_ValueError,
+                      "The items of the buffer do not have the size of the pixels");
+      return NULL;
+    }
+    ImageData<T>* data = new ImageData<T>(dim, offset, (T*)buffer->buf,
+                                          release_python_buffer, buffer);
+    return new ImageView<ImageData<T> >(*data);
+  }
+}
+
+/*
+  Instantiates a dense image whose pixels are the memory of an object
+  supporting the buffer protocol (such as a NumPy array), without
+  copying them.  The buffer must be C contiguous and writable, with
+  the shape (nrows, ncols), or (nrows, ncols, 3) for RGB images.  The
+  object is kept alive as long as the image data.
+*/
+Image* _from_buffer(Point offset, int pixel_type, PyObject* object) {
+  Py_buffer* buffer = new Py_buffer;
+  if (PyObject_GetBuffer(object, buffer,
+                         PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE) != 0) {
+    delete buffer;
+    return NULL;
+  }
+  Image* image = NULL;
+  if (!PyBuffer_IsContiguous(buffer, 'C')) {
+    PyErr_SetString(PyExc_ValueError, "The buffer must be C contiguous");
+  } else if (buffer->ndim != (pixel_type == RGB ? 3 : 2)
+      || (pixel_type == RGB && buffer->shape[2] != 3)
+      || buffer->shape[0] < 1 || buffer->shape[1] < 1) {
+    PyErr_SetString(PyExc_ValueError,
+                    "The buffer must have the shape (nrows, ncols), or (nrows, ncols, 3) for RGB images");
+  } else {
+    Dim dim(buffer->shape[1], buffer->shape[0]);
+    if (pixel_type == ONEBIT)
+      image = image_from_buffer<OneBitPixel>(offset, dim, buffer);
+    else if (pixel_type == GREYSCALE)
+      image = image_from_buffer<GreyScalePixel>(offset, dim, buffer);
+    else if (pixel_type == GREY16)
+      image = image_from_buffer<Grey16Pixel>(offset, dim, buffer);
+    else if (pixel_type == RGB)
+      image = image_from_buffer<RGBPixel>(offset, dim, buffer);
+    else if (pixel_type == FLOAT)
+      image = image_from_buffer<FloatPixel>(offset, dim, buffer);
+    else if (pixel_type == COMPLEX)
+      image = image_from_buffer<ComplexPixel>(offset, dim, buffer);
+    else
+      PyErr_SetString(PyExc_ValueError, "Invalid pixel_type");
+  }
+  if (image == NULL)
+    release_python_buffer(buffer);
+  return image;
+}
+
+/*
+  The bitmaps of lists of OneBit glyphs in one Python string, as used
+  by the binary glyph databases of gamera_gdb.py.  The pixels of each
+  glyph are packed along its rows with eight pixels per byte (the first
+  pixel in the lowest bit), and each glyph starts at a new byte.
+*/
+namespace {
+  inline size_t packed_size(size_t ncols, size_t nrows) {
+    return (ncols * nrows + 7) / 8;
+  }
+
+  template<class T>
+  void pack_bits(const T& image, unsigned char* out) {
+    size_t bit = 0;
+    unsigned char byte = 0;
+    for (typename T::const_vec_iterator i = image.vec_begin(); i != image.vec_end(); ++i) {
+      if (is_black(*i))
+        byte |= (unsigned char)(1 << bit);
+      if (++bit == 8) {
+        *out++ = byte;
+        byte = 0;
+        bit = 0;
+      }
+    }
+    if (bit != 0)
+      *out = byte;
+  }
+
+  // sets the black pixels of image, returns the start of the next bitmap
+  template<class T>
+  const unsigned char* unpack_bits(T& image, const unsigned char* in) {
+    size_t bit = 0;
+    for (typename T::vec_iterator i = image.vec_begin(); i != image.vec_end(); ++i) {
+      if ((*in >> bit) & 1)
+        *i = black(image);
+      if (++bit == 8) {
+        ++in;
+        bit = 0;
+      }
+    }
+    if (bit != 0)
+      ++in;
+    return in;
+  }
+
+  inline void pack_bits_of(Image* image, int combination, unsigned char* out) {
+    switch (combination) {
+    case ONEBITIMAGEVIEW:
+      pack_bits(*((OneBitImageView*)image), out);
+      break;
+    case CC:
+      pack_bits(*((Cc*)image), out);
+      break;
+    case MLCC:
+      pack_bits(*((MlCc*)image), out);
+      break;
+    case ONEBITRLEIMAGEVIEW:
+      pack_bits(*((OneBitRleImageView*)image), out);
+      break;
+    case RLECC:
+      pack_bits(*((RleCc*)image), out);
+      break;
+    case ONEBITPACKEDIMAGEVIEW:
+      pack_bits(*((OneBitPackedImageView*)image), out);
+      break;
+    }
+  }
+}
+
+PyObject* _glyphs_to_bits(ImageVector& glyphs) {
+  std::vector<size_t> start(glyphs.size() + 1, 0);
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+    switch (glyphs[i].second) {
+    case ONEBITIMAGEVIEW: case CC: case MLCC: case ONEBITRLEIMAGEVIEW:
+    case RLECC: case ONEBITPACKEDIMAGEVIEW:
+      break;
+    default:
+      throw std::runtime_error("There is an Image in the list that is not a OneBit image.");
+    }
+    Image* image = glyphs[i].first;
+    start[i + 1] = start[i] + packed_size(image->ncols(), image->nrows());
+  }
+  PyObject* pystring = PyString_FromStringAndSize((char *)NULL, start.back());
+  if (pystring == NULL)
+    return NULL;
+  unsigned char* out = (unsigned char*)PyString_AS_STRING(pystring);
+  Py_BEGIN_ALLOW_THREADS
+  for (size_t i = 0; i < glyphs.size(); ++i)
+    pack_bits_of(glyphs[i].first, glyphs[i].second, out + start[i]);
+  Py_END_ALLOW_THREADS
+  return pystring;
+}
+
+/*
+  The dense OneBit glyphs of the bitmaps in data_string packed by
+  _glyphs_to_bits.  geometry holds the four numbers ul_x, ul_y, ncols,
+  nrows of each glyph.
+*/
+ImageList* _glyphs_from_bits(PyObject* data_string, const IntVector* geometry) {
+  if (!PyString_CheckExact(data_string))
+    throw std::invalid_argument("data_string must be a Python string");
+  if (geometry->size() % 4 != 0)
+    throw std::invalid_argument("geometry must hold four numbers for each glyph");
+  size_t n = geometry->size() / 4;
+  size_t length = PyString_GET_SIZE(data_string);
+  size_t total = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if ((*geometry)[4*i] < 0 || (*geometry)[4*i+1] < 0 ||
+        (*geometry)[4*i+2] < 1 || (*geometry)[4*i+3] < 1)
+      throw std::invalid_argument("Invalid glyph geometry");
+    total += packed_size((*geometry)[4*i+2], (*geometry)[4*i+3]);
+  }
+  if (total != length)
+    throw std::invalid_argument(length > total ? "data_string too long for glyphs"
+                                : "data_string too short for glyphs");
+
+  const unsigned char* in = (const unsigned char*)PyString_AS_STRING(data_string);
+  ImageList* result = new ImageList();
+  for (size_t i = 0; i < n; ++i) {
+    Dim dim((*geometry)[4*i+2], (*geometry)[4*i+3]);
+    OneBitImageData* data = new OneBitImageData(dim, Point((*geometry)[4*i], (*geometry)[4*i+1]));
+    OneBitImageView* image = new OneBitImageView(*data);
+    in = unpack_bits(*image, in);
+    result->push_back(image);
+  }
+  return result;
+}
+
+/*
+  Sets the pixels of image from one bitmap packed by _glyphs_to_bits,
+  which is how the glyphs of gamera_gdb.py decode their pixels when
+  they are first used.
+*/
+template<class T>
+void _unpack_glyph_bits(T& image, PyObject* data_string) {
+  if (!PyString_CheckExact(data_string))
+    throw std::invalid_argument("data_string must be a Python string");
+  if ((size_t)PyString_GET_SIZE(data_string) != packed_size(image.ncols(), image.nrows()))
+    throw std::invalid_argument("data_string does not fit the image");
+  std::fill(image.vec_begin(), image.vec_end(), white(image));
+  unpack_bits(image, (const unsigned char*)PyString_AS_STRING(data_string));
+}
+
+/*
+  A parser for the glyph databases written by WriteXML (gamera_xml.py),
+  which reads large databases much faster than expat calling back into
+  Python for every element.  It only takes the ASCII documents of the
+  Gamera XML schema, without comments, CDATA sections, processing
+  instructions or document types, and gives up (returning None) on
+  anything else.  LoadXML then reads the document with expat, so a
+  document means the same either way and expat reports its errors.
+
+  The <glyph> elements are split into ranges at their start tags (a
+  well-formed document has no other '<' in between) and the ranges are
+  parsed in parallel.
+*/
+namespace {
+  typedef std::pair<std::string, std::string> XmlPair;
+  typedef std::vector<XmlPair> XmlAttributes;
+
+  struct XmlProperty {
+    std::string name, type, value;
+  };
+
+  struct XmlGlyph {
+    long ul_x, ul_y, ncols, nrows;
+    std::string state;            // empty without <ids>
+    std::vector<XmlPair> ids;     // confidence, name
+    bool has_data;
+    std::string runs;
+    std::string scaling;          // empty without <features>
+    std::vector<XmlPair> features;
+    std::vector<XmlProperty> properties;
+  };
+
+  struct XmlDatabase {
+    std::string version;
+    std::vector<std::string> symbols;
+    std::vector<XmlGlyph> glyphs;
+  };
+
+  inline bool xml_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  inline bool xml_name_char(char c, bool first) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':' ||
+      (!first && ((c >= '0' && c <= '9') || c == '-' || c == '.'));
+  }
+
+  // Decodes the character data (or an attribute value) in [p, end)
+  bool xml_decode(const char* p, const char* end, bool attribute, std::string& out) {
+    out.clear();
+    out.reserve(end - p);
+    for (; p != end; ++p) {
+      unsigned char c = *p;
+      if (c >= 0x80 || c == '<' || (c < 0x20 && !xml_space(c)))
+        return false;
+      if (c == '&') {
+        const char* semicolon = (const char*)memchr(p, ';', end - p);
+        if (semicolon == 0)
+          return false;
+        std::string entity(p + 1, semicolon);
+        p = semicolon;
+        if (entity == "lt") c = '<';
+        else if (entity == "gt") c = '>';
+        else if (entity == "amp") c = '&';
+        else if (entity == "quot") c = '"';
+        else if (entity == "apos") c = '\'';
+        else if (entity.size() > 1 && entity[0] == '#') {
+          // character references are taken as they are, without the
+          // normalization of line ends and attribute whitespace
+          bool hex = entity[1] == 'x';
+          size_t i = hex ? 2 : 1;
+          if (i == entity.size() || entity.size() - i > 6)
+            return false;
+          unsigned long code = 0;
+          for (; i < entity.size(); ++i) {
+            char d = entity[i];
+            if (d >= '0' && d <= '9') code = code * (hex ? 16 : 10) + (d - '0');
+            else if (hex && d >= 'a' && d <= 'f') code = code * 16 + (d - 'a' + 10);
+            else if (hex && d >= 'A' && d <= 'F') code = code * 16 + (d - 'A' + 10);
+            else return false;
+          }
+          if (code >= 0x80 || (code < 0x20 && !xml_space((char)code)))
+            return false;
+          out += (char)code;
+          continue;
+        }
+        else return false;
+        out += c;
+        continue;
+      }
+      if (c == '\r') {
+        if (p + 1 != end && p[1] == '\n')
+          ++p;
+        c = '\n';
+      }
+      if (attribute && (c == '\t' || c == '\n'))
+        c = ' ';
+      else if (c == ']' && end - p >= 3 && p[1] == ']' && p[2] == '>')
+        return false;
+      out += c;
+    }
+    return true;
+  }
+
+  bool xml_long(const std::string& s, long& value) {
+    size_t i = (!s.empty() && s[0] == '-') ? 1 : 0;
+    if (i == s.size() || s.size() - i > 9)
+      return false;
+    value = 0;
+    for (; i < s.size(); ++i) {
+      if (s[i] < '0' || s[i] > '9')
+        return false;
+      value = value * 10 + (s[i] - '0');
+    }
+    if (s[0] == '-')
+      value = -value;
+    return true;
+  }
+
+  const std::string* xml_attribute(const XmlAttributes& attributes, const char* name) {
+    for (size_t i = 0; i < attributes.size(); ++i)
+      if (attributes[i].first == name)
+        return &attributes[i].second;
+    return 0;
+  }
+
+  class XmlReader {
+  public:
+    XmlReader(const char* begin, const char* end) : m_p(begin), m_end(end) { }
+
+    const char* position() const { return m_p; }
+    bool at_end() const { return m_p == m_end; }
+    bool at_end_tag() const {
+      return m_end - m_p >= 2 && m_p[0] == '<' && m_p[1] == '/';
+    }
+    void skip_space() {
+      while (m_p != m_end && xml_space(*m_p))
+        ++m_p;
+    }
+    // skips whitespace, false if there is other character data
+    bool space_only() {
+      skip_space();
+      return m_p == m_end || *m_p == '<';
+    }
+
+    // <?xml version="1.0" encoding="..."?> with an encoding of ASCII
+    bool declaration() {
+      if (m_end - m_p < 6 || strncmp(m_p, "<?xml", 5) != 0 || !xml_space(m_p[5]))
+        return true;
+      m_p += 5;
+      XmlAttributes decl;
+      if (!attributes(decl) || m_end - m_p < 2 || m_p[0] != '?' || m_p[1] != '>')
+        return false;
+      m_p += 2;
+      const std::string* version = xml_attribute(decl, "version");
+      if (version == 0 || *version != "1.0")
+        return false;
+      const std::string* encoding = xml_attribute(decl, "encoding");
+      if (encoding == 0)
+        return true;
+      std::string name(*encoding);
+      for (size_t i = 0; i < name.size(); ++i)
+        name[i] = tolower(name[i]);
+      return name == "utf-8" || name == "us-ascii" || name == "iso-8859-1";
+    }
+
+    // a start tag, or an empty element tag (then empty is set)
+    bool start_tag(std::string& name, XmlAttributes& attrs, bool& empty) {
+      if (m_p == m_end || *m_p != '<')
+        return false;
+      ++m_p;
+      if (!read_name(name) || !attributes(attrs))
+        return false;
+      if (*m_p == '>') {
+        ++m_p;
+        empty = false;
+        return true;
+      }
+      if (*m_p == '/' && m_end - m_p >= 2 && m_p[1] == '>') {
+        m_p += 2;
+        empty = true;
+        return true;
+      }
+      return false;
+    }
+
+    bool end_tag(const char* name) {
+      size_t n = strlen(name);
+      if ((size_t)(m_end - m_p) < n + 2 || !at_end_tag() || strncmp(m_p + 2, name, n) != 0)
+        return false;
+      m_p += n + 2;
+      skip_space();
+      if (m_p == m_end || *m_p != '>')
+        return false;
+      ++m_p;
+      return true;
+    }
+
+    // the character data up to the next tag
+    bool text(std::string& out) {
+      const char* begin = m_p;
+      while (m_p != m_end && *m_p != '<')
+        ++m_p;
+      return xml_decode(begin, m_p, false, out);
+    }
+
+  private:
+    bool read_name(std::string& name) {
+      const char* begin = m_p;
+      if (m_p == m_end || !xml_name_char(*m_p, true))
+        return false;
+      while (m_p != m_end && xml_name_char(*m_p, false))
+        ++m_p;
+      name.assign(begin, m_p);
+      return true;
+    }
+
+    // the attributes of a tag, up to '>', '/' or '?'
+    bool attributes(XmlAttributes& attrs) {
+      attrs.clear();
+      for (;;) {
+        const char* before = m_p;
+        skip_space();
+        if (m_p == m_end)
+          return false;
+        if (*m_p == '>' || *m_p == '/' || *m_p == '?')
+          return true;
+        std::string name;
+        if (m_p == before || !read_name(name))
+          return false;
+        skip_space();
+        if (m_p == m_end || *m_p != '=')
+          return false;
+        ++m_p;
+        skip_space();
+        if (m_p == m_end || (*m_p != '"' && *m_p != '\''))
+          return false;
+        const char* value = ++m_p;
+        m_p = (const char*)memchr(m_p, m_p[-1], m_end - m_p);
+        if (m_p == 0 || xml_attribute(attrs, name.c_str()) != 0)
+          return false;
+        attrs.push_back(XmlPair(name, std::string()));
+        if (!xml_decode(value, m_p, true, attrs.back().second))
+          return false;
+        ++m_p;
+      }
+    }
+
+    const char* m_p;
+    const char* m_end;
+  };
+
+  bool xml_number(const std::string* s) {
+    if (s == 0 || s->empty())
+      return false;
+    for (size_t i = 0; i < s->size(); ++i)
+      if (!(((*s)[i] >= '0' && (*s)[i] <= '9') || strchr("+-.eE", (*s)[i])))
+        return false;
+    return true;
+  }
+
+  bool parse_xml_glyph(XmlReader& r, bool with_data, bool with_features, XmlGlyph& glyph) {
+    std::string name;
+    XmlAttributes attrs;
+    bool empty;
+    if (!r.start_tag(name, attrs, empty) || name != "glyph")
+      return false;
+    const std::string* ul_y = xml_attribute(attrs, "uly");
+    const std::string* ul_x = xml_attribute(attrs, "ulx");
+    const std::string* nrows = xml_attribute(attrs, "nrows");
+    const std::string* ncols = xml_attribute(attrs, "ncols");
+    if (ul_y == 0 || ul_x == 0 || nrows == 0 || ncols == 0 ||
+        !xml_long(*ul_y, glyph.ul_y) || !xml_long(*ul_x, glyph.ul_x) ||
+        !xml_long(*nrows, glyph.nrows) || !xml_long(*ncols, glyph.ncols))
+      return false;
+    glyph.has_data = false;
+    if (empty)
+      return true;
+    bool ids = false, data = false, features = false;
+    for (;;) {
+      if (!r.space_only())
+        return false;
+      if (r.at_end_tag())
+        return r.end_tag("glyph");
+      if (!r.start_tag(name, attrs, empty))
+        return false;
+      if (name == "ids" && !ids) {
+        ids = true;
+        const std::string* state = xml_attribute(attrs, "state");
+        if (state == 0 || state->empty())
+          return false;
+        glyph.state = *state;
+        while (!empty) {
+          if (!r.space_only())
+            return false;
+          if (r.at_end_tag()) {
+            if (!r.end_tag("ids"))
+              return false;
+            break;
+          }
+          bool empty_id;
+          if (!r.start_tag(name, attrs, empty_id) || name != "id" || !empty_id)
+            return false;
+          const std::string* id = xml_attribute(attrs, "name");
+          const std::string* confidence = xml_attribute(attrs, "confidence");
+          if (id == 0 || !xml_number(confidence))
+            return false;
+          glyph.ids.push_back(XmlPair(*confidence, *id));
+        }
+      } else if (name == "data" && !data) {
+        data = true;
+        std::string runs;
+        if (!empty && (!r.text(runs) || !r.end_tag("data")))
+          return false;
+        if (with_data) {
+          glyph.has_data = true;
+          glyph.runs.swap(runs);
+        }
+      } else if (name == "features" && !features) {
+        features = true;
+        const std::string* scaling = xml_attribute(attrs, "scaling");
+        if (!xml_number(scaling))
+          return false;
+        glyph.scaling = *scaling;
+        while (!empty) {
+          if (!r.space_only())
+            return false;
+          if (r.at_end_tag()) {
+            if (!r.end_tag("features"))
+              return false;
+            break;
+          }
+          bool empty_feature;
+          if (!r.start_tag(name, attrs, empty_feature) || name != "feature")
+            return false;
+          const std::string* feature = xml_attribute(attrs, "name");
+          std::string values;
+          if (feature == 0 ||
+              (!empty_feature && (!r.text(values) || !r.end_tag("feature"))))
+            return false;
+          if (with_features)
+            glyph.features.push_back(XmlPair(*feature, values));
+        }
+      } else if (name == "property") {
+        const std::string* property = xml_attribute(attrs, "name");
+        const std::string* type = xml_attribute(attrs, "type");
+        if (property == 0 || type == 0)
+          return false;
+        glyph.properties.push_back(XmlProperty());
+        glyph.properties.back().name = *property;
+        glyph.properties.back().type = *type;
+        if (!empty && (!r.text(glyph.properties.back().value) || !r.end_tag("property")))
+          return false;
+      } else
+        return false;
+    }
+  }
+
+  bool parse_xml_glyphs(const char* begin, const char* end, bool with_data,
+                        bool with_features, std::vector<XmlGlyph>& glyphs) {
+    try {
+      XmlReader r(begin, end);
+      for (;;) {
+        r.skip_space();
+        if (r.at_end())
+          return true;
+        glyphs.push_back(XmlGlyph());
+        if (!parse_xml_glyph(r, with_data, with_features, glyphs.back()))
+          return false;
+      }
+    } catch (std::exception&) {
+      return false;
+    }
+  }
+
+  // the first tag in [p, end) that starts with prefix, or end
+  const char* xml_find_tag(const char* p, const char* end, const char* prefix) {
+    size_t n = strlen(prefix);
+    for (;; ++p) {
+      p = (const char*)memchr(p, '<', end - p);
+      if (p == 0 || (size_t)(end - p) <= n)
+        return end;
+      if (strncmp(p, prefix, n) == 0 &&
+          (xml_space(p[n]) || p[n] == '>' || p[n] == '/'))
+        return p;
+    }
+  }
+
+  bool parse_xml_glyphs_parallel(const char* begin, const char* end, bool with_data,
+                                 bool with_features, int threads,
+                                 std::vector<XmlGlyph>& glyphs) {
+    // a range of a megabyte at least for each thread
+    size_t parts = std::max((size_t)1, std::min((size_t)threads, (size_t)(end - begin) >> 20));
+    std::vector<const char*> bounds(parts + 1, end);
+    bounds[0] = begin;
+    for (size_t k = 1; k < parts && bounds[k - 1] != end; ++k)
+      bounds[k] = xml_find_tag(std::max(bounds[k - 1] + 1, begin + (end - begin) / parts * k),
+                               end, "<glyph");
+    std::vector<std::vector<XmlGlyph> > ranges(parts);
+    std::vector<char> ok(parts, 0);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(parts) schedule(static, 1)
+#endif
+    for (long k = 0; k < (long)parts; ++k)
+      ok[k] = parse_xml_glyphs(bounds[k], bounds[k + 1], with_data, with_features, ranges[k]);
+    size_t total = 0;
+    for (size_t k = 0; k < parts; ++k) {
+      if (!ok[k])
+        return false;
+      total += ranges[k].size();
+    }
+    size_t i = glyphs.size();
+    glyphs.resize(i + total);
+    for (size_t k = 0; k < parts; ++k)
+      for (size_t j = 0; j < ranges[k].size(); ++j, ++i)
+        std::swap(glyphs[i], ranges[k][j]);
+    return true;
+  }
+
+  bool parse_xml_database(const char* begin, const char* end, bool with_data,
+                          bool with_features, int threads, XmlDatabase& database) {
+    XmlReader r(begin, end);
+    std::string name;
+    XmlAttributes attrs;
+    bool empty;
+    if (!r.declaration())
+      return false;
+    r.skip_space();
+    if (!r.start_tag(name, attrs, empty) || name != "gamera-database")
+      return false;
+    const std::string* version = xml_attribute(attrs, "version");
+    if (!xml_number(version))
+      return false;
+    database.version = *version;
+    while (!empty) {
+      if (!r.space_only())
+        return false;
+      if (r.at_end_tag()) {
+        if (!r.end_tag("gamera-database"))
+          return false;
+        break;
+      }
+      bool empty_child;
+      if (!r.start_tag(name, attrs, empty_child))
+        return false;
+      if (name == "symbols") {
+        while (!empty_child) {
+          if (!r.space_only())
+            return false;
+          if (r.at_end_tag()) {
+            if (!r.end_tag("symbols"))
+              return false;
+            break;
+          }
+          bool empty_symbol;
+          if (!r.start_tag(name, attrs, empty_symbol) || name != "symbol" || !empty_symbol)
+            return false;
+          const std::string* symbol = xml_attribute(attrs, "name");
+          if (symbol == 0)
+            return false;
+          database.symbols.push_back(*symbol);
+        }
+      } else if (name == "glyphs") {
+        if (!empty_child) {
+          const char* glyphs_end = xml_find_tag(r.position(), end, "</glyphs");
+          if (!parse_xml_glyphs_parallel(r.position(), glyphs_end, with_data,
+                                         with_features, threads, database.glyphs))
+            return false;
+          r = XmlReader(glyphs_end, end);
+          if (!r.end_tag("glyphs"))
+            return false;
+        }
+      } else
+        return false;
+    }
+    r.skip_space();
+    return r.at_end();
+  }
+
+  PyObject* xml_string(const std::string& s) {
+    return PyString_FromStringAndSize(s.data(), s.size());
+  }
+
+  // None when the element is missing
+  PyObject* xml_optional_string(bool present, const std::string& s) {
+    if (!present) {
+      Py_INCREF(Py_None);
+      return Py_None;
+    }
+    return xml_string(s);
+  }
+
+  PyObject* xml_double(const std::string& s) {
+    char* end;
+    double value = PyOS_string_to_double(s.c_str(), &end, NULL);
+    if (value == -1.0 && PyErr_Occurred())
+      return 0;
+    if (end != s.c_str() + s.size()) {
+      PyErr_SetString(PyExc_ValueError, "invalid number");
+      return 0;
+    }
+    return PyFloat_FromDouble(value);
+  }
+
+  PyObject* xml_glyph_to_python(const XmlGlyph& glyph) {
+    PyObject* ids = PyList_New(glyph.ids.size());
+    PyObject* features = PyList_New(glyph.features.size());
+    PyObject* properties = PyList_New(glyph.properties.size());
+    if (ids == 0 || features == 0 || properties == 0) {
+      Py_XDECREF(ids);
+      Py_XDECREF(features);
+      Py_XDECREF(properties);
+      return 0;
+    }
+    PyObject* result = Py_BuildValue
+      ("(llllNNNNNN)", glyph.ul_x, glyph.ul_y, glyph.ncols, glyph.nrows,
+       xml_optional_string(!glyph.state.empty(), glyph.state), ids,
+       xml_optional_string(glyph.has_data, glyph.runs),
+       glyph.scaling.empty() ? PyFloat_FromDouble(1.0) : xml_double(glyph.scaling),
+       features, properties);
+    if (result == 0)
+      return 0;
+    for (size_t i = 0; i < glyph.ids.size(); ++i) {
+      PyObject* id = Py_BuildValue("(NN)", xml_double(glyph.ids[i].first),
+                                   xml_string(glyph.ids[i].second));
+      if (id == 0) {
+        Py_DECREF(result);
+        return 0;
+      }
+      PyList_SET_ITEM(ids, i, id);
+    }
+    for (size_t i = 0; i < glyph.features.size(); ++i) {
+      PyObject* feature = Py_BuildValue("(NN)", xml_string(glyph.features[i].first),
+                                        xml_string(glyph.features[i].second));
+      if (feature == 0) {
+        Py_DECREF(result);
+        return 0;
+      }
+      PyList_SET_ITEM(features, i, feature);
+    }
+    for (size_t i = 0; i < glyph.properties.size(); ++i) {
+      const XmlProperty& p = glyph.properties[i];
+      PyObject* property = Py_BuildValue("(NNN)", xml_string(p.name), xml_string(p.type),
+                                         xml_string(p.value));
+      if (property == 0) {
+        Py_DECREF(result);
+        return 0;
+      }
+      PyList_SET_ITEM(properties, i, property);
+    }
+    return result;
+  }
+}
+
+/*
+  Parses a glyph database written by WriteXML.  Returns None for the
+  documents that only expat can read, or else a tuple (version,
+  symbols, glyphs), where each glyph is a tuple (ul_x, ul_y, ncols,
+  nrows, state, ids, runs, scaling, features, properties) of the
+  values of its elements as gamera_xml.py reads them: ids holds pairs
+  (confidence, name), features pairs (name, values) and properties
+  triples (name, type, value).  state is None without <ids>, runs None
+  without <data> or when with_data is false, and features are only
+  read when with_features is set.
+*/
+PyObject* _glyphs_from_xml(PyObject* data_string, int with_data, int with_features, int threads) {
+  if (!PyString_CheckExact(data_string))
+    throw std::invalid_argument("data_string must be a Python string");
+#ifdef _OPENMP
+  if (threads <= 0)
+    threads = omp_get_max_threads();
+#else
+  threads = 1;
 #endif
+  const char* begin = PyString_AS_STRING(data_string);
+  const char* end = begin + PyString_GET_SIZE(data_string);
+  XmlDatabase database;
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    ok = parse_xml_database(begin, end, with_data != 0, with_features != 0, threads, database);
+  } catch (std::exception&) {
+    ok = false;
+  }
+  Py_END_ALLOW_THREADS
+  if (!ok)
+    Py_RETURN_NONE;
+
+  PyObject* symbols = PyList_New(database.symbols.size());
+  PyObject* glyphs = PyList_New(database.glyphs.size());
+  PyObject* result = Py_BuildValue("(NNN)", xml_double(database.version), symbols, glyphs);
+  if (result == 0)
+    goto failed;
+  for (size_t i = 0; i < database.symbols.size(); ++i) {
+    PyObject* symbol = xml_string(database.symbols[i]);
+    if (symbol == 0)
+      goto failed;
+    PyList_SET_ITEM(symbols, i, symbol);
+  }
+  for (size_t i = 0; i < database.glyphs.size(); ++i) {
+    PyObject* glyph = xml_glyph_to_python(database.glyphs[i]);
+    if (glyph == 0)
+      goto failed;
+    PyList_SET_ITEM(glyphs, i, glyph);
+    // the strings of the glyph are no longer needed
+    database.glyphs[i] = XmlGlyph();
+  }
+  return result;
 
+ failed:
+  Py_XDECREF(result);
+  // numbers that only Python cannot read are left to expat as well
+  if (PyErr_ExceptionMatches(PyExc_ValueError)) {
+    PyErr_Clear();
+    Py_RETURN_NONE;
+  }
+  return 0;
+}
+
+#endif
@@ -25,6 +25,8 @@
 #include "gamera.hpp"
 #include <math.h>
 #include <algorithm>
+#include <string>
+#include <vector>
 
 namespace Gamera {
   template<class T, class U>
@@ -328,45 +330,131 @@ namespace Gamera {
     return Py_BuildValue(CHAR_PTR_CAST "fffi", b, a, q, x_of_y);
   }
 
-  // straightforward implementation of Wagner and Fischer's algorithm from 1974
-  int edit_distance(std::string s1, std::string s2)
+  /*
+    Computes the edit distance with the bit-parallel algorithm by Myers,
+    in the block form by Hyyro: the differences between adjacent cells
+    of a column of the Wagner-Fischer matrix are kept as bits, so that a
+    whole column of up to 64 characters of the shorter string is
+    advanced with a few word operations per character of the longer
+    string.
+
+    See G. Myers: A fast bit-vector algorithm for approximate string
+    matching based on dynamic programming. Journal of the ACM 46,
+    pp. 395-415, 1999, and H. Hyyro: A bit-vector algorithm for
+    computing Levenshtein and Damerau edit distances. Nordic Journal
+    of Computing 10, pp. 29-39, 2003.
+  */
+  int edit_distance(const std::string& s1, const std::string& s2)
   {
-    size_t s1len, s2len;       // length of the two strings
-    IntVector *prev, *curr;    // previous and current matrix column
-    IntVector *tmp;
-    size_t result, add, del, sub;
-    size_t i,j;
-  
-    s1len = s1.size(); s2len = s2.size();
-    if (s1len == 0) return s2len;
-    if (s2len == 0) return s1len;
-
-    prev = new IntVector(s1len+1);
-    curr = new IntVector(s1len+1);
-    for (i=0; i<s1len+1; i++) (*prev)[i] = i;
-
-    for (j=1; j<s2len+1; j++) {
-      if (j>1) {
-        // move one column further in evaluation matrix
-        tmp = prev;
-        prev = curr;
-        curr = tmp;
+    typedef unsigned long long word;
+    const std::string& p = (s1.size() <= s2.size()) ? s1 : s2;
+    const std::string& t = (s1.size() <= s2.size()) ? s2 : s1;
+    size_t m = p.size();
+    if (m == 0) return t.size();
+
+    size_t nblocks = (m + 63) / 64;
+    // peq[c * nblocks + k]: the positions of character c in block k
+    std::vector<word> peq(256 * nblocks, 0);
+    for (size_t i = 0; i < m; ++i)
+      peq[(unsigned char)p[i] * nblocks + i / 64] |= word(1) << (i % 64);
+    std::vector<word> pv(nblocks, ~word(0)), mv(nblocks, 0);
+    const word high = word(1) << 63;
+    const word last = word(1) << ((m - 1) % 64);
+    int score = m;
+
+    for (size_t j = 0; j < t.size(); ++j) {
+      const word* eqs = &peq[(unsigned char)t[j] * nblocks];
+      // the first row of the matrix increases by one in each column
+      int hin = 1;
+      for (size_t k = 0; k < nblocks; ++k) {
+        word eq = eqs[k], xv = eq | mv[k];
+        if (hin < 0)
+          eq |= 1;
+        word xh = (((eq & pv[k]) + pv[k]) ^ pv[k]) | eq;
+        word ph = mv[k] | ~(xh | pv[k]);
+        word mh = pv[k] & xh;
+        if (k + 1 == nblocks) {
+          if (ph & last) ++score;
+          else if (mh & last) --score;
+        }
+        int hout = (ph & high) ? 1 : ((mh & high) ? -1 : 0);
+        ph <<= 1; mh <<= 1;
+        if (hin < 0) mh |= 1;
+        else if (hin > 0) ph |= 1;
+        pv[k] = mh | ~(xv | ph);
+        mv[k] = ph & xv;
+        hin = hout;
       }
-      (*curr)[0] = j;
-      for (i=1; i<s1len+1; i++) {
-        // cost of different transformation operations
-        if (s1[i-1] == s2[j-1])
-          sub = (*prev)[i-1];
-        else
-          sub = (*prev)[i-1] + 1;
-        add = (*prev)[i] + 1;
-        del = (*curr)[i-1] + 1;
-        (*curr)[i] = std::min(sub, std::min(add,del));
+    }
+    return score;
+  }
+
+  // the edit distances of a list of string pairs
+  IntVector* edit_distances(PyObject* pairs) {
+    PyObject* seq = PySequence_Fast(pairs, "pairs must be a list of string pairs");
+    if (seq == NULL)
+      throw std::runtime_error("pairs must be a list of string pairs");
+    size_t n = PySequence_Fast_GET_SIZE(seq);
+    IntVector* result = new IntVector(n);
+    for (size_t i = 0; i < n; ++i) {
+      PyObject* pair = PySequence_Fast_GET_ITEM(seq, i);
+      char *s1, *s2;
+      if (!PyTuple_Check(pair) || !PyArg_ParseTuple(pair, CHAR_PTR_CAST "ss", &s1, &s2)) {
+        PyErr_Clear();
+        Py_DECREF(seq);
+        delete result;
+        throw std::runtime_error("edit_distances: each pair must be a tuple of two strings");
       }
+      (*result)[i] = edit_distance(s1, s2);
     }
+    Py_DECREF(seq);
+    return result;
+  }
 
-    result = (*curr)[s1len];
-    delete prev; delete curr;
+  /*
+    The least square fits through the bounding boxes of the images of
+    each line in lines, using the lower center (reference 0), the
+    center (1) or the upper center (2) of each bounding box.
+  */
+  PyObject* least_squares_fit_lines(PyObject* lines, int reference) {
+    PyObject* seq = PySequence_Fast(lines, "lines must be a list of image lists");
+    if (seq == NULL)
+      throw std::runtime_error("lines must be a list of image lists");
+    size_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject* result = PyList_New(n);
+    PointVector points;
+    for (size_t i = 0; i < n; ++i) {
+      PyObject* line = PySequence_Fast(PySequence_Fast_GET_ITEM(seq, i),
+                                       "each line must be a list of images");
+      if (line == NULL) {
+        Py_DECREF(seq);
+        Py_DECREF(result);
+        throw std::runtime_error("each line must be a list of images");
+      }
+      points.clear();
+      for (Py_ssize_t j = 0; j < PySequence_Fast_GET_SIZE(line); ++j) {
+        PyObject* image = PySequence_Fast_GET_ITEM(line, j);
+        if (!is_RectObject(image)) {
+          Py_DECREF(line);
+          Py_DECREF(seq);
+          Py_DECREF(result);
+          throw std::runtime_error("each line must be a list of images");
+        }
+        Rect* r = ((RectObject*)image)->m_x;
+        size_t y = (reference == 0) ? r->lr_y() : ((reference == 1) ? r->center_y() : r->ul_y());
+        points.push_back(Point(r->center_x(), y));
+      }
+      Py_DECREF(line);
+      if (points.empty()) {
+        Py_DECREF(seq);
+        Py_DECREF(result);
+        throw std::runtime_error("least_squares_fit_lines: a line has no images");
+      }
+      double a, b, q;
+      least_squares_fit(points, a, b, q);
+      PyList_SET_ITEM(result, i, Py_BuildValue(CHAR_PTR_CAST "fff", b, a, q));
+    }
+    Py_DECREF(seq);
     return result;
   }
 
@@ -73,45 +73,135 @@ namespace Gamera {
     }
   }
 
-  template<class T>
-  inline void thin_zs_flag(const T& thin, T& flag, const unsigned char a, const unsigned char b) {
-    register unsigned char p;
-    size_t N, S; 
-    for (size_t y = 0; y < thin.nrows(); ++y) {
-      size_t y_before = (y == 0) ? 1 : y - 1;
-      size_t y_after = (y == thin.nrows() - 1) ? thin.nrows() - 2 : y + 1;
-      for (size_t x = 0; x < thin.ncols(); ++x) {
-	if (is_black(thin.get(Point(x, y)))) {
-	  thin_zs_get(y, y_before, y_after, x, thin, p, N, S);
-	  if ((N <= 6) && (N >= 2) &&
-	      (S == 1) &&
-	      !((p & a) == a) &&
-	      !((p & b) == b))  
-	    flag.set(Point(x, y), black(flag));
-	  else
-	    flag.set(Point(x, y), white(flag));
-	}
+  /* All three thinnings delete black pixels according to their eight
+     neighbors only, so they look the neighborhood up in a table of the
+     256 possible ones (bit i being the i-th neighbor clockwise from the
+     one above, as in thin_zs_get).  A pixel can only be deleted when it
+     has a white neighbor, so every step only checks the black pixels
+     on the contour, whose list grows by the black neighbors of the
+     pixels deleted. */
+  namespace ThinningDetail {
+    class Pixels {
+    public:
+      template<class T>
+      Pixels(const T& image) : ncols(image.ncols()), nrows(image.nrows()),
+                               black(ncols * nrows) {
+        std::vector<unsigned char>::iterator p = black.begin();
+        for (typename T::const_vec_iterator i = image.vec_begin(); i != image.vec_end(); ++i, ++p)
+          *p = is_black(*i);
       }
-    }
-  }
-  
-  template<class T>
-  inline bool thin_zs_del_fbp(T& thin, const T& flag) {
-    bool deleted = false;
-    typename T::vec_iterator thin_it = thin.vec_begin();
-    typename T::const_vec_iterator flag_it = flag.vec_begin();
-    for (; thin_it != thin.vec_end(); ++thin_it, ++flag_it)
-      if (is_black(*flag_it) && is_black(*thin_it)) {
-	(*thin_it) = white(thin);
-	deleted = true;
+
+      // whitens the pixels of image that have been deleted
+      template<class T>
+      void write(T& image) const {
+        std::vector<unsigned char>::const_iterator p = black.begin();
+        for (typename T::vec_iterator i = image.vec_begin(); i != image.vec_end(); ++i, ++p)
+          if (!*p && is_black(*i))
+            *i = white(image);
+      }
+
+      // outside the image, the neighbors are reflected as in thin_zs_get
+      unsigned char neighborhood(size_t x, size_t y) const {
+        size_t x_before = (x == 0) ? 1 : x - 1;
+        size_t x_after = (x == ncols - 1) ? ncols - 2 : x + 1;
+        const unsigned char* before = &black[((y == 0) ? 1 : y - 1) * ncols];
+        const unsigned char* row = &black[y * ncols];
+        const unsigned char* after = &black[((y == nrows - 1) ? nrows - 2 : y + 1) * ncols];
+        return (before[x_before] << 7) | (row[x_before] << 6) |
+          (after[x_before] << 5) | (after[x] << 4) | (after[x_after] << 3) |
+          (row[x_after] << 2) | (before[x_after] << 1) | before[x];
+      }
+
+      size_t ncols, nrows;
+      std::vector<unsigned char> black;
+    };
+
+    class Contour {
+    public:
+      Contour(const Pixels& pixels) : listed(pixels.black.size(), 0) {
+        for (size_t y = 0; y < pixels.nrows; ++y)
+          for (size_t x = 0; x < pixels.ncols; ++x)
+            if (pixels.black[y * pixels.ncols + x] &&
+                pixels.neighborhood(x, y) != 0xff) {
+              listed[y * pixels.ncols + x] = 1;
+              candidates.push_back(y * pixels.ncols + x);
+            }
+      }
+
+      /* deletes at once all the contour pixels whose neighborhood is
+         deletable, and returns whether there were any */
+      bool step(Pixels& pixels, const bool* deletable) {
+        size_t ncols = pixels.ncols;
+        matches.clear();
+        for (size_t i = 0; i < candidates.size(); ++i) {
+          size_t at = candidates[i];
+          if (deletable[pixels.neighborhood(at % ncols, at / ncols)])
+            matches.push_back(at);
+        }
+        if (matches.empty())
+          return false;
+        for (size_t i = 0; i < matches.size(); ++i) {
+          pixels.black[matches[i]] = 0;
+          listed[matches[i]] = 0;
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < candidates.size(); ++i)
+          if (listed[candidates[i]])
+            candidates[kept++] = candidates[i];
+        candidates.resize(kept);
+        for (size_t i = 0; i < matches.size(); ++i) {
+          size_t x = matches[i] % ncols, y = matches[i] / ncols;
+          for (size_t ny = (y == 0 ? 0 : y - 1); ny <= y + 1 && ny < pixels.nrows; ++ny)
+            for (size_t nx = (x == 0 ? 0 : x - 1); nx <= x + 1 && nx < ncols; ++nx) {
+              size_t at = ny * ncols + nx;
+              if (pixels.black[at] && !listed[at]) {
+                listed[at] = 1;
+                candidates.push_back(at);
+              }
+            }
+        }
+        return true;
+      }
+
+    private:
+      std::vector<unsigned char> listed;
+      std::vector<size_t> candidates, matches;
+    };
+
+    // the two subiterations of Zhang and Suen
+    inline void thin_zs_tables(bool tables[2][256]) {
+      const unsigned char constants[2][2] = {{21, 84}, {69, 81}};
+      for (size_t p = 0; p < 256; ++p) {
+        size_t N = 0, S = 0;
+        bool prev = p & (1 << 7);
+        for (size_t i = 0; i < 8; ++i) {
+          if (p & (1 << i)) {
+            ++N;
+            S += !prev;
+            prev = true;
+          } else
+            prev = false;
+        }
+        for (size_t t = 0; t < 2; ++t) {
+          unsigned char a = constants[t][0], b = constants[t][1];
+          tables[t][p] = (N <= 6) && (N >= 2) && (S == 1) &&
+            !((p & a) == a) && !((p & b) == b);
+        }
       }
-    return deleted;
+    }
+
+    inline void thin_zs_pixels(Pixels& pixels) {
+      bool tables[2][256];
+      thin_zs_tables(tables);
+      Contour contour(pixels);
+      size_t t = 0;
+      while (contour.step(pixels, tables[t]))
+        t = !t;
+    }
   }
 
   template<class T>
   typename ImageFactory<T>::view_type* thin_zs(const T& in) {
-    const unsigned char constants[2][2] = {{21, 84}, {69, 81}};
-
     typedef typename ImageFactory<T>::data_type data_type;
     typedef typename ImageFactory<T>::view_type view_type;
     data_type* thin_data = new data_type(in.size(), in.origin());
@@ -120,35 +210,16 @@ namespace Gamera {
     if (in.nrows() == 1 || in.ncols() == 1) {
       return thin_view;
     }
-    
-    data_type* flag_data = 0;
-    view_type* flag_view = 0;
+
     try {
-      flag_data = new data_type(in.size(), in.origin());
-      flag_view = new view_type(*flag_data);
-      
-      try {
-	bool deleted = true;
-	bool constant_i = false;
-	while (deleted) {
-	  thin_zs_flag(*thin_view, *flag_view, 
-		       constants[constant_i][0], constants[constant_i][1]);
-	  deleted = thin_zs_del_fbp(*thin_view, *flag_view);
-	  constant_i = !constant_i;
-	}
-      } catch (std::exception e) {
-	delete flag_view;
-	delete flag_data;
-	throw;
-      }
+      ThinningDetail::Pixels pixels(*thin_view);
+      ThinningDetail::thin_zs_pixels(pixels);
+      pixels.write(*thin_view);
     } catch (std::exception e) {
-      delete thin_data;
       delete thin_view;
+      delete thin_data;
       throw;
     }
-
-    delete flag_view;
-    delete flag_data;
     return thin_view;
   }
 
@@ -195,62 +266,25 @@ namespace Gamera {
 
   static unsigned char thin_hs_elements[16][3] = {{0x7, 0x2, 0x0}, {0x0, 0x0, 0x7}, {0x2, 0x6, 0x0}, {0x0, 0x1, 0x3}, {0x1, 0x3, 0x1}, {0x4, 0x4, 0x4}, {0x2, 0x3, 0x0}, {0x0, 0x4, 0x6}, {0x4, 0x6, 0x4}, {0x1, 0x1, 0x1}, {0x0, 0x3, 0x2}, {0x6, 0x4, 0x0}, {0x0, 0x2, 0x7}, {0x7, 0x0, 0x0}, {0x0, 0x6, 0x2}, {0x3, 0x1, 0x0}};
 
-  template<class T>
-  inline void thin_hs_diff_image(T& in, const T& other) {
-    typename T::vec_iterator in_it = in.vec_begin();
-    typename T::const_vec_iterator other_it = other.vec_begin();
-    for (; in_it != in.vec_end(); ++in_it, ++other_it) {
-      if (is_black(*in_it) ^ is_black(*other_it)) 
-	*in_it = black(in);
-      else
-	*in_it = white(in);
-    }
-  }
-
-  template<class T>
-  inline bool thin_hs_hit_and_miss(const T& in, T& H_M, 
-				   const size_t& j, const size_t& k) {
-    bool flag;
-
-    /* HIT operation */
-    flag = false;
-    for (size_t r = 1; r < in.nrows() - 1; ++r) {
-      for (size_t c = 1; c < in.ncols() - 1; ++c) {
-	for (size_t l = 0; l < 3; ++l) {
-	  for (size_t m = 0; m < 3; ++m) {
-	    if (is_white(in.get(Point(c + m - 1, r + l - 1)))) {
-	      if (thin_hs_elements[j][l] & (1 << m))
-		goto remove;
-	    } else {
-	      if (thin_hs_elements[k][l] & (1 << m))
-		goto remove;
-	    }
-	  }
-	}
-
-	H_M.set(Point(c, r), black(H_M));
-	flag = true; 
-	continue;
-      remove:
-	H_M.set(Point(c, r), white(H_M));
-      }
-    }
-
-    return flag;
-  }
-
-  template<class T>
-  bool thin_hs_one_pass(T& in, T& H_M) {
-    bool update_flag = false;
-    for (size_t i = 0; i < 8; ++i) {
-      size_t j = i * 2;
-      size_t k = j + 1;
-      if (thin_hs_hit_and_miss(in, H_M, j, k)) {
-	thin_hs_diff_image(in, H_M);
-	update_flag = true;
+  namespace ThinningDetail {
+    /* the neighborhoods that the eight pairs of structuring elements
+       J (black) and K (white) hit, J always holding the center */
+    inline void thin_hs_tables(bool tables[8][256]) {
+      const int bit[3][3] = {{7, 0, 1}, {6, -1, 2}, {5, 4, 3}};
+      for (size_t i = 0; i < 8; ++i) {
+        unsigned char hit = 0, miss = 0;
+        for (size_t l = 0; l < 3; ++l)
+          for (size_t m = 0; m < 3; ++m)
+            if (bit[l][m] >= 0) {
+              if (thin_hs_elements[i * 2][l] & (1 << m))
+                hit |= 1 << bit[l][m];
+              if (thin_hs_elements[i * 2 + 1][l] & (1 << m))
+                miss |= 1 << bit[l][m];
+            }
+        for (size_t p = 0; p < 256; ++p)
+          tables[i][p] = ((p & hit) == hit) && !(p & miss);
       }
     }
-    return update_flag;
   }
 
   template<class T>
@@ -272,19 +306,19 @@ namespace Gamera {
 	  thin_view->set(Point(x + 1, y + 1), in.get(Point(x, y)));
       if (in.nrows() == 1 || in.ncols() == 1)
 	goto end;
-      data_type* H_M_data = new data_type(new_size, new_origin);
-      view_type* H_M_view = new view_type(*H_M_data);
-      try {
-	bool not_finished = true;
-	while (not_finished)
-	  not_finished = thin_hs_one_pass(*thin_view, *H_M_view);
-      } catch (std::exception e) {
-	delete H_M_view;
-	delete H_M_data;
-	throw;
+      // the white border keeps the structuring elements in the image
+      ThinningDetail::Pixels pixels(*thin_view);
+      ThinningDetail::Contour contour(pixels);
+      bool tables[8][256];
+      ThinningDetail::thin_hs_tables(tables);
+      bool not_finished = true;
+      while (not_finished) {
+	not_finished = false;
+	for (size_t i = 0; i < 8; ++i)
+	  if (contour.step(pixels, tables[i]))
+	    not_finished = true;
       }
-      delete H_M_view;
-      delete H_M_data;
+      pixels.write(*thin_view);
     } catch (std::exception e) {
       delete thin_view;
       delete thin_data;
@@ -348,47 +382,56 @@ namespace Gamera {
 					       0x2020, 0x20a0, 0x0,    0xa0a0, 
 					       0x2020, 0x5b5b, 0xa020, 0x4850};
 
+  namespace ThinningDetail {
+    /* thin_lc on pixels, whose final pass whitens the pixels in place,
+       one after the other.  Since a pixel only depends on the rows next
+       to it, a row is final once the row below it is done, and is then
+       handed to row_done(pixels, y), so that the skeleton can be
+       measured in the same pass. */
+    template<class RowDone>
+    void thin_lc_pixels(Pixels& pixels, RowDone& row_done) {
+      thin_zs_pixels(pixels);
+      for (size_t y = 0; y < pixels.nrows; ++y) {
+	for (size_t x = 0; x < pixels.ncols; ++x) {
+	  if (pixels.black[y * pixels.ncols + x]) {
+	    unsigned char p = pixels.neighborhood(x, y);
+	    if (thin_lc_look_up[p >> 4] & (1 << (p & 0xf)))
+	      pixels.black[y * pixels.ncols + x] = 0;
+	  }
+	}
+	if (y > 0)
+	  row_done(pixels, y - 1);
+      }
+      row_done(pixels, pixels.nrows - 1);
+    }
+
+    struct IgnoreRows {
+      void operator()(const Pixels&, size_t) { }
+    };
+  }
+
   template<class T>
   typename ImageFactory<T>::view_type* thin_lc(const T& in) {
     typedef typename ImageFactory<T>::data_type data_type;
     typedef typename ImageFactory<T>::view_type view_type;
 
     // Chain to thin_zs
-    view_type* thin_view = thin_zs(in);
+    data_type* thin_data = new data_type(in.size(), in.origin());
+    view_type* thin_view = new view_type(*thin_data);
+    image_copy_fill(in, *thin_view);
     if (in.nrows() == 1 || in.ncols() == 1) {
       return thin_view;
     }
 
     try {
-      size_t nrows = thin_view->nrows();
-      size_t ncols = thin_view->ncols();
-      typename view_type::vec_iterator it = thin_view->vec_begin();
-      for (size_t y = 0; y < nrows; ++y) {
-	size_t y_before = (y == 0) ? 1 : y - 1;
-	size_t y_after = (y == nrows - 1) ? nrows - 2 : y + 1;
-	for (size_t x = 0; x < ncols; ++x, ++it) {
-	  if (is_black(*it)) {
-	    size_t x_before = (x == 0) ? 1 : x - 1;
-	    size_t x_after = (x == ncols - 1) ? ncols - 2 : x + 1;
-	    
-	    size_t j = ((is_black(thin_view->get(Point(x_after, y_after))) << 3) |
-			(is_black(thin_view->get(Point(x_after, y))) << 2) |
-			(is_black(thin_view->get(Point(x_after, y_before))) << 1) |
-			(is_black(thin_view->get(Point(x, y_before)))));
-	    
-	    size_t i = ((is_black(thin_view->get(Point(x_before, y_before))) << 3) |
-			(is_black(thin_view->get(Point(x_before, y))) << 2) |
-			(is_black(thin_view->get(Point(x_before, y_after))) << 1) |
-			(is_black(thin_view->get(Point(x, y_after)))));
-	    
-	    if (thin_lc_look_up[i] & (1 << j))
-	      *it = white(*thin_view);
-	  }
-	}
-      }
+      ThinningDetail::Pixels pixels(*thin_view);
+      ThinningDetail::IgnoreRows ignore;
+      ThinningDetail::thin_lc_pixels(pixels, ignore);
+      pixels.write(*thin_view);
     } catch (std::exception e) {
-      delete thin_view->data();
       delete thin_view;
+      delete thin_data;
+      throw;
     }
     return thin_view;
   }
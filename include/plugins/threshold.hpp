@@ -21,11 +21,17 @@
 #define kwm12032001_threshold
 
 #include "gamera.hpp"
+#include "thread_exception.hpp"
 #include "image_utilities.hpp"
 #include "misc_filters.hpp"
 #include <exception>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace Gamera;
 
@@ -64,6 +70,33 @@ void threshold_fill(const T& in, U& out, typename T::value_type threshold) {
   }
 }
 
+// dense images into dense ones, row by row as plain arrays
+template<class P>
+void threshold_fill(const ImageView<ImageData<P> >& in, OneBitImageView& out,
+                    typename ImageView<ImageData<P> >::value_type threshold) {
+  if (in.nrows() != out.nrows() || in.ncols() != out.ncols())
+    throw std::range_error("Dimensions must match!");
+  for (size_t y = 0; y < in.nrows(); ++y) {
+    const P* in_row = in[y];
+    OneBitPixel* out_row = out[y];
+    for (size_t x = 0; x < in.ncols(); ++x)
+      out_row[x] = in_row[x] > threshold ? white(out) : black(out);
+  }
+}
+
+// into RLE images, run by run
+template<class T>
+void threshold_fill(const T& in, OneBitRleImageView& out, typename T::value_type threshold) {
+  if (in.nrows() != out.nrows() || in.ncols() != out.ncols())
+    throw std::range_error("Dimensions must match!");
+  RleBuilder<OneBitPixel> builder(out);
+  typename T::const_row_iterator row = in.row_begin();
+  typename T::const_col_iterator col;
+  for (; row != in.row_end(); ++row)
+    for (col = row.begin(); col != row.end(); ++col)
+      builder.append(*col > threshold ? white(out) : black(out));
+}
+
 /*
   Image* threshold(GreyScale|Grey16|Float image, threshold, storage_format);
 
@@ -77,6 +110,11 @@ Image* threshold(const T &m, int threshold, int storage_format) {
     typename fact_type::image_type* view = fact_type::create(m.origin(), m.dim());
     threshold_fill(m, *view, threshold);
     return view;
+  } else if (storage_format == PACKED) {
+    typedef TypeIdImageFactory<ONEBIT, PACKED> fact_type;
+    typename fact_type::image_type* view = fact_type::create(m.origin(), m.dim());
+    threshold_fill(m, *view, threshold);
+    return view;
   } else {
     typedef TypeIdImageFactory<ONEBIT, RLE> fact_type;
     typename fact_type::image_type* view = fact_type::create(m.origin(), m.dim());
@@ -114,8 +152,8 @@ Image* threshold(const T &m, int threshold, int storage_format) {
  
 
 */
-template<class T>
-int otsu_find_threshold(const T& matrix) {
+// the Otsu threshold of a normalized greyscale histogram
+inline int otsu_find_threshold_of_histogram(const FloatVector* p) {
   int thresh;
   double criterion;
   double expr_1;
@@ -127,8 +165,6 @@ int otsu_find_threshold(const T& matrix) {
   double mu_k;
   int k_low, k_high;
 
-  FloatVector* p = histogram(matrix);
-
   mu_T = 0.0;
   for (i=0; i<256; i++)
     mu_T += i*(*p)[i];
@@ -159,6 +195,13 @@ int otsu_find_threshold(const T& matrix) {
           thresh = k;
         }
     }
+  return thresh;
+}
+
+template<class T>
+int otsu_find_threshold(const T& matrix) {
+  FloatVector* p = histogram(matrix);
+  int thresh = otsu_find_threshold_of_histogram(p);
   delete p;
   return thresh;
 }
@@ -171,6 +214,11 @@ Image* otsu_threshold(const T &m, int storage_format) {
     typename fact_type::image_type* view = fact_type::create(m.origin(), m.dim());
     threshold_fill(m, *view, threshold);
     return view;
+  } else if (storage_format == PACKED) {
+    typedef TypeIdImageFactory<ONEBIT, PACKED> fact_type;
+    typename fact_type::image_type* view = fact_type::create(m.origin(), m.dim());
+    threshold_fill(m, *view, threshold);
+    return view;
   } else {
     typedef TypeIdImageFactory<ONEBIT, RLE> fact_type;
     typename fact_type::image_type* view = fact_type::create(m.origin(), m.dim());
@@ -241,6 +289,11 @@ Image* tsai_moment_preserving_threshold(const T &m, int storage_format) {
     typename fact_type::image_type* view = fact_type::create(m.origin(), m.dim());
     threshold_fill(m, *view, threshold);
     return view;
+  } else if (storage_format == PACKED) {
+    typedef TypeIdImageFactory<ONEBIT, PACKED> fact_type;
+    typename fact_type::image_type* view = fact_type::create(m.origin(), m.dim());
+    threshold_fill(m, *view, threshold);
+    return view;
   } else {
     typedef TypeIdImageFactory<ONEBIT, RLE> fact_type;
     typename fact_type::image_type* view = fact_type::create(m.origin(), m.dim());
@@ -287,74 +340,106 @@ Original author:
 Øivind Due Trier
 */
 
+// the pixels with a grey value up to threshold and a mean of their
+// neighbourhood up to avg_threshold are black
+template<class T, class U, class V>
+void abutaleb_fill(const T& m, const U& average, V& view,
+                   size_t threshold, size_t avg_threshold) {
+  for (size_t y = 0; y < m.nrows(); ++y) {
+    const typename T::value_type* a = m[y];
+    const typename U::value_type* b = average[y];
+    for (size_t x = 0; x < m.ncols(); ++x) {
+      if (a[x] <= threshold && b[x] <= avg_threshold)
+        view.set(Point(x, y), black(view));
+      else
+        view.set(Point(x, y), white(view));
+    }
+  }
+}
+
+template<class T, class U>
+void abutaleb_fill(const T& m, const U& average, OneBitImageView& view,
+                   size_t threshold, size_t avg_threshold) {
+  for (size_t y = 0; y < m.nrows(); ++y) {
+    const typename T::value_type* a = m[y];
+    const typename U::value_type* b = average[y];
+    OneBitPixel* out = view[y];
+    for (size_t x = 0; x < m.ncols(); ++x)
+      out[x] = (a[x] <= threshold && b[x] <= avg_threshold) ? 1 : 0;
+  }
+}
+
+template<class T, class U>
+void abutaleb_fill(const T& m, const U& average, OneBitRleImageView& view,
+                   size_t threshold, size_t avg_threshold) {
+  RleBuilder<OneBitPixel> builder(view);
+  for (size_t y = 0; y < m.nrows(); ++y) {
+    const typename T::value_type* a = m[y];
+    const typename U::value_type* b = average[y];
+    for (size_t x = 0; x < m.ncols(); ++x)
+      builder.append((a[x] <= threshold && b[x] <= avg_threshold) ? 1 : 0);
+  }
+}
+
+/*
+  The two-dimensional histogram of grey values and neighbourhood means
+  is counted in one pass over the image.  The cumulative probability and
+  entropy of every (s, t) quadrant are integral tables of it, so that
+  each of the 256 * 256 candidate thresholds is evaluated in constant
+  time.
+*/
 template<class T>
 Image* abutaleb_threshold(const T &m, int storage_format) {
   typedef typename ImageFactory<T>::view_type view_type;
   view_type* average = mean(m);
-  
-  typedef FloatImageData histogram_data_type;
-  typedef FloatImageView histogram_type;
-  histogram_data_type histogram_data(Dim(256, 256));
-  histogram_type histogram(histogram_data);
-  histogram_data_type P_histogram_data(Dim(256, 256));
-  histogram_type P_histogram(P_histogram_data);
-  histogram_data_type H_histogram_data(Dim(256, 256));
-  histogram_type H_histogram(H_histogram_data);
-
-  typename histogram_type::vec_iterator hist_it = histogram.vec_begin();
-  for (; hist_it != histogram.vec_end(); ++hist_it)
-    *hist_it = 0.0;
-
-  for (size_t y = 0; y < m.nrows(); ++y)
-    for (size_t x = 0; x < m.ncols(); ++x) {
-      size_t a = m.get(Point(x, y));
-      size_t b = average->get(Point(x, y));
-      histogram.set(Point(a, b), histogram.get(Point(a, b)) + 1.0);
-    }
- 
-  double one_over_area = 1.0 / (m.nrows() * m.ncols());
-  for (size_t b = 0; b < 256; ++b)
-    for (size_t a = 0; a < 256; ++a)
-      histogram.set(Point(a, b), histogram.get(Point(a, b)) * one_over_area);
 
-  double P_sum = 0.0;
-  for (size_t s = 0; s < 256; ++s) {
-    P_sum += histogram.get(Point(s, 0));
-    P_histogram.set(Point(s, 0), P_sum);
-  }
-  for (size_t t = 1; t < 256; ++t) {
-    P_sum = 0.0;
-    for (size_t s = 0; s < 256; ++s) {
-      P_sum += histogram.get(Point(s, t));
-      P_histogram.set(Point(s, t), P_histogram.get(Point(s, t - 1)) + P_sum);
-    }
+  // indexed by [b * 256 + a] for grey value a and mean b
+  std::vector<size_t> counts(256 * 256, 0);
+  for (size_t y = 0; y < m.nrows(); ++y) {
+    const typename T::value_type* a = m[y];
+    const typename view_type::value_type* b = (*average)[y];
+    for (size_t x = 0; x < m.ncols(); ++x)
+      counts[size_t(b[x]) * 256 + size_t(a[x])]++;
   }
-  
-  double H_sum = 0.0;
+
+  std::vector<double> histogram(256 * 256);
+  double one_over_area = 1.0 / (m.nrows() * m.ncols());
+  for (size_t i = 0; i < 256 * 256; ++i)
+    histogram[i] = double(counts[i]) * one_over_area;
+
+  std::vector<double> P_histogram(256 * 256);
+  std::vector<double> H_histogram(256 * 256);
+  double P_sum = 0.0, H_sum = 0.0;
   for (size_t s = 0; s < 256; ++s) {
-    double p = histogram.get(Point(s, 0));
+    double p = histogram[s];
+    P_sum += p;
+    P_histogram[s] = P_sum;
     if (p != 0)
       H_sum -= p * log(p);
-    H_histogram.set(Point(s, 0), H_sum);
+    H_histogram[s] = H_sum;
   }
   for (size_t t = 1; t < 256; ++t) {
+    const double* row = &histogram[t * 256];
+    P_sum = 0.0;
     H_sum = 0.0;
     for (size_t s = 0; s < 256; ++s) {
-      double p = histogram.get(Point(s, t));
+      double p = row[s];
+      P_sum += p;
+      P_histogram[t * 256 + s] = P_histogram[(t - 1) * 256 + s] + P_sum;
       if (p != 0)
         H_sum -= p * log(p);
-      H_histogram.set(Point(s, t), H_histogram.get(Point(s, t - 1)) + H_sum);
+      H_histogram[t * 256 + s] = H_histogram[(t - 1) * 256 + s] + H_sum;
     }
   }
 
   double Phi_max = std::numeric_limits<double>::min();
   double tiny = 1e-6;
-  double H_end = H_histogram.get(Point(255, 255));
+  double H_end = H_histogram[255 * 256 + 255];
   size_t threshold = 0, avg_threshold = 0;
   for (size_t s = 0; s < 256; ++s)
     for (size_t t = 0; t < 256; ++t) {
-      double P = P_histogram.get(Point(s, t));
-      double H = H_histogram.get(Point(s, t));
+      double P = P_histogram[t * 256 + s];
+      double H = H_histogram[t * 256 + s];
       if ((P > tiny) && ((1.0 - P) > tiny)) {   
         double Phi = log(P * (1.0 - P)) + H / P + (H_end - H) / (1.0 - P);
         if (Phi > Phi_max) {
@@ -365,35 +450,27 @@ Image* abutaleb_threshold(const T &m, int storage_format) {
       }
     }
 
+  Image* result;
   if (storage_format == DENSE) {
     typedef TypeIdImageFactory<ONEBIT, DENSE> result_type;
     typename result_type::image_type* view = result_type::create(m.origin(), m.dim());
-    for (size_t y = 0; y < m.nrows(); ++y)
-      for (size_t x = 0; x < m.ncols(); ++x) {
-        if (m.get(Point(x, y)) <= threshold && average->get(Point(x, y)) <= avg_threshold)
-          view->set(Point(x, y), black(*view));
-        else
-          view->set(Point(x, y), white(*view));
-      }
-    delete average->data();
-    delete average;
-    return view;
+    abutaleb_fill(m, *average, *view, threshold, avg_threshold);
+    result = view;
+  } else if (storage_format == PACKED) {
+    typedef TypeIdImageFactory<ONEBIT, PACKED> result_type;
+    typename result_type::image_type* view = result_type::create(m.origin(), m.dim());
+    abutaleb_fill(m, *average, *view, threshold, avg_threshold);
+    result = view;
   } else {
     typedef TypeIdImageFactory<ONEBIT, RLE> result_type;
     typename result_type::image_type* view = result_type::create(m.origin(), m.dim());
-    for (size_t y = 0; y < m.nrows(); ++y) 
-      for (size_t x = 0; x < m.ncols(); ++x) {
-        if (m.get(Point(x, y)) <= threshold && average->get(Point(x, y)) <= avg_threshold)
-          view->set(Point(x, y), black(*view));
-        else
-          view->set(Point(x, y), white(*view));
-      }
-
-    delete average->data();
-    delete average;
-    return view;
+    abutaleb_fill(m, *average, *view, threshold, avg_threshold);
+    result = view;
   }
-}  
+  delete average->data();
+  delete average;
+  return result;
+}
 
 /*
   References:
@@ -405,51 +482,324 @@ Image* abutaleb_threshold(const T &m, int storage_format) {
 
   Original author:
   Øivind Due Trier
+
+  The minimum and maximum of each window are computed separably, first
+  along the rows and then along the columns, with the van Herk/Gil-Werman
+  algorithm: the image is cut into blocks of the window length L, and
+  the minimum of any window of length L is the minimum of a suffix of
+  one block and a prefix of the next.  This takes a constant number of
+  comparisons per pixel for any region_size.
+
+  The window of pixel i covers i - h .. i + h - 1 (h = region_size / 2);
+  positions outside the image are mirrored at i.  That window is
+  0 .. i + h near the upper (left) border and i - h .. n - 1 near the
+  lower (right) one, so that it is always a prefix or suffix of a block
+  there.  The image is processed in bands of rows, which are divided
+  among the threads.
 */
+namespace BernsenDetail {
+  inline void window(size_t i, size_t h, size_t n, size_t& lo, size_t& hi) {
+    if (i < h) {
+      lo = 0;
+      hi = i + h;
+    } else {
+      lo = i - h;
+      hi = std::min(n - 1, i + h - 1);
+    }
+  }
+
+  template<class P>
+  inline OneBitPixel decide(P pixel, P minimum, P maximum,
+                            size_t contrast_limit, OneBitPixel confused) {
+    P c = maximum - minimum;
+    if (c < contrast_limit)
+      return confused;
+    long t = (maximum + minimum) / 2;
+    return pixel >= t ? OneBitPixel(0) : OneBitPixel(1);
+  }
+
+  /*
+    The window s .. e (of at most L values) is the suffix from s of one
+    block and the prefix up to e of the next.  When it lies within one
+    block, it is the prefix up to e (the block starts at s) or the
+    suffix from s (e is the end of the block or of the values).
+  */
+  enum { BOTH, PREFIX, SUFFIX };
+
+  inline int blocks(size_t s, size_t e, size_t L) {
+    if (s / L != e / L)
+      return BOTH;
+    return s % L == 0 ? PREFIX : SUFFIX;
+  }
+
+  /*
+    Prefix (p) and suffix (s) minima and maxima within the blocks of
+    length L of the n values in.
+  */
+  template<class P>
+  void block_extrema(const P* in, size_t n, size_t L,
+                     P* pmin, P* pmax, P* smin, P* smax) {
+    for (size_t i = 0; i < n; ++i) {
+      P v = in[i];
+      if (i % L == 0) {
+        pmin[i] = pmax[i] = v;
+      } else {
+        pmin[i] = std::min(pmin[i - 1], v);
+        pmax[i] = std::max(pmax[i - 1], v);
+      }
+    }
+    for (size_t i = n; i-- > 0;) {
+      P v = in[i];
+      if (i % L == L - 1 || i == n - 1) {
+        smin[i] = smax[i] = v;
+      } else {
+        smin[i] = std::min(smin[i + 1], v);
+        smax[i] = std::max(smax[i + 1], v);
+      }
+    }
+  }
+
+  /*
+    Thresholds the rows y0 .. y1 - 1 into out[0] .. out[y1 - y0 - 1].
+  */
+  template<class T>
+  void bernsen_band(const T& m, size_t y0, size_t y1, size_t h,
+                    size_t contrast_limit, OneBitPixel confused,
+                    OneBitPixel* const* out) {
+    typedef typename T::value_type P;
+    const size_t ncols = m.ncols(), nrows = m.nrows(), L = 2 * h;
+    size_t r0, r1, lo, hi;
+    window(y0, h, nrows, r0, hi);
+    window(y1 - 1, h, nrows, lo, r1);
+    const size_t n = r1 - r0 + 1;
+
+    // the row extrema of the rows the band needs, as prefixes and
+    // suffixes of column blocks
+    std::vector<P> rmin(n * ncols), rmax(n * ncols);
+    std::vector<P> pmin(ncols), pmax(ncols), smin(ncols), smax(ncols);
+    for (size_t i = 0; i < n; ++i) {
+      block_extrema(m[r0 + i], ncols, L, &pmin[0], &pmax[0],
+                    &smin[0], &smax[0]);
+      P* mn = &rmin[i * ncols];
+      P* mx = &rmax[i * ncols];
+      for (size_t x = 0; x < ncols; ++x) {
+        window(x, h, ncols, lo, hi);
+        switch (blocks(lo, hi, L)) {
+        case PREFIX:
+          mn[x] = pmin[hi];
+          mx[x] = pmax[hi];
+          break;
+        case SUFFIX:
+          mn[x] = smin[lo];
+          mx[x] = smax[lo];
+          break;
+        default:
+          mn[x] = std::min(smin[lo], pmin[hi]);
+          mx[x] = std::max(smax[lo], pmax[hi]);
+        }
+      }
+    }
+
+    // the same along the columns, for whole rows at a time
+    std::vector<P> cpmin(n * ncols), cpmax(n * ncols);
+    std::vector<P> csmin(n * ncols), csmax(n * ncols);
+    for (size_t i = 0; i < n; ++i) {
+      const P* mn = &rmin[i * ncols];
+      const P* mx = &rmax[i * ncols];
+      P* a = &cpmin[i * ncols];
+      P* b = &cpmax[i * ncols];
+      if (i % L == 0) {
+        std::copy(mn, mn + ncols, a);
+        std::copy(mx, mx + ncols, b);
+      } else {
+        const P* pa = a - ncols;
+        const P* pb = b - ncols;
+        for (size_t x = 0; x < ncols; ++x) {
+          a[x] = std::min(pa[x], mn[x]);
+          b[x] = std::max(pb[x], mx[x]);
+        }
+      }
+    }
+    for (size_t i = n; i-- > 0;) {
+      const P* mn = &rmin[i * ncols];
+      const P* mx = &rmax[i * ncols];
+      P* a = &csmin[i * ncols];
+      P* b = &csmax[i * ncols];
+      if (i % L == L - 1 || i == n - 1) {
+        std::copy(mn, mn + ncols, a);
+        std::copy(mx, mx + ncols, b);
+      } else {
+        const P* na = a + ncols;
+        const P* nb = b + ncols;
+        for (size_t x = 0; x < ncols; ++x) {
+          a[x] = std::min(na[x], mn[x]);
+          b[x] = std::max(nb[x], mx[x]);
+        }
+      }
+    }
+
+    for (size_t y = y0; y < y1; ++y) {
+      window(y, h, nrows, lo, hi);
+      const P* sa = &csmin[(lo - r0) * ncols];
+      const P* sb = &csmax[(lo - r0) * ncols];
+      const P* pa = &cpmin[(hi - r0) * ncols];
+      const P* pb = &cpmax[(hi - r0) * ncols];
+      int which = blocks(lo - r0, hi - r0, L);
+      if (which == PREFIX) {
+        sa = pa;
+        sb = pb;
+      } else if (which == SUFFIX) {
+        pa = sa;
+        pb = sb;
+      }
+      const P* in = m[y];
+      OneBitPixel* o = out[y - y0];
+      for (size_t x = 0; x < ncols; ++x)
+        o[x] = decide(in[x], std::min(sa[x], pa[x]), std::max(sb[x], pb[x]),
+                      contrast_limit, confused);
+    }
+  }
+
+  /*
+    Thresholds the bands b0 .. b1 - 1 in parallel; rows[y - first]
+    is the output row y.
+  */
+  template<class T>
+  void bernsen_bands(const T& m, long b0, long b1, size_t band, size_t h,
+                     size_t contrast_limit, OneBitPixel confused,
+                     const std::vector<OneBitPixel*>& rows, size_t first,
+                     int threads) {
+    typedef typename T::value_type P;
+    ThreadException error;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1) if (b1 - b0 > 1)
+#endif
+    for (long b = b0; b < b1; ++b) {
+      size_t y0 = size_t(b) * band, y1 = std::min(m.nrows(), y0 + band);
+      OneBitPixel* const* out = &rows[y0 - first];
+      try {
+        if (h == 0) {
+          // an empty window, whose maximum is below its minimum
+          for (size_t y = y0; y < y1; ++y)
+            for (size_t x = 0; x < m.ncols(); ++x)
+              out[y - y0][x] = decide(m[y][x], std::numeric_limits<P>::max(),
+                                      P(0), contrast_limit, confused);
+        } else {
+          bernsen_band(m, y0, y1, h, contrast_limit, confused, out);
+        }
+      } catch (...) {
+        error.keep();
+      }
+    }
+    error.rethrow();
+  }
+
+  // writes the rows of PACKED and RLE images
+  template<class U>
+  struct RowWriter {
+    U& view;
+    RowWriter(U& v) : view(v) { }
+    void operator()(size_t y, const OneBitPixel* row) {
+      for (size_t x = 0; x < view.ncols(); ++x)
+        view.set(Point(x, y), row[x]);
+    }
+  };
+
+  template<>
+  struct RowWriter<OneBitRleImageView> {
+    RleBuilder<OneBitPixel> builder;
+    size_t ncols;
+    RowWriter(OneBitRleImageView& v) : builder(v), ncols(v.ncols()) { }
+    void operator()(size_t y, const OneBitPixel* row) {
+      for (size_t x = 0; x < ncols; ++x)
+        builder.append(row[x]);
+    }
+  };
+
+  /*
+    Thresholds into an image that can not be written by several threads,
+    through a buffer for one band per thread.
+  */
+  template<class T, class U>
+  void bernsen_buffered(const T& m, U& view, size_t band, size_t h,
+                        size_t contrast_limit, OneBitPixel confused,
+                        int threads) {
+    const size_t ncols = m.ncols(), nrows = m.nrows();
+    const long nbands = long((nrows + band - 1) / band);
+    std::vector<OneBitPixel> buffer(size_t(threads) * band * ncols);
+    std::vector<OneBitPixel*> rows(size_t(threads) * band);
+    for (size_t i = 0; i < rows.size(); ++i)
+      rows[i] = &buffer[i * ncols];
+    RowWriter<U> write(view);
+    for (long b = 0; b < nbands; b += threads) {
+      long b1 = std::min(nbands, b + threads);
+      size_t first = size_t(b) * band;
+      bernsen_bands(m, b, b1, band, h, contrast_limit, confused, rows, first,
+                    threads);
+      for (size_t y = first; y < std::min(nrows, size_t(b1) * band); ++y)
+        write(y, rows[y - first]);
+    }
+  }
+}
 
 template<class T>
-Image* bernsen_threshold(const T &m, int storage_format, size_t region_size, size_t contrast_limit, bool doubt_to_black) {
+Image* bernsen_threshold(const T &m, int storage_format, size_t region_size, size_t contrast_limit, bool doubt_to_black, int threads = 0) {
+  using namespace BernsenDetail;
   if ((contrast_limit < 0) || (contrast_limit > 255))
     throw std::range_error("bernsen_threshold: contrast_limit out of range (0 - 255)");
   if ((region_size < 1) || (region_size > std::min(m.nrows(), m.ncols())))
     throw std::range_error("bernsen_threshold: region_size out of range");
 
-  typedef typename T::value_type pixel_type;
-  int half_region_size = region_size / 2;
+  const size_t h = region_size / 2;
+  OneBitPixel confused = doubt_to_black ? 1 : 0;
+  if (threads <= 0) {
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#else
+    threads = 1;
+#endif
+  }
+  // a band also reads the h rows above and below it
+  const size_t band = std::max(size_t(128), 8 * h);
 
-  typedef TypeIdImageFactory<ONEBIT, DENSE> result_type;
-  typename result_type::image_type* view = result_type::create(m.origin(), m.dim());
-  OneBitPixel confused;
-  if (doubt_to_black)
-    confused = black(*view);
-  else
-    confused = white(*view);
-
-  for (size_t y = 0; y < m.nrows(); ++y)
-    for (size_t x = 0; x < m.ncols(); ++x) {
-      pixel_type minimum = std::numeric_limits<pixel_type>::max();
-      pixel_type maximum = 0;
-      for (int dy = -half_region_size; dy < half_region_size; ++dy) {
-        int use_dy = (y + dy < 0 || y + dy >= m.nrows()) ? -dy : dy;
-        for (int dx = -half_region_size; dx < half_region_size; ++dx) {
-          int use_dx = (x + dx < 0 || x + dx >= m.ncols()) ? -dx : dx;
-          pixel_type pixel = m.get(Point(x + use_dx, y + use_dy));
-          minimum = std::min(minimum, pixel);
-          maximum = std::max(maximum, pixel);
-        }
-      }
-      pixel_type c = maximum - minimum;
-      if (c < contrast_limit)
-        view->set(Point(x, y), confused);
-      else {
-        long t = (maximum + minimum) / 2;
-        if (m.get(Point(x, y)) >= t)
-          view->set(Point(x, y), white(*view));
-        else
-          view->set(Point(x, y), black(*view));
-      }
+  if (storage_format == DENSE) {
+    typedef TypeIdImageFactory<ONEBIT, DENSE> result_type;
+    typename result_type::image_type* view = result_type::create(m.origin(), m.dim());
+    try {
+      std::vector<OneBitPixel*> rows(m.nrows());
+      for (size_t y = 0; y < m.nrows(); ++y)
+        rows[y] = (*view)[y];
+      bernsen_bands(m, 0, long((m.nrows() + band - 1) / band), band, h,
+                    contrast_limit, confused, rows, 0, threads);
+    } catch (std::exception e) {
+      delete view->data();
+      delete view;
+      throw;
+    }
+    return view;
+  } else if (storage_format == PACKED) {
+    typedef TypeIdImageFactory<ONEBIT, PACKED> result_type;
+    typename result_type::image_type* view = result_type::create(m.origin(), m.dim());
+    try {
+      bernsen_buffered(m, *view, band, h, contrast_limit, confused, threads);
+    } catch (std::exception e) {
+      delete view->data();
+      delete view;
+      throw;
     }
-  return view;
+    return view;
+  } else {
+    typedef TypeIdImageFactory<ONEBIT, RLE> result_type;
+    typename result_type::image_type* view = result_type::create(m.origin(), m.dim());
+    try {
+      bernsen_buffered(m, *view, band, h, contrast_limit, confused, threads);
+    } catch (std::exception e) {
+      delete view->data();
+      delete view;
+      throw;
+    }
+    return view;
+  }
 }
 
 /*
@@ -482,70 +832,271 @@ inline bool djvu_converged(const T& fg, const T& bg) {
   return (djvu_distance(fg, bg) < CONVERGE_THRESHOLD);
 }
 
-template<class T, class U>
-void djvu_threshold_recurse(const T image, 
-                            const double smoothness,
-                            const size_t min_block_size,
-                            U& fg_image, U& bg_image,
-                            Rgb<double> fg_init, 
-                            Rgb<double> bg_init, 
-                            const size_t block_size) {
-  typedef typename T::value_type value_type;
+namespace DjvuDetail {
   typedef Rgb<double> promote_t;
 
-  promote_t fg = fg_init;
-  promote_t bg = bg_init;
-  promote_t last_fg, last_bg;
-  bool fg_converged = false, bg_converged = false;
-  promote_t fg_init_scaled = promote_t(fg_init) * smoothness;
-  promote_t bg_init_scaled = promote_t(bg_init) * smoothness;
-  do {
-    last_fg = fg;
-    last_bg = bg;
+  inline int resolve_threads(int threads) {
+    if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+    }
+    return threads;
+  }
+
+  // Colour sums of the pixels closer to the foreground and to the
+  // background colour. The sums are exact (integers in doubles), so
+  // partial sums can be added in any order.
+  struct Sums {
     promote_t fg_avg, bg_avg;
+    size_t fg_count, bg_count;
+    Sums() : fg_count(0), bg_count(0) {}
+    Sums& operator+=(const Sums& other) {
+      fg_avg += other.fg_avg;
+      bg_avg += other.bg_avg;
+      fg_count += other.fg_count;
+      bg_count += other.bg_count;
+      return *this;
+    }
+  };
+
+  // Adds the pixels of image to the sums of the closer colour. This is
+  // djvu_distance spelled out on plain doubles, which keeps the colours
+  // and sums in registers.
+  template<class T>
+  void classify(const T& image, const promote_t& fg, const promote_t& bg,
+                Sums& result) {
+    const double fg_r = fg.red(), fg_g = fg.green(), fg_b = fg.blue();
+    const double bg_r = bg.red(), bg_g = bg.green(), bg_b = bg.blue();
+    double fg_sum_r = 0, fg_sum_g = 0, fg_sum_b = 0;
+    double bg_sum_r = 0, bg_sum_g = 0, bg_sum_b = 0;
     size_t fg_count = 0, bg_count = 0;
     for (typename T::const_vec_iterator i = image.vec_begin();
          i != image.vec_end(); ++i) {
-      double fg_dist = djvu_distance(*i, fg);
-      double bg_dist = djvu_distance(*i, bg);
+      double r = (*i).red(), g = (*i).green(), b = (*i).blue();
+      double dr = r - fg_r, dg = g - fg_g, db = b - fg_b;
+      double fg_dist = 0.75*dr*dr + dg*dg + 0.5*db*db;
+      dr = r - bg_r;
+      dg = g - bg_g;
+      db = b - bg_b;
+      double bg_dist = 0.75*dr*dr + dg*dg + 0.5*db*db;
       if (fg_dist <= bg_dist) {
-        fg_avg += *i;
+        fg_sum_r += r;
+        fg_sum_g += g;
+        fg_sum_b += b;
         ++fg_count;
       } else {
-        bg_avg += *i;
+        bg_sum_r += r;
+        bg_sum_g += g;
+        bg_sum_b += b;
         ++bg_count;
       }
     }
+    result.fg_avg += promote_t(fg_sum_r, fg_sum_g, fg_sum_b);
+    result.bg_avg += promote_t(bg_sum_r, bg_sum_g, bg_sum_b);
+    result.fg_count += fg_count;
+    result.bg_count += bg_count;
+  }
 
-    if (fg_count) {
-      fg = (((fg_avg / fg_count) * (1.0 - smoothness)) + fg_init_scaled);
-      fg_converged = djvu_converged(fg, last_fg);
-    } else {
-      fg_converged = true;
+  // Iterates the foreground and background colours of one block,
+  // starting from (and smoothed towards) the colours of its parent.
+  // With more than one thread, the rows of the block are split among
+  // the threads.
+  template<class T>
+  void block_colors(const T& image, const double smoothness,
+                    promote_t& fg, promote_t& bg, int threads) {
+    promote_t last_fg, last_bg;
+    bool fg_converged = false, bg_converged = false;
+    promote_t fg_init_scaled = fg * smoothness;
+    promote_t bg_init_scaled = bg * smoothness;
+    if ((size_t)threads > image.nrows())
+      threads = (int)image.nrows();
+    std::vector<Sums> parts(threads);
+    do {
+      last_fg = fg;
+      last_bg = bg;
+      Sums sums;
+      if (threads > 1) {
+        std::fill(parts.begin(), parts.end(), Sums());
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+        for (int t = 0; t < threads; ++t) {
+          size_t r0 = image.nrows() * t / threads;
+          size_t r1 = image.nrows() * (t + 1) / threads;
+          if (r0 < r1)
+            classify(T(image, Point(image.ul_x(), image.ul_y() + r0),
+                       Point(image.lr_x(), image.ul_y() + r1 - 1)),
+                     last_fg, last_bg, parts[t]);
+        }
+        for (int t = 0; t < threads; ++t)
+          sums += parts[t];
+      } else {
+        classify(image, last_fg, last_bg, sums);
+      }
+
+      if (sums.fg_count) {
+        fg = (((sums.fg_avg / sums.fg_count) * (1.0 - smoothness)) +
+              fg_init_scaled);
+        fg_converged = djvu_converged(fg, last_fg);
+      } else {
+        fg_converged = true;
+      }
+      if (sums.bg_count) {
+        bg = (((sums.bg_avg / sums.bg_count) * (1.0 - smoothness)) +
+              bg_init_scaled);
+        bg_converged = djvu_converged(bg, last_bg);
+      } else {
+        bg_converged = true;
+      }
+    } while (!(fg_converged && bg_converged));
+  }
+
+  // A channel of the block colours a, b (row iy) and c, d (row iy + 1)
+  // interpolated with the weights w, in the order of operations of
+  // vigra's BilinearInterpolatingAccessor, and rounded as there.
+  inline GreyScalePixel interpolate(const double* w, double a, double b,
+                                    double c, double d) {
+    return NumericTraits<GreyScalePixel>::fromRealPromote
+      (w[0] * a + w[1] * b + w[2] * c + w[3] * d);
+  }
+
+  /*
+    Thresholds the rows [r0, r1) against the block colours, interpolated
+    as with a BilinearInterpolatingAccessor at (c / min_block_size,
+    r / min_block_size).  The accessor's special cases for dx == 0 or
+    dy == 0 give the same values as the general case (the other weights
+    are zero), so the general case is used throughout, and the block
+    columns and weights of the pixels are computed once per row rather
+    than for each of the two colours.  The rows are read and written
+    through plain pointers.
+  */
+  template<class T, class R>
+  void threshold_rows(const T& image, const RGBImageView& fg_image,
+                      const RGBImageView& bg_image, R& result,
+                      const size_t min_block_size,
+                      const size_t r0, const size_t r1) {
+    const size_t ncols = image.ncols();
+    std::vector<int> ix(ncols);
+    std::vector<float> dx(ncols);
+    for (size_t c = 0; c < ncols; ++c) {
+      float x = (float)((double)c / min_block_size);
+      ix[c] = int(x);
+      dx[c] = x - ix[c];
     }
-    if (bg_count) {
-      bg = (((bg_avg / bg_count) * (1.0 - smoothness)) + bg_init_scaled);
-      bg_converged = djvu_converged(bg, last_bg);
+    std::vector<double> weights(4 * ncols);
+    const typename R::value_type black_value = black(result);
+    const typename R::value_type white_value = white(result);
+    for (size_t r = r0; r < r1; ++r) {
+      float y = (float)((double)r / min_block_size);
+      int iy = int(y);
+      float dy = y - iy;
+      for (size_t c = 0; c < ncols; ++c) {
+        double* w = &weights[4 * c];
+        w[0] = (1.0 - dx[c]) * (1.0 - dy);
+        w[1] = dx[c] * (1.0 - dy);
+        w[2] = (1.0 - dx[c]) * dy;
+        w[3] = dx[c] * dy;
+      }
+      const RGBPixel* fg0 = fg_image[iy];
+      const RGBPixel* fg1 = fg_image[iy + 1];
+      const RGBPixel* bg0 = bg_image[iy];
+      const RGBPixel* bg1 = bg_image[iy + 1];
+      const typename T::value_type* in_row = image[r];
+      typename R::value_type* out_row = result[r];
+      for (size_t c = 0; c < ncols; ++c) {
+        const double* w = &weights[4 * c];
+        const int i = ix[c];
+        RGBPixel fg(interpolate(w, fg0[i].red(), fg0[i + 1].red(),
+                                fg1[i].red(), fg1[i + 1].red()),
+                    interpolate(w, fg0[i].green(), fg0[i + 1].green(),
+                                fg1[i].green(), fg1[i + 1].green()),
+                    interpolate(w, fg0[i].blue(), fg0[i + 1].blue(),
+                                fg1[i].blue(), fg1[i + 1].blue()));
+        RGBPixel bg(interpolate(w, bg0[i].red(), bg0[i + 1].red(),
+                                bg1[i].red(), bg1[i + 1].red()),
+                    interpolate(w, bg0[i].green(), bg0[i + 1].green(),
+                                bg1[i].green(), bg1[i + 1].green()),
+                    interpolate(w, bg0[i].blue(), bg0[i + 1].blue(),
+                                bg1[i].blue(), bg1[i + 1].blue()));
+        double fg_dist = djvu_distance(in_row[c], fg);
+        double bg_dist = djvu_distance(in_row[c], bg);
+        out_row[c] = (fg_dist <= bg_dist) ? black_value : white_value;
+      }
+    }
+  }
+
+  // A block of the quad-tree, with the colours of its parent
+  struct Block {
+    Point ul, lr;
+    promote_t fg, bg;
+    Block(const Point& ul_, const Point& lr_,
+          const promote_t& fg_, const promote_t& bg_)
+      : ul(ul_), lr(lr_), fg(fg_), bg(bg_) {}
+  };
+}
+
+/*
+  The block hierarchy is processed level by level. The blocks of one
+  level only depend on the colours of their parents, so they are
+  computed in parallel; while a level has fewer blocks than threads
+  (near the root), the rows of each block are split among the threads
+  instead.
+*/
+template<class T, class U>
+void djvu_threshold_levels(const T& image,
+                           const double smoothness,
+                           const size_t min_block_size,
+                           U& fg_image, U& bg_image,
+                           Rgb<double> fg_init,
+                           Rgb<double> bg_init,
+                           size_t block_size, int threads) {
+  using namespace DjvuDetail;
+  std::vector<Block> blocks;
+  blocks.push_back(Block(image.ul(), image.lr(), fg_init, bg_init));
+  while (!blocks.empty()) {
+    const long n = (long)blocks.size();
+    if (n >= threads) {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic)
+#endif
+      for (long i = 0; i < n; ++i)
+        block_colors(T(image, blocks[i].ul, blocks[i].lr), smoothness,
+                     blocks[i].fg, blocks[i].bg, 1);
     } else {
-      bg_converged = true;
+      for (long i = 0; i < n; ++i)
+        block_colors(T(image, blocks[i].ul, blocks[i].lr), smoothness,
+                     blocks[i].fg, blocks[i].bg, threads);
     }
-  } while (!(fg_converged && bg_converged));
 
-  if (block_size < min_block_size) {
-    fg_image.set(Point(image.ul_x() / min_block_size,
-                       image.ul_y() / min_block_size), fg);
-    bg_image.set(Point(image.ul_x() / min_block_size,
-                       image.ul_y() / min_block_size), bg);
-  } else {
-    for (size_t r = 0; r <= (image.nrows() - 1) / block_size; ++r) {
-      for (size_t c = 0; c <= (image.ncols() - 1) / block_size; ++c) {
-        Point ul(c * block_size + image.ul_x(), r * block_size + image.ul_y());
-        Point lr(std::min((c + 1) * block_size + image.ul_x(), image.lr_x()),
-                 std::min((r + 1) * block_size + image.ul_y(), image.lr_y()));
-        djvu_threshold_recurse(T(image, ul, lr), smoothness, min_block_size, 
-                               fg_image, bg_image, fg, bg, block_size / 2);
+    if (block_size < min_block_size) {
+      for (long i = 0; i < n; ++i) {
+        Point p(blocks[i].ul.x() / min_block_size,
+                blocks[i].ul.y() / min_block_size);
+        fg_image.set(p, blocks[i].fg);
+        bg_image.set(p, blocks[i].bg);
+      }
+      break;
+    }
+
+    std::vector<Block> children;
+    for (long i = 0; i < n; ++i) {
+      const Block& b = blocks[i];
+      size_t nrows = b.lr.y() - b.ul.y() + 1;
+      size_t ncols = b.lr.x() - b.ul.x() + 1;
+      for (size_t r = 0; r <= (nrows - 1) / block_size; ++r) {
+        for (size_t c = 0; c <= (ncols - 1) / block_size; ++c) {
+          Point ul(c * block_size + b.ul.x(), r * block_size + b.ul.y());
+          Point lr(std::min((c + 1) * block_size + b.ul.x(), b.lr.x()),
+                   std::min((r + 1) * block_size + b.ul.y(), b.lr.y()));
+          children.push_back(Block(ul, lr, b.fg, b.bg));
+        }
       }
     }
+    blocks.swap(children);
+    block_size /= 2;
   }
 }
 
@@ -554,72 +1105,105 @@ Image *djvu_threshold(const T& image, const double smoothness,
                       const size_t max_block_size, const size_t min_block_size,
                       const size_t block_factor,
                       const typename T::value_type init_fg, 
-                      const typename T::value_type init_bg) {
+                      const typename T::value_type init_bg,
+                      int threads = 0) {
+  threads = DjvuDetail::resolve_threads(threads);
+
   // Create some temporary images to store the foreground and 
-  // background colors for each block
+  // background colors for each block. The interpolation below reads
+  // up to two blocks beyond the last full one.
 
-  RGBImageData fg_data(Dim(image.ncols() / min_block_size + 1,
-                           image.nrows() / min_block_size + 1),
-                       Point(0, 0));
+  Dim block_dim(image.ncols() / min_block_size + 2,
+                image.nrows() / min_block_size + 2);
+  RGBImageData fg_data(block_dim, Point(0, 0));
   RGBImageView fg_image(fg_data);
 
-  RGBImageData bg_data(Dim(image.ncols() / min_block_size + 1,
-                           image.nrows() / min_block_size + 1),
-                       Point(0, 0));
+  RGBImageData bg_data(block_dim, Point(0, 0));
   RGBImageView bg_image(bg_data);
 
-  djvu_threshold_recurse(image, smoothness, min_block_size, 
-                         fg_image, bg_image,
-                         init_fg, init_bg, max_block_size);
+  djvu_threshold_levels(image, smoothness, min_block_size, 
+                        fg_image, bg_image,
+                        init_fg, init_bg, max_block_size, threads);
 
   typedef TypeIdImageFactory<ONEBIT, DENSE> result_type;
   typename result_type::image_type* result = result_type::create
     (image.origin(), image.dim());
   
-  typename choose_accessor<T>::interp_accessor fg_acc = 
-    choose_accessor<T>::make_interp_accessor(fg_image);
-  typename choose_accessor<T>::interp_accessor bg_acc = 
-    choose_accessor<T>::make_interp_accessor(bg_image);
-
-  for (size_t r = 0; r < image.nrows(); ++r) {
-    for (size_t c = 0; c < image.ncols(); ++c) {
-      double c_frac = (double)c / min_block_size;
-      double r_frac = (double)r / min_block_size;
-      RGBPixel fg = fg_acc(fg_image.upperLeft(), c_frac, r_frac); 
-      RGBPixel bg = bg_acc(bg_image.upperLeft(), c_frac, r_frac);
-      double fg_dist = djvu_distance(image.get(Point(c, r)), fg);
-      double bg_dist = djvu_distance(image.get(Point(c, r)), bg);
-      if (fg_dist <= bg_dist)
-        result->set(Point(c, r), black(*result));
-      else
-        result->set(Point(c, r), white(*result));
-    }
-  }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#endif
+  for (int t = 0; t < threads; ++t)
+    DjvuDetail::threshold_rows(image, fg_image, bg_image,
+                               *result, min_block_size,
+                               image.nrows() * t / threads,
+                               image.nrows() * (t + 1) / threads);
 
   return result;
 }
 
 Image *djvu_threshold(const RGBImageView& image, double smoothness = 0.2, 
                       int max_block_size = 512, int min_block_size = 16, 
-                      int block_factor = 2) {
+                      int block_factor = 2, int threads = 0) {
+  threads = DjvuDetail::resolve_threads(threads);
   // We do an approximate histrogram here, using 6 bits per pixel
   // plane.  That greatly reduces the amount of memory required.
+  // Each thread counts its rows in its own histogram, and the
+  // histograms are added up afterwards.
   RGBPixel max_color;
   {
+    const size_t nbins = 64 * 64 * 64;
+    int hthreads = std::max(1, std::min(threads, (int)(image.nrows() / 64)));
+    std::vector<std::vector<size_t> > histograms(hthreads);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(hthreads) schedule(static)
+#endif
+    for (int t = 0; t < hthreads; ++t) {
+      std::vector<size_t>& histogram = histograms[t];
+      histogram.assign(nbins, 0);
+      size_t r0 = image.nrows() * t / hthreads;
+      size_t r1 = image.nrows() * (t + 1) / hthreads;
+      const RGBImageView rows(image,
+                              Point(image.ul_x(), image.ul_y() + r0),
+                              Point(image.lr_x(), image.ul_y() + r1 - 1));
+      for (RGBImageView::const_vec_iterator i = rows.vec_begin();
+           i != rows.vec_end(); ++i) {
+        ++histogram[((size_t)((*i).red() & 0xfc) << 10) |
+                    ((size_t)((*i).green() & 0xfc) << 4) |
+                    ((size_t)((*i).blue() & 0xfc) >> 2)];
+      }
+    }
+    std::vector<size_t>& histogram = histograms[0];
     size_t max_count = 0;
-    std::vector<size_t> histogram(64 * 64 * 64, 0);
-    for (RGBImageView::const_vec_iterator i = image.vec_begin();
-         i != image.vec_end(); ++i) {
-      size_t approx_color = (((size_t)((*i).red() & 0xfc) << 10) |
-                             ((size_t)((*i).green() & 0xfc) << 4) |
-                             ((size_t)((*i).blue() & 0xfc) >> 2));
-      size_t x = histogram[approx_color]++;
-      if (x > max_count) {
-        max_count = x;
-        max_color = RGBPixel((*i).red() & 0xfc,
-                             (*i).green() & 0xfc,
-                             (*i).blue() & 0xfc);
+    for (size_t k = 0; k < nbins; ++k) {
+      for (int t = 1; t < hthreads; ++t)
+        histogram[k] += histograms[t][k];
+      max_count = std::max(max_count, histogram[k]);
+    }
+
+    // As with a single running maximum, the colour that first reaches
+    // the maximum count wins (and none when no colour occurs twice).
+    if (max_count > 1) {
+      std::vector<size_t> candidates;
+      for (size_t k = 0; k < nbins; ++k)
+        if (histogram[k] == max_count)
+          candidates.push_back(k);
+      size_t best = candidates[0];
+      if (candidates.size() > 1) {
+        std::vector<size_t> counts(nbins, 0);
+        for (RGBImageView::const_vec_iterator i = image.vec_begin();
+             i != image.vec_end(); ++i) {
+          size_t approx_color = (((size_t)((*i).red() & 0xfc) << 10) |
+                                 ((size_t)((*i).green() & 0xfc) << 4) |
+                                 ((size_t)((*i).blue() & 0xfc) >> 2));
+          if (++counts[approx_color] == max_count &&
+              histogram[approx_color] == max_count) {
+            best = approx_color;
+            break;
+          }
+        }
       }
+      max_color = RGBPixel((best >> 10) & 0xfc, (best >> 4) & 0xfc,
+                           (best << 2) & 0xfc);
     }
   }
 
@@ -627,7 +1211,7 @@ Image *djvu_threshold(const RGBImageView& image, double smoothness = 0.2,
     max_color = RGBPixel(255, 255, 255);
 
   return djvu_threshold(image, smoothness, max_block_size, min_block_size, 
-                        block_factor, RGBPixel(0, 0, 0), max_color);
+                        block_factor, RGBPixel(0, 0, 0), max_color, threads);
 }
 
 #endif
@@ -22,44 +22,137 @@
 #define kwm10222002_tiff_support
 
 #include "gamera.hpp"
+#include "thread_exception.hpp"
+#include "binarization.hpp"
+#include "morphology.hpp"
+#include "rle_utilities.hpp"
 #include <tiffio.h>
 #include <string>
 #include <exception>
 #include <stdexcept>
 #include <bitset>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <list>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace Gamera {
 
 // forward declarations
-ImageInfo* tiff_info(const char* filename);
+ImageInfo* tiff_info(const char* filename, int page = 0);
+int tiff_page_count(const char* filename);
 Image* load_tiff(const char* filename, int compressed);
+Image* load_tiff_page(const char* filename, int page, int storage);
+Image* load_tiff_from_bytes(PyObject* data, int storage);
+std::list<Image*>* load_tiff_pages(const char* filename, int first, int count,
+                                   int storage, int threads);
+Image* load_tiff_region(const char* filename, Rect* rect, int storage);
 template<class T>
-void save_tiff(const T& matrix, const char* filename);
-
-/*
-  Get information about tiff images
+void save_tiff(const T& matrix, const char* filename, int compression);
+template<class T>
+PyObject* save_tiff_to_bytes(const T& matrix, int compression);
+void stream_binarize_tiff(const char* filename, const char* out_filename,
+                          int region_size, double sensitivity,
+                          int dynamic_range, int lower_bound, int upper_bound,
+                          int despeckle_size, int band_height);
+Image* map_tiff(const char* filename);
+Image* map_raw(const char* filename, int pixel_type, int ncols, int nrows,
+               int offset);
 
-  This function gets informtion about tiff images and places it in and
-  ImageInfo object.  See image_info.hpp for more information.
-*/
-ImageInfo* tiff_info(const char* filename) {
-  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
-  TIFF* tif = 0;
-  tif = TIFFOpen(filename, "r");
-  if (tif == 0) {
-    TIFFSetErrorHandler(saved_handler);
-    throw std::invalid_argument("Failed to open image header");
+namespace {
+  /*
+    Opens a TIFF file at the given page (directory).  Returns 0 if the
+    file cannot be opened or has no such page.
+  */
+  TIFF* tiff_open(const char* filename, int page) {
+    TIFF* tif = TIFFOpen(filename, "r");
+    if (tif != 0 && page != 0 && !TIFFSetDirectory(tif, (tdir_t)page)) {
+      TIFFClose(tif);
+      return 0;
+    }
+    return tif;
   }
-  // Create this later so it isn't leaked if filename does
-  // not exist or is not a TIFF file.
-  ImageInfo* info = new ImageInfo();
 
   /*
-    The tiff library seems very sensitive to type yet provides only a
-    stupid non-type-checked interface.  The following seems to work well
-    (notice that resolution is floating point).  KWM 6/6/01
-   */
-  try {
+    A TIFF file in memory, read and written by libtiff through the
+    procedures below (see TIFFClientOpen).
+  */
+  struct tiff_memory_file {
+    std::vector<char> data;
+    size_t pos;
+  };
+
+  tsize_t tiff_memory_read(thandle_t handle, tdata_t buf, tsize_t size) {
+    tiff_memory_file* file = (tiff_memory_file*)handle;
+    size_t n = 0;
+    if (file->pos < file->data.size())
+      n = std::min((size_t)size, file->data.size() - file->pos);
+    if (n > 0)
+      memcpy(buf, &file->data[file->pos], n);
+    file->pos += n;
+    return (tsize_t)n;
+  }
+
+  tsize_t tiff_memory_write(thandle_t handle, tdata_t buf, tsize_t size) {
+    tiff_memory_file* file = (tiff_memory_file*)handle;
+    if (file->pos + size > file->data.size())
+      file->data.resize(file->pos + size);
+    if (size > 0)
+      memcpy(&file->data[file->pos], buf, size);
+    file->pos += size;
+    return size;
+  }
+
+  toff_t tiff_memory_seek(thandle_t handle, toff_t offset, int whence) {
+    tiff_memory_file* file = (tiff_memory_file*)handle;
+    if (whence == SEEK_CUR)
+      file->pos += offset;
+    else if (whence == SEEK_END)
+      file->pos = file->data.size() + offset;
+    else
+      file->pos = offset;
+    return (toff_t)file->pos;
+  }
+
+  int tiff_memory_close(thandle_t) {
+    return 0;
+  }
+
+  toff_t tiff_memory_size(thandle_t handle) {
+    return (toff_t)((tiff_memory_file*)handle)->data.size();
+  }
+
+  int tiff_memory_map(thandle_t, tdata_t*, toff_t*) {
+    return 0;
+  }
+
+  void tiff_memory_unmap(thandle_t, tdata_t, toff_t) {
+  }
+
+  TIFF* tiff_memory_open(tiff_memory_file& file, const char* mode) {
+    file.pos = 0;
+    return TIFFClientOpen("memory", mode, (thandle_t)&file,
+                          tiff_memory_read, tiff_memory_write,
+                          tiff_memory_seek, tiff_memory_close,
+                          tiff_memory_size, tiff_memory_map,
+                          tiff_memory_unmap);
+  }
+}
+
+namespace {
+  ImageInfo* tiff_read_info(TIFF* tif) {
+    ImageInfo* info = new ImageInfo();
+
+    /*
+      The tiff library seems very sensitive to type yet provides only a
+      stupid non-type-checked interface.  The following seems to work well
+      (notice that resolution is floating point).  KWM 6/6/01
+    */
     unsigned short tmp;
     uint32 size;
     TIFFGetFieldDefaulted(tif, TIFFTAG_IMAGEWIDTH, &size);
@@ -77,21 +170,34 @@ ImageInfo* tiff_info(const char* filename) {
     info->ncolors((size_t)tmp);
     TIFFGetFieldDefaulted(tif, TIFFTAG_PHOTOMETRIC, &tmp);
     info->inverted(tmp == PHOTOMETRIC_MINISWHITE);
-    
-    TIFFClose(tif);
-  } catch (std::exception e) {
+    return info;
+  }
+}
+
+/*
+  Get information about tiff images
+
+  This function gets informtion about tiff images and places it in and
+  ImageInfo object.  See image_info.hpp for more information.  Multi-page
+  files hold one image per page; page selects one of them.
+*/
+ImageInfo* tiff_info(const char* filename, int page) {
+  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
+  TIFF* tif = 0;
+  tif = tiff_open(filename, page);
+  if (tif == 0) {
     TIFFSetErrorHandler(saved_handler);
-    delete info;
+    throw std::invalid_argument("Failed to open image header");
   }
+  ImageInfo* info = tiff_read_info(tif);
+  TIFFClose(tif);
   TIFFSetErrorHandler(saved_handler);
   return info;
 }
 namespace {
 
   template<class T>
-  void tiff_load_onebit(T& matrix, ImageInfo& info, const char* filename) {
-    // open the image
-    TIFF* tif = TIFFOpen(filename, "r");
+  void tiff_load_onebit(T& matrix, ImageInfo& info, TIFF* tif) {
     tdata_t buf = _TIFFmalloc(TIFFScanlineSize(tif));
     
     // load the data
@@ -116,13 +222,45 @@ namespace {
     }
     // do the cleanup
     _TIFFfree(buf);
-    TIFFClose(tif);
+  }
+
+  /*
+    OneBit RLE images get their runs straight from the scanlines (as
+    decoded from Group 4 files, for example), instead of setting, and
+    searching the run lists for, every pixel.
+  */
+  void tiff_load_onebit(OneBitRleImageView& matrix, ImageInfo& info, TIFF* tif) {
+    tdata_t buf = _TIFFmalloc(TIFFScanlineSize(tif));
+    if (!buf)
+      throw std::runtime_error("Error allocating scanline");
+    RleBuilder<OneBitPixel> builder(matrix);
+    size_t ncols = info.ncols();
+    for (size_t i = 0; i < info.nrows(); i++) {
+      if (TIFFReadScanline(tif, buf, i) < 0) {
+        _TIFFfree(buf);
+        throw std::runtime_error("Error reading scanline");
+      }
+      const unsigned char* bits = (const unsigned char*)buf;
+      size_t j = 0;
+      while (j < ncols) {
+        // white pixels, skipping whole bytes where possible
+        size_t start = j;
+        while (j < ncols && !(bits[j >> 3] & (0x80 >> (j & 7))))
+          j += ((j & 7) == 0 && bits[j >> 3] == 0x00) ? 8 : 1;
+        j = std::min(j, ncols);
+        builder.append(pixel_traits<OneBitPixel>::white(), j - start);
+        start = j;
+        while (j < ncols && (bits[j >> 3] & (0x80 >> (j & 7))))
+          j += ((j & 7) == 0 && bits[j >> 3] == 0xff) ? 8 : 1;
+        j = std::min(j, ncols);
+        builder.append(pixel_traits<OneBitPixel>::black(), j - start);
+      }
+    }
+    _TIFFfree(buf);
   }
 
   template<class T>
-  void tiff_load_greyscale(T& matrix, ImageInfo& info, const char* filename) {
-    // open the image
-    TIFF* tif = TIFFOpen(filename, "r");
+  void tiff_load_greyscale(T& matrix, ImageInfo& info, TIFF* tif) {
     tdata_t buf = _TIFFmalloc(TIFFScanlineSize(tif));
     
     typename T::row_iterator mi = matrix.row_begin();
@@ -150,13 +288,19 @@ namespace {
     
     // do the cleanup
     _TIFFfree(buf);
-    TIFFClose(tif);
   }
 
   template<class T>
-  void tiff_load_grey16(T& matrix, ImageInfo& info, const char* filename) {
-    // open the image
-    TIFF* tif = TIFFOpen(filename, "r");
+  void tiff_load_grey16(T& matrix, ImageInfo& info, TIFF* tif) {
+#ifdef GAMERA_GREY16_NATIVE
+    // the scanlines have the layout of the rows of the image
+    if ((size_t)TIFFScanlineSize(tif) == info.ncols() * sizeof(Grey16Pixel)) {
+      typename T::row_iterator mi = matrix.row_begin();
+      for (size_t i = 0; i < info.nrows(); i++, mi++)
+        TIFFReadScanline(tif, (tdata_t)(&(*mi)), i);
+      return;
+    }
+#endif
     tdata_t buf = _TIFFmalloc(TIFFScanlineSize(tif));
     
     typename T::row_iterator mi = matrix.row_begin();
@@ -173,13 +317,10 @@ namespace {
     
     // do the cleanup
     _TIFFfree(buf);
-    TIFFClose(tif);
   }
 
   template<class T>
-  void tiff_load_rgb(T& matrix, ImageInfo& info, const char* filename) {
-    // open the image
-    TIFF* tif = TIFFOpen(filename, "r");
+  void tiff_load_rgb(T& matrix, ImageInfo& info, TIFF* tif) {
     tdata_t buf = _TIFFmalloc(TIFFScanlineSize(tif));
     
     typename T::row_iterator mi = matrix.row_begin();
@@ -197,7 +338,6 @@ namespace {
     }
     // do the cleanup
     _TIFFfree(buf);
-    TIFFClose(tif);
   }
 
     template<class Pixel>
@@ -213,47 +353,59 @@ namespace {
     return (*((char*)(&numberone)));
   }
 
+  // packs a row of ncols OneBit pixels into the 32 bit words of a scanline
+  template<class Iterator>
+  void tiff_pack_onebit_row(Iterator it, size_t ncols, uint32* data,
+                            bool little_endian) {
+    std::bitset<32> bits;
+    size_t bit_index = 0;
+    int k = 31;
+    for (size_t j = 0; j < ncols; k--) {
+      if (k < 0) {
+        data[bit_index] = bits.to_ulong();
+        if (little_endian)
+          byte_swap32((unsigned char *)&data[bit_index]);
+        bit_index++;
+        k = 32;
+        continue;
+      }
+      if (is_black(*it))
+        bits[k] = 1;
+      else
+        bits[k] = 0;
+      j++;
+      it++;
+    }
+    // The last 32 pixels need to be saved, even if they are not full
+    if (k != 31) {
+      data[bit_index] = bits.to_ulong();
+      if (little_endian)
+        byte_swap32((unsigned char *)&data[bit_index]);
+    }
+  }
+
+  // the scanline buffer for OneBit rows, rounded up to 32 bit words
+  tdata_t tiff_onebit_scanline(TIFF* tif) {
+    tsize_t scanline_size = TIFFScanlineSize(tif);
+    if (scanline_size % 4) // round up to multiple of 4
+      scanline_size += 4 - (scanline_size % 4);
+    tdata_t buf = _TIFFmalloc(scanline_size);
+    if (!buf)
+      throw std::runtime_error("Error allocating scanline");
+    return buf;
+  }
+
   template<>
   struct tiff_saver<OneBitPixel> {
     template<class T>
     void operator()(const T& matrix, TIFF* tif) {
-      TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-      tsize_t scanline_size = TIFFScanlineSize(tif);
-      if (scanline_size % 4) // round up to multiple of 4
-        scanline_size += 4 - (scanline_size % 4);
-      tdata_t buf = _TIFFmalloc(scanline_size);
-      if (!buf)
-        throw std::runtime_error("Error allocating scanline");
       TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISWHITE);
-      std::bitset<32> bits;
-      uint32* data = (uint32 *)buf;
+      tdata_t buf = tiff_onebit_scanline(tif);
       bool little_endian = byte_order_little_endian();
-      typename T::const_vec_iterator it = matrix.vec_begin();
-      for (size_t i = 0; i < matrix.nrows(); i++) {
-        size_t bit_index = 0;
-        int k = 31;
-        for (size_t j = 0; j < matrix.ncols(); k--) {
-          if (k < 0) {
-            data[bit_index] = bits.to_ulong();
-            if (little_endian)
-              byte_swap32((unsigned char *)&data[bit_index]);
-            bit_index++;
-            k = 32;
-            continue;
-          }
-          if (is_black(*it))
-            bits[k] = 1;
-          else
-            bits[k] = 0;
-          j++;
-          it++;
-        }
-        // The last 32 pixels need to be saved, even if they are not full
-        if (k != 31) {
-          data[bit_index] = bits.to_ulong();
-          if (little_endian)
-            byte_swap32((unsigned char *)&data[bit_index]);
-        }
+      typename T::const_row_iterator row = matrix.row_begin();
+      for (size_t i = 0; i < matrix.nrows(); i++, row++) {
+        tiff_pack_onebit_row(row.begin(), matrix.ncols(), (uint32 *)buf,
+                             little_endian);
         TIFFWriteScanline(tif, buf, i);
       }
       _TIFFfree(buf);
@@ -324,92 +476,729 @@ namespace {
       _TIFFfree(buf);
     }
   };
+
+  /*
+    Reads the rows of a greyscale, grey16 or RGB TIFF file in order and
+    converts them to greyscale as to_greyscale does.  Grey16 images are
+    scaled by their maximum, which is found in a first pass over the
+    file.
+  */
+  class tiff_greyscale_rows {
+  public:
+    tiff_greyscale_rows(const char* filename, ImageInfo& info)
+      : m_filename(filename), m_info(info), m_tif(0), m_buf(0), m_scale(0.0) {
+      if (info.ncolors() == 3) {
+        if (info.depth() != 8)
+          throw std::runtime_error("Unable to load image of this type!");
+      } else if (info.ncolors() != 1 || (info.depth() != 8 && info.depth() != 16)) {
+        throw std::runtime_error("Image must be GreyScale, Grey16 or RGB.");
+      }
+      open();
+      if (info.ncolors() == 1 && info.depth() == 16) {
+        Grey16Pixel max = 0;
+        for (size_t i = 0; i < m_info.nrows(); i++) {
+          unsigned short* data = read_scanline<unsigned short>(i);
+          for (size_t j = 0; j < m_info.ncols(); j++)
+            max = std::max(max, (Grey16Pixel)data[j]);
+        }
+        if (max > 0)
+          m_scale = 255.0 / max;
+        close();
+        open();
+      }
+    }
+
+    ~tiff_greyscale_rows() {
+      close();
+    }
+
+    template<class Iterator>
+    void read(size_t row, Iterator out) {
+      if (m_info.ncolors() == 3) {
+        unsigned char* data = read_scanline<unsigned char>(row);
+        for (size_t j = 0; j < m_info.ncols() * 3; j += 3, out++)
+          *out = RGBPixel(data[j], data[j + 1], data[j + 2]).luminance();
+      } else if (m_info.depth() == 16) {
+        unsigned short* data = read_scanline<unsigned short>(row);
+        for (size_t j = 0; j < m_info.ncols(); j++, out++)
+          *out = GreyScalePixel(data[j] * m_scale);
+      } else {
+        unsigned char* data = read_scanline<unsigned char>(row);
+        for (size_t j = 0; j < m_info.ncols(); j++, out++)
+          *out = m_info.inverted() ? 255 - data[j] : data[j];
+      }
+    }
+
+  private:
+    void open() {
+      m_tif = TIFFOpen(m_filename, "r");
+      if (m_tif == 0)
+        throw std::invalid_argument("Failed to open image");
+      m_buf = _TIFFmalloc(TIFFScanlineSize(m_tif));
+      if (!m_buf)
+        throw std::runtime_error("Error allocating scanline");
+    }
+
+    void close() {
+      if (m_buf)
+        _TIFFfree(m_buf);
+      if (m_tif)
+        TIFFClose(m_tif);
+      m_buf = 0;
+      m_tif = 0;
+    }
+
+    template<class Pointer>
+    Pointer* read_scanline(size_t row) {
+      if (TIFFReadScanline(m_tif, m_buf, row) < 0)
+        throw std::runtime_error("Error reading scanline");
+      return (Pointer*)m_buf;
+    }
+
+    const char* m_filename;
+    ImageInfo& m_info;
+    TIFF* m_tif;
+    tdata_t m_buf;
+    double m_scale;
+  };
+
+  /*
+    Pixel x of a decoded row of a strip or tile.
+  */
+  template<class Pixel>
+  struct tiff_pixel_reader {
+  };
+
+  template<>
+  struct tiff_pixel_reader<OneBitPixel> {
+    OneBitPixel operator()(const unsigned char* row, size_t x, bool) const {
+      if ((row[x >> 3] >> (7 - (x & 7))) & 1)
+        return pixel_traits<OneBitPixel>::black();
+      return pixel_traits<OneBitPixel>::white();
+    }
+  };
+
+  template<>
+  struct tiff_pixel_reader<GreyScalePixel> {
+    GreyScalePixel operator()(const unsigned char* row, size_t x,
+                              bool inverted) const {
+      return inverted ? 255 - row[x] : row[x];
+    }
+  };
+
+  template<>
+  struct tiff_pixel_reader<Grey16Pixel> {
+    Grey16Pixel operator()(const unsigned char* row, size_t x, bool) const {
+      return ((const unsigned short*)row)[x];
+    }
+  };
+
+  template<>
+  struct tiff_pixel_reader<RGBPixel> {
+    RGBPixel operator()(const unsigned char* row, size_t x, bool) const {
+      return RGBPixel(row[3 * x], row[3 * x + 1], row[3 * x + 2]);
+    }
+  };
+
+  /*
+    Loads the part of a TIFF image within rect into matrix, decoding only
+    the strips or tiles that overlap it.
+  */
+  template<class T>
+  void tiff_load_region(T& matrix, ImageInfo& info, const char* filename,
+                        const Rect& rect) {
+    TIFF* tif = TIFFOpen(filename, "r");
+    if (tif == 0)
+      throw std::invalid_argument("Failed to open image");
+    tiff_pixel_reader<typename T::value_type> reader;
+    bool inverted = info.inverted();
+    size_t x0 = rect.ul_x(), x1 = rect.lr_x() + 1;
+    size_t y0 = rect.ul_y(), y1 = rect.lr_y() + 1;
+    // the size of the blocks (strips are blocks of full rows)
+    uint32 block_width, block_height;
+    tsize_t block_size, row_size;
+    bool tiled = TIFFIsTiled(tif);
+    if (tiled) {
+      TIFFGetField(tif, TIFFTAG_TILEWIDTH, &block_width);
+      TIFFGetField(tif, TIFFTAG_TILELENGTH, &block_height);
+      block_size = TIFFTileSize(tif);
+      row_size = TIFFTileRowSize(tif);
+    } else {
+      block_width = (uint32)info.ncols();
+      TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &block_height);
+      block_height = std::min(block_height, (uint32)info.nrows());
+      block_size = TIFFStripSize(tif);
+      row_size = TIFFScanlineSize(tif);
+    }
+    tdata_t buf = _TIFFmalloc(block_size);
+    if (!buf) {
+      TIFFClose(tif);
+      throw std::runtime_error("Error allocating strip");
+    }
+
+    for (size_t by = y0 - y0 % block_height; by < y1; by += block_height) {
+      for (size_t bx = x0 - x0 % block_width; bx < x1; bx += block_width) {
+        tsize_t read;
+        if (tiled)
+          read = TIFFReadEncodedTile(tif, TIFFComputeTile(tif, bx, by, 0, 0),
+                                     buf, block_size);
+        else
+          read = TIFFReadEncodedStrip(tif, TIFFComputeStrip(tif, by, 0),
+                                      buf, block_size);
+        if (read < 0) {
+          _TIFFfree(buf);
+          TIFFClose(tif);
+          throw std::runtime_error("Error reading image");
+        }
+        size_t ya = std::max(by, y0), yb = std::min(by + block_height, y1);
+        size_t xa = std::max(bx, x0), xb = std::min(bx + block_width, x1);
+        for (size_t y = ya; y < yb; ++y) {
+          const unsigned char* row = (const unsigned char*)buf
+            + (y - by) * row_size;
+          for (size_t x = xa; x < xb; ++x)
+            matrix.set(Point(x - x0, y - y0), reader(row, x - bx, inverted));
+        }
+      }
+    }
+    _TIFFfree(buf);
+    TIFFClose(tif);
+  }
 }
 
-Image* load_tiff(const char* filename, int storage) {
-  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
-  ImageInfo* info = tiff_info(filename);
-  if (info->ncolors() == 1) {
-    if (info->depth() == 1) {
-      if (storage == DENSE) {
-        typedef TypeIdImageFactory<ONEBIT, DENSE> fact_type;
+namespace {
+  /*
+    Loads the image of the current page of an open TIFF file.
+  */
+  Image* tiff_load(TIFF* tif, int storage) {
+    ImageInfo* info = tiff_read_info(tif);
+    Image* image = 0;
+    try {
+      if (info->ncolors() == 1 && info->depth() == 1) {
+        if (storage == DENSE) {
+          typedef TypeIdImageFactory<ONEBIT, DENSE> fact_type;
+          fact_type::image_type*
+            view = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
+          image = view;
+          tiff_load_onebit(*view, *info, tif);
+        } else if (storage == PACKED) {
+          typedef TypeIdImageFactory<ONEBIT, PACKED> fact_type;
+          fact_type::image_type*
+            view = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
+          image = view;
+          tiff_load_onebit(*view, *info, tif);
+        } else {
+          typedef TypeIdImageFactory<ONEBIT, RLE> fact_type;
+          fact_type::image_type*
+            view = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
+          image = view;
+          tiff_load_onebit(*view, *info, tif);
+        }
+      } else if (storage == RLE || storage == PACKED) {
+        throw std::runtime_error("Pixel type must be OneBit to use RLE or PACKED data.");
+      } else if (info->ncolors() == 3) {
+        typedef TypeIdImageFactory<RGB, DENSE> fact_type;
         fact_type::image_type*
-          image = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
-        image->resolution(info->x_resolution());
-        tiff_load_onebit(*image, *info, filename);
-        delete info;
-        TIFFSetErrorHandler(saved_handler);
-        return image;
-      } else {
-        typedef TypeIdImageFactory<ONEBIT, RLE> fact_type;
+          view = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
+        image = view;
+        tiff_load_rgb(*view, *info, tif);
+      } else if (info->depth() == 8) {
+        typedef TypeIdImageFactory<GREYSCALE, DENSE> fact_type;
+        fact_type::image_type*
+          view = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
+        image = view;
+        tiff_load_greyscale(*view, *info, tif);
+      } else if (info->depth() == 16) {
+        typedef TypeIdImageFactory<GREY16, DENSE> fact_type;
         fact_type::image_type*
-          image = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
-        image->resolution(info->x_resolution());
-        tiff_load_onebit(*image, *info, filename);
-        delete info;
-        TIFFSetErrorHandler(saved_handler);
-        return image;
+          view = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
+        image = view;
+        tiff_load_grey16(*view, *info, tif);
+      } else {
+        throw std::runtime_error("Unable to load image of this type!");
       }
+    } catch (std::exception& e) {
+      if (image) {
+        delete image->data();
+        delete image;
+      }
+      delete info;
+      throw;
     }
-  }
-  if (storage == RLE) {
+    image->resolution(info->x_resolution());
     delete info;
+    return image;
+  }
+}
+
+/*
+  Loads one page of a (multi-page) TIFF file.
+*/
+Image* load_tiff_page(const char* filename, int page, int storage) {
+  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
+  TIFF* tif = tiff_open(filename, page);
+  if (tif == 0) {
     TIFFSetErrorHandler(saved_handler);
-    throw std::runtime_error("Pixel type must be OneBit to use RLE data.");
+    throw std::invalid_argument("Failed to open image header");
   }
-  if (info->ncolors() == 3) {
-    typedef TypeIdImageFactory<RGB, DENSE> fact;
-    fact::image_type* image =
-      fact::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
-    tiff_load_rgb(*image, *info, filename);
-    delete info;
+  Image* image = 0;
+  try {
+    image = tiff_load(tif, storage);
+  } catch (std::exception& e) {
+    TIFFClose(tif);
     TIFFSetErrorHandler(saved_handler);
-    return image;
-  } else if (info->depth() == 8) {
-    typedef TypeIdImageFactory<GREYSCALE, DENSE> fact_type;
-    fact_type::image_type*
-      image = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
-    image->resolution(info->x_resolution());
-    tiff_load_greyscale(*image, *info, filename);
-    delete info;
+    throw;
+  }
+  TIFFClose(tif);
+  TIFFSetErrorHandler(saved_handler);
+  return image;
+}
+
+Image* load_tiff(const char* filename, int storage) {
+  return load_tiff_page(filename, 0, storage);
+}
+
+/*
+  Loads (the first page of) a TIFF file held in a string, such as one
+  received over the network, without writing it to disk.
+*/
+Image* load_tiff_from_bytes(PyObject* data, int storage) {
+  if (!PyString_Check(data))
+    throw std::invalid_argument("The data must be a string.");
+  tiff_memory_file file;
+  file.data.assign(PyString_AS_STRING(data),
+                   PyString_AS_STRING(data) + PyString_GET_SIZE(data));
+  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
+  TIFF* tif = tiff_memory_open(file, "r");
+  if (tif == 0) {
     TIFFSetErrorHandler(saved_handler);
-    return image;
-  } else if (info->depth() == 16) {
-    typedef TypeIdImageFactory<GREY16, DENSE> fact_type;
-    fact_type::image_type*
-      image = fact_type::create(Point(0, 0), Dim(info->ncols(), info->nrows()));
-    image->resolution(info->x_resolution());
-    tiff_load_greyscale(*image, *info, filename);
+    throw std::invalid_argument("The data is not a TIFF file.");
+  }
+  Image* image = 0;
+  try {
+    image = tiff_load(tif, storage);
+  } catch (std::exception& e) {
+    TIFFClose(tif);
+    TIFFSetErrorHandler(saved_handler);
+    throw;
+  }
+  TIFFClose(tif);
+  TIFFSetErrorHandler(saved_handler);
+  return image;
+}
+
+/*
+  The number of pages (directories) of a TIFF file.
+*/
+int tiff_page_count(const char* filename) {
+  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
+  TIFF* tif = TIFFOpen(filename, "r");
+  if (tif == 0) {
+    TIFFSetErrorHandler(saved_handler);
+    throw std::invalid_argument("Failed to open image header");
+  }
+  int count = (int)TIFFNumberOfDirectories(tif);
+  TIFFClose(tif);
+  TIFFSetErrorHandler(saved_handler);
+  return count;
+}
+
+/*
+  Loads count pages from page first on (fewer at the end of the file).
+  The pages are decoded in parallel by up to threads threads (all
+  available when threads <= 0), each reading the file through its own
+  handle.
+*/
+std::list<Image*>* load_tiff_pages(const char* filename, int first, int count,
+                                   int storage, int threads) {
+  // the error handler is global, so it is switched off once for all
+  // threads (load_tiff_page then only ever sets it to NULL)
+  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
+  int npages = tiff_page_count(filename);
+  if (first < 0 || first >= npages) {
+    TIFFSetErrorHandler(saved_handler);
+    throw std::range_error("load_tiff_pages: first page is out of range");
+  }
+  count = std::max(0, std::min(count, npages - first));
+  if (threads <= 0) {
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#else
+    threads = 1;
+#endif
+  }
+  std::vector<Image*> pages(count, (Image*)0);
+  ThreadException error;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+  for (int i = 0; i < count; ++i) {
+    try {
+      pages[i] = load_tiff_page(filename, first + i, storage);
+    } catch (...) {
+      error.keep();
+    }
+  }
+  TIFFSetErrorHandler(saved_handler);
+  if (!error.empty()) {
+    for (int i = 0; i < count; ++i)
+      if (pages[i]) {
+        delete pages[i]->data();
+        delete pages[i];
+      }
+    error.rethrow();
+  }
+  return new std::list<Image*>(pages.begin(), pages.end());
+}
+
+/*
+  Loads the part of a TIFF image within rect (in page coordinates), at
+  the offset of rect.  For tiled images, and images saved in more than
+  one strip, only the tiles or strips that overlap rect are decoded.
+*/
+Image* load_tiff_region(const char* filename, Rect* rect, int storage) {
+  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
+  ImageInfo* info = tiff_info(filename);
+  Image* image = 0;
+  try {
+    if (rect->lr_x() >= info->ncols() || rect->lr_y() >= info->nrows())
+      throw std::range_error("load_tiff_region: rect is outside the image");
+    if (info->ncolors() == 1 && info->depth() == 1) {
+      if (storage == DENSE) {
+        typedef TypeIdImageFactory<ONEBIT, DENSE> fact_type;
+        fact_type::image_type* view = fact_type::create(rect->ul(), rect->dim());
+        image = view;
+        tiff_load_region(*view, *info, filename, *rect);
+      } else if (storage == PACKED) {
+        typedef TypeIdImageFactory<ONEBIT, PACKED> fact_type;
+        fact_type::image_type* view = fact_type::create(rect->ul(), rect->dim());
+        image = view;
+        tiff_load_region(*view, *info, filename, *rect);
+      } else {
+        typedef TypeIdImageFactory<ONEBIT, RLE> fact_type;
+        fact_type::image_type* view = fact_type::create(rect->ul(), rect->dim());
+        image = view;
+        tiff_load_region(*view, *info, filename, *rect);
+      }
+    } else if (storage == RLE || storage == PACKED) {
+      throw std::runtime_error("Pixel type must be OneBit to use RLE or PACKED data.");
+    } else if (info->ncolors() == 3 && info->depth() == 8) {
+      typedef TypeIdImageFactory<RGB, DENSE> fact_type;
+      fact_type::image_type* view = fact_type::create(rect->ul(), rect->dim());
+      image = view;
+      tiff_load_region(*view, *info, filename, *rect);
+    } else if (info->ncolors() == 1 && info->depth() == 8) {
+      typedef TypeIdImageFactory<GREYSCALE, DENSE> fact_type;
+      fact_type::image_type* view = fact_type::create(rect->ul(), rect->dim());
+      image = view;
+      tiff_load_region(*view, *info, filename, *rect);
+    } else if (info->ncolors() == 1 && info->depth() == 16) {
+      typedef TypeIdImageFactory<GREY16, DENSE> fact_type;
+      fact_type::image_type* view = fact_type::create(rect->ul(), rect->dim());
+      image = view;
+      tiff_load_region(*view, *info, filename, *rect);
+    } else {
+      throw std::runtime_error("Unable to load image of this type!");
+    }
+  } catch (std::exception& e) {
+    if (image) {
+      delete image->data();
+      delete image;
+    }
     delete info;
     TIFFSetErrorHandler(saved_handler);
-    return image;
+    throw;
   }
+  image->resolution(info->x_resolution());
   delete info;
   TIFFSetErrorHandler(saved_handler);
-  throw std::runtime_error("Unable to load image of this type!");
-  return 0;
+  return image;
+}
+
+namespace {
+  template<class T>
+  void tiff_write(const T& matrix, TIFF* tif, uint16 compression) {
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, matrix.ncols());
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, matrix.nrows());
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, matrix.depth());
+    TIFFSetField(tif, TIFFTAG_XRESOLUTION, matrix.resolution());
+    TIFFSetField(tif, TIFFTAG_YRESOLUTION, matrix.resolution());
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, matrix.ncolors());
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+
+    tiff_saver<typename T::value_type> saver;
+    saver(matrix, tif);
+  }
+}
+
+/*
+  The compressions save_tiff can use.  Group 4 (CCITT T.6) is only
+  available for OneBit images.
+*/
+enum { TIFF_SAVE_NONE, TIFF_SAVE_GROUP4 };
+
+namespace {
+  template<class T>
+  uint16 tiff_compression_tag(const T& matrix, int compression) {
+    if (compression == TIFF_SAVE_NONE)
+      return COMPRESSION_NONE;
+    if (compression == TIFF_SAVE_GROUP4) {
+      if (matrix.depth() != 1)
+        throw std::invalid_argument("Group 4 compression is only available for OneBit images.");
+      return COMPRESSION_CCITTFAX4;
+    }
+    throw std::invalid_argument("Unknown TIFF compression.");
+  }
 }
 
 template<class T>
-void save_tiff(const T& matrix, const char* filename) {
+void save_tiff(const T& matrix, const char* filename, int compression) {
+  uint16 tag = tiff_compression_tag(matrix, compression);
   TIFF* tif = 0;
   tif = TIFFOpen(filename, "w");
   if (tif == 0)
     throw std::invalid_argument("Failed to create image.");
+  tiff_write(matrix, tif, tag);
+  TIFFClose(tif);
+}
 
-  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, matrix.ncols());
-  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, matrix.nrows());
-  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, matrix.depth());
-  TIFFSetField(tif, TIFFTAG_XRESOLUTION, matrix.resolution());
-  TIFFSetField(tif, TIFFTAG_YRESOLUTION, matrix.resolution());
-  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, matrix.ncolors());
-  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+/*
+  Returns the image encoded as a TIFF file in a string, without writing
+  it to disk.
+*/
+template<class T>
+PyObject* save_tiff_to_bytes(const T& matrix, int compression) {
+  uint16 tag = tiff_compression_tag(matrix, compression);
+  tiff_memory_file file;
+  TIFF* tif = tiff_memory_open(file, "w");
+  if (tif == 0)
+    throw std::runtime_error("Failed to create image.");
+  tiff_write(matrix, tif, tag);
+  TIFFClose(tif);
+  return PyString_FromStringAndSize(file.data.empty() ? 0 : &file.data[0],
+                                    (Py_ssize_t)file.data.size());
+}
+
+/*
+  Binarizes a greyscale, grey16 or RGB TIFF file with sauvola_threshold,
+  removes the speckles smaller than despeckle_size (if it is not 0) and
+  saves the result as a OneBit TIFF file, without ever holding the whole
+  image in memory.
+
+  The image is processed in horizontal bands of band_height rows (at
+  least region_size).  Each band is binarized and despeckled together
+  with the rows around it that its pixels depend on: region_size / 2
+  greyscale rows for the threshold, and despeckle_size binarized rows
+  for the speckles, as a speckle is less than despeckle_size pixels
+  high.  The result is therefore the same as that of loading the whole
+  image, converting it to greyscale, thresholding and despeckling it.
+*/
+void stream_binarize_tiff(const char* filename, const char* out_filename,
+                          int region_size, double sensitivity,
+                          int dynamic_range, int lower_bound, int upper_bound,
+                          int despeckle_size, int band_height) {
+  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
+  ImageInfo* info = 0;
+  tiff_greyscale_rows* rows = 0;
+  TIFF* tif = 0;
+  tdata_t buf = 0;
+  OneBitImageView* binarized = 0;
+  try {
+    info = tiff_info(filename);
+    size_t nrows = info->nrows(), ncols = info->ncols();
+    if (region_size < 1 || (size_t)region_size > std::min(nrows, ncols))
+      throw std::out_of_range("stream_binarize_tiff: region_size out of range");
+    if (despeckle_size < 0)
+      throw std::out_of_range("stream_binarize_tiff: despeckle_size out of range");
+    rows = new tiff_greyscale_rows(filename, *info);
 
+    tif = TIFFOpen(out_filename, "w");
+    if (tif == 0)
+      throw std::invalid_argument("Failed to create image.");
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, ncols);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, nrows);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 1);
+    TIFFSetField(tif, TIFFTAG_XRESOLUTION, info->x_resolution());
+    TIFFSetField(tif, TIFFTAG_YRESOLUTION, info->y_resolution());
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISWHITE);
+    buf = tiff_onebit_scanline(tif);
+    bool little_endian = byte_order_little_endian();
 
-  tiff_saver<typename T::value_type> saver;
-  saver(matrix, tif);
-        
+    size_t band = std::max((size_t)band_height, (size_t)region_size);
+    size_t halo = region_size / 2, speckle_halo = despeckle_size;
+    // the greyscale rows [g0, g1) of the image
+    GreyScaleImageData grey_data(Dim(ncols, std::min(nrows, band + 2 * (halo + speckle_halo))));
+    GreyScaleImageView grey(grey_data);
+    size_t g0 = 0, g1 = 0;
+    for (size_t y0 = 0; y0 < nrows; y0 += band) {
+      size_t y1 = std::min(y0 + band, nrows);
+      // the binarized rows [b0, b1) and the greyscale rows needed for them
+      size_t b0 = y0 - std::min(y0, speckle_halo);
+      size_t b1 = std::min(y1 + speckle_halo, nrows);
+      size_t new_g1 = std::min(b1 + halo, nrows);
+      // (sauvola_threshold needs at least region_size rows)
+      size_t new_g0 = std::min(b0 - std::min(b0, halo),
+                               new_g1 - std::min(new_g1, (size_t)region_size));
+      for (size_t y = new_g0; y < g1; ++y)
+        std::copy((grey.row_begin() + (y - g0)).begin(),
+                  (grey.row_begin() + (y - g0)).end(),
+                  (grey.row_begin() + (y - new_g0)).begin());
+      for (size_t y = g1; y < new_g1; ++y)
+        rows->read(y, (grey.row_begin() + (y - new_g0)).begin());
+      g0 = new_g0;
+      g1 = new_g1;
+
+      GreyScaleImageView grey_band(grey_data, Point(0, 0), Dim(ncols, g1 - g0));
+      binarized = sauvola_threshold(grey_band, region_size, sensitivity,
+                                    dynamic_range, lower_bound, upper_bound);
+      OneBitImageView speckle_band(*binarized->data(), Point(0, b0 - g0),
+                                   Dim(ncols, b1 - b0));
+      if (despeckle_size > 0)
+        despeckle(speckle_band, despeckle_size);
+      OneBitImageView::row_iterator row = speckle_band.row_begin() + (y0 - b0);
+      for (size_t y = y0; y < y1; ++y, ++row) {
+        tiff_pack_onebit_row(row.begin(), ncols, (uint32 *)buf, little_endian);
+        if (TIFFWriteScanline(tif, buf, y) < 0)
+          throw std::runtime_error("Error writing scanline");
+      }
+      delete binarized->data();
+      delete binarized;
+      binarized = 0;
+    }
+  } catch (std::exception& e) {
+    if (binarized) {
+      delete binarized->data();
+      delete binarized;
+    }
+    if (buf)
+      _TIFFfree(buf);
+    if (tif)
+      TIFFClose(tif);
+    delete rows;
+    delete info;
+    TIFFSetErrorHandler(saved_handler);
+    throw;
+  }
+  _TIFFfree(buf);
   TIFFClose(tif);
+  delete rows;
+  delete info;
+  TIFFSetErrorHandler(saved_handler);
+}
+
+namespace {
+  // the type of the strip offsets and byte counts
+#if TIFFLIB_VERSION >= 20111221
+  typedef uint64 tiff_strip_offset;
+#else
+  typedef uint32 tiff_strip_offset;
+#endif
+
+  template<class T>
+  Image* map_image(const char* filename, const Dim& dim, size_t offset) {
+    ImageData<T>* data = new ImageData<T>(dim, Point(0, 0), filename, offset);
+    return new ImageView<ImageData<T> >(*data);
+  }
+}
+
+/*
+  Maps an uncompressed 8 bit greyscale or RGB TIFF file whose strips follow
+  each other in the file, instead of loading it.  The pixels are only read
+  when they are accessed (see the file constructor of ImageData).  When
+  Grey16 pixels are stored in 16 bits (GAMERA_GREY16_NATIVE), 16 bit
+  greyscale files in the byte order of the machine are mapped too.
+*/
+Image* map_tiff(const char* filename) {
+  TIFFErrorHandler saved_handler = TIFFSetErrorHandler(NULL);
+  TIFF* tif = TIFFOpen(filename, "r");
+  if (tif == 0) {
+    TIFFSetErrorHandler(saved_handler);
+    throw std::invalid_argument("Failed to open image");
+  }
+  uint32 ncols, nrows;
+  unsigned short depth, ncolors, compression, planar, photometric;
+  float resolution;
+  TIFFGetFieldDefaulted(tif, TIFFTAG_IMAGEWIDTH, &ncols);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_IMAGELENGTH, &nrows);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &depth);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &ncolors);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_XRESOLUTION, &resolution);
+
+  bool mappable = compression == COMPRESSION_NONE && !TIFFIsTiled(tif)
+    && ((depth == 8
+         && ((ncolors == 1 && photometric == PHOTOMETRIC_MINISBLACK)
+             || (ncolors == 3 && photometric == PHOTOMETRIC_RGB
+                 && planar == PLANARCONFIG_CONTIG)))
+#ifdef GAMERA_GREY16_NATIVE
+        || (depth == 16 && ncolors == 1
+            && photometric == PHOTOMETRIC_MINISBLACK && !TIFFIsByteSwapped(tif))
+#endif
+        );
+  size_t offset = 0;
+  tiff_strip_offset* offsets;
+  tiff_strip_offset* bytecounts;
+  if (mappable
+      && TIFFGetField(tif, TIFFTAG_STRIPOFFSETS, &offsets)
+      && TIFFGetField(tif, TIFFTAG_STRIPBYTECOUNTS, &bytecounts)) {
+    offset = (size_t)offsets[0];
+    size_t bytes = 0;
+    tstrip_t nstrips = TIFFNumberOfStrips(tif);
+    for (tstrip_t i = 0; i < nstrips; ++i) {
+      if ((size_t)offsets[i] != offset + bytes)
+        mappable = false;
+      bytes += (size_t)bytecounts[i];
+    }
+    if (bytes < (size_t)ncols * nrows * ncolors * (depth / 8))
+      mappable = false;
+  } else {
+    mappable = false;
+  }
+  TIFFClose(tif);
+  TIFFSetErrorHandler(saved_handler);
+  if (!mappable)
+    throw std::runtime_error("Only uncompressed 8 bit greyscale and RGB TIFF images with consecutive strips can be mapped.");
+
+  Image* image;
+  if (depth == 16)
+    image = map_image<Grey16Pixel>(filename, Dim(ncols, nrows), offset);
+  else if (ncolors == 1)
+    image = map_image<GreyScalePixel>(filename, Dim(ncols, nrows), offset);
+  else
+    image = map_image<RGBPixel>(filename, Dim(ncols, nrows), offset);
+  image->resolution(resolution);
+  return image;
+}
+
+/*
+  Maps a file holding the pixels of the given type uncompressed, row by row
+  and in the native byte order, from offset on.
+*/
+Image* map_raw(const char* filename, int pixel_type, int ncols, int nrows,
+               int offset) {
+  if (ncols < 1 || nrows < 1 || offset < 0)
+    throw std::range_error("map_raw: ncols and nrows must be >= 1 and offset >= 0.");
+  Dim dim(ncols, nrows);
+  switch (pixel_type) {
+  case ONEBIT:
+    return map_image<OneBitPixel>(filename, dim, offset);
+  case GREYSCALE:
+    return map_image<GreyScalePixel>(filename, dim, offset);
+  case GREY16:
+    return map_image<Grey16Pixel>(filename, dim, offset);
+  case RGB:
+    return map_image<RGBPixel>(filename, dim, offset);
+  case FLOAT:
+    return map_image<FloatPixel>(filename, dim, offset);
+  case COMPLEX:
+    return map_image<ComplexPixel>(filename, dim, offset);
+  default:
+    throw std::runtime_error("map_raw: unknown pixel type");
+  }
 }
 
 }
@@ -32,18 +32,165 @@
 #include <exception>
 #include <math.h>
 #include <algorithm>
+#include <vector>
 
 
 namespace Gamera {
   
 
+  /*
+   * Rotate clockwise by quarters * 90 degrees, which only moves pixels.
+   *
+   * The pixels are moved in square blocks, so that the rows read and the
+   * columns written (or the other way around) of a block stay in cache.
+   */
+  template<class T>
+  typename ImageFactory<T>::view_type* rotate_quarters(const T &src, int quarters)
+  {
+    typedef typename ImageFactory<T>::data_type data_type;
+    typedef typename ImageFactory<T>::view_type view_type;
+    quarters = ((quarters % 4) + 4) % 4;
+    const size_t ncols = src.ncols(), nrows = src.nrows();
+    data_type* dest_data;
+    if (quarters % 2 == 0)
+      dest_data = new data_type(Dim(ncols, nrows));
+    else
+      dest_data = new data_type(Dim(nrows, ncols));
+    view_type* dest = new view_type(*dest_data);
+
+    const size_t block = 64;
+    for (size_t y0 = 0; y0 < nrows; y0 += block) {
+      const size_t y1 = std::min(y0 + block, nrows);
+      for (size_t x0 = 0; x0 < ncols; x0 += block) {
+        const size_t x1 = std::min(x0 + block, ncols);
+        for (size_t y = y0; y < y1; ++y) {
+          for (size_t x = x0; x < x1; ++x) {
+            Point to;
+            if (quarters == 0)
+              to = Point(x, y);
+            else if (quarters == 1)
+              to = Point(nrows - 1 - y, x);
+            else if (quarters == 2)
+              to = Point(ncols - 1 - x, nrows - 1 - y);
+            else
+              to = Point(y, ncols - 1 - x);
+            dest->set(to, src.get(Point(x, y)));
+          }
+        }
+      }
+    }
+    return dest;
+  }
+
+  /*
+   * Rotate the image in the middle of work by angle degrees (between -90
+   * and 90) about the center of work with three shears (A.W. Paeth: A fast
+   * algorithm for general raster rotation.  Graphics Interface '86,
+   * pp. 77-81, 1986): the rows, the columns, and again the rows are
+   * shifted by whole pixels.  work must have a margin of background wide
+   * enough that no pixel of the image is shifted out of it.
+   */
+  template<class T>
+  void rotate_shears(T &work, double angle)
+  {
+    double rad = (angle / 180.0) * M_PI;
+    double row_shear = -tan(rad / 2.0);
+    double column_shear = sin(rad);
+    double cx = (work.ncols() - 1) / 2.0, cy = (work.nrows() - 1) / 2.0;
+    for (int pass = 0; pass < 3; ++pass) {
+      if (pass == 1) {
+        for (size_t x = 0; x < work.ncols(); ++x) {
+          int distance = (int)floor(column_shear * (x - cx) + 0.5);
+          // columns shifted that far are only background
+          if (size_t(std::abs(distance)) < work.nrows())
+            shear_column(work, x, distance);
+        }
+      } else {
+        for (size_t y = 0; y < work.nrows(); ++y) {
+          int distance = (int)floor(row_shear * (y - cy) + 0.5);
+          if (size_t(std::abs(distance)) < work.ncols())
+            shear_row(work, y, distance);
+        }
+      }
+    }
+  }
+
+  /*
+   * The rotation of rotate with order 0: src (a view_type of
+   * ImageFactory) padded by pad_width and pad_height is rotated by angle
+   * degrees (between 0 and 360) with rotate_shears, after turning it by
+   * 180 degrees first when that makes the angle smaller, in a work image
+   * with the margin the shears need.
+   */
+  template<class T>
+  T* rotate_padded_by_shears(const T &src, double angle, typename T::value_type bgcolor, size_t pad_width, size_t pad_height)
+  {
+    typedef typename ImageFactory<T>::data_type data_type;
+    typedef T view_type;
+    view_type* turned = 0;
+    const view_type* image = &src;
+    if (angle > 90.0 && angle < 270.0) {
+      turned = rotate_quarters(src, 2);
+      image = turned;
+      angle -= 180.0;
+    } else if (angle > 270.0) {
+      angle -= 360.0;
+    }
+    // the extent of the image from the center after each shear
+    double rad = (angle / 180.0) * M_PI;
+    double row_shear = std::abs(tan(rad / 2.0));
+    double column_shear = std::abs(sin(rad));
+    double half_width = src.ncols() / 2.0, half_height = src.nrows() / 2.0;
+    double sheared_width = half_width + row_shear * half_height;
+    double sheared_height = half_height + column_shear * sheared_width;
+    double final_width = sheared_width + row_shear * sheared_height;
+    size_t width = src.ncols() + 2 * pad_width;
+    size_t height = src.nrows() + 2 * pad_height;
+    size_t margin_x = (size_t)std::max(0.0, ceil(std::max(sheared_width, final_width) + 3.0 - width / 2.0));
+    size_t margin_y = (size_t)std::max(0.0, ceil(sheared_height + 3.0 - height / 2.0));
+
+    view_type* work = 0;
+    view_type* dest = 0;
+    try {
+      work = pad_image(*image, pad_height + margin_y, pad_width + margin_x,
+                       pad_height + margin_y, pad_width + margin_x, bgcolor);
+      rotate_shears(*work, angle);
+      view_type middle(*work->data(),
+                       Point(work->ul_x() + margin_x, work->ul_y() + margin_y),
+                       Dim(width, height));
+      data_type* dest_data = new data_type(Dim(width, height));
+      dest = new view_type(*dest_data);
+      image_copy_fill(middle, *dest);
+    } catch (std::exception e) {
+      if (turned) {
+        delete turned->data();
+        delete turned;
+      }
+      if (work) {
+        delete work->data();
+        delete work;
+      }
+      throw;
+    }
+    if (turned) {
+      delete turned->data();
+      delete turned;
+    }
+    delete work->data();
+    delete work;
+    return dest;
+  }
+
   /*
    * Rotate at an arbitrary angle.
    *
-   * This algorithm works by first rotating for 90 degrees, depending whether
-   * height and width are exchanged by rotation or not.
+   * Multiples of 90 degrees only move pixels and are done by
+   * rotate_quarters.  Otherwise this algorithm works by first rotating for
+   * 90 degrees, depending whether height and width are exchanged by rotation
+   * or not.
    * Afterwards VIGRA's rotation algorithm is called, which allows
-   * for different types of interpolation.
+   * for different types of interpolation, or, when order is 0, the image
+   * is rotated by rotate_shears without interpolation.
    *
    * src - A view of of the source image
    * angle - Degree of rotation
@@ -53,8 +200,8 @@ namespace Gamera {
   template<class T>
   typename ImageFactory<T>::view_type* rotate(const T &src, double angle, typename T::value_type bgcolor, int order)
   {
-    if (order < 1 || order > 3) {
-      throw std::range_error("Order must be between 1 and 3");
+    if (order < 0 || order > 3) {
+      throw std::range_error("Order must be between 0 and 3");
     }
     if (src.nrows()<2 && src.ncols()<2)
       return simple_image_copy(src);
@@ -63,6 +210,9 @@ namespace Gamera {
     while(angle<0.0) angle+=360;
     while(angle>=360.0) angle-=360;
 
+    if (angle == 0.0 || angle == 90.0 || angle == 180.0 || angle == 270.0)
+      return rotate_quarters(src, int(angle) / 90);
+
     // some angle ranges flip width and height
     // as VIGRA requires source and destination to be of the same
     // size, it cannot handle a reduce in one image dimension.
@@ -71,15 +221,7 @@ namespace Gamera {
     typename ImageFactory<T>::view_type* prep4vigra = (typename ImageFactory<T>::view_type*) &src;
     if ((45 < angle && angle < 135) ||
         (225 < angle && angle < 315)) {
-      typename ImageFactory<T>::data_type* prep4vigra_data =
-        new typename ImageFactory<T>::data_type(Size(src.height(),src.width()));
-      prep4vigra = new typename ImageFactory<T>::view_type(*prep4vigra_data);
-      size_t ymax = src.nrows() - 1;
-      for (size_t y = 0; y < src.nrows(); ++y) {
-        for (size_t x = 0; x < src.ncols(); ++x) {
-          prep4vigra->set(Point(ymax-y,x), src.get(Point(x,y)));
-        }
-      }
+      prep4vigra = rotate_quarters(src, 1);
       rot90done = true;
       // recompute rotation angle, because partial rotation already done
       angle -= 90.0;
@@ -109,6 +251,25 @@ namespace Gamera {
     if (new_height > prep4vigra->height())
       pad_height = (new_height - prep4vigra->height()) / 2 + 2;
 
+    if (order == 0) {
+      typename ImageFactory<T>::view_type* dest = 0;
+      try {
+        dest = rotate_padded_by_shears(*prep4vigra, angle, bgcolor,
+                                       pad_width, pad_height);
+      } catch (std::exception e) {
+        if (rot90done) {
+          delete prep4vigra->data();
+          delete prep4vigra;
+        }
+        throw;
+      }
+      if (rot90done) {
+        delete prep4vigra->data();
+        delete prep4vigra;
+      }
+      return dest;
+    }
+
     typename ImageFactory<T>::view_type* tmp =
       pad_image(*prep4vigra, pad_height, pad_width, pad_height, pad_width, bgcolor);
 
@@ -200,6 +361,209 @@ namespace Gamera {
 		  resize_quality);
   }
 
+  /*
+    Area averaging downscale (downscale_area and image_pyramid)
+  */
+
+  namespace AreaDetail {
+    /*
+     * The sums of the pixels of a block are kept per channel in doubles,
+     * which are exact for all integer pixel types.  ONEBIT blocks count
+     * their black pixels and give a GREYSCALE image.
+     */
+    template<class Pixel>
+    struct area_traits {
+      typedef Pixel result_type;
+      enum { channels = 1 };
+      static void add(double* sums, Pixel value) {
+        sums[0] += value;
+      }
+      static result_type mean(const double* sums, double area) {
+        return result_type(sums[0] / area + 0.5);
+      }
+    };
+
+    template<>
+    struct area_traits<OneBitPixel> {
+      typedef GreyScalePixel result_type;
+      enum { channels = 1 };
+      static void add(double* sums, OneBitPixel value) {
+        if (is_black(value))
+          sums[0] += 1.0;
+      }
+      static result_type mean(const double* sums, double area) {
+        return result_type(255.0 - 255.0 * sums[0] / area + 0.5);
+      }
+    };
+
+    template<>
+    struct area_traits<FloatPixel> {
+      typedef FloatPixel result_type;
+      enum { channels = 1 };
+      static void add(double* sums, FloatPixel value) {
+        sums[0] += value;
+      }
+      static result_type mean(const double* sums, double area) {
+        return sums[0] / area;
+      }
+    };
+
+    template<>
+    struct area_traits<RGBPixel> {
+      typedef RGBPixel result_type;
+      enum { channels = 3 };
+      static void add(double* sums, RGBPixel value) {
+        sums[0] += value.red();
+        sums[1] += value.green();
+        sums[2] += value.blue();
+      }
+      static result_type mean(const double* sums, double area) {
+        return RGBPixel(GreyScalePixel(sums[0] / area + 0.5),
+                        GreyScalePixel(sums[1] / area + 0.5),
+                        GreyScalePixel(sums[2] / area + 0.5));
+      }
+    };
+
+    /*
+     * One level of the downscale: rows of block sums (with the number of
+     * source pixels of each block) are added factor by factor into the
+     * blocks of this level.  When a band of factor rows is complete, its
+     * row of the image is written and its sums are passed on to the next
+     * level, so that a pyramid is built in one pass over the source rows
+     * and every level averages the source pixels exactly.
+     */
+    template<class Pixel>
+    class AreaLevel {
+    public:
+      typedef area_traits<Pixel> traits;
+      typedef typename traits::result_type result_type;
+      typedef ImageData<result_type> data_type;
+      typedef ImageView<data_type> view_type;
+
+      AreaLevel(size_t in_ncols, size_t in_nrows, size_t factor, AreaLevel* next)
+        : m_factor(factor), m_ncols((in_ncols + factor - 1) / factor),
+          m_in_ncols(in_ncols), m_rows_added(0), m_row(0), m_next(next),
+          m_sums(m_ncols * traits::channels, 0.0), m_areas(m_ncols, 0.0) {
+        data_type* data = new data_type(Dim(m_ncols, (in_nrows + factor - 1) / factor));
+        m_view = new view_type(*data);
+      }
+
+      size_t ncols() const { return m_ncols; }
+      size_t nrows() const { return m_view->nrows(); }
+      view_type* view() const { return m_view; }
+
+      // adds a row of in_ncols block sums and areas
+      void add_row(const double* sums, const double* areas) {
+        for (size_t x = 0; x < m_in_ncols; ++x) {
+          size_t to = x / m_factor;
+          for (int c = 0; c < traits::channels; ++c)
+            m_sums[to * traits::channels + c] += sums[x * traits::channels + c];
+          m_areas[to] += areas[x];
+        }
+        if (++m_rows_added == m_factor)
+          finish_row();
+      }
+
+      // adds a row of source pixels
+      template<class Iterator>
+      void add_pixels(Iterator begin, Iterator end) {
+        size_t x = 0;
+        for (Iterator i = begin; i != end; ++i, ++x) {
+          size_t to = x / m_factor;
+          traits::add(&m_sums[to * traits::channels], *i);
+          m_areas[to] += 1.0;
+        }
+        if (++m_rows_added == m_factor)
+          finish_row();
+      }
+
+      // writes the last band, which may have fewer than factor rows
+      void finish() {
+        if (m_rows_added > 0)
+          finish_row();
+        if (m_next)
+          m_next->finish();
+      }
+
+    private:
+      void finish_row() {
+        typename view_type::row_iterator out = m_view->row_begin() + m_row;
+        typename view_type::row_iterator::iterator o = out.begin();
+        for (size_t x = 0; x < m_ncols; ++x, ++o)
+          *o = traits::mean(&m_sums[x * traits::channels], m_areas[x]);
+        if (m_next)
+          m_next->add_row(&m_sums[0], &m_areas[0]);
+        std::fill(m_sums.begin(), m_sums.end(), 0.0);
+        std::fill(m_areas.begin(), m_areas.end(), 0.0);
+        m_rows_added = 0;
+        ++m_row;
+      }
+
+      size_t m_factor, m_ncols, m_in_ncols, m_rows_added, m_row;
+      AreaLevel* m_next;
+      std::vector<double> m_sums, m_areas;
+      view_type* m_view;
+    };
+  }
+
+  /*
+   * Shrinks the image by an integer factor, each pixel of the result
+   * being the mean of a factor x factor block.
+   */
+  template<class T>
+  Image* downscale_area(const T& image, int factor) {
+    typedef AreaDetail::AreaLevel<typename T::value_type> level_type;
+    if (factor < 1)
+      throw std::range_error("The factor must be at least 1.");
+    level_type level(image.ncols(), image.nrows(), factor, 0);
+    try {
+      for (typename T::const_row_iterator r = image.row_begin(); r != image.row_end(); ++r)
+        level.add_pixels(r.begin(), r.end());
+      level.finish();
+    } catch (std::exception e) {
+      delete level.view()->data();
+      delete level.view();
+      throw;
+    }
+    level.view()->resolution(image.resolution() / factor);
+    return level.view();
+  }
+
+  /*
+   * Halves the image levels times, by area averaging from the source
+   * pixels, in a single pass over the image.
+   */
+  template<class T>
+  ImageList* image_pyramid(const T& image, int levels) {
+    typedef AreaDetail::AreaLevel<typename T::value_type> level_type;
+    if (levels < 1)
+      throw std::range_error("The number of levels must be at least 1.");
+    // the levels are created from the smallest, which the others feed
+    std::vector<size_t> ncols(levels + 1), nrows(levels + 1);
+    ncols[0] = image.ncols();
+    nrows[0] = image.nrows();
+    for (int i = 1; i <= levels; ++i) {
+      ncols[i] = (ncols[i - 1] + 1) / 2;
+      nrows[i] = (nrows[i - 1] + 1) / 2;
+    }
+    std::vector<level_type*> pyramid(levels, (level_type*)0);
+    for (int i = levels - 1; i >= 0; --i)
+      pyramid[i] = new level_type(ncols[i], nrows[i], 2,
+                                  i + 1 < levels ? pyramid[i + 1] : 0);
+    for (typename T::const_row_iterator r = image.row_begin(); r != image.row_end(); ++r)
+      pyramid[0]->add_pixels(r.begin(), r.end());
+    pyramid[0]->finish();
+    ImageList* result = new ImageList();
+    double resolution = image.resolution();
+    for (int i = 0; i < levels; ++i) {
+      resolution /= 2;
+      pyramid[i]->view()->resolution(resolution);
+      result->push_back(pyramid[i]->view());
+      delete pyramid[i];
+    }
+    return result;
+  }
+
 
 
   /*
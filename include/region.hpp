@@ -24,8 +24,10 @@
 #include "gamera_limits.hpp"
 #include <list>
 #include <map>
+#include <vector>
 #include <algorithm>
 #include <exception>
+#include <stdexcept>
 #include <string>
 
 #include <iostream>
@@ -44,7 +46,10 @@
   REGIONMAP
 
   A regionmap is a list of regions with a function to add regions and a
-  function to lookup regions based on position.
+  function to lookup regions based on position. Lookups go through a
+  spatial index over the region rectangles that is rebuilt on the first
+  lookup after regions have been added, so regions should be added
+  with add_region.
 */
 
 namespace Gamera {
@@ -115,6 +120,129 @@ namespace Gamera {
       else
 	return -(int)(b.ul_y() - a.lr_y());
     }
+
+    /*
+      A static interval tree over closed intervals [lo, hi], reporting
+      the indices of all intervals that contain a given value.
+    */
+    class IntervalTree {
+    public:
+      typedef std::pair<size_t, size_t> interval_type;
+
+      void build(const std::vector<interval_type>& intervals) {
+	m_intervals = intervals;
+	m_nodes.clear();
+	std::vector<size_t> all(intervals.size());
+	for (size_t i = 0; i < all.size(); ++i)
+	  all[i] = i;
+	if (!all.empty())
+	  build_node(all);
+      }
+
+      // appends the indices of the intervals containing x to result
+      void stab(size_t x, std::vector<size_t>& result) const {
+	long n = m_nodes.empty() ? -1 : 0;
+	while (n >= 0) {
+	  const Node& node = m_nodes[n];
+	  if (x < node.center) {
+	    for (size_t i = 0; i < node.by_lo.size() &&
+		   m_intervals[node.by_lo[i]].first <= x; ++i)
+	      result.push_back(node.by_lo[i]);
+	    n = node.left;
+	  } else {
+	    for (size_t i = 0; i < node.by_hi.size() &&
+		   m_intervals[node.by_hi[i]].second >= x; ++i)
+	      result.push_back(node.by_hi[i]);
+	    n = (x == node.center) ? -1 : node.right;
+	  }
+	}
+      }
+
+    private:
+      struct Node {
+	size_t center;
+	// the intervals containing center, by ascending lower and by
+	// descending upper end
+	std::vector<size_t> by_lo, by_hi;
+	long left, right;
+      };
+
+      struct by_lo_less {
+	const std::vector<interval_type>& v;
+	by_lo_less(const std::vector<interval_type>& v_) : v(v_) {}
+	bool operator()(size_t a, size_t b) const {
+	  return v[a].first < v[b].first;
+	}
+      };
+
+      struct by_hi_greater {
+	const std::vector<interval_type>& v;
+	by_hi_greater(const std::vector<interval_type>& v_) : v(v_) {}
+	bool operator()(size_t a, size_t b) const {
+	  return v[a].second > v[b].second;
+	}
+      };
+
+      long build_node(std::vector<size_t>& indices) {
+	// the median of the interval midpoints
+	std::vector<size_t> mids(indices.size());
+	for (size_t i = 0; i < indices.size(); ++i)
+	  mids[i] = m_intervals[indices[i]].first +
+	    (m_intervals[indices[i]].second - m_intervals[indices[i]].first) / 2;
+	std::nth_element(mids.begin(), mids.begin() + mids.size() / 2,
+			 mids.end());
+	size_t center = mids[mids.size() / 2];
+
+	std::vector<size_t> left, right, here;
+	for (size_t i = 0; i < indices.size(); ++i) {
+	  const interval_type& iv = m_intervals[indices[i]];
+	  if (iv.second < center)
+	    left.push_back(indices[i]);
+	  else if (iv.first > center)
+	    right.push_back(indices[i]);
+	  else
+	    here.push_back(indices[i]);
+	}
+	long n = (long)m_nodes.size();
+	m_nodes.push_back(Node());
+	m_nodes[n].center = center;
+	m_nodes[n].by_lo = here;
+	std::stable_sort(m_nodes[n].by_lo.begin(), m_nodes[n].by_lo.end(),
+			 by_lo_less(m_intervals));
+	m_nodes[n].by_hi = here;
+	std::stable_sort(m_nodes[n].by_hi.begin(), m_nodes[n].by_hi.end(),
+			 by_hi_greater(m_intervals));
+	long l = left.empty() ? -1 : build_node(left);
+	long r = right.empty() ? -1 : build_node(right);
+	m_nodes[n].left = l;
+	m_nodes[n].right = r;
+	return n;
+      }
+
+      std::vector<interval_type> m_intervals;
+      std::vector<Node> m_nodes;
+    };
+
+    // orders region indices by their left or right edge, for range
+    // queries with lower_bound/upper_bound on an edge_value
+    struct edge_value {
+      size_t x;
+      edge_value(size_t x_) : x(x_) {}
+    };
+
+    template<class R>
+    struct edge_less {
+      const std::vector<const R*>& regions;
+      bool right;
+      edge_less(const std::vector<const R*>& r, bool right_)
+	: regions(r), right(right_) {}
+      size_t edge(size_t i) const {
+	return right ? regions[i]->lr_x() : regions[i]->ul_x();
+      }
+      bool operator()(size_t a, size_t b) const { return edge(a) < edge(b); }
+      bool operator()(size_t a, const edge_value& v) const { return edge(a) < v.x; }
+      bool operator()(const edge_value& v, size_t b) const { return v.x < edge(b); }
+    };
   }
 
   template<class T>
@@ -127,40 +255,100 @@ namespace Gamera {
     typedef RegionTemplate<T> region_type;
     typedef Rect rect_t;
     RegionMapTemplate() : std::list<region_type>(0) { }
+    RegionMapTemplate(const RegionMapTemplate& other)
+      : std::list<region_type>(other) { }
+    RegionMapTemplate& operator=(const RegionMapTemplate& other) {
+      std::list<region_type>::operator=(other);
+      m_index.clear();
+      return *this;
+    }
     virtual ~RegionMapTemplate() { }
     void add_region(const region_type& x) {
       this->push_back(x);
+      m_index.clear();
     }
+    /*
+      Returns the first region (in the order of insertion) that contains
+      r. When there is none, the closest of the regions whose left or
+      right edge lies within the horizontal extent of r is returned,
+      or the first region when there is no such region either.
+    */
     virtual region_type lookup(const rect_t& r) {
-      typename self::iterator answer =
-	std::find_if(begin(), end(), region_detail::intersect<rect_t>(r));
-      if (answer != end())
-	return *answer;
-      else {
-	// if we weren't contained in the rectangle we need to find the closest
-	// by going straight up and down
-	typename self::iterator closest = begin();
-	typename self::iterator i = begin();
-	int closest_distance = std::numeric_limits<int>::max();
-	for (; i != end(); ++i) {
-	  if (region_detail::vertically_intersected(r, *i)) {
-	    // get the distance above
-	    int current_distance = region_detail::distance_above(r, *i);
-	    // if we aren't really above, get the distance below. Because we
-	    // know that the rectangles don't intersect, these cases really
-	    // are exclusive
-	    if (current_distance < 0) {
-	      current_distance = region_detail::distance_below(r, *i);
-	    }
-	    if (current_distance < closest_distance)
-	      closest = i;
+      return *lookup_region(r);
+    }
+    const region_type* lookup_region(const rect_t& r) {
+      if (this->empty())
+	throw std::range_error("RegionMap is empty.");
+      if (m_index.size() != this->size())
+	build_index();
+
+      // containing regions cover the top row of r
+      size_t answer = m_index.size();
+      m_candidates.clear();
+      m_rows.stab(r.ul_y(), m_candidates);
+      for (size_t i = 0; i < m_candidates.size(); ++i)
+	if (m_candidates[i] < answer && m_index[m_candidates[i]]->contains_rect(r))
+	  answer = m_candidates[i];
+      if (answer != m_index.size())
+	return m_index[answer];
+
+      // if we weren't contained in the rectangle we need to find the closest
+      // by going straight up and down
+      answer = 0;
+      int closest_distance = std::numeric_limits<int>::max();
+      for (int right = 0; right < 2; ++right) {
+	const std::vector<size_t>& order = right ? m_by_lr_x : m_by_ul_x;
+	region_detail::edge_less<region_type> less(m_index, right != 0);
+	std::vector<size_t>::const_iterator i =
+	  std::lower_bound(order.begin(), order.end(),
+			   region_detail::edge_value(r.ul_x()), less);
+	std::vector<size_t>::const_iterator last =
+	  std::upper_bound(order.begin(), order.end(),
+			   region_detail::edge_value(r.lr_x()), less);
+	for (; i < last; ++i) {
+	  const region_type& region = *m_index[*i];
+	  // get the distance above
+	  int current_distance = region_detail::distance_above(r, region);
+	  // if we aren't really above, get the distance below. Because we
+	  // know that the rectangles don't intersect, these cases really
+	  // are exclusive
+	  if (current_distance < 0)
+	    current_distance = region_detail::distance_below(r, region);
+	  if (current_distance < closest_distance ||
+	      (current_distance == closest_distance && *i < answer)) {
+	    closest_distance = current_distance;
+	    answer = *i;
 	  }
 	}
-	return *closest;
       }
+      return m_index[answer];
+    }
+
+  private:
+    void build_index() {
+      m_index.clear();
+      std::vector<region_detail::IntervalTree::interval_type> rows;
+      for (typename self::const_iterator i = begin(); i != end(); ++i) {
+	m_index.push_back(&(*i));
+	rows.push_back(std::make_pair(i->ul_y(), i->lr_y()));
+      }
+      m_rows.build(rows);
+      m_by_ul_x.resize(m_index.size());
+      for (size_t i = 0; i < m_index.size(); ++i)
+	m_by_ul_x[i] = i;
+      m_by_lr_x = m_by_ul_x;
+      std::stable_sort(m_by_ul_x.begin(), m_by_ul_x.end(),
+		       region_detail::edge_less<region_type>(m_index, false));
+      std::stable_sort(m_by_lr_x.begin(), m_by_lr_x.end(),
+		       region_detail::edge_less<region_type>(m_index, true));
     }
+
+    // the regions in the order of insertion, and the index over them
+    std::vector<const region_type*> m_index;
+    region_detail::IntervalTree m_rows;
+    std::vector<size_t> m_by_ul_x, m_by_lr_x;
+    std::vector<size_t> m_candidates;
   };
 
 }
 #endif
-
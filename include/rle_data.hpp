@@ -109,11 +109,27 @@ namespace Gamera {
         list_of_runs = array_of_lists[pos / RLE_CHUNK]
    
       Once you have the appropriate list, it is still necessary to
-      scan through to find the particular run (or lack of run if the
+      search it to find the particular run (or lack of run if the
       pixel is white). All we have done by using this array is to
-      limit the length of the list that needs to be scanned by
+      limit the length of the list that needs to be searched by
       RLE_CHUNK.
 
+      The runs of a chunk are kept in a contiguous, sorted array
+      (std::vector) rather than a linked list.  This avoids a heap
+      node (and two pointers) per run, keeps the runs of a chunk
+      together in the cache, and lets a run be found by binary
+      search on the run ends.  Inserting into or erasing from the
+      array invalidates the iterators into it, but these operations
+      always increment m_dirty, so iterators recover in the same way
+      as before.
+
+      An iterator that moves within its chunk (e.g. down a column of
+      a narrow image) passes the run it is in to the search as a hint
+      (see RleVector::find_run): the search tries that run and the
+      next one first, and otherwise only bisects the runs on the side
+      of the new position.  The hint lives in the iterator, not in the
+      vector, so that any number of threads can read the same data.
+
       
 
       SPACE REDUCTION
@@ -209,9 +225,7 @@ namespace Gamera {
 
       There are two cases for the Proxy:
       a) we have a position that is in the middle of a run (so we have
-         a pointer to an iterator that points to the run - we use
-	 a pointer so we can determine whether or not we have the
-	 iterator by comparison to 0).
+         an iterator that points to the run).
       b) we only have the position and not an iterator.
       Case 'a' allows us to avoid a rather slow lookup, but we can't
       always use this optimization.
@@ -226,39 +240,34 @@ namespace Gamera {
       RLEProxy(T* vec, size_t pos) {
 	m_vec = vec;
 	m_pos = pos;
-	m_iterator = 0;
+	m_has_iterator = false;
 	m_dirty = vec->m_dirty;
       }
-      RLEProxy(T* vec, size_t pos, const iterator* it) {
-	m_vec = vec;
-	m_pos = pos;
-	m_iterator = it;
-	m_dirty = vec->m_dirty;
-      }
-      // this is for RleVector[] - so, so, stupid, but oh well
       RLEProxy(T* vec, size_t pos, iterator i) {
 	m_vec = vec;
 	m_pos = pos;
 	m_i = i;
-	m_iterator = &m_i;
+	m_has_iterator = true;
 	m_dirty = vec->m_dirty;
       }
       void operator=(value_type v) {
-	if (m_dirty == m_vec->m_dirty && m_iterator != 0)
- 	  m_vec->set(m_pos, v, *m_iterator);
+	if (m_dirty == m_vec->m_dirty && m_has_iterator)
+ 	  m_vec->set(m_pos, v, m_i);
  	else
 	  m_vec->set(m_pos, v);
       }
       operator value_type() const {
-	if (m_dirty == m_vec->m_dirty && m_iterator != 0)
-	  return (*m_iterator)->value;
+	if (m_dirty == m_vec->m_dirty && m_has_iterator)
+	  return m_i->value;
 	return m_vec->get(m_pos);
       }
     private:
       T* m_vec;
       size_t m_pos;
-      const iterator* m_iterator;
+      // the proxy is returned by value, so it keeps a copy of the
+      // iterator rather than a pointer to the caller's
       iterator m_i;
+      bool m_has_iterator;
       size_t m_dirty;
     };
   
@@ -272,12 +281,19 @@ namespace Gamera {
       performance for separation and simplicity to be worthwhile.
     */
 
-    // helper for the iterators
+    // helper for the iterators: find the first run that ends at or
+    // after rel_pos (the runs are sorted by their end)
     template<class I>
     I find_run_in_list(I i, I end, runsize_t rel_pos) {
-      for (; i != end; ++i) {
-	if (i->end >= rel_pos)
-	  return i;
+      typename std::iterator_traits<I>::difference_type len = end - i;
+      while (len > 0) {
+	typename std::iterator_traits<I>::difference_type half = len >> 1;
+	I middle = i + half;
+	if (middle->end < rel_pos) {
+	  i = middle + 1;
+	  len = len - half - 1;
+	} else
+	  len = half;
       }
       return i;
     }
@@ -297,10 +313,9 @@ namespace Gamera {
 	m_vec = vec;
 	m_pos = pos;
 	// find the current iterator (if there is one)
-	size_t m_chunk = get_chunk(m_pos);
-	runsize_t rel_pos = get_rel_pos(m_pos);
-	m_i = find_run_in_list(m_vec->m_data[m_chunk].begin(),
-			       m_vec->m_data[m_chunk].end(), rel_pos);
+	m_chunk = get_chunk(m_pos);
+	m_i = m_vec->m_data[m_chunk].begin()
+	  + m_vec->find_run(m_chunk, get_rel_pos(m_pos));
       }
       self& operator++() {
 	m_pos++;
@@ -346,8 +361,9 @@ namespace Gamera {
       self& operator+=(size_t n) {
 	m_pos += n;
 	if (!check_chunk()) {
-	  m_i = find_run_in_list(m_vec->m_data[m_chunk].begin(),
-				 m_vec->m_data[m_chunk].end(), get_rel_pos(m_pos));
+	  m_i = m_vec->m_data[m_chunk].begin()
+	    + m_vec->find_run(m_chunk, get_rel_pos(m_pos),
+			      m_i - m_vec->m_data[m_chunk].begin());
 	}
 	return (self&)*this;
       }
@@ -364,8 +380,9 @@ namespace Gamera {
       self& operator-=(size_t n) {
 	m_pos -= n;
 	if (!check_chunk()) {
-	  m_i = find_run_in_list(m_vec->m_data[m_chunk].begin(),
-				 m_vec->m_data[m_chunk].end(), get_rel_pos(m_pos));
+	  m_i = m_vec->m_data[m_chunk].begin()
+	    + m_vec->find_run(m_chunk, get_rel_pos(m_pos),
+			      m_i - m_vec->m_data[m_chunk].begin());
 	}
 	return (self&)*this;
       }
@@ -406,8 +423,8 @@ namespace Gamera {
 	// the run list chunk each time.
 	iterator i;
 	if (m_dirty != m_vec->m_dirty)
-	  i = find_run_in_list(m_vec->m_data[m_chunk].begin(),
-			       m_vec->m_data[m_chunk].end(), get_rel_pos(m_pos));
+	  i = m_vec->m_data[m_chunk].begin()
+	    + m_vec->find_run(m_chunk, get_rel_pos(m_pos));
 	else 
 	  i = m_i;
 	if (i != m_vec->m_data[m_chunk].end())
@@ -416,8 +433,8 @@ namespace Gamera {
       }
       void set(const value_type& v) {
 	if (m_dirty != m_vec->m_dirty) {
-	  m_i = find_run_in_list(m_vec->m_data[m_chunk].begin(),
-				 m_vec->m_data[m_chunk].end(), get_rel_pos(m_pos));
+	  m_i = m_vec->m_data[m_chunk].begin()
+	    + m_vec->find_run(m_chunk, get_rel_pos(m_pos));
 	  m_dirty = m_vec->m_dirty;
 	}
 	m_vec->set(m_pos, v, m_i);
@@ -430,8 +447,8 @@ namespace Gamera {
 	    m_i = m_vec->m_data[m_chunk].end();
 	  } else {
 	    m_chunk = get_chunk(m_pos);
-	    m_i = find_run_in_list(m_vec->m_data[m_chunk].begin(),
-				   m_vec->m_data[m_chunk].end(), get_rel_pos(m_pos));
+	    m_i = m_vec->m_data[m_chunk].begin()
+	      + m_vec->find_run(m_chunk, get_rel_pos(m_pos));
 	  }
 	  m_dirty = m_vec->m_dirty;
 	  return true;
@@ -473,12 +490,12 @@ namespace Gamera {
 	// the run list chunk each time.
 	typename base::iterator i;
 	if (m_dirty != m_vec->m_dirty)
-	  i = find_run_in_list(m_vec->m_data[m_chunk].begin(),
-			       m_vec->m_data[m_chunk].end(), get_rel_pos(m_pos));
+	  i = m_vec->m_data[m_chunk].begin()
+	    + m_vec->find_run(m_chunk, get_rel_pos(m_pos));
 	else 
 	  i = m_i;
 	if (i != m_vec->m_data[m_chunk].end())
-	  return proxy_type(m_vec, m_pos, &i);
+	  return proxy_type(m_vec, m_pos, i);
 	return proxy_type(m_vec, m_pos);
       }
     };
@@ -510,8 +527,8 @@ namespace Gamera {
 	// the run list chunk each time.
 	typename base::iterator i;
 	if (m_dirty != m_vec->m_dirty)
-	  i = find_run_in_list(m_vec->m_data[m_chunk].begin(),
-			       m_vec->m_data[m_chunk].end(), get_rel_pos(m_pos));
+	  i = m_vec->m_data[m_chunk].begin()
+	    + m_vec->find_run(m_chunk, get_rel_pos(m_pos));
 	else 
 	  i = m_i;
 	if (i != m_vec->m_data[m_chunk].end()) {
@@ -539,20 +556,50 @@ namespace Gamera {
       typedef int difference_type;
 
       typedef Run<value_type> run_type;
-      typedef std::list<run_type> list_type;
+      // the runs count into the memory budget (see memory_budget.hpp)
+      typedef MemoryBudgetAllocator<run_type, memory_budget_slot<Data>::value>
+        run_allocator;
+      typedef std::vector<run_type, run_allocator> list_type;
+      typedef MemoryBudgetAllocator<list_type, memory_budget_slot<Data>::value>
+        chunk_allocator;
       typedef RleVector self;
 
       // iterators
       typedef RleVectorIterator<self> iterator;
       typedef ConstRleVectorIterator<const self> const_iterator;
 
-      RleVector(size_t size = 0) : m_size(size), m_data((size >> RLE_CHUNK_BITS) + 1), m_dirty(0) { }
+      RleVector(size_t size = 0)
+	: m_size(size), m_data((size >> RLE_CHUNK_BITS) + 1), m_dirty(0) { }
       void resize(size_t size) {
 	m_size = size;
 	m_data.resize((m_size >> RLE_CHUNK_BITS) + 1);
       }
       size_t size() const { return m_size; }
 
+      /*
+	Returns the index of the first run of chunk that ends at or
+	after rel_pos (the number of runs if there is none).  hint is
+	the index of a run of the chunk near rel_pos, if the caller
+	knows one (an iterator knows the run it is in).  That run and
+	the one after it are tried first, and otherwise only the runs
+	on the side of rel_pos are searched.
+      */
+      size_t find_run(size_t chunk, runsize_t rel_pos, size_t hint = size_t(-1)) const {
+	const list_type& runs = m_data[chunk];
+	size_t n = runs.size();
+	if (hint < n) {
+	  if (runs[hint].end >= rel_pos) {
+	    if (hint == 0 || runs[hint - 1].end < rel_pos)
+	      return hint;
+	    return find_run_in_list(runs.begin(), runs.begin() + hint, rel_pos) - runs.begin();
+	  }
+	  if (hint + 1 < n && runs[hint + 1].end >= rel_pos)
+	    return hint + 1;
+	  return find_run_in_list(runs.begin() + hint + 1, runs.end(), rel_pos) - runs.begin();
+	}
+	return find_run_in_list(runs.begin(), runs.end(), rel_pos) - runs.begin();
+      }
+
       /*
 	Return the value at the specified position.
       */
@@ -564,19 +611,16 @@ namespace Gamera {
 // 	if (m_data[chunk].empty())
 // 	  return 0;
 
-	typename list_type::const_iterator i;
-	for (i = m_data[chunk].begin(); i != m_data[chunk].end(); ++i) {
-	  if (i->end >= rel_pos)
-	    return i->value;
-	}
+	size_t i = find_run(chunk, rel_pos);
+	if (i < m_data[chunk].size())
+	  return m_data[chunk][i].value;
 	return 0;
       }
 
       reference operator[](size_t pos) {
 	size_t chunk = get_chunk(pos);
-	typename list_type::iterator i = find_run_in_list(m_data[chunk].begin(),
-							  m_data[chunk].end(),
-							  get_rel_pos(pos));
+	typename list_type::iterator i = m_data[chunk].begin()
+	  + find_run(chunk, get_rel_pos(pos));
 	if (i != m_data[chunk].end()) {
 	  return proxy_type(this, pos, i);
 	}
@@ -592,9 +636,8 @@ namespace Gamera {
 	if (m_data[chunk].empty())
 	  set(pos, v, m_data[chunk].end());
 	else {
-	  typename list_type::iterator i = find_run_in_list
-	    (m_data[chunk].begin(),
-	     m_data[chunk].end(), get_rel_pos(pos));
+	  typename list_type::iterator i = m_data[chunk].begin()
+	    + find_run(chunk, get_rel_pos(pos));
 	  set(pos, v, i);
 	}
       }
@@ -635,6 +678,57 @@ namespace Gamera {
 	}
       }
 
+      /*
+	Sets the positions start to end (inclusive) to v, where no
+	position from start on has been set yet.  This fills the vector
+	in order, run by run, without searching the run lists, e.g. when
+	decoding run-length coded files.
+      */
+      void append_run(size_t start, size_t end, value_type v) {
+	if (v == 0)
+	  return;
+	push_run(start, end, v);
+	m_dirty++;
+      }
+
+      /*
+	append_run without invalidating the iterators, for writers that
+	append many runs and invalidate the iterators once when they are
+	done (see RleBuilder).
+      */
+      void push_run(size_t start, size_t end, value_type v) {
+	assert(end < m_size);
+	while (start <= end) {
+	  size_t chunk = get_chunk(start);
+	  size_t chunk_end = std::min(end, get_global_pos(RLE_CHUNK_1, chunk));
+	  runsize_t rel_start = get_rel_pos(start);
+	  runsize_t rel_end = get_rel_pos(chunk_end);
+	  list_type& runs = m_data[chunk];
+	  if (runs.empty()) {
+	    if (rel_start > 0)
+	      runs.push_back(run_type(rel_start - 1, 0));
+	    runs.push_back(run_type(rel_end, v));
+	  } else if (rel_start - runs.back().end > 1) {
+	    runs.push_back(run_type(rel_start - 1, 0));
+	    runs.push_back(run_type(rel_end, v));
+	  } else if (runs.back().value == v) {
+	    runs.back().end = rel_end;
+	  } else {
+	    runs.push_back(run_type(rel_end, v));
+	  }
+	  start = chunk_end + 1;
+	}
+      }
+
+      /*
+	Sets every position to 0.
+      */
+      void clear() {
+	for (size_t i = 0; i < m_data.size(); ++i)
+	  m_data[i].clear();
+	m_dirty++;
+      }
+
       /*
 	Iterator access
       */
@@ -725,11 +819,12 @@ namespace Gamera {
 	  } 
 	  
 	  //// in middle of run
-	  runsize_t old_end = i->end;
+	  // (inserting invalidates i, so the run is copied first)
+	  run_type old_run = *i;
 	  i->end = rel_pos - 1;
 	  typename list_type::iterator next_i = next(i);
-	  m_data[chunk].insert(next_i, run_type(rel_pos, v));
-	  m_data[chunk].insert(next_i, run_type(old_end, i->value));
+	  next_i = m_data[chunk].insert(next_i, run_type(rel_pos, v));
+	  m_data[chunk].insert(next(next_i), old_run);
 	}
       }
       /*
@@ -787,7 +882,7 @@ namespace Gamera {
       }
     public:
       size_t m_size;
-      std::vector<list_type> m_data;
+      std::vector<list_type, chunk_allocator> m_data;
       size_t m_dirty;
     };
   } // namespace RleDataDetail
@@ -825,22 +920,18 @@ namespace Gamera {
     }
 
     /*
-      This is a little tricky and potentially expensive. The C++ standard
-      (according the www.sgi.com/tech/stl) does not garuntee that list.size()
-      is constant time - it can be O(N). So we may have to do an O(N) search
-      on a large number of lists. This also cannot be exact because we have
-      no way of determining the size of a list element (we don't know it's type).
-      We are going to assume that each list node has two pointers to Run (this
-      is what gcc does and any other sane implementation will do). This should
-      give us an idea of the size, but nothing exact.
+      The runs of each chunk are stored in a std::vector, so the memory
+      used is the run arrays (by their capacity) plus the array of
+      chunks itself and the run hint of each chunk.
     */
     virtual size_t bytes() const {
       size_t run_size = sizeof(RleDataDetail::Run<T>);
-      size_t run_ptr_size = sizeof(RleDataDetail::Run<T>*);
       size_t num_runs = 0;
       for (size_t i = 0; i < this->m_data.size(); ++i)
-	num_runs += this->m_data[i].size();
-      return num_runs * (run_size + run_ptr_size + run_ptr_size);
+	num_runs += this->m_data[i].capacity();
+      return num_runs * run_size
+	+ this->m_data.size() * (sizeof(typename RleDataDetail::RleVector<T>::list_type)
+				 + sizeof(RleDataDetail::runsize_t));
     }
     virtual double mbytes() const { return bytes() / 1048576.0; }
     virtual void dimensions(size_t rows, size_t cols) {
@@ -0,0 +1,126 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GAMERA_THREAD_EXCEPTION_HPP
+#define GAMERA_THREAD_EXCEPTION_HPP
+
+#include <exception>
+#include <stdexcept>
+#include <new>
+#include <string>
+
+namespace Gamera {
+
+  /*
+    Exceptions cannot leave the threads of an OpenMP loop.  A
+    ThreadException keeps the first one caught in the loop and throws
+    it again once the loop is done:
+
+      ThreadException error;
+      #pragma omp parallel for
+      for (long i = 0; i < n; ++i) {
+        try {
+          ...
+        } catch (...) {
+          error.keep();
+        }
+      }
+      error.rethrow();
+
+    The standard exceptions are thrown again with their own type, so
+    that an invalid_argument stays an invalid_argument; any other
+    exception becomes a runtime_error with its message.
+  */
+  class ThreadException {
+  public:
+    ThreadException() : m_type(NONE) { }
+
+    bool empty() const { return m_type == NONE; }
+    const std::string& what() const { return m_what; }
+
+    // to be called from a catch block; only the first exception is kept
+    void keep() {
+      Type type = RUNTIME_ERROR;
+      std::string what;
+      try {
+        throw;
+      } catch (std::invalid_argument& e) {
+        type = INVALID_ARGUMENT; what = e.what();
+      } catch (std::domain_error& e) {
+        type = DOMAIN_ERROR; what = e.what();
+      } catch (std::length_error& e) {
+        type = LENGTH_ERROR; what = e.what();
+      } catch (std::out_of_range& e) {
+        type = OUT_OF_RANGE; what = e.what();
+      } catch (std::logic_error& e) {
+        type = LOGIC_ERROR; what = e.what();
+      } catch (std::range_error& e) {
+        type = RANGE_ERROR; what = e.what();
+      } catch (std::overflow_error& e) {
+        type = OVERFLOW_ERROR; what = e.what();
+      } catch (std::underflow_error& e) {
+        type = UNDERFLOW_ERROR; what = e.what();
+      } catch (std::bad_alloc& e) {
+        type = BAD_ALLOC; what = e.what();
+      } catch (std::exception& e) {
+        what = e.what();
+      } catch (...) {
+        what = "Unknown exception in a thread.";
+      }
+#ifdef _OPENMP
+#pragma omp critical (gamera_thread_exception)
+#endif
+      {
+        if (m_type == NONE) {
+          m_type = type;
+          m_what = what;
+        }
+      }
+    }
+
+    // throws the kept exception, if there is one
+    void rethrow() const {
+      switch (m_type) {
+      case NONE: return;
+      case INVALID_ARGUMENT: throw std::invalid_argument(m_what);
+      case DOMAIN_ERROR: throw std::domain_error(m_what);
+      case LENGTH_ERROR: throw std::length_error(m_what);
+      case OUT_OF_RANGE: throw std::out_of_range(m_what);
+      case LOGIC_ERROR: throw std::logic_error(m_what);
+      case RANGE_ERROR: throw std::range_error(m_what);
+      case OVERFLOW_ERROR: throw std::overflow_error(m_what);
+      case UNDERFLOW_ERROR: throw std::underflow_error(m_what);
+      case BAD_ALLOC: throw std::bad_alloc();
+      default: throw std::runtime_error(m_what);
+      }
+    }
+
+  private:
+    enum Type {
+      NONE, INVALID_ARGUMENT, DOMAIN_ERROR, LENGTH_ERROR, OUT_OF_RANGE,
+      LOGIC_ERROR, RANGE_ERROR, OVERFLOW_ERROR, UNDERFLOW_ERROR, BAD_ALLOC,
+      RUNTIME_ERROR
+    };
+    Type m_type;
+    std::string m_what;
+  };
+
+}
+
+#endif
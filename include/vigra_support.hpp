@@ -432,12 +432,12 @@ namespace Gamera {
     typedef OneBitPixel value_type;
     typedef OneBitPixel VALUETYPE;
 
-    MLCCAccessor(const std::map<value_type, Rect*>* labels){
+    MLCCAccessor(const MLCCDetail::LabelMask* labels){
       m_labels=labels;
     }
     
     inline bool has_label(value_type value) const {
-      return m_labels->find(value)==m_labels->end();
+      return !m_labels->contains(value);
     }
     
     template <class ITERATOR>
@@ -486,7 +486,7 @@ namespace Gamera {
 	      }
       }
     }
-    const std::map<value_type, Rect*>* m_labels;
+    const MLCCDetail::LabelMask* m_labels;
     ImageAccessor<value_type> m_accessor;
   };
 
@@ -495,12 +495,12 @@ namespace Gamera {
     typedef OneBitPixel value_type;
     typedef OneBitPixel VALUETYPE;
 
-    RawMLCCAccessor(const std::map<value_type, Rect*>* labels){ 
+    RawMLCCAccessor(const MLCCDetail::LabelMask* labels){ 
       m_labels=labels;
     }
     
    inline bool has_label(value_type value) const {
-      return m_labels->find(value)==m_labels->end();
+      return !m_labels->contains(value);
     }
     
     template <class ITERATOR>
@@ -549,7 +549,7 @@ namespace Gamera {
 	      }
       }
     }
-    const std::map<value_type, Rect*>* m_labels;
+    const MLCCDetail::LabelMask* m_labels;
     ImageAccessor<value_type> m_accessor;
   };
 
@@ -751,6 +751,26 @@ namespace Gamera {
     }
   };
 
+  template<>
+  struct choose_accessor<OneBitPackedImageView> {
+    typedef OneBitAccessor accessor;
+    static accessor make_accessor(const OneBitPackedImageView& mat) {
+      return accessor();
+    }
+    typedef RawOneBitAccessor raw_accessor;
+    static raw_accessor make_raw_accessor(const OneBitPackedImageView& mat) {
+      return raw_accessor();
+    }
+    typedef accessor real_accessor;
+    static real_accessor make_real_accessor(const OneBitPackedImageView& mat) {
+      return real_accessor();
+    }
+    typedef BilinearInterpolatingAccessor<raw_accessor, OneBitPixel> interp_accessor;
+    static interp_accessor make_interp_accessor(const OneBitPackedImageView& mat) {
+      return interp_accessor(make_raw_accessor(mat));
+    }
+  };
+
   template<>
   struct choose_accessor<StaticImage<OneBitPixel> > {
     typedef OneBitAccessor accessor;
@@ -795,15 +815,15 @@ namespace Gamera {
   struct choose_accessor<MlCc> {
     typedef MLCCAccessor accessor;
     static accessor make_accessor(const MlCc& mat) {
-      return accessor(mat.get_labels_pointer());
+      return accessor(mat.get_label_mask());
     }
     typedef RawMLCCAccessor raw_accessor;
     static raw_accessor make_raw_accessor(const MlCc& mat) {
-      return raw_accessor(mat.get_labels_pointer());
+      return raw_accessor(mat.get_label_mask());
     }
     typedef accessor real_accessor;
     static real_accessor make_real_accessor(const MlCc& mat) {
-      return real_accessor(mat.get_labels_pointer());
+      return real_accessor(mat.get_label_mask());
     }
     typedef BilinearInterpolatingAccessor<raw_accessor, OneBitPixel> interp_accessor;
     static interp_accessor make_interp_accessor(MlCc& mat) {
@@ -940,6 +960,82 @@ namespace vigra {
     typedef RGBValue<NumericTraits<RGBPixel::value_type>::RealPromote> Promote;
   };
 
+#ifdef GAMERA_GREY16_NATIVE
+  /*
+    NumericTraits for the 16 bit Grey16 type.  The vigra algorithms compute
+    with unsigned ints, as they do with the default Grey16Pixel, and the
+    results are clipped to 16 bits.
+  */
+  template<>
+  struct NumericTraits<Grey16Pixel>
+  {
+    typedef Grey16Pixel Type;
+    typedef unsigned int Promote;
+    typedef unsigned int UnsignedPromote;
+    typedef double RealPromote;
+    typedef std::complex<RealPromote> ComplexPromote;
+    typedef Type ValueType;
+
+    typedef VigraTrueType isIntegral;
+    typedef VigraTrueType isScalar;
+    typedef VigraFalseType isSigned;
+    typedef VigraTrueType isOrdered;
+    typedef VigraFalseType isComplex;
+
+    static Grey16Pixel zero() { return 0; }
+    static Grey16Pixel one() { return 1; }
+    static Grey16Pixel nonZero() { return 1; }
+    static Grey16Pixel min() { return 0; }
+    static Grey16Pixel max() { return 65535; }
+
+    static Promote toPromote(Grey16Pixel v) { return v; }
+    static RealPromote toRealPromote(Grey16Pixel v) { return (unsigned int)v; }
+    static Grey16Pixel fromPromote(Promote v) {
+      return v > 65535 ? 65535 : v;
+    }
+    static Grey16Pixel fromRealPromote(RealPromote v) {
+      return (v < 0.0) ? 0 : ((v > 65535.0) ? 65535 : (unsigned int)(v + 0.5));
+    }
+  };
+
+  template<>
+  struct NormTraits<Grey16Pixel>
+  {
+    typedef Grey16Pixel Type;
+    typedef unsigned int SquaredNormType;
+    typedef Grey16Pixel NormType;
+  };
+
+  template<class T>
+  struct PromoteTraits<Grey16Pixel, T>
+    : public PromoteTraits<unsigned int, T> { };
+
+  template<class T>
+  struct PromoteTraits<T, Grey16Pixel>
+    : public PromoteTraits<T, unsigned int> { };
+
+  template<>
+  struct PromoteTraits<Grey16Pixel, Grey16Pixel>
+    : public PromoteTraits<unsigned int, unsigned int> { };
+
+  namespace detail {
+    // the accessors round real values, as for the built-in types
+    template<>
+    struct RequiresExplicitCast<Grey16Pixel> {
+      static Grey16Pixel cast(float v) {
+        return NumericTraits<Grey16Pixel>::fromRealPromote(v);
+      }
+      static Grey16Pixel cast(double v) {
+        return NumericTraits<Grey16Pixel>::fromRealPromote(v);
+      }
+      template<class U>
+      static Grey16Pixel cast(U v) {
+        return static_cast<Grey16Pixel>(v);
+      }
+    };
+  }
+#endif
+
 template<>
 struct NumericTraits<ComplexPixel> {
   typedef ComplexPixel Type;
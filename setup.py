@@ -41,8 +41,12 @@ cross_compiling = False
 # it is in fact the new and updated version
 gamera_version = open("version", 'r').readlines()[0].strip()
 has_openmp = None
+grey16_native = False
+float_single = False
+cpu_dispatch = True
 i = 0
-for argument in sys.argv:
+# a copy, since the options of this script are removed from sys.argv
+for argument in sys.argv[:]:
    i = i + 1
    if argument=="--dated_version":
       d = datetime.date.today()
@@ -54,7 +58,6 @@ for argument in sys.argv:
          daystring = '0' + daystring
       gamera_version = "2_nightly_%s%s%s" % (d.year, monthstring, daystring)
       sys.argv.remove(argument)
-      break
    elif argument == '--compiler=mingw32_cross':
       import mingw32_cross_compile
       sys.argv[sys.argv.index('--compiler=mingw32_cross')] = '--compiler=mingw32'
@@ -65,6 +68,15 @@ for argument in sys.argv:
    elif argument == '--openmp=no':
       has_openmp = False
       sys.argv.remove(argument)
+   elif argument == '--grey16=native':
+      grey16_native = True
+      sys.argv.remove(argument)
+   elif argument == '--float=single':
+      float_single = True
+      sys.argv.remove(argument)
+   elif argument == '--cpu-dispatch=no':
+      cpu_dispatch = False
+      sys.argv.remove(argument)
 open("gamera/__version__.py", "w").write("ver = '%s'\n\n" % gamera_version)
 print "Gamera version:", gamera_version
 
@@ -85,6 +97,18 @@ if has_openmp:
 else:
     f.write("has_openmp = False\n")
     print "Compiling genetic algorithms without parallelization (OpenMP)"
+# Grey16 pixels are stored in 16 bits instead of in an unsigned int
+f.write("grey16_native = %s\n" % grey16_native)
+if grey16_native:
+    print "Storing Grey16 pixels in 16 bits"
+# Float pixels are floats instead of doubles
+f.write("float_single = %s\n" % float_single)
+if float_single:
+    print "Storing Float pixels in single precision"
+# The vectorized kernels are compiled for AVX2 and AVX-512 as well
+f.write("cpu_dispatch = %s\n" % cpu_dispatch)
+if not cpu_dispatch:
+    print "Compiling the vectorized kernels without CPU dispatch"
 f.close()
 
 from distutils.core import setup, Extension
@@ -166,6 +190,7 @@ for entry in eodev_dir:
 
 graph_files = glob.glob("src/graph/*.cpp") + glob.glob("src/graph/graphmodule/*.cpp")
 kdtree_files = ["src/kdtreemodule.cpp", "src/geostructs/kdtree.cpp"]
+rectindex_files = ["src/rectindexmodule.cpp", "src/geostructs/rectindex.cpp"]
 
 if has_openmp:
     ExtGA = Extension("gamera.knnga",
@@ -173,16 +198,53 @@ if has_openmp:
                       include_dirs=["include", "src"] + eodev_includes,
                       libraries=["stdc++"],
                       extra_compile_args=["-Wall", "-fopenmp"],
-                      extra_link_args=["-fopenmp"]
+                      extra_link_args=["-fopenmp"],
+                      define_macros=gamera_setup.extras.get('define_macros', [])
                       )
 else:
     ExtGA = Extension("gamera.knnga",
                       ["src/knngamodule.cpp"] + eodev_files,
                       include_dirs=["include", "src"] + eodev_includes,
                       libraries=["stdc++"],
-                      extra_compile_args=["-Wall"]
+                      extra_compile_args=["-Wall"],
+                      define_macros=gamera_setup.extras.get('define_macros', [])
                       )
 
+if has_openmp:
+    knncore_extras = gamera_setup.extras.copy()
+    knncore_extras['extra_compile_args'] = \
+        gamera_setup.extras.get('extra_compile_args', []) + ["-fopenmp"]
+    knncore_extras['extra_link_args'] = \
+        gamera_setup.extras.get('extra_link_args', []) + ["-fopenmp"]
+    ExtKnn = Extension("gamera.knncore",
+                       ["src/knncoremodule.cpp"],
+                       include_dirs=["include", "src"],
+                       **knncore_extras
+                       )
+else:
+    ExtKnn = Extension("gamera.knncore",
+                       ["src/knncoremodule.cpp"],
+                       include_dirs=["include", "src"],
+                       **gamera_setup.extras
+                       )
+
+if has_openmp:
+    kdtree_extras = gamera_setup.extras.copy()
+    kdtree_extras['extra_compile_args'] = \
+        gamera_setup.extras.get('extra_compile_args', []) + ["-fopenmp"]
+    kdtree_extras['extra_link_args'] = \
+        gamera_setup.extras.get('extra_link_args', []) + ["-fopenmp"]
+else:
+    kdtree_extras = gamera_setup.extras
+
+if has_openmp:
+    graph_extras = gamera_setup.extras.copy()
+    graph_extras['extra_compile_args'] = \
+        gamera_setup.extras.get('extra_compile_args', []) + ["-fopenmp"]
+    graph_extras['extra_link_args'] = \
+        gamera_setup.extras.get('extra_link_args', []) + ["-fopenmp"]
+else:
+    graph_extras = gamera_setup.extras
 
 extensions = [Extension("gamera.gameracore",
                         ["src/gameramodule.cpp",
@@ -202,16 +264,15 @@ extensions = [Extension("gamera.gameracore",
                         include_dirs=["include"],
                         **gamera_setup.extras
                         ),
-              Extension("gamera.knncore", 
-                        ["src/knncoremodule.cpp"],
-                        include_dirs=["include", "src"],
-                        **gamera_setup.extras
-                        ),
+              ExtKnn,
               ExtGA,
               Extension("gamera.graph", graph_files,
                         include_dirs=["include", "src", "include/graph", "src/graph/graphmodule"],
-                        **gamera_setup.extras),
+                        **graph_extras),
               Extension("gamera.kdtree", kdtree_files,
+                        include_dirs=["include", "src", "include/geostructs"],
+                        **kdtree_extras),
+              Extension("gamera.rectindex", rectindex_files,
                         include_dirs=["include", "src", "include/geostructs"],
                         **gamera_setup.extras)]
 extensions.extend(plugin_extensions)
@@ -19,12 +19,14 @@
 
 #define GAMERACORE_INTERNAL
 #include "gameramodule.hpp"
+#include "object_freelist.hpp"
 
 using namespace Gamera;
 
 extern "C" {
   static PyObject* dim_new(PyTypeObject* pytype, PyObject* args,
 			    PyObject* kwds);
+  static PyObject* dim_alloc(PyTypeObject* pytype, Py_ssize_t nitems);
   static void dim_dealloc(PyObject* self);
   static int dim_set_nrows(PyObject* self, PyObject* value);
   static PyObject* dim_get_nrows(PyObject* self);
@@ -39,6 +41,8 @@ static PyTypeObject DimType = {
   0,
 };
 
+static ObjectFreeList<> dim_free_list(&DimType);
+
 static PyGetSetDef dim_getset[] = {
   { (char *)"nrows", (getter)dim_get_nrows, (setter)dim_set_nrows,
     (char *)"(int property get/set)\n\nThe current number of rows", 0},
@@ -51,6 +55,10 @@ PyTypeObject* get_DimType() {
   return &DimType;
 }
 
+static PyObject* dim_alloc(PyTypeObject* pytype, Py_ssize_t nitems) {
+  return dim_free_list.alloc(pytype, nitems);
+}
+
 static PyObject* dim_new(PyTypeObject* pytype, PyObject* args,
 			  PyObject* kwds) {
   int x, y;
@@ -58,14 +66,15 @@ static PyObject* dim_new(PyTypeObject* pytype, PyObject* args,
     return 0;
   DimObject* so;
   so = (DimObject*)pytype->tp_alloc(pytype, 0);
-  so->m_x = new Dim((size_t)x, (size_t)y);
+  so->m_x = new (so->m_value.get()) Dim((size_t)x, (size_t)y);
   return (PyObject*)so;
 }
 
 static void dim_dealloc(PyObject* self) {
   DimObject* x = (DimObject*)self;
-  delete x->m_x;
-  self->ob_type->tp_free(self);
+  if (x->m_x != x->m_value.get())
+    delete x->m_x;
+  dim_free_list.release(self);
 }
 
 #define CREATE_GET_FUNC(name) static PyObject* dim_get_##name(PyObject* self) {\
@@ -142,7 +151,7 @@ void init_DimType(PyObject* module_dict) {
   DimType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE;
   DimType.tp_new = dim_new;
   DimType.tp_getattro = PyObject_GenericGetAttr;
-  DimType.tp_alloc = NULL; // PyType_GenericAlloc;
+  DimType.tp_alloc = dim_alloc;
   DimType.tp_richcompare = dim_richcompare;
   DimType.tp_getset = dim_getset;
   DimType.tp_free = NULL; // _PyObject_Del;
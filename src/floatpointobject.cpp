@@ -19,10 +19,12 @@
 
 #define GAMERACORE_INTERNAL
 #include "gameramodule.hpp"
+#include "object_freelist.hpp"
 
 extern "C" {
   static PyObject* floatpoint_new(PyTypeObject* pytype, PyObject* args,
 				  PyObject* kwds);
+  static PyObject* floatpoint_alloc(PyTypeObject* pytype, Py_ssize_t nitems);
   static void floatpoint_dealloc(PyObject* self);
   // get/set
   static PyObject* floatpoint_get_x(PyObject* self);
@@ -48,6 +50,8 @@ static PyTypeObject FloatPointType = {
 
 static PyNumberMethods floatpoint_number_methods;
 
+static ObjectFreeList<> floatpoint_free_list(&FloatPointType);
+
 static PyGetSetDef floatpoint_getset[] = {
   { (char *)"x", (getter)floatpoint_get_x, NULL,
     (char *)"(float property)\n\nGet the current x value", 0},
@@ -66,10 +70,14 @@ PyTypeObject* get_FloatPointType() {
   return &FloatPointType;
 }
 
-static PyObject* _floatpoint_new(PyTypeObject* pytype, FloatPoint* fp) {
+static PyObject* floatpoint_alloc(PyTypeObject* pytype, Py_ssize_t nitems) {
+  return floatpoint_free_list.alloc(pytype, nitems);
+}
+
+static PyObject* _floatpoint_new(PyTypeObject* pytype, const FloatPoint& fp) {
   FloatPointObject* so;
   so = (FloatPointObject*)pytype->tp_alloc(pytype, 0);
-  so->m_x = fp;
+  so->m_x = new (so->m_value.get()) FloatPoint(fp);
   return (PyObject*)so;
 }
 
@@ -79,7 +87,7 @@ static PyObject* floatpoint_new(PyTypeObject* pytype, PyObject* args,
   if (num_args == 2) {
     double x, y;
     if (PyArg_ParseTuple(args, CHAR_PTR_CAST "dd:FloatPoint.__init__", &x, &y))
-      return _floatpoint_new(pytype, new FloatPoint(x, y));
+      return _floatpoint_new(pytype, FloatPoint(x, y));
   }
 
   PyErr_Clear();
@@ -88,7 +96,7 @@ static PyObject* floatpoint_new(PyTypeObject* pytype, PyObject* args,
     PyObject* p;
     if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &p)) {
       try {
-	return _floatpoint_new(pytype, new FloatPoint(coerce_FloatPoint(p)));
+	return _floatpoint_new(pytype, coerce_FloatPoint(p));
       } catch (std::exception e) {
 	;
       }
@@ -102,8 +110,9 @@ static PyObject* floatpoint_new(PyTypeObject* pytype, PyObject* args,
 
 static void floatpoint_dealloc(PyObject* self) {
   FloatPointObject* x = (FloatPointObject*)self;
-  delete x->m_x;
-  self->ob_type->tp_free(self);
+  if (x->m_x != x->m_value.get())
+    delete x->m_x;
+  floatpoint_free_list.release(self);
 }
 
 #define CREATE_GET_FUNC(name) static PyObject* floatpoint_get_##name(PyObject* self) {\
@@ -234,7 +243,7 @@ void init_FloatPointType(PyObject* module_dict) {
   FloatPointType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE;
   FloatPointType.tp_new = floatpoint_new;
   FloatPointType.tp_getattro = PyObject_GenericGetAttr;
-  FloatPointType.tp_alloc = NULL; // PyType_GenericAlloc;
+  FloatPointType.tp_alloc = floatpoint_alloc;
   FloatPointType.tp_richcompare = floatpoint_richcompare;
   FloatPointType.tp_getset = floatpoint_getset;
   FloatPointType.tp_free = NULL; // _PyObject_Del;
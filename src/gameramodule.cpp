@@ -45,7 +45,175 @@ extern "C" {
   DL_EXPORT(void) initgameracore(void);
 }
 
+/*
+  The memory budget (see memory_budget.hpp)
+*/
+static PyObject* memory_budget_slots(const size_t* slots) {
+  PyObject* list = PyList_New(MEMORY_BUDGET_SLOTS - 1);
+  if (list == 0)
+    return 0;
+  for (int slot = 0; slot < MEMORY_BUDGET_SLOTS - 1; ++slot)
+    PyList_SET_ITEM(list, slot, Py_BuildValue(CHAR_PTR_CAST "n", (Py_ssize_t)slots[slot]));
+  return list;
+}
+
+static PyObject* memory_usage(PyObject* self, PyObject* args) {
+  MemoryBudgetState& state = memory_budget();
+  memory_budget_lock(state);
+  MemoryBudgetState copy = state;
+  memory_budget_unlock(state);
+  return Py_BuildValue(CHAR_PTR_CAST "{sNsNsnsnsnsnsnsnsN}",
+                       "current", memory_budget_slots(copy.bytes),
+                       "peak", memory_budget_slots(copy.peak),
+                       "total", (Py_ssize_t)copy.total,
+                       "peak_total", (Py_ssize_t)copy.peak_total,
+                       "spilled", (Py_ssize_t)copy.spilled,
+                       "spills", (Py_ssize_t)copy.spills,
+                       "over_limit", (Py_ssize_t)copy.over_limit,
+                       "limit", (Py_ssize_t)copy.limit,
+                       "spill", PyBool_FromLong(copy.spill));
+}
+
+static PyObject* set_memory_limit(PyObject* self, PyObject* args) {
+  double mbytes;
+  int spill = 0;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "d|i:set_memory_limit", &mbytes, &spill) <= 0)
+    return 0;
+  if (mbytes < 0) {
+    PyErr_SetString(PyExc_ValueError, "The memory limit can not be negative.");
+    return 0;
+  }
+  MemoryBudgetState& state = memory_budget();
+  memory_budget_lock(state);
+  state.limit = size_t(mbytes * 1048576.0);
+  state.spill = spill != 0;
+  memory_budget_unlock(state);
+  memory_budget_enforce();
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* spill_images(PyObject* self, PyObject* args) {
+  return Py_BuildValue(CHAR_PTR_CAST "n", (Py_ssize_t)memory_budget_enforce(true));
+}
+
+static PyObject* reset_memory_peak(PyObject* self, PyObject* args) {
+  MemoryBudgetState& state = memory_budget();
+  memory_budget_lock(state);
+  std::copy(state.bytes, state.bytes + MEMORY_BUDGET_SLOTS, state.peak);
+  state.peak_total = state.total;
+  state.over_limit = 0;
+  memory_budget_unlock(state);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+/*
+  The buffer pool (see buffer_pool.hpp)
+*/
+static PyObject* buffer_pool_usage(PyObject* self, PyObject* args) {
+  BufferPoolState& state = buffer_pool_state();
+  buffer_pool_lock(state);
+  if (!state.initialized)
+    buffer_pool_init(state);
+  BufferPoolState copy = state;
+  buffer_pool_unlock(state);
+  return Py_BuildValue(CHAR_PTR_CAST "{snsnsn}",
+                       "bytes", (Py_ssize_t)copy.bytes,
+                       "buffers", (Py_ssize_t)copy.nbuffers,
+                       "limit", (Py_ssize_t)copy.max_bytes);
+}
+
+static PyObject* set_buffer_pool_limit(PyObject* self, PyObject* args) {
+  double mbytes;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "d:set_buffer_pool_limit", &mbytes) <= 0)
+    return 0;
+  if (mbytes < 0) {
+    PyErr_SetString(PyExc_ValueError, "The buffer pool limit can not be negative.");
+    return 0;
+  }
+  buffer_pool_set_limit(size_t(mbytes * 1048576.0));
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* clear_buffer_pool(PyObject* self, PyObject* args) {
+  buffer_pool_clear();
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+/*
+  The CPU dispatch (see cpu_dispatch.hpp)
+*/
+static PyObject* cpu_dispatch_report(PyObject* self, PyObject* args) {
+  CpuDispatchState& state = cpu_dispatch();
+  PyObject* kernels = PyDict_New();
+  if (kernels == 0)
+    return 0;
+  spin_lock(state.lock);
+  CpuDispatchState copy = state;
+  spin_unlock(state.lock);
+  for (size_t i = 0; i < copy.nkernels; ++i) {
+    PyObject* variant = PyString_FromString(cpu_level_name(copy.levels[i]));
+    if (variant == 0 || PyDict_SetItemString(kernels, copy.names[i], variant) < 0) {
+      Py_XDECREF(variant);
+      Py_DECREF(kernels);
+      return 0;
+    }
+    Py_DECREF(variant);
+  }
+  return Py_BuildValue(CHAR_PTR_CAST "{sssssN}",
+                       "cpu", cpu_level_name(cpu_detect_level()),
+                       "level", cpu_level_name(copy.level),
+                       "kernels", kernels);
+}
+
 PyMethodDef gamera_module_methods[] = {
+  { CHAR_PTR_CAST "memory_usage", memory_usage, METH_NOARGS,
+    CHAR_PTR_CAST "memory_usage()\n\n"
+    "The memory held by the pixels of all images, as a dictionary with the "
+    "bytes held now (*current*) and the most ever held at once (*peak*) per "
+    "pixel type, as lists indexed by the pixel type, the *total* and "
+    "*peak_total* bytes of all types, the bytes of pixels *spilled* to "
+    "temporary files and the number of *spills*, the memory *limit* in bytes "
+    "(0 for none), whether images are spilled over the limit (*spill*), and "
+    "the number of allocations that went *over_limit*." },
+  { CHAR_PTR_CAST "set_memory_limit", set_memory_limit, METH_VARARGS,
+    CHAR_PTR_CAST "set_memory_limit(mbytes, spill=False)\n\n"
+    "Sets the soft limit on the memory held by the pixels of all images, in "
+    "megabytes (0 for none).  When *spill* is true, the images that were not "
+    "used for the longest time have their pixels spilled to temporary files "
+    "whenever more than the limit is held in memory." },
+  { CHAR_PTR_CAST "spill_images", spill_images, METH_NOARGS,
+    CHAR_PTR_CAST "spill_images()\n\n"
+    "Spills the pixels of all images that can be spilled now, returning the "
+    "number of bytes spilled." },
+  { CHAR_PTR_CAST "reset_memory_peak", reset_memory_peak, METH_NOARGS,
+    CHAR_PTR_CAST "reset_memory_peak()\n\n"
+    "Starts the peaks of memory_usage (and its count of allocations over the "
+    "limit) over from the memory held now." },
+  { CHAR_PTR_CAST "buffer_pool_usage", buffer_pool_usage, METH_NOARGS,
+    CHAR_PTR_CAST "buffer_pool_usage()\n\n"
+    "The freed pixel buffers kept for new images, as a dictionary with the "
+    "*bytes* and the number of *buffers* kept, and the most bytes that are "
+    "kept (*limit*)." },
+  { CHAR_PTR_CAST "set_buffer_pool_limit", set_buffer_pool_limit, METH_VARARGS,
+    CHAR_PTR_CAST "set_buffer_pool_limit(mbytes)\n\n"
+    "Sets the most megabytes of freed pixel buffers that are kept for new "
+    "images (0 gives back all of them at once), freeing the buffers that no "
+    "longer fit." },
+  { CHAR_PTR_CAST "clear_buffer_pool", clear_buffer_pool, METH_NOARGS,
+    CHAR_PTR_CAST "clear_buffer_pool()\n\n"
+    "Gives the freed pixel buffers that are kept for new images back to the "
+    "system." },
+  { CHAR_PTR_CAST "cpu_dispatch", cpu_dispatch_report, METH_NOARGS,
+    CHAR_PTR_CAST "cpu_dispatch()\n\n"
+    "The vectorized kernels chosen for the CPU, as a dictionary with the best "
+    "instruction set of the *cpu* (``generic``, ``avx2`` or ``avx512``), the "
+    "*level* the kernels are chosen for (which the environment variable "
+    "GAMERA_CPU_DISPATCH can lower), and the variant of each of the *kernels* "
+    "that was used so far, by name." },
   {NULL, NULL },
 };
 
@@ -53,6 +221,18 @@ DL_EXPORT(void)
 initgameracore(void) {
   PyObject* m = Py_InitModule(CHAR_PTR_CAST "gameracore", gamera_module_methods);
   PyObject* d = PyModule_GetDict(m);
+  // for memory_budget_attach
+  PyObject* budget = PyCObject_FromVoidPtr((void*)&memory_budget(), 0);
+  PyDict_SetItemString(d, "_memory_budget", budget);
+  Py_DECREF(budget);
+  // for cpu_dispatch_attach
+  PyObject* dispatch = PyCObject_FromVoidPtr((void*)&cpu_dispatch(), 0);
+  PyDict_SetItemString(d, "_cpu_dispatch", dispatch);
+  Py_DECREF(dispatch);
+  // for buffer_pool_attach
+  PyObject* pool = PyCObject_FromVoidPtr((void*)&buffer_pool_state(), 0);
+  PyDict_SetItemString(d, "_buffer_pool", pool);
+  Py_DECREF(pool);
 
   init_SizeType(d);
   init_PointType(d);
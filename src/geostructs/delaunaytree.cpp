@@ -1,10 +1,6 @@
 //
 // Copyright (C) 2010-2012 Oliver Christen, Christoph Dalitz
 //
-// This code is based on the Delaunay_Tree implementation
-// http://people.sc.fsu.edu/~burkardt/cpp_src/delaunay_tree_2d/
-// with the kind permission by Olivier Devillers.
-//
 // This program is free software; you can redistribute it and/or
 // modify it under the terms of the GNU General Public License
 // as published by the Free Software Foundation; either version 2
@@ -30,6 +26,7 @@
 #include "geostructs/delaunaytree.hpp"
 #include <math.h>
 #include <stdio.h>
+#include <algorithm>
 
 //-------------------------------------------------------------------------
 // data structure for computing the two dimensional Delaunay triangulation
@@ -37,16 +34,8 @@
 
 namespace Gamera { namespace Delaunaytree {
 
-  // are three points collinear?
-  inline bool three_points_collinear(Vertex* v1, Vertex* v2, Vertex* v3) {
-    // in DIA applications, the coordinates are typically integers
-    // => we may compare to a hard coded epsilon
-    return fabs(
-                v1->getX() * (v2->getY() - v3->getY()) +
-                v2->getX() * (v3->getY() - v1->getY()) +
-                v3->getX() * (v1->getY() - v2->getY())
-                ) < 1.0e-07F;
-  }
+  // the vertex index of the point at infinity
+  const int INF = -1;
 
   // Vertex
   Vertex::Vertex(double x, double y) {
@@ -89,526 +78,414 @@ namespace Gamera { namespace Delaunaytree {
     return a.x * b.y - a.y * b.x;
   }
 
-  //TriangleFlag
-  TriangleFlag::TriangleFlag() {
-    this->flag = 0;
-  }
-
-  void TriangleFlag::kill() {
-    this->flag |= 16;
-  }
-
-  bool TriangleFlag::isDead() {
-    return this->flag & 16;
-  }
-
-  void TriangleFlag::setInfinite(int i) {
-    this->flag |= i;
-  }
-
-  int TriangleFlag::isInfinite() {
-    return this->flag & 7;
-  }
-
-  void TriangleFlag::setLastFinite() {
-    this->flag |= 8;
-  }
-
-  bool TriangleFlag::isLastFinite() {
-    return this->flag & 8;
-  }
-
-  int TriangleFlag::getFlag() {
-    return flag;
+  //-------------------------------------------------------------------------
+  // insertion order
+  //-------------------------------------------------------------------------
+
+  // position of the grid point (x,y) on a Hilbert curve through
+  // the n x n grid, where n is a power of two
+  inline unsigned int hilbert_key(unsigned int n, unsigned int x, unsigned int y) {
+    unsigned int rx, ry, s, t, d = 0;
+    for (s = n/2; s > 0; s /= 2) {
+      rx = (x & s) > 0;
+      ry = (y & s) > 0;
+      d += s * s * ((3 * rx) ^ ry);
+      if (ry == 0) {
+        if (rx == 1) {
+          x = n - 1 - x;
+          y = n - 1 - y;
+        }
+        t = x; x = y; y = t;
+      }
+    }
+    return d;
   }
 
-  // TriangleList
-  TriangleList::TriangleList(TriangleList *list, Triangle *triangle) {
-    this->next = list;
-    this->triangle = triangle;
+  // pseudo random numbers that are the same on all platforms,
+  // so that the insertion order does not depend on rand()
+  inline unsigned int next_random(unsigned int *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return (*seed >> 16) & 0x7fff;
   }
 
-  TriangleList::~TriangleList() {
-    if(next) {
-		delete next;
-		next = NULL;
-		triangle = NULL;
+  // Biased randomized insertion order (N. Amenta, S. Choi, G. Rote:
+  // Incremental constructions con BRIO. Proc. 19th Symposium on
+  // Computational Geometry, pp. 211-219, 2003): the shuffled points are
+  // split into rounds, each twice as large as the previous one, and each
+  // round is sorted along a Hilbert curve.
+  void brio_order(std::vector<Vertex*> *order) {
+    size_t i, n = order->size();
+    if (n < 2)
+      return;
+    unsigned int seed = 0x9e3779b9u;
+    for (i = n - 1; i > 0; --i) {
+      size_t j = ((size_t)next_random(&seed) << 15 | next_random(&seed)) % (i + 1);
+      std::swap((*order)[i], (*order)[j]);
     }
-  }
 
-  Triangle * TriangleList::getTriangle() {
-    return this->triangle;
-  }
+    double minx = (*order)[0]->getX(), maxx = minx;
+    double miny = (*order)[0]->getY(), maxy = miny;
+    for (i = 1; i < n; ++i) {
+      minx = std::min(minx, (*order)[i]->getX());
+      maxx = std::max(maxx, (*order)[i]->getX());
+      miny = std::min(miny, (*order)[i]->getY());
+      maxy = std::max(maxy, (*order)[i]->getY());
+    }
+    const unsigned int gridsize = 1u << 16;
+    double scale = (gridsize - 1) / std::max(std::max(maxx - minx, maxy - miny), 1.0);
+    std::vector<std::pair<unsigned int, Vertex*> > keys(n);
+    for (i = 0; i < n; ++i) {
+      Vertex *v = (*order)[i];
+      keys[i].first = hilbert_key(gridsize,
+                                  (unsigned int)((v->getX() - minx) * scale),
+                                  (unsigned int)((v->getY() - miny) * scale));
+      keys[i].second = v;
+    }
 
-  TriangleList * TriangleList::getNext() {
-    return this->next;
+    size_t begin, end = n;
+    while (end > 0) {
+      begin = (end > 64) ? end / 2 : 0;
+      std::sort(keys.begin() + begin, keys.begin() + end);
+      end = begin;
+    }
+    for (i = 0; i < n; ++i)
+      (*order)[i] = keys[i].second;
   }
 
+  //-------------------------------------------------------------------------
   // DelaunayTree
+  //-------------------------------------------------------------------------
+
   DelaunayTree::DelaunayTree() {
-    this->number = 0;
-    this->root = new Triangle(this);
-	
-    new Triangle(this, root, 0);
-    new Triangle(this, root, 1);
-    new Triangle(this, root, 2);
-	
-    this->root->getNeighbor(0)->setNeighbor(1, this->root->getNeighbor(1));
-    this->root->getNeighbor(0)->setNeighbor(2, this->root->getNeighbor(2));
-    this->root->getNeighbor(1)->setNeighbor(0, this->root->getNeighbor(0));
-    this->root->getNeighbor(1)->setNeighbor(2, this->root->getNeighbor(2));
-    this->root->getNeighbor(2)->setNeighbor(0, this->root->getNeighbor(0));
-    this->root->getNeighbor(2)->setNeighbor(1, this->root->getNeighbor(1));
+    this->last = -1;
+    this->mark = 0;
+    this->seed = 1;
+    this->infstartlink = this->infendlink = -1;
   }
 
   DelaunayTree::~DelaunayTree() {
+  }
 
-    delete root->getVertex(0);
-    delete root->getVertex(1);
-    delete root->getVertex(2);
-
-    std::vector<Triangle*>::iterator it;
-	
-    for( it = triangles.begin() ; it != triangles.end() ; ++it ) {
-		delete *it;
+  int DelaunayTree::newVertex(Vertex *v) {
+    vertices.push_back(v);
+    coords.push_back(v->getX());
+    coords.push_back(v->getY());
+    startlink.push_back(-1);
+    endlink.push_back(-1);
+    return (int)vertices.size() - 1;
+  }
+
+  // returns the index of an unused triangle, preferably one freed
+  // by an earlier insertion
+  int DelaunayTree::newTriangle() {
+    int t;
+    if (freetriangles.empty()) {
+      t = (int)triangles.size();
+      triangles.push_back(Triangle());
+    } else {
+      t = freetriangles.back();
+      freetriangles.pop_back();
+    }
+    triangles[t].mark = 0;
+    triangles[t].dead = false;
+    return t;
+  }
+
+  // orientation of the point p with respect to the line a->b:
+  // positive when p is left of the line, zero when collinear
+  inline double DelaunayTree::orientation(int a, int b, int p) {
+    const double *A = &coords[2*a], *B = &coords[2*b], *P = &coords[2*p];
+    return (B[0] - A[0]) * (P[1] - A[1]) - (B[1] - A[1]) * (P[0] - A[0]);
+  }
+
+  // is the point p inside the circumcircle of triangle t?
+  // For a ghost triangle, this means that p is outside the convex hull
+  // beyond the hull edge of t, or on the hull edge itself.
+  bool DelaunayTree::conflict(int t, int p) {
+    const int *v = triangles[t].vertex;
+    int k = (v[0] == INF) ? 0 : ((v[1] == INF) ? 1 : ((v[2] == INF) ? 2 : -1));
+    const double *P = &coords[2*p];
+
+    if (k >= 0) {
+      int a = v[(k+1) % 3];
+      int b = v[(k+2) % 3];
+      double o = orientation(a, b, p);
+      if (o != 0.0)
+        return (o > 0.0);
+      const double *A = &coords[2*a], *B = &coords[2*b];
+      return ((P[0] - A[0]) * (B[0] - P[0]) + (P[1] - A[1]) * (B[1] - P[1]) > 0.0);
     }
-  }
 
-  void DelaunayTree::appendTriangle(Triangle *t) {
-    this->triangles.push_back(t);
-  }
+    // in DIA applications, the coordinates are typically integers
+    // => the determinant is exact when computed relative to p
+    double ax = coords[2*v[0]] - P[0], ay = coords[2*v[0]+1] - P[1];
+    double bx = coords[2*v[1]] - P[0], by = coords[2*v[1]+1] - P[1];
+    double cx = coords[2*v[2]] - P[0], cy = coords[2*v[2]+1] - P[1];
+    return ((ax*ax + ay*ay) * (bx*cy - cx*by)
+            + (bx*bx + by*by) * (cx*ay - ax*cy)
+            + (cx*cx + cy*cy) * (ax*by - bx*ay) > 0.0);
+  }
+
+  // sets up the first triangle from three non collinear vertices
+  // and its three ghost triangles
+  void DelaunayTree::createFirstTriangle(int a, int b, int c) {
+    if (orientation(a, b, c) < 0.0)
+      std::swap(b, c);
+    int t = newTriangle();
+    int ga = newTriangle(), gb = newTriangle(), gc = newTriangle();
+    Triangle *T;
+
+    T = &triangles[t];
+    T->vertex[0] = a; T->vertex[1] = b; T->vertex[2] = c;
+    T->neighbor[0] = ga; T->neighbor[1] = gb; T->neighbor[2] = gc;
+
+    // the ghost triangle (x,y,INF) has the neighbors (ghost starting
+    // at y, ghost ending at x, finite triangle)
+    T = &triangles[ga];
+    T->vertex[0] = c; T->vertex[1] = b; T->vertex[2] = INF;
+    T->neighbor[0] = gc; T->neighbor[1] = gb; T->neighbor[2] = t;
+    T = &triangles[gb];
+    T->vertex[0] = a; T->vertex[1] = c; T->vertex[2] = INF;
+    T->neighbor[0] = ga; T->neighbor[1] = gc; T->neighbor[2] = t;
+    T = &triangles[gc];
+    T->vertex[0] = b; T->vertex[1] = a; T->vertex[2] = INF;
+    T->neighbor[0] = gb; T->neighbor[1] = ga; T->neighbor[2] = t;
+
+    last = t;
+  }
+
+  // returns a triangle in conflict with the point p by walking
+  // from the last created triangle towards p
+  int DelaunayTree::locate(int p) {
+    int i, j, t = last;
+    const int *v = triangles[t].vertex;
+
+    if (v[0] == INF || v[1] == INF || v[2] == INF) {
+      i = (v[0] == INF) ? 0 : ((v[1] == INF) ? 1 : 2);
+      t = triangles[t].neighbor[i];
+    }
 
-  void DelaunayTree::addVertex(Vertex *v) {
-    Triangle *n, *first, *last, *created;
-    Vertex *q, *r;
-    int i;
-	
-    this->root->setNumber( ++this->number );
-	
-    n = this->root->findConflict(v);
-    if(!n) {
-		return;
+    while (true) {
+      v = triangles[t].vertex;
+      if (v[0] == INF || v[1] == INF || v[2] == INF) {
+        // we have left the convex hull across the edge of this ghost
+        return t;
+      }
+      // the start edge is chosen randomly, so that the walk cannot cycle
+      int start = next_random(&seed) % 3;
+      for (j = 0; j < 3; ++j) {
+        i = (start + j) % 3;
+        if (orientation(v[(i+1) % 3], v[(i+2) % 3], p) < 0.0)
+          break;
+      }
+      if (j == 3)
+        break;
+      t = triangles[t].neighbor[i];
     }
-	
-    n->getFlag()->kill();
-	
-    for(i = 0; i < (3 - n->getFlag()->isInfinite()); ++i) {
-      if( ( v->getX() == n->getVertex(i)->getX() )
-          && ( v->getY() == n->getVertex(i)->getY() ) ) {
+
+    // p is inside or on the border of t
+    for (i = 0; i < 3; ++i) {
+      if (coords[2*v[i]] == coords[2*p] && coords[2*v[i]+1] == coords[2*p+1]) {
         char msg[64];
-        sprintf(msg, "point (%.1f,%.1f) is already inserted", v->getX(), v->getY());
+        sprintf(msg, "point (%.1f,%.1f) is already inserted", coords[2*p], coords[2*p+1]);
         throw std::runtime_error(msg);
       }
     }
-	
-    q = n->getVertex(0);
-    while( n->getNeighbor( i = n->cwNeighbor(q) )->Conflict(v) ) {
-  	n = n->getNeighbor(i);
-  	n->getFlag()->kill();
-    }
-  
-    first = last = new Triangle(this, n, v, i);
-  
-    r = n->getVertex((i+2) % 3);
-  
-    while(true) {
-  	i = n->cwNeighbor(r);
-  	if(n->getNeighbor(i)->getFlag()->isDead()) {
-        n = n->getNeighbor(i);
-        continue;
-  	}
-  	
-  	if(n->getNeighbor(i)->Conflict(v)) {
-        n = n->getNeighbor(i);
-        n->getFlag()->kill();
-        continue;
-  	}
-  	
-  	break;
-    }
-  
-    while(true) {
-  	created = new Triangle(this, n, v, i);
-  	created->setNeighbor(2, last);
-  	last->setNeighbor(1, created);
-  	last = created;
-  	r = n->getVertex((i+2) % 3);
-  	
-  	if(r==q)  {
-        break;
-		}
-		
-		while(true) {
-        i = n->cwNeighbor(r);
-        if(n->getNeighbor(i)->getFlag()->isDead()) {
-          n = n->getNeighbor(i);
+    return t;
+  }
+
+  // Bowyer-Watson insertion: removes all triangles in conflict with p
+  // and connects p to the border of the resulting cavity
+  void DelaunayTree::insert(int p) {
+    int i, t, n, a, b;
+    size_t k;
+
+    t = locate(p);
+    ++mark;
+    cavity.clear();
+    created.clear();
+    triangles[t].mark = mark;
+    cavity.push_back(t);
+
+    for (k = 0; k < cavity.size(); ++k) {
+      t = cavity[k];
+      for (i = 0; i < 3; ++i) {
+        n = triangles[t].neighbor[i];
+        if (triangles[n].mark == mark)
           continue;
-        }
-  	
-        if(n->getNeighbor(i)->Conflict(v)) {
-          n = n->getNeighbor(i);
-          n->getFlag()->kill();
+        if (conflict(n, p)) {
+          triangles[n].mark = mark;
+          cavity.push_back(n);
           continue;
         }
-  
-        break;
-  	}
-    }
-  
-    first->setNeighbor(2, last);
-    last->setNeighbor(1, first);
-    return;
-  }
-	
-  void DelaunayTree::addVertices(std::vector<Vertex*> *vertices) {
-    std::vector<Vertex*>::iterator it;
-    unsigned int i;
-
-    // randomization commented out, to avoid unexpected changes to input
-    // argument => input data should be randomized beforehand by caller
-    // //random_shuffle(vertices->begin(), vertices->end());
-
-    // to avoid an infinite loop while adding the first three points,
-    // we must make sure that these are not colliner
-    if( three_points_collinear((*vertices)[0], (*vertices)[1], (*vertices)[2]) ) {
-			
-      if(vertices->size() == 3) {
-        throw std::runtime_error("all points are collinear");
-      }
-			
-      this->addVertex((*vertices)[0]);
-      this->addVertex((*vertices)[1]);
-			
-      i = 3;
-			
-      // find next non collinear point
-      while( three_points_collinear((*vertices)[0], (*vertices)[1], (*vertices)[i] )) {
-        i++;
-        if(i == vertices->size()) {
-          throw std::runtime_error("all points are collinear");
-        }
-      }
-      // insert points beginning at first non collinear point
-      for(it = vertices->begin() + i; it != vertices->end() ; ++it) {
-        this->addVertex(*it);
-      }
-	  // insert skipped points
-      for(it = vertices->begin() + 2; it != vertices->begin() + i ; ++it) {
-        this->addVertex(*it);
-      }
-    }
-    // when the first three points are not collinear,
-    // we can insert all points sequentially
-    else {
-      for (it = vertices->begin(); it != vertices->end(); ++it) {
-        this->addVertex(*it);
+        // border edge a->b of the cavity
+        a = triangles[t].vertex[(i+1) % 3];
+        b = triangles[t].vertex[(i+2) % 3];
+        int c = newTriangle();
+        Triangle *C = &triangles[c];
+        C->vertex[0] = p; C->vertex[1] = a; C->vertex[2] = b;
+        C->neighbor[0] = n;
+        Triangle *N = &triangles[n];
+        N->neighbor[(N->neighbor[0] == t) ? 0 : ((N->neighbor[1] == t) ? 1 : 2)] = c;
+        if (a == INF) infstartlink = c; else startlink[a] = c;
+        if (b == INF) infendlink = c; else endlink[b] = c;
+        created.push_back(c);
       }
     }
-  }
-
-  // returns all neighboring vertices as a map vertex->{neighbor1, ...}
-  // every neighbor pair is only listed once in the set for the smaller vertex*
-  void DelaunayTree::neighboringVertices(std::map<Vertex*,std::set<Vertex*> > *vertexmap) {
-  	root->setNumber(++number); // termination criterium
-    root->neighboringVertices(vertexmap);
-  }
-  // returns all neighboring labels as a map label->{neighbor1, ...}
-  // every neighbor pair is only listed once in the set for the smaller label
-  void DelaunayTree::neighboringLabels(std::map<int,std::set<int> > *labelmap) {
-    root->setNumber(++number); // termination criterium
-    root->neighboringLabels(labelmap);
-  }
-
-  void DelaunayTree::getTriangles(std::list< std::vector<Vertex*>* > *triangles) {
-    root->setNumber(++number); // termination criterium
-    root->getTriangles(triangles);
-  }
-
-  // Triangle
-  Triangle::Triangle(DelaunayTree *tree) {
-    tree->appendTriangle(this);
-	
-    this->vertices[0] = new Vertex(1.0, 0.0);
-    this->vertices[1] = new Vertex(-0.5, 0.8660254);
-    this->vertices[2] = new Vertex(-0.5, -0.8660254);
-	
-    this->flag.setInfinite(3);
-    this->number = 0;
-    this->sons = NULL;
-  }
 
-  Triangle::Triangle(DelaunayTree *tree, Triangle *parent, int i) {
-    tree->appendTriangle(this);
-	
-    this->vertices[0] = parent->vertices[0];
-    this->vertices[1] = parent->vertices[1];
-    this->vertices[2] = parent->vertices[2];
-	
-    this->flag.setInfinite(4);
-    this->number = 0;
-    this->sons = NULL;
-	
-    this->neighbors[i] = parent;
-    parent->neighbors[i] = this;
-  }
-
-  Triangle::Triangle(DelaunayTree *tree, Triangle *parent, Vertex *v, int i) {
-    tree->appendTriangle(this);
-	
-    switch( parent->flag.isInfinite() ) {
-    case 0:
-		flag.setInfinite(0);
-		break;
-    case 1:
-		if( parent->flag.isLastFinite() ) {
-        flag.setInfinite( (i==1) ? 0 : 1 );
-		} else {
-        flag.setInfinite( (i==2) ? 0 : 1 );
-		}
-		
-		if(flag.isInfinite()) {
-        if(parent->flag.isLastFinite()) {
-          if(i==0) { flag.setLastFinite(); }
-        } else {
-          if(i==1) { flag.setLastFinite(); }
-        }
-		}
-		break;
-		
-    case 2:
-		flag.setInfinite( (i==0 ) ? 2 : 1);
-		if(i==1) { flag.setLastFinite(); }
-		break;
-    case 3:
-		flag.setInfinite(2);
-		break;
+    // the border of the cavity is a simple cycle, so that every border
+    // vertex starts one edge and ends another
+    for (k = 0; k < created.size(); ++k) {
+      Triangle *C = &triangles[created[k]];
+      a = C->vertex[1];
+      b = C->vertex[2];
+      C->neighbor[1] = (b == INF) ? infstartlink : startlink[b];
+      C->neighbor[2] = (a == INF) ? infendlink : endlink[a];
     }
-	
-    number = 0;
-    sons = NULL;
-    parent->sons = new TriangleList( parent->sons, this );
-    parent->neighbors[i]->sons = new TriangleList(parent->neighbors[i]->sons, this);
-    parent->neighbors[i]->neighbors[ parent->neighbors[i]->NeighborIndex(parent) ] = this;
-    vertices[0] = v;
-    neighbors[0] = parent->neighbors[i];
-	
-    switch(i) {
-    case 0:
-		vertices[1] = parent->vertices[1];
-		vertices[2] = parent->vertices[2];
-		break;
-	
-    case 1:
-		vertices[1] = parent->vertices[2];
-		vertices[2] = parent->vertices[0];
-		break;
-	
-    case 2:
-		vertices[1] = parent->vertices[0];
-		vertices[2] = parent->vertices[1];
-		break;
-    }
-  }
 
-  Triangle::~Triangle() {
-    if(sons) {
-		delete sons;
+    for (k = 0; k < cavity.size(); ++k) {
+      triangles[cavity[k]].dead = true;
+      freetriangles.push_back(cavity[k]);
     }
+    last = created[0];
   }
 
-  Triangle * Triangle::findConflict(Vertex *v) {
-    if( !Conflict(v) ) {
-		return NULL;
-    }
-	
-    if(!flag.isDead()) {
-		return this;
-    }
-	
-    for(TriangleList *l = sons ; l ; l = l->getNext()) {
-		if( l->getTriangle()->number != this->number ) {
-        l->getTriangle()->number = this->number;
-        Triangle *n = l->getTriangle()->findConflict(v);
-        if(n) {
-          return n;
-        }
-		}
-    }
-	
-    return NULL;
-  }
+  void DelaunayTree::addVertex(Vertex *v) {
+    size_t i;
 
-  bool Triangle::Conflict(Vertex *v) {
-    switch( this->flag.isInfinite() ) {
-    case 4:
-		return false;
-    case 3:
-		return true;
-    case 2:
-		return ( ( *v - *vertices[0]  ) * ( *vertices[1] + *vertices[2] ) >= 0 );
-    case 1:
-		if( this->flag.isLastFinite() ) {
-        return (  (( *v - *vertices[2] ) ^ ( *vertices[2] - *vertices[0] )) >= 0 );
-		} else {
-        return (  (( *v - *vertices[0] ) ^ ( *vertices[0] - *vertices[1] )) >= 0 );
-		}
-    case 0:
-		double x = v->getX();
-      double y = v->getY();
-      
-      double x0 = vertices[0]->getX();
-      double y0 = vertices[0]->getY();
-      double x1 = vertices[1]->getX();
-      double y1 = vertices[1]->getY();
-      double x2 = vertices[2]->getX();
-      double y2 = vertices[2]->getY();
-      
-      x1 -= x0;
-      y1 -= y0;
-      x2 -= x0;
-      y2 -= y0;
-      x -= x0;
-      y -= y0;
-      
-      double z1 = (x1*x1)+(y1*y1);
-      double z2 = (x2*x2)+(y2*y2);
-      
-      double alpha = (y1*z2)-(z1*y2);
-      double beta = (x2*z1)-(x1*z2);
-      double gamma = (x1*y2)-(y1*x2);
-      
-      return ((alpha*x)+(beta*y)+gamma*((x*x)+(y*y)) <= 0);
+    if (!triangles.empty()) {
+      insert(newVertex(v));
+      return;
     }
-	
-    return false;
-  }
-
-  int Triangle::NeighborIndex(Triangle *t) {
-    return ( (this->neighbors[0] == t) ? 0 : ( (this->neighbors[1] == t) ? 1 : 2) );
-  }
-
-  int Triangle::cwNeighbor(Vertex *v) {
-    return ( (v == this->vertices[0]) ? 2 : ( (v == vertices[1]) ? 0 : 1) );
-  }
 
-  TriangleFlag * Triangle::getFlag() {
-    return &this->flag;
-  }
-
-  Vertex * Triangle::getVertex(int i) {
-    return this->vertices[i];
-  }
-
-  void Triangle::setNeighbor(int i, Triangle *t) {
-    this->neighbors[i] = t;
-  }
-
-  Triangle * Triangle::getNeighbor(int i) {
-    return this->neighbors[i];
-  }
-
-  void Triangle::setNumber(int i) {
-    this->number = i;
-  }
+    // no triangle yet: wait for three non collinear points
+    for (i = 0; i < pending.size(); ++i) {
+      if (pending[i]->getX() == v->getX() && pending[i]->getY() == v->getY()) {
+        char msg[64];
+        sprintf(msg, "point (%.1f,%.1f) is already inserted", v->getX(), v->getY());
+        throw std::runtime_error(msg);
+      }
+    }
+    pending.push_back(v);
+    if (pending.size() < 3)
+      return;
+    Vertex *v0 = pending[0], *v1 = pending[1], *v2 = pending.back();
+    if (((*v1 - *v0) ^ (*v2 - *v0)) == 0.0)
+      return;
 
-  int Triangle::getNumber() {
-    return this->number;
+    int a = newVertex(v0), b = newVertex(v1), c = newVertex(v2);
+    createFirstTriangle(a, b, c);
+    for (i = 2; i + 1 < pending.size(); ++i)
+      insert(newVertex(pending[i]));
+    pending.clear();
   }
+	
+  void DelaunayTree::addVertices(std::vector<Vertex*> *vertices) {
+    std::vector<Vertex*> order(*vertices);
+    std::vector<Vertex*>::iterator it;
 
-  // adds the labels of neighboring vertices into the neighbors map
-  void Triangle::neighboringLabels(std::map<int,std::set<int> > *allneighbors) {
-    if( flag.isDead() ) {
-      for( TriangleList *l = sons; l ; l = l->getNext() ) {
-        if( l->getTriangle()->number != number ) {
-          l->getTriangle()->number = number;
-          l->getTriangle()->neighboringLabels(allneighbors);
-        }
-      }
-      return;
+    brio_order(&order);
+    this->vertices.reserve(this->vertices.size() + order.size());
+    this->coords.reserve(this->coords.size() + 2 * order.size());
+    this->triangles.reserve(this->triangles.size() + 2 * order.size() + 4);
+    for (it = order.begin(); it != order.end(); ++it) {
+      this->addVertex(*it);
     }
-
-    if(three_points_collinear(vertices[0], vertices[1], vertices[2]) ||
-       vertices[0]->getLabel() == -1 || vertices[1]->getLabel() == -1 || vertices[2]->getLabel() == -1) {
-    	return;
+    if (this->triangles.empty() && this->pending.size() >= 3) {
+      throw std::runtime_error("all points are collinear");
     }
+  }
 
-    if( vertices[0]->getLabel() < vertices[1]->getLabel()  ) {
-    	(*allneighbors)[vertices[0]->getLabel()].insert(vertices[1]->getLabel());
-    } else if( vertices[0]->getLabel() > vertices[1]->getLabel()  ) {
-    	(*allneighbors)[vertices[1]->getLabel()].insert(vertices[0]->getLabel());
-    }
+  // returns all Delaunay edges as pairs of vertex indices,
+  // where the smaller index comes first
+  void DelaunayTree::neighboringVertexIndices(std::vector<std::pair<int,int> > *edges) {
+    size_t t;
+    int i, a, b;
 
-    if( vertices[1]->getLabel() < vertices[2]->getLabel()  ) {
-    	(*allneighbors)[vertices[1]->getLabel()].insert(vertices[2]->getLabel());
-    } else if( vertices[1]->getLabel() > vertices[2]->getLabel()  ) {
-    	(*allneighbors)[vertices[2]->getLabel()].insert(vertices[1]->getLabel());
+    edges->clear();
+    for (t = 0; t < triangles.size(); ++t) {
+      const Triangle &T = triangles[t];
+      if (T.dead || T.vertex[0] == INF || T.vertex[1] == INF || T.vertex[2] == INF)
+        continue;
+      for (i = 0; i < 3; ++i) {
+        // every edge only once: from the triangle with the smaller
+        // index or from the finite side of the convex hull
+        int n = T.neighbor[i];
+        const int *nv = triangles[n].vertex;
+        if ((int)t > n && nv[0] != INF && nv[1] != INF && nv[2] != INF)
+          continue;
+        a = T.vertex[(i+1) % 3];
+        b = T.vertex[(i+2) % 3];
+        edges->push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+      }
     }
+  }
 
-    if( vertices[2]->getLabel() < vertices[0]->getLabel()  ) {
-    	(*allneighbors)[vertices[2]->getLabel()].insert(vertices[0]->getLabel());
-    } else if( vertices[2]->getLabel() > vertices[0]->getLabel()  ) {
-    	(*allneighbors)[vertices[0]->getLabel()].insert(vertices[2]->getLabel());
+  // returns all neighboring labels as sorted pairs (label1, label2)
+  // with label1 < label2; every pair is only listed once
+  void DelaunayTree::neighboringLabels(std::vector<std::pair<int,int> > *labelpairs) {
+    std::vector<std::pair<int,int> > edges;
+    std::vector<std::pair<int,int> >::iterator it;
+    int a, b;
+
+    neighboringVertexIndices(&edges);
+    labelpairs->clear();
+    labelpairs->reserve(edges.size());
+    for (it = edges.begin(); it != edges.end(); ++it) {
+      a = vertices[it->first]->getLabel();
+      b = vertices[it->second]->getLabel();
+      if (a == b || a == -1 || b == -1)
+        continue;
+      labelpairs->push_back(std::make_pair(std::min(a, b), std::max(a, b)));
     }
+    std::sort(labelpairs->begin(), labelpairs->end());
+    labelpairs->erase(std::unique(labelpairs->begin(), labelpairs->end()), labelpairs->end());
   }
-  
-  // adds the neighboring vertices into the map neighbors
-  void Triangle::neighboringVertices(std::map<Vertex*,std::set<Vertex*> > *allneighbors) {
-    if( flag.isDead() ) {
-      for( TriangleList *l = sons; l; l = l->getNext() ) {
-        if( l->getTriangle()->number != number ) {
-          l->getTriangle()->number = number;
-          l->getTriangle()->neighboringVertices(allneighbors);
-        }
-      }
-      return;
-    }
-        
-    if(three_points_collinear(vertices[0], vertices[1], vertices[2]) ||
-       vertices[0]->getLabel() == -1 || vertices[1]->getLabel() == -1 || vertices[2]->getLabel() == -1) {
-    	return;
-    }
 
-    if( vertices[0] < vertices[1]  ) {
-    	(*allneighbors)[vertices[0]].insert(vertices[1]);
-    } else if( vertices[0] > vertices[1] ) {
-    	(*allneighbors)[vertices[1]].insert(vertices[0]);
-    }
+  // returns all neighboring labels as a map label->{neighbor1, ...}
+  // every neighbor pair is only listed once in the set for the smaller label
+  void DelaunayTree::neighboringLabels(std::map<int,std::set<int> > *labelmap) {
+    std::vector<std::pair<int,int> > labelpairs;
+    std::vector<std::pair<int,int> >::iterator it;
 
-    if( vertices[1] < vertices[2] ) {
-    	(*allneighbors)[vertices[1]].insert(vertices[2]);
-    } else if( vertices[1] > vertices[2] ) {
-    	(*allneighbors)[vertices[2]].insert(vertices[1]);
+    neighboringLabels(&labelpairs);
+    for (it = labelpairs.begin(); it != labelpairs.end(); ++it) {
+      (*labelmap)[it->first].insert(it->second);
     }
+  }
 
-    if( vertices[2] < vertices[0] ) {
-    	(*allneighbors)[vertices[2]].insert(vertices[0]);
-    } else if( vertices[2] > vertices[0] ) {
-    	(*allneighbors)[vertices[0]].insert(vertices[2]);
+  // returns all neighboring vertices as a map vertex->{neighbor1, ...}
+  // every neighbor pair is only listed once in the set for the smaller vertex*
+  void DelaunayTree::neighboringVertices(std::map<Vertex*,std::set<Vertex*> > *vertexmap) {
+    std::vector<std::pair<int,int> > edges;
+    std::vector<std::pair<int,int> >::iterator it;
+
+    neighboringVertexIndices(&edges);
+    for (it = edges.begin(); it != edges.end(); ++it) {
+      Vertex *a = vertices[it->first];
+      Vertex *b = vertices[it->second];
+      if (a < b)
+        (*vertexmap)[a].insert(b);
+      else
+        (*vertexmap)[b].insert(a);
     }
   }
 
-  void Triangle::getTriangles(std::list< std::vector<Vertex*>* > *triangles) {
-    if( flag.isDead() ) {
-      for( TriangleList *l = sons; l ; l = l->getNext() ) {
-        if( l->getTriangle()->number != number ) {
-          l->getTriangle()->number = number;
-          l->getTriangle()->getTriangles(triangles);
-        }
-      }
-      return;
-    }
+  // returns all triangles as newly allocated vectors of three vertices,
+  // which must be deleted by the caller
+  void DelaunayTree::getTriangles(std::list< std::vector<Vertex*>* > *triangles) {
+    size_t t;
 
-    if(three_points_collinear(vertices[0], vertices[1], vertices[2]) ||
-       vertices[0]->getLabel() == -1 || vertices[1]->getLabel() == -1 || vertices[2]->getLabel() == -1) {
-    	return;
+    for (t = 0; t < this->triangles.size(); ++t) {
+      const Triangle &T = this->triangles[t];
+      if (T.dead || T.vertex[0] == INF || T.vertex[1] == INF || T.vertex[2] == INF)
+        continue;
+      std::vector<Vertex*>* tri = new std::vector<Vertex*>();
+      tri->push_back(vertices[T.vertex[0]]);
+      tri->push_back(vertices[T.vertex[1]]);
+      tri->push_back(vertices[T.vertex[2]]);
+      triangles->push_back(tri);
     }
-
-    std::vector<Vertex*>* tri = new std::vector<Vertex*>();
-    tri->push_back(vertices[0]);
-    tri->push_back(vertices[1]);
-    tri->push_back(vertices[2]);
-    triangles->push_back(tri);
-    
   }
 
 }} // end namespace Gamera::Delaunaytree
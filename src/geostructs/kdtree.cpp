@@ -21,154 +21,127 @@
 #include <stdexcept>
 #include <math.h>
 #include <limits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 namespace Gamera { namespace Kdtree {
 
 //--------------------------------------------------------------
-// function object for comparing only dimension d of two vecotrs
+// function object for comparing only dimension d of two points
+// given by their index in a packed coordinate array
 //--------------------------------------------------------------
 class compare_dimension {
 public:
-  compare_dimension(size_t dim) { d=dim; }
-  bool operator()(const KdNode &p, const KdNode &q) {
-    return (p.point[d] < q.point[d]);
+  compare_dimension(const double* c, size_t dim, size_t n) {
+    coords = c; d = dim; dimension = n;
   }
-  size_t d;
-};
-
-//--------------------------------------------------------------
-// internal node structure used by kdtree
-//--------------------------------------------------------------
-class kdtree_node {
-public:
-  kdtree_node() {
-    dataindex = cutdim = 0;
-    loson = hison = (kdtree_node*)NULL;
-  }
-  ~kdtree_node() {
-    if (loson) delete loson;
-    if (hison) delete hison;
-  }
-  // index of node data in kdtree array "allnodes"
-  size_t dataindex;
-  // cutting dimension
-  size_t cutdim;
-  // value of point
-  //double cutval; // == point[cutdim]
-  CoordPoint point;
-  //  roots of the two subtrees
-  kdtree_node *loson, *hison;
-  // bounding rectangle of this node's subtree
-  CoordPoint lobound, upbound;
+  bool operator()(size_t p, size_t q) {
+    return (coords[p*dimension+d] < coords[q*dimension+d]);
+  }
+  const double* coords;
+  size_t d, dimension;
 };
 
 //--------------------------------------------------------------
 // different distance metrics
+// Each metric provides the distance between two points, the
+// distance in a single coordinate, how coordinate distances
+// are accumulated into the distance to a bounding box, and
+// the distance value that corresponds to a search radius.
+// *w* are the coordinate weights, or NULL when unweighted.
 //--------------------------------------------------------------
-class DistanceMeasure {
-public:
-  DistanceMeasure() {}
-  virtual ~DistanceMeasure() {}
-  virtual double distance(const CoordPoint &p, const CoordPoint &q) = 0;
-  virtual double coordinate_distance(double x, double y, size_t dim) = 0;
-};
 // Maximum distance (Linfinite norm)
-class DistanceL0 : virtual public DistanceMeasure
-{
-  DoubleVector* w;
+class DistanceL0 {
+  const double* w;
  public:
-  DistanceL0(const DoubleVector* weights = NULL) {
-    if (weights) w = new DoubleVector(*weights);
-    else         w = (DoubleVector*)NULL;
-  }
-  ~DistanceL0() {
-    if (w) delete w;
-  }
-  double distance(const CoordPoint &p, const CoordPoint &q) {
+  DistanceL0(const double* weights) { w = weights; }
+  double distance(const double* p, const double* q, size_t n) const {
     size_t i;
     double dist, test;
     if (w) {
-      dist = (*w)[0] * fabs(p[0]-q[0]);
-      for (i=1; i<p.size();i++) {
-        test = (*w)[i] * fabs(p[i]-q[i]);
+      dist = w[0] * fabs(p[0]-q[0]);
+      for (i=1; i<n; i++) {
+        test = w[i] * fabs(p[i]-q[i]);
         if (test > dist) dist = test;
       }
     } else {
       dist = fabs(p[0]-q[0]);
-      for (i=1; i<p.size();i++) {
+      for (i=1; i<n; i++) {
         test = fabs(p[i]-q[i]);
         if (test > dist) dist = test;
       }
     }
     return dist;
   }
-  double coordinate_distance(double x, double y, size_t dim) {
-    if (w) return (*w)[dim] * fabs(x-y);
+  double coordinate_distance(double x, double y, size_t dim) const {
+    if (w) return w[dim] * fabs(x-y);
     else   return fabs(x-y);
   }
+  double accumulate(double sum, double dist) const {
+    return (dist > sum) ? dist : sum;
+  }
+  double radius(double r) const {
+    return r;
+  }
 };
 // Manhatten distance (L1 norm)
-class DistanceL1 : virtual public DistanceMeasure
-{
-  DoubleVector* w;
+class DistanceL1 {
+  const double* w;
  public:
-  DistanceL1(const DoubleVector* weights = NULL) {
-    if (weights) w = new DoubleVector(*weights);
-    else         w = (DoubleVector*)NULL;
-  }
-  ~DistanceL1() {
-    if (w) delete w;
-  }
-  double distance(const CoordPoint &p, const CoordPoint &q)
-  {
+  DistanceL1(const double* weights) { w = weights; }
+  double distance(const double* p, const double* q, size_t n) const {
     size_t i;
     double dist = 0.0;
     if (w) {
-      for (i=0; i<p.size();i++)
-        dist += (*w)[i]*fabs(p[i]-q[i]);
+      for (i=0; i<n; i++)
+        dist += w[i]*fabs(p[i]-q[i]);
     } else {
-      for (i=0; i<p.size();i++)
+      for (i=0; i<n; i++)
         dist += fabs(p[i]-q[i]);
     }
     return dist;
   }
-  double coordinate_distance(double x, double y, size_t dim)
-  {
-    if (w) return (*w)[dim] * fabs(x-y);
+  double coordinate_distance(double x, double y, size_t dim) const {
+    if (w) return w[dim] * fabs(x-y);
     else   return fabs(x-y);
   }
+  double accumulate(double sum, double dist) const {
+    return sum + dist;
+  }
+  double radius(double r) const {
+    return r;
+  }
 };
 // Euklidean distance (L2 norm)
-class DistanceL2 : virtual public DistanceMeasure
-{
-  DoubleVector* w;
+class DistanceL2 {
+  const double* w;
  public:
-  DistanceL2(const DoubleVector* weights = NULL) {
-    if (weights) w = new DoubleVector(*weights);
-    else         w = (DoubleVector*)NULL;
-  }
-  ~DistanceL2() {
-    if (w) delete w;
-  }
-  double distance(const CoordPoint &p, const CoordPoint &q)
-  {
+  DistanceL2(const double* weights) { w = weights; }
+  double distance(const double* p, const double* q, size_t n) const {
     size_t i;
     double dist = 0.0;
     if (w) {
-      for (i=0; i<p.size();i++)
-        dist += (*w)[i]*(p[i]-q[i])*(p[i]-q[i]);
+      for (i=0; i<n; i++)
+        dist += w[i]*(p[i]-q[i])*(p[i]-q[i]);
     } else {
-      for (i=0; i<p.size();i++)
+      for (i=0; i<n; i++)
         dist += (p[i]-q[i])*(p[i]-q[i]);
-    }      
+    }
     return dist;
   }
-  double coordinate_distance(double x, double y, size_t dim)
-  {
-    if (w) return (*w)[dim] * (x-y)*(x-y);
+  double coordinate_distance(double x, double y, size_t dim) const {
+    if (w) return w[dim] * (x-y)*(x-y);
     else   return (x-y)*(x-y);
   }
+  double accumulate(double sum, double dist) const {
+    return sum + dist;
+  }
+  // distances are squared
+  double radius(double r) const {
+    return r*r;
+  }
 };
 
 //--------------------------------------------------------------
@@ -176,84 +149,243 @@ class DistanceL2 : virtual public DistanceMeasure
 //--------------------------------------------------------------
 KdTree::~KdTree()
 {
-  if (root) delete root;
-  delete distance;
 }
 // distance_type can be 0 (Maximum), 1 (Manhatten), or 2 (Euklidean)
-KdTree::KdTree(const KdNodeVector* nodes, int distance_type /*=2*/)
+KdTree::KdTree(const KdNodeVector* nodes, int distance_type /*=2*/, int num_threads /*=1*/)
 {
-  size_t i,j;
-  double val;
+  size_t i,j,n;
   // copy over input data
   dimension = nodes->begin()->point.size();
+  n = nodes->size();
   allnodes = *nodes;
+  coords.resize(n*dimension);
+  for (i=0; i<n; i++)
+    for (j=0; j<dimension; j++)
+      coords[i*dimension+j] = allnodes[i].point[j];
+  build(distance_type, num_threads);
+}
+
+KdTree::KdTree(const double* points, size_t n, size_t dimension, int distance_type /*=2*/, int num_threads /*=1*/)
+{
+  size_t i;
+  this->dimension = dimension;
+  coords.assign(points, points + n*dimension);
+  allnodes.resize(n);
+  for (i=0; i<n; i++)
+    allnodes[i].point.assign(points + i*dimension, points + (i+1)*dimension);
+  build(distance_type, num_threads);
+}
+
+void KdTree::build(int distance_type, int num_threads)
+{
+  size_t i,j,n;
+  double val;
+  n = allnodes.size();
   // initialize distance values
-  distance = NULL;
   set_distance(distance_type);
   // compute global bounding box
-  lobound = nodes->begin()->point;
-  upbound = nodes->begin()->point;
-  for (i=1; i<nodes->size(); i++) {
+  lobound.assign(coords.begin(), coords.begin() + dimension);
+  upbound = lobound;
+  for (i=1; i<n; i++) {
     for (j=0; j<dimension; j++) {
-      val = allnodes[i].point[j];
+      val = coords[i*dimension+j];
       if (lobound[j] > val) lobound[j] = val;
       if (upbound[j] < val) upbound[j] = val;        
     }
   }
-  // build tree recursively
-  root = build_tree(0,0,allnodes.size());
+  // build tree as a permutation of the input nodes
+  std::vector<size_t> order(n);
+  for (i=0; i<n; i++)
+    order[i] = i;
+  bounds.resize(2*n*dimension);
+  std::copy(lobound.begin(), lobound.end(), bounds.begin() + 2*(n/2)*dimension);
+  std::copy(upbound.begin(), upbound.end(), bounds.begin() + (2*(n/2)+1)*dimension);
+#ifdef _OPENMP
+  if (num_threads > 1 && n > parallel_cutoff) {
+#pragma omp parallel num_threads(num_threads)
+#pragma omp single
+    build_tree(0,0,n,&order[0],true);
+  } else
+#endif
+    build_tree(0,0,n,&order[0],false);
+  // bring nodes and coordinates into tree order
+  KdNodeVector sortednodes(n);
+  DoubleVector sortedcoords(n*dimension);
+  for (i=0; i<n; i++) {
+    sortednodes[i].point.swap(allnodes[order[i]].point);
+    sortednodes[i].data = allnodes[order[i]].data;
+    for (j=0; j<dimension; j++)
+      sortedcoords[i*dimension+j] = coords[order[i]*dimension+j];
+  }
+  allnodes.swap(sortednodes);
+  coords.swap(sortedcoords);
+  inputindex.swap(order);
 }
 
 // distance_type can be 0 (Maximum), 1 (Manhatten), or 2 (Euklidean)
 void KdTree::set_distance(int distance_type, const DoubleVector* weights /*=NULL*/)
 {
-  if (distance) delete distance;
-  if (distance_type == 0) {
-    distance = (DistanceMeasure*) new DistanceL0(weights);
-  } else if (distance_type == 1) {
-    distance = (DistanceMeasure*) new DistanceL1(weights);
-  } else {
-    distance = (DistanceMeasure*) new DistanceL2(weights);
-  }
+  this->distance_type = distance_type;
+  if (weights)
+    this->weights = *weights;
+  else
+    this->weights.clear();
 }
 
 //--------------------------------------------------------------
 // recursive build of tree
 // "a" and "b"-1 are the lower and upper indices
-// from "allnodes" from which the subtree is to be built
+// from "order" from which the subtree is to be built
+// "order" contains indices into the initial "allnodes"
+// Each subtree root gets the bounds of its parent with the
+// cut coordinate replaced before the subtree is built, so that
+// subtrees over disjoint ranges can be built concurrently
 //--------------------------------------------------------------
-kdtree_node* KdTree::build_tree(size_t depth, size_t a, size_t b)
+void KdTree::build_tree(size_t depth, size_t a, size_t b, size_t* order, bool parallel)
 {
-  size_t m;
-  double temp, cutval;
-  kdtree_node* node = new kdtree_node();
-  node->lobound = lobound;
-  node->upbound = upbound;
-  node->cutdim = depth % dimension;
-  if (b-a <= 1) {
-    node->dataindex = a;
-    node->point = allnodes[a].point;
-  } else {
-    m = (a+b)/2;
-    std::nth_element(allnodes.begin()+a, allnodes.begin()+m,
-                     allnodes.begin()+b, compare_dimension(node->cutdim));
-    node->point = allnodes[m].point;
-    cutval = allnodes[m].point[node->cutdim];
-    node->dataindex = m;
+  size_t m, c, cutdim;
+  double cutval;
+  m = (a+b)/2;
+  cutdim = depth % dimension;
+  if (b-a > 1) {
+    std::nth_element(order+a, order+m, order+b,
+                     compare_dimension(&coords[0], cutdim, dimension));
+    cutval = coords[order[m]*dimension+cutdim];
     if (m-a>0) {
-      temp = upbound[node->cutdim];
-      upbound[node->cutdim] = cutval;
-      node->loson = build_tree(depth+1,a,m);
-      upbound[node->cutdim] = temp;
+      c = (a+m)/2;
+      std::copy(bounds.begin() + 2*m*dimension, bounds.begin() + 2*(m+1)*dimension,
+                bounds.begin() + 2*c*dimension);
+      bounds[(2*c+1)*dimension+cutdim] = cutval;
+#ifdef _OPENMP
+#pragma omp task if(parallel && m-a > parallel_cutoff)
+#endif
+      build_tree(depth+1,a,m,order,parallel);
     }
     if (b-m>1) {
-      temp = lobound[node->cutdim];
-      lobound[node->cutdim] = cutval;
-      node->hison = build_tree(depth+1,m+1,b);
-      lobound[node->cutdim] = temp;
+      c = (m+1+b)/2;
+      std::copy(bounds.begin() + 2*m*dimension, bounds.begin() + 2*(m+1)*dimension,
+                bounds.begin() + 2*c*dimension);
+      bounds[2*c*dimension+cutdim] = cutval;
+      build_tree(depth+1,m+1,b,order,parallel);
     }
   }
-  return node;
+}
+
+//--------------------------------------------------------------
+// state of a single k nearest neighbor search
+//--------------------------------------------------------------
+template<class Distance>
+class kdtree_search {
+public:
+  kdtree_search(const KdTree &t, const Distance &dist, const double* p,
+                size_t k, KdNodePredicate* pred)
+    : tree(t), distance(dist), point(p), k(k), searchpredicate(pred) {}
+  // the neighbors found so far, the farthest on top
+  std::priority_queue<nn4heap, std::vector<nn4heap>, compare_nn4heap> neighborheap;
+  bool neighbor_search(size_t a, size_t b, size_t depth);
+private:
+  bool bounds_overlap_ball(double dist, size_t node) const;
+  bool ball_within_bounds(double dist, size_t node) const;
+  const KdTree &tree;
+  const Distance &distance;
+  const double* point;
+  size_t k;
+  KdNodePredicate* searchpredicate;
+};
+
+//--------------------------------------------------------------
+// recursive function for nearest neighbor search in the subtree
+// over the node range [a,b). Updates the heap *neighborheap*.
+// returns "true" when no nearer neighbor elsewhere possible
+//--------------------------------------------------------------
+template<class Distance>
+bool kdtree_search<Distance>::neighbor_search(size_t a, size_t b, size_t depth)
+{
+  double curdist, dist;
+  size_t dim = tree.dimension;
+  size_t m = (a+b)/2;
+  size_t cutdim = depth % dim;
+  const double* nodepoint = &tree.coords[m*dim];
+  bool haslo = (m > a);
+  bool hashi = (b > m+1);
+
+  curdist = distance.distance(point, nodepoint, dim);
+  if (!(searchpredicate && !(*searchpredicate)(tree.allnodes[m]))) {
+    if (neighborheap.size() < k) {
+      neighborheap.push(nn4heap(m,curdist));
+    } else if (curdist < neighborheap.top().distance) {
+      neighborheap.pop();
+      neighborheap.push(nn4heap(m,curdist));
+    }
+  }
+  // first search on side closer to point
+  if (point[cutdim] < nodepoint[cutdim]) {
+    if (haslo)
+      if (neighbor_search(a, m, depth+1))
+        return true;
+  } else {
+    if (hashi)
+      if (neighbor_search(m+1, b, depth+1))
+        return true;
+  }
+  // second search on farther side, if necessary
+  if (neighborheap.size() < k) {
+    dist = std::numeric_limits<double>::max();
+  } else {
+    dist = neighborheap.top().distance;
+  }
+  if (point[cutdim] < nodepoint[cutdim]) {
+    if (hashi && bounds_overlap_ball(dist, (m+1+b)/2))
+      if (neighbor_search(m+1, b, depth+1))
+        return true;
+  } else {
+    if (haslo && bounds_overlap_ball(dist, (a+m)/2))
+      if (neighbor_search(a, m, depth+1))
+        return true;
+  }  
+
+  if (neighborheap.size() == k)
+    dist = neighborheap.top().distance;
+  return ball_within_bounds(dist, m);
+}
+
+// returns true when the bounds of *node* overlap with the 
+// ball with radius *dist* around *point*
+template<class Distance>
+bool kdtree_search<Distance>::bounds_overlap_ball(double dist, size_t node) const
+{
+  double distsum = 0.0;
+  size_t i, dim = tree.dimension;
+  const double* lo = &tree.bounds[2*node*dim];
+  const double* up = lo + dim;
+  for (i=0; i<dim; i++) {
+    if (point[i] < lo[i]) { // lower than low boundary
+      distsum = distance.accumulate(distsum, distance.coordinate_distance(point[i],lo[i],i));
+      if (distsum > dist)
+        return false;
+    }
+    else if (point[i] > up[i]) { // higher than high boundary
+      distsum = distance.accumulate(distsum, distance.coordinate_distance(point[i],up[i],i));
+      if (distsum > dist)
+        return false;
+    }
+  }
+  return true;
+}
+
+// returns true when the bounds of *node* completely contain the 
+// ball with radius *dist* around *point*
+template<class Distance>
+bool kdtree_search<Distance>::ball_within_bounds(double dist, size_t node) const
+{
+  size_t i, dim = tree.dimension;
+  const double* lo = &tree.bounds[2*node*dim];
+  const double* up = lo + dim;
+  for (i=0; i<dim; i++)
+    if (distance.coordinate_distance(point[i],lo[i],i) <= dist ||
+        distance.coordinate_distance(point[i],up[i],i) <= dist)
+      return false;
+  return true;
 }
 
 //--------------------------------------------------------------
@@ -265,128 +397,394 @@ kdtree_node* KdTree::build_tree(size_t depth, size_t a, size_t b)
 // derived from KdNodePredicate. When Null (default, no search
 // predicate is applied).
 //--------------------------------------------------------------
-    void KdTree::k_nearest_neighbors(const CoordPoint &point, size_t k, KdNodeVector* result, KdNodePredicate* pred /*=NULL*/)
+void KdTree::k_nearest_neighbors(const CoordPoint &point, size_t k, KdNodeVector* result, KdNodePredicate* pred /*=NULL*/) const
 {
+  const double* w = weights.empty() ? (const double*)NULL : &weights[0];
+  std::vector<nn4heap> found;
   size_t i;
-  KdNode temp;
-  searchpredicate = pred;
 
   result->clear();
   if (k<1) return;
   if (point.size() != dimension)
     throw std::invalid_argument("kdtree::k_nearest_neighbors(): point must be of same dimension as kdtree");
 
+  if (distance_type == 0) {
+    k_nearest_neighbors(DistanceL0(w), &point[0], k, &found, pred);
+  } else if (distance_type == 1) {
+    k_nearest_neighbors(DistanceL1(w), &point[0], k, &found, pred);
+  } else {
+    k_nearest_neighbors(DistanceL2(w), &point[0], k, &found, pred);
+  }
+  result->reserve(found.size());
+  for (i=0; i<found.size(); i++)
+    result->push_back(allnodes[found[i].dataindex]);
+}
+
+// the neighbors as node indices in *found*, sorted by distance
+template<class Distance>
+void KdTree::k_nearest_neighbors(const Distance &d, const double* point, size_t k, std::vector<nn4heap>* found, KdNodePredicate* pred) const
+{
+  size_t i;
 
   // collect result of k values in neighborheap
-  neighborheap = new std::priority_queue<nn4heap, std::vector<nn4heap>, compare_nn4heap>();
+  kdtree_search<Distance> search(*this, d, point, k, pred);
   if (k>allnodes.size()) {
     // when more neighbors asked than nodes in tree, return everything
     k = allnodes.size();
     for (i=0; i<k; i++) {
-      if (!(searchpredicate && !(*searchpredicate)(allnodes[i])))
-        neighborheap->push(nn4heap(i,distance->distance(allnodes[i].point,point)));
+      if (!(pred && !(*pred)(allnodes[i])))
+        search.neighborheap.push(nn4heap(i,d.distance(&coords[i*dimension],point,dimension)));
     }
   } else {
-    neighbor_search(point, root, k);
+    search.neighbor_search(0, allnodes.size(), 0);
   }
 
   // copy over result sorted by distance
   // (we must revert the vector for ascending order)
-  while (!neighborheap->empty()) {
-    i = neighborheap->top().dataindex;
-    neighborheap->pop();
-    result->push_back(allnodes[i]);
+  found->clear();
+  found->reserve(search.neighborheap.size());
+  while (!search.neighborheap.empty()) {
+    found->push_back(search.neighborheap.top());
+    search.neighborheap.pop();
   }
   // beware that less than k results might have been returned
-  k = result->size();
-  for (i=0; i<k/2; i++) {
-    temp = (*result)[i];
-    (*result)[i] = (*result)[k-1-i];
-    (*result)[k-1-i] = temp;
-  }
-  delete neighborheap;
+  std::reverse(found->begin(), found->end());
+}
+
+double KdTree::true_distance(double dist) const
+{
+  // euklidean distances are computed squared
+  return (distance_type == 0 || distance_type == 1) ? dist : sqrt(dist);
 }
 
 //--------------------------------------------------------------
-// recursive function for nearest neighbor search in subtree
-// under *node*. Updates the heap (class member) *neighborheap*.
-// returns "true" when no nearer neighbor elsewhere possible
+// batch k nearest neighbor search on packed points
+// with input indices and distances as result
 //--------------------------------------------------------------
-bool KdTree::neighbor_search(const CoordPoint &point, kdtree_node* node, size_t k)
+void KdTree::k_nearest_neighbors_indices(const double* points, size_t npoints, size_t k, size_t* indices, double* distances, int num_threads /*=1*/) const
 {
-  double curdist, dist;
+  const double* w = weights.empty() ? (const double*)NULL : &weights[0];
+
+  if (k<1) return;
+  if (k>allnodes.size())
+    throw std::invalid_argument("kdtree::k_nearest_neighbors_indices(): k must not be greater than the number of nodes");
+  if (num_threads < 1) num_threads = 1;
 
-  curdist = distance->distance(point, node->point);
-  if (!(searchpredicate && !(*searchpredicate)(allnodes[node->dataindex]))) {
-    if (neighborheap->size() < k) {
-      neighborheap->push(nn4heap(node->dataindex,curdist));
-    } else if (curdist < neighborheap->top().distance) {
-      neighborheap->pop();
-      neighborheap->push(nn4heap(node->dataindex,curdist));
+  if (distance_type == 0) {
+    k_nearest_neighbors_indices(DistanceL0(w), points, npoints, k, indices, distances, num_threads);
+  } else if (distance_type == 1) {
+    k_nearest_neighbors_indices(DistanceL1(w), points, npoints, k, indices, distances, num_threads);
+  } else {
+    k_nearest_neighbors_indices(DistanceL2(w), points, npoints, k, indices, distances, num_threads);
+  }
+}
+
+template<class Distance>
+void KdTree::k_nearest_neighbors_indices(const Distance &d, const double* points, size_t npoints, size_t k, size_t* indices, double* distances, int num_threads) const
+{
+  long i, n = (long)npoints;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+  {
+    std::vector<nn4heap> found;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+    for (i=0; i<n; i++) {
+      k_nearest_neighbors(d, points + i*dimension, k, &found, NULL);
+      for (size_t j=0; j<k; j++) {
+        indices[i*k+j] = inputindex[found[j].dataindex];
+        distances[i*k+j] = true_distance(found[j].distance);
+      }
     }
   }
-  // first search on side closer to point
-  if (point[node->cutdim] < node->point[node->cutdim]) {
-    if (node->loson)
-      if (neighbor_search(point, node->loson, k))
-        return true;
-  } else {
-    if (node->hison)
-      if (neighbor_search(point, node->hison, k))
-        return true;
+}
+
+//--------------------------------------------------------------
+// batch k nearest neighbor search
+// returns the *k* nearest neighbors of each point in *points*
+// in the corresponding entry of *results*. The queries are
+// distributed over *num_threads* threads (when compiled with
+// OpenMP); each search has its own neighbor heap, so that
+// the tree is shared read-only between the threads.
+//--------------------------------------------------------------
+void KdTree::k_nearest_neighbors_many(const std::vector<CoordPoint> &points, size_t k, std::vector<KdNodeVector>* results, int num_threads /*=1*/) const
+{
+  long i, n = (long)points.size();
+
+  // check all points first, as we cannot throw from the threads
+  for (i=0; i<n; i++)
+    if (points[i].size() != dimension)
+      throw std::invalid_argument("kdtree::k_nearest_neighbors_many(): points must be of same dimension as kdtree");
+
+  if (num_threads < 1) num_threads = 1;
+  results->clear();
+  results->resize(n);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 64)
+#endif
+  for (i=0; i<n; i++)
+    k_nearest_neighbors(points[i], k, &(*results)[i]);
+}
+
+//--------------------------------------------------------------
+// state of a range search or of the pairs self join
+// with the search radius *radius* (in the units returned by
+// Distance::distance)
+//--------------------------------------------------------------
+template<class Distance>
+class kdtree_range {
+public:
+  kdtree_range(const KdTree &t, const Distance &dist, double r,
+               KdNodePredicate* pred)
+    : tree(t), distance(dist), radius(r), searchpredicate(pred) {}
+  void point_search(const double* point, size_t a, size_t b, std::vector<nn4heap> &found) const;
+  void pair_search(size_t a, size_t b, std::vector<std::pair<size_t,size_t> > &pairs) const;
+  void pair_search(size_t a1, size_t b1, size_t a2, size_t b2, std::vector<std::pair<size_t,size_t> > &pairs) const;
+private:
+  void point_pairs(size_t node, size_t a, size_t b, std::vector<std::pair<size_t,size_t> > &pairs) const;
+  bool point_overlaps(const double* point, size_t node) const;
+  bool bounds_overlap(size_t node1, size_t node2) const;
+  const KdTree &tree;
+  const Distance &distance;
+  double radius;
+  KdNodePredicate* searchpredicate;
+};
+
+//--------------------------------------------------------------
+// collects all nodes in the subtree over the node range [a,b)
+// within *radius* of *point* in *found*
+//--------------------------------------------------------------
+template<class Distance>
+void kdtree_range<Distance>::point_search(const double* point, size_t a, size_t b, std::vector<nn4heap> &found) const
+{
+  size_t dim = tree.dimension;
+  size_t m = (a+b)/2;
+  double dist;
+  if (!point_overlaps(point, m))
+    return;
+  dist = distance.distance(point, &tree.coords[m*dim], dim);
+  if (dist <= radius && !(searchpredicate && !(*searchpredicate)(tree.allnodes[m])))
+    found.push_back(nn4heap(m,dist));
+  if (m > a)
+    point_search(point, a, m, found);
+  if (b > m+1)
+    point_search(point, m+1, b, found);
+}
+
+// pairs of *node* with all nodes in the range [a,b) within *radius*
+template<class Distance>
+void kdtree_range<Distance>::point_pairs(size_t node, size_t a, size_t b, std::vector<std::pair<size_t,size_t> > &pairs) const
+{
+  std::vector<nn4heap> found;
+  size_t i;
+  point_search(&tree.coords[node*tree.dimension], a, b, found);
+  for (i=0; i<found.size(); i++)
+    pairs.push_back(std::make_pair(node, found[i].dataindex));
+}
+
+//--------------------------------------------------------------
+// collects all pairs of nodes within *radius* inside of the
+// subtree over the node range [a,b)
+//--------------------------------------------------------------
+template<class Distance>
+void kdtree_range<Distance>::pair_search(size_t a, size_t b, std::vector<std::pair<size_t,size_t> > &pairs) const
+{
+  size_t m = (a+b)/2;
+  if (b-a <= 1)
+    return;
+  // pairs with the root, then within and between its subtrees
+  if (m > a) {
+    point_pairs(m, a, m, pairs);
+    pair_search(a, m, pairs);
   }
-  // second search on farther side, if necessary
-  if (neighborheap->size() < k) {
-    dist = std::numeric_limits<double>::max();
-  } else {
-    dist = neighborheap->top().distance;
+  if (b > m+1) {
+    point_pairs(m, m+1, b, pairs);
+    pair_search(m+1, b, pairs);
   }
-  if (point[node->cutdim] < node->point[node->cutdim]) {
-    if (node->hison && bounds_overlap_ball(point,dist,node->hison))
-      if (neighbor_search(point, node->hison, k))
-        return true;
-  } else {
-    if (node->loson && bounds_overlap_ball(point,dist,node->loson))
-      if (neighbor_search(point, node->loson, k))
-        return true;
-  }  
+  if (m > a && b > m+1)
+    pair_search(a, m, m+1, b, pairs);
+}
 
-  if (neighborheap->size() == k)
-    dist = neighborheap->top().distance;
-  return ball_within_bounds(point, dist, node);
+//--------------------------------------------------------------
+// collects all pairs of nodes within *radius* between the two
+// disjoint (and non empty) subtrees over the node ranges
+// [a1,b1) and [a2,b2)
+//--------------------------------------------------------------
+template<class Distance>
+void kdtree_range<Distance>::pair_search(size_t a1, size_t b1, size_t a2, size_t b2, std::vector<std::pair<size_t,size_t> > &pairs) const
+{
+  size_t m1 = (a1+b1)/2;
+  size_t m2 = (a2+b2)/2;
+  if (!bounds_overlap(m1, m2))
+    return;
+  // pairs with the first root, then with the second root
+  point_pairs(m1, a2, b2, pairs);
+  if (m1 > a1)
+    point_pairs(m2, a1, m1, pairs);
+  if (b1 > m1+1)
+    point_pairs(m2, m1+1, b1, pairs);
+  // then between the subtrees of both
+  if (m1 > a1) {
+    if (m2 > a2)
+      pair_search(a1, m1, a2, m2, pairs);
+    if (b2 > m2+1)
+      pair_search(a1, m1, m2+1, b2, pairs);
+  }
+  if (b1 > m1+1) {
+    if (m2 > a2)
+      pair_search(m1+1, b1, a2, m2, pairs);
+    if (b2 > m2+1)
+      pair_search(m1+1, b1, m2+1, b2, pairs);
+  }
 }
 
-// returns true when the bounds of *node* overlap with the 
-// ball with radius *dist* around *point*
-bool KdTree::bounds_overlap_ball(const CoordPoint &point, double dist, kdtree_node* node)
+// returns true when the bounds of *node* are within *radius*
+// of *point*
+template<class Distance>
+bool kdtree_range<Distance>::point_overlaps(const double* point, size_t node) const
 {
   double distsum = 0.0;
-  size_t i;
-  for (i=0; i<dimension; i++) {
-    if (point[i] < node->lobound[i]) { // lower than low boundary
-      distsum += distance->coordinate_distance(point[i],node->lobound[i],i);
-      if (distsum > dist)
-        return false;
-    }
-    else if (point[i] > node->upbound[i]) { // higher than high boundary
-      distsum += distance->coordinate_distance(point[i],node->upbound[i],i);
-      if (distsum > dist)
-        return false;
-    }
+  size_t i, dim = tree.dimension;
+  const double* lo = &tree.bounds[2*node*dim];
+  const double* up = lo + dim;
+  for (i=0; i<dim; i++) {
+    if (point[i] < lo[i])
+      distsum = distance.accumulate(distsum, distance.coordinate_distance(point[i],lo[i],i));
+    else if (point[i] > up[i])
+      distsum = distance.accumulate(distsum, distance.coordinate_distance(point[i],up[i],i));
+    else
+      continue;
+    if (distsum > radius)
+      return false;
   }
   return true;
 }
 
-// returns true when the bounds of *node* completely contain the 
-// ball with radius *dist* around *point*
-bool KdTree::ball_within_bounds(const CoordPoint &point, double dist, kdtree_node* node)
+// returns true when the bounds of *node1* and *node2* are
+// within *radius* of each other
+template<class Distance>
+bool kdtree_range<Distance>::bounds_overlap(size_t node1, size_t node2) const
 {
-  size_t i;
-  for (i=0; i<dimension; i++)
-    if (distance->coordinate_distance(point[i],node->lobound[i],i) <= dist ||
-        distance->coordinate_distance(point[i],node->upbound[i],i) <= dist)
+  double distsum = 0.0;
+  size_t i, dim = tree.dimension;
+  const double* lo1 = &tree.bounds[2*node1*dim];
+  const double* up1 = lo1 + dim;
+  const double* lo2 = &tree.bounds[2*node2*dim];
+  const double* up2 = lo2 + dim;
+  for (i=0; i<dim; i++) {
+    if (up1[i] < lo2[i])
+      distsum = distance.accumulate(distsum, distance.coordinate_distance(up1[i],lo2[i],i));
+    else if (up2[i] < lo1[i])
+      distsum = distance.accumulate(distsum, distance.coordinate_distance(up2[i],lo1[i],i));
+    else
+      continue;
+    if (distsum > radius)
       return false;
+  }
   return true;
 }
 
+// sorts the found nodes by distance
+static bool compare_found(const nn4heap &n, const nn4heap &m) {
+  if (n.distance == m.distance)
+    return (n.dataindex < m.dataindex);
+  return (n.distance < m.distance);
+}
+
+//--------------------------------------------------------------
+// range search
+// returns all nodes within distance *r* of *point* in *result*,
+// sorted by distance from *point*. As in k_nearest_neighbors,
+// an optional search predicate can exclude nodes.
+//--------------------------------------------------------------
+void KdTree::range_search(const CoordPoint &point, double r, KdNodeVector* result, KdNodePredicate* pred /*=NULL*/) const
+{
+  const double* w = weights.empty() ? (const double*)NULL : &weights[0];
+  std::vector<nn4heap> found;
+  size_t i;
+
+  result->clear();
+  if (r<0) return;
+  if (point.size() != dimension)
+    throw std::invalid_argument("kdtree::range_search(): point must be of same dimension as kdtree");
+
+  if (distance_type == 0) {
+    range_search(DistanceL0(w), &point[0], r, &found, pred);
+  } else if (distance_type == 1) {
+    range_search(DistanceL1(w), &point[0], r, &found, pred);
+  } else {
+    range_search(DistanceL2(w), &point[0], r, &found, pred);
+  }
+  result->reserve(found.size());
+  for (i=0; i<found.size(); i++)
+    result->push_back(allnodes[found[i].dataindex]);
+}
+
+template<class Distance>
+void KdTree::range_search(const Distance &d, const double* point, double r, std::vector<nn4heap>* found, KdNodePredicate* pred) const
+{
+  kdtree_range<Distance> search(*this, d, d.radius(r), pred);
+  search.point_search(point, 0, allnodes.size(), *found);
+  std::sort(found->begin(), found->end(), compare_found);
+}
+
+void KdTree::range_search_indices(const double* point, double r, std::vector<size_t>* indices, std::vector<double>* distances) const
+{
+  const double* w = weights.empty() ? (const double*)NULL : &weights[0];
+  std::vector<nn4heap> found;
+  size_t i;
+
+  indices->clear();
+  distances->clear();
+  if (r<0) return;
+
+  if (distance_type == 0) {
+    range_search(DistanceL0(w), point, r, &found, NULL);
+  } else if (distance_type == 1) {
+    range_search(DistanceL1(w), point, r, &found, NULL);
+  } else {
+    range_search(DistanceL2(w), point, r, &found, NULL);
+  }
+  indices->reserve(found.size());
+  distances->reserve(found.size());
+  for (i=0; i<found.size(); i++) {
+    indices->push_back(inputindex[found[i].dataindex]);
+    distances->push_back(true_distance(found[i].distance));
+  }
+}
+
+//--------------------------------------------------------------
+// pairs self join
+// returns all pairs of nodes within distance *r* of each other
+// in *result* in no particular order. Each pair is returned once
+// as a pair of indices into *allnodes*. The tree is traversed
+// simultaneously on both sides of the pairs, so that whole pairs
+// of subtrees are skipped when their bounding boxes are too far
+// apart.
+//--------------------------------------------------------------
+void KdTree::pairs_within(double r, std::vector<std::pair<size_t,size_t> >* result) const
+{
+  const double* w = weights.empty() ? (const double*)NULL : &weights[0];
+
+  result->clear();
+  if (r<0) return;
+
+  if (distance_type == 0) {
+    pairs_within(DistanceL0(w), r, result);
+  } else if (distance_type == 1) {
+    pairs_within(DistanceL1(w), r, result);
+  } else {
+    pairs_within(DistanceL2(w), r, result);
+  }
+}
+
+template<class Distance>
+void KdTree::pairs_within(const Distance &d, double r, std::vector<std::pair<size_t,size_t> >* result) const
+{
+  kdtree_range<Distance> search(*this, d, d.radius(r), NULL);
+  search.pair_search(0, allnodes.size(), *result);
+}
+
 }} // end namespace Gamera::Kdtree
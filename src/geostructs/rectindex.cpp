@@ -0,0 +1,565 @@
+//
+// Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+
+#include "geostructs/rectindex.hpp"
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <map>
+#include <math.h>
+
+
+namespace Gamera { namespace Rectindex {
+
+//--------------------------------------------------------------
+// geometric helper functions
+//--------------------------------------------------------------
+double rect_distance(const Rect& a, const Rect& b) {
+  long dx = std::max(0l, std::max((long)a.ul_x() - (long)b.lr_x(),
+                                  (long)b.ul_x() - (long)a.lr_x()));
+  long dy = std::max(0l, std::max((long)a.ul_y() - (long)b.lr_y(),
+                                  (long)b.ul_y() - (long)a.lr_y()));
+  return sqrt((double)(dx*dx + dy*dy));
+}
+
+static inline bool boxes_intersect(long aulx, long auly, long alrx, long alry,
+                                   long bulx, long buly, long blrx, long blry) {
+  return (aulx <= blrx && bulx <= alrx && auly <= blry && buly <= alry);
+}
+
+//--------------------------------------------------------------
+// searches common to all indices
+//--------------------------------------------------------------
+void RectIndex::intersecting(const Rect& r, IndexVector* result) const {
+  IndexVector found;
+  size_t i;
+  result->clear();
+  candidates(r.ul_x(), r.ul_y(), r.lr_x(), r.lr_y(), &found);
+  std::sort(found.begin(), found.end());
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+  for (i = 0; i < found.size(); i++) {
+    if (r.intersects(rects[found[i]]))
+      result->push_back(found[i]);
+  }
+}
+
+void RectIndex::within_distance(const Rect& r, double d, IndexVector* result) const {
+  IndexVector found;
+  size_t i;
+  long e;
+  result->clear();
+  if (d < 0.0)
+    return;
+  e = (long)ceil(d);
+  candidates((long)r.ul_x() - e, (long)r.ul_y() - e,
+             (long)r.lr_x() + e, (long)r.lr_y() + e, &found);
+  std::sort(found.begin(), found.end());
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+  for (i = 0; i < found.size(); i++) {
+    if (rect_distance(r, rects[found[i]]) <= d)
+      result->push_back(found[i]);
+  }
+}
+
+void RectIndex::k_nearest(const Rect& r, size_t k, IndexVector* result) const {
+  IndexVector found;
+  std::vector<std::pair<double,size_t> > sorted;
+  double radius, maxradius;
+  size_t i;
+  result->clear();
+  if (k == 0 || bbox_ul_x > bbox_lr_x)
+    return;
+  // no rect can be farther away than the extent of the bounding
+  // box of r and all rects
+  maxradius = sqrt(pow((double)(std::max(bbox_lr_x, (long)r.lr_x()) -
+                                std::min(bbox_ul_x, (long)r.ul_x())), 2) +
+                   pow((double)(std::max(bbox_lr_y, (long)r.lr_y()) -
+                                std::min(bbox_ul_y, (long)r.ul_y())), 2));
+  // the search radius is doubled until k rects are found, which
+  // then contain the k nearest ones
+  radius = 0.0;
+  while (true) {
+    within_distance(r, radius, &found);
+    if (found.size() >= k || radius >= maxradius)
+      break;
+    radius = (radius == 0.0) ? 1.0 : 2.0 * radius;
+  }
+  for (i = 0; i < found.size(); i++)
+    sorted.push_back(std::make_pair(rect_distance(r, rects[found[i]]), found[i]));
+  std::sort(sorted.begin(), sorted.end());
+  for (i = 0; i < sorted.size() && i < k; i++)
+    result->push_back(sorted[i].second);
+}
+
+//--------------------------------------------------------------
+// uniform grid
+//--------------------------------------------------------------
+RectGrid::RectGrid(const RectVector& r, size_t size) {
+  size_t i;
+  double extent = 0.0;
+  bbox_ul_x = bbox_ul_y = std::numeric_limits<long>::max();
+  bbox_lr_x = bbox_lr_y = std::numeric_limits<long>::min();
+  for (i = 0; i < r.size(); i++) {
+    bbox_ul_x = std::min(bbox_ul_x, (long)r[i].ul_x());
+    bbox_ul_y = std::min(bbox_ul_y, (long)r[i].ul_y());
+    bbox_lr_x = std::max(bbox_lr_x, (long)r[i].lr_x());
+    bbox_lr_y = std::max(bbox_lr_y, (long)r[i].lr_y());
+    extent += std::max(r[i].ncols(), r[i].nrows());
+  }
+  if (r.empty()) {
+    ul_x = ul_y = 0;
+    cell_size = (size > 0) ? (long)size : 1;
+    ncols = nrows = 1;
+  } else {
+    ul_x = bbox_ul_x;
+    ul_y = bbox_ul_y;
+    if (size > 0) {
+      cell_size = (long)size;
+    } else {
+      // cells of the average rect extent, but not many more cells
+      // than rects, so that sparse pages do not waste memory
+      cell_size = std::max(1l, (long)(extent / r.size() + 0.5));
+      while (((bbox_lr_x - ul_x) / cell_size + 1) *
+             ((bbox_lr_y - ul_y) / cell_size + 1) > (long)(4 * r.size() + 16))
+        cell_size *= 2;
+    }
+    ncols = (bbox_lr_x - ul_x) / cell_size + 1;
+    nrows = (bbox_lr_y - ul_y) / cell_size + 1;
+  }
+  cells.resize(ncols * nrows);
+  for (i = 0; i < r.size(); i++)
+    add(r[i]);
+}
+
+void RectGrid::cell_range(const Rect& r, long* c0, long* r0, long* c1, long* r1) const {
+  *c0 = std::min(ncols - 1, std::max(0l, ((long)r.ul_x() - ul_x) / cell_size));
+  *c1 = std::min(ncols - 1, std::max(0l, ((long)r.lr_x() - ul_x) / cell_size));
+  *r0 = std::min(nrows - 1, std::max(0l, ((long)r.ul_y() - ul_y) / cell_size));
+  *r1 = std::min(nrows - 1, std::max(0l, ((long)r.lr_y() - ul_y) / cell_size));
+}
+
+void RectGrid::register_rect(size_t i) {
+  long c0, r0, c1, r1, x, y;
+  cell_range(rects[i], &c0, &r0, &c1, &r1);
+  for (y = r0; y <= r1; y++)
+    for (x = c0; x <= c1; x++)
+      cells[y * ncols + x].push_back(i);
+}
+
+void RectGrid::unregister_rect(size_t i) {
+  long c0, r0, c1, r1, x, y;
+  cell_range(rects[i], &c0, &r0, &c1, &r1);
+  for (y = r0; y <= r1; y++) {
+    for (x = c0; x <= c1; x++) {
+      IndexVector& cell = cells[y * ncols + x];
+      cell.erase(std::find(cell.begin(), cell.end(), i));
+    }
+  }
+}
+
+size_t RectGrid::add(const Rect& r) {
+  rects.push_back(r);
+  removed.push_back(false);
+  bbox_ul_x = std::min(bbox_ul_x, (long)r.ul_x());
+  bbox_ul_y = std::min(bbox_ul_y, (long)r.ul_y());
+  bbox_lr_x = std::max(bbox_lr_x, (long)r.lr_x());
+  bbox_lr_y = std::max(bbox_lr_y, (long)r.lr_y());
+  register_rect(rects.size() - 1);
+  return rects.size() - 1;
+}
+
+void RectGrid::update(size_t i, const Rect& r) {
+  if (!removed[i])
+    unregister_rect(i);
+  rects[i] = r;
+  bbox_ul_x = std::min(bbox_ul_x, (long)r.ul_x());
+  bbox_ul_y = std::min(bbox_ul_y, (long)r.ul_y());
+  bbox_lr_x = std::max(bbox_lr_x, (long)r.lr_x());
+  bbox_lr_y = std::max(bbox_lr_y, (long)r.lr_y());
+  if (!removed[i])
+    register_rect(i);
+}
+
+void RectGrid::remove(size_t i) {
+  if (!removed[i]) {
+    unregister_rect(i);
+    removed[i] = true;
+  }
+}
+
+void RectGrid::candidates(long qulx, long quly, long qlrx, long qlry,
+                          IndexVector* result) const {
+  long c0, r0, c1, r1, x, y;
+  c0 = std::min(ncols - 1, std::max(0l, (qulx - ul_x) / cell_size));
+  c1 = std::min(ncols - 1, std::max(0l, (qlrx - ul_x) / cell_size));
+  r0 = std::min(nrows - 1, std::max(0l, (quly - ul_y) / cell_size));
+  r1 = std::min(nrows - 1, std::max(0l, (qlry - ul_y) / cell_size));
+  for (y = r0; y <= r1; y++) {
+    for (x = c0; x <= c1; x++) {
+      const IndexVector& cell = cells[y * ncols + x];
+      result->insert(result->end(), cell.begin(), cell.end());
+    }
+  }
+}
+
+//--------------------------------------------------------------
+// STR bulk loaded R-tree
+//--------------------------------------------------------------
+
+// box with the doubled coordinates of its center for sorting
+struct str_entry {
+  long ul_x, ul_y, lr_x, lr_y;
+  size_t index;
+  long cx() const { return ul_x + lr_x; }
+  long cy() const { return ul_y + lr_y; }
+};
+static bool str_less_x(const str_entry& a, const str_entry& b) {
+  return (a.cx() < b.cx() || (a.cx() == b.cx() && a.index < b.index));
+}
+static bool str_less_y(const str_entry& a, const str_entry& b) {
+  return (a.cy() < b.cy() || (a.cy() == b.cy() && a.index < b.index));
+}
+
+// sorts the entries such that consecutive runs of m entries
+// form the nodes of the next level
+static void str_sort(std::vector<str_entry>& entries, size_t m) {
+  size_t n = entries.size();
+  size_t nnodes = (n + m - 1) / m;
+  size_t nslices = (size_t)ceil(sqrt((double)nnodes));
+  size_t slice = nslices * m;
+  size_t s;
+  std::sort(entries.begin(), entries.end(), str_less_x);
+  for (s = 0; s < n; s += slice)
+    std::sort(entries.begin() + s, entries.begin() + std::min(n, s + slice),
+              str_less_y);
+}
+
+RectTree::RectTree(const RectVector& r, size_t m) {
+  std::vector<str_entry> entries(r.size());
+  size_t i, j, first, level_begin, level_end;
+  rects = r;
+  node_size = std::max((size_t)2, m);
+  bbox_ul_x = bbox_ul_y = std::numeric_limits<long>::max();
+  bbox_lr_x = bbox_lr_y = std::numeric_limits<long>::min();
+  for (i = 0; i < r.size(); i++) {
+    entries[i].ul_x = (long)r[i].ul_x();
+    entries[i].ul_y = (long)r[i].ul_y();
+    entries[i].lr_x = (long)r[i].lr_x();
+    entries[i].lr_y = (long)r[i].lr_y();
+    entries[i].index = i;
+    bbox_ul_x = std::min(bbox_ul_x, entries[i].ul_x);
+    bbox_ul_y = std::min(bbox_ul_y, entries[i].ul_y);
+    bbox_lr_x = std::max(bbox_lr_x, entries[i].lr_x);
+    bbox_lr_y = std::max(bbox_lr_y, entries[i].lr_y);
+  }
+  root = 0;
+  if (r.empty())
+    return;
+  // the leaves hold runs of the reordered rect indices
+  str_sort(entries, node_size);
+  for (i = 0; i < entries.size(); i++)
+    order.push_back(entries[i].index);
+  for (first = 0; first < entries.size(); first += node_size) {
+    Node node;
+    node.first = first;
+    node.count = std::min(node_size, entries.size() - first);
+    node.leaf = true;
+    node.ul_x = node.ul_y = std::numeric_limits<long>::max();
+    node.lr_x = node.lr_y = std::numeric_limits<long>::min();
+    for (j = first; j < first + node.count; j++) {
+      node.ul_x = std::min(node.ul_x, entries[j].ul_x);
+      node.ul_y = std::min(node.ul_y, entries[j].ul_y);
+      node.lr_x = std::max(node.lr_x, entries[j].lr_x);
+      node.lr_y = std::max(node.lr_y, entries[j].lr_y);
+    }
+    nodes.push_back(node);
+  }
+  // each upper level is built from the reordered nodes of the level below
+  level_begin = 0;
+  level_end = nodes.size();
+  while (level_end - level_begin > 1) {
+    std::vector<Node> level(nodes.begin() + level_begin, nodes.begin() + level_end);
+    entries.resize(level.size());
+    for (i = 0; i < level.size(); i++) {
+      entries[i].ul_x = level[i].ul_x;
+      entries[i].ul_y = level[i].ul_y;
+      entries[i].lr_x = level[i].lr_x;
+      entries[i].lr_y = level[i].lr_y;
+      entries[i].index = i;
+    }
+    str_sort(entries, node_size);
+    for (i = 0; i < level.size(); i++)
+      nodes[level_begin + i] = level[entries[i].index];
+    for (first = level_begin; first < level_end; first += node_size) {
+      Node node;
+      node.first = first;
+      node.count = std::min(node_size, level_end - first);
+      node.leaf = false;
+      node.ul_x = node.ul_y = std::numeric_limits<long>::max();
+      node.lr_x = node.lr_y = std::numeric_limits<long>::min();
+      for (j = first; j < first + node.count; j++) {
+        node.ul_x = std::min(node.ul_x, nodes[j].ul_x);
+        node.ul_y = std::min(node.ul_y, nodes[j].ul_y);
+        node.lr_x = std::max(node.lr_x, nodes[j].lr_x);
+        node.lr_y = std::max(node.lr_y, nodes[j].lr_y);
+      }
+      nodes.push_back(node);
+    }
+    level_begin = level_end;
+    level_end = nodes.size();
+  }
+  root = level_begin;
+}
+
+void RectTree::candidates(long qulx, long quly, long qlrx, long qlry,
+                          IndexVector* result) const {
+  std::vector<size_t> stack;
+  size_t i;
+  if (nodes.empty())
+    return;
+  stack.push_back(root);
+  while (!stack.empty()) {
+    const Node& node = nodes[stack.back()];
+    stack.pop_back();
+    if (!boxes_intersect(node.ul_x, node.ul_y, node.lr_x, node.lr_y,
+                         qulx, quly, qlrx, qlry))
+      continue;
+    if (node.leaf) {
+      for (i = node.first; i < node.first + node.count; i++) {
+        const Rect& r = rects[order[i]];
+        if (boxes_intersect(r.ul_x(), r.ul_y(), r.lr_x(), r.lr_y(),
+                            qulx, quly, qlrx, qlry))
+          result->push_back(order[i]);
+      }
+    } else {
+      for (i = node.first; i < node.first + node.count; i++)
+        stack.push_back(i);
+    }
+  }
+}
+
+//--------------------------------------------------------------
+// merging of intersecting rects
+//--------------------------------------------------------------
+void merge_intersecting(const RectVector& rects, std::vector<IndexVector>* groups) {
+  size_t n = rects.size();
+  size_t i, j, g, h;
+  groups->clear();
+  if (n == 0)
+    return;
+  RectVector boxes(rects);
+  RectGrid grid(boxes);
+  std::vector<IndexVector> members(n);
+  // the list of groups is ordered by key; the initial keys are the
+  // positions, and a group moved to the front gets a key smaller
+  // than all others
+  std::vector<long> key(n);
+  std::map<long, size_t> list;
+  std::map<long, size_t>::iterator next;
+  for (i = 0; i < n; i++) {
+    members[i].push_back(i);
+    key[i] = (long)i;
+    list[key[i]] = i;
+  }
+  long front = 0;
+  // The groups between the front and the key *resume* are known not to
+  // intersect any other group. When the front group has absorbed all it
+  // intersects, the scan goes on after them.
+  long resume = 0;
+  bool at_front = true;
+  IndexVector found, absorbed;
+  std::vector<std::pair<long, size_t> > by_key;
+  g = 0;
+  while (true) {
+    grid.intersecting(boxes[g], &found);
+    by_key.clear();
+    for (i = 0; i < found.size(); i++)
+      if (found[i] != g)
+        by_key.push_back(std::make_pair(key[found[i]], found[i]));
+    if (!by_key.empty()) {
+      std::sort(by_key.begin(), by_key.end());
+      for (i = 0; i < by_key.size(); i++) {
+        h = by_key[i].second;
+        boxes[g].union_rect(boxes[h]);
+        grid.remove(h);
+        list.erase(key[h]);
+        for (j = 0; j < members[h].size(); j++)
+          members[g].push_back(members[h][j]);
+        IndexVector().swap(members[h]);
+      }
+      grid.update(g, boxes[g]);
+      if (!at_front)
+        resume = key[g];
+      list.erase(key[g]);
+      key[g] = --front;
+      list[key[g]] = g;
+      at_front = true;
+    } else {
+      next = list.upper_bound(at_front ? resume : key[g]);
+      if (next == list.end())
+        break;
+      g = next->second;
+      at_front = false;
+    }
+  }
+  for (next = list.begin(); next != list.end(); ++next)
+    groups->push_back(members[next->second]);
+}
+
+//--------------------------------------------------------------
+// text sections and lines
+//--------------------------------------------------------------
+static bool top_left_less(const std::pair<const Rect*, size_t>& a,
+                          const std::pair<const Rect*, size_t>& b) {
+  if (a.first->ul_y() != b.first->ul_y())
+    return a.first->ul_y() < b.first->ul_y();
+  if (a.first->ul_x() != b.first->ul_x())
+    return a.first->ul_x() < b.first->ul_x();
+  return a.second < b.second;
+}
+
+void find_text_sections(const RectVector& glyphs, const std::vector<double>& black_areas,
+                        double search_size, const Rect& page, std::vector<long>* sections) {
+  size_t i, j;
+  sections->assign(glyphs.size(), -1);
+  if (glyphs.empty())
+    return;
+  // the average extent of the glyphs
+  double total = 0.0;
+  for (i = 0; i < glyphs.size(); i++) {
+    total += glyphs[i].nrows();
+    total += glyphs[i].ncols();
+  }
+  double fudge = total / (2 * glyphs.size()) * search_size;
+  double large = fudge * 20;
+  // the remaining glyphs from top to bottom and left to right
+  std::vector<std::pair<const Rect*, size_t> > kept;
+  for (i = 0; i < glyphs.size(); i++) {
+    if (black_areas[i] > fudge && glyphs[i].nrows() < large && glyphs[i].ncols() < large)
+      kept.push_back(std::make_pair(&glyphs[i], i));
+  }
+  std::sort(kept.begin(), kept.end(), top_left_less);
+  RectVector big;
+  for (i = 0; i < kept.size(); i++) {
+    const Rect& g = *kept[i].first;
+    long ul_x = (long)std::max(0.0, g.ul_x() - fudge);
+    long ul_y = (long)std::max(0.0, g.ul_y() - fudge);
+    double lr_x = std::min((double)page.lr_x(), g.lr_x() + fudge);
+    double lr_y = std::min((double)page.lr_y(), g.lr_y() + fudge);
+    big.push_back(Rect(Point(ul_x, ul_y),
+                       Dim((size_t)(lr_x - ul_x + 1), (size_t)(lr_y - ul_y + 1))));
+  }
+  std::vector<IndexVector> groups;
+  merge_intersecting(big, &groups);
+  for (i = 0; i < groups.size(); i++)
+    for (j = 0; j < groups[i].size(); j++)
+      (*sections)[kept[groups[i][j]].second] = (long)i;
+}
+
+static bool left_less(const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b) {
+  return a.first < b.first;
+}
+
+// inserts a glyph into a line after all glyphs with the same left edge
+static void add_to_line(const RectVector& glyphs, IndexVector& line, size_t glyph) {
+  IndexVector::iterator it = line.end();
+  while (it != line.begin() && glyphs[*(it - 1)].ul_x() > glyphs[glyph].ul_x())
+    --it;
+  line.insert(it, glyph);
+}
+
+void find_text_lines(const RectVector& glyphs, double tall_deviation,
+                     std::vector<IndexVector>* lines, IndexVector* lost) {
+  size_t i, j, k;
+  lines->clear();
+  lost->clear();
+  if (glyphs.empty())
+    return;
+  double total = 0.0;
+  for (i = 0; i < glyphs.size(); i++)
+    total += glyphs[i].nrows();
+  double avg_height = total / glyphs.size();
+  // the first line containing the center of each glyph that is not tall
+  IndexVector tall;
+  std::vector<IndexVector> found;
+  RectVector boxes;
+  for (i = 0; i < glyphs.size(); i++) {
+    // the standard deviation of the height and the average height
+    double height = (double)glyphs[i].nrows();
+    double mean = (height + avg_height) / 2.0;
+    double deviation = sqrt(((height - mean) * (height - mean) +
+                             (avg_height - mean) * (avg_height - mean)) / 2.0);
+    if (deviation > tall_deviation) {
+      tall.push_back(i);
+      continue;
+    }
+    size_t center = (glyphs[i].ul_y() + glyphs[i].lr_y()) / 2;
+    for (j = 0; j < found.size(); j++)
+      if (boxes[j].contains_y(center))
+        break;
+    if (j == found.size()) {
+      found.push_back(IndexVector(1, i));
+      boxes.push_back(glyphs[i]);
+    } else {
+      add_to_line(glyphs, found[j], i);
+      boxes[j].union_rect(glyphs[i]);
+    }
+  }
+  // merge the intersecting lines
+  std::vector<IndexVector> merged;
+  merge_intersecting(boxes, &merged);
+  RectVector merged_boxes;
+  for (i = 0; i < merged.size(); i++) {
+    IndexVector line;
+    Rect box = boxes[merged[i][0]];
+    for (j = 0; j < merged[i].size(); j++) {
+      const IndexVector& part = found[merged[i][j]];
+      line.insert(line.end(), part.begin(), part.end());
+      box.union_rect(boxes[merged[i][j]]);
+    }
+    lines->push_back(line);
+    merged_boxes.push_back(box);
+  }
+  // the tall glyphs go into the first line containing their top, which
+  // is sorted again (and stays sorted, as the sort is stable)
+  std::vector<bool> with_tall(lines->size(), false);
+  for (i = 0; i < tall.size(); i++) {
+    const Rect& g = glyphs[tall[i]];
+    for (j = 0; j < lines->size(); j++)
+      if (merged_boxes[j].contains_y(g.ul_y()))
+        break;
+    if (j == lines->size()) {
+      lost->push_back(tall[i]);
+      continue;
+    }
+    IndexVector& line = (*lines)[j];
+    if (!with_tall[j]) {
+      std::vector<std::pair<size_t, size_t> > by_left;
+      for (k = 0; k < line.size(); k++)
+        by_left.push_back(std::make_pair(glyphs[line[k]].ul_x(), line[k]));
+      std::stable_sort(by_left.begin(), by_left.end(), left_less);
+      for (k = 0; k < line.size(); k++)
+        line[k] = by_left[k].second;
+      with_tall[j] = true;
+    }
+    add_to_line(glyphs, line, tall[i]);
+    merged_boxes[j].union_rect(g);
+  }
+}
+
+}} // end namespace Gamera::Rectindex
@@ -27,6 +27,21 @@ namespace Gamera { namespace GraphApi {
 
    
    
+// -----------------------------------------------------------------------------
+VisitMap* NodeTraverseIterator::borrow_visit_map() {
+   return _graph->_visit_maps.borrow(_graph->_node_ids.bound());
+}
+
+
+
+// -----------------------------------------------------------------------------
+NodeTraverseIterator::~NodeTraverseIterator() {
+   if(_visited != NULL)
+      _graph->_visit_maps.give_back(_visited);
+}
+
+
+
 // -----------------------------------------------------------------------------
 void BfsIterator::init(Node* start) {
    visit(start);
@@ -61,12 +76,20 @@ Node* BfsIterator::next() {
 // -----------------------------------------------------------------------------
 void DfsIterator::init(Node* start) {
    found_cycles = false;
+   _used_edges = _graph->_visit_maps.borrow(_graph->_edge_ids.bound());
    visit(start);
    _stack.push(start);
 }
 
 
 
+// -----------------------------------------------------------------------------
+DfsIterator::~DfsIterator() {
+   _graph->_visit_maps.give_back(_used_edges);
+}
+
+
+
 // -----------------------------------------------------------------------------
 Node* DfsIterator::next() {
    if(_stack.empty())
@@ -82,10 +105,10 @@ Node* DfsIterator::next() {
       if(n != NULL && !is_visited(n)) {
          visit(n);
          _stack.push(n);
-         _used_edges.insert(*it);
+         _used_edges->set((*it)->_id);
       }
       else if(!found_cycles && n != NULL && 
-            _used_edges.find(*it) == _used_edges.end()) {
+            !_used_edges->is_set((*it)->_id)) {
 
          found_cycles = true;
       }
@@ -0,0 +1,543 @@
+/*
+ *
+ * Copyright (C) 2011 Christian Brandt
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <algorithm>
+#include <limits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "graph/graph.hpp"
+#include "graph/node.hpp"
+#include "graph/edge.hpp"
+#include "graph/csr_graph.hpp"
+#include "graph/graphdataderived.hpp"
+
+namespace Gamera { namespace GraphApi {
+
+
+
+const size_t CsrGraph::NONE;
+
+
+
+// -----------------------------------------------------------------------------
+CsrGraph::CsrGraph(Graph* g) {
+   _directed = g->is_directed();
+   _nedges = g->get_nedges();
+
+   // number the nodes in the order of their values
+   size_t nnodes = g->get_nnodes();
+   std::vector<std::pair<Node*, size_t> > indices;
+   std::vector<Node*> nodes;
+   indices.reserve(nnodes);
+   nodes.reserve(nnodes);
+   _values.reserve(nnodes);
+   for(ValueNodeMap::iterator it = g->_valuemap.begin(); 
+         it != g->_valuemap.end(); it++) {
+      indices.push_back(std::make_pair(it->second, nodes.size()));
+      nodes.push_back(it->second);
+   }
+   std::sort(indices.begin(), indices.end());
+
+   _offsets.reserve(nnodes + 1);
+   _offsets.push_back(0);
+   for(size_t i = 0; i < nodes.size(); i++) {
+      Node* n = nodes[i];
+      for(EdgeIterator it = n->_edges.begin(); it != n->_edges.end(); it++) {
+         Node* target = (*it)->traverse(n);
+         if(target == NULL)
+            continue;
+         std::vector<std::pair<Node*, size_t> >::iterator found = 
+            std::lower_bound(indices.begin(), indices.end(), 
+                  std::make_pair(target, (size_t)0));
+         _targets.push_back(found->second);
+         _weights.push_back((*it)->weight);
+      }
+      _offsets.push_back(_targets.size());
+   }
+
+   try {
+      for(size_t i = 0; i < nodes.size(); i++)
+         _values.push_back(nodes[i]->_value->copy());
+   }
+   catch(...) {
+      for(size_t i = 0; i < _values.size(); i++)
+         delete _values[i];
+      throw;
+   }
+}
+
+
+
+// -----------------------------------------------------------------------------
+CsrGraph::CsrGraph(const std::vector<std::pair<long, long> >& edges) {
+   _directed = false;
+   _nedges = edges.size();
+
+   // number the nodes in the order of their values
+   std::vector<long> labels;
+   labels.reserve(2 * edges.size());
+   for(size_t i = 0; i < edges.size(); i++) {
+      labels.push_back(edges[i].first);
+      labels.push_back(edges[i].second);
+   }
+   std::sort(labels.begin(), labels.end());
+   labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+   size_t nnodes = labels.size();
+
+   std::vector<std::pair<size_t, size_t> > ends(edges.size());
+   std::vector<size_t> degree(nnodes + 1, 0);
+   for(size_t i = 0; i < edges.size(); i++) {
+      ends[i].first = std::lower_bound(labels.begin(), labels.end(), 
+            edges[i].first) - labels.begin();
+      ends[i].second = std::lower_bound(labels.begin(), labels.end(), 
+            edges[i].second) - labels.begin();
+      degree[ends[i].first]++;
+      degree[ends[i].second]++;
+   }
+
+   // each edge is appended at both of its nodes in the order of
+   // insertion, like Edge does with the Node edge lists (twice at the
+   // node for a self loop)
+   _offsets.resize(nnodes + 1);
+   _offsets[0] = 0;
+   for(size_t n = 0; n < nnodes; n++)
+      _offsets[n + 1] = _offsets[n] + degree[n];
+   _targets.resize(_offsets[nnodes]);
+   _weights.assign(_offsets[nnodes], 1.0);
+   std::vector<size_t> fill(_offsets.begin(), _offsets.end() - 1);
+   for(size_t i = 0; i < ends.size(); i++) {
+      _targets[fill[ends[i].first]++] = ends[i].second;
+      _targets[fill[ends[i].second]++] = ends[i].first;
+   }
+
+   try {
+      _values.reserve(nnodes);
+      for(size_t n = 0; n < nnodes; n++)
+         _values.push_back(new GraphDataLong(labels[n]));
+   }
+   catch(...) {
+      for(size_t i = 0; i < _values.size(); i++)
+         delete _values[i];
+      throw;
+   }
+}
+
+
+
+// -----------------------------------------------------------------------------
+CsrGraph::~CsrGraph() {
+   for(size_t i = 0; i < _values.size(); i++)
+      delete _values[i];
+}
+
+
+
+// -----------------------------------------------------------------------------
+size_t CsrGraph::get_index(GraphData* value) const {
+   std::vector<GraphData*>::const_iterator it = std::lower_bound(
+         _values.begin(), _values.end(), value, GraphDataPtrLessCompare());
+   if(it == _values.end() || **it != *value)
+      return NONE;
+   return it - _values.begin();
+}
+
+
+
+// -----------------------------------------------------------------------------
+size_t CsrGraph::get_edge_source(size_t edge) const {
+   return std::upper_bound(_offsets.begin(), _offsets.end(), edge) 
+      - _offsets.begin() - 1;
+}
+
+
+
+// -----------------------------------------------------------------------------
+void CsrGraph::BFS(size_t root, std::vector<size_t>& order) const {
+   std::vector<bool> visited(get_nnodes(), false);
+   // order itself is the queue
+   size_t first = order.size();
+   visited[root] = true;
+   order.push_back(root);
+   for(size_t q = first; q < order.size(); q++) {
+      size_t current = order[q];
+      for(size_t e = _offsets[current]; e < _offsets[current + 1]; e++) {
+         size_t n = _targets[e];
+         if(!visited[n]) {
+            visited[n] = true;
+            order.push_back(n);
+         }
+      }
+   }
+}
+
+
+
+// -----------------------------------------------------------------------------
+void CsrGraph::DFS(size_t root, std::vector<size_t>& order) const {
+   std::vector<bool> visited(get_nnodes(), false);
+   std::vector<size_t> stack;
+   visited[root] = true;
+   stack.push_back(root);
+   while(!stack.empty()) {
+      size_t current = stack.back();
+      stack.pop_back();
+      order.push_back(current);
+      for(size_t e = _offsets[current]; e < _offsets[current + 1]; e++) {
+         size_t n = _targets[e];
+         if(!visited[n]) {
+            visited[n] = true;
+            stack.push_back(n);
+         }
+      }
+   }
+}
+
+
+
+namespace {
+
+/** Min-heap of nodes with four children per entry, ordered by their
+ * distances, that can lower the distance of a node already in it
+ * (decrease-key) instead of inserting the node again.  The distances
+ * are kept in the entries for locality; _position[n] is the place of
+ * node n in _heap, or NONE.
+ * */
+class DijkstraHeap {
+   struct Entry {
+      cost_t distance;
+      size_t node;
+   };
+   std::vector<Entry> _heap;
+   std::vector<size_t> _position;
+
+   void place(size_t i, const Entry& entry) {
+      _heap[i] = entry;
+      _position[entry.node] = i;
+   }
+
+   void sift_up(size_t i, const Entry& entry) {
+      while(i > 0) {
+         size_t parent = (i - 1) / 4;
+         if(_heap[parent].distance <= entry.distance)
+            break;
+         place(i, _heap[parent]);
+         i = parent;
+      }
+      place(i, entry);
+   }
+
+   void sift_down(size_t i, const Entry& entry) {
+      size_t size = _heap.size();
+      while(true) {
+         size_t first = 4 * i + 1;
+         if(first >= size)
+            break;
+         size_t last = std::min(first + 4, size);
+         size_t child = first;
+         for(size_t c = first + 1; c < last; c++)
+            if(_heap[c].distance < _heap[child].distance)
+               child = c;
+         if(entry.distance <= _heap[child].distance)
+            break;
+         place(i, _heap[child]);
+         i = child;
+      }
+      place(i, entry);
+   }
+
+public:
+   DijkstraHeap(size_t nnodes) : _position(nnodes, CsrGraph::NONE) {}
+
+   bool empty() const { return _heap.empty(); }
+
+   /// inserts node n, or moves it up when it is in the heap already
+   void update(size_t n, cost_t distance) {
+      Entry entry;
+      entry.distance = distance;
+      entry.node = n;
+      if(_position[n] == CsrGraph::NONE) {
+         _heap.push_back(entry);
+         sift_up(_heap.size() - 1, entry);
+      }
+      else
+         sift_up(_position[n], entry);
+   }
+
+   size_t pop() {
+      size_t top = _heap[0].node;
+      _position[top] = CsrGraph::NONE;
+      Entry last = _heap.back();
+      _heap.pop_back();
+      if(!_heap.empty())
+         sift_down(0, last);
+      return top;
+   }
+};
+
+
+
+/// Dijkstra's algorithm on the rows distance and predecessor (which may
+/// be NULL) of nnodes entries each
+void csr_dijkstra(const CsrGraph& g, size_t source, cost_t* distance,
+      size_t* predecessor, DijkstraHeap& heap) {
+
+   size_t nnodes = g.get_nnodes();
+   std::fill(distance, distance + nnodes, std::numeric_limits<cost_t>::max());
+   if(predecessor != NULL)
+      std::fill(predecessor, predecessor + nnodes, CsrGraph::NONE);
+
+   distance[source] = 0;
+   heap.update(source, 0);
+   while(!heap.empty()) {
+      size_t n = heap.pop();
+      for(size_t e = g._offsets[n]; e < g._offsets[n + 1]; e++) {
+         size_t to = g._targets[e];
+         if(distance[n] + g._weights[e] < distance[to]) {
+            distance[to] = distance[n] + g._weights[e];
+            if(predecessor != NULL)
+               predecessor[to] = n;
+            heap.update(to, distance[to]);
+         }
+      }
+   }
+}
+
+} // end anonymous namespace
+
+
+
+// -----------------------------------------------------------------------------
+void CsrGraph::dijkstra_shortest_path(size_t source, 
+      std::vector<cost_t>& distance, std::vector<size_t>& predecessor) const {
+
+   distance.resize(get_nnodes());
+   predecessor.resize(get_nnodes());
+   DijkstraHeap heap(get_nnodes());
+   csr_dijkstra(*this, source, &distance[0], &predecessor[0], heap);
+}
+
+
+
+// -----------------------------------------------------------------------------
+void CsrGraph::all_pairs_shortest_path(std::vector<cost_t>& distance, 
+      std::vector<size_t>* predecessor, int threads) const {
+
+   size_t nnodes = get_nnodes();
+   distance.resize(nnodes * nnodes);
+   if(predecessor != NULL)
+      predecessor->resize(nnodes * nnodes);
+   if(nnodes == 0)
+      return;
+
+   if(threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+   }
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+   {
+      // each thread has its own heap and works on its own rows
+      DijkstraHeap heap(nnodes);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+      for(long source = 0; source < (long)nnodes; source++) {
+         csr_dijkstra(*this, source, &distance[source * nnodes],
+               predecessor == NULL ? NULL : &(*predecessor)[source * nnodes],
+               heap);
+      }
+   }
+}
+
+
+
+namespace {
+
+/// helper for sorting edges by their weights in Kruskal's algorithm
+struct CsrEdgeWeightLess {
+   const std::vector<cost_t>& weights;
+   CsrEdgeWeightLess(const std::vector<cost_t>& w) : weights(w) {}
+   bool operator()(size_t a, size_t b) const {
+      return weights[a] < weights[b];
+   }
+};
+
+/// root of a node in the union-find forest of Kruskal's algorithm
+inline size_t find_set(std::vector<size_t>& parent, size_t n) {
+   while(parent[n] != n) {
+      parent[n] = parent[parent[n]];
+      n = parent[n];
+   }
+   return n;
+}
+
+}
+
+
+
+// -----------------------------------------------------------------------------
+bool CsrGraph::minimum_spanning_tree(std::vector<size_t>& tree_edges) const {
+   if(_directed) //Kruskal-algorithm is only for undirected graphs
+      return false;
+
+   // every undirected edge appears at both nodes; use it once
+   std::vector<size_t> edges;
+   for(size_t n = 0; n < get_nnodes(); n++) {
+      for(size_t e = _offsets[n]; e < _offsets[n + 1]; e++) {
+         if(n < _targets[e])
+            edges.push_back(e);
+      }
+   }
+   std::stable_sort(edges.begin(), edges.end(), CsrEdgeWeightLess(_weights));
+
+   std::vector<size_t> parent(get_nnodes());
+   for(size_t n = 0; n < parent.size(); n++)
+      parent[n] = n;
+
+   size_t needed = get_nnodes() > 0 ? get_nnodes() - 1 : 0;
+   size_t added = 0;
+   for(size_t i = 0; i < edges.size() && added < needed; i++) {
+      size_t from = find_set(parent, get_edge_source(edges[i]));
+      size_t to = find_set(parent, _targets[edges[i]]);
+      if(from != to) {
+         parent[from] = to;
+         tree_edges.push_back(edges[i]);
+         added++;
+      }
+   }
+   return true;
+}
+
+
+
+// -----------------------------------------------------------------------------
+Graph* CsrGraph::create_minimum_spanning_tree() const {
+   std::vector<size_t> tree_edges;
+   if(!minimum_spanning_tree(tree_edges))
+      return NULL;
+
+   Graph* tree = new Graph(FLAG_TREE);
+   for(size_t n = 0; n < get_nnodes(); n++)
+      tree->add_node(_values[n]->copy());
+   for(size_t i = 0; i < tree_edges.size(); i++) {
+      size_t e = tree_edges[i];
+      tree->add_edge(_values[get_edge_source(e)], _values[_targets[e]], 
+            _weights[e], false);
+   }
+   return tree;
+}
+
+
+
+// -----------------------------------------------------------------------------
+void CsrGraph::colorize(unsigned int ncolors, 
+      std::vector<unsigned int>& colors) const {
+
+   if (ncolors < 6) {
+      throw std::runtime_error("CsrGraph::colorize: insufficient colors. "
+            "ncolors has to be at least 6");
+   }
+   size_t nnodes = get_nnodes();
+
+   // --------------------------------------------------------------------------
+   //Step 1: degrees, and a list of nodes for each degree.  When the
+   //degree of a node drops, it is added to the next lower list, and
+   //the entry in the higher one is skipped later.
+   std::vector<size_t> degree(nnodes, 0);
+   size_t maxdegree = 0;
+   for(size_t n = 0; n < nnodes; n++) {
+      for(size_t e = _offsets[n]; e < _offsets[n + 1]; e++) {
+         if(_targets[e] != n)
+            degree[n]++;
+      }
+      maxdegree = std::max(maxdegree, degree[n]);
+   }
+   std::vector<std::vector<size_t> > degrees(maxdegree + 1);
+   for(size_t n = 0; n < nnodes; n++)
+      degrees[degree[n]].push_back(n);
+
+   // --------------------------------------------------------------------------
+   //Step 2: remove the nodes smallest degree first
+   std::vector<size_t> removed(nnodes);
+   std::vector<bool> is_removed(nnodes, false);
+   size_t smallest = 0;
+   for(size_t i = nnodes; i-- > 0; ) {
+      size_t to_be_removed = NONE;
+      while(to_be_removed == NONE) {
+         while(degrees[smallest].empty())
+            smallest++;
+         size_t n = degrees[smallest].back();
+         degrees[smallest].pop_back();
+         if(!is_removed[n] && degree[n] == smallest)
+            to_be_removed = n;
+      }
+      is_removed[to_be_removed] = true;
+      removed[i] = to_be_removed;
+
+      for(size_t e = _offsets[to_be_removed]; e < _offsets[to_be_removed + 1]; 
+            e++) {
+         size_t neighbor = _targets[e];
+         if(is_removed[neighbor] || degree[neighbor] == 0)
+            continue;
+         degree[neighbor]--;
+         degrees[degree[neighbor]].push_back(neighbor);
+         smallest = std::min(smallest, degree[neighbor]);
+      }
+   }
+
+   // --------------------------------------------------------------------------
+   //Step 3: color the nodes in the reverse order
+   const unsigned int uncolored = std::numeric_limits<unsigned int>::max();
+   colors.assign(nnodes, uncolored);
+   std::vector<unsigned int> histogram(ncolors, 0);
+   // used[c] == n when a neighbor of n has color c
+   std::vector<size_t> used(ncolors, NONE);
+   for(size_t i = 0; i < nnodes; i++) {
+      size_t n = removed[i];
+      for(size_t e = _offsets[n]; e < _offsets[n + 1]; e++) {
+         unsigned int neighbor_color = colors[_targets[e]];
+         if(neighbor_color != uncolored)
+            used[neighbor_color] = n;
+      }
+
+      int color = -1;
+      unsigned int mincount = std::numeric_limits<unsigned int>::max();
+      for(unsigned int c = 0; c < ncolors; c++) {
+         if(used[c] != n && (color == -1 || histogram[c] <= mincount)) {
+            color = c;
+            mincount = histogram[c];
+         }
+      }
+      if(color < 0)
+         throw std::runtime_error("not enough colors for this graph");
+      colors[n] = color;
+      histogram[color]++;
+   }
+}
+
+
+
+}} // end Gamera::GraphApi
@@ -33,6 +33,7 @@ Edge::Edge(Node* from_node, Node* to_node, cost_t weight,
    this->to_node = to_node;
    this->weight = weight;
    this->label = label;
+   this->_id = 0;
    from_node->add_edge(this);
    to_node->add_edge(this);
 }
@@ -24,6 +24,7 @@
 #include "graph/spanning_tree.hpp"
 #include "graph/shortest_path.hpp"
 #include "graph/subgraph_root.hpp"
+#include "graph/csr_graph.hpp"
 
 namespace Gamera { namespace GraphApi {
 
@@ -178,14 +179,36 @@ ShortestPathMap* Graph::dijkstra_shortest_path(GraphData * value) {
 
 // -----------------------------------------------------------------------------
 std::map<Node*, ShortestPathMap*> Graph::dijkstra_all_pairs_shortest_path() {
+   // the searches run on a CsrGraph, from all nodes in parallel
+   CsrGraph csr(this);
+   size_t nnodes = csr.get_nnodes();
+   std::vector<cost_t> distance;
+   std::vector<size_t> predecessor;
+   csr.all_pairs_shortest_path(distance, &predecessor);
+
+   std::vector<Node*> nodes(nnodes);
+   for(size_t i = 0; i < nnodes; i++)
+      nodes[i] = get_node(csr.get_value(i));
+
+   // same results as dijkstra_shortest_path(n) for each n
    std::map<Node*, ShortestPathMap*> res;
-   NodePtrIterator *it = get_nodes();
-   Node* n;
-   
-   while((n=it->next()) != NULL) {
-      res[n] = dijkstra_shortest_path(n);
-   }   
-   delete it;
+   for(size_t source = 0; source < nnodes; source++) {
+      ShortestPathMap* paths = new ShortestPathMap();
+      const cost_t* row_distance = &distance[source * nnodes];
+      const size_t* row_predecessor = &predecessor[source * nnodes];
+      for(size_t target = 0; target < nnodes; target++) {
+         DijkstraPath& path = (*paths)[nodes[target]];
+         if(row_distance[target] == std::numeric_limits<cost_t>::max()) {
+            path.cost = 0;
+            path.path.push_back(nodes[target]);
+            continue;
+         }
+         path.cost = row_distance[target];
+         for(size_t n = target; n != CsrGraph::NONE; n = row_predecessor[n])
+            path.path.push_back(nodes[n]);
+      }
+      res[nodes[source]] = paths;
+   }
    return res;
 }
 
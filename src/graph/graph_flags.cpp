@@ -109,29 +109,29 @@ bool Graph::is_cyclic() {
    bool cyclic = false;
    if(is_directed()) { //similar algorithm to make_acyclic
       NodeStack node_stack;
-      std::set<Node*> visited;
+      VisitMap* visited = _visit_maps.borrow(_node_ids.bound());
       if (get_nedges() != 0) {
          NodePtrIterator *i = get_nodes();
          Node* n;
          while((n = i->next()) != NULL && !cyclic) {
-            if (visited.count(n) == 0) {
+            if (!visited->is_set(n->_id)) {
                node_stack.push(n);
                while (!node_stack.empty() && !cyclic) {
                   Node* node = node_stack.top();
                   node_stack.pop();
-                  visited.insert(node);
+                  visited->set(node->_id);
 
                   EdgePtrIterator *it = node->get_edges();
                   Edge* e;
                   while ((e = it->next()) != NULL && !cyclic) {
                      Node* inner_node = e->traverse(node);
                      if(inner_node) {
-                        if(visited.count(inner_node) != 0) {
+                        if(visited->is_set(inner_node->_id)) {
                            cyclic = true;
                         }
                         else  {
                            node_stack.push(inner_node);
-                           visited.insert(inner_node);
+                           visited->set(inner_node->_id);
                         }
                      }
                   }
@@ -143,6 +143,7 @@ bool Graph::is_cyclic() {
 
          delete i;
       }
+      _visit_maps.give_back(visited);
    }  
    else {
       NodeVector* roots = NULL;
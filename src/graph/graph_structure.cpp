@@ -201,6 +201,7 @@ bool Graph::add_node(GraphData * value) {
 bool Graph::add_node(Node* node) {
    if(!has_node(node)) {
       node->add_to_graph(this);
+      node->_id = _node_ids.acquire();
       _nodes.push_back(node);
       _valuemap[node->_value] = node;
       return true;
@@ -283,6 +284,7 @@ void Graph::remove_node(Node* node) {
    if(node != NULL) {
       node->remove_self(true);
       _nodes.remove(node);
+      _node_ids.release(node->_id);
       _valuemap.erase(node->_value);
       delete node;
    }
@@ -312,6 +314,7 @@ void Graph::remove_node_and_edges(Node* node) {
    if(node != NULL) {
       node->remove_self(false);
       _nodes.remove(node);
+      _node_ids.release(node->_id);
       _valuemap.erase(node->_value);
       delete node;
    }
@@ -356,7 +359,8 @@ int Graph::add_edge(Node* from_node, Node* to_node, cost_t cost,
    if(GRAPH_HAS_FLAG(this, FLAG_DIRECTED) && !directed) {
       directed = true;
       f = new Edge(to_node, from_node, cost, true, label);
-      _edges.push_back(f);
+      f->_id = _edge_ids.acquire();
+      f->_position = _edges.insert(_edges.end(), f);
       if(GRAPH_HAS_FLAG(this, FLAG_CHECK_ON_INSERT) && 
             !conforms_restrictions()) {
          remove_edge(f);
@@ -367,7 +371,8 @@ int Graph::add_edge(Node* from_node, Node* to_node, cost_t cost,
    }
 
    e = new Edge(from_node, to_node, cost, directed, label);
-   _edges.push_back(e);
+   e->_id = _edge_ids.acquire();
+   e->_position = _edges.insert(_edges.end(), e);
 
    if(GRAPH_HAS_FLAG(this, FLAG_CHECK_ON_INSERT) && 
          !conforms_restrictions()) {
@@ -451,7 +456,8 @@ void Graph::remove_edge(Node* from_node, Node* to_node) {
 void Graph::remove_edge(Edge* edge) {
    edge->remove_self();
 //   int count = _edges.size();
-   _edges.remove(edge);
+   _edges.erase(edge->_position);
+   _edge_ids.release(edge->_id);
 //   assert(_edges.size() < count);
    delete edge;
 }
@@ -467,6 +473,7 @@ void Graph::remove_all_edges() {
       delete *it;
    }
    _edges.clear();
+   _edge_ids.clear();
 }
 
 
@@ -0,0 +1,440 @@
+/*
+ *
+ * Copyright (C) 2011 Christian Brandt
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "gameramodule.hpp"
+#include "frozengraphobject.hpp"
+#include "graphobject.hpp"
+#include "nodeobject.hpp"
+#include "graph.hpp"
+#include <limits>
+
+extern "C" {
+   static PyObject* frozengraph_new(PyTypeObject* pytype, PyObject* args,
+           PyObject* kwds);
+   static void frozengraph_dealloc(PyObject* self);
+   static PyObject* frozengraph_get_nnodes(PyObject* self, PyObject* _);
+   static PyObject* frozengraph_get_nedges(PyObject* self, PyObject* _);
+   static PyObject* frozengraph_is_directed(PyObject* self, PyObject* _);
+   static PyObject* frozengraph_has_node(PyObject* self, PyObject* pyobject);
+   static PyObject* frozengraph_get_nodes(PyObject* self, PyObject* _);
+   static PyObject* frozengraph_BFS(PyObject* self, PyObject* pyobject);
+   static PyObject* frozengraph_DFS(PyObject* self, PyObject* pyobject);
+   static PyObject* frozengraph_dijkstra_shortest_path(PyObject* self, 
+         PyObject* pyobject);
+   static PyObject* frozengraph_all_pairs_distance_matrix(PyObject* self, 
+         PyObject* args);
+   static PyObject* frozengraph_create_minimum_spanning_tree(PyObject* self, 
+         PyObject* _);
+   static PyObject* frozengraph_colorize(PyObject* self, PyObject* pyobject);
+   static PyObject* frozengraph_get_color(PyObject* self, PyObject* pyobject);
+}
+
+#define INIT_SELF_FROZENGRAPH() FrozenGraphObject* so = ((FrozenGraphObject*)self)
+
+
+
+// -----------------------------------------------------------------------------
+// Python Type Definition
+// -----------------------------------------------------------------------------
+static PyTypeObject FrozenGraphType = {
+  PyObject_HEAD_INIT(NULL)
+  0,
+};
+
+
+
+// -----------------------------------------------------------------------------
+PyMethodDef frozengraph_methods[] = {
+  { CHAR_PTR_CAST "is_directed", frozengraph_is_directed, METH_NOARGS,
+    CHAR_PTR_CAST "**is_directed** ()\n\n" \
+    "Returns ``True`` if the graph was directed.\n"
+  },
+  { CHAR_PTR_CAST "has_node", frozengraph_has_node, METH_O,
+    CHAR_PTR_CAST "**has_node** (*value*)\n\n" \
+    "Returns ``True`` if graph has a node identified by *value*.\n\n"\
+    "**Complexity**: *O* ( ln *n* ) where *n* is the number of nodes.\n\n"
+  },
+  { CHAR_PTR_CAST "get_nodes", frozengraph_get_nodes, METH_NOARGS,
+    CHAR_PTR_CAST "**get_nodes** ()\n\n" \
+    "Returns a list of the node values in the order of the rows and\n" \
+    "columns of all_pairs_distance_matrix.\n\n"
+  },
+  { CHAR_PTR_CAST "BFS", frozengraph_BFS, METH_O,
+    CHAR_PTR_CAST "**BFS** (*value*)\n\n" \
+    "Returns a list of the values of the nodes reachable from the node\n" \
+    "identified by *value*, in the order of a breadth-first search.  The\n" \
+    "order is the same as that of ``Graph.BFS``.\n\n"
+  },
+  { CHAR_PTR_CAST "DFS", frozengraph_DFS, METH_O,
+    CHAR_PTR_CAST "**DFS** (*value*)\n\n" \
+    "Returns a list of the values of the nodes reachable from the node\n" \
+    "identified by *value*, in the order of a depth-first search.  The\n" \
+    "order is the same as that of ``Graph.DFS``.\n\n"
+  },
+  { CHAR_PTR_CAST "dijkstra_shortest_path", frozengraph_dijkstra_shortest_path, METH_O,
+    CHAR_PTR_CAST "**dijkstra_shortest_path** (*value*)\n\n" \
+    "Calculates the shortest paths from the node identified by *value* to\n" \
+    "all nodes that can be reached from it, using Dijkstra's algorithm.\n\n" \
+    "The result is a dictionary like that of\n" \
+    "``Graph.dijkstra_shortest_path``, except that it only has entries\n" \
+    "for the nodes that can be reached.\n\n" \
+    "**Complexity**: *O* ( (*n* + *e*) ln *n* ) where *n* is the number\n" \
+    "of nodes and *e* the number of edges.\n\n"
+  },
+  { CHAR_PTR_CAST "shortest_path", frozengraph_dijkstra_shortest_path, METH_O,
+    CHAR_PTR_CAST "**shortest_path** (*value*)\n\n" \
+    "Same as dijkstra_shortest_path.\n\n"
+  },
+  { CHAR_PTR_CAST "all_pairs_distance_matrix", 
+    frozengraph_all_pairs_distance_matrix, METH_VARARGS,
+    CHAR_PTR_CAST "**all_pairs_distance_matrix** (*threads* = 0)\n\n" \
+    "Calculates the costs of the shortest paths between all pairs of\n" \
+    "nodes with Dijkstra's algorithm, starting from the nodes in parallel\n" \
+    "on *threads* threads (0 means all processors).\n\n" \
+    "The result is a ``FloatImage`` with one row and one column per node\n" \
+    "in the order of get_nodes, holding the cost of the shortest path\n" \
+    "from the row node to the column node, or infinity when there is no\n" \
+    "path.  This needs much less memory than\n" \
+    "``Graph.dijkstra_all_pairs_shortest_path``, which also returns\n" \
+    "the paths.\n\n" \
+    "**Complexity**: *O* ( *n* (*n* + *e*) ln *n* ) where *n* is the\n" \
+    "number of nodes and *e* the number of edges.\n\n"
+  },
+  { CHAR_PTR_CAST "create_minimum_spanning_tree", 
+    frozengraph_create_minimum_spanning_tree, METH_NOARGS,
+    CHAR_PTR_CAST "**create_minimum_spanning_tree** ()\n\n" \
+    "Returns a new ``Graph`` that is a minimum spanning tree (or forest)\n" \
+    "of this undirected graph, using Kruskal's algorithm with a\n" \
+    "union-find structure.\n\n" \
+    "**Complexity**: *O* ( *e* ln *e* ) where *e* is the number of edges.\n\n"
+  },
+  { CHAR_PTR_CAST "colorize", frozengraph_colorize, METH_O,
+    CHAR_PTR_CAST "**colorize** (*ncolors*)\n\n" \
+    "Colors the nodes with *ncolors* colors (at least 6) such that no two\n" \
+    "neighbors have the same color, like ``Graph.colorize``.  The colors\n" \
+    "are returned by get_color.\n\n" \
+    "**Complexity**: *O* ( *n* + *e* ) where *n* is the number of nodes and\n" \
+    "*e* the number of edges.\n\n"
+  },
+  { CHAR_PTR_CAST "get_color", frozengraph_get_color, METH_O,
+    CHAR_PTR_CAST "**get_color** (*value*)\n\n" \
+    "Returns the color of the node identified by *value* after colorize\n" \
+    "has been called.\n\n"
+  },
+  { NULL }
+};
+
+
+
+// -----------------------------------------------------------------------------
+PyGetSetDef frozengraph_getset[] = {
+  { CHAR_PTR_CAST "nnodes", (getter)frozengraph_get_nnodes, 0,
+    CHAR_PTR_CAST "Number of nodes in the graph", 0 },
+  { CHAR_PTR_CAST "nedges", (getter)frozengraph_get_nedges, 0,
+    CHAR_PTR_CAST "Number of edges in the graph", 0 },
+  { NULL }
+};
+
+
+
+// -----------------------------------------------------------------------------
+void init_FrozenGraphType(PyObject* d) {
+  FrozenGraphType.ob_type = &PyType_Type;
+  FrozenGraphType.tp_name = CHAR_PTR_CAST "gamera.graph.FrozenGraph";
+  FrozenGraphType.tp_basicsize = sizeof(FrozenGraphObject);
+  FrozenGraphType.tp_dealloc = frozengraph_dealloc;
+  FrozenGraphType.tp_flags = Py_TPFLAGS_DEFAULT;
+  FrozenGraphType.tp_new = frozengraph_new;
+  FrozenGraphType.tp_getattro = PyObject_GenericGetAttr;
+  FrozenGraphType.tp_alloc = NULL; // PyType_GenericAlloc;
+  FrozenGraphType.tp_free = NULL; // _PyObject_Del;
+  FrozenGraphType.tp_methods = frozengraph_methods;
+  FrozenGraphType.tp_getset = frozengraph_getset;
+  FrozenGraphType.tp_weaklistoffset = 0;
+  FrozenGraphType.tp_doc = CHAR_PTR_CAST
+    "**FrozenGraph** (*graph*)\n\n" \
+    "Creates a compact copy of *graph* that cannot be changed.\n\n" \
+    "The nodes are numbered and the edges stored in contiguous arrays\n" \
+    "(compressed sparse row form) instead of node and edge objects, so\n" \
+    "that large graphs need much less memory, and searching, shortest\n" \
+    "paths, minimum spanning trees and coloring are much faster.  When\n" \
+    "*graph* changes later, the ``FrozenGraph`` does not.\n\n";
+
+  PyType_Ready(&FrozenGraphType);
+  PyDict_SetItemString(d, "FrozenGraph", (PyObject*)&FrozenGraphType);
+}
+
+
+
+// -----------------------------------------------------------------------------
+bool is_FrozenGraphObject(PyObject* self) {
+  return PyObject_TypeCheck(self, &FrozenGraphType);
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_new(PyTypeObject* pytype, PyObject* args,
+		    PyObject* kwds) {
+   PyObject* graph = NULL;
+   if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O:FrozenGraph.__init__", &graph) <= 0)
+      return NULL;
+   if (!is_GraphObject(graph)) {
+      PyErr_SetString(PyExc_TypeError, "Invalid argument type (must be Graph)");
+      return NULL;
+   }
+
+   FrozenGraphObject* so = 
+      (FrozenGraphObject*)(FrozenGraphType.tp_alloc(&FrozenGraphType, 0));
+   so->_colors = NULL;
+   so->_graph = new CsrGraph(((GraphObject*)graph)->_graph);
+   return (PyObject*)so;
+}
+
+
+
+// -----------------------------------------------------------------------------
+void frozengraph_dealloc(PyObject* self) {
+   INIT_SELF_FROZENGRAPH();
+   delete so->_graph;
+   delete so->_colors;
+   self->ob_type->tp_free(self);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/// index of the node given by a Node object or a value, or NONE with a
+/// KeyError set
+static size_t frozengraph_index(FrozenGraphObject* so, PyObject* pyobject) {
+   size_t index;
+   if(is_NodeObject(pyobject) && ((NodeObject*)pyobject)->_node != NULL)
+      index = so->_graph->get_index(((NodeObject*)pyobject)->_node->_value);
+   else {
+      GraphDataPyObject a(pyobject);
+      index = so->_graph->get_index(&a);
+   }
+   if(index == CsrGraph::NONE)
+      PyErr_SetString(PyExc_KeyError, "node not found");
+   return index;
+}
+
+static inline PyObject* frozengraph_value(FrozenGraphObject* so, size_t index) {
+   return dynamic_cast<GraphDataPyObject*>(so->_graph->get_value(index))->data;
+}
+
+static PyObject* frozengraph_values(FrozenGraphObject* so, 
+      const std::vector<size_t>& indices) {
+   PyObject* list = PyList_New(indices.size());
+   for(size_t i = 0; i < indices.size(); i++) {
+      PyObject* value = frozengraph_value(so, indices[i]);
+      Py_INCREF(value);
+      PyList_SET_ITEM(list, i, value);
+   }
+   return list;
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_get_nnodes(PyObject* self, PyObject* _) {
+   INIT_SELF_FROZENGRAPH();
+   RETURN_INT(so->_graph->get_nnodes());
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_get_nedges(PyObject* self, PyObject* _) {
+   INIT_SELF_FROZENGRAPH();
+   RETURN_INT(so->_graph->get_nedges());
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_is_directed(PyObject* self, PyObject* _) {
+   INIT_SELF_FROZENGRAPH();
+   RETURN_BOOL(so->_graph->is_directed());
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_has_node(PyObject* self, PyObject* pyobject) {
+   INIT_SELF_FROZENGRAPH();
+   GraphDataPyObject a(pyobject);
+   RETURN_BOOL(so->_graph->get_index(&a) != CsrGraph::NONE);
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_get_nodes(PyObject* self, PyObject* _) {
+   INIT_SELF_FROZENGRAPH();
+   PyObject* list = PyList_New(so->_graph->get_nnodes());
+   for(size_t i = 0; i < so->_graph->get_nnodes(); i++) {
+      PyObject* value = frozengraph_value(so, i);
+      Py_INCREF(value);
+      PyList_SET_ITEM(list, i, value);
+   }
+   return list;
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_BFS(PyObject* self, PyObject* pyobject) {
+   INIT_SELF_FROZENGRAPH();
+   size_t root = frozengraph_index(so, pyobject);
+   if(root == CsrGraph::NONE)
+      return NULL;
+   std::vector<size_t> order;
+   so->_graph->BFS(root, order);
+   return frozengraph_values(so, order);
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_DFS(PyObject* self, PyObject* pyobject) {
+   INIT_SELF_FROZENGRAPH();
+   size_t root = frozengraph_index(so, pyobject);
+   if(root == CsrGraph::NONE)
+      return NULL;
+   std::vector<size_t> order;
+   so->_graph->DFS(root, order);
+   return frozengraph_values(so, order);
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_dijkstra_shortest_path(PyObject* self, PyObject* pyobject) {
+   INIT_SELF_FROZENGRAPH();
+   size_t source = frozengraph_index(so, pyobject);
+   if(source == CsrGraph::NONE)
+      return NULL;
+   std::vector<cost_t> distance;
+   std::vector<size_t> predecessor;
+   so->_graph->dijkstra_shortest_path(source, distance, predecessor);
+
+   // same form as pathmap_to_dict: value -> (cost, [value, ..., source])
+   PyObject* pathdict = PyDict_New();
+   std::vector<size_t> path;
+   for(size_t n = 0; n < so->_graph->get_nnodes(); n++) {
+      if(distance[n] == std::numeric_limits<cost_t>::max())
+         continue;
+      path.clear();
+      for(size_t p = n; p != CsrGraph::NONE; p = predecessor[p])
+         path.push_back(p);
+      PyObject *pathtuple = PyTuple_New(2);
+      PyTuple_SetItem(pathtuple, 0, PyFloat_FromDouble(distance[n]));
+      PyTuple_SetItem(pathtuple, 1, frozengraph_values(so, path));
+      PyDict_SetItem(pathdict, frozengraph_value(so, n), pathtuple);
+      Py_DECREF(pathtuple);
+   }
+   return pathdict;
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_all_pairs_distance_matrix(PyObject* self, PyObject* args) {
+   INIT_SELF_FROZENGRAPH();
+   int threads = 0;
+   if(PyArg_ParseTuple(args, CHAR_PTR_CAST "|i:all_pairs_distance_matrix", 
+            &threads) <= 0)
+      return NULL;
+   size_t nnodes = so->_graph->get_nnodes();
+   if(nnodes == 0) {
+      PyErr_SetString(PyExc_RuntimeError, "The graph has no nodes.");
+      return NULL;
+   }
+
+   std::vector<cost_t> distance;
+   try {
+      so->_graph->all_pairs_shortest_path(distance, NULL, threads);
+   }
+   catch (std::bad_alloc) {
+      PyErr_SetString(PyExc_MemoryError, 
+            "Not enough memory for the distance matrix.");
+      return NULL;
+   }
+
+   FloatImageData* data = new FloatImageData(Dim(nnodes, nnodes));
+   FloatImageView* mat = new FloatImageView(*data);
+   FloatImageView::vec_iterator out = mat->vec_begin();
+   for(size_t i = 0; i < distance.size(); i++, out++) {
+      if(distance[i] == std::numeric_limits<cost_t>::max())
+         *out = std::numeric_limits<FloatPixel>::infinity();
+      else
+         *out = distance[i];
+   }
+   return create_ImageObject(mat);
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_create_minimum_spanning_tree(PyObject* self, PyObject* _) {
+   INIT_SELF_FROZENGRAPH();
+   Graph* g = so->_graph->create_minimum_spanning_tree();
+   if(g == NULL) {
+      PyErr_SetString(PyExc_TypeError, "Graph Type does not match");
+      return NULL;
+   }
+   return (PyObject*)graph_new(g);
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_colorize(PyObject* self, PyObject* pyobject) {
+   INIT_SELF_FROZENGRAPH();
+   unsigned int ncolors = PyInt_AsUnsignedLongMask(pyobject);
+   std::vector<unsigned int>* colors = new std::vector<unsigned int>;
+   try {
+      so->_graph->colorize(ncolors, *colors);
+   }
+   catch (std::runtime_error e) {
+      delete colors;
+      PyErr_SetString(PyExc_RuntimeError, e.what());
+      return NULL;
+   }
+   delete so->_colors;
+   so->_colors = colors;
+   RETURN_VOID();
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* frozengraph_get_color(PyObject* self, PyObject* pyobject) {
+   INIT_SELF_FROZENGRAPH();
+   if(so->_colors == NULL) {
+      PyErr_SetString(PyExc_RuntimeError, "FrozenGraph.get_color: Graph is not colorized");
+      return NULL;
+   }
+   size_t index = frozengraph_index(so, pyobject);
+   if(index == CsrGraph::NONE)
+      return NULL;
+   RETURN_INT((*so->_colors)[index]);
+}
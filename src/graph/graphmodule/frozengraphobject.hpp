@@ -0,0 +1,37 @@
+/*
+ *
+ * Copyright (C) 2011 Christian Brandt
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef _FROZENGRAPHOBJECT_HPP_A7D40E51C93B28
+#define _FROZENGRAPHOBJECT_HPP_A7D40E51C93B28
+
+#include "wrapper.hpp"
+#include "csr_graph.hpp"
+
+// FrozenGraphObject contains a compact, unchangeable copy of a Graph
+struct FrozenGraphObject {
+   PyObject_HEAD
+   CsrGraph* _graph;
+   std::vector<unsigned int>* _colors; ///< NULL until colorize is called
+};
+
+void init_FrozenGraphType(PyObject* dict);
+bool is_FrozenGraphObject(PyObject* self);
+
+#endif /* _FROZENGRAPHOBJECT_HPP_A7D40E51C93B28 */
@@ -21,6 +21,7 @@
 #include "nodeobject.hpp"
 #include "graphobject.hpp"
 #include "edgeobject.hpp"
+#include "frozengraphobject.hpp"
 
 
 
@@ -70,6 +71,7 @@ DL_EXPORT(void) initgraph(void) {
   init_NodeType();
   init_EdgeType();
   init_GraphType(d);
+  init_FrozenGraphType(d);
 
   PyDict_SetItemString(d, "DEFAULT", PyInt_FromLong(FLAG_DEFAULT));
   PyDict_SetItemString(d, "DIRECTED", PyInt_FromLong(FLAG_DIRECTED));
@@ -197,6 +197,7 @@ PyObject* graph_create_minimum_spanning_tree_unique_distances(GraphObject* so,
       return 0;
    }
    FloatImageView* dists = (FloatImageView*)((RectObject*)uniq_dists)->m_x;
+   dists->refresh();
    if (dists->nrows() != dists->ncols()) {
       PyErr_SetString(PyExc_TypeError, "image must be symmetric.");
       Py_DECREF(images_seq);
@@ -247,6 +248,101 @@ PyObject* graph_create_minimum_spanning_tree_unique_distances(GraphObject* so,
 
 
 
+// -----------------------------------------------------------------------------
+// graph_create_minimum_spanning_tree_edges
+// -----------------------------------------------------------------------------
+
+/// Sorting class for graph_create_minimum_spanning_tree_edges
+struct EdgeCostSorter {
+   bool operator()(const std::pair<cost_t, std::pair<size_t, size_t> >& a,
+         const std::pair<cost_t, std::pair<size_t, size_t> >& b) {
+      return a.first < b.first;
+   }
+};
+
+
+
+/// root of the tree of i in a union-find forest
+inline size_t find_tree(std::vector<size_t>& parent, size_t i) {
+   while(parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+   }
+   return i;
+}
+
+
+
+// -----------------------------------------------------------------------------
+PyObject* graph_create_minimum_spanning_tree_edges(GraphObject* so, 
+      PyObject* images, PyObject* edges) {
+
+   PyObject* images_seq = PySequence_Fast(images, "images must be iteratable");
+   if (images_seq == NULL)
+      return NULL;
+   PyObject* edges_seq = PySequence_Fast(edges, "edges must be iteratable");
+   if (edges_seq == NULL) {
+      Py_DECREF(images_seq);
+      return NULL;
+   }
+
+   // read the edges (i, j, cost) between the images
+   size_t images_len = PySequence_Fast_GET_SIZE(images_seq);
+   size_t edges_len = PySequence_Fast_GET_SIZE(edges_seq);
+   typedef std::vector<std::pair<cost_t, std::pair<size_t, size_t> > > edge_vec_type;
+   edge_vec_type sorted(edges_len);
+   for (size_t e = 0; e < edges_len; ++e) {
+      long i, j;
+      double cost;
+      if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(edges_seq, e),
+               CHAR_PTR_CAST "lld:create_minimum_spanning_tree", &i, &j, &cost)) {
+         Py_DECREF(images_seq);
+         Py_DECREF(edges_seq);
+         return NULL;
+      }
+      if (i < 0 || j < 0 || size_t(i) >= images_len || size_t(j) >= images_len) {
+         PyErr_SetString(PyExc_IndexError, "edge between unknown images.");
+         Py_DECREF(images_seq);
+         Py_DECREF(edges_seq);
+         return NULL;
+      }
+      sorted[e] = std::make_pair(cost_t(cost), std::make_pair(size_t(i), size_t(j)));
+   }
+   Py_DECREF(edges_seq);
+   std::stable_sort(sorted.begin(), sorted.end(), EdgeCostSorter());
+
+   // get the graph ready
+   so->_graph->remove_all_edges();
+   GRAPH_UNSET_FLAG(so->_graph, FLAG_CYCLIC);
+
+   std::vector<Node*> nodes(images_len);
+   for (size_t i = 0; i < images_len; ++i) {
+      GraphDataPyObject* obj = new GraphDataPyObject(PySequence_Fast_GET_ITEM(images_seq, i));
+      nodes[i] = so->_graph->add_node_ptr(obj);
+      assert(nodes[i] != NULL);
+   }
+   Py_DECREF(images_seq);
+
+   // create the mst (or forest) using kruskal, with the trees
+   // in a union-find forest instead of the whole distance matrix
+   std::vector<size_t> parent(images_len);
+   for (size_t i = 0; i < images_len; ++i)
+      parent[i] = i;
+   for (size_t e = 0; e < edges_len; ++e) {
+      size_t a = find_tree(parent, sorted[e].second.first);
+      size_t b = find_tree(parent, sorted[e].second.second);
+      if (a == b)
+         continue;
+      parent[a] = b;
+      so->_graph->add_edge(nodes[sorted[e].second.first],
+            nodes[sorted[e].second.second], sorted[e].first);
+   }
+
+   RETURN_VOID();
+}
+
+
+
 // -----------------------------------------------------------------------------
 PyObject* graph_create_minimum_spanning_tree(PyObject* self, PyObject* args) {
    INIT_SELF_GRAPH();
@@ -267,6 +363,8 @@ PyObject* graph_create_minimum_spanning_tree(PyObject* self, PyObject* args) {
       return (PyObject*)graph_new(g);
 
    }
+   else if (PyList_Check(uniq_dists) || PyTuple_Check(uniq_dists))
+      return graph_create_minimum_spanning_tree_edges(so, images, uniq_dists);
    else
       return graph_create_minimum_spanning_tree_unique_distances(so, images, 
             uniq_dists);
@@ -83,7 +83,13 @@ extern "C" {
   { CHAR_PTR_CAST "create_minimum_spanning_tree", graph_create_minimum_spanning_tree, METH_VARARGS, \
     CHAR_PTR_CAST "**create_minimum_spanning_tree** ()\n\n" \
     "Creates a minimum spanning tree of the entire graph in place using Kruskal's algorithm.\n" \
-    "A minimum spanning tree connects all nodes using the minimum total edge cost.\n" \
+    "A minimum spanning tree connects all nodes using the minimum total edge cost.\n\n" \
+    "**create_minimum_spanning_tree** (*images*, *distances*)\n\n" \
+    "Replaces the graph by the minimum spanning tree of the *images*. *distances* is\n" \
+    "either the symmetric FloatImage of the distances between all images, or a list of\n" \
+    "edges as tuples (*i*, *j*, *distance*) between the images *i* and *j* (as given by\n" \
+    "*kNN.spanning_tree*). Only these edges are considered, so that the result is a forest\n" \
+    "if they do not connect all images.\n" \
   }, \
 
 
@@ -58,10 +58,12 @@ struct NTIteratorObject: IteratorObject {
       return (PyObject*)node_deliver(n,((NTIteratorObject*)self)->_graph);
    }
    static void dealloc(IteratorObject* self) {
+      // the iterator gives its visit map back to the graph, which must
+      // still exist
+      delete (itertype*)((NTIteratorObject*)self)->_iterator;
       if(((NTIteratorObject*)self)->_graph) {
          Py_DECREF(((NTIteratorObject*)self)->_graph);
       }
-      delete (itertype*)((NTIteratorObject*)self)->_iterator;
    }
 
    itertype* _iterator;
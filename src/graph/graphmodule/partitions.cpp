@@ -27,6 +27,10 @@
 #include "graph.hpp"
 #include <limits>
 #include <cstdio>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // This should always be at least a 64-bit unsigned
 // If compiling on a platform with a larger available native integer length,
@@ -42,6 +46,7 @@ typedef unsigned long long Bitfield;
 
 extern "C" {
    PyObject* graph_optimize_partitions(PyObject* self, PyObject* args);
+   PyObject* graph_optimize_all_partitions(PyObject* self, PyObject* args);
 }
 
 
@@ -55,6 +60,10 @@ protected:
    std::set<Node*> _visited1;
    std::set<Node*> _visited2;
    std::map<Node*,unsigned long> _number;
+   std::map<Bitfield,double> _scores; ///< scores of the current subgraph
+   /// the numbers of the neighbors of each node of the current subgraph,
+   /// in the order of its edges (more than once for parallel edges)
+   std::vector<std::vector<size_t> > _adjacent;
 
    void visit1(Node* n) {
       _visited1.insert(n);
@@ -129,6 +138,18 @@ protected:
    typedef std::vector<Part> Parts;
    typedef std::vector<Bitfield> Solution;
 
+public:
+   /// a subgraph prepared for the search: its nodes in the order of the
+   /// bits, its scored parts and, after solve, the best partition
+   struct Subgraph {
+      std::vector<Node*> nodes;
+      Parts parts;
+      bool trivial; ///< too large or a single node: every node is a group
+      Solution best_solution;
+   };
+
+protected:
+
    void print_parts(Parts& parts) {
       std::cerr << "parts =====\n";
       for (size_t i = 0; i < parts.size(); ++i) {
@@ -214,19 +235,14 @@ protected:
    }
 
    // --------------------------------------------------------------------------
-   inline void graph_optimize_partitions_evaluate_parts(Node* node, 
-         const size_t max_parts_per_group,
-         const size_t subgraph_size,
-         std::vector<Node*>& node_stack,
-         Bitfield bits,
-         const PyObject* eval_func, Parts& parts) {
-
-      size_t node_number = get_number(node);
-      node_stack.push_back(node);
-      bits |= (Bitfield)1 << node_number;
+   /** Gets the score for a group by building a Python list and passing
+    * it to the (Python) evaluation function.  When cache is a dict, the
+    * scores are kept in it under the sorted ids of the values in the
+    * group, so that later calls can reuse them.
+    * */
+   double graph_optimize_partitions_score(std::vector<Node*>& node_stack,
+         const PyObject* eval_func, PyObject* cache) {
 
-      // Get the score for this part by building a Python list and
-      // passing it to the (Python) evaluation function
       PyObject* result = PyList_New(node_stack.size());
       size_t j = 0;
       for (std::vector<Node*>::iterator i = node_stack.begin();
@@ -235,6 +251,24 @@ protected:
          PyList_SET_ITEM(result, j, dynamic_cast<GraphDataPyObject*>((*i)->_value)->data);
       }
 
+      PyObject* key = NULL;
+      if (cache != NULL) {
+         // the values need not be hashable, so their sorted ids are used
+         std::vector<void*> ids(node_stack.size());
+         for (j = 0; j < node_stack.size(); ++j)
+            ids[j] = dynamic_cast<GraphDataPyObject*>(node_stack[j]->_value)->data;
+         std::sort(ids.begin(), ids.end());
+         key = PyTuple_New(ids.size());
+         for (j = 0; j < ids.size(); ++j)
+            PyTuple_SET_ITEM(key, j, PyLong_FromVoidPtr(ids[j]));
+         PyObject* cached = PyDict_GetItem(cache, key);
+         if (cached != NULL && PyFloat_Check(cached)) {
+            Py_DECREF(key);
+            Py_DECREF(result);
+            return PyFloat_AsDouble(cached);
+         }
+      }
+
       PyObject* tuple = Py_BuildValue(CHAR_PTR_CAST "(O)", result);
       PyObject* evalobject = PyObject_CallObject(const_cast<PyObject*>(eval_func), tuple);
       Py_DECREF(tuple);
@@ -244,27 +278,57 @@ protected:
       if (evalobject == NULL)
          eval = -1.0;
       else {
-         if (PyFloat_Check(evalobject))
+         if (PyFloat_Check(evalobject)) {
             eval = PyFloat_AsDouble(evalobject);
+            if (key != NULL)
+               PyDict_SetItem(cache, key, evalobject);
+         }
          else
             eval = -1.0;
          Py_DECREF(evalobject);
       }
+      Py_XDECREF(key);
+      return eval;
+   }
 
-      parts.push_back(Part(bits, eval));
 
-      if ((node_stack.size() < max_parts_per_group) &&
-            (get_number(node) != subgraph_size - 1)) {
-         EdgePtrIterator* ei = node->get_edges();
-         Edge* e;
-         while((e = ei->next()) != NULL) {
-            Node* to_node = e->traverse(node);
-            if (get_number(to_node) > node_number)
+
+   // --------------------------------------------------------------------------
+   /** Adds the groups of the paths through nodes with increasing numbers
+    * that continue the path in node_stack with node_number.  The groups
+    * are bitfields of node numbers, and the nodes are only looked up to
+    * score a group that has not been seen before.
+    * */
+   inline void graph_optimize_partitions_evaluate_parts(size_t node_number,
+         const size_t max_parts_per_group,
+         const std::vector<Node*>& nodes,
+         std::vector<Node*>& node_stack,
+         Bitfield bits,
+         const PyObject* eval_func, PyObject* cache, Parts& parts) {
+
+      node_stack.push_back(nodes[node_number]);
+      bits |= (Bitfield)1 << node_number;
+
+      // Parallel edges lead to the same group more than once, but it is
+      // only scored once
+      std::map<Bitfield,double>::iterator known = _scores.find(bits);
+      if (known != _scores.end())
+         parts.push_back(Part(bits, known->second));
+      else {
+         double eval = graph_optimize_partitions_score(node_stack, 
+               eval_func, cache);
+         _scores[bits] = eval;
+         parts.push_back(Part(bits, eval));
+      }
+
+      if (node_stack.size() < max_parts_per_group) {
+         const std::vector<size_t>& adjacent = _adjacent[node_number];
+         for (size_t i = 0; i < adjacent.size(); ++i) {
+            if (adjacent[i] > node_number)
                graph_optimize_partitions_evaluate_parts(
-                  to_node, max_parts_per_group, subgraph_size,
-                  node_stack, bits, eval_func, parts);
+                  adjacent[i], max_parts_per_group, nodes,
+                  node_stack, bits, eval_func, cache, parts);
          }
-         delete ei;
       }
 
       node_stack.pop_back();
@@ -311,6 +375,11 @@ protected:
          ScoreValue partial_val, const Bitfield bits, const Bitfield all_bits, 
          const char* criterion) {
 
+      // With the criterion "min", more parts can only lower the minimum,
+      // so a partial solution below the best minimum can not become better
+      if (partial_val.value1 < best_val.value1 && 0 != strcmp(criterion, "avg"))
+         return;
+
       ScoreValue tmp_val = partial_val;
 
       if (bits == all_bits) {
@@ -351,13 +420,16 @@ protected:
 
 public:
    // --------------------------------------------------------------------------
-   PyObject* optimize_partitions(const GraphObject* so, Node* root,
-                                       const PyObject* eval_func, 
-                                       const size_t max_parts_per_group,
-                                       const size_t max_graph_size, 
-                                       const char* criterion = "min") {
+   /** Numbers the nodes of the subgraph of root and scores its parts with
+    * eval_func.  This calls Python and needs the GIL.
+    * */
+   void prepare(Node* root, const PyObject* eval_func, PyObject* cache,
+         const size_t max_parts_per_group, const size_t max_graph_size,
+         Subgraph& sg) {
+
       _visited2.clear();
       _visited1.clear();
+      _scores.clear();
       // not neccessary because of set-based approach
 
       size_t size;
@@ -369,103 +441,164 @@ public:
          // We can't do the grouping if there's more than 64 nodes,
          // so just return them all.  Also, if there's only one node,
          // just trivially return it to save time.
-         if (size > BITFIELD_SIZE - 2 || size > max_graph_size || size == 1) {
-            // Now, build a Python list of the solution
-            PyObject* result = PyList_New(subgraph.size());
-            for (size_t i = 0; i < subgraph.size(); ++i) {
-               PyObject* subresult = PyList_New(1);
-               Py_INCREF(dynamic_cast<GraphDataPyObject*>(subgraph[i]->_value)->data);
-               PyList_SET_ITEM(subresult, 0, dynamic_cast<GraphDataPyObject*>(subgraph[i]->_value)->data);
-               PyList_SET_ITEM(result, i, subresult);
-            }
-            return result;
+         sg.trivial = 
+            size > BITFIELD_SIZE - 2 || size > max_graph_size || size == 1;
+         if (sg.trivial) {
+            sg.nodes.swap(subgraph);
+            return;
          }
       }
-      {
-         Solution best_solution;
-         std::vector<Node*> subgraph;
-         subgraph.reserve(size);
-         {
-            Parts parts;
-
-            graph_optimize_partitions_number_parts(root, subgraph);
-
-            // That gives us an idea of the number of nodes in the graph,
-            // now go through and find the parts
-
-            parts.reserve(size * max_parts_per_group);
-            std::vector<Node*> node_stack;
-            node_stack.reserve(max_parts_per_group);
-            for (std::vector<Node*>::iterator i = subgraph.begin();
-                  i != subgraph.end(); ++i) {
-               Bitfield bits = 0;
-               graph_optimize_partitions_evaluate_parts(*i, max_parts_per_group, 
-                     size, node_stack, bits, eval_func, parts);
-            }
 
-            // Build the skip list
-            graph_optimize_partitions_find_skips(parts);
-
-            // Now, we find a solution
-            Solution partial_solution;
-            best_solution.reserve(size);    // Maximum size the solution can be
-            partial_solution.reserve(size); // Maximum size the solution can be
-            Bitfield all_bits = (Bitfield(1) << size) - 1;
-            ScoreValue best_val;
-            best_val.value1 = best_val.value2 = 0.0;
-            // partial_val.value1 carries sum (criterion "avg") or minimum ("min")
-            // of confidences in subgroups => different initialization
-            // partial_val.value2 always carries sum
-            ScoreValue partial_val_init;
-            partial_val_init.value2 = 0.0;
-            if (0 == strcmp(criterion, "avg")) {
-               partial_val_init.value1 = 0.0;
-            } else { // criterion == "min"
-               partial_val_init.value1 = std::numeric_limits<double>::max();
-            }
-            graph_optimize_partitions_find_solution(
-               parts, 0, (*(parts.begin())).begin,
-               best_solution, best_val,
-               partial_solution, partial_val_init,
-               0, all_bits, criterion);
-         }
+      sg.nodes.reserve(size);
+      graph_optimize_partitions_number_parts(root, sg.nodes);
+      _adjacent.assign(size, std::vector<size_t>());
+      for (size_t i = 0; i < size; ++i) {
+         EdgePtrIterator* ei = sg.nodes[i]->get_edges();
+         Edge* e;
+         while((e = ei->next()) != NULL)
+            _adjacent[i].push_back(get_number(e->traverse(sg.nodes[i])));
+         delete ei;
+      }
 
-         // Now, build a Python list of the solution
-         PyObject* result = PyList_New(best_solution.size());
-         for (size_t i = 0; i < best_solution.size(); ++i) {
-            Bitfield solution_part = best_solution[i];
-            size_t c = 0;
-            for (size_t b=0; b < BITFIELD_SIZE; ++b) {
-               if (((Bitfield)1 << b) & solution_part)
-                  ++c;
-            }
-            // Count the set bits (Kernighan's method) so that we can allocate the
-            // correct sized list from the get-go
-            // (Kernighan's method does not seem to work on OS-X PPC, so I've
-            // replaced it with the above)
-            /*    size_t c = 0;
-               for (; solution_part; c++)
-                  solution_part &= solution_part - 1; */
-            PyObject* subresult = PyList_New(c);
-            Bitfield k = (Bitfield)1;
-            solution_part = best_solution[i];
-            for (size_t j = 0, l = 0; k < solution_part; ++j, k <<= 1)
-               if (solution_part & k) {
-                  PyObject* data = dynamic_cast<GraphDataPyObject*>(subgraph[j]->_value)->data;
-                  Py_INCREF(data);
-                  PyList_SET_ITEM(subresult, l++, data);
-               }
-				
+      // That gives us an idea of the number of nodes in the graph,
+      // now go through and find the parts
+
+      sg.parts.reserve(size * max_parts_per_group);
+      std::vector<Node*> node_stack;
+      node_stack.reserve(max_parts_per_group);
+      for (size_t i = 0; i < size; ++i) {
+         Bitfield bits = 0;
+         graph_optimize_partitions_evaluate_parts(i, max_parts_per_group, 
+               sg.nodes, node_stack, bits, eval_func, cache, sg.parts);
+      }
+
+      // Build the skip list
+      graph_optimize_partitions_find_skips(sg.parts);
+   }
+
+
+
+   // --------------------------------------------------------------------------
+   /** Finds the best partition of a prepared subgraph.  This does not
+    * touch any Python objects, so that several subgraphs can be solved
+    * in parallel without the GIL.
+    * */
+   void solve(Subgraph& sg, const char* criterion) {
+      if (sg.trivial)
+         return;
+
+      size_t size = sg.nodes.size();
+      Solution partial_solution;
+      sg.best_solution.reserve(size); // Maximum size the solution can be
+      partial_solution.reserve(size); // Maximum size the solution can be
+      Bitfield all_bits = (Bitfield(1) << size) - 1;
+      ScoreValue best_val;
+      best_val.value1 = best_val.value2 = 0.0;
+      // partial_val.value1 carries sum (criterion "avg") or minimum ("min")
+      // of confidences in subgroups => different initialization
+      // partial_val.value2 always carries sum
+      ScoreValue partial_val_init;
+      partial_val_init.value2 = 0.0;
+      if (0 == strcmp(criterion, "avg")) {
+         partial_val_init.value1 = 0.0;
+      } else { // criterion == "min"
+         partial_val_init.value1 = std::numeric_limits<double>::max();
+      }
+      graph_optimize_partitions_find_solution(
+         sg.parts, 0, (*(sg.parts.begin())).begin,
+         sg.best_solution, best_val,
+         partial_solution, partial_val_init,
+         0, all_bits, criterion);
+   }
+
+
+
+   // --------------------------------------------------------------------------
+   /// the best partition of a solved subgraph as a nested Python list
+   PyObject* result(const Subgraph& sg) {
+      if (sg.trivial) {
+         PyObject* result = PyList_New(sg.nodes.size());
+         for (size_t i = 0; i < sg.nodes.size(); ++i) {
+            PyObject* subresult = PyList_New(1);
+            Py_INCREF(dynamic_cast<GraphDataPyObject*>(sg.nodes[i]->_value)->data);
+            PyList_SET_ITEM(subresult, 0, dynamic_cast<GraphDataPyObject*>(sg.nodes[i]->_value)->data);
             PyList_SET_ITEM(result, i, subresult);
          }
          return result;
       }
+
+      const Solution& best_solution = sg.best_solution;
+      PyObject* result = PyList_New(best_solution.size());
+      for (size_t i = 0; i < best_solution.size(); ++i) {
+         Bitfield solution_part = best_solution[i];
+         size_t c = 0;
+         for (size_t b=0; b < BITFIELD_SIZE; ++b) {
+            if (((Bitfield)1 << b) & solution_part)
+               ++c;
+         }
+         // Count the set bits (Kernighan's method) so that we can allocate the
+         // correct sized list from the get-go
+         // (Kernighan's method does not seem to work on OS-X PPC, so I've
+         // replaced it with the above)
+         /*    size_t c = 0;
+            for (; solution_part; c++)
+               solution_part &= solution_part - 1; */
+         PyObject* subresult = PyList_New(c);
+         Bitfield k = (Bitfield)1;
+         solution_part = best_solution[i];
+         for (size_t j = 0, l = 0; l < c; ++j, k <<= 1)
+            if (solution_part & k) {
+               PyObject* data = dynamic_cast<GraphDataPyObject*>(sg.nodes[j]->_value)->data;
+               Py_INCREF(data);
+               PyList_SET_ITEM(subresult, l++, data);
+            }
+				
+         PyList_SET_ITEM(result, i, subresult);
+      }
+      return result;
+   }
+
+
+
+   // --------------------------------------------------------------------------
+   PyObject* optimize_partitions(const GraphObject* so, Node* root,
+                                       const PyObject* eval_func, 
+                                       const size_t max_parts_per_group,
+                                       const size_t max_graph_size, 
+                                       const char* criterion = "min",
+                                       PyObject* cache = NULL) {
+      Subgraph sg;
+      prepare(root, eval_func, cache, max_parts_per_group, max_graph_size, sg);
+      solve(sg, criterion);
+      return result(sg);
    }
 
 };
 
 
 
+// -----------------------------------------------------------------------------
+/// the node for a Node object or a value, or NULL
+static Node* partitions_get_node(GraphObject* so, PyObject* a) {
+   if(is_NodeObject(a))
+      return so->_graph->get_node(((NodeObject*)a)->_node->_value);
+   GraphDataPyObject obj(a);
+   return so->_graph->get_node(&obj);
+}
+
+/// checks that cache is None or a dict and returns it (NULL for None)
+static bool partitions_get_cache(PyObject*& cache) {
+   if (cache == Py_None)
+      cache = NULL;
+   else if (cache != NULL && !PyDict_Check(cache)) {
+      PyErr_SetString(PyExc_TypeError, "cache must be a dict or None");
+      return false;
+   }
+   return true;
+}
+
+
+
 // -----------------------------------------------------------------------------
 PyObject* graph_optimize_partitions(PyObject* self, PyObject* args) {
    GraphObject* so = ((GraphObject*)self);
@@ -473,27 +606,86 @@ PyObject* graph_optimize_partitions(PyObject* self, PyObject* args) {
    int max_parts_per_group = 5;
    int max_graph_size = 16;
    char* criterion = (char*)"min";
-   if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OO|iis:optimize_partitions", &a, 
-            &eval_func, &max_parts_per_group, &max_graph_size, &criterion) <= 0)
+   PyObject* cache = NULL;
+   if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OO|iisO:optimize_partitions", &a, 
+            &eval_func, &max_parts_per_group, &max_graph_size, &criterion,
+            &cache) <= 0)
 
       return 0;
+   if (!partitions_get_cache(cache))
+      return 0;
 
-
-   Node* root;
-   if(is_NodeObject(a))
-      root = so->_graph->get_node(((NodeObject*)a)->_node->_value);
-   else {
-      GraphDataPyObject obj(a);
-      root = so->_graph->get_node(&obj);
-   }
+   Node* root = partitions_get_node(so, a);
    if (root == NULL)
       return 0;
 
    Partitions p;
    PyObject* result = p.optimize_partitions(so, root, eval_func, 
-         max_parts_per_group, max_graph_size, criterion);
+         max_parts_per_group, max_graph_size, criterion, cache);
 
    assert(result != NULL);
    return result;
 }
 
+
+
+// -----------------------------------------------------------------------------
+PyObject* graph_optimize_all_partitions(PyObject* self, PyObject* args) {
+   GraphObject* so = ((GraphObject*)self);
+   PyObject* roots, *eval_func;
+   int max_parts_per_group = 5;
+   int max_graph_size = 16;
+   char* criterion = (char*)"min";
+   PyObject* cache = NULL;
+   int threads = 0;
+   if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OO|iisOi:optimize_all_partitions", 
+            &roots, &eval_func, &max_parts_per_group, &max_graph_size, 
+            &criterion, &cache, &threads) <= 0)
+      return 0;
+   if (!partitions_get_cache(cache))
+      return 0;
+
+   PyObject* seq = PySequence_Fast(roots, "roots must be a sequence");
+   if (seq == NULL)
+      return 0;
+   size_t nroots = PySequence_Fast_GET_SIZE(seq);
+   std::vector<Node*> nodes(nroots);
+   for (size_t i = 0; i < nroots; ++i) {
+      nodes[i] = partitions_get_node(so, PySequence_Fast_GET_ITEM(seq, i));
+      if (nodes[i] == NULL) {
+         Py_DECREF(seq);
+         PyErr_SetString(PyExc_KeyError, "root node not found");
+         return 0;
+      }
+   }
+   Py_DECREF(seq);
+
+   // The scores come from Python, so the parts of the subgraphs are
+   // scored one after the other
+   Partitions p;
+   std::vector<Partitions::Subgraph> subgraphs(nroots);
+   for (size_t i = 0; i < nroots; ++i)
+      p.prepare(nodes[i], eval_func, cache, max_parts_per_group, 
+            max_graph_size, subgraphs[i]);
+
+   // but the searches for the best partitions are independent
+   if (threads <= 0) {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = 1;
+#endif
+   }
+   Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+   for (long i = 0; i < (long)nroots; ++i)
+      p.solve(subgraphs[i], criterion);
+   Py_END_ALLOW_THREADS
+
+   PyObject* result = PyList_New(nroots);
+   for (size_t i = 0; i < nroots; ++i)
+      PyList_SET_ITEM(result, i, p.result(subgraphs[i]));
+   return result;
+}
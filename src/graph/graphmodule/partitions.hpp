@@ -30,6 +30,7 @@
 
 extern "C" {
   PyObject* graph_optimize_partitions(PyObject* self, PyObject* args);
+  PyObject* graph_optimize_all_partitions(PyObject* self, PyObject* args);
 }
 
 
@@ -37,7 +38,8 @@ extern "C" {
 #define PARTITIONS_METHODS \
    { CHAR_PTR_CAST "optimize_partitions", graph_optimize_partitions, METH_VARARGS, \
       CHAR_PTR_CAST "**optimize_partitions** (*root_node*, *fittness_func*, "\
-      "*max_parts_per_group* = 5, *max_subgraph_size* = 16, criterion = \"min\")\n\n" \
+      "*max_parts_per_group* = 5, *max_subgraph_size* = 16, criterion = \"min\", "\
+      "*cache* = ``None``)\n\n" \
       "A partition is defined as a way to divide a subgraph into groups.  This "\
       "algorithm finds an optimal\n" \
       "partition according to the given fitness function.\n\n" \
@@ -56,6 +58,23 @@ extern "C" {
       "  *criterion*\n" \
       "    Choses the solution with the highest minimum ('min') or highest \n"\
       "    average ('avg') confidence.\n\n" \
+      "  *cache*\n" \
+      "    A dictionary for the scores of the groups, keyed by the sorted\n"\
+      "    ``id`` values of their node identifiers.  Groups already in it are\n"\
+      "    not scored again, so that passing the same dictionary to several\n"\
+      "    calls saves calls of *fitness_func*.  It must not be kept longer\n"\
+      "    than the node identifiers, whose ids could be reused.\n\n" \
+   }, \
+   { CHAR_PTR_CAST "optimize_all_partitions", graph_optimize_all_partitions, METH_VARARGS, \
+      CHAR_PTR_CAST "**optimize_all_partitions** (*root_nodes*, *fittness_func*, "\
+      "*max_parts_per_group* = 5, *max_subgraph_size* = 16, criterion = \"min\", "\
+      "*cache* = ``None``, *threads* = 0)\n\n" \
+      "Optimizes the partitions of the subgraphs of all *root_nodes* and\n" \
+      "returns a list with the result of optimize_partitions_ for each of\n" \
+      "them.  The groups are scored one after the other, since *fitness_func*\n" \
+      "is a Python function, but the searches for the best partitions of\n" \
+      "the subgraphs then run in parallel on *threads* threads (0 means all\n" \
+      "processors).  The other arguments are as for optimize_partitions_.\n\n" \
    }, \
 
 #endif
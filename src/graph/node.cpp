@@ -29,6 +29,7 @@ namespace Gamera { namespace GraphApi {
 Node::Node(GraphData * value, Graph* graph) {
    _value = value;
    _graph = graph;
+   _id = 0;
 }
 
 
@@ -46,6 +47,7 @@ Node::~Node() {
 Node::Node(Node& node) {
    _value = node._value;
    _graph = node._graph;
+   _id = 0;
 }
 
 
@@ -54,6 +56,7 @@ Node::Node(Node& node) {
 Node::Node(Node* node) {
    _value = node->_value;
    _graph = node->_graph;
+   _id = 0;
 }
 
 
@@ -175,7 +178,8 @@ void Node::remove_self(bool glue) {
      
          e->to_node = NULL;
          e->from_node = NULL; 
-         _graph->_edges.remove(e);
+         _graph->_edges.erase(e->_position);
+         _graph->_edge_ids.release(e->_id);
          e->weight = 2000;
          delete e;
       }
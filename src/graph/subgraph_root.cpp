@@ -17,26 +17,24 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <algorithm>
+#include <functional>
 #include "graph/subgraph_root.hpp"
 
 namespace Gamera { namespace GraphApi {
 
    
 
-void SubgraphRoots::process(SubgraphNode* v) {
-   SubgraphNode *w = NULL;
+void SubgraphRoots::process(Node* n) {
+   root[n->_id] = true;
+   visited[n->_id] = true;
 
-   v->root = true;
-   v->visited = true;
-
-   DfsIterator* it = g->DFS(v->n);
-   Node* w_node = it->next();
-   while((w_node = it->next()) != NULL) {
-      w = nodeMap[w_node];
-      w->root = false;
-      w->visited = true;
+   DfsIterator it(g, n);
+   Node* w_node = it.next();
+   while((w_node = it.next()) != NULL) {
+      root[w_node->_id] = false;
+      visited[w_node->_id] = true;
    }
-   delete it;
 }
 
 
@@ -44,31 +42,26 @@ void SubgraphRoots::process(SubgraphNode* v) {
 // -----------------------------------------------------------------------------
 NodeVector* SubgraphRoots::subgraph_roots(Graph* g) {
    this->g = g;
-   NodePtrIterator *nit = g->get_nodes();
-   Node *n = NULL;
-   while((n = nit->next()) != NULL) {
-      SubgraphNode* t = new SubgraphNode(n);
-      nodeMap[n] = t;
-   }
-   delete nit;
-   i = 0;
-
-
-   for(std::map<Node*, SubgraphNode*>::iterator it = nodeMap.begin(); 
-         it != nodeMap.end(); it ++) {
-      SubgraphNode* v = it->second;
-      if(!v->visited) {
-         process(v);
+   // the nodes are processed in the order of their addresses, as the keys
+   // of the map this used to keep
+   std::vector<Node*> nodes(g->_nodes.begin(), g->_nodes.end());
+   std::sort(nodes.begin(), nodes.end(), std::less<Node*>());
+   root.assign(g->_node_ids.bound(), false);
+   visited.assign(g->_node_ids.bound(), false);
+
+   for(std::vector<Node*>::iterator it = nodes.begin(); 
+         it != nodes.end(); it ++) {
+      if(!visited[(*it)->_id]) {
+         process(*it);
       }
    }
 
    //create root-vector
    NodeVector *nv = new NodeVector();
-   for(std::map<Node*, SubgraphNode*>::iterator it = nodeMap.begin(); 
-         it != nodeMap.end(); it ++) {
-      if(it->second->root)
-         nv->push_back(it->second->n);
-      delete it->second;
+   for(std::vector<Node*>::iterator it = nodes.begin(); 
+         it != nodes.end(); it ++) {
+      if(root[(*it)->_id])
+         nv->push_back(*it);
    }
 
    return nv;
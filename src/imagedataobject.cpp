@@ -138,6 +138,23 @@ static void imagedata_dealloc(PyObject* self) {
   return 0; \
 }
 
+// the pixels of exported buffers (see image_getbuffer) must not move
+static bool imagedata_check_exports(ImageDataBase* x) {
+  if (x->exports() != 0) {
+    PyErr_SetString(PyExc_BufferError, "The pixels cannot be resized while their buffer is exported.");
+    return false;
+  }
+  return true;
+}
+
+#define CREATE_RESIZE_FUNC(name) static int imagedata_set_##name(PyObject* self, PyObject* value) {\
+  ImageDataBase* x = ((ImageDataObject*)self)->m_x; \
+  if (!imagedata_check_exports(x)) \
+    return -1; \
+  x->name((size_t)PyInt_AS_LONG(value)); \
+  return 0; \
+}
+
 CREATE_GET_FUNC(stride)
 CREATE_GET_FUNC(ncols)
 CREATE_GET_FUNC(nrows)
@@ -148,8 +165,8 @@ CREATE_GET_FUNC(bytes)
 
 CREATE_SET_FUNC(page_offset_x)
 CREATE_SET_FUNC(page_offset_y)
-CREATE_SET_FUNC(nrows)
-CREATE_SET_FUNC(ncols)
+CREATE_RESIZE_FUNC(nrows)
+CREATE_RESIZE_FUNC(ncols)
 
 static PyObject* imagedata_get_mbytes(PyObject* self) {
   ImageDataBase* x = ((ImageDataObject*)self)->m_x;
@@ -171,6 +188,8 @@ static PyObject* imagedata_dimensions(PyObject* self, PyObject* args) {
     PyObject* py_dim;
     if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &py_dim)) {
       if (is_DimObject(py_dim)) {
+	if (!imagedata_check_exports(x))
+	  return 0;
 	x->dim(*(((DimObject*)py_dim)->m_x));
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -226,6 +245,8 @@ void init_ImageDataType(PyObject* module_dict) {
 		       Py_BuildValue(CHAR_PTR_CAST "i", DENSE));
   PyDict_SetItemString(module_dict, "RLE",
 		       Py_BuildValue(CHAR_PTR_CAST "i", RLE));
+  PyDict_SetItemString(module_dict, "PACKED",
+		       Py_BuildValue(CHAR_PTR_CAST "i", PACKED));
 }
 
 
@@ -55,6 +55,13 @@ extern "C" {
   static PyObject* image_getitem(PyObject* self, PyObject* args);
   static PyObject* image_setitem(PyObject* self, PyObject* args);
   static PyObject* image_len(PyObject* self, PyObject* args);
+  static PyObject* image_get_row(PyObject* self, PyObject* args);
+  static PyObject* image_set_row(PyObject* self, PyObject* args);
+  static PyObject* image_get_pixels(PyObject* self, PyObject* args);
+  static PyObject* image_set_pixels(PyObject* self, PyObject* args);
+  // buffer protocol
+  static int image_getbuffer(PyObject* self, Py_buffer* view, int flags);
+  static void image_releasebuffer(PyObject* self, Py_buffer* view);
   // Removed 07/28/04 MGD.  Can't figure out why this is useful.
   // static PyObject* image_sort(PyObject* self, PyObject* args);
   // Get/set
@@ -199,6 +206,34 @@ static PyMethodDef image_methods[] = {
 "    image.set((5, 2), value)\n"
 "    image.set([5, 2], value)\n\n"
 "This coordinate is relative to the image view, not the absolute coordinates."
+  },
+  { (char *)"get_row", image_get_row, METH_VARARGS,
+(char *)"list **get_row** (int *y*)\n\n"
+"Returns the pixel values of row *y* as a list, in the same form as ``get`` "
+"returns them.\n\n"
+"Rows and columns can also be read and written without copying through the "
+"buffer protocol of a one row or one column subimage of a dense image."
+  },
+  { (char *)"set_row", image_set_row, METH_VARARGS,
+(char *)"**set_row** (int *y*, *values*)\n\n"
+"Sets the pixels of row *y* to the values in the sequence *values*, which "
+"must have one entry per column. When *values* is a single pixel value, "
+"the whole row is set to it."
+  },
+  { (char *)"get_pixels", image_get_pixels, METH_VARARGS,
+(char *)"list **get_pixels** (*points*)\n\n"
+"Returns the pixel values at all given points as a list.\n\n"
+"*points* is either a buffer of C longs holding the coordinates of the "
+"points one after the other (*x0*, *y0*, *x1*, *y1*, ...), e.g. an "
+"``array('l')``, or a sequence of ``Point`` objects or (*x*, *y*) pairs. "
+"As with ``get``, the coordinates are relative to the image view."
+  },
+  { (char *)"set_pixels", image_set_pixels, METH_VARARGS,
+(char *)"**set_pixels** (*points*, *values*)\n\n"
+"Sets the pixels at all given points, which are passed as for "
+"``get_pixels``. *values* is either a sequence with one pixel value per "
+"point, or a single pixel value that is set at all points.\n\n"
+"All coordinates and values are checked before the first pixel is set."
   },
   { (char *)"white", image_white, METH_NOARGS,
 (char *)"Pixel **white** ()\n\n"
@@ -217,7 +252,7 @@ static PyMethodDef image_methods[] = {
 };
 
 static PyObject* _image_new(PyTypeObject* pytype, const Point& offset, const Dim& dim,
-                            int pixel, int format) {
+                            int pixel, int format, PyObject* decode = 0) {
   /*
     This is looks really awful, but it is not. We are simply creating a
     matrix view and some matrix data based on the pixel type and storage
@@ -228,32 +263,41 @@ static PyObject* _image_new(PyTypeObject* pytype, const Point& offset, const Dim
     through RTTI, but it is simpler to use an enum and makes it easier to
     export to Python.
   */
+  if (decode == Py_None)
+    decode = 0;
+  if (decode != 0 && (!PyTuple_Check(decode) || PyTuple_GET_SIZE(decode) != 2
+                      || !PyCallable_Check(PyTuple_GET_ITEM(decode, 0)))) {
+    PyErr_SetString(PyExc_TypeError, "decode must be a pair (function, argument).");
+    return NULL;
+  }
+  // the pixels are allocated when they are decoded (see image_decode_pending)
+  bool deferred = decode != 0;
   ImageDataObject* py_data = NULL;
   Rect* image = NULL;
   try {
     if (format == DENSE) {
       if (pixel == ONEBIT) {
-        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format);
+        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format, deferred);
         ImageData<OneBitPixel>* data = (ImageData<OneBitPixel>*)(py_data->m_x);
         image = (Rect*)new ImageView<ImageData<OneBitPixel> >(*data, offset, dim);
       } else if (pixel == GREYSCALE) {
-        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format);
+        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format, deferred);
         ImageData<GreyScalePixel>* data = (ImageData<GreyScalePixel>*)(py_data->m_x);
         image = (Rect *)new ImageView<ImageData<GreyScalePixel> >(*data, offset, dim);
       } else if (pixel == GREY16) {
-        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format);
+        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format, deferred);
         ImageData<Grey16Pixel>* data = (ImageData<Grey16Pixel>*)(py_data->m_x);
         image = (Rect*)new ImageView<ImageData<Grey16Pixel> >(*data, offset, dim);
       } else if (pixel == Gamera::FLOAT) {
-        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format);
+        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format, deferred);
         ImageData<FloatPixel>* data = (ImageData<FloatPixel>*)(py_data->m_x);
         image = (Rect*)new ImageView<ImageData<FloatPixel> >(*data, offset, dim);
       } else if (pixel == RGB) {
-        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format);
+        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format, deferred);
         ImageData<RGBPixel>* data = (ImageData<RGBPixel>*)(py_data->m_x);
         image = (Rect*)new ImageView<ImageData<RGBPixel> >(*data, offset, dim);
       } else if (pixel == Gamera::COMPLEX) {
-        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format);
+        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format, deferred);
         ImageData<ComplexPixel>* data = (ImageData<ComplexPixel>*)(py_data->m_x);
         image = (Rect*)new ImageView<ImageData<ComplexPixel> >(*data, offset, dim);
       } else {
@@ -262,7 +306,7 @@ static PyObject* _image_new(PyTypeObject* pytype, const Point& offset, const Dim
       }
     } else if (format == RLE) {
       if (pixel == ONEBIT) {
-        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format);
+        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format, deferred);
         RleImageData<OneBitPixel>* data = (RleImageData<OneBitPixel>*)(py_data->m_x);
         image = (Rect*)new ImageView<RleImageData<OneBitPixel> >(*data, offset, dim);
       } else {
@@ -270,6 +314,16 @@ static PyObject* _image_new(PyTypeObject* pytype, const Point& offset, const Dim
                         "Pixel type must be ONEBIT if storage format is RLE.");
         return NULL;
       }
+    } else if (format == PACKED) {
+      if (pixel == ONEBIT) {
+        py_data = (ImageDataObject*)create_ImageDataObject(dim, offset, pixel, format, deferred);
+        PackedImageData<OneBitPixel>* data = (PackedImageData<OneBitPixel>*)(py_data->m_x);
+        image = (Rect*)new ImageView<PackedImageData<OneBitPixel> >(*data, offset, dim);
+      } else {
+        PyErr_SetString(PyExc_TypeError,
+                        "Pixel type must be ONEBIT if storage format is PACKED.");
+        return NULL;
+      }
     } else {
       PyErr_SetString(PyExc_TypeError, "Unknown pixel type/storage format combination.");
       return NULL;
@@ -290,6 +344,8 @@ static PyObject* _image_new(PyTypeObject* pytype, const Point& offset, const Dim
   o->m_data = (PyObject*)py_data;
   ((RectObject*)o)->m_x = image;
   PyObject* o2 = init_image_members(o);
+  Py_XINCREF(decode);
+  o->m_pending_pixels = decode;
   return o2;
 }
 
@@ -302,8 +358,9 @@ static PyObject* image_new(PyTypeObject* pytype, PyObject* args,
     PyObject* b = NULL;
     int pixel = 0;
     int format = 0;
-    static const char *kwlist[] = {"a", "b", "pixel_type", "storage_format", NULL};
-    if (PyArg_ParseTupleAndKeywords(args, kwds, (char *)"OO|ii", (char **)kwlist, &a, &b, &pixel, &format)) {
+    PyObject* decode = NULL;
+    static const char *kwlist[] = {"a", "b", "pixel_type", "storage_format", "decode", NULL};
+    if (PyArg_ParseTupleAndKeywords(args, kwds, (char *)"OO|iiO", (char **)kwlist, &a, &b, &pixel, &format, &decode)) {
       Point point_a;
       try {
         point_a = coerce_Point(a);
@@ -315,17 +372,17 @@ static PyObject* image_new(PyTypeObject* pytype, PyObject* args,
         Point point_b = coerce_Point(b);
         int ncols = point_b.x() - point_a.x() + 1;
         int nrows = point_b.y() - point_a.y() + 1;
-        return _image_new(pytype, point_a, Dim(ncols, nrows), pixel, format);
+        return _image_new(pytype, point_a, Dim(ncols, nrows), pixel, format, decode);
       } catch (std::invalid_argument e) {
         PyErr_Clear();
         if (is_SizeObject(b)) {
           Size* size_b = ((SizeObject*)b)->m_x;
           int nrows = size_b->height() + 1;
           int ncols = size_b->width() + 1;
-          return _image_new(pytype, point_a, Dim(ncols, nrows), pixel, format);
+          return _image_new(pytype, point_a, Dim(ncols, nrows), pixel, format, decode);
         } else if (is_DimObject(b)) {
           Dim* dim_b = ((DimObject*)b)->m_x;
-          return _image_new(pytype, point_a, *dim_b, pixel, format);
+          return _image_new(pytype, point_a, *dim_b, pixel, format, decode);
         }
 #ifdef GAMERA_DEPRECATED
           else if (is_DimensionsObject(b)) {
@@ -413,6 +470,8 @@ static PyObject* _sub_image_new(PyTypeObject* pytype, PyObject* py_src, const Po
     PyErr_SetString(PyExc_TypeError, "First argument to SubImage constructor must be an Image (or SubImage).");
     return NULL;
   }
+  if (!image_decode_pending(py_src))
+    return NULL;
 
   int pixel, format;
   ImageObject* src = (ImageObject*)py_src;
@@ -460,6 +519,16 @@ static PyObject* _sub_image_new(PyTypeObject* pytype, PyObject* py_src, const Po
                         "Pixel type must be ONEBIT if storage format is RLE.  Receiving this error indicates an internal inconsistency or memory corruption.  Please report it on the Gamera mailing list.");
         return NULL;
       }
+    } else if (format == PACKED) {
+      if (pixel == ONEBIT) {
+        PackedImageData<OneBitPixel>* data =
+          ((PackedImageData<OneBitPixel>*)((ImageDataObject*)src->m_data)->m_x);
+        subimage = (Rect *)new ImageView<PackedImageData<OneBitPixel> >(*data, offset, dim);
+      } else {
+        PyErr_SetString(PyExc_TypeError,
+                        "Pixel type must be ONEBIT if storage format is PACKED.  Receiving this error indicates an internal inconsistency or memory corruption.  Please report it on the Gamera mailing list.");
+        return NULL;
+      }
     } else {
       PyErr_SetString(PyExc_TypeError, "Unknown pixel type/storage format combination.  Receiving this error indicates an internal inconsistency or memory corruption.  Please report it on the Gamera mailing list.");
       return NULL;
@@ -568,6 +637,8 @@ static PyObject* _cc_new(PyTypeObject* pytype, PyObject* py_src, int label,
     PyErr_SetString(PyExc_TypeError, "First argument to the Cc constructor must be an Image (or SubImage).");
     return NULL;
   }
+  if (!image_decode_pending(py_src))
+    return NULL;
 
   int pixel, format;
   ImageObject* src = (ImageObject*)py_src;
@@ -590,6 +661,9 @@ static PyObject* _cc_new(PyTypeObject* pytype, PyObject* py_src, int label,
       RleImageData<OneBitPixel>* data =
         ((RleImageData<OneBitPixel>*)((ImageDataObject*)src->m_data)->m_x);
       cc = (Rect*)new ConnectedComponent<RleImageData<OneBitPixel> >(*data, label, offset, dim);
+    } else if (format == PACKED) {
+      PyErr_SetString(PyExc_TypeError, "Cc objects cannot be created on PACKED images, since they can not store labels.  Convert the image to DENSE first.");
+      return NULL;
     } else {
       PyErr_SetString(PyExc_TypeError, "Unknown pixel type/storage format combination.   Receiving this error indicates an internal inconsistency or memory corruption.  Please report it on the Gamera mailing list.");
       return NULL;
@@ -705,8 +779,8 @@ static void image_dealloc(PyObject* self) {
   image_clear(self);
 
   Py_DECREF(o->m_data);
-  Py_DECREF(o->m_features);
-  Py_DECREF(o->m_classification_state);
+  Py_XDECREF(o->m_features);
+  Py_XDECREF(o->m_classification_state);
 
   delete ((RectObject*)self)->m_x;
 
@@ -725,6 +799,11 @@ static int image_traverse(PyObject* self, visitproc visit, void *arg) {
     if (err)
       return err;
   }
+  if (o->m_pending_pixels) {
+    int err = visit(o->m_pending_pixels, arg);
+    if (err)
+      return err;
+  }
   return 0;
 }
 
@@ -742,6 +821,10 @@ static int image_clear(PyObject* self) {
   o->m_children_images = NULL;
   Py_XDECREF(tmp);
 
+  tmp = o->m_pending_pixels;
+  o->m_pending_pixels = NULL;
+  Py_XDECREF(tmp);
+
   return 0;
 }
 
@@ -760,12 +843,17 @@ static PyObject* image_get(PyObject* self, const Point& point) {
     PyErr_Format(PyExc_IndexError, "('%d', '%d') is out of bounds for image with size ('%d', '%d').  Remember get/set coordinates are relative to the upper left corner of the subimage, not to the corner of the page.", (int)point.x(), (int)point.y(), (int)r->ncols(), (int)r->nrows());
     return 0;
   }
+  if (!image_decode_pending(self))
+    return 0;
+  ((Image*)r)->refresh();
   if (is_CCObject(self)) {
     return PyInt_FromLong(((Cc*)o->m_x)->get(point));
   } else if (is_MLCCObject(self)) {
     return PyInt_FromLong(((MlCc*)o->m_x)->get(point));
   } else if (od->m_storage_format == RLE) {
     return PyInt_FromLong(((OneBitRleImageView*)o->m_x)->get(point));
+  } else if (od->m_storage_format == PACKED) {
+    return PyInt_FromLong(((OneBitPackedImageView*)o->m_x)->get(point));
   } else {
     switch (od->m_pixel_type) {
     case Gamera::FLOAT:
@@ -805,6 +893,10 @@ static PyObject* image_set(PyObject* self, const Point& point, PyObject* value)
                  (int)point.x(), (int)point.y(), (int)r->ncols(), (int)r->nrows());
     return 0;
   }
+  if (!image_decode_pending(self))
+    return 0;
+  ((Image*)r)->data()->touch();
+  ((Image*)r)->refresh();
   if (is_CCObject(self)) {
     if (!PyInt_Check(value)) {
       PyErr_SetString(PyExc_TypeError, "Pixel value for CC objects must be an int.");
@@ -830,6 +922,13 @@ static PyObject* image_set(PyObject* self, const Point& point, PyObject* value)
     }
     ((OneBitRleImageView*)o->m_x)->set(point,
                                        (OneBitPixel)PyInt_AS_LONG(value));
+  } else if (od->m_storage_format == PACKED) {
+    if (!PyInt_Check(value)) {
+      PyErr_SetString(PyExc_TypeError, "Pixel value for OneBit objects must be an int.");
+      return 0;
+    }
+    ((OneBitPackedImageView*)o->m_x)->set(point,
+                                          (OneBitPixel)PyInt_AS_LONG(value));
   } else if (od->m_pixel_type == RGB) {
     if (!is_RGBPixelObject((PyObject*)value)) {
       PyErr_SetString(PyExc_TypeError, "Pixel value for OneBit objects must be an RGBPixel");
@@ -1076,30 +1175,410 @@ static PyObject* image_len(PyObject* self, PyObject* args) {
   return Py_BuildValue(CHAR_PTR_CAST "i", (long)(image->nrows() * image->ncols()));
 }
 
-#define CREATE_GET_FUNC(name) static PyObject* image_get_##name(PyObject* self) {\
-  ImageObject* o = (ImageObject*)self; \
-  Py_INCREF(o->m_##name); \
-  return o->m_##name; \
+/*
+  Bulk pixel access.  get_row, set_row, get_pixels and set_pixels
+  determine the type of the image once and then loop over all pixels
+  in C++, instead of converting and dispatching for every pixel.
+*/
+
+// calls *f* with the image as its actual C++ view type
+template<class F>
+static PyObject* image_apply(PyObject* self, F& f) {
+  RectObject* o = (RectObject*)self;
+  ImageDataObject* od = (ImageDataObject*)((ImageObject*)self)->m_data;
+  if (is_CCObject(self)) {
+    return f(*(Cc*)o->m_x);
+  } else if (is_MLCCObject(self)) {
+    return f(*(MlCc*)o->m_x);
+  } else if (od->m_storage_format == RLE) {
+    return f(*(OneBitRleImageView*)o->m_x);
+  } else if (od->m_storage_format == PACKED) {
+    return f(*(OneBitPackedImageView*)o->m_x);
+  } else {
+    switch (od->m_pixel_type) {
+    case Gamera::FLOAT:
+      return f(*(FloatImageView*)o->m_x);
+    case Gamera::RGB:
+      return f(*(RGBImageView*)o->m_x);
+    case Gamera::GREYSCALE:
+      return f(*(GreyScaleImageView*)o->m_x);
+    case Gamera::GREY16:
+      return f(*(Grey16ImageView*)o->m_x);
+    case Gamera::ONEBIT:
+      return f(*(OneBitImageView*)o->m_x);
+    case Gamera::COMPLEX:
+      return f(*(ComplexImageView*)o->m_x);
+    default:
+      PyErr_SetString(PyExc_TypeError, "Unknown pixel type.");
+      return 0;
+    }
+  }
+}
+
+static bool image_check_point(Rect* r, long x, long y) {
+  if (x < 0 || y < 0 || (size_t)y >= r->nrows() || (size_t)x >= r->ncols()) {
+    PyErr_Format(PyExc_IndexError, "('%ld', '%ld') is out of bounds for image with size ('%d', '%d').  Remember get/set coordinates are relative to the upper left corner of the subimage, not to the corner of the page.", x, y, (int)r->ncols(), (int)r->nrows());
+    return false;
+  }
+  return true;
+}
+
+// reads *points* (see get_pixels) into *result*; returns false and
+// sets a Python exception when a point is invalid or out of bounds
+static bool image_parse_points(PyObject* self, PyObject* points, std::vector<Point>& result) {
+  Rect* r = ((RectObject*)self)->m_x;
+  const long* coords;
+  Py_ssize_t len;
+  size_t i, n;
+  if (!PySequence_Check(points) || PyObject_CheckReadBuffer(points)) {
+    if (PyObject_AsReadBuffer(points, (const void**)&coords, &len) < 0)
+      return false;
+    if (len % (2 * sizeof(long)) != 0) {
+      PyErr_SetString(PyExc_ValueError, "The coordinate buffer must hold pairs of C longs (x, y).");
+      return false;
+    }
+    n = len / (2 * sizeof(long));
+    result.resize(n);
+    for (i = 0; i < n; ++i) {
+      if (!image_check_point(r, coords[2*i], coords[2*i+1]))
+        return false;
+      result[i] = Point(coords[2*i], coords[2*i+1]);
+    }
+    return true;
+  }
+  PyObject* seq = PySequence_Fast(points, "points must be a buffer of coordinates or a sequence of points.");
+  if (seq == 0)
+    return false;
+  n = PySequence_Fast_GET_SIZE(seq);
+  result.resize(n);
+  for (i = 0; i < n; ++i) {
+    try {
+      result[i] = coerce_Point(PySequence_Fast_GET_ITEM(seq, i));
+    } catch (std::invalid_argument e) {
+      Py_DECREF(seq);
+      PyErr_SetString(PyExc_TypeError, "points must be a buffer of coordinates or a sequence of points.");
+      return false;
+    }
+    if (!image_check_point(r, (long)result[i].x(), (long)result[i].y())) {
+      Py_DECREF(seq);
+      return false;
+    }
+  }
+  Py_DECREF(seq);
+  return true;
+}
+
+// the points of row *y*
+static bool image_row_points(PyObject* self, int y, std::vector<Point>& result) {
+  Rect* r = ((RectObject*)self)->m_x;
+  if (y < 0 || (size_t)y >= r->nrows()) {
+    PyErr_Format(PyExc_IndexError, "Row %d is out of bounds for image with %d rows.", y, (int)r->nrows());
+    return false;
+  }
+  result.resize(r->ncols());
+  for (size_t x = 0; x < r->ncols(); ++x)
+    result[x] = Point(x, y);
+  return true;
+}
+
+struct ImageGetPixels {
+  const std::vector<Point>* points;
+  template<class V>
+  PyObject* operator()(V& view) {
+    size_t n = points->size();
+    PyObject* list = PyList_New(n);
+    if (list == 0)
+      return 0;
+    for (size_t i = 0; i < n; ++i)
+      PyList_SET_ITEM(list, i, pixel_to_python(view.get((*points)[i])));
+    return list;
+  }
+};
+
+struct ImageSetPixels {
+  const std::vector<Point>* points;
+  // either a fast sequence with one value per point or a single value
+  PyObject* values;
+  PyObject* value;
+  template<class V>
+  PyObject* operator()(V& view) {
+    typedef typename V::value_type T;
+    size_t i, n = points->size();
+    try {
+      if (values) {
+        // all values are converted before anything is written
+        std::vector<T> converted(n);
+        for (i = 0; i < n; ++i)
+          converted[i] = pixel_from_python<T>::convert(PySequence_Fast_GET_ITEM(values, i));
+        for (i = 0; i < n; ++i)
+          view.set((*points)[i], converted[i]);
+      } else {
+        T v = pixel_from_python<T>::convert(value);
+        for (i = 0; i < n; ++i)
+          view.set((*points)[i], v);
+      }
+    } catch (std::exception& e) {
+      PyErr_SetString(PyExc_TypeError, e.what());
+      return 0;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+};
+
+static PyObject* image_get_points(PyObject* self, const std::vector<Point>& points) {
+  if (!image_decode_pending(self))
+    return 0;
+  ((Image*)((RectObject*)self)->m_x)->refresh();
+  ImageGetPixels f;
+  f.points = &points;
+  return image_apply(self, f);
+}
+
+static PyObject* image_set_points(PyObject* self, const std::vector<Point>& points,
+                                  PyObject* values) {
+  if (!image_decode_pending(self))
+    return 0;
+  Rect* r = ((RectObject*)self)->m_x;
+  ImageSetPixels f;
+  f.points = &points;
+  f.values = NULL;
+  f.value = values;
+  // pixel values themselves may be sequences (RGBPixel is not)
+  if (PySequence_Check(values) && !is_RGBPixelObject(values)) {
+    f.values = PySequence_Fast(values, "values must be a sequence of pixels.");
+    if (f.values == 0)
+      return 0;
+    if ((size_t)PySequence_Fast_GET_SIZE(f.values) != points.size()) {
+      Py_DECREF(f.values);
+      PyErr_Format(PyExc_ValueError, "%d values given for %d pixels.",
+                   (int)PySequence_Fast_GET_SIZE(f.values), (int)points.size());
+      return 0;
+    }
+  }
+  ((Image*)r)->data()->touch();
+  ((Image*)r)->refresh();
+  PyObject* result = image_apply(self, f);
+  Py_XDECREF(f.values);
+  return result;
+}
+
+static PyObject* image_get_row(PyObject* self, PyObject* args) {
+  int y;
+  std::vector<Point> points;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "i:get_row", &y) <= 0)
+    return 0;
+  if (!image_row_points(self, y, points))
+    return 0;
+  return image_get_points(self, points);
+}
+
+static PyObject* image_set_row(PyObject* self, PyObject* args) {
+  int y;
+  PyObject* values;
+  std::vector<Point> points;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "iO:set_row", &y, &values) <= 0)
+    return 0;
+  if (!image_row_points(self, y, points))
+    return 0;
+  return image_set_points(self, points, values);
+}
+
+static PyObject* image_get_pixels(PyObject* self, PyObject* args) {
+  PyObject* py_points;
+  std::vector<Point> points;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O:get_pixels", &py_points) <= 0)
+    return 0;
+  if (!image_parse_points(self, py_points, points))
+    return 0;
+  return image_get_points(self, points);
+}
+
+static PyObject* image_set_pixels(PyObject* self, PyObject* args) {
+  PyObject *py_points, *values;
+  std::vector<Point> points;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OO:set_pixels", &py_points, &values) <= 0)
+    return 0;
+  if (!image_parse_points(self, py_points, points))
+    return 0;
+  return image_set_points(self, points, values);
+}
+
+/*
+  The buffer protocol (PEP 3118) lets NumPy and other libraries use the
+  pixels of dense images without copying them.  The buffer of a view on
+  part of a page has the row stride of the page.  RGB pixels are
+  exported as a third dimension of three bytes.
+*/
+template<class T>
+static char* image_buffer_start(ImageDataBase* data, Rect* image) {
+  return (char*)(((ImageData<T>*)data)->begin()
+                 + (image->offset_y() - data->page_offset_y()) * data->stride()
+                 + (image->offset_x() - data->page_offset_x()));
+}
+
+static int image_getbuffer(PyObject* self, Py_buffer* view, int flags) {
+  ImageDataObject* od = (ImageDataObject*)((ImageObject*)self)->m_data;
+  Rect* image = ((RectObject*)self)->m_x;
+  ImageDataBase* data = (ImageDataBase*)od->m_x;
+  view->obj = NULL;
+  if (is_CCObject(self) || is_MLCCObject(self) || od->m_storage_format != DENSE) {
+    PyErr_SetString(PyExc_BufferError, "Only dense images (and not connected components) have a buffer.");
+    return -1;
+  }
+  if (!image_decode_pending(self))
+    return -1;
+  // the pixels may be changed through the buffer, so shared pixels
+  // are copied before their address is handed out
+  data->touch();
+  ((Image*)image)->refresh();
+
+  char* start;
+  Py_ssize_t itemsize;
+  const char* format;
+  switch (od->m_pixel_type) {
+  case ONEBIT:
+    start = image_buffer_start<OneBitPixel>(data, image);
+    itemsize = sizeof(OneBitPixel);
+    format = "H";
+    break;
+  case GREYSCALE:
+    start = image_buffer_start<GreyScalePixel>(data, image);
+    itemsize = sizeof(GreyScalePixel);
+    format = "B";
+    break;
+  case GREY16:
+    start = image_buffer_start<Grey16Pixel>(data, image);
+    itemsize = sizeof(Grey16Pixel);
+    format = sizeof(Grey16Pixel) == 2 ? "H" : "I";
+    break;
+  case RGB:
+    start = image_buffer_start<RGBPixel>(data, image);
+    itemsize = sizeof(RGBPixel);
+    format = "B";
+    break;
+  case Gamera::FLOAT:
+    start = image_buffer_start<FloatPixel>(data, image);
+    itemsize = sizeof(FloatPixel);
+    format = sizeof(FloatPixel) == 4 ? "f" : "d";
+    break;
+  case Gamera::COMPLEX:
+    start = image_buffer_start<ComplexPixel>(data, image);
+    itemsize = sizeof(ComplexPixel);
+    format = "Zd";
+    break;
+  default:
+    PyErr_SetString(PyExc_BufferError, "Unknown pixel type.");
+    return -1;
+  }
+
+  bool contiguous = image->ncols() == data->stride() || image->nrows() == 1;
+  if (!contiguous && (flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+    PyErr_SetString(PyExc_BufferError, "The rows of this view are not contiguous; a strided buffer is needed.");
+    return -1;
+  }
+
+  // shape and strides live in the image object: memoryview in Python 2.7
+  // copies the Py_buffer (internal included) into each buffer taken from
+  // it, so nothing may be allocated per view and freed on release.  They
+  // are shared by all buffers of the image, so they cannot change while
+  // any of them is held.
+  ImageObject* o = (ImageObject*)self;
+  Py_ssize_t* dims = o->m_buffer_dims;
+  Py_ssize_t new_dims[6] = { Py_ssize_t(image->nrows()), Py_ssize_t(image->ncols()), 3,
+                             Py_ssize_t(data->stride() * itemsize), itemsize, 1 };
+  if (o->m_buffer_exports != 0 && !std::equal(new_dims, new_dims + 6, dims)) {
+    PyErr_SetString(PyExc_BufferError, "The image has changed its size while its buffer is exported.");
+    return -1;
+  }
+  std::copy(new_dims, new_dims + 6, dims);
+
+  view->buf = start;
+  view->len = image->nrows() * image->ncols() * itemsize;
+  view->readonly = 0;
+  view->internal = NULL;
+  view->suboffsets = NULL;
+  if (od->m_pixel_type == RGB) {
+    view->ndim = 3;
+    view->itemsize = 1;
+  } else {
+    view->ndim = 2;
+    view->itemsize = itemsize;
+  }
+  view->format = (flags & PyBUF_FORMAT) ? (char*)format : NULL;
+  if ((flags & PyBUF_ND) == PyBUF_ND) {
+    view->shape = dims;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? dims + 3 : NULL;
+  } else {
+    // a plain block of bytes
+    view->ndim = 1;
+    view->itemsize = 1;
+    view->shape = NULL;
+    view->strides = NULL;
+  }
+  if (((flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS
+       && !PyBuffer_IsContiguous(view, 'C'))
+      || ((flags & PyBUF_F_CONTIGUOUS) == PyBUF_F_CONTIGUOUS
+          && !PyBuffer_IsContiguous(view, 'F'))
+      || ((flags & PyBUF_ANY_CONTIGUOUS) == PyBUF_ANY_CONTIGUOUS
+          && !PyBuffer_IsContiguous(view, 'A'))) {
+    PyErr_SetString(PyExc_BufferError, "The buffer of this image is not contiguous.");
+    return -1;
+  }
+  // the pixels stay where they are until the buffer is released
+  data->add_exports(1);
+  ++o->m_buffer_exports;
+  Py_INCREF(self);
+  view->obj = self;
+  return 0;
+}
+
+static void image_releasebuffer(PyObject* self, Py_buffer* view) {
+  ImageDataObject* od = (ImageDataObject*)((ImageObject*)self)->m_data;
+  ImageDataBase* data = (ImageDataBase*)od->m_x;
+  data->add_exports(-1);
+  --((ImageObject*)self)->m_buffer_exports;
+  data->touch();
+}
+
+static PyBufferProcs image_as_buffer = {
+  0, 0, 0, 0, image_getbuffer, image_releasebuffer
+};
+
+// the ImageData gives access to the pixels (see image_decode_pending)
+static PyObject* image_get_data(PyObject* self) {
+  ImageObject* o = (ImageObject*)self;
+  if (!image_decode_pending(self))
+    return 0;
+  Py_INCREF(o->m_data);
+  return o->m_data;
+}
+
+// the classification members are created on first access (see
+// init_image_members)
+#define CREATE_LAZY_GET_FUNC(name) static PyObject* image_get_##name(PyObject* self) {\
+  PyObject* member = image_##name((ImageObject*)self); \
+  Py_XINCREF(member); \
+  return member; \
 }
 
 #define CREATE_SET_FUNC(name) static int image_set_##name(PyObject* self, PyObject* v) {\
   ImageObject* o = (ImageObject*)self; \
-  Py_DECREF(o->m_##name); \
+  Py_XDECREF(o->m_##name); \
   o->m_##name = v; \
   Py_INCREF(o->m_##name); \
   return 0; \
 }
 
-CREATE_GET_FUNC(data)
-CREATE_GET_FUNC(features)
+CREATE_LAZY_GET_FUNC(features)
 CREATE_SET_FUNC(features)
 CREATE_SET_FUNC(id_name)
-CREATE_GET_FUNC(id_name)
+CREATE_LAZY_GET_FUNC(id_name)
 CREATE_SET_FUNC(confidence)
-CREATE_GET_FUNC(confidence)
-CREATE_GET_FUNC(children_images)
+CREATE_LAZY_GET_FUNC(confidence)
+CREATE_LAZY_GET_FUNC(children_images)
 CREATE_SET_FUNC(children_images)
-CREATE_GET_FUNC(classification_state)
+CREATE_LAZY_GET_FUNC(classification_state)
 CREATE_SET_FUNC(classification_state)
 
 
@@ -1145,6 +1624,7 @@ static int cc_set_label(PyObject* self, PyObject* v) {
     return -1;
   }
   ((Cc*)o->m_x)->label(PyInt_AS_LONG(v));
+  ((Cc*)o->m_x)->cache(0);
   return 0;
 }
 
@@ -1349,6 +1829,7 @@ static PyObject* mlcc_remove_label(PyObject* self, PyObject* args){
   
   RectObject* o = (RectObject*)self;
   ((MlCc*)o->m_x)->remove_label(PyInt_AS_LONG(args));
+  ((MlCc*)o->m_x)->cache(0);
   
   Py_INCREF(Py_None);
   return Py_None;
@@ -1372,6 +1853,7 @@ static PyObject* mlcc_add_label(PyObject* self, PyObject* args){
   
   RectObject* o = (RectObject*)self;
  ((MlCc*)o->m_x)->add_label(i, *rect);
+ ((MlCc*)o->m_x)->cache(0);
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -1620,6 +2102,8 @@ static PyObject* _mlcc_new(PyTypeObject* pytype, PyObject* py_src, int label, co
     PyErr_SetString(PyExc_TypeError, "First argument to the MlCc constructor must be an Image (or SubImage).");
     return NULL;
   }
+  if (!image_decode_pending(py_src))
+    return NULL;
 
   int pixel, format;
   ImageObject* src = (ImageObject*)py_src;
@@ -1641,6 +2125,9 @@ static PyObject* _mlcc_new(PyTypeObject* pytype, PyObject* py_src, int label, co
     } else if (format == RLE) {
       PyErr_SetString(PyExc_TypeError, "MultiLabelCCs cannot be used with runline length encoding.");
       return NULL;
+    } else if (format == PACKED) {
+      PyErr_SetString(PyExc_TypeError, "MultiLabelCCs cannot be used with PACKED storage.");
+      return NULL;
     } else {
       PyErr_SetString(PyExc_TypeError, "Unknown pixel type/storage format combination. Receiving this error indicates an internal inconsistency or memory corruption.  Please report it on the Gamera mailing list.");
       return NULL;
@@ -1865,7 +2352,7 @@ void init_ImageType(PyObject* module_dict) {
   ImageType.tp_basicsize = sizeof(ImageObject) + PyGC_HEAD_SIZE;
   ImageType.tp_dealloc = image_dealloc;
   ImageType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE |
-    Py_TPFLAGS_HAVE_WEAKREFS | Py_TPFLAGS_HAVE_GC;
+    Py_TPFLAGS_HAVE_WEAKREFS | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_HAVE_NEWBUFFER;
   ImageType.tp_base = get_RectType();
   ImageType.tp_getset = image_getset;
   ImageType.tp_methods = image_methods;
@@ -1875,6 +2362,7 @@ void init_ImageType(PyObject* module_dict) {
   ImageType.tp_alloc = NULL; // PyType_GenericAlloc;
   ImageType.tp_free = NULL; //_PyObject_Del;
   ImageType.tp_richcompare = image_richcompare;
+  ImageType.tp_as_buffer = &image_as_buffer;
   ImageType.tp_weaklistoffset = offsetof(ImageObject, m_weakreflist);
   ImageType.tp_traverse = image_traverse;
   ImageType.tp_clear = image_clear;
@@ -1900,7 +2388,12 @@ void init_ImageType(PyObject* module_dict) {
 "*storage_format*\n"
 "  An integer value specifying the method used to store the image data.\n"
 "  See `storage formats`__ for more information.\n\n"
-".. __: image_types.html#storage-formats\n";
+".. __: image_types.html#storage-formats\n\n"
+"*decode*\n"
+"  Only for the forms taking *upper_left*: a pair (*function*, *argument*).\n"
+"  The pixels are then neither allocated nor set until they are first\n"
+"  used, when *function* (*image*, *argument*) is called to fill them,\n"
+"  e.g. (Image.from_rle, *runs*).\n";
   PyType_Ready(&ImageType);
   PyDict_SetItemString(module_dict, "Image", (PyObject*)&ImageType);
 
@@ -1909,7 +2402,7 @@ void init_ImageType(PyObject* module_dict) {
   SubImageType.tp_basicsize = sizeof(SubImageObject) + PyGC_HEAD_SIZE;
   SubImageType.tp_dealloc = image_dealloc;
   SubImageType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE |
-    Py_TPFLAGS_HAVE_WEAKREFS | Py_TPFLAGS_HAVE_GC;
+    Py_TPFLAGS_HAVE_WEAKREFS | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_HAVE_NEWBUFFER;
   SubImageType.tp_base = &ImageType;
   SubImageType.tp_new = sub_image_new;
   SubImageType.tp_init = (initproc)sub_image_init;
@@ -1938,7 +2431,7 @@ void init_ImageType(PyObject* module_dict) {
   CCType.tp_basicsize = sizeof(CCObject) + PyGC_HEAD_SIZE;
   CCType.tp_dealloc = image_dealloc;
   CCType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE |
-    Py_TPFLAGS_HAVE_WEAKREFS | Py_TPFLAGS_HAVE_GC;
+    Py_TPFLAGS_HAVE_WEAKREFS | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_HAVE_NEWBUFFER;
   CCType.tp_base = &ImageType;
   CCType.tp_new = cc_new;
   CCType.tp_init = (initproc)cc_init;
@@ -1969,7 +2462,7 @@ void init_ImageType(PyObject* module_dict) {
   MLCCType.tp_basicsize = sizeof(MLCCObject) + PyGC_HEAD_SIZE;
   MLCCType.tp_dealloc = image_dealloc;
   MLCCType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE |
-    Py_TPFLAGS_HAVE_WEAKREFS | Py_TPFLAGS_HAVE_GC;
+    Py_TPFLAGS_HAVE_WEAKREFS | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_HAVE_NEWBUFFER;
   MLCCType.tp_base = &ImageType;
   MLCCType.tp_new = mlcc_new;
   MLCCType.tp_init = (initproc)mlcc_init;
@@ -20,6 +20,10 @@
 #include <Python.h>
 #include "gameramodule.hpp"
 #include "geostructs/kdtree.hpp"
+#include <cstdio>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // these classes are used from kdtree.hpp:
 //using Gamera::Kdtree::KdTree;
@@ -161,6 +165,9 @@ struct KdTreeObject {
   Kdtree::KdTree* tree;
   // the nodes are stored in the property kdnode.data
   // of the nodes in tree->allnodes
+  // trees built with from_array have no nodes, but optional ids
+  bool from_array;
+  std::vector<long>* ids;
 };
 
 extern "C" {
@@ -175,16 +182,28 @@ static PyTypeObject KdTreeType = {
   0,
 };
 
+// the number of threads for *num_threads*, where 0 means all cores
+static int kdtree_num_threads(int num_threads) {
+  if (num_threads <= 0) {
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads();
+#else
+    num_threads = 1;
+#endif
+  }
+  return num_threads;
+}
+
 
 static PyObject* kdtree_new(PyTypeObject* pytype, PyObject* args, PyObject* kwds) {
   KdTreeObject* self;
-  int distance_type=2;
+  int distance_type=2, num_threads=0;
   size_t i,j,n,dimension;
   PyObject* list = NULL;
   PyObject *obj1,*obj2;
   Kdtree::KdNodeVector nodes4tree;
   // do some plausibility checks and extract basic properties
-  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O|i:kdtree_new", &list, &distance_type) <= 0)
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O|ii:kdtree_new", &list, &distance_type, &num_threads) <= 0)
     return 0;
   if(!PyList_Check(list)) {
     PyErr_SetString(PyExc_RuntimeError, "KdTree: given nodes must be list of KdNode's");
@@ -230,17 +249,70 @@ static PyObject* kdtree_new(PyTypeObject* pytype, PyObject* args, PyObject* kwds
   // copy over parsed stuff to data structure
   self = (KdTreeObject*)(KdTreeType.tp_alloc(&KdTreeType, 0));
   self->dimension = dimension;
-  self->tree = new Kdtree::KdTree(&nodes4tree,distance_type);
+  self->tree = new Kdtree::KdTree(&nodes4tree,distance_type,kdtree_num_threads(num_threads));
+  self->from_array = false;
+  self->ids = NULL;
+  return (PyObject*)self;
+}
+
+static PyObject* kdtree_from_array(PyObject* cls, PyObject* args) {
+  KdTreeObject* self;
+  int dimension, distance_type=2, num_threads=0;
+  size_t n;
+  PyObject *points, *ids = NULL;
+  const double* coords;
+  const long* idvalues = NULL;
+  Py_ssize_t len, idlen;
+  Kdtree::KdTree* tree;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "Oi|Oii:from_array", &points, &dimension, &ids, &distance_type, &num_threads) <= 0)
+    return 0;
+  if (dimension < 1) {
+    PyErr_SetString(PyExc_RuntimeError, "KdTree.from_array: dimension must be positive");
+    return 0;
+  }
+  if (PyObject_AsReadBuffer(points, (const void**)&coords, &len) < 0) {
+    PyErr_SetString(PyExc_TypeError, "KdTree.from_array: points must be a buffer of C doubles (e.g. array('d'))");
+    return 0;
+  }
+  if (len == 0 || len % (dimension*sizeof(double)) != 0) {
+    PyErr_SetString(PyExc_RuntimeError, "KdTree.from_array: number of coordinates must be a positive multiple of dimension");
+    return 0;
+  }
+  n = len / (dimension*sizeof(double));
+  if (ids && ids != Py_None) {
+    if (PyObject_AsReadBuffer(ids, (const void**)&idvalues, &idlen) < 0) {
+      PyErr_SetString(PyExc_TypeError, "KdTree.from_array: ids must be a buffer of C longs (e.g. array('l'))");
+      return 0;
+    }
+    if ((size_t)idlen != n*sizeof(long)) {
+      PyErr_SetString(PyExc_RuntimeError, "KdTree.from_array: there must be one id per point");
+      return 0;
+    }
+  }
+  num_threads = kdtree_num_threads(num_threads);
+  // the build only reads the C buffer
+  Py_BEGIN_ALLOW_THREADS
+  tree = new Kdtree::KdTree(coords, n, (size_t)dimension, distance_type, num_threads);
+  Py_END_ALLOW_THREADS
+  self = (KdTreeObject*)(KdTreeType.tp_alloc(&KdTreeType, 0));
+  self->dimension = (size_t)dimension;
+  self->tree = tree;
+  self->from_array = true;
+  self->ids = idvalues ? new std::vector<long>(idvalues, idvalues + n) : NULL;
   return (PyObject*)self;
 }
 
 static void kdtree_dealloc(PyObject* self) {
   size_t i;
-  Kdtree::KdTree* tree = ((KdTreeObject*)self)->tree;
-  for (i=0; i<tree->allnodes.size(); i++) {
-    Py_DECREF((PyObject*)tree->allnodes[i].data);
+  KdTreeObject* so = (KdTreeObject*)self;
+  Kdtree::KdTree* tree = so->tree;
+  if (!so->from_array) {
+    for (i=0; i<tree->allnodes.size(); i++) {
+      Py_DECREF((PyObject*)tree->allnodes[i].data);
+    }
   }
   delete tree;
+  delete so->ids;
   self->ob_type->tp_free(self);
 }
 
@@ -314,13 +386,124 @@ struct KdNodePredicate_Py : public Gamera::Kdtree::KdNodePredicate {
   }
 };
 
+// copies the coordinates of the sequence *list* into *point*
+// returns false and sets a Python exception on errors
+static bool kdtree_parse_point(PyObject* list, Kdtree::CoordPoint &point, const char* funcname) {
+  PyObject *entry;
+  size_t i,n;
+  char msg[128];
+  if(!PySequence_Check(list)) {
+    sprintf(msg, "KdTree.%s: given point must be list or tuple of numbers", funcname);
+    PyErr_SetString(PyExc_RuntimeError, msg);
+    return false;
+  }
+  n = PySequence_Size(list);
+  if (n != point.size()) {
+    sprintf(msg, "KdTree.%s: given point must have same dimension as KdTree", funcname);
+    PyErr_SetString(PyExc_RuntimeError, msg);
+    return false;
+  }
+  // copy over input data
+  for(i=0;i<n;++i) {
+    entry = PySequence_GetItem(list,i);
+    if (PyFloat_Check(entry)) {
+      point[i] = PyFloat_AsDouble(entry);
+    } else if  (PyInt_Check(entry)) {
+      point[i] = (double)PyInt_AsLong(entry);
+    } else {
+      sprintf(msg, "KdTree.%s: point coordinates must be numbers", funcname);
+      PyErr_SetString(PyExc_RuntimeError, msg);
+      Py_DECREF(entry);
+      return false;
+    }
+    Py_DECREF(entry);
+  }
+  return true;
+}
+
+// converts the found nodes into a list of Python KdNode's
+static PyObject* kdtree_result_list(const Kdtree::KdNodeVector &result) {
+  PyObject *list, *entry;
+  size_t i;
+  list = PyList_New(result.size());
+  for (i=0; i<result.size(); i++) {
+    entry = (PyObject*)result[i].data;
+    Py_INCREF(entry);
+    PyList_SetItem(list, i, entry);
+  }
+  return list;
+}
+
+// node queries need the KdNode's, which trees from from_array do not have
+static bool kdtree_check_nodes(KdTreeObject* so, const char* funcname) {
+  char msg[128];
+  if (so->from_array) {
+    sprintf(msg, "KdTree.%s: tree was built with from_array; use %s_array", funcname, funcname);
+    PyErr_SetString(PyExc_RuntimeError, msg);
+    return false;
+  }
+  return true;
+}
+
+// the points of a buffer of C doubles; returns false and sets
+// a Python exception when it does not hold whole points
+static bool kdtree_parse_points(PyObject* points, size_t dimension, const double** coords, size_t* n, const char* funcname) {
+  Py_ssize_t len;
+  char msg[128];
+  if (PyObject_AsReadBuffer(points, (const void**)coords, &len) < 0) {
+    sprintf(msg, "KdTree.%s: points must be a buffer of C doubles (e.g. array('d'))", funcname);
+    PyErr_SetString(PyExc_TypeError, msg);
+    return false;
+  }
+  if (len % (dimension*sizeof(double)) != 0) {
+    sprintf(msg, "KdTree.%s: number of coordinates must be a multiple of the dimension", funcname);
+    PyErr_SetString(PyExc_RuntimeError, msg);
+    return false;
+  }
+  *n = len / (dimension*sizeof(double));
+  return true;
+}
+
+// converts *n* items of *size* bytes into an array.array of *typecode*
+static PyObject* kdtree_to_array(const char* typecode, const void* values, size_t n, size_t size) {
+  PyObject* array_init = get_ArrayInit();
+  if (array_init == 0)
+    return 0;
+  PyObject* str = PyString_FromStringAndSize(n ? (const char*)values : "", n*size);
+  PyObject* py = PyObject_CallFunction(array_init, (char *)"sO", typecode, str);
+  Py_DECREF(str);
+  return py;
+}
+
+// the input indices as array of the ids of the tree
+static PyObject* kdtree_ids_array(KdTreeObject* so, const std::vector<size_t> &indices) {
+  std::vector<long> ids(indices.size());
+  size_t i;
+  for (i=0; i<indices.size(); i++)
+    ids[i] = so->ids ? (*so->ids)[indices[i]] : (long)indices[i];
+  return kdtree_to_array("l", ids.empty() ? NULL : &ids[0], ids.size(), sizeof(long));
+}
+
+// the tuple (ids, distances) of arrays
+static PyObject* kdtree_ids_distances(KdTreeObject* so, const std::vector<size_t> &indices, const std::vector<double> &distances) {
+  PyObject *ids, *dists;
+  ids = kdtree_ids_array(so, indices);
+  if (ids == 0)
+    return 0;
+  dists = kdtree_to_array("d", distances.empty() ? NULL : &distances[0], distances.size(), sizeof(double));
+  if (dists == 0) {
+    Py_DECREF(ids);
+    return 0;
+  }
+  return Py_BuildValue(CHAR_PTR_CAST "(NN)", ids, dists);
+}
+
 static PyObject* kdtree_k_nearest_neighbors(PyObject* self, PyObject* args) {
   KdTreeObject* so = (KdTreeObject*)self;
   Kdtree::CoordPoint point(so->dimension);
-  PyObject *list, *entry;
+  PyObject *list;
   PyObject *predicate = NULL;
   int k;
-  size_t i,n;
   Kdtree::KdNodeVector result;
   if (PyArg_ParseTuple(args, CHAR_PTR_CAST "Oi|O", &list, &k, &predicate) <= 0) {
     return 0;
@@ -329,52 +512,224 @@ static PyObject* kdtree_k_nearest_neighbors(PyObject* self, PyObject* args) {
     PyErr_SetString(PyExc_RuntimeError, "KdTree.k_nearest_neighbor: search predicate must be callable");
     return 0;
   }
-  if(!PySequence_Check(list)) {
-    PyErr_SetString(PyExc_RuntimeError, "KdTree.k_nearest_neighbor: given point must be list or tuple of numbers");
+  if (!kdtree_check_nodes(so, "k_nearest_neighbors"))
+    return 0;
+  if (!kdtree_parse_point(list, point, "k_nearest_neighbor"))
     return 0;
+  // actual C++ function call
+  if (predicate) {
+    KdNodePredicate_Py searchpredicate(predicate);
+    so->tree->k_nearest_neighbors(point, (size_t)k, &result, &searchpredicate);
+  } else {
+    so->tree->k_nearest_neighbors(point, (size_t)k, &result);
   }
-  n = PySequence_Size(list);
-  if (n != so->dimension) {
-    PyErr_SetString(PyExc_RuntimeError, "KdTree.k_nearest_neighbor: given point must have same dimension as KdTree");
+  // copy over result data
+  return kdtree_result_list(result);
+}
+
+static PyObject* kdtree_k_nearest_neighbors_many(PyObject* self, PyObject* args) {
+  KdTreeObject* so = (KdTreeObject*)self;
+  PyObject *points, *seq, *list;
+  int k, num_threads = 0;
+  size_t i,n;
+  std::vector<Kdtree::KdNodeVector> results;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "Oi|i", &points, &k, &num_threads) <= 0) {
     return 0;
   }
-  // copy over input data
-  for(i=0;i<n;++i) {
-    entry = PySequence_GetItem(list,i);
-    if (PyFloat_Check(entry)) {
-      point[i] = PyFloat_AsDouble(entry);
-    } else if  (PyInt_Check(entry)) {
-      point[i] = (double)PyInt_AsLong(entry);
-    } else {
-      PyErr_SetString(PyExc_RuntimeError, "KdTree.k_nearest_neighbor: point coordinates must be numbers");
-      Py_DECREF(entry);
+  if (!kdtree_check_nodes(so, "k_nearest_neighbors_many"))
+    return 0;
+  seq = PySequence_Fast(points, "KdTree.k_nearest_neighbors_many: given points must be a list or tuple of points");
+  if (seq == NULL)
+    return 0;
+  n = PySequence_Fast_GET_SIZE(seq);
+  std::vector<Kdtree::CoordPoint> querypoints(n, Kdtree::CoordPoint(so->dimension));
+  for (i=0; i<n; i++) {
+    if (!kdtree_parse_point(PySequence_Fast_GET_ITEM(seq, i), querypoints[i],
+                            "k_nearest_neighbors_many")) {
+      Py_DECREF(seq);
       return 0;
     }
-    Py_DECREF(entry);
   }
+  Py_DECREF(seq);
+  num_threads = kdtree_num_threads(num_threads);
+  // actual C++ function call; the searches only read the tree
+  Py_BEGIN_ALLOW_THREADS
+  so->tree->k_nearest_neighbors_many(querypoints, (size_t)k, &results, num_threads);
+  Py_END_ALLOW_THREADS
+  // copy over result data
+  list = PyList_New(n);
+  for (i=0; i<n; i++)
+    PyList_SetItem(list, i, kdtree_result_list(results[i]));
+  return list;
+}
+
+static PyObject* kdtree_range_search(PyObject* self, PyObject* args) {
+  KdTreeObject* so = (KdTreeObject*)self;
+  Kdtree::CoordPoint point(so->dimension);
+  PyObject *list;
+  PyObject *predicate = NULL;
+  double r;
+  Kdtree::KdNodeVector result;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "Od|O", &list, &r, &predicate) <= 0) {
+    return 0;
+  }
+  if (predicate && !PyCallable_Check(predicate)) {
+    PyErr_SetString(PyExc_RuntimeError, "KdTree.range_search: search predicate must be callable");
+    return 0;
+  }
+  if (!kdtree_check_nodes(so, "range_search"))
+    return 0;
+  if (!kdtree_parse_point(list, point, "range_search"))
+    return 0;
   // actual C++ function call
   if (predicate) {
     KdNodePredicate_Py searchpredicate(predicate);
-    so->tree->k_nearest_neighbors(point, (size_t)k, &result, &searchpredicate);
+    so->tree->range_search(point, r, &result, &searchpredicate);
   } else {
-    so->tree->k_nearest_neighbors(point, (size_t)k, &result);
+    so->tree->range_search(point, r, &result);
+  }
+  // copy over result data
+  return kdtree_result_list(result);
+}
+
+static PyObject* kdtree_pairs_within(PyObject* self, PyObject* args) {
+  KdTreeObject* so = (KdTreeObject*)self;
+  PyObject *list, *entry;
+  double r;
+  size_t i;
+  std::vector<std::pair<size_t,size_t> > result;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "d", &r) <= 0) {
+    return 0;
   }
+  if (!kdtree_check_nodes(so, "pairs_within"))
+    return 0;
+  // actual C++ function call
+  Py_BEGIN_ALLOW_THREADS
+  so->tree->pairs_within(r, &result);
+  Py_END_ALLOW_THREADS
   // copy over result data
   list = PyList_New(result.size());
   for (i=0; i<result.size(); i++) {
-    entry = (PyObject*)result[i].data;
-    Py_INCREF(entry);
+    entry = Py_BuildValue(CHAR_PTR_CAST "(OO)",
+                          (PyObject*)so->tree->allnodes[result[i].first].data,
+                          (PyObject*)so->tree->allnodes[result[i].second].data);
     PyList_SetItem(list, i, entry);
   }
   return list;
 }
 
+static PyObject* kdtree_k_nearest_neighbors_array(PyObject* self, PyObject* args) {
+  KdTreeObject* so = (KdTreeObject*)self;
+  PyObject *points;
+  const double* coords;
+  int k, num_threads = 0;
+  size_t n;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "Oi|i", &points, &k, &num_threads) <= 0) {
+    return 0;
+  }
+  if (!kdtree_parse_points(points, so->dimension, &coords, &n, "k_nearest_neighbors_array"))
+    return 0;
+  if (k < 0) k = 0;
+  if ((size_t)k > so->tree->allnodes.size())
+    k = (int)so->tree->allnodes.size();
+  num_threads = kdtree_num_threads(num_threads);
+  std::vector<size_t> indices(n*k);
+  std::vector<double> distances(n*k);
+  // actual C++ function call; the searches only read the tree
+  if (n*k > 0) {
+    Py_BEGIN_ALLOW_THREADS
+    so->tree->k_nearest_neighbors_indices(coords, n, (size_t)k, &indices[0], &distances[0], num_threads);
+    Py_END_ALLOW_THREADS
+  }
+  return kdtree_ids_distances(so, indices, distances);
+}
+
+static PyObject* kdtree_range_search_array(PyObject* self, PyObject* args) {
+  KdTreeObject* so = (KdTreeObject*)self;
+  PyObject *points, *offsetarray, *result;
+  const double* coords;
+  double r;
+  size_t i,n;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "Od", &points, &r) <= 0) {
+    return 0;
+  }
+  if (!kdtree_parse_points(points, so->dimension, &coords, &n, "range_search_array"))
+    return 0;
+  std::vector<long> offsets(n+1, 0);
+  std::vector<size_t> indices, found;
+  std::vector<double> distances, founddist;
+  // actual C++ function call
+  Py_BEGIN_ALLOW_THREADS
+  for (i=0; i<n; i++) {
+    so->tree->range_search_indices(coords + i*so->dimension, r, &found, &founddist);
+    indices.insert(indices.end(), found.begin(), found.end());
+    distances.insert(distances.end(), founddist.begin(), founddist.end());
+    offsets[i+1] = (long)indices.size();
+  }
+  Py_END_ALLOW_THREADS
+  offsetarray = kdtree_to_array("l", &offsets[0], offsets.size(), sizeof(long));
+  if (offsetarray == 0)
+    return 0;
+  result = kdtree_ids_distances(so, indices, distances);
+  if (result == 0) {
+    Py_DECREF(offsetarray);
+    return 0;
+  }
+  points = Py_BuildValue(CHAR_PTR_CAST "(NOO)", offsetarray,
+                         PyTuple_GET_ITEM(result, 0), PyTuple_GET_ITEM(result, 1));
+  Py_DECREF(result);
+  return points;
+}
+
+static PyObject* kdtree_pairs_within_array(PyObject* self, PyObject* args) {
+  KdTreeObject* so = (KdTreeObject*)self;
+  PyObject *first, *second;
+  double r;
+  size_t i;
+  std::vector<std::pair<size_t,size_t> > result;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "d", &r) <= 0) {
+    return 0;
+  }
+  // actual C++ function call
+  Py_BEGIN_ALLOW_THREADS
+  so->tree->pairs_within(r, &result);
+  Py_END_ALLOW_THREADS
+  // copy over result data as input indices
+  std::vector<size_t> a(result.size()), b(result.size());
+  for (i=0; i<result.size(); i++) {
+    a[i] = so->tree->inputindex[result[i].first];
+    b[i] = so->tree->inputindex[result[i].second];
+  }
+  first = kdtree_ids_array(so, a);
+  if (first == 0)
+    return 0;
+  second = kdtree_ids_array(so, b);
+  if (second == 0) {
+    Py_DECREF(first);
+    return 0;
+  }
+  return Py_BuildValue(CHAR_PTR_CAST "(NN)", first, second);
+}
 
 PyMethodDef kdtree_methods[] = {
+  { (char *)"from_array", kdtree_from_array, METH_VARARGS | METH_CLASS,
+    (char *)"**from_array** (*points*, *dimension*, *ids* = ``None``, *distance_type* = 2, *num_threads* = 0)\n\nCreates a kd-tree over the points in the buffer *points* without creating ``KdNode`` objects. *points* must hold the coordinates of all points one after the other as C doubles, e.g. ``array('d')`` or a contiguous NumPy array of ``float64`` with *dimension* columns.\n\nThe optional *ids* must hold one C long per point, e.g. ``array('l')``. The array queries return these ids instead of the position of the points in *points*.\n\nA tree created with ``from_array`` only supports the queries ending in ``_array``. *distance_type* and *num_threads* have the same meaning as in the ``KdTree`` constructor." },
   { (char *)"set_distance", kdtree_set_distance, METH_VARARGS,
     (char *)"**set_distance** (*distance_type*, *weights* = ``None``)\n\nSets the distance metrics used in subsequent k nearest neighbor searches.\n\n*distance_type* can be 0 (Linfinite or maximum norm), 1 (L1 or city block norm), or 2 (L2 or euklidean norm).\n\n*weights* is a list of floating point values, where each specifies a weight for a coordinate index in the distance computation. When weights are provided, the weight list must have exactly *d* entries, where *d* is the dimension of the kdtree. When no weights are provided, all coordinates are equally weighted with 1.0." },
   { (char *)"k_nearest_neighbors", kdtree_k_nearest_neighbors, METH_VARARGS,
     (char *)"**k_nearest_neighbors** (*point*, *k*, *predicate* = ``None``)\n\nReturns the *k* nearest neighbors to the given *point* in O(log(n)) time. The parameter *point* must not be of Gamera's data type ``Point``, but a list or tuple of numbers representing the coordinates. *point* must be of the same dimension as the kd-tree.\n\nThe result is a list of nodes ordered by distance from *point*,i.e. the closest node is the first. If your query point happens to coincide with a node, you can skip it by simply removing the first entry from the result list.\n\nThe optional parameter *predicate* is a function or callable class that takes a ``KdNode`` as argument and returns ``False`` when this node shall not be among the returned neighbors." },
+  { (char *)"k_nearest_neighbors_many", kdtree_k_nearest_neighbors_many, METH_VARARGS,
+    (char *)"**k_nearest_neighbors_many** (*points*, *k*, *num_threads* = 0)\n\nReturns the *k* nearest neighbors to each point in the list *points*. The result is a list that contains for each point the same list of nodes as returned by ``k_nearest_neighbors``.\n\nThe queries run without holding the Python interpreter lock and are distributed over *num_threads* threads. When *num_threads* is 0 (default), all available cores are used. Search predicates are not supported in batch queries." },
+  { (char *)"range_search", kdtree_range_search, METH_VARARGS,
+    (char *)"**range_search** (*point*, *r*, *predicate* = ``None``)\n\nReturns all nodes within distance *r* of the given *point*. *point* must be a list or tuple of numbers of the same dimension as the kd-tree, and the distance is measured with the distance metrics of the tree (see *set_distance*).\n\nThe result is a list of nodes ordered by distance from *point*. As in ``k_nearest_neighbors``, the optional parameter *predicate* can exclude nodes from the result." },
+  { (char *)"pairs_within", kdtree_pairs_within, METH_VARARGS,
+    (char *)"**pairs_within** (*r*)\n\nReturns all pairs of nodes of the tree that are within distance *r* of each other. The result is a list of 2-tuples of nodes in no particular order, and each pair occurs only once.\n\nBoth sides of the pairs are searched simultaneously in the tree, so that the runtime depends on the number of close pairs rather than on the square of the number of nodes." },
+  { (char *)"k_nearest_neighbors_array", kdtree_k_nearest_neighbors_array, METH_VARARGS,
+    (char *)"**k_nearest_neighbors_array** (*points*, *k*, *num_threads* = 0)\n\nReturns the *k* nearest neighbors to each point in the buffer *points*, which holds the coordinates as C doubles like in ``from_array``. When the tree has less than *k* nodes, *k* is reduced to the number of nodes.\n\nThe result is a tuple (*ids*, *distances*) of an ``array('l')`` and an ``array('d')``, each with *k* entries per query point, where the neighbors of each point are ordered by distance. The ids are the *ids* given to ``from_array``, or otherwise the positions of the neighbors in the input of the tree. The queries run on *num_threads* threads as in ``k_nearest_neighbors_many``." },
+  { (char *)"range_search_array", kdtree_range_search_array, METH_VARARGS,
+    (char *)"**range_search_array** (*points*, *r*)\n\nReturns all nodes within distance *r* of each point in the buffer *points*, which holds the coordinates as C doubles like in ``from_array``.\n\nThe result is a tuple (*offsets*, *ids*, *distances*) of arrays. The nodes found for point *i* are at the positions ``offsets[i]`` to ``offsets[i+1]-1`` of *ids* and *distances*, ordered by distance. The ids are those of ``k_nearest_neighbors_array``." },
+  { (char *)"pairs_within_array", kdtree_pairs_within_array, METH_VARARGS,
+    (char *)"**pairs_within_array** (*r*)\n\nReturns the same pairs as ``pairs_within`` as a tuple (*first*, *second*) of two ``array('l')`` holding the ids of both sides of each pair. The ids are those of ``k_nearest_neighbors_array``." },
   { NULL }
 };
 
@@ -398,10 +753,12 @@ void init_KdTreeType(PyObject* d) {
   KdTreeType.tp_getset = kdtree_getset;
   KdTreeType.tp_weaklistoffset = 0;
   KdTreeType.tp_doc = CHAR_PTR_CAST
-    "**KdTree** (*nodes*, *distance_type* = 2)\n\n"        \
+    "**KdTree** (*nodes*, *distance_type* = 2, *num_threads* = 0)\n\n"        \
     "The ``KdTree`` constructor creates a new kd tree in *O(n*log(n))* time from the given list of nodes.\n\n" \
     "The nodes in the list *nodes* must be of type ``KdNode``. The dimension of the tree is automatically taken from the length of *nodes[0].point*.\n\n"
-    "The parameter *distance_type* specifies the distance measure that is to be used for nearest neighbor searches. It can be 0 (Linfinite or maximum norm), 1 (L1 or city block norm), or 2 (L2 or euklidean norm).";
+    "The parameter *distance_type* specifies the distance measure that is to be used for nearest neighbor searches. It can be 0 (Linfinite or maximum norm), 1 (L1 or city block norm), or 2 (L2 or euklidean norm).\n\n"
+    "Large subtrees are built in parallel on *num_threads* threads. When *num_threads* is 0 (default), all available cores are used.\n\n"
+    "For large numbers of points, ``KdTree.from_array`` builds the tree directly from a buffer of coordinates.";
 
   PyType_Ready(&KdTreeType);
   PyDict_SetItemString(d, "KdTree", (PyObject*)&KdTreeType);
@@ -30,12 +30,18 @@
 #include "knn.hpp"
 #include "knncoremodule.hpp"
 #include "knnmodule.hpp"
+#include "knn_index.hpp"
 #include <algorithm>
 #include <vector>
 #include <map>
+#include <string>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#ifndef _WIN32
+// for mapping serialized databases
+#include <sys/mman.h>
+#endif
 // for rand
 #include <stdlib.h>
 #include <time.h>
@@ -52,19 +58,37 @@ extern "C" {
                            PyObject* kwds);
   static void knn_dealloc(PyObject* self);
   static PyObject* knn_instantiate_from_images(PyObject* self, PyObject* args);
+  static PyObject* knn_instantiate_from_features(PyObject* self, PyObject* args);
+  static PyObject* knn_add_images(PyObject* self, PyObject* args);
+  static PyObject* knn_remove_feature_vectors(PyObject* self, PyObject* args);
   // classification
   static PyObject* knn_classify(PyObject* self, PyObject* args);
+  static PyObject* knn_classify_list(PyObject* self, PyObject* args);
   static PyObject* knn_classify_with_images(PyObject* self, PyObject* args);
   static PyObject* knn_leave_one_out(PyObject* self, PyObject* args);
   // distance
   static PyObject* knn_knndistance_statistics(PyObject* self, PyObject* args);
+  static PyObject* knn_edit_candidates(PyObject* self, PyObject* args);
+  static PyObject* knn_condense(PyObject* self, PyObject* args);
   static PyObject* knn_distance_from_images(PyObject* self, PyObject* args);
   static PyObject* knn_distance_between_images(PyObject* self, PyObject* args);
   static PyObject* knn_distance_matrix(PyObject* self, PyObject* args);
   static PyObject* knn_unique_distances(PyObject* self, PyObject* args);
+  static PyObject* knn_cluster(PyObject* self, PyObject* args);
+  static PyObject* knn_spanning_tree(PyObject* self, PyObject* args);
   // settings
   static PyObject* knn_get_num_k(PyObject* self);
   static int knn_set_num_k(PyObject* self, PyObject* v);
+  static PyObject* knn_get_num_threads(PyObject* self);
+  static int knn_set_num_threads(PyObject* self, PyObject* v);
+  static PyObject* knn_get_use_index(PyObject* self);
+  static int knn_set_use_index(PyObject* self, PyObject* v);
+  static PyObject* knn_get_approximate_candidates(PyObject* self);
+  static int knn_set_approximate_candidates(PyObject* self, PyObject* v);
+  static PyObject* knn_get_num_feature_vectors(PyObject* self);
+  static PyObject* knn_get_data_version(PyObject* self);
+  static PyObject* knn_get_storage(PyObject* self);
+  static int knn_set_storage(PyObject* self, PyObject* v);
   static PyObject* knn_get_distance_type(PyObject* self);
   static int knn_set_distance_type(PyObject* self, PyObject* v);
   static PyObject* knn_get_confidence_types(PyObject* self);
@@ -93,11 +117,24 @@ PyMethodDef knn_methods[] = {
     ".. _confidence: #confidence"
   },
   { (char *)"instantiate_from_images", knn_instantiate_from_images, METH_VARARGS,
-    (char *)"Use the list of images for non-interactive classification." },
+    (char *)"Use the list of images for non-interactive classification. The optional\n"
+    "third argument is the storage type of the data (see storage)." },
+  { (char *)"instantiate_from_features", knn_instantiate_from_features, METH_VARARGS,
+    (char *)"Like instantiate_from_images, but takes the feature vectors as one buffer\n"
+    "of doubles (e.g. an array('d'), one row of num_features values per feature\n"
+    "vector) and the list of their id names, so that no images are needed." },
+  { (char *)"add_images", knn_add_images, METH_VARARGS,
+    (char *)"Add the images to the data created by instantiate_from_images without\n"
+    "rebuilding it. The normalization is updated with the new feature vectors." },
+  { (char *)"remove_feature_vectors", knn_remove_feature_vectors, METH_VARARGS,
+    (char *)"Remove the feature vectors with the given indexes (in the order in which\n"
+    "they were added) from the data. The normalization is updated accordingly." },
   { (char *)"_distance_from_images", knn_distance_from_images, METH_VARARGS, (char *)"" },
   { (char *)"_distance_between_images", knn_distance_between_images, METH_VARARGS, (char *)"" },
   { (char *)"_distance_matrix", knn_distance_matrix, METH_VARARGS, (char *)"" },
   { (char *)"_unique_distances", knn_unique_distances, METH_VARARGS, (char *)"" },
+  { (char *)"_cluster", knn_cluster, METH_VARARGS, (char *)"" },
+  { (char *)"_spanning_tree", knn_spanning_tree, METH_VARARGS, (char *)"" },
   { (char *)"set_selections", knn_set_selections, METH_VARARGS,
     (char *)"Set the feature selection used for classification."},
   { (char *)"get_selections", knn_get_selections, METH_VARARGS,
@@ -108,9 +145,20 @@ PyMethodDef knn_methods[] = {
     (char *)"Get the weights used for classification." },
   { (char *)"classify", knn_classify, METH_VARARGS,
     (char *)"" },
+  { (char *)"classify_list", knn_classify_list, METH_VARARGS,
+    (char *) "[(id_name, confidencemap), ...] **classify_list** (ImageList *glyphs*)\n"
+    "\nClassifies a list of images with the data given to instantiate_from_images\n"
+    "in a single call. The return value is a list of ``(id_name,confidencemap)``\n"
+    "tuples (as returned by classify) in the order of *glyphs*. The distance\n"
+    "computations are done without holding the Python interpreter lock, so that\n"
+    "other Python threads can run meanwhile. The features of the glyphs must\n"
+    "already be generated."
+  },
   { (char *)"leave_one_out", knn_leave_one_out, METH_VARARGS, (char *)"" },
   { (char *)"_knndistance_statistics", knn_knndistance_statistics, METH_VARARGS,
     (char *)"" },
+  { (char *)"_edit_candidates", knn_edit_candidates, METH_VARARGS, (char *)"" },
+  { (char *)"_condense", knn_condense, METH_VARARGS, (char *)"" },
   { (char *)"serialize", knn_serialize, METH_VARARGS, (char *)"" },
   { (char *)"unserialize", knn_unserialize, METH_VARARGS, (char *)"" },
   { NULL }
@@ -119,6 +167,41 @@ PyMethodDef knn_methods[] = {
 PyGetSetDef knn_getset[] = {
   { (char *)"num_k", (getter)knn_get_num_k, (setter)knn_set_num_k,
     (char *)"The value of k used for classification.", 0 },
+  { (char *)"num_threads", (getter)knn_get_num_threads, (setter)knn_set_num_threads,
+    (char *)"The number of threads used for the distance computations in classify,\n"
+    "classify_list, leave_one_out, distance_matrix and unique_distances. When 0\n"
+    "(the default), all available cores are used. Without OpenMP support,\n"
+    "everything runs on a single thread.", 0 },
+  { (char *)"use_index", (getter)knn_get_use_index, (setter)knn_set_use_index,
+    (char *)"When true, classify and classify_list find the nearest neighbors with a\n"
+    "vantage point tree over the (weighted) training data instead of comparing\n"
+    "each glyph with the whole database. The tree is built on the first\n"
+    "classification after the data, weights or selections changed. The results\n"
+    "(including the confidences, and the choice between equally distant\n"
+    "neighbors) are the same as without the index, as the neighbors found in\n"
+    "the tree are compared with the distances of the linear scan. The tree is\n"
+    "not used with negative weights.", 0 },
+  { (char *)"approximate_candidates", (getter)knn_get_approximate_candidates,
+    (setter)knn_set_approximate_candidates,
+    (char *)"When non-zero, classify and classify_list search approximately: the\n"
+    "training data is compressed to one byte per four features (product\n"
+    "quantization), and only the given number of entries with the smallest\n"
+    "approximate distance are compared exactly. Larger values give results\n"
+    "closer to the exact search (up to identical results), smaller values are\n"
+    "faster. The NUN and default confidences are then estimated from the\n"
+    "approximate distances. This takes precedence over use_index.", 0 },
+  { (char *)"num_feature_vectors", (getter)knn_get_num_feature_vectors, 0,
+    (char *)"The number of feature vectors in the data (read-only).", 0 },
+  { (char *)"data_version", (getter)knn_get_data_version, 0,
+    (char *)"A number that changes whenever the feature vectors or their class names\n"
+    "change, for instance by instantiate_from_images, add_images or\n"
+    "remove_feature_vectors (read-only).", 0 },
+  { (char *)"storage", (getter)knn_get_storage, (setter)knn_set_storage,
+    (char *)"The element type of the stored training data (STORAGE_DOUBLE,\n"
+    "STORAGE_FLOAT, STORAGE_UINT16 or STORAGE_UINT8). FLOAT halves the memory,\n"
+    "the UINT types store each feature scaled linearly between its minimum and\n"
+    "maximum (after the normalization) with 65536 or 256 levels. Setting it\n"
+    "converts the current data, and it is used by the next instantiate_from_images.", 0 },
   { (char *)"distance_type", (getter)knn_get_distance_type, (setter)knn_set_distance_type,
     (char *)"The type of distance calculation used.", 0 },
   { (char *)"confidence_types", (getter)knn_get_confidence_types, (setter)knn_set_confidence_types,
@@ -130,33 +213,73 @@ PyGetSetDef knn_getset[] = {
 
 static PyObject* array_init;
 
+/*
+  The searches release the GIL, so other Python threads can call the
+  methods of the same object meanwhile. Everything that changes the
+  data or the settings read by a running search fails instead.
+*/
+static int knn_check_idle(KnnObject* o) {
+  if (o->searching > 0) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "knn: the classifier cannot be changed during a search");
+    return -1;
+  }
+  return 0;
+}
+
 /*
   Convenience function to delete all of the dynamic data used for
   classification.
 */
+static void knn_delete_index(KnnObject* o);
+static void knn_delete_active(KnnObject* o);
+
+static void knn_free_matrix(KnnObject* o) {
+  if (o->feature_storage != 0) {
+    delete[] o->feature_storage;
+    o->feature_storage = 0;
+  }
+#ifndef _WIN32
+  if (o->mapping != 0) {
+    munmap(o->mapping, o->mapping_size);
+    o->mapping = 0;
+    o->mapping_size = 0;
+  }
+#endif
+  o->features = 0;
+}
+
+static void knn_free_features(KnnObject* o) {
+  knn_free_matrix(o);
+  if (o->quantize_offset != 0) {
+    delete[] o->quantize_offset;
+    o->quantize_offset = 0;
+  }
+  if (o->quantize_step != 0) {
+    delete[] o->quantize_step;
+    o->quantize_step = 0;
+  }
+}
+
 static void knn_delete_feature_data(KnnObject* o) {
-  size_t num_feature_vectors;
+  knn_delete_index(o);
+  knn_delete_active(o);
 
-  if (o->feature_vectors == NULL ) {
-    num_feature_vectors = 0;
-  } else {
-    num_feature_vectors = o->feature_vectors->size();
+  knn_free_features(o);
+  o->num_feature_vectors = 0;
+  o->capacity = 0;
+  o->normalization_changed = false;
+  ++o->data_version;
 
-    std::vector<double*>::iterator fv_it;
-    for (fv_it = o->feature_vectors->begin(); fv_it != o->feature_vectors->end(); ++fv_it ) {
-      delete[] *fv_it;
-    }
-    delete o->feature_vectors;
-    o->feature_vectors = 0;
+  if (o->class_ids != 0) {
+    delete[] o->class_ids;
+    o->class_ids = 0;
   }
-
-  if (o->id_names != 0) {
-    for (size_t i = 0; i < num_feature_vectors; ++i) {
-      if (o->id_names[i] != 0)
-        delete[] o->id_names[i];
-    }
-    delete[] o->id_names;
-    o->id_names = 0;
+  if (o->class_names != 0) {
+    for (size_t i = 0; i < o->class_names->size(); ++i)
+      delete[] (*o->class_names)[i];
+    delete o->class_names;
+    o->class_names = 0;
   }
   if (o->id_name_histogram != 0) {
     delete[] o->id_name_histogram;
@@ -184,9 +307,6 @@ static void set_num_features(KnnObject* o, size_t num_features) {
   if (o->normalize != 0)
     delete o->normalize;
   o->normalize = 0;
-  if (o->unknown != 0)
-    delete[] o->unknown;
-  o->unknown = new double[o->num_features];
 }
 
 /*
@@ -200,15 +320,31 @@ static PyObject* knn_new(PyTypeObject* pytype, PyObject* args,
     Initialize knn
   */
   o->num_features = 0;
-  o->feature_vectors = 0;
-  o->id_names = 0;
+  o->num_feature_vectors = 0;
+  o->capacity = 0;
+  o->storage = STORAGE_DOUBLE;
+  o->features = 0;
+  o->feature_storage = 0;
+  o->mapping = 0;
+  o->mapping_size = 0;
+  o->quantize_offset = 0;
+  o->quantize_step = 0;
+  o->class_ids = 0;
+  o->class_names = 0;
   o->id_name_histogram = 0;
+  o->normalization_changed = false;
+  o->data_version = 0;
   o->selection_vector = 0;
   o->weight_vector = 0;
   o->normalize = 0;
-  o->unknown = 0;
   o->num_k = 1;
   o->distance_type = CITY_BLOCK;
+  o->num_threads = 0;
+  o->use_index = false;
+  o->approximate_candidates = 0;
+  o->index = 0;
+  o->active = 0;
+  o->searching = 0;
   o->confidence_types.push_back(CONFIDENCE_DEFAULT);
 
   Py_INCREF(Py_None);
@@ -225,17 +361,40 @@ static PyObject* knn_new(PyTypeObject* pytype, PyObject* args,
   easier and also allows certain features (like normalization) to become
   a lot easier.
 */
-static int knn_create_feature_data(KnnObject* o, size_t num_feature_vectors) {
+static void knn_allocate_matrix(KnnObject* o, size_t num_feature_vectors,
+                                StorageType storage) {
+  // one block for all feature vectors, with room to align the first row
+  const size_t line = 64;
+  o->feature_storage = new char[num_feature_vectors * o->num_features
+                                * storage_size(storage) + line];
+  size_t misalignment = size_t(o->feature_storage) % line;
+  o->features = o->feature_storage + (line - misalignment) % line;
+}
+
+static void knn_allocate_features(KnnObject* o, size_t num_feature_vectors,
+                                  StorageType storage, bool matrix = true) {
+  if (matrix)
+    knn_allocate_matrix(o, num_feature_vectors, storage);
+  o->storage = storage;
+  if (storage == STORAGE_UINT16 || storage == STORAGE_UINT8) {
+    o->quantize_offset = new double[o->num_features];
+    o->quantize_step = new double[o->num_features];
+  }
+}
+
+static int knn_create_feature_data(KnnObject* o, size_t num_feature_vectors,
+                                   StorageType storage = STORAGE_DOUBLE,
+                                   bool matrix = true) {
   try {
     assert(num_feature_vectors > 0);
 
-    o->feature_vectors = new std::vector<double*>(num_feature_vectors);
-    for (size_t i = 0; i < num_feature_vectors; ++i)
-      (*o->feature_vectors)[i] = new double[o->num_features];
+    knn_allocate_features(o, num_feature_vectors, storage, matrix);
+    o->num_feature_vectors = num_feature_vectors;
+    o->capacity = num_feature_vectors;
 
-    o->id_names = new char*[num_feature_vectors];
-    for (size_t i = 0; i < num_feature_vectors; ++i)
-      o->id_names[i] = 0;
+    o->class_ids = new int[num_feature_vectors];
+    o->class_names = new std::vector<char*>();
+    // there are at most as many classes as feature vectors
     o->id_name_histogram = new int[num_feature_vectors];
   } catch (std::exception e) {
     PyErr_SetString(PyExc_RuntimeError, e.what());
@@ -244,6 +403,126 @@ static int knn_create_feature_data(KnnObject* o, size_t num_feature_vectors) {
   return 1;
 }
 
+/*
+  Sets the class of the i-th feature vector to the given id_name. Each
+  distinct id_name is copied into class_names only once; classes maps
+  the names seen so far to their class ids.
+*/
+static void knn_set_id_name(KnnObject* o, size_t i, const char* id_name,
+                            std::map<char*, int, ltstr>& classes) {
+  std::map<char*, int, ltstr>::iterator c = classes.find((char*)id_name);
+  if (c == classes.end()) {
+    size_t len = strlen(id_name);
+    char* name = new char[len + 1];
+    strncpy(name, id_name, len + 1);
+    o->id_name_histogram[o->class_names->size()] = 0;
+    c = classes.insert(std::make_pair(name, int(o->class_names->size()))).first;
+    o->class_names->push_back(name);
+  }
+  o->class_ids[i] = c->second;
+  o->id_name_histogram[c->second]++;
+}
+
+/*
+  Computes the quantization of each feature for the quantized storage
+  types from the values (num_feature_vectors rows): the minimum and
+  maximum map to the smallest and the largest value of T (a constant
+  feature is stored as 0 with its value as offset).
+*/
+template<class T>
+static void knn_quantization_ranges(KnnObject* o, const double* values) {
+  size_t num_features = o->num_features;
+  const double levels = double(std::numeric_limits<T>::max());
+  for (size_t k = 0; k < num_features; ++k) {
+    double lo = std::numeric_limits<double>::max();
+    double hi = -std::numeric_limits<double>::max();
+    for (size_t i = 0; i < o->num_feature_vectors; ++i) {
+      lo = std::min(lo, values[i * num_features + k]);
+      hi = std::max(hi, values[i * num_features + k]);
+    }
+    o->quantize_offset[k] = lo;
+    o->quantize_step[k] = (hi > lo) ? (hi - lo) / levels : 1.0;
+  }
+}
+
+/*
+  Stores count rows of values as the feature vectors first, first + 1,
+  ... (quantized with the current quantization if quantize is true).
+*/
+template<class T>
+static void knn_store_rows(KnnObject* o, const double* values, size_t first,
+                           size_t count, bool quantize) {
+  size_t num_features = o->num_features;
+  const double levels = double(std::numeric_limits<T>::max());
+  for (size_t i = 0; i < count; ++i) {
+    T* fv = knn_feature_vector<T>(o, first + i);
+    const double* value = values + i * num_features;
+    if (quantize) {
+      for (size_t k = 0; k < num_features; ++k) {
+        double q = (value[k] - o->quantize_offset[k]) / o->quantize_step[k];
+        fv[k] = T(std::min(levels, std::max(0.0, std::floor(q + 0.5))));
+      }
+    } else {
+      std::copy(value, value + num_features, fv);
+    }
+  }
+}
+
+// stores all feature vectors with the storage type T
+template<class T>
+static void knn_store_features(KnnObject* o, const double* values, bool quantize) {
+  if (quantize)
+    knn_quantization_ranges<T>(o, values);
+  knn_store_rows<T>(o, values, 0, o->num_feature_vectors, quantize);
+}
+
+static void knn_store_rows(KnnObject* o, const double* values, size_t first,
+                           size_t count) {
+  switch (o->storage) {
+  case STORAGE_DOUBLE:
+    knn_store_rows<double>(o, values, first, count, false);
+    break;
+  case STORAGE_FLOAT:
+    knn_store_rows<float>(o, values, first, count, false);
+    break;
+  case STORAGE_UINT16:
+    knn_store_rows<unsigned short>(o, values, first, count, true);
+    break;
+  case STORAGE_UINT8:
+    knn_store_rows<unsigned char>(o, values, first, count, true);
+    break;
+  }
+}
+
+static void knn_convert_storage(KnnObject* o, StorageType storage) {
+  if (o->features == 0 || storage == o->storage) {
+    o->storage = storage;
+    return;
+  }
+  knn_update_normalization(o);
+  knn_delete_index(o);
+  size_t num_features = o->num_features;
+  std::vector<double> values(o->num_feature_vectors * num_features + 1);
+  for (size_t i = 0; i < o->num_feature_vectors; ++i)
+    knn_get_feature_vector(o, i, &values[i * num_features]);
+  knn_free_features(o);
+  knn_allocate_features(o, o->num_feature_vectors, storage);
+  switch (storage) {
+  case STORAGE_DOUBLE:
+    knn_store_features<double>(o, &values[0], false);
+    break;
+  case STORAGE_FLOAT:
+    knn_store_features<float>(o, &values[0], false);
+    break;
+  case STORAGE_UINT16:
+    knn_store_features<unsigned short>(o, &values[0], true);
+    break;
+  case STORAGE_UINT8:
+    knn_store_features<unsigned char>(o, &values[0], true);
+    break;
+  }
+}
+
 // destructor for Python
 static void knn_dealloc(PyObject* self) {
   KnnObject* o = (KnnObject*)self;
@@ -254,8 +533,6 @@ static void knn_dealloc(PyObject* self) {
     delete[] o->weight_vector;
   if (o->normalize != 0)
     delete o->normalize;
-  if (o->unknown != 0)
-    delete[] o->unknown;
   self->ob_type->tp_free(self);
 }
 
@@ -269,10 +546,19 @@ static void knn_dealloc(PyObject* self) {
   non-interactive classifiers cannot have feature vectors added or deleted by definition.
 */
 static PyObject* knn_instantiate_from_images(PyObject* self, PyObject* args) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return 0;
   PyObject* images;
   PyObject* norm;
   KnnObject* o = (KnnObject*)self;
-  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OO", &images, &norm) <= 0) {
+  int storage = -1;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OO|i", &images, &norm, &storage) <= 0) {
+    return 0;
+  }
+  if (storage == -1)
+    storage = o->storage;
+  if (storage < STORAGE_DOUBLE || storage > STORAGE_UINT8) {
+    PyErr_SetString(PyExc_ValueError, "knn: unknown storage type.");
     return 0;
   }
   /*
@@ -322,10 +608,10 @@ static PyObject* knn_instantiate_from_images(PyObject* self, PyObject* args) {
   double* tmp_fv;
   Py_ssize_t tmp_fv_len;
 
-  std::map<char*, int, ltstr> id_name_histogram;
+  std::map<char*, int, ltstr> classes;
   double *current_features;
-  for (size_t i = 0; i < o->feature_vectors->size(); ++i) {
-    current_features = (*o->feature_vectors)[i];
+  for (size_t i = 0; i < o->num_feature_vectors; ++i) {
+    current_features = knn_feature_vector<double>(o, i);
 
     PyObject* cur_image = PySequence_Fast_GET_ITEM(images_seq, i);
 
@@ -350,29 +636,21 @@ static PyObject* knn_instantiate_from_images(PyObject* self, PyObject* args) {
       PyErr_SetString(PyExc_ValueError, "knn: could not get id name");
       goto error;
     }
-    o->id_names[i] = new char[len + 1];
-    strncpy(o->id_names[i], tmp_id_name, len + 1);
-    id_name_histogram[o->id_names[i]]++;
+    knn_set_id_name(o, i, tmp_id_name, classes);
   }
 
   /*
-    Apply the normalization and store the histogram data for fast access in
-    leave-one-out.
+    Apply the normalization, and then convert to the requested storage.
   */
   if (o->normalize != 0) {
     o->normalize->compute_normalization();
 
-    for (size_t i = 0; i < o->feature_vectors->size(); ++i) {
-      current_features = (*o->feature_vectors)[i];
+    for (size_t i = 0; i < o->num_feature_vectors; ++i) {
+      current_features = knn_feature_vector<double>(o, i);
       o->normalize->apply(current_features, current_features + o->num_features);
-      o->id_name_histogram[i] = id_name_histogram[o->id_names[i]];
-    }
-  } else {
-    for (size_t i = 0; i < o->feature_vectors->size(); ++i) {
-      current_features = (*o->feature_vectors)[i];
-      o->id_name_histogram[i] = id_name_histogram[o->id_names[i]];
     }
   }
+  knn_convert_storage(o, StorageType(storage));
 
   Py_DECREF(images_seq);
   Py_INCREF(Py_None);
@@ -383,76 +661,662 @@ static PyObject* knn_instantiate_from_images(PyObject* self, PyObject* args) {
 }
 
 /*
-  non-interactive classification using the data created by
-  instantiate from images.
+  Instantiates the data from feature vectors that are not attached to
+  images (see gamera_xml.LoadXMLFeatures): features is a read buffer of
+  len(id_names) * num_features doubles, row by row. Apart from that this
+  is the same as instantiate_from_images.
 */
-static PyObject* knn_classify(PyObject* self, PyObject* args) {
+static PyObject* knn_instantiate_from_features(PyObject* self, PyObject* args) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return 0;
+  PyObject* features;
+  PyObject* id_names;
+  PyObject* norm;
   KnnObject* o = (KnnObject*)self;
-
-  if (o->feature_vectors == 0) {
-      PyErr_SetString(PyExc_RuntimeError,
-                      "knn: classify called before instantiate from images");
-      return 0;
+  int storage = -1;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OOO|i", &features, &id_names, &norm, &storage) <= 0)
+    return 0;
+  if (storage == -1)
+    storage = o->storage;
+  if (storage < STORAGE_DOUBLE || storage > STORAGE_UINT8) {
+    PyErr_SetString(PyExc_ValueError, "knn: unknown storage type.");
+    return 0;
   }
-  PyObject* unknown;
-  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &unknown) <= 0) {
+  if (!PyBool_Check(norm)) {
+    PyErr_SetString(PyExc_TypeError, "knn_instantiate_from_features: third argument must be a bool");
     return 0;
   }
+  const double* values;
+  Py_ssize_t values_len;
+  if (PyObject_AsReadBuffer(features, (const void**)&values, &values_len) < 0)
+    return 0;
+  PyObject* id_names_seq = PySequence_Fast(id_names, "knn: expected a sequence of id names");
+  if (id_names_seq == NULL)
+    return 0;
+  size_t num_new = PySequence_Fast_GET_SIZE(id_names_seq);
+  if (num_new == 0) {
+    PyErr_SetString(PyExc_ValueError, "Initial database of a non-interactive kNN classifier must have at least one element.");
+    Py_DECREF(id_names_seq);
+    return 0;
+  }
+  if (size_t(values_len) != num_new * o->num_features * sizeof(double)) {
+    PyErr_SetString(PyExc_ValueError, "knn: feature vector lengths don't match");
+    Py_DECREF(id_names_seq);
+    return 0;
+  }
+  for (size_t i = 0; i < num_new; ++i) {
+    if (!PyString_Check(PySequence_Fast_GET_ITEM(id_names_seq, i))) {
+      PyErr_SetString(PyExc_TypeError, "knn: id names must be strings");
+      Py_DECREF(id_names_seq);
+      return 0;
+    }
+  }
 
-  if (!is_ImageObject(unknown)) {
-    PyErr_SetString(PyExc_TypeError, "knn: unknown must be an image");
+  knn_delete_feature_data(o);
+  if (o->normalize != 0) {
+    delete o->normalize;
+    o->normalize = 0;
+  }
+  if (PyObject_IsTrue(norm))
+    o->normalize = new Normalize(o->num_features);
+  if (knn_create_feature_data(o, num_new) < 0) {
+    Py_DECREF(id_names_seq);
     return 0;
   }
-  double* fv;
-  Py_ssize_t fv_len;
-  if (image_get_fv(unknown, &fv, &fv_len) < 0) {
-    PyErr_SetString(PyExc_ValueError, "knn: could not get features");
+
+  std::map<char*, int, ltstr> classes;
+  for (size_t i = 0; i < num_new; ++i) {
+    const double* fv = values + i * o->num_features;
+    std::copy(fv, fv + o->num_features, knn_feature_vector<double>(o, i));
+    if (o->normalize != 0)
+      o->normalize->add(fv, fv + o->num_features);
+    knn_set_id_name(o, i, PyString_AS_STRING(PySequence_Fast_GET_ITEM(id_names_seq, i)),
+                    classes);
+  }
+  Py_DECREF(id_names_seq);
+
+  if (o->normalize != 0) {
+    o->normalize->compute_normalization();
+    for (size_t i = 0; i < num_new; ++i) {
+      double* current_features = knn_feature_vector<double>(o, i);
+      o->normalize->apply(current_features, current_features + o->num_features);
+    }
+  }
+  knn_convert_storage(o, StorageType(storage));
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+/*
+  Makes room for num_feature_vectors rows. The capacity grows by at
+  least a factor of two, so that adding feature vectors one batch at a
+  time takes amortized linear time. A mapped matrix (see unserialize) is
+  always copied, since the mapping is read-only.
+*/
+static void knn_reserve(KnnObject* o, size_t num_feature_vectors) {
+  if (num_feature_vectors <= o->capacity && o->mapping == 0)
+    return;
+  size_t capacity = std::max(num_feature_vectors, 2 * o->capacity);
+  size_t row_size = o->num_features * storage_size(o->storage);
+  char* old_features = (char*)o->features;
+  char* old_storage = o->feature_storage;
+  void* old_mapping = o->mapping;
+  size_t old_mapping_size = o->mapping_size;
+  knn_allocate_matrix(o, capacity, o->storage);
+  std::copy(old_features, old_features + o->num_feature_vectors * row_size,
+            (char*)o->features);
+  if (old_storage != 0)
+    delete[] old_storage;
+#ifndef _WIN32
+  if (old_mapping != 0)
+    munmap(old_mapping, old_mapping_size);
+#endif
+  o->mapping = 0;
+  o->mapping_size = 0;
+
+  if (capacity > o->capacity) {
+    int* class_ids = new int[capacity];
+    std::copy(o->class_ids, o->class_ids + o->num_feature_vectors, class_ids);
+    delete[] o->class_ids;
+    o->class_ids = class_ids;
+    int* histogram = new int[capacity];
+    std::copy(o->id_name_histogram, o->id_name_histogram + o->class_names->size(),
+              histogram);
+    delete[] o->id_name_histogram;
+    o->id_name_histogram = histogram;
+    o->capacity = capacity;
+  }
+}
+
+/*
+  Appends the feature vectors of the given images to the data created
+  by instantiate_from_images. The new feature vectors are added to the
+  normalization statistics, and the stored feature vectors are brought
+  up to date lazily (see knn_update_normalization). The index is rebuilt
+  on the next classification.
+*/
+static PyObject* knn_add_images(PyObject* self, PyObject* args) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return 0;
+  KnnObject* o = (KnnObject*)self;
+  PyObject* images;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &images) <= 0)
+    return 0;
+  if (o->features == 0) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "knn: add_images called before instantiate_from_images.");
     return 0;
   }
-  if (size_t(fv_len) != o->num_features) {
-    PyErr_SetString(PyExc_ValueError, "knn: features not the correct size");
+  PyObject* images_seq = PySequence_Fast(images, "knn: expected a sequence of images");
+  if (images_seq == NULL)
     return 0;
+  size_t num_new = PySequence_Fast_GET_SIZE(images_seq);
+  size_t num_features = o->num_features;
+
+  // get all of the data first, so that nothing changes on errors
+  std::vector<double> values(num_new * num_features + 1);
+  std::vector<char*> id_names(num_new + 1);
+  for (size_t i = 0; i < num_new; ++i) {
+    PyObject* cur_image = PySequence_Fast_GET_ITEM(images_seq, i);
+    double* tmp_fv;
+    Py_ssize_t tmp_fv_len;
+    if (!is_ImageObject(cur_image) || image_get_fv(cur_image, &tmp_fv, &tmp_fv_len) < 0) {
+      PyErr_SetString(PyExc_ValueError, "knn: could not get features from image");
+      Py_DECREF(images_seq);
+      return 0;
+    }
+    if (size_t(tmp_fv_len) != num_features) {
+      PyErr_SetString(PyExc_ValueError, "knn: feature vector lengths don't match");
+      Py_DECREF(images_seq);
+      return 0;
+    }
+    std::copy(tmp_fv, tmp_fv + num_features, &values[i * num_features]);
+    int len = 0;
+    if (image_get_id_name(cur_image, &id_names[i], &len) < 0) {
+      PyErr_SetString(PyExc_ValueError, "knn: could not get id name");
+      Py_DECREF(images_seq);
+      return 0;
+    }
   }
 
-  // normalize the unknown
+  // the new feature vectors use the same normalization as the stored ones
   if (o->normalize != 0) {
-    o->normalize->apply(fv, fv + o->num_features, o->unknown);
-  } else {
-    std::copy(fv, fv + o->num_features, o->unknown);
+    for (size_t i = 0; i < num_new; ++i) {
+      double* fv = &values[i * num_features];
+      o->normalize->add(fv, fv + num_features);
+      o->normalize->apply(fv, fv + num_features);
+    }
+    o->normalization_changed = true;
   }
 
-  // create the kNN object
-  kNearestNeighbors<char*, ltstr, eqstr> knn(o->num_k);
-  knn.confidence_types = o->confidence_types;
+  knn_delete_index(o);
+  size_t first = o->num_feature_vectors;
+  knn_reserve(o, first + num_new);
+  std::map<char*, int, ltstr> classes;
+  for (size_t c = 0; c < o->class_names->size(); ++c)
+    classes[(*o->class_names)[c]] = int(c);
+  for (size_t i = 0; i < num_new; ++i)
+    knn_set_id_name(o, first + i, id_names[i], classes);
+  Py_DECREF(images_seq);
 
-  double *current_known;
+  bool quantized = o->storage == STORAGE_UINT16 || o->storage == STORAGE_UINT8;
+  if (quantized) {
+    // feature values outside of the quantized range need new ranges
+    double levels = (o->storage == STORAGE_UINT8) ? 255.0 : 65535.0;
+    bool in_range = true;
+    for (size_t i = 0; in_range && i < num_new; ++i) {
+      for (size_t k = 0; k < num_features; ++k) {
+        double q = (values[i * num_features + k] - o->quantize_offset[k])
+          / o->quantize_step[k];
+        if (q < -0.5 || q > levels + 0.5) {
+          in_range = false;
+          break;
+        }
+      }
+    }
+    if (!in_range) {
+      std::vector<double> all((first + num_new) * num_features + 1);
+      for (size_t i = 0; i < first; ++i)
+        knn_get_feature_vector(o, i, &all[i * num_features]);
+      std::copy(values.begin(), values.begin() + num_new * num_features,
+                all.begin() + first * num_features);
+      o->num_feature_vectors = first + num_new;
+      if (o->storage == STORAGE_UINT8)
+        knn_store_features<unsigned char>(o, &all[0], true);
+      else
+        knn_store_features<unsigned short>(o, &all[0], true);
+      ++o->data_version;
+      Py_INCREF(Py_None);
+      return Py_None;
+    }
+  }
 
-  for (size_t i = 0; i < o->feature_vectors->size(); ++i) {
-    double distance;
+  // store the new rows (with the current quantization)
+  knn_store_rows(o, &values[0], first, num_new);
+  o->num_feature_vectors = first + num_new;
+  ++o->data_version;
+  Py_INCREF(Py_None);
+  return Py_None;
+}
 
-    current_known = (*o->feature_vectors)[i];
+/*
+  Removes the feature vectors with the given indexes (in the order of
+  instantiate_from_images and add_images) from the data. As with
+  add_images, the normalization is updated lazily.
+*/
+static PyObject* knn_remove_feature_vectors(PyObject* self, PyObject* args) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return 0;
+  KnnObject* o = (KnnObject*)self;
+  PyObject* indexes;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &indexes) <= 0)
+    return 0;
+  if (o->features == 0) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "knn: remove_feature_vectors called before instantiate_from_images.");
+    return 0;
+  }
+  PyObject* indexes_seq = PySequence_Fast(indexes, "knn: expected a sequence of indexes");
+  if (indexes_seq == NULL)
+    return 0;
+  size_t num_known = o->num_feature_vectors;
+  std::vector<bool> removed(num_known, false);
+  for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(indexes_seq); ++i) {
+    PyObject* index = PySequence_Fast_GET_ITEM(indexes_seq, i);
+    if (!PyInt_Check(index)) {
+      PyErr_SetString(PyExc_TypeError, "knn: the indexes must be ints.");
+      Py_DECREF(indexes_seq);
+      return 0;
+    }
+    long j = PyInt_AS_LONG(index);
+    if (j < 0 || size_t(j) >= num_known) {
+      PyErr_SetString(PyExc_IndexError, "knn: index out of range.");
+      Py_DECREF(indexes_seq);
+      return 0;
+    }
+    removed[j] = true;
+  }
+  Py_DECREF(indexes_seq);
+
+  knn_delete_index(o);
+  // the mapping is read-only
+  knn_reserve(o, num_known);
+  size_t num_features = o->num_features;
+  size_t row_size = num_features * storage_size(o->storage);
+  std::vector<double> fv(num_features + 1);
+  size_t j = 0;
+  for (size_t i = 0; i < num_known; ++i) {
+    if (removed[i]) {
+      if (o->normalize != 0) {
+        // the statistics are over the feature vectors before normalization
+        knn_get_feature_vector(o, i, &fv[0]);
+        const double* mean = o->normalize->get_mean_vector();
+        const double* stdev = o->normalize->get_stdev_vector();
+        for (size_t k = 0; k < num_features; ++k)
+          fv[k] = fv[k] * stdev[k] + mean[k];
+        o->normalize->remove(fv.begin(), fv.begin() + num_features);
+        o->normalization_changed = true;
+      }
+      o->id_name_histogram[o->class_ids[i]]--;
+    } else {
+      if (j != i) {
+        char* features = (char*)o->features;
+        std::copy(features + i * row_size, features + (i + 1) * row_size,
+                  features + j * row_size);
+        o->class_ids[j] = o->class_ids[i];
+      }
+      ++j;
+    }
+  }
+  o->num_feature_vectors = j;
+  ++o->data_version;
+  if (j == 0)
+    knn_delete_feature_data(o);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
 
-    compute_distance(o->distance_type, current_known, o->num_features,
-                     o->unknown, &distance,
-                     o->selection_vector, o->weight_vector);
+/*
+  The search index used by classify when use_index is set (a VP tree,
+  exact) or approximate_candidates is non-zero (a product quantizer,
+  approximate). Both are built over the feature vectors scaled with the
+  effective weights (w for the city block distance, sqrt(w) for the
+  euclidean distance), so that their unweighted metric is the weighted
+  distance of the linear scan. Features with a weight of zero are left
+  out.
+*/
+struct Gamera::kNN::KnnIndex {
+  KnnIndex(KnnObject* o, const std::vector<double>& w, bool approximate)
+    : distance_type(o->distance_type), data_version(o->data_version),
+      weights(w), tree(0), pq(0) {
+    for (size_t k = 0; k < weights.size(); ++k) {
+      if (weights[k] != 0.0) {
+        dims.push_back(k);
+        if (distance_type == FAST_EUCLIDEAN)
+          scale.push_back(std::sqrt(weights[k]));
+        else
+          scale.push_back(weights[k]);
+      }
+    }
+    // the class ids are the integer labels
+    size_t num_known = o->num_feature_vectors;
+    labels.assign(o->class_ids, o->class_ids + num_known);
+    num_labels = o->class_names->size();
+    std::vector<double> points(num_known * dims.size() + 1);
+    std::vector<double> fv(o->num_features + 1);
+    for (size_t i = 0; i < num_known; ++i) {
+      knn_get_feature_vector(o, i, &fv[0]);
+      transform(&fv[0], &points[i * dims.size()]);
+    }
+    VpTree::Metric metric = (distance_type == FAST_EUCLIDEAN) ? VpTree::L2 : VpTree::L1;
+    if (approximate)
+      pq = new ProductQuantizer(&points[0], num_known, dims.size(), metric);
+    else
+      tree = new VpTree(&points[0], num_known, dims.size(), metric, &labels[0]);
+  }
+  ~KnnIndex() {
+    delete tree;
+    delete pq;
+  }
+  void transform(const double* fv, double* out) const {
+    for (size_t k = 0; k < dims.size(); ++k)
+      out[k] = scale[k] * fv[dims[k]];
+  }
+  DistanceType distance_type;
+  size_t data_version;
+  // the effective weights the index was built with
+  std::vector<double> weights;
+  std::vector<size_t> dims;
+  std::vector<double> scale;
+  std::vector<int> labels;
+  size_t num_labels;
+  VpTree* tree;
+  ProductQuantizer* pq;
+};
 
-    knn.add(o->id_names[i], distance);
+static void knn_delete_index(KnnObject* o) {
+  if (o->index != 0) {
+    delete o->index;
+    o->index = 0;
   }
+}
+
+/*
+  Returns the index for classification when use_index or
+  approximate_candidates is set (building it if it does not exist yet
+  or was built for other settings), or 0 if the linear scan has to be
+  used.
+*/
+static KnnIndex* knn_get_index(KnnObject* o, const std::vector<double>& weights) {
+  bool approximate = o->approximate_candidates > 0;
+  if (!o->use_index && !approximate) {
+    if (o->searching == 0)
+      knn_delete_index(o);
+    return 0;
+  }
+  for (size_t k = 0; k < weights.size(); ++k) {
+    if (weights[k] < 0.0)
+      return 0;
+  }
+  if (o->index != 0 && (o->index->distance_type != o->distance_type ||
+                        o->index->data_version != o->data_version ||
+                        o->index->weights != weights ||
+                        (o->index->pq != 0) != approximate)) {
+    // another thread may still search the old index
+    if (o->searching > 0)
+      return 0;
+    knn_delete_index(o);
+  }
+  if (o->index == 0)
+    o->index = new KnnIndex(o, weights, approximate);
+  return o->index;
+}
+
+static void knn_delete_active(KnnObject* o) {
+  if (o->active != 0) {
+    delete o->active;
+    o->active = 0;
+  }
+}
+
+/*
+  Returns the feature vectors reduced to the features with a non-zero
+  weight for the linear scan (building them if the data or the used
+  features changed), or 0 if nearly all features are used, so that the
+  full feature vectors are scanned without the copy.
+*/
+static KnnActive* knn_get_active(KnnObject* o, const std::vector<double>& weights) {
+  std::vector<size_t> used;
+  for (size_t k = 0; k < weights.size(); ++k) {
+    if (weights[k] != 0.0)
+      used.push_back(k);
+  }
+  if (4 * used.size() > 3 * weights.size()) {
+    if (o->searching == 0)
+      knn_delete_active(o);
+    return 0;
+  }
+  if (o->active != 0 && (o->active->storage != o->storage ||
+                         o->active->data_version != o->data_version ||
+                         o->active->dims != used)) {
+    if (o->searching > 0)
+      return 0;
+    knn_delete_active(o);
+  }
+  if (o->active == 0)
+    o->active = new KnnActive(o, used);
+  return o->active;
+}
+
+/*
+  The same search as knn_search, with the index. Only the neighbors
+  that influence the result are added to knn: the k nearest, the
+  nearest one with a class other than that of the nearest neighbor
+  (for the NUN confidence) and the farthest one (the default confidence
+  is relative to the largest distance). They are added in database
+  order with the distances of the linear scan, so that with the VP tree
+  the results are the same: the distances in the tree (over the scaled
+  coordinates) can round differently, so the tree gives all entries up
+  to a small margin beyond each of these distances, and knn picks among
+  them with the exact distances and, for ties, the database order.
+
+  With the product quantizer these are only estimated from the
+  approximate distances: the approximate_candidates nearest entries
+  are compared with their exact distances to find the k nearest, and
+  the nearest unlike and farthest entry are those with the smallest
+  and largest approximate distance.
+*/
+static void knn_search_index(KnnObject* o, const KnnIndex* index,
+                             const double* unknown, const double* weights,
+                             ClassNearestNeighbors& knn) {
+  std::vector<double> query(index->dims.size() + 1);
+  index->transform(unknown, &query[0]);
+  StoredQuery stored(o, unknown, weights);
+  std::vector<size_t> found;
+  if (index->tree != 0 && index->tree->size() > 0) {
+    const VpTree* tree = index->tree;
+    size_t farthest = tree->farthest(&query[0]);
+    double largest = tree->distance(&query[0], farthest);
+    // far more than the rounding differences to the distances of the
+    // linear scan
+    double margin = 1e-6 * largest;
+    std::vector<size_t> nearest;
+    tree->nearest(&query[0], o->num_k, nearest);
+    double kth = 0.0;
+    for (size_t i = 0; i < nearest.size(); ++i)
+      kth = std::max(kth, tree->distance(&query[0], nearest[i]));
+    if (!nearest.empty())
+      tree->within(&query[0], kth + margin, found);
+    if (!found.empty()) {
+      size_t first = found[0];
+      double first_distance = stored.distance(first);
+      for (size_t i = 1; i < found.size(); ++i) {
+        double d = stored.distance(found[i]);
+        if (d < first_distance || (d == first_distance && found[i] < first)) {
+          first = found[i];
+          first_distance = d;
+        }
+      }
+      int label = index->labels[first];
+      size_t unlike = tree->nearest_unlike(&query[0], label);
+      if (unlike < tree->size())
+        tree->within(&query[0], tree->distance(&query[0], unlike) + margin, found, label);
+      tree->beyond(&query[0], largest - margin, found);
+    }
+  } else if (index->pq != 0) {
+    const ProductQuantizer* pq = index->pq;
+    size_t num_known = pq->size();
+    std::vector<double> table;
+    pq->distance_table(&query[0], table);
+    std::vector<std::pair<double, size_t> > approx(num_known);
+    std::vector<std::pair<double, size_t> >
+      label_nearest(index->num_labels, std::make_pair(std::numeric_limits<double>::max(), num_known));
+    size_t farthest = 0;
+    for (size_t i = 0; i < num_known; ++i) {
+      double d = pq->distance(table, i);
+      approx[i] = std::make_pair(d, i);
+      if (d < label_nearest[index->labels[i]].first)
+        label_nearest[index->labels[i]] = approx[i];
+      if (d > approx[farthest].first)
+        farthest = i;
+    }
+    size_t num_candidates = std::min(num_known, std::max(o->approximate_candidates, o->num_k));
+    std::nth_element(approx.begin(), approx.begin() + num_candidates, approx.end());
+    size_t nearest = num_known;
+    double nearest_distance = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < num_candidates; ++i) {
+      size_t j = approx[i].second;
+      found.push_back(j);
+      double d = stored.distance(j);
+      if (d < nearest_distance || (d == nearest_distance && j < nearest)) {
+        nearest = j;
+        nearest_distance = d;
+      }
+    }
+    if (nearest < num_known) {
+      size_t unlike = num_known;
+      double unlike_distance = std::numeric_limits<double>::max();
+      for (size_t l = 0; l < index->num_labels; ++l) {
+        if (int(l) != index->labels[nearest] && label_nearest[l].first < unlike_distance) {
+          unlike = label_nearest[l].second;
+          unlike_distance = label_nearest[l].first;
+        }
+      }
+      if (unlike < num_known)
+        found.push_back(unlike);
+      found.push_back(farthest);
+    }
+  }
+  std::sort(found.begin(), found.end());
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+  for (size_t i = 0; i < found.size(); ++i)
+    knn.add(o->class_ids[found[i]], stored.distance(found[i]));
   knn.majority();
   knn.calculate_confidences();
-  PyObject* ans_list = PyList_New(knn.answer.size());
-  for (size_t i = 0; i < knn.answer.size(); ++i) {
+}
+
+static const size_t knn_search_block_size = 8;
+static const long knn_search_tile = 64;
+
+/*
+  Searches the k nearest neighbors of the (normalized) unknown feature
+  vector in the data created by instantiate_from_images. This does not
+  use the Python API, so it can be called without holding the GIL. With
+  more than one thread the distances are computed in parallel first and
+  then added to knn in the database order, so that ties are broken the
+  same way as with one thread. With active (see knn_get_active), only
+  the used features are read. The distances are computed a tile of
+  rows at a time by StoredQuery::distances, which runs the variant of
+  the kernel for the CPU.
+*/
+static void knn_search(KnnObject* o, const double* unknown,
+                       const double* weights,
+                       ClassNearestNeighbors& knn,
+                       int num_threads = 1,
+                       const KnnActive* active = 0) {
+  long num_known = long(o->num_feature_vectors);
+  StoredQuery stored(o, unknown, weights, active);
+  // small databases are not worth starting the threads
+  if (num_threads > 1 && num_known >= 1024) {
+    std::vector<double> distances(num_known);
+    long num_tiles = (num_known + knn_search_tile - 1) / knn_search_tile;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+    for (long t = 0; t < num_tiles; ++t) {
+      long begin = t * knn_search_tile;
+      stored.distances(begin, std::min(num_known, begin + knn_search_tile),
+                       &distances[begin]);
+    }
+    for (long i = 0; i < num_known; ++i)
+      knn.add(o->class_ids[i], distances[i]);
+  } else {
+    double distances[knn_search_tile];
+    for (long begin = 0; begin < num_known; begin += knn_search_tile) {
+      long end = std::min(num_known, begin + knn_search_tile);
+      stored.distances(begin, end, distances);
+      for (long i = begin; i < end; ++i)
+        knn.add(o->class_ids[i], distances[i - begin]);
+    }
+  }
+  knn.majority();
+  knn.calculate_confidences();
+}
+
+/*
+  knn_search for the unknowns of a block at once (num_unknowns feature
+  vectors of num_features, with one kNN object each). The database is
+  walked in tiles of rows, which stay in the cache while they are
+  compared with all unknowns, so that a database larger than the cache
+  is read from memory once per block instead of once per unknown. Each
+  kNN object still gets the distances in the database order, so the
+  results are the same as with knn_search.
+*/
+static void knn_search_block(KnnObject* o, const double* unknowns,
+                             size_t num_unknowns, const double* weights,
+                             std::vector<ClassNearestNeighbors>& knns,
+                             const KnnActive* active = 0) {
+  long num_known = long(o->num_feature_vectors);
+  std::vector<StoredQuery> stored;
+  stored.reserve(num_unknowns);
+  for (size_t q = 0; q < num_unknowns; ++q)
+    stored.push_back(StoredQuery(o, unknowns + q * o->num_features, weights, active));
+  double distances[knn_search_tile];
+  for (long begin = 0; begin < num_known; begin += knn_search_tile) {
+    long end = std::min(num_known, begin + knn_search_tile);
+    for (size_t q = 0; q < num_unknowns; ++q) {
+      stored[q].distances(begin, end, distances);
+      for (long i = begin; i < end; ++i)
+        knns[q].add(o->class_ids[i], distances[i - begin]);
+    }
+  }
+  for (size_t q = 0; q < num_unknowns; ++q) {
+    knns[q].majority();
+    knns[q].calculate_confidences();
+  }
+}
+
+/*
+  Creates the (id_name, confidencemap) tuple returned by classify from
+  the answers of kNearestNeighbors, whose class ids index names.
+*/
+static PyObject* knn_result(const std::vector<std::pair<int, double> >& answer,
+                            const std::vector<char*>& names,
+                            const std::vector<int>& confidence_types,
+                            const std::vector<double>& confidence) {
+  PyObject* ans_list = PyList_New(answer.size());
+  for (size_t i = 0; i < answer.size(); ++i) {
     // PyList_SET_ITEM steals references so this code only looks
     // like it leaks. KWM
     PyObject* ans = PyTuple_New(2);
-    PyTuple_SET_ITEM(ans, 0, PyFloat_FromDouble(knn.answer[i].second));
-    PyTuple_SET_ITEM(ans, 1, PyString_FromString(knn.answer[i].first));
+    PyTuple_SET_ITEM(ans, 0, PyFloat_FromDouble(answer[i].second));
+    PyTuple_SET_ITEM(ans, 1, PyString_FromString(names[answer[i].first]));
     PyList_SET_ITEM(ans_list, i, ans);
   }
   PyObject* conf_dict = PyDict_New();
-  for (size_t i = 0; i < knn.confidence_types.size(); ++i) {
-    PyObject* o1 = PyInt_FromLong(knn.confidence_types[i]);
-    PyObject* o2 = PyFloat_FromDouble(knn.confidence[i]);
+  for (size_t i = 0; i < confidence_types.size() && i < confidence.size(); ++i) {
+    PyObject* o1 = PyInt_FromLong(confidence_types[i]);
+    PyObject* o2 = PyFloat_FromDouble(confidence[i]);
     PyDict_SetItem(conf_dict, o1, o2);
     Py_DECREF(o1);
     Py_DECREF(o2);
@@ -463,6 +1327,168 @@ static PyObject* knn_classify(PyObject* self, PyObject* args) {
   return result;
 }
 
+/*
+  Gets the features of an unknown image and stores them normalized
+  in dest.
+*/
+static int knn_get_unknown(KnnObject* o, PyObject* unknown, double* dest) {
+  if (!is_ImageObject(unknown)) {
+    PyErr_SetString(PyExc_TypeError, "knn: unknown must be an image");
+    return -1;
+  }
+  double* fv;
+  Py_ssize_t fv_len;
+  if (image_get_fv(unknown, &fv, &fv_len) < 0) {
+    PyErr_SetString(PyExc_ValueError, "knn: could not get features");
+    return -1;
+  }
+  if (size_t(fv_len) != o->num_features) {
+    PyErr_SetString(PyExc_ValueError, "knn: features not the correct size");
+    return -1;
+  }
+
+  // normalize the unknown
+  if (o->normalize != 0) {
+    o->normalize->apply(fv, fv + o->num_features, dest);
+  } else {
+    std::copy(fv, fv + o->num_features, dest);
+  }
+  return 0;
+}
+
+/*
+  non-interactive classification using the data created by
+  instantiate from images.
+*/
+static PyObject* knn_classify(PyObject* self, PyObject* args) {
+  KnnObject* o = (KnnObject*)self;
+
+  if (o->features == 0) {
+      PyErr_SetString(PyExc_RuntimeError,
+                      "knn: classify called before instantiate from images");
+      return 0;
+  }
+  knn_update_normalization(o);
+  PyObject* unknown;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &unknown) <= 0) {
+    return 0;
+  }
+  std::vector<double> features(o->num_features);
+  if (knn_get_unknown(o, unknown, &features[0]) < 0)
+    return 0;
+
+  // create the kNN object
+  ClassNearestNeighbors knn(o->num_k, ClassNameLess(o->class_names));
+  knn.confidence_types = o->confidence_types;
+  std::vector<double> weights(o->num_features);
+  fold_weights(o->selection_vector, o->weight_vector, o->num_features, &weights[0]);
+  KnnIndex* index = knn_get_index(o, weights);
+  KnnActive* active = index == 0 ? knn_get_active(o, weights) : 0;
+  ++o->searching;
+  Py_BEGIN_ALLOW_THREADS
+  if (index != 0)
+    knn_search_index(o, index, &features[0], &weights[0], knn);
+  else
+    knn_search(o, &features[0], &weights[0], knn, knn_num_threads(o), active);
+  Py_END_ALLOW_THREADS
+  --o->searching;
+  return knn_result(knn.answer, *o->class_names, knn.confidence_types,
+                    knn.confidence);
+}
+
+/*
+  non-interactive classification of a whole list of images. The
+  features of all images are copied first, so that the search itself
+  can run without the GIL.
+*/
+static PyObject* knn_classify_list(PyObject* self, PyObject* args) {
+  KnnObject* o = (KnnObject*)self;
+
+  if (o->features == 0) {
+      PyErr_SetString(PyExc_RuntimeError,
+                      "knn: classify_list called before instantiate from images");
+      return 0;
+  }
+  knn_update_normalization(o);
+  PyObject* unknowns;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &unknowns) <= 0) {
+    return 0;
+  }
+  PyObject* unknowns_seq = PySequence_Fast(unknowns, "knn: glyphs must be iterable");
+  if (unknowns_seq == NULL)
+    return 0;
+  size_t num_unknowns = PySequence_Fast_GET_SIZE(unknowns_seq);
+
+  std::vector<double> features(num_unknowns * o->num_features);
+  for (size_t i = 0; i < num_unknowns; ++i) {
+    if (knn_get_unknown(o, PySequence_Fast_GET_ITEM(unknowns_seq, i),
+                        &features[i * o->num_features]) < 0) {
+      Py_DECREF(unknowns_seq);
+      return 0;
+    }
+  }
+  Py_DECREF(unknowns_seq);
+
+  std::vector<std::vector<std::pair<int, double> > > answers(num_unknowns);
+  std::vector<std::vector<double> > confidences(num_unknowns);
+  std::vector<double> weights(o->num_features);
+  fold_weights(o->selection_vector, o->weight_vector, o->num_features, &weights[0]);
+  KnnIndex* index = knn_get_index(o, weights);
+  KnnActive* active = index == 0 ? knn_get_active(o, weights) : 0;
+  // every thread classifies whole blocks of glyphs (see
+  // knn_search_block) with its own kNN objects
+  size_t block = index == 0 ? knn_search_block_size : 1;
+  long num_blocks = long((num_unknowns + block - 1) / block);
+  int num_threads = knn_num_threads(o);
+  bool failed = false;
+  ++o->searching;
+  Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+  {
+    std::vector<ClassNearestNeighbors>
+      knns(block, ClassNearestNeighbors(o->num_k, ClassNameLess(o->class_names)));
+    for (size_t q = 0; q < block; ++q)
+      knns[q].confidence_types = o->confidence_types;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (long b = 0; b < num_blocks; ++b) {
+      size_t first = size_t(b) * block;
+      size_t count = std::min(block, num_unknowns - first);
+      try {
+        for (size_t q = 0; q < count; ++q)
+          knns[q].reset();
+        if (index != 0)
+          knn_search_index(o, index, &features[first * o->num_features],
+                           &weights[0], knns[0]);
+        else
+          knn_search_block(o, &features[first * o->num_features], count,
+                           &weights[0], knns, active);
+        for (size_t q = 0; q < count; ++q) {
+          answers[first + q].swap(knns[q].answer);
+          confidences[first + q].swap(knns[q].confidence);
+        }
+      } catch (std::exception e) {
+        failed = true;
+      }
+    }
+  }
+  Py_END_ALLOW_THREADS
+  --o->searching;
+  if (failed) {
+    PyErr_SetString(PyExc_RuntimeError, "knn: classification failed");
+    return 0;
+  }
+
+  PyObject* result = PyList_New(num_unknowns);
+  for (size_t i = 0; i < num_unknowns; ++i)
+    PyList_SET_ITEM(result, i, knn_result(answers[i], *o->class_names,
+                                          o->confidence_types, confidences[i]));
+  return result;
+}
+
 static PyObject* knn_classify_with_images(PyObject* self, PyObject* args) {
   KnnObject* o = (KnnObject*)self;
   PyObject* unknown, *iterator, *container;
@@ -498,7 +1524,10 @@ static PyObject* knn_classify_with_images(PyObject* self, PyObject* args) {
     return 0;
   }
 
-  kNearestNeighbors<char*, ltstr, eqstr> knn(o->num_k);
+  // the id_names of the known images get class ids in the order seen
+  std::map<char*, int, ltstr> classes;
+  std::vector<char*> names;
+  ClassNearestNeighbors knn(o->num_k, ClassNameLess(&names));
   knn.confidence_types = o->confidence_types;
 
   PyObject* cur;
@@ -523,7 +1552,12 @@ static PyObject* knn_classify_with_images(PyObject* self, PyObject* args) {
     int len;
     if (image_get_id_name(cur, &id_name, &len) < 0)
       return 0;
-    knn.add(id_name, distance);
+    std::map<char*, int, ltstr>::iterator c = classes.find(id_name);
+    if (c == classes.end()) {
+      c = classes.insert(std::make_pair(id_name, int(names.size()))).first;
+      names.push_back(id_name);
+    }
+    knn.add(c->second, distance);
     Py_DECREF(cur);
   }
 
@@ -536,7 +1570,7 @@ static PyObject* knn_classify_with_images(PyObject* self, PyObject* args) {
     // like it leaks. KWM
     PyObject* ans = PyTuple_New(2);
     PyTuple_SET_ITEM(ans, 0, PyFloat_FromDouble(knn.answer[i].second));
-    PyTuple_SET_ITEM(ans, 1, PyString_FromString(knn.answer[i].first));
+    PyTuple_SET_ITEM(ans, 1, PyString_FromString(names[knn.answer[i].first]));
     PyList_SET_ITEM(ans_list, i, ans);
   }
   PyObject* conf_dict = PyDict_New();
@@ -633,6 +1667,286 @@ static PyObject* knn_distance_between_images(PyObject* self, PyObject* args) {
   return Py_BuildValue(CHAR_PTR_CAST "f", distance);
 }
 
+/*
+  Copies the feature vectors of all images in images_seq into one
+  contiguous buffer (normalized over all of these images if normalize
+  is true). Sets a Python exception and returns -1 on error.
+*/
+static int knn_get_image_features(KnnObject* o, PyObject* images_seq,
+                                  bool normalize, std::vector<double>& features) {
+  size_t images_len = PySequence_Fast_GET_SIZE(images_seq);
+  features.resize(images_len * o->num_features);
+  kNN::Normalize norm(o->num_features);
+  for (size_t i = 0; i < images_len; ++i) {
+    PyObject* cur = PySequence_Fast_GET_ITEM(images_seq, i);
+    if (!is_ImageObject(cur)) {
+      PyErr_SetString(PyExc_TypeError, "knn: expected an image");
+      return -1;
+    }
+    double* buf;
+    Py_ssize_t len;
+    if (image_get_fv(cur, &buf, &len) < 0)
+      return -1;
+    if (len != (int)o->num_features) {
+      PyErr_SetString(PyExc_ValueError, "knn: feature vector lengths don't match.");
+      return -1;
+    }
+    std::copy(buf, buf + len, &features[i * o->num_features]);
+    if (normalize)
+      norm.add(buf, buf + len);
+  }
+  if (normalize) {
+    norm.compute_normalization();
+    for (size_t i = 0; i < images_len; ++i) {
+      double* fv = &features[i * o->num_features];
+      norm.apply(fv, fv + o->num_features);
+    }
+  }
+  return 0;
+}
+
+/*
+  The distances between the feature vectors for the distance matrix.
+  With FAST_EUCLIDEAN and non-negative weights, the distance between a
+  and b is computed as |a|^2 + |b|^2 - 2 a.b from the feature vectors
+  scaled by the square roots of the weights (and without the features
+  of weight zero), which needs half the arithmetic of the difference.
+  The cancellation in that sum makes small distances inaccurate, so
+  that distances below a small fraction of |a|^2 + |b|^2 are computed
+  again from the differences. All other distances are computed as by
+  classify.
+*/
+struct MatrixDistance {
+  MatrixDistance(KnnObject* o, const std::vector<double>& features_, long images_len)
+    : data(&features_[0]), distance_type(o->distance_type),
+      num_features(o->num_features), dot(false) {
+    weights.resize(num_features + 1);
+    fold_weights(o->selection_vector, o->weight_vector, num_features, &weights[0]);
+    if (distance_type != FAST_EUCLIDEAN)
+      return;
+    std::vector<size_t> used;
+    for (size_t k = 0; k < num_features; ++k) {
+      if (weights[k] < 0.0)
+        return;
+      if (weights[k] > 0.0)
+        used.push_back(k);
+    }
+    dot = true;
+    len = used.size();
+    scaled.resize(images_len * len + 1);
+    norms.resize(images_len);
+    for (long i = 0; i < images_len; ++i) {
+      double norm = 0.0;
+      for (size_t k = 0; k < len; ++k) {
+        double x = std::sqrt(weights[used[k]]) * data[i * num_features + used[k]];
+        scaled[i * len + k] = x;
+        norm += x * x;
+      }
+      norms[i] = norm;
+    }
+  }
+
+  double operator()(long i, long j) const {
+    if (dot) {
+      const double* a = &scaled[i * len];
+      const double* b = &scaled[j * len];
+      double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+      size_t k = 0;
+      for (; k + 4 <= len; k += 4) {
+        sum[0] += a[k] * b[k];
+        sum[1] += a[k + 1] * b[k + 1];
+        sum[2] += a[k + 2] * b[k + 2];
+        sum[3] += a[k + 3] * b[k + 3];
+      }
+      double product = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+      for (; k < len; ++k)
+        product += a[k] * b[k];
+      double norm = norms[i] + norms[j];
+      double distance = norm - 2.0 * product;
+      if (distance > 1e-4 * norm)
+        return distance;
+    }
+    return compute_distance(distance_type, data + i * num_features,
+                            data + j * num_features, &weights[0], num_features);
+  }
+
+  const double* data;
+  DistanceType distance_type;
+  size_t num_features;
+  std::vector<double> weights;
+  bool dot;
+  size_t len;
+  std::vector<double> scaled;
+  std::vector<double> norms;
+};
+
+static const long knn_distance_tile = 64;
+
+/*
+  Computes the upper triangle of the distance matrix of features in
+  bands of tile rows, without the GIL and on num_threads threads. Each
+  band is split into tiles of tile x tile distances, which are computed
+  in parallel, so that the feature vectors of a tile stay in the cache.
+  The distance between i and j (with i < j) is passed to
+  set(i, j, distance), and set.band(begin, end) is called (with the GIL)
+  after the rows begin to end - 1 are done. The progress object is then
+  called once for each of these rows, as before.
+*/
+template<class F>
+static int knn_distance_triangle(KnnObject* o, const std::vector<double>& features,
+                                 long images_len, PyObject* progress, F& set) {
+  MatrixDistance distance(o, features, images_len);
+  int num_threads = knn_num_threads(o);
+  const long tile = knn_distance_tile;
+  for (long begin = 0; begin < images_len; begin += tile) {
+    long end = std::min(images_len, begin + tile);
+    long num_tiles = (images_len - begin + tile - 1) / tile;
+    ++o->searching;
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+#endif
+    for (long t = 0; t < num_tiles; ++t) {
+      long column_begin = begin + t * tile;
+      long column_end = std::min(images_len, column_begin + tile);
+      for (long i = begin; i < end; ++i) {
+        for (long j = std::max(column_begin, i + 1); j < column_end; ++j)
+          set(i, j, distance(i, j));
+      }
+    }
+    Py_END_ALLOW_THREADS
+    --o->searching;
+    if (set.band(begin, end) < 0)
+      return -1;
+    if (progress) {
+      for (long i = begin; i < end; ++i) {
+        PyObject* res = PyObject_CallObject(progress, NULL);
+        if (res == NULL)
+          return -1;
+        Py_DECREF(res);
+      }
+    }
+  }
+  return 0;
+}
+
+struct SetMatrixDistance {
+  SetMatrixDistance(FloatImageView* m) : mat(m) { }
+  void operator()(long i, long j, double distance) {
+    mat->set(Point(j, i), distance);
+    mat->set(Point(i, j), distance);
+  }
+  int band(long begin, long end) { return 0; }
+  FloatImageView* mat;
+};
+
+struct SetListDistance {
+  SetListDistance(FloatImageView* l, long n) : list(l), images_len(n) { }
+  void operator()(long i, long j, double distance) {
+    list->set(Point(knn_triangle_index(i, j, images_len), 0), distance);
+  }
+  int band(long begin, long end) { return 0; }
+  FloatImageView* list;
+  long images_len;
+};
+
+struct SetVectorDistance {
+  SetVectorDistance(std::vector<double>& v, long n) : distances(v), images_len(n) { }
+  void operator()(long i, long j, double distance) {
+    distances[knn_triangle_index(i, j, images_len)] = distance;
+  }
+  int band(long begin, long end) { return 0; }
+  std::vector<double>& distances;
+  long images_len;
+};
+
+/*
+  Writes the distances in the order of SetListDistance to a file as
+  doubles (in the byte order of the machine), a band of rows at a time,
+  so that only the distances of one band are kept in memory.
+*/
+struct WriteListDistance {
+  WriteListDistance(FILE* f, long n) : file(f), images_len(n), first(0) {
+    buffer.resize(std::min(n * knn_distance_tile, n * (n - 1) / 2));
+  }
+  void operator()(long i, long j, double distance) {
+    buffer[knn_triangle_index(i, j, images_len) - first] = distance;
+  }
+  int band(long begin, long end) {
+    long next = knn_triangle_index(end, end + 1, images_len);
+    if (end >= images_len)
+      next = images_len * (images_len - 1) / 2;
+    size_t count = size_t(next - first);
+    if (fwrite(&buffer[0], sizeof(double), count, file) != count) {
+      PyErr_SetString(PyExc_IOError, "knn: error writing the distances.");
+      return -1;
+    }
+    first = next;
+    return 0;
+  }
+  FILE* file;
+  long images_len;
+  long first;
+  std::vector<double> buffer;
+};
+
+/*
+  A small pseudo-random generator (splitmix64) for the sampled
+  distances. The seed is drawn by gamera.knn from the random module,
+  so that random.seed makes the samples reproducible.
+*/
+struct KnnRandom {
+  KnnRandom(unsigned long seed) : state(seed) { }
+  unsigned long long next() {
+    unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  // uniform in [0, n), up to a bias of n / 2^64
+  long below(long n) {
+    return long(next() % (unsigned long long)n);
+  }
+  unsigned long long state;
+};
+
+/*
+  The distances of a stratified random sample of num_samples of the
+  pairs of unique_distances: the indexes of the pairs (see
+  knn_triangle_index) are split into num_samples strata of (nearly)
+  equal size, and one pair is drawn from each stratum. The distances
+  are in the order of the pairs and are computed without the GIL and
+  on num_threads threads.
+*/
+static void knn_sample_distances(KnnObject* o, const std::vector<double>& features,
+                                 long images_len, long num_samples, unsigned long seed,
+                                 FloatImageView* list) {
+  long num_pairs = images_len * (images_len - 1) / 2;
+  KnnRandom random(seed);
+  std::vector<long> first(num_samples), second(num_samples);
+  for (long s = 0; s < num_samples; ++s) {
+    long begin = long(double(num_pairs) * s / num_samples);
+    long end = long(double(num_pairs) * (s + 1) / num_samples);
+    end = std::max(begin + 1, std::min(end, num_pairs));
+    knn_triangle_pair(begin + random.below(end - begin), images_len,
+                      first[s], second[s]);
+  }
+  MatrixDistance distance(o, features, images_len);
+  int num_threads = knn_num_threads(o);
+  std::vector<double> distances(num_samples);
+  ++o->searching;
+  Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 256)
+#endif
+  for (long s = 0; s < num_samples; ++s)
+    distances[s] = distance(first[s], second[s]);
+  Py_END_ALLOW_THREADS
+  --o->searching;
+  for (long s = 0; s < num_samples; ++s)
+    list->set(Point(s, 0), distances[s]);
+}
+
 /*
   Create a symmetric float matrix (image) containing all of the
   distances between the images in the list passed in. This is useful
@@ -659,109 +1973,49 @@ PyObject* knn_distance_matrix(PyObject* self, PyObject* args) {
     return 0;
   }
 
-  // Check the number of features
-  double* buf_a, *buf_b;
-  Py_ssize_t len_a, len_b;
-  PyObject* cur_a, *cur_b;
-  cur_a = PySequence_Fast_GET_ITEM(images_seq, 0);
-  if (!is_ImageObject(cur_a)) {
-    PyErr_SetString(PyExc_TypeError, "knn: expected an image");
-    Py_DECREF(images_seq);
-    return 0;
-  }
-  if (image_get_fv(cur_a, &buf_a, &len_a) < 0) {
-    Py_DECREF(images_seq);
-    return 0;
-  }
-
-  if (len_a != (int)o->num_features) {
-    PyErr_SetString(PyExc_ValueError, "knn: feature vector lengths don't match.");
+  std::vector<double> features;
+  if (knn_get_image_features(o, images_seq, normalize != 0, features) < 0) {
     Py_DECREF(images_seq);
     return 0;
   }
+  Py_DECREF(images_seq);
 
-  // create the normalization object
-  double* tmp_a = new double[len_a];
-  double* tmp_b = new double[len_a];
   FloatImageData* data = new FloatImageData(Dim(images_len, images_len));
   FloatImageView* mat = new FloatImageView(*data);
-
-  kNN::Normalize norm(len_a);
-  for (int i = 0; i < images_len; ++i) {
-    cur_a = PySequence_Fast_GET_ITEM(images_seq, i);
-    if (cur_a == NULL)
-      goto mat_error;
-    if (!is_ImageObject(cur_a)) {
-      PyErr_SetString(PyExc_TypeError, "knn: expected an image");
-      goto mat_error;
-    }
-    if (image_get_fv(cur_a, &buf_a, &len_a) < 0)
-      goto mat_error;
-    if (len_a != (int)o->num_features) {
-      PyErr_SetString(PyExc_ValueError, "knn: feature vector lengths don't match.");
-      goto mat_error;
-    }
-    if (normalize)
-      norm.add(buf_a, buf_a + len_a);
-  }
-  if (normalize)
-    norm.compute_normalization();
-
   std::fill(mat->vec_begin(), mat->vec_end(), 0.0);
   // do the distance calculations
-  for (int i = 0; i < images_len; ++i) {
-    cur_a = PySequence_Fast_GET_ITEM(images_seq, i);
-    if (cur_a == NULL)
-      goto mat_error;
-    if (image_get_fv(cur_a, &buf_a, &len_a) < 0)
-      goto mat_error;
-    if (normalize)
-      norm.apply(buf_a, buf_a + len_a, tmp_a);
-    for (int j = i + 1; j < images_len; ++j) {
-      cur_b = PySequence_Fast_GET_ITEM(images_seq, j);
-      if (cur_b == NULL)
-        goto mat_error;
-      if (image_get_fv(cur_b, &buf_b, &len_b) < 0)
-        goto mat_error;
-      if (normalize)
-        norm.apply(buf_b, buf_b + len_b, tmp_b);
-      double distance;
-      if (normalize)
-        compute_distance(o->distance_type, tmp_a, len_a, tmp_b, &distance,
-                         o->selection_vector, o->weight_vector);
-      else
-        compute_distance(o->distance_type, buf_a, len_a, buf_b, &distance,
-                         o->selection_vector, o->weight_vector);
-      mat->set(Point(j, i), distance);
-      mat->set(Point(i, j), distance);
-    }
-    if (progress)
-      PyObject_CallObject(progress, NULL);
+  SetMatrixDistance set(mat);
+  if (knn_distance_triangle(o, features, images_len, progress, set) < 0) {
+    delete mat; delete data;
+    return 0;
   }
-  delete[] tmp_a;
-  delete[] tmp_b;
-  Py_DECREF(images_seq);
   return create_ImageObject(mat);
- mat_error:
-  Py_DECREF(images_seq);
-  // delete the image
-  delete mat; delete data;
-  // delete the tmp buffers
-  delete[] tmp_a; delete[] tmp_b;
-  return 0;
 }
 
 /*
   unique_distances takes a list of images and returns all of the unique
-  pairs of distances between the images.
+  pairs of distances between the images. When a filename is given, the
+  distances are written to that file instead (see WriteListDistance).
+  When sample is below the number of pairs, only the distances of a
+  sample of the pairs are returned (see knn_sample_distances), and
+  progress is not called.
 */
 PyObject* knn_unique_distances(PyObject* self, PyObject* args) {
   KnnObject* o = (KnnObject*)self;
   PyObject* images;
   PyObject* progress;
   long normalize = 1;
-  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OO|i", &images, &progress, &normalize) <= 0)
+  char* filename = 0;
+  long sample = 0;
+  unsigned long seed = 0;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OO|izlk", &images, &progress, &normalize,
+                       &filename, &sample, &seed) <= 0)
+    return 0;
+  if (sample > 0 && filename != 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "knn: a sample of the distances can not be written to a file.");
     return 0;
+  }
   // images is a list of Gamera/Python ImageObjects
   PyObject* images_seq = PySequence_Fast(images, "First argument must be iterable.");
   if (images_seq == NULL)
@@ -773,101 +2027,204 @@ PyObject* knn_unique_distances(PyObject* self, PyObject* args) {
     Py_DECREF(images_seq);
     return 0;
   }
+
+  std::vector<double> features;
+  if (knn_get_image_features(o, images_seq, normalize != 0, features) < 0) {
+    Py_DECREF(images_seq);
+    return 0;
+  }
+  Py_DECREF(images_seq);
+
+  if (filename != 0) {
+    FILE* file = fopen(filename, "wb");
+    if (file == 0) {
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+      return 0;
+    }
+    WriteListDistance write(file, images_len);
+    int result = knn_distance_triangle(o, features, images_len, progress, write);
+    if (fclose(file) != 0 && result == 0) {
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+      result = -1;
+    }
+    if (result < 0)
+      return 0;
+    Py_RETURN_NONE;
+  }
+
   // create the 'vector' for the output
-  int list_len = ((images_len * images_len) - images_len) / 2;
+  long list_len = (long(images_len) * images_len - images_len) / 2;
+  if (sample > 0 && sample < list_len) {
+    FloatImageData* data = new FloatImageData(Dim(sample, 1));
+    FloatImageView* list = new FloatImageView(*data);
+    knn_sample_distances(o, features, images_len, sample, seed, list);
+    return create_ImageObject(list);
+  }
   FloatImageData* data = new FloatImageData(Dim(list_len, 1));
   FloatImageView* list = new FloatImageView(*data);
+  // do the distance calculations
+  SetListDistance set(list, images_len);
+  if (knn_distance_triangle(o, features, images_len, progress, set) < 0) {
+    delete list; delete data;
+    return 0;
+  }
+  return create_ImageObject(list);
+}
 
-  // create a default set of weights for the distance calculation.
-  double* buf_a, *buf_b;
-  Py_ssize_t len_a, len_b;
-  PyObject* cur_a, *cur_b;
-  cur_a = PySequence_Fast_GET_ITEM(images_seq, 0);
-  if (!is_ImageObject(cur_a)) {
-    PyErr_SetString(PyExc_TypeError, "knn: expected an image");
+/*
+  Agglomerative clustering of a list of images (see gamera.cluster). The
+  single linkage clustering computes the distances when needed; the other
+  linkages need the upper triangle of the distance matrix, which is
+  computed as by unique_distances. Returns the merges as a list of
+  tuples (cluster a, cluster b, distance, size).
+*/
+PyObject* knn_cluster(PyObject* self, PyObject* args) {
+  KnnObject* o = (KnnObject*)self;
+  PyObject* images;
+  PyObject* progress;
+  long normalize = 1;
+  int linkage = SINGLE_LINKAGE;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OO|ii", &images, &progress, &normalize,
+                       &linkage) <= 0)
+    return 0;
+  if (linkage < SINGLE_LINKAGE || linkage > AVERAGE_LINKAGE) {
+    PyErr_SetString(PyExc_ValueError, "knn: unknown linkage.");
+    return 0;
+  }
+  PyObject* images_seq = PySequence_Fast(images, "First argument must be iterable.");
+  if (images_seq == NULL)
+    return 0;
+
+  long images_len = PySequence_Fast_GET_SIZE(images_seq);
+  if (!(images_len > 1)) {
+    PyErr_SetString(PyExc_ValueError, "List must have at least two images.");
+    Py_DECREF(images_seq);
+    return 0;
+  }
+
+  std::vector<double> features;
+  if (knn_get_image_features(o, images_seq, normalize != 0, features) < 0) {
     Py_DECREF(images_seq);
     return 0;
   }
-  if (image_get_fv(cur_a, &buf_a, &len_a) < 0) {
+  Py_DECREF(images_seq);
+
+  std::vector<ClusterMerge> merges;
+  if (linkage == SINGLE_LINKAGE) {
+    MatrixDistance distance(o, features, images_len);
+    int num_threads = knn_num_threads(o);
+    ++o->searching;
+    Py_BEGIN_ALLOW_THREADS
+    merges = single_linkage(images_len, distance, num_threads);
+    Py_END_ALLOW_THREADS
+    --o->searching;
+  } else {
+    std::vector<double> distances(images_len * (images_len - 1) / 2);
+    SetVectorDistance set(distances, images_len);
+    if (knn_distance_triangle(o, features, images_len, progress, set) < 0)
+      return 0;
+    ++o->searching;
+    Py_BEGIN_ALLOW_THREADS
+    merges = chain_linkage(images_len, distances, ClusterLinkage(linkage));
+    Py_END_ALLOW_THREADS
+    --o->searching;
+  }
+
+  PyObject* result = PyList_New(merges.size());
+  for (size_t m = 0; m < merges.size(); ++m) {
+    PyList_SET_ITEM(result, m, Py_BuildValue(CHAR_PTR_CAST "(lldl)", merges[m].a, merges[m].b,
+                                             merges[m].distance, merges[m].size));
+  }
+  return result;
+}
+
+/*
+  A spanning tree of a list of images for gamera.cluster: the
+  approximate minimum spanning tree from the num_neighbors nearest
+  neighbors of each image (see neighbor_spanning_tree, whose Boruvka
+  steps search from num_neighbors images of each tree), or the exact
+  one with Prim's algorithm when num_neighbors is zero or a weight is
+  negative (which the VP tree does not handle). Returns the edges as a
+  list of tuples (image a, image b, distance) in increasing order of
+  distance.
+*/
+PyObject* knn_spanning_tree(PyObject* self, PyObject* args) {
+  KnnObject* o = (KnnObject*)self;
+  PyObject* images;
+  long normalize = 1;
+  long num_neighbors = 10;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O|il", &images, &normalize,
+                       &num_neighbors) <= 0)
+    return 0;
+  if (num_neighbors < 0) {
+    PyErr_SetString(PyExc_ValueError, "knn: the number of neighbors must not be negative.");
+    return 0;
+  }
+  PyObject* images_seq = PySequence_Fast(images, "First argument must be iterable.");
+  if (images_seq == NULL)
+    return 0;
+
+  long images_len = PySequence_Fast_GET_SIZE(images_seq);
+  if (!(images_len > 1)) {
+    PyErr_SetString(PyExc_ValueError, "List must have at least two images.");
     Py_DECREF(images_seq);
     return 0;
   }
 
-  if (len_a != (int)o->num_features) {
-    PyErr_SetString(PyExc_ValueError, "knn: feature vector lengths don't match.");
+  std::vector<double> features;
+  if (knn_get_image_features(o, images_seq, normalize != 0, features) < 0) {
     Py_DECREF(images_seq);
     return 0;
   }
+  Py_DECREF(images_seq);
 
-  // create the normalization object
-  kNN::Normalize norm(len_a);
-  for (int i = 0; i < images_len; ++i) {
-    cur_a = PySequence_Fast_GET_ITEM(images_seq, i);
-    if (!is_ImageObject(cur_a)) {
-      PyErr_SetString(PyExc_TypeError, "knn: expected an image");
-      Py_DECREF(images_seq);
-      return 0;
-    }
-    if (cur_a == NULL) {
-      Py_DECREF(images_seq);
-      return 0;
+  // the VP tree is built over the scaled features, as by KnnIndex
+  std::vector<double> weights(o->num_features);
+  fold_weights(o->selection_vector, o->weight_vector, o->num_features, &weights[0]);
+  std::vector<size_t> dims;
+  std::vector<double> scale;
+  for (size_t k = 0; k < weights.size(); ++k) {
+    if (weights[k] < 0.0)
+      num_neighbors = 0;
+    if (weights[k] != 0.0) {
+      dims.push_back(k);
+      scale.push_back(o->distance_type == FAST_EUCLIDEAN ? std::sqrt(weights[k]) : weights[k]);
     }
-    if (image_get_fv(cur_a, &buf_a, &len_a) < 0) {
-      Py_DECREF(images_seq);
-      return 0;
-    }
-    if (normalize)
-      norm.add(buf_a, buf_a + len_a);
   }
-  if (normalize)
-    norm.compute_normalization();
-  double* tmp_a = new double[len_a];
-  double* tmp_b = new double[len_a];
-  // do the distance calculations
-  size_t index = 0;
-  for (int i = 0; i < images_len; ++i) {
-    cur_a = PySequence_Fast_GET_ITEM(images_seq, i);
-    if (cur_a == NULL)
-      goto uniq_error;
-    if (image_get_fv(cur_a, &buf_a, &len_a) < 0)
-      goto uniq_error;
-    if (normalize)
-      norm.apply(buf_a, buf_a + len_a, tmp_a);
-    for (int j = i + 1; j < images_len; ++j) {
-      cur_b = PySequence_Fast_GET_ITEM(images_seq, j);
-      if (cur_b == NULL)
-        goto uniq_error;
-      if (image_get_fv(cur_b, &buf_b, &len_b) < 0)
-        goto uniq_error;
-
-      if (len_a != len_b) {
-        PyErr_SetString(PyExc_ValueError, "Feature vector lengths do not match!");
-        goto uniq_error;
-      }
-      if (normalize)
-        norm.apply(buf_b, buf_b + len_b, tmp_b);
-      double distance;
-      if (normalize)
-        compute_distance(o->distance_type, tmp_a, len_a, tmp_b, &distance,
-                         o->selection_vector, o->weight_vector);
-      else
-        compute_distance(o->distance_type, buf_a, len_a, buf_b, &distance,
-                         o->selection_vector, o->weight_vector);
-      list->set(Point(index, 0), distance);
-      index++;
+
+  MatrixDistance distance(o, features, images_len);
+  int num_threads = knn_num_threads(o);
+  std::vector<ClusterMerge> edges;
+  if (num_neighbors == 0) {
+    ++o->searching;
+    Py_BEGIN_ALLOW_THREADS
+    edges = prim_spanning_tree(images_len, distance, num_threads);
+    std::sort(edges.begin(), edges.end(), ClusterEdgeLess());
+    Py_END_ALLOW_THREADS
+    --o->searching;
+  } else {
+    ++o->searching;
+    Py_BEGIN_ALLOW_THREADS
+    std::vector<double> points(images_len * dims.size() + 1);
+    for (long i = 0; i < images_len; ++i) {
+      for (size_t k = 0; k < dims.size(); ++k)
+        points[i * dims.size() + k] = scale[k] * features[i * o->num_features + dims[k]];
     }
-    // call the progress object
-    PyObject_CallObject(progress, NULL);
+    std::vector<int> labels(images_len, 0);
+    VpTree tree(&points[0], images_len, dims.size(),
+                o->distance_type == FAST_EUCLIDEAN ? VpTree::L2 : VpTree::L1, &labels[0]);
+    edges = neighbor_spanning_tree(tree, &points[0], dims.size(), num_neighbors,
+                                   num_neighbors, distance, num_threads);
+    Py_END_ALLOW_THREADS
+    --o->searching;
   }
 
-  delete[] tmp_a; delete[] tmp_b;
-  return create_ImageObject(list);
-  // in case of error
- uniq_error:
-  delete[] tmp_a; delete[] tmp_b;
-  delete list;
-  delete data;
-  return 0;
+  PyObject* result = PyList_New(edges.size());
+  for (size_t e = 0; e < edges.size(); ++e) {
+    PyList_SET_ITEM(result, e, Py_BuildValue(CHAR_PTR_CAST "(lld)", edges[e].a, edges[e].b,
+                                             edges[e].distance));
+  }
+  return result;
 }
 
 static PyObject* knn_get_num_k(PyObject* self) {
@@ -875,6 +2232,8 @@ static PyObject* knn_get_num_k(PyObject* self) {
 }
 
 static int knn_set_num_k(PyObject* self, PyObject* v) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return -1;
   if (!PyInt_Check(v)) {
     PyErr_SetString(PyExc_TypeError, "knn: expected an int.");
     return -1;
@@ -883,11 +2242,96 @@ static int knn_set_num_k(PyObject* self, PyObject* v) {
   return 0;
 }
 
+static PyObject* knn_get_num_threads(PyObject* self) {
+  return Py_BuildValue(CHAR_PTR_CAST "i", ((KnnObject*)self)->num_threads);
+}
+
+static int knn_set_num_threads(PyObject* self, PyObject* v) {
+  if (!PyInt_Check(v)) {
+    PyErr_SetString(PyExc_TypeError, "knn: expected an int.");
+    return -1;
+  }
+  long num_threads = PyInt_AS_LONG(v);
+  if (num_threads < 0) {
+    PyErr_SetString(PyExc_ValueError, "knn: the number of threads must not be negative.");
+    return -1;
+  }
+  ((KnnObject*)self)->num_threads = int(num_threads);
+  return 0;
+}
+
+static PyObject* knn_get_use_index(PyObject* self) {
+  return PyBool_FromLong(((KnnObject*)self)->use_index);
+}
+
+static int knn_set_use_index(PyObject* self, PyObject* v) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return -1;
+  int use_index = PyObject_IsTrue(v);
+  if (use_index < 0)
+    return -1;
+  KnnObject* o = (KnnObject*)self;
+  o->use_index = use_index != 0;
+  if (!o->use_index)
+    knn_delete_index(o);
+  return 0;
+}
+
+static PyObject* knn_get_num_feature_vectors(PyObject* self) {
+  return Py_BuildValue(CHAR_PTR_CAST "i", int(((KnnObject*)self)->num_feature_vectors));
+}
+
+static PyObject* knn_get_data_version(PyObject* self) {
+  return PyLong_FromSize_t(((KnnObject*)self)->data_version);
+}
+
+static PyObject* knn_get_storage(PyObject* self) {
+  return Py_BuildValue(CHAR_PTR_CAST "i", int(((KnnObject*)self)->storage));
+}
+
+static int knn_set_storage(PyObject* self, PyObject* v) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return -1;
+  if (!PyInt_Check(v)) {
+    PyErr_SetString(PyExc_TypeError, "knn: expected an int.");
+    return -1;
+  }
+  long storage = PyInt_AS_LONG(v);
+  if (storage < STORAGE_DOUBLE || storage > STORAGE_UINT8) {
+    PyErr_SetString(PyExc_ValueError, "knn: unknown storage type.");
+    return -1;
+  }
+  knn_convert_storage((KnnObject*)self, StorageType(storage));
+  return 0;
+}
+
+static PyObject* knn_get_approximate_candidates(PyObject* self) {
+  return Py_BuildValue(CHAR_PTR_CAST "i", int(((KnnObject*)self)->approximate_candidates));
+}
+
+static int knn_set_approximate_candidates(PyObject* self, PyObject* v) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return -1;
+  if (!PyInt_Check(v)) {
+    PyErr_SetString(PyExc_TypeError, "knn: expected an int.");
+    return -1;
+  }
+  long candidates = PyInt_AS_LONG(v);
+  if (candidates < 0) {
+    PyErr_SetString(PyExc_ValueError, "knn: the number of candidates must not be negative.");
+    return -1;
+  }
+  ((KnnObject*)self)->approximate_candidates = size_t(candidates);
+  return 0;
+}
+
 static PyObject* knn_get_distance_type(PyObject* self) {
   return Py_BuildValue(CHAR_PTR_CAST "i", ((KnnObject*)self)->distance_type);
 }
 
 static int knn_set_distance_type(PyObject* self, PyObject* v) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return -1;
   if (!PyInt_Check(v)) {
     PyErr_SetString(PyExc_TypeError, "knn: expected an int.");
     return -1;
@@ -910,6 +2354,8 @@ static PyObject* knn_get_confidence_types(PyObject* self) {
 }
 
 static int knn_set_confidence_types(PyObject* self, PyObject* list) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return -1;
   if(!PyList_Check(list)) {
     PyErr_SetString(PyExc_TypeError, "knn: confidence_types must be list.");
     return -1;
@@ -943,16 +2389,19 @@ static PyObject* knn_leave_one_out(PyObject* self, PyObject* args) {
   int stop_threshold = std::numeric_limits<int>::max();
   if (PyArg_ParseTuple(args, CHAR_PTR_CAST "|Oi", &indexes, &stop_threshold) <= 0)
     return 0;
-  if (o->feature_vectors == 0) {
+  if (o->features == 0) {
     PyErr_SetString(PyExc_RuntimeError,
                     "knn: leave_one_out called before instantiate_from_images.");
     return 0;
   }
+  knn_update_normalization(o);
   if (indexes == 0) {
     // If we don't have a list of indexes, just do the leave_one_out
+    ++o->searching;
     Py_BEGIN_ALLOW_THREADS
     ans = leave_one_out(o, std::numeric_limits<int>::max());
     Py_END_ALLOW_THREADS
+    --o->searching;
     return Py_BuildValue(CHAR_PTR_CAST "(ii)", ans.first, ans.second);
   } else {
     // Get the list of indexes
@@ -988,68 +2437,197 @@ static PyObject* knn_leave_one_out(PyObject* self, PyObject* args) {
     }
 
     // do the leave-one-out
+    ++o->searching;
     Py_BEGIN_ALLOW_THREADS
     ans = leave_one_out(o, stop_threshold, o->selection_vector, o->weight_vector, &idx);
     Py_END_ALLOW_THREADS
+    --o->searching;
 
     return Py_BuildValue(CHAR_PTR_CAST "(ii)", ans.first, ans.second);
   }
 }
 
 /*
-  statistics of average distance to k nearest neighbors
+  statistics of average distance to k nearest neighbors. When a list of
+  indexes is given, only these training samples are used as queries
+  (all are still used as neighbors). The queries are searched without
+  the GIL and on knn_num_threads threads in blocks, after each of which
+  progress is called once per query of the block.
 */
 static PyObject* knn_knndistance_statistics(PyObject* self, PyObject* args) {
   KnnObject* o = (KnnObject*)self;
   PyObject* progress = 0;
-  int k;
-  size_t i,j;
-  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "|iO", &k, &progress) <= 0)
+  PyObject* indexes = Py_None;
+  int k = 0;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "|iOO", &k, &progress, &indexes) <= 0)
     return 0;
-  if (o->feature_vectors == 0) {
+  if (o->features == 0) {
     PyErr_SetString(PyExc_RuntimeError,
                     "knn: knndistance_statistics called before instantiate_from_images.");
     return 0;
   }
+  knn_update_normalization(o);
   if (k <= 0) {
     k = o->num_k;
   }
-  if (k > (int)o->feature_vectors->size() - 1) {
+  if (k > (int)o->num_feature_vectors - 1) {
     PyErr_SetString(PyExc_RuntimeError,
                     "knn: knndistance_statistics requires more than k training samples.");
     return 0;
   }
-  PyObject* entry;
-  PyObject* result = PyList_New(o->feature_vectors->size());
-  double *feature_i, *feature_j;
-  double distance;
-  kNearestNeighbors<char*, ltstr, eqstr> knn((size_t)k);
-  for (i=0; i<o->feature_vectors->size(); i++) {
-    knn.reset();
-    // find k nearest neighbors of i-th prototype
-    feature_i = (*o->feature_vectors)[i];
-    for (j=0; j<o->feature_vectors->size(); j++) {
-      if (j==i) continue;
-      feature_j = (*o->feature_vectors)[j];
-      // compute distance
-      compute_distance(o->distance_type, feature_i, o->num_features,
-                       feature_j, &distance, o->selection_vector, o->weight_vector);
-      // store distance in kNearestNeighbors
-      knn.add(o->id_names[j], distance);
-    }
-    // compute average distance
-    distance = 0.0;
-    for (j=0; j < knn.m_nn.size(); ++j) {
-      distance += knn.m_nn[j].distance;
-    }
-    distance = distance / k;
-    entry = PyTuple_New(2);
-    PyTuple_SET_ITEM(entry, 0, PyFloat_FromDouble(distance));
-    PyTuple_SET_ITEM(entry, 1, PyString_FromString(o->id_names[i]));
-    PyList_SetItem(result, i, entry);
-    if (progress)
-      PyObject_CallObject(progress, NULL);
+  std::vector<long> queries;
+  if (indexes == Py_None) {
+    for (size_t i = 0; i < o->num_feature_vectors; ++i)
+      queries.push_back(long(i));
+  } else {
+    PyObject* indexes_seq = PySequence_Fast(indexes, "knn: indexes must be iterable.");
+    if (indexes_seq == NULL)
+      return 0;
+    for (Py_ssize_t q = 0; q < PySequence_Fast_GET_SIZE(indexes_seq); ++q) {
+      long i = PyInt_AsLong(PySequence_Fast_GET_ITEM(indexes_seq, q));
+      if (i == -1 && PyErr_Occurred()) {
+        Py_DECREF(indexes_seq);
+        return 0;
+      }
+      if (i < 0 || i >= long(o->num_feature_vectors)) {
+        PyErr_SetString(PyExc_IndexError, "knn: index out of range in index list");
+        Py_DECREF(indexes_seq);
+        return 0;
+      }
+      queries.push_back(i);
+    }
+    Py_DECREF(indexes_seq);
+  }
+
+  long num_queries = long(queries.size());
+  std::vector<double> distances(num_queries);
+  int num_threads = knn_num_threads(o);
+  const long block = 256;
+  NearestSearch database(o, o->selection_vector, o->weight_vector);
+  for (long begin = 0; begin < num_queries; begin += block) {
+    long end = std::min(num_queries, begin + block);
+    ++o->searching;
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+    {
+      ClassNearestNeighbors knn((size_t)k, ClassNameLess(o->class_names));
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+      for (long q = begin; q < end; ++q) {
+        knn.reset();
+        // find k nearest neighbors of the prototype
+        database.search(size_t(queries[q]), o, knn);
+        // compute average distance
+        double distance = 0.0;
+        for (size_t j = 0; j < knn.m_nn.size(); ++j) {
+          distance += knn.m_nn[j].distance;
+        }
+        distances[q] = distance / k;
+      }
+    }
+    Py_END_ALLOW_THREADS
+    --o->searching;
+    if (progress) {
+      for (long q = begin; q < end; ++q) {
+        PyObject* res = PyObject_CallObject(progress, NULL);
+        if (res == NULL)
+          return 0;
+        Py_DECREF(res);
+      }
+    }
+  }
+
+  PyObject* result = PyList_New(num_queries);
+  for (long q = 0; q < num_queries; ++q) {
+    PyObject* entry = PyTuple_New(2);
+    PyTuple_SET_ITEM(entry, 0, PyFloat_FromDouble(distances[q]));
+    PyTuple_SET_ITEM(entry, 1, PyString_FromString(knn_id_name(o, queries[q])));
+    PyList_SET_ITEM(result, q, entry);
+  }
+  return result;
+}
+
+/*
+  The feature vectors removed by the editing rules (see gamera.knn_editing):
+  a tuple of the list of the indexes of those misclassified by their k
+  nearest neighbors (Wilson) and the list of those in a Tomek link.
+*/
+static PyObject* knn_edit_candidates(PyObject* self, PyObject* args) {
+  KnnObject* o = (KnnObject*)self;
+  int k = 0;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "|i", &k) <= 0)
+    return 0;
+  if (o->features == 0) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "knn: _edit_candidates called before instantiate_from_images.");
+    return 0;
+  }
+  knn_update_normalization(o);
+  if (k <= 0)
+    k = o->num_k;
+
+  std::vector<bool> wilson, tomek;
+  ++o->searching;
+  Py_BEGIN_ALLOW_THREADS
+  NeighborLists lists;
+  neighbor_lists(o, size_t(k), lists);
+  wilson = wilson_edit(o, size_t(k), lists);
+  tomek = tomek_links(o, lists);
+  Py_END_ALLOW_THREADS
+  --o->searching;
+
+  PyObject* wilson_list = PyList_New(0);
+  PyObject* tomek_list = PyList_New(0);
+  for (size_t i = 0; i < o->num_feature_vectors; ++i) {
+    PyObject* index = PyInt_FromLong(long(i));
+    if (wilson[i])
+      PyList_Append(wilson_list, index);
+    if (tomek[i])
+      PyList_Append(tomek_list, index);
+    Py_DECREF(index);
+  }
+  PyObject* result = PyTuple_New(2);
+  PyTuple_SET_ITEM(result, 0, wilson_list);
+  PyTuple_SET_ITEM(result, 1, tomek_list);
+  return result;
+}
+
+/*
+  The indexes of the prototypes selected by condense (see
+  gamera.knn_editing.edit_condense).
+*/
+static PyObject* knn_condense(PyObject* self, PyObject* args) {
+  KnnObject* o = (KnnObject*)self;
+  int k = 0;
+  double tolerance = 0.0;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "|id", &k, &tolerance) <= 0)
+    return 0;
+  if (o->features == 0) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "knn: _condense called before instantiate_from_images.");
+    return 0;
   }
+  if (tolerance < 0.0 || tolerance > 1.0) {
+    PyErr_SetString(PyExc_ValueError, "knn: tolerance must be between 0 and 1.");
+    return 0;
+  }
+  knn_update_normalization(o);
+  if (k <= 0)
+    k = o->num_k;
+
+  std::vector<int> store;
+  ++o->searching;
+  Py_BEGIN_ALLOW_THREADS
+  store = condense(o, size_t(k), tolerance);
+  Py_END_ALLOW_THREADS
+  --o->searching;
+
+  PyObject* result = PyList_New(store.size());
+  for (size_t i = 0; i < store.size(); ++i)
+    PyList_SET_ITEM(result, i, PyInt_FromLong(store[i]));
   return result;
 }
 
@@ -1065,45 +2643,67 @@ static PyObject* knn_knndistance_statistics(PyObject* self, PyObject* args) {
 
   FORMAT
 
-  The format is designed to be as simple as possible. First is a header consisting
-  of the file format version (currently 2), then the size and settings of the data,
-  and finally the data.
-
-  HEADER
+  serialize writes version 4 of the format. All fields have a fixed width and
+  are written in the byte order of the writing machine, which is recorded in
+  the header. The feature matrix starts at a multiple of 64 bytes, so that
+  unserialize can map the file into memory and use the matrix in place: loading
+  does not copy the data, and processes that load the same file share its pages.
+  Because a mapped file must not change, serialize writes a temporary file next
+  to the target and renames it over the target at the end: a classifier that
+  was loaded from the target keeps its (now unnamed) copy.
 
   size             what
   ------------------------------------------
-  unsigned long    version
-  unsigned long    number of k
-  unsigned long    number of feaures
-  unsigned long    number of feature vectors
-  unsigned long    number of feature names
-  na               list of feature names in the format
-                   of unsigned long (length - including null)
-                   and char[]
-  bool             flag which indicated wheter normalization is used or not
-    double[]       normalization mean_vector (sizeof(double) * #feature vectors)
+  char[8]          "GAMERAKN"
+  uint32           byte order mark 0x01020304
+  uint32           version (4)
+  uint32           storage type (StorageType)
+  uint32           number of k
+  uint32           1 if normalization is used, 0 otherwise
+  uint32           0 (reserved)
+  uint64           number of features
+  uint64           number of feature vectors
+  uint64           number of feature names
+  uint64           number of classes
+  uint64           offset of the feature matrix from the start of the file
+  na               the feature names and then the class names, each as uint32
+                   (length - including null) and char[]
+  uint32[]         class of each feature vector (index into the class names)
+  double[]         normalization mean_vector (sizeof(double) * #features)
                    NOTE: only if normalization is used
-    double[]       normalization stdev_vector (sizeof(double) * #feature vectors)
+  double[]         normalization stdev_vector (sizeof(double) * #features)
                    NOTE: only if normalization is used
-  int[]            selection vector (sizeof(int) * #features)
+  int32[]          selection vector (4 * #features)
   double[]         weighting vector (sizeof(double) * #features)
+  double[]         quantization offsets (sizeof(double) * #features)
+                   NOTE: only for the quantized storage types
+  double[]         quantization steps (sizeof(double) * #features)
+                   NOTE: only for the quantized storage types
+  na               zero padding up to the offset of the feature matrix
+  na               the feature matrix: #feature vectors rows of #features
+                   values of the storage type
+
+  OLDER VERSIONS
+
+  unserialize also reads the versions 2 and 3, which start with the version as
+  unsigned long and store all sizes as unsigned long (see knn_unserialize_stream).
+*/
 
-  DATA
+typedef unsigned int knn_uint32;
+typedef unsigned long long knn_uint64;
 
-  The data as stored a list of id_names followed by the feature vectors.
-  The id_names are stored as:
+static const char knn_file_magic[8] = { 'G', 'A', 'M', 'E', 'R', 'A', 'K', 'N' };
+static const knn_uint32 knn_byte_order_mark = 0x01020304;
 
-  size             what
-  ------------------------------------------
-  unsigned long    length of string
-  char[]           id_name
+static bool knn_write(FILE* file, const void* data, size_t size, size_t count) {
+  return fwrite(data, size, count, file) == count;
+}
 
-  There are, of course, feature_vectors->size() id_names. Next is the data which is
-  simply written directly - i.e. feature_vectors->size() arrays of doubles of length
-  num_features.
+static bool knn_write_string(FILE* file, const char* s, size_t len) {
+  knn_uint32 size = knn_uint32(len + 1);
+  return knn_write(file, &size, sizeof(size), 1) && knn_write(file, s, 1, len + 1);
+}
 
-*/
 static PyObject* knn_serialize(PyObject* self, PyObject* args) {
   KnnObject* o = (KnnObject*)self;
   char* filename;
@@ -1117,178 +2717,284 @@ static PyObject* knn_serialize(PyObject* self, PyObject* args) {
     PyErr_SetString(PyExc_TypeError, "knn: list of features must be a list.");
     return 0;
   }
+  for (Py_ssize_t i = 0; i < PyList_GET_SIZE(features); ++i) {
+    if (!PyString_Check(PyList_GET_ITEM(features, i))) {
+      PyErr_SetString(PyExc_TypeError, "knn: feature names must be strings.");
+      return 0;
+    }
+  }
 
-  unsigned long feature_size = PyList_GET_SIZE(features);
+  if (o->features == 0) {
+    PyErr_SetString(PyExc_RuntimeError, "knn: serialize called before instatiate from images.");
+    return 0;
+  }
+  knn_update_normalization(o);
 
-  FILE* file = fopen(filename, "w+b");
+  std::string tmp_filename = std::string(filename) + ".tmp";
+  FILE* file = fopen(tmp_filename.c_str(), "w+b");
   if (file == 0) {
     PyErr_SetString(PyExc_IOError, "knn: error opening file.");
     return 0;
   }
 
-  if (o->feature_vectors == 0) {
-    PyErr_SetString(PyExc_RuntimeError, "knn: serialize called before instatiate from images.");
-    fclose(file);
+  size_t num_names = PyList_GET_SIZE(features);
+  size_t num_classes = o->class_names->size();
+  size_t num_features = o->num_features;
+  bool quantized = o->quantize_offset != 0;
+
+  // the size of everything before the feature matrix
+  size_t offset = sizeof(knn_file_magic) + 6 * sizeof(knn_uint32) + 5 * sizeof(knn_uint64);
+  for (size_t i = 0; i < num_names; ++i)
+    offset += sizeof(knn_uint32) + PyString_GET_SIZE(PyList_GET_ITEM(features, i)) + 1;
+  for (size_t i = 0; i < num_classes; ++i)
+    offset += sizeof(knn_uint32) + strlen((*o->class_names)[i]) + 1;
+  offset += o->num_feature_vectors * sizeof(knn_uint32);
+  offset += num_features * (sizeof(knn_uint32) + sizeof(double)
+                            * (1 + (o->normalize ? 2 : 0) + (quantized ? 2 : 0)));
+  size_t padding = (64 - offset % 64) % 64;
+
+  knn_uint32 header[6] = {
+    knn_byte_order_mark, 4, knn_uint32(o->storage), knn_uint32(o->num_k),
+    knn_uint32(o->normalize != 0), 0
+  };
+  knn_uint64 sizes[5] = {
+    num_features, o->num_feature_vectors, num_names, num_classes, offset + padding
+  };
+  bool ok = knn_write(file, knn_file_magic, 1, sizeof(knn_file_magic))
+    && knn_write(file, header, sizeof(knn_uint32), 6)
+    && knn_write(file, sizes, sizeof(knn_uint64), 5);
+  for (size_t i = 0; ok && i < num_names; ++i) {
+    PyObject* name = PyList_GET_ITEM(features, i);
+    ok = knn_write_string(file, PyString_AS_STRING(name), PyString_GET_SIZE(name));
+  }
+  for (size_t i = 0; ok && i < num_classes; ++i)
+    ok = knn_write_string(file, (*o->class_names)[i], strlen((*o->class_names)[i]));
+  if (ok) {
+    std::vector<knn_uint32> class_ids(o->class_ids, o->class_ids + o->num_feature_vectors);
+    class_ids.push_back(0);
+    ok = knn_write(file, &class_ids[0], sizeof(knn_uint32), o->num_feature_vectors);
+  }
+  if (ok && o->normalize) {
+    ok = knn_write(file, o->normalize->get_mean_vector(), sizeof(double), num_features)
+      && knn_write(file, o->normalize->get_stdev_vector(), sizeof(double), num_features);
+  }
+  if (ok) {
+    std::vector<knn_uint32> selections(o->selection_vector, o->selection_vector + num_features);
+    selections.push_back(0);
+    ok = knn_write(file, &selections[0], sizeof(knn_uint32), num_features)
+      && knn_write(file, o->weight_vector, sizeof(double), num_features);
+  }
+  if (ok && quantized) {
+    ok = knn_write(file, o->quantize_offset, sizeof(double), num_features)
+      && knn_write(file, o->quantize_step, sizeof(double), num_features);
+  }
+  if (ok) {
+    // write the data (the rows are contiguous)
+    const char zeros[64] = { 0 };
+    ok = knn_write(file, zeros, 1, padding)
+      && knn_write(file, o->features, storage_size(o->storage),
+                   o->num_feature_vectors * num_features);
+  }
+  if (fclose(file) != 0)
+    ok = false;
+#ifdef _WIN32
+  // rename does not replace existing files on Windows (nothing is mapped there)
+  if (ok)
+    remove(filename);
+#endif
+  if (!ok || rename(tmp_filename.c_str(), filename) != 0) {
+    remove(tmp_filename.c_str());
+    PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
     return 0;
   }
+  Py_INCREF(Py_None);
+  return Py_None;
+}
 
-  // write the header info
-  unsigned long version = 2;
-  if (fwrite((const void*)&version, sizeof(unsigned long), 1, file) != 1) {
-    PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-    fclose(file);
+static bool knn_read(FILE* file, void* data, size_t size, size_t count) {
+  return fread(data, size, count, file) == count;
+}
+
+static bool knn_read_string(FILE* file, std::vector<char>& s) {
+  knn_uint32 size;
+  if (!knn_read(file, &size, sizeof(size), 1) || size == 0)
+    return false;
+  s.resize(size);
+  return knn_read(file, &s[0], 1, size) && s[size - 1] == 0;
+}
+
+/*
+  Uses the feature matrix at offset in file as the storage of the
+  feature vectors. The file is mapped into memory where possible (the
+  mapping is read-only, nothing writes to the stored feature vectors),
+  and read otherwise.
+*/
+static bool knn_map_features(KnnObject* o, FILE* file, size_t offset) {
+  size_t size = o->num_feature_vectors * o->num_features * storage_size(o->storage);
+  // accessing a mapping beyond the end of the file would crash
+  if (fseek(file, 0, SEEK_END) != 0 || size_t(ftell(file)) < offset + size)
+    return false;
+#ifndef _WIN32
+  void* mapping = mmap(0, offset + size, PROT_READ, MAP_SHARED, fileno(file), 0);
+  if (mapping != MAP_FAILED) {
+    o->mapping = mapping;
+    o->mapping_size = offset + size;
+    o->features = (char*)mapping + offset;
+    return true;
+  }
+#endif
+  knn_allocate_matrix(o, o->num_feature_vectors, o->storage);
+  return fseek(file, long(offset), SEEK_SET) == 0 && knn_read(file, o->features, 1, size);
+}
+
+// reads version 4 (the magic has already been read)
+static PyObject* knn_unserialize_mapped(KnnObject* o, FILE* file) {
+  knn_uint32 header[6];
+  knn_uint64 sizes[5];
+  if (!knn_read(file, header, sizeof(knn_uint32), 6)
+      || !knn_read(file, sizes, sizeof(knn_uint64), 5)) {
+    PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
     return 0;
   }
-  unsigned long num_k = (unsigned long)o->num_k;
-  if (fwrite((const void*)&num_k, sizeof(unsigned long), 1, file) != 1) {
-    PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-    fclose(file);
+  if (header[0] != knn_byte_order_mark) {
+    PyErr_SetString(PyExc_IOError, "knn: the file was written on a machine with a different byte order.");
     return 0;
   }
-  unsigned long num_features = (unsigned long)o->num_features;
-  if (fwrite((const void*)&num_features, sizeof(unsigned long), 1, file) != 1) {
-    PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-    fclose(file);
+  if (header[1] != 4) {
+    PyErr_SetString(PyExc_IOError, "knn: unknown version of knn file.");
     return 0;
   }
-  unsigned long num_feature_vectors = (unsigned long)o->feature_vectors->size();
-  if (fwrite((const void*)&num_feature_vectors, sizeof(unsigned long), 1, file) != 1) {
-    PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-    fclose(file);
+  if (header[2] > STORAGE_UINT8) {
+    PyErr_SetString(PyExc_IOError, "knn: unknown storage type in knn file.");
     return 0;
   }
-
-  // write the feature names
-  if (fwrite((const void*)&feature_size, sizeof(unsigned long), 1, file) != 1) {
-    PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-    fclose(file);
+  size_t num_features = size_t(sizes[0]);
+  size_t num_feature_vectors = size_t(sizes[1]);
+  size_t num_feature_names = size_t(sizes[2]);
+  size_t num_classes = size_t(sizes[3]);
+  size_t offset = size_t(sizes[4]);
+  if (num_feature_vectors == 0 || num_classes == 0 || num_classes > num_feature_vectors
+      || offset % 64 != 0) {
+    PyErr_SetString(PyExc_IOError, "knn: the knn file is corrupt.");
     return 0;
   }
 
-  for (size_t i = 0; i < feature_size; ++i) {
-    PyObject* cur_string = PyList_GET_ITEM(features, i);
-    unsigned long string_size = PyString_GET_SIZE(cur_string) + 1;
-    if (fwrite((const void*)&string_size, sizeof(unsigned long), 1, file) != 1) {
-      PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-      fclose(file);
-      return 0;
-    }
-    if (fwrite((const void*)PyString_AS_STRING(cur_string),
-               sizeof(char), string_size, file) != string_size) {
-      PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-      fclose(file);
+  std::vector<char> name;
+  PyObject* feature_names = PyList_New(num_feature_names);
+  for (size_t i = 0; i < num_feature_names; ++i) {
+    if (!knn_read_string(file, name)) {
+      PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
+      Py_DECREF(feature_names);
       return 0;
     }
+    PyList_SET_ITEM(feature_names, i,
+                    PyString_FromStringAndSize(&name[0], name.size() - 1));
   }
 
-  for (size_t i = 0; i < o->feature_vectors->size(); ++i) {
-    unsigned long len = strlen(o->id_names[i]) + 1; // include \0
-    if (fwrite((const void*)&len, sizeof(unsigned long), 1, file) != 1) {
-      PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-      fclose(file);
-      return 0;
-    }
-    if (fwrite((const void*)o->id_names[i], sizeof(char), len, file) != len) {
-      PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-      fclose(file);
-      return 0;
+  knn_delete_feature_data(o);
+  set_num_features(o, num_features);
+  if (knn_create_feature_data(o, num_feature_vectors, StorageType(header[2]), false) < 0) {
+    Py_DECREF(feature_names);
+    return 0;
+  }
+  o->num_k = header[3];
+
+  // the class names are already unique
+  bool ok = true;
+  for (size_t i = 0; ok && i < num_classes; ++i) {
+    ok = knn_read_string(file, name);
+    if (ok) {
+      char* id_name = new char[name.size()];
+      std::copy(name.begin(), name.end(), id_name);
+      o->class_names->push_back(id_name);
+      o->id_name_histogram[i] = 0;
     }
   }
-
-  bool normalize = (bool) o->normalize;
-  if (fwrite((const void*) &normalize, sizeof(bool), 1, file) != 1) {
-    PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-    fclose(file);
-    return 0;
-  }
-
-  if (normalize) {
-    if (fwrite((const void*)o->normalize->get_mean_vector(),
-               sizeof(double), o->num_features, file) != o->num_features) {
-      PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-      fclose(file);
-      return 0;
-    }
-    if (fwrite((const void*)o->normalize->get_stdev_vector(),
-               sizeof(double), o->num_features, file) != o->num_features) {
-      PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-      fclose(file);
-      return 0;
+  std::vector<knn_uint32> values(std::max(num_feature_vectors, num_features) + 1);
+  ok = ok && knn_read(file, &values[0], sizeof(knn_uint32), num_feature_vectors);
+  for (size_t i = 0; ok && i < num_feature_vectors; ++i) {
+    ok = values[i] < num_classes;
+    if (ok) {
+      o->class_ids[i] = int(values[i]);
+      o->id_name_histogram[values[i]]++;
     }
   }
 
-  if (fwrite((const void*)o->selection_vector, sizeof(int), o->num_features, file)
-      != o->num_features) {
-    PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-    fclose(file);
-    return 0;
+  if (ok && header[4] != 0) {
+    // set_num_features drops the normalization of a different size
+    if (o->normalize == 0)
+      o->normalize = new Normalize(num_features);
+    std::vector<double> mean(num_features + 1), stdev(num_features + 1);
+    ok = knn_read(file, &mean[0], sizeof(double), num_features)
+      && knn_read(file, &stdev[0], sizeof(double), num_features);
+    if (ok) {
+      o->normalize->set_mean_vector(mean.begin(), mean.begin() + num_features);
+      o->normalize->set_stdev_vector(stdev.begin(), stdev.begin() + num_features);
+      o->normalize->restore_sums(num_feature_vectors);
+    }
   }
-
-  if (fwrite((const void*)o->weight_vector, sizeof(double), o->num_features, file)
-      != o->num_features) {
-    PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-    fclose(file);
-    return 0;
+  if (ok) {
+    ok = knn_read(file, &values[0], sizeof(knn_uint32), num_features)
+      && knn_read(file, o->weight_vector, sizeof(double), num_features);
+    std::copy(values.begin(), values.begin() + num_features, o->selection_vector);
   }
-
-  // write the data
-  double* cur;
-  for (size_t i = 0; i < o->feature_vectors->size(); ++i) {
-    cur = (*o->feature_vectors)[i];
-    if (fwrite((const void*)cur, sizeof(double), o->num_features, file)
-        != o->num_features) {
-      PyErr_SetString(PyExc_IOError, "knn: problem writing to a file.");
-      fclose(file);
-      return 0;
-    }
+  if (ok && o->quantize_offset != 0) {
+    ok = knn_read(file, o->quantize_offset, sizeof(double), num_features)
+      && knn_read(file, o->quantize_step, sizeof(double), num_features);
   }
-
-  fclose(file);
-  Py_INCREF(Py_None);
-  return Py_None;
-}
-
-static PyObject* knn_unserialize(PyObject* self, PyObject* args) {
-  KnnObject* o = (KnnObject*)self;
-  char* filename;
-  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "s", &filename) <= 0)
-    return 0;
-
-  FILE* file = fopen(filename, "rb");
-  if (file == 0) {
-    PyErr_SetString(PyExc_IOError, "knn: error opening file.");
+  ok = ok && knn_map_features(o, file, offset);
+  if (!ok) {
+    knn_delete_feature_data(o);
+    Py_DECREF(feature_names);
+    PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
     return 0;
   }
+  return feature_names;
+}
 
+/*
+  Reads the versions 2 and 3. These store the version, (only version 3)
+  the storage type, k, the number of features, feature vectors and
+  feature names as unsigned long, then the feature names and the
+  id_name of each feature vector (unsigned long length and char[]), the
+  normalization flag as bool, and then the vectors and the data as in
+  version 4, without padding.
+*/
+static PyObject* knn_unserialize_stream(KnnObject* o, FILE* file) {
   unsigned long version, num_k, num_features, num_feature_vectors, num_feature_names;
   if (fread((void*)&version, sizeof(unsigned long), 1, file) != 1) {
     PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-    fclose(file);
     return 0;
   }
-  if (version != 2) {
+  if (version != 2 && version != 3) {
     PyErr_SetString(PyExc_IOError, "knn: unknown version of knn file.");
-    fclose(file);
     return 0;
   }
+  unsigned long storage = STORAGE_DOUBLE;
+  if (version == 3) {
+    if (fread((void*)&storage, sizeof(unsigned long), 1, file) != 1) {
+      PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
+      return 0;
+    }
+    if (storage > STORAGE_UINT8) {
+      PyErr_SetString(PyExc_IOError, "knn: unknown storage type in knn file.");
+      return 0;
+    }
+  }
   if (fread((void*)&num_k, sizeof(unsigned long), 1, file) != 1) {
     PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-    fclose(file);
     return 0;
   }
   if (fread((void*)&num_features, sizeof(unsigned long), 1, file) != 1) {
     PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-    fclose(file);
     return 0;
   }
   if (fread((void*)&num_feature_vectors, sizeof(unsigned long), 1, file) != 1) {
     PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-    fclose(file);
     return 0;
   }
   if (fread((void*)&num_feature_names, sizeof(unsigned long), 1, file) != 1) {
     PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-    fclose(file);
     return 0;
   }
   PyObject* feature_names = PyList_New(num_feature_names);
@@ -1296,13 +3002,11 @@ static PyObject* knn_unserialize(PyObject* self, PyObject* args) {
     unsigned long string_size;
     if (fread((void*)&string_size, sizeof(unsigned long), 1, file) != 1) {
       PyErr_SetString(PyExc_RuntimeError, "knn: problem reading file.");
-      fclose(file);
       return 0;
     }
     char tmp_string[1024];
     if (fread((void*)&tmp_string, sizeof(char), string_size, file) != string_size) {
       PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-      fclose(file);
       return 0;
     }
     PyList_SET_ITEM(feature_names, i,
@@ -1311,42 +3015,42 @@ static PyObject* knn_unserialize(PyObject* self, PyObject* args) {
 
   knn_delete_feature_data(o);
   set_num_features(o, (size_t)num_features);
-  if (knn_create_feature_data(o, (size_t)num_feature_vectors) < 0) {
-    fclose(file);
+  if (knn_create_feature_data(o, (size_t)num_feature_vectors, StorageType(storage)) < 0) {
     return 0;
   }
   o->num_k = num_k;
 
-  std::map<char*, int, ltstr> id_name_histogram;
-  for (size_t i = 0; i < o->feature_vectors->size(); ++i) {
+  std::map<char*, int, ltstr> classes;
+  std::vector<char> id_name;
+  for (size_t i = 0; i < o->num_feature_vectors; ++i) {
     unsigned long len;
     if (fread((void*)&len, sizeof(unsigned long), 1, file) != 1) {
       PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-      fclose(file);
       return 0;
     }
-    o->id_names[i] = new char[len];
-    if (fread((void*)o->id_names[i], sizeof(char), len, file) != len) {
+    id_name.resize(len + 1);
+    if (fread((void*)&id_name[0], sizeof(char), len, file) != len) {
       PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-      fclose(file);
       return 0;
     }
-    id_name_histogram[o->id_names[i]]++;
+    id_name[len] = 0;
+    knn_set_id_name(o, i, &id_name[0], classes);
   }
 
   bool normalize = false;
   if (fread((void*) &normalize, sizeof(bool), 1, file) != 1) {
     PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-    fclose(file);
     return 0;
   }
 
   if (normalize) {
+    // set_num_features drops the normalization of a different size
+    if (o->normalize == 0)
+      o->normalize = new Normalize(o->num_features);
     double* tmp_mean_norm = new double[o->num_features];
     if (fread((void*)tmp_mean_norm, sizeof(double), o->num_features, file) != o->num_features) {
       PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
       delete[] tmp_mean_norm;
-      fclose(file);
       return 0;
     }
     o->normalize->set_mean_vector(tmp_mean_norm, tmp_mean_norm + o->num_features);
@@ -1356,40 +3060,70 @@ static PyObject* knn_unserialize(PyObject* self, PyObject* args) {
     if (fread((void*)tmp_stdev_norm, sizeof(double), o->num_features, file) != o->num_features) {
       PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
       delete[] tmp_stdev_norm;
-      fclose(file);
       return 0;
     }
     o->normalize->set_stdev_vector(tmp_stdev_norm, tmp_stdev_norm + o->num_features);
     delete[] tmp_stdev_norm;
+    o->normalize->restore_sums(o->num_feature_vectors);
   }
 
   if (fread((void*)o->selection_vector, sizeof(int), o->num_features, file) != o->num_features) {
     PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-    fclose(file);
     return 0;
   }
 
   if (fread((void*)o->weight_vector, sizeof(double), o->num_features, file) != o->num_features) {
     PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-    fclose(file);
     return 0;
   }
 
-  double* cur;
-  for (size_t i = 0; i < o->feature_vectors->size(); ++i) {
-    cur = (*o->feature_vectors)[i];
-    if (fread((void*)cur, sizeof(double), o->num_features, file) != o->num_features) {
+  if (o->quantize_offset != 0) {
+    if (fread((void*)o->quantize_offset, sizeof(double), o->num_features, file)
+        != o->num_features ||
+        fread((void*)o->quantize_step, sizeof(double), o->num_features, file)
+        != o->num_features) {
       PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
-      fclose(file);
       return 0;
     }
-    o->id_name_histogram[i] = id_name_histogram[o->id_names[i]];
   }
 
-  fclose(file);
+  size_t num_values = o->num_feature_vectors * o->num_features;
+  if (fread((void*)o->features, storage_size(o->storage), num_values, file) != num_values) {
+    PyErr_SetString(PyExc_IOError, "knn: problem reading file.");
+    return 0;
+  }
+
   return feature_names;
 }
 
+
+static PyObject* knn_unserialize(PyObject* self, PyObject* args) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return 0;
+  KnnObject* o = (KnnObject*)self;
+  char* filename;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "s", &filename) <= 0)
+    return 0;
+
+  FILE* file = fopen(filename, "rb");
+  if (file == 0) {
+    PyErr_SetString(PyExc_IOError, "knn: error opening file.");
+    return 0;
+  }
+
+  PyObject* result;
+  char magic[sizeof(knn_file_magic)];
+  if (knn_read(file, magic, 1, sizeof(magic))
+      && memcmp(magic, knn_file_magic, sizeof(magic)) == 0) {
+    result = knn_unserialize_mapped(o, file);
+  } else {
+    rewind(file);
+    result = knn_unserialize_stream(o, file);
+  }
+  fclose(file);
+  return result;
+}
+
 static PyObject* knn_get_selections(PyObject* self, PyObject* args) {
   KnnObject *o = (KnnObject*) self;
   PyObject *arglist = Py_BuildValue(CHAR_PTR_CAST "(s)", "i");
@@ -1435,6 +3169,8 @@ static PyObject* knn_get_weights(PyObject* self, PyObject* args) {
 }
 
 static PyObject* knn_set_selections(PyObject* self, PyObject* args) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return 0;
   KnnObject *o = (KnnObject*) self;
   PyObject *array;
 
@@ -1474,6 +3210,8 @@ static PyObject* knn_set_selections(PyObject* self, PyObject* args) {
 }
 
 static PyObject* knn_set_weights(PyObject* self, PyObject* args) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return 0;
   KnnObject* o = (KnnObject*)self;
   PyObject* array;
   if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &array) <= 0) {
@@ -1506,6 +3244,8 @@ static PyObject* knn_get_num_features(PyObject* self) {
 }
 
 static int knn_set_num_features(PyObject* self, PyObject* v) {
+  if (knn_check_idle((KnnObject*)self) < 0)
+    return -1;
   KnnObject* o = (KnnObject*)self;
   if (!PyInt_Check(v)) {
     PyErr_SetString(PyExc_TypeError, "knn: must be an integer.");
@@ -1542,6 +3282,17 @@ DL_EXPORT(void) initknncore(void) {
                        Py_BuildValue(CHAR_PTR_CAST "i", EUCLIDEAN));
   PyDict_SetItemString(d, "FAST_EUCLIDEAN",
                        Py_BuildValue(CHAR_PTR_CAST "i", FAST_EUCLIDEAN));
+  PyDict_SetItemString(d, "STORAGE_DOUBLE",
+                       Py_BuildValue(CHAR_PTR_CAST "i", STORAGE_DOUBLE));
+  PyDict_SetItemString(d, "STORAGE_FLOAT",
+                       Py_BuildValue(CHAR_PTR_CAST "i", STORAGE_FLOAT));
+  PyDict_SetItemString(d, "STORAGE_UINT16",
+                       Py_BuildValue(CHAR_PTR_CAST "i", STORAGE_UINT16));
+  PyDict_SetItemString(d, "STORAGE_UINT8",
+                       Py_BuildValue(CHAR_PTR_CAST "i", STORAGE_UINT8));
+
+  // records the kernels in the CPU dispatch of gameracore
+  get_gameracore_dict();
 
   PyObject* array_dict = get_module_dict("array");
   if (array_dict == 0) {
@@ -74,7 +74,12 @@ EO<EOT> * GASingleSettingBase<EOT, EO>::getSetting() {
 
 GABaseSetting::GABaseSetting(int opMode /*= GA_SELECTION*/,
                              unsigned int pSize /*= 75*/,
-                             double cRate /*= 0.95*/, double mRate /*= 0.05*/) {
+                             double cRate /*= 0.95*/, double mRate /*= 0.05*/,
+                             unsigned int dCache /*= 0*/,
+                             unsigned int fCache /*= 10000*/,
+                             double qSample /*= 1.0*/, unsigned int qGrowth /*= 0*/,
+                             bool eStop /*= false*/,
+                             unsigned int seed /*= 0*/) {
 
     if ( opMode != GA_SELECTION && opMode != GA_WEIGHTING ) {
         throw std::invalid_argument("GABaseSetting: unknown mode of opertation");
@@ -84,6 +89,12 @@ GABaseSetting::GABaseSetting(int opMode /*= GA_SELECTION*/,
     this->pSize = pSize;
     this->cRate = cRate;
     this->mRate = mRate;
+    this->dCache = dCache;
+    this->fCache = fCache;
+    this->setQuerySample(qSample);
+    this->qGrowth = qGrowth;
+    this->eStop = eStop;
+    this->seed = seed;
 }
 
 int GABaseSetting::getOpMode() {
@@ -102,6 +113,30 @@ double GABaseSetting::getMutRate() {
     return this->mRate;
 }
 
+unsigned int GABaseSetting::getDistanceCache() {
+    return this->dCache;
+}
+
+unsigned int GABaseSetting::getFitnessCache() {
+    return this->fCache;
+}
+
+double GABaseSetting::getQuerySample() {
+    return this->qSample;
+}
+
+unsigned int GABaseSetting::getSampleGrowth() {
+    return this->qGrowth;
+}
+
+bool GABaseSetting::getEarlyStop() {
+    return this->eStop;
+}
+
+unsigned int GABaseSetting::getSeed() {
+    return this->seed;
+}
+
 void GABaseSetting::setOpMode(int opMode) {
     if ( opMode != GA_SELECTION && opMode != GA_WEIGHTING ) {
         throw std::invalid_argument("GABaseSetting: setOpMode: unknown mode of opertation");
@@ -122,6 +157,416 @@ void GABaseSetting::setMutRate(double mRate) {
     this->mRate = mRate;
 }
 
+void GABaseSetting::setDistanceCache(unsigned int dCache) {
+    this->dCache = dCache;
+}
+
+void GABaseSetting::setFitnessCache(unsigned int fCache) {
+    this->fCache = fCache;
+}
+
+void GABaseSetting::setQuerySample(double qSample) {
+    if ( !(qSample > 0.0 && qSample <= 1.0) ) {
+        throw std::invalid_argument("GABaseSetting: querySample must be in (0, 1]");
+    }
+
+    this->qSample = qSample;
+}
+
+void GABaseSetting::setSampleGrowth(unsigned int qGrowth) {
+    this->qGrowth = qGrowth;
+}
+
+void GABaseSetting::setEarlyStop(bool eStop) {
+    this->eStop = eStop;
+}
+
+void GABaseSetting::setSeed(unsigned int seed) {
+    this->seed = seed;
+}
+
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+
+GAQuerySample::GAQuerySample(KnnObject *knn, double fraction /*= 1.0*/,
+                             unsigned int growth /*= 0*/) {
+    this->knn = knn;
+    this->startFraction = fraction;
+    this->fraction = fraction;
+    this->growth = growth;
+    this->keepFitness = 0.0;
+    for (size_t i = 0; i < knn->num_feature_vectors; ++i) {
+        if (leave_one_out_query(knn, i)) {
+            this->all.push_back(i);
+        }
+    }
+    this->draw();
+}
+
+// draws fraction of the queries of each class (at least one)
+void GAQuerySample::draw() {
+    this->queries.clear();
+    this->keepFitness = 0.0;
+    if (this->fraction >= 1.0) {
+        return;
+    }
+
+    std::map<int, std::vector<size_t> > classes;
+    for (size_t q = 0; q < this->all.size(); ++q) {
+        classes[this->knn->class_ids[this->all[q]]].push_back(this->all[q]);
+    }
+    std::map<int, std::vector<size_t> >::iterator c;
+    for (c = classes.begin(); c != classes.end(); ++c) {
+        std::vector<size_t> &members = c->second;
+        size_t count = std::max(size_t(1), size_t(std::ceil(this->fraction * members.size())));
+        for (size_t i = 0; i < count; ++i) {
+            std::swap(members[i], members[i + eo::rng.random(members.size() - i)]);
+            this->queries.push_back(members[i]);
+        }
+    }
+    std::sort(this->queries.begin(), this->queries.end());
+}
+
+bool GAQuerySample::nextGeneration(unsigned int generation) {
+    if (this->growth == 0 || this->fraction >= 1.0) {
+        return false;
+    }
+
+    double fraction = std::min(1.0, this->startFraction
+        * std::pow(2.0, double(generation / this->growth)));
+    if (fraction == this->fraction) {
+        return false;
+    }
+
+    this->fraction = fraction;
+    this->draw();
+    return true;
+}
+
+const std::vector<size_t> *GAQuerySample::getQueries() {
+    if (this->fraction >= 1.0) {
+        return NULL;
+    }
+    return &this->queries;
+}
+
+size_t GAQuerySample::size() {
+    if (this->fraction >= 1.0) {
+        return this->all.size();
+    }
+    return this->queries.size();
+}
+
+void GAQuerySample::setKeepFitness(double fitness) {
+#ifdef _OPENMP
+#pragma omp critical(knnga_query_sample)
+#endif
+    this->keepFitness = fitness;
+}
+
+int GAQuerySample::stopThreshold() {
+    double keep;
+#ifdef _OPENMP
+#pragma omp critical(knnga_query_sample)
+#endif
+    keep = this->keepFitness;
+
+    if (keep <= 0.0) {
+        return std::numeric_limits<int>::max();
+    }
+    // more errors than this give a fitness below keep
+    return int(std::floor(this->size() * (1.0 - keep) + 1e-9));
+}
+
+bool GAQuerySample::rejected(std::pair<int, int> looEvalRes) {
+    return size_t(looEvalRes.second) < this->size();
+}
+
+double GAQuerySample::fitness(std::pair<int, int> looEvalRes) {
+    size_t numQueries = this->size();
+    if (numQueries == 0) {
+        return 0.0;
+    }
+
+    // after an early stop, the fitness if the remaining queries were correct
+    int errors = looEvalRes.second - looEvalRes.first;
+    return (numQueries - errors) / (double) numQueries;
+}
+
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+
+GASelectionDistances::GASelectionDistances(KnnObject *knn,
+                                           std::map<unsigned int, unsigned int> *indexRelation,
+                                           size_t memory) {
+    this->knn = knn;
+    this->numKnown = knn->num_feature_vectors;
+    this->numPairs = this->numKnown * (this->numKnown - 1) / 2;
+    this->numGenes = indexRelation->size();
+    this->maxEntries = 0;
+    this->useCount = 0;
+
+    // the terms and the distances of at least one individual (besides
+    // the one being evaluated) must fit
+    double termBytes = double(this->numGenes) * this->numPairs * sizeof(float);
+    double distanceBytes = double(this->numPairs) * sizeof(double);
+    this->usable = this->numKnown > 1
+        && termBytes + 2 * distanceBytes <= double(memory);
+    if (!this->usable) {
+        return;
+    }
+    this->maxEntries = size_t((double(memory) - termBytes) / distanceBytes) - 1;
+
+    // the same queries as leave_one_out
+    for (size_t i = 0; i < this->numKnown; ++i) {
+        if (leave_one_out_query(knn, i)) {
+            this->queries.push_back(i);
+        }
+    }
+
+    std::vector<double> features(this->numKnown * this->numGenes);
+    std::vector<double> fv(knn->num_features + 1);
+    for (size_t i = 0; i < this->numKnown; ++i) {
+        knn_get_feature_vector(knn, i, &fv[0]);
+        for (size_t g = 0; g < this->numGenes; ++g) {
+            features[i * this->numGenes + g] = fv[(*indexRelation)[g]];
+        }
+    }
+    std::vector<double> weights(this->numGenes);
+    for (size_t g = 0; g < this->numGenes; ++g) {
+        weights[g] = knn->weight_vector[(*indexRelation)[g]];
+    }
+
+    // EUCLIDEAN is the weighted sum of sqrt(d*d) (see knn.hpp)
+    bool squared = (knn->distance_type == FAST_EUCLIDEAN);
+    this->terms.resize(this->numGenes * this->numPairs);
+    long numGenes = long(this->numGenes);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(knn_num_threads(knn))
+#endif
+    for (long g = 0; g < numGenes; ++g) {
+        float *term = &this->terms[g * this->numPairs];
+        for (size_t i = 0; i < this->numKnown; ++i) {
+            double a = features[i * this->numGenes + g];
+            for (size_t j = i + 1; j < this->numKnown; ++j) {
+                double d = a - features[j * this->numGenes + g];
+                *term++ = float(weights[g] * (squared ? d * d : std::fabs(d)));
+            }
+        }
+    }
+}
+
+GASelectionDistances::~GASelectionDistances() {
+    for (size_t i = 0; i < this->cache.size(); ++i) {
+        delete this->cache[i];
+    }
+}
+
+bool GASelectionDistances::isUsable() {
+    return this->usable;
+}
+
+// the index of the pair i < j in the upper triangle, row by row (also
+// used with j = i + 1 for the start of the row of i, with unsigned
+// wrap-around for the last i)
+size_t GASelectionDistances::pairIndex(size_t i, size_t j) const {
+    return i * this->numKnown - i * (i + 1) / 2 + (j - i - 1);
+}
+
+// adds the terms of the genes times their factors to the distances,
+// in blocks of pairs that stay in the cache for all genes
+void GASelectionDistances::addTerms(std::vector<double> &distances,
+                                    const std::vector<std::pair<size_t, double> > &genes) const {
+    const size_t blockSize = 4096;
+    long numBlocks = long((this->numPairs + blockSize - 1) / blockSize);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(knn_num_threads(this->knn))
+#endif
+    for (long b = 0; b < numBlocks; ++b) {
+        size_t begin = size_t(b) * blockSize;
+        size_t end = std::min(this->numPairs, begin + blockSize);
+        for (size_t k = 0; k < genes.size(); ++k) {
+            const float *term = &this->terms[genes[k].first * this->numPairs];
+            double factor = genes[k].second;
+            for (size_t p = begin; p < end; ++p) {
+                distances[p] += factor * term[p];
+            }
+        }
+    }
+}
+
+std::pair<int, int> GASelectionDistances::leaveOneOut(const SelectionIndi &individual,
+                                                      const std::vector<size_t> *subset,
+                                                      int stopThreshold) {
+    size_t numSelected = 0;
+    for (size_t g = 0; g < this->numGenes; ++g) {
+        if (individual[g]) {
+            numSelected++;
+        }
+    }
+
+    // start from the cached individual with the fewest differing genes,
+    // unless computing the distances from scratch is cheaper
+    Entry *base = NULL;
+#ifdef _OPENMP
+#pragma omp critical(knnga_distances)
+#endif
+    {
+        size_t fewest = numSelected;
+        for (size_t i = 0; i < this->cache.size(); ++i) {
+            size_t differing = 0;
+            for (size_t g = 0; g < this->numGenes && differing < fewest; ++g) {
+                if (this->cache[i]->genome[g] != bool(individual[g])) {
+                    differing++;
+                }
+            }
+            if (differing < fewest) {
+                fewest = differing;
+                base = this->cache[i];
+            }
+        }
+        if (base != NULL) {
+            base->readers++;
+            base->lastUse = ++this->useCount;
+        }
+    }
+
+    std::vector<std::pair<size_t, double> > genes;
+    std::vector<double> distances;
+    if (base != NULL) {
+        distances = base->distances;
+        for (size_t g = 0; g < this->numGenes; ++g) {
+            if (base->genome[g] != bool(individual[g])) {
+                genes.push_back(std::make_pair(g, individual[g] ? 1.0 : -1.0));
+            }
+        }
+#ifdef _OPENMP
+#pragma omp critical(knnga_distances)
+#endif
+        base->readers--;
+    } else {
+        distances.resize(this->numPairs, 0.0);
+        for (size_t g = 0; g < this->numGenes; ++g) {
+            if (individual[g]) {
+                genes.push_back(std::make_pair(g, 1.0));
+            }
+        }
+    }
+    this->addTerms(distances, genes);
+
+    // the k nearest neighbors of each query, with the candidates added
+    // in the same order as leave_one_out. The queries are searched in
+    // blocks, so that the distances to the candidates before them (a
+    // column of the upper triangle) are read from contiguous memory.
+    // The blocks are searched a few per thread at a time, and their
+    // results counted in order, so that stopThreshold stops after the
+    // same query as leave_one_out.
+    const int *classIds = this->knn->class_ids;
+    const std::vector<size_t> &queries = (subset != NULL) ? *subset : this->queries;
+    const size_t blockSize = 64;
+    int numThreads = knn_num_threads(this->knn);
+    long numBlocks = long((queries.size() + blockSize - 1) / blockSize);
+    long roundBlocks = long(numThreads) * 2;
+    std::vector<char> correct(queries.size());
+    int totalCorrect = 0;
+    int totalQueries = 0;
+    for (long first = 0; first < numBlocks; first += roundBlocks) {
+        long last = std::min(numBlocks, first + roundBlocks);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(numThreads)
+#endif
+        {
+            std::vector<kNN::ClassNearestNeighbors*> knnSearch(blockSize);
+            for (size_t b = 0; b < blockSize; ++b) {
+                knnSearch[b] = new kNN::ClassNearestNeighbors(this->knn->num_k,
+                    kNN::ClassNameLess(this->knn->class_names));
+            }
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+            for (long block = first; block < last; ++block) {
+                size_t begin = size_t(block) * blockSize;
+                size_t end = std::min(queries.size(), begin + blockSize);
+                size_t lastQuery = queries[end - 1];
+                for (size_t j = 0; j < lastQuery; ++j) {
+                    // distances[column + i] is the distance between j and i > j
+                    size_t column = this->pairIndex(j, j + 1) - (j + 1);
+                    for (size_t q = begin; q < end; ++q) {
+                        size_t i = queries[q];
+                        kNN::ClassNearestNeighbors &search = *knnSearch[q - begin];
+                        if (j < i && (!search.full()
+                                      || distances[column + i] < search.max_nn_distance())) {
+                            search.add(classIds[j], distances[column + i]);
+                        }
+                    }
+                }
+                for (size_t q = begin; q < end; ++q) {
+                    size_t i = queries[q];
+                    kNN::ClassNearestNeighbors &search = *knnSearch[q - begin];
+                    // the row of i holds its distances to all j > i
+                    size_t row = this->pairIndex(i, i + 1) - (i + 1);
+                    for (size_t j = i + 1; j < this->numKnown; ++j) {
+                        if (!search.full() || distances[row + j] < search.max_nn_distance()) {
+                            search.add(classIds[j], distances[row + j]);
+                        }
+                    }
+                    search.majority();
+                    correct[q] = search.answer[0].first == classIds[i];
+                    search.reset();
+                }
+            }
+            for (size_t b = 0; b < blockSize; ++b) {
+                delete knnSearch[b];
+            }
+        }
+
+        bool stopped = false;
+        size_t end = std::min(queries.size(), size_t(last) * blockSize);
+        for (size_t q = size_t(first) * blockSize; q < end && !stopped; ++q) {
+            if (correct[q]) {
+                totalCorrect++;
+            }
+            totalQueries++;
+            stopped = totalQueries - totalCorrect > stopThreshold;
+        }
+        if (stopped) {
+            break;
+        }
+    }
+
+    // keep the distances in place of the least recently used individual
+#ifdef _OPENMP
+#pragma omp critical(knnga_distances)
+#endif
+    {
+        Entry *entry = NULL;
+        if (this->cache.size() < this->maxEntries) {
+            entry = new Entry();
+            this->cache.push_back(entry);
+        } else {
+            for (size_t i = 0; i < this->cache.size(); ++i) {
+                if (this->cache[i]->readers == 0
+                    && (entry == NULL || this->cache[i]->lastUse < entry->lastUse)) {
+                    entry = this->cache[i];
+                }
+            }
+        }
+        if (entry != NULL) {
+            entry->genome.resize(this->numGenes);
+            for (size_t g = 0; g < this->numGenes; ++g) {
+                entry->genome[g] = individual[g];
+            }
+            entry->distances.swap(distances);
+            entry->readers = 0;
+            entry->lastUse = ++this->useCount;
+        }
+    }
+
+    return std::make_pair(totalCorrect, totalQueries);
+}
+
 /******************************************************************************/
 /******************************************************************************/
 /******************************************************************************/
@@ -204,6 +649,19 @@ void GASelection<EOT, EO>::setRandomSelection() {
     this->setting = (EO<EOT>*) randomSelect;
 }
 
+template <typename EOT, template <typename IndiType> class EO>
+void GASelection<EOT, EO>::setParetoSelection() {
+    if ( this->setting != NULL ) {
+        delete this->setting;
+        this->setting = NULL;
+    }
+
+    GAParetoSelect<EOT> *paretoSelect;
+    paretoSelect = new GAParetoSelect<EOT>();
+
+    this->setting = (EO<EOT>*) paretoSelect;
+}
+
 /******************************************************************************/
 /******************************************************************************/
 /******************************************************************************/
@@ -398,6 +856,19 @@ void GAReplacement<EOT, EO>::setSSGAdetTournament(unsigned int tSize /*= 3*/) {
     this->setting = (EO<EOT>*) ssgaDetTour;
 }
 
+template <typename EOT, template <typename IndiType> class EO>
+void GAReplacement<EOT, EO>::setParetoReplacement() {
+    if ( this->setting != NULL ) {
+        delete this->setting;
+        this->setting = NULL;
+    }
+
+    GAParetoReplacement<EOT> *paretoReplacement;
+    paretoReplacement = new GAParetoReplacement<EOT>();
+
+    this->setting = (EO<EOT>*) paretoReplacement;
+}
+
 /******************************************************************************/
 /******************************************************************************/
 /******************************************************************************/
@@ -444,6 +915,10 @@ GAParallelization::GAParallelization(bool mode /*= true*/,
                                      unsigned int threads /*= 2*/) {
     this->parallelMode = mode;
     this->threadNum = threads;
+    this->island = 0;
+    this->islands = 1;
+    this->migrationInterval = 10;
+    this->migrants = 5;
 }
 
 bool GAParallelization::isParallel() {
@@ -462,6 +937,44 @@ void GAParallelization::setThreadNum(unsigned int n /*= 2*/) {
     this->threadNum = n;
 }
 
+void GAParallelization::setIslandModel(std::string directory, unsigned int island,
+                                       unsigned int islands, unsigned int interval /*= 10*/,
+                                       unsigned int migrants /*= 5*/) {
+    if (!directory.empty() && island >= islands) {
+        throw std::invalid_argument("GAParallelization: setIslandModel: island must be less than islands");
+    }
+
+    this->islandDirectory = directory;
+    this->island = island;
+    this->islands = islands;
+    this->migrationInterval = interval;
+    this->migrants = migrants;
+}
+
+bool GAParallelization::isIslandModel() {
+    return !this->islandDirectory.empty();
+}
+
+std::string GAParallelization::getIslandDirectory() {
+    return this->islandDirectory;
+}
+
+unsigned int GAParallelization::getIsland() {
+    return this->island;
+}
+
+unsigned int GAParallelization::getIslands() {
+    return this->islands;
+}
+
+unsigned int GAParallelization::getMigrationInterval() {
+    return this->migrationInterval;
+}
+
+unsigned int GAParallelization::getMigrants() {
+    return this->migrants;
+}
+
 /******************************************************************************/
 /******************************************************************************/
 /******************************************************************************/
@@ -477,7 +990,7 @@ GAOptimization<EOT>::GAOptimization(KnnObject *knn,
                                GAParallelization *parallel) {
 
     // status information
-    this->running = false;
+    this->running = 0;
 
     // embedded classifier
     this->knn = knn;
@@ -524,13 +1037,39 @@ GAOptimization<EOT>::~GAOptimization() {
 }
 
 template <typename EOT>
-void GAOptimization<EOT>::StartCalculation() {
-
+void GAOptimization<EOT>::PrepareCalculation() {
     this->manualStop.setFlag(true);
-    this->running = true;
+    ga_flag_set(this->running, 1);
+}
 
-    // seed the random number generator from EO
-    rng.reseed(time(NULL));
+template <typename EOT>
+void GAOptimization<EOT>::CancelCalculation() {
+    ga_flag_set(this->running, 0);
+}
+
+template <typename EOT>
+void GAOptimization<EOT>::StartCalculation() {
+    try {
+        this->Calculate();
+    } catch (...) {
+        ga_flag_set(this->running, 0);
+        throw;
+    }
+    ga_flag_set(this->running, 0);
+}
+
+template <typename EOT>
+void GAOptimization<EOT>::Calculate() {
+
+    // seed the random number generator from EO (from the clock unless a
+    // seed is set, and differently for islands started at the same time).
+    // The operators draw from it outside of the parallel evaluation, so
+    // that a run is repeated exactly with the same seed
+    uint32_t seed = this->baseSetting->getSeed();
+    if (seed == 0) {
+        seed = time(NULL);
+    }
+    rng.reseed(seed + 1000003 * this->parallelization->getIsland());
 
 #ifdef _OPENMP
     // *************** PARALLELIZATION ***************
@@ -572,7 +1111,25 @@ void GAOptimization<EOT>::StartCalculation() {
     }
 
     // *************** FITNESS SETTINGS ***************
-    GAFitnessEval<EOT> fitnessEvalFunctor(this->getKnnObject(), &indexRelation);
+    // precomputed distances for the selection, if they fit into the
+    // memory given by the distance cache setting (in megabytes)
+    size_t distanceMemory = 0;
+    if (this->baseSetting->getOpMode() == GA_SELECTION) {
+        distanceMemory = size_t(this->baseSetting->getDistanceCache()) << 20;
+    }
+    GASelectionDistances distances(this->getKnnObject(), &indexRelation, distanceMemory);
+    // the fitness of genomes that reappear is taken from the cache
+    GAFitnessCache<EOT> fitnessCache(this->baseSetting->getFitnessCache());
+    // the queries of the leave-one-out evaluation
+    GAQuerySample querySample(this->getKnnObject(), this->baseSetting->getQuerySample(),
+                              this->baseSetting->getSampleGrowth());
+    // early stopping rejects individuals below the worst fitness kept,
+    // but the Pareto replacement may keep them for their fewer features
+    bool earlyStop = this->baseSetting->getEarlyStop() &&
+        dynamic_cast<GAParetoReplacement<EOT>*>(this->replacement->getSetting()) == NULL;
+    GAFitnessEval<EOT> fitnessEvalFunctor(this->getKnnObject(), &indexRelation,
+                                          &distances, &fitnessCache, &querySample,
+                                          earlyStop);
     eoEvalFuncCounter<EOT> eval(fitnessEvalFunctor);
 
     // *************** POPULATIONS SETTINGS ***************
@@ -663,7 +1220,7 @@ void GAOptimization<EOT>::StartCalculation() {
     this->generationCounter = new eoIncrementorParam<unsigned int>("Generation");
     this->bestStat = new eoBestFitnessStat<EOT>();
     eoSecondMomentStats<EOT> secondStat;
-    GABestIndiStat<EOT> bestIndividualStat;
+    GABestIndiStat<EOT> bestIndividualStat("bestIndi", &fitnessCache);
 
     this->monitorStream = new std::ostringstream(std::ostringstream::out);
     eoOStreamMonitor monitor(*(this->monitorStream), "\t");
@@ -686,17 +1243,38 @@ void GAOptimization<EOT>::StartCalculation() {
     this->kNNUpdater = new GAClassifierUpdater<EOT>(this->getKnnObject(), &indexRelation);
     checkpoint.add(*(this->kNNUpdater));
 
+    GAQuerySchedule<EOT> querySchedule(&querySample, &fitnessCache, this->kNNUpdater);
+    checkpoint.add(querySchedule);
+
+    // after the other continuators, so that it sees the updated best fitness
+    this->progress.start(&eval, this->kNNUpdater, this->monitorStream,
+                         this->bestIndiStream);
+    checkpoint.add(this->progress);
+
+    this->paretoFront.start(&indexRelation, this->knn->num_features);
+    checkpoint.add(this->paretoFront);
+
     // *************** MAIN SETUP ***************
     eoSGATransform<EOT> transform(xover, this->baseSetting->getCrossRate(),
                                   muta, this->baseSetting->getMutRate());
 
+    // in the island model, the replacement also exchanges individuals
+    // with the other islands
+    GAIslandMigration<EOT> migration(*replacement,
+        this->parallelization->getIslandDirectory(),
+        this->parallelization->getIsland(), this->parallelization->getIslands(),
+        this->parallelization->getMigrationInterval(),
+        this->parallelization->getMigrants());
+    if (this->parallelization->isIslandModel()) {
+        replacement = &migration;
+    }
+
     eoEasyEA<EOT> realGA( checkpoint, eval, selection, transform, *replacement );
 
     // run the main GA algorithm
     if (this->manualStop.getFlag()) {
         realGA(population);
     }
-    this->running = false;
 }
 
 template <typename EOT>
@@ -708,7 +1286,7 @@ void GAOptimization<EOT>::StopCalculation() {
 
 template <typename EOT>
 bool GAOptimization<EOT>::getRunStatus() {
-    return this->running;
+    return ga_flag_get(this->running) != 0;
 }
 
 template <typename EOT>
@@ -751,40 +1329,46 @@ GAParallelization * GAOptimization<EOT>::getParallelization() {
     return this->parallelization;
 }
 
+// the getters of the progress may be called while the GA runs in
+// another thread (see GAProgress)
+
 template <typename EOT>
 unsigned int GAOptimization<EOT>::getGenerationCount() {
-    if (this->generationCounter == NULL ) {
-        return 0;
-    } else {
-        return this->generationCounter->value();
-    }
+    unsigned int generation;
+    double bestFitness, seconds;
+    unsigned long evaluations;
+    this->progress.get(generation, bestFitness, evaluations, seconds);
+    return generation;
 }
 
 template <typename EOT>
 double GAOptimization<EOT>::getBestFitnessValue() {
-    if (this->bestStat == NULL) {
-        return 0.0;
-    } else {
-        return this->kNNUpdater->getBestFitness();
-    }
+    unsigned int generation;
+    double bestFitness, seconds;
+    unsigned long evaluations;
+    this->progress.get(generation, bestFitness, evaluations, seconds);
+    return bestFitness;
+}
+
+template <typename EOT>
+void GAOptimization<EOT>::getProgress(unsigned int &generation, double &bestFitness,
+                                      unsigned long &evaluations, double &seconds) {
+    this->progress.get(generation, bestFitness, evaluations, seconds);
 }
 
 template <typename EOT>
 std::string GAOptimization<EOT>::getMonitorString() {
-    if (this->monitorStream == NULL) {
-        return "";
-    } else {
-        return this->monitorStream->str();
-    }
+    return this->progress.getMonitor();
 }
 
 template <typename EOT>
 std::string GAOptimization<EOT>::getBestIndiString() {
-    if (this->bestIndiStream == NULL) {
-        return "";
-    } else {
-        return this->bestIndiStream->str();
-    }
+    return this->progress.getBestIndi();
+}
+
+template <typename EOT>
+std::vector<GAParetoPoint> GAOptimization<EOT>::getParetoFront() {
+    return this->paretoFront.get();
 }
 // *********************** SETTER ***********************
 
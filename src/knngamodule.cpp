@@ -17,6 +17,7 @@
  */
  
 #include <Python.h>
+#include <pythread.h>
 #include "gameramodule.hpp"
 #include "knnga.hpp"
 
@@ -35,11 +36,23 @@ extern "C" {
     static PyObject* getPopSize(PyObject* object);
     static PyObject* getCrossRate(PyObject* object);
     static PyObject* getMutRate(PyObject* object);
+    static PyObject* getDistanceCache(PyObject* object);
+    static PyObject* getFitnessCache(PyObject* object);
+    static PyObject* getQuerySample(PyObject* object);
+    static PyObject* getSampleGrowth(PyObject* object);
+    static PyObject* getEarlyStop(PyObject* object);
+    static PyObject* getSeed(PyObject* object);
     // Setter
     static int setOpMode(PyObject* object, PyObject* arg);
     static int setPopSize(PyObject* object, PyObject* arg);
     static int setCrossRate(PyObject* object, PyObject* arg);
     static int setMutRate(PyObject* object, PyObject* arg);
+    static int setDistanceCache(PyObject* object, PyObject* arg);
+    static int setFitnessCache(PyObject* object, PyObject* arg);
+    static int setQuerySample(PyObject* object, PyObject* arg);
+    static int setSampleGrowth(PyObject* object, PyObject* arg);
+    static int setEarlyStop(PyObject* object, PyObject* arg);
+    static int setSeed(PyObject* object, PyObject* arg);
 }
 
 struct GABaseSettingObject {
@@ -68,6 +81,42 @@ PyGetSetDef GABaseSetting_getset[] = {
     { (char *) "mutRate", (getter)getMutRate, (setter)setMutRate,
       (char *) "the mutation probability "
                "(should be between 0.0 and 1.0)", NULL },
+    { (char *) "distanceCache", (getter)getDistanceCache, (setter)setDistanceCache,
+      (char *) "the memory (in megabytes) for precomputed distances in the "
+               "selection mode, or 0 to compute the distances for every "
+               "individual. The per-feature distances of all pairs of training "
+               "samples (about features * samples^2 * 2 bytes) are computed "
+               "once, and individuals are evaluated from them and from the "
+               "distances of the last individuals kept in the remaining memory. "
+               "When the per-feature distances do not fit, this is ignored.", NULL },
+    { (char *) "fitnessCache", (getter)getFitnessCache, (setter)setFitnessCache,
+      (char *) "the number of genomes whose fitness is kept, so that genomes "
+               "that reappear are not evaluated again (0 disables the cache). "
+               "In the weighting mode, genomes whose weights are equal when "
+               "rounded to single precision share their fitness. The hits and "
+               "misses of the cache are shown in the ``bestIndiString``.", NULL },
+    { (char *) "querySample", (getter)getQuerySample, (setter)setQuerySample,
+      (char *) "the fraction of the training samples (of each class) used as "
+               "queries of the leave-one-out fitness evaluation. With a value "
+               "below 1.0, a stratified random sample is evaluated, which "
+               "makes the evaluation cheaper but the fitness only an estimate "
+               "(all training samples are still used as neighbors)", NULL },
+    { (char *) "sampleGrowth", (getter)getSampleGrowth, (setter)setSampleGrowth,
+      (char *) "the number of generations after which the query sample is "
+               "doubled (and drawn again), until all training samples are "
+               "used; 0 keeps the sample of ``querySample``. The individuals "
+               "kept from before the sample grew keep their fitness", NULL },
+    { (char *) "earlyStop", (getter)getEarlyStop, (setter)setEarlyStop,
+      (char *) "flag which determines whether the evaluation of an individual "
+               "stops as soon as it has misclassified too many queries to "
+               "reach the fitness of the worst individual kept in the "
+               "population. Such an individual is rejected: its fitness is "
+               "the one it would have with all remaining queries correct, "
+               "which is below that of every kept individual", NULL },
+    { (char *) "seed", (getter)getSeed, (setter)setSeed,
+      (char *) "the seed of the random number generator, or 0 to seed it "
+               "from the clock. Runs with the same seed and settings give "
+               "the same result, also with parallel evaluation", NULL },
     { NULL }
 };
 
@@ -80,8 +129,15 @@ static PyObject *GABaseSetting_new(PyTypeObject *pytype, PyObject *args, PyObjec
     unsigned int pSize = 75;
     double cRate = 0.95;
     double mRate = 0.05;
-
-    if (!PyArg_ParseTuple(args, CHAR_PTR_CAST "|iIdd", &opMode, &pSize, &cRate, &mRate)) {
+    unsigned int dCache = 0;
+    unsigned int fCache = 10000;
+    double qSample = 1.0;
+    unsigned int qGrowth = 0;
+    PyObject *eStopObject = NULL;
+    unsigned int seed = 0;
+
+    if (!PyArg_ParseTuple(args, CHAR_PTR_CAST "|iIddIIdIOI", &opMode, &pSize, &cRate, &mRate,
+                          &dCache, &fCache, &qSample, &qGrowth, &eStopObject, &seed)) {
         PyErr_SetString(PyExc_RuntimeError, "GABaseSetting: argument parse error");
         return NULL;
     }
@@ -92,7 +148,10 @@ static PyObject *GABaseSetting_new(PyTypeObject *pytype, PyObject *args, PyObjec
     }
 
     try {
-        self->baseSetting = new GABaseSetting(opMode, pSize, cRate, mRate);
+        self->baseSetting = new GABaseSetting(opMode, pSize, cRate, mRate, dCache, fCache,
+                                              qSample, qGrowth,
+                                              eStopObject != NULL && PyObject_IsTrue(eStopObject),
+                                              seed);
     } catch (std::exception &e) {
         PyErr_SetString(PyExc_RuntimeError, e.what());
         return NULL;
@@ -158,6 +217,79 @@ static PyObject* getMutRate(PyObject* object) {
     }
 }
 
+static PyObject* getDistanceCache(PyObject* object) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    try {
+        return Py_BuildValue(CHAR_PTR_CAST "I", self->baseSetting->getDistanceCache());
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        Py_RETURN_NONE;
+    }
+}
+
+static PyObject* getFitnessCache(PyObject* object) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    try {
+        return Py_BuildValue(CHAR_PTR_CAST "I", self->baseSetting->getFitnessCache());
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        Py_RETURN_NONE;
+    }
+}
+
+static PyObject* getQuerySample(PyObject* object) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    try {
+        return Py_BuildValue(CHAR_PTR_CAST "d", self->baseSetting->getQuerySample());
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        Py_RETURN_NONE;
+    }
+}
+
+static PyObject* getSampleGrowth(PyObject* object) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    try {
+        return Py_BuildValue(CHAR_PTR_CAST "I", self->baseSetting->getSampleGrowth());
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        Py_RETURN_NONE;
+    }
+}
+
+static PyObject* getEarlyStop(PyObject* object) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+    bool earlyStop;
+
+    try {
+        earlyStop = self->baseSetting->getEarlyStop();
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        Py_RETURN_NONE;
+    }
+
+    if ( earlyStop ) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject* getSeed(PyObject* object) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    try {
+        return Py_BuildValue(CHAR_PTR_CAST "I", self->baseSetting->getSeed());
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        Py_RETURN_NONE;
+    }
+}
+
 static int setOpMode(PyObject* object, PyObject* arg) {
     GABaseSettingObject *self = (GABaseSettingObject*) object;
 
@@ -237,6 +369,114 @@ static int setMutRate(PyObject* object, PyObject* arg) {
     return 0;
 }
 
+static int setDistanceCache(PyObject* object, PyObject* arg) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    if(!PyInt_Check(arg) || PyInt_AsLong(arg) < 0) {
+        PyErr_SetString(PyExc_TypeError, "GABaseSetting.setDistanceCache: distanceCache have to be a non-negative int");
+        return -1;
+    }
+
+    try {
+        self->baseSetting->setDistanceCache((unsigned int) PyInt_AsLong(arg));
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+static int setFitnessCache(PyObject* object, PyObject* arg) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    if(!PyInt_Check(arg) || PyInt_AsLong(arg) < 0) {
+        PyErr_SetString(PyExc_TypeError, "GABaseSetting.setFitnessCache: fitnessCache have to be a non-negative int");
+        return -1;
+    }
+
+    try {
+        self->baseSetting->setFitnessCache((unsigned int) PyInt_AsLong(arg));
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+static int setQuerySample(PyObject* object, PyObject* arg) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    if(!PyFloat_Check(arg)) {
+        PyErr_SetString(PyExc_TypeError, "GABaseSetting.setQuerySample: querySample have to be a float value");
+        return -1;
+    }
+
+    try {
+        self->baseSetting->setQuerySample(PyFloat_AsDouble(arg));
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+static int setSampleGrowth(PyObject* object, PyObject* arg) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    if(!PyInt_Check(arg) || PyInt_AsLong(arg) < 0) {
+        PyErr_SetString(PyExc_TypeError, "GABaseSetting.setSampleGrowth: sampleGrowth have to be a non-negative int");
+        return -1;
+    }
+
+    try {
+        self->baseSetting->setSampleGrowth((unsigned int) PyInt_AsLong(arg));
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+static int setEarlyStop(PyObject* object, PyObject* arg) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    if(!PyBool_Check(arg)) {
+        PyErr_SetString(PyExc_TypeError, "GABaseSetting.setEarlyStop: earlyStop have to be a bool");
+        return -1;
+    }
+
+    try {
+        self->baseSetting->setEarlyStop(PyObject_IsTrue(arg));
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+static int setSeed(PyObject* object, PyObject* arg) {
+    GABaseSettingObject *self = (GABaseSettingObject*) object;
+
+    if(!PyInt_Check(arg) || PyInt_AsLong(arg) < 0) {
+        PyErr_SetString(PyExc_TypeError, "GABaseSetting.setSeed: seed have to be a non-negative int");
+        return -1;
+    }
+
+    try {
+        self->baseSetting->setSeed((unsigned int) PyInt_AsLong(arg));
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
 void init_GABaseSettingType(PyObject *d) {
     GABaseSettingType.ob_type = &PyType_Type;
     GABaseSettingType.tp_name = CHAR_PTR_CAST "gamera.knnga.GABaseSetting";
@@ -253,7 +493,13 @@ void init_GABaseSettingType(PyObject *d) {
         "**GABaseSetting** (*opMode* = ``GA_SELECTION``,"
         " int *popSize* = ``75``,"
         " double *crossRate* = ``0.95``,"
-        " double *mutRate* = ``0.05``)\n\n"
+        " double *mutRate* = ``0.05``,"
+        " int *distanceCache* = ``0``,"
+        " int *fitnessCache* = ``10000``,"
+        " double *querySample* = ``1.0``,"
+        " int *sampleGrowth* = ``0``,"
+        " bool *earlyStop* = ``False``,"
+        " int *seed* = ``0``)\n\n"
         "The ``GABaseSetting`` constructor creates a new settings object with "
         "the basic parameters for GA-optimization for the later usage in a "
         "GAOptimization-object.\n\n"
@@ -264,7 +510,25 @@ void init_GABaseSettingType(PyObject *d) {
         "double *crossRate* (optional)\n"
         "    crossover probability which is used in the GA-progress\n"
         "double *mutRate* (optional)\n"
-        "    mutation probability which is used in the GA-progress\n";
+        "    mutation probability which is used in the GA-progress\n"
+        "int *distanceCache* (optional)\n"
+        "    memory in megabytes for precomputed distances in the selection "
+        "mode (see the ``distanceCache`` property)\n"
+        "int *fitnessCache* (optional)\n"
+        "    number of genomes whose fitness is cached "
+        "(see the ``fitnessCache`` property)\n"
+        "double *querySample* (optional)\n"
+        "    fraction of the training samples used as leave-one-out queries "
+        "(see the ``querySample`` property)\n"
+        "int *sampleGrowth* (optional)\n"
+        "    generations after which the query sample is doubled "
+        "(see the ``sampleGrowth`` property)\n"
+        "bool *earlyStop* (optional)\n"
+        "    reject individuals that can not reach the worst kept fitness "
+        "(see the ``earlyStop`` property)\n"
+        "int *seed* (optional)\n"
+        "    seed of the random number generator, 0 for the clock "
+        "(see the ``seed`` property)\n";
 
     PyType_Ready(&GABaseSettingType);
     PyDict_SetItemString(d, "GABaseSetting", (PyObject*)&GABaseSettingType);
@@ -284,6 +548,7 @@ extern "C" {
     static PyObject* setRankSelection(PyObject* object, PyObject* args);
     static PyObject* setTournamentSelection(PyObject* object, PyObject* args);
     static PyObject* setRandomSelection(PyObject* object, PyObject* args);
+    static PyObject* setParetoSelection(PyObject* object, PyObject* args);
 }
 
 struct GASelectionObject {
@@ -341,6 +606,18 @@ PyMethodDef GASelection_methods[] = {
       (char *) "**setRandomSelection** ()\n\n"
                "Select all individuals in the genetic progress randomly."
     },
+    { (char *) "setParetoSelection", setParetoSelection, METH_NOARGS,
+      (char *) "**setParetoSelection** ()\n\n"
+               "Sets the crowded binary tournament of NSGA-II as selection "
+               "method, which optimizes both the fitness and the number of "
+               "selected features (or of weights that are not 0). Of two "
+               "random individuals, the one in the lower non-dominated front "
+               "wins, or in the same front the one in a less crowded part of "
+               "it.\n\n"
+               "Should be used together with "
+               "``GAReplacement.setParetoReplacement``; the result is "
+               "``GAOptimization.paretoFront``."
+    },
     { NULL }
 };
 
@@ -480,6 +757,20 @@ static PyObject* setRandomSelection(PyObject* object, PyObject* args) {
     Py_RETURN_NONE;
 }
 
+static PyObject* setParetoSelection(PyObject* object, PyObject* args) {
+    GASelectionObject *self = (GASelectionObject*) object;
+
+    try {
+        self->bitSelection->setParetoSelection();
+        self->realSelection->setParetoSelection();
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
 void init_GASelectionType(PyObject *d) {
     GASelectionType.ob_type = &PyType_Type;
     GASelectionType.tp_name = CHAR_PTR_CAST "gamera.knnga.GASelection";
@@ -1002,6 +1293,7 @@ extern "C" {
     static PyObject* setGenerationalReplacement(PyObject* object, PyObject* args);
     static PyObject* setSSGAworse(PyObject* object, PyObject* args);
     static PyObject* setSSGAdetTournament(PyObject* object, PyObject* args);
+    static PyObject* setParetoReplacement(PyObject* object, PyObject* args);
 }
 
 struct GAReplacementObject {
@@ -1036,6 +1328,17 @@ PyMethodDef GAReplacement_methods[] = {
                "int *tSize* (optinal)\n"
                "    the number of individuals in the tournament"
     },
+    { (char *) "setParetoReplacement", setParetoReplacement, METH_NOARGS,
+      (char *) "**setParetoReplacement** ()\n\n"
+               "Sets the elitist replacement of NSGA-II as replacement method: "
+               "the population and its offspring are sorted into "
+               "non-dominated fronts by the fitness and the number of "
+               "selected features (or of weights that are not 0), and the "
+               "best fronts form the next population, where the last one is "
+               "thinned out in its most crowded parts.\n\n"
+               "The early stopping of ``GABaseSetting.earlyStop`` is not used "
+               "with this replacement."
+    },
     { NULL }
 };
 
@@ -1100,6 +1403,20 @@ static PyObject* setSSGAworse(PyObject* object, PyObject* args) {
     Py_RETURN_NONE;
 }
 
+static PyObject* setParetoReplacement(PyObject* object, PyObject* args) {
+    GAReplacementObject *self = (GAReplacementObject*) object;
+
+    try {
+        self->bitReplacement->setParetoReplacement();
+        self->realReplacement->setParetoReplacement();
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
 static PyObject* setSSGAdetTournament(PyObject* object, PyObject* args) {
     GAReplacementObject *self = (GAReplacementObject*) object;
     unsigned int tSize = 3;
@@ -1355,6 +1672,9 @@ extern "C" {
     // Setter
     static int setMode(PyObject* object, PyObject* arg);
     static int setThreadNum(PyObject* object, PyObject* arg);
+    // Functions
+    static PyObject* setIslandModel(PyObject* object, PyObject* args);
+    static PyObject* getIsland(PyObject* object);
 }
 
 struct GAParallelizationObject {
@@ -1368,6 +1688,28 @@ static PyTypeObject GAParallelizationType = {
 };
 
 PyMethodDef GAParallelization_methods[] = {
+    { (char *) "setIslandModel", setIslandModel, METH_VARARGS,
+      (char *) "**setIslandModel** (string *directory*, int *island*, int *islands*, "
+               "int *interval* = ``10``, int *migrants* = ``5``)\n\n"
+               "Runs the optimization as one of several islands, i.e. GA "
+               "processes (possibly on different hosts) which optimize the "
+               "same classifier with the same settings and exchange their "
+               "best individuals through files in a shared directory. The "
+               "classifier is updated from the best individual of the island "
+               "population, which includes the best individuals received from "
+               "the other islands.\n\n"
+               "string *directory*\n"
+               "    the directory shared by all islands (an empty string "
+               "disables the island model)\n"
+               "int *island*\n"
+               "    the number of this island, from 0 to *islands* - 1\n"
+               "int *islands*\n"
+               "    the number of islands\n"
+               "int *interval* (optional)\n"
+               "    the number of generations between two exchanges\n"
+               "int *migrants* (optional)\n"
+               "    the number of best individuals sent to the other islands"
+    },
     { NULL }
 };
 
@@ -1378,6 +1720,10 @@ PyGetSetDef GAParallelization_getset[] = {
     { (char *) "thredNum", (getter)getThreadNum, (setter)setThreadNum,
       (char *) "the number of threads which are used by enabled "
                "parallelization", NULL },
+    { (char *) "island", (getter)getIsland, NULL,
+      (char *) "the tuple (*directory*, *island*, *islands*, *interval*, "
+               "*migrants*) set by ``setIslandModel``, or ``None`` when the "
+               "island model is not used", NULL },
     { NULL }
 };
 
@@ -1491,6 +1837,49 @@ static int setThreadNum(PyObject* object, PyObject* arg) {
     return 0;
 }
 
+static PyObject* setIslandModel(PyObject* object, PyObject* args) {
+    GAParallelizationObject *self = (GAParallelizationObject*) object;
+    char *directory;
+    unsigned int island;
+    unsigned int islands;
+    unsigned int interval = 10;
+    unsigned int migrants = 5;
+
+    if (PyArg_ParseTuple(args, CHAR_PTR_CAST "sII|II", &directory, &island, &islands,
+                         &interval, &migrants) <= 0) {
+        PyErr_SetString(PyExc_RuntimeError, "GAParallelization.setIslandModel: argument parse error");
+        return NULL;
+    }
+
+    try {
+        self->parallel->setIslandModel(directory, island, islands, interval, migrants);
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* getIsland(PyObject* object) {
+    GAParallelizationObject *self = (GAParallelizationObject*) object;
+
+    try {
+        if (!self->parallel->isIslandModel()) {
+            Py_RETURN_NONE;
+        }
+        return Py_BuildValue(CHAR_PTR_CAST "(sIIII)",
+                             self->parallel->getIslandDirectory().c_str(),
+                             self->parallel->getIsland(),
+                             self->parallel->getIslands(),
+                             self->parallel->getMigrationInterval(),
+                             self->parallel->getMigrants());
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        Py_RETURN_NONE;
+    }
+}
+
 void init_GAParallelizationType(PyObject *d) {
     GAParallelizationType.ob_type = &PyType_Type;
     GAParallelizationType.tp_name = CHAR_PTR_CAST "gamera.knnga.GAParallelization";
@@ -1527,19 +1916,27 @@ extern "C" {
 
     static PyObject* startCalculation(PyObject* object, PyObject* args);
     static PyObject* stopCalculation(PyObject* object, PyObject* args);
+    static PyObject* waitCalculation(PyObject* object, PyObject* args);
 
     // getter
     static PyObject* getRunStatus(PyObject* object);
     static PyObject* getGenerationCount(PyObject* object);
     static PyObject* getBestFitnessValue(PyObject* object);
+    static PyObject* getProgress(PyObject* object);
     static PyObject* getMonitorString(PyObject* object);
     static PyObject* getBestIndiString(PyObject* object);
+    static PyObject* getParetoFront(PyObject* object);
 }
 
 struct GAOptimizationObject {
     PyObject_HEAD
     GAOptimization<SelectionIndi> *selection;
     GAOptimization<WeightingIndi> *weighting;
+    // a run started with background=True: the lock is held until it
+    // has finished, and error holds the message of its exception
+    bool background;
+    PyThread_type_lock finished;
+    std::string *error;
 };
 
 static PyTypeObject GAOptimizationType = {
@@ -1548,12 +1945,18 @@ static PyTypeObject GAOptimizationType = {
 };
 
 PyMethodDef GAOptimization_methods[] = {
-    { (char *) "startCalculation", startCalculation, METH_NOARGS,
-      (char *) "**startCalculation** ()\n\n"
-               "Starts the evolutionary optimization progress\n\n"
+    { (char *) "startCalculation", startCalculation, METH_VARARGS,
+      (char *) "**startCalculation** (bool *background* = ``False``)\n\n"
+               "Starts the evolutionary optimization progress and returns when "
+               "it is finished, or with *background* = ``True`` at once, while "
+               "the optimization runs in a new thread (see ``waitCalculation``, "
+               "``status`` and ``progress``).\n\n"
+               "Whenever a better individual is found, its selections or "
+               "weights are written to the classifier, so that it can still "
+               "classify while the optimization runs.\n\n"
                ".. note:: After starting the optimization no changes in the "
-               "used classifier object are allowed until the optimization "
-               "is finished!"
+               "training data or the settings of the used classifier object "
+               "are allowed until the optimization is finished!"
     },
     { (char *) "stopCalculation", stopCalculation, METH_NOARGS,
       (char *) "**stopCalculation** ()\n\n"
@@ -1563,6 +1966,12 @@ PyMethodDef GAOptimization_methods[] = {
                "the optimization is finished. As a result it could take a "
                "long time until this functions returns!"
     },
+    { (char *) "waitCalculation", waitCalculation, METH_NOARGS,
+      (char *) "**waitCalculation** ()\n\n"
+               "Waits until an optimization started with *background* = "
+               "``True`` is finished, and raises a ``RuntimeError`` if it has "
+               "failed. Returns at once when there is no such optimization."
+    },
     { NULL }
 };
 
@@ -1575,10 +1984,26 @@ PyGetSetDef GAOptimization_getset[] = {
     { (char *) "bestFitness", (getter)getBestFitnessValue, NULL,
       (char *) "the best fitness value which has occurred in the "
                "optimization progress so far", NULL },
+    { (char *) "progress", (getter)getProgress, NULL,
+      (char *) "the tuple (*generation*, *bestFitness*, *evaluations*, "
+               "*evaluationsPerSecond*) of the optimization at the end of the "
+               "latest generation, where *evaluations* is the number of "
+               "fitness evaluations so far", NULL },
     { (char *) "monitorString", (getter)getMonitorString, NULL,
       (char *) "string which contains some statistical information about "
                "the optimization process, like number of fitness evaluations, "
                "average and stdev of fitness values within each generation.", NULL },
+    { (char *) "paretoFront", (getter)getParetoFront, NULL,
+      (char *) "the non-dominated individuals of the population after the "
+               "latest generation, with regard to the fitness and the number "
+               "of selected features (or of weights that are not 0), as a "
+               "list of tuples (*fitness*, *numFeatures*, *values*) ordered "
+               "by *numFeatures*, where *values* holds the selections or "
+               "weights of all features (in an ``array.array`` of type 'i' "
+               "or 'd' they can be passed to ``set_selections`` or "
+               "``set_weights`` of the classifier). It is most useful with "
+               "``GASelection.setParetoSelection`` and "
+               "``GAReplacement.setParetoReplacement``", NULL },
     { (char *) "bestIndiString", (getter)getBestIndiString, NULL,
       (char *) "string coded version from the best individual of each "
                "generation", NULL },
@@ -1682,6 +2107,10 @@ static PyObject *GAOptimization_new(PyTypeObject *pytype, PyObject *args, PyObje
         return NULL;
     }
 
+    self->background = false;
+    self->finished = NULL;
+    self->error = new std::string();
+
     Py_INCREF(classifier);
     Py_INCREF(baseSetting);
     Py_INCREF(selection);
@@ -1752,31 +2181,138 @@ static void GAOptimization_dealloc(PyObject *object) {
         return;
     }
 
+    // a background run keeps a reference, so it has finished here
+    if (self->finished != NULL) {
+        PyThread_free_lock(self->finished);
+    }
+    delete self->error;
+
     self->ob_type->tp_free(self);
 }
 
-static PyObject* startCalculation(PyObject* object, PyObject* args) {
-    GAOptimizationObject *self = (GAOptimizationObject*) object;
-
-    Py_BEGIN_ALLOW_THREADS
-
+// runs the optimization without the GIL; returns false and sets error
+// when it fails
+static bool runCalculation(GAOptimizationObject *self) {
     try {
-        if ( self->selection != NULL && self->weighting == NULL) {
+        if (self->selection != NULL) {
             self->selection->StartCalculation();
-        } else if ( self->weighting != NULL && self->selection == NULL) {
-            self->weighting->StartCalculation();
         } else {
-            PyErr_SetString(PyExc_RuntimeError, "GAOptimization.startCalculation: invalid configuration settings");
-            return NULL;
+            self->weighting->StartCalculation();
         }
     } catch (std::exception &e) {
-        PyEval_RestoreThread(_save);
-        PyErr_SetString(PyExc_RuntimeError, e.what());
+        *self->error = e.what();
+        return false;
+    }
+    return true;
+}
+
+// the thread of a run started with background=True
+static void backgroundCalculation(void *object) {
+    GAOptimizationObject *self = (GAOptimizationObject*) object;
+
+    runCalculation(self);
+    PyThread_release_lock(self->finished);
+
+    PyGILState_STATE state = PyGILState_Ensure();
+    Py_DECREF(object);
+    PyGILState_Release(state);
+}
+
+// whether a run started with background=True has not finished yet
+static bool backgroundRunning(GAOptimizationObject *self) {
+    if (!self->background) {
+        return false;
+    }
+    if (PyThread_acquire_lock(self->finished, 0)) {
+        PyThread_release_lock(self->finished);
+        return false;
+    }
+    return true;
+}
+
+static PyObject* startCalculation(PyObject* object, PyObject* args) {
+    GAOptimizationObject *self = (GAOptimizationObject*) object;
+    PyObject *backgroundObject = NULL;
+
+    if (!PyArg_ParseTuple(args, CHAR_PTR_CAST "|O", &backgroundObject)) {
+        return NULL;
+    }
+    if ((self->selection == NULL) == (self->weighting == NULL)) {
+        PyErr_SetString(PyExc_RuntimeError, "GAOptimization.startCalculation: invalid configuration settings");
+        return NULL;
+    }
+    if (backgroundRunning(self)) {
+        PyErr_SetString(PyExc_RuntimeError, "GAOptimization.startCalculation: the optimization is already running");
+        return NULL;
+    }
+    self->background = false;
+    self->error->clear();
+
+    // feature vectors may have been added since the last classification
+    if (self->selection != NULL)
+        kNN::knn_update_normalization(self->selection->getKnnObject());
+    else
+        kNN::knn_update_normalization(self->weighting->getKnnObject());
+
+    // before the thread starts, so that stopCalculation right after a
+    // background start is not undone by the thread
+    if (self->selection != NULL)
+        self->selection->PrepareCalculation();
+    else
+        self->weighting->PrepareCalculation();
+
+    if (backgroundObject != NULL && PyObject_IsTrue(backgroundObject)) {
+        // the classifier updates take the GIL from the new thread
+        PyEval_InitThreads();
+        if (self->finished == NULL) {
+            self->finished = PyThread_allocate_lock();
+        }
+        PyThread_acquire_lock(self->finished, 1);
+        self->background = true;
+        Py_INCREF(object);
+        if (PyThread_start_new_thread(backgroundCalculation, object) == -1) {
+            PyThread_release_lock(self->finished);
+            self->background = false;
+            if (self->selection != NULL)
+                self->selection->CancelCalculation();
+            else
+                self->weighting->CancelCalculation();
+            Py_DECREF(object);
+            PyErr_SetString(PyExc_RuntimeError, "GAOptimization.startCalculation: cannot start the thread");
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = runCalculation(self);
+    Py_END_ALLOW_THREADS
+
+    if (!success) {
+        PyErr_SetString(PyExc_RuntimeError, self->error->c_str());
         return NULL;
     }
+    Py_RETURN_NONE;
+}
+
+static PyObject* waitCalculation(PyObject* object, PyObject* args) {
+    GAOptimizationObject *self = (GAOptimizationObject*) object;
+
+    if (!self->background) {
+        Py_RETURN_NONE;
+    }
 
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->finished, 1);
+    PyThread_release_lock(self->finished);
     Py_END_ALLOW_THREADS
 
+    self->background = false;
+    if (!self->error->empty()) {
+        PyErr_SetString(PyExc_RuntimeError, self->error->c_str());
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
@@ -1803,6 +2339,11 @@ static PyObject* stopCalculation(PyObject* object, PyObject* args) {
 static PyObject* getRunStatus(PyObject* object) {
     GAOptimizationObject *self = (GAOptimizationObject*) object;
 
+    // a background run may not have started the optimization yet
+    if (backgroundRunning(self)) {
+        Py_RETURN_TRUE;
+    }
+
     try {
         if ( self->selection != NULL && self->weighting == NULL) {
             if (self->selection->getRunStatus()) {
@@ -1862,6 +2403,30 @@ static PyObject* getBestFitnessValue(PyObject* object) {
     }
 }
 
+static PyObject* getProgress(PyObject* object) {
+    GAOptimizationObject *self = (GAOptimizationObject*) object;
+    unsigned int generation;
+    double bestFitness, seconds;
+    unsigned long evaluations;
+
+    try {
+        if ( self->selection != NULL && self->weighting == NULL) {
+            self->selection->getProgress(generation, bestFitness, evaluations, seconds);
+        } else if ( self->weighting != NULL && self->selection == NULL) {
+            self->weighting->getProgress(generation, bestFitness, evaluations, seconds);
+        } else {
+            PyErr_SetString(PyExc_RuntimeError, "GAOptimization.getProgress: invalid configuration settings");
+            return NULL;
+        }
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        Py_RETURN_NONE;
+    }
+
+    return Py_BuildValue(CHAR_PTR_CAST "(Idkd)", generation, bestFitness, evaluations,
+                         seconds > 0.0 ? evaluations / seconds : 0.0);
+}
+
 static PyObject* getMonitorString(PyObject* object) {
     GAOptimizationObject *self = (GAOptimizationObject*) object;
 
@@ -1898,6 +2463,40 @@ static PyObject* getBestIndiString(PyObject* object) {
     }
 }
 
+static PyObject* getParetoFront(PyObject* object) {
+    GAOptimizationObject *self = (GAOptimizationObject*) object;
+    std::vector<GAParetoPoint> front;
+
+    try {
+        if ( self->selection != NULL && self->weighting == NULL) {
+            front = self->selection->getParetoFront();
+        } else if ( self->weighting != NULL && self->selection == NULL) {
+            front = self->weighting->getParetoFront();
+        } else {
+            PyErr_SetString(PyExc_RuntimeError, "GAOptimization.getParetoFront: invalid configuration settings");
+            return NULL;
+        }
+    } catch (std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+
+    PyObject *result = PyList_New(front.size());
+    for (size_t i = 0; i < front.size(); ++i) {
+        PyObject *values = PyList_New(front[i].genes.size());
+        for (size_t k = 0; k < front[i].genes.size(); ++k) {
+            if (self->selection != NULL) {
+                PyList_SET_ITEM(values, k, PyInt_FromLong((long) front[i].genes[k]));
+            } else {
+                PyList_SET_ITEM(values, k, PyFloat_FromDouble(front[i].genes[k]));
+            }
+        }
+        PyList_SET_ITEM(result, i, Py_BuildValue(CHAR_PTR_CAST "(dIN)", front[i].fitness,
+                                                 front[i].features, values));
+    }
+    return result;
+}
+
 void init_GAOptimizationType(PyObject *d) {
     GAOptimizationType.ob_type = &PyType_Type;
     GAOptimizationType.tp_name = CHAR_PTR_CAST "gamera.knnga.GAOptimization";
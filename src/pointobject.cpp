@@ -20,12 +20,14 @@
 
 #define GAMERACORE_INTERNAL
 #include "gameramodule.hpp"
+#include "object_freelist.hpp"
 
 using namespace Gamera;
 
 extern "C" {
   static PyObject* point_new(PyTypeObject* pytype, PyObject* args,
 			    PyObject* kwds);
+  static PyObject* point_alloc(PyTypeObject* pytype, Py_ssize_t nitems);
   static void point_dealloc(PyObject* self);
   // get/set
   static int point_set_x(PyObject* self, PyObject* value);
@@ -46,6 +48,8 @@ static PyTypeObject PointType = {
 
 static PyNumberMethods point_number_methods;
 
+static ObjectFreeList<> point_free_list(&PointType);
+
 static PyGetSetDef point_getset[] = {
   { (char *)"x", (getter)point_get_x, (setter)point_set_x, (char *)"(int property)\n\nThe current x value", 0},
   { (char *)"y", (getter)point_get_y, (setter)point_set_y, (char *)"(int property)\n\nThe current y value", 0},
@@ -63,10 +67,14 @@ PyTypeObject* get_PointType() {
   return &PointType;
 }
 
-static PyObject* _point_new(PyTypeObject* pytype, Point *p) {
+static PyObject* point_alloc(PyTypeObject* pytype, Py_ssize_t nitems) {
+  return point_free_list.alloc(pytype, nitems);
+}
+
+static PyObject* _point_new(PyTypeObject* pytype, const Point& p) {
   PointObject* so;
   so = (PointObject*)pytype->tp_alloc(pytype, 0);
-  so->m_x = p;
+  so->m_x = new (so->m_value.get()) Point(p);
   return (PyObject*)so;
 }
 
@@ -76,7 +84,7 @@ static PyObject* point_new(PyTypeObject* pytype, PyObject* args,
   if (num_args == 2) {
     int x, y;
     if (PyArg_ParseTuple(args, CHAR_PTR_CAST "ii", &x, &y))
-      return _point_new(pytype, new Point((size_t)x, (size_t)y));
+      return _point_new(pytype, Point((size_t)x, (size_t)y));
   }
 
   PyErr_Clear();
@@ -85,7 +93,7 @@ static PyObject* point_new(PyTypeObject* pytype, PyObject* args,
     PyObject* py_point;
     if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &py_point)) {
       try {
-	return _point_new(pytype, new Point(coerce_Point(py_point)));
+	return _point_new(pytype, coerce_Point(py_point));
       } catch (std::invalid_argument e) {
 	;
       }
@@ -99,8 +107,9 @@ static PyObject* point_new(PyTypeObject* pytype, PyObject* args,
 
 static void point_dealloc(PyObject* self) {
   PointObject* x = (PointObject*)self;
-  delete x->m_x;
-  self->ob_type->tp_free(self);
+  if (x->m_x != x->m_value.get())
+    delete x->m_x;
+  point_free_list.release(self);
 }
 
 #define CREATE_GET_FUNC(name) static PyObject* point_get_##name(PyObject* self) {\
@@ -213,7 +222,7 @@ void init_PointType(PyObject* module_dict) {
   PointType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE;
   PointType.tp_new = point_new;
   PointType.tp_getattro = PyObject_GenericGetAttr;
-  PointType.tp_alloc = NULL; // PyType_GenericAlloc;
+  PointType.tp_alloc = point_alloc;
   PointType.tp_richcompare = point_richcompare;
   PointType.tp_getset = point_getset;
   PointType.tp_free = NULL; // _PyObject_Del;
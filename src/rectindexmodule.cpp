@@ -0,0 +1,467 @@
+/*
+ *
+ * Copyright (C) 2001-2005 Ichiro Fujinaga, Michael Droettboom, and Karl MacMillan
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <Python.h>
+#include "gameramodule.hpp"
+#include "geostructs/rectindex.hpp"
+#include <map>
+#include <cstdio>
+
+
+//======================================================================
+// common part of RectTree and RectGrid
+//======================================================================
+
+struct RectIndexObject {
+  PyObject_HEAD
+  Rectindex::RectIndex* index;
+  // the Python object of each rect in the index (NULL when removed)
+  std::vector<PyObject*>* objects;
+  // the position of each object in *objects* (only for RectGrid)
+  std::map<PyObject*, size_t>* positions;
+};
+
+extern "C" {
+  static PyObject* recttree_new(PyTypeObject* pytype, PyObject* args,
+                                PyObject* kwds);
+  static PyObject* rectgrid_new(PyTypeObject* pytype, PyObject* args,
+                                PyObject* kwds);
+  static void rectindex_dealloc(PyObject* self);
+}
+
+static PyTypeObject RectTreeType = {
+  PyObject_HEAD_INIT(NULL)
+  0,
+};
+
+static PyTypeObject RectGridType = {
+  PyObject_HEAD_INIT(NULL)
+  0,
+};
+
+// copies the rects of the Rect objects (or images) in the sequence
+// *list* into *rects*; returns the sequence as a new list or NULL
+// and sets a Python exception on errors
+static PyObject* rectindex_parse_rects(PyObject* list, Rectindex::RectVector &rects,
+                                       const char* classname) {
+  PyObject *seq, *entry;
+  size_t i, n;
+  char msg[128];
+  sprintf(msg, "%s: given objects must be a list of Rects or images", classname);
+  seq = PySequence_Fast(list, msg);
+  if (seq == NULL)
+    return NULL;
+  n = PySequence_Fast_GET_SIZE(seq);
+  for (i = 0; i < n; i++) {
+    entry = PySequence_Fast_GET_ITEM(seq, i);
+    if (!is_RectObject(entry)) {
+      PyErr_SetString(PyExc_TypeError, msg);
+      Py_DECREF(seq);
+      return NULL;
+    }
+    rects.push_back(*((RectObject*)entry)->m_x);
+  }
+  return seq;
+}
+
+static RectIndexObject* rectindex_create(PyTypeObject* type, PyObject* seq,
+                                         Rectindex::RectIndex* index) {
+  RectIndexObject* self;
+  PyObject* entry;
+  size_t i, n;
+  n = PySequence_Fast_GET_SIZE(seq);
+  self = (RectIndexObject*)(type->tp_alloc(type, 0));
+  self->index = index;
+  self->objects = new std::vector<PyObject*>(n);
+  self->positions = NULL;
+  for (i = 0; i < n; i++) {
+    entry = PySequence_Fast_GET_ITEM(seq, i);
+    Py_INCREF(entry);
+    (*self->objects)[i] = entry;
+  }
+  return self;
+}
+
+static void rectindex_dealloc(PyObject* self) {
+  RectIndexObject* so = (RectIndexObject*)self;
+  size_t i;
+  for (i = 0; i < so->objects->size(); i++) {
+    Py_XDECREF((*so->objects)[i]);
+  }
+  delete so->objects;
+  delete so->positions;
+  delete so->index;
+  self->ob_type->tp_free(self);
+}
+
+// converts the found indices into a list of the Python objects
+static PyObject* rectindex_result_list(RectIndexObject* so,
+                                       const Rectindex::IndexVector &result) {
+  PyObject *list, *entry;
+  size_t i;
+  list = PyList_New(result.size());
+  for (i = 0; i < result.size(); i++) {
+    entry = (*so->objects)[result[i]];
+    Py_INCREF(entry);
+    PyList_SetItem(list, i, entry);
+  }
+  return list;
+}
+
+static bool rectindex_parse_rect(PyObject* obj, Rect &rect, const char* funcname) {
+  char msg[128];
+  if (!is_RectObject(obj)) {
+    sprintf(msg, "%s: given rect must be a Rect or an image", funcname);
+    PyErr_SetString(PyExc_TypeError, msg);
+    return false;
+  }
+  rect = *((RectObject*)obj)->m_x;
+  return true;
+}
+
+static PyObject* rectindex_intersecting(PyObject* self, PyObject* args) {
+  RectIndexObject* so = (RectIndexObject*)self;
+  PyObject* obj;
+  Rect rect;
+  Rectindex::IndexVector result;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O:intersecting", &obj) <= 0)
+    return 0;
+  if (!rectindex_parse_rect(obj, rect, "intersecting"))
+    return 0;
+  so->index->intersecting(rect, &result);
+  return rectindex_result_list(so, result);
+}
+
+static PyObject* rectindex_within_distance(PyObject* self, PyObject* args) {
+  RectIndexObject* so = (RectIndexObject*)self;
+  PyObject* obj;
+  double d;
+  Rect rect;
+  Rectindex::IndexVector result;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "Od:within_distance", &obj, &d) <= 0)
+    return 0;
+  if (!rectindex_parse_rect(obj, rect, "within_distance"))
+    return 0;
+  so->index->within_distance(rect, d, &result);
+  return rectindex_result_list(so, result);
+}
+
+static PyObject* rectindex_k_nearest(PyObject* self, PyObject* args) {
+  RectIndexObject* so = (RectIndexObject*)self;
+  PyObject* obj;
+  int k;
+  Rect rect;
+  Rectindex::IndexVector result;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "Oi:k_nearest", &obj, &k) <= 0)
+    return 0;
+  if (!rectindex_parse_rect(obj, rect, "k_nearest"))
+    return 0;
+  if (k < 0) {
+    PyErr_SetString(PyExc_ValueError, "k_nearest: k must not be negative");
+    return 0;
+  }
+  so->index->k_nearest(rect, (size_t)k, &result);
+  return rectindex_result_list(so, result);
+}
+
+#define RECTINDEX_SEARCH_METHODS \
+  { (char *)"intersecting", rectindex_intersecting, METH_VARARGS, \
+    (char *)"**intersecting** (*rect*)\n\nReturns all objects whose bounding box intersects *rect*, in the order in which they were added to the index. *rect* can be a ``Rect`` or an image, and is found itself when it is in the index." }, \
+  { (char *)"within_distance", rectindex_within_distance, METH_VARARGS, \
+    (char *)"**within_distance** (*rect*, *distance*)\n\nReturns all objects whose bounding box is within *distance* of *rect*, in the order in which they were added to the index. The distance between two rects is the euclidean distance between their closest pixels, and is zero when they intersect." }, \
+  { (char *)"k_nearest", rectindex_k_nearest, METH_VARARGS, \
+    (char *)"**k_nearest** (*rect*, *k*)\n\nReturns the *k* objects whose bounding boxes are closest to *rect*, the closest first. Objects at the same distance are returned in the order in which they were added to the index. The distance is measured as in ``within_distance``." }
+
+
+//======================================================================
+// interface for RectTree class
+//======================================================================
+
+static PyObject* recttree_new(PyTypeObject* pytype, PyObject* args, PyObject* kwds) {
+  PyObject *list, *seq;
+  int node_size = 16;
+  Rectindex::RectVector rects;
+  RectIndexObject* self;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O|i:RectTree", &list, &node_size) <= 0)
+    return 0;
+  if (node_size < 2) {
+    PyErr_SetString(PyExc_ValueError, "RectTree: node_size must be at least 2");
+    return 0;
+  }
+  seq = rectindex_parse_rects(list, rects, "RectTree");
+  if (seq == NULL)
+    return 0;
+  self = rectindex_create(pytype, seq,
+                          new Rectindex::RectTree(rects, (size_t)node_size));
+  Py_DECREF(seq);
+  return (PyObject*)self;
+}
+
+PyMethodDef recttree_methods[] = {
+  RECTINDEX_SEARCH_METHODS,
+  { NULL }
+};
+
+void init_RectTreeType(PyObject* d) {
+  RectTreeType.ob_type = &PyType_Type;
+  RectTreeType.tp_name = CHAR_PTR_CAST "gamera.rectindex.RectTree";
+  RectTreeType.tp_basicsize = sizeof(RectIndexObject);
+  RectTreeType.tp_dealloc = rectindex_dealloc;
+  RectTreeType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE;
+  RectTreeType.tp_new = recttree_new;
+  RectTreeType.tp_getattro = PyObject_GenericGetAttr;
+  RectTreeType.tp_alloc = NULL; // PyType_GenericAlloc;
+  RectTreeType.tp_free = NULL; // _PyObject_Del;
+  RectTreeType.tp_methods = recttree_methods;
+  RectTreeType.tp_weaklistoffset = 0;
+  RectTreeType.tp_doc = CHAR_PTR_CAST
+    "**RectTree** (*objects*, *node_size* = 16)\n\n"        \
+    "The ``RectTree`` constructor builds an R-tree over the bounding boxes of the given list of ``Rect``'s or images (e.g. connected components) in *O(n*log(n))* time.\n\n" \
+    "The tree is bulk loaded with the Sort-Tile-Recursive method, and each node has at most *node_size* entries. It cannot be altered once it is built; use a ``RectGrid`` when objects are to be added, moved or removed between searches.";
+
+  PyType_Ready(&RectTreeType);
+  PyDict_SetItemString(d, "RectTree", (PyObject*)&RectTreeType);
+}
+
+
+//======================================================================
+// interface for RectGrid class
+//======================================================================
+
+static PyObject* rectgrid_new(PyTypeObject* pytype, PyObject* args, PyObject* kwds) {
+  PyObject *list, *seq;
+  int cell_size = 0;
+  size_t i;
+  Rectindex::RectVector rects;
+  RectIndexObject* self;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O|i:RectGrid", &list, &cell_size) <= 0)
+    return 0;
+  if (cell_size < 0) {
+    PyErr_SetString(PyExc_ValueError, "RectGrid: cell_size must not be negative");
+    return 0;
+  }
+  seq = rectindex_parse_rects(list, rects, "RectGrid");
+  if (seq == NULL)
+    return 0;
+  self = rectindex_create(pytype, seq,
+                          new Rectindex::RectGrid(rects, (size_t)cell_size));
+  Py_DECREF(seq);
+  self->positions = new std::map<PyObject*, size_t>();
+  for (i = 0; i < self->objects->size(); i++) {
+    if (!self->positions->insert(std::make_pair((*self->objects)[i], i)).second) {
+      PyErr_SetString(PyExc_ValueError, "RectGrid: the same object is given twice");
+      Py_DECREF(self);
+      return 0;
+    }
+  }
+  return (PyObject*)self;
+}
+
+// position of *obj* in the grid, or -1 with a Python exception set
+static long rectgrid_position(RectIndexObject* so, PyObject* obj, const char* funcname) {
+  char msg[128];
+  std::map<PyObject*, size_t>::iterator it = so->positions->find(obj);
+  if (it == so->positions->end()) {
+    sprintf(msg, "RectGrid.%s: object is not in the grid", funcname);
+    PyErr_SetString(PyExc_KeyError, msg);
+    return -1;
+  }
+  return (long)it->second;
+}
+
+static PyObject* rectgrid_add(PyObject* self, PyObject* args) {
+  RectIndexObject* so = (RectIndexObject*)self;
+  PyObject* obj;
+  Rect rect;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O:add", &obj) <= 0)
+    return 0;
+  if (!rectindex_parse_rect(obj, rect, "RectGrid.add"))
+    return 0;
+  if (so->positions->find(obj) != so->positions->end()) {
+    PyErr_SetString(PyExc_ValueError, "RectGrid.add: object is already in the grid");
+    return 0;
+  }
+  (*so->positions)[obj] = ((Rectindex::RectGrid*)so->index)->add(rect);
+  so->objects->push_back(obj);
+  Py_INCREF(obj);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* rectgrid_update(PyObject* self, PyObject* args) {
+  RectIndexObject* so = (RectIndexObject*)self;
+  PyObject* obj;
+  Rect rect;
+  long i;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O:update", &obj) <= 0)
+    return 0;
+  if ((i = rectgrid_position(so, obj, "update")) < 0)
+    return 0;
+  rect = *((RectObject*)obj)->m_x;
+  ((Rectindex::RectGrid*)so->index)->update((size_t)i, rect);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* rectgrid_remove(PyObject* self, PyObject* args) {
+  RectIndexObject* so = (RectIndexObject*)self;
+  PyObject* obj;
+  long i;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O:remove", &obj) <= 0)
+    return 0;
+  if ((i = rectgrid_position(so, obj, "remove")) < 0)
+    return 0;
+  ((Rectindex::RectGrid*)so->index)->remove((size_t)i);
+  so->positions->erase(obj);
+  (*so->objects)[i] = NULL;
+  Py_DECREF(obj);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+PyMethodDef rectgrid_methods[] = {
+  RECTINDEX_SEARCH_METHODS,
+  { (char *)"add", rectgrid_add, METH_VARARGS,
+    (char *)"**add** (*object*)\n\nAdds a ``Rect`` or an image to the grid. It is found by searches after all objects that were added before." },
+  { (char *)"update", rectgrid_update, METH_VARARGS,
+    (char *)"**update** (*object*)\n\nRereads the bounding box of an object in the grid. The grid only knows the bounding box that an object had when it was added or last updated, so this must be called after the object has been moved or resized (e.g. with ``union``)." },
+  { (char *)"remove", rectgrid_remove, METH_VARARGS,
+    (char *)"**remove** (*object*)\n\nRemoves an object from the grid." },
+  { NULL }
+};
+
+void init_RectGridType(PyObject* d) {
+  RectGridType.ob_type = &PyType_Type;
+  RectGridType.tp_name = CHAR_PTR_CAST "gamera.rectindex.RectGrid";
+  RectGridType.tp_basicsize = sizeof(RectIndexObject);
+  RectGridType.tp_dealloc = rectindex_dealloc;
+  RectGridType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE;
+  RectGridType.tp_new = rectgrid_new;
+  RectGridType.tp_getattro = PyObject_GenericGetAttr;
+  RectGridType.tp_alloc = NULL; // PyType_GenericAlloc;
+  RectGridType.tp_free = NULL; // _PyObject_Del;
+  RectGridType.tp_methods = rectgrid_methods;
+  RectGridType.tp_weaklistoffset = 0;
+  RectGridType.tp_doc = CHAR_PTR_CAST
+    "**RectGrid** (*objects*, *cell_size* = 0)\n\n"        \
+    "The ``RectGrid`` constructor builds a uniform grid of square cells over the bounding boxes of the given list of ``Rect``'s or images (e.g. connected components). Each object is registered in all cells that it overlaps.\n\n" \
+    "When *cell_size* is 0 (default), the cell size is the average extent of the objects. Unlike a ``RectTree``, objects can be added, moved and removed after construction.";
+
+  PyType_Ready(&RectGridType);
+  PyDict_SetItemString(d, "RectGrid", (PyObject*)&RectGridType);
+}
+
+
+//======================================================================
+// text sections and lines
+//======================================================================
+
+static PyObject* rectindex_find_text_sections(PyObject* self, PyObject* args) {
+  PyObject *list, *areas, *page_obj, *seq, *area_seq, *result;
+  double search_size;
+  Rectindex::RectVector glyphs;
+  std::vector<double> black_areas;
+  std::vector<long> sections;
+  Rect page;
+  size_t i;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "OOdO:find_text_sections",
+                       &list, &areas, &search_size, &page_obj) <= 0)
+    return 0;
+  if (!rectindex_parse_rect(page_obj, page, "find_text_sections"))
+    return 0;
+  seq = rectindex_parse_rects(list, glyphs, "find_text_sections");
+  if (seq == NULL)
+    return 0;
+  Py_DECREF(seq);
+  area_seq = PySequence_Fast(areas, "find_text_sections: black_areas must be a list of numbers");
+  if (area_seq == NULL)
+    return 0;
+  if ((size_t)PySequence_Fast_GET_SIZE(area_seq) != glyphs.size()) {
+    Py_DECREF(area_seq);
+    PyErr_SetString(PyExc_ValueError, "find_text_sections: there must be one black area per glyph");
+    return 0;
+  }
+  for (i = 0; i < glyphs.size(); i++) {
+    black_areas.push_back(PyFloat_AsDouble(PySequence_Fast_GET_ITEM(area_seq, i)));
+    if (PyErr_Occurred()) {
+      Py_DECREF(area_seq);
+      return 0;
+    }
+  }
+  Py_DECREF(area_seq);
+  Rectindex::find_text_sections(glyphs, black_areas, search_size, page, &sections);
+  result = PyList_New(sections.size());
+  for (i = 0; i < sections.size(); i++)
+    PyList_SET_ITEM(result, i, PyInt_FromLong(sections[i]));
+  return result;
+}
+
+static PyObject* rectindex_index_list(const Rectindex::IndexVector& indices) {
+  PyObject* list = PyList_New(indices.size());
+  for (size_t i = 0; i < indices.size(); i++)
+    PyList_SET_ITEM(list, i, PyInt_FromLong((long)indices[i]));
+  return list;
+}
+
+static PyObject* rectindex_find_text_lines(PyObject* self, PyObject* args) {
+  PyObject *list, *seq, *lines_list, *result;
+  double tall_deviation = 20.0;
+  Rectindex::RectVector glyphs;
+  std::vector<Rectindex::IndexVector> lines;
+  Rectindex::IndexVector lost;
+  size_t i;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O|d:find_text_lines",
+                       &list, &tall_deviation) <= 0)
+    return 0;
+  seq = rectindex_parse_rects(list, glyphs, "find_text_lines");
+  if (seq == NULL)
+    return 0;
+  Py_DECREF(seq);
+  Rectindex::find_text_lines(glyphs, tall_deviation, &lines, &lost);
+  lines_list = PyList_New(lines.size());
+  for (i = 0; i < lines.size(); i++)
+    PyList_SET_ITEM(lines_list, i, rectindex_index_list(lines[i]));
+  result = Py_BuildValue(CHAR_PTR_CAST "(NN)", lines_list, rectindex_index_list(lost));
+  return result;
+}
+
+
+//======================================================================
+// interface for python module
+//======================================================================
+
+extern "C" {
+  DL_EXPORT(void) initrectindex(void);
+}
+
+PyMethodDef rectindex_module_methods[] = {
+  { (char *)"find_text_sections", rectindex_find_text_sections, METH_VARARGS,
+    (char *)"**find_text_sections** (*glyphs*, *black_areas*, *search_size*, *page*)\n\nGroups the glyphs of a text page into sections, and returns the number of the section of each glyph (-1 for the glyphs left out). This is the section finding of ``roman_text.Page``: the glyphs whose black area (given in the list *black_areas*) is at most the average extent *e* of the glyphs (times *search_size*), or whose width or height is at least 20 *e*, are left out. The others are expanded by *e* on all sides (up to the lower right of the rect *page*), and merged with all expanded glyphs or sections that they intersect until the sections do not intersect." },
+  { (char *)"find_text_lines", rectindex_find_text_lines, METH_VARARGS,
+    (char *)"**find_text_lines** (*glyphs*, *tall_deviation* = 20)\n\nGroups the glyphs of a text section into lines, and returns a tuple (*lines*, *lost*) of the lines, each as a list of glyph indices, and the indices of the tall glyphs that are in no line. This is the line finding of ``roman_text.Section``: the glyphs whose height differs from the average height by more than twice *tall_deviation* are set aside, each other glyph is put into the first line whose vertical extent contains its center, and intersecting lines are merged. Then each tall glyph goes into the first line containing its top. The glyphs of a line are ordered by their left edge, except in merged lines without tall glyphs, which list the glyphs of the merged lines one after the other." },
+  {NULL}
+};
+
+DL_EXPORT(void) initrectindex(void) {
+  PyObject* m = Py_InitModule(CHAR_PTR_CAST "gamera.rectindex", rectindex_module_methods);
+  PyObject* d = PyModule_GetDict(m);
+
+  init_RectTreeType(d);
+  init_RectGridType(d);
+}
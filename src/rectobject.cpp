@@ -19,6 +19,7 @@
 
 #define GAMERACORE_INTERNAL
 #include "gameramodule.hpp"
+#include "object_freelist.hpp"
 #include <exception>
 
 using namespace Gamera;
@@ -26,6 +27,7 @@ using namespace Gamera;
 extern "C" {
   static PyObject* rect_new(PyTypeObject* pytype, PyObject* args,
 			    PyObject* kwds);
+  static PyObject* rect_alloc(PyTypeObject* pytype, Py_ssize_t nitems);
   static void rect_dealloc(PyObject* self);
   // get
   static PyObject* rect_get_ul(PyObject* self);
@@ -99,6 +101,8 @@ static PyTypeObject RectType = {
   0,
 };
 
+static ObjectFreeList<> rect_free_list(&RectType);
+
 static PyGetSetDef rect_getset[] = {
   {(char *)"ul", (getter)rect_get_ul, (setter)rect_set_ul,
   (char *)"(Point property)\n\nThe upper-left coordinate of the rectangle in logical coordinate space."},
@@ -190,10 +194,14 @@ extern PyTypeObject* get_RectType() {
   return &RectType;
 }
 
-static PyObject* _rect_new(PyTypeObject* pytype, Rect* rect) {
+static PyObject* rect_alloc(PyTypeObject* pytype, Py_ssize_t nitems) {
+  return rect_free_list.alloc(pytype, nitems);
+}
+
+static PyObject* _rect_new(PyTypeObject* pytype, const Rect& rect) {
   RectObject* so;
   so = (RectObject*)pytype->tp_alloc(pytype, 0);
-  so->m_x = rect;
+  so->m_x = new (so->m_value.get()) Rect(rect);
   return (PyObject*)so;
 }
 
@@ -212,13 +220,13 @@ static PyObject* rect_new(PyTypeObject* pytype, PyObject* args,
 
       try {
 	Point point_b = coerce_Point(b);
-	return _rect_new(pytype, new Rect(point_a, point_b));
+	return _rect_new(pytype, Rect(point_a, point_b));
       } catch (std::invalid_argument e) {
 	PyErr_Clear();
 	if (is_SizeObject(b)) {
-	  return _rect_new(pytype, new Rect(point_a, *((SizeObject*)b)->m_x));
+	  return _rect_new(pytype, Rect(point_a, *((SizeObject*)b)->m_x));
 	} else if (is_DimObject(b)) {
-	  return _rect_new(pytype, new Rect(point_a, *((DimObject*)b)->m_x));
+	  return _rect_new(pytype, Rect(point_a, *((DimObject*)b)->m_x));
 	}
       }
     }
@@ -231,7 +239,7 @@ static PyObject* rect_new(PyTypeObject* pytype, PyObject* args,
     PyObject* other;
     if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O", &other)) {
       if (is_RectObject(other)) {
-	return _rect_new(pytype, new Rect(*((RectObject*)other)->m_x));
+	return _rect_new(pytype, *((RectObject*)other)->m_x);
       }
     }
   }
@@ -239,7 +247,7 @@ static PyObject* rect_new(PyTypeObject* pytype, PyObject* args,
   PyErr_Clear();
 
   if (num_args == 0) {
-    return _rect_new(pytype, new Rect());
+    return _rect_new(pytype, Rect());
   }
 
   PyErr_Clear();
@@ -249,8 +257,11 @@ static PyObject* rect_new(PyTypeObject* pytype, PyObject* args,
 
 static void rect_dealloc(PyObject* self) {
   RectObject* x = (RectObject*)self;
-  delete x->m_x;
-  self->ob_type->tp_free(self);
+  if (x->m_x == x->m_value.get())
+    x->m_value.get()->~Rect();
+  else
+    delete x->m_x;
+  rect_free_list.release(self);
 }
 
 /*
@@ -476,10 +487,7 @@ static PyObject* rect_expand(PyObject* self, PyObject* args) {
   long size;
   if (PyArg_ParseTuple(args, CHAR_PTR_CAST "i:expand", &size) <= 0)
     return 0;
-  PyTypeObject* pytype = get_RectType();
-  RectObject* so = (RectObject*)pytype->tp_alloc(pytype, 0);
-  so->m_x = new Rect(x->expand(size));
-  return (PyObject*)so;
+  return _rect_new(get_RectType(), x->expand(size));
 }
 
 static PyObject* rect_intersects_x(PyObject* self, PyObject* args) {
@@ -545,10 +553,7 @@ static PyObject* rect_intersection (PyObject* self, PyObject* args) {
     PyErr_SetString(PyExc_TypeError, "Argument must be a Rect object.");
     return 0;
   }
-  PyTypeObject* pytype = get_RectType();
-  RectObject* so = (RectObject*)pytype->tp_alloc(pytype, 0);
-  so->m_x = new Rect(x->intersection(*((RectObject*)rect)->m_x));
-  return (PyObject*)so;
+  return _rect_new(get_RectType(), x->intersection(*((RectObject*)rect)->m_x));
 }
 
 static PyObject* rect_union_rects(PyObject* _ /* staticmethod */, PyObject* l) {
@@ -567,10 +572,10 @@ static PyObject* rect_union_rects(PyObject* _ /* staticmethod */, PyObject* l) {
     vec[i] = ((RectObject *)py_rect)->m_x;
   }
   Py_DECREF(seq);
-  PyTypeObject* pytype = get_RectType();
-  RectObject* so = (RectObject*)pytype->tp_alloc(pytype, 0);
-  so->m_x = Rect::union_rects(vec);
-  return (PyObject*)so;
+  Rect* rect = Rect::union_rects(vec);
+  PyObject* so = _rect_new(get_RectType(), *rect);
+  delete rect;
+  return so;
 }
 
 static PyObject* rect_union(PyObject* self, PyObject* args) {
@@ -695,7 +700,7 @@ void init_RectType(PyObject* module_dict) {
   RectType.tp_getset = rect_getset;
   RectType.tp_new = rect_new;
   RectType.tp_getattro = PyObject_GenericGetAttr;
-  RectType.tp_alloc = NULL;
+  RectType.tp_alloc = rect_alloc;
   RectType.tp_richcompare = rect_richcompare;
   RectType.tp_free = NULL;
   RectType.tp_repr = rect_repr;
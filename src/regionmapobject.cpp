@@ -27,6 +27,7 @@ extern "C" {
 			     PyObject* kwds);
   static void regionmap_dealloc(PyObject* self);
   static PyObject* regionmap_lookup(PyObject* self, PyObject* args);
+  static PyObject* regionmap_lookup_list(PyObject* self, PyObject* args);
   static PyObject* regionmap_add_region(PyObject* self, PyObject* args);
   static PyObject* regionmap___getitem__(PyObject* self, Py_ssize_t index);
   static Py_ssize_t regionmap___len__(PyObject* self);
@@ -43,6 +44,7 @@ static PySequenceMethods RegionMapSequenceMethods = {
 
 static PyMethodDef regionmap_methods[] = {
   { CHAR_PTR_CAST "lookup", regionmap_lookup, METH_VARARGS },
+  { CHAR_PTR_CAST "lookup_list", regionmap_lookup_list, METH_VARARGS },
   { CHAR_PTR_CAST "add_region", regionmap_add_region, METH_VARARGS },
   { NULL }
 };
@@ -79,8 +81,47 @@ static PyObject* regionmap_lookup(PyObject* self, PyObject* args) {
     return 0;
   }
   RegionMapObject* r = (RegionMapObject*)self;
-  Region tmp = r->m_x->lookup(*((RectObject*)key)->m_x);
-  return create_RegionObject(tmp);
+  try {
+    Region tmp = r->m_x->lookup(*((RectObject*)key)->m_x);
+    return create_RegionObject(tmp);
+  } catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+}
+
+/*
+  Looks up the regions of a whole list of rectangles (or glyphs) at
+  once and returns the list of the regions found.
+*/
+static PyObject* regionmap_lookup_list(PyObject* self, PyObject* args) {
+  PyObject* keys;
+  if (PyArg_ParseTuple(args, CHAR_PTR_CAST "O:lookup_list", &keys) <= 0)
+    return 0;
+  PyObject* seq = PySequence_Fast(keys, "Argument must be a sequence of Rects!");
+  if (seq == 0)
+    return 0;
+  Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+  for (Py_ssize_t i = 0; i < n; ++i) {
+    if (!is_RectObject(PySequence_Fast_GET_ITEM(seq, i))) {
+      Py_DECREF(seq);
+      PyErr_SetString(PyExc_TypeError, "Keys must be Rects!");
+      return 0;
+    }
+  }
+  RegionMap* r = ((RegionMapObject*)self)->m_x;
+  if (n > 0 && r->empty()) {
+    Py_DECREF(seq);
+    PyErr_SetString(PyExc_RuntimeError, "RegionMap is empty.");
+    return 0;
+  }
+  PyObject* result = PyList_New(n);
+  for (Py_ssize_t i = 0; i < n; ++i) {
+    Rect* key = ((RectObject*)PySequence_Fast_GET_ITEM(seq, i))->m_x;
+    PyList_SET_ITEM(result, i, create_RegionObject(*r->lookup_region(*key)));
+  }
+  Py_DECREF(seq);
+  return result;
 }
 
 static PyObject* regionmap_add_region(PyObject* self, PyObject* args) {
@@ -19,12 +19,14 @@
 
 #define GAMERACORE_INTERNAL
 #include "gameramodule.hpp"
+#include "object_freelist.hpp"
 
 using namespace Gamera;
 
 extern "C" {
   static PyObject* size_new(PyTypeObject* pytype, PyObject* args,
 			    PyObject* kwds);
+  static PyObject* size_alloc(PyTypeObject* pytype, Py_ssize_t nitems);
   static void size_dealloc(PyObject* self);
   static PyObject* size_get_width(PyObject* self);
   static int size_set_width(PyObject* self, PyObject* value);
@@ -39,6 +41,8 @@ static PyTypeObject SizeType = {
   0,
 };
 
+static ObjectFreeList<> size_free_list(&SizeType);
+
 static PyGetSetDef size_getset[] = {
   { (char *)"width", (getter)size_get_width, (setter)size_set_width,
     (char *)"(int property)\n\nThe width of an object is the right boundary minus the left. This is the same as the number of columns *minus one.*", 0 },
@@ -51,6 +55,10 @@ PyTypeObject* get_SizeType() {
   return &SizeType;
 }
 
+static PyObject* size_alloc(PyTypeObject* pytype, Py_ssize_t nitems) {
+  return size_free_list.alloc(pytype, nitems);
+}
+
 static PyObject* size_new(PyTypeObject* pytype, PyObject* args,
 			  PyObject* kwds) {
   int width, height;
@@ -58,14 +66,15 @@ static PyObject* size_new(PyTypeObject* pytype, PyObject* args,
     return 0;
   SizeObject* so;
   so = (SizeObject*)pytype->tp_alloc(pytype, 0);
-  so->m_x = new Size((size_t)width, (size_t)height);
+  so->m_x = new (so->m_value.get()) Size((size_t)width, (size_t)height);
   return (PyObject*)so;
 }
 
 static void size_dealloc(PyObject* self) {
   SizeObject* x = (SizeObject*)self;
-  delete x->m_x;
-  self->ob_type->tp_free(self);
+  if (x->m_x != x->m_value.get())
+    delete x->m_x;
+  size_free_list.release(self);
 }
 
 #define CREATE_GET_FUNC(name) static PyObject* size_get_##name(PyObject* self) {\
@@ -143,7 +152,7 @@ void init_SizeType(PyObject* module_dict) {
   SizeType.tp_getset = size_getset;
   SizeType.tp_new = size_new;
   SizeType.tp_getattro = PyObject_GenericGetAttr;
-  SizeType.tp_alloc = NULL; // PyType_GenericAlloc;
+  SizeType.tp_alloc = size_alloc;
   SizeType.tp_richcompare = size_richcompare;
   SizeType.tp_free = NULL; // _PyObject_Del;
   SizeType.tp_repr = size_repr;
@@ -0,0 +1,61 @@
+from gamera.core import *
+init_gamera()
+from gamera import batch
+
+def count_ccs(image, filename):
+    return len(image.to_onebit().cc_analysis())
+
+# the results come back in the order of the pages, whatever the workers
+def test_process_pages():
+    files = ["data/OneBit_generic.png", "data/GreyScale_generic.png"] * 3
+    expected = [count_ccs(load_image(f), f) for f in files]
+    for processes in (1, 2):
+        results = list(batch.process_pages(files, count_ccs, processes))
+        assert [f for f, x in results] == files
+        assert [x for f, x in results] == expected
+
+def fail(image, filename):
+    raise ValueError("no")
+
+def test_process_pages_error():
+    for processes in (1, 2):
+        try:
+            list(batch.process_pages(["data/OneBit_generic.png"], fail, processes))
+        except RuntimeError, e:
+            assert "ValueError" in str(e)
+        else:
+            assert False
+
+# the images are saved on the writer threads, also while they are changed
+def test_image_writer():
+    writer = batch.ImageWriter(threads=2, queue_size=2)
+    results = []
+    for ext, options in (("png", ()), ("png", (1, 1)), ("tiff", (1,))):
+        image = load_image("data/OneBit_generic.png")
+        raw = image._to_raw_string()
+        filename = "tmp/writer_test_%d.%s" % (len(results), ext)
+        results.append((writer.save(image, filename, options), raw))
+        image.fill(1)
+    writer.close()
+    for result, raw in results:
+        result.wait()
+        assert load_image(result.filename)._to_raw_string() == raw
+    try:
+        writer.save(image, "tmp/writer_test.png")
+    except RuntimeError:
+        pass
+    else:
+        assert False
+
+def test_image_writer_error():
+    writer = batch.ImageWriter()
+    result = writer.save(load_image("data/OneBit_generic.png"),
+                         "tmp/no_such_directory/writer_test.png")
+    try:
+        writer.wait()
+    except IOError:
+        pass
+    else:
+        assert False
+    assert result.done() and result.error is not None
+    writer.close()
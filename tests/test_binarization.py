@@ -0,0 +1,321 @@
+from gamera.core import *
+init_gamera()
+
+# the tiled (multi-threaded) thresholds must give the serial result
+def test_tiled_thresholds():
+    generic = load_image("data/GreyScale_generic.png")
+    # large enough for several tiles
+    img = Image((0, 0), (599, 399), GREYSCALE)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            img.set((x, y), generic.get((x % generic.ncols, y % generic.nrows)))
+    for region_size in (3, 15, 101):
+        serial = img.niblack_threshold(region_size, threads=1)
+        for threads in (0, 2, 3):
+            tiled = img.niblack_threshold(region_size, threads=threads)
+            assert tiled.to_string() == serial.to_string()
+        serial = img.sauvola_threshold(region_size, threads=1)
+        for threads in (0, 2, 3):
+            tiled = img.sauvola_threshold(region_size, threads=threads)
+            assert tiled.to_string() == serial.to_string()
+
+# streaming a TIFF file in bands must give the in-memory result
+def test_stream_binarize_tiff():
+    from gamera.plugins import tiff_support
+    img = load_image("data/GreyScale_generic.tiff")
+    expected = img.sauvola_threshold(9)
+    expected.despeckle(3)
+    for band_height in (1, 10, 1000):
+        tiff_support.stream_binarize_tiff("data/GreyScale_generic.tiff",
+                                          "tmp/stream_binarize.tiff",
+                                          9, despeckle_size=3,
+                                          band_height=band_height)
+        result = load_image("tmp/stream_binarize.tiff")
+        assert result.to_string() == expected.to_string()
+
+# the fused conversions must give the result of the two separate steps
+def test_to_onebit():
+    for name in ("RGB", "GreyScale", "Grey16"):
+        img = load_image("data/%s_generic.png" % name)
+        for im in (img, img.subimage((3, 5), (40, 30))):
+            expected = im.to_greyscale().otsu_threshold()
+            for storage_format in (DENSE, RLE):
+                onebit = im.to_onebit(storage_format)
+                assert onebit.data.storage_format == storage_format
+                assert onebit.to_string() == expected.to_string()
+
+# the histogram of a page large enough to be counted on several threads
+def test_histogram():
+    generic = load_image("data/GreyScale_generic.png")
+    img = Image((0, 0), (2099, 1999), GREYSCALE)
+    counts = [0] * 256
+    for y in range(img.nrows):
+        for x in range(0, img.ncols, 7):
+            value = generic.get((x % generic.ncols, y % generic.nrows))
+            img.set((x, y), value)
+            counts[value] += 1
+    counts[255] += img.nrows * img.ncols - sum(counts)
+    size = float(img.nrows * img.ncols)
+    assert list(img.histogram()) == [c / size for c in counts]
+    sub = img.subimage((5, 3), (40, 30))
+    counts = [0] * 256
+    for y in range(sub.nrows):
+        for x in range(sub.ncols):
+            counts[sub.get((x, y))] += 1
+    size = float(sub.nrows * sub.ncols)
+    assert list(sub.histogram()) == [c / size for c in counts]
+
+# the parallel block levels and colour histogram of djvu_threshold must
+# give the serial result
+def test_djvu_threshold_threads():
+    generic = load_image("data/RGB_generic.png")
+    img = Image((0, 0), (499, 299), RGB)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            img.set((x, y), generic.get((x % generic.ncols, y % generic.nrows)))
+    for (max_block_size, min_block_size) in ((512, 64), (64, 8), (100, 16)):
+        serial = img.djvu_threshold(0.2, max_block_size, min_block_size,
+                                    threads=1)
+        for threads in (0, 2, 3):
+            result = img.djvu_threshold(0.2, max_block_size, min_block_size,
+                                        threads=threads)
+            assert result.to_string() == serial.to_string()
+
+# the columns of White-Rohrer thresholding computed in parallel must give
+# the serial result, over several bands of rows
+def test_white_rohrer_threshold_threads():
+    generic = load_image("data/GreyScale_generic.png")
+    img = Image((0, 0), (1499, 199), GREYSCALE)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            img.set((x, y), generic.get((x % generic.ncols, y % generic.nrows)))
+    for (x_lookahead, y_lookahead, bias_mode) in ((8, 1, 0), (0, 0, 10),
+                                                  (30, 5, 0), (3, 250, 0)):
+        serial = img.white_rohrer_threshold(x_lookahead, y_lookahead,
+                                            bias_mode, threads=1)
+        for threads in (0, 2, 3):
+            result = img.white_rohrer_threshold(x_lookahead, y_lookahead,
+                                                bias_mode, threads=threads)
+            assert result.to_string() == serial.to_string()
+
+# the tabulated thresholds give the pixel by pixel formula of Gatos et al.,
+# and a sweep gives the single thresholds
+def test_gatos_threshold_sweep():
+    import math
+    img = load_image("data/GreyScale_generic.png")
+    binarization = img.niblack_threshold(15)
+    background = img.gatos_background(binarization, 15)
+    src = [img.get((x, y)) for y in range(img.nrows) for x in range(img.ncols)]
+    bg = [background.get((x, y)) for y in range(img.nrows) for x in range(img.ncols)]
+    black = [binarization.get((x, y)) for y in range(img.nrows) for x in range(img.ncols)]
+    delta = sum([(s - g) % 256 for (s, g) in zip(src, bg)]) / float(black.count(1))
+    b = sum([g for (g, m) in zip(bg, black) if not m]) / float(black.count(0))
+    parameters = [(0.6, 0.5, 0.8), (0.2, 0.1, 0.3), (1.5, 0.9, 1.0)]
+    results = img.gatos_threshold_sweep(background, binarization,
+                                        [p[0] for p in parameters],
+                                        [p[1] for p in parameters],
+                                        [p[2] for p in parameters])
+    for ((q, p1, p2), result) in zip(parameters, results):
+        single = img.gatos_threshold(background, binarization, q, p1, p2)
+        assert single.to_string() == result.to_string()
+        for i in range(len(src)):
+            t = q * delta * ((1 - p2) / (1 + math.exp(-4 * bg[i] / (b * (1 - p1))
+                                                      + 2 * (1 + p1) / (1 - p1))) + p2)
+            assert result.get((i % img.ncols, i / img.ncols)) == int(bg[i] - src[i] > t)
+
+# the sliding minimum and maximum of bernsen_threshold give the pixel by
+# pixel windows, in every storage format and for any number of threads
+def test_bernsen_threshold():
+    generic = load_image("data/GreyScale_generic.png")
+    # tall enough for several bands of rows
+    img = Image((0, 0), (29, 299), GREYSCALE)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            img.set((x, y), generic.get((x % generic.ncols, y % generic.nrows)))
+    src = [[img.get((x, y)) for x in range(img.ncols)] for y in range(img.nrows)]
+    for region_size in (1, 2, 7, 11):
+        h = region_size / 2
+        for (contrast_limit, doubt_to_black) in ((15, False), (80, True)):
+            expected = []
+            for y in range(img.nrows):
+                for x in range(img.ncols):
+                    window = []
+                    for dy in range(-h, h):
+                        yy = y + dy
+                        if yy < 0 or yy >= img.nrows:
+                            yy = y - dy
+                        for dx in range(-h, h):
+                            xx = x + dx
+                            if xx < 0 or xx >= img.ncols:
+                                xx = x - dx
+                            window.append(src[yy][xx])
+                    if window:
+                        low, high = min(window), max(window)
+                    else:
+                        low, high = 255, 0
+                    if (high - low) % 256 < contrast_limit:
+                        expected.append(int(doubt_to_black))
+                    else:
+                        expected.append(int(src[y][x] < (high + low) / 2))
+            for storage_format in (DENSE, RLE, PACKED):
+                for threads in (1, 3):
+                    result = img.bernsen_threshold(storage_format, region_size,
+                                                   contrast_limit,
+                                                   doubt_to_black, threads)
+                    assert result.data.storage_format == storage_format
+                    assert [result.get((x, y)) for y in range(img.nrows)
+                            for x in range(img.ncols)] == expected
+
+def _brink_reference(image):
+    # the criterion of Brink and Pendock summed over all levels
+    from math import log
+    histo = [0] * 256
+    for y in range(image.nrows):
+        for x in range(image.ncols):
+            histo[image.get((x, y))] += 1
+    total = float(sum(histo))
+    p = [h / total for h in histo]
+    best = None
+    for t in range(256):
+        m_f = sum([g * p[g] for g in range(t + 1)])
+        m_b = sum([g * p[g] for g in range(t + 1, 256)])
+        if m_f == 0 or m_b == 0:
+            continue
+        value = 0.0
+        for g in range(1, 256):
+            m = g <= t and m_f or m_b
+            value += p[g] * (m - g) * (log(m) - log(g))
+        if best is None or value < best[0]:
+            best = (value, t)
+    if best is None:
+        return 1
+    return best[1] + 1
+
+def test_brink_threshold():
+    img = load_image("data/GreyScale_generic.png")
+    t = _brink_reference(img)
+    expected = img.threshold(t)
+    assert img.brink_threshold().to_string() == expected.to_string()
+    # Grey16 images have the same threshold for the same histogram
+    assert img.to_grey16().brink_threshold().to_string() == expected.to_string()
+    # the tiles with several levels are thresholded on their own
+    result = img.brink_threshold(16)
+    for y in range(0, img.nrows, 16):
+        for x in range(0, img.ncols, 16):
+            rect = Rect((img.ul_x + x, img.ul_y + y),
+                        Dim(min(16, img.ncols - x), min(16, img.nrows - y)))
+            tile = img.subimage(rect)
+            if len([i for i, v in enumerate(tile.histogram()) if v and i]) > 1:
+                expected = tile.brink_threshold()
+            else:
+                expected = tile.threshold(t)
+            assert result.subimage(rect).to_string() == expected.to_string()
+
+def _region_stats(image, region_size):
+    # the mean and variance of the region around each pixel, summed
+    # pixel by pixel
+    h = region_size / 2
+    pixels = [[image.get((x, y)) for x in range(image.ncols)]
+              for y in range(image.nrows)]
+    stats = []
+    for y in range(image.nrows):
+        row = []
+        for x in range(image.ncols):
+            window = [pixels[yy][xx]
+                      for yy in range(max(0, y - h), min(y + h, image.nrows - 1) + 1)
+                      for xx in range(max(0, x - h), min(x + h, image.ncols - 1) + 1)]
+            mean = float(sum(window)) / len(window)
+            variance = float(sum([v * v for v in window])) / len(window) - mean * mean
+            row.append((pixels[y][x], mean, variance))
+        stats.append(row)
+    return stats
+
+def _noise_image(pixel_type, maximum):
+    import random
+    random.seed(25)
+    image = Image((7, 11), Dim(53, 41), pixel_type)
+    for y in range(image.nrows):
+        for x in range(image.ncols):
+            if pixel_type == FLOAT:
+                image.set((x, y), random.uniform(0, maximum))
+            else:
+                image.set((x, y), random.randint(0, maximum))
+    return image
+
+def _wiener(stats, noise_variance, convert=int):
+    if noise_variance < 0:
+        variances = sorted([v for row in stats for (p, m, v) in row])
+        noise_variance = variances[(len(variances) - 1) / 2]
+    result = []
+    for row in stats:
+        for (p, mean, variance) in row:
+            if variance < noise_variance:
+                result.append(convert(mean))
+            else:
+                multiplier = (variance - noise_variance) / variance
+                result.append(convert(mean + multiplier * (p - mean)))
+    return result
+
+def _pixels(image):
+    return [image.get((x, y)) for y in range(image.nrows) for x in range(image.ncols)]
+
+# the regional statistics taken from running sums give the sums over
+# each region, also on a view whose offset differs from that of its
+# image
+def test_region_statistics():
+    from math import sqrt
+    image = _noise_image(GREYSCALE, 255)
+    for img in (image, image.subimage((19, 16), Dim(30, 22))):
+        for region_size in (1, 2, 7, 15):
+            stats = _region_stats(img, region_size)
+            means = img.mean_filter(region_size)
+            assert _pixels(means) == [m for row in stats for (p, m, v) in row]
+            assert _pixels(img.variance_filter(means, region_size)) == \
+                   [v for row in stats for (p, m, v) in row]
+            if region_size > 1:
+                # (regions of one pixel have no variance to filter)
+                assert _pixels(img.wiener_filter(region_size, -1.0)) == \
+                       _wiener(stats, -1.0)
+            for threads in (1, 0):
+                niblack = []
+                sauvola = []
+                for row in stats:
+                    for (p, mean, variance) in row:
+                        if p < 20:
+                            niblack.append(1)
+                            sauvola.append(1)
+                        elif p >= 200:
+                            niblack.append(0)
+                            sauvola.append(0)
+                        else:
+                            deviation = sqrt(variance)
+                            niblack.append(int(not p > mean + -0.2 * deviation))
+                            sauvola.append(int(not p > mean + (1.0 - 0.5 * (1.0 - deviation / 128.0))))
+                assert _pixels(img.niblack_threshold(region_size, -0.2, 20, 200, threads)) == niblack
+                assert _pixels(img.sauvola_threshold(region_size, 0.5, 128, 20, 200, threads)) == sauvola
+
+# the Wiener filter with a given noise variance, and with the median of
+# the regional variances
+def test_wiener_filter():
+    for (pixel_type, maximum) in ((GREYSCALE, 255), (GREY16, 4000)):
+        image = _noise_image(pixel_type, maximum)
+        for img in (image, image.subimage((19, 16), Dim(30, 22))):
+            for region_size in (3, 8):
+                stats = _region_stats(img, region_size)
+                variances = sorted([v for row in stats for (p, m, v) in row])
+                for noise_variance in (-1.0, 0.0, variances[len(variances) / 4]):
+                    result = img.wiener_filter(region_size, noise_variance)
+                    assert result.data.pixel_type == pixel_type
+                    assert result.ul == img.ul and result.dim == img.dim
+                    assert _pixels(result) == _wiener(stats, noise_variance)
+                # above the largest variance, each pixel is the mean of
+                # its region
+                result = img.wiener_filter(region_size, variances[-1] + 1.0)
+                assert _pixels(result) == [int(m) for row in stats for (p, m, v) in row]
+    # FLOAT pixels are summed in another order
+    image = _noise_image(FLOAT, 255)
+    stats = _region_stats(image, 5)
+    for noise_variance in (-1.0, 100.0):
+        result = _pixels(image.wiener_filter(5, noise_variance))
+        expected = _wiener(stats, noise_variance, float)
+        assert max([abs(a - b) for (a, b) in zip(result, expected)]) < 1e-6
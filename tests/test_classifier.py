@@ -1,5 +1,6 @@
 from gamera.core import *
-from gamera import knn, classify, gamera_xml
+from gamera import knn, knn_editing, classify, cluster, gamera_xml, gamera_gdb
+import array
 init_gamera()
 
 correct_classes = ['latin.lower.letter.h', 'latin.lower.ligature.ft', 'latin.capital.letter.m', '_group._part.latin.capital.letter.m', '_group._part.latin.capital.letter.m', '_group._part.latin.lower.letter.i', 'latin.lower.letter.d', 'latin.capital.letter.m', 'latin.capital.letter.t', '_group._part.latin.lower.letter.h', 'latin.lower.ligature.fi', '_group._part.latin.lower.ligature.ft', '_group._part.latin.lower.letter.h', '_group._part.latin.lower.letter.i', 'latin.lower.letter.h', 'latin.lower.letter.d', 'latin.lower.letter.d', 'latin.capital.letter.m', 'latin.capital.letter.c', 'latin.lower.letter.t', 'latin.lower.letter.t', '_group._part.latin.lower.letter.n', 'latin.lower.letter.e', 'latin.lower.letter.a', 'latin.lower.letter.r', 'latin.lower.letter.r', 'latin.lower.letter.a', '_group._part.latin.lower.letter.n', '_group._part.latin.lower.letter.i', 'latin.lower.letter.a', 'latin.lower.letter.r', 'latin.lower.letter.r', '_group._part.latin.lower.letter.h', 'latin.lower.letter.e', 'latin.lower.letter.r', 'latin.lower.letter.e', 'latin.lower.letter.n', 'latin.lower.letter.n', 'latin.lower.letter.o', 'latin.lower.letter.e', 'latin.lower.letter.s', 'latin.lower.letter.e', '_group._part.latin.lower.letter.h', '_group._part.latin.lower.letter.i', '_group._part.latin.lower.letter.g', 'latin.lower.letter.a', 'latin.lower.letter.r', 'latin.lower.letter.r', 'latin.lower.letter.o-', 'latin.lower.letter.r', 'hyphen-minus', 'comma', 'full.stop', 'comma', '_group._part.latin.lower.ligature.ft', 'noise', '_group._part.latin.lower.letter.g']
@@ -108,7 +109,33 @@ def test_interactive_classifier():
    assert len(classifier.get_glyphs()) == 0
    classifier.from_xml_filename("data/testline.xml")
    assert len(classifier.get_glyphs()) == 66
-   
+
+def test_interactive_database_changes():
+   # the feature data kept by kNNInteractive follows the database
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+   classifier = knn.kNNInteractive([],features=featureset)
+   classifier.from_xml_filename("data/testline.xml")
+   for glyph in ccs:
+      classifier.generate_features(glyph)
+
+   def check():
+      for glyph in ccs[:20]:
+         expected = classifier.classify_with_images(classifier.database, glyph)
+         assert classifier.guess_glyph_automatic(glyph)[0] == expected[0]
+
+   check()
+   glyphs = list(classifier.get_glyphs())
+   classifier.remove_from_database(glyphs[:10])
+   check()
+   classifier.classify_list_manual(glyphs[20:25], "dummy")
+   check()
+   classifier.add_to_database(glyphs[:10])
+   check()
+   classifier.evaluate()
+   classifier.classify_glyph_manual(glyphs[30], "dummy")
+   check()
+
 def test_noninteractive_classifier():
    # We assume the XML reading/writing itself is fine (given
    # test_xml), but we should test the wrappers in classify anyway
@@ -122,8 +149,601 @@ def test_noninteractive_classifier():
    
    _test_classification(classifier, ccs)
 
+   for glyph in ccs:
+      classifier.generate_features(glyph)
+   expected = classifier.classify_list(ccs)
    classifier.serialize("tmp/serialized.knn")
    classifier.clear_glyphs()
    assert len(classifier.get_glyphs()) == 0
    classifier.unserialize("tmp/serialized.knn")
+   assert classifier.classify_list(ccs) == expected
+   # the loaded data is mapped from the file; saving over the same
+   # file leaves it intact
+   classifier.serialize("tmp/serialized.knn")
+   assert classifier.classify_list(ccs) == expected
+   classifier.unserialize("tmp/serialized.knn")
+   assert classifier.classify_list(ccs) == expected
+   # only knn files can be loaded
+   try:
+      classifier.unserialize("data/testline.xml")
+   except IOError:
+      pass
+   else:
+      assert False
+
+
+def test_noninteractive_classify_list():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   for normalize in (False, True):
+      classifier = knn.kNNNonInteractive(database,features=featureset,normalize=normalize)
+      classifier.num_k = 3
+      for glyph in ccs:
+         classifier.generate_features(glyph)
+      # one call for the whole list gives the same as one call per glyph
+      assert classifier.classify_list(ccs) == [classifier.classify(glyph) for glyph in ccs]
+      assert classifier.classify_list([]) == []
+   try:
+      classifier.classify_list([1])
+   except TypeError:
+      pass
+   else:
+      assert False
+
+def test_knn_num_threads():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset,normalize=True)
+   classifier.num_k = 3
+   assert classifier.num_threads == 0
+   for glyph in ccs:
+      classifier.generate_features(glyph)
+   results = []
+   for threads in (1, 4):
+      classifier.num_threads = threads
+      assert classifier.num_threads == threads
+      results.append((classifier.classify_list(ccs),
+                      classifier.leave_one_out(),
+                      classifier.distance_matrix(ccs)._to_raw_string(),
+                      classifier.unique_distances(ccs)._to_raw_string()))
+   # the result does not depend on the number of threads
+   assert results[0] == results[1]
+   try:
+      classifier.num_threads = -1
+   except ValueError:
+      pass
+   else:
+      assert False
+
+def test_knn_classify_threads():
+   import threading
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset,normalize=True)
+   classifier.num_k = 3
+   for glyph in ccs:
+      classifier.generate_features(glyph)
+   expected = [classifier.classify(glyph) for glyph in ccs]
+   results = []
+   def worker():
+      for i in range(10):
+         results.append([classifier.classify(glyph) for glyph in ccs])
+         results.append(classifier.classify_list(ccs))
+   threads = [threading.Thread(target=worker) for i in range(4)]
+   for thread in threads:
+      thread.start()
+   # the classifier cannot be changed while another thread searches it
+   while [thread for thread in threads if thread.isAlive()]:
+      try:
+         classifier.instantiate_from_images(database, True)
+      except RuntimeError:
+         pass
+   for thread in threads:
+      thread.join()
+   # the searches running at the same time do not disturb each other
+   assert len(results) == 80
+   for result in results:
+      assert result == expected
+
+def test_knn_distance_types():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   noninteractive = knn.kNNNonInteractive(database,features=featureset)
+   interactive = knn.kNNInteractive(database,features=featureset)
+   for glyph in ccs:
+      noninteractive.generate_features(glyph)
+   all_features = range(noninteractive.num_features)
+   for distance_type in (knn.CITY_BLOCK, knn.EUCLIDEAN, knn.FAST_EUCLIDEAN):
+      noninteractive.distance_type = distance_type
+      interactive.distance_type = distance_type
+      # the kernels of the non-interactive classifier agree with the
+      # generic distance functions
+      for glyph, (id, conf) in zip(ccs, noninteractive.classify_list(ccs)):
+         (id2, conf2) = interactive.guess_glyph_automatic(glyph)
+         assert id[0][1] == id2[0][1]
+         assert abs(id[0][0] - id2[0][0]) < 1e-9
+      # using all features by index is the same as using all features
+      assert noninteractive.leave_one_out(all_features) == noninteractive.leave_one_out()
+
+def test_knn_leave_one_out():
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset)
+   for distance_type in (knn.CITY_BLOCK, knn.FAST_EUCLIDEAN):
+      classifier.distance_type = distance_type
+      # leave_one_out stops the distance computations early; compare
+      # with classifiers trained without the left out glyph
+      correct = 0
+      for i, glyph in enumerate(database):
+         others = knn.kNNNonInteractive(database[:i] + database[i+1:],
+                                        features=featureset)
+         others.distance_type = distance_type
+         if others.classify(glyph)[0][0][1] == glyph.get_main_id():
+            correct += 1
+      assert classifier.leave_one_out() == (correct, len(database))
+
+def test_knn_index():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset,normalize=True)
+   for glyph in ccs:
+      classifier.generate_features(glyph)
+   classifier.confidence_types = [CONFIDENCE_DEFAULT, CONFIDENCE_KNNFRACTION,
+                                  CONFIDENCE_NUN, CONFIDENCE_AVGDISTANCE]
+   weights = array.array('d', [(i % 5) * 0.25 for i in range(classifier.num_features)])
+   for distance_type in (knn.CITY_BLOCK, knn.FAST_EUCLIDEAN):
+      classifier.distance_type = distance_type
+      for num_k in (1, 3):
+         classifier.num_k = num_k
+         for w in (None, weights):
+            if w is not None:
+               classifier.set_weights(w)
+            classifier.use_index = False
+            expected = classifier.classify_list(ccs)
+            classifier.use_index = True
+            result = classifier.classify_list(ccs)
+            assert [r[0][0][1] for r in result] == [e[0][0][1] for e in expected]
+            for (id, conf), (id2, conf2) in zip(result, expected):
+               for t in conf:
+                  assert abs(conf[t] - conf2[t]) < 1e-9
+            assert classifier.classify(ccs[0])[0] == result[0][0]
+
+def test_knn_index_ties():
+   import random
+   def glyph(features):
+      image = Image((0, 0), Dim(1, 1))
+      image.features = array.array('d', features)
+      return image
+   def compare(classifier, glyphs):
+      classifier.use_index = False
+      expected = classifier.classify_list(glyphs)
+      classifier.use_index = True
+      assert classifier.classify_list(glyphs) == expected
+
+   # equally distant neighbors are chosen in database order, with the
+   # index as without it
+   classifier = knn.kNNNonInteractive(None, features=['area'], normalize=False)
+   classifier.instantiate_from_features(array.array('d', [5, 1, -1, 3, -3, 1]),
+                                        ['e', 'b', 'c', 'd', 'a', 'f'], False)
+   classifier.confidence_types = [CONFIDENCE_DEFAULT, CONFIDENCE_KNNFRACTION,
+                                  CONFIDENCE_NUN]
+   glyphs = [glyph([x]) for x in (0, 2, 4, -2, 10, -10)]
+   for distance_type in (knn.CITY_BLOCK, knn.EUCLIDEAN, knn.FAST_EUCLIDEAN):
+      classifier.distance_type = distance_type
+      for num_k in (1, 2, 3, 4):
+         classifier.num_k = num_k
+         compare(classifier, glyphs)
+   assert classifier.classify(glyph([0]))[0][0][1] == 'b'
+
+   # many ties, and the distances of the quantized storage types
+   classifier = knn.kNNNonInteractive(None, features=['moments', 'nholes'], normalize=False)
+   n = classifier.num_features
+   random.seed(11)
+   levels = [0.0, 0.25, 0.5, 1.0, 2.0]
+   values = array.array('d', [random.choice(levels) for i in range(2000 * n)])
+   id_names = ['c%d' % random.randint(0, 9) for i in range(2000)]
+   glyphs = [glyph([random.choice(levels) for j in range(n)]) for i in range(100)]
+   classifier.confidence_types = [CONFIDENCE_DEFAULT, CONFIDENCE_KNNFRACTION,
+                                  CONFIDENCE_NUN]
+   for storage in (knn.STORAGE_DOUBLE, knn.STORAGE_FLOAT, knn.STORAGE_UINT16):
+      classifier.instantiate_from_features(values, id_names, False, storage)
+      for distance_type in (knn.CITY_BLOCK, knn.FAST_EUCLIDEAN):
+         classifier.distance_type = distance_type
+         for num_k in (1, 3, 7):
+            classifier.num_k = num_k
+            compare(classifier, glyphs)
+
+def test_knn_storage():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset,normalize=True)
+   for glyph in ccs:
+      classifier.generate_features(glyph)
+   classifier.confidence_types = [CONFIDENCE_DEFAULT, CONFIDENCE_AVGDISTANCE]
+   expected = classifier.classify_list(ccs)
+   assert classifier.storage == knn.STORAGE_DOUBLE
+   for storage, tolerance in ((knn.STORAGE_FLOAT, 1e-4), (knn.STORAGE_UINT16, 1e-2)):
+      classifier.storage = storage
+      result = classifier.classify_list(ccs)
+      assert [r[0][0][1] for r in result] == [e[0][0][1] for e in expected]
+      for (id, conf), (id2, conf2) in zip(result, expected):
+         assert abs(conf[CONFIDENCE_AVGDISTANCE] - conf2[CONFIDENCE_AVGDISTANCE]) < tolerance
+   # the storage is kept when the data is instantiated again
+   classifier.storage = knn.STORAGE_UINT8
+   classifier.instantiate_from_images(database, True)
+   assert classifier.storage == knn.STORAGE_UINT8
+   result = classifier.classify_list(ccs)
+   same = [r[0][0][1] == e[0][0][1] for r, e in zip(result, expected)]
+   assert same.count(True) > 0.9 * len(same)
+   classifier.serialize("tmp/serialized_uint8.knn")
+   classifier2 = knn.kNNNonInteractive("tmp/serialized_uint8.knn", features=featureset)
+   assert classifier2.storage == knn.STORAGE_UINT8
+   classifier2.confidence_types = classifier.confidence_types
+   assert classifier2.classify_list(ccs) == result
+
+def test_knn_incremental():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   first, second = database[:40], database[40:]
+   full = knn.kNNNonInteractive(database,features=featureset,normalize=True)
+   for glyph in ccs:
+      full.generate_features(glyph)
+   confidence_types = [CONFIDENCE_DEFAULT, CONFIDENCE_AVGDISTANCE]
+   full.confidence_types = confidence_types
+   expected = full.classify_list(ccs)
+
+   def check(classifier, expected):
+      classifier.confidence_types = confidence_types
+      result = classifier.classify_list(ccs)
+      assert [r[0][0][1] for r in result] == [e[0][0][1] for e in expected]
+      for (id, conf), (id2, conf2) in zip(result, expected):
+         for t in conf:
+            assert abs(conf[t] - conf2[t]) < 1e-9
+
+   # adding glyphs gives the same data as building it from all glyphs
+   incremental = knn.kNNNonInteractive(first,features=featureset,normalize=True)
+   incremental.merge_glyphs(second)
+   assert incremental.num_feature_vectors == len(database)
+   assert len(incremental.get_glyphs()) == len(database)
+   check(incremental, expected)
+   assert incremental.leave_one_out() == full.leave_one_out()
 
+   # and removing them gives the same as never adding them
+   incremental.remove_glyphs(second)
+   assert incremental.num_feature_vectors == len(first)
+   small = knn.kNNNonInteractive(first,features=featureset,normalize=True)
+   small.confidence_types = confidence_types
+   check(incremental, small.classify_list(ccs))
+
+   # quantized data gets new ranges when necessary
+   incremental.storage = knn.STORAGE_UINT8
+   incremental.merge_glyphs(second)
+   assert incremental.storage == knn.STORAGE_UINT8
+   result = incremental.classify_list(ccs)
+   same = [r[0][0][1] == e[0][0][1] for r, e in zip(result, expected)]
+   assert same.count(True) > 0.9 * len(same)
+
+def test_knn_instantiate_from_xml():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   full = knn.kNNNonInteractive(database,features=featureset,normalize=True)
+   for glyph in ccs:
+      full.generate_features(glyph)
+   full.confidence_types = [CONFIDENCE_DEFAULT, CONFIDENCE_AVGDISTANCE]
+   expected = full.classify_list(ccs)
+
+   # the features stored in the file give the same data without any images
+   classifier = knn.kNNNonInteractive(None,features=featureset,normalize=True)
+   classifier.instantiate_from_xml("data/testline.xml")
+   assert classifier.num_feature_vectors == len(database)
+   assert len(classifier.get_glyphs()) == 0
+   classifier.confidence_types = full.confidence_types
+   result = classifier.classify_list(ccs)
+   assert [r[0][0][1] for r in result] == [e[0][0][1] for e in expected]
+   for (id, conf), (id2, conf2) in zip(result, expected):
+      assert abs(conf[CONFIDENCE_AVGDISTANCE] - conf2[CONFIDENCE_AVGDISTANCE]) < 1e-6
+
+   # with the pixel data the glyphs are loaded as well
+   classifier.instantiate_from_xml("data/testline.xml", with_data=True)
+   glyphs = classifier.get_glyphs()
+   assert len(glyphs) == len(database)
+   assert [g.get_main_id() for g in glyphs] == [g.get_main_id() for g in database]
+   assert glyphs[0].to_rle() == database[0].to_rle()
+   assert classifier.classify_list(ccs) == result
+
+   # features that are not stored in the file can not be loaded
+   classifier = knn.kNNNonInteractive(None,features=['area', 'diagonal_projection'])
+   try:
+      classifier.instantiate_from_xml("data/testline.xml")
+   except gamera_xml.XMLError:
+      pass
+   else:
+      assert False
+
+def test_knn_instantiate_from_gdb():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml", featureset)
+   full = knn.kNNNonInteractive(database,features=featureset,normalize=True)
+   for glyph in ccs:
+      full.generate_features(glyph)
+   expected = full.classify_list(ccs)
+
+   # the features saved in the database, or computed from the glyphs
+   gamera_gdb.glyphs_to_gdb("tmp/testline_knn.gdb", database, True)
+   gamera_gdb.glyphs_to_gdb("tmp/testline_knn_nofeatures.gdb", database, False)
+   for filename in ("tmp/testline_knn.gdb", "tmp/testline_knn_nofeatures.gdb"):
+      for with_data in (False, True):
+         classifier = knn.kNNNonInteractive(None,features=featureset,normalize=True)
+         classifier.instantiate_from_gdb(filename, with_data, threads=2)
+         assert classifier.num_feature_vectors == len(database)
+         assert len(classifier.get_glyphs()) == with_data * len(database)
+         result = classifier.classify_list(ccs)
+         assert [r[0][0][1] for r in result] == [e[0][0][1] for e in expected]
+
+def test_classifier_stats():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset,normalize=False)
+   assert classifier.get_stats() is None
+   expected = classifier.group_list_automatic(ccs)
+   stats = classifier.enable_stats(trace=True)
+   assert classifier.get_stats() is stats
+   for glyph in ccs:
+      glyph.classification_state = UNCLASSIFIED
+   added, removed = classifier.group_list_automatic(ccs)
+   assert len(added) == len(expected[0])
+   for stage in ('features', 'classify', 'splits', 'pregroup', 'grouping'):
+      assert stats.calls[stage] >= 1
+   assert stats.counters['glyphs'] >= len(ccs)
+   assert stats.counters['distances'] == stats.counters['glyphs'] * 66
+   assert stats.counters['group_candidates'] > 0
+   stats.write_trace("tmp/classifier_trace.json")
+   assert open("tmp/classifier_trace.json").read().startswith('{"traceEvents"')
+   classifier.disable_stats()
+   assert classifier.get_stats() is None
+
+def test_group_cache():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset,normalize=False)
+   expected, removed = classifier.group_list_automatic(ccs)
+   expected.sort(lambda a,b: cmp(a.offset_x,b.offset_x))
+   stats = classifier.enable_stats()
+
+   def regroup():
+      stats.reset()
+      for glyph in ccs:
+         glyph.classification_state = UNCLASSIFIED
+      added, removed = classifier.group_list_automatic(ccs)
+      added.sort(lambda a,b: cmp(a.offset_x,b.offset_x))
+      assert [cc.get_main_id() for cc in added] == \
+             [cc.get_main_id() for cc in expected]
+      for a, b in zip(added, expected):
+         assert list(a.features) == list(b.features)
+      return stats.counters.get('group_cache_hits', 0)
+
+   # all candidates are found in the cache
+   assert regroup() > stats.counters['groups']
+   # only the unions found are (after evaluating their candidates)
+   classifier.invalidate_group_cache(ccs)
+   assert regroup() == stats.counters['groups']
+   assert regroup() > stats.counters['groups']
+   classifier.clear_group_cache()
+   assert regroup() == stats.counters['groups']
+   # unchanged settings keep the cache, changes of the training data
+   # clear it
+   classifier.set_weights(classifier.get_weights())
+   assert regroup() > stats.counters['groups']
+   classifier.set_normalization_state(False)
+   assert regroup() == stats.counters['groups']
+   classifier.disable_stats()
+
+def test_knn_approximate():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset,normalize=True)
+   classifier.num_k = 3
+   for glyph in ccs:
+      classifier.generate_features(glyph)
+   classifier.confidence_types = [CONFIDENCE_DEFAULT, CONFIDENCE_NUN]
+   expected = classifier.classify_list(ccs)
+   # comparing all candidates exactly gives the exact result
+   classifier.approximate_candidates = len(database)
+   assert classifier.approximate_candidates == len(database)
+   result = classifier.classify_list(ccs)
+   for (id, conf), (id2, conf2) in zip(result, expected):
+      assert id[0][1] == id2[0][1]
+      for t in conf:
+         assert abs(conf[t] - conf2[t]) < 1e-9
+   # few candidates still find most of the nearest neighbors
+   classifier.approximate_candidates = 10
+   result = classifier.classify_list(ccs)
+   same = [r[0][0][1] == e[0][0][1] for r, e in zip(result, expected)]
+   assert same.count(True) >= 0.8 * len(same)
+   classifier.approximate_candidates = 0
+   assert classifier.classify_list(ccs) == expected
+
+def test_knn_editing():
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNInteractive(database,features=featureset,num_k=3)
+   # Wilson's editing removes the glyphs misclassified without themselves
+   removed = set()
+   for glyph in database:
+      others = knn.kNNInteractive([g for g in database if g is not glyph],
+                                  features=featureset, num_k=3)
+      if others.guess_glyph_automatic(glyph)[0][0][1] != glyph.get_main_id():
+         removed.add(glyph)
+   edited = knn_editing.edit_mnn(classifier, 0, False)
+   assert set(edited.get_glyphs()) == set(database) - removed
+   # the glyphs of Tomek links are each other's nearest neighbor
+   edited = knn_editing.edit_tomek(classifier, False)
+   for glyph in set(database) - set(edited.get_glyphs()):
+      nearest = knn.kNNInteractive([g for g in database if g is not glyph],
+                                   features=featureset)
+      assert nearest.guess_glyph_automatic(glyph)[0][0][1] != glyph.get_main_id()
+
+def test_knn_condense():
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNInteractive(database,features=featureset,num_k=1)
+   def leave_one_out(glyphs):
+      correct = 0
+      for glyph in database:
+         others = knn.kNNInteractive([g for g in glyphs if g is not glyph],
+                                     features=featureset)
+         if others.guess_glyph_automatic(glyph)[0][0][1] == glyph.get_main_id():
+            correct += 1
+      return correct
+   full = leave_one_out(database)
+   for tolerance in (0.0, 0.1):
+      edited = knn_editing.edit_condense(classifier, 0, tolerance)
+      prototypes = list(edited.get_glyphs())
+      assert len(prototypes) < len(database)
+      assert set(prototypes) <= set(database)
+      # the accuracy is lost by at most the tolerance
+      assert leave_one_out(prototypes) >= full - int(tolerance * len(database))
+
+def test_knn_unique_distances():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset)
+   for distance_type in (knn.CITY_BLOCK, knn.FAST_EUCLIDEAN):
+      classifier.distance_type = distance_type
+      matrix = classifier.distance_matrix(ccs, False)
+      distances = classifier.unique_distances(ccs, False)
+      # the matrix is symmetric and its upper triangle are the unique distances
+      n = len(ccs)
+      index = 0
+      for i in range(n):
+         assert matrix.get((i, i)) == 0.0
+         for j in range(i + 1, n):
+            assert matrix.get((j, i)) == matrix.get((i, j))
+            assert matrix.get((j, i)) == distances.get((index, 0))
+            # the same as the distance of the pair alone, up to rounding
+            single = classifier.distance_between_images(ccs[i], ccs[j])
+            assert abs(distances.get((index, 0)) - single) <= 1e-9 * max(1.0, single)
+            index += 1
+      # the distances written to a file are those returned
+      assert classifier.unique_distances(ccs, False, "tmp/distances.bin") is None
+      written = array.array('d')
+      written.fromstring(open("tmp/distances.bin", "rb").read())
+      assert list(written) == [distances.get((k, 0)) for k in range(index)]
+      # a sample of the pairs has one pair of each stratum of the pairs
+      sample = index // 3
+      sampled = classifier.unique_distances(ccs, False, None, sample)
+      assert sampled.ncols == sample
+      for s in range(sample):
+         begin, end = (index * s) // sample, (index * (s + 1)) // sample
+         assert sampled.get((s, 0)) in [distances.get((k, 0)) for k in range(begin, end)]
+
+def test_knn_knndistance_statistics():
+   database = gamera_xml.glyphs_from_xml("data/testline.xml")
+   classifier = knn.kNNNonInteractive(database,features=featureset)
+   stats = classifier.knndistance_statistics(3)
+   assert len(stats) == len(database)
+   # the same with more threads, and for the training samples of a sample
+   classifier.num_threads = 2
+   assert classifier.knndistance_statistics(3) == stats
+   sampled = classifier.knndistance_statistics(3, len(database) // 4)
+   assert 0 < len(sampled) <= len(database)
+   for entry in sampled:
+      assert entry in stats
+   # the variant of the distance kernel in use is reported
+   dispatch = cpu_dispatch()
+   assert dispatch["kernels"]["knn.distances"] in ("generic", "avx2", "avx512")
+   assert dispatch["level"] in ("generic", "avx2", "avx512")
+
+def test_knn_hierarchical_clustering():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   classifier = knn.kNNInteractive([],features=featureset)
+   matrix = classifier.distance_matrix(ccs, False)
+   n = len(ccs)
+   # the single linkage merges are the edges of the minimum spanning tree
+   merges = classifier.hierarchical_clustering(ccs, "single", False)
+   assert len(merges) == n - 1 and merges[-1][3] == n
+   nearest = [matrix.get((0, j)) for j in range(n)]
+   outside = range(1, n)
+   costs = []
+   while outside:
+      j = min(outside, key=lambda j: nearest[j])
+      costs.append(nearest[j])
+      outside.remove(j)
+      for k in outside:
+         nearest[k] = min(nearest[k], matrix.get((j, k)))
+   costs.sort()
+   for (a, b, distance, size), cost in zip(merges, costs):
+      assert abs(distance - cost) <= 1e-9 * max(1.0, cost)
+   # the last complete linkage merge is at the largest distance
+   merges = classifier.hierarchical_clustering(ccs, "complete", False)
+   largest = max([matrix.get((i, j)) for i in range(n) for j in range(n)])
+   assert abs(merges[-1][2] - largest) <= 1e-9 * largest
+   distances = [m[2] for m in merges]
+   assert distances == sorted(distances)
+   # cutting the dendrogram
+   assert cluster.cut_dendrogram(merges, 1) == [0] * n
+   assert cluster.cut_dendrogram(merges, n) == range(n)
+   labels = cluster.cut_dendrogram(merges, 5)
+   assert len(set(labels)) == 5
+   cluster.hierarchical_cluster(ccs, 5, linkage="average", k=classifier)
+   assert len(set([cc.get_main_id() for cc in ccs])) == 5
+
+def test_knn_spanning_tree():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+
+   classifier = knn.kNNInteractive([],features=featureset)
+   matrix = classifier.distance_matrix(ccs, False)
+   n = len(ccs)
+   def check_tree(edges):
+      assert len(edges) == n - 1
+      tree = range(n)
+      def find(i):
+         while tree[i] != i:
+            i = tree[i]
+         return i
+      for a, b, distance in edges:
+         assert find(a) != find(b)
+         tree[find(a)] = find(b)
+         assert abs(distance - matrix.get((a, b))) <= 1e-9 * max(1.0, distance)
+      distances = [e[2] for e in edges]
+      assert distances == sorted(distances)
+      return sum(distances)
+   # the exact tree has the distances of the single linkage merges
+   exact = classifier.spanning_tree(ccs, 0, False)
+   total = check_tree(exact)
+   merges = classifier.hierarchical_clustering(ccs, "single", False)
+   assert abs(total - sum([m[2] for m in merges])) <= 1e-9 * total
+   # the approximate trees are not shorter
+   for num_neighbors in (1, 3, 10):
+      edges = classifier.spanning_tree(ccs, num_neighbors, False)
+      assert check_tree(edges) >= total * (1 - 1e-9)
+   # the graph of the tree
+   g = cluster.make_spanning_tree(ccs, classifier, 3)
+   assert g.nnodes == n and g.nedges == n - 1 and g.is_fully_connected()
+   g = cluster.make_spanning_tree(ccs, classifier, 0)
+   assert abs(sum([e.cost for e in g.get_edges()]) - total) <= 1e-9 * total
+   cluster.cluster(ccs, k=classifier, num_neighbors=3)
@@ -38,3 +38,21 @@ def test_color_to_ccs():
             assert [(10,3),(15,35)] == [c.ul, c.lr]
         if c.label == 7:
             assert [(5,20),(30,25)] == [c.ul, c.lr]
+
+def test_color_to_ccs_offset():
+    # automatic labels are given in scan order, and the Cc's of an
+    # image with an offset lie on that image
+    img = Image((10,20), (40,40), RGB)
+    img.draw_filled_rect((13,23),(15,25),RGBPixel(255,0,0))
+    img.draw_filled_rect((20,23),(25,55),RGBPixel(0,255,0))
+    img.draw_filled_rect((30,50),(33,52),RGBPixel(0,0,0))
+    labeled = img.colors_to_labels()
+    assert labeled.ul == (10,20)
+    assert labeled.get((0,0)) == 0
+    assert labeled.get((4,4)) == 2
+    assert labeled.get((12,18)) == 3
+    assert labeled.get((21,31)) == 1
+    ccs = labeled.ccs_from_labeled_image()
+    assert [(c.label, c.ul, c.lr) for c in ccs] == \
+           [(1, (30,50), (33,52)), (2, (13,23), (15,25)), (3, (20,23), (25,55))]
+    assert ccs[1].black_area()[0] == 9
@@ -0,0 +1,131 @@
+from gamera.core import *
+init_gamera()
+
+# a ring holding a smaller ring, which holds a single pixel, next to
+# another single pixel and a thin glyph with a hole
+def _page():
+    image = Image((100, 50), Dim(30, 24), ONEBIT)
+    image.subimage((102, 52), Dim(14, 12)).fill(1)
+    image.subimage((104, 54), Dim(10, 8)).fill(0)
+    image.subimage((105, 55), Dim(8, 6)).fill(1)
+    image.subimage((106, 56), Dim(6, 4)).fill(0)
+    image.set((8, 7), 1)
+    image.set((25, 20), 1)
+    for x, y in ((2, 16), (3, 16), (4, 16), (2, 17), (4, 17), (2, 18), (3, 18),
+                 (4, 18), (5, 19), (6, 20), (6, 21), (7, 22)):
+        image.set((x, y), 1)
+    return image
+
+def _regions(image):
+    # the 4-connected white regions, with the outside of the page as region 0
+    region = {}
+    count = 1
+    for y in range(image.nrows):
+        for x in range(image.ncols):
+            if image.get((x, y)) or (x, y) in region:
+                continue
+            stack = [(x, y)]
+            region[(x, y)] = count
+            outside = False
+            while stack:
+                px, py = stack.pop()
+                for q in ((px - 1, py), (px + 1, py), (px, py - 1), (px, py + 1)):
+                    if not (0 <= q[0] < image.ncols and 0 <= q[1] < image.nrows):
+                        outside = True
+                    elif not image.get(q) and q not in region:
+                        region[q] = count
+                        stack.append(q)
+            if outside:
+                for p in region.keys():
+                    if region[p] == count:
+                        region[p] = 0
+            count += 1
+    return region
+
+def _expected(image):
+    # the border pixels of each component next to each white region, the
+    # region left of its first pixel holding the outer contour
+    region = _regions(image)
+    result = {}
+    outer = {}
+    for y in range(image.nrows):
+        for x in range(image.ncols):
+            label = image.get((x, y))
+            if not label:
+                continue
+            if label not in outer:
+                outer[label] = region.get((x - 1, y), 0)
+            for q in ((x - 1, y), (x + 1, y), (x, y - 1), (x, y + 1)):
+                if image.get(q) if (0 <= q[0] < image.ncols and 0 <= q[1] < image.nrows) else False:
+                    continue
+                r = region.get(q, 0)
+                key = (label, int(r != outer[label]), r)
+                result.setdefault(key, set()).add((x + image.offset_x, y + image.offset_y))
+    return sorted([(label, hole, points) for (label, hole, r), points in result.items()])
+
+def test_labeled_contours():
+    image = _page()
+    ccs = image.cc_analysis()
+    assert len(ccs) == 5
+    contours = image.labeled_contours()
+    assert len(contours) == 8
+    for label, hole, points in contours:
+        # closed 8-connected paths
+        for a, b in zip(points, points[1:] + points[:1]):
+            assert max(abs(a.x - b.x), abs(a.y - b.y)) <= 1
+    found = sorted([(label, hole, set([(p.x, p.y) for p in points]))
+                    for label, hole, points in contours])
+    assert found == _expected(image)
+    # both rings and the thin glyph have one hole each
+    assert len([c for c in contours if c[1]]) == 3
+    # single pixels are contours of one point
+    singles = [c for c in contours if len(c[2]) == 1]
+    assert len(singles) == 2
+    assert sorted([(c[2][0].x, c[2][0].y) for c in singles]) == [(108, 57), (125, 70)]
+
+# the sample points computed from contour_top etc. before the contours
+# were traced, by the upper left corner of the component and percentage
+SAMPLEPOINTS = {
+    (102, 52, 30):
+        [(102, 52), (105, 52), (108, 52), (112, 52), (115, 52), (115, 55),
+         (115, 59), (115, 62), (103, 63), (106, 63), (110, 63), (113, 63),
+         (102, 55), (102, 58), (102, 61), (115, 63), (102, 63)],
+    (102, 52, 100):
+        [(102, 52), (103, 52), (104, 52), (105, 52), (106, 52), (107, 52),
+         (108, 52), (109, 52), (110, 52), (111, 52), (112, 52), (113, 52),
+         (114, 52), (115, 52), (115, 53), (115, 54), (115, 55), (115, 56),
+         (115, 57), (115, 58), (115, 59), (115, 60), (115, 61), (115, 62),
+         (115, 63), (102, 63), (103, 63), (104, 63), (105, 63), (106, 63),
+         (107, 63), (108, 63), (109, 63), (110, 63), (111, 63), (112, 63),
+         (113, 63), (114, 63), (102, 53), (102, 54), (102, 55), (102, 56),
+         (102, 57), (102, 58), (102, 59), (102, 60), (102, 61), (102, 62)],
+    (102, 66, 30):
+        [(102, 66), (105, 69), (104, 67), (103, 68), (107, 72), (102, 68)],
+    (102, 66, 100):
+        [(102, 66), (103, 66), (104, 66), (105, 69), (106, 70), (107, 72),
+         (104, 67), (104, 68), (106, 71), (102, 68), (103, 68), (102, 67)],
+    (105, 55, 30):
+        [(105, 55), (108, 55), (111, 55), (112, 58), (105, 60), (108, 60),
+         (105, 56), (105, 59), (112, 55), (112, 60)],
+    (105, 55, 100):
+        [(105, 55), (106, 55), (107, 55), (108, 55), (109, 55), (110, 55),
+         (111, 55), (112, 55), (112, 56), (112, 57), (112, 58), (112, 59),
+         (112, 60), (105, 60), (106, 60), (107, 60), (108, 60), (109, 60),
+         (110, 60), (111, 60), (105, 56), (105, 57), (105, 58), (105, 59)],
+    (108, 57, 30):
+        [(108, 57)],
+    (108, 57, 100):
+        [(108, 57)],
+    (125, 70, 30):
+        [(125, 70)],
+    (125, 70, 100):
+        [(125, 70)]
+}
+
+# the sample points are the same as before the contours were traced
+def test_contour_samplepoints():
+    ccs = _page().cc_analysis()
+    for cc in ccs:
+        for percentage in (100, 30):
+            points = [(p.x, p.y) for p in cc.contour_samplepoints(percentage)]
+            assert points == SAMPLEPOINTS[(cc.ul_x, cc.ul_y, percentage)]
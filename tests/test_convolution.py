@@ -0,0 +1,99 @@
+from gamera.core import *
+init_gamera()
+from gamera.plugins.convolution import GaussianKernel, \
+     BORDER_TREATMENT_REFLECT
+
+def _float_image(ncols, nrows):
+    img = Image((0, 0), (ncols - 1, nrows - 1), FLOAT)
+    for y in range(nrows):
+        for x in range(ncols):
+            img.set((x, y), float((x * 7 + y * 13) % 17))
+    return img
+
+# the separable kernel is applied as row and column passes, which must
+# give the direct 2D convolution (with reflected borders)
+def test_convolve_separable():
+    img = _float_image(12, 9)
+    kernel = [[.125, 0.0, -.125],
+              [.25, 0.0, -.25],
+              [.125, 0.0, -.125]]
+    result = img.convolve(kernel, BORDER_TREATMENT_REFLECT)
+    def reflect(i, n):
+        if i < 0:
+            return -i
+        if i >= n:
+            return 2 * (n - 1) - i
+        return i
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            expected = 0.0
+            for j in range(-1, 2):
+                for i in range(-1, 2):
+                    expected += kernel[1 + j][1 + i] * \
+                        img.get((reflect(x - i, img.ncols),
+                                 reflect(y - j, img.nrows)))
+            assert abs(result.get((x, y)) - expected) < 1e-9
+
+# the result must not depend on the number of threads
+def test_convolve_threads():
+    img = _float_image(80, 70).to_greyscale()
+    kernel = GaussianKernel(2.0)
+    row = [kernel.get((x, 0)) for x in range(kernel.ncols)]
+    kernel2d = [[a * b for b in row] for a in row]
+    for border in range(5):
+        serial = img.convolve_x(kernel, border, threads=1)
+        assert img.convolve_x(kernel, border, threads=3).to_string() == \
+            serial.to_string()
+        serial = img.convolve_y(kernel, border, threads=1)
+        assert img.convolve_y(kernel, border, threads=3).to_string() == \
+            serial.to_string()
+        serial = img.convolve(kernel2d, border, threads=1)
+        assert img.convolve(kernel2d, border, threads=3).to_string() == \
+            serial.to_string()
+
+# the running sums of the box filter must give the mean filter
+def test_box_filter():
+    img = _float_image(30, 20)
+    for radius in (0, 1, 4):
+        size = 2 * radius + 1
+        kernel = [[1.0 / (size * size)] * size] * size
+        for border in range(1, 5):
+            result = img.box_filter(radius, border)
+            expected = img.convolve(kernel, border)
+            for y in range(img.nrows):
+                for x in range(img.ncols):
+                    assert abs(result.get((x, y)) - expected.get((x, y))) < 1e-9
+
+# the recursive gaussian must keep a constant image
+def test_recursive_gaussian_smoothing():
+    img = Image((0, 0), (49, 39), FLOAT)
+    img.fill(7.0)
+    result = img.recursive_gaussian_smoothing(10.0)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            assert abs(result.get((x, y)) - 7.0) < 1e-9
+
+# large kernels that are not separable are convolved through the Fourier
+# transform, which must give the direct sum
+def test_convolve_fft():
+    img = _float_image(40, 30)
+    kernel = [[float((i * 3 + j * 5 + i * j) % 7 - 3) / 50.0
+               for i in range(9)] for j in range(9)]
+    result = img.convolve(kernel, BORDER_TREATMENT_REFLECT)
+    def reflect(i, n):
+        if i < 0:
+            return -i
+        if i >= n:
+            return 2 * (n - 1) - i
+        return i
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            expected = 0.0
+            for j in range(-4, 5):
+                for i in range(-4, 5):
+                    expected += kernel[4 + j][4 + i] * \
+                        img.get((reflect(x - i, img.ncols),
+                                 reflect(y - j, img.nrows)))
+            assert abs(result.get((x, y)) - expected) < 1e-9
+    assert img.convolve(kernel, BORDER_TREATMENT_REFLECT,
+                        threads=3).to_string() == result.to_string()
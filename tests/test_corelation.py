@@ -0,0 +1,87 @@
+from gamera.core import *
+init_gamera()
+import random
+
+def _noise(image, seed, values):
+    random.seed(seed)
+    for y in range(image.nrows):
+        for x in range(image.ncols):
+            image.set((x, y), random.choice(values))
+
+def _template(ncols, nrows, seed):
+    # black corners, so that every overlap with a larger image holds a
+    # black template pixel
+    template = Image((0, 0), Dim(ncols, nrows), ONEBIT)
+    _noise(template, seed, [0, 1])
+    for x, y in ((0, 0), (ncols - 1, 0), (0, nrows - 1), (ncols - 1, nrows - 1)):
+        template.set((x, y), 1)
+    return template
+
+# the image is read at the image coordinates of the overlap, not at
+# those of the template
+def test_corelation_image_coordinates():
+    image = Image((10, 20), Dim(8, 6), ONEBIT)
+    image.subimage((12, 21), Dim(3, 3)).fill(1)
+    template = Image((0, 0), Dim(3, 3), ONEBIT)
+    template.fill(1)
+    assert image.corelation_sum(template, (12, 21)) == 0.0
+    assert image.corelation_sum_squares(template, (12, 21)) == 0.0
+    assert image.corelation_weighted(template, (12, 21), 1.0, -1.0, -1.0, 0.0) == 1.0
+    # the template two pixels to the left misses two of its columns
+    assert image.corelation_sum(template, (10, 21)) == 6.0 / 9.0
+
+# the squared distance of greyscale pixels depends on the template
+# pixel: the image value under black, and its distance to white under
+# white template pixels
+def test_corelation_sum_squares_greyscale():
+    image = Image((0, 0), Dim(4, 4), GREYSCALE)
+    image.fill(100)
+    template = Image((0, 0), Dim(2, 2), ONEBIT)
+    template.set((0, 0), 1)
+    assert image.corelation_sum_squares(template, (1, 1)) == 100 ** 2 + 3 * 155 ** 2
+    assert image.corelation_sum(template, (1, 1)) == 100 + 3 * 155
+
+# the last row and column of the image are part of the overlap
+def test_corelation_last_row_and_column():
+    image = Image((0, 0), Dim(5, 5), ONEBIT)
+    image.set((4, 4), 1)
+    template = Image((0, 0), Dim(2, 2), ONEBIT)
+    template.fill(1)
+    assert image.corelation_sum(template, (4, 4)) == 0.0
+    assert image.corelation_sum_squares(template, (4, 4)) == 0.0
+    assert image.corelation_weighted(template, (4, 4), 1.0, 0.0, 0.0, 0.0) == 1.0
+    assert image.corelation_sum(template, (3, 3)) == 0.75
+    grey = Image((0, 0), Dim(5, 5), GREYSCALE)
+    grey.set((4, 3), 10)
+    assert grey.corelation_sum(template, (4, 3)) == (10 + 255) / 2.0
+
+# each pixel of a map is the corelation at its offset, including the
+# offsets where the template only partly overlaps the image, for small
+# templates (summed along their runs) and large ones (through the
+# Fourier transform)
+def test_corelation_maps():
+    onebit = Image((40, 35), Dim(60, 50), ONEBIT)
+    _noise(onebit, 1, [0, 0, 1])
+    grey = Image((40, 35), Dim(60, 50), GREYSCALE)
+    _noise(grey, 2, range(256))
+    for template in (_template(5, 4, 3), _template(30, 30, 4)):
+        offset = Point(onebit.ul_x - template.ncols + 1, onebit.ul_y - template.nrows + 1)
+        size = Dim(onebit.ncols + template.ncols - 1, onebit.nrows + template.nrows - 1)
+        for image in (onebit, grey):
+            maps = [(image.corelation_sum_map(template, offset, size),
+                     lambda p: image.corelation_sum(template, p)),
+                    (image.corelation_sum_squares_map(template, offset, size),
+                     lambda p: image.corelation_sum_squares(template, p))]
+            if image is onebit:
+                maps.append((image.corelation_weighted_map(template, offset, size,
+                                                           1.0, -0.5, -0.25, 0.125),
+                             lambda p: image.corelation_weighted(template, p,
+                                                                 1.0, -0.5, -0.25, 0.125)))
+            for map, single in maps:
+                assert map.ul == offset and map.dim == size
+                for y in range(size.nrows):
+                    for x in range(size.ncols):
+                        assert map.get((x, y)) == single((offset.x + x, offset.y + y))
+            one_thread = image.corelation_sum_map(template, offset, size, 1)
+            assert [one_thread.get((x, y)) for y in range(size.nrows) for x in range(size.ncols)] == \
+                   [maps[0][0].get((x, y)) for y in range(size.nrows) for x in range(size.ncols)]
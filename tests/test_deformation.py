@@ -0,0 +1,46 @@
+from gamera.core import *
+init_gamera()
+
+def _pixels(image):
+    return [image.get((x, y)) for y in range(image.nrows) for x in range(image.ncols)]
+
+def _glyph():
+    image = Image((0, 0), Dim(40, 30), ONEBIT)
+    image.subimage((5, 4), Dim(30, 6)).fill(1)
+    image.subimage((17, 4), Dim(6, 22)).fill(1)
+    image.subimage((10, 20), Dim(20, 6)).fill(1)
+    return image
+
+# the i-th variant is degrade_kanungo with the seed random_seed + i, on
+# any number of threads
+def test_degrade_kanungo_variants():
+    image = _glyph()
+    args = (0.05, 0.5, 0.5, 0.5, 0.5, 2)
+    variants = image.degrade_kanungo_variants(*(args + (6, 11, 1)))
+    assert len(variants) == 6
+    singles = [_pixels(image.degrade_kanungo(*(args + (11 + i,)))) for i in range(6)]
+    assert [_pixels(v) for v in variants] == singles
+    # the seeds give different degradations
+    assert singles[0] != singles[1]
+    for threads in (0, 2, 3, 8):
+        variants = image.degrade_kanungo_variants(*(args + (6, 11, threads)))
+        assert [_pixels(v) for v in variants] == singles
+    assert image.degrade_kanungo_variants(*(args + (0, 11, 0))) == []
+    # without the closing
+    variants = image.degrade_kanungo_variants(0.05, 0.5, 0.5, 0.5, 0.5, 0, 2, 3, 2)
+    assert _pixels(variants[1]) == _pixels(image.degrade_kanungo(0.05, 0.5, 0.5, 0.5, 0.5, 0, 4))
+
+# the turbulence of wave is random: reproducible for a seed, but
+# different for different seeds
+def test_wave_turbulence():
+    image = Image((0, 0), Dim(40, 30), GREYSCALE)
+    for y in range(image.nrows):
+        for x in range(image.ncols):
+            image.set((x, y), (x * 7 + y * 3) % 256)
+    for direction in (0, 1):
+        calm = [_pixels(image.wave(6, 10, direction, 0, 0, 0.0, seed)) for seed in (1, 2)]
+        assert calm[0] == calm[1]
+        turbulent = [_pixels(image.wave(6, 10, direction, 0, 0, 5.0, seed)) for seed in (1, 1, 2)]
+        assert turbulent[0] == turbulent[1]
+        assert turbulent[0] != turbulent[2]
+        assert turbulent[0] != calm[0]
@@ -0,0 +1,27 @@
+from gamera.core import *
+init_gamera()
+
+def _black(image):
+    return [(x, y) for y in range(image.nrows) for x in range(image.ncols)
+            if image.get((x, y))]
+
+def test_flood_fill_spans():
+    # a ring with an opening at (1, 2) and a wall across its inside
+    image = Image((0, 0), (9, 7))
+    image.draw_filled_rect((1, 1), (7, 5), 1)
+    image.draw_filled_rect((2, 2), (6, 4), 0)
+    image.draw_filled_rect((2, 3), (6, 3), 1)
+    image.set((1, 2), 0)
+    image.flood_fill((0, 0), 1)
+    # only the part below the wall is not reached
+    assert _black(image) == [(x, y) for y in range(7) for x in range(9)
+                             if not (2 <= x <= 6 and y == 4)]
+
+def test_remove_border():
+    image = Image((10, 20), (30, 20))
+    image.draw_filled_rect((10, 20), (39, 22), 1)      # top border
+    image.draw_filled_rect((20, 23), (20, 30), 1)      # attached to it
+    image.draw_filled_rect((25, 26), (28, 30), 1)      # free blob
+    image.draw_filled_rect((39, 35), (39, 39), 1)      # right border
+    image.remove_border()
+    assert _black(image) == [(x, y) for y in range(6, 11) for x in range(15, 19)]
@@ -0,0 +1,23 @@
+from gamera.core import *
+init_gamera()
+
+def _marked(image):
+    return [(x, y) for y in range(image.nrows) for x in range(image.ncols)
+            if image.get((x, y)) == 1]
+
+def test_canny_threads():
+    image = load_image("data/GreyScale_generic.png")
+    edges = image.canny_edge_image(1.5, 4.0)
+    for threads in (1, 2, 5):
+        assert _marked(image.canny_edge_image(1.5, 4.0, -1.0, threads)) == \
+               _marked(edges)
+
+def test_canny_hysteresis():
+    image = load_image("data/GreyScale_generic.png")
+    strong = _marked(image.canny_edge_image(1.0, 20.0))
+    weak = _marked(image.canny_edge_image(1.0, 5.0))
+    hysteresis = _marked(image.canny_edge_image(1.0, 20.0, 5.0))
+    # every strong edge pixel is kept, and only weak ones are added
+    assert set(strong) <= set(hysteresis) <= set(weak)
+    # a low threshold above the gradient threshold changes nothing
+    assert _marked(image.canny_edge_image(1.0, 20.0, 30.0)) == strong
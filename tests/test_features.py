@@ -506,3 +506,291 @@ def test_zernike_moments():
     assert abs(ZM_f[11] -  5.6105727) <= abs(ZM_f[11] * 0.01)             
     assert abs(ZM_f[12] -  2.6840807) <= abs(ZM_f[12] * 0.01)             
     assert abs(ZM_f[13] -  0.6231440) <= abs(ZM_f[13] * 0.01)  
+
+
+# generate_features computes the features in one fused call; the
+# results must be the same as those of the single feature functions
+def test_generate_features_fused():
+    image = load_image("data/OneBit_generic.png")
+    ccs = image.cc_analysis()
+    names = [name for name, function in image.get_feature_functions()[0]]
+    for cc in ccs[:20] + [image]:
+        cc.generate_features(force=True)
+        offset = 0
+        for name in names:
+            single = getattr(cc, name)()
+            fused = cc.features[offset:offset + len(single)]
+            for a, b in zip(single, fused):
+                assert a == b or (a != a and b != b)
+            offset += len(single)
+
+    # a subset of the features
+    image.generate_features(['volume', 'top_bottom'], force=True)
+    assert list(image.features) == \
+           list(image.volume()) + list(image.top_bottom())
+
+
+# the intermediates kept with an image must be dropped when its
+# pixels change
+def test_generate_features_cache():
+    img = Image((0,0), (9,9), ONEBIT)
+    img.draw_filled_rect((1,1),(3,5),1)
+    img.generate_features(['black_area', 'moments'], force=True)
+    assert img.features[0] == 15.0
+    img.set((7,7), 1)
+    img.generate_features(['black_area', 'moments'], force=True)
+    assert img.features[0] == 16.0
+    assert list(img.features[1:]) == list(img.moments())
+    img.draw_filled_rect((1,1),(3,5),0)
+    img.generate_features(['black_area', 'skeleton_features'], force=True)
+    assert img.features[0] == 1.0
+    assert list(img.features[1:]) == list(img.skeleton_features())
+
+
+# connected components keep a compact copy of their pixels, which
+# must be dropped when their pixels or their label change
+def test_generate_features_cc_cache():
+    img = Image((0,0), (9,9), ONEBIT)
+    img.draw_filled_rect((1,1),(3,5),1)
+    img.draw_filled_rect((5,1),(7,2),1)
+    ccs = img.cc_analysis()
+    cc = ccs[0]
+    names = ['black_area', 'skeleton_features']
+    cc.generate_features(names, force=True)
+    area = cc.features[0]
+    img.set((cc.offset_x + 1, cc.offset_y + 1), 0)
+    cc.generate_features(names, force=True)
+    assert cc.features[0] == area - 1
+    assert list(cc.features[1:]) == list(cc.skeleton_features())
+    cc.label = ccs[1].label
+    cc.generate_features(names, force=True)
+    assert cc.features[0] == cc.black_area()[0] != area - 1
+
+
+# generate_features_list computes the features of all glyphs in
+# parallel; they must equal those of generate_features
+def test_generate_features_list():
+    image = load_image("data/OneBit_generic.png")
+    ccs = image.cc_analysis()
+    features.generate_features_list(ccs, threads=2)
+    for cc in ccs:
+        fused = list(cc.features)
+        cc.generate_features(force=True)
+        assert fused == list(cc.features)
+
+
+# the _many variant of a feature packs the features of all glyphs
+# into one array
+def test_feature_many():
+    image = load_image("data/OneBit_generic.png")
+    ccs = image.cc_analysis()
+    for threads in (1, 2):
+        packed = features.nholes.many(ccs, threads)
+        assert len(packed) == 2 * len(ccs)
+        for i, cc in enumerate(ccs):
+            assert list(packed[2 * i:2 * i + 2]) == list(cc.nholes())
+
+
+# the run-based features of RLE images must equal those of dense ones
+def test_rle_features():
+    dense = load_image("data/OneBit_generic.png")
+    rle = load_image("data/OneBit_generic.png", RLE)
+    for name in ['black_area', 'volume', 'moments', 'nholes',
+                 'nholes_extended', 'projection_rows', 'projection_cols']:
+        assert list(getattr(rle, name)()) == list(getattr(dense, name)())
+    rle_ccs = rle.cc_analysis()
+    dense_ccs = dense.cc_analysis()
+    for a, b in zip(rle_ccs[:20], dense_ccs[:20]):
+        for name in ['black_area', 'moments', 'nholes', 'projection_cols']:
+            assert list(getattr(a, name)()) == list(getattr(b, name)())
+
+
+# run_statistics of a filled rectangle: one run length per direction
+def test_run_statistics():
+    img = Image((0,0), (24,5), ONEBIT)
+    img.draw_filled_rect((2,1),(21,3),1)
+    stats = img.run_statistics()
+    assert len(stats) == 33
+    # 3 horizontal runs of 20, 20 vertical runs of 3
+    assert stats[4] == 1.0 and sum(stats[0:8]) == 1.0
+    assert stats[8 + 1] == 1.0
+    # the diagonal runs are 1, 2 or 3 long
+    assert abs(sum(stats[16:24]) - 1.0) < eps
+    assert stats[16 + 2] == 0.0
+    assert stats[32] == 3.0
+    img.fill(0)
+    assert list(img.run_statistics()) == [0.0] * 33
+
+    image = load_image("data/OneBit_generic.png")
+    ccs = image.cc_analysis()
+    features.generate_features_list(ccs, ['run_statistics'], threads=2)
+    for cc in ccs[:20]:
+        assert list(cc.features) == list(cc.run_statistics())
+
+
+# nholes and the volume regions as computed pixel by pixel before they
+# were taken from packed rows and a summed-area table, from the rows of
+# black pixels
+def _nholes_1d(lines):
+    holes = 0
+    for line in lines:
+        last = has_black = False
+        for black in line:
+            if black:
+                last = has_black = True
+            elif last:
+                last = False
+                holes += 1
+        if not last and holes and has_black:
+            holes -= 1
+    return holes
+
+def _old_nholes(rows):
+    cols = zip(*rows)
+    return [float(_nholes_1d(cols)) / len(cols), float(_nholes_1d(rows)) / len(rows)]
+
+def _old_nholes_extended(rows):
+    result = []
+    for lines in (zip(*rows), rows):
+        quarter = len(lines) / 4.0
+        start = 0.0
+        for i in range(4):
+            result.append(_nholes_1d(lines[int(start):int(start) + int(quarter)]) / quarter)
+            start += quarter
+    return result
+
+def _old_volume_regions(rows, n):
+    nrows = len(rows) / float(n)
+    ncols = len(rows[0]) / float(n)
+    width, height = max(int(ncols), 1), max(int(nrows), 1)
+    result = []
+    start_col = 0.0
+    for i in range(n):
+        # the height is not reset between the columns
+        start_row = 0.0
+        for j in range(n):
+            x0, y0 = int(start_col), int(start_row)
+            black = sum([sum(row[x0:x0 + width]) for row in rows[y0:y0 + height]])
+            result.append(float(black) / (width * height))
+            start_row += nrows
+            height = max(int(start_row + nrows) - int(start_row), 1)
+        start_col += ncols
+        width = max(int(start_col + ncols) - int(start_col), 1)
+    return result
+
+def test_nholes_volume_regions_old_results():
+    import random
+    random.seed(135)
+    images = []
+    for ncols in (67, 131, 200):
+        for storage in (DENSE, RLE, PACKED):
+            img = Image((5, 3), Dim(ncols, 37), ONEBIT, storage)
+            for y in range(img.nrows):
+                for x in range(img.ncols):
+                    if random.random() < 0.5:
+                        img.set((x, y), 1)
+            rows = [[img.get((x, y)) != 0 for x in range(img.ncols)]
+                    for y in range(img.nrows)]
+            images.append((img, rows))
+            # a view whose columns do not start at a word boundary
+            images.append((img.subimage((13, 8), Dim(ncols - 8, 30)),
+                           [row[8:] for row in rows[5:35]]))
+            if storage == DENSE:
+                # the biggest component, whose bounding box holds
+                # pixels of the others
+                ccs = img.cc_analysis()
+                ccs.sort(key=lambda cc: cc.nrows * cc.ncols)
+                cc = ccs[-1]
+                assert cc.ncols > 64
+                x0, y0 = cc.offset_x - img.offset_x, cc.offset_y - img.offset_y
+                images.append((cc, [[img.get((x, y)) == cc.label
+                                     for x in range(x0, x0 + cc.ncols)]
+                                    for y in range(y0, y0 + cc.nrows)]))
+    for img, rows in images:
+        assert list(img.nholes()) == _old_nholes(rows)
+        assert list(img.nholes_extended()) == _old_nholes_extended(rows)
+        assert list(img.volume16regions()) == _old_volume_regions(rows, 4)
+        assert list(img.volume64regions()) == _old_volume_regions(rows, 8)
+
+
+# the skeleton features as counted pixel by pixel on the output of
+# thin_lc before they were counted in its final pass
+def _old_skeleton_features(img):
+    skel = img.thin_lc()
+    ncols, nrows = skel.ncols, skel.nrows
+    black = [[skel.get((x, y)) != 0 for x in range(ncols)] for y in range(nrows)]
+    X_joints = T_joints = bend_points = end_points = total = 0
+    center_x = center_y = 0
+    for y in range(nrows):
+        # outside the image, the neighbors are reflected
+        before, after = y == 0 and 1 or y - 1, y == nrows - 1 and nrows - 2 or y + 1
+        for x in range(ncols):
+            if not black[y][x]:
+                continue
+            total += 1
+            center_x += x
+            center_y += y
+            left, right = x == 0 and 1 or x - 1, x == ncols - 1 and ncols - 2 or x + 1
+            p = 0
+            for bit, (nx, ny) in enumerate([(x, before), (right, before), (right, y),
+                                            (right, after), (x, after), (left, after),
+                                            (left, y), (left, before)]):
+                p |= black[ny][nx] << bit
+            N = len([bit for bit in range(8) if p & (1 << bit)])
+            if N == 4:
+                X_joints += 1
+            elif N == 3:
+                T_joints += 1
+            elif N == 2:
+                if not ((p & 17) == 17 or (p & 34) == 34 or (p & 68) == 68 or
+                        (p & 136) == 136):
+                    bend_points += 1
+            elif N == 1:
+                end_points += 1
+    if total == 0:
+        return [0.0] * 6
+    crossings = []
+    for line in ([row[center_x / total] for row in black], black[center_y / total]):
+        count = 0
+        last = False
+        for pixel in line:
+            if pixel and not last:
+                last = True
+                count += 1
+            else:
+                last = False
+        crossings.append(float(count))
+    return [float(X_joints), float(T_joints), float(bend_points) / total,
+            float(end_points)] + crossings
+
+def test_skeleton_features_thin_lc():
+    glyphs = []
+    # a cross, a T, a ring and an L
+    img = Image((0, 0), Dim(31, 27), ONEBIT)
+    img.subimage((12, 0), Dim(7, 27)).fill(1)
+    img.subimage((0, 10), Dim(31, 6)).fill(1)
+    glyphs.append(img)
+    img = Image((10, 20), Dim(25, 30), ONEBIT)
+    img.subimage((10, 20), Dim(25, 5)).fill(1)
+    img.subimage((20, 25), Dim(6, 25)).fill(1)
+    glyphs.append(img)
+    img = Image((0, 0), Dim(30, 24), ONEBIT)
+    img.fill(1)
+    img.subimage((6, 5), Dim(18, 14)).fill(0)
+    glyphs.append(img)
+    img = Image((0, 0), Dim(20, 33), ONEBIT)
+    img.subimage((0, 0), Dim(6, 33)).fill(1)
+    img.subimage((0, 27), Dim(20, 6)).fill(1)
+    glyphs.append(img)
+    # the components of noise
+    import random
+    random.seed(136)
+    img = Image((3, 4), Dim(90, 60), ONEBIT)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            if random.random() < 0.45:
+                img.set((x, y), 1)
+    glyphs.extend([cc for cc in img.cc_analysis() if cc.nrows > 2 and cc.ncols > 2])
+    assert len(glyphs) > 6
+    for glyph in glyphs:
+        assert list(glyph.skeleton_features()) == _old_skeleton_features(glyph)
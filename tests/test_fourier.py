@@ -0,0 +1,53 @@
+import cmath, math
+from gamera.core import *
+init_gamera()
+
+def dft(values, inverse):
+    n = len(values)
+    sign = inverse and 1 or -1
+    return [sum([values[k] * cmath.exp(sign * 2j * math.pi * k * u / n)
+                 for k in range(n)]) for u in range(n)]
+
+def dft2(values, ncols, nrows, inverse):
+    rows = [dft(values[y * ncols:(y + 1) * ncols], inverse) for y in range(nrows)]
+    columns = [dft([row[x] for row in rows], inverse) for x in range(ncols)]
+    scale = inverse and 1.0 / (ncols * nrows) or 1.0
+    return [columns[x][y] * scale for y in range(nrows) for x in range(ncols)]
+
+def _values(img):
+    return [img.get((x, y)) for y in range(img.nrows) for x in range(img.ncols)]
+
+# every row and column length, whatever its factors, must give the
+# direct transform, for real images (two rows at a time) and complex ones
+def test_fft():
+    for ncols, nrows in ((8, 9), (7, 7), (30, 11), (1, 5), (13, 2)):
+        for pixel_type in (GREYSCALE, GREY16, FLOAT, COMPLEX):
+            img = Image((3, 2), Dim(ncols, nrows), pixel_type)
+            for y in range(nrows):
+                for x in range(ncols):
+                    value = (x * 7 + y * 13 + x * y) % 23
+                    if pixel_type == FLOAT:
+                        value = float(value)
+                    elif pixel_type == COMPLEX:
+                        value = complex(value, (x * 3 + y) % 5)
+                    img.set((x, y), value)
+            expected = dft2(_values(img), ncols, nrows, False)
+            for threads in (1, 3):
+                spectrum = img.fft(threads)
+                assert spectrum.ul == img.ul
+                assert spectrum.dim == img.dim
+                for a, b in zip(_values(spectrum), expected):
+                    assert abs(a - b) < 1e-9
+
+# the inverse transform is scaled so that it gives back the image
+def test_inverse_fft():
+    img = Image((0, 0), Dim(25, 12), FLOAT)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            img.set((x, y), float((x * 5 + y * 3) % 11))
+    spectrum = img.fft()
+    expected = dft2(_values(spectrum), img.ncols, img.nrows, True)
+    result = spectrum.inverse_fft()
+    for a, b, c in zip(_values(result), expected, _values(img)):
+        assert abs(a - b) < 1e-9
+        assert abs(a - c) < 1e-9
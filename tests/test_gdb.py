@@ -0,0 +1,90 @@
+import py.test
+
+from gamera.core import *
+init_gamera()
+
+from gamera import gamera_xml, gamera_gdb
+from test_xml import equal_files
+
+features = ['aspect_ratio', 'moments', 'volume64regions']
+
+def test_glyphs_to_gdb():
+   glyphs = gamera_xml.glyphs_from_xml("data/testline.xml")
+   gamera_gdb.glyphs_to_gdb("tmp/testline.gdb", glyphs, False)
+   glyphs = gamera_gdb.glyphs_from_gdb("tmp/testline.gdb")
+   assert len(glyphs) == 66
+   gamera_xml.glyphs_to_xml("tmp/testline_gdb1.xml", glyphs, False)
+   assert equal_files("tmp/testline_gdb1.xml", "data/testline_test1.xml")
+
+def test_glyphs_to_gdb_uncompressed():
+   glyphs = gamera_xml.glyphs_from_xml("data/testline.xml")
+   gamera_gdb.glyphs_to_gdb("tmp/testline_none.gdb", glyphs, False, compression='none')
+   glyphs = gamera_gdb.glyphs_from_gdb("tmp/testline_none.gdb")
+   gamera_xml.glyphs_to_xml("tmp/testline_gdb2.xml", glyphs, False)
+   assert equal_files("tmp/testline_gdb2.xml", "data/testline_test1.xml")
+
+def test_glyphs_to_gdb_with_features():
+   glyphs = gamera_xml.glyphs_with_features_from_xml("data/testline.xml", feature_functions=features)
+   gamera_gdb.glyphs_to_gdb("tmp/testline_features.gdb", glyphs, True)
+   loaded = gamera_gdb.glyphs_from_gdb("tmp/testline_features.gdb")
+   for a, b in zip(glyphs, loaded):
+      assert list(a.features) == list(b.features)
+      assert a.feature_functions == b.feature_functions
+   gdb = gamera_gdb.GDBFile("tmp/testline_features.gdb")
+   matrix = gdb.features()
+   assert len(matrix) == len(glyphs) * gdb.num_features
+   assert list(matrix[:gdb.num_features]) == list(glyphs[0].features)
+   gdb.close()
+
+def test_random_access():
+   glyphs = gamera_xml.glyphs_from_xml("data/testline.xml")
+   gamera_gdb.WriteGDB(glyphs, chunk_size=8).write_filename("tmp/testline_chunks.gdb")
+   gdb = gamera_gdb.GDBFile("tmp/testline_chunks.gdb")
+   assert len(gdb) == 66
+   for i in (0, 7, 8, 40, 65, -1):
+      glyph = gdb[i]
+      assert glyph.dimensions == glyphs[i].dimensions
+      assert glyph.ul == glyphs[i].ul
+      assert glyph.to_rle() == glyphs[i].to_rle()
+      assert glyph.id_name == glyphs[i].id_name
+   py.test.raises(IndexError, gdb.__getitem__, 66)
+   gdb.close()
+
+def test_convert():
+   gamera_gdb.xml_to_gdb("data/testline.xml", "tmp/testline_converted.gdb")
+   gamera_gdb.gdb_to_xml("tmp/testline_converted.gdb", "tmp/testline_converted.xml", False)
+   assert equal_files("tmp/testline_converted.xml", "data/testline_test1.xml")
+
+   symbol_table = gamera_gdb.LoadGDB(parts=['symbol_table']).parse_filename("tmp/testline_converted.gdb").symbol_table
+   gamera_xml.WriteXMLFile([], symbol_table).write_filename("tmp/symbol_table_gdb.xml")
+   assert equal_files("data/symbol_table.xml", "tmp/symbol_table_gdb.xml")
+
+# Error cases
+def test_not_a_gdb():
+   def _test_not_a_gdb():
+      glyphs = gamera_gdb.glyphs_from_gdb("data/testline.xml")
+   py.test.raises(gamera_gdb.GDBError, _test_not_a_gdb)
+
+def test_corrupt_gdb():
+   import random
+   glyphs = gamera_xml.glyphs_from_xml("data/testline.xml")
+   gamera_gdb.WriteGDB(glyphs, compression='none', chunk_size=8).write_filename(
+      "tmp/testline_corrupt.gdb")
+   data = open("tmp/testline_corrupt.gdb", "rb").read()
+   random.seed(81)
+   for i in range(200):
+      corrupt = bytearray(data)
+      for j in range(random.randint(1, 4)):
+         corrupt[random.randrange(len(corrupt))] = random.randrange(256)
+      if i % 3 == 0:
+         # cut out a part, keeping the tail
+         start = random.randrange(len(corrupt) - 16)
+         corrupt = corrupt[:start] + corrupt[random.randint(start, len(corrupt) - 16):]
+      fd = open("tmp/testline_corrupt.gdb", "wb")
+      fd.write(str(corrupt))
+      fd.close()
+      # a corrupt file gives a GDBError, or glyphs if only values changed
+      try:
+         gamera_gdb.glyphs_from_gdb("tmp/testline_corrupt.gdb")
+      except gamera_gdb.GDBError:
+         pass
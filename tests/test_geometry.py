@@ -0,0 +1,124 @@
+import py.test
+
+from gamera.core import *
+init_gamera()
+from gamera.plugins.geometry import convex_hull_from_points
+
+#
+# Tests for the largest empty rectangles
+#
+
+def _three_columns():
+    image = Image((10,10),(60,40))
+    for x in (10, 30, 50):
+        image.draw_filled_rect((x+2,12),(x+15,47),1)
+    return image
+
+def test_max_empty_rects_gutters():
+    image = _three_columns()
+    rects = image.max_empty_rects(n=10, min_width=2, min_height=30)
+    # left and right margins, two gutters
+    assert len(rects) == 4
+    boxes = sorted([(r.ul_x, r.ul_y, r.lr_x, r.lr_y) for r in rects])
+    assert boxes == [(0,0,1,39), (16,0,21,39), (36,0,41,39), (56,0,59,39)]
+
+def test_max_empty_rects_order():
+    image = _three_columns()
+    ccs = image.image_copy().cc_analysis()
+    rects = image.max_empty_rects(ccs, 20)
+    assert rects[0].ncols * rects[0].nrows == \
+           image.max_empty_rect().ncols * image.max_empty_rect().nrows
+    areas = [r.ncols * r.nrows for r in rects]
+    assert areas == sorted(areas, reverse=True)
+    # results are empty and pairwise disjoint
+    for i, r in enumerate(rects):
+        assert SubImage(image, Point(r.ul_x+10, r.ul_y+10), r.size).black_area()[0] == 0
+        for s in rects[i+1:]:
+            assert not r.intersects(s)
+
+def test_max_empty_rects_none():
+    image = Image((0,0),(10,10))
+    image.fill(1)
+    assert image.max_empty_rects([image]) == []
+    assert image.max_empty_rects(n=0) == []
+
+#
+# Tests for the convex hulls
+#
+
+def test_convex_hull_from_points():
+    points = [Point(2,0), Point(0,2), Point(2,4), Point(4,2), Point(2,2),
+              Point(1,1), Point(3,1), Point(0,2), Point(2,0)]
+    hull = convex_hull_from_points(points)
+    # topmost of the leftmost points first, no repeated or inner points
+    assert [(p.x, p.y) for p in hull] == [(0,2), (2,0), (4,2), (2,4)]
+
+def test_convex_hulls():
+    image = Image((5,7),(40,30))
+    image.draw_filled_rect((8,10),(20,12),1)
+    image.draw_line((25,9),(40,30),1)
+    for y in range(21,30):
+        image.draw_filled_rect((15-(y-21),y),(15+(y-21)/2,y),1)
+    image.set((38,8),1)
+    ccs = image.cc_analysis()
+    hulls = image.convex_hulls(ccs)
+    assert len(hulls) == len(ccs) == 4
+    for cc, hull in zip(ccs, hulls):
+        if cc.ncols == cc.nrows == 1:
+            assert [(p.x, p.y) for p in hull] == [(0,0)]
+        else:
+            assert [(p.x, p.y) for p in hull] == \
+                   [(p.x, p.y) for p in cc.convex_hull_as_points()]
+
+#
+# Tests for the graph coloring of ccs
+#
+
+def _grid_of_squares():
+    image = Image((0,0),(60,60))
+    for y in range(0,60,12):
+        for x in range(0,60,12):
+            image.draw_filled_rect((x+2,y+2),(x+8,y+8),1)
+    return image
+
+def test_labeled_region_neighbors():
+    image = Image((0,0),(4,3))
+    for x, y, label in [(0,0,1), (1,0,1), (2,0,2), (3,0,2), (0,1,3), (1,1,3),
+                        (2,1,4), (3,1,4), (0,2,3), (1,2,3), (2,2,4), (3,2,4)]:
+        image.set((x,y), label)
+    # only the lower right diagonal neighbor is compared, so that 2 and 3
+    # do not touch
+    assert image.labeled_region_neighbors() == \
+           [[2,1], [3,1], [4,1], [4,2], [4,3]]
+    assert image.labeled_region_neighbors(False) == \
+           [[2,1], [3,1], [4,2], [4,3]]
+
+def test_labeled_region_neighbors_bands():
+    # tall enough for several bands of rows
+    image = Image((0,0),(30,600))
+    for i in range(198):
+        for y in range(i*3, i*3+6):
+            for x in range((i*7)%25, (i*7)%25+5):
+                image.set((x,y), i+1)
+    pairs = image.labeled_region_neighbors(threads=1)
+    assert pairs == sorted(pairs)
+    for threads in (2, 5):
+        assert image.labeled_region_neighbors(threads=threads) == pairs
+
+def test_graph_color_ccs():
+    image = _grid_of_squares()
+    ccs = image.cc_analysis()
+    colors = [RGBPixel(10*i, 0, 0) for i in range(1,8)]
+    neighbors = image.voronoi_from_labeled_image().labeled_region_neighbors()
+    for method in (0, 1, 2):
+        rgb = image.graph_color_ccs(ccs, colors, method)
+        color = {}
+        for cc in ccs:
+            c = rgb.get((cc.center_x - image.ul_x, cc.center_y - image.ul_y))
+            assert c in colors
+            color[cc.label] = c
+        if method == 2:
+            for a, b in neighbors:
+                assert color[a] != color[b]
+        # background stays white
+        assert rgb.get((0,0)) == RGBPixel(255,255,255)
@@ -206,6 +206,34 @@ def _test_dfs(flag = gamera.graph.FREE):
 
 
 
+# ------------------------------------------------------------------------------
+# traversals running at the same time keep their own visited nodes, and
+# the ids of removed nodes are reused
+def _test_simultaneous_traversals(flag = gamera.graph.FREE):
+   g = gamera.graph.Graph(flag)
+   for i in range(20):
+      g.add_edge(i, (i * 7 + 3) % 20)
+   g.remove_node_and_edges(5)
+   g.remove_node_and_edges(11)
+   g.add_edge(30, 0)
+   g.add_edge(31, 30)
+   bfs = [n() for n in g.BFS(0)]
+   dfs = [n() for n in g.DFS(0)]
+   sizes = [g.size_of_subgraph(n()) for n in g.get_nodes()]
+   a, b = g.BFS(0), g.DFS(0)
+   result_bfs, result_dfs = [], []
+   for n in a:
+      result_bfs.append(n())
+      result_dfs.append(b.next()())
+      # a complete traversal in between
+      assert g.size_of_subgraph(n()) == sizes[[m() for m in g.get_nodes()].index(n())]
+   result_dfs.extend([n() for n in b])
+   assert result_bfs == bfs
+   assert result_dfs == dfs
+   del g
+
+
+
 # ------------------------------------------------------------------------------
 def _test_dijkstra(flag = gamera.graph.FREE):
    #TODO more correct_paths
@@ -990,6 +1018,7 @@ tests_small = [
    _test_remove_difference,
    _test_bfs,
    _test_dfs,
+   _test_simultaneous_traversals,
    _test_dijkstra,
    _test_dijkstra_all_pairs,
    _test_subgraph_roots,
@@ -1138,3 +1167,87 @@ def test_textline_reading_order():
       del img
 
 
+
+
+
+# ------------------------------------------------------------------------------
+def test_frozen_graph():
+   for flag in (gamera.graph.FREE, gamera.graph.UNDIRECTED):
+      g = gamera.graph.Graph(flag)
+      g.add_edges([
+         (1,2,10,True), (1,7,5,True), (2,6,1,True), (2,7,2,True),
+         (6,8,4,True), (7,8,2,True), (7,2,3,True), (7,6,9,True),
+         (8,1,7,True), (8,6,6,True), (3,4,1,True)
+      ])
+      fg = gamera.graph.FrozenGraph(g)
+      assert fg.nnodes == g.nnodes and fg.nedges == g.nedges
+      assert fg.is_directed() == g.is_directed()
+      assert fg.has_node(3) and not fg.has_node(5)
+      for value in (1, 2, 3, 8):
+         assert fg.BFS(value) == [n() for n in g.BFS(value)]
+         assert fg.DFS(value) == [n() for n in g.DFS(value)]
+         paths = g.dijkstra_shortest_path(value)
+         for k, v in fg.dijkstra_shortest_path(value).items():
+            assert paths[k][0] == v[0]
+      try:
+         fg.BFS(5)
+         assert False
+      except KeyError:
+         pass
+
+      nodes = fg.get_nodes()
+      for threads in (1, 2):
+         m = fg.all_pairs_distance_matrix(threads)
+         assert m.nrows == m.ncols == len(nodes)
+         for row, source in enumerate(nodes):
+            paths = fg.dijkstra_shortest_path(source)
+            for col, target in enumerate(nodes):
+               if paths.has_key(target):
+                  assert m.get((col, row)) == paths[target][0]
+               else:
+                  assert m.get((col, row)) == float("inf")
+
+      if not g.is_directed():
+         mst = fg.create_minimum_spanning_tree()
+         assert mst.nnodes == g.nnodes and mst.nedges == g.nnodes - 2
+         assert sum([e.cost for e in mst.get_edges()]) == \
+                sum([e.cost for e in g.create_minimum_spanning_tree().get_edges()])
+
+         fg.colorize(6)
+         for e in g.get_edges():
+            assert fg.get_color(e.from_node) != fg.get_color(e.to_node)
+
+      # later changes to the graph do not change the frozen copy
+      g.add_edge(5, 6)
+      assert not fg.has_node(5)
+      del fg
+      del g
+
+
+
+# ------------------------------------------------------------------------------
+def test_optimize_all_partitions():
+   g = gamera.graph.Undirected()
+   g.add_edges([(1,2), (2,3), (3,1), (3,4), (10,11), (11,12), (20,21)])
+   g.add_node(30)
+   calls = []
+   def score(group):
+      calls.append(group)
+      return 1.0 / (1 + abs(len(group) - 2))
+
+   roots = [1, 10, 20, 30]
+   single = [g.optimize_partitions(root, score) for root in roots]
+   for threads in (1, 2):
+      assert g.optimize_all_partitions(roots, score, 5, 16, "min", None,
+                                       threads) == single
+
+   # with a cache, the groups are only scored once over several calls
+   cache = {}
+   del calls[:]
+   first = g.optimize_all_partitions(roots, score, 5, 16, "min", cache)
+   ncalls = len(calls)
+   assert ncalls > 0 and first == single
+   second = g.optimize_all_partitions(roots, score, 5, 16, "avg", cache)
+   assert len(calls) == ncalls
+   assert second == \
+          [g.optimize_partitions(root, score, 5, 16, "avg") for root in roots]
@@ -0,0 +1,29 @@
+from gamera.core import *
+init_gamera()
+
+# the tiled rendering of the display gives the pixels of the scaled image
+def test_to_buffer_tiled():
+    img = load_image("data/OneBit_generic.png")
+    for scaling in (1.0, 3.0, 0.5, 0.25):
+        if scaling < 1.0:
+            expected = img.to_rgb().downscale_area(int(1.0 / scaling))
+        else:
+            expected = img.to_rgb().scale(scaling, 0)
+        width, height = expected.ncols, expected.nrows
+        buffer = bytearray(width * height * 3)
+        img.to_buffer_tiled(buffer, 0, 0, width, height, scaling)
+        assert str(buffer) == expected.to_string()
+        # again from the tiles kept with the image, shifted by a pixel
+        buffer = bytearray((width - 1) * height * 3)
+        img.to_buffer_tiled(buffer, 1, 0, width - 1, height, scaling)
+        assert str(buffer)[:(width - 1) * 3] == expected.to_string()[3:width * 3]
+
+# changing the pixels drops the rendered tiles
+def test_to_buffer_tiled_changed():
+    img = Image((0, 0), (9, 9), ONEBIT)
+    buffer = bytearray(3)
+    img.to_buffer_tiled(buffer, 0, 0, 1, 1, 1.0)
+    assert buffer[0] == 255
+    img.set((0, 0), 1)
+    img.to_buffer_tiled(buffer, 0, 0, 1, 1, 1.0)
+    assert buffer[0] == 0
@@ -126,6 +126,31 @@ def _test_index(type, value, storage):
    py.test.raises(IndexError, _fail2)
 test_index = make_test(_test_index)
 
+def _test_bulk_get_set(type, value, storage):
+   from array import array
+   image = Image((25, 25), Dim(50, 50), type, storage)
+   values = []
+   for val in value:
+      values.append(val)
+      if len(values) == 50:
+         break
+   points = [(x, (3 * x) % 50) for x in range(len(values))]
+   image.set_pixels(array('l', [c for p in points for c in p]), values)
+   assert image.get_pixels(points) == values
+   assert image.get_pixels(array('l', [c for p in points for c in p])) == \
+       [image.get(p) for p in points]
+   image.set_row(7, values[0])
+   assert image.get_row(7) == [values[0]] * 50
+   row = (values * 50)[:50]
+   image.set_row(8, row)
+   assert image.get_row(8) == row
+   sub = image.subimage((30, 30), Dim(10, 10))
+   assert sub.get_row(0) == [image.get((5 + x, 5)) for x in range(10)]
+   py.test.raises(IndexError, image.get_pixels, [(0, 0), (50, 0)])
+   py.test.raises(IndexError, image.get_row, 50)
+   py.test.raises(ValueError, image.set_row, 0, row[:49])
+test_bulk_get_set = make_test(_test_bulk_get_set)
+
 def test_conversions():
     img = Image((0,0),(9,9),FLOAT)
     img.set((0,0),-5.0)
@@ -150,3 +175,276 @@ def test_conversions():
     assert tmp.get((0,0)) == 0
     assert tmp.get((5,5)) == 85
     assert tmp.get((9,9)) == 255
+
+def test_buffer():
+   image = Image((0, 0), (9, 4), GREYSCALE)
+   for y in range(image.nrows):
+      for x in range(image.ncols):
+         image.set((x, y), y * 10 + x)
+   buffer = memoryview(image)
+   assert buffer.format == "B"
+   assert buffer.shape == (5, 10)
+   assert buffer.tobytes() == "".join([chr(x) for x in range(50)])
+   del buffer
+   # views with shorter rows than the page are strided
+   sub = image.subimage((2, 1), (5, 3))
+   py.test.raises(BufferError, lambda: memoryview(sub).tobytes())
+   py.test.raises(BufferError, memoryview, Image((0, 0), (9, 4), ONEBIT, RLE))
+   # images that share the pixels of another image
+   from gamera.plugins import _string_io
+   shared = _string_io._from_buffer((3, 4), GREYSCALE, image)
+   assert shared.offset_x == 3 and shared.offset_y == 4
+   assert shared.get((5, 2)) == 25
+   shared.set((5, 2), 99)
+   assert image.get((5, 2)) == 99
+   py.test.raises(ValueError, _string_io._from_buffer, (0, 0), GREY16, image)
+
+def test_shared_copy():
+   image = Image((0, 0), (20, 10), GREYSCALE)
+   image.set((3, 4), 7)
+   sub = image.subimage((2, 2), (5, 5))
+   copies = [image.image_copy() for i in range(3)]
+   # the original and the copies are changed independently
+   image.set((3, 4), 9)
+   assert sub.get((1, 2)) == 9
+   assert [copy.get((3, 4)) for copy in copies] == [7, 7, 7]
+   copies[0].fill(0)
+   assert copies[0].get((0, 0)) == 0
+   assert copies[1].get((0, 0)) == 255 and image.get((0, 0)) == 255
+   del copies[1]
+   copies[1].invert()
+   assert copies[1].get((3, 4)) == 248 and image.get((3, 4)) == 9
+   sub.fill(1)
+   assert image.get((3, 4)) == 1 and copies[0].get((3, 4)) == 0
+
+def test_shared_copy_exported():
+   # the pixels of an exported buffer are copied eagerly, so the buffer
+   # keeps showing the image and never the pixels of the copy
+   image = Image((0, 0), (9, 4), GREYSCALE)
+   buffer = memoryview(image)
+   copy = image.image_copy()
+   image.set((0, 0), 7)
+   assert buffer.tobytes()[0] == chr(7)
+   assert copy.get((0, 0)) == 255
+   del copy
+   assert buffer.tobytes()[0] == chr(7)
+   # nor are they resized
+   py.test.raises(BufferError, image.data.dimensions, Dim(5, 5))
+   py.test.raises(BufferError, setattr, image.data, "nrows", 2)
+   assert image.data.nrows == 5
+   del buffer
+   copy = image.image_copy()
+   image.data.dimensions(Dim(10, 6))
+   assert image.data.nrows == 6
+   assert copy.get((0, 0)) == 7
+
+def test_shared_memory():
+   import os, sys, pickle
+   if sys.platform == "win32":
+      return
+   image = Image((3, 5), (30, 20), GREYSCALE)
+   for y in range(image.nrows):
+      for x in range(image.ncols):
+         image.set((x, y), (x * 3 + y) % 256)
+   shared = image.to_shared_memory()
+   assert shared.to_string() == image.to_string()
+   assert shared.offset_x == 3 and shared.offset_y == 5
+   py.test.raises(ValueError, image.shared_memory_handle)
+   handle = pickle.loads(pickle.dumps(shared.shared_memory_handle()))
+   sub = shared.subimage((8, 10), (5, 4))
+   sub_handle = pickle.loads(pickle.dumps(sub.shared_memory_handle()))
+   read, write = os.pipe()
+   pid = os.fork()
+   if pid == 0:
+      # the other process sees and changes the same pixels
+      attached = handle.attach()
+      same = attached.to_string() == image.to_string()
+      attached_sub = sub_handle.attach()
+      same = same and attached_sub.to_string() == sub.to_string()
+      attached_sub.set((0, 0), 1)
+      os.write(write, str(int(same)))
+      os._exit(0)
+   os.waitpid(pid, 0)
+   assert os.read(read, 1) == "1"
+   assert shared.get((5, 5)) == 1
+   del shared, sub
+   py.test.raises(Exception, handle.attach)
+
+def test_memory_budget():
+   import sys, gc
+   gc.collect()
+   before = memory_usage()
+   image = Image((0, 0), (1000, 1100), GREYSCALE)
+   rgb = Image((0, 0), (100, 100), RGB)
+   usage = memory_usage()
+   assert usage["current"][GREYSCALE] - before["current"][GREYSCALE] == 1100000
+   assert usage["current"][RGB] - before["current"][RGB] == 30000
+   assert usage["peak_total"] >= usage["total"]
+   # a shared copy costs nothing until it is changed
+   copy = image.image_copy()
+   assert memory_usage()["total"] == usage["total"]
+   copy.set((0, 0), 1)
+   assert memory_usage()["total"] == usage["total"] + 1100000
+   del copy, rgb
+   assert memory_usage()["total"] == usage["total"] - 30000
+   if sys.platform == "win32":
+      return
+   image.set((999, 1099), 7)
+   try:
+      assert spill_images() > 0
+      assert memory_usage()["spilled"] > 0
+      # the pixels are still there, and can still be changed
+      assert image.get((999, 1099)) == 7 and image.get((500, 500)) == 255
+      image.set((500, 500), 3)
+      assert image.get((500, 500)) == 3
+      assert image.image_copy().get((999, 1099)) == 7
+   finally:
+      spilled = memory_usage()["spilled"]
+      del image
+   assert memory_usage()["spilled"] < spilled
+
+def test_memory_budget_unspillable():
+   # images too small to spill do not make every later image look at
+   # all of them again
+   import sys, time
+   if sys.platform == "win32":
+      return
+   usage = memory_usage()
+   def make(n):
+      start = time.time()
+      images = [Image((0, 0), (9, 9), GREYSCALE) for i in xrange(n)]
+      return images, time.time() - start
+   unlimited = make(20000)[1]
+   set_memory_limit(0.000001, True)
+   try:
+      images, limited = make(20000)
+      assert limited < 2 * unlimited + 0.25
+      # but a new image that can be spilled is
+      spills = memory_usage()["spills"]
+      image = Image((0, 0), (1000, 1100), GREYSCALE)
+      assert memory_usage()["spills"] == spills + 1
+      del images, image
+   finally:
+      set_memory_limit(usage["limit"] / 1048576.0, usage["spill"])
+
+def test_buffer_pool():
+   usage = buffer_pool_usage()
+   image = Image((0, 0), (1000, 1100), GREYSCALE)
+   try:
+      set_buffer_pool_limit(16)
+      clear_buffer_pool()
+      assert buffer_pool_usage()["bytes"] == 0
+      # the images freed by plugins go into the same pool
+      rgb = image.to_rgb()
+      del rgb
+      assert buffer_pool_usage()["buffers"] == 1
+      assert buffer_pool_usage()["bytes"] >= 3300000
+      clear_buffer_pool()
+      assert buffer_pool_usage()["bytes"] == 0
+      rgb = image.to_rgb()
+      set_buffer_pool_limit(0)
+      del rgb
+      assert buffer_pool_usage()["buffers"] == 0
+   finally:
+      set_buffer_pool_limit(usage["limit"] / 1048576.0)
+
+def test_row_spans():
+   # whole pages are one span, views narrower than the page one per row
+   a = Image((0, 0), (12, 6), GREY16)
+   b = Image((0, 0), (12, 6), GREY16)
+   a.fill(0)
+   b.fill(3)
+   sub_a = a.subimage((2, 1), (5, 3))
+   sub_b = b.subimage((2, 1), (5, 3))
+   sub_a.fill(40)
+   sub_a.add_images(sub_b, True)
+   assert a.get((2, 1)) == 43 and a.get((5, 3)) == 43
+   assert a.get((1, 1)) == 0 and a.get((6, 1)) == 0 and a.get((2, 4)) == 0
+   sum = a.add_images(b, False)
+   assert sum.get((0, 0)) == 3 and sum.get((3, 2)) == 46
+   sub_a.invert()
+   assert a.get((4, 2)) == 0xffffffff - 43 and a.get((0, 0)) == 0
+   onebit = Image((0, 0), (12, 6), ONEBIT)
+   sub = onebit.subimage((2, 1), (5, 3))
+   sub.fill(1)
+   result = onebit.xor_image(Image((0, 0), (12, 6), ONEBIT), False)
+   assert result.get((2, 1)) == 1 and result.get((1, 1)) == 0
+
+def test_multiply_add():
+   image = Image((0, 0), (4, 1), GREYSCALE)
+   for x, v in enumerate([0, 10, 100, 200]):
+      image.set((x, 0), v)
+   scaled = image.multiply_add(1.5, 3)
+   assert [scaled.get((x, 0)) for x in range(4)] == [3, 18, 153, 255]
+   wrapped = image.multiply_add(2, -10, saturate=False)
+   assert [wrapped.get((x, 0)) for x in range(4)] == [246, 10, 190, 134]
+   assert image.multiply_add(-1, 255, in_place=True) is None
+   assert [image.get((x, 0)) for x in range(4)] == [255, 245, 155, 55]
+   grey16 = Image((0, 0), (2, 1), GREY16)
+   grey16.set((1, 0), 40000)
+   scaled = grey16.multiply_add(2, 1)
+   assert scaled.get((0, 0)) == 1 and scaled.get((1, 0)) == 65535
+
+def test_multiply_add_images():
+   image = Image((0, 0), (3, 1), GREYSCALE)
+   background = Image((0, 0), (3, 1), GREYSCALE)
+   for x, (v, b) in enumerate([(50, 20), (20, 50), (255, 0)]):
+      image.set((x, 0), v)
+      background.set((x, 0), b)
+   foreground = image.multiply_add_images(background, 1, -1)
+   assert [foreground.get((x, 0)) for x in range(3)] == [30, 0, 255]
+   wrapped = image.multiply_add_images(background, 1, -1, saturate=False)
+   assert [wrapped.get((x, 0)) for x in range(3)] == [30, 226, 255]
+   mean = image.multiply_add_images(background, 0.5, 0.5)
+   assert [mean.get((x, 0)) for x in range(3)] == [35, 35, 128]
+
+def test_combine_threads():
+   # large enough for several blocks, with views narrower than the page
+   a = Image((0, 0), (700, 400), GREYSCALE)
+   b = Image((0, 0), (700, 400), GREYSCALE)
+   for y in range(0, 400, 7):
+      for x in range(0, 700, 3):
+         a.set((x, y), (x + y) % 256)
+         b.set((x, y), (x * y) % 256)
+   sub_a = a.subimage((10, 5), (600, 390))
+   sub_b = b.subimage((0, 0), (600, 390))
+   one = sub_a.add_images(sub_b, False, 1)
+   four = sub_a.add_images(sub_b, False, 4)
+   assert one.to_string() == four.to_string()
+   one = a.multiply_add_images(b, 2, -1, 7, threads=1)
+   four = a.multiply_add_images(b, 2, -1, 7, threads=4)
+   assert one.to_string() == four.to_string()
+
+def test_compare_images():
+   a = Image((0, 0), (20, 10), GREYSCALE)
+   a.fill(100)
+   b = a.image_copy()
+   result = a.compare_images(b)
+   assert result["differing"] == 0 and result["bbox"] is None
+   assert result["mse"] == 0 and result["psnr"] == float("inf")
+   b.set((3, 2), 110)
+   b.set((12, 7), 90)
+   result = a.compare_images(b)
+   assert result["differing"] == 2 and result["mse"] == 200.0 / 200
+   assert str(result["bbox"]) == str(Rect(Point(3, 2), Point(12, 7)))
+   assert a.mse(b) == result["mse"]
+   # the box is in the coordinates of the view
+   sub_a = a.subimage((2, 1), (15, 8))
+   sub_b = b.subimage((2, 1), (15, 8))
+   assert sub_a.compare_images(sub_b)["bbox"].ul == Point(3, 2)
+   # ONEBIT pixels only differ in black and white
+   onebit = Image((0, 0), (70, 3), ONEBIT)
+   labeled = onebit.image_copy()
+   onebit.set((65, 1), 1)
+   labeled.set((65, 1), 5)
+   labeled.set((2, 2), 1)
+   assert onebit.compare_images(labeled)["differing"] == 1
+   rgb = Image((0, 0), (2, 1), RGB)
+   other = rgb.image_copy()
+   other.set((1, 0), RGBPixel(3, 0, 0))
+   assert rgb.mse(other) == 9.0 / 6
+   # the pairs of two lists at once
+   from gamera.plugins.image_utilities import compare_image_pairs
+   results = compare_image_pairs([a, onebit, rgb], [b, labeled, other], 2)
+   assert [r["differing"] for r in results] == [2, 1, 1]
+   py.test.raises(RuntimeError, compare_image_pairs, [a], [onebit])
@@ -82,3 +82,121 @@ def test_search_predicate():
     assert [[5,5], [4,4]] == \
         [n.point for n in tree.k_nearest_neighbors([5,6],2,predicate([5,6]))]
     assert 0 == len(tree.k_nearest_neighbors([5,6],2,predicate([1,2])))
+
+#
+# batch searches
+#
+def test_nearest_neighbors_many():
+    points = [(1,4), (2,4), (1,5), (3,6), (8,9),
+              (3.2,4.2), (4,4), (5,5), (3.8,6), (8,3)]
+    nodes = [KdNode(p) for p in points]
+    tree = KdTree(nodes)
+    queries = [[5,6], (1,1), [8,4], (3,5)] * 50
+    for num_threads in [1, 4, 0]:
+        result = tree.k_nearest_neighbors_many(queries, 3, num_threads)
+        assert len(result) == len(queries)
+        for q, r in zip(queries, result):
+            assert [n.point for n in tree.k_nearest_neighbors(q,3)] == \
+                [n.point for n in r]
+    assert [] == tree.k_nearest_neighbors_many([], 3)
+    py.test.raises(Exception, tree.k_nearest_neighbors_many, [[1,2],[1,2,3]], 3)
+
+#
+# range searches and pairs within a distance
+#
+def test_range_search():
+    points = [(1,4), (2,4), (1,5), (3,6), (8,9),
+              (3.2,4.2), (4,4), (5,5), (3.8,6), (8,3)]
+    nodes = [KdNode(p) for p in points]
+    tree = KdTree(nodes)
+    assert [[5,5], [3.8,6], [3,6]] == \
+        [n.point for n in tree.range_search([5,6],2.1)]
+    assert [] == tree.range_search([20,20],1.0)
+    tree.set_distance(0)
+    assert [[5,5], [3.8,6], [3.2,4.2]] == \
+        [n.point for n in tree.range_search([5,6],1.8)]
+    class predicate(object):
+        def __call__(self, node):
+            return (node.point[1] < 6)
+    assert [[5,5], [3.2,4.2], [4,4]] == \
+        [n.point for n in tree.range_search([5,6],2,predicate())]
+
+def test_pairs_within():
+    import random
+    random.seed(42)
+    points = [(random.randint(0,100), random.randint(0,100)) for i in range(300)]
+    nodes = [KdNode(p, i) for i, p in enumerate(points)]
+    for distance_type in [0, 1, 2]:
+        tree = KdTree(nodes, distance_type)
+        r = 6.5
+        pairs = [tuple(sorted([a.data, b.data])) for a, b in tree.pairs_within(r)]
+        assert len(pairs) == len(set(pairs))
+        expected = []
+        for i in range(len(points)):
+            for j in range(i + 1, len(points)):
+                dx = abs(points[i][0] - points[j][0])
+                dy = abs(points[i][1] - points[j][1])
+                d = [max(dx, dy), dx + dy, (dx*dx + dy*dy) ** 0.5][distance_type]
+                if d <= r:
+                    expected.append((i, j))
+        assert sorted(pairs) == expected
+
+#
+# construction and queries with arrays
+#
+def test_from_array():
+    from array import array
+    points = [(1,4), (2,4), (1,5), (3,6), (8,9),
+              (3.2,4.2), (4,4), (5,5), (3.8,6), (8,3)]
+    coords = array('d', [c for p in points for c in p])
+    nodetree = KdTree([KdNode(p, i) for i, p in enumerate(points)])
+    tree = KdTree.from_array(coords, 2)
+    idtree = KdTree.from_array(coords, 2, array('l', range(100, 110)))
+    assert tree.dimension == 2
+    queries = [[5,6], (1,1), [8,4], (3,5)]
+    qcoords = array('d', [c for q in queries for c in q])
+    ids, dists = tree.k_nearest_neighbors_array(qcoords, 3)
+    assert len(ids) == len(dists) == 12
+    for i, q in enumerate(queries):
+        assert [n.data for n in nodetree.k_nearest_neighbors(q,3)] == \
+            list(ids[3*i:3*i+3])
+        for j in range(3):
+            p = points[ids[3*i+j]]
+            assert abs(dists[3*i+j] - ((p[0]-q[0])**2 + (p[1]-q[1])**2) ** 0.5) < 1e-9
+    assert (ids, dists) == nodetree.k_nearest_neighbors_array(qcoords, 3, 1)
+    assert [i + 100 for i in ids] == list(idtree.k_nearest_neighbors_array(qcoords, 3)[0])
+    assert 10 == len(tree.k_nearest_neighbors_array(array('d', [0,0]), 20)[0])
+    offsets, ids, dists = tree.range_search_array(qcoords, 2.1)
+    assert len(offsets) == 5 and offsets[-1] == len(ids)
+    for i, q in enumerate(queries):
+        assert [n.data for n in nodetree.range_search(q,2.1)] == \
+            list(ids[offsets[i]:offsets[i+1]])
+    first, second = idtree.pairs_within_array(1.5)
+    assert sorted(tuple(sorted([a.data + 100, b.data + 100]))
+                  for a, b in nodetree.pairs_within(1.5)) == \
+        sorted(tuple(sorted(p)) for p in zip(first, second))
+    # node queries need KdNode's
+    py.test.raises(Exception, tree.k_nearest_neighbors, [5,6], 3)
+    py.test.raises(Exception, KdTree.from_array, array('d', [1,2,3]), 2)
+    py.test.raises(Exception, KdTree.from_array, coords, 2, array('l', [1,2]))
+    py.test.raises(Exception, tree.k_nearest_neighbors_array, array('d', [1,2,3]), 2)
+
+def test_parallel_build():
+    from array import array
+    import random
+    random.seed(7)
+    coords = array('d', [random.randint(0,200) for i in range(2*20000)])
+    queries = array('d', [random.random()*200 for i in range(2*100)])
+    result = None
+    for num_threads in [1, 4, 0]:
+        tree = KdTree.from_array(coords, 2, None, 2, num_threads)
+        ids, dists = tree.k_nearest_neighbors_array(queries, 4)
+        offsets, rids, rdists = tree.range_search_array(queries, 2.5)
+        if result is None:
+            result = (list(dists), list(offsets), list(rdists))
+        assert result == (list(dists), list(offsets), list(rdists))
+        for i in range(100):
+            q = queries[2*i:2*i+2]
+            d = [((coords[2*j]-q[0])**2 + (coords[2*j+1]-q[1])**2) ** 0.5 for j in ids[4*i:4*i+4]]
+            assert max(abs(a - b) for a, b in zip(d, dists[4*i:4*i+4])) < 1e-9
+        assert dists[0] <= dists[1] <= dists[2] <= dists[3]
@@ -96,3 +96,96 @@ def load_image_grey16_rle2():
 #    py.test.raises(Exception, load_image_grey16_rle1)
 #    py.test.raises(Exception, load_image_grey16_rle2)
 
+
+def test_map_tiff():
+   from gamera.plugins import tiff_support
+   for name in ("GreyScale", "RGB"):
+      image = load_image("data/%s_generic.tiff" % name)
+      image.save_tiff("tmp/%s_map.tiff" % name)
+      mapped = tiff_support.map_tiff("tmp/%s_map.tiff" % name)
+      assert mapped.to_string() == image.to_string()
+      # changing the mapped image does not change the file
+      mapped.invert()
+      assert load_image("tmp/%s_map.tiff" % name).to_string() == image.to_string()
+
+def test_map_raw():
+   from gamera.plugins import tiff_support
+   image = load_image("data/GreyScale_generic.tiff")
+   f = open("tmp/raw_map.bin", "wb")
+   f.write("header")
+   for y in range(image.nrows):
+      f.write("".join([chr(image.get((x, y))) for x in range(image.ncols)]))
+   f.close()
+   mapped = tiff_support.map_raw("tmp/raw_map.bin", GREYSCALE,
+                                 image.ncols, image.nrows, 6)
+   assert mapped.to_string() == image.to_string()
+
+def test_load_image_region():
+   for name in ("OneBit", "GreyScale", "RGB", "Grey16"):
+      image = load_image("data/%s_generic.tiff" % name)
+      for rect in (Rect(Point(0, 0), Dim(1, 1)), Rect(Point(5, 7), Dim(25, 13)),
+                   Rect(Point(0, 0), image.dim)):
+         region = load_image("data/%s_generic.tiff" % name, rect=rect)
+         assert region.offset_x == rect.offset_x
+         assert region.offset_y == rect.offset_y
+         assert region.nrows == rect.nrows and region.ncols == rect.ncols
+         assert region.to_string() == image.subimage(rect).to_string()
+   region = load_image("data/OneBit_generic.tiff", RLE, Rect(Point(5, 7), Dim(25, 13)))
+   assert region.storage_format_name == "RLE"
+
+def test_tiff_pages():
+   from gamera.plugins import tiff_support
+   image = load_image("data/GreyScale_generic.tiff")
+   assert tiff_support.tiff_page_count("data/GreyScale_generic.tiff") == 1
+   page = tiff_support.load_tiff_page("data/GreyScale_generic.tiff", 0)
+   assert page.to_string() == image.to_string()
+   pages = tiff_support.load_tiff_pages("data/GreyScale_generic.tiff", 0, 5)
+   assert len(pages) == 1
+   assert pages[0].to_string() == image.to_string()
+   pages = list(tiff_support.iter_tiff_pages("data/GreyScale_generic.tiff",
+                                             prefetch=3))
+   assert len(pages) == 1
+   py.test.raises(Exception, tiff_support.load_tiff_page,
+                  "data/GreyScale_generic.tiff", 1)
+
+def test_bytes_round_trip():
+   from gamera.plugins import tiff_support, png_support
+   for name in ("OneBit", "GreyScale", "RGB", "Grey16"):
+      image = load_image("data/%s_generic.tiff" % name)
+      data = image.save_tiff_to_bytes()
+      assert data == open_file_bytes(image, "tmp/bytes.tiff", "save_tiff")
+      loaded = tiff_support.load_tiff_from_bytes(data)
+      assert loaded.to_string() == image.to_string()
+      loaded = png_support.load_PNG_from_bytes(image.save_PNG_to_bytes())
+      assert loaded.to_string() == image.to_string()
+   py.test.raises(Exception, png_support.load_PNG_from_bytes, "not a png")
+   py.test.raises(Exception, tiff_support.load_tiff_from_bytes, "not a tiff")
+
+def open_file_bytes(image, filename, method):
+   getattr(image, method)(filename)
+   f = open(filename, "rb")
+   data = f.read()
+   f.close()
+   return data
+
+def test_save_PNG_options():
+   for name in ("OneBit", "GreyScale", "RGB", "Grey16"):
+      image = load_image("data/%s_generic.tiff" % name)
+      for level, filters in ((-1, 0), (1, 1), (9, 6), (0, 5)):
+         image.save_PNG("tmp/options.png", level, filters)
+         loaded = load_image("tmp/options.png")
+         assert loaded.to_string() == image.to_string()
+   py.test.raises(Exception, image.save_PNG, "tmp/options.png", 10)
+
+def test_save_tiff_group4():
+   from gamera.plugins import tiff_support
+   image = load_image("data/OneBit_generic.tiff")
+   image.save_tiff("tmp/group4.tiff", 1)
+   for compression in (DENSE, RLE):
+      loaded = load_image("tmp/group4.tiff", compression)
+      assert loaded.to_string() == image.to_string()
+   data = image.save_tiff_to_bytes(1)
+   loaded = tiff_support.load_tiff_from_bytes(data, RLE)
+   assert loaded.to_string() == image.to_string()
+   grey = load_image("data/GreyScale_generic.tiff")
+   py.test.raises(Exception, grey.save_tiff, "tmp/group4.tiff", 1)
@@ -0,0 +1,169 @@
+import cmath, math
+from gamera.core import *
+init_gamera()
+
+def window_values(img, x, y, k, border_treatment):
+    values = []
+    for wy in range(y - k / 2, y + k / 2 + 1):
+        for wx in range(x - k / 2, x + k / 2 + 1):
+            if 0 <= wx < img.ncols and 0 <= wy < img.nrows:
+                values.append(img.get((wx, wy)))
+            elif border_treatment == 1:
+                rx = -wx if wx < 0 else wx
+                if rx >= img.ncols:
+                    rx = 2 * img.ncols - rx - 2
+                ry = -wy if wy < 0 else wy
+                if ry >= img.nrows:
+                    ry = 2 * img.nrows - ry - 2
+                values.append(img.get((rx, ry)))
+            else:
+                values.append(img.white())
+    values.sort()
+    return values
+
+# the r-th smallest value of every window, whatever the pixel type and
+# the number of threads
+def test_rank():
+    for pixel_type in (GREYSCALE, GREY16, FLOAT):
+        img = Image((0, 0), (22, 16), pixel_type)
+        for y in range(img.nrows):
+            for x in range(img.ncols):
+                img.set((x, y), (x * 37 + y * 101 + x * y * 7) % 251)
+        for (k, r, border_treatment) in ((3, 5, 1), (7, 1, 0), (7, 49, 1), (5, 9, 0)):
+            ranked = img.rank(r, k, border_treatment, threads=1)
+            for y in range(img.nrows):
+                for x in range(img.ncols):
+                    assert ranked.get((x, y)) == \
+                           window_values(img, x, y, k, border_treatment)[r - 1]
+            for threads in (0, 2, 5):
+                assert img.rank(r, k, border_treatment, threads).to_string() == \
+                       ranked.to_string()
+
+# filtering in place returns the image itself with the pixels of the copy
+def test_in_place():
+    for pixel_type in (GREYSCALE, FLOAT):
+        img = Image((0, 0), (22, 16), pixel_type)
+        for y in range(img.nrows):
+            for x in range(img.ncols):
+                img.set((x, y), (x * 37 + y * 101 + x * y * 7) % 251)
+        for k in (3, 5):
+            for (name, args) in (("mean", (k, 1)), ("rank", (5, k, 0)),
+                                 ("min_max_filter", (k, 1, 0))):
+                filtered = getattr(img, name)(*args)
+                copy = img.image_copy()
+                assert getattr(copy, name)(*args, in_place=True) is copy
+                assert copy.to_string() == filtered.to_string()
+
+# straightforward kFill: counts of every window taken from the image of the
+# previous iteration
+def kfill_windows(img, k):
+    def black(x, y):
+        return 0 <= x < img.ncols and 0 <= y < img.nrows and img.get((x, y)) != 0
+    for y in range(img.nrows - k + 3):
+        for x in range(img.ncols - k + 3):
+            core = [img.get((cx, cy)) == 1 for cy in range(y, y + k - 2)
+                    for cx in range(x, x + k - 2)].count(True)
+            ring = [black(px, y - 1) for px in range(x - 1, x + k - 2)] + \
+                   [black(x + k - 2, py) for py in range(y - 1, y + k - 2)] + \
+                   [black(px, y + k - 2) for px in range(x + k - 2, x - 1, -1)] + \
+                   [black(x - 1, py) for py in range(y + k - 2, y - 1, -1)]
+            n = ring.count(True)
+            r = [ring[i * (k - 1)] for i in range(4)].count(True)
+            c = len([i for i in range(len(ring)) if ring[i] != ring[i - 1]]) / 2
+            yield x, y, core, n, r, c
+
+def kfill_condition(k, n, r, c):
+    return c <= 1 and (n > 3 * k - 4 or (n == 3 * k - 4 and r == 2))
+
+def kfill_reference(img, k, iterations):
+    res = img.image_copy()
+    for i in range(iterations):
+        tmp = res.image_copy()
+        changed = False
+        for (x, y, core, n, r, c) in kfill_windows(tmp, k):
+            if core == 0 and kfill_condition(k, n, r, c):
+                value = 1
+            elif core == (k - 2) ** 2 and kfill_condition(k, 4 * (k - 1) - n, 4 - r, c):
+                value = 0
+            else:
+                continue
+            changed = True
+            for cy in range(y, y + k - 2):
+                for cx in range(x, x + k - 2):
+                    res.set((cx, cy), value)
+        if not changed:
+            break
+    return res
+
+def kfill_modified_reference(img, k):
+    res = Image(img, ONEBIT)
+    for (x, y, core, n, r, c) in kfill_windows(img, k):
+        if 2 * core >= (k - 2) ** 2:
+            value = int(not kfill_condition(k, 4 * (k - 1) - n, 4 - r, c))
+        else:
+            value = int(kfill_condition(k, n, r, c))
+        for cy in range(y, y + k - 2):
+            for cx in range(x, x + k - 2):
+                res.set((cx, cy), value)
+    return res
+
+# the sliding window counts and the iterations over changed windows only
+# give the same result as recounting every window
+def test_kfill():
+    img = Image((0, 0), (23, 17), ONEBIT)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            if (x * 37 + y * 101 + x * y * 7) % 11 < 5:
+                img.set((x, y), 1)
+    for k in (3, 4, 5, 7):
+        for iterations in (1, 3):
+            assert img.kfill(k, iterations).to_string() == \
+                   kfill_reference(img, k, iterations).to_string()
+        assert img.kfill_modified(k).to_string() == \
+               kfill_modified_reference(img, k).to_string()
+
+def dft(values, inverse):
+    n = len(values)
+    sign = inverse and 1 or -1
+    return [sum([values[k] * cmath.exp(sign * 2j * math.pi * k * u / n)
+                 for k in range(n)]) for u in range(n)]
+
+def dft2(values, ncols, nrows, inverse):
+    rows = [dft(values[y * ncols:(y + 1) * ncols], inverse) for y in range(nrows)]
+    columns = [dft([row[x] for row in rows], inverse) for x in range(ncols)]
+    scale = inverse and 1.0 / (ncols * nrows) or 1.0
+    return [columns[x][y] * scale for y in range(nrows) for x in range(ncols)]
+
+# each response is the image convolved with the filter of
+# create_gabor_filter, and the pooled energies are its block means
+def test_gabor_filter_bank():
+    orientations, frequencies = [0.0, 2.0], [0.1, 0.3]
+    # 9 has the factor 3, 67 is filtered through a power of two
+    for (ncols, nrows) in ((9, 8), (67, 2)):
+        img = Image((0, 0), (ncols, nrows), GREYSCALE)
+        for y in range(nrows):
+            for x in range(ncols):
+                img.set((x, y), (x * 37 + y * 101 + x * y * 7) % 251)
+        values = [img.get((x, y)) for y in range(nrows) for x in range(ncols)]
+        spectrum = dft2(values, ncols, nrows, False)
+        responses = img.gabor_filter_bank(orientations, frequencies, threads=1)
+        energies = img.gabor_filter_bank(orientations, frequencies, block_size=4)
+        assert len(responses) == len(energies) == 4
+        i = 0
+        for frequency in frequencies:
+            for orientation in orientations:
+                kernel = img.create_gabor_filter(orientation, frequency, 5)
+                expected = dft2([spectrum[j] * kernel.get((j % ncols, j / ncols))
+                                 for j in range(ncols * nrows)], ncols, nrows, True)
+                for y in range(nrows):
+                    for x in range(ncols):
+                        assert abs(responses[i].get((x, y)) - expected[y * ncols + x]) < 1e-9
+                assert energies[i].ncols == (ncols + 3) / 4
+                assert energies[i].nrows == (nrows + 3) / 4
+                for by in range(energies[i].nrows):
+                    for bx in range(energies[i].ncols):
+                        block = [abs(expected[y * ncols + x]) ** 2
+                                 for y in range(by * 4, min(nrows, by * 4 + 4))
+                                 for x in range(bx * 4, min(ncols, bx * 4 + 4))]
+                        assert abs(energies[i].get((bx, by)) - sum(block) / len(block)) < 1e-6
+                i += 1
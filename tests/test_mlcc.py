@@ -93,3 +93,17 @@ def test_mlcc():
    cclabels = [c.label for c in ccs]; cclabels.sort()
    mlcclabels = mlcc.get_labels(); mlcclabels.sort()
    assert cclabels == mlcclabels
+
+def test_mlcc_label_membership():
+   # labels above, below and between the stored ones must stay white
+   img=Image((0,0),(8,8))
+   for x, label in enumerate([1, 7, 300, 8, 299, 301]):
+      img.set((x,0),label)
+   mlcc = MlCc(img, 7, Rect((0,0),(7,0)))
+   mlcc.add_label(300, Rect((0,0),(7,0)))
+   assert [0,7,300,0,0,0] == [mlcc.get((x,0)) for x in range(6)]
+   mlcc.remove_label(300)
+   assert False == mlcc.has_label(300)
+   assert [0,7,0,0,0,0] == [mlcc.get((x,0)) for x in range(6)]
+   py.test.raises(Exception, mlcc.relabel, [7, 42])
+   assert [7] == mlcc.get_labels()
@@ -0,0 +1,65 @@
+from gamera.core import *
+init_gamera()
+from math import sqrt
+
+# the Euclidean distance is exact and does not depend on the threads,
+# the chamfer distance uses steps of 3 and 4
+def test_distance_transform():
+    img = Image((0, 0), (30, 20), ONEBIT)
+    img.fill(1)
+    for (x, y) in ((0, 0), (17, 4), (30, 20), (8, 15)):
+        img.set((x, y), 0)
+    whites = [(x, y) for y in range(img.nrows) for x in range(img.ncols)
+              if img.get((x, y)) == 0]
+    euclidean = img.distance_transform(2, threads=1)
+    chamfer = img.distance_transform(3)
+    assert chamfer.data.pixel_type == GREY16
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            expected = min([sqrt((x - wx) ** 2 + (y - wy) ** 2) for (wx, wy) in whites])
+            assert abs(euclidean.get((x, y)) - expected) < 1e-9
+            steps = [(abs(x - wx), abs(y - wy)) for (wx, wy) in whites]
+            assert chamfer.get((x, y)) == \
+                   min([4 * min(dx, dy) + 3 * abs(dx - dy) for (dx, dy) in steps])
+    for threads in (0, 2, 3):
+        assert img.distance_transform(2, threads=threads).to_string() == \
+               euclidean.to_string()
+
+# long lines and squares, which are split into rectangles, give the
+# same result as the structuring element added pixel by pixel
+def test_large_structures():
+    img = Image((0, 0), (99, 59), ONEBIT)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            if x % 50 != 7 and y % 29 != 3 and (x * 7 + y * 13) % 97 != 0:
+                img.set((x, y), 1)
+    for (ncols, nrows, origin) in ((41, 1, (20, 0)), (1, 31, (0, 3)),
+                                   (15, 15, (7, 7)), (9, 5, (12, 2))):
+        se = Image((0, 0), (ncols - 1, nrows - 1), ONEBIT)
+        se.fill(1)
+        offsets = [(x - origin[0], y - origin[1])
+                   for y in range(nrows) for x in range(ncols)]
+        dilated = img.dilate_with_structure(se, origin)
+        eroded = img.erode_with_structure(se, origin)
+        for (x, y) in ((0, 0), (50, 30), (99, 59), (20, 3), (75, 40)):
+            inside = [(x + dx, y + dy) for (dx, dy) in offsets
+                      if 0 <= x + dx < img.ncols and 0 <= y + dy < img.nrows]
+            assert eroded.get((x, y)) == \
+                   int(len(inside) == len(offsets) and img.get((x, y)) == 1 and
+                       min([img.get(p) for p in inside]) == 1)
+            dilated_here = [(x - dx, y - dy) for (dx, dy) in offsets
+                            if 0 <= x - dx < img.ncols and 0 <= y - dy < img.nrows]
+            assert dilated.get((x, y)) == \
+                   int(max([0] + [img.get(p) for p in dilated_here]) == 1)
+    grey = load_image("data/GreyScale_generic.png")
+    assert grey.erode_dilate(3, 1, 0).to_string() == \
+           grey.erode().erode().erode().to_string()
+
+def test_erode_dilate_in_place():
+    for img in (load_image("data/GreyScale_generic.png"),
+                load_image("data/OneBit_generic.png")):
+        for (times, direction, shape) in ((1, 0, 0), (2, 1, 0), (2, 0, 1)):
+            result = img.erode_dilate(times, direction, shape)
+            copy = img.image_copy()
+            assert copy.erode_dilate(times, direction, shape, in_place=True) is copy
+            assert copy.to_string() == result.to_string()
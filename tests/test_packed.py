@@ -0,0 +1,108 @@
+from gamera.core import *
+init_gamera()
+
+def test_packed1():
+   image1 = load_image("data/testline.png")
+   image2 = load_image("data/testline.png", PACKED)
+
+   # Check basic PACKED image loading
+   assert image2.pixel_type_name == "OneBit"
+   assert image2.storage_format_name == "Packed"
+   assert image2.nrows == 44
+   assert image2.ncols == 907
+   assert image2.black_area()[0] == 5174.0
+
+   # A packed image needs (at most) one bit per pixel plus row padding
+   assert image2.memory_size < image1.memory_size / 8
+
+   # Compare PACKED to DENSE image
+   assert image1._to_raw_string() == image2._to_raw_string()
+   assert image1.to_rle() == image2.to_rle()
+
+   # Use iterators in unusual ways
+   assert image1.projection_rows() == image2.projection_rows()
+   assert image1.projection_cols() == image2.projection_cols()
+   assert image1.most_frequent_run("black","vertical") == image2.most_frequent_run("black","vertical")
+   assert image1.most_frequent_run("black","horizontal") == image2.most_frequent_run("black","horizontal")
+
+   # cc_analysis labels a DENSE copy
+   ccs1 = image1.cc_analysis()
+   ccs2 = image2.cc_analysis()
+   assert len(ccs1) == len(ccs2)
+   for a, b in zip(ccs1, ccs2):
+      assert a.ul == b.ul and a.lr == b.lr
+      assert a.label == b.label
+      assert a._to_raw_string() == b._to_raw_string()
+
+def test_packed_get_set():
+   # an odd width that does not fill the last word of each row
+   image = Image(Point(0, 0), Dim(131, 7), ONEBIT, PACKED)
+   assert image.storage_format_name == "Packed"
+   for y in range(image.nrows):
+      for x in range(y, image.ncols, 3):
+         image.set(Point(x, y), 1)
+   dense = image.image_copy(DENSE)
+   for y in range(image.nrows):
+      for x in range(image.ncols):
+         assert image.get(Point(x, y)) == dense.get(Point(x, y))
+         assert image.get(Point(x, y)) == ((x >= y and (x - y) % 3 == 0) and 1 or 0)
+   # any non-zero value is stored as black
+   image.set(Point(5, 5), 42)
+   assert image.get(Point(5, 5)) == 1
+   image.set(Point(5, 5), 0)
+   assert image.get(Point(5, 5)) == 0
+
+def test_packed_subimage():
+   image = load_image("data/testline.png", PACKED)
+   dense = image.image_copy(DENSE)
+   sub1 = SubImage(image, Point(70, 3), Dim(100, 30))
+   sub2 = SubImage(dense, Point(70, 3), Dim(100, 30))
+   assert sub1._to_raw_string() == sub2._to_raw_string()
+   copy = sub2.image_copy(PACKED)
+   assert copy.storage_format_name == "Packed"
+   assert copy._to_raw_string() == sub1._to_raw_string()
+
+def test_packed_cc():
+   image = Image(Point(0, 0), Dim(10, 10), ONEBIT, PACKED)
+   try:
+      Cc(image, 1, Point(0, 0), Dim(5, 5))
+   except TypeError:
+      pass
+   else:
+      assert False
+
+def test_packed_word_kernels():
+   dense = load_image("data/testline.png")
+   packed = dense.image_copy(PACKED)
+   other = dense.image_copy(DENSE)
+   other.mirror_horizontal()
+   other_packed = other.image_copy(PACKED)
+   # logical operations on whole words give the same result as per pixel
+   for op in ("and_image", "or_image", "xor_image"):
+      a = getattr(dense, op)(other, False)
+      b = getattr(packed, op)(other_packed, False)
+      assert a._to_raw_string() == b._to_raw_string()
+   a = dense.and_image(other, False)
+   assert a.black_area()[0] < dense.black_area()[0]
+   # in place on unaligned subimages
+   full_dense = dense.image_copy()
+   full_packed = packed.image_copy()
+   sub_dense = SubImage(full_dense, Point(37, 5), Dim(301, 30))
+   sub_packed = SubImage(full_packed, Point(37, 5), Dim(301, 30))
+   sub_other = SubImage(other, Point(100, 10), Dim(301, 30))
+   sub_other_packed = SubImage(other_packed, Point(100, 10), Dim(301, 30))
+   sub_dense.xor_image(sub_other, True)
+   sub_packed.xor_image(sub_other_packed, True)
+   assert sub_dense._to_raw_string() == sub_packed._to_raw_string()
+   # and the pixels around the subimage are untouched
+   assert full_packed._to_raw_string() == full_dense._to_raw_string()
+   # morphology
+   for times in (1, 2, 3):
+      for geo in (0, 1):
+         for direction in (0, 1):
+            a = dense.erode_dilate(times, direction, geo)
+            b = packed.erode_dilate(times, direction, geo)
+            assert b.storage_format_name == "Packed"
+            assert a._to_raw_string() == b._to_raw_string()
+   assert dense.erode()._to_raw_string() == packed.erode()._to_raw_string()
+   assert dense.dilate()._to_raw_string() == packed.dilate()._to_raw_string()
@@ -10,6 +10,7 @@ from gamera import plugin
 class PluginTester(gendoc.PluginDocumentationGenerator):
    def __init__(self):
       self.images = self.get_generic_images()
+      plugin.load_lazy_plugins()
       self.methods = plugin._methods_flatten(plugin.plugin_methods)
 
 class TestPlugins:
@@ -23,3 +24,219 @@ def make_test(tester, method):
 tester = PluginTester()
 for name, method in tester.methods:
    setattr(TestPlugins, "test_plugin_" + name, make_test(tester, method))
+
+# the statistics count the calls of the C++ plugins while enabled
+def test_plugin_stats():
+   image = load_image("data/OneBit_generic.png")
+   plugin.reset_stats()
+   plugin.enable_stats()
+   try:
+      image.downscale_area(4)
+      image.downscale_area(4)
+      grey = image.to_greyscale()
+      grey.downscale_area(2)
+   finally:
+      plugin.enable_stats(False)
+   image.downscale_area(4)
+   entries = {}
+   for name, pixel_type, calls, seconds, pixels, bytes in plugin.stats():
+      entries[(name, pixel_type)] = (calls, pixels, bytes)
+   small = (image.ncols + 3) / 4 * ((image.nrows + 3) / 4)
+   assert entries[("downscale_area", "OneBit")] == \
+          (2, 2.0 * image.ncols * image.nrows, 2.0 * small)
+   assert entries[("downscale_area", "GreyScale")][0] == 1
+   plugin.reset_stats()
+   assert plugin.stats() == []
+
+def test_result_cache():
+   import os, shutil, array, cPickle
+   from gamera import result_cache
+   image = load_image("data/GreyScale_generic.tiff")
+   expected = image.otsu_threshold()
+   if os.path.exists("tmp/result_cache"):
+      shutil.rmtree("tmp/result_cache")
+   result_cache.enable(directory="tmp/result_cache")
+   try:
+      if hasattr(os, "getuid"):
+         assert os.stat("tmp/result_cache").st_mode & 0777 == 0700
+      first = image.otsu_threshold()
+      second = image.otsu_threshold()
+      assert result_cache.stats()[:3] == (1, 0, 1)
+      assert second.to_string() == expected.to_string()
+      # results are copies
+      second.fill(1)
+      assert image.otsu_threshold().to_string() == expected.to_string()
+      # other arguments and other pixels are computed again
+      image.otsu_threshold(1)
+      image.image_copy().otsu_threshold()
+      assert result_cache.stats()[:3] == (3, 0, 2)
+      image.set((0, 0), 255 - image.get((0, 0)))
+      image.otsu_threshold()
+      assert result_cache.stats()[2] == 3
+      # results are found on disk when they are not in memory
+      image.set((0, 0), 255 - image.get((0, 0)))
+      result_cache.clear()
+      assert image.otsu_threshold().to_string() == expected.to_string()
+      assert result_cache.stats()[:3] == (3, 1, 3)
+      # the stored results are read back with their types
+      value = [None, True, 2, 1L << 70, 0.5, 1j, "a\0b", u"\xe9",
+               array.array('d', [1.5]), (1, [2]), {"k": (3,)}, expected]
+      result_cache._write("tmp/result_cache", "values", value)
+      found, stored = result_cache._read("tmp/result_cache", "values")
+      assert found
+      assert stored[:-1] == value[:-1]
+      assert [type(x) for x in stored[:-1]] == [type(x) for x in value[:-1]]
+      assert stored[-1].to_string() == expected.to_string()
+      # files that are not results, pickles among them, are misses
+      f = open("tmp/result_cache/values.result", "wb")
+      f.write(cPickle.dumps(value[:-1], 2))
+      f.close()
+      assert result_cache._read("tmp/result_cache", "values") == (False, None)
+   finally:
+      result_cache.disable()
+      shutil.rmtree("tmp/result_cache")
+   # directories others can access are refused
+   if hasattr(os, "getuid"):
+      os.makedirs("tmp/result_cache", 0755)
+      os.chmod("tmp/result_cache", 0755)
+      try:
+         try:
+            result_cache.enable(directory="tmp/result_cache")
+         except IOError:
+            pass
+         else:
+            assert False
+      finally:
+         result_cache.disable()
+         shutil.rmtree("tmp/result_cache")
+
+# lazy chains of pointwise plugins give the images of the plugins
+def test_pointwise():
+   grey = load_image("data/GreyScale_generic.tiff")
+   rgb = load_image("data/RGB_generic.tiff")
+   onebit = load_image("data/OneBit_generic.png")
+   other = grey.image_copy()
+   other.invert()
+   difference = grey.subtract_images(other)
+   difference.invert()
+   expected = difference.threshold(128)
+   result = grey.lazy().subtract_images(other).invert().threshold(128).evaluate()
+   assert result.data.pixel_type == ONEBIT
+   assert result.to_string() == expected.to_string()
+   # subimages, expressions as operands and the conversions
+   view = rgb.subimage((3, 5), Dim(60, 40))
+   grey_view = view.to_greyscale()
+   expected = grey_view.multiply_add_images(grey_view.multiply_add(0.5, 10), 1, -1)
+   lazy_grey = view.lazy().to_greyscale()
+   result = lazy_grey.multiply_add_images(lazy_grey.multiply_add(0.5, 10), 1, -1)
+   assert result.evaluate(2).to_string() == expected.to_string()
+   assert result.evaluate().ul == view.ul
+   expected = onebit.xor_image(onebit.to_float().threshold(0)).to_float()
+   result = onebit.lazy().xor_image(onebit.lazy().to_float().threshold(0)).to_float()
+   assert result.evaluate().to_string() == expected.to_string()
+   # operations that are not pointwise are computed when they are called
+   expected = grey.to_float().to_greyscale().threshold(100)
+   result = grey.lazy().to_float().to_greyscale().threshold(100)
+   assert result.evaluate().to_string() == expected.to_string()
+   # and so are the other methods of images
+   assert result.black_area() == expected.black_area()
+
+# plugin modules loaded on first use of their methods
+_lazy_plugin_source = '''
+from gamera.plugin import *
+class %(method)s(PluginFunction):
+   """A method of a test plugin."""
+   pure_python = True
+   self_type = ImageType(ALL)
+   return_type = Class("result")
+   args = Args([Int("a"), Int("b", default=2)])
+   def __call__(self, a, b=2):
+      return (self.ncols, a, b)
+   __call__ = staticmethod(__call__)
+class LazyTestModule(PluginModule):
+   category = "LazyTest"
+   functions = [%(method)s]
+module = LazyTestModule()
+'''
+
+def _lazy_plugin(directory, name, method):
+   import os
+   if not os.path.exists(directory):
+      os.makedirs(directory)
+   open(os.path.join(directory, name + ".py"), "w").write(
+      _lazy_plugin_source % {"method": method})
+
+def _lazy_plugin_test(test):
+   # runs test with an index of its own and the test plugins importable
+   import os, sys, shutil
+   directory = os.path.abspath("tmp/lazy_plugins")
+   index = plugin.plugin_index
+   plugin.plugin_index = os.path.abspath("tmp/lazy_plugin_index")
+   sys.path.insert(0, directory)
+   try:
+      test(directory)
+   finally:
+      del sys.path[0]
+      plugin.plugin_index = index
+      shutil.rmtree(directory)
+      if os.path.exists("tmp/lazy_plugin_index"):
+         os.remove("tmp/lazy_plugin_index")
+
+def test_lazy_plugin_stub():
+   import sys
+   def test(directory):
+      _lazy_plugin(directory, "lazy_plugin_a", "lazy_method_a")
+      signature = plugin._plugin_signature(directory)
+      plugin._write_plugin_index(directory, signature,
+                                 [("lazy_plugin_a", None, ["lazy_method_a"], ["LazyTest"])])
+      plugin.import_plugins(directory)
+      assert not sys.modules.has_key("lazy_plugin_a")
+      image = Image((0, 0), Dim(7, 3), GREYSCALE)
+      # the stub imports the module and passes its arguments on
+      assert image.lazy_method_a(1, b=5) == (7, 1, 5)
+      assert sys.modules.has_key("lazy_plugin_a")
+      assert image.lazy_method_a(3) == (7, 3, 2)
+   _lazy_plugin_test(test)
+
+def test_lazy_plugin_index_rebuilt():
+   def test(directory):
+      _lazy_plugin(directory, "lazy_plugin_b", "lazy_method_b")
+      plugin._write_plugin_index(directory, plugin._plugin_signature(directory),
+                                 [("lazy_plugin_b", None, ["lazy_method_b"], ["LazyTest"])])
+      # a changed plugin file makes the index stale
+      _lazy_plugin(directory, "lazy_plugin_b", "lazy_method_b_changed")
+      signature = plugin._plugin_signature(directory)
+      assert plugin._read_plugin_index(directory, signature) is None
+      plugin.import_plugins(directory)
+      entries = plugin._read_plugin_index(directory, signature)
+      assert [(name, methods) for name, failed, methods, categories in entries] == \
+             [("lazy_plugin_b", ["lazy_method_b_changed"])]
+      image = Image((0, 0), Dim(4, 4), ONEBIT)
+      assert image.lazy_method_b_changed(2) == (4, 2, 2)
+   _lazy_plugin_test(test)
+
+def test_lazy_plugin_missing_method():
+   import py.test
+   def test(directory):
+      _lazy_plugin(directory, "lazy_plugin_c", "lazy_method_c")
+      plugin._write_plugin_index(directory, plugin._plugin_signature(directory),
+                                 [("lazy_plugin_c", None, ["lazy_method_c", "lazy_method_gone"],
+                                   ["LazyTest"])])
+      plugin.import_plugins(directory)
+      image = Image((0, 0), Dim(4, 4), ONEBIT)
+      py.test.raises(AttributeError, image.lazy_method_gone)
+      assert image.lazy_method_c(1) == (4, 1, 2)
+   _lazy_plugin_test(test)
+
+def test_lazy_plugin_unwritable_index():
+   import os, sys
+   def test(directory):
+      # the index cannot be written, so the plugins are imported at once
+      plugin.plugin_index = os.path.join(directory, "missing", "index")
+      _lazy_plugin(directory, "lazy_plugin_d", "lazy_method_d")
+      plugin.import_plugins(directory)
+      assert sys.modules.has_key("lazy_plugin_d")
+      assert not os.path.exists(os.path.join(directory, "missing"))
+      image = Image((0, 0), Dim(4, 4), ONEBIT)
+      assert image.lazy_method_d(1) == (4, 1, 2)
+   _lazy_plugin_test(test)
@@ -0,0 +1,81 @@
+import math
+from gamera.core import *
+init_gamera()
+
+def _image(storage=DENSE):
+    img = Image((0, 0), (46, 38), ONEBIT, storage)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            if (x * 5 + y * 11 + (x / 7) * y) % 13 < 6:
+                img.set((x, y), 1)
+    return img
+
+# the projections computed from the runs must count every black pixel
+# in the bin of its rotated coordinate
+def test_projection_skewed():
+    img = _image()
+    angles = [0.0, 0.7, -2.3, 15.0, -45.0, 90.0]
+    rows = img.projection_skewed_rows(angles)
+    cols = img.projection_skewed_cols(angles)
+    for angle, row, col in zip(angles, rows, cols):
+        sina = math.sin(angle * math.pi / 180.0)
+        cosa = math.cos(angle * math.pi / 180.0)
+        expected_rows = [0] * img.nrows
+        expected_cols = [0] * img.ncols
+        for y in range(img.nrows):
+            for x in range(img.ncols):
+                if img.get((x, y)):
+                    r = int(math.floor(x * sina + y * cosa + 0.5))
+                    if 0 < r < img.nrows:
+                        expected_rows[r] += 1
+                    c = int(math.floor(x * cosa - y * sina + 0.5))
+                    if 0 < c < img.ncols:
+                        expected_cols[c] += 1
+        assert list(row) == expected_rows
+        assert list(col) == expected_cols
+
+def test_rotation_angle_projections():
+    img = Image((0, 0), (199, 99), ONEBIT)
+    slope = math.tan(1.2 * math.pi / 180.0)
+    for line in range(10, 90, 12):
+        for x in range(img.ncols):
+            for y in range(3):
+                img.set((x, int(line + y + x * slope)), 1)
+    angle, accuracy = img.rotation_angle_projections()
+    assert abs(angle + 1.2) < 0.3
+
+# the projections counted row by row must not depend on the storage
+# or on the number of threads
+def test_projections_threads():
+    img = _image()
+    expected_rows = [len([x for x in range(img.ncols) if img.get((x, y))])
+                     for y in range(img.nrows)]
+    expected_cols = [len([y for y in range(img.nrows) if img.get((x, y))])
+                     for x in range(img.ncols)]
+    for image in (img, _image(PACKED), img.subimage(Point(3, 2), Dim(40, 30))):
+        for threads in (0, 1, 3):
+            rows = image.projection_rows(threads)
+            cols = image.projection_cols(threads)
+            if image is img:
+                assert list(rows) == expected_rows
+                assert list(cols) == expected_cols
+            assert image.projections() == (rows, cols)
+
+def test_strip_projections():
+    img = _image()
+    x_bounds = [0, 10, 10, 31, img.ncols]
+    y_bounds = [5, 6, 20, 38]
+    for image in (img, _image(PACKED)):
+        rows, cols = image.strip_projections(x_bounds, y_bounds)
+        assert len(rows) == 4 and len(cols) == 3
+        for i in range(4):
+            x, width = x_bounds[i], x_bounds[i + 1] - x_bounds[i]
+            if width == 0:
+                assert list(rows[i]) == [0] * img.nrows
+            else:
+                strip = image.subimage(Point(x, 0), Dim(width, img.nrows))
+                assert rows[i] == strip.projection_rows()
+        for i in range(3):
+            y, height = y_bounds[i], y_bounds[i + 1] - y_bounds[i]
+            strip = image.subimage(Point(0, y), Dim(img.ncols, height))
+            assert cols[i] == strip.projection_cols()
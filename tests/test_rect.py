@@ -1,3 +1,4 @@
+import py.test
 from gamera.core import *
 from math import sqrt
 
@@ -50,3 +51,24 @@ def test_rect():
    assert r1.distance_bb(Rect(Point(0,0), Point(20,20))) == sqrt(5*5 + 5*5)
    assert r1.distance_cx(Rect(Point(0,0), Point(20,20))) == 39
    assert r1.distance_cy(Rect(Point(0,0), Point(20,20))) == 34
+
+def test_region_map():
+   m = RegionMap()
+   py.test.raises(RuntimeError, m.lookup, Rect(Point(0, 0), Point(2, 2)))
+   for i in range(100):
+      region = Region(Point(10, 10 + i * 50), Point(989, 49 + i * 50))
+      region.add("scaling", float(i))
+      m.add_region(region)
+   # contained, on a page or in the gap between two regions
+   glyphs = [Rect(Point(100, 20 + i * 7), Point(110, 30 + i * 7))
+             for i in range(700)]
+   regions = m.lookup_list(glyphs)
+   assert len(regions) == len(glyphs)
+   for glyph, region in zip(glyphs, regions):
+      assert region.get("scaling") == m.lookup(glyph).get("scaling")
+      if region.contains_rect(glyph):
+         assert (glyph.ul_y - 10) // 50 == int(region.get("scaling"))
+   assert m.lookup(Rect(Point(100, 61), Point(110, 65))).get("scaling") == 1.0
+   # glyph below the last region, nearest region by its edge at x = 989
+   assert m.lookup(Rect(Point(980, 5100), Point(990, 5110))).get("scaling") == 99.0
+   py.test.raises(TypeError, m.lookup_list, [1])
@@ -0,0 +1,111 @@
+import py.test
+
+from gamera.core import *
+init_gamera()
+
+#
+# Tests for neighbor finding with rect indices
+#
+
+from gamera.rectindex import *
+
+def _rects():
+    # a row of small rects and one large rect overlapping some of them
+    rects = [Rect(Point(10*i, 0), Dim(5, 5)) for i in range(10)]
+    rects.append(Rect(Point(22, 2), Dim(20, 20)))
+    return rects
+
+def _names(rects, found):
+    return [rects.index(r) for r in found]
+
+#
+# input parameter check
+#
+def test_wrongparams():
+    py.test.raises(Exception, RectTree, None)
+    py.test.raises(Exception, RectTree, [Rect(Point(0,0), Dim(1,1)), 1])
+    py.test.raises(Exception, RectTree, [Rect(Point(0,0), Dim(1,1))], 1)
+    r = Rect(Point(0,0), Dim(1,1))
+    py.test.raises(Exception, RectGrid, [r, r])
+    grid = RectGrid([r])
+    py.test.raises(Exception, grid.add, r)
+    py.test.raises(Exception, grid.remove, Rect(Point(0,0), Dim(1,1)))
+    py.test.raises(Exception, grid.k_nearest, r, -1)
+
+#
+# the searches give the same result on both indices
+#
+def test_searches():
+    rects = _rects()
+    query = Rect(Point(31, 1), Dim(3, 3))
+    for index in (RectTree(rects), RectTree(rects, 2),
+                  RectGrid(rects), RectGrid(rects, 3)):
+        assert [3, 10] == _names(rects, index.intersecting(query))
+        assert [3, 10] == _names(rects, index.within_distance(query, 6))
+        assert [2, 3, 4, 10] == \
+            _names(rects, index.within_distance(query, 7.5))
+        assert [3, 10, 2, 4] == _names(rects, index.k_nearest(query, 4))
+        assert 11 == len(index.k_nearest(query, 20))
+        assert [] == index.intersecting(Rect(Point(200,200), Dim(5,5)))
+    # empty indices
+    assert [] == RectTree([]).k_nearest(query, 3)
+    assert [] == RectGrid([]).intersecting(query)
+
+#
+# a grid follows the changes of its objects
+#
+def test_grid_changes():
+    rects = _rects()
+    grid = RectGrid(rects)
+    query = Rect(Point(31, 1), Dim(3, 3))
+    grid.remove(rects[10])
+    assert [3] == _names(rects, grid.intersecting(query))
+    rects[0].union(query)
+    grid.update(rects[0])
+    assert [0, 3] == _names(rects, grid.intersecting(query))
+    far = Rect(Point(500, 500), Dim(10, 10))
+    grid.add(far)
+    assert [far] == grid.k_nearest(Rect(Point(600,600), Dim(1,1)), 1)
+
+#
+# the glyphs of connected components are returned
+#
+def test_ccs():
+    image = Image(Point(0,0), Dim(40,10), ONEBIT)
+    image.draw_filled_rect(Point(1,1), Point(5,5), 1)
+    image.draw_filled_rect(Point(8,1), Point(12,5), 1)
+    image.draw_filled_rect(Point(30,1), Point(35,5), 1)
+    ccs = image.cc_analysis()
+    ccs.sort(lambda a, b: cmp(a.ul_x, b.ul_x))
+    tree = RectTree(ccs)
+    found = tree.within_distance(ccs[0], 3)
+    assert 2 == len(found)
+    assert ccs[1].label in [c.label for c in found]
+
+#
+# sections and lines of a text page
+#
+def test_text_sections_and_lines():
+    glyphs = []
+    for x0 in (10, 300):
+        for y0 in (10, 30):
+            glyphs.extend([Rect(Point(x0 + 12*i, y0), Dim(8, 10)) for i in range(3)])
+    # a tall glyph and a noise speck
+    glyphs.append(Rect(Point(50, 10), Dim(8, 60)))
+    glyphs.append(Rect(Point(200, 200), Dim(2, 2)))
+    areas = [40.0] * 13 + [1.0]
+    page = Rect(Point(0, 0), Dim(400, 300))
+    sections = find_text_sections(glyphs, areas, 1, page)
+    assert sections[13] == -1
+    assert len(set(sections[:13])) == 2
+    assert [sections[0]] * 6 + [sections[6]] * 6 == sections[:12]
+    assert sections[12] == sections[0]
+    first = [i for i in range(len(glyphs)) if sections[i] == sections[0]]
+    lines, lost = find_text_lines([glyphs[i] for i in first])
+    assert [[0, 1, 2, 6], [3, 4, 5]] == lines
+    assert [] == lost
+    # when it is not set aside, the tall glyph joins the two lines
+    lines, lost = find_text_lines([glyphs[i] for i in first], 100)
+    assert [[0, 1, 2, 3, 4, 5, 6]] == [sorted(l) for l in lines]
+    py.test.raises(Exception, find_text_sections, glyphs, areas[1:], 1, page)
+    assert ([], []) == find_text_lines([])
@@ -31,3 +31,119 @@ def test_rle1():
    assert image1.most_frequent_run("black","horizontal") == image2.most_frequent_run("black","horizontal")
 
    
+
+def test_rle_set():
+   # Splitting and merging runs in the middle, at the ends and across
+   # chunk boundaries (a chunk is 256 pixels)
+   image1 = Image(Point(0, 0), Dim(600, 3), ONEBIT, DENSE)
+   image2 = Image(Point(0, 0), Dim(600, 3), ONEBIT, RLE)
+   points = [(10, 0), (11, 0), (12, 0), (11, 0), (255, 0), (256, 0),
+             (257, 0), (599, 0), (0, 1), (300, 1), (301, 1), (299, 1),
+             (300, 1), (598, 2), (597, 2), (599, 2)]
+   for i, (x, y) in enumerate(points):
+      value = (i % 5 != 3) and 1 or 0
+      image1.set(Point(x, y), value)
+      image2.set(Point(x, y), value)
+      assert image1._to_raw_string() == image2._to_raw_string()
+   for y in range(image1.nrows):
+      for x in range(image1.ncols):
+         assert image1.get(Point(x, y)) == image2.get(Point(x, y))
+   assert image1.to_rle() == image2.to_rle()
+
+def test_rle_random_access():
+   # Column order and scattered accesses search the runs from the
+   # run of the iterator, which must stay right while the runs change
+   image1 = load_image("data/testline.png")
+   image2 = load_image("data/testline.png", RLE)
+   for x in range(image1.ncols):
+      for y in range(image1.nrows):
+         assert image1.get(Point(x, y)) == image2.get(Point(x, y))
+   for i in range(2000):
+      x = (i * 7919) % image1.ncols
+      y = (i * 104729) % image1.nrows
+      value = (i % 3 == 0) and 1 or 0
+      image1.set(Point(x, y), value)
+      image2.set(Point(x, y), value)
+      for dx in (-1, 0, 1):
+         if 0 <= x + dx < image1.ncols:
+            assert image1.get(Point(x + dx, y)) == image2.get(Point(x + dx, y))
+   assert image1._to_raw_string() == image2._to_raw_string()
+
+def test_rle_runs():
+   # The run histograms and run filters of RLE images and RleCcs are
+   # computed from the runs, and must match those of dense images
+   image1 = load_image("data/testline.png")
+   image2 = load_image("data/testline.png", RLE)
+   for color in ("black", "white"):
+      for direction in ("horizontal", "vertical"):
+         assert image1.run_histogram(color, direction) == \
+                image2.run_histogram(color, direction)
+   ccs1 = image1.cc_analysis()
+   ccs2 = image2.cc_analysis()
+   for cc1, cc2 in zip(ccs1, ccs2)[:10]:
+      for direction in ("horizontal", "vertical"):
+         assert cc1.run_histogram("white", direction) == \
+                cc2.run_histogram("white", direction)
+   for filter in ("filter_narrow_runs", "filter_wide_runs",
+                  "filter_short_runs", "filter_tall_runs"):
+      for color in ("black", "white"):
+         copy1 = image1.image_copy()
+         copy2 = image2.image_copy(RLE)
+         getattr(copy1, filter)(3, color)
+         getattr(copy2, filter)(3, color)
+         assert copy1._to_raw_string() == copy2._to_raw_string()
+
+def test_rle_strings():
+   image1 = load_image("data/testline.png")
+   image2 = load_image("data/testline.png", RLE)
+   ccs = image1.cc_analysis()
+   # white runs come first, and a final white run is followed by an
+   # empty black run
+   small = Image(Point(0, 0), Dim(3, 2), ONEBIT, DENSE)
+   small.set(Point(1, 0), 1)
+   small.set(Point(2, 0), 1)
+   assert small.to_rle() == "1 2 3 0 "
+   small.from_rle("0 6 0 0")
+   assert small.black_area()[0] == 6
+   for runs in ("5", "7 0", "1 x 5"):
+      try:
+         small.from_rle(runs)
+      except RuntimeError:
+         pass
+      else:
+         assert False
+
+   # the list versions give the same strings, and decode unicode strings
+   glyphs = [image1, image2] + ccs
+   runs = glyphs_to_rle(glyphs)
+   assert runs == [glyph.to_rle() for glyph in glyphs]
+   copies = [Image(glyph.ul, glyph.dim, ONEBIT, (DENSE, RLE)[i % 2])
+             for i, glyph in enumerate(glyphs)]
+   glyphs_from_rle(copies, [unicode(x) for x in runs])
+   for glyph, copy in zip(glyphs, copies):
+      assert copy.to_rle() == glyph.to_rle()
+
+def test_rle_builders():
+   # thresholds, copies and decoders write RLE images run by run (and
+   # replace the old pixels of existing images); the runs must then be
+   # found as if every pixel had been set
+   image1 = load_image("data/testline.png")
+   grey = image1.to_greyscale()
+   for image2 in (grey.threshold(128, RLE), grey.otsu_threshold(RLE),
+                  image1.image_copy(RLE),
+                  image1.subimage(Point(0, 0), Dim(300, 40)).image_copy(RLE)):
+      dense = image2.image_copy()
+      assert image2._to_raw_string() == dense._to_raw_string()
+      for x, y in ((0, 0), (255, 1), (256, 10), (299, 39)):
+         image2.set((x, y), 1 - image2.get((x, y)))
+         dense.set((x, y), 1 - dense.get((x, y)))
+      assert image2._to_raw_string() == dense._to_raw_string()
+   image2 = load_image("data/testline.png", RLE)
+   image2.invert()
+   image2.from_rle(image1.to_rle())
+   assert image2._to_raw_string() == image1._to_raw_string()
+   # a view that does not cover its data keeps the pixels around it
+   part = image2.subimage(Point(100, 5), Dim(50, 20))
+   part.from_rle("0 1000")
+   assert image2.black_area()[0] == image1.black_area()[0] + \
+          1000 - image1.subimage(Point(100, 5), Dim(50, 20)).black_area()[0]
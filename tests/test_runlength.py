@@ -0,0 +1,82 @@
+from gamera.core import *
+init_gamera()
+
+import random
+
+def _page(storage_format):
+   image = Image((3, 5), Dim(131, 40), ONEBIT, storage_format)
+   random.seed(119)
+   for y in range(image.nrows):
+      for x in range(image.ncols):
+         if random.random() < 0.6:
+            image.set((x, y), 1)
+   return image
+
+def _black(image):
+   return [[image.get((x, y)) != 0 for x in range(image.ncols)]
+           for y in range(image.nrows)]
+
+def _filter_columns(rows, length, tall, color):
+   # the vertical runs of color, filtered column by column
+   rows = [list(row) for row in rows]
+   black = color == "black"
+   for x in range(len(rows[0])):
+      y = 0
+      while y < len(rows):
+         if rows[y][x] != black:
+            y += 1
+            continue
+         end = y
+         while end < len(rows) and rows[end][x] == black:
+            end += 1
+         if (tall and end - y > length) or (not tall and end - y < length):
+            for i in range(y, end):
+               rows[i][x] = not black
+         y = end
+   return rows
+
+# the vertical runs found row by row are those of the columns,
+# including the runs at the top and bottom of the image
+def test_filter_vertical_runs():
+   for storage_format in (DENSE, RLE):
+      for filter, tall in (("filter_tall_runs", True), ("filter_short_runs", False)):
+         for color in ("black", "white"):
+            for length in (1, 3, 7):
+               image = _page(storage_format)
+               expected = _filter_columns(_black(image), length, tall, color)
+               getattr(image, filter)(length, color)
+               assert _black(image) == expected
+               # only the pixels of a view are filtered
+               image = _page(storage_format)
+               before = _black(image)
+               view = image.subimage((10, 9), Dim(70, 30))
+               expected = _filter_columns(_black(view), length, tall, color)
+               getattr(view, filter)(length, color)
+               assert _black(view) == expected
+               after = _black(image)
+               for y in range(image.nrows):
+                  for x in range(image.ncols):
+                     if not (7 <= x < 77 and 4 <= y < 34):
+                        assert after[y][x] == before[y][x]
+
+# the black runs of a connected component leave the pixels of the
+# other components in its bounding box alone
+def test_filter_vertical_runs_cc():
+   for filter, tall in (("filter_tall_runs", True), ("filter_short_runs", False)):
+      image = _page(DENSE)
+      ccs = image.cc_analysis()
+      ccs.sort(key=lambda cc: cc.nrows * cc.ncols)
+      cc = ccs[-1]
+      x0, y0 = cc.offset_x - image.offset_x, cc.offset_y - image.offset_y
+      before = [[image.get((x, y)) for x in range(image.ncols)]
+                for y in range(image.nrows)]
+      expected = _filter_columns(_black(cc), 2, tall, "black")
+      getattr(cc, filter)(2, "black")
+      assert _black(cc) == expected
+      for y in range(image.nrows):
+         for x in range(image.ncols):
+            if before[y][x] != cc.label:
+               assert image.get((x, y)) == before[y][x]
+            else:
+               assert image.get((x, y)) in (0, cc.label)
+               assert (image.get((x, y)) != 0) == expected[y - y0][x - x0]
@@ -9,8 +9,7 @@ def test_save_image():
          image2 = load_image("tmp/%s_test.%s" % (name, ext))
          assert image._to_raw_string() == image2._to_raw_string()
 
-   # TODO: Add Grey16
-   for type in ["OneBit", "GreyScale", "RGB"]:
+   for type in ["OneBit", "GreyScale", "Grey16", "RGB"]:
       _test_save_image(type)
    _test_save_image("OneBit", RLE)
 
@@ -0,0 +1,220 @@
+from gamera.core import *
+init_gamera()
+
+def _compare_methods(image1):
+   image2 = image1.image_copy()
+   ccs1 = image1.cc_analysis(0)
+   ccs2 = image2.cc_analysis(1)
+   assert len(ccs1) == len(ccs2)
+   for a, b in zip(ccs1, ccs2):
+      assert a.label == b.label
+      assert a.ul == b.ul and a.lr == b.lr
+   # the labels written into the image are the same too
+   assert image1._to_raw_string() == image2._to_raw_string()
+   assert image1.color_ccs().to_string() == image2.color_ccs().to_string()
+   # and do not depend on the number of strips in parallel mode
+   for threads in (1, 2, 3, 7, 100):
+      image3 = image1.image_copy()
+      ccs3 = image3.cc_analysis(2, threads)
+      assert [(c.label, c.ul, c.lr) for c in ccs1] == \
+             [(c.label, c.ul, c.lr) for c in ccs3]
+      assert image1._to_raw_string() == image3._to_raw_string()
+
+def test_cc_analysis_methods():
+   for filename in ("data/testline.png", "data/OneBit_generic.png"):
+      image = load_image(filename)
+      _compare_methods(image)
+      # the run-based labeling gives the same labels on RLE images
+      rle = load_image(filename, RLE)
+      ccs1 = image.cc_analysis(0)
+      ccs2 = rle.cc_analysis(1)
+      assert [(c.ul, c.lr) for c in ccs1] == [(c.ul, c.lr) for c in ccs2]
+      assert image._to_raw_string() == rle._to_raw_string()
+      rle = load_image(filename, RLE)
+      ccs3 = rle.cc_analysis(2, 4)
+      assert [(c.ul, c.lr) for c in ccs1] == [(c.ul, c.lr) for c in ccs3]
+      assert image._to_raw_string() == rle._to_raw_string()
+
+def test_cc_analysis_runs_shapes():
+   # U-shapes, diagonal connections and runs ending at the image border
+   image = Image(Point(0, 0), Dim(12, 8), ONEBIT)
+   for x, y in [(0, 0), (0, 1), (0, 2), (1, 2), (2, 2), (2, 1), (2, 0),
+                (4, 0), (5, 1), (6, 0), (7, 1), (8, 2), (11, 3), (10, 4),
+                (11, 5), (3, 7), (4, 7), (5, 7), (11, 7)]:
+      image.set(Point(x, y), 1)
+   _compare_methods(image)
+   ccs = image.image_copy().cc_analysis(1)
+   assert len(ccs) == 5
+
+def test_cc_analysis_reanalyse():
+   # a labeled image can be labeled again
+   image = load_image("data/testline.png")
+   ccs1 = image.cc_analysis(0)
+   ccs2 = image.cc_analysis(1)
+   assert [(c.label, c.ul, c.lr) for c in ccs1] == \
+          [(c.label, c.ul, c.lr) for c in ccs2]
+
+def test_cc_analysis_many_labels():
+   # more components than OneBit labels: a frame around a grid of
+   # 301 * 301 isolated pixels
+   size = 605
+   image = Image(Point(0, 0), Dim(size, size), ONEBIT)
+   for i in range(size):
+      for p in ((i, 0), (i, size - 1), (0, i), (size - 1, i)):
+         image.set(Point(*p), 1)
+   for y in range(2, size - 2, 2):
+      for x in range(2, size - 2, 2):
+         image.set(Point(x, y), 1)
+   for method in (0, 1, 2):
+      copy = image.image_copy()
+      ccs = copy.cc_analysis(method, 3)
+      assert len(ccs) == 301 * 301 + 1
+      frame = ccs[0]
+      assert frame.ul == Point(0, 0) and frame.lr == Point(size - 1, size - 1)
+      assert frame.black_area()[0] == 4 * (size - 1)
+      labels = {}
+      for cc in ccs[1:]:
+         assert cc.nrows == 1 and cc.ncols == 1
+         assert cc.label != frame.label
+         assert 2 <= cc.label < 65535
+         labels[cc.label] = 1
+      assert len(labels) == 65532
+      # the first ccs keep the labels they get on smaller images
+      assert [cc.label for cc in ccs[:4]] == [2, 3, 4, 5]
+
+def _cc_signature(ccs):
+   return sorted([(c.ul_x, c.ul_y, c.lr_x, c.lr_y, c.black_area()[0])
+                  for c in ccs])
+
+def test_update_cc_analysis():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+   # nothing changed
+   removed, added = image.update_cc_analysis(ccs, Rect(Point(0, 0), Point(3, 3)))
+   assert removed == [] and added == []
+   edits = [(Rect(Point(20, 10), Point(60, 25)), 0),
+            (Rect(Point(5, 30), Point(200, 31)), 1),
+            (Rect(Point(100, 0), Point(101, image.lr_y)), 1),
+            (Rect(Point(100, 20), Point(101, 40)), 0)]
+   for rect, value in edits:
+      for y in range(rect.ul_y, rect.lr_y + 1):
+         for x in range(rect.ul_x, rect.lr_x + 1):
+            image.set(Point(x, y), value)
+      removed, added = image.update_cc_analysis(ccs, rect)
+      assert removed
+      ids = [id(c) for c in removed]
+      ccs = [c for c in ccs if id(c) not in ids] + added
+      expected = image.image_copy().cc_analysis()
+      assert _cc_signature(ccs) == _cc_signature(expected)
+      labels = [c.label for c in ccs]
+      assert len(labels) == len(dict.fromkeys(labels))
+      for c in ccs:
+         assert c.black_area()[0] > 0
+
+def test_split_pieces():
+   # the splits cover exactly the black pixels of the glyph
+   image = load_image("data/testline.png")
+   for cc in image.cc_analysis():
+      for split in ("splitx", "splity", "splitx_max"):
+         for center in ([0.5], [0.2, 0.6]):
+            parts = getattr(cc, split)(center)
+            assert sum([p.black_area()[0] for p in parts]) == cc.black_area()[0]
+            for p in parts:
+               assert cc.ul_x <= p.ul_x and p.lr_x <= cc.lr_x
+               assert cc.ul_y <= p.ul_y and p.lr_y <= cc.lr_y
+
+def test_split_glyphs():
+   image = load_image("data/testline.png")
+   ccs = image.cc_analysis()
+   for method, split in ((0, "splitx"), (1, "splity"), (2, "splitx_max")):
+      for center in ([0.5], [0.25, 0.75]):
+         for threads in (0, 1, 3):
+            splits = split_glyphs(ccs, method, center, threads)
+            assert len(splits) == len(ccs)
+            for cc, parts in zip(ccs, splits):
+               expected = getattr(cc, split)(center)
+               assert [(p.ul, p.lr) for p in parts] == \
+                      [(p.ul, p.lr) for p in expected]
+               for a, b in zip(parts, expected):
+                  assert a.to_rle() == b.to_rle()
+
+def test_projection_cutting_segment_bbox():
+   # the segment must include black pixels in its top row that lie
+   # right of all other black pixels
+   image = Image(Point(0, 0), Dim(12, 6), ONEBIT)
+   for p in [(0, 0), (9, 0), (0, 1), (0, 2), (0, 3), (0, 4), (0, 5)]:
+      image.set(Point(*p), 1)
+   ccs = image.projection_cutting(20, 3, 0, 0)
+   assert len(ccs) == 1
+   assert ccs[0].ul == Point(0, 0) and ccs[0].lr == Point(9, 5)
+   assert image.get(Point(9, 0)) == ccs[0].label
+
+def _segment_signature(ccs):
+   return [(c.ul, c.lr) for c in ccs]
+
+def test_projection_cutting_tree():
+   image = load_image("data/testline.png")
+   expected = image.image_copy()
+   ccs = expected.projection_cutting(5, 3, 0, 1)
+   tree = image.projection_cutting_tree(5, 3, 0, 1)
+   assert _segment_signature(tree.segments()) == _segment_signature(ccs)
+   assert image._to_raw_string() == expected._to_raw_string()
+   leaves = []
+   def walk(node):
+      if node.children:
+         for child in node.children:
+            walk(child)
+      else:
+         leaves.append((node.bbox.ul, node.bbox.lr))
+   walk(tree.root())
+   assert leaves == _segment_signature(ccs)
+   # removing a glyph and drawing a bar only cuts the changed regions anew
+   glyph = image.cc_analysis()[3]
+   edits = [(Rect(glyph.ul, glyph.lr), 0),
+            (Rect(Point(30, 2), Point(120, 3)), 1)]
+   for rect, value in edits:
+      for y in range(rect.ul_y, rect.lr_y + 1):
+         for x in range(rect.ul_x, rect.lr_x + 1):
+            if value == 0 or image.get(Point(x, y)) == 0:
+               image.set(Point(x, y), value)
+      tree.update(rect)
+      fresh = image.image_copy()
+      ccs = fresh.projection_cutting(5, 3, 0, 1)
+      assert _segment_signature(tree.segments()) == _segment_signature(ccs)
+      labels = dict([(c.label, c2.label) for c, c2 in zip(tree.segments(), ccs)])
+      for c in tree.segments():
+         for y in range(c.ul_y, c.lr_y + 1):
+            for x in range(c.ul_x, c.lr_x + 1):
+               p = image.get(Point(x, y))
+               q = fresh.get(Point(x, y))
+               assert (p == 0) == (q == 0)
+               if p in labels:
+                  assert labels[p] == q
+
+def test_cc_analysis_table():
+   from gamera.plugins.segmentation import filter_black_area_small, filter_tall
+   for storage in (DENSE, RLE, PACKED):
+      image1 = load_image("data/testline.png")
+      image2 = load_image("data/testline.png", storage)
+      ccs = image1.cc_analysis()
+      table = image2.cc_analysis_table(2, 3)
+      assert len(table) == len(ccs)
+      columns = table.columns()
+      assert columns["label"] == [c.label for c in ccs]
+      assert columns["ul_x"] == [c.ul_x for c in ccs]
+      assert columns["lr_y"] == [c.lr_y for c in ccs]
+      assert columns["black_area"] == [int(c.black_area()[0]) for c in ccs]
+      for c, x, y in zip(ccs, columns["center_x"], columns["center_y"]):
+         black = [(c.ul_x + i, c.ul_y + j) for j in range(c.nrows)
+                  for i in range(c.ncols) if c.get(Point(i, j))]
+         assert abs(sum([p[0] for p in black]) / float(len(black)) - x) < 1e-6
+         assert abs(sum([p[1] for p in black]) / float(len(black)) - y) < 1e-6
+      # the filters remove the same ccs and pixels as the list filters
+      ccs = filter_black_area_small(ccs, 10)
+      ccs = filter_tall(ccs, 20)
+      table.filter_black_area_small(10)
+      table.filter_tall(20)
+      survivors = table.ccs()
+      assert [(c.label, c.ul, c.lr) for c in survivors] == \
+             [(c.label, c.ul, c.lr) for c in ccs]
+      assert table.image._to_raw_string() == image1._to_raw_string()
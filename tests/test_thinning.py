@@ -0,0 +1,55 @@
+from gamera.core import *
+init_gamera()
+
+def neighborhood(pixels, x, y):
+    nrows, ncols = len(pixels), len(pixels[0])
+    xb = 1 if x == 0 else x - 1
+    xa = ncols - 2 if x == ncols - 1 else x + 1
+    yb = 1 if y == 0 else y - 1
+    ya = nrows - 2 if y == nrows - 1 else y + 1
+    return (pixels[yb][xb] << 7) | (pixels[y][xb] << 6) | (pixels[ya][xb] << 5) | \
+           (pixels[ya][x] << 4) | (pixels[ya][xa] << 3) | (pixels[y][xa] << 2) | \
+           (pixels[yb][xa] << 1) | pixels[yb][x]
+
+# Zhang and Suen, scanning every pixel in every subiteration
+def thin_zs_reference(pixels):
+    constants = ((21, 84), (69, 81))
+    t = 0
+    while True:
+        deleted = []
+        for y in range(len(pixels)):
+            for x in range(len(pixels[0])):
+                if not pixels[y][x]:
+                    continue
+                p = neighborhood(pixels, x, y)
+                bits = [(p >> i) & 1 for i in range(8)]
+                N = sum(bits)
+                S = len([i for i in range(8) if bits[i] and not bits[i - 1]])
+                a, b = constants[t]
+                if 2 <= N <= 6 and S == 1 and (p & a) != a and (p & b) != b:
+                    deleted.append((x, y))
+        if not deleted:
+            return
+        for (x, y) in deleted:
+            pixels[y][x] = 0
+        t = 1 - t
+
+def test_thin_zs():
+    img = load_image("data/OneBit_generic.png")
+    pixels = [[int(img.get((x, y)) != 0) for x in range(img.ncols)]
+              for y in range(img.nrows)]
+    thin_zs_reference(pixels)
+    thin = img.thin_zs()
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            assert thin.get((x, y)) == pixels[y][x]
+
+# the skeletons lie in the image, and thin_hs stops when it deletes nothing
+def test_thin_hs_lc():
+    img = load_image("data/OneBit_generic.png")
+    for thin in (img.thin_hs(), img.thin_lc()):
+        assert thin.nrows == img.nrows and thin.ncols == img.ncols
+        assert thin.black_area()[0] < img.black_area()[0]
+        assert thin.and_image(img).to_string() == thin.to_string()
+    thin = img.thin_hs()
+    assert thin.thin_hs().to_string() == thin.to_string()
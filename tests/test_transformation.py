@@ -0,0 +1,57 @@
+from gamera.core import *
+init_gamera()
+
+# rotations by multiples of 90 degrees only move the pixels
+def test_rotate_quarters():
+    img = load_image("data/GreyScale_generic.png")
+    ncols, nrows = img.ncols, img.nrows
+    for order in (0, 1, 3):
+        turned = img.rotate(90.0, None, order)
+        assert turned.ncols == nrows and turned.nrows == ncols
+        for (x, y) in ((0, 0), (ncols - 1, 0), (3, nrows - 1), (ncols / 2, nrows / 3)):
+            assert turned.get((nrows - 1 - y, x)) == img.get((x, y))
+        assert img.rotate(180.0, None, order).rotate(180.0, None, order).to_string() == \
+               img.to_string()
+        assert img.rotate(270.0, None, order).to_string() == \
+               img.rotate(-90.0, None, order).to_string()
+
+# the shear rotation (order 0) keeps every black pixel
+def test_rotate_shears():
+    img = load_image("data/OneBit_generic.png")
+    for angle in (0.5, -3.0, 30.0, 100.0, 200.0):
+        rotated = img.rotate(angle, None, 0)
+        assert rotated.black_area()[0] == img.black_area()[0]
+
+# the pixels of downscale_area are the means of their blocks
+def test_downscale_area():
+    img = load_image("data/OneBit_generic.png")
+    small = img.downscale_area(5)
+    assert small.data.pixel_type == GREYSCALE
+    assert small.ncols == (img.ncols + 4) / 5
+    assert small.nrows == (img.nrows + 4) / 5
+    for (bx, by) in ((0, 0), (small.ncols - 1, small.nrows - 1), (7, 3)):
+        black = 0
+        n = 0
+        for y in range(by * 5, min(by * 5 + 5, img.nrows)):
+            for x in range(bx * 5, min(bx * 5 + 5, img.ncols)):
+                black += img.get((x, y))
+                n += 1
+        assert small.get((bx, by)) == int(255.0 - 255.0 * black / n + 0.5)
+
+# every level of the pyramid is averaged from the image
+def test_image_pyramid():
+    img = load_image("data/GreyScale_generic.png")
+    pyramid = img.image_pyramid(3)
+    assert len(pyramid) == 3
+    for level, factor in zip(pyramid, (2, 4, 8)):
+        assert level.to_string() == img.downscale_area(factor).to_string()
+
+# the _many variant of a plugin returns the list of its results
+def test_plugin_many():
+    from gamera.plugins import transformation
+    image = load_image("data/OneBit_generic.png")
+    ccs = image.cc_analysis()
+    small = transformation.downscale_area.many(ccs, 3, 2)
+    assert len(small) == len(ccs)
+    for cc, s in zip(ccs, small):
+        assert s.to_string() == cc.downscale_area(3).to_string()
@@ -51,6 +51,55 @@ def test_voronoi_cell_labeling():
     assert [2,3] in labelpairs or [3,2] in labelpairs
     assert [4,3] in labelpairs or [3,4] in labelpairs
 
+# every pixel must get the label of a closest labeled pixel
+def test_voronoi_exact_nearest_label():
+    import random
+    random.seed(3)
+    img = Image((0,0),(39,29))
+    for label in range(2, 9):
+        x, y = random.randrange(img.ncols), random.randrange(img.nrows)
+        for dx in range(3):
+            if x + dx < img.ncols:
+                img.set((x + dx, y), label)
+    seeds = [(x, y, img.get((x, y))) for y in range(img.nrows)
+             for x in range(img.ncols) if img.get((x, y))]
+    voronoi = img.voronoi_from_labeled_image(threads=1)
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            dists = {}
+            for sx, sy, label in seeds:
+                d = (sx - x) ** 2 + (sy - y) ** 2
+                dists[label] = min(d, dists.get(label, d))
+            assert dists[voronoi.get((x, y))] == min(dists.values())
+    for threads in (0, 2, 3):
+        other = img.voronoi_from_labeled_image(threads=threads)
+        assert other.to_string() == voronoi.to_string()
+
+# every white pixel must get the label of a closest point, also with
+# points outside of the image and on the same pixel
+def test_voronoi_from_points_exact():
+    import random
+    random.seed(5)
+    img = Image((0,0),(39,29),GREYSCALE)
+    img.fill(0)
+    img.set((3,4), 200)
+    points = [(random.randrange(50), random.randrange(35)) for i in range(12)]
+    points.append(points[0])
+    labels = range(2, 2 + len(points))
+    voronoi = Image(img)
+    voronoi.voronoi_from_points(points, labels, threads=1)
+    assert voronoi.get((3,4)) == 200
+    for y in range(img.nrows):
+        for x in range(img.ncols):
+            if (x, y) == (3, 4):
+                continue
+            dists = [(sx - x) ** 2 + (sy - y) ** 2 for sx, sy in points]
+            assert dists[labels.index(voronoi.get((x, y)))] == min(dists)
+    for threads in (0, 2, 3):
+        other = Image(img)
+        other.voronoi_from_points(points, labels, threads=threads)
+        assert other.to_string() == voronoi.to_string()
+
 #
 # delaunay triangulation
 #
@@ -87,3 +136,11 @@ def test_delaunay_triangulation():
     assert [2, 3] in edges
     assert [2, 4] in edges
     assert [3, 4] in edges
+    # grid points are highly degenerate (four points on each circle)
+    points = [(x*10,y*10) for x in range(20) for y in range(20)]
+    edges = delaunay_from_points(points,range(len(points)))
+    # Euler formula for a triangulation with 76 points on the convex hull
+    assert len(edges) == 3*len(points) - 3 - 76
+    for a,b in edges:
+        (xa,ya),(xb,yb) = points[a],points[b]
+        assert abs(xa-xb) <= 10 and abs(ya-yb) <= 10
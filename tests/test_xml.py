@@ -4,6 +4,7 @@ from gamera.core import *
 init_gamera()
 
 from gamera import gamera_xml
+from gamera.plugins import runlength
 
 features = ['aspect_ratio', 'moments', 'volume64regions']
 
@@ -46,6 +47,49 @@ def test_glyphs_from_xml():
    glyphs = gamera_xml.glyphs_from_xml("data/testline.xml")
    assert len(glyphs) == 66
       
+def test_glyphs_from_xml_decoded_lazily():
+   before = memory_usage()['total']
+   glyphs = gamera_xml.glyphs_from_xml("data/testline.xml")
+   assert memory_usage()['total'] == before
+   # the pixels are decoded by their first use
+   for glyph in glyphs:
+      assert glyph.black_area()[0] > 0
+   assert memory_usage()['total'] > before
+
+def test_glyphs_from_xml_expat():
+   # the same glyphs from a file that is left to expat
+   data = open("data/testline.xml").read()
+   glyphs = gamera_xml.LoadXML().parse_string(data).glyphs
+   expat_glyphs = gamera_xml.LoadXML().parse_string(
+      data.replace("<glyphs>", "<glyphs><!-- expat -->")).glyphs
+   assert len(glyphs) == len(expat_glyphs) == 66
+   for a, b in zip(glyphs, expat_glyphs):
+      assert a.ul == b.ul and a.dim == b.dim
+      assert a.id_name == b.id_name
+      assert a.classification_state == b.classification_state
+      assert a.to_rle() == b.to_rle()
+
+def test_glyphs_from_xml_packed():
+   glyphs = gamera_xml.glyphs_from_xml("data/testline.xml")
+   packed = gamera_xml.glyphs_from_xml("data/testline.xml", storage_format=PACKED)
+   # documents left to expat give PACKED glyphs of their own
+   data = open("data/testline.xml").read()
+   expat_packed = gamera_xml.LoadXML(storage_format=PACKED).parse_string(
+      data.replace("<glyphs>", "<glyphs><!-- expat -->")).glyphs
+   assert len(glyphs) == len(packed) == len(expat_packed) == 66
+   for a, b, c in zip(glyphs, packed, expat_packed):
+      assert b.data.storage_format == c.data.storage_format == PACKED
+      assert a.ul == b.ul == c.ul and a.dim == b.dim == c.dim
+      assert a.id_name == b.id_name
+      assert a.classification_state == b.classification_state
+      assert a.to_rle() == b.to_rle() == c.to_rle()
+   # the pixels outlive most of the glyphs sharing their memory
+   last = packed[-1]
+   rle = last.to_rle()
+   del packed[:-1]
+   assert last.to_rle() == rle
+   assert runlength.glyphs_to_rle([last]) == [rle]
+
 def test_glyphs_with_features_from_xml():
    glyphs = gamera_xml.glyphs_with_features_from_xml(
       "data/testline.xml", ["area", "aspect_ratio"])